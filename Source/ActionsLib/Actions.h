@@ -24,6 +24,10 @@ template <typename ElemType>
 void DoAdapt(const ConfigParameters& config);
 template <typename ElemType>
 void DoEdit(const ConfigParameters& config);
+template <typename ElemType>
+void DoBenchmarkAggregation(const ConfigParameters& config);
+template <typename ElemType>
+void DoPlanMemory(const ConfigParameters& config);
 
 // evaluation (EvalActions.cpp)
 template <typename ElemType>
@@ -32,6 +36,7 @@ template <typename ElemType>
 void DoCrossValidate(const ConfigParameters& config);
 template <typename ElemType>
 void DoWriteOutput(const ConfigParameters& config);
+void ClearActionCache(); // release the networks and readers shared by eval, cv, and write
 
 // misc (OtherActions.cp)
 template <typename ElemType>
@@ -42,6 +47,10 @@ template <typename ElemType>
 void DoWriteWordAndClassInfo(const ConfigParameters& config);
 template <typename ElemType>
 void DoTopologyPlot(const ConfigParameters& config);
+template <typename ElemType>
+void DoBenchmarkReader(const ConfigParameters& config);
+template <typename ElemType>
+void DoServeData(const ConfigParameters& config);
 
 // special purpose (EsotericActions.cp)
 template <typename ElemType>
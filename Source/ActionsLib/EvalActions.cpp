@@ -29,6 +29,8 @@
 #include <queue>
 #include <set>
 #include <memory>
+#include <map>
+#include <sys/stat.h>
 
 #ifndef let
 #define let const auto
@@ -38,6 +40,103 @@ using namespace std;
 using namespace Microsoft::MSR;
 using namespace Microsoft::MSR::CNTK;
 
+// ===========================================================================
+// ActionCache - networks and readers shared by the eval actions of one run
+// A config like command=train:test:write would otherwise load the same model once per action, and re-create a reader
+// (re-parsing its scp files and MLFs) for every action with the same reader config. Instead, the actions that only
+// evaluate a model (eval, write) take it from here, and eval, cv, and write take their readers from here.
+// A network is keyed by path and device, and reloaded if the file has changed since; its compiled eval orders are
+// kept with it. It is not shared if node values may share matrices (shareNodeValueMatrices), as the memory of such
+// a network is planned for one set of outputs only.
+// A reader is keyed by the full text of its config, and starts a new pass whenever it is reused, like the reader of
+// DoCrossValidate() does for each model. Set shareAcrossActions=false for a command to load everything afresh.
+// ClearActionCache() empties the cache before a command that changes models (train, adapt, edit), and at the end of the run.
+// ===========================================================================
+
+template <typename ElemType>
+class ActionCache
+{
+    struct FileStamp
+    {
+        int64_t size;
+        int64_t modificationTime;
+        bool operator==(const FileStamp& other) const { return size == other.size && modificationTime == other.modificationTime; }
+    };
+    static FileStamp GetFileStamp(const wstring& path)
+    {
+#ifdef _WIN32
+        struct _stat64 fileinfo;
+        if (_wstat64(path.c_str(), &fileinfo) != 0)
+#else
+        struct stat fileinfo;
+        if (stat(msra::strfun::utf8(path).c_str(), &fileinfo) != 0)
+#endif
+            RuntimeError("ActionCache: Cannot access model file '%ls'.", path.c_str());
+        return FileStamp{(int64_t) fileinfo.st_size, (int64_t) fileinfo.st_mtime};
+    }
+
+    struct CachedNetwork
+    {
+        ComputationNetworkPtr net;
+        FileStamp stamp;
+    };
+    static map<pair<wstring, DEVICEID_TYPE>, CachedNetwork>& Networks()
+    {
+        static map<pair<wstring, DEVICEID_TYPE>, CachedNetwork> networks;
+        return networks;
+    }
+    static map<string, shared_ptr<DataReader<ElemType>>>& Readers()
+    {
+        static map<string, shared_ptr<DataReader<ElemType>>> readers;
+        return readers;
+    }
+
+public:
+    static ComputationNetworkPtr GetNetwork(const ConfigParameters& config, DEVICEID_TYPE deviceId, const wstring& modelPath)
+    {
+        if (!config(L"shareAcrossActions", true) || g_shareNodeValueMatrices)
+            return ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath);
+        let stamp = GetFileStamp(modelPath);
+        auto& entry = Networks()[make_pair(modelPath, deviceId)];
+        if (entry.net && entry.stamp == stamp)
+        {
+            fprintf(stderr, "Reusing model %ls loaded by an earlier command.\n", modelPath.c_str());
+            return entry.net;
+        }
+        entry.net = nullptr; // release the outdated one first
+        entry.net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath);
+        entry.stamp = stamp;
+        return entry.net;
+    }
+
+    static shared_ptr<DataReader<ElemType>> GetReader(const ConfigParameters& config, const ConfigParameters& readerConfig)
+    {
+        if (!config(L"shareAcrossActions", true))
+            return make_shared<DataReader<ElemType>>(readerConfig);
+        string key; // the config as name=value lines, in the (case-insensitive) order of the names
+        for (const auto& iter : readerConfig)
+            key += iter.first + "=" + iter.second + "\n";
+        auto& reader = Readers()[key];
+        if (reader)
+            fprintf(stderr, "Reusing the reader of an earlier command.\n");
+        else
+            reader = make_shared<DataReader<ElemType>>(readerConfig);
+        return reader;
+    }
+
+    static void Clear()
+    {
+        Networks().clear();
+        Readers().clear();
+    }
+};
+
+void ClearActionCache()
+{
+    ActionCache<float>::Clear();
+    ActionCache<double>::Clear();
+}
+
 // ===========================================================================
 // DoEvalBase() - implements CNTK "eval" command
 // ===========================================================================
@@ -65,9 +164,10 @@ static void DoEvalBase(const ConfigParameters& config, IDataReader<ElemType>& re
         evalNodeNamesVector.push_back(evalNodeNames[i]);
     }
 
-    auto net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath);
+    auto net = ActionCache<ElemType>::GetNetwork(config, deviceId, modelPath);
 
-    SimpleEvaluator<ElemType> eval(net, numMBsToShowResult, traceLevel);
+    // when run with MPI, the ranks share the work
+    SimpleEvaluator<ElemType> eval(net, numMBsToShowResult, traceLevel, true /*parallel*/, config(L"distributedMBReading", false));
     eval.Evaluate(&reader, evalNodeNamesVector, mbSize[0], epochSize);
 }
 
@@ -78,9 +178,9 @@ void DoEval(const ConfigParameters& config)
     ConfigParameters readerConfig(config(L"reader"));
     readerConfig.Insert("traceLevel", config(L"traceLevel", "0"));
 
-    DataReader<ElemType> testDataReader(readerConfig);
+    auto testDataReader = ActionCache<ElemType>::GetReader(config, readerConfig);
 
-    DoEvalBase(config, testDataReader);
+    DoEvalBase(config, *testDataReader);
 }
 
 template void DoEval<double>(const ConfigParameters& config);
@@ -125,7 +225,7 @@ void DoCrossValidate(const ConfigParameters& config)
     std::vector<std::vector<double>> cvErrorResults;
     std::vector<std::wstring> cvModels;
 
-    DataReader<ElemType> cvDataReader(readerConfig);
+    auto cvDataReader = ActionCache<ElemType>::GetReader(config, readerConfig);
 
     bool finalModelEvaluated = false;
     for (size_t i = cvInterval[0]; i <= cvInterval[2]; i += cvInterval[1])
@@ -147,10 +247,10 @@ void DoCrossValidate(const ConfigParameters& config)
         cvModels.push_back(cvModelPath);
         auto net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, cvModelPath);
 
-        SimpleEvaluator<ElemType> eval(net, numMBsToShowResult, traceLevel);
+        SimpleEvaluator<ElemType> eval(net, numMBsToShowResult, traceLevel, true /*parallel*/, config(L"distributedMBReading", false));
 
         fprintf(stderr, "model %ls --> \n", cvModelPath.c_str());
-        auto evalErrors = eval.Evaluate(&cvDataReader, evalNodeNamesVector, mbSize[0], epochSize);
+        auto evalErrors = eval.Evaluate(cvDataReader.get(), evalNodeNamesVector, mbSize[0], epochSize);
         cvErrorResults.push_back(evalErrors);
 
         ::Sleep(1000 * sleepSecondsBetweenRuns);
@@ -206,7 +306,7 @@ void DoWriteOutput(const ConfigParameters& config)
     readerConfig.Insert("traceLevel", config(L"traceLevel", "0"));
     readerConfig.Insert("randomize", "None"); // we don't want randomization when output results
 
-    DataReader<ElemType> testDataReader(readerConfig);
+    auto testDataReader = ActionCache<ElemType>::GetReader(config, readerConfig);
 
     DEVICEID_TYPE deviceId = DeviceFromConfig(config);
     ConfigArray minibatchSize = config(L"minibatchSize", "2048");
@@ -226,7 +326,7 @@ void DoWriteOutput(const ConfigParameters& config)
         outputNodeNamesVector.push_back(outputNodeNames[i]);
     }
 
-    auto net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath);
+    auto net = ActionCache<ElemType>::GetNetwork(config, deviceId, modelPath);
 
     SimpleOutputWriter<ElemType> writer(net, 1);
 
@@ -235,12 +335,29 @@ void DoWriteOutput(const ConfigParameters& config)
         ConfigParameters writerConfig(config(L"writer"));
         bool bWriterUnittest = writerConfig(L"unittest", "false");
         DataWriter<ElemType> testDataWriter(writerConfig);
-        writer.WriteOutput(testDataReader, mbSize[0], testDataWriter, outputNodeNamesVector, epochSize, bWriterUnittest);
+        // pipelined: read, evaluate and write concurrently, optionally with several copies of the model evaluating in parallel
+        // (on the same device, since a process only uses one GPU; most useful on the CPU with numCPUThreads=1)
+        const size_t numEvaluators = config(L"numEvaluators", (size_t) 1);
+        if ((config(L"pipelined", false) || numEvaluators > 1) && !bWriterUnittest)
+        {
+            vector<ComputationNetworkPtr> replicas;
+            for (size_t i = 1; i < numEvaluators; ++i)
+                replicas.push_back(ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath));
+            writer.WriteOutputPipelined(*testDataReader, mbSize[0], testDataWriter, outputNodeNamesVector, replicas, config(L"pipelineDepth", (size_t) 4), epochSize);
+        }
+        else
+            writer.WriteOutput(*testDataReader, mbSize[0], testDataWriter, outputNodeNamesVector, epochSize, bWriterUnittest);
     }
     else if (config.Exists("outputPath"))
     {
         wstring outputPath = config(L"outputPath"); // crashes if no default given?
-        writer.WriteOutput(testDataReader, mbSize[0], outputPath, outputNodeNamesVector, epochSize);
+        // outputFormat=archive writes binary FeatureArchives instead of text, with archiveEncoding=float16 (default), uint8, or float32
+        const wstring outputFormat = config(L"outputFormat", L"text");
+        if (outputFormat != L"text" && outputFormat != L"archive")
+            InvalidArgument("outputFormat must be 'text' or 'archive', not '%ls'.", outputFormat.c_str());
+        const auto archiveEncoding = FeatureArchive::ParseEncoding(config(L"archiveEncoding", L"float16"));
+        writer.WriteOutput(*testDataReader, mbSize[0], outputPath, outputNodeNamesVector, epochSize,
+                           outputFormat == L"archive" ? &archiveEncoding : nullptr, config(L"archiveChunkFrames", (size_t) 65536));
     }
     // writer.WriteOutput(testDataReader, mbSize[0], testDataWriter, outputNodeNamesVector, epochSize);
 }
@@ -15,6 +15,9 @@
 #include "Config.h"
 #include "ScriptableObjects.h"
 #include "BrainScriptEvaluator.h"
+#include "DataReader.h"
+#include "TimerUtility.h"
+#include "DataServer.h"
 
 #include <string>
 #include <chrono>
@@ -24,6 +27,13 @@
 #include <queue>
 #include <set>
 #include <memory>
+#include <thread>
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
 
 #ifndef let
 #define let const auto
@@ -134,7 +144,7 @@ template void DoCreateLabelMap<double>(const ConfigParameters& config);
 //          user need to specify:
 //                  1)  modelPath           -- path to the existing model
 //                  2)  outputmodelPath     -- where to write the transformed model
-//                  3)  KeepRatio           -- how many percentage of energy we want to keep
+//                  3)  KeepRatio           -- how many percentage of energy we want to keep (a value > 1 is the rank to keep instead)
 //                  4)  AlignedSize         -- the resultant number of signular values is aligned to e.g., 32 or 64
 //                  5)  ParameterName       -- name (regex) of the parameter node we want to perform a SVD decomposition
 //
@@ -164,6 +174,7 @@ void SVDConfigFileUsage()
     fprintf(stderr, "An example: \n");
     fprintf(stderr, "W0         1.0\n");
     fprintf(stderr, "W[1-5]     0.4\n");
+    fprintf(stderr, "W6         256   (a value > 1 is the number of singular values to keep)\n");
 }
 template <typename ElemType>
 void DoParameterSVD(const ConfigParameters& config)
@@ -512,3 +523,251 @@ void DoTopologyPlot(const ConfigParameters& config)
 
 template void DoTopologyPlot<float>(const ConfigParameters& config);
 template void DoTopologyPlot<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoBenchmarkReader() - implements CNTK "benchmarkReader" command
+// Drives the reader alone through StartMinibatchLoop()/GetMinibatch(), without a network, to tell whether
+// training is bound by I/O or by compute. Optionally sweeps a reader parameter, e.g. its number of threads.
+// ===========================================================================
+
+// peak resident memory of the process so far, in bytes
+static size_t GetPeakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (size_t) usage.ru_maxrss * 1024; // (in KB on Linux)
+#endif
+}
+
+template <typename ElemType>
+static void BenchmarkReaderOnce(const ConfigParameters& readerConfig, const std::string& sweepDescription,
+                                DEVICEID_TYPE deviceId, size_t minibatchSize, size_t epochSize, size_t maxMinibatches)
+{
+    std::vector<std::wstring> featureNames;
+    std::vector<std::wstring> labelNames;
+    GetFileConfigNames(readerConfig, featureNames, labelNames);
+    std::vector<std::wstring> inputNames(featureNames);
+    inputNames.insert(inputNames.end(), labelNames.begin(), labelNames.end());
+    if (inputNames.empty())
+        RuntimeError("BenchmarkReader: The reader defines no inputs.");
+
+    std::vector<std::unique_ptr<Matrix<ElemType>>> inputs;
+    std::map<std::wstring, Matrix<ElemType>*> matrices;
+    for (const auto& name : inputNames)
+    {
+        inputs.push_back(std::unique_ptr<Matrix<ElemType>>(new Matrix<ElemType>(deviceId)));
+        matrices[name] = inputs.back().get();
+    }
+
+    Timer timer;
+    timer.Start();
+    DataReader<ElemType> dataReader(readerConfig);
+    timer.Stop();
+    const double setupSeconds = timer.ElapsedSeconds();
+
+    Timer totalTimer;
+    totalTimer.Start();
+    dataReader.StartMinibatchLoop(minibatchSize, 0, epochSize);
+    std::vector<double> latencies; // per minibatch, in seconds
+    size_t numSamples = 0;
+    double numBytes = 0;
+    for (;;)
+    {
+        if (maxMinibatches > 0 && latencies.size() >= maxMinibatches)
+            break;
+        timer.Restart();
+        const bool moreData = dataReader.GetMinibatch(matrices);
+        timer.Stop();
+        if (!moreData)
+            break;
+        latencies.push_back(timer.ElapsedSeconds());
+        numSamples += matrices[inputNames[0]]->GetNumCols();
+        for (const auto& input : inputs) // what the minibatch occupies in memory, as a measure of bandwidth
+        {
+            if (input->GetMatrixType() == MatrixType::SPARSE)
+                numBytes += (double) input->NzCount() * (sizeof(ElemType) + sizeof(CPUSPARSE_INDEX_TYPE));
+            else
+                numBytes += (double) input->GetNumElements() * sizeof(ElemType);
+        }
+    }
+    totalTimer.Stop();
+    const double seconds = totalTimer.ElapsedSeconds();
+
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p)
+    {
+        return sorted.empty() ? 0.0 : 1000 * sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+    };
+    fprintf(stderr, "BenchmarkReader%s: %d minibatches, %d samples in %.3f seconds (%.3f seconds to open the reader)\n",
+            sweepDescription.c_str(), (int) latencies.size(), (int) numSamples, seconds, setupSeconds);
+    fprintf(stderr, "\tsamples/sec = %.1f; MB/s = %.2f; latency ms: p50 = %.3f, p90 = %.3f, p99 = %.3f, max = %.3f; peak memory = %.1f MB\n",
+            seconds > 0 ? numSamples / seconds : 0.0, seconds > 0 ? numBytes / seconds / 1e6 : 0.0,
+            percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0), GetPeakResidentBytes() / 1e6);
+}
+
+template <typename ElemType>
+void DoBenchmarkReader(const ConfigParameters& config)
+{
+    ConfigParameters readerConfig(config(L"reader"));
+    const DEVICEID_TYPE deviceId = config(L"deviceId", (int) CPUDEVICE); // where the minibatches go, to include the copy to the GPU
+    const size_t minibatchSize = config(L"minibatchSize", (size_t) 256);
+    const size_t epochSize = config(L"epochSize", (size_t) requestDataSize);
+    const size_t maxMinibatches = config(L"numMinibatches", (size_t) 0); // 0 means a whole epoch
+    // the sweep: for each of the values (separated by ':'), the reader is opened anew with its parameter sweepParameter set to it
+    const std::string sweepParameter = config(L"sweepParameter", "");
+    ConfigArray sweepValues = config(L"sweepValues", "");
+
+    if (sweepParameter.empty() || sweepValues.empty())
+    {
+        BenchmarkReaderOnce<ElemType>(readerConfig, "", deviceId, minibatchSize, epochSize, maxMinibatches);
+        return;
+    }
+    for (size_t i = 0; i < sweepValues.size(); i++)
+    {
+        const std::string value = sweepValues[i];
+        ConfigParameters sweepConfig(readerConfig);
+        sweepConfig.Insert(sweepParameter, value);
+        BenchmarkReaderOnce<ElemType>(sweepConfig, " (" + sweepParameter + " = " + value + ")", deviceId, minibatchSize, epochSize, maxMinibatches);
+    }
+}
+
+template void DoBenchmarkReader<float>(const ConfigParameters& config);
+template void DoBenchmarkReader<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoServeData() - implements CNTK "serveData" command
+// Runs the reader of this command for trainers elsewhere, which read with RemoteReader (servers=thisHost:port); see DataServer.h.
+// Each connection gets a reader of its own, on a thread of its own, for the subset of its worker; so the readers of one server run
+// concurrently. Options: port, numConnections (serve this many, then exit; default 0, until killed), traceLevel.
+// ===========================================================================
+
+// one client: its StartEpoch requests, and its minibatches as far as it has granted credits
+template <typename ElemType>
+static void ServeDataConnection(std::shared_ptr<DataSocket> socket, const ConfigParameters& readerConfig, int traceLevel)
+{
+    uint64_t generation = 0;
+    try
+    {
+        std::unique_ptr<DataReader<ElemType>> reader; // created on the first request, kept for the following epochs
+        std::vector<std::shared_ptr<Matrix<ElemType>>> inputs;
+        std::map<std::wstring, Matrix<ElemType>*> matrices;
+        MBLayoutPtr pMBLayout = make_shared<MBLayout>();
+        bool inEpoch = false;
+        uint64_t credits = 0;
+        size_t numMinibatches = 0;
+        std::vector<char> payload;
+        for (;;)
+        {
+            // read ahead while the client lets us, but look at its requests first
+            if (inEpoch && credits > 0 && !socket->HasData())
+            {
+                DataMessage message;
+                if (reader->GetMinibatch(matrices))
+                {
+                    reader->CopyMBLayoutTo(pMBLayout);
+                    PackDataServerMinibatch(message, matrices, *pMBLayout);
+                    message.Send(*socket, DataServerMinibatch, generation);
+                    credits--;
+                    numMinibatches++;
+                }
+                else
+                {
+                    message.Send(*socket, DataServerEndOfEpoch, generation);
+                    inEpoch = false;
+                    if (traceLevel > 0)
+                        fprintf(stderr, "ServeData: Sent %d minibatches to %s.\n", (int) numMinibatches, socket->GetPeer().c_str());
+                }
+                continue;
+            }
+
+            uint64_t tag;
+            if (!socket->ReceiveMessageOrEnd(tag, generation, payload))
+                break; // the client is done
+            DataMessageReader message(payload);
+            if (tag == DataServerCredit)
+                credits += message.Get();
+            else if (tag == DataServerStartEpoch)
+            {
+                const size_t mbSize = (size_t) message.Get();
+                const size_t epoch = (size_t) message.Get();
+                const size_t subsetNum = (size_t) message.Get();
+                const size_t numSubsets = (size_t) message.Get();
+                const size_t requestedEpochSamples = (size_t) message.Get();
+                credits = message.Get();
+                if (message.Get() != sizeof(ElemType))
+                    InvalidArgument("ServeData: The client does not have the precision of the server (%d bytes).", (int) sizeof(ElemType));
+                const size_t numInputs = (size_t) message.Get();
+                inputs.clear();
+                matrices.clear();
+                for (size_t i = 0; i < numInputs; i++)
+                {
+                    const std::wstring name = msra::strfun::utf16(message.GetString());
+                    const bool isSparse = message.Get() != 0;
+                    inputs.push_back(make_shared<Matrix<ElemType>>(0, 0, CPUDEVICE, isSparse ? SPARSE : DENSE, isSparse ? matrixFormatSparseCSC : matrixFormatDense));
+                    matrices[name] = inputs.back().get();
+                }
+
+                if (!reader)
+                    reader.reset(new DataReader<ElemType>(readerConfig));
+                if (numSubsets > 1 && !reader->SupportsDistributedMBRead())
+                    InvalidArgument("ServeData: The reader does not support distributed reading, which worker %d of %d asks for.", (int) subsetNum, (int) numSubsets);
+                if (reader->SupportsDistributedMBRead())
+                    reader->StartDistributedMinibatchLoop(mbSize, epoch, subsetNum, numSubsets, requestedEpochSamples);
+                else
+                    reader->StartMinibatchLoop(mbSize, epoch, requestedEpochSamples);
+                inEpoch = true;
+                numMinibatches = 0;
+                if (traceLevel > 0)
+                    fprintf(stderr, "ServeData: Epoch %d for worker %d of %d at %s.\n", (int) epoch, (int) subsetNum, (int) numSubsets, socket->GetPeer().c_str());
+            }
+            else
+                RuntimeError("ServeData: Unexpected message %d.", (int) tag);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "ServeData: Connection to %s failed: %s\n", socket->GetPeer().c_str(), e.what());
+        try // pass it on, unless the connection is what failed
+        {
+            DataMessage message;
+            message.PutString(e.what());
+            message.Send(*socket, DataServerError, generation);
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+}
+
+template <typename ElemType>
+void DoServeData(const ConfigParameters& config)
+{
+    ConfigParameters readerConfig(config(L"reader"));
+    const int port = config(L"port");
+    const size_t numConnections = config(L"numConnections", (size_t) 0);
+    const int traceLevel = config(L"traceLevel", 0);
+
+    auto listener = DataSocket::Listen(port);
+    fprintf(stderr, "ServeData: Serving the reader on port %d.\n", port);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; numConnections == 0 || i < numConnections; i++)
+    {
+        std::shared_ptr<DataSocket> socket(listener->Accept().release());
+        if (traceLevel > 0)
+            fprintf(stderr, "ServeData: Connection from %s.\n", socket->GetPeer().c_str());
+        threads.push_back(std::thread(ServeDataConnection<ElemType>, socket, std::cref(readerConfig), traceLevel));
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+template void DoServeData<float>(const ConfigParameters& config);
+template void DoServeData<double>(const ConfigParameters& config);
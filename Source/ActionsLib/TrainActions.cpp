@@ -19,6 +19,14 @@
 #include "SynchronousExecutionEngine.h"
 #include "ModelEditLanguage.h"
 #include "SGD.h"
+#include "MatrixQuantizerImpl.h"
+#include "SimpleDistGradAggregator.h"
+#include "CompressedDistGradAggregator.h"
+#include "NcclDistGradAggregator.h"
+#ifdef QUANTIZED_GRADIENT_AGGREGATION
+#include "AllReduceDistGradAggregator.h"
+#endif
+#include "ModelAverager.h"
 #include "Config.h"
 #include "SimpleEvaluator.h"
 #include "SimpleOutputWriter.h"
@@ -35,6 +43,7 @@
 #include <queue>
 #include <set>
 #include <memory>
+#include <stdio.h>
 
 #ifndef let
 #define let const auto
@@ -93,13 +102,10 @@ shared_ptr<C> CreateObject(const ConfigParameters& config, const wchar_t* id)
     return make_shared<C>(readerConfig);                           // old CNTK config specifies a dictionary which then must be explicitly instantiated
 }
 
+// determine the network-creation function of a "train" or "planMemory" command
 template <class ConfigRecordType, typename ElemType>
-void DoTrain(const ConfigRecordType& config)
+static function<ComputationNetworkPtr(DEVICEID_TYPE)> GetCreateNetworkFnFromConfig(const ConfigRecordType& config, DEVICEID_TYPE deviceId)
 {
-    bool makeMode = config(L"makeMode", true);
-    DEVICEID_TYPE deviceId = DeviceFromConfig(config);
-
-    // determine the network-creation function
     // We have several ways to create that network.
     function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn;
 
@@ -154,6 +160,17 @@ void DoTrain(const ConfigRecordType& config)
     {
         RuntimeError("No network builder found in the config file. NDLNetworkBuilder or SimpleNetworkBuilde must be specified");
     }
+    return createNetworkFn;
+}
+
+template <class ConfigRecordType, typename ElemType>
+void DoTrain(const ConfigRecordType& config)
+{
+    bool makeMode = config(L"makeMode", true);
+    DEVICEID_TYPE deviceId = DeviceFromConfig(config);
+
+    // determine the network-creation function
+    function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn = GetCreateNetworkFnFromConfig<ConfigRecordType, ElemType>(config, deviceId);
 
     auto dataReader = CreateObject<DataReader<ElemType>>(config, L"reader");
 
@@ -272,3 +289,243 @@ void DoEdit(const ConfigParameters& config)
 
 template void DoEdit<double>(const ConfigParameters& config);
 template void DoEdit<float>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoPlanMemory() - implements CNTK "planMemory" command
+// Takes the network and SGD sections of a "train" command, and reports what training would take on each device
+// for minibatches of the given shape, and the largest minibatch that fits, without reading data (see SGD::PlanMemory()).
+// ===========================================================================
+
+template <typename ElemType>
+void DoPlanMemory(const ConfigParameters& config)
+{
+    DEVICEID_TYPE deviceId = DeviceFromConfig(config);
+    function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn = GetCreateNetworkFnFromConfig<ConfigParameters, ElemType>(config, deviceId);
+
+    // the minibatch shape: for sequences, numParallelSequences times sequenceLength columns (incl. padding); for frames, minibatchSize
+    const size_t numParallelSequences = config(L"numParallelSequences", (size_t) 0);
+    const size_t numColumns = numParallelSequences > 0 ? numParallelSequences * (size_t) config(L"sequenceLength", (size_t) 1)
+                                                       : (size_t) config(L"minibatchSize", (size_t) 256);
+    const size_t deviceMemoryMB = config(L"deviceMemoryMB", (size_t) 0); // what to fit into; 0 means all memory of the GPU
+
+    const ConfigParameters& configSGD(config(L"SGD"));
+    SGD<ElemType> optimizer(configSGD);
+    optimizer.PlanMemory(createNetworkFn, deviceId, numColumns, deviceMemoryMB);
+}
+
+template void DoPlanMemory<float>(const ConfigParameters& config);
+template void DoPlanMemory<double>(const ConfigParameters& config);
+
+// ===========================================================================
+// DoBenchmarkAggregation() - implements CNTK "benchmarkAggregation" command
+// Runs the gradient aggregators (and model averaging) on gradients of given shapes, without a network, under mpiexec,
+// and reports per-step latency and bandwidth. The shapes are those of the LearnableParameters of a model, or listed.
+// Each run appends one JSON line per strategy to resultsFile; running it with different numbers of ranks into the
+// same file yields the scaling curve, which is printed from the file after each run.
+// ===========================================================================
+
+// aggregator for the given strategy, or nullptr for model averaging
+template <typename ElemType>
+static IDistGradAggregator<ElemType>* CreateBenchmarkAggregator(const string& strategy, const ConfigParameters& config)
+{
+    const size_t bucketBytes = (size_t) config(L"gradientBucketSizeInKB", (size_t) 0) << 10;
+    const size_t packBytes = (size_t) config(L"packGradientsBelowKB", (size_t) 32) << 10;
+    const size_t numGradientBits = config(L"gradientBits", (size_t) 1);
+    const bool zeroThresholdFor1Bit = config(L"useZeroThresholdFor1BitQuantization", true);
+    const double topKFraction = config(L"topKGradientFraction", 0.0);
+
+    if (strategy == "mpi")
+        return new SimpleDistGradAggregator<ElemType>(g_mpi, false, 0, bucketBytes, AllReduceAlgorithm::Mpi, packBytes);
+    else if (strategy == "ring")
+        return new SimpleDistGradAggregator<ElemType>(g_mpi, false, 0, bucketBytes, AllReduceAlgorithm::Ring, packBytes);
+    else if (strategy == "recursiveHalving")
+        return new SimpleDistGradAggregator<ElemType>(g_mpi, false, 0, bucketBytes, AllReduceAlgorithm::RecursiveHalving, packBytes);
+    else if (strategy == "auto")
+        return new SimpleDistGradAggregator<ElemType>(g_mpi, false, 0, bucketBytes, AllReduceAlgorithm::Auto, packBytes);
+    else if (strategy == "compressed")
+        return new CompressedDistGradAggregator<ElemType>(g_mpi, numGradientBits, zeroThresholdFor1Bit, topKFraction, 0);
+    else if (strategy == "quantized")
+    {
+#ifdef QUANTIZED_GRADIENT_AGGREGATION
+        return new AllReduceDistGradAggregator<ElemType>(g_mpi, (int) numGradientBits, zeroThresholdFor1Bit, true /*useQuantizationForSelfStripe*/, false, 0, 0);
+#else
+        RuntimeError("BenchmarkAggregation: Strategy 'quantized' needs a CNTK binary built with 1-bit SGD.");
+#endif
+    }
+    else if (strategy == "nccl")
+    {
+        if (!NcclComm::IsSupported())
+            RuntimeError("BenchmarkAggregation: Strategy 'nccl' needs a CNTK binary built with NCCL support.");
+        return new NcclDistGradAggregator<ElemType>(g_mpi, 0);
+    }
+    else if (strategy == "modelAveraging")
+        return nullptr;
+    else
+        InvalidArgument("BenchmarkAggregation: Invalid strategy '%s'. Valid values are (mpi | ring | recursiveHalving | auto | compressed | quantized | nccl | modelAveraging)", strategy.c_str());
+}
+
+// prints, from the results of all runs in resultsPath, how the step time of this strategy and gradient size grows with the number of ranks
+// The efficiency is that of data-parallel training with a fixed minibatch per rank: (compute + step time at the fewest ranks) / (compute + step time).
+static void PrintAggregationScaling(const wstring& resultsPath, const string& strategy, double numBytes, double computeSeconds)
+{
+    FILE* f = _wfopen(resultsPath.c_str(), L"r");
+    if (!f)
+        return;
+    map<int, double> stepSeconds; // [numRanks] -> the latest result
+    char line[1024];
+    while (fgets(line, sizeof(line), f))
+    {
+        char lineStrategy[64];
+        int numRanks;
+        double lineBytes, meanSeconds;
+        if (sscanf(line, "{\"strategy\":\"%63[^\"]\",\"numRanks\":%d,\"bytes\":%lf,\"meanSeconds\":%lf", lineStrategy, &numRanks, &lineBytes, &meanSeconds) == 4 &&
+            strategy == lineStrategy && lineBytes == numBytes)
+            stepSeconds[numRanks] = meanSeconds;
+    }
+    fclose(f);
+    if (stepSeconds.size() < 2)
+        return;
+
+    const double referenceSeconds = computeSeconds + stepSeconds.begin()->second;
+    fprintf(stderr, "BenchmarkAggregation: Scaling of %s from %ls:\n", strategy.c_str(), resultsPath.c_str());
+    for (const auto& result : stepSeconds)
+        fprintf(stderr, "\tranks = %4d; step ms = %9.3f; efficiency = %6.2f%%\n", result.first, 1000 * result.second, 100 * referenceSeconds / (computeSeconds + result.second));
+}
+
+template <typename ElemType>
+void DoBenchmarkAggregation(const ConfigParameters& config)
+{
+    if (!g_mpi)
+        RuntimeError("BenchmarkAggregation: Needs to be run with parallelTrain=true under mpiexec.");
+
+    const DEVICEID_TYPE deviceId = DeviceFromConfig(config);
+    const wstring modelPath = config(L"modelPath", L"");
+    ConfigArray gradientShapes = config(L"gradientShapes", ""); // e.g. 2048x440:2048x2048, if there is no model
+    ConfigArray strategies = config(L"strategies", "mpi:ring:recursiveHalving");
+    const size_t numSteps = config(L"numSteps", (size_t) 50);
+    const size_t numWarmupSteps = config(L"numWarmupSteps", (size_t) 5);
+    const size_t minibatchSize = config(L"minibatchSize", (size_t) 256); // samples per rank and step, for the headers and model averaging weights
+    const double computeSeconds = config(L"computeSecondsPerStep", 0.0);  // forward/backward time of a step, for the scaling efficiency
+    const wstring resultsPath = config(L"resultsFile", L"");
+
+    // the gradients, filled with random values that differ between ranks
+    ComputationNetworkPtr net;
+    list<ComputationNodeBasePtr> learnableNodes;
+    vector<pair<size_t, size_t>> shapes;
+    if (!modelPath.empty())
+    {
+        net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelPath);
+        learnableNodes = net->GetNodesWithType(OperationNameOf(LearnableParameter));
+        for (const auto& node : learnableNodes)
+            shapes.push_back(make_pair(node->GetAsMatrixNumRows(), node->GetAsMatrixNumCols()));
+    }
+    else
+    {
+        for (size_t i = 0; i < gradientShapes.size(); i++)
+        {
+            const string shape = gradientShapes[i];
+            unsigned long rows, cols;
+            if (sscanf(shape.c_str(), "%lux%lu", &rows, &cols) != 2)
+                InvalidArgument("BenchmarkAggregation: Invalid gradient shape '%s', expected <rows>x<columns>.", shape.c_str());
+            shapes.push_back(make_pair((size_t) rows, (size_t) cols));
+        }
+    }
+    if (shapes.empty())
+        InvalidArgument("BenchmarkAggregation: Either modelPath or gradientShapes must be given.");
+
+    vector<unique_ptr<Matrix<ElemType>>> gradientMatrices;
+    vector<Matrix<ElemType>*> gradients;
+    double numBytes = 0;
+    for (const auto& shape : shapes)
+    {
+        gradientMatrices.push_back(unique_ptr<Matrix<ElemType>>(new Matrix<ElemType>(shape.first, shape.second, deviceId)));
+        gradientMatrices.back()->SetUniformRandomValue(-1, 1, (unsigned long) (g_mpi->CurrentNodeRank() * gradientMatrices.size() + 1));
+        gradients.push_back(gradientMatrices.back().get());
+        numBytes += (double) shape.first * shape.second * sizeof(ElemType);
+    }
+    const size_t numRanks = g_mpi->NumNodesInUse();
+    fprintf(stderr, "BenchmarkAggregation: %d gradients, %.3f MB, on %d ranks\n", (int) gradients.size(), numBytes / 1e6, (int) numRanks);
+
+    DistGradHeader* header = DistGradHeader::Create(0);
+    for (size_t s = 0; s < strategies.size(); s++)
+    {
+        const string strategy = strategies[s];
+        unique_ptr<IDistGradAggregator<ElemType>> aggregator(CreateBenchmarkAggregator<ElemType>(strategy, config));
+        unique_ptr<ModelAverager<ElemType>> modelAverager;
+        if (!aggregator)
+        {
+            if (!net)
+                InvalidArgument("BenchmarkAggregation: Strategy 'modelAveraging' averages the parameters of a model, it needs modelPath.");
+            modelAverager.reset(new ModelAverager<ElemType>(g_mpi, false, 1.0, 0.0, 1.0));
+        }
+
+        // one step as in training: the gradients get final in backprop order, then the aggregation completes
+        vector<double> latencies;
+        DeviceTimer timer(deviceId); // (includes the GPU work that is still in flight when a step returns)
+        for (size_t step = 0; step < numWarmupSteps + numSteps; step++)
+        {
+            g_mpi->WaitAll(); // (so that the ranks start together, and skew from the previous step is not counted)
+            timer.Start();
+            if (modelAverager)
+                modelAverager->Sync(learnableNodes, minibatchSize);
+            else
+            {
+                header->Clear();
+                header->numSamples = minibatchSize;
+                header->numSamplesWithLabel = minibatchSize;
+                if (aggregator->OverlapsWithBackprop())
+                {
+                    for (size_t i = gradients.size(); i-- > 0;)
+                        aggregator->GradientIsFinal(gradients, i);
+                }
+                aggregator->AggregateGradients(gradients, header, 0);
+            }
+            timer.Stop();
+            if (step >= numWarmupSteps)
+                latencies.push_back(timer.ElapsedSeconds());
+        }
+        // a step takes as long as on the slowest rank
+        if (!latencies.empty())
+            MPI_Allreduce(MPI_IN_PLACE, latencies.data(), (int) latencies.size(), MPI_DOUBLE, MPI_MAX, g_mpi->Communicator()) || MpiFail("BenchmarkAggregation: MPI_Allreduce");
+
+        vector<double> sorted(latencies);
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](double p)
+        {
+            return sorted.empty() ? 0.0 : sorted[min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+        };
+        double meanSeconds = 0;
+        for (double latency : latencies)
+            meanSeconds += latency / latencies.size();
+        // bus bandwidth: what a ring all-reduce moves across the slowest link, 2 (N-1)/N times the gradient size per step
+        const double algorithmBandwidth = meanSeconds > 0 ? numBytes / meanSeconds : 0;
+        const double busBandwidth = algorithmBandwidth * 2 * (numRanks - 1) / numRanks;
+        const double efficiency = computeSeconds > 0 ? computeSeconds / (computeSeconds + meanSeconds) : 0;
+        const double bytesSent = aggregator ? (double) aggregator->GetNumGradientBytesSent() / (numWarmupSteps + numSteps) : numBytes;
+
+        if (!g_mpi->IsMainNode())
+            continue;
+        fprintf(stderr, "BenchmarkAggregation: %s on %d ranks: step ms: mean = %.3f, p50 = %.3f, p99 = %.3f; algorithm bandwidth = %.3f GB/s; bus bandwidth = %.3f GB/s; sent per step = %.3f MB",
+                strategy.c_str(), (int) numRanks, 1000 * meanSeconds, 1000 * percentile(0.5), 1000 * percentile(0.99), algorithmBandwidth / 1e9, busBandwidth / 1e9, bytesSent / 1e6);
+        if (computeSeconds > 0)
+            fprintf(stderr, "; efficiency = %.2f%%", 100 * efficiency);
+        fprintf(stderr, "\n");
+
+        if (resultsPath.empty())
+            continue;
+        FILE* f = _wfopen(resultsPath.c_str(), L"a");
+        if (!f)
+            RuntimeError("BenchmarkAggregation: Cannot open results file %ls.", resultsPath.c_str());
+        fprintf(f, "{\"strategy\":\"%s\",\"numRanks\":%d,\"bytes\":%.0f,\"meanSeconds\":%.9f,\"p50Seconds\":%.9f,\"p99Seconds\":%.9f,"
+                   "\"algorithmBandwidthGBs\":%.6f,\"busBandwidthGBs\":%.6f,\"bytesSentPerStep\":%.0f,\"efficiency\":%.6f}\n",
+                strategy.c_str(), (int) numRanks, numBytes, meanSeconds, percentile(0.5), percentile(0.99),
+                algorithmBandwidth / 1e9, busBandwidth / 1e9, bytesSent, efficiency);
+        if (fclose(f) != 0)
+            RuntimeError("BenchmarkAggregation: Error writing results file %ls.", resultsPath.c_str());
+        PrintAggregationScaling(resultsPath, strategy, numBytes, computeSeconds);
+    }
+    DistGradHeader::Destroy(header);
+}
+
+template void DoBenchmarkAggregation<float>(const ConfigParameters& config);
+template void DoBenchmarkAggregation<double>(const ConfigParameters& config);
@@ -17,9 +17,12 @@
 #include "SimpleNetworkBuilder.h"
 #include "NDLNetworkBuilder.h"
 #include "SynchronousExecutionEngine.h"
+#include "InputAndParamNodes.h" // used for LearnableParameterInitOnDeviceMinElements()
 #include "ModelEditLanguage.h"
 #include "CPUMatrix.h" // used for SetNumThreads()
 #include "CommonMatrix.h"
+#include "CuDnnConvolutionEngine.h" // used for SetAlgorithmCacheFile()
+#include "CUDAPageLockedMemAllocator.h"
 #include "SGD.h"
 #include "MPIWrapper.h"
 #include "Config.h"
@@ -159,6 +162,32 @@ void DoCommands(const ConfigParameters& config)
         std::cerr << "Using " << numCPUThreads << " CPU threads" << endl;
     }
 
+    // on NUMA machines, keep the CPU threads and the pages of their matrices on the same node
+    CPUMatrix<ElemType>::SetNumaPlacement(ParseNumaMemoryPolicy((wstring) config(L"numaMemoryPolicy", L"none")), config(L"pinCPUThreads", false));
+
+    // vectorized CPU code paths (AVX2/AVX-512) may use polynomial approximations of exp() etc., at the cost of bit-exactness
+    CPUMatrix<ElemType>::SetUseFastMathApproximations(config(L"fastMathApproximations", false));
+
+    // back large CPU matrices with huge pages (none, transparent, reserved), to save TLB misses
+    CPUMatrix<ElemType>::SetHugePages(ParseHugePageMode((wstring) config(L"hugePages", L"none")), config(L"hugePageMinMB", (size_t) 64) * 1024 * 1024);
+
+    // random-initialize parameters of at least this many elements on their own device, see LearnableParameter::InitRandom()
+    LearnableParameterInitOnDeviceMinElements() = config(L"initOnDeviceMinElements", (size_t) 0);
+
+    // CPU loops over fewer elements than this run single-threaded, as the OpenMP overhead would exceed the work
+    CPUMatrix<ElemType>::SetParallelMinElements(config(L"parallelMinElements", (size_t) 16384));
+
+    // remember the algorithms picked by the cuDNN auto-tuner across runs
+    CuDnnConvolutionEngineFactory<ElemType>::SetAlgorithmCacheFile(config(L"cudnnAlgorithmCacheFile", L""));
+
+    // run independent nodes concurrently, on this many CUDA streams
+    ComputationNetwork::SetNumConcurrentStreams(config(L"concurrentStreams", (size_t) 0));
+
+    // keep only every this-many-th activation for backprop, and recompute the others (or tag nodes 'checkpoint')
+    ComputationNetwork::SetRecomputeSegmentLength(config(L"recomputeSegmentLength", (size_t) 0));
+    // or copy activations of at least this many elements per sample to host memory in between forward prop and backprop
+    ComputationNetwork::SetOffloadMinValueSize(config(L"offloadMinValueSize", (size_t) 0));
+
     bool progressTracing = config(L"progressTracing", false);
 
     // temporary hack to prevent users from failling for a small breaking change related to the "truncated" flag (will be redone bigger and better some day)
@@ -210,6 +239,11 @@ void DoCommands(const ConfigParameters& config)
         // determine the action to perform, and do it
         for (int j = 0; j < action.size(); j++)
         {
+            // eval, cv, and write share loaded models and readers (see ActionCache), which must not hold memory while models are
+            // trained or edited
+            if (action[j] == "train" || action[j] == "trainRNN" || action[j] == "adapt" || action[j] == "edit")
+                ClearActionCache();
+
             if (action[j] == "train" || action[j] == "trainRNN")
             {
                 std::cerr << "CNTKCommandTrainBegin: " + command[i] << endl;
@@ -265,6 +299,22 @@ void DoCommands(const ConfigParameters& config)
             {
                 DoParameterSVD<ElemType>(commandParams);
             }
+            else if (action[j] == "benchmarkReader")
+            {
+                DoBenchmarkReader<ElemType>(commandParams);
+            }
+            else if (action[j] == "serveData")
+            {
+                DoServeData<ElemType>(commandParams);
+            }
+            else if (action[j] == "benchmarkAggregation")
+            {
+                DoBenchmarkAggregation<ElemType>(commandParams);
+            }
+            else if (action[j] == "planMemory")
+            {
+                DoPlanMemory<ElemType>(commandParams);
+            }
             else
             {
                 RuntimeError("unknown action: %s  in command set: %s", action[j].c_str(), command[i].c_str());
@@ -274,6 +324,7 @@ void DoCommands(const ConfigParameters& config)
             ndlScript.ClearGlobal(); // clear global macros between commands
         }
     }
+    ClearActionCache();
 }
 
 std::string TimeDateStamp()
@@ -432,6 +483,8 @@ int wmainWithBS(int argc, wchar_t* argv[]) // called from wmain which is a wrapp
     g_shareNodeValueMatrices = config(L"shareNodeValueMatrices", false);
 
     TracingGPUMemoryAllocator::SetTraceLevel(config(L"traceGPUMemoryAllocations", 0));
+    TracingGPUMemoryAllocator::SetCachingEnabled(config(L"cacheGPUMemoryAllocations", true));
+    CUDAPageLockedMemArena::SetSharedArenaLimit((size_t) config(L"pinnedMemoryLimitMB", (size_t) 1024) << 20);
 
     // logging
     wstring logpath = config(L"stderr", L"");
@@ -456,6 +509,15 @@ int wmainWithBS(int argc, wchar_t* argv[]) // called from wmain which is a wrapp
     numCPUThreads = CPUMatrix<float /*any will do*/>::SetNumThreads(numCPUThreads);
     if (numCPUThreads > 0)
         fprintf(stderr, "Using %d CPU threads.\n", numCPUThreads);
+    CPUMatrix<float /*any will do*/>::SetNumaPlacement(ParseNumaMemoryPolicy((wstring) config(L"numaMemoryPolicy", L"none")), config(L"pinCPUThreads", false));
+    CPUMatrix<float /*any will do*/>::SetUseFastMathApproximations(config(L"fastMathApproximations", false));
+    CPUMatrix<float /*any will do*/>::SetParallelMinElements(config(L"parallelMinElements", (size_t) 16384));
+    CPUMatrix<float /*any will do*/>::SetHugePages(ParseHugePageMode((wstring) config(L"hugePages", L"none")), config(L"hugePageMinMB", (size_t) 64) * 1024 * 1024);
+    LearnableParameterInitOnDeviceMinElements() = config(L"initOnDeviceMinElements", (size_t) 0);
+    CuDnnConvolutionEngineFactory<float /*any will do*/>::SetAlgorithmCacheFile(config(L"cudnnAlgorithmCacheFile", L""));
+    ComputationNetwork::SetNumConcurrentStreams(config(L"concurrentStreams", (size_t) 0));
+    ComputationNetwork::SetRecomputeSegmentLength(config(L"recomputeSegmentLength", (size_t) 0));
+    ComputationNetwork::SetOffloadMinValueSize(config(L"offloadMinValueSize", (size_t) 0));
 
     bool progressTracing = config(L"progressTracing", false);
     size_t fullTotalMaxEpochs = 1; // BUGBUG: BS does not allow me to read out the max epochs parameters, as that would instantiate and thus execute the objects
@@ -521,6 +583,8 @@ int wmainOldCNTKConfig(int argc, wchar_t* argv[]) // called from wmain which is
     g_shareNodeValueMatrices = config(L"shareNodeValueMatrices", false);
 
     TracingGPUMemoryAllocator::SetTraceLevel(config(L"traceGPUMemoryAllocations", 0));
+    TracingGPUMemoryAllocator::SetCachingEnabled(config(L"cacheGPUMemoryAllocations", true));
+    CUDAPageLockedMemArena::SetSharedArenaLimit((size_t) config(L"pinnedMemoryLimitMB", (size_t) 1024) << 20);
 
     if (logpath != L"")
     {
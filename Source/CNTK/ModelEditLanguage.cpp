@@ -186,7 +186,7 @@ void MELScript<ElemType>::CallFunction(const std::string& p_name, const ConfigPa
     {
         size_t numFixedParams = 1, numOptionalParams = 1;
         if (params.size() > numFixedParams + numOptionalParams || params.size() < numFixedParams)
-            RuntimeError("Invalid number of parameters. Valid parameters: SaveDefaultModel(modelFileName, [format=cntk]).");
+            RuntimeError("Invalid number of parameters. Valid parameters: SaveDefaultModel(modelFileName, [format=cntk|cntk_fp16|cntk_int8]).");
 
         std::wstring modelFormat = GetOptionalModelFormat(params, numFixedParams);
 
@@ -198,13 +198,13 @@ void MELScript<ElemType>::CallFunction(const std::string& p_name, const ConfigPa
 
         // validate the network before we save it out
         ProcessNDLScript(m_netNdlDefault, ndlPassAll, true);
-        cn->SaveEdited(fileName);
+        cn->SaveEdited(fileName, GetModelFileOptions(modelFormat));
     }
     else if (EqualInsensitive(name, "SaveModel"))
     {
         size_t numFixedParams = 2, numOptionalParams = 1;
         if (params.size() > numFixedParams + numOptionalParams || params.size() < numFixedParams)
-            RuntimeError("Invalid number of parameters. Valid parameters: SaveModel(modelName, modelFileName, [format=cntk]).");
+            RuntimeError("Invalid number of parameters. Valid parameters: SaveModel(modelName, modelFileName, [format=cntk|cntk_fp16|cntk_int8]).");
 
         std::wstring modelFormat = GetOptionalModelFormat(params, numFixedParams);
 
@@ -217,7 +217,7 @@ void MELScript<ElemType>::CallFunction(const std::string& p_name, const ConfigPa
 
         // validate and finish the second pass through NDL if any in-line NDL was defined
         ProcessNDLScript(netNdl, ndlPassAll, true);
-        netNdl->cn->SaveEdited(fileName);
+        netNdl->cn->SaveEdited(fileName, GetModelFileOptions(modelFormat));
     }
     else if (EqualInsensitive(name, "SetDefaultModel"))
     {
@@ -635,6 +635,59 @@ void MELScript<ElemType>::CallFunction(const std::string& p_name, const ConfigPa
             netNdlFrom->cn->RenameNode(node, nodeName.second);
         }
     }
+    else if (EqualInsensitive(name, "OptimizeForInference"))
+    {
+        if (params.size() < 1)
+            RuntimeError("Invalid number of parameters. Valid parameters: OptimizeForInference(modelName, [outputNodeName1, ...]).");
+
+        std::string modelName = params[0];
+        auto found = m_mapNameToNetNdl.find(modelName);
+        if (found == m_mapNameToNetNdl.end())
+            RuntimeError("Model %s does not exist. Cannot optimize non-existant model.", modelName.c_str());
+        NetNdl<ElemType>* netNdl = &found->second;
+        ProcessNDLScript(netNdl, ndlPassAll, true);
+
+        // the remaining parameters are the outputs to keep, e.g. model.OutputNode or model.Out*
+        vector<ComputationNodeBasePtr> outputNodes;
+        for (int i = 1; i < params.size(); ++i)
+        {
+            NetNdl<ElemType>* netNdlOutput;
+            vector<ComputationNodeBasePtr> nodes = FindSymbols(params[i], netNdlOutput);
+            if (netNdlOutput != netNdl)
+                RuntimeError("OptimizeForInference: output %s does not belong to model %s.", params[i].c_str(), modelName.c_str());
+            if (nodes.size() < 1)
+                RuntimeError("OptimizeForInference: %s doesn't represent any nodes.", params[i].c_str());
+            outputNodes.insert(outputNodes.end(), nodes.begin(), nodes.end());
+        }
+        netNdl->cn->template OptimizeForInference<ElemType>(outputNodes);
+    }
+    else if (EqualInsensitive(name, "SVD", "FactorParameter"))
+    {
+        // SVD(parameterNames, keep, [alignedSize]) -- replaces each parameter W by Times(W-U, W-V) (see ComputationNetwork::PerformSVDecomposition())
+        // 'keep' is the fraction of the energy to keep if <= 1, or the rank if > 1. The result can be fine-tuned by a "train" command.
+        size_t numFixedParams = 2, numOptionalParams = 1;
+        if (params.size() > numFixedParams + numOptionalParams || params.size() < numFixedParams)
+            RuntimeError("Invalid number of parameters. Valid parameters are SVD(parameterNames, keepRatioOrRank, [alignedSize=8]).");
+
+        NetNdl<ElemType>* netNdl;
+        vector<ComputationNodeBasePtr> nodes = FindSymbols(params[0], netNdl);
+        if (nodes.size() < 1)
+            RuntimeError("SVD: %s doesn't represent any nodes.", params[0].c_str());
+        ProcessNDLScript(netNdl, ndlPassAll, true);
+
+        float keep = (float) msra::strfun::todouble(params[1].c_str());
+        size_t alignedSize = params.size() > 2 ? (size_t) msra::strfun::toint(params[2].c_str()) : 8;
+        for (const auto& node : nodes)
+        {
+            if (node->OperationName() != LearnableParameter<ElemType>::TypeName())
+            {
+                fprintf(stderr, "WARNING: SVD: %ls is not a learnable parameter (it is a %ls node). Skipping this node\n", node->NodeName().c_str(), node->OperationName().c_str());
+                continue;
+            }
+            netNdl->cn->template FactorParameterBySVD<ElemType>(node->NodeName(), keep, alignedSize);
+        }
+        netNdl->cn->CompileNetwork();
+    }
     else if (EqualInsensitive(name, "ReviseParameter"))
     {
         typedef LearnableParameter<ElemType> LearnableParameterNode;
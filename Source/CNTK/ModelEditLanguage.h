@@ -456,9 +456,17 @@ public:
                     {
                         modelFormat = L"cntk_legacy_no_tensorlib";
                     }
+                    else if (EqualInsensitive(value, "cntk_fp16")) // (for saving; loading detects these)
+                    {
+                        modelFormat = L"cntk_fp16";
+                    }
+                    else if (EqualInsensitive(value, "cntk_int8"))
+                    {
+                        modelFormat = L"cntk_int8";
+                    }
                     else
                     {
-                        RuntimeError("Invalid optional parameter value %s, valid values are: format=(cntk)", value.c_str());
+                        RuntimeError("Invalid optional parameter value %s, valid values are: format=(cntk|cntk_fp16|cntk_int8)", value.c_str());
                     }
                 }
                 else
@@ -470,6 +478,16 @@ public:
 
         return modelFormat;
     }
+    // file options for saving a model in the given format: parameters in FP16, or in 8 bits with a scale per row
+    static FileOptions GetModelFileOptions(const wstring& modelFormat)
+    {
+        if (modelFormat == L"cntk_fp16")
+            return (FileOptions)(FileOptions::fileOptionsBinary | FileOptions::fileOptionsHalfPrecision);
+        else if (modelFormat == L"cntk_int8")
+            return (FileOptions)(FileOptions::fileOptionsBinary | FileOptions::fileOptionsQuantized8Bit);
+        else
+            return FileOptions::fileOptionsBinary;
+    }
 
     std::string GetOptionalSnippetSection(const ConfigParamList& params, const size_t numFixedParams)
     {
@@ -220,6 +220,24 @@ void SynchronousNodeEvaluator<ElemType>::Evaluate(NDLNode<ElemType>* node, const
             nodePtr->SetParameterUpdateRequired(needGradient);
         }
     }
+    else if (cnNodeType == OperationNameOf(ContextWindowNode))
+    {
+        if (parameter.size() != 3)
+            RuntimeError("ContextWindow should have three parameters. Usage: ContextWindow(origNodeName, leftContext, rightContext).");
+
+        nodeParamCount = 1;
+        nodeParamStart = 0;
+
+        if (pass == ndlPassInitial)
+        {
+            // evaluate only scalar parameters
+            vector<void*> params = EvaluateParameters(node, baseName, 0, parameter.size(), pass);
+            size_t leftContext = ((NDLNode<ElemType>*) params[1])->GetScalar();
+            size_t rightContext = ((NDLNode<ElemType>*) params[2])->GetScalar();
+
+            nodePtr = builder.ContextWindow(NULL, leftContext, rightContext, name);
+        }
+    }
     else if (cnNodeType == OperationNameOf(DiagonalNode))
     {
         if (parameter.size() != 1)
@@ -326,6 +344,28 @@ void SynchronousNodeEvaluator<ElemType>::Evaluate(NDLNode<ElemType>* node, const
                                           horizontalSubsample, verticalSubsample, imageLayoutKind, zeroPadding, maxTempMemSizeInSamples, name);
         }
     }
+    else if (cnNodeType == OperationNameOf(SampledCrossEntropyWithSoftmaxNode))
+    {
+        if (parameter.size() != 4)
+            RuntimeError("%ls should have 4 parameters [labelIndexNodeName, inputValueNodeName, weightNodeName, numSamples].", cnNodeType.c_str());
+
+        // setup the parameter position of children so we can hook them up later
+        nodeParamCount = 3;
+        nodeParamStart = 0;
+
+        if (pass == ndlPassInitial)
+        {
+            int id = 3; // skip the three inputs
+
+            // evaluate only scalar parameters
+            vector<void*> params = EvaluateParameters(node, baseName, id, parameter.size() - id, pass);
+            id = 0; // reset counter because the params array starts at zero
+            size_t numSamples = ((NDLNode<ElemType>*) params[id++])->GetScalar();
+            assert(id == 1);
+
+            nodePtr = builder.SampledCrossEntropyWithSoftmax(NULL, NULL, NULL, numSamples, name);
+        }
+    }
     else if (cnNodeType == OperationNameOf(MaxPoolingNode))
     {
         if (parameter.size() != 5)
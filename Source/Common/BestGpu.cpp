@@ -18,6 +18,7 @@
 #include "Config.h" // for ConfigParameters
 #include "ScriptableObjects.h"
 #include "DebugUtil.h"
+#include "MPIWrapper.h" // for identifying the other processes of the job on this machine
 #ifndef CPUONLY
 #pragma comment(lib, "cudart.lib")
 #include <cuda_runtime.h>
@@ -66,6 +67,8 @@ struct ProcessorData
     bool dbnFound;
     bool cnFound;
     int deviceId; // the deviceId (cuda side) for this processor
+    nvmlDevice_t nvmlDevice;
+    bool nvmlDeviceFound; // nvmlDevice is valid
 };
 
 enum BestGpuFlags
@@ -76,12 +79,14 @@ enum BestGpuFlags
     bestGpuFavorUtilization = 4, // favor low utilization
     bestGpuFavorSpeed = 8,       // favor fastest processor
     bestGpuExclusiveLock = 16,   // obtain mutex for selected GPU
+    bestGpuFavorPeers = 32,      // favor fast peer-to-peer links to the GPUs already taken by the other processes of our peer group (see SetPeerGroup())
     bestGpuRequery = 256,        // rerun the last query, updating statistics
 };
 
 class BestGpu
 {
     std::map<int, std::unique_ptr<CrossProcessMutex>> m_GPUMutex;
+    std::map<int, std::unique_ptr<CrossProcessMutex>> m_peerGroupMutex; // marks the GPUs we hold as taken by our peer group
 
 private:
     bool m_initialized;       // initialized
@@ -93,9 +98,12 @@ private:
     int m_lastCount;          // count of devices (with filtering of allowed Devices)
     std::vector<ProcessorData*> m_procData;
     int m_allowedDevices; // bitfield of allowed devices
+    std::string m_peerGroup;                     // name shared by the processes of a job on this machine (empty: none)
+    std::vector<std::vector<double>> m_peerLink; // [i][j] in [0,1], the quality of the peer-to-peer path between CUDA devices i and j
     void GetCudaProperties();
     void GetNvmlData();
     void QueryNvmlData();
+    void GetTopology();
 
 public:
     BestGpu()
@@ -112,6 +120,10 @@ public:
         m_allowedDevices &= ~(1 << device);
     }
     void AllowAll();                                                                          // reset to allow all GPUs (no allowed list)
+    void SetPeerGroup(const std::string& name)                                                // processes that set the same name pick GPUs close to each other's
+    {
+        m_peerGroup = name;
+    }
     bool UseMultiple();                                                                       // using multiple GPUs?
     int GetDevice(BestGpuFlags flags = bestGpuNormal);                                        // get a single device
     static const int AllDevices = -1;                                                         // can be used to specify all GPUs in GetDevices() call
@@ -119,6 +131,7 @@ public:
     std::vector<int> GetDevices(int number = AllDevices, BestGpuFlags flags = bestGpuNormal); // get multiple devices
 private:
     bool LockDevice(int deviceId, bool trial = true);
+    std::string PeerGroupMutexName(int deviceId) const;
 };
 
 // DeviceFromConfig - Parse 'deviceId' config parameter to determine what type of behavior is desired
@@ -145,8 +158,15 @@ static DEVICEID_TYPE SelectDevice(DEVICEID_TYPE deviceId, bool bLockGPU)
             static BestGpu* g_bestGpu = nullptr;
             if (g_bestGpu == nullptr)
                 g_bestGpu = new BestGpu();
-            deviceId = (DEVICEID_TYPE)
-                           g_bestGpu->GetDevice(BestGpuFlags(bLockGPU ? (bestGpuAvoidSharing | bestGpuExclusiveLock) : bestGpuAvoidSharing));
+            int flags = bLockGPU ? (bestGpuAvoidSharing | bestGpuExclusiveLock) : bestGpuAvoidSharing;
+            // the ranks of a parallel job that share a machine come here one after the other (MPIWrapper staggers them),
+            // and each picks a GPU with fast links to those the ones before it took, e.g. behind the same PCIe switch
+            if (g_mpi != nullptr && g_mpi->NumNodesInUse() > 1)
+            {
+                g_bestGpu->SetPeerGroup(std::to_string(g_mpi->JobId()));
+                flags |= bestGpuFavorPeers;
+            }
+            deviceId = (DEVICEID_TYPE) g_bestGpu->GetDevice(BestGpuFlags(flags));
             bestDeviceId = deviceId;
         }
         else // already chosen
@@ -281,6 +301,7 @@ void BestGpu::Init()
     {
         GetCudaProperties();
         GetNvmlData();
+        GetTopology();
     }
     m_initialized = true;
 }
@@ -316,6 +337,42 @@ void BestGpu::GetNvmlData()
     QueryNvmlData();
 }
 
+// GetTopology - Rate the peer-to-peer path between each pair of GPUs
+// Pairs that cannot access each other's memory get 0; otherwise the closer their common ancestor in the PCIe tree
+// (the same board, one switch, several switches, a host bridge, a CPU, across CPUs), the better.
+void BestGpu::GetTopology()
+{
+    m_peerLink.assign(m_deviceCount, std::vector<double>(m_deviceCount, 0.0));
+    for (ProcessorData* pd : m_procData)
+    {
+        for (ProcessorData* peer : m_procData)
+        {
+            int canAccessPeer = 0;
+            if (pd == peer || cudaDeviceCanAccessPeer(&canAccessPeer, pd->deviceId, peer->deviceId) != cudaSuccess || !canAccessPeer)
+                continue;
+            double link = 0.5; // P2P works, but NVML cannot tell us how far apart they are
+            nvmlGpuTopologyLevel_t level;
+            if (pd->nvmlDeviceFound && peer->nvmlDeviceFound && nvmlDeviceGetTopologyCommonAncestor(pd->nvmlDevice, peer->nvmlDevice, &level) == NVML_SUCCESS)
+            {
+                // (compare the numeric values, as the names of the levels above the host bridge differ between NVML versions)
+                if (level <= 0) // NVML_TOPOLOGY_INTERNAL
+                    link = 1.0;
+                else if (level <= 10) // NVML_TOPOLOGY_SINGLE
+                    link = 0.8;
+                else if (level <= 20) // NVML_TOPOLOGY_MULTIPLE
+                    link = 0.7;
+                else if (level <= 30) // NVML_TOPOLOGY_HOSTBRIDGE
+                    link = 0.4;
+                else if (level <= 40) // NVML_TOPOLOGY_CPU/NODE
+                    link = 0.2;
+                else // NVML_TOPOLOGY_SYSTEM
+                    link = 0.1;
+            }
+            m_peerLink[pd->deviceId][peer->deviceId] = link;
+        }
+    }
+}
+
 // GetDevice - Determine the best device ID to use
 // bestFlags - flags that modify how the score is calculated
 int BestGpu::GetDevice(BestGpuFlags bestFlags)
@@ -390,6 +447,7 @@ std::vector<int> BestGpu::GetDevices(int number, BestGpuFlags p_bestFlags)
     double speedW = 0.2;
     double freeMemW = 0.2;
     double mlAppRunningW = 0.2;
+    double peersW = 1.0;
 
     // if it's a requery, just use the same flags as last time
     if (bestFlags & bestGpuRequery)
@@ -414,6 +472,27 @@ std::vector<int> BestGpu::GetDevices(int number, BestGpuFlags p_bestFlags)
         speedW *= 2;
     }
 
+    // this code allows only one process to run concurrently on a machine
+    // (acquired before scoring, so that the GPUs taken by our peer group cannot change under our feet)
+    CrossProcessMutex deviceAllocationLock("DBN.exe GPGPU querying lock");
+
+    if (!deviceAllocationLock.Acquire((bestFlags & bestGpuExclusiveLock) != 0)) // failure  --this should not really happen
+        RuntimeError("DeviceFromConfig: unexpected failure");
+
+    // which GPUs do the other processes of our peer group hold? Their marker mutex cannot be acquired.
+    std::vector<int> peerDevices;
+    if ((bestFlags & bestGpuFavorPeers) && !m_peerGroup.empty())
+    {
+        for (ProcessorData* pd : m_procData)
+        {
+            if (m_peerGroupMutex.find(pd->deviceId) != m_peerGroupMutex.end()) // (our own)
+                continue;
+            CrossProcessMutex marker(PeerGroupMutexName(pd->deviceId));
+            if (!marker.Acquire(false))
+                peerDevices.push_back(pd->deviceId);
+        }
+    }
+
     for (ProcessorData* pd : m_procData)
     {
         double score = 0.0;
@@ -431,6 +510,13 @@ std::vector<int> BestGpu::GetDevices(int number, BestGpuFlags p_bestFlags)
             mem = pd->cudaFreeMem / (double) pd->cudaTotalMem;
         score += mem * freeMemW;
         score += ((pd->cnFound || pd->dbnFound) ? 0 : 1) * mlAppRunningW;
+        if (!peerDevices.empty())
+        {
+            double link = 0;
+            for (int peer : peerDevices)
+                link += m_peerLink[pd->deviceId][peer];
+            score += link / peerDevices.size() * peersW;
+        }
         for (int i = 0; i < best.size(); i++)
         {
             // look for a better score
@@ -459,12 +545,6 @@ std::vector<int> BestGpu::GetDevices(int number, BestGpuFlags p_bestFlags)
             break;
     }
 
-    // this code allows only one process to run concurrently on a machine
-    CrossProcessMutex deviceAllocationLock("DBN.exe GPGPU querying lock");
-
-    if (!deviceAllocationLock.Acquire((bestFlags & bestGpuExclusiveLock) != 0)) // failure  --this should not really happen
-        RuntimeError("DeviceFromConfig: unexpected failure");
-
     {
         // even if user do not want to lock the GPU, we still need to check whether a particular GPU is locked or not,
         // to respect other users' exclusive lock.
@@ -498,7 +578,16 @@ std::vector<int> BestGpu::GetDevices(int number, BestGpuFlags p_bestFlags)
     for (int z = 0; z < best.size() && z < number; z++)
     {
         LockDevice(best[z], false);
+        // tell the processes of our peer group that come after us that we are here
+        if (best[z] >= 0 && !m_peerGroup.empty() && m_peerGroupMutex.find(best[z]) == m_peerGroupMutex.end())
+        {
+            std::unique_ptr<CrossProcessMutex> marker(new CrossProcessMutex(PeerGroupMutexName(best[z])));
+            if (marker->Acquire(false))
+                m_peerGroupMutex[best[z]] = std::move(marker);
+        }
     }
+    if (!peerDevices.empty() && best[0] >= 0)
+        fprintf(stderr, "BestGpu: GPU %d, next to the %d GPU(s) of the other processes of this job on this machine.\n", best[0], (int) peerDevices.size());
 
     return best; // return the array of the best GPUs
 }
@@ -543,6 +632,8 @@ void BestGpu::QueryNvmlData()
 
         if (curPd == NULL)
             continue;
+        curPd->nvmlDevice = device;
+        curPd->nvmlDeviceFound = true;
 
         // Get the memory usage, will only work for TCC drivers
         result = nvmlDeviceGetMemoryInfo(device, &memory);
@@ -609,6 +700,14 @@ void BestGpu::QueryNvmlData()
     return;
 }
 
+// name of the mutex by which a process of our peer group marks a GPU as taken (held for as long as the process uses the GPU)
+std::string BestGpu::PeerGroupMutexName(int deviceId) const
+{
+    char buffer[160];
+    sprintf(buffer, "CNTK GPU of peer group %s device %d", m_peerGroup.c_str(), deviceId);
+    return buffer;
+}
+
 bool BestGpu::LockDevice(int deviceId, bool trial)
 {
     if (deviceId < 0) // don't lock CPU, always return true
@@ -15,6 +15,7 @@
 #include "DataReader.h"
 #include "Config.h"
 #include "ScriptableObjects.h"
+#include "TimelineTrace.h"
 
 using namespace std;
 
@@ -38,6 +39,16 @@ std::string GetReaderName(double)
     return name;
 }
 
+// the entry point of a reader plugin: its own reader, or with pipeline=true its deserializer in the composable pipeline (see PipelineReader.h)
+template <class ElemType, class ConfigRecordType>
+static std::string GetReaderName(const ConfigRecordType& config)
+{
+    std::string name = GetReaderName((ElemType) 0);
+    if (config(L"pipeline", false))
+        name = "GetPipelineReader" + name.substr(strlen("GetReader"));
+    return name;
+}
+
 template <class ElemType>
 template <class ConfigRecordType>
 void DataReader<ElemType>::InitFromConfig(const ConfigRecordType& /*config*/)
@@ -51,6 +62,7 @@ void DataReader<ElemType>::InitFromConfig(const ConfigRecordType& /*config*/)
 template <class ElemType>
 void DataReader<ElemType>::Destroy()
 {
+    CancelReadAhead();
     // newer code that explicitly place multiple streams for inputs
     foreach_index (i, m_ioNames) // inputNames should map to node names
     {
@@ -63,6 +75,7 @@ void DataReader<ElemType>::Destroy()
 template <class ElemType>
 template <class ConfigRecordType>
 DataReader<ElemType>::DataReader(const ConfigRecordType& config)
+    : m_aheadNumParallelSequences(0), m_currentNumParallelSequences(0), m_hasCurrentState(false)
 {
     typedef void (*GetReaderProc)(IDataReader<ElemType>** preader);
 
@@ -77,7 +90,7 @@ DataReader<ElemType>::DataReader(const ConfigRecordType& config)
         {
             const ConfigRecordType& thisIO = config(ioName);
             // get the name for the reader we want to use, default to UCIFastReader
-            GetReaderProc getReaderProc = (GetReaderProc) Plugin::Load(thisIO(L"readerType", L"UCIFastReader"), GetReaderName((ElemType) 0));
+            GetReaderProc getReaderProc = (GetReaderProc) Plugin::Load(thisIO(L"readerType", L"UCIFastReader"), GetReaderName<ElemType>(thisIO));
             m_ioNames.push_back(ioName);
             getReaderProc(&m_dataReaders[ioName]); // instantiates the reader with the default constructor (no config processed at this point)
         }
@@ -87,13 +100,14 @@ DataReader<ElemType>::DataReader(const ConfigRecordType& config)
         wstring ioName = L"ioName";
         // backward support to use only one type of data reader
         // get the name for the reader we want to use, default to UCIFastReader
-        GetReaderProc getReaderProc = (GetReaderProc) Plugin::Load(config(L"readerType", L"UCIFastReader"), GetReaderName((ElemType) 0));
+        GetReaderProc getReaderProc = (GetReaderProc) Plugin::Load(config(L"readerType", L"UCIFastReader"), GetReaderName<ElemType>(config));
         m_ioNames.push_back(ioName);
         getReaderProc(&m_dataReaders[ioName]);
     }
 
-    // now pass that to concurrent reader so we can read ahead
-    // m_DataReader = new ConcurrentReader<ElemType>(m_DataReader);
+    // read the next minibatch in the background while the caller works on the current one
+    m_readAhead = config(L"readAhead", false);
+
     // NOW we can init
     // TODO: merge with the code above, but we first need to get the nbrUttPerMinibatch initialized inside each reader
     for (const auto& ioName : m_ioNames)
@@ -116,6 +130,7 @@ template DataReader<double>::DataReader(const ScriptableObjects::IConfigRecord&)
 template <class ElemType>
 DataReader<ElemType>::~DataReader()
 {
+    CancelReadAhead();
     // free up resources
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->Destroy();
@@ -128,6 +143,7 @@ DataReader<ElemType>::~DataReader()
 template <class ElemType>
 void DataReader<ElemType>::StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples)
 {
+    CancelReadAhead();
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->StartMinibatchLoop(mbSize, epoch, requestedEpochSamples);
 }
@@ -157,6 +173,7 @@ bool DataReader<ElemType>::SupportsDistributedMBRead() const
 template <class ElemType>
 void DataReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t epoch, size_t subsetNum, size_t numSubsets, size_t requestedEpochSamples /* = requestDataSize*/)
 {
+    CancelReadAhead();
     for (size_t i = 0; i < m_ioNames.size(); i++)
     {
         m_dataReaders[m_ioNames[i]]->StartDistributedMinibatchLoop(mbSize, epoch, subsetNum, numSubsets, requestedEpochSamples);
@@ -167,9 +184,115 @@ void DataReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t e
 // matrices - [in] a map with named matrix types (i.e. 'features', 'labels') mapped to the corresponding matrix,
 //             [out] each matrix resized if necessary containing data.
 // returns - true if there are more minibatches, false if no more minibatchs remain
+// With readAhead, the data comes from the second set of matrices, swapped in without a copy, and the next minibatch is started on a
+// background thread. DataEnd(endDataSentence), which every minibatch loop calls after each minibatch, is then done by that thread
+// just before it reads, so that the readers see the same sequence of calls as without read-ahead.
 template <class ElemType>
 bool DataReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
 {
+    if (!m_readAhead)
+        return ReadMinibatch(matrices);
+
+    bool moreData;
+    if (m_pendingMinibatch.valid())
+    {
+        TimelineScope scope("WaitForReadAhead", "reader");
+        moreData = m_pendingMinibatch.get();
+        if (m_aheadMatrices.size() != matrices.size())
+            LogicError("DataReader: GetMinibatch called with a different set of inputs within one minibatch loop, which readAhead does not support.");
+    }
+    else // first minibatch of this loop: set up the second buffers like the caller's and read synchronously
+    {
+        m_aheadMatrices.clear();
+        m_aheadMatrixPtrs.clear();
+        for (const auto& iter : matrices)
+        {
+            auto& mat = *iter.second;
+            auto aheadMat = make_shared<Matrix<ElemType>>(0, 0, mat.GetDeviceId(), mat.GetMatrixType(), mat.GetFormat());
+            m_aheadMatrices[iter.first] = aheadMat;
+            m_aheadMatrixPtrs[iter.first] = aheadMat.get();
+        }
+        if (!m_aheadLayout)
+            m_aheadLayout = make_shared<MBLayout>();
+        moreData = ReadAheadMinibatch(false);
+    }
+    if (!moreData)
+        return false; // (no further read-ahead until the next StartMinibatchLoop())
+
+    for (const auto& iter : matrices)
+    {
+        auto aheadIter = m_aheadMatrices.find(iter.first);
+        if (aheadIter == m_aheadMatrices.end())
+            LogicError("DataReader: GetMinibatch called with a different set of inputs within one minibatch loop, which readAhead does not support.");
+        std::swap(*iter.second, *aheadIter->second);
+    }
+    if (!m_currentLayout)
+        m_currentLayout = make_shared<MBLayout>();
+    std::swap(m_currentLayout, m_aheadLayout);
+    m_currentNumParallelSequences = m_aheadNumParallelSequences;
+
+    // the readers are now positioned after the minibatch the caller gets; remember that in case the caller asks for it
+    m_hasCurrentState = GetReaderStates(m_currentState);
+
+    m_pendingMinibatch = std::async(std::launch::async, [this]()
+                                    {
+                                        TimelineThread thread("read-ahead");
+                                        return ReadAheadMinibatch(true);
+                                    });
+    return true;
+}
+
+// ReadAheadMinibatch - read the next minibatch into the second buffers, with its layout (runs on the read-ahead thread)
+// sentenceEnd - forward DataEnd(endDataSentence) for the minibatch the caller now has before reading
+template <class ElemType>
+bool DataReader<ElemType>::ReadAheadMinibatch(bool sentenceEnd)
+{
+    if (sentenceEnd)
+    {
+        for (size_t i = 0; i < m_ioNames.size(); i++)
+            m_dataReaders[m_ioNames[i]]->DataEnd(endDataSentence);
+    }
+    if (!ReadMinibatch(m_aheadMatrixPtrs))
+        return false;
+    for (size_t i = 0; i < m_ioNames.size(); i++)
+        m_dataReaders[m_ioNames[i]]->CopyMBLayoutTo(m_aheadLayout);
+    m_aheadNumParallelSequences = ReaderNumParallelSequences();
+    return true;
+}
+
+// WaitForReadAhead - let a read-ahead in flight finish, so that the readers can be called from this thread
+// The readers are then one minibatch ahead of the caller, so only calls that do not depend on their position in the data may follow.
+template <class ElemType>
+void DataReader<ElemType>::WaitForReadAhead()
+{
+    if (m_pendingMinibatch.valid())
+        m_pendingMinibatch.wait();
+}
+
+// CancelReadAhead - drop a read-ahead in flight (and the minibatch it read), e.g. before starting a new minibatch loop
+template <class ElemType>
+void DataReader<ElemType>::CancelReadAhead()
+{
+    if (m_pendingMinibatch.valid())
+    {
+        try
+        {
+            m_pendingMinibatch.get();
+        }
+        catch (const exception& e) // the minibatch is discarded, and so is an error reading it
+        {
+            fprintf(stderr, "DataReader: discarding the minibatch read ahead, which failed: %s\n", e.what());
+        }
+    }
+    m_currentLayout.reset();
+    m_currentNumParallelSequences = 0;
+}
+
+// ReadMinibatch - GetMinibatch() from all readers, without read-ahead
+template <class ElemType>
+bool DataReader<ElemType>::ReadMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
+{
+    TimelineScope scope("ReadMinibatch", "reader");
     bool bRet = true;
     vector<size_t> vNbrSentences;
     size_t nbr = 0;
@@ -204,6 +327,8 @@ bool DataReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*
 template <class ElemType>
 bool DataReader<ElemType>::GetMinibatch4SE(std::vector<shared_ptr<const msra::dbn::latticepair>>& latticeinput, vector<size_t>& uids, vector<size_t>& boundaries, vector<size_t>& extrauttmap)
 {
+    if (m_readAhead)
+        InvalidArgument("DataReader: readAhead cannot be used for sequence training, since the lattices belong to the minibatch the reader has read last.");
     bool bRet = true;
     for (size_t i = 0; i < m_ioNames.size(); i++)
     {
@@ -218,6 +343,7 @@ bool DataReader<ElemType>::GetMinibatch4SE(std::vector<shared_ptr<const msra::db
 template <class ElemType>
 bool DataReader<ElemType>::GetHmmData(msra::asr::simplesenonehmm* hmm)
 {
+    WaitForReadAhead();
     bool bRet = true;
     for (size_t i = 0; i < m_ioNames.size(); i++)
     {
@@ -228,6 +354,15 @@ bool DataReader<ElemType>::GetHmmData(msra::asr::simplesenonehmm* hmm)
 
 template <class ElemType>
 size_t DataReader<ElemType>::GetNumParallelSequences()
+{
+    if (m_readAhead && m_currentLayout) // (the readers are already at the next minibatch)
+        return m_currentNumParallelSequences;
+    WaitForReadAhead();
+    return ReaderNumParallelSequences();
+}
+
+template <class ElemType>
+size_t DataReader<ElemType>::ReaderNumParallelSequences()
 {
     size_t nNbr = 0;
     for (size_t i = 0; i < m_ioNames.size(); i++)
@@ -253,6 +388,7 @@ bool DataReader<ElemType>::RequireSentenceSeg() const
 template <class ElemType>
 void DataReader<ElemType>::InitProposals(std::map<std::wstring, Matrix<ElemType>*>* matrices)
 {
+    WaitForReadAhead();
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->InitProposals(matrices);
 }
@@ -260,6 +396,7 @@ void DataReader<ElemType>::InitProposals(std::map<std::wstring, Matrix<ElemType>
 template <class ElemType>
 int DataReader<ElemType>::GetSentenceEndIdFromOutputLabel()
 {
+    WaitForReadAhead();
     int iRet = -1;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         iRet = m_dataReaders[m_ioNames[i]]->GetSentenceEndIdFromOutputLabel();
@@ -269,6 +406,7 @@ int DataReader<ElemType>::GetSentenceEndIdFromOutputLabel()
 template <class ElemType>
 bool DataReader<ElemType>::GetProposalObs(std::map<std::wstring, Matrix<ElemType>*>* matrices, const size_t tidx, vector<size_t>& history)
 {
+    WaitForReadAhead();
     bool bRet = true;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         bRet &= m_dataReaders[m_ioNames[i]]->GetProposalObs(matrices, tidx, history);
@@ -278,6 +416,12 @@ bool DataReader<ElemType>::GetProposalObs(std::map<std::wstring, Matrix<ElemType
 template <class ElemType>
 void DataReader<ElemType>::CopyMBLayoutTo(MBLayoutPtr pMBLayout)
 {
+    if (m_readAhead && m_currentLayout)
+    {
+        pMBLayout->CopyFrom(m_currentLayout);
+        return;
+    }
+    WaitForReadAhead();
     // BUGBUG: This copies all data reader's layout info on top of each other, keeping only the last one; likely not what was intended.
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->CopyMBLayoutTo(pMBLayout);
@@ -286,16 +430,68 @@ void DataReader<ElemType>::CopyMBLayoutTo(MBLayoutPtr pMBLayout)
 template <class ElemType>
 void DataReader<ElemType>::SetRandomSeed(int seed)
 {
+    WaitForReadAhead();
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->SetRandomSeed(seed);
 }
 
+// GetReaderStates - GetState() of all readers, each under its own name
+template <class ElemType>
+bool DataReader<ElemType>::GetReaderStates(ReaderState& state)
+{
+    state.clear();
+    for (size_t i = 0; i < m_ioNames.size(); i++)
+    {
+        ReaderState readerState;
+        if (!m_dataReaders[m_ioNames[i]]->GetState(readerState))
+            return false;
+        for (const auto& iter : readerState)
+            state[m_ioNames[i] + L"." + iter.first] = iter.second;
+    }
+    return true;
+}
+
+// GetState - get the position of the readers after the minibatch last returned
+// With readAhead, the readers are already past that, so this is the state they had when the read-ahead was started.
+template <class ElemType>
+bool DataReader<ElemType>::GetState(ReaderState& state)
+{
+    if (m_pendingMinibatch.valid())
+    {
+        state = m_currentState;
+        return m_hasCurrentState;
+    }
+    return GetReaderStates(state);
+}
+
+// SetState - continue reading from a state obtained through GetState(); a minibatch read ahead is dropped
+template <class ElemType>
+bool DataReader<ElemType>::SetState(const ReaderState& state)
+{
+    CancelReadAhead();
+    for (size_t i = 0; i < m_ioNames.size(); i++)
+    {
+        const wstring prefix = m_ioNames[i] + L".";
+        ReaderState readerState;
+        for (const auto& iter : state)
+        {
+            if (iter.first.compare(0, prefix.size(), prefix) == 0)
+                readerState[iter.first.substr(prefix.size())] = iter.second;
+        }
+        if (!m_dataReaders[m_ioNames[i]]->SetState(readerState))
+            return false;
+    }
+    return true;
+}
+
 template <class ElemType>
 bool DataReader<ElemType>::GetMinibatchCopy(
     std::vector<std::vector<std::pair<wstring, size_t>>>& uttInfo,
     std::map<std::wstring, Matrix<ElemType>*>& matrices,
     MBLayoutPtr pMBLayout)
 {
+    if (m_readAhead)
+        InvalidArgument("DataReader: readAhead cannot be used with GetMinibatchCopy(), which reads minibatches in the reader's own order.");
     bool ans = false;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         ans = (m_dataReaders[m_ioNames[i]]->GetMinibatchCopy(uttInfo, matrices, pMBLayout) || ans);
@@ -308,6 +504,7 @@ bool DataReader<ElemType>::SetNetOutput(
     const Matrix<ElemType>& outputs,
     const MBLayoutPtr pMBLayout)
 {
+    WaitForReadAhead();
     bool ans = false;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         ans = (m_dataReaders[m_ioNames[i]]->SetNetOutput(uttInfo, outputs, pMBLayout) || ans);
@@ -328,6 +525,7 @@ const std::map<typename DataReader<ElemType>::LabelIdType, typename DataReader<E
 template <class ElemType>
 void DataReader<ElemType>::SetLabelMapping(const std::wstring& sectionName, const std::map<LabelIdType, LabelType>& labelMapping)
 {
+    WaitForReadAhead();
     for (size_t i = 0; i < m_ioNames.size(); i++)
         m_dataReaders[m_ioNames[i]]->SetLabelMapping(sectionName, labelMapping);
 }
@@ -343,6 +541,7 @@ void DataReader<ElemType>::SetLabelMapping(const std::wstring& sectionName, cons
 template <class ElemType>
 bool DataReader<ElemType>::GetData(const std::wstring& sectionName, size_t numRecords, void* data, size_t& dataBufferSize, size_t recordStart)
 {
+    WaitForReadAhead();
     bool bRet = true;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         bRet &= m_dataReaders[m_ioNames[i]]->GetData(sectionName, numRecords, data, dataBufferSize, recordStart);
@@ -352,6 +551,9 @@ bool DataReader<ElemType>::GetData(const std::wstring& sectionName, size_t numRe
 template <class ElemType>
 bool DataReader<ElemType>::DataEnd(EndDataType endDataType)
 {
+    if (m_readAhead && m_currentLayout && endDataType == endDataSentence)
+        return true; // (forwarded by the read-ahead of the next minibatch, see GetMinibatch())
+    WaitForReadAhead();
     bool bRet = true;
     for (size_t i = 0; i < m_ioNames.size(); i++)
         bRet &= m_dataReaders[m_ioNames[i]]->DataEnd(endDataType);
@@ -120,6 +120,14 @@ void Eval<ElemType>::StartEvaluateMinibatchLoop(const std::wstring& outputNodeNa
     m_eval->StartEvaluateMinibatchLoop(outputNodeName);
 }
 
+// StartEvaluateMinibatchLoop - Prepare network for Evaluate() calls that ask for several outputs at once
+// outputNodeNames - names of the nodes that will be evaluated
+template <class ElemType>
+void Eval<ElemType>::StartEvaluateMinibatchLoop(const std::vector<std::wstring>& outputNodeNames)
+{
+    m_eval->StartEvaluateMinibatchLoop(outputNodeNames);
+}
+
 // Evaluate - Evalute using the model with the given inputs and outputs
 // inputs - map from node name to input vector
 // outputs - map from node name to output vector, outputs vectors need to be preallocated by caller, sizing will happen during evaluation
@@ -136,6 +144,76 @@ void Eval<ElemType>::ResetState()
     m_eval->ResetState();
 }
 
+// GetNodeHandle - look up a node once, for use in EvalBuffer::node
+template <class ElemType>
+size_t Eval<ElemType>::GetNodeHandle(const std::wstring& nodeName)
+{
+    return m_eval->GetNodeHandle(nodeName);
+}
+
+// Evaluate - evaluate numSamples samples from and into caller-owned buffers
+template <class ElemType>
+void Eval<ElemType>::Evaluate(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs)
+{
+    m_eval->Evaluate(numSamples, inputs, outputs);
+}
+
+// Warmup - allocate everything the evaluation of up to maxSamples samples needs, by evaluating that many once
+template <class ElemType>
+void Eval<ElemType>::Warmup(size_t maxSamples)
+{
+    m_eval->Warmup(maxSamples);
+}
+
+// GetLatencyHistograms - snapshot of the latencies of the calls so far, with latencyStatistics=true
+template <class ElemType>
+std::vector<EvalLatencyHistogram> Eval<ElemType>::GetLatencyHistograms()
+{
+    return m_eval->GetLatencyHistograms();
+}
+
+// ResetLatencyHistograms - start collecting anew
+template <class ElemType>
+void Eval<ElemType>::ResetLatencyHistograms()
+{
+    m_eval->ResetLatencyHistograms();
+}
+
+// OpenSession - start a new stream of frames with its own recurrent state
+template <class ElemType>
+size_t Eval<ElemType>::OpenSession()
+{
+    return m_eval->OpenSession();
+}
+
+// CloseSession - drop the state of a session
+template <class ElemType>
+void Eval<ElemType>::CloseSession(size_t session)
+{
+    m_eval->CloseSession(session);
+}
+
+// EvaluateSessions - advance several sessions by one chunk of frames each
+template <class ElemType>
+void Eval<ElemType>::EvaluateSessions(const std::vector<size_t>& sessions, const std::vector<size_t>& numFrames, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs)
+{
+    m_eval->EvaluateSessions(sessions, numFrames, inputs, outputs);
+}
+
+// BeamSearch - decode the continuations of several sessions at once
+template <class ElemType>
+std::vector<std::vector<BeamSearchHypothesis>> Eval<ElemType>::BeamSearch(const std::vector<size_t>& sessions, const BeamSearchOptions& options)
+{
+    return m_eval->BeamSearch(sessions, options);
+}
+
+// CreateWorkspace - create another evaluator sharing the model parameters; the caller must Destroy() it
+template <class ElemType>
+IEvaluateModel<ElemType>* Eval<ElemType>::CreateWorkspace()
+{
+    return m_eval->CreateWorkspace();
+}
+
 //The explicit instantiation
 template class Eval<double>;
 template class Eval<float>;
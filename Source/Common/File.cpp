@@ -20,6 +20,7 @@
 #endif
 #ifdef __unix__
 #include <unistd.h>
+#include <fcntl.h>
 #endif
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -118,6 +119,12 @@ void File::Init(const wchar_t* filename, int fileOptions)
                     m_file = fopenOrDie(filename, options.c_str());
                     m_seekable = true;
                 });
+#ifdef __unix__
+    // On Windows, the 'S' flag above already tells the OS that we are going to read sequentially.
+    // Here we ask for the same: a bigger kernel read-ahead window, which fills while we are parsing.
+    if ((fileOptions & fileOptionsSequential) && m_seekable)
+        posix_fadvise(fileno(m_file), 0, 0, POSIX_FADV_SEQUENTIAL); // (only a hint; OK if it fails)
+#endif
 }
 
 // skip to given delimiter character
@@ -161,14 +168,14 @@ void File::Flush()
 // str - string to store the line
 void File::GetLine(wstring& str)
 {
-    str = fgetlinew(m_file);
+    fgetline(m_file, str, m_wlineBuffer);
 }
 
 // GetLine - get a line from the file
 // str - string
 void File::GetLine(string& str)
 {
-    str = fgetline(m_file);
+    fgetline(m_file, str, m_lineBuffer);
 }
 
 // GetLines - get all lines from a file
@@ -0,0 +1,159 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// AlignedMemory.h -- cache-line aligned allocations for large CPU buffers (matrix elements, reader chunks), optionally on huge pages
+// Multi-GB parameter and feature buffers on 4 KB pages need a TLB entry per page; on 2 MB pages they need 512 times fewer.
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <string>
+#include <new>
+#include "Basics.h" // for InvalidArgument()
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// HugePageMode -- how allocations of at least hugePageMinBytes are backed
+//  - none: the OS default pages
+//  - transparent: 2 MB-aligned and marked for transparent huge pages (Linux madvise(MADV_HUGEPAGE); elsewhere same as none)
+//  - reserved: from the pool the administrator reserved (Linux MAP_HUGETLB, Windows large pages, which need the 'Lock pages
+//    in memory' privilege); falls back to 'transparent' when the pool is exhausted
+// -----------------------------------------------------------------------
+
+enum class HugePageMode
+{
+    none,
+    transparent,
+    reserved
+};
+
+static inline HugePageMode ParseHugePageMode(const std::wstring& s)
+{
+    if (s == L"none")
+        return HugePageMode::none;
+    else if (s == L"transparent")
+        return HugePageMode::transparent;
+    else if (s == L"reserved")
+        return HugePageMode::reserved;
+    InvalidArgument("Unknown hugePages '%ls'. Must be one of none, transparent, reserved.", s.c_str());
+}
+
+// alignment of all allocations: a cache line, and the width of AVX-512 registers
+static const size_t MemoryAlignment = 64;
+
+struct AlignedMemoryOptions
+{
+    HugePageMode hugePages;
+    size_t hugePageMinBytes;
+};
+
+// the settings of this module (non-static inline, so there is one copy per executable or DLL)
+inline AlignedMemoryOptions& GetAlignedMemoryOptions()
+{
+    static AlignedMemoryOptions options = {HugePageMode::none, 64 * 1024 * 1024};
+    return options;
+}
+
+inline void SetAlignedMemoryHugePages(HugePageMode hugePages, size_t hugePageMinBytes)
+{
+    GetAlignedMemoryOptions().hugePages = hugePages;
+    GetAlignedMemoryOptions().hugePageMinBytes = hugePageMinBytes;
+}
+
+// Each allocation starts with this header, MemoryAlignment bytes before the pointer handed out, so that FreeAlignedMemory() needs no size.
+struct AlignedMemoryHeader
+{
+    enum Kind
+    {
+        heap,      // _aligned_malloc() / posix_memalign()
+        mapped,    // mmap() (Linux huge-page pool)
+        committed  // VirtualAlloc() (Windows large pages)
+    };
+    Kind kind;
+    size_t mappedBytes; // (mapped only) size of the mapping
+};
+static_assert(sizeof(AlignedMemoryHeader) <= MemoryAlignment, "AlignedMemoryHeader must fit in front of the aligned elements");
+
+static inline void* AlignedMemoryFromBase(void* base, AlignedMemoryHeader::Kind kind, size_t mappedBytes)
+{
+    AlignedMemoryHeader* header = (AlignedMemoryHeader*) base;
+    header->kind = kind;
+    header->mappedBytes = mappedBytes;
+    return (char*) base + MemoryAlignment;
+}
+
+// allocate 'bytes' (uninitialized, except for memory from the huge-page pool, which is zero) aligned to MemoryAlignment; throws std::bad_alloc
+inline void* AllocateAlignedMemory(size_t bytes)
+{
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    const size_t totalBytes = bytes + MemoryAlignment;
+    const AlignedMemoryOptions& options = GetAlignedMemoryOptions();
+    const HugePageMode hugePages = bytes >= options.hugePageMinBytes ? options.hugePages : HugePageMode::none;
+#ifdef _WIN32
+    if (hugePages == HugePageMode::reserved)
+    {
+        const size_t largePageSize = GetLargePageMinimum();
+        if (largePageSize > 0)
+        {
+            const size_t mappedBytes = (totalBytes + largePageSize - 1) / largePageSize * largePageSize;
+            void* base = VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (base)
+                return AlignedMemoryFromBase(base, AlignedMemoryHeader::committed, mappedBytes);
+        }
+    }
+    void* base = _aligned_malloc(totalBytes, MemoryAlignment);
+    if (!base)
+        throw std::bad_alloc();
+#else
+    if (hugePages == HugePageMode::reserved)
+    {
+        const size_t mappedBytes = (totalBytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+        void* base = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED)
+            return AlignedMemoryFromBase(base, AlignedMemoryHeader::mapped, mappedBytes);
+    }
+    // for transparent huge pages, whole 2 MB pages, so that the advice does not extend to the neighbors
+    const bool useHugePages = hugePages != HugePageMode::none;
+    const size_t allocatedBytes = useHugePages ? (totalBytes + hugePageSize - 1) / hugePageSize * hugePageSize : totalBytes;
+    void* base = nullptr;
+    if (posix_memalign(&base, useHugePages ? hugePageSize : MemoryAlignment, allocatedBytes) != 0)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (useHugePages)
+        madvise(base, allocatedBytes, MADV_HUGEPAGE); // (best effort: without THP support this just fails)
+#endif
+#endif
+    UNUSED(hugePageSize);
+    return AlignedMemoryFromBase(base, AlignedMemoryHeader::heap, 0);
+}
+
+inline void FreeAlignedMemory(void* p)
+{
+    if (!p)
+        return;
+    void* base = (char*) p - MemoryAlignment;
+    const AlignedMemoryHeader* header = (const AlignedMemoryHeader*) base;
+#ifdef _WIN32
+    if (header->kind == AlignedMemoryHeader::committed)
+        VirtualFree(base, 0, MEM_RELEASE);
+    else
+        _aligned_free(base);
+#else
+    if (header->kind == AlignedMemoryHeader::mapped)
+        munmap(base, header->mappedBytes);
+    else
+        free(base);
+#endif
+}
+
+} } }
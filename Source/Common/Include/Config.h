@@ -373,7 +373,7 @@ public:
         // close braces and quote
         static const std::string closingBraces = CLOSINGBRACES;
 
-        const auto charsToLookFor = closingBraces + openBraces; // all chars we match for
+        static const std::string charsToLookFor = closingBraces + openBraces; // all chars we match for
 
         // get brace index for first character of input string
         const auto braceFound = openBraces.find(str[tokenStart]);
@@ -511,7 +511,8 @@ public:
                     // Hence there is an ugly fix for it below. This will go away when we replace all configuration parsing by BrainScript.
                     const static std::string customSeperators = "`~!@$%^&*_-+|:;,?.";
 
-                    if (customSeperators.find(stringParse[tokenStart]) != npos && stringParse.substr(tokenStart).find("..") != 0 && stringParse.substr(tokenStart).find(".\\") != 0 && stringParse.substr(tokenStart).find("./") != 0 && stringParse.substr(tokenStart).find("\\\\") != 0 // [fseide] otherwise this will nuke leading . or .. or \\ in a pathname... Aargh!
+                    // (compare() rather than substr().find(), which would copy the entire rest of the string)
+                    if (customSeperators.find(stringParse[tokenStart]) != npos && stringParse.compare(tokenStart, 2, "..") != 0 && stringParse.compare(tokenStart, 2, ".\\") != 0 && stringParse.compare(tokenStart, 2, "./") != 0 && stringParse.compare(tokenStart, 2, "\\\\") != 0 // [fseide] otherwise this will nuke leading . or .. or \\ in a pathname... Aargh!
                         )
                     {
                         char separator = stringParse[tokenStart];
@@ -1039,14 +1040,14 @@ public:
                 "\"ResolveVariablesInSingleLine\" shouldn't be called with a string containing a newline character");
         }
 
+        static const std::string closingBraceOrForbiddenCharacters = std::string(closingBraceVar) + forbiddenCharactersInVarName;
         std::string newConfigLine = StripComments(configLine);
         std::size_t start = newConfigLine.find_first_of(openBraceVar);
         std::size_t end = 0;
         while (start != std::string::npos)
         {
             // search for whitespace or closing brace.
-            end = newConfigLine.find_first_of(std::string(closingBraceVar) + forbiddenCharactersInVarName,
-                                              start + openBraceVarSize);
+            end = newConfigLine.find_first_of(closingBraceOrForbiddenCharacters, start + openBraceVarSize);
 
             // ensure that a closing brace exists for every opening brace.
             // Also ensure that there is no whitespace between the opening and closing braces.
@@ -1115,10 +1116,18 @@ public:
         if (configString.find_first_of("\n") != std::string::npos)
         {
             // if 'configString' contains newlines, put them back after resolving each line.
-            std::vector<std::string> configLines = msra::strfun::split(configString, "\n");
-            for (auto configLine : configLines)
+            // (Same as splitting on newlines, i.e. empty lines are dropped, but without copying all lines first.)
+            newConfigString.reserve(configString.size());
+            std::string configLine;
+            for (size_t lineStart = configString.find_first_not_of('\n'); lineStart != std::string::npos;)
             {
-                newConfigString += ResolveVariablesInSingleLine(configLine) + "\n";
+                size_t lineEnd = configString.find('\n', lineStart);
+                if (lineEnd == std::string::npos)
+                    lineEnd = configString.size();
+                configLine.assign(configString, lineStart, lineEnd - lineStart);
+                newConfigString += ResolveVariablesInSingleLine(configLine);
+                newConfigString += '\n';
+                lineStart = configString.find_first_not_of('\n', lineEnd);
             }
         }
         else
@@ -29,6 +29,7 @@
 #include "ScriptableObjects.h"
 #include <map>
 #include <string>
+#include <future>
 
 // forward-declare these lattice-related types to avoid having to include and pollute everything with lattice-related headers
 namespace msra { namespace dbn {
@@ -64,6 +65,10 @@ enum EndDataType
     endDataSentence, // end of sentence
 };
 
+// ReaderState - a reader's position within a minibatch loop, see IDataReader::GetState()
+// Each reader stores whatever identifies its position under names of its choosing, e.g. a file offset or a cursor per parallel sequence.
+typedef std::map<std::wstring, std::vector<size_t>> ReaderState;
+
 // Data Reader interface
 // implemented by DataReader and underlying classes
 template <class ElemType>
@@ -152,6 +157,18 @@ public:
         return false;
     }
 
+    // GetState - get the position in the current minibatch loop, i.e. after the minibatch last returned (for checkpointing in the middle of an epoch)
+    // SetState - continue from such a position; called right after StartMinibatchLoop() with the same arguments as when the state was taken
+    // Readers that cannot do this return false; the caller must then get back to the position by reading the minibatches again.
+    virtual bool GetState(ReaderState& /*state*/)
+    {
+        return false;
+    }
+    virtual bool SetState(const ReaderState& /*state*/)
+    {
+        return false;
+    }
+
     bool GetFrame(std::map<std::wstring, Matrix<ElemType>*>& /*matrices*/, const size_t /*tidx*/, vector<size_t>& /*history*/)
     {
         NOT_IMPLEMENTED;
@@ -203,6 +220,26 @@ private:
     vector<wstring> m_ioNames;                          // TODO: why are these needed, why not loop over m_dataReaders?
     map<wstring, IDataReader<ElemType>*> m_dataReaders; // readers
 
+    // read-ahead (readAhead=true): GetMinibatch() returns the minibatch read while the caller was busy with the previous one,
+    // and starts reading the next one on a background thread into a second set of matrices
+    bool m_readAhead;
+    std::future<bool> m_pendingMinibatch;                     // read of the next minibatch, if one is in flight
+    map<wstring, shared_ptr<Matrix<ElemType>>> m_aheadMatrices; // the second buffer of each input, filled by the read-ahead
+    map<wstring, Matrix<ElemType>*> m_aheadMatrixPtrs;          // (same, in the form GetMinibatch() takes)
+    MBLayoutPtr m_aheadLayout;                                 // layout of the minibatch read ahead
+    size_t m_aheadNumParallelSequences;
+    MBLayoutPtr m_currentLayout;                               // layout of the minibatch last returned; null before the first one
+    size_t m_currentNumParallelSequences;
+    ReaderState m_currentState;                                // the readers' state before the read-ahead in flight, see GetState()
+    bool m_hasCurrentState;                                    // (false if a reader does not support GetState())
+
+    bool ReadMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices);
+    size_t ReaderNumParallelSequences();
+    bool ReadAheadMinibatch(bool sentenceEnd);
+    void WaitForReadAhead();
+    void CancelReadAhead();
+    bool GetReaderStates(ReaderState& state);
+
     // Init - Reader Initialize for multiple data sets
     // config - [in] configuration parameters for the datareader
     // Sample format below for UCIReader:
@@ -314,6 +351,9 @@ public:
 
     void SetRandomSeed(int);
 
+    virtual bool GetState(ReaderState& state) override;
+    virtual bool SetState(const ReaderState& state) override;
+
     bool GetProposalObs(std::map<std::wstring, Matrix<ElemType>*>*, const size_t, vector<size_t>&);
     void InitProposals(std::map<std::wstring, Matrix<ElemType>*>* matrices);
 };
@@ -0,0 +1,443 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// DataServer.h -- TCP connection and wire format between a data server (CNTK action "serveData") and its clients (RemoteReader)
+//
+// A data server runs a reader in a process (or on a machine) of its own, and streams its minibatches to the trainers, where
+// RemoteReader replays them as an IDataReader. Each client connection gets a reader of its own on the server, which reads the
+// subset of the client's rank. Each message is [tag][generation][payload bytes] and the payload, all numbers uint64 (in native
+// byte order; both sides must agree):
+//
+//   client -> server: StartEpoch: [mbSize][epoch][subsetNum][numSubsets][requestedEpochSamples][credits][sizeof(ElemType)]
+//                                 [number of inputs] and each input as [name][isSparse]
+//                     Credit: [n] -- may send n more minibatches
+//   server -> client: Minibatch, EndOfEpoch (no payload), or Error: [message]
+//
+// Back-pressure is by credits: the server reads at most as many minibatches ahead as the client has granted (prefetchMinibatches to
+// begin with, then one more for each it consumed). A new StartEpoch, with the next generation, ends the previous epoch on both sides;
+// the client skips what the server had sent of it.
+// The payload of a minibatch is its MBLayout (dimensions and all sequences, including gaps), then each input as [name][isSparse]
+// [numRows][numCols] and either its values (column-major) or its CSC arrays [nz][column starts][row indices][values]. Everything
+// is padded to 8 bytes.
+//
+// On Windows, this must be included before Windows.h, or Windows.h with WIN32_LEAN_AND_MEAN (which keeps out WinSock.h).
+//
+
+#pragma once
+
+#include "Basics.h"
+#include "Matrix.h"
+#include "Sequences.h"
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// message tags
+enum DataServerTag : uint64_t
+{
+    // client -> server
+    DataServerStartEpoch = 1,
+    DataServerCredit = 2,
+    // server -> client
+    DataServerMinibatch = 11,
+    DataServerEndOfEpoch = 12,
+    DataServerError = 13
+};
+
+// -----------------------------------------------------------------------
+// DataSocket -- a connected (or listening) TCP socket; all failures are RuntimeErrors
+// -----------------------------------------------------------------------
+
+class DataSocket
+{
+#ifdef _WIN32
+    typedef SOCKET Handle;
+    static Handle InvalidHandle() { return INVALID_SOCKET; }
+    static int LastError() { return WSAGetLastError(); }
+    static void CloseHandle(Handle h) { closesocket(h); }
+    static const int SendFlags = 0;
+#else
+    typedef int Handle;
+    static Handle InvalidHandle() { return -1; }
+    static int LastError() { return errno; }
+    static void CloseHandle(Handle h) { close(h); }
+    static const int SendFlags = MSG_NOSIGNAL; // a closed peer is an error, not a SIGPIPE
+#endif
+    Handle m_handle;
+    std::string m_peer; // host:port, for messages
+
+    DataSocket(Handle handle, const std::string& peer)
+        : m_handle(handle), m_peer(peer)
+    {
+    }
+    DataSocket(const DataSocket&);
+    void operator=(const DataSocket&);
+
+    static void Startup()
+    {
+#ifdef _WIN32
+        static bool started = false;
+        if (!started)
+        {
+            WSADATA wsaData;
+            if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+                RuntimeError("DataSocket: WSAStartup failed.");
+            started = true;
+        }
+#endif
+    }
+
+    // minibatches are few and large; do not let Nagle hold back the last segment of one
+    static void SetNoDelay(Handle handle)
+    {
+        int flag = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*) &flag, sizeof(flag));
+    }
+
+public:
+    ~DataSocket()
+    {
+        if (m_handle != InvalidHandle())
+            CloseHandle(m_handle);
+    }
+
+    const std::string& GetPeer() const { return m_peer; }
+
+    // connect to host:port, retrying for up to timeoutSeconds while the server is not up yet
+    static std::unique_ptr<DataSocket> Connect(const std::string& address, size_t timeoutSeconds)
+    {
+        Startup();
+        const size_t colon = address.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+            InvalidArgument("DataSocket: Server address '%s' is not of the form host:port.", address.c_str());
+        const std::string host = address.substr(0, colon);
+        const std::string port = address.substr(colon + 1);
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSeconds);
+        for (;;)
+        {
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            struct addrinfo* addresses = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) == 0)
+            {
+                for (struct addrinfo* a = addresses; a; a = a->ai_next)
+                {
+                    Handle handle = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (handle == InvalidHandle())
+                        continue;
+                    if (connect(handle, a->ai_addr, (int) a->ai_addrlen) == 0)
+                    {
+                        freeaddrinfo(addresses);
+                        SetNoDelay(handle);
+                        return std::unique_ptr<DataSocket>(new DataSocket(handle, address));
+                    }
+                    CloseHandle(handle);
+                }
+                freeaddrinfo(addresses);
+            }
+            if (std::chrono::steady_clock::now() >= deadline)
+                RuntimeError("DataSocket: Cannot connect to data server %s (error %d).", address.c_str(), LastError());
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+
+    // a socket that accepts connections on the given port, on all interfaces
+    static std::unique_ptr<DataSocket> Listen(int port)
+    {
+        Startup();
+        Handle handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (handle == InvalidHandle())
+            RuntimeError("DataSocket: Cannot create a socket (error %d).", LastError());
+        int reuse = 1;
+        setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons((unsigned short) port);
+        if (bind(handle, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(handle, SOMAXCONN) != 0)
+        {
+            const int error = LastError();
+            CloseHandle(handle);
+            RuntimeError("DataSocket: Cannot listen on port %d (error %d).", port, error);
+        }
+        return std::unique_ptr<DataSocket>(new DataSocket(handle, "*:" + std::to_string(port)));
+    }
+
+    // the next connection to a listening socket
+    std::unique_ptr<DataSocket> Accept()
+    {
+        struct sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        Handle handle = accept(m_handle, (struct sockaddr*) &address, &length);
+        if (handle == InvalidHandle())
+            RuntimeError("DataSocket: Accepting a connection failed (error %d).", LastError());
+        SetNoDelay(handle);
+        char host[NI_MAXHOST], port[NI_MAXSERV];
+        std::string peer = "client";
+        if (getnameinfo((struct sockaddr*) &address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+            peer = std::string(host) + ":" + port;
+        return std::unique_ptr<DataSocket>(new DataSocket(handle, peer));
+    }
+
+    void Send(const void* data, size_t bytes)
+    {
+        const char* p = (const char*) data;
+        while (bytes > 0)
+        {
+            const int chunk = (int) std::min(bytes, (size_t) (1 << 30));
+            const int sent = send(m_handle, p, chunk, SendFlags);
+            if (sent <= 0)
+                RuntimeError("DataSocket: Sending to %s failed (error %d).", m_peer.c_str(), LastError());
+            p += sent;
+            bytes -= sent;
+        }
+    }
+
+    // receive exactly 'bytes'; false if the peer closed the connection before the first of them
+    bool ReceiveOrEnd(void* data, size_t bytes)
+    {
+        char* p = (char*) data;
+        const size_t total = bytes;
+        while (bytes > 0)
+        {
+            const int chunk = (int) std::min(bytes, (size_t) (1 << 30));
+            const int received = recv(m_handle, p, chunk, 0);
+            if (received == 0 && bytes == total)
+                return false;
+            if (received <= 0)
+                RuntimeError("DataSocket: Receiving from %s failed (error %d).", m_peer.c_str(), received == 0 ? 0 : LastError());
+            p += received;
+            bytes -= received;
+        }
+        return true;
+    }
+    void Receive(void* data, size_t bytes)
+    {
+        if (!ReceiveOrEnd(data, bytes))
+            RuntimeError("DataSocket: %s closed the connection.", m_peer.c_str());
+    }
+    // the next message: false if the peer closed the connection instead
+    bool ReceiveMessageOrEnd(uint64_t& tag, uint64_t& generation, std::vector<char>& payload)
+    {
+        uint64_t header[3];
+        if (!ReceiveOrEnd(header, sizeof(header)))
+            return false;
+        tag = header[0];
+        generation = header[1];
+        payload.resize((size_t) header[2]);
+        Receive(payload.data(), payload.size());
+        return true;
+    }
+
+    // whether something can be received right away
+    bool HasData()
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(m_handle, &readable);
+        struct timeval timeout = {0, 0};
+        return select((int) m_handle + 1, &readable, nullptr, nullptr, &timeout) > 0;
+    }
+};
+
+// -----------------------------------------------------------------------
+// DataMessage -- a message being built, and DataMessageReader -- one being decoded (see the wire format above)
+// -----------------------------------------------------------------------
+
+class DataMessage
+{
+    std::vector<char> m_bytes;
+
+public:
+    void PutBytes(const void* data, size_t bytes)
+    {
+        const char* p = (const char*) data;
+        m_bytes.insert(m_bytes.end(), p, p + bytes);
+        m_bytes.resize((m_bytes.size() + 7) / 8 * 8, 0);
+    }
+    void Put(uint64_t value)
+    {
+        PutBytes(&value, sizeof(value));
+    }
+    void PutString(const std::string& s)
+    {
+        Put(s.size());
+        PutBytes(s.data(), s.size());
+    }
+    size_t Size() const { return m_bytes.size(); }
+    const char* Data() const { return m_bytes.data(); }
+
+    // send [tag][generation][payload bytes] and this as the payload
+    void Send(DataSocket& socket, uint64_t tag, uint64_t generation) const
+    {
+        const uint64_t header[3] = {tag, generation, (uint64_t) m_bytes.size()};
+        socket.Send(header, sizeof(header));
+        socket.Send(m_bytes.data(), m_bytes.size());
+    }
+};
+
+class DataMessageReader
+{
+    const char* m_p;
+    const char* m_end;
+
+public:
+    DataMessageReader(const std::vector<char>& bytes)
+        : m_p(bytes.data()), m_end(bytes.data() + bytes.size())
+    {
+    }
+    const void* GetBytes(size_t bytes)
+    {
+        const size_t padded = (bytes + 7) / 8 * 8;
+        if ((size_t) (m_end - m_p) < padded)
+            RuntimeError("DataMessageReader: Message is truncated.");
+        const char* p = m_p;
+        m_p += padded;
+        return p;
+    }
+    uint64_t Get()
+    {
+        return *(const uint64_t*) GetBytes(sizeof(uint64_t));
+    }
+    std::string GetString()
+    {
+        const size_t length = (size_t) Get();
+        return std::string((const char*) GetBytes(length), length);
+    }
+    template <class T>
+    const T* GetArray(size_t count)
+    {
+        return (const T*) GetBytes(count * sizeof(T));
+    }
+};
+
+// -----------------------------------------------------------------------
+// minibatch payloads
+// -----------------------------------------------------------------------
+
+// encode the given inputs and layout; the matrices must be on the CPU
+template <class ElemType>
+void PackDataServerMinibatch(DataMessage& message, const std::map<std::wstring, Matrix<ElemType>*>& matrices, const MBLayout& layout)
+{
+    message.Put(layout.GetNumParallelSequences());
+    message.Put(layout.GetNumTimeSteps());
+    const auto& sequences = layout.GetAllSequences();
+    message.Put(sequences.size());
+    for (const auto& seq : sequences)
+    {
+        message.Put(seq.seqId);
+        message.Put(seq.s);
+        message.Put((uint64_t) seq.tBegin);
+        message.Put(seq.tEnd);
+    }
+
+    message.Put(matrices.size());
+    std::vector<CPUSPARSE_INDEX_TYPE> colStarts, rows;
+    std::vector<ElemType> values;
+    for (const auto& input : matrices)
+    {
+        const Matrix<ElemType>& matrix = *input.second;
+        if (matrix.GetDeviceId() != CPUDEVICE)
+            LogicError("PackDataServerMinibatch: Input '%ls' is not on the CPU.", input.first.c_str());
+        const bool isSparse = matrix.GetMatrixType() == SPARSE;
+        message.PutString(msra::strfun::utf8(input.first));
+        message.Put(isSparse);
+        message.Put(matrix.GetNumRows());
+        message.Put(matrix.GetNumCols());
+        if (isSparse)
+        {
+            matrix.GetCSCFormat(colStarts, rows, values);
+            message.Put(values.size());
+            message.PutBytes(colStarts.data(), colStarts.size() * sizeof(CPUSPARSE_INDEX_TYPE));
+            message.PutBytes(rows.data(), rows.size() * sizeof(CPUSPARSE_INDEX_TYPE));
+            message.PutBytes(values.data(), values.size() * sizeof(ElemType));
+        }
+        else
+            message.PutBytes(matrix.BufferPointer(), matrix.GetNumElements() * sizeof(ElemType));
+    }
+}
+
+// decode a minibatch into the given inputs (on whichever device they are) and layout; all inputs must be in it
+template <class ElemType>
+void UnpackDataServerMinibatch(DataMessageReader& message, std::map<std::wstring, Matrix<ElemType>*>& matrices, MBLayout& layout)
+{
+    const size_t numParallelSequences = (size_t) message.Get();
+    const size_t numTimeSteps = (size_t) message.Get();
+    layout.Init(numParallelSequences, numTimeSteps);
+    const size_t numSequences = (size_t) message.Get();
+    for (size_t i = 0; i < numSequences; i++)
+    {
+        MBLayout::SequenceInfo seq;
+        seq.seqId = (UniqueSequenceId) message.Get();
+        seq.s = (size_t) message.Get();
+        seq.tBegin = (ptrdiff_t) message.Get();
+        seq.tEnd = (size_t) message.Get();
+        layout.AddSequence(seq);
+    }
+
+    const size_t numInputs = (size_t) message.Get();
+    size_t numFound = 0;
+    for (size_t i = 0; i < numInputs; i++)
+    {
+        const std::wstring name = msra::strfun::utf16(message.GetString());
+        const bool isSparse = message.Get() != 0;
+        const size_t numRows = (size_t) message.Get();
+        const size_t numCols = (size_t) message.Get();
+        auto found = matrices.find(name);
+        Matrix<ElemType>* matrix = found == matrices.end() ? nullptr : found->second;
+        if (matrix)
+            numFound++;
+        if (isSparse)
+        {
+            const size_t nz = (size_t) message.Get();
+            const CPUSPARSE_INDEX_TYPE* colStarts = message.GetArray<CPUSPARSE_INDEX_TYPE>(numCols + 1);
+            const CPUSPARSE_INDEX_TYPE* rows = message.GetArray<CPUSPARSE_INDEX_TYPE>(nz);
+            const ElemType* values = message.GetArray<ElemType>(nz);
+            if (!matrix)
+                continue;
+            if (matrix->GetMatrixType() != SPARSE || matrix->GetFormat() != matrixFormatSparseCSC)
+                matrix->SwitchToMatrixType(SPARSE, matrixFormatSparseCSC, false);
+            matrix->SetMatrixFromCSCFormat(colStarts, rows, values, nz, numRows, numCols);
+        }
+        else
+        {
+            const ElemType* values = message.GetArray<ElemType>(numRows * numCols);
+            if (!matrix)
+                continue;
+            if (matrix->GetMatrixType() != DENSE)
+                matrix->SwitchToMatrixType(DENSE, matrixFormatDense, false);
+            matrix->SetValue(numRows, numCols, matrix->GetDeviceId(), const_cast<ElemType*>(values), matrixFlagNormal);
+        }
+    }
+    if (numFound != matrices.size())
+        RuntimeError("UnpackDataServerMinibatch: The minibatch lacks %d of the requested inputs.", (int) (matrices.size() - numFound));
+}
+
+} } }
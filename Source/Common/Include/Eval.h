@@ -23,6 +23,7 @@
 #endif
 
 #include "Basics.h"
+#include <cmath>
 #include <map>
 #include <vector>
 #include <string>
@@ -36,6 +37,85 @@ enum NodeGroup
     nodeSpecified
 };
 
+// EvalBuffer - caller-owned memory holding the values of one input or output node, for IEvaluateModel::Evaluate(numSamples, ...)
+// Sample j occupies data[j * colStride ... j * colStride + dim - 1], where dim is the node's dimension.
+template <class ElemType>
+struct EvalBuffer
+{
+    size_t node;      // handle obtained from GetNodeHandle()
+    ElemType* data;   // first value of the first sample
+    size_t colStride; // distance between samples, in elements; 0 means dim (densely packed)
+    int deviceId;     // -1 if 'data' is CPU memory, otherwise the GPU that 'data' lives on
+};
+
+// BeamSearchOptions - what IEvaluateModel::BeamSearch() decodes with
+// The model predicts the scores of the next token from the previous one, a one-hot vector; any other context is in the recurrent state.
+struct BeamSearchOptions
+{
+    size_t inputNode;         // handle of the input node that takes the previous token, one-hot
+    size_t outputNode;        // handle of the output node that gives the scores of the next token
+    bool logProbabilities;    // true if the outputs are log-probabilities (e.g. LogSoftmax), false if probabilities (Softmax)
+    size_t beamWidth;         // hypotheses of each request kept after each step
+    size_t maxLength;         // tokens at most (not counting the start token)
+    size_t startToken;        // previous token of the first step
+    size_t endToken;          // token that ends a hypothesis
+    size_t numBest;           // results per request, at most beamWidth
+};
+
+// BeamSearchHypothesis - one result of IEvaluateModel::BeamSearch()
+struct BeamSearchHypothesis
+{
+    std::vector<size_t> tokens; // decoded tokens, ending with the end token unless maxLength was reached
+    double score;               // sum of the tokens' log-probabilities
+};
+
+// EvalLatencyHistogram - distribution of the latencies of one part of the evaluation, see IEvaluateModel::GetLatencyHistograms()
+// Bucket i counts the latencies of more than BucketUpperBound(i - 1) and up to BucketUpperBound(i) seconds; the bounds are 1 us * 2^(i/4),
+// i.e. 19% apart, up to about 20 seconds. The last bucket also counts everything longer.
+struct EvalLatencyHistogram
+{
+    static const size_t numBuckets = 98;
+
+    std::wstring name;          // "total", "input", "forward" or "output", or "forward:" and an operation name (e.g. "forward:Times")
+    size_t count;               // number of latencies
+    double totalSeconds;        // their sum
+    double maxSeconds;          // the largest of them
+    std::vector<size_t> counts; // [bucket] number of latencies in it
+
+    EvalLatencyHistogram(const std::wstring& name = std::wstring())
+        : name(name), count(0), totalSeconds(0), maxSeconds(0), counts(numBuckets, 0)
+    {
+    }
+
+    static double BucketUpperBound(size_t bucket)
+    {
+        return 1e-6 * pow(2.0, bucket / 4.0);
+    }
+
+    void Add(double seconds)
+    {
+        const double bucket = seconds > 1e-6 ? ceil(4 * log2(seconds * 1e6)) : 0; // (in floating point, since log2() of an outlier may be huge)
+        counts[(size_t) (bucket < numBuckets - 1 ? bucket : numBuckets - 1)]++;
+        count++;
+        totalSeconds += seconds;
+        maxSeconds = seconds > maxSeconds ? seconds : maxSeconds;
+    }
+
+    // the latency 'fraction' (e.g. 0.99) of all latencies are at most, up to the precision of the buckets (the upper bound of its bucket, but at most maxSeconds)
+    double Percentile(double fraction) const
+    {
+        const double rank = fraction * count;
+        size_t numBelow = 0;
+        for (size_t bucket = 0; bucket < numBuckets; bucket++)
+        {
+            numBelow += counts[bucket];
+            if (numBelow > 0 && numBelow >= rank)
+                return BucketUpperBound(bucket) < maxSeconds ? BucketUpperBound(bucket) : maxSeconds;
+        }
+        return maxSeconds;
+    }
+};
+
 // IEvaluateModel - interface used by decoders and other components that need just evaluator functionality in DLL form
 template <class ElemType>
 class IEvaluateModel // Evaluate Model Interface
@@ -47,8 +127,27 @@ public:
     virtual void LoadModel(const std::wstring& modelFileName) = 0;
     virtual void GetNodeDimensions(std::map<std::wstring, size_t>& dimensions, NodeGroup nodeGroup) = 0;
     virtual void StartEvaluateMinibatchLoop(const std::wstring& outputNodeName) = 0;
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& outputNodeNames) = 0;
     virtual void Evaluate(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs) = 0;
     virtual void ResetState() = 0;
+
+    // evaluation from and into caller-owned buffers, see Eval<ElemType> below
+    virtual size_t GetNodeHandle(const std::wstring& nodeName) = 0;
+    virtual void Evaluate(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs) = 0;
+    virtual void Warmup(size_t maxSamples) = 0;
+
+    // latency statistics, see Eval<ElemType> below
+    virtual std::vector<EvalLatencyHistogram> GetLatencyHistograms() = 0;
+    virtual void ResetLatencyHistograms() = 0;
+
+    // streaming evaluation of recurrent models for many sessions at once, see Eval<ElemType> below
+    virtual size_t OpenSession() = 0;
+    virtual void CloseSession(size_t session) = 0;
+    virtual void EvaluateSessions(const std::vector<size_t>& sessions, const std::vector<size_t>& numFrames, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs) = 0;
+    virtual std::vector<std::vector<BeamSearchHypothesis>> BeamSearch(const std::vector<size_t>& sessions, const BeamSearchOptions& options) = 0;
+
+    // one evaluator per thread, sharing the model parameters, see Eval<ElemType> below
+    virtual IEvaluateModel<ElemType>* CreateWorkspace() = 0;
 };
 
 // GetEval - get a evaluator type from the DLL
@@ -80,6 +179,9 @@ public:
     // deviceId=auto ( can be [0,all,cpu,0:2:3,auto] define accellerators (GPUs) to use, or the CPU
     // modelPath=c:\models\model.dnn (model path, if not specified, must call LoadModel() method before Evaluate()
     // minibatchSize=1024 (minibatch size used during evaluation if < passed data size)
+    // dynamicBatching=false (if true, Evaluate() is thread-safe, and concurrent calls are evaluated together as one minibatch; not for recurrent models)
+    // maxBatchSamples=minibatchSize, maxBatchWaitMicroseconds=1000 (with dynamicBatching: evaluate when this many samples are pending, or the oldest call has waited this long)
+    // latencyStatistics=false, latencyStatisticsPerNodeType=false (collect latency histograms, see GetLatencyHistograms())
     Eval(const std::string& config);
     virtual ~Eval();
 
@@ -96,11 +198,73 @@ public:
     // ouputNodeName - name of node that will be evaluated
     virtual void StartEvaluateMinibatchLoop(const std::wstring& outputNodeName);
 
+    // StartEvaluateMinibatchLoop - Prepare network for Evaluate() calls that ask for several outputs at once (e.g. posteriors and a bottleneck layer)
+    // outputNodeNames - names of the nodes that will be evaluated; Evaluate() computes all of them in one forward pass, sharing their common inputs
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& outputNodeNames);
+
     // Evaluate - Evalute using the model with the given inputs and outputs
     // inputs - map from node name to input vector
     // outputs - map from node name to output vector, outputs vectors need to be preallocated by caller, sizing will happen during evaluation
+    // All requested outputs are computed in one forward pass. They must be output nodes of the model, or other nodes without consumers.
     virtual void Evaluate(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs);
     virtual void Init(const std::string& config);
     virtual void ResetState();
+
+    // GetNodeHandle - look up a node once, for use in EvalBuffer::node; valid until the next LoadModel()
+    virtual size_t GetNodeHandle(const std::wstring& nodeName);
+
+    // Evaluate - evaluate numSamples samples, reading the inputs from and writing the outputs to caller-owned buffers
+    // This avoids the name lookups and copies of the Evaluate() above: a densely packed buffer on the network's device
+    // is used in place, other CPU buffers take a single copy. The samples form one sequence, i.e. no state is carried
+    // over from previous calls. Buffers on a GPU other than the network's device cannot be used.
+    virtual void Evaluate(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs);
+
+    // Warmup - prepare for latency-critical use: evaluate maxSamples samples once, for the outputs of the last StartEvaluateMinibatchLoop()
+    // (or the model's output nodes). This allocates all node values and workspaces for minibatches of up to maxSamples samples, creates the
+    // GPU library handles, and tunes the convolution algorithms, so that later calls of up to that many samples do not allocate or tune
+    // (for the map-based Evaluate() above, up to its own buffers). Call it after StartEvaluateMinibatchLoop().
+    virtual void Warmup(size_t maxSamples);
+
+    // GetLatencyHistograms - snapshot of the latencies of the Evaluate() and EvaluateSessions() calls so far, with latencyStatistics=true
+    // One histogram covers each whole call ("total"). For the buffer-based calls, there are also histograms of its parts: copying the inputs
+    // into the network ("input"), the forward pass on the device ("forward"), and copying the outputs ("output"). With
+    // latencyStatisticsPerNodeType=true, the forward passes are also broken down into the time of each type of node ("forward:Times", ...).
+    // That times every node, which costs a little, and can only be enabled in one evaluator of a process at a time.
+    // Each call adds one latency to each histogram; with dynamicBatching, each call of Evaluate() adds its total time only.
+    virtual std::vector<EvalLatencyHistogram> GetLatencyHistograms();
+
+    // ResetLatencyHistograms - start collecting anew, e.g. after a Warmup() or for each export interval of a service
+    virtual void ResetLatencyHistograms();
+
+    // OpenSession - start a new stream of frames (e.g. one utterance of an online recognizer) with its own recurrent state
+    // Returns a handle for EvaluateSessions(); valid until CloseSession() or the next LoadModel().
+    virtual size_t OpenSession();
+
+    // CloseSession - drop the state of a session
+    virtual void CloseSession(size_t session);
+
+    // EvaluateSessions - advance each of the given sessions by its next numFrames[i] frames, evaluated together as parallel
+    // sequences of one minibatch. PastValue nodes see the frames of earlier calls for the same session; models with
+    // FutureValue nodes cannot be evaluated this way. Buffers are as for Evaluate(numSamples, ...) above, with
+    // sessions.size() * max(numFrames) samples: frame t of sessions[i] is sample t * sessions.size() + i. Samples past
+    // the end of a shorter chunk are ignored in the inputs and undefined in the outputs.
+    // All calls for a session must evaluate the same output nodes.
+    virtual void EvaluateSessions(const std::vector<size_t>& sessions, const std::vector<size_t>& numFrames, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs);
+
+    // BeamSearch - decode the continuations of many requests at once, each from the state of one of the given sessions (e.g. an encoder's
+    // state after EvaluateSessions() of the source, or a language model's after the prefix; these sessions must have evaluated options.outputNode,
+    // and are left unchanged). All hypotheses of all requests are the parallel sequences of one minibatch per step, each continuing the
+    // recurrent state of its parent. The best beamWidth next tokens of each hypothesis are selected on the network's device, so that
+    // only those come back to the host. A request ends when it has numBest finished hypotheses that no active one can beat any more (the
+    // scores are sums of log-probabilities, which only decrease), or after maxLength steps. Returns [request] its up to numBest best hypotheses, best first.
+    virtual std::vector<std::vector<BeamSearchHypothesis>> BeamSearch(const std::vector<size_t>& sessions, const BeamSearchOptions& options);
+
+    // CreateWorkspace - create another evaluator of the loaded model that shares its parameters, for use by another thread
+    // An evaluator is not thread-safe (except with dynamicBatching), but different evaluators can be used concurrently.
+    // A workspace costs only the memory for the activations of its own copy of the network, which is loaded from the
+    // model file once more (its parameters are freed again right away). It has the configuration of this evaluator,
+    // needs its own StartEvaluateMinibatchLoop(), stays valid across a LoadModel() of this one, and must be released
+    // with Destroy(). The parameters are read-only while they are shared.
+    virtual IEvaluateModel<ElemType>* CreateWorkspace();
 };
 } } }
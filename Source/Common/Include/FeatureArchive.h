@@ -0,0 +1,354 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// FeatureArchive.h -- chunked binary archive of feature frames (e.g. the posteriors or bottleneck features of the 'write' command), in float32, FP16 or 8 bits
+//
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include "Half.h"
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// FeatureArchive -- replaces one small HTK file per utterance by one large file of consecutive frames
+//
+// File layout (little endian):
+//  - header: magic, version, feature dimension/kind/frame shift, encoding, number of chunks and frames, offset of the chunk index
+//  - chunks of up to chunkFrames frames each, one after the other; per chunk
+//     - float32: featDim floats per frame
+//     - float16: featDim FP16 values per frame (half the size, see Half.h)
+//     - uint8: the minimum and the quantization step of each dimension within the chunk as floats, then featDim bytes per frame
+//       (a quarter of the size; the error is at most half a step, i.e. 1/510 of the range of the dimension within the chunk)
+//  - the chunk index: for each chunk, its offset in the file, its first frame, and its number of frames
+// Utterances are ranges of frames, which may span chunks. They are listed in an HTK script file (name=archive[s,e], one per line),
+// so that HTKMLFReader reads them like ranges of an HTK archive file (htkfeatreader recognizes the file by its magic).
+// The writer encodes a chunk while the previous one is written on a background thread, with one large write per chunk. The file
+// is written to a temp name and renamed when closed.
+// -----------------------------------------------------------------------
+
+class FeatureArchive
+{
+public:
+    enum Encoding
+    {
+        float32 = 0,
+        float16 = 1,
+        uint8 = 2,
+    };
+    static Encoding ParseEncoding(const std::wstring& name)
+    {
+        if (name == L"float32")
+            return float32;
+        else if (name == L"float16")
+            return float16;
+        else if (name == L"uint8")
+            return uint8;
+        InvalidArgument("FeatureArchive: encoding must be 'float32', 'float16', or 'uint8', not '%ls'", name.c_str());
+    }
+    static const char* EncodingName(Encoding encoding)
+    {
+        return encoding == float16 ? "float16" : encoding == uint8 ? "uint8" : "float32";
+    }
+
+    // whether the first bytes of a file (at least MagicSize of them) are those of an archive
+    static const size_t MagicSize = 8;
+    static bool HasMagic(const char* bytes)
+    {
+        return memcmp(bytes, "CNTKFARC", MagicSize) == 0;
+    }
+
+private:
+    static const size_t FeatKindSize = 16;
+    struct Header
+    {
+        char magic[MagicSize]; // "CNTKFARC"
+        uint32_t version;
+        uint32_t featDim;
+        uint32_t sampPeriod;
+        uint32_t encoding;
+        char featKind[FeatKindSize];
+        uint64_t numChunks;
+        uint64_t numFrames;
+        uint64_t indexOffset;
+    };
+    struct ChunkEntry
+    {
+        uint64_t offset;
+        uint64_t firstFrame;
+        uint64_t numFrames;
+    };
+
+    // the quantization parameters of a uint8 chunk, before its frames
+    static size_t ParameterBytes(const Header& header)
+    {
+        return header.encoding == uint8 ? 2 * header.featDim * sizeof(float) : 0;
+    }
+    static size_t FrameBytes(const Header& header)
+    {
+        return header.featDim * (header.encoding == float32 ? sizeof(float) : header.encoding == float16 ? sizeof(uint16_t) : 1);
+    }
+
+public:
+    // -----------------------------------------------------------------------
+    // Writer -- appends utterances; Close() completes the file
+    // -----------------------------------------------------------------------
+
+    class Writer
+    {
+        std::wstring m_path;
+        std::wstring m_tempPath;
+        FILE* m_f;
+        Header m_header;
+        size_t m_chunkFrames;
+        std::vector<ChunkEntry> m_index;
+        uint64_t m_pos;             // where the next chunk goes
+        std::vector<float> m_frames; // frames of the current chunk, featDim per frame
+        std::vector<char> m_encoded; // the current chunk, encoded
+        std::vector<char> m_writing; // the previous chunk, being written by m_pendingWrite
+        std::future<void> m_pendingWrite;
+
+    public:
+        Writer(const std::wstring& path, size_t featDim, const std::string& featKind, unsigned int sampPeriod, Encoding encoding, size_t chunkFrames = 65536)
+            : m_path(path), m_tempPath(path + L".tmp"), m_f(nullptr), m_chunkFrames(std::max(chunkFrames, (size_t) 1)), m_pos(sizeof(Header))
+        {
+            if (featDim == 0)
+                InvalidArgument("FeatureArchive: the feature dimension must be positive.");
+            if (featKind.size() >= FeatKindSize)
+                InvalidArgument("FeatureArchive: feature kind '%s' too long.", featKind.c_str());
+            memset(&m_header, 0, sizeof(m_header));
+            memcpy(m_header.magic, "CNTKFARC", MagicSize);
+            m_header.version = 1;
+            m_header.featDim = (uint32_t) featDim;
+            m_header.sampPeriod = sampPeriod;
+            m_header.encoding = encoding;
+            strcpy(m_header.featKind, featKind.c_str());
+            m_frames.reserve(m_chunkFrames * featDim);
+            msra::files::make_intermediate_dirs(path);
+            m_f = fopenOrDie(m_tempPath, L"wb");
+            fwriteOrDie(&m_header, sizeof(m_header), 1, m_f); // (completed by Close())
+        }
+        ~Writer()
+        {
+            if (!m_f) // closed
+                return;
+            try
+            {
+                if (m_pendingWrite.valid())
+                    m_pendingWrite.get();
+            }
+            catch (...)
+            {
+            }
+            fclose(m_f);
+            _wunlink(m_tempPath.c_str());
+        }
+
+        size_t GetFeatDim() const { return m_header.featDim; }
+
+        // append the numFrames frames of an utterance, each the featDim values at frames + t * colStride; returns its first frame in the archive
+        size_t Write(const float* frames, size_t numFrames, size_t colStride)
+        {
+            const size_t featDim = m_header.featDim;
+            const size_t firstFrame = (size_t) m_header.numFrames;
+            for (size_t t = 0; t < numFrames; t++)
+            {
+                m_frames.insert(m_frames.end(), frames + t * colStride, frames + t * colStride + featDim);
+                if (m_frames.size() == m_chunkFrames * featDim)
+                    FlushChunk();
+            }
+            m_header.numFrames += numFrames;
+            return firstFrame;
+        }
+
+        // write the last chunk, the index and the header, and move the file into place
+        void Close()
+        {
+            if (!m_frames.empty())
+                FlushChunk();
+            if (m_pendingWrite.valid())
+                m_pendingWrite.get();
+            m_header.numChunks = m_index.size();
+            m_header.indexOffset = m_pos;
+            fsetpos(m_f, m_pos);
+            if (!m_index.empty())
+                fwriteOrDie(m_index.data(), sizeof(ChunkEntry), m_index.size(), m_f);
+            fsetpos(m_f, (uint64_t) 0);
+            fwriteOrDie(&m_header, sizeof(m_header), 1, m_f);
+            fflushOrDie(m_f);
+            fcloseOrDie(m_f);
+            m_f = nullptr;
+            renameOrDie(m_tempPath, m_path);
+        }
+
+    private:
+        // encode the frames collected so far as a chunk, and write it once the previous chunk is written
+        void FlushChunk()
+        {
+            const size_t featDim = m_header.featDim;
+            const size_t numFrames = m_frames.size() / featDim;
+            ChunkEntry entry;
+            entry.offset = m_pos;
+            entry.firstFrame = m_index.empty() ? 0 : m_index.back().firstFrame + m_index.back().numFrames;
+            entry.numFrames = numFrames;
+            m_index.push_back(entry);
+
+            m_encoded.resize(ParameterBytes(m_header) + numFrames * FrameBytes(m_header));
+            const float* frames = m_frames.data();
+            if (m_header.encoding == float32)
+                memcpy(m_encoded.data(), frames, m_frames.size() * sizeof(float));
+            else if (m_header.encoding == float16)
+            {
+                uint16_t* p = (uint16_t*) m_encoded.data();
+                for (size_t i = 0; i < m_frames.size(); i++)
+                    p[i] = half(frames[i]).bits;
+            }
+            else // uint8
+            {
+                float* mins = (float*) m_encoded.data();
+                float* steps = mins + featDim;
+                unsigned char* p = (unsigned char*) (steps + featDim);
+                for (size_t i = 0; i < featDim; i++)
+                {
+                    float lo = frames[i], hi = frames[i];
+                    for (size_t t = 1; t < numFrames; t++)
+                    {
+                        lo = std::min(lo, frames[t * featDim + i]);
+                        hi = std::max(hi, frames[t * featDim + i]);
+                    }
+                    mins[i] = lo;
+                    steps[i] = (hi - lo) / 255;
+                }
+                for (size_t t = 0; t < numFrames; t++)
+                    for (size_t i = 0; i < featDim; i++)
+                    {
+                        float code = steps[i] > 0 ? floorf((frames[t * featDim + i] - mins[i]) / steps[i] + 0.5f) : 0.0f;
+                        *p++ = (unsigned char) std::min(std::max(code, 0.0f), 255.0f);
+                    }
+            }
+            m_frames.clear();
+            m_pos += m_encoded.size();
+
+            // the file is appended to by one write at a time
+            if (m_pendingWrite.valid())
+                m_pendingWrite.get();
+            m_writing.swap(m_encoded);
+            m_pendingWrite = std::async(std::launch::async, [this]()
+                                        {
+                                            fwriteOrDie(m_writing.data(), 1, m_writing.size(), m_f);
+                                        });
+        }
+    };
+
+    // -----------------------------------------------------------------------
+    // Reader -- reads ranges of frames
+    // -----------------------------------------------------------------------
+
+    class Reader
+    {
+        std::wstring m_path;
+        auto_file_ptr m_f;
+        Header m_header;
+        std::vector<ChunkEntry> m_index;
+        size_t m_parameterChunk;   // chunk whose quantization parameters are in m_parameters
+        std::vector<float> m_parameters; // (uint8) minimum, then step, of each dimension of that chunk
+        std::vector<char> m_buffer;
+
+    public:
+        Reader(const std::wstring& path)
+            : m_path(path), m_f(fopenOrDie(path, L"rb")), m_parameterChunk(SIZE_MAX)
+        {
+            freadOrDie(&m_header, sizeof(m_header), 1, m_f);
+            if (!HasMagic(m_header.magic) || m_header.version != 1)
+                RuntimeError("FeatureArchive: %ls is not a feature archive of the expected version", path.c_str());
+            if (m_header.featKind[FeatKindSize - 1] != 0 || m_header.encoding > uint8 || m_header.featDim == 0 || m_header.indexOffset < sizeof(Header))
+                RuntimeError("FeatureArchive: %ls is truncated or corrupt", path.c_str());
+            m_index.resize((size_t) m_header.numChunks);
+            fsetpos(m_f, m_header.indexOffset);
+            if (!m_index.empty())
+                freadOrDie(m_index.data(), sizeof(ChunkEntry), m_index.size(), m_f);
+            uint64_t numFrames = 0;
+            for (const auto& entry : m_index)
+            {
+                if (entry.firstFrame != numFrames || entry.offset + ParameterBytes(m_header) + entry.numFrames * FrameBytes(m_header) > m_header.indexOffset)
+                    RuntimeError("FeatureArchive: %ls is truncated or corrupt", path.c_str());
+                numFrames += entry.numFrames;
+            }
+            if (numFrames != m_header.numFrames)
+                RuntimeError("FeatureArchive: %ls is truncated or corrupt", path.c_str());
+        }
+
+        size_t GetNumFrames() const { return (size_t) m_header.numFrames; }
+        size_t GetFeatDim() const { return m_header.featDim; }
+        std::string GetFeatKind() const { return m_header.featKind; }
+        unsigned int GetSampPeriod() const { return m_header.sampPeriod; }
+        Encoding GetEncoding() const { return (Encoding) m_header.encoding; }
+
+        // read frames [firstFrame, firstFrame + numFrames), each into the featDim values at frames + t * colStride
+        void Read(size_t firstFrame, size_t numFrames, float* frames, size_t colStride)
+        {
+            if (firstFrame + numFrames > m_header.numFrames)
+                RuntimeError("FeatureArchive: frames [%d, %d) are beyond the end (%d frames) of %ls", (int) firstFrame, (int) (firstFrame + numFrames), (int) m_header.numFrames, m_path.c_str());
+            const size_t featDim = m_header.featDim;
+            const size_t frameBytes = FrameBytes(m_header);
+            // the first chunk: the last one that begins at or before firstFrame
+            size_t k = std::upper_bound(m_index.begin(), m_index.end(), (uint64_t) firstFrame, [](uint64_t frame, const ChunkEntry& entry)
+                                        {
+                                            return frame < entry.firstFrame;
+                                        }) - m_index.begin() - 1;
+            while (numFrames > 0)
+            {
+                const ChunkEntry& entry = m_index[k];
+                const size_t begin = firstFrame - (size_t) entry.firstFrame;
+                const size_t n = std::min(numFrames, (size_t) entry.numFrames - begin);
+                if (m_header.encoding == uint8 && m_parameterChunk != k)
+                {
+                    m_parameters.resize(2 * featDim);
+                    fsetpos(m_f, entry.offset);
+                    freadOrDie(m_parameters.data(), sizeof(float), m_parameters.size(), m_f);
+                    m_parameterChunk = k;
+                }
+                m_buffer.resize(n * frameBytes);
+                fsetpos(m_f, entry.offset + ParameterBytes(m_header) + begin * frameBytes);
+                freadOrDie(m_buffer.data(), 1, m_buffer.size(), m_f);
+                for (size_t t = 0; t < n; t++)
+                {
+                    float* frame = frames + t * colStride;
+                    if (m_header.encoding == float32)
+                        memcpy(frame, m_buffer.data() + t * frameBytes, frameBytes);
+                    else if (m_header.encoding == float16)
+                    {
+                        const uint16_t* p = (const uint16_t*) (m_buffer.data() + t * frameBytes);
+                        half h;
+                        for (size_t i = 0; i < featDim; i++)
+                        {
+                            h.bits = p[i];
+                            frame[i] = (float) h;
+                        }
+                    }
+                    else // uint8
+                    {
+                        const unsigned char* p = (const unsigned char*) (m_buffer.data() + t * frameBytes);
+                        for (size_t i = 0; i < featDim; i++)
+                            frame[i] = m_parameters[i] + m_parameters[featDim + i] * p[i];
+                    }
+                }
+                frames += n * colStride;
+                firstFrame += n;
+                numFrames -= n;
+                k++;
+            }
+        }
+    };
+};
+
+} } }
@@ -34,7 +34,10 @@ enum FileOptions
     fileOptionsType = fileOptionsBinary | fileOptionsText | fileOptionsUnicode, // file types
     fileOptionsRead = 8,                                                        // open in read mode
     fileOptionsWrite = 16,                                                      // open in write mode
-    fileOptionsSequential = 32,                                                 // optimize for sequential reads (allocates big buffer)
+    fileOptionsSequential = 32,                                                 // optimize for sequential access (allocates big buffer, and asks the OS for aggressive read-ahead)
+    fileOptionsHalfPrecision = 64,                                              // write floating-point matrices in FP16 (binary files only)
+    fileOptionsMappableParameters = 128,                                        // write model parameters as page-aligned blobs that the loader can memory-map (binary files only)
+    fileOptionsQuantized8Bit = 256,                                             // write floating-point matrices as 8-bit integers with a scale per row (binary files only)
     fileOptionsReadWrite = fileOptionsRead | fileOptionsWrite,                  // read/write mode
 };
 
@@ -100,6 +103,8 @@ private:
     bool m_pcloseNeeded; // was opened with popen(), use pclose() when destructing
     bool m_seekable;     // this stream is seekable
     int m_options;       // FileOptions ored togther
+    std::vector<char> m_lineBuffer;     // for GetLine(), kept across lines (allocating it per line dominated reading config files)
+    std::vector<wchar_t> m_wlineBuffer; // same for wide lines
     void Init(const wchar_t* filename, int fileOptions);
 
 public:
@@ -120,6 +125,22 @@ public:
     void SkipToDelimiter(int delim);
 
     bool IsTextBased();
+    bool IsHalfPrecision() const
+    {
+        return (m_options & fileOptionsHalfPrecision) && !(m_options & (fileOptionsText | fileOptionsUnicode));
+    }
+    bool IsQuantized8Bit() const
+    {
+        return (m_options & fileOptionsQuantized8Bit) && !(m_options & (fileOptionsText | fileOptionsUnicode));
+    }
+    bool IsMappableParameters() const
+    {
+        return (m_options & fileOptionsMappableParameters) && !(m_options & (fileOptionsText | fileOptionsUnicode));
+    }
+    const std::wstring& GetName() const
+    {
+        return m_filename;
+    }
 
     bool IsUnicodeBOM(bool skip = false);
     bool IsEOF();
@@ -197,6 +218,33 @@ public:
         return *this;
     }
 
+    // bulk versions of operator<< and operator>> for arrays of basic types
+    // In binary files, these are a single fwrite()/fread() instead of one call (and retry loop) per element.
+    template <typename T>
+    File& WriteArray(const T* data, size_t count)
+    {
+        if (IsTextBased())
+        {
+            for (size_t i = 0; i < count; i++)
+                *this << data[i];
+        }
+        else if (count > 0)
+            fwriteOrDie(data, sizeof(T), count, m_file);
+        return *this;
+    }
+    template <typename T>
+    File& ReadArray(T* data, size_t count)
+    {
+        if (IsTextBased())
+        {
+            for (size_t i = 0; i < count; i++)
+                *this >> data[i];
+        }
+        else if (count > 0)
+            freadOrDie(data, sizeof(T), count, m_file);
+        return *this;
+    }
+
     void WriteString(const char* str, int size = 0);                   // zero terminated strings use size=0
     void ReadString(char* str, int size);                              // read up to size bytes, or a zero terminator (or space in text mode)
     void WriteString(const wchar_t* str, int size = 0);                // zero terminated strings use size=0
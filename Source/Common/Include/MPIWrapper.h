@@ -6,10 +6,18 @@
 // and the MPI dev package on Linux (sudo apt-get install libopenmpi-dev openmpi-bin openmpi-doc)
 #include "mpi.h"
 #pragma comment(lib, "msmpi.lib")
+#if !defined(_WIN32) && defined(OPEN_MPI)
+#include "mpi-ext.h" // MPIX_CUDA_AWARE_SUPPORT and MPIX_Query_cuda_support()
+#endif
+
+#include "TimelineTrace.h"
 
 #include <string>
 #include <array>
 #include <vector>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -19,6 +27,17 @@ struct MpiFail : public std::string
         : std::string(what)
     {
     }
+
+    static bool s_throwOnLostWorkers; // see MPIWrapper::EnableElasticity()
+};
+
+// thrown by the MPI functions in elastic mode when a worker has been lost, see MPIWrapper::ExcludeLostWorkers()
+struct MpiWorkerLost : public std::runtime_error
+{
+    MpiWorkerLost(const std::string &what)
+        : std::runtime_error(what)
+    {
+    }
 };
 
 static int operator||(int rc, const MpiFail &what)
@@ -31,6 +50,14 @@ static int operator||(int rc, const MpiFail &what)
     fprintf(stderr, "%s, MPI error %d\n", what.c_str(), rc);
     fflush(stderr);
 
+#ifdef MPIX_ERR_PROC_FAILED // (ULFM fault tolerance, e.g. Open MPI built with --with-ft=ulfm)
+    // in elastic mode, the remaining workers go on without the lost one instead of aborting
+    int errorClass = rc;
+    MPI_Error_class(rc, &errorClass);
+    if (MpiFail::s_throwOnLostWorkers && (errorClass == MPIX_ERR_PROC_FAILED || errorClass == MPIX_ERR_PROC_FAILED_PENDING || errorClass == MPIX_ERR_REVOKED))
+        throw MpiWorkerLost(what);
+#endif
+
     // (special case: we use that code to indicate a missing msmpi.dll...)
     if (rc != MPI_ERR_INTERN)
     {
@@ -49,11 +76,23 @@ static int operator||(int rc, const MpiFail &what)
     RuntimeError("%s", what.c_str());
 }
 
+// algorithm for summing up buffers across all workers, see MPIWrapper::AllReduce()
+enum class AllReduceAlgorithm : int
+{
+    Mpi,              // MPI_Allreduce(); the MPI library picks
+    Ring,             // reduce-scatter and all-gather around a ring; bandwidth-optimal, but 2 (N-1) steps
+    RecursiveHalving, // reduce-scatter by recursive halving, all-gather by recursive doubling; 2 log N steps
+    Auto              // RecursiveHalving for small messages, Ring for large ones
+};
+
 class MPIWrapper
 {
     int m_myRank;
     int m_numMPINodes;
     size_t m_numNodesInUse;
+    int m_jobId; // process id of rank 0; the same in all processes of this job
+    bool m_isCudaAware; // all workers' MPI libraries accept GPU device pointers
+    std::string m_elasticPortName; // the port on which the main node accepts joining workers, see OpenElasticPort()
 
     // MPI communicator that reflects the current subset selection
     MPI_Comm m_currentComm;
@@ -98,6 +137,21 @@ class MPIWrapper
         Sleep(s_myRank * 50);
     }
 
+    // Whether the MPI library can be passed GPU device pointers (CUDA-aware MPI, e.g. with GPUDirect RDMA).
+    // Open MPI can tell at runtime; other libraries cannot, for them CNTK_CUDA_AWARE_MPI=1 declares it (e.g. MVAPICH2 with MV2_USE_CUDA=1).
+    // CNTK_CUDA_AWARE_MPI=0 turns it off.
+    static bool QueryCudaAwareness()
+    {
+        const char* declared = getenv("CNTK_CUDA_AWARE_MPI");
+        if (declared && *declared)
+            return atoi(declared) != 0;
+#if defined(MPIX_CUDA_AWARE_SUPPORT) && MPIX_CUDA_AWARE_SUPPORT
+        return MPIX_Query_cuda_support() != 0;
+#else
+        return false;
+#endif
+    }
+
 public:
     MPIWrapper()
         : m_currentComm(MPI_COMM_WORLD)
@@ -139,11 +193,27 @@ public:
         // do an initial handshake
         Ping("mpihelper");
 
+        // agree on a name for this job, so that its processes on one machine can recognize each other, e.g. when picking GPUs
+        m_jobId = (int) GetCurrentProcessId();
+        Bcast(&m_jobId, 1, MainNodeRank());
+
+        // device pointers are only passed if all workers can take them
+        DetermineCudaAwareness();
+
         // stagger the jobs just a little to get a sort-of deterministic order e.g. in GPU allocation when running on one machine
         // continue 0.5 seconds apart
         ::Sleep((DWORD)(500 * CurrentNodeRank()));
     }
 
+    void DetermineCudaAwareness()
+    {
+        int isCudaAware = QueryCudaAwareness() ? 1 : 0;
+        MPI_Allreduce(MPI_IN_PLACE, &isCudaAware, 1, MPI_INT, MPI_MIN, m_currentComm) || MpiFail("MPIWrapper: MPI_Allreduce");
+        m_isCudaAware = (isCudaAware != 0);
+        if (m_isCudaAware)
+            fprintf(stderr, "mpihelper: MPI is CUDA-aware\n");
+    }
+
     // Note: we don't clear the sub-communication here although we should, because in case of a crash, this prevents the EXE from terminating.
     // It's OK since this class is a singleton anyway that gets instantiated exactly once at program startup.
     ~MPIWrapper()
@@ -244,7 +314,123 @@ public:
     {
         return 0;
     }
+    int JobId() const
+    {
+        return m_jobId;
+    }
+    // device pointers may be passed to the data-exchange functions that call MPI directly (not to the Ring and RecursiveHalving
+    // algorithms of AllReduce(), which add on the host); the caller must have completed the device's work on the buffers
+    bool IsCudaAware() const
+    {
+        return m_isCudaAware;
+    }
 
+    // -----------------------------------------------------------------------
+    // elastic membership: workers may leave (fail) and join while the job runs (SGD's ParallelTrain/elastic=true)
+    // The workers always form one communicator, which replaces MPI_COMM_WORLD. A worker that joins is a new MPI job of its
+    // own that connects to the port of the main node (MPI-2 dynamic processes) and is merged into the communicator with the
+    // highest rank. Lost workers are only survived with an MPI library that has ULFM fault tolerance (MPIX_ERR_PROC_FAILED):
+    // the MPI functions then throw MpiWorkerLost, and the remaining workers agree on a communicator without the lost ones.
+    // -----------------------------------------------------------------------
+
+    // called by all workers before elastic training (or when joining it), which must use all MPI nodes
+    void EnableElasticity()
+    {
+        if (!UsingAllNodes())
+            LogicError("EnableElasticity: Elastic training requires all MPI nodes.");
+#ifdef MPIX_ERR_PROC_FAILED
+        MPI_Comm_set_errhandler(m_currentComm, MPI_ERRORS_RETURN) || MpiFail("EnableElasticity: MPI_Comm_set_errhandler");
+        MpiFail::s_throwOnLostWorkers = true;
+#else
+        fprintf(stderr, "mpihelper: MPI without ULFM fault tolerance: workers can join, but the loss of one still ends the job\n");
+#endif
+    }
+
+    // main node: the name of the port that workers join on (opened at the first call, also by a main node that took over)
+    const std::string &OpenElasticPort()
+    {
+        if (!IsMainNode())
+            LogicError("OpenElasticPort: Only the main node accepts joining workers.");
+        if (m_elasticPortName.empty())
+        {
+            char portName[MPI_MAX_PORT_NAME + 1] = {0};
+            MPI_Open_port(MPI_INFO_NULL, portName) || MpiFail("OpenElasticPort: MPI_Open_port");
+            m_elasticPortName = portName;
+        }
+        return m_elasticPortName;
+    }
+
+    // all workers: take in the given number of workers (significant on the main node only) that are connecting in JoinElasticJob()
+    // Each is merged in by a collective operation of the workers so far, in which the ones already merged take part.
+    // Returns the number, as told by the main node.
+    size_t AcceptJoiningWorkers(size_t numJoining)
+    {
+        Bcast(&numJoining, 1, MainNodeRank());
+        const size_t numJoined = numJoining;
+        while (numJoining > 0)
+        {
+            MPI_Comm intercomm, merged;
+            MPI_Comm_accept(const_cast<char *>(m_elasticPortName.c_str()), MPI_INFO_NULL, (int) MainNodeRank(), m_currentComm, &intercomm) || MpiFail("AcceptJoiningWorkers: MPI_Comm_accept");
+            MPI_Intercomm_merge(intercomm, 0 /*we come first*/, &merged) || MpiFail("AcceptJoiningWorkers: MPI_Intercomm_merge");
+            MPI_Comm_free(&intercomm);
+            ReplaceCommunicator(merged);
+            fprintf(stderr, "mpihelper: a worker joined, now %d workers\n", (int) NumNodesInUse());
+            numJoining--;
+            Bcast(&numJoining, 1, MainNodeRank()); // (the new one learns how many more follow)
+        }
+        return numJoined;
+    }
+
+    // a new worker, alone in its MPI job: connect to the port of a running elastic job and become its worker of the highest rank
+    void JoinElasticJob(const std::string &portName)
+    {
+        if (m_numMPINodes != 1)
+            LogicError("JoinElasticJob: Workers join one at a time, each as an MPI job of its own.");
+        MPI_Comm intercomm, merged;
+        MPI_Comm_connect(const_cast<char *>(portName.c_str()), MPI_INFO_NULL, 0, MPI_COMM_SELF, &intercomm) || MpiFail("JoinElasticJob: MPI_Comm_connect");
+        MPI_Intercomm_merge(intercomm, 1 /*we come last*/, &merged) || MpiFail("JoinElasticJob: MPI_Intercomm_merge");
+        MPI_Comm_free(&intercomm);
+        ReplaceCommunicator(merged);
+        fprintf(stderr, "mpihelper: joined as worker %d of %d\n", (int) CurrentNodeRank(), (int) NumNodesInUse());
+        AcceptJoiningWorkers(0); // (the others that join together with us; the count is the main node's)
+    }
+
+    // all remaining workers, after MpiWorkerLost: go on with a communicator without the lost workers (the main node may change)
+    void ExcludeLostWorkers()
+    {
+#ifdef MPIX_ERR_PROC_FAILED
+        MPIX_Comm_revoke(m_currentComm); // (pending operations of the others fail, too, so that they get here)
+        MPI_Comm shrunk;
+        MPIX_Comm_shrink(m_currentComm, &shrunk) || MpiFail("ExcludeLostWorkers: MPIX_Comm_shrink");
+        const size_t numBefore = NumNodesInUse();
+        const bool wasMainNode = IsMainNode();
+        ReplaceCommunicator(shrunk);
+        if (IsMainNode() && !wasMainNode)
+            m_elasticPortName.clear(); // (the port of the lost main node is gone)
+        fprintf(stderr, "mpihelper: lost %d workers, %d remain; we are now worker %d\n", (int) (numBefore - NumNodesInUse()), (int) NumNodesInUse(), (int) CurrentNodeRank());
+#else
+        LogicError("ExcludeLostWorkers: MPI without ULFM fault tolerance cannot survive lost workers.");
+#endif
+    }
+
+private:
+    void ReplaceCommunicator(MPI_Comm comm)
+    {
+        if (m_currentComm != MPI_COMM_WORLD)
+            MPI_Comm_free(&m_currentComm); // (may fail for one with lost workers, which does not matter)
+        m_currentComm = comm;
+#ifdef MPIX_ERR_PROC_FAILED
+        if (MpiFail::s_throwOnLostWorkers)
+            MPI_Comm_set_errhandler(m_currentComm, MPI_ERRORS_RETURN) || MpiFail("ReplaceCommunicator: MPI_Comm_set_errhandler");
+#endif
+        MPI_Comm_rank(m_currentComm, &m_myRank);
+        MPI_Comm_size(m_currentComm, &m_numMPINodes);
+        m_numNodesInUse = m_numMPINodes;
+        s_myRank = m_myRank;
+        DetermineCudaAwareness();
+    }
+
+public:
     // -----------------------------------------------------------------------
     // data-exchange functions (wrappers around MPI functions)
     // -----------------------------------------------------------------------
@@ -281,6 +467,7 @@ public:
         // use MPI to compute the sum over all elements in (dataptr, totalnumelements) and redistribute to all nodes
         if ((NumNodesInUse() > 1) && (Communicator() != MPI_COMM_NULL))
         {
+            TimelineScope scope("MPI_Allreduce", "mpi");
             MPI_Allreduce(MPI_IN_PLACE, dataptr, (int) totalnumelements, GetDataType(dataptr), MPI_SUM, Communicator()) || MpiFail("allreduce: MPI_Allreduce");
         }
     }
@@ -291,22 +478,251 @@ public:
     {
         if ((NumNodesInUse() > 1 && (Communicator() != MPI_COMM_NULL)))
         {
+            TimelineScope scope("MPI_Allreduce", "mpi");
             MPI_Allreduce(MPI_IN_PLACE, pData, (int) nData, GetDataType(pData), MPI_SUM, Communicator()) || MpiFail("Allreduce: MPI_Allreduce");
         }
     }
 
+    // non-blocking version, to be completed with Wait()
+    template <class ElemType>
+    void AllReduceAsync(ElemType *pData, size_t nData, MPI_Request *request) const
+    {
+        *request = MPI_REQUEST_NULL;
+        if ((NumNodesInUse() > 1) && (Communicator() != MPI_COMM_NULL))
+        {
+            MPI_Iallreduce(MPI_IN_PLACE, pData, (int) nData, GetDataType(pData), MPI_SUM, Communicator(), request) || MpiFail("AllReduceAsync: MPI_Iallreduce");
+        }
+    }
+
+    // returns whether a non-blocking operation has completed; MPI implementations may need this to make progress
+    bool Test(MPI_Request *request) const
+    {
+        int completed = 0;
+        MPI_Test(request, &completed, MPI_STATUS_IGNORE) || MpiFail("Test: MPI_Test");
+        return completed != 0;
+    }
+
+    void Wait(MPI_Request *request) const
+    {
+        TimelineScope scope("MPI_Wait", "mpi");
+        MPI_Wait(request, MPI_STATUS_IGNORE) || MpiFail("Wait: MPI_Wait");
+    }
+
+    // allreduce of a raw buffer with a specific algorithm
+    template <class ElemType>
+    void AllReduce(ElemType *pData, size_t nData, AllReduceAlgorithm algorithm)
+    {
+        if ((NumNodesInUse() <= 1) || (Communicator() == MPI_COMM_NULL))
+            return;
+        TimelineScope scope("AllReduce", "mpi");
+        const size_t smallMessageSize = 64 * 1024; // bytes; below this, latency dominates
+        if (algorithm == AllReduceAlgorithm::Auto)
+            algorithm = (nData * sizeof(ElemType) < smallMessageSize) ? AllReduceAlgorithm::RecursiveHalving : AllReduceAlgorithm::Ring;
+        if (nData < NumNodesInUse()) // too small to be split across the workers
+            algorithm = AllReduceAlgorithm::Mpi;
+
+        if (algorithm == AllReduceAlgorithm::Ring)
+            RingAllReduce(pData, nData);
+        else if (algorithm == AllReduceAlgorithm::RecursiveHalving)
+            RecursiveHalvingAllReduce(pData, nData);
+        else
+            AllReduce(pData, nData);
+    }
+
+private:
+    // exchange a part of our buffer with another worker and add what we receive to another part of our buffer
+    template <class ElemType>
+    void SendAndReceiveAdd(ElemType *pData, size_t sendBegin, size_t sendEnd, size_t recvBegin, size_t recvEnd, int peer, std::vector<ElemType> &scratch)
+    {
+        scratch.resize(recvEnd - recvBegin);
+        MPI_Sendrecv(pData + sendBegin, (int) (sendEnd - sendBegin), GetDataType(pData), peer, 0,
+                     scratch.data(), (int) scratch.size(), GetDataType(pData), peer, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("SendAndReceiveAdd: MPI_Sendrecv");
+        for (size_t i = recvBegin; i < recvEnd; i++)
+            pData[i] += scratch[i - recvBegin];
+    }
+
+    // Ring all-reduce: the buffer is split into one chunk per worker; in N-1 steps, every worker sends one chunk to its successor, and adds
+    // the one it receives from its predecessor (reduce-scatter). Then every worker owns one complete chunk, and N-1 more steps pass them around (all-gather).
+    // Each worker sends and receives 2 (N-1)/N times the buffer size, independent of N.
+    template <class ElemType>
+    void RingAllReduce(ElemType *pData, size_t nData)
+    {
+        const int num = (int) NumNodesInUse();
+        const int rank = (int) CurrentNodeRank();
+        const int next = (rank + 1) % num;
+        const int prev = (rank + num - 1) % num;
+        auto chunkBegin = [nData, num](int c)
+        {
+            return nData * c / num;
+        };
+        std::vector<ElemType> scratch;
+        for (int step = 0; step < num - 1; step++)
+        {
+            int sendChunk = (rank - step + num) % num;
+            int recvChunk = (rank - step - 1 + num) % num;
+            scratch.resize(chunkBegin(recvChunk + 1) - chunkBegin(recvChunk));
+            MPI_Sendrecv(pData + chunkBegin(sendChunk), (int) (chunkBegin(sendChunk + 1) - chunkBegin(sendChunk)), GetDataType(pData), next, 0,
+                         scratch.data(), (int) scratch.size(), GetDataType(pData), prev, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("RingAllReduce: MPI_Sendrecv");
+            ElemType *pChunk = pData + chunkBegin(recvChunk);
+            for (size_t i = 0; i < scratch.size(); i++)
+                pChunk[i] += scratch[i];
+        }
+        // now we own the complete chunk (rank + 1) % num
+        for (int step = 0; step < num - 1; step++)
+        {
+            int sendChunk = (rank + 1 - step + num) % num;
+            int recvChunk = (rank - step + num) % num;
+            MPI_Sendrecv(pData + chunkBegin(sendChunk), (int) (chunkBegin(sendChunk + 1) - chunkBegin(sendChunk)), GetDataType(pData), next, 0,
+                         pData + chunkBegin(recvChunk), (int) (chunkBegin(recvChunk + 1) - chunkBegin(recvChunk)), GetDataType(pData), prev, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("RingAllReduce: MPI_Sendrecv");
+        }
+    }
+
+    // Recursive halving all-reduce (Rabenseifner): in log N steps, workers exchange half of their current range with a partner and keep summing
+    // the other half (reduce-scatter); then the same steps in reverse order gather the sums (all-gather).
+    // If N is not a power of 2, the first 2 r workers (r = N - 2^floor(log N)) are paired up first, and one of each pair sits out.
+    template <class ElemType>
+    void RecursiveHalvingAllReduce(ElemType *pData, size_t nData)
+    {
+        const int num = (int) NumNodesInUse();
+        const int rank = (int) CurrentNodeRank();
+        int pow2 = 1;
+        while (pow2 * 2 <= num)
+            pow2 *= 2;
+        const int extra = num - pow2;
+        std::vector<ElemType> scratch;
+
+        // fold the extra workers into their neighbors
+        int newRank;
+        if (rank < 2 * extra)
+        {
+            if (rank % 2 == 0)
+            {
+                MPI_Send(pData, (int) nData, GetDataType(pData), rank + 1, 0, Communicator()) || MpiFail("RecursiveHalvingAllReduce: MPI_Send");
+                newRank = -1;
+            }
+            else
+            {
+                scratch.resize(nData);
+                MPI_Recv(scratch.data(), (int) nData, GetDataType(pData), rank - 1, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("RecursiveHalvingAllReduce: MPI_Recv");
+                for (size_t i = 0; i < nData; i++)
+                    pData[i] += scratch[i];
+                newRank = rank / 2;
+            }
+        }
+        else
+            newRank = rank - extra;
+
+        if (newRank >= 0)
+        {
+            auto realRank = [extra](int r)
+            {
+                return r < extra ? 2 * r + 1 : r + extra;
+            };
+            // reduce-scatter; remember the ranges to retrace them in the all-gather
+            std::vector<std::pair<size_t, size_t>> ranges; // [step] -> range before the step
+            size_t begin = 0, end = nData;
+            for (int mask = pow2 / 2; mask > 0; mask /= 2)
+            {
+                ranges.push_back(std::make_pair(begin, end));
+                size_t mid = begin + (end - begin) / 2;
+                int peer = realRank(newRank ^ mask);
+                if (newRank & mask) // keep the upper half
+                {
+                    SendAndReceiveAdd(pData, begin, mid, mid, end, peer, scratch);
+                    begin = mid;
+                }
+                else
+                {
+                    SendAndReceiveAdd(pData, mid, end, begin, mid, peer, scratch);
+                    end = mid;
+                }
+            }
+            // all-gather: our range is complete; send it to the partners in reverse order, receiving the complementary halves
+            for (int mask = 1; mask < pow2; mask *= 2)
+            {
+                auto parent = ranges.back();
+                ranges.pop_back();
+                size_t otherBegin = (begin == parent.first) ? end : parent.first;
+                size_t otherEnd = (begin == parent.first) ? parent.second : begin;
+                int peer = realRank(newRank ^ mask);
+                MPI_Sendrecv(pData + begin, (int) (end - begin), GetDataType(pData), peer, 0,
+                             pData + otherBegin, (int) (otherEnd - otherBegin), GetDataType(pData), peer, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("RecursiveHalvingAllReduce: MPI_Sendrecv");
+                begin = parent.first;
+                end = parent.second;
+            }
+        }
+
+        // and pass the result back to the workers that sat out
+        if (rank < 2 * extra)
+        {
+            if (rank % 2 == 0)
+                MPI_Recv(pData, (int) nData, GetDataType(pData), rank + 1, 0, Communicator(), MPI_STATUS_IGNORE) || MpiFail("RecursiveHalvingAllReduce: MPI_Recv");
+            else
+                MPI_Send(pData, (int) nData, GetDataType(pData), rank - 1, 0, Communicator()) || MpiFail("RecursiveHalvingAllReduce: MPI_Send");
+        }
+    }
+
+public:
     template <class ElemType>
     void Bcast(ElemType *pData, size_t nData, size_t srcRank)
     {
         if ((NumNodesInUse() > 1) && (Communicator() != MPI_COMM_NULL))
         {
+            TimelineScope scope("MPI_Bcast", "mpi");
             MPI_Bcast(pData, (int) nData, GetDataType(pData), (int) srcRank, Communicator()) || MpiFail("Bcast: MPI_Bcast");
         }
     }
 
+    // personalized exchange: send sendCounts[r] elements to each rank r and receive recvCounts[r] from each,
+    // both buffers holding the ranks' parts consecutively in rank order
+    template <class ElemType>
+    void AllToAll(const ElemType *sendData, const std::vector<size_t> &sendCounts, ElemType *recvData, const std::vector<size_t> &recvCounts)
+    {
+        const size_t num = NumNodesInUse();
+        if (sendCounts.size() != num || recvCounts.size() != num)
+            LogicError("AllToAll: There must be one count per rank.");
+        if (num == 1 || Communicator() == MPI_COMM_NULL)
+        {
+            std::copy(sendData, sendData + sendCounts[0], recvData);
+            return;
+        }
+        std::vector<int> sendInts(num), sendDispls(num), recvInts(num), recvDispls(num);
+        size_t sendOffset = 0, recvOffset = 0;
+        for (size_t r = 0; r < num; r++)
+        {
+            sendInts[r] = (int) sendCounts[r];
+            sendDispls[r] = (int) sendOffset;
+            recvInts[r] = (int) recvCounts[r];
+            recvDispls[r] = (int) recvOffset;
+            sendOffset += sendCounts[r];
+            recvOffset += recvCounts[r];
+        }
+        if (sendOffset > INT_MAX || recvOffset > INT_MAX)
+            RuntimeError("AllToAll: Too much data for one exchange.");
+        TimelineScope scope("MPI_Alltoallv", "mpi");
+        MPI_Alltoallv(const_cast<ElemType *>(sendData), sendInts.data(), sendDispls.data(), GetDataType(recvData),
+                      recvData, recvInts.data(), recvDispls.data(), GetDataType(recvData), Communicator()) || MpiFail("AllToAll: MPI_Alltoallv");
+    }
+
+    // the counts for AllToAll(): recvCounts[r] becomes what rank r passes as sendCounts[our rank]
+    void AllToAllCounts(const std::vector<size_t> &sendCounts, std::vector<size_t> &recvCounts)
+    {
+        const size_t num = NumNodesInUse();
+        recvCounts.resize(num);
+        if (num == 1 || Communicator() == MPI_COMM_NULL)
+        {
+            recvCounts = sendCounts;
+            return;
+        }
+        TimelineScope scope("MPI_Alltoall", "mpi");
+        MPI_Alltoall(const_cast<size_t *>(sendCounts.data()), 1, GetDataType(recvCounts.data()),
+                     recvCounts.data(), 1, GetDataType(recvCounts.data()), Communicator()) || MpiFail("AllToAllCounts: MPI_Alltoall");
+    }
+
     // wait for all ranks to reach here
     void WaitAll()
     {
+        TimelineScope scope("MPI_Barrier", "mpi");
         MPI_Barrier(m_currentComm) || MpiFail("waitall: MPI_Barrier");
     }
 };
@@ -0,0 +1,169 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NumaPlacement.h -- portable helpers to place threads and memory on NUMA nodes
+// Unlike numahelpers.h (Windows only, used by the speech readers' own allocator), these only
+// pin threads and set placement policies, and degrade to no-ops where the OS does not tell us enough.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "Basics.h" // for UNUSED()
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// NUMA placement of a thread that has no preference
+static const int NoNumaNode = -1;
+
+#ifndef _WIN32
+// parse a Linux cpu/node list such as "0-7,16-23"
+static inline std::vector<int> ParseLinuxIdList(const std::string& list)
+{
+    std::vector<int> ids;
+    const char* p = list.c_str();
+    while (isdigit((unsigned char) *p))
+    {
+        char* end;
+        const int first = (int) strtol(p, &end, 10);
+        int last = first;
+        if (*end == '-')
+            last = (int) strtol(end + 1, &end, 10);
+        for (int id = first; id <= last; id++)
+            ids.push_back(id);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ids;
+}
+
+// read the first line of a sysfs file; empty if it does not exist
+static inline std::string ReadLinuxSysFile(const std::string& path)
+{
+    std::string line;
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        return line;
+    char buf[4096];
+    if (fgets(buf, sizeof(buf), f))
+        line = buf;
+    fclose(f);
+    return line;
+}
+#endif
+
+// number of NUMA nodes of this machine (1 if it is not a NUMA machine or we cannot tell)
+static inline size_t GetNumNumaNodes()
+{
+#ifdef _WIN32
+    ULONG highest;
+    if (!GetNumaHighestNodeNumber(&highest))
+        return 1;
+    return highest + 1;
+#else
+    const std::vector<int> nodes = ParseLinuxIdList(ReadLinuxSysFile("/sys/devices/system/node/online"));
+    return nodes.empty() ? 1 : (size_t) nodes.back() + 1;
+#endif
+}
+
+// the logical processors of a NUMA node (empty if unknown)
+static inline std::vector<int> GetNumaNodeCpus(int node)
+{
+#ifdef _WIN32
+    std::vector<int> cpus;
+    ULONGLONG mask;
+    if (GetNumaNodeProcessorMask((UCHAR) node, &mask)) // note: only the first 64 processors (one processor group)
+    {
+        for (int cpu = 0; cpu < 64; cpu++)
+            if (mask & (1ull << cpu))
+                cpus.push_back(cpu);
+    }
+    return cpus;
+#else
+    return ParseLinuxIdList(ReadLinuxSysFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+#endif
+}
+
+// restrict the calling thread to the given logical processors; returns false if that did not work
+static inline bool BindCurrentThreadToCpus(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+        return false;
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus)
+        if (cpu < (int) (8 * sizeof(mask)))
+            mask |= (DWORD_PTR) 1 << cpu;
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    return sched_setaffinity(0 /*calling thread*/, sizeof(set), &set) == 0;
+#endif
+}
+
+// restrict the calling thread to the processors of a NUMA node; NoNumaNode or an unknown node leaves it alone
+static inline bool BindCurrentThreadToNumaNode(int node)
+{
+    if (node == NoNumaNode)
+        return false;
+    return BindCurrentThreadToCpus(GetNumaNodeCpus(node));
+}
+
+// NUMA node that a PCIe device (e.g. a GPU, by its bus id as cudaDeviceGetPCIBusId() reports it) is attached to
+// Returns NoNumaNode if unknown, which is always the case on Windows and on single-socket machines.
+static inline int GetNumaNodeOfPciDevice(const std::string& busId)
+{
+#ifdef _WIN32
+    UNUSED(busId);
+    return NoNumaNode;
+#else
+    std::string id = busId; // sysfs spells the hex digits in lower case
+    for (auto& c : id)
+        c = (char) tolower((unsigned char) c);
+    const std::string node = ReadLinuxSysFile("/sys/bus/pci/devices/" + id + "/numa_node");
+    if (node.empty() || !isdigit((unsigned char) node[0])) // (the kernel writes -1 when it does not know)
+        return NoNumaNode;
+    return atoi(node.c_str());
+#endif
+}
+
+// ask the OS to spread the not-yet-touched pages of [p, p + bytes) round-robin over all NUMA nodes
+// Only whole pages inside the range are affected. Not available on Windows, where pages are placed on first touch.
+static inline void InterleaveMemoryAcrossNumaNodes(void* p, size_t bytes)
+{
+#ifdef _WIN32
+    UNUSED(p);
+    UNUSED(bytes);
+#else
+    const size_t numNodes = GetNumNumaNodes();
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t begin = ((size_t) p + pageSize - 1) / pageSize * pageSize;
+    const size_t end = ((size_t) p + bytes) / pageSize * pageSize;
+    if (numNodes < 2 || end <= begin)
+        return;
+    const size_t bitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodeMask((numNodes + bitsPerWord - 1) / bitsPerWord, 0);
+    for (size_t node = 0; node < numNodes; node++)
+        nodeMask[node / bitsPerWord] |= 1ul << (node % bitsPerWord);
+    const int mpolInterleave = 3; // MPOL_INTERLEAVE from <numaif.h>, which we do not want to depend on
+    syscall(SYS_mbind, (void*) begin, end - begin, mpolInterleave, nodeMask.data(), numNodes + 1, 0); // (best effort: failure just leaves the default policy)
+#endif
+}
+
+} } }
@@ -10,6 +10,7 @@
 #include "Basics.h"
 #include "Matrix.h"
 #include <vector>
+#include <map>
 #include <memory> // for shared_ptr
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -98,7 +99,7 @@ struct MBLayout
     // -------------------------------------------------------------------
 
     MBLayout(size_t numParallelSequences, size_t numTimeSteps)
-        : m_distanceToStart(CPUDEVICE), m_distanceToEnd(CPUDEVICE), m_columnsValidityMask(CPUDEVICE)
+        : m_distanceToStart(CPUDEVICE), m_distanceToEnd(CPUDEVICE)
     {
         Init(numParallelSequences, numTimeSteps);
     }
@@ -132,7 +133,15 @@ public:
         m_distanceToNearestStart.assign(m_numTimeSteps, PTRDIFF_MAX);
         m_distanceToNearestEnd.assign(m_numTimeSteps, PTRDIFF_MAX);
         m_timeStepHasGap.assign(m_numTimeSteps, false);
-        m_columnsValidityMask.Resize(0, 0); // invalidate
+        // invalidate the cached masks, but keep their memory for the next minibatch
+        m_columnsValidityMaskOnHost.clear();
+        m_numActiveParallelSequences.clear();
+        for (auto& iter : m_columnsValidityMasks)
+            iter.second.Resize(0, 0);
+        for (auto& iter : m_validColumnIndicesFloat)
+            iter.second.Resize(0, 0);
+        for (auto& iter : m_validColumnIndicesDouble)
+            iter.second.Resize(0, 0);
         // reset state
         m_numFramesDeclared = 0;
         m_numGapFrames = 0;
@@ -171,6 +180,11 @@ public:
 
     const Matrix<char>& GetColumnsValidityMask(DEVICEID_TYPE deviceId) const;
 
+    // the indices of the columns that are not gaps, as a [1 x GetActualNumSamples()] row vector
+    // For gathering them into a compact matrix and scattering results back, see SkipsGapColumns().
+    template <class ElemType>
+    const Matrix<ElemType>& GetValidColumnIndices(DEVICEID_TYPE deviceId) const;
+
     // compare whether two layouts are the same
     bool operator==(const MBLayout &other) const
     {
@@ -312,6 +326,10 @@ public:
     bool IsBeyondStartOrEnd(const FrameRange &fr) const;
     bool IsGap(const FrameRange &fr) const;
 
+    // number of parallel sequences that are active in time step t, i.e. 1 + the highest slot that is not a gap there
+    // If the reader puts the longest sequences into the first slots, a recurrent loop only needs to compute on these (FrameRange::WithActiveSequences()).
+    size_t GetNumActiveParallelSequences(size_t t) const;
+
     // test whether at least one sequence crosses the bounds of this minibatch
     bool HasSequenceBeyondBegin() const
     {
@@ -397,7 +415,30 @@ private:
     // TODO: We actually just need a boolean matrix for this.
     // A value of 1 indicates that the column has valid content
     // and 0 indicates invalid (aka MinibatchPackingFlags::NoInput)
-    mutable Matrix<char> m_columnsValidityMask;
+    // It is formed once on the host from the gap sequences, and uploaded once to each device that asks for it
+    // (all nodes share the layout, but a model split across GPUs asks from more than one).
+    mutable vector<char> m_columnsValidityMaskOnHost;
+    mutable map<DEVICEID_TYPE, Matrix<char>> m_columnsValidityMasks;
+
+    // Cached number of active parallel sequences per time step (GetNumActiveParallelSequences()), formed lazily like the mask above
+    mutable vector<size_t> m_numActiveParallelSequences;
+    const vector<char>& GetColumnsValidityMaskOnHost() const;
+
+    // Cached row vectors of the indices of all valid columns, per device and element type (for DoGatherColumnsOf() and DoScatterColumnsOf())
+    mutable map<DEVICEID_TYPE, Matrix<float>> m_validColumnIndicesFloat;
+    mutable map<DEVICEID_TYPE, Matrix<double>> m_validColumnIndicesDouble;
+    map<DEVICEID_TYPE, Matrix<float>>& ValidColumnIndices(float*) const { return m_validColumnIndicesFloat; }
+    map<DEVICEID_TYPE, Matrix<double>>& ValidColumnIndices(double*) const { return m_validColumnIndicesDouble; }
+
+    // the cached matrix of 'deviceId' in one of the maps above (empty if not formed yet)
+    template <class ElemType>
+    static Matrix<ElemType>& GetCachedMatrix(map<DEVICEID_TYPE, Matrix<ElemType>>& cache, DEVICEID_TYPE deviceId)
+    {
+        auto iter = cache.find(deviceId);
+        if (iter == cache.end())
+            iter = cache.emplace(deviceId, Matrix<ElemType>(deviceId)).first;
+        return iter->second;
+    }
 
     // A boolean flag indicating whether the MBLayout can be further modified
     // When it's value is false, no set operations are allowed on the MBLayout.
@@ -449,6 +490,7 @@ public:                       // TODO: make private (currently used from masking
     ptrdiff_t m_timeOffset;   // this is added to timeIdxInSeq wherever it is used
     size_t m_timeRange;       // use this to describe a custom range > 1 frame
     size_t seqIndex;          // parallel-sequence index; SIZE_MAX = all sequences in MB (most common case)  --TODO: Bad name, 'sequence' and 'parallel sequence' are two different things
+    size_t m_numActiveSequences; // if seqIndex == SIZE_MAX: only the first this many parallel sequences of a single time step; SIZE_MAX = all
     MBLayoutPtr m_pMBLayout;  // layout associated with this
     bool m_broadcastAllowed;  // frame range may be broadcast from outer layout (e.g. a matrix with NULL layout and 1 column is acceptable to this frame range). Only applies when iterating over time; otherwise broadcasting is always OK.
     const FrameRange *parent; // or NULL: parent range, relative to which this FrameRange is interpreted  --TODO: not used yet
@@ -456,7 +498,7 @@ public:                       // TODO: make private (currently used from masking
 public:
     // can construct from a single size_t -> a single-frame range
     FrameRange(MBLayoutPtr pMBLayout, size_t timeIdxInSeq)
-        : timeIdxInSeq(timeIdxInSeq), m_timeOffset(0), m_timeRange(1), seqIndex(SIZE_MAX), m_pMBLayout(pMBLayout), m_broadcastAllowed(false), parent(nullptr)
+        : timeIdxInSeq(timeIdxInSeq), m_timeOffset(0), m_timeRange(1), seqIndex(SIZE_MAX), m_numActiveSequences(SIZE_MAX), m_pMBLayout(pMBLayout), m_broadcastAllowed(false), parent(nullptr)
     {
     }
 
@@ -490,6 +532,16 @@ public:
         return ret;
     }
 
+    // create a FrameRange that accesses only the first 'n' parallel sequences of its time step
+    // This is used by recurrent loops to skip the slots whose sequences have ended (MBLayout::GetNumActiveParallelSequences()).
+    // The columns beyond are left untouched, so the caller must mask them afterwards.
+    FrameRange WithActiveSequences(size_t n) const
+    {
+        FrameRange ret = *this;
+        ret.m_numActiveSequences = n;
+        return ret;
+    }
+
     // create a FrameRange with its MBLayout replaced by another
     // You must check yourself whether this is correct.
     FrameRange WithLayout(MBLayoutPtr pMBLayout) const
@@ -554,7 +606,7 @@ public:
     };
     IndexIteration GetSequenceRange(const shared_ptr<MBLayout> &pMBLayout) const
     {
-        return IndexIteration(seqIndex == SIZE_MAX ? 0 : seqIndex, seqIndex == SIZE_MAX ? pMBLayout->GetNumParallelSequences() : seqIndex + 1);
+        return IndexIteration(seqIndex == SIZE_MAX ? 0 : seqIndex, seqIndex == SIZE_MAX ? min(pMBLayout->GetNumParallelSequences(), m_numActiveSequences) : seqIndex + 1);
     }
 
     // code that can only handle single-frame ranges will call t() to get the time index, which will throw if numFrames != 1
@@ -595,7 +647,7 @@ inline bool MBLayout::HasGaps(const FrameRange &fr) const
     CheckIsValid();
     if (fr.IsAllFrames())
         return m_numGapFrames > 0; // test entire minibatch
-    if (fr.seqIndex == SIZE_MAX)
+    if (fr.seqIndex == SIZE_MAX && fr.m_numActiveSequences >= m_numParallelSequences)
         return m_timeStepHasGap[fr.timeIdxInSeq]; // test all seq for one time step
     else
         return IsGap(fr); // test one sequence
@@ -612,7 +664,14 @@ inline bool MBLayout::IsGap(const FrameRange &fr) const
     const auto t = fr.timeIdxInSeq; // we test off the frame without offset
     const auto s = fr.seqIndex;
     if (s == SIZE_MAX) // aggregate requested
-        return m_timeStepHasGap[t];
+    {
+        if (!m_timeStepHasGap[t] || fr.m_numActiveSequences >= m_numParallelSequences)
+            return m_timeStepHasGap[t];
+        for (size_t s1 = 0; s1 < fr.m_numActiveSequences; s1++) // only the active sequences
+            if (m_distanceToStart(s1, t) < 0)
+                return true;
+        return false;
+    }
 
     // determine flags from matrices
     return m_distanceToStart(s, t) < 0; // value is -1 for gaps, non-negative otherwise
@@ -663,48 +722,96 @@ inline bool MBLayout::IsBeyondStartOrEnd(const FrameRange &fr) const
 // TODO: Remove this version (with sanity checks) after this has been tested. Then the function can be inlined above.
 inline size_t MBLayout::GetActualNumSamples() const { return m_numFramesDeclared - m_numGapFrames; }
 
-// return m_columnsValidityMask(,), which is lazily created here upon first call
-// only called from MaskMissingColumnsTo()
-// TODO: Can probably be faster by using the sequence array directly.
-// TODO: Or should we just blast m_distanceToStart to GPU, and maks based on that? It is small compared to features.
-inline const Matrix<char> &MBLayout::GetColumnsValidityMask(DEVICEID_TYPE deviceId) const
+// return the validity mask of all columns in a CPU-side STL vector, which is lazily formed here upon first call
+// The gaps are sequences of their own, so this only touches the gap frames, not every column.
+inline const vector<char> &MBLayout::GetColumnsValidityMaskOnHost() const
 {
-    CheckIsValid();
-    // lazily compute the validity mask
-    if (m_columnsValidityMask.IsEmpty())
+    if (m_columnsValidityMaskOnHost.empty())
     {
-        assert(HasGaps()); // must only be called if there are gaps
         Lock();
 
-        // Determine indices of all invalid columns in the minibatch
-        // TODO: This can be done more efficiently by using m_sequences[].
         size_t nT = GetNumTimeSteps();
         size_t nS = GetNumParallelSequences();
 
-        std::vector<char> columnsValidityMask(nT * nS, 1); // form the mask in a CPU-side STL vector first
+        m_columnsValidityMaskOnHost.assign(nT * nS, 1);
         size_t gapsFound = 0;
-        for (size_t t = 0; t < nT; t++)
+        for (const auto &seq : m_sequences)
         {
-            FrameRange fr(nullptr, t);
-            if (IsGap(fr))
-            {
-                for (size_t s = 0; s < nS; s++)
-                {
-                    if (IsGap(fr.Sequence(s)))
-                    {
-                        columnsValidityMask[(t * nS) + s] = 0;
-                        gapsFound++;
-                    }
-                }
-            }
+            if (seq.seqId != GAP_SEQUENCE_ID)
+                continue;
+            size_t b = (size_t) max(seq.tBegin, (ptrdiff_t) 0);
+            size_t e = min(seq.tEnd, nT);
+            for (size_t t = b; t < e; t++)
+                m_columnsValidityMaskOnHost[(t * nS) + seq.s] = 0;
+            gapsFound += e - b;
         }
         assert(gapsFound == m_numGapFrames); // sanity check
+        UNUSED(gapsFound);
+    }
+    return m_columnsValidityMaskOnHost;
+}
+
+// return the number of active parallel sequences in time step t; the vector is lazily formed upon first call
+inline size_t MBLayout::GetNumActiveParallelSequences(size_t t) const
+{
+    CheckIsValid();
+    if (m_numActiveParallelSequences.empty())
+    {
+        Lock();
 
-        if (deviceId != m_columnsValidityMask.GetDeviceId())
-            m_columnsValidityMask = Matrix<char>(deviceId);
-        m_columnsValidityMask.SetValue(1, nS * nT, deviceId, columnsValidityMask.data());
+        size_t nT = GetNumTimeSteps();
+        m_numActiveParallelSequences.assign(nT, 1); // (at least one, so that a time step that is all gaps still yields a valid slice)
+        for (const auto &seq : m_sequences)
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            size_t b = (size_t) max(seq.tBegin, (ptrdiff_t) 0);
+            size_t e = min(seq.tEnd, nT);
+            for (size_t t1 = b; t1 < e; t1++)
+                m_numActiveParallelSequences[t1] = max(m_numActiveParallelSequences[t1], seq.s + 1);
+        }
     }
-    return m_columnsValidityMask;
+    return m_numActiveParallelSequences[t];
+}
+
+// return the validity mask on 'deviceId', which is lazily uploaded here upon first call from that device
+// only called from MaskMissingColumnsTo()
+// TODO: Or should we just blast m_distanceToStart to GPU, and maks based on that? It is small compared to features.
+inline const Matrix<char> &MBLayout::GetColumnsValidityMask(DEVICEID_TYPE deviceId) const
+{
+    CheckIsValid();
+    Matrix<char> &columnsValidityMask = GetCachedMatrix(m_columnsValidityMasks, deviceId);
+    if (columnsValidityMask.IsEmpty())
+    {
+        assert(HasGaps()); // must only be called if there are gaps
+        const auto &mask = GetColumnsValidityMaskOnHost();
+        columnsValidityMask.SetValue(1, mask.size(), deviceId, const_cast<char *>(mask.data()));
+    }
+    return columnsValidityMask;
+}
+
+// return the indices of the valid columns, which are lazily determined here upon first call
+template <class ElemType>
+inline const Matrix<ElemType> &MBLayout::GetValidColumnIndices(DEVICEID_TYPE deviceId) const
+{
+    CheckIsValid();
+    Matrix<ElemType> &validColumnIndices = GetCachedMatrix(ValidColumnIndices((ElemType *) nullptr), deviceId);
+    if (validColumnIndices.IsEmpty())
+    {
+        const auto &mask = GetColumnsValidityMaskOnHost();
+
+        std::vector<ElemType> indices; // form them in a CPU-side STL vector first
+        indices.reserve(GetActualNumSamples());
+        for (size_t j = 0; j < mask.size(); j++)
+        {
+            if (mask[j])
+                indices.push_back((ElemType) j);
+        }
+        assert(indices.size() == GetActualNumSamples()); // sanity check
+
+        validColumnIndices.SetValue(1, indices.size(), deviceId, indices.data());
+    }
+    return validColumnIndices;
 }
 
 // class for defining an iteration over a sequence, forward and backward
@@ -823,7 +930,13 @@ static inline std::pair<size_t, size_t> ColumnRangeWithMBLayoutFor(size_t numCol
         size_t startColumn = (fr.timeIdxInSeq + fr.m_timeOffset) * numParallelSequences;
         if (startColumn >= numCols)
             LogicError("DataFor: FrameRange specifies a time index that is out of range.");
-        if (fr.seqIndex == SIZE_MAX)
+        if (fr.seqIndex == SIZE_MAX && fr.m_numActiveSequences < numParallelSequences)
+        {
+            if (fr.m_timeRange != 1)
+                LogicError("DataFor: FrameRange only supports a subset of the parallel sequences for a single time step.");
+            return std::pair<size_t, size_t>(startColumn, fr.m_numActiveSequences);
+        }
+        else if (fr.seqIndex == SIZE_MAX)
             return std::pair<size_t, size_t>(startColumn, numParallelSequences * fr.m_timeRange);
         else if (fr.m_timeRange != 1)
             LogicError("DataFor: FrameRange only support per-sequence time ranges with tensor slices, not matrix slices.");
@@ -926,6 +1039,13 @@ static inline std::pair<DimensionVector, DimensionVector> TensorSliceWithMBLayou
         result.first[sequenceDim] = (ElemType) s;
         result.second[sequenceDim] = (ElemType) s + 1;
     }
+    // only the active sequences of a time step (FrameRange::WithActiveSequences())
+    else if (fr.seqIndex == SIZE_MAX && fr.m_numActiveSequences < result.second[sequenceDim] && pMBLayout && isTimeIteration && !fr.IsAllFrames() && result.second[sequenceDim] > 1)
+    {
+        if (fr.m_timeRange != 1)
+            LogicError("DataFor: FrameRange only supports a subset of the parallel sequences for a single time step.");
+        result.second[sequenceDim] = (ElemType) fr.m_numActiveSequences;
+    }
 
     return result;
 }
@@ -960,4 +1080,18 @@ static inline void MaskMissingColumnsTo(Matrix<ElemType> &matrixToMask, const MB
 #endif
     }
 }
+
+// -----------------------------------------------------------------------
+// SkipsGapColumns() -- whether to compute on the valid columns only
+// -----------------------------------------------------------------------
+
+// Instead of computing on all columns and masking the gaps afterwards, expensive nodes can gather the valid columns
+// (MBLayout::GetValidColumnIndices()) into a compact matrix, compute on that, and scatter the result back, with gaps set to 0.
+// The gathering and scattering cost a copy each, so this is only worth it if at least 1 in 10 columns is a gap.
+// This is only done for the entire minibatch, i.e. outside of loops.
+static inline bool SkipsGapColumns(const MBLayoutPtr &pMBLayout, const FrameRange &fr)
+{
+    return pMBLayout && fr.IsAllFrames() && fr.seqIndex == SIZE_MAX && pMBLayout->HasGaps() &&
+           pMBLayout->GetActualNumSamples() * 10 <= pMBLayout->GetNumCols() * 9;
+}
 } } }
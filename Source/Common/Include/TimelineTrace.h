@@ -0,0 +1,270 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// TimelineTrace.h -- records what each thread does when, for viewing as a timeline in chrome://tracing or Perfetto
+//
+#pragma once
+
+#include "Basics.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// TimelineTrace -- process-wide trace of named time intervals, per thread
+// Every thread appends to a buffer of its own, so recording takes no lock; only the first event of a thread registers its buffer.
+// Each thread keeps at most maxEventsPerThread events; later ones are dropped (and counted).
+// While disabled, recording costs one test of a flag. Event names and categories must be string literals (they are kept as pointers).
+// Times are CPU times: for GPU work they span the kernel launches, and waits for the GPU show up where the CPU blocks.
+// The state is static in accessors, so we won't need a CPP file. (On Windows, each DLL therefore traces on its own.)
+// -----------------------------------------------------------------------
+
+/*static*/ class TimelineTrace
+{
+    struct Event
+    {
+        const char* name;
+        const char* category;
+        int64_t beginTime;
+        int64_t endTime;
+    };
+
+    // events of one thread, in chunks that are allocated as needed and never move
+    // Only the owning thread writes. It publishes an event by incrementing numEvents (release), after which Save() may read it.
+    struct ThreadBuffer
+    {
+        static const size_t chunkSize = 4096;
+
+        std::vector<std::unique_ptr<Event[]>> chunks; // (sized once, so that Save() can index it while the owner fills it in)
+        std::atomic<size_t> numEvents;
+        std::atomic<size_t> numDropped;
+        std::atomic<const char*> name;
+
+        ThreadBuffer(size_t maxEvents)
+            : chunks((maxEvents + chunkSize - 1) / chunkSize), numEvents(0), numDropped(0), name(nullptr)
+        {
+        }
+    };
+
+    struct State
+    {
+        std::atomic<bool> enabled;
+        std::mutex lock; // for registering threads
+        std::vector<std::shared_ptr<ThreadBuffer>> threads; // (owned here, so that events outlive their threads)
+        std::vector<ThreadBuffer*> unusedBuffers;            // of threads that called EndThread(), for the next new thread to continue
+        size_t maxEventsPerThread;
+        std::chrono::steady_clock::time_point startTime;
+
+        State()
+            : enabled(false), maxEventsPerThread(0), startTime(std::chrono::steady_clock::now())
+        {
+        }
+    };
+
+    static State& GetState()
+    {
+        static State state;
+        return state;
+    }
+
+    static ThreadBuffer*& ThreadBufferOfThisThread()
+    {
+#ifdef _WIN32
+        static __declspec(thread) ThreadBuffer* t_threadBuffer = nullptr;
+#else
+        static __thread ThreadBuffer* t_threadBuffer = nullptr;
+#endif
+        return t_threadBuffer;
+    }
+
+    static ThreadBuffer& GetThreadBuffer()
+    {
+        ThreadBuffer*& threadBuffer = ThreadBufferOfThisThread();
+        if (!threadBuffer)
+        {
+            auto& state = GetState();
+            std::lock_guard<std::mutex> guard(state.lock);
+            if (!state.unusedBuffers.empty())
+            {
+                threadBuffer = state.unusedBuffers.back();
+                state.unusedBuffers.pop_back();
+            }
+            else
+            {
+                state.threads.push_back(std::make_shared<ThreadBuffer>(state.maxEventsPerThread));
+                threadBuffer = state.threads.back().get();
+            }
+        }
+        return *threadBuffer;
+    }
+
+    // JSON string literal; names are plain identifiers, but better safe
+    static std::string JsonString(const char* s)
+    {
+        std::string json = "\"";
+        for (; s && *s; s++)
+        {
+            if (*s == '"' || *s == '\\')
+                json += '\\';
+            if ((unsigned char) *s >= 0x20)
+                json += *s;
+        }
+        return json + "\"";
+    }
+
+public:
+    static void Enable(size_t maxEventsPerThread = 1 << 20)
+    {
+        auto& state = GetState();
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            if (state.enabled)
+                return;
+            state.maxEventsPerThread = maxEventsPerThread;
+        }
+        state.enabled = true;
+    }
+
+    static bool IsEnabled()
+    {
+        return GetState().enabled.load(std::memory_order_relaxed);
+    }
+
+    // microseconds since the process started
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - GetState().startTime).count();
+    }
+
+    static void AddEvent(const char* name, const char* category, int64_t beginTime, int64_t endTime)
+    {
+        ThreadBuffer& buffer = GetThreadBuffer();
+        const size_t i = buffer.numEvents.load(std::memory_order_relaxed);
+        if (i / ThreadBuffer::chunkSize >= buffer.chunks.size())
+        {
+            buffer.numDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto& chunk = buffer.chunks[i / ThreadBuffer::chunkSize];
+        if (!chunk)
+            chunk.reset(new Event[ThreadBuffer::chunkSize]);
+        chunk[i % ThreadBuffer::chunkSize] = Event{name, category, beginTime, endTime};
+        buffer.numEvents.store(i + 1, std::memory_order_release);
+    }
+
+    // label for the calling thread in the timeline, e.g. "read-ahead"
+    static void SetThreadName(const char* name)
+    {
+        if (IsEnabled())
+            GetThreadBuffer().name.store(name, std::memory_order_release);
+    }
+
+    // hand the calling thread's buffer on to the next thread that starts recording
+    // Short-lived threads, such as those of std::async(), call this when done, so that they share one row of the timeline.
+    static void EndThread()
+    {
+        ThreadBuffer*& threadBuffer = ThreadBufferOfThisThread();
+        if (!threadBuffer)
+            return;
+        auto& state = GetState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        state.unusedBuffers.push_back(threadBuffer);
+        threadBuffer = nullptr;
+    }
+
+    // write the events so far in Chrome trace format; processId tells the ranks of a parallel job apart
+    // Threads may go on recording meanwhile.
+    static void Save(const std::wstring& path, int processId)
+    {
+        auto& state = GetState();
+        std::vector<std::shared_ptr<ThreadBuffer>> threads;
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            threads = state.threads;
+        }
+
+        FILE* f = _wfopen(path.c_str(), L"w");
+        if (!f)
+            RuntimeError("TimelineTrace: Cannot create trace file %ls.", path.c_str());
+        fprintf(f, "{\"traceEvents\":[\n");
+        fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}", processId, processId);
+        size_t numDropped = 0;
+        for (size_t tid = 0; tid < threads.size(); tid++)
+        {
+            const ThreadBuffer& buffer = *threads[tid];
+            const char* name = buffer.name.load(std::memory_order_acquire);
+            if (name)
+                fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":%s}}", processId, (int) tid, JsonString(name).c_str());
+            const size_t numEvents = buffer.numEvents.load(std::memory_order_acquire);
+            for (size_t i = 0; i < numEvents; i++)
+            {
+                const Event& event = buffer.chunks[i / ThreadBuffer::chunkSize][i % ThreadBuffer::chunkSize];
+                fprintf(f, ",\n{\"name\":%s,\"cat\":%s,\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+                        JsonString(event.name).c_str(), JsonString(event.category).c_str(),
+                        (long long) event.beginTime, (long long) (event.endTime - event.beginTime), processId, (int) tid);
+            }
+            numDropped += buffer.numDropped.load(std::memory_order_relaxed);
+        }
+        fprintf(f, "\n]}\n");
+        if (fclose(f) != 0)
+            RuntimeError("TimelineTrace: Error writing trace file %ls.", path.c_str());
+        if (numDropped > 0)
+            fprintf(stderr, "TimelineTrace: %d events were dropped since their threads' buffers were full.\n", (int) numDropped);
+    }
+};
+
+// -----------------------------------------------------------------------
+// TimelineScope -- records the lifetime of this object as an event
+// -----------------------------------------------------------------------
+
+class TimelineScope
+{
+    const char* m_name;
+    const char* m_category;
+    int64_t m_beginTime; // -1 if not tracing
+
+public:
+    TimelineScope(const char* name, const char* category)
+        : m_name(name), m_category(category), m_beginTime(TimelineTrace::IsEnabled() ? TimelineTrace::Now() : -1)
+    {
+    }
+    ~TimelineScope()
+    {
+        if (m_beginTime >= 0)
+            TimelineTrace::AddEvent(m_name, m_category, m_beginTime, TimelineTrace::Now());
+    }
+
+private:
+    TimelineScope(const TimelineScope&) = delete;
+    void operator=(const TimelineScope&) = delete;
+};
+
+// -----------------------------------------------------------------------
+// TimelineThread -- names the calling thread for its lifetime, e.g. in the function run by std::async(), see EndThread()
+// -----------------------------------------------------------------------
+
+class TimelineThread
+{
+public:
+    TimelineThread(const char* name)
+    {
+        TimelineTrace::SetThreadName(name);
+    }
+    ~TimelineThread()
+    {
+        TimelineTrace::EndThread();
+    }
+
+private:
+    TimelineThread(const TimelineThread&) = delete;
+    void operator=(const TimelineThread&) = delete;
+};
+} } }
@@ -36,11 +36,31 @@
 // A pathname of "-" returns stdout or stdin, depending on mode, and it will
 // change the binary mode if 'b' or 't' are given. If you use this, make sure
 // not to fclose() such a handle.
+// A remote path (see isremotepath()) opened for reading opens its local copy.
 // ----------------------------------------------------------------------------
 
 FILE* fopenOrDie(const std::string& pathname, const char* mode);
 FILE* fopenOrDie(const std::wstring& pathname, const wchar_t* mode);
 
+// ----------------------------------------------------------------------------
+// remote storage -- paths scheme://... (e.g. https://, s3://, hdfs://) of files in object storage or distributed file systems
+// Reading one makes a local copy in a disk cache upon first use. It is fetched in blocks with parallel range requests, each by a
+// command that writes a byte range of the file to stdout. The commands come from environment variables, so that all modules and
+// processes agree on them:
+//   CNTK_STORAGE_<SCHEME>_RANGE  the range command, with {url} (quoted for the shell, so not to be quoted again), {first} and {last} (inclusive) replaced
+//                                (default for http and https: curl -sfL -r {first}-{last} {url})
+//   CNTK_STORAGE_<SCHEME>_SIZE   a command that prints the size of the file in bytes, or HTTP headers with its Content-Length
+//                                (default for http and https: curl -sfIL {url})
+//   CNTK_STORAGE_CACHE           directory of the local copies (default: cntk-storage-cache in the temp directory)
+//   CNTK_STORAGE_PARALLEL        number of concurrent range requests per file (default 16)
+//   CNTK_STORAGE_BLOCK_MB        size of a range request (default 8)
+// Local copies are never refreshed; delete them from the cache to fetch a file again. Other processes on the machine use them as well.
+// ----------------------------------------------------------------------------
+
+bool isremotepath(const std::wstring& path);
+std::wstring getremotelocalcopy(const std::wstring& path); // waits until the local copy is complete
+void prefetchremotefile(const std::wstring& path);         // starts making the local copy in the background, unless there is one
+
 #ifndef __unix__
 // ----------------------------------------------------------------------------
 // fsetmode(): set mode to binary or text
@@ -141,6 +161,12 @@ size_t filesize(const wchar_t* pathname);
 size_t filesize(FILE* f);
 int64_t filesize64(const wchar_t* pathname);
 
+// ----------------------------------------------------------------------------
+// filemodtime64(): last modification time of the file (seconds since 1970), 0 if it cannot be determined
+// ----------------------------------------------------------------------------
+
+int64_t filemodtime64(const wchar_t* pathname);
+
 // ----------------------------------------------------------------------------
 // fseekOrDie(),ftellOrDie(), fget/setpos(): seek functions with error handling
 // ----------------------------------------------------------------------------
@@ -170,6 +196,13 @@ void unlinkOrDie(const std::wstring& pathname);
 void renameOrDie(const std::string& from, const std::string& to);
 void renameOrDie(const std::wstring& from, const std::wstring& to);
 
+// ----------------------------------------------------------------------------
+// uniquetemppath(): a temp name next to 'path', unique to this process even across hosts that share the file system
+// Write a file there and renameOrDie() it to 'path', so that readers and concurrent writers never see a partial file.
+// ----------------------------------------------------------------------------
+
+std::wstring uniquetemppath(const std::wstring& path);
+
 // ----------------------------------------------------------------------------
 // fexists(): test if a file exists
 // ----------------------------------------------------------------------------
@@ -227,7 +260,7 @@ CHAR* fgetline(FILE* f, CHAR(&buf)[n])
 std::string fgetline(FILE* f);
 std::wstring fgetlinew(FILE* f);
 void fgetline(FILE* f, std::string& s, std::vector<char>& buf);
-void fgetline(FILE* f, std::wstring& s, std::vector<char>& buf);
+void fgetline(FILE* f, std::wstring& s, std::vector<wchar_t>& buf);
 void fgetline(FILE* f, std::vector<char>& buf);
 void fgetline(FILE* f, std::vector<wchar_t>& buf);
 
@@ -17,11 +17,14 @@
 #include "latticestorage.h"
 #include "simple_checked_arrays.h"
 #include "fileutil.h"
+#include "mappedfile.h"
 #include <stdint.h>
 #include <vector>
 #include <string>
 #include <unordered_map>
 #include <algorithm> // for find()
+#include <memory>
+#include <mutex>
 #include "simplesenonehmm.h"
 #include "Matrix.h"
 
@@ -37,7 +40,7 @@ class ssematrixstriperef;
 
 namespace msra { namespace lm {
 
-class CMGramLM;
+class ILM;
 class CSymbolSet;
 };
 }; // for numer-lattice building
@@ -767,7 +770,7 @@ public:
 
     // construct from an MLF file (numerator lattice)
     void frommlf(const std::wstring& key, const std::unordered_map<std::string, size_t>& unitmap, const msra::asr::htkmlfreader<msra::asr::htkmlfentry, lattice::htkmlfwordsequence>& labels,
-                 const msra::lm::CMGramLM& lm, const msra::lm::CSymbolSet& unigramsymbols);
+                 const msra::lm::ILM& lm, const msra::lm::CSymbolSet& unigramsymbols);
 
     // check consistency
     //  - only one end node
@@ -828,6 +831,123 @@ public:
                 info.numedges / (double) info.numnodes, align.size() / (double) info.numedges, totaledgeframes / (double) info.numedges, totaledgeframes / (double) info.numframes);
     }
 
+    // prune the lattice, e.g. once when it is loaded for sequence training, removing edges
+    //  - whose best path is worse than the lattice's best path by more than 'beam' (0: no beam pruning)
+    //  - whose posterior is below 'minposterior' (0: no posterior pruning)
+    // Path scores are the lattice's own (ac + lmf * lm + wp), in the acoustic scale 1/lmf. The best path is always kept,
+    // as is every edge on a complete path of kept edges; nodes without edges are removed. Nodes, edges, and the alignment
+    // array are then renumbered and compacted in their original order, so the lattice remains sorted as checklattice() expects.
+    // Returns the number of edges removed.
+    size_t prune(float beam, float minposterior)
+    {
+        if ((beam <= 0 && minposterior <= 0) || info.numedges == 0)
+            return 0;
+        if (!info.hasacscores)
+        {
+            fprintf(stderr, "prune: WARNING: lattice '%ls' has no acoustic scores, not pruned\n", key.c_str());
+            return 0;
+        }
+        const size_t numnodes = info.numnodes, numedges = info.numedges;
+        const double scale = info.lmf > 0 ? 1.0 / info.lmf : 1.0;
+        std::vector<double> edgescores(numedges);
+        for (size_t j = 0; j < numedges; j++)
+            edgescores[j] = (edges[j].a + info.lmf * edges[j].l + info.wp) * scale;
+        auto logadd = [](double& loga, double logb)
+        {
+            if (logb > loga)
+                std::swap(loga, logb);
+            if (loga > LOGZERO && logb - loga > -37.0)
+                loga += log(1.0 + exp(logb - loga));
+        };
+
+        // forward and backward, in sum (posteriors) and max (beam); edges are sorted by end node, so S is done before E
+        std::vector<double> logalphas(numnodes, LOGZERO), logbetas(numnodes, LOGZERO);
+        std::vector<double> bestalphas(numnodes, LOGZERO), bestbetas(numnodes, LOGZERO);
+        std::vector<size_t> bestinedges(numnodes, SIZE_MAX);
+        logalphas[0] = bestalphas[0] = 0;
+        for (size_t j = 0; j < numedges; j++)
+        {
+            const auto& e = edges[j];
+            logadd(logalphas[e.E], logalphas[e.S] + edgescores[j]);
+            if (bestalphas[e.S] + edgescores[j] > bestalphas[e.E])
+            {
+                bestalphas[e.E] = bestalphas[e.S] + edgescores[j];
+                bestinedges[e.E] = j;
+            }
+        }
+        logbetas[numnodes - 1] = bestbetas[numnodes - 1] = 0;
+        for (size_t j = numedges; j-- > 0;)
+        {
+            const auto& e = edges[j];
+            logadd(logbetas[e.S], logbetas[e.E] + edgescores[j]);
+            bestbetas[e.S] = std::max(bestbetas[e.S], bestbetas[e.E] + edgescores[j]);
+        }
+        const double totalscore = logalphas[numnodes - 1], bestscore = bestalphas[numnodes - 1];
+        if (bestinedges[numnodes - 1] == SIZE_MAX || bestscore <= LOGZERO / 2)
+        {
+            fprintf(stderr, "prune: WARNING: lattice '%ls' has no complete path with a score, not pruned\n", key.c_str());
+            return 0;
+        }
+
+        // decide which edges to keep
+        const double logminposterior = minposterior > 0 ? log((double) minposterior) : LOGZERO;
+        std::vector<bool> keep(numedges);
+        for (size_t j = 0; j < numedges; j++)
+        {
+            const auto& e = edges[j];
+            keep[j] = (beam <= 0 || bestalphas[e.S] + edgescores[j] + bestbetas[e.E] >= bestscore - beam) &&
+                      (minposterior <= 0 || logalphas[e.S] + edgescores[j] + logbetas[e.E] - totalscore >= logminposterior);
+        }
+        for (size_t i = numnodes - 1; i > 0; i = edges[bestinedges[i]].S) // best path
+            keep[bestinedges[i]] = true;
+        // posterior pruning may leave edges that are no longer on a complete path; remove those, and find the nodes left
+        std::vector<bool> reached(numnodes, false), reaches(numnodes, false);
+        reached[0] = reaches[numnodes - 1] = true;
+        for (size_t j = 0; j < numedges; j++)
+            if (keep[j] && reached[edges[j].S])
+                reached[edges[j].E] = true;
+        for (size_t j = numedges; j-- > 0;)
+            if (keep[j] && reaches[edges[j].E])
+                reaches[edges[j].S] = true;
+        std::vector<size_t> newnodeindex(numnodes, SIZE_MAX);
+        std::vector<nodeinfo> newnodes;
+        for (size_t i = 0; i < numnodes; i++)
+        {
+            if (!reached[i] || !reaches[i])
+                continue;
+            newnodeindex[i] = newnodes.size();
+            newnodes.push_back(nodes[i]);
+        }
+
+        // compact edges and their alignments
+        std::vector<edgeinfowithscores> newedges;
+        std::vector<aligninfo> newalign;
+        for (size_t j = 0; j < numedges; j++)
+        {
+            const auto& e = edges[j];
+            if (!keep[j] || newnodeindex[e.S] == SIZE_MAX || newnodeindex[e.E] == SIZE_MAX)
+                continue;
+            newedges.push_back(e);
+            newedges.back().S = newnodeindex[e.S];
+            newedges.back().E = newnodeindex[e.E];
+            newedges.back().firstalign = newalign.size();
+            auto ai = getaligninfo(j);
+            newalign.insert(newalign.end(), ai.begin(), ai.end());
+        }
+        if (verbosity)
+            fprintf(stderr, "prune: lattice '%ls' pruned to %d of %d nodes, %d of %d edges, %d of %d units\n", key.c_str(),
+                    (int) newnodes.size(), (int) numnodes, (int) newedges.size(), (int) numedges, (int) newalign.size(), (int) align.size());
+        nodes.swap(newnodes);
+        edges.swap(newedges);
+        align.swap(newalign);
+        nodes.shrink_to_fit();
+        edges.shrink_to_fit();
+        align.shrink_to_fit();
+        info.numnodes = nodes.size();
+        info.numedges = edges.size();
+        return numedges - edges.size();
+    }
+
     // merge a second lattice in --for use by convert()
 private:
     // helper for merge()
@@ -917,15 +1037,37 @@ public:
         fwriteOrDie(v, f);
     }
 
-    void fwrite(FILE* f)
+    // write a tag with the number of elements, followed by the coded elements and their byte size
+    void fwritecompressed(FILE* f, const char* tag, size_t n, const std::vector<unsigned char>& bytes)
+    {
+        fwritetag(f, tag, n);
+        fputint(f, (int) bytes.size());
+        fwriteOrDie(bytes, f);
+    }
+
+    // write in V2 format, or with 'compressed' in V3 format, which holds the same arrays delta- and varint-coded (see compressnodes() etc.)
+    void fwrite(FILE* f, bool compressed = false)
     {
 #if 1
-        const size_t version = 2; // format version
+        const size_t version = compressed ? 3 : 2; // format version
         fwritetag(f, "LAT ", version);
         fwriteOrDie(&info, sizeof(info), 1, f);
-        fwritevector(f, "NODS", nodes);
-        fwritevector(f, "EDGS", edges2);                // uniqued edges
-        fwritevector(f, "ALNS", uniquededgedatatokens); // uniqued alignments and scores
+        if (compressed)
+        {
+            std::vector<unsigned char> bytes;
+            compressnodes(bytes);
+            fwritecompressed(f, "NODZ", nodes.size(), bytes);
+            compressedges(bytes);
+            fwritecompressed(f, "EDGZ", edges2.size(), bytes);
+            compresstokens(bytes);
+            fwritecompressed(f, "ALNZ", uniquededgedatatokens.size(), bytes);
+        }
+        else
+        {
+            fwritevector(f, "NODS", nodes);
+            fwritevector(f, "EDGS", edges2);                // uniqued edges
+            fwritevector(f, "ALNS", uniquededgedatatokens); // uniqued alignments and scores
+        }
         fputTag(f, "END ");
 #else
         const size_t version = 1; // format version
@@ -968,29 +1110,118 @@ public:
     template <class IDMAP>
     void fread(FILE* f, const IDMAP& idmap, size_t spunit)
     {
-        size_t version = freadtag(f, "LAT ");
+        filesource in = {f};
+        readfrom(in, idmap, spunit);
+    }
+
+    // read from memory, e.g. from a memory-mapped archive; [data, data + size) must contain the lattice, but may extend beyond it
+    template <class IDMAP>
+    void fread(const char* data, size_t size, const IDMAP& idmap, size_t spunit)
+    {
+        memorysource in = {data, data + size};
+        readfrom(in, idmap, spunit);
+    }
+
+private:
+    // sources for readfrom() to read a lattice from
+    struct filesource
+    {
+        FILE* f;
+        void read(void* p, size_t n)
+        {
+            freadOrDie(p, 1, n, f);
+        }
+    };
+    struct memorysource
+    {
+        const char* p;
+        const char* end;
+        void read(void* dst, size_t n)
+        {
+            if (n > (size_t)(end - p))
+                RuntimeError("fread: lattice extends beyond the end of the archive");
+            memcpy(dst, p, n);
+            p += n;
+        }
+    };
+
+    template <class SOURCE>
+    static void checktag(SOURCE& in, const char* tag)
+    {
+        char buf[4];
+        in.read(buf, sizeof(buf));
+        if (memcmp(buf, tag, sizeof(buf)) != 0)
+            RuntimeError("fread: malformed file, expected tag '%s'", tag);
+    }
+    template <class SOURCE>
+    static size_t readtag(SOURCE& in, const char* tag)
+    {
+        checktag(in, tag);
+        int n;
+        in.read(&n, sizeof(n));
+        return (unsigned int) n;
+    }
+    template <class SOURCE, class VECTOR>
+    static void readvector(SOURCE& in, const char* tag, VECTOR& v, size_t expectedsize = SIZE_MAX)
+    {
+        const size_t sz = readtag(in, tag);
+        if (expectedsize != SIZE_MAX && sz != expectedsize)
+            RuntimeError("freadvector: malformed file, number of vector elements differs from head, for tag %s", tag);
+        v.resize(sz);
+        if (sz > 0)
+            in.read(&v[0], sz * sizeof(v[0]));
+    }
+    // read what fwritecompressed() wrote; returns the number of elements
+    template <class SOURCE>
+    static size_t readcompressed(SOURCE& in, const char* tag, size_t expectedsize, std::vector<unsigned char>& bytes)
+    {
+        const size_t sz = readtag(in, tag);
+        if (expectedsize != SIZE_MAX && sz != expectedsize)
+            RuntimeError("freadvector: malformed file, number of vector elements differs from head, for tag %s", tag);
+        int numbytes;
+        in.read(&numbytes, sizeof(numbytes));
+        bytes.resize((unsigned int) numbytes);
+        if (!bytes.empty())
+            in.read(&bytes[0], bytes.size());
+        return sz;
+    }
+
+    template <class IDMAP, class SOURCE>
+    void readfrom(SOURCE& in, const IDMAP& idmap, size_t spunit)
+    {
+        size_t version = readtag(in, "LAT ");
         if (version == 1)
         {
-            freadOrDie(&info, sizeof(info), 1, f);
-            freadvector(f, "NODE", nodes, info.numnodes);
+            in.read(&info, sizeof(info));
+            readvector(in, "NODE", nodes, info.numnodes);
             if (nodes.back().t != info.numframes)
                 RuntimeError("fread: mismatch between info.numframes and last node's time");
-            freadvector(f, "EDGE", edges, info.numedges);
-            freadvector(f, "ALIG", align);
-            fcheckTag(f, "END ");
+            readvector(in, "EDGE", edges, info.numedges);
+            readvector(in, "ALIG", align);
+            checktag(in, "END ");
             // map align ids to user's symmap  --the lattice gets updated in place here
             foreach_index (k, align)
                 align[k].updateunit(idmap); // updates itself
         }
-        else if (version == 2)
+        else if (version == 2 || version == 3)
         {
-            freadOrDie(&info, sizeof(info), 1, f);
-            freadvector(f, "NODS", nodes, info.numnodes);
+            in.read(&info, sizeof(info));
+            if (version == 2)
+            {
+                readvector(in, "NODS", nodes, info.numnodes);
+                readvector(in, "EDGS", edges2, info.numedges); // uniqued edges
+                readvector(in, "ALNS", uniquededgedatatokens); // uniqued alignments
+            }
+            else // V3: same, but compressed
+            {
+                std::vector<unsigned char> bytes;
+                decompressnodes(bytes, readcompressed(in, "NODZ", info.numnodes, bytes));
+                decompressedges(bytes, readcompressed(in, "EDGZ", info.numedges, bytes));
+                decompresstokens(bytes, readcompressed(in, "ALNZ", SIZE_MAX, bytes));
+            }
             if (nodes.back().t != info.numframes)
                 RuntimeError("fread: mismatch between info.numframes and last node's time");
-            freadvector(f, "EDGS", edges2, info.numedges); // uniqued edges
-            freadvector(f, "ALNS", uniquededgedatatokens); // uniqued alignments
-            fcheckTag(f, "END ");
+            checktag(in, "END ");
 // check if we need to map
 #if 1                                                                                     // post-bugfix for incorrect inference of spunit
             if (info.impliedspunitid != SIZE_MAX && info.impliedspunitid >= idmap.size()) // we have buggy lattices like that--what do they mean??
@@ -1064,6 +1295,169 @@ public:
             RuntimeError("fread: unsupported lattice format version");
     }
 
+    // V3 format coding of the V2 arrays: integers as varints (7 bits per byte, high bit set if more follow),
+    // signed ones zigzag-mapped (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...) so that small deltas of either sign take one byte
+    static void putvarint(std::vector<unsigned char>& bytes, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            bytes.push_back((unsigned char) (v | 0x80));
+            v >>= 7;
+        }
+        bytes.push_back((unsigned char) v);
+    }
+    static uint64_t getvarint(const unsigned char*& p, const unsigned char* end)
+    {
+        uint64_t v = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            if (p == end)
+                break;
+            const unsigned char b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return v;
+        }
+        RuntimeError("fread: malformed compressed lattice");
+    }
+    static uint64_t zigzag(int64_t v)
+    {
+        return ((uint64_t) v << 1) ^ (uint64_t)(v >> 63);
+    }
+    static int64_t unzigzag(uint64_t v)
+    {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    // nodes: delta of the time to the previous node
+    void compressnodes(std::vector<unsigned char>& bytes) const
+    {
+        bytes.clear();
+        int64_t prevt = 0;
+        foreach_index (i, nodes)
+        {
+            putvarint(bytes, zigzag(nodes[i].t - prevt));
+            prevt = nodes[i].t;
+        }
+    }
+    void decompressnodes(const std::vector<unsigned char>& bytes, size_t n)
+    {
+        const unsigned char* p = bytes.data();
+        const unsigned char* end = p + bytes.size();
+        nodes.resize(n);
+        int64_t t = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            t += unzigzag(getvarint(p, end));
+            nodes[i] = nodeinfo((size_t) t);
+        }
+    }
+
+    // edges (sorted by end node): delta of E to the previous edge with the two flag bits, E - S, and delta of firstalign to the previous edge
+    void compressedges(std::vector<unsigned char>& bytes) const
+    {
+        bytes.clear();
+        int64_t preve = 0, prevfirstalign = 0;
+        foreach_index (j, edges2)
+        {
+            const auto& e = edges2[j];
+            putvarint(bytes, (zigzag((int64_t) e.E - preve) << 2) | (e.unused << 1) | e.implysp);
+            putvarint(bytes, zigzag((int64_t) e.E - (int64_t) e.S));
+            putvarint(bytes, zigzag((int64_t) e.firstalign - prevfirstalign));
+            preve = e.E;
+            prevfirstalign = e.firstalign;
+        }
+    }
+    void decompressedges(const std::vector<unsigned char>& bytes, size_t n)
+    {
+        const unsigned char* p = bytes.data();
+        const unsigned char* end = p + bytes.size();
+        edges2.resize(n);
+        int64_t E = 0, firstalign = 0;
+        for (size_t j = 0; j < n; j++)
+        {
+            const uint64_t eandflags = getvarint(p, end);
+            E += unzigzag(eandflags >> 2);
+            const int64_t S = E - unzigzag(getvarint(p, end));
+            firstalign += unzigzag(getvarint(p, end));
+            edges2[j] = edgeinfo((size_t) S, (size_t) E, (size_t) firstalign);
+            edges2[j].unused = (eandflags >> 1) & 1;
+            edges2[j].implysp = eandflags & 1;
+        }
+    }
+
+    // alignment tokens: the scores of each unique alignment as they are, its tokens as (frames, flags) and unit
+    // Unless the tokens follow that structure (as in lattices with broken /sp/ units), they are all stored as they are.
+    bool tokensarestructured() const
+    {
+        const size_t skipscoretokens = info.hasacscores ? 2 : 1;
+        for (size_t k = 0; k < uniquededgedatatokens.size();)
+        {
+            k += skipscoretokens;
+            do
+            {
+                if (k >= uniquededgedatatokens.size())
+                    return false;
+            } while (!uniquededgedatatokens[k++].last);
+        }
+        return true;
+    }
+    void compresstokens(std::vector<unsigned char>& bytes) const
+    {
+        bytes.clear();
+        const bool structured = tokensarestructured();
+        bytes.push_back(structured ? 1 : 0);
+        const size_t skipscoretokens = structured ? (info.hasacscores ? 2 : 1) : SIZE_MAX;
+        size_t scoretokens = skipscoretokens; // number of tokens still to be stored as they are
+        for (size_t k = 0; k < uniquededgedatatokens.size(); k++)
+        {
+            const auto& ai = uniquededgedatatokens[k];
+            if (scoretokens > 0)
+            {
+                const unsigned char* raw = (const unsigned char*) &ai;
+                bytes.insert(bytes.end(), raw, raw + sizeof(ai));
+                scoretokens--;
+                continue;
+            }
+            putvarint(bytes, (ai.frames << 2) | (ai.unused << 1) | ai.last);
+            putvarint(bytes, ai.unit);
+            if (ai.last) // the scores of the next alignment follow
+                scoretokens = skipscoretokens;
+        }
+    }
+    void decompresstokens(const std::vector<unsigned char>& bytes, size_t n)
+    {
+        const unsigned char* p = bytes.data();
+        const unsigned char* end = p + bytes.size();
+        if (p == end)
+            RuntimeError("fread: malformed compressed lattice");
+        const bool structured = *p++ != 0;
+        const size_t skipscoretokens = structured ? (info.hasacscores ? 2 : 1) : SIZE_MAX;
+        uniquededgedatatokens.resize(n);
+        size_t scoretokens = skipscoretokens;
+        for (size_t k = 0; k < n; k++)
+        {
+            auto& ai = uniquededgedatatokens[k];
+            if (scoretokens > 0)
+            {
+                if (end - p < (ptrdiff_t) sizeof(ai))
+                    RuntimeError("fread: malformed compressed lattice");
+                memcpy(&ai, p, sizeof(ai));
+                p += sizeof(ai);
+                scoretokens--;
+                continue;
+            }
+            const uint64_t framesandflags = getvarint(p, end);
+            ai = aligninfo((size_t) getvarint(p, end), (size_t) (framesandflags >> 2));
+            ai.unused = (framesandflags >> 1) & 1;
+            ai.last = framesandflags & 1;
+            if (ai.last)
+                scoretokens = skipscoretokens;
+        }
+    }
+
+public:
+
     // parallel versions (defined in parallelforwardbackward.cpp)
     class parallelstate
     {
@@ -1122,8 +1516,9 @@ public:
 
 // ===========================================================================
 // archive -- a disk-based archive of lattices
-// Optimized for sequentially retrieving lattices in order of original archive
-// building process.
+// The archive files are memory-mapped, so that lattices are read in any order
+// without per-lattice I/O calls, and getlattice() may be called from several
+// threads at once (e.g. the read-ahead threads of the utterance source).
 // ===========================================================================
 
 class archive
@@ -1134,6 +1529,7 @@ class archive
     std::vector<std::wstring> archivepaths; // [archiveindex] -> archive path
     std::wstring prefixPathInToc;           // prefix path in a toc; using this to avoid pushd some path before start training
     mutable int verbosity;
+    mutable float pruningbeam, pruningminposterior; // lattice pruning at load time, see lattice::prune(); 0 = off
     size_t getarchiveindex(const std::wstring& path) // get index of a path in archivepaths[]; create new entry if needed
     {
         auto iter = std::find(archivepaths.begin(), archivepaths.end(), path);
@@ -1154,9 +1550,11 @@ class archive
             RuntimeError("getcachedidmap: symbol not found in user-supplied symbol map: %s", key.c_str());
         return iter->second;
     }
+    mutable std::mutex lazyloadmutex; // guards symmaps[] and mappedarchives[], which are filled in on first use
     template <class SYMMAP>
     const symbolidmapping& getcachedidmap(size_t archiveindex, const SYMMAP& symmap /*[string] -> numeric id*/) const
     {
+        std::lock_guard<std::mutex> lock(lazyloadmutex);
         symbolidmapping& idmap = symmaps[archiveindex];
         if (idmap.empty()) // TODO: delete this: && !modelsymmap.empty()/*no mapping; used in conversion*/)
         {                  // need to read the map and establish the mapping
@@ -1211,16 +1609,30 @@ class archive
     };
     static_assert(sizeof(latticeref) == 8, "unexpected byte size of struct latticeref");
 
-    mutable size_t currentarchiveindex;               // which archive is open
-    mutable auto_file_ptr f;                          // cached archive file handle of currentarchiveindex
-    std::unordered_map<std::wstring, latticeref> toc; // [key] -> (file, offset)  --table of content (.toc file)
+    mutable std::vector<std::shared_ptr<msra::files::mappedfile>> mappedarchives; // [archiveindex] mapping of the archive file, created on first access
+    std::unordered_map<std::wstring, latticeref> toc;                            // [key] -> (file, offset)  --table of content (.toc file)
+
+    std::shared_ptr<msra::files::mappedfile> getmappedarchive(size_t archiveindex) const
+    {
+        std::lock_guard<std::mutex> lock(lazyloadmutex);
+        auto& mapped = mappedarchives[archiveindex];
+        if (!mapped)
+            mapped = std::make_shared<msra::files::mappedfile>(archivepaths[archiveindex]);
+        return mapped;
+    }
+
 public:
     // construct = open the archive
-    // archive() : currentarchiveindex (SIZE_MAX) {}
     void setverbosity(int veb) const
     {
         verbosity = veb;
     }
+    // prune each lattice when it is loaded (see lattice::prune())
+    void setpruning(float beam, float minposterior) const
+    {
+        pruningbeam = beam;
+        pruningminposterior = minposterior;
+    }
     // test if this object is loaded with anything (if not, an empty set of TOC paths was passed--meaning disable lattice mode)
     bool empty() const
     {
@@ -1229,7 +1641,7 @@ public:
 
     // construct from a list of TOC files
     archive(const std::vector<std::wstring>& tocpaths, const std::unordered_map<std::string, size_t>& modelsymmap, const std::wstring prefixPath = L"")
-        : currentarchiveindex(SIZE_MAX), modelsymmap(modelsymmap), prefixPathInToc(prefixPath), verbosity(0)
+        : modelsymmap(modelsymmap), prefixPathInToc(prefixPath), verbosity(0), pruningbeam(0), pruningminposterior(0)
     {
         if (tocpaths.empty()) // nothing to read--keep silent
             return;
@@ -1294,6 +1706,7 @@ public:
 
         // initialize symmaps  --alloc the array, but actually read the symmap on demand
         symmaps.resize(archivepaths.size());
+        mappedarchives.resize(archivepaths.size()); // (likewise)
     }
 
     // check if a lattice for a given key is available  --do this during initial check ideally
@@ -1336,51 +1749,40 @@ public:
         if (spunit2 != spunit)
             LogicError("getlattice: huh? same lookup of /sp/ gives different result?");
 #endif
-        // open archive file in case it is not the current one
-        if (archiveindex != currentarchiveindex)
-        {
-            f = fopenOrDie(archivepaths[archiveindex], L"rbS"); // or throw (will close old 'f' iff succeeded)
-            currentarchiveindex = archiveindex;
-        }
-        try // (for read operation)
-        {
-            // seek to start
-            fsetpos(f, offset);
-            // get it
-            L.fread(f, idmap, spunit);
-            L.setverbosity(verbosity);
+        // map the archive file (once), and decode the lattice from the mapping
+        auto mapped = getmappedarchive(archiveindex);
+        if (offset >= mapped->size())
+            RuntimeError("getlattice: offset of lattice '%ls' is beyond the end of its archive", key.c_str());
+        L.fread(mapped->data() + offset, mapped->size() - offset, idmap, spunit);
+        L.setverbosity(verbosity);
 #ifdef HACK_IN_SILENCE // hack to simulate DEL in the lattice
-            const size_t silunit = getid(modelsymmap, "sil");
-            const bool addsp = true;
-            L.hackinsilencesubstitutionedges(silunit, spunit, addsp);
+        const size_t silunit = getid(modelsymmap, "sil");
+        const bool addsp = true;
+        L.hackinsilencesubstitutionedges(silunit, spunit, addsp);
 #endif
-        }
-        catch (...) // to retry a read error due to a disconnected file handle, we need to reopen the file
-        {
-            currentarchiveindex = SIZE_MAX;
-            f = NULL; // this closes the file handle
-            throw;
-        }
         // check if number of frames is as expected
         if (expectedframes != SIZE_MAX && L.getnumframes() != expectedframes)
             LogicError("getlattice: number of frames mismatch between numerator lattice and features");
         // remember the latice key for diagnostics messages
         L.key = key;
+        // prune once here, rather than running forward-backward over the full lattice in every epoch
+        L.prune(pruningbeam, pruningminposterior);
     };
 
     // static method for building an archive
     static void build(const std::vector<std::wstring>& infiles, const std::wstring& outpath,
                       const std::unordered_map<std::string, size_t>& modelsymmap,
                       const msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>& labels,
-                      const msra::lm::CMGramLM& lm, const msra::lm::CSymbolSet& unigramsymbols);
+                      const msra::lm::ILM& lm, const msra::lm::CSymbolSet& unigramsymbols);
 
     // static method for converting an archive to a new format
     // Extended features:
     //  - check consistency (don't write out)
     //  - dump to stdout
     //  - merge two lattices (for merging numer into denom lattices)
+    //  - write the compressed (V3) format
     static void convert(const std::wstring& intocpath, const std::wstring& intocpath2, const std::wstring& outpath,
-                        const msra::asr::simplesenonehmm& hset);
+                        const msra::asr::simplesenonehmm& hset, bool compressed = false);
 };
 };
 };
@@ -75,5 +75,11 @@ public:
         numlattices.setverbosity(veb);
         denlattices.setverbosity(veb);
     }
+
+    // prune the denominator lattices when they are loaded (see lattice::prune()); 0 = off
+    void setpruning(float beam, float minposterior)
+    {
+        denlattices.setpruning(beam, minposterior);
+    }
 };
 } }
@@ -0,0 +1,118 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// mappedfile.h -- read-only memory mapping of a whole file
+//
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include <string>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace msra { namespace files {
+
+// -----------------------------------------------------------------------
+// mappedfile -- maps a file read-only into memory; pages are read on first access, and only kept as long as the OS likes
+// With copyonwrite, the mapping can be written to; written pages become private copies, and the file is never modified.
+// A remote path (see isremotepath()) maps its local copy.
+// -----------------------------------------------------------------------
+
+class mappedfile
+{
+    mappedfile(const mappedfile &);
+    void operator=(const mappedfile &);
+
+public:
+    mappedfile(const std::wstring &remoteorlocalpath, bool copyonwrite = false)
+        : base(nullptr), mappedsize(0)
+    {
+        const std::wstring path = isremotepath(remoteorlocalpath) ? getremotelocalcopy(remoteorlocalpath) : remoteorlocalpath;
+#ifdef _WIN32
+        HANDLE hfile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE)
+            RuntimeError("mappedfile: cannot open %ls, error %d", path.c_str(), (int) GetLastError());
+        LARGE_INTEGER size;
+        GetFileSizeEx(hfile, &size);
+        mappedsize = (size_t) size.QuadPart;
+        if (mappedsize == 0) // (cannot map empty files)
+        {
+            CloseHandle(hfile);
+            return;
+        }
+        HANDLE hmapping = CreateFileMappingW(hfile, NULL, copyonwrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(hfile);
+        if (hmapping == NULL)
+            RuntimeError("mappedfile: cannot map %ls, error %d", path.c_str(), (int) GetLastError());
+        base = (const char *) MapViewOfFile(hmapping, copyonwrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hmapping); // (the view keeps the mapping alive)
+        if (base == nullptr)
+            RuntimeError("mappedfile: cannot map %ls, error %d", path.c_str(), (int) GetLastError());
+#else
+        int fd = open(msra::strfun::utf8(path).c_str(), O_RDONLY);
+        if (fd < 0)
+            RuntimeError("mappedfile: cannot open %ls, error %d", path.c_str(), errno);
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            RuntimeError("mappedfile: cannot stat %ls, error %d", path.c_str(), errno);
+        }
+        mappedsize = (size_t) st.st_size;
+        if (mappedsize == 0) // (cannot map empty files)
+        {
+            ::close(fd);
+            return;
+        }
+        void *p = copyonwrite ? mmap(nullptr, mappedsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : mmap(nullptr, mappedsize, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // (the mapping keeps the file open)
+        if (p == MAP_FAILED)
+            RuntimeError("mappedfile: cannot map %ls, error %d", path.c_str(), errno);
+        base = (const char *) p;
+#endif
+    }
+    ~mappedfile()
+    {
+        if (base == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap((void *) base, mappedsize);
+#endif
+    }
+
+    const char *data() const
+    {
+        return base;
+    }
+    size_t size() const
+    {
+        return mappedsize;
+    }
+
+    // hint that [offset, offset + n) will be read soon, so that it is read ahead as one sequential stream
+    void prefetch(size_t offset, size_t n) const
+    {
+#ifndef _WIN32
+        const size_t pagesize = 4096; // (madvise() needs a page-aligned start)
+        const size_t begin = offset / pagesize * pagesize;
+        if (base && n > 0)
+            madvise((void *) (base + begin), offset + n - begin, MADV_WILLNEED);
+#endif
+    }
+
+private:
+    const char *base;
+    size_t mappedsize;
+};
+} }
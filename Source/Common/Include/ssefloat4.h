@@ -211,5 +211,90 @@ public:
 
     // please add anything else you might need HERE
 };
+
+// ===========================================================================
+// AVX2 variants of the inner loops of ssematrixbase::dotprod() and dotprod4()
+//
+// These are compiled for AVX2+FMA regardless of the compiler flags of the including
+// binary, and must only be called if cpusupportsavx2(), which is checked once at runtime.
+// The vector lengths are multiples of 4 (ssematrix pads its columns), not necessarily of 8.
+// ===========================================================================
+
+#ifdef _MSC_VER
+#define SSE_TARGET_AVX2 // MSVC compiles AVX intrinsics without special flags
+#else
+#define SSE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+static inline bool cpusupportsavx2()
+{
+    static const bool supported = []() -> bool
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0, fma = (info[2] & (1 << 12)) != 0;
+        if (!osxsave || !fma || (_xgetbv(0) & 6) != 6) // OS must save the YMM registers
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    }();
+    return supported;
+}
+
+SSE_TARGET_AVX2 static inline float hsumavx2(__m256 acc8, __m128 acc4)
+{
+    acc4 = _mm_add_ps(acc4, _mm_add_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1)));
+    acc4 = _mm_hadd_ps(acc4, acc4);
+    acc4 = _mm_hadd_ps(acc4, acc4);
+    return _mm_cvtss_f32(acc4);
+}
+
+// sum of a[m] * b[m] over m < n
+SSE_TARGET_AVX2 static inline float dotprodavx2(const float* a, const float* b, size_t n)
+{
+    __m256 acc8 = _mm256_setzero_ps();
+    size_t m = 0;
+    for (; m + 8 <= n; m += 8)
+        acc8 = _mm256_fmadd_ps(_mm256_loadu_ps(a + m), _mm256_loadu_ps(b + m), acc8);
+    __m128 acc4 = _mm_setzero_ps();
+    for (; m < n; m += 4)
+        acc4 = _mm_fmadd_ps(_mm_loadu_ps(a + m), _mm_loadu_ps(b + m), acc4);
+    return hsumavx2(acc8, acc4);
+}
+
+// dot products of 'row' with 4 columns at col0 + k * colstride, k = 0..3, loading each 'row' value only once
+SSE_TARGET_AVX2 static inline void dotprod4avx2(const float* row, const float* col0, size_t colstride, size_t n, float (&result)[4])
+{
+    const float* col1 = col0 + colstride;
+    const float* col2 = col1 + colstride;
+    const float* col3 = col2 + colstride;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t m = 0;
+    for (; m + 8 <= n; m += 8)
+    {
+        const __m256 r = _mm256_loadu_ps(row + m);
+        acc0 = _mm256_fmadd_ps(r, _mm256_loadu_ps(col0 + m), acc0);
+        acc1 = _mm256_fmadd_ps(r, _mm256_loadu_ps(col1 + m), acc1);
+        acc2 = _mm256_fmadd_ps(r, _mm256_loadu_ps(col2 + m), acc2);
+        acc3 = _mm256_fmadd_ps(r, _mm256_loadu_ps(col3 + m), acc3);
+    }
+    __m128 rem0 = _mm_setzero_ps(), rem1 = _mm_setzero_ps(), rem2 = _mm_setzero_ps(), rem3 = _mm_setzero_ps();
+    for (; m < n; m += 4)
+    {
+        const __m128 r = _mm_loadu_ps(row + m);
+        rem0 = _mm_fmadd_ps(r, _mm_loadu_ps(col0 + m), rem0);
+        rem1 = _mm_fmadd_ps(r, _mm_loadu_ps(col1 + m), rem1);
+        rem2 = _mm_fmadd_ps(r, _mm_loadu_ps(col2 + m), rem2);
+        rem3 = _mm_fmadd_ps(r, _mm_loadu_ps(col3 + m), rem3);
+    }
+    result[0] = hsumavx2(acc0, rem0);
+    result[1] = hsumavx2(acc1, rem1);
+    result[2] = hsumavx2(acc2, rem2);
+    result[3] = hsumavx2(acc3, rem3);
+}
 };
 };
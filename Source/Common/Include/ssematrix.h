@@ -19,9 +19,15 @@
 #include "pplhelpers.h"
 #include "numahelpers.h"
 #endif
+#include "AlignedMemory.h"
 #include "fileutil.h" // for saving and reading matrices
 #include <limits>     // for NaN
 #include <malloc.h>
+#if defined(USE_MKL) // (set by the Makefile for all sources; the math library links it in)
+#include <mkl.h>
+#elif defined(USE_ACML)
+#include <acml.h>
+#endif
 
 #ifdef min
 #undef min // some garbage from some Windows header that conflicts with std::min()
@@ -387,17 +393,24 @@ public:
         assert((15 & reinterpret_cast<uintptr_t>(&b[0])) == 0); // enforce SSE alignment
 
         size_t nlong = (a.size() + 3) / 4; // number of SSE elements
-        const msra::math::float4 *pa = (const msra::math::float4 *) &a[0];
-        const msra::math::float4 *pb = (const msra::math::float4 *) &b[0];
+        float sum;
+        if (msra::math::cpusupportsavx2())
+            sum = msra::math::dotprodavx2(&a[0], &b[0], 4 * nlong);
+        else
+        {
+            const msra::math::float4 *pa = (const msra::math::float4 *) &a[0];
+            const msra::math::float4 *pb = (const msra::math::float4 *) &b[0];
 
-        msra::math::float4 acc = pa[0] * pb[0];
-        for (size_t m = 1; m < nlong; m++)
-            acc += pa[m] * pb[m];
+            msra::math::float4 acc = pa[0] * pb[0];
+            for (size_t m = 1; m < nlong; m++)
+                acc += pa[m] * pb[m];
+            sum = acc.sum();
+        }
         // final sum
         if (addtoresult)
-            result = result * thisscale + weight * acc.sum();
+            result = result * thisscale + weight * sum;
         else
-            result = acc.sum();
+            result = sum;
     }
 
     // dot product of a matrix row with 4 columns at the same time
@@ -428,6 +441,15 @@ public:
         // perform multiple columns in parallel
         const size_t nlong = (row.size() + 3) / 4; // number of SSE elements
 
+        if (msra::math::cpusupportsavx2())
+        {
+            float sums[4];
+            msra::math::dotprod4avx2(&row[0], &cols4[0], cols4stride, 4 * nlong, sums);
+            for (size_t k = 0; k < 4; k++)
+                usij[k * usijstride] = addtoresult ? usij[k * usijstride] * thisscale + weight * sums[k] : sums[k];
+            return;
+        }
+
         // row
         const msra::math::float4 *prow = (const msra::math::float4 *) &row[0];
 
@@ -491,6 +513,32 @@ public:
         }
     }
 
+    // c = thisscale * c + weight * op(a) * op(b) through the BLAS the build is configured with (MKL or ACML), if any,
+    // column-major with the given leading dimensions (our colstride)
+    // Returns false if there is none, or if the product is too small to be worth the call; then the caller falls back to the SSE code.
+#if defined(USE_MKL) || defined(USE_ACML)
+    static bool blasmatprod(bool transa, bool transb, size_t m, size_t n, size_t k, float weight, const float *a, size_t lda,
+                            const float *b, size_t ldb, float thisscale, float *c, size_t ldc)
+    {
+        const size_t minmultiplyadds = 32 * 32 * 32; // below this, the call overhead eats the gain
+        if (m == 0 || n == 0 || k == 0 || m * n * k < minmultiplyadds)
+            return false;
+#ifdef USE_MKL
+        cblas_sgemm(CblasColMajor, transa ? CblasTrans : CblasNoTrans, transb ? CblasTrans : CblasNoTrans, (int) m, (int) n, (int) k,
+                    weight, a, (int) lda, b, (int) ldb, thisscale, c, (int) ldc);
+#else
+        sgemm(transa ? 'T' : 'N', transb ? 'T' : 'N', (int) m, (int) n, (int) k,
+              weight, const_cast<float *>(a), (int) lda, const_cast<float *>(b), (int) ldb, thisscale, c, (int) ldc);
+#endif
+        return true;
+    }
+#else
+    static bool blasmatprod(bool, bool, size_t, size_t, size_t, float, const float *, size_t, const float *, size_t, float, float *, size_t)
+    {
+        return false; // no BLAS in this build
+    }
+#endif
+
     // this = M * V where M is passed as its transposed form M'
 
     void matprod_mtm(const ssematrixbase &Mt, const ssematrixbase &V)
@@ -578,6 +626,10 @@ public:
         assert(us.cols() == V.cols());
         assert(beginrow < endrow && endrow <= Mt.cols()); // remember that cols of Mt are the rows of M
 
+        if (blasmatprod(true, false, endrow - beginrow, V.cols(), V.rows(), 1.0f, &Mt.p[Mt.locate(0, beginrow)], Mt.colstride,
+                        V.p, V.colstride, 0.0f, &us.p[us.locate(beginrow, 0)], us.colstride))
+            return;
+
         // overall execution of matrix product, optimized for 128 KB first-level CPU cache
         //  - loop over col stripes {j} of V, e.g. 24 (note that columns are independent)
         //    Col stripes are chosen such that row stripes of V of 1024 rows fit the cache (24x1024=96 KB)
@@ -681,6 +733,9 @@ public:
         assert(A.cols() == Bt.cols());  // Bt.cols() == B.rows()
         // fprintf (stderr, "0x%x(%d,%d) x 0x%x(%d,%d)' -> 0x%x(%d,%d)\n", A.p, A.rows(), A.cols(), Bt.p, Bt.rows(), Bt.cols(), us.p, us.rows(), us.cols());
 
+        if (blasmatprod(false, true, us.rows(), us.cols(), A.cols(), 1.0f, A.p, A.colstride, Bt.p, Bt.colstride, 0.0f, us.p, us.colstride))
+            return;
+
         foreach_coord (i, j, us)
         {
             // us(i,j) = dotprod (A.row(i), B.col(j))
@@ -701,6 +756,8 @@ public:
         assert(us.rows() == A.rows() && B.cols() == us.cols());
         size_t K = A.cols();
         assert(K == B.rows());
+        if (blasmatprod(false, false, us.rows(), us.cols(), K, 1.0f, A.p, A.colstride, B.p, B.colstride, 0.0f, us.p, us.colstride))
+            return;
         foreach_coord (i, j, us)
         {
             float sum = 0.0;
@@ -939,6 +996,10 @@ public:
         assert(us.cols() == V.cols());
         assert(i0 < i1 && i1 <= Mt.cols());
 
+        if (blasmatprod(true, false, i1 - i0, V.cols(), V.rows(), otherweight, &Mt.p[Mt.locate(0, i0)], Mt.colstride,
+                        V.p, V.colstride, thisscale, &us.p[us.locate(i0, 0)], us.colstride))
+            return;
+
         const size_t cacheablecolsV = V.cacheablecols();
 
         // loop over stripes of V
@@ -1340,41 +1401,27 @@ public:
 template <class ssematrixbase>
 class ssematrix : public ssematrixbase
 {
-    // helpers for SSE-compatible memory allocation
+    // helpers for SSE-compatible memory allocation: cache-line aligned, and on huge pages if so configured (SetAlignedMemoryHugePages())
     static __declspec_noreturn void failed(size_t nbytes)
     {
         BadExceptionError("allocation of SSE vector failed (%d bytes)", nbytes);
     }
-#ifdef _WIN32
-    template <typename T>
-    static T *new_sse(size_t nbytes)
-    {
-        T *pv = (T *) _aligned_malloc(nbytes * sizeof(T), 16);
-        if (pv)
-            return pv;
-        failed(nbytes * sizeof(T));
-    }
-    static void delete_sse(void *p)
-    {
-        if (p)
-            _aligned_free(p);
-    }
-#endif
-#ifdef __unix__
     template <typename T>
     static T *new_sse(size_t nbytes)
     {
-        T *pv = (T *) _mm_malloc(nbytes * sizeof(T), 16);
-        if (pv)
-            return pv;
-        failed(nbytes * sizeof(T));
+        try
+        {
+            return (T *) Microsoft::MSR::CNTK::AllocateAlignedMemory(nbytes * sizeof(T));
+        }
+        catch (const std::bad_alloc &)
+        {
+            failed(nbytes * sizeof(T));
+        }
     }
     static void delete_sse(void *p)
     {
-        if (p)
-            _mm_free(p);
+        Microsoft::MSR::CNTK::FreeAlignedMemory(p);
     }
-#endif
 
     // helper to assign a copy from another matrix
     void assign(const ssematrixbase &other)
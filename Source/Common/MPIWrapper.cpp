@@ -2,3 +2,4 @@
 #include "Include/MPIWrapper.h"
 
 int Microsoft::MSR::CNTK::MPIWrapper::s_myRank = -1;
+bool Microsoft::MSR::CNTK::MpiFail::s_throwOnLostWorkers = false;
@@ -36,6 +36,12 @@
 #include <limits.h>
 #include <memory>
 #include <cwctype>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
 #ifndef UNDER_CE // some headers don't exist under winCE - the appropriate definitions seem to be in stdlib.h
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <fcntl.h> // for _O_BINARY/TEXT - not needed for wince
@@ -229,8 +235,17 @@ FILE* fopenStdHandle(const _T* mode)
     return f;
 }
 
+// whether fopen() with this mode only reads
+template <class _T>
+static bool isreadonlymode(const _T* mode)
+{
+    return !strchr(mode, 'w') && !strchr(mode, 'a') && !strchr(mode, '+');
+}
+
 FILE* fopenOrDie(const string& pathname, const char* mode)
 {
+    if (isreadonlymode(mode) && isremotepath(msra::strfun::utf16(pathname)))
+        return fopenOrDie(getremotelocalcopy(msra::strfun::utf16(pathname)), msra::strfun::utf16(mode).c_str());
     FILE* f = (pathname[0] == '-') ? fopenStdHandle(mode) : fopen(pathname.c_str(), mode);
     if (f == NULL)
     {
@@ -245,6 +260,8 @@ FILE* fopenOrDie(const string& pathname, const char* mode)
 
 FILE* fopenOrDie(const wstring& pathname, const wchar_t* mode)
 {
+    if (isreadonlymode(mode) && isremotepath(pathname))
+        return fopenOrDie(getremotelocalcopy(pathname), mode);
     FILE* f = (pathname[0] == '-') ? fopenStdHandle(mode) : _wfopen(pathname.c_str(), mode);
     if (f == NULL)
     {
@@ -257,6 +274,266 @@ FILE* fopenOrDie(const wstring& pathname, const wchar_t* mode)
     return f;
 }
 
+// ----------------------------------------------------------------------------
+// remote storage (see fileutil.h)
+// ----------------------------------------------------------------------------
+
+// the scheme of a path scheme://..., in upper case; empty if it is none
+static string remotescheme(const wstring& path)
+{
+    const size_t end = path.find(L"://");
+    if (end == wstring::npos || end < 2) // (a drive letter is not a scheme)
+        return string();
+    string scheme;
+    for (size_t i = 0; i < end; i++)
+    {
+        if (!iswalnum(path[i]) && path[i] != L'+' && path[i] != L'-' && path[i] != L'.')
+            return string();
+        scheme.push_back((char) toupper((int) path[i]));
+    }
+    return scheme;
+}
+
+// the command of a scheme for an operation (RANGE or SIZE), or an empty string if there is none
+static string remotecommand(const string& scheme, const char* operation)
+{
+    const char* command = getenv(("CNTK_STORAGE_" + scheme + "_" + operation).c_str());
+    if (command && *command)
+        return command;
+    if (scheme == "HTTP" || scheme == "HTTPS")
+        return !strcmp(operation, "RANGE") ? "curl -sfL -r {first}-{last} {url}" : "curl -sfIL {url}";
+    return string();
+}
+
+static size_t remotesetting(const char* name, size_t defaultValue)
+{
+    const char* value = getenv(name);
+    return (value && atoi(value) > 0) ? (size_t) atoi(value) : defaultValue;
+}
+
+bool isremotepath(const wstring& path)
+{
+    const string scheme = remotescheme(path);
+    return !scheme.empty() && !remotecommand(scheme, "RANGE").empty();
+}
+
+// a string as a single argument of the shell that _wpopen() runs, so that the path cannot inject commands
+static string shellquote(const string& s)
+{
+#ifdef _WIN32 // cmd.exe: there is no way to escape a double quote inside double quotes; a valid URL has it percent-encoded anyway
+    if (s.find('"') != string::npos)
+        InvalidArgument("remote storage: path %s must not contain a double quote", s.c_str());
+    return "\"" + s + "\"";
+#else // sh: nothing is special inside single quotes except the single quote itself, which we close, escape, and reopen
+    string quoted = "'";
+    for (char c : s)
+        quoted += c == '\'' ? string("'\\''") : string(1, c);
+    return quoted + "'";
+#endif
+}
+
+// run a command of a scheme with {url} (quoted), {first} and {last} replaced, and append what it writes to stdout to 'output'
+static void runremotecommand(const wstring& path, const char* operation, uint64_t first, uint64_t last, vector<char>& output)
+{
+    const string templ = remotecommand(remotescheme(path), operation);
+    if (templ.empty())
+        RuntimeError("remote storage: no CNTK_STORAGE_%s_%s command for %ls", remotescheme(path).c_str(), operation, path.c_str());
+    const pair<const char*, string> replacements[] = {{"{url}", shellquote(msra::strfun::utf8(path))}, {"{first}", to_string(first)}, {"{last}", to_string(last)}};
+    // (a single pass over the template, so that the replacements are never searched for placeholders themselves)
+    string command;
+    for (size_t pos = 0; pos < templ.size();)
+    {
+        const pair<const char*, string>* replacement = nullptr;
+        for (const auto& r : replacements)
+            if (templ.compare(pos, strlen(r.first), r.first) == 0)
+                replacement = &r;
+        if (replacement)
+        {
+            command += replacement->second;
+            pos += strlen(replacement->first);
+        }
+        else
+            command += templ[pos++];
+    }
+#ifdef _WIN32
+    FILE* f = _wpopen(msra::strfun::utf16(command).c_str(), L"rb");
+#else
+    FILE* f = _wpopen(msra::strfun::utf16(command).c_str(), L"r");
+#endif
+    if (!f)
+        RuntimeError("remote storage: cannot run '%s': %s", command.c_str(), strerror(errno));
+    char buffer[65536];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), f)) > 0;)
+        output.insert(output.end(), buffer, buffer + n);
+    if (_pclose(f) != 0)
+        RuntimeError("remote storage: '%s' failed", command.c_str());
+}
+
+// the size of a remote file: the number that the SIZE command prints, or the (last, after redirects) Content-Length among its HTTP headers
+static uint64_t remotefilesize(const wstring& path)
+{
+    vector<char> output;
+    runremotecommand(path, "SIZE", 0, 0, output);
+    string text(output.begin(), output.end());
+    string lower(text);
+    transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (char) tolower((unsigned char) c); });
+    const size_t header = lower.rfind("content-length:");
+    const char* number = text.c_str() + ((header != string::npos) ? header + strlen("content-length:") : 0);
+    char* end;
+    const uint64_t size = strtoull(number, &end, 10);
+    if (end == number)
+        RuntimeError("remote storage: cannot determine the size of %ls from '%s'", path.c_str(), text.c_str());
+    return size;
+}
+
+// where the local copy of a remote file goes: the cache directory, a hash of the path, and the file name
+static wstring remotelocalpath(const wstring& path)
+{
+    wstring cache;
+    const char* cacheDir = getenv("CNTK_STORAGE_CACHE");
+    if (cacheDir && *cacheDir)
+        cache = msra::strfun::utf16(cacheDir);
+    else
+    {
+#ifdef _WIN32
+        wchar_t temp[MAX_PATH + 1];
+        cache = GetTempPathW(MAX_PATH + 1, temp) ? temp : L".";
+#else
+        const char* temp = getenv("TMPDIR");
+        cache = msra::strfun::utf16((temp && *temp) ? temp : "/tmp");
+#endif
+        cache += L"/cntk-storage-cache";
+    }
+    wstring name = path.substr(path.find_last_of(L"/") + 1);
+    name = name.substr(0, min(name.find_first_of(L"?#"), (size_t) 64));
+    for (auto& c : name)
+    {
+        if (!iswalnum(c) && c != L'.' && c != L'-' && c != L'_')
+            c = L'_';
+    }
+    wchar_t hash[32];
+    swprintf(hash, sizeof(hash) / sizeof(*hash), L"%016llx", (unsigned long long) std::hash<wstring>()(path));
+    return cache + L"/" + hash + L"_" + name;
+}
+
+// fetch a remote file into its local copy, the blocks on parallel threads, each writing at its offset of a temporary file,
+// which becomes the local copy only when it is complete (so that an interrupted fetch leaves no partial copy behind)
+static wstring fetchremotefile(const wstring& path)
+{
+    const wstring localPath = remotelocalpath(path);
+    if (fexists(localPath))
+        return localPath;
+
+    const uint64_t size = remotefilesize(path);
+    const uint64_t blockSize = (uint64_t) remotesetting("CNTK_STORAGE_BLOCK_MB", 8) << 20;
+    const size_t numBlocks = (size_t) ((size + blockSize - 1) / blockSize);
+    const size_t numThreads = min(remotesetting("CNTK_STORAGE_PARALLEL", 16), max(numBlocks, (size_t) 1));
+    fprintf(stderr, "remote storage: fetching %ls (%.1f MB) into %ls\n", path.c_str(), size / 1048576.0, localPath.c_str());
+
+    msra::files::make_intermediate_dirs(localPath);
+    const wstring partPath = localPath + L"." + to_wstring((int) GetCurrentProcessId()) + L"." + to_wstring(std::hash<std::thread::id>()(std::this_thread::get_id())) + L".part";
+    fclose(fopenOrDie(partPath, L"wb"));
+
+    atomic<size_t> nextBlock(0);
+    atomic<bool> failed(false);
+    mutex errorMutex;
+    exception_ptr error;
+    vector<thread> threads;
+    for (size_t k = 0; k < numThreads; k++)
+    {
+        threads.push_back(thread([&]()
+        {
+            try
+            {
+                FILE* f = fopenOrDie(partPath, L"r+b");
+                vector<char> data;
+                for (size_t b; !failed && (b = nextBlock++) < numBlocks;)
+                {
+                    const uint64_t first = b * blockSize;
+                    const uint64_t last = min(first + blockSize, size) - 1;
+                    for (int attempt = 1;; attempt++) // (a few retries, since requests to object storage do fail now and then)
+                    {
+                        data.clear();
+                        try
+                        {
+                            runremotecommand(path, "RANGE", first, last, data);
+                        }
+                        catch (const exception&)
+                        {
+                            if (attempt >= 3)
+                                throw;
+                            continue;
+                        }
+                        if (data.size() == last + 1 - first)
+                            break;
+                        if (attempt >= 3)
+                            RuntimeError("remote storage: got %d bytes instead of %d of %ls at offset %llu", (int) data.size(), (int) (last + 1 - first), path.c_str(), (unsigned long long) first);
+                    }
+                    fsetpos(f, first);
+                    fwriteOrDie(data, f);
+                }
+                fclose(f);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(errorMutex);
+                if (!failed)
+                    error = current_exception();
+                failed = true;
+            }
+        }));
+    }
+    for (auto& t : threads)
+        t.join();
+    if (error)
+    {
+        _wunlink(partPath.c_str());
+        rethrow_exception(error);
+    }
+    if (fexists(localPath)) // (another process was faster)
+        _wunlink(partPath.c_str());
+    else
+        renameOrDie(partPath, localPath);
+    return localPath;
+}
+
+// the fetches in progress or done in this process, so that each file is fetched once
+static mutex s_remoteFetchesMutex;
+static map<wstring, shared_future<wstring>> s_remoteFetches;
+
+static shared_future<wstring> startremotefetch(const wstring& path)
+{
+    lock_guard<mutex> lock(s_remoteFetchesMutex);
+    auto iter = s_remoteFetches.find(path);
+    if (iter == s_remoteFetches.end())
+        iter = s_remoteFetches.insert(make_pair(path, async(launch::async, [path]() { return fetchremotefile(path); }).share())).first;
+    return iter->second;
+}
+
+wstring getremotelocalcopy(const wstring& path)
+{
+    const wstring localPath = remotelocalpath(path);
+    if (fexists(localPath))
+        return localPath;
+    auto fetch = startremotefetch(path);
+    try
+    {
+        return fetch.get();
+    }
+    catch (...)
+    {
+        lock_guard<mutex> lock(s_remoteFetchesMutex); // (the next open tries again)
+        s_remoteFetches.erase(path);
+        throw;
+    }
+}
+
+void prefetchremotefile(const wstring& path)
+{
+    if (!fexists(remotelocalpath(path)))
+        startremotefetch(path);
+}
+
 // ----------------------------------------------------------------------------
 // set mode to binary or text (pass 'b' or 't')
 // ----------------------------------------------------------------------------
@@ -484,6 +761,20 @@ int64_t filesize64(const wchar_t* pathname)
 }
 #endif
 
+int64_t filemodtime64(const wchar_t* pathname)
+{
+#ifdef _WIN32
+    struct _stat64 fileinfo;
+    if (_wstat64(pathname, &fileinfo) == -1)
+        return 0;
+#else
+    struct stat fileinfo;
+    if (stat(wtocharpath(pathname).c_str(), &fileinfo) == -1)
+        return 0;
+#endif
+    return (int64_t) fileinfo.st_mtime;
+}
+
 // ----------------------------------------------------------------------------
 // fget/setpos(): seek functions with error handling
 // ----------------------------------------------------------------------------
@@ -595,6 +886,26 @@ void renameOrDie(const std::wstring& from, const std::wstring& to)
 #endif
 }
 
+// ----------------------------------------------------------------------------
+// uniquetemppath(): a temp name for 'path' that no other process uses, e.g. path.myhost.1234.tmp
+// ----------------------------------------------------------------------------
+
+wstring uniquetemppath(const wstring& path)
+{
+#ifdef _WIN32
+    wchar_t host[MAX_COMPUTERNAME_LENGTH + 1];
+    DWORD hostlen = _countof(host);
+    if (!GetComputerNameW(host, &hostlen))
+        wcscpy(host, L"localhost");
+    const wstring hostname = host;
+#else
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const wstring hostname = msra::strfun::utf16(host);
+#endif
+    return path + L"." + hostname + msra::strfun::wstrprintf(L".%d.tmp", (int) GetCurrentProcessId());
+}
+
 // ----------------------------------------------------------------------------
 // fputstring(): write a 0-terminated string
 // ----------------------------------------------------------------------------
@@ -33,17 +33,29 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 // -----------------------------------------------------------------------
 
 template <>
-vector<shared_ptr<Matrix<float>>>& MatrixPool::GetReleasedMatrices<float>()
+vector<MatrixPool::PooledMatrix<float>>& MatrixPool::GetReleasedMatrices<float>()
 {
     return m_releasedFloatMatrices;
 }
 
 template <>
-vector<shared_ptr<Matrix<double>>>& MatrixPool::GetReleasedMatrices<double>()
+vector<MatrixPool::PooledMatrix<double>>& MatrixPool::GetReleasedMatrices<double>()
 {
     return m_releasedDoubleMatrices;
 }
 
+template <>
+map<DEVICEID_TYPE, shared_ptr<Matrix<float>>>& MatrixPool::GetWorkspaces<float>()
+{
+    return m_floatWorkspaces;
+}
+
+template <>
+map<DEVICEID_TYPE, shared_ptr<Matrix<double>>>& MatrixPool::GetWorkspaces<double>()
+{
+    return m_doubleWorkspaces;
+}
+
 // -----------------------------------------------------------------------
 // construction
 // -----------------------------------------------------------------------
@@ -98,15 +110,66 @@ void ComputationNetwork::Save(const wstring& fileName, const FileOptions fileFor
     }
 }
 
+// parameter blobs of models saved with fileOptionsMappableParameters start at multiples of this
+static const size_t mappedParameterAlignment = 4096;
+
+static void PadToMappedParameterAlignment(File& fstream)
+{
+    const std::vector<char> padding((size_t)((mappedParameterAlignment - fstream.GetPosition() % mappedParameterAlignment) % mappedParameterAlignment), 0);
+    fwriteOrDie(padding.data(), 1, padding.size(), fstream);
+}
+
+// write the value of a LearnableParameter<ElemType> whose Save() left it out; returns false if the node is none such
+template <class ElemType>
+static bool TrySaveMappedValue(const ComputationNodeBasePtr& node, File& fstream, size_t& rows, size_t& cols, size_t& elemSize)
+{
+    auto param = dynamic_pointer_cast<LearnableParameter<ElemType>>(node);
+    if (!param || !param->IsValueMappable(fstream))
+        return false;
+    rows = param->SavedValue().GetNumRows();
+    cols = param->SavedValue().GetNumCols();
+    elemSize = param->SaveMappedValue(fstream);
+    return true;
+}
+
+template <class ElemType>
+static bool TrySnapshotValue(const ComputationNodeBasePtr& node, bool release)
+{
+    auto param = dynamic_pointer_cast<LearnableParameter<ElemType>>(node);
+    if (!param)
+        return false;
+    if (release)
+        param->ReleaseValueSnapshot();
+    else
+        param->SnapshotValue();
+    return true;
+}
+
+// copy all LearnableParameter values to CPU memory; until ReleaseParameterSnapshot(), Save() writes these copies
+// This lets a background thread save the model while training modifies the parameters.
+void ComputationNetwork::SnapshotParameters()
+{
+    for (auto nodeIter = m_nameToNodeMap.begin(); nodeIter != m_nameToNodeMap.end(); nodeIter++)
+        TrySnapshotValue<float>(nodeIter->second, false) || TrySnapshotValue<double>(nodeIter->second, false);
+}
+
+void ComputationNetwork::ReleaseParameterSnapshot()
+{
+    for (auto nodeIter = m_nameToNodeMap.begin(); nodeIter != m_nameToNodeMap.end(); nodeIter++)
+        TrySnapshotValue<float>(nodeIter->second, true) || TrySnapshotValue<double>(nodeIter->second, true);
+}
+
 // TODO: how does the file distinguish float vs double nodes?
 void ComputationNetwork::SaveToFileImpl(const wstring& fileName, const FileOptions fileFormat) const
 {
-    File fstream(fileName, fileFormat | FileOptions::fileOptionsWrite);
+    File fstream(fileName, fileFormat | FileOptions::fileOptionsWrite | FileOptions::fileOptionsSequential);
     fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BCN");
 
     // model version
     fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BVersion");
     fstream << (size_t) CURRENT_CNTK_MODEL_VERSION;
+    const uint64_t mappedIndexPositionPosition = fstream.GetPosition();
+    fstream << (uint64_t) 0; // position of the parameter-blob index, filled in below if there is one
     fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EVersion");
 
     fstream << (size_t) m_nameToNodeMap.size();
@@ -185,6 +248,39 @@ void ComputationNetwork::SaveToFileImpl(const wstring& fileName, const FileOptio
 
     fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ECN");
 
+    // with fileOptionsMappableParameters, LearnableParameter values follow as page-aligned blobs, so that the loader can
+    // memory-map them instead of reading them (see ReadMappedParameters()), and then an index of the blobs
+    if (fstream.IsMappableParameters())
+    {
+        struct MappedBlob
+        {
+            wstring nodeName;
+            size_t rows, cols, elemSize;
+            uint64_t offset;
+        };
+        vector<MappedBlob> blobs;
+        for (auto nodeIter = m_nameToNodeMap.begin(); nodeIter != m_nameToNodeMap.end(); nodeIter++)
+        {
+            PadToMappedParameterAlignment(fstream);
+            MappedBlob blob;
+            blob.nodeName = nodeIter->first;
+            blob.offset = fstream.GetPosition();
+            if (TrySaveMappedValue<float>(nodeIter->second, fstream, blob.rows, blob.cols, blob.elemSize) ||
+                TrySaveMappedValue<double>(nodeIter->second, fstream, blob.rows, blob.cols, blob.elemSize))
+                blobs.push_back(blob);
+        }
+
+        const uint64_t indexPosition = fstream.GetPosition();
+        fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BMappedParameters");
+        fstream << blobs.size();
+        for (const auto& blob : blobs)
+            fstream << blob.nodeName << blob.rows << blob.cols << blob.elemSize << blob.offset;
+        fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EMappedParameters");
+
+        fstream.SetPosition(mappedIndexPositionPosition);
+        fstream << indexPosition;
+    }
+
     fstream.Flush();
 }
 
@@ -198,9 +294,14 @@ void ComputationNetwork::ReadPersistableParameters(File& fstream, bool create)
 
     // model version
     size_t modelVersion = CNTK_MODEL_VERSION_1; // if version info is not there it is version 1
+    uint64_t mappedIndexPosition = 0;
     if (fstream.TryGetMarker(FileMarker::fileMarkerBeginSection, L"BVersion"))
     {
         fstream >> modelVersion;
+        if (modelVersion > CURRENT_CNTK_MODEL_VERSION)
+            RuntimeError("Read: The model has version %d, but this version of CNTK can only read versions up to %d.", (int) modelVersion, (int) CURRENT_CNTK_MODEL_VERSION);
+        if (modelVersion >= CNTK_MODEL_VERSION_3)
+            fstream >> mappedIndexPosition;
         fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EVersion");
     }
 
@@ -216,7 +317,10 @@ void ComputationNetwork::ReadPersistableParameters(File& fstream, bool create)
 
         ComputationNodeBasePtr node;
         if (create) // loading from scratch
-            node = ComputationNetworkBuilder<ElemType>::NewNode(opName, m_deviceId, nodeName);
+        {
+            auto placement = m_nodeDevicePlacement.find(nodeName);
+            node = ComputationNetworkBuilder<ElemType>::NewNode(opName, placement != m_nodeDevicePlacement.end() ? placement->second : m_deviceId, nodeName);
+        }
         else // reloading existing
             node = GetNodeFromName(nodeName);
 
@@ -229,6 +333,34 @@ void ComputationNetwork::ReadPersistableParameters(File& fstream, bool create)
     }
 
     fstream.GetMarker(FileMarker::fileMarkerEndSection, L"ENodeList");
+
+    if (mappedIndexPosition != 0)
+        ReadMappedParameters<ElemType>(fstream, mappedIndexPosition);
+}
+
+// map the file and hand the LearnableParameters their values, as listed in the index written by SaveToFileImpl()
+template <class ElemType>
+void ComputationNetwork::ReadMappedParameters(File& fstream, uint64_t indexPosition)
+{
+    auto mapping = make_shared<msra::files::mappedfile>(fstream.GetName(), /*copyonwrite=*/true);
+    const uint64_t position = fstream.GetPosition();
+    fstream.SetPosition(indexPosition);
+    fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BMappedParameters");
+    size_t numBlobs;
+    fstream >> numBlobs;
+    for (size_t i = 0; i < numBlobs; i++)
+    {
+        wstring nodeName;
+        size_t rows, cols, elemSize;
+        uint64_t offset;
+        fstream >> nodeName >> rows >> cols >> elemSize >> offset;
+        auto param = dynamic_pointer_cast<LearnableParameter<ElemType>>(GetNodeFromName(nodeName));
+        if (!param)
+            RuntimeError("ReadMappedParameters: %ls is not a LearnableParameter.", nodeName.c_str());
+        param->LoadMappedValue(mapping, offset, rows, cols, elemSize);
+    }
+    fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EMappedParameters");
+    fstream.SetPosition(position);
 }
 
 // deserialize the model
@@ -238,7 +370,7 @@ void ComputationNetwork::Read(const wstring& fileName, const FileOptions fileFor
 {
     ClearNetwork();
 
-    File fstream(fileName, fileFormat | FileOptions::fileOptionsRead);
+    File fstream(fileName, fileFormat | FileOptions::fileOptionsRead | FileOptions::fileOptionsSequential);
 
     ReadPersistableParameters<ElemType>(fstream, true);
 
@@ -376,6 +508,48 @@ void ComputationNetwork::InitLearnableParameters(const ComputationNodeBasePtr& n
     learnableParameterNode->InitRandom(uniformInit, randomSeed + GetRandomSeedOffset(), initValueScale, initOnCPUOnly);
 }
 
+template <class ElemType>
+/*static*/ void ComputationNetwork::AllocateFlatParameterBuffers(const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                                              shared_ptr<Matrix<ElemType>>& flatValues, shared_ptr<Matrix<ElemType>>& flatGradients,
+                                                              std::vector<size_t>& offsets)
+{
+    const size_t alignment = 32; // (elements; keeps every parameter on a 128-byte boundary for coalesced access)
+    offsets.assign(learnableNodes.size(), SIZE_MAX);
+    flatValues.reset();
+    flatGradients.reset();
+
+    // lay out the qualifying parameters
+    size_t numElements = 0;
+    DEVICEID_TYPE deviceId = CPUDEVICE;
+    size_t i = 0;
+    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, i++)
+    {
+        auto node = dynamic_pointer_cast<LearnableParameter<ElemType>>(*nodeIter);
+        if (!node || !node->CanBindToFlatBuffers())
+            continue;
+        if (numElements == 0)
+            deviceId = node->Value().GetDeviceId();
+        else if (node->Value().GetDeviceId() != deviceId)
+            continue;
+        offsets[i] = numElements;
+        numElements += (node->Value().GetNumElements() + alignment - 1) / alignment * alignment;
+    }
+    if (numElements == 0)
+        return;
+
+    flatValues = make_shared<Matrix<ElemType>>(numElements, 1, deviceId);
+    flatValues->SetValue(0); // (padding)
+    flatGradients = make_shared<Matrix<ElemType>>(numElements, 1, deviceId);
+    flatGradients->SetValue(0);
+    i = 0;
+    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, i++)
+    {
+        if (offsets[i] != SIZE_MAX)
+            dynamic_pointer_cast<LearnableParameter<ElemType>>(*nodeIter)->BindToFlatBuffers(flatValues, flatGradients, offsets[i]);
+    }
+    fprintf(stderr, "AllocateFlatParameterBuffers: %d parameter elements in flat buffers.\n", (int) numElements);
+}
+
 bool ComputationNetwork::IsTypicalCriterionNode(ComputationNodeBasePtr nodePtr)
 {
     // TODO: just use return!
@@ -385,6 +559,7 @@ bool ComputationNetwork::IsTypicalCriterionNode(ComputationNodeBasePtr nodePtr)
         nodePtr->OperationName() == OperationNameOf(SequenceWithSoftmaxNode) ||
         nodePtr->OperationName() == OperationNameOf(CrossEntropyNode) ||
         nodePtr->OperationName() == OperationNameOf(ClassBasedCrossEntropyWithSoftmaxNode) ||
+        nodePtr->OperationName() == OperationNameOf(SampledCrossEntropyWithSoftmaxNode) ||
         nodePtr->OperationName() == OperationNameOf(ErrorPredictionNode) ||
 #ifdef COMING_SOON
         nodePtr->OperationName() == OperationNameOf(CRFNode) ||
@@ -870,6 +1045,7 @@ void ComputationNodeBase::EnumerateArcs(std::unordered_set<ComputationNodeBasePt
 //  A \approx B*C, where rank(B)=rank(C)=r < rank(A)
 // After SVD decomposition, the node A will become an intermediate node whose children are B,C ;
 // B and C are two learnable parameters
+// SVDConfig maps name regexes to the fraction of the energy to keep, or to the rank r if > 1.
 // ========================================
 // BUGBUG: this only currently works for one ElemType, not both
 template <class ElemType>
@@ -927,114 +1103,143 @@ void ComputationNetwork::PerformSVDecomposition(const map<wstring, float>& SVDCo
                 // could be deleted in the previous groups
                 continue;
             }
+            FactorParameterBySVD<ElemType>(name, keepratio, AlignedSize);
+        }
+    }
 
-            shared_ptr<ComputationNode<ElemType>> pNode = dynamic_pointer_cast<LearnableParameter<ElemType>>(m_nameToNodeMap[name]);
-
-            // Step 1. do SVD decomposition
-            Matrix<ElemType> A = pNode->ValueAsMatrix();
-
-            // it is a vector, no need to do it
-            if (A.GetNumCols() == 1 || A.GetNumRows() == 1)
-                continue;
-
-            size_t m = A.GetNumRows();
-            size_t n = A.GetNumCols();
-
-            Matrix<ElemType> S(-1), U(-1), VT(-1), W(-1);
-            chrono::time_point<chrono::system_clock> stTime = chrono::system_clock::now();
-            Matrix<ElemType>::SVD(A, S, U, VT, W);
-            chrono::time_point<chrono::system_clock> enTime = chrono::system_clock::now();
-
-            // A \in R^{mXn}
-            // U \in R^{mXm}
-            // VT \in R^{nXn}
-            // S \in R^{min(m,n),1}
-            // S is in descending order
-
-            ElemType totalenergy = 0.0f;
-            for (size_t i = 0; i < S.GetNumRows(); i++)
-                totalenergy += S(i, 0);
-            ElemType keepenergy = totalenergy * keepratio;
-            ElemType runenergy = 0.0f;
+    // redo necessary post-processing
+    CompileNetwork();
+}
 
-            size_t r = 0;
-            for (size_t indx = 0; indx < S.GetNumRows(); indx++)
+// replace the LearnableParameter 'name' by Times(name-U, name-V) with the given rank (see PerformSVDecomposition())
+// The network must be compiled afterwards.
+template <class ElemType>
+size_t ComputationNetwork::FactorParameterBySVD(const wstring& name, float keep, size_t alignedSize)
+{
+    shared_ptr<ComputationNode<ElemType>> pNode = dynamic_pointer_cast<LearnableParameter<ElemType>>(GetNodeFromName(name));
+    if (!pNode)
+        InvalidArgument("FactorParameterBySVD: %ls is not a LearnableParameter.", name.c_str());
+    if (keep <= 0)
+        InvalidArgument("FactorParameterBySVD: The energy ratio or rank for %ls must be positive.", name.c_str());
+    if (alignedSize == 0)
+        alignedSize = 1;
+
+    // Step 1. do SVD decomposition
+    Matrix<ElemType> A = pNode->ValueAsMatrix();
+
+    // it is a vector, no need to do it
+    if (A.GetNumCols() == 1 || A.GetNumRows() == 1)
+        return 0;
+
+    size_t m = A.GetNumRows();
+    size_t n = A.GetNumCols();
+
+    Matrix<ElemType> S(-1), U(-1), VT(-1), W(-1);
+    chrono::time_point<chrono::system_clock> stTime = chrono::system_clock::now();
+    Matrix<ElemType>::SVD(A, S, U, VT, W);
+    chrono::time_point<chrono::system_clock> enTime = chrono::system_clock::now();
+
+    // A \in R^{mXn}
+    // U \in R^{mXm}
+    // VT \in R^{nXn}
+    // S \in R^{min(m,n),1}
+    // S is in descending order
+
+    ElemType totalenergy = 0.0f;
+    for (size_t i = 0; i < S.GetNumRows(); i++)
+        totalenergy += S(i, 0);
+
+    size_t r = 0;
+    if (keep > 1) // a rank
+        r = (size_t) keep;
+    else // an energy ratio
+    {
+        ElemType keepenergy = totalenergy * keep;
+        ElemType runenergy = 0.0f;
+        for (size_t indx = 0; indx < S.GetNumRows(); indx++)
+        {
+            runenergy += S(indx, 0);
+            if (runenergy > keepenergy)
             {
-                runenergy += S(indx, 0);
-                if (runenergy > keepenergy)
-                {
-                    r = indx + 1;
-                    break;
-                }
+                r = indx + 1;
+                break;
             }
+        }
+        if (r == 0) // (rounding) keep all
+            r = S.GetNumRows();
+    }
 
-            r = r > S.GetNumRows() ? S.GetNumRows() : r;
-
-            if (r % AlignedSize != 0)
-            {
-                r -= r % AlignedSize;
-                r = r + AlignedSize > S.GetNumRows() ? S.GetNumRows() : r + AlignedSize;
-            }
-            // r = (r + 7) & (~7); //  to keep the number of rows/cols of resultant matrix a multipier of 8
-            //  which can be helpful at runtime
-
-            chrono::duration<double> elapsedtime = enTime - stTime;
-            fprintf(stderr,
-                    "Performing SVD for a %5d-by-%-5d matrix (node name: %-20ls) ---  computation time %5.2f secs ;  keep %4.1f%% energy ===> keep %5d svd values (reduce to %4.1f%% parameters) \n",
-                    (int) m, (int) n, name.c_str(), elapsedtime.count(),
-                    keepratio * 100, (int) r,
-                    ((m + n) * r + 0.0f) / m / n * 100);
-
-            // redU in R^ {mXr}
-            Matrix<ElemType> redU = U.ColumnSlice(0, r);
-            Matrix<ElemType> redVT(-1);
-
-            // redVT in R^{rXn}
-            redVT.Resize(r, n);
-            redVT.AssignRowSliceValuesOf(VT, 0, r);
-
-            Matrix<ElemType> redS(r, (size_t) 1);
-            for (size_t i = 0; i < r; i++)
-            {
-                ElemType sqrtsigma = (ElemType) sqrt((double) S(i, 0));
-                redS(i, 0) = sqrtsigma;
-            }
+    r = r > S.GetNumRows() ? S.GetNumRows() : r;
 
-            redU.RowElementMultiplyWith(redS.Transpose());
-            redVT.ColumnElementMultiplyWith(redS);
+    if (r % alignedSize != 0)
+    {
+        r -= r % alignedSize;
+        r = r + alignedSize > S.GetNumRows() ? S.GetNumRows() : r + alignedSize;
+    }
+    // r = (r + 7) & (~7); //  to keep the number of rows/cols of resultant matrix a multipier of 8
+    //  which can be helpful at runtime
+
+    ElemType keptenergy = 0.0f;
+    for (size_t i = 0; i < r; i++)
+        keptenergy += S(i, 0);
+
+    chrono::duration<double> elapsedtime = enTime - stTime;
+    fprintf(stderr,
+            "Performing SVD for a %5d-by-%-5d matrix (node name: %-20ls) ---  computation time %5.2f secs ;  keep %4.1f%% energy ===> keep %5d svd values (reduce to %4.1f%% parameters) \n",
+            (int) m, (int) n, name.c_str(), elapsedtime.count(),
+            totalenergy > 0 ? keptenergy / totalenergy * 100 : 100.0f, (int) r,
+            ((m + n) * r + 0.0f) / m / n * 100);
+
+    // redU in R^ {mXr}
+    Matrix<ElemType> redU = U.ColumnSlice(0, r);
+    Matrix<ElemType> redVT(-1);
+
+    // redVT in R^{rXn}
+    redVT.Resize(r, n);
+    redVT.AssignRowSliceValuesOf(VT, 0, r);
+
+    Matrix<ElemType> redS(r, (size_t) 1);
+    for (size_t i = 0; i < r; i++)
+    {
+        ElemType sqrtsigma = (ElemType) sqrt((double) S(i, 0));
+        redS(i, 0) = sqrtsigma;
+    }
 
-            // Step 2. create two new Parameter nodes and one Times node
-            wstring leftChildName = name + L"-U";
-            wstring rightChildName = name + L"-V";
-            shared_ptr<ComputationNode<ElemType>> pLeft = AddNodeToNetWithElemType(New<LearnableParameter<ElemType>>(m_deviceId, leftChildName, m, r));
-            shared_ptr<ComputationNode<ElemType>> pRight = AddNodeToNetWithElemType(New<LearnableParameter<ElemType>>(m_deviceId, rightChildName, r, n));
+    redU.RowElementMultiplyWith(redS.Transpose());
+    redVT.ColumnElementMultiplyWith(redS);
 
-            pLeft->ValueAsMatrix() = redU;
-            pRight->ValueAsMatrix() = redVT;
+    // Step 2. create two new Parameter nodes and one Times node
+    wstring leftChildName = name + L"-U";
+    wstring rightChildName = name + L"-V";
+    shared_ptr<ComputationNode<ElemType>> pLeft = AddNodeToNetWithElemType(New<LearnableParameter<ElemType>>(m_deviceId, leftChildName, m, r));
+    shared_ptr<ComputationNode<ElemType>> pRight = AddNodeToNetWithElemType(New<LearnableParameter<ElemType>>(m_deviceId, rightChildName, r, n));
 
-            shared_ptr<ComputationNode<ElemType>> pTimes = AddNodeToNetAndAttachInputs(New<TimesNode<ElemType>>(m_deviceId, name + L"-SVD"), pLeft, pRight);
+    pLeft->ValueAsMatrix() = redU;
+    pRight->ValueAsMatrix() = redVT;
 
-            // Step 3. remove old node
-            ReplaceLeafNode(name, pTimes);
-        }
-    }
+    shared_ptr<ComputationNode<ElemType>> pTimes = AddNodeToNetAndAttachInputs(New<TimesNode<ElemType>>(m_deviceId, name + L"-SVD"), pLeft, pRight);
 
-    // redo necessary post-processing
-    CompileNetwork();
+    // Step 3. remove old node
+    ReplaceLeafNode(name, pTimes);
+    return r;
 }
 
 template void ComputationNetwork::InitLearnableParameters<float>(const ComputationNodeBasePtr& node, const bool uniformInit, const unsigned long randomSeed, const float initValueScale, bool initOnCPUOnly);
+template void ComputationNetwork::AllocateFlatParameterBuffers<float>(const std::list<ComputationNodeBasePtr>& learnableNodes, shared_ptr<Matrix<float>>& flatValues, shared_ptr<Matrix<float>>& flatGradients, std::vector<size_t>& offsets);
 template void ComputationNetwork::Read<float>(const wstring& fileName, const FileOptions fileFormat, const bool bAllowNoCriterionNode, ComputationNetwork* anotherNetwork);
 template void ComputationNetwork::ReadPersistableParameters<float>(File& fstream, bool create);
 template void ComputationNetwork::PerformSVDecomposition<float>(const map<wstring, float>& SVDConfig, size_t alignedsize);
+template size_t ComputationNetwork::FactorParameterBySVD<float>(const wstring& name, float keep, size_t alignedSize);
 template /*static*/ void ComputationNetwork::SetDropoutRate<float>(ComputationNetworkPtr net, const ComputationNodeBasePtr& criterionNode, const double dropoutRate, double& prevDropoutRate, unsigned long& dropOutSeed);
 template void ComputationNetwork::SetSeqParam<float>(ComputationNetworkPtr net, const ComputationNodeBasePtr criterionNode, const double& hsmoothingWeight, const double& frameDropThresh, const bool& doreferencealign,
                                                      const double& amf, const double& lmf, const double& wp, const double& bMMIfactor, const bool& sMBR);
 
 template void ComputationNetwork::InitLearnableParameters<double>(const ComputationNodeBasePtr& node, const bool uniformInit, const unsigned long randomSeed, const double initValueScale, bool initOnCPUOnly);
+template void ComputationNetwork::AllocateFlatParameterBuffers<double>(const std::list<ComputationNodeBasePtr>& learnableNodes, shared_ptr<Matrix<double>>& flatValues, shared_ptr<Matrix<double>>& flatGradients, std::vector<size_t>& offsets);
 template void ComputationNetwork::Read<double>(const wstring& fileName, const FileOptions fileFormat, const bool bAllowNoCriterionNode, ComputationNetwork* anotherNetwork);
 template void ComputationNetwork::ReadPersistableParameters<double>(File& fstream, bool create);
 template void ComputationNetwork::PerformSVDecomposition<double>(const map<wstring, float>& SVDConfig, size_t alignedsize);
+template size_t ComputationNetwork::FactorParameterBySVD<double>(const wstring& name, float keep, size_t alignedSize);
 template /*static*/ void ComputationNetwork::SetDropoutRate<double>(ComputationNetworkPtr net, const ComputationNodeBasePtr& criterionNode, const double dropoutRate, double& prevDropoutRate, unsigned long& dropOutSeed);
 template void ComputationNetwork::SetSeqParam<double>(ComputationNetworkPtr net, const ComputationNodeBasePtr criterionNode, const double& hsmoothingWeight, const double& frameDropThresh, const bool& doreferencealign,
                                                       const double& amf, const double& lmf, const double& wp, const double& bMMIfactor, const bool& sMBR);
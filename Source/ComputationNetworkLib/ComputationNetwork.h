@@ -17,6 +17,7 @@
 #include <string>
 #include <stdexcept>
 #include <list>
+#include <set>
 #include <vector>
 #include <algorithm>
 #include <fstream>
@@ -26,6 +27,7 @@
 #include <regex>
 #include <chrono>
 #include <unordered_map>
+#include <functional>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -45,7 +47,8 @@ public:
     ComputationNetwork()
         : m_randomSeedOffset(0),
           m_isCompiled(false),
-          m_pMBLayout(make_shared<MBLayout>())
+          m_pMBLayout(make_shared<MBLayout>()),
+          m_matrixPool(make_shared<MatrixPool>())
     {
     }
     ComputationNetwork(DEVICEID_TYPE deviceId)
@@ -73,12 +76,17 @@ public:
 
     DEVICEID_TYPE GetDeviceId() const { return m_deviceId; }
 
+    // create the nodes loaded hereafter on these devices instead of GetDeviceId(), by node name (for models split across GPUs)
+    void SetNodeDevicePlacement(const std::map<std::wstring, DEVICEID_TYPE>& placement) { m_nodeDevicePlacement = placement; }
+
     // -----------------------------------------------------------------------
     // (de-)serialization
     // -----------------------------------------------------------------------
 
     template <class ElemType>
     void ReadPersistableParameters(File& fstream, bool create);
+    template <class ElemType>
+    void ReadMappedParameters(File& fstream, uint64_t indexPosition);
     // reload node content only, e.g. used by SGD::Train() when going back to an older model that had better training objective
     template <class ElemType>
     void RereadPersistableParameters(const std::wstring& fileName)
@@ -114,6 +122,10 @@ public:
     void Save(const std::wstring& fileName, const FileOptions fileFormat = FileOptions::fileOptionsBinary) const;
     void SaveEdited(const std::wstring& fileName, const FileOptions fileFormat = FileOptions::fileOptionsBinary);
 
+    // freeze the parameter values that Save() writes, so that it can run on another thread while training continues
+    void SnapshotParameters();
+    void ReleaseParameterSnapshot();
+
 private:
 
     void SaveToFileImpl(const std::wstring& fileName, const FileOptions fileFormat) const;
@@ -128,7 +140,8 @@ public:
     void ForwardProp(const ComputationNodeBasePtr rootNode);
 
     // main entry point for backprop
-    void Backprop(const ComputationNodeBasePtr rootNode);
+    // If given, gradientIsFinal(node) is called as soon as the gradient of node is complete, e.g. to start aggregating it across workers.
+    void Backprop(const ComputationNodeBasePtr rootNode, const std::function<void(const ComputationNodeBasePtr&)>& gradientIsFinal = nullptr);
 
     template <class NODESET> // version that takes multiple nodes
     void ForwardProp(const NODESET& nodes)
@@ -137,6 +150,10 @@ public:
             ForwardProp(node);
     }
 
+    // forward prop of several roots (e.g. all outputs an evaluator is asked for) in one traversal of the union of their eval orders
+    // Unlike ForwardProp(nodes), every node is visited once, and with concurrent streams, nodes of different roots can share a wave.
+    void ForwardPropJointly(const std::vector<ComputationNodeBasePtr>& rootNodes);
+
     static void BumpEvalTimeStamp(const std::vector<ComputationNodeBasePtr>& nodes);
     void ResetEvalTimeStamps();
 
@@ -169,8 +186,16 @@ public:
     // prepares the network for computation
     // void BuildAndValidateSubNetwork(const ComputationNodeBasePtr rootNode);
 private:
-    void ValidateNodes(list<ComputationNodeBasePtr> nodes, bool isFinalValidationPass, size_t& todo);
-    void ValidateSubNetwork(const ComputationNodeBasePtr& rootNode);
+    // which nodes were valid after the last validation pass, and which ones changed in it (so that the next pass only redoes what depends on them)
+    struct ValidationProgress
+    {
+        std::unordered_set<ComputationNodeBase*> m_valid;
+        std::unordered_set<ComputationNodeBase*> m_changed;
+    };
+    // progress: if given, nodes that were valid and none of whose inputs changed are skipped; it is updated for the next pass
+    void ValidateNodes(const list<ComputationNodeBasePtr>& nodes, bool isFinalValidationPass, size_t& todo, ValidationProgress* progress = nullptr);
+    // validatedNodes: if given, nodes in it are taken as final and skipped, and the ones validated here are added to it
+    void ValidateSubNetwork(const ComputationNodeBasePtr& rootNode, std::unordered_set<ComputationNodeBasePtr>* validatedNodes = nullptr);
     void MarkValueNonSharableNodes();
 
 private:
@@ -184,9 +209,17 @@ private:
     // bool BuiltAndValidatedSubNetwork(const ComputationNodeBasePtr & rootNode);
 public:
     void AllocateAllMatrices(const std::vector<ComputationNodeBasePtr>& evalRootNodes, const std::vector<ComputationNodeBasePtr>& outValueRootNodes, ComputationNodeBasePtr trainRootNode);
+    const MatrixPool& GetMatrixPool() const { return *m_matrixPool; } // (its plans tell what AllocateAllMatrices() will take)
+    // plan the matrices of this network in the given pool, e.g. the same as that of other networks, so that they share their
+    // value matrices and workspaces; such networks must then only be evaluated one at a time. Call this before AllocateAllMatrices().
+    void SetMatrixPool(const shared_ptr<MatrixPool>& matrixPool) { m_matrixPool = matrixPool; }
+    const shared_ptr<MatrixPool>& GetMatrixPoolPtr() const { return m_matrixPool; }
 
 private:
     void ReleaseMatricesAfterEvalForChildren(ComputationNodeBasePtr n, std::unordered_map<ComputationNodeBasePtr, int>& parentCount);
+    void PlanValueRecomputation(const ComputationNodeBasePtr& trainRootNode, std::unordered_map<ComputationNodeBasePtr, bool>& outputValueNeededDuringBackProp);
+    void PlanValueOffloading(const ComputationNodeBasePtr& trainRootNode, std::unordered_map<ComputationNodeBasePtr, bool>& outputValueNeededDuringBackProp);
+    std::vector<std::pair<ComputationNodeBasePtr, std::vector<ComputationNodeBasePtr>>> GetBackpropUnits(const ComputationNodeBasePtr& rootNode);
     void AllocateGradientMatricesForInputs(ComputationNodeBasePtr parentNode);
 
 public:
@@ -196,6 +229,24 @@ public:
 
     void FormNestedNetwork(const ComputationNodeBasePtr& rootNode);
     ComputationNodeBasePtr GetNestedNetwork(const ComputationNodeBasePtr& rootNode);
+    ComputationNodeBasePtr GetJointNestedNetwork(const std::vector<ComputationNodeBasePtr>& rootNodes);
+
+    // Let PAR traversal run independent nodes concurrently, on this many CUDA streams, or on the OpenMP threads on the CPU (0 or 1: off).
+    // This must be set before the network is compiled, since it affects memory sharing.
+    static void SetNumConcurrentStreams(size_t numStreams) { s_numConcurrentStreams = numStreams; }
+    static size_t GetNumConcurrentStreams() { return s_numConcurrentStreams; }
+
+    // Trade compute for memory in training: drop all but every this-many-th activation that backprop needs, and recompute the others
+    // from the nearest kept ones right before backprop needs them (0: off, unless nodes are tagged 'checkpoint'). See PlanValueRecomputation().
+    // Requires shareNodeValueMatrices. This must be set before AllocateAllMatrices() is called.
+    static void SetRecomputeSegmentLength(size_t length) { s_recomputeSegmentLength = length; }
+    static size_t GetRecomputeSegmentLength() { return s_recomputeSegmentLength; }
+
+    // Another way to save GPU memory in training: copy the activations of at least this many elements per sample that backprop needs
+    // to host memory after forward prop, and back right before backprop (0: off). See PlanValueOffloading().
+    // Requires shareNodeValueMatrices. This must be set before AllocateAllMatrices() is called.
+    static void SetOffloadMinValueSize(size_t numElements) { s_offloadMinValueSize = numElements; }
+    static size_t GetOffloadMinValueSize() { return s_offloadMinValueSize; }
 
     // The methods below determine evaluation order, which is tricky in presence of recurrent loops.
     // TODO: Can this be moved to a separate class?
@@ -203,10 +254,22 @@ private:
     // This is part of the FormRecurrentLoops() process, and only called from there.
     void FormRecurrentLoops(const ComputationNodeBasePtr& rootNode);
     void DetermineSCCs(const ComputationNodeBasePtr& rootNode);
-    void DetermineSCCsR(ComputationNodeBasePtr cur, std::list<ComputationNodeBasePtr>& sccStack, size_t& index, size_t& loopId);
+    static void DetermineSCCsFrom(const ComputationNodeBasePtr& startNode, std::vector<ComputationNodeBasePtr>& sccStack, size_t& index,
+                                  const std::function<void(std::vector<ComputationNodeBasePtr>&& sccNodes, const ComputationNodeBasePtr& entryNode)>& closeSCC);
     void DetermineLoopForwardOrder(std::unordered_set<ComputationNodeBasePtr>& visited, std::unordered_set<ComputationNodeBasePtr>& recStack, std::list<ComputationNodeBasePtr>& nodesStack, ComputationNodeBasePtr cur);
-    void GatherLoopNodesR(const ComputationNodeBasePtr& rootNode, std::unordered_set<ComputationNodeBasePtr>& visited, std::map<int, std::list<ComputationNodeBasePtr>>& recurrentResult, std::list<ComputationNodeBasePtr>& noRecurrentResult);
-    void ReorderLoops(std::list<ComputationNodeBasePtr>& nodes, const std::map<int, std::list<ComputationNodeBasePtr>>& /*recurrentNodes*/, const std::list<ComputationNodeBasePtr>& /*noRecurrentNodes*/);
+    void ReorderLoops(std::list<ComputationNodeBasePtr>& nodes);
+    // moving loop-invariant terms of sums and products out of recurrent loops, called from CompileNetwork()
+    void HoistLoopInvariantTerms();
+    // elementwise operator fusion, called from CompileNetwork()
+    void FuseElementwiseOperations();
+    // fusion of convolution, bias and ReLU into one engine call, called from CompileNetwork()
+    void FuseConvolutionBiasReLU();
+    // undo the fusions of nodes whose values a caller reads, e.g. outputs asked for by name, called from AllocateAllMatrices()
+    void KeepValuesOf(const std::vector<ComputationNodeBasePtr>& nodes);
+    // letting chains of image nodes pass their values in their engine's layout, called from CompileNetwork()
+    void ElideImageLayoutConversions();
+    // letting elementwise nodes overwrite their inputs' values, called from AllocateAllMatrices()
+    void PlanInPlaceValues();
 
 public:
     // -----------------------------------------------------------------------
@@ -253,6 +316,9 @@ protected:
 
 private:
     static std::shared_ptr<SEQTraversalFlowControlNode> FindInRecurrentLoops(const std::vector<std::shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const ComputationNodeBasePtr& node);
+    // group nodes given in eval order into waves that can be executed concurrently: a node's wave is 1 + the latest wave of its inputs;
+    // all nodes of a loop share one wave
+    static std::map<ComputationNodeBasePtr, int> DetermineConcurrentWaves(const std::vector<std::shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const std::list<ComputationNodeBasePtr>& nodes);
 
 public:
     // -----------------------------------------------------------------------
@@ -312,6 +378,14 @@ public:
                                  const ElemType initValueScale,
                                  bool initOnCPUOnly = false);
 
+    // move the values and gradients of the given learnable parameters into two contiguous buffers each, such that whole-model
+    // operations (aggregation, updates) can run as single calls. Only dense parameters that are updated are moved; the others
+    // get offset SIZE_MAX. Offsets are in elements and aligned. flatValues/flatGradients are null if no parameter qualifies.
+    template <class ElemType>
+    static void AllocateFlatParameterBuffers(const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                             shared_ptr<Matrix<ElemType>>& flatValues, shared_ptr<Matrix<ElemType>>& flatGradients,
+                                             std::vector<size_t>& offsets);
+
     template <typename N>
     static shared_ptr<N> AsNodePtr(const ComputationNodeBasePtr& inode)
     {
@@ -341,6 +415,37 @@ public:
     void SetLearnableNodesBelowNeedGradient(const bool needGradient, const ComputationNodeBasePtr& rootNode = nullptr);
     void SetBatchNormlizationNodesBelowEvalMode(const bool evalMode, const ComputationNodeBasePtr& rootNode = nullptr);
 
+    // rewrite the network for inference only (folding of normalizations and constants, pruning), see ComputationNetworkOptimization.cpp
+    template <class ElemType>
+    void OptimizeForInference(const std::vector<ComputationNodeBasePtr>& outputNodes);
+
+    // split the model into consecutive parts of the eval order, one per device, for model-parallel training
+    // A part starts at each node named in 'partitionStarts' (one less than devices), or, if none are given, the parts are balanced
+    // by their number of parameter elements. Recurrent loops are not split. DeviceTransfer nodes are inserted at the edges between parts
+    // (after removing any left from an earlier split). Returns the device for every node, to load the model with, see SetNodeDevicePlacement().
+    template <class ElemType>
+    std::map<std::wstring, DEVICEID_TYPE> PartitionAcrossDevices(const ComputationNodeBasePtr& criterionNode, const std::vector<DEVICEID_TYPE>& deviceIds,
+                                                                 const std::vector<std::wstring>& partitionStarts);
+
+private:
+    // the steps of OptimizeForInference()
+    size_t BypassDropoutNodes();
+    template <class ElemType>
+    size_t ReplacePreComputedNodesByParameters();
+    template <class ElemType>
+    size_t FoldBatchNormalizationNodes();
+    template <class ElemType>
+    size_t FoldMeanVarNormalizationNodes();
+    template <class ElemType>
+    size_t FoldConstantSubgraphs();
+    size_t PruneNodesNotNeededFor(const std::vector<ComputationNodeBasePtr>& roots);
+    // and their helpers
+    std::map<ComputationNodeBasePtr, size_t> CountNodeUses();
+    std::wstring GetUniqueNodeName(const std::wstring& name) const;
+    void ReplaceNodeInNetwork(const ComputationNodeBasePtr& oldNode, const ComputationNodeBasePtr& newNode, bool newNodeTakesName);
+
+public:
+
     // -----------------------------------------------------------------------
     // node access
     // -----------------------------------------------------------------------
@@ -558,6 +663,9 @@ public:
 
     template <class ElemType>
     void PerformSVDecomposition(const map<wstring, float>& SVDConfig, size_t AlignedSize);
+    // 'keep' <= 1 is the fraction of the singular-value energy to keep, > 1 the rank; returns the rank, or 0 if nothing was done
+    template <class ElemType>
+    size_t FactorParameterBySVD(const wstring& name, float keep, size_t alignedSize);
 
     // -----------------------------------------------------------------------
     // construction
@@ -788,15 +896,20 @@ protected:
         virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool);
         virtual bool IsOutputOlderThanInputs() const override;
 
+    private:
+        FrameRange ActiveSequencesOf(const FrameRange& t) const;
+
     public:
         // std::vector<ComputationNodeBasePtr> m_nestedNodes;               // all nodes involved in this loop, in evaluation order
         ComputationNodeBasePtr m_sourceNode; // one of the nodes of the loop   --TODO: What is the special meaning of this node? It seems to always be a delay node.
         int m_loopId;                        // unique loop id, index in m_allSEQNodes array
         int m_steppingDirection;             // +1 if left to right (t=0..T-1), -1 if rightt to left (t=T-1..0)
+        bool m_activeSequencesOnly;          // compute each time step only on its active parallel sequences (determined in BeginForwardProp())
 
         SEQTraversalFlowControlNode(int loopId, ComputationNodeBasePtr cur)
             : m_loopId(loopId),
-              m_sourceNode(cur)
+              m_sourceNode(cur),
+              m_activeSequencesOnly(false)
         {
             SetNodeName(L"Loop_" + m_sourceNode->NodeName());
         }
@@ -852,6 +965,31 @@ protected:
         // There is currently no other constructor for inner nested PAR-traversed sub-networks, but there will be.
         PARTraversalFlowControlNode(const std::vector<shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const std::list<ComputationNodeBasePtr>& allNodes);
         // Base::m_nestedNodes contains all top-level nodes, in evaluation order
+
+        // backprop that notifies the caller about every top-level node whose gradient is complete; see ComputationNetwork::Backprop()
+        void Backprop(const FrameRange& fr, const std::function<void(const ComputationNodeBasePtr&)>& gradientIsFinal);
+
+        // what to do right before a top-level node's backprop for the values that were not kept from forward prop;
+        // set by PlanValueRecomputation() and PlanValueOffloading()
+        struct ValueRestoreSteps
+        {
+            std::vector<ComputationNodeBasePtr> beginPrefetch; // offloaded values to start copying back, for a later node's backprop
+            std::vector<ComputationNodeBasePtr> endPrefetch;   // offloaded values that this node's backprop (or a recomputation) reads first
+            std::vector<ComputationNodeBasePtr> recompute;     // values to be recomputed, in evaluation order
+        };
+        std::map<ComputationNodeBasePtr, ValueRestoreSteps> m_stepsBeforeBackprop; // [top-level node]
+
+    private:
+        void ForwardPropNode(const ComputationNodeBasePtr& node, const FrameRange& fr);
+        void BackpropNode(const ComputationNodeBasePtr& node, const FrameRange& fr);
+        void RunConcurrently(const std::vector<ComputationNodeBasePtr>& nodes, const std::function<void(const ComputationNodeBasePtr&)>& run);
+        void RestoreValuesBeforeBackprop(const ComputationNodeBasePtr& node, const FrameRange& fr);
+        void SwapBackValuesAfterBackprop(const ComputationNodeBasePtr& node);
+
+        // m_nestedNodes grouped by DetermineConcurrentWaves(), each in evaluation order, for GetNumConcurrentStreams() > 1
+        std::vector<std::vector<ComputationNodeBasePtr>> m_waves;
+        std::vector<bool> m_waveBackpropIsConcurrent; // [wave] its nodes propagate into disjoint sets of inputs
+        std::unique_ptr<ConcurrentStreams> m_streams; // created upon first use
     };
 
 public:
@@ -870,6 +1008,7 @@ public:
 
 protected:
     DEVICEID_TYPE m_deviceId; // TODO: is this shared by all nodes?
+    std::map<std::wstring, DEVICEID_TYPE> m_nodeDevicePlacement; // exceptions from m_deviceId, see SetNodeDevicePlacement()
     unsigned long m_randomSeedOffset;
 
     // main node holder
@@ -901,6 +1040,7 @@ private:
     // list of all roots in this network
     // A root is a node that can run as a target of ForwardProp(). See DetermineSetOfAllRoots().
     std::vector<ComputationNodeBasePtr> m_allRoots;
+    std::set<ComputationNodeBasePtr> m_valueNeededNodes; // not roots, but asked for by callers (see KeepValuesOf()), so never fused into their consumers
 
     std::vector<std::shared_ptr<SEQTraversalFlowControlNode>> m_allSEQNodes; // [loopId] cached set of SEQTraversalFlowControlNodes to allow sharing and idempotence of FormRecurrentLoops()
 
@@ -910,6 +1050,7 @@ private:
     // cached network iterations
     std::map<const ComputationNodeBasePtr, std::list<ComputationNodeBasePtr>> m_evalOrders; // [out node] flat depth-first traversal starting from out node
     std::map<const ComputationNodeBasePtr, ComputationNodeBasePtr> m_nestedNetworks;        // [out node] network rewritten as recursive traveral, potentially optimized; execution plan
+    std::map<std::vector<ComputationNodeBasePtr>, ComputationNodeBasePtr> m_jointNestedNetworks; // [out nodes] execution plan for the union of their eval orders, see ForwardPropJointly()
 
     // cached quick-access list for inputs and parameters
     std::map<const ComputationNodeBasePtr, std::list<ComputationNodeBasePtr>> m_inputValues;         // [out node] -> all input nodes feeding into out node
@@ -918,7 +1059,11 @@ private:
 private:
     // pool for matrices that can be shared across nodes
     // TODO: does this apply to anything else besides temporary node-internal intermediate results? What, for example?
-    MatrixPool m_matrixPool;
+    shared_ptr<MatrixPool> m_matrixPool; // (possibly shared with other networks, see SetMatrixPool())
+
+    static size_t s_numConcurrentStreams;   // see SetNumConcurrentStreams()
+    static size_t s_recomputeSegmentLength; // see SetRecomputeSegmentLength()
+    static size_t s_offloadMinValueSize;    // see SetOffloadMinValueSize()
 };
 typedef ComputationNetwork::ComputationNetworkPtr ComputationNetworkPtr;
 
@@ -9,6 +9,7 @@
 #include "ComputationNode.h"
 #include "ComputationNetwork.h"
 #include "RecurrentNodes.h"
+#include "LinearAlgebraNodes.h"
 #include <string>
 #include <set>
 
@@ -112,21 +113,6 @@ void ComputationNetwork::FormRecurrentLoops(const ComputationNodeBasePtr& rootNo
 
     if (m_allSEQNodes.size() > 0)
     {
-        unordered_set<ComputationNodeBasePtr> visited;
-
-        // get set of all nodes in and outside loops hanging off rootNode
-        map<int, list<ComputationNodeBasePtr>> recurrentNodes;
-        list<ComputationNodeBasePtr> noRecurrentNodes;
-#if 1 // will soon no longer be allowed
-        if (rootNode)
-            GatherLoopNodesR(rootNode, visited, recurrentNodes, noRecurrentNodes);
-        else
-#endif
-        {
-            for (const auto& rootNode : m_allRoots)
-                GatherLoopNodesR(rootNode, visited, recurrentNodes, noRecurrentNodes);
-        }
-
         auto reorderedNodes = nodes;
 
         // first sort by the updated m_visitedOrder, which is identical for all nodes in a loop
@@ -135,7 +121,7 @@ void ComputationNetwork::FormRecurrentLoops(const ComputationNodeBasePtr& rootNo
                                 return lhs->m_visitedOrder < rhs->m_visitedOrder;
                             });
 
-        ReorderLoops(reorderedNodes, recurrentNodes, noRecurrentNodes); // group nodes in loops together
+        ReorderLoops(reorderedNodes); // group nodes in loops together
 
         UpdateEvalOrder(rootNode, reorderedNodes);
 
@@ -183,107 +169,102 @@ static int DetermineLoopDirection(const std::vector<ComputationNodeBasePtr>& nes
 // This sets index, lowLink, m_visited, and m_inStack.
 void ComputationNetwork::DetermineSCCs(const ComputationNodeBasePtr& rootNode)
 {
-    list<ComputationNodeBasePtr> sccStack;
+    vector<ComputationNodeBasePtr> sccStack;
     size_t index = 0;
-    size_t loopId = 0; // BUGBUG: I think this is currently buggy in an edge case, and not needed (use m_allSEQNodes.size() instead).
+
+    // A loop is found again from each root that reaches it (FormRecurrentLoops() is called for multiple roots), and is added only once.
+    // TODO: Check whether this edge case of idempotence is done correctly:
+    //  - a recurrent loop with two delay nodes
+    //  - two root nodes
+    //  - the first root takes the first delay node's value, the second root that of the second delay node
+    //    I.e. the depth-first tree traversals enter the loop at two different places (m_sourceNode).
+    //  -> Are these two loops detected as identical? (determined by m_minIndex, but m_index depends on traversal from each root, so maybe not)
+    unordered_set<ComputationNodeBasePtr> sourceNodes;
+    for (const auto& loop : m_allSEQNodes)
+        sourceNodes.insert(loop->m_sourceNode);
+    auto closeSCC = [&](vector<ComputationNodeBasePtr>&& nestedNodes, const ComputationNodeBasePtr& cur)
+    {
+        // non-looped nodes are detected here as loops of size 1 --skip those
+        if (nestedNodes.size() <= 1 || !sourceNodes.insert(cur).second)
+            return;
+        // TODO: can we prove that 'cur' == nestedNodes.front()? If so, we won't need to store it separately.
+        SEQTraversalFlowControlNode rInfo(m_allSEQNodes.size() /*loopId*/, cur);
+        rInfo.m_nestedNodes = move(nestedNodes); // TODO: make these two part of the constructor
+        rInfo.m_steppingDirection = DetermineLoopDirection(rInfo.m_nestedNodes);
+        m_allSEQNodes.push_back(make_shared<SEQTraversalFlowControlNode>(move(rInfo)));
+    };
 #if 1
     if (rootNode)
     {
         if (!rootNode->m_visited)
-            DetermineSCCsR(rootNode, sccStack, index, loopId);
+            DetermineSCCsFrom(rootNode, sccStack, index, closeSCC);
         return;
     }
 #endif
     // traverse all root nodes (as if they were all children of a master root)
     for (auto& rootNode : m_allRoots)
         if (!rootNode->m_visited)
-            DetermineSCCsR(rootNode, sccStack, index, loopId);
+            DetermineSCCsFrom(rootNode, sccStack, index, closeSCC);
 }
 
-// (recursive part of DetermineSCCs())
-void ComputationNetwork::DetermineSCCsR(ComputationNodeBasePtr cur,
-                                        list<ComputationNodeBasePtr>& sccStack,
-                                        size_t& index, size_t& loopId)
+// Tarjan's algorithm from 'startNode' over all nodes not yet m_visited
+// closeSCC() is called for every strongly connected component when it is closed, with its nodes in the order they are popped off
+// the stack (ending with the node through which the search entered it). The depth-first search keeps its own stack rather than
+// recursing, since generated networks (e.g. unrolled decoders) can be far deeper than the call stack allows.
+// This sets m_index, m_minIndex, m_visited, and m_inStack.
+/*static*/ void ComputationNetwork::DetermineSCCsFrom(const ComputationNodeBasePtr& startNode, vector<ComputationNodeBasePtr>& sccStack, size_t& index,
+                                                     const function<void(vector<ComputationNodeBasePtr>&&, const ComputationNodeBasePtr&)>& closeSCC)
 {
-    assert(!cur->m_visited);
-
-    // set the index (in order of visitation)
-    cur->m_index = index;    // TODO: can this be used as m_visitedOrder?
-    cur->m_minIndex = index; // also set m_minIndex
-    index++;
-
-    cur->m_visited = true;
-    sccStack.push_back(cur);
-    cur->m_inStack = true;
-
-    // set m_minIndex to min over m_lowLinks of children
-    for (int i = 0; i < cur->GetNumInputs(); i++)
+    vector<pair<ComputationNodeBasePtr, size_t>> dfsStack; // (node, index of the next input to visit)
+    auto enter = [&](const ComputationNodeBasePtr& node)
     {
-        if (!cur->Input(i)->m_visited)
+        assert(!node->m_visited);
+        // set the index (in order of visitation)
+        node->m_index = (int) index;    // TODO: can this be used as m_visitedOrder?
+        node->m_minIndex = (int) index; // also set m_minIndex
+        index++;
+        node->m_visited = true;
+        sccStack.push_back(node);
+        node->m_inStack = true;
+        dfsStack.push_back(make_pair(node, (size_t) 0));
+    };
+    enter(startNode);
+    while (!dfsStack.empty())
+    {
+        // set m_minIndex to min over m_lowLinks of children
+        ComputationNodeBasePtr cur = dfsStack.back().first;
+        size_t i = dfsStack.back().second++;
+        if (i < cur->GetNumInputs())
         {
-            DetermineSCCsR(cur->Input(i), sccStack, index, loopId);
-            cur->m_minIndex = min(cur->m_minIndex, cur->Input(i)->m_minIndex);
+            const auto& input = cur->Input(i);
+            if (!input->m_visited)
+                enter(input); // (its m_minIndex is folded into ours once it is done, below)
+            else if (input->m_inStack)
+                cur->m_minIndex = min(cur->m_minIndex, input->m_minIndex);
+            continue;
         }
-        else if (cur->Input(i)->m_inStack)
+        dfsStack.pop_back();
+        if (!dfsStack.empty())
         {
-            cur->m_minIndex = min(cur->m_minIndex, cur->Input(i)->m_minIndex);
+            auto& parent = dfsStack.back().first;
+            parent->m_minIndex = min(parent->m_minIndex, cur->m_minIndex);
         }
-    }
 
-    // if we closed a loop then create an entry in m_allSEQNodes
-    if (cur->m_minIndex == cur->m_index) // m_minIndex is still equal to m_index, as we set it at the start of this function: we closed a loop
-    {
-        // gather the list of all nodes in this loop
-        vector<ComputationNodeBasePtr> nestedNodes;
-        // TODO: build array first in a local array. Only if succeeds, then construct the node off it.
-        SEQTraversalFlowControlNode rInfo(m_allSEQNodes.size() /*loopId*/, cur);
-        for (;;)
+        // if we closed a loop then hand it over
+        if (cur->m_minIndex == cur->m_index) // m_minIndex is still equal to m_index, as we set it when entering: we closed a loop
         {
-            ComputationNodeBasePtr w = sccStack.back();
-            sccStack.pop_back();
-            w->m_inStack = false;
-            nestedNodes.push_back(w);
-            if (w == cur) // hit our starting point: done
-                break;
-        }
-        // insert loop into m_allSEQNodes
-        if (nestedNodes.size() > 1) // non-looped nodes are detected here as loops of size 1 --skip those
-        {
-            // only add to the array if the loop is not already there
-            // We end up producing the same loop multiple times because:
-            //  - FormRecurrentLoops() is called multiple times from different roots
-            //  - depth-first traversal might have led us to enter a loop multiple times?
-            // TODO: Check whether this edge case of idempotence is done correctly:
-            //  - a recurrent loop with two delay nodes
-            //  - two root nodes
-            //  - the first root takes the first delay node's value, the second root that of the second delay node
-            //    I.e. the depth-first tree traversals enter the loop at two different places (m_sourceNode).
-            //  -> Are these two loops detected as identical? (determined by m_minIndex, but m_index depends on traversal from each root, so maybe not)
-            bool bFound = false; // find a dup  --TODO: check whether there is an STL algorithm for this
-            for (const auto& iter2 : m_allSEQNodes)
+            // gather the list of all nodes in this loop
+            vector<ComputationNodeBasePtr> nestedNodes;
+            for (;;)
             {
-                if (iter2->m_sourceNode == cur)
-                {
-                    bFound = true;
+                ComputationNodeBasePtr w = sccStack.back();
+                sccStack.pop_back();
+                w->m_inStack = false;
+                nestedNodes.push_back(w);
+                if (w == cur) // hit our starting point: done
                     break;
-                }
-            }
-            if (!bFound)
-            {
-#if 1
-                if (loopId != m_allSEQNodes.size())
-                    LogicError("DetermineSCCsR(): inconsistent loopId (%d) vs. m_allSEQNodes.size() (%d)", (int) loopId, (int) m_allSEQNodes.size());
-                SEQTraversalFlowControlNode rInfo(m_allSEQNodes.size(), cur);
-#else
-                assert(loopId == m_allSEQNodes.size()); // BUGBUG: Only true if all loops are shared among roots. Fix: use m_allSEQNodes.size() instead
-                SEQTraversalFlowControlNode rInfo(loopId, cur);
-#endif
-                // TODO: can we prove that 'cur' == nestedNodes.front()? If so, we won't need to store it separately.
-                rInfo.m_nestedNodes = move(nestedNodes); // TODO: make these two part of the constructor
-                rInfo.m_steppingDirection = DetermineLoopDirection(rInfo.m_nestedNodes);
-                m_allSEQNodes.push_back(make_shared<SEQTraversalFlowControlNode>(move(rInfo)));
-                loopId++; // and count it  TODO: may be removed
             }
+            closeSCC(move(nestedNodes), cur);
         }
     }
 }
@@ -313,36 +294,12 @@ void ComputationNetwork::DetermineLoopForwardOrder(unordered_set<ComputationNode
         LogicError("%ls %ls operation is part of an infinite loop that cannot be unrolled.", cur->NodeName().c_str(), cur->OperationName().c_str());
 }
 
-// traverse sub-graph feeding this node (which is a top-level node at start, e.g. training criterion) and list
-//  - all nodes that participate in a loop -> recurrentResult[loopId][]
-//  - all nodes that don't                 -> noRecurrentResult[]
-// in order of traversal (depth-first).
-// This is part of the FormRecurrentLoops() process, and only called from there from one place.
-void ComputationNetwork::GatherLoopNodesR(const ComputationNodeBasePtr& node, unordered_set<ComputationNodeBasePtr>& visited,
-                                          map<int, list<ComputationNodeBasePtr>>& recurrentResult,
-                                          list<ComputationNodeBasePtr>& noRecurrentResult)
-{
-    if (visited.find(node) != visited.end())
-        return; // do each node only once
-    visited.insert(node);
-
-    for (int i = 0; i < node->GetNumInputs(); i++)
-        GatherLoopNodesR(node->Input(i), visited, recurrentResult, noRecurrentResult);
-
-    if (node->m_loopId >= 0)
-        recurrentResult[node->m_loopId].push_back(node);
-    else
-        noRecurrentResult.push_back(node);
-}
-
 // takes a list of nodes and modifies it such that all nodes of the same loop are consecutive
 //  - 'nodes' is in some traversal order
 //  - that order is preserved for all nodes outside loops
 //  - each node that belongs to a loop is replaced by all nodes of that loop in loop order
 // Called only from FormRecurrentLoops().
-void ComputationNetwork::ReorderLoops(list<ComputationNodeBasePtr>& nodes,
-                                      const map<int, list<ComputationNodeBasePtr>>& /*recurrentNodes*/,
-                                      const list<ComputationNodeBasePtr>& /*noRecurrentNodes*/)
+void ComputationNetwork::ReorderLoops(list<ComputationNodeBasePtr>& nodes)
 {
     list<ComputationNodeBasePtr> newList;
 
@@ -408,4 +365,361 @@ static int DetermineLoopDirection(const std::vector<ComputationNodeBasePtr>& nes
     return steppingDirection;
 }
 
+// -----------------------------------------------------------------------
+// loop-invariant terms
+// -----------------------------------------------------------------------
+
+// HoistLoopInvariantTerms() -- reassociate sums and elementwise products inside recurrent loops, so that their loop-invariant terms are combined outside
+// A recurrent loop consists of the nodes on a cycle, so e.g. the input projection W * x of an LSTM gate is already computed once for the whole
+// minibatch, and only W_h * h(t-1) runs per time step. But a gate is typically written as ((W_h * h(t-1) + W * x) + b), where each Plus depends
+// on the recurrence, so both additions run per time step. This turns (a + b) + c, where only 'a' depends on the recurrence, into a + (b + c),
+// which leaves a single Plus in the loop, and likewise for ElementTimes. The inner node is rewired in place; it must
+//  - have the outer node as its only consumer, and not be in a node group (its value is not asked for by anyone), and
+//  - be the same associative operation as the outer node.
+// (Reassociation may change the results in the last bits.)
+// Called from CompileNetwork() before recurrent loops are formed.
+void ComputationNetwork::HoistLoopInvariantTerms()
+{
+    set<ComputationNodeBasePtr> valueNeeded(m_allRoots.begin(), m_allRoots.end());
+    valueNeeded.insert(m_pairNodes.begin(), m_pairNodes.end());
+
+    size_t numHoisted = 0;
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+
+        // determine which nodes are on a cycle (with the same search as DetermineSCCs(), whose node state FormRecurrentLoops() resets)
+        set<ComputationNodeBase*> inLoop;
+        for (const auto& iter : m_nameToNodeMap)
+            iter.second->PurgeStateForFormingRecurrentLoops();
+        vector<ComputationNodeBasePtr> sccStack;
+        size_t index = 0;
+        for (const auto& iter : m_nameToNodeMap)
+        {
+            if (!iter.second->m_visited)
+                DetermineSCCsFrom(iter.second, sccStack, index, [&inLoop](vector<ComputationNodeBasePtr>&& sccNodes, const ComputationNodeBasePtr&)
+                                  {
+                                      if (sccNodes.size() > 1) // (unless it is a single node, it is a loop)
+                                          for (const auto& node : sccNodes)
+                                              inLoop.insert(node.get());
+                                  });
+        }
+        if (inLoop.empty())
+            break;
+        auto isInLoop = [&inLoop](const ComputationNodeBasePtr& node)
+        {
+            return inLoop.find(node.get()) != inLoop.end();
+        };
+
+        auto numUses = CountNodeUses();
+        for (const auto& iter : m_nameToNodeMap)
+        {
+            auto outer = iter.second;
+            const auto& operation = outer->OperationName();
+            if (!isInLoop(outer) || outer->GetNumInputs() != 2 || (operation != OperationNameOf(PlusNode) && operation != OperationNameOf(ElementTimesNode)))
+                continue;
+            for (size_t k = 0; k < 2; k++)
+            {
+                auto inner = outer->Input(k);
+                auto c = outer->Input(1 - k);
+                if (isInLoop(c) || !isInLoop(inner) || inner->OperationName() != operation || inner->GetNumInputs() != 2 ||
+                    numUses[inner] != 1 || valueNeeded.find(inner) != valueNeeded.end())
+                    continue;
+                // which of the inner inputs is the invariant one?
+                size_t j = isInLoop(inner->Input(0)) ? 1 : 0;
+                if (isInLoop(inner->Input(j)) || !isInLoop(inner->Input(1 - j)))
+                    continue;
+                // (a + b) + c -> a + (b + c)
+                auto a = inner->Input(1 - j);
+                inner->SetInput(1 - j, c);
+                outer->SetInput(k, a);
+                outer->SetInput(1 - k, inner);
+                inLoop.erase(inner.get());
+                numHoisted++;
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    if (numHoisted > 0)
+        fprintf(stderr, "\nMoved %d loop-invariant terms out of recurrent loops.\n", (int) numHoisted);
+}
+
+// -----------------------------------------------------------------------
+// elementwise operator fusion
+// -----------------------------------------------------------------------
+
+// FuseElementwiseOperations() -- let unary elementwise nodes compute their binary elementwise input in the same TensorOp
+// E.g. for Sigmoid(Plus(x, b)), the Sigmoid node computes opSigmoidOfSum(x, b) directly, and Plus::ForwardProp() is skipped.
+// This saves one kernel launch and one round-trip of the intermediate through memory. It is done only if
+//  - the input implements IFusableElementwiseNode and this node is its only consumer,
+//  - the input is not a root and was not asked for by a caller of AllocateAllMatrices() (its value is not read by anyone), and
+//  - the consumer accepts the fusion (it has a fused opcode and computes its gradient from its output, so that the input's value is not needed in backprop).
+// The input's gradient is still computed as usual.
+// Called from CompileNetwork() after validation, and idempotent.
+void ComputationNetwork::FuseElementwiseOperations()
+{
+    // undo the decision of the previous call, the network may have changed since
+    map<ComputationNodeBasePtr, size_t> numConsumers;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        node->m_isFusedIntoConsumer = false;
+        auto fusableNode = dynamic_pointer_cast<IFusableElementwiseNode>(node);
+        if (fusableNode)
+            fusableNode->UnfuseInput();
+        for (const auto& input : node->GetInputs())
+            numConsumers[input]++;
+    }
+
+    set<ComputationNodeBasePtr> valueNeeded(m_allRoots.begin(), m_allRoots.end());
+    valueNeeded.insert(m_pairNodes.begin(), m_pairNodes.end());
+    valueNeeded.insert(m_valueNeededNodes.begin(), m_valueNeededNodes.end());
+
+    size_t numFused = 0;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        auto consumer = dynamic_pointer_cast<IFusableElementwiseNode>(node);
+        if (!consumer || node->GetNumInputs() != 1)
+            continue;
+        auto input = node->Input(0);
+        auto producer = dynamic_pointer_cast<IFusableElementwiseNode>(input);
+        if (!producer || input->GetNumInputs() != 2 || input->IsFusedIntoConsumer() || numConsumers[input] != 1 || valueNeeded.find(input) != valueNeeded.end())
+            continue;
+        if (!consumer->TryFuseInput(producer->GetForwardOpCode()))
+            continue;
+        input->m_isFusedIntoConsumer = true;
+        numFused++;
+    }
+
+    if (numFused > 0)
+        fprintf(stderr, "\nFused %d elementwise operations into their consumers.\n", (int) numFused);
+}
+
+// FuseConvolutionBiasReLU() -- let a Convolution node compute ReLU(Plus(Convolution(W, x), b)) in a single engine call
+// With cuDNN 6 or later, cudnnConvolutionBiasActivationForward() adds the bias and applies the ReLU before the convolution output
+// is written, so neither the Convolution's nor the Plus's value is ever materialized (see IFusableChainHeadNode).
+// In backprop, the ReLU propagates its gradient right into the gradients of the Convolution and of b, and the Plus node's backprop is skipped.
+// It is done only if
+//  - the Convolution, the Plus and b have no other consumer and are not roots,
+//  - none of them is part of a recurrent loop, and
+//  - the Convolution node accepts the fusion (its engine supports it, and b is one bias per channel).
+// This replaces the fusion of the Plus into the ReLU by FuseElementwiseOperations(), so it is called right after it, and is idempotent.
+void ComputationNetwork::FuseConvolutionBiasReLU()
+{
+    // undo the decision of the previous call (FuseElementwiseOperations() has reset m_isFusedIntoConsumer and the tails)
+    map<ComputationNodeBasePtr, size_t> numConsumers;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        node->m_isBackpropFusedIntoConsumer = false;
+        auto headNode = dynamic_pointer_cast<IFusableChainHeadNode>(node);
+        if (headNode)
+            headNode->UnfuseChain();
+        for (const auto& input : node->GetInputs())
+            numConsumers[input]++;
+    }
+
+    set<ComputationNodeBasePtr> valueNeeded(m_allRoots.begin(), m_allRoots.end());
+    valueNeeded.insert(m_pairNodes.begin(), m_pairNodes.end());
+    valueNeeded.insert(m_valueNeededNodes.begin(), m_valueNeededNodes.end());
+    // (a bias with several consumers would get its gradient from several tails, which concurrent backprop does not expect)
+    auto isPrivate = [&](const ComputationNodeBasePtr& node)
+    {
+        return numConsumers[node] == 1 && valueNeeded.find(node) == valueNeeded.end() && !node->IsPartOfLoop();
+    };
+
+    size_t numFused = 0;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        auto tail = dynamic_pointer_cast<IFusableElementwiseNode>(node);
+        if (!tail || node->GetNumInputs() != 1 || node->IsPartOfLoop())
+            continue;
+        auto plus = node->Input(0);
+        if (plus->OperationName() != OperationNameOf(PlusNode) || plus->GetNumInputs() != 2 || !isPrivate(plus) ||
+            !isPrivate(plus->Input(0)) || !isPrivate(plus->Input(1)))
+            continue;
+        for (const auto& input : plus->GetInputs())
+        {
+            auto head = dynamic_pointer_cast<IFusableChainHeadNode>(input);
+            if (!head || !head->TryFuseChain(plus))
+                continue;
+            if (tail->TryFuseChain(head))
+            {
+                plus->m_isFusedIntoConsumer = true;
+                plus->m_isBackpropFusedIntoConsumer = true;
+                input->m_isFusedIntoConsumer = true;
+                numFused++;
+            }
+            else
+                head->UnfuseChain();
+            break;
+        }
+    }
+
+    if (numFused > 0)
+        fprintf(stderr, "\nFused %d convolutions with their bias and ReLU.\n", (int) numFused);
+}
+
+// KeepValuesOf() -- let nodes whose values a caller reads be computed by themselves, even if they are not roots
+// Callers may ask for any node, e.g. an output by name in evaluation or WriteOutput, or a constant subnetwork to be folded.
+// If one of them was fused into its consumer, its value would never be written, so the fusions are decided again without it.
+// The nodes are remembered for later calls of CompileNetwork().
+void ComputationNetwork::KeepValuesOf(const vector<ComputationNodeBasePtr>& nodes)
+{
+    bool anyFused = false;
+    for (const auto& node : nodes)
+    {
+        if (node && m_valueNeededNodes.insert(node).second)
+            anyFused |= node->IsFusedIntoConsumer();
+    }
+    if (anyFused)
+    {
+        FuseElementwiseOperations();
+        FuseConvolutionBiasReLU();
+    }
+}
+
+// -----------------------------------------------------------------------
+// image layout conversions
+// -----------------------------------------------------------------------
+
+// ElideImageLayoutConversions() -- let chains of image nodes pass their values in their engine's layout
+// An image node (IImageLayoutNode) whose engine computes in another layout than the model transposes its input and output.
+// Between two such nodes that is wasted work, e.g. in Convolution -> MaxPooling -> Convolution on the legacy engine with a CHW model,
+// so a producer keeps its output in the engine layout if
+//  - all its consumers are image nodes that take it as their image input, with the same model and engine layouts, and
+//  - it is not a root (its value is not asked for by anyone).
+// Then transpositions only remain at the boundaries of the chain.
+// Called from CompileNetwork() before validation, since a value's layout determines its tensor shape, and idempotent.
+void ComputationNetwork::ElideImageLayoutConversions()
+{
+    // undo the decision of the previous call, the network may have changed since
+    map<ComputationNodeBasePtr, vector<pair<ComputationNodeBasePtr, size_t>>> consumers; // [node] -> (consumer, input index)
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        auto imageNode = dynamic_pointer_cast<IImageLayoutNode>(node);
+        if (imageNode)
+            imageNode->SetValuesInEngineLayout(false, false);
+        for (size_t i = 0; i < node->GetNumInputs(); i++)
+            consumers[node->Input(i)].push_back(make_pair(node, i));
+    }
+
+    set<ComputationNodeBasePtr> valueNeeded(m_allRoots.begin(), m_allRoots.end());
+    valueNeeded.insert(m_pairNodes.begin(), m_pairNodes.end());
+
+    set<ComputationNodeBasePtr> inputInEngineLayout, outputInEngineLayout;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        auto producer = dynamic_pointer_cast<IImageLayoutNode>(node);
+        if (!producer || producer->GetEngineImageLayout() == producer->GetImageLayout() || valueNeeded.find(node) != valueNeeded.end())
+            continue;
+        const auto& nodeConsumers = consumers[node];
+        bool chained = !nodeConsumers.empty();
+        for (const auto& consumerAndIndex : nodeConsumers)
+        {
+            auto consumer = dynamic_pointer_cast<IImageLayoutNode>(consumerAndIndex.first);
+            if (!consumer || consumer->GetImageInputIndex() != consumerAndIndex.second ||
+                consumer->GetImageLayout() != producer->GetImageLayout() || consumer->GetEngineImageLayout() != producer->GetEngineImageLayout())
+            {
+                chained = false;
+                break;
+            }
+        }
+        if (!chained)
+            continue;
+        outputInEngineLayout.insert(node);
+        for (const auto& consumerAndIndex : nodeConsumers)
+            inputInEngineLayout.insert(consumerAndIndex.first);
+    }
+
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        bool input = inputInEngineLayout.find(node) != inputInEngineLayout.end();
+        bool output = outputInEngineLayout.find(node) != outputInEngineLayout.end();
+        if (input || output)
+            dynamic_pointer_cast<IImageLayoutNode>(node)->SetValuesInEngineLayout(input, output);
+    }
+
+    if (!outputInEngineLayout.empty())
+        fprintf(stderr, "\nKeeping the outputs of %d image nodes in their engine's layout.\n", (int) outputInEngineLayout.size());
+}
+
+// -----------------------------------------------------------------------
+// in-place values
+// -----------------------------------------------------------------------
+
+// PlanInPlaceValues() -- let elementwise nodes write their value into their input's matrix
+// E.g. in Sigmoid(Plus(Times(W, x), b)), the Plus overwrites the Times value and the Sigmoid the Plus value, so that the three share one matrix.
+// A Reshape of such an input becomes a view of its value that is never copied.
+// A node (CanComputeValueInPlaceOfInput()) takes over the matrix of an input if
+//  - it is the input's only consumer, and the input is not a root (nobody else ever reads the input's value),
+//  - neither its own backprop nor the input's reads the input's value (so it may be overwritten right away),
+//  - both have the same layout and element type (so the matrix has the right size; a reshape only needs the same number of elements per sample), and
+//  - both go through memory sharing at all (not leaves, not in a loop, sharable, not fused, and shareNodeValueMatrices=true).
+// The matrix is then released by the last node of such a chain. Since node matrices are kept across AllocateAllMatrices() calls,
+// this only depends on the network structure, not on the roots of a particular call.
+// Called from AllocateAllMatrices() before the sharing of the value matrices is planned, and idempotent.
+void ComputationNetwork::PlanInPlaceValues()
+{
+    // undo the decision of the previous call, the network may have changed since
+    map<ComputationNodeBasePtr, size_t> numConsumers;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        node->m_inPlaceInputIndex = SIZE_MAX;
+        node->m_isValueTakenOverByConsumer = false;
+        for (const auto& input : node->GetInputs())
+            numConsumers[input]++;
+    }
+    if (!g_shareNodeValueMatrices)
+        return;
+
+    set<ComputationNodeBasePtr> roots(m_allRoots.begin(), m_allRoots.end());
+    roots.insert(m_pairNodes.begin(), m_pairNodes.end());
+    auto isShared = [&roots](const ComputationNodeBasePtr& node)
+    {
+        return !node->IsLeaf() && !node->RequiresPreCompute() && !node->IsPartOfLoop() && !node->IsFusedIntoConsumer() &&
+               node->isValueSharable() && roots.find(node) == roots.end();
+    };
+    // can the value of 'node' live in the matrix of input 'i' (given the same MBLayout)? Without MBLayout, the matrix dims come from the sample layout.
+    auto haveSameValueMatrixLayout = [](const ComputationNodeBasePtr& node, size_t i)
+    {
+        const auto& input = node->Input(i);
+        if (input->GetSampleLayout() == node->GetSampleLayout())
+            return true;
+        return node->IsValueReshapeOfInput(i) && node->HasMBLayout() && input->GetSampleLayout().GetNumElements() == node->GetSampleLayout().GetNumElements();
+    };
+
+    size_t numInPlace = 0;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        auto node = iter.second;
+        if (!isShared(node))
+            continue;
+        for (size_t i = 0; i < node->GetNumInputs(); i++)
+        {
+            auto input = node->Input(i);
+            if (!node->CanComputeValueInPlaceOfInput(i) || node->InputUsedInComputingInputNodesGradients(i) ||
+                !isShared(input) || numConsumers[input] != 1 || input->OutputUsedInComputingInputNodesGradients() ||
+                input->GetMBLayout() != node->GetMBLayout() || !haveSameValueMatrixLayout(node, i) ||
+                input->Is<ComputationNode<float>>() != node->Is<ComputationNode<float>>())
+                continue;
+            node->m_inPlaceInputIndex = i;
+            input->m_isValueTakenOverByConsumer = true;
+            numInPlace++;
+            break;
+        }
+    }
+
+    if (numInPlace > 0)
+        fprintf(stderr, "\nComputing %d node values in place of their inputs.\n", (int) numInPlace);
+}
+
 } } }
@@ -10,9 +10,13 @@
 #include "ComputationNetwork.h"
 #include "InputAndParamNodes.h"
 #include "TrainingNodes.h"
+#include "ReshapingNodes.h"
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 using namespace std;
 
@@ -360,4 +364,151 @@ void ComputationNetwork::SetBatchNormlizationNodesBelowEvalMode(const bool evalM
         }
     }
 }
+
+template <class ElemType>
+map<wstring, DEVICEID_TYPE> ComputationNetwork::PartitionAcrossDevices(const ComputationNodeBasePtr& criterionNode, const vector<DEVICEID_TYPE>& deviceIds,
+                                                                       const vector<wstring>& partitionStarts)
+{
+    VerifyIsCompiled("PartitionAcrossDevices");
+    if (deviceIds.size() < 2)
+        InvalidArgument("PartitionAcrossDevices: At least two devices are needed to split a model.");
+    if (!partitionStarts.empty() && partitionStarts.size() != deviceIds.size() - 1)
+        InvalidArgument("PartitionAcrossDevices: %d part starts were given for %d devices; one less is needed.", (int) partitionStarts.size(), (int) deviceIds.size());
+
+    // undo an earlier split (a checkpoint of a model trained this way), so that the parts can be chosen afresh
+    bool removedTransfers = false;
+    for (const auto& transfer : GetNodesWithType(OperationNameOf(DeviceTransferNode)))
+    {
+        for (const auto& node : GetAllNodes())
+            for (size_t i = 0; i < node->GetNumInputs(); i++)
+                if (node->GetInputs()[i] == transfer)
+                    node->SetInput(i, transfer->GetInputs()[0]);
+        for (auto groupIter : GetAllNodeGroups())
+            for (auto& groupNode : *groupIter)
+                if (groupNode == transfer)
+                    groupNode = transfer->GetInputs()[0];
+        DeleteNode(transfer->NodeName());
+        removedTransfers = true;
+    }
+    if (removedTransfers)
+        CompileNetwork();
+
+    // the nodes that compute something, in the order they run in
+    vector<ComputationNodeBasePtr> computeNodes;
+    for (const auto& node : GetEvalOrder(nullptr))
+        if (!node->IsLeaf())
+            computeNodes.push_back(node);
+    if (computeNodes.size() < deviceIds.size())
+        InvalidArgument("PartitionAcrossDevices: The model has fewer operations (%d) than devices (%d).", (int) computeNodes.size(), (int) deviceIds.size());
+
+    // determine where each part begins, as an index into computeNodes
+    vector<size_t> partBegins(1, 0);
+    if (!partitionStarts.empty())
+    {
+        for (const auto& name : partitionStarts)
+        {
+            auto iter = find(computeNodes.begin(), computeNodes.end(), GetNodeFromName(name));
+            if (iter == computeNodes.end())
+                InvalidArgument("PartitionAcrossDevices: %ls is not an operation of the model, so no part can start with it.", name.c_str());
+            size_t begin = iter - computeNodes.begin();
+            if (begin <= partBegins.back())
+                InvalidArgument("PartitionAcrossDevices: The part starts must be given in evaluation order; %ls comes too early.", name.c_str());
+            partBegins.push_back(begin);
+        }
+    }
+    else
+    {
+        // balance by parameter elements, each parameter counted with the first operation that uses it
+        vector<size_t> weights(computeNodes.size(), 0);
+        set<ComputationNodeBasePtr> counted;
+        size_t totalWeight = 0;
+        for (size_t k = 0; k < computeNodes.size(); k++)
+        {
+            for (const auto& input : computeNodes[k]->GetInputs())
+                if (input->OperationName() == OperationNameOf(LearnableParameter) && counted.insert(input).second)
+                    weights[k] += input->GetSampleLayout().GetNumElements();
+            totalWeight += weights[k];
+        }
+        size_t cumulativeWeight = 0;
+        for (size_t k = 0; k < computeNodes.size() && partBegins.size() < deviceIds.size(); k++)
+        {
+            // a part ends once it holds its share, but leaves at least one operation to each of the following parts
+            const size_t partsLeft = deviceIds.size() - partBegins.size();
+            if (k > partBegins.back() && (cumulativeWeight * deviceIds.size() >= totalWeight * partBegins.size() || computeNodes.size() - k <= partsLeft))
+                partBegins.push_back(k);
+            cumulativeWeight += weights[k];
+        }
+    }
+
+    // do not cut through a recurrent loop: move the begin of a part behind its end
+    for (size_t p = 1; p < partBegins.size(); p++)
+    {
+        size_t& begin = partBegins[p];
+        while (begin < computeNodes.size() && computeNodes[begin]->IsPartOfLoop() && computeNodes[begin - 1]->IsPartOfLoop() &&
+               FindInRecurrentLoops(m_allSEQNodes, computeNodes[begin]) == FindInRecurrentLoops(m_allSEQNodes, computeNodes[begin - 1]))
+            begin++;
+        if (begin >= computeNodes.size() || (p + 1 < partBegins.size() && begin >= partBegins[p + 1]))
+            InvalidArgument("PartitionAcrossDevices: Part %d of the model would be empty, since recurrent loops cannot be split. Please choose other part starts.", (int) p);
+    }
+
+    // assign the operations; the criteria and evaluation results go with the last part, where the training criterion is
+    unordered_map<ComputationNodeBasePtr, size_t> partOf;
+    for (size_t p = 0; p < partBegins.size(); p++)
+    {
+        size_t end = p + 1 < partBegins.size() ? partBegins[p + 1] : computeNodes.size();
+        for (size_t k = partBegins[p]; k < end; k++)
+            partOf[computeNodes[k]] = p;
+    }
+    const size_t lastPart = deviceIds.size() - 1;
+    partOf[criterionNode] = lastPart;
+    for (const auto& node : FinalCriterionNodes())
+        partOf[node] = lastPart;
+    for (const auto& node : EvaluationNodes())
+        partOf[node] = lastPart;
+
+    // parameters and inputs live with the first operation that uses them
+    for (const auto& node : computeNodes)
+        for (const auto& input : node->GetInputs())
+            if (input->IsLeaf() && (partOf.find(input) == partOf.end() || partOf[input] > partOf[node]))
+                partOf[input] = partOf[node];
+
+    // insert a transfer on each edge between parts; consumers on the same device share one
+    map<pair<ComputationNodeBasePtr, size_t>, ComputationNodeBasePtr> transfers;
+    map<wstring, DEVICEID_TYPE> placement;
+    for (const auto& node : GetAllNodes())
+    {
+        if (partOf.find(node) == partOf.end()) // not used for anything we run
+            continue;
+        const size_t part = partOf[node];
+        placement[node->NodeName()] = deviceIds[part];
+        for (size_t i = 0; i < node->GetNumInputs(); i++)
+        {
+            const auto input = node->GetInputs()[i];
+            if (partOf[input] == part)
+                continue;
+            auto& transfer = transfers[make_pair(input, part)];
+            if (!transfer)
+            {
+                wstring name = input->NodeName() + L".toGPU" + std::to_wstring(deviceIds[part]);
+                while (NodeNameExists(name))
+                    name += L"_";
+                transfer = AddNodeToNetAndAttachInputs(New<DeviceTransferNode<ElemType>>(deviceIds[part], name), input);
+                placement[name] = deviceIds[part];
+            }
+            node->SetInput(i, transfer);
+        }
+    }
+
+    for (size_t p = 0; p < partBegins.size(); p++)
+        fprintf(stderr, "PartitionAcrossDevices: Part %d on GPU %d starts with %ls %ls operation.\n",
+                (int) p, (int) deviceIds[p], computeNodes[partBegins[p]]->NodeName().c_str(), computeNodes[partBegins[p]]->OperationName().c_str());
+    fprintf(stderr, "PartitionAcrossDevices: %d DeviceTransfer operations were inserted between them.\n", (int) transfers.size());
+
+    InvalidateCompiledNetwork();
+    CompileNetwork();
+    return placement;
+}
+
+template map<wstring, DEVICEID_TYPE> ComputationNetwork::PartitionAcrossDevices<float>(const ComputationNodeBasePtr& criterionNode, const vector<DEVICEID_TYPE>& deviceIds, const vector<wstring>& partitionStarts);
+template map<wstring, DEVICEID_TYPE> ComputationNetwork::PartitionAcrossDevices<double>(const ComputationNodeBasePtr& criterionNode, const vector<DEVICEID_TYPE>& deviceIds, const vector<wstring>& partitionStarts);
 } } }
@@ -10,12 +10,14 @@
 #include "ComputationNetwork.h"
 #include "RecurrentNodes.h"
 #include "InputAndParamNodes.h"
+#include "NodeProfiler.h"
 #include <string>
 #include <vector>
 #include <list>
 #include <set>
 #include <algorithm>
 #include <map>
+#include <exception>
 
 using namespace std;
 
@@ -43,6 +45,16 @@ void ComputationNetwork::ForwardProp(const ComputationNodeBasePtr rootNode)
     GetNestedNetwork(rootNode)->ForwardProp(FrameRange(nullptr));
 }
 
+void ComputationNetwork::ForwardPropJointly(const std::vector<ComputationNodeBasePtr>& rootNodes)
+{
+    VerifyIsCompiled("ForwardPropJointly");
+
+    if (rootNodes.size() == 1)
+        ForwardProp(rootNodes.front());
+    else
+        GetJointNestedNetwork(rootNodes)->ForwardProp(FrameRange(nullptr));
+}
+
 // set the gradient matrix of a node to an 1x1 matrix containing 1.0
 // Returns false if the node is not a ComputationNode<ElemType>.
 template <class ElemType>
@@ -64,7 +76,8 @@ static bool SetGradientToScalarOne(ComputationNodeBasePtr nodep)
 //  - ForwardProp() for eval nodes
 //  - ForwardProp() for the training criterion (which will reuse computation results from the previous step)
 //  - Backprop() for the training criterion
-void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode) // training criterion to compute the gradients for
+void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode, // training criterion to compute the gradients for
+                                  const std::function<void(const ComputationNodeBasePtr&)>& gradientIsFinal)
 {
     // reset all gradients to zero (actually, internally, this is lazy, but we don't care here)
     ZeroGradients(rootNode);
@@ -74,7 +87,8 @@ void ComputationNetwork::Backprop(const ComputationNodeBasePtr rootNode) // trai
         LogicError("Backprop: Training criterion is neither ComputationNode<float> nor ComputationNode<double>.");
 
     // backpropagate through the network
-    GetNestedNetwork(rootNode)->Backprop(FrameRange(nullptr), true, true);
+    auto network = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(rootNode));
+    network->Backprop(FrameRange(nullptr), gradientIsFinal);
 }
 
 void ComputationNetwork::FormNestedNetwork(const ComputationNodeBasePtr& rootNode)
@@ -92,6 +106,54 @@ ComputationNodeBasePtr ComputationNetwork::GetNestedNetwork(const ComputationNod
     return m_nestedNetworks[rootNode];
 }
 
+// get the execution plan for a set of roots, formed on first use
+// Its eval order is the union of theirs, in the order of the global one (which keeps the nodes of a loop consecutive).
+ComputationNodeBasePtr ComputationNetwork::GetJointNestedNetwork(const std::vector<ComputationNodeBasePtr>& rootNodes)
+{
+    auto iter = m_jointNestedNetworks.find(rootNodes);
+    if (iter != m_jointNestedNetworks.end())
+        return iter->second;
+
+    unordered_set<ComputationNodeBasePtr> neededNodes;
+    for (const auto& rootNode : rootNodes)
+        for (const auto& node : GetEvalOrder(rootNode))
+            neededNodes.insert(node);
+    list<ComputationNodeBasePtr> evalOrder;
+    for (const auto& node : GetEvalOrder(nullptr))
+        if (neededNodes.find(node) != neededNodes.end())
+            evalOrder.push_back(node);
+    return m_jointNestedNetworks[rootNodes] = make_shared<PARTraversalFlowControlNode>(m_allSEQNodes, evalOrder);
+}
+
+/*static*/ size_t ComputationNetwork::s_numConcurrentStreams = 0;
+/*static*/ size_t ComputationNetwork::s_recomputeSegmentLength = 0;
+/*static*/ size_t ComputationNetwork::s_offloadMinValueSize = 0;
+
+/*static*/ map<ComputationNodeBasePtr, int> ComputationNetwork::DetermineConcurrentWaves(const vector<shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const list<ComputationNodeBasePtr>& nodes /*must be in eval order*/)
+{
+    map<ComputationNodeBasePtr, int> waves;
+    for (auto& node : nodes)
+    {
+        if (waves.find(node) != waves.end()) // member of a loop we have already seen
+            continue;
+        auto recInfo = node->IsPartOfLoop() ? FindInRecurrentLoops(recurrentInfo, node) : nullptr;
+        vector<ComputationNodeBasePtr> members = recInfo ? recInfo->m_nestedNodes : vector<ComputationNodeBasePtr>{node};
+        int wave = 0;
+        for (auto& member : members)
+        {
+            for (auto& input : member->GetInputs())
+            {
+                auto iter = waves.find(input); // (inputs that are members of the same loop are not found)
+                if (iter != waves.end())
+                    wave = max(wave, iter->second + 1);
+            }
+        }
+        for (auto& member : members)
+            waves[member] = wave;
+    }
+    return waves;
+}
+
 // -----------------------------------------------------------------------
 // PARTraversalFlowControlNode methods -- implements PAR traversal
 //
@@ -124,38 +186,251 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
             nodeIter++; // and consume this node
         }
     }
+
+    // group the nodes into waves of mutually independent nodes, for concurrent execution
+    auto waves = DetermineConcurrentWaves(recurrentInfo, allNodes);
+    for (auto& node : m_nestedNodes)
+    {
+        auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(node);
+        size_t wave = waves[recInfo ? recInfo->m_nestedNodes.front() : node];
+        if (m_waves.size() <= wave)
+            m_waves.resize(wave + 1);
+        m_waves[wave].push_back(node);
+    }
+
+    // Backprop() of the nodes of a wave can only run concurrently if they propagate into different nodes, since each adds to its inputs' gradients
+    // (e.g. the forward and backward loops of a BLSTM layer qualify, while two nodes reading the same parameter don't).
+    for (auto& wave : m_waves)
+    {
+        set<ComputationNodeBasePtr> gradientsWritten;
+        bool disjoint = true;
+        for (auto& node : wave)
+        {
+            auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(node);
+            const vector<ComputationNodeBasePtr>& members = recInfo ? recInfo->m_nestedNodes : vector<ComputationNodeBasePtr>{node};
+            set<ComputationNodeBasePtr> inputs;
+            for (auto& member : members)
+                inputs.insert(member->GetInputs().begin(), member->GetInputs().end());
+            for (auto& member : members) // (inside a loop, the gradients are the loop's own)
+                inputs.erase(member);
+            for (auto& input : inputs)
+                disjoint &= gradientsWritten.insert(input).second;
+        }
+        m_waveBackpropIsConcurrent.push_back(disjoint);
+    }
 }
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::ForwardProp(const FrameRange& fr) /*override*/
 {
-    for (auto& node : m_nestedNodes)
+    if (GetNumConcurrentStreams() <= 1)
     {
-        if (node->IsOutputOlderThanInputs())
+        for (auto& node : m_nestedNodes)
+            ForwardPropNode(node, fr);
+    }
+    else
+    {
+        // every wave only depends on earlier ones, so the nodes inside a wave can run concurrently
+        for (auto& wave : m_waves)
         {
-            auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(node);
-            if (recInfo)
-                assert(recInfo->m_sourceNode->GetMBLayout() == node->GetMBLayout());
+            if (wave.size() == 1)
+                ForwardPropNode(wave.front(), fr);
+            else
+                RunConcurrently(wave, [this, &fr](const ComputationNodeBasePtr& node)
+                                {
+                                    ForwardPropNode(node, fr);
+                                });
+        }
+    }
+}
 
-            node->BeginForwardProp();
+void ComputationNetwork::PARTraversalFlowControlNode::ForwardPropNode(const ComputationNodeBasePtr& node, const FrameRange& fr)
+{
+    if (node->IsOutputOlderThanInputs())
+    {
+        auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(node);
+        if (recInfo)
+            assert(recInfo->m_sourceNode->GetMBLayout() == node->GetMBLayout());
+
+        // (a loop's nodes are profiled one by one inside its ForwardProp())
+        NodeProfiler* profiler = recInfo ? nullptr : NodeProfiler::Current();
+
+        node->BeginForwardProp();
+        if (!node->IsFusedIntoConsumer()) // otherwise computed by its consumer
+        {
+            auto profilerEntry = profiler ? profiler->Begin(node, NodeProfiler::forward) : nullptr;
             node->ForwardProp(fr.WithLayout(node->GetMBLayout()));
-            node->EndForwardProp();
+            if (profilerEntry)
+                profiler->End(profilerEntry, NodeProfiler::forward);
+        }
+        node->EndForwardProp();
 
-            node->BumpEvalTimeStamp();
+        // start copying offloaded values to host memory, and complete the copies of those that were read here last (see PlanValueOffloading())
+        auto offload = [](const ComputationNodeBasePtr& member)
+        {
+            if (member->IsValueOffloaded())
+                member->BeginValueOffload();
+            for (auto& offloaded : member->GetOffloadsToCompleteAfterForwardProp())
+                offloaded->EndValueOffload();
+        };
+        if (recInfo)
+            for_each(recInfo->m_nestedNodes.begin(), recInfo->m_nestedNodes.end(), offload);
+        else
+            offload(node);
+
+        node->BumpEvalTimeStamp();
+    }
+}
+
+// run independent nodes concurrently: on a GPU, on the streams of m_streams, round-robin; on the CPU, on the OpenMP threads
+// The nodes' own OpenMP loops then run single-threaded, since OpenMP does not nest by default.
+void ComputationNetwork::PARTraversalFlowControlNode::RunConcurrently(const vector<ComputationNodeBasePtr>& nodes, const function<void(const ComputationNodeBasePtr&)>& run)
+{
+    auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(nodes.front());
+    DEVICEID_TYPE deviceId = (recInfo ? recInfo->m_sourceNode : nodes.front())->GetDeviceId();
+    if (deviceId >= 0)
+    {
+        if (!m_streams)
+            m_streams.reset(new ConcurrentStreams(deviceId, GetNumConcurrentStreams()));
+        m_streams->Fork();
+        try
+        {
+            for (size_t i = 0; i < nodes.size(); i++)
+            {
+                m_streams->Select(i);
+                run(nodes[i]);
+            }
+        }
+        catch (...)
+        {
+            m_streams->Join();
+            throw;
         }
+        m_streams->Join();
+    }
+    else
+    {
+        exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+        for (long i = 0; i < (long) nodes.size(); i++)
+        {
+            try
+            {
+                run(nodes[i]);
+            }
+            catch (...)
+            {
+#pragma omp critical
+                if (!error)
+                    error = current_exception();
+            }
+        }
+        if (error)
+            rethrow_exception(error);
     }
 }
 
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::Backprop(const FrameRange& fr, bool childrenInThisLoop, bool childrenInOuterLoop) /*override*/
 {
     childrenInThisLoop, childrenInOuterLoop; // TODO: think through what these mean when coming from PAR mode
-    // process nodes in pre-determined order
-    for (auto pnode = m_nestedNodes.rbegin(); pnode != m_nestedNodes.rend(); pnode++) // iterate backwards over evaluation order
+    Backprop(fr, nullptr);
+}
+
+void ComputationNetwork::PARTraversalFlowControlNode::Backprop(const FrameRange& fr, const std::function<void(const ComputationNodeBasePtr&)>& gradientIsFinal)
+{
+    if (GetNumConcurrentStreams() <= 1)
     {
-        auto& node = *pnode;
+        // process nodes in pre-determined order
+        for (auto pnode = m_nestedNodes.rbegin(); pnode != m_nestedNodes.rend(); pnode++) // iterate backwards over evaluation order
+        {
+            RestoreValuesBeforeBackprop(*pnode, fr);
+            BackpropNode(*pnode, fr);
+            SwapBackValuesAfterBackprop(*pnode);
+            // all consumers of this node come later in evaluation order, so they are done, and its gradient is complete
+            if (gradientIsFinal)
+                gradientIsFinal(*pnode);
+        }
+    }
+    else
+    {
+        // (PlanValueRecomputation() and PlanValueOffloading() do nothing with concurrent streams)
+        // all consumers of the nodes of a wave are in later waves, which are done
+        for (size_t w = m_waves.size(); w-- > 0;)
+        {
+            const auto& wave = m_waves[w];
+            if (wave.size() > 1 && m_waveBackpropIsConcurrent[w])
+            {
+                RunConcurrently(wave, [this, &fr](const ComputationNodeBasePtr& node)
+                                {
+                                    BackpropNode(node, fr);
+                                });
+            }
+            else
+            {
+                for (auto pnode = wave.rbegin(); pnode != wave.rend(); pnode++)
+                    BackpropNode(*pnode, fr);
+            }
+            if (gradientIsFinal)
+            {
+                for (auto pnode = wave.rbegin(); pnode != wave.rend(); pnode++)
+                    gradientIsFinal(*pnode);
+            }
+        }
+    }
+}
 
-        node->BeginBackprop();
+void ComputationNetwork::PARTraversalFlowControlNode::BackpropNode(const ComputationNodeBasePtr& node, const FrameRange& fr)
+{
+    NodeProfiler* profiler = NodeProfiler::Current();
+    if (profiler && dynamic_pointer_cast<SEQTraversalFlowControlNode>(node)) // (profiled inside)
+        profiler = nullptr;
+
+    node->BeginBackprop();
+    if (!node->IsBackpropFusedIntoConsumer()) // otherwise done by its consumer
+    {
+        auto profilerEntry = profiler ? profiler->Begin(node, NodeProfiler::backward) : nullptr;
         node->Backprop(fr.WithLayout(node->GetMBLayout()), true /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
-        node->EndBackprop();
+        if (profilerEntry)
+            profiler->End(profilerEntry, NodeProfiler::backward);
     }
+    node->EndBackprop();
+}
+
+// bring back the values that PlanValueRecomputation() and PlanValueOffloading() dropped after forward prop, right before 'node's backprop
+// reads them: start copying back offloaded values for later nodes, wait for those that are read now, and run forward prop once more for the
+// recomputed values. They go into their second matrix, which they keep until their own backprop.
+void ComputationNetwork::PARTraversalFlowControlNode::RestoreValuesBeforeBackprop(const ComputationNodeBasePtr& node, const FrameRange& fr)
+{
+    auto iter = m_stepsBeforeBackprop.find(node);
+    if (iter == m_stepsBeforeBackprop.end())
+        return;
+    const auto& steps = iter->second;
+    for (auto& prefetched : steps.beginPrefetch)
+        prefetched->BeginValuePrefetch();
+    for (auto& prefetched : steps.endPrefetch)
+        prefetched->EndValuePrefetch();
+    for (auto& recomputed : steps.recompute)
+    {
+        recomputed->SwapBackpropValue();
+        recomputed->BeginForwardProp();
+        recomputed->ForwardProp(fr.WithLayout(recomputed->GetMBLayout()));
+        recomputed->EndForwardProp();
+    }
+}
+
+// a recomputed or offloaded value is not needed after the node's own backprop; forward prop gets its own matrix back
+void ComputationNetwork::PARTraversalFlowControlNode::SwapBackValuesAfterBackprop(const ComputationNodeBasePtr& node)
+{
+    if (m_stepsBeforeBackprop.empty())
+        return;
+    auto swapBack = [](const ComputationNodeBasePtr& member)
+    {
+        if (member->IsValueRecomputed() || member->IsValueOffloaded())
+            member->SwapBackpropValue();
+    };
+    auto recInfo = dynamic_pointer_cast<SEQTraversalFlowControlNode>(node);
+    if (recInfo)
+        for_each(recInfo->m_nestedNodes.begin(), recInfo->m_nestedNodes.end(), swapBack);
+    else
+        swapBack(node);
 }
 /*virtual*/ void ComputationNetwork::PARTraversalFlowControlNode::RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) /*override*/
 {
@@ -192,11 +467,32 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
                        node->NodeName().c_str(), m_nestedNodes[0]->NodeName().c_str());
     }
 
+    // Time steps in which the last parallel sequences have ended (or not yet begun) are computed only on the active ones,
+    // if all nodes of the loop can be given such a FrameRange. A sequence that crosses the minibatch boundary (truncated BPTT)
+    // would have a delayed value from the previous minibatch, with the full width, so that case is left alone.
+    const auto& pMBLayout = GetMBLayout();
+    m_activeSequencesOnly = pMBLayout->GetNumParallelSequences() > 1 && pMBLayout->HasGaps() &&
+                            !pMBLayout->HasSequenceBeyondBegin() && !pMBLayout->HasSequenceBeyondEnd();
+    for (auto& node : m_nestedNodes)
+    {
+        if (!node->SupportsActiveSequencePrefix())
+            m_activeSequencesOnly = false;
+    }
+
     // tell all that loop is about to commence
     for (auto& node : m_nestedNodes)
         node->BeginForwardProp();
 }
 
+// the FrameRange for one time step of the loop, narrowed to the active parallel sequences if allowed
+FrameRange ComputationNetwork::SEQTraversalFlowControlNode::ActiveSequencesOf(const FrameRange& t) const
+{
+    if (!m_activeSequencesOnly)
+        return t;
+    size_t numActive = GetMBLayout()->GetNumActiveParallelSequences(t.timeIdxInSeq);
+    return numActive < GetMBLayout()->GetNumParallelSequences() ? t.WithActiveSequences(numActive) : t;
+}
+
 // evaluation of a SEQTraversalFlowControlNode FlowControlNode
 // This evaluates all nodes in this FlowControlNode in SEQ mode: process the loop frame by frame in a nested loop.
 // This is where the time axis changes.
@@ -210,12 +506,20 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
     // for every time step run through all nodes in this particular loop (treat the loop like a little ComputationNetwork)
     // Note: Currently, this is limited to linear-time loops. But nothing stops the iteration below to, e.g., be a 2D iteration over an image
     // if we implement an according FrameRangeIteration.
+    NodeProfiler* profiler = NodeProfiler::Current();
     FrameRangeIteration range(GetMBLayout(), m_steppingDirection);
     for (auto t = range.begin(); t != range.end(); t++)
     {
+        FrameRange fr = ActiveSequencesOf(t);
         for (auto& node : m_nestedNodes)
         {
-            node->ForwardProp(t);
+            if (!node->IsFusedIntoConsumer())
+            {
+                auto profilerEntry = profiler ? profiler->Begin(node, NodeProfiler::forward) : nullptr;
+                node->ForwardProp(fr);
+                if (profilerEntry)
+                    profiler->End(profilerEntry, NodeProfiler::forward);
+            }
             node->BumpEvalTimeStamp();
         }
     }
@@ -223,6 +527,13 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
 
 /*virtual*/ void ComputationNetwork::SEQTraversalFlowControlNode::EndForwardProp() /*override*/
 {
+    // the columns of the skipped sequences were not written; they are gaps, but must not carry stale numbers (e.g. NaN) downstream
+    if (m_activeSequencesOnly)
+    {
+        for (auto& node : m_nestedNodes)
+            node->MaskMissingValueColumnsToZero(FrameRange(GetMBLayout()));
+    }
+
     // tell all that loop is done  --e.g. PastValueNode will capture its state for BPTT processing
     for (auto& node : m_nestedNodes)
         node->EndForwardProp();
@@ -240,13 +551,18 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
     childrenInThisLoop, childrenInOuterLoop;    // TODO: think through what these mean when coming from PAR mode
     const auto& recurrentNodes = m_nestedNodes; // BUGBUG: -ForForward?? Does this mean we can remove non-ForForward?
     auto pMBLayout = recurrentNodes[0]->GetMBLayout();
+    NodeProfiler* profiler = NodeProfiler::Current();
     FrameRangeIteration range(pMBLayout, m_steppingDirection);
     for (auto t = range.rbegin(); t != range.rend(); t++) // note: reverse iteration
     {
+        FrameRange fr = ActiveSequencesOf(t); // (the skipped columns are gaps, which need no gradient)
         for (auto nodeIter2 = recurrentNodes.rbegin(); nodeIter2 != recurrentNodes.rend(); ++nodeIter2)
         {
             auto& node2 = *nodeIter2;
-            node2->Backprop(t, true /*childrenInThisLoop*/, false /*childrenInOuterLoop*/);
+            auto profilerEntry = profiler ? profiler->Begin(node2, NodeProfiler::backward) : nullptr;
+            node2->Backprop(fr, true /*childrenInThisLoop*/, false /*childrenInOuterLoop*/);
+            if (profilerEntry)
+                profiler->End(profilerEntry, NodeProfiler::backward);
             // The above flags tell Backprop() to skip back-propagation from inside a node into
             // a node that is outside the loop, which is done later in EndBackprop() in PAR mode.
         }
@@ -258,10 +574,14 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
 {
     // The following loop handles the case that a node inside the loop back-propagates a gradient into a node outside of the loop.
     // For efficiency, we perform this outside the loop in PAR mode. E.g., in one LSTM speech setup, we measured 12..14% overall speed-up.
+    NodeProfiler* profiler = NodeProfiler::Current();
     for (auto nodeIter2 = m_nestedNodes.rbegin(); nodeIter2 != m_nestedNodes.rend(); ++nodeIter2)
     {
         auto& node2 = *nodeIter2;
+        auto profilerEntry = profiler ? profiler->Begin(node2, NodeProfiler::backward) : nullptr;
         node2->Backprop(FrameRange(m_nestedNodes[0]->GetMBLayout()), false /*childrenInThisLoop*/, true /*childrenInOuterLoop*/);
+        if (profilerEntry)
+            profiler->End(profilerEntry, NodeProfiler::backward);
     }
 
     // tell all nodes we are done for this iteraTion
@@ -301,8 +621,14 @@ ComputationNetwork::PARTraversalFlowControlNode::PARTraversalFlowControlNode(con
 // If found then return a pointer to the list of nodes of this loop.
 /*static*/ shared_ptr<ComputationNetwork::SEQTraversalFlowControlNode> ComputationNetwork::FindInRecurrentLoops(const std::vector<std::shared_ptr<SEQTraversalFlowControlNode>>& recurrentInfo, const ComputationNodeBasePtr& node)
 {
+    if (!node->IsPartOfLoop())
+        return nullptr;
+    // FormRecurrentLoops() leaves the loop id in the node, which indexes m_allSEQNodes
+    // This is called for every node by the compilation steps, so it must not search all loops of a large network each time.
+    int loopId = node->m_loopId;
+    if (loopId >= 0 && loopId < (int) recurrentInfo.size() && recurrentInfo[loopId]->m_loopId == loopId)
+        return recurrentInfo[loopId];
     // look in all recurrent loops of the network
-    // TODO: Check for IsPartOfLoop(). Also why not store the loop id in the node for direct lookup?
     for (auto& iter : recurrentInfo)
         if (std::find(iter->m_nestedNodes.begin(), iter->m_nestedNodes.end(), node) != iter->m_nestedNodes.end()) // TODO: should this loop need to be a method of SEQTraversalFlowControlNode?
             return iter;
@@ -373,6 +699,7 @@ void ComputationNetwork::InvalidateCompiledNetwork()
     m_allSEQNodes.clear();
     m_evalOrders.clear();
     m_nestedNetworks.clear();
+    m_jointNestedNetworks.clear();
     m_inputValues.clear();
     m_learnableParameters.clear();
 }
@@ -404,6 +731,10 @@ void ComputationNetwork::CompileNetwork()
     // Note: Steps below are loops over root nodes. We will gradually push those loops through to the functions,
     //       to reduce redundant operation on shared portions of the network.
 
+    // STEP: Reassociate sums and products in recurrent loops, so that fewer of their operations run per time step.
+    // This changes the graph, so it must precede all steps that analyze it.
+    HoistLoopInvariantTerms();
+
     // STEP: Create a depth-first tree-traversal order through original graph for every root.
     // This is used wherever a nested structure is not relevant.
     FormEvalOrder(nullptr); // form the global one
@@ -423,13 +754,28 @@ void ComputationNetwork::CompileNetwork()
     for (auto& node : m_allRoots)
         FormNestedNetwork(node);
 
+    // STEP: Decide which image nodes keep their values in the engine's layout.
+    // This must precede validation, since it determines their tensor shapes.
+    ElideImageLayoutConversions();
+
     // STEP: Infer node dimensions.
     // This leverages the nested structure.  TODO: ... one day
+    // The roots mostly share their nodes (e.g. criterion, eval and output nodes on one model), which are validated with the first of them only.
+    unordered_set<ComputationNodeBasePtr> validatedNodes;
     for (auto& node : m_allRoots)
-        ValidateSubNetwork(node);
+        ValidateSubNetwork(node, &validatedNodes);
 
     // STEP: Optimize the network.
-    // :)
+    for (auto iter = m_valueNeededNodes.begin(); iter != m_valueNeededNodes.end();) // (forget nodes that were removed from the network)
+    {
+        auto found = m_nameToNodeMap.find((*iter)->NodeName());
+        if (found == m_nameToNodeMap.end() || found->second != *iter)
+            iter = m_valueNeededNodes.erase(iter);
+        else
+            iter++;
+    }
+    FuseElementwiseOperations();
+    FuseConvolutionBiasReLU();
 
     // STEP: Some final details.
     ResetEvalTimeStamps(); // invalidate all m_value fields. Really belongs into StartEvaluateMinibatchLoop()
@@ -496,7 +842,7 @@ void ComputationNetwork::DetermineSetOfAllRoots()
 // This calls Validate() on every node in evaluation order (allowing to propagate things forwards through the net).
 // This is called lazily but once only per node until next ClearCache().
 // This also sets up MBLayout links.
-void ComputationNetwork::ValidateSubNetwork(const ComputationNodeBasePtr& rootNode)
+void ComputationNetwork::ValidateSubNetwork(const ComputationNodeBasePtr& rootNode, unordered_set<ComputationNodeBasePtr>* validatedNodes)
 {
     // reset to a well-defined MBLayout (any meaningful layout should do here)
     // Note that Validate is never called during operation. Any actual computation will lead to MBLayout to be set.
@@ -510,12 +856,18 @@ void ComputationNetwork::ValidateSubNetwork(const ComputationNodeBasePtr& rootNo
     // we call all nodes' Validate() in order to validate, that is, set up MBLayout and FunctionValues dimension
     // A problem is that recurrent loops may require partial validation.
     // Nodes validated on partial input (i.e. some children not yet validated) will be revisited.
-    const auto& nodes = GetEvalOrder(rootNode);
-
-    for (auto& node : nodes)
+    // Nodes in 'validatedNodes' are final already (validated for another root); they only count as visited inputs.
+    list<ComputationNodeBasePtr> nodes;
+    for (auto& node : GetEvalOrder(rootNode))
     {
+        if (validatedNodes && validatedNodes->find(node) != validatedNodes->end())
+        {
+            node->m_visited = true;
+            continue;
+        }
         node->m_visited = false;
         node->m_needsGradient = node->IsParameterUpdateRequired(); // these get propagated upwards in the following
+        nodes.push_back(node);
     }
 
     // loop and validate until we are done
@@ -524,18 +876,22 @@ void ComputationNetwork::ValidateSubNetwork(const ComputationNodeBasePtr& rootNo
     //    Keep going through the list until all nodes have been validated and all inputs have been validated as well.
     //  - validate (final)              // final means consistency checks
     //    Fail if any change during this stage.
+    //    After the first pass, only nodes that are not valid yet or whose inputs changed are validated again.
     size_t pass = 0;
     size_t toValidate = nodes.size();
+    ValidationProgress progress;
     while (toValidate > 0)
     {
         pass++;
         fprintf(stderr, "\n\nValidating for node %ls. %d nodes to process in pass %d.\n", rootNode->NodeName().c_str(), (int) toValidate, (int) pass);
-        ValidateNodes(nodes, false /*isFinalValidationPass*/, toValidate);
+        ValidateNodes(nodes, false /*isFinalValidationPass*/, toValidate, &progress);
     }
     fprintf(stderr, "\n\nValidating for node %ls, final verification.\n", rootNode->NodeName().c_str());
     ValidateNodes(nodes, true /*isFinalValidationPass*/, toValidate);
     if (toValidate != 0)
         LogicError("ValidateSubNetwork: ValidateNodes(true) unexpectedly returned with work left to do.");
+    if (validatedNodes)
+        validatedNodes->insert(nodes.begin(), nodes.end());
 
     // propagate some info to SEQTraversalFlowControlNode
     // TODO: In the future we should validate not on the flat list but the PARTraversalFlowControlNode structure. Then this will be unnecessary.
@@ -576,13 +932,23 @@ static pair<TensorShape, bool> GetDims(const ComputationNodeBasePtr& node)
     return make_pair(node->GetSampleLayout(), node->HasMBLayout());
 }
 
-void ComputationNetwork::ValidateNodes(list<ComputationNodeBasePtr> nodes, bool isFinalValidationPass, size_t& todo)
+void ComputationNetwork::ValidateNodes(const list<ComputationNodeBasePtr>& nodes, bool isFinalValidationPass, size_t& todo, ValidationProgress* progress)
 {
     todo = 0; // returns how many nodes are to be redone
+    unordered_set<ComputationNodeBase*> changed; // nodes changed in this pass
     for (auto& node : nodes)
     {
         const auto& children = node->GetInputs();
         const bool isLeaf = node->IsLeaf();
+        // skip nodes that were valid after the last pass, unless one of their inputs changed since
+        if (progress && progress->m_valid.find(node.get()) != progress->m_valid.end())
+        {
+            bool inputChanged = false;
+            for (auto& child : children)
+                inputChanged |= progress->m_changed.find(child.get()) != progress->m_changed.end() || changed.find(child.get()) != changed.end();
+            if (!inputChanged)
+                continue;
+        }
         // only validate a node if it has at least one child
         bool hasVisitedChild = false;
         bool allChildrenVisited = true;
@@ -622,6 +988,13 @@ void ComputationNetwork::ValidateNodes(list<ComputationNodeBasePtr> nodes, bool
             unchanged &= (childDims == newChildDims);
             unchanged &= (sampleLayout == node->GetSampleLayout());
             unchanged &= (needsGradient == node->m_needsGradient);
+            if (progress && !unchanged) // (Validate() may also infer the dimensions of inputs, e.g. of parameters)
+            {
+                changed.insert(node.get());
+                for (size_t i = 0; i < children.size(); i++)
+                    if (childDims[i] != newChildDims[i])
+                        changed.insert(children[i].get());
+            }
             if (isFinalValidationPass && !unchanged)
                 LogicError("ValidateSubNetwork: %ls %ls operation changed during final validation.", node->NodeName().c_str(), node->OperationName().c_str());
             if (isFinalValidationPass && !allChildrenVisited)
@@ -632,7 +1005,13 @@ void ComputationNetwork::ValidateNodes(list<ComputationNodeBasePtr> nodes, bool
         // count those that we need to redo
         if (!valid)
             todo++;
+        if (progress && valid)
+            progress->m_valid.insert(node.get());
+        else if (progress)
+            progress->m_valid.erase(node.get());
     }
+    if (progress)
+        progress->m_changed = move(changed);
 }
 
 // -----------------------------------------------------------------------
@@ -643,8 +1022,9 @@ void ComputationNetwork::MarkValueNonSharableNodes()
 {
     const auto& nodes = GetEvalOrder(nullptr);
     std::map<wstring, bool> allLeafDescendentsAreParameters;
-    std::list<ComputationNodeBasePtr> allLearnableParameters = GetNodesWithType(OperationNameOf(LearnableParameter));
+    std::list<ComputationNodeBasePtr> allLearnableParametersList = GetNodesWithType(OperationNameOf(LearnableParameter));
     // note that: we cannot use m_learnableParameters because we need all parameters node, regardless whether it requires update or not
+    unordered_set<ComputationNodeBasePtr> allLearnableParameters(allLearnableParametersList.begin(), allLearnableParametersList.end()); // (looked up for every input)
 
     for (auto& node : nodes)
     {
@@ -661,7 +1041,7 @@ void ComputationNetwork::MarkValueNonSharableNodes()
                 {
                     // not found, means it is a leaf node (we are at eval order )
                     assert(child->IsLeaf() || child->IsPartOfLoop());
-                    if (std::find(allLearnableParameters.begin(), allLearnableParameters.end(), child) != allLearnableParameters.end())
+                    if (allLearnableParameters.find(child) != allLearnableParameters.end())
                     {
                         allLeafDescendentsAreParameters[ChildName] = true;
                     }
@@ -694,6 +1074,257 @@ void ComputationNetwork::MarkValueNonSharableNodes()
     }
 }
 
+// -----------------------------------------------------------------------
+// value recomputation (gradient checkpointing) and offloading
+// -----------------------------------------------------------------------
+
+// the values that a node's forward prop reads (a fused input's value is never materialized; its consumer reads the fused input's inputs)
+static vector<ComputationNodeBasePtr> GetValueInputs(const ComputationNodeBasePtr& node)
+{
+    vector<ComputationNodeBasePtr> inputs;
+    for (auto& input : node->GetInputs())
+    {
+        if (input->IsFusedIntoConsumer()) // (recursively, for a fused chain such as ReLU(Plus(Convolution(W, x), b)))
+        {
+            auto fusedInputs = GetValueInputs(input);
+            inputs.insert(inputs.end(), fusedInputs.begin(), fusedInputs.end());
+        }
+        else
+            inputs.push_back(input);
+    }
+    return inputs;
+}
+
+// the values that a node's backprop reads
+static vector<ComputationNodeBasePtr> GetValuesReadByBackprop(const ComputationNodeBasePtr& node)
+{
+    vector<ComputationNodeBasePtr> values;
+    if (!node->NeedGradient()) // (then its backprop reads nothing)
+        return values;
+    if (node->OutputUsedInComputingInputNodesGradients())
+        values.push_back(node);
+    for (size_t i = 0; i < node->GetNumInputs(); i++)
+    {
+        if (node->InputUsedInComputingInputNodesGradients(i))
+            values.push_back(node->Input(i));
+    }
+    return values;
+}
+
+// the top-level nodes of the nested network of 'rootNode', in backprop order, each with its members
+// A loop is backpropagated as a whole; it is represented by its SEQTraversalFlowControlNode, like in PARTraversalFlowControlNode::Backprop().
+vector<pair<ComputationNodeBasePtr, vector<ComputationNodeBasePtr>>> ComputationNetwork::GetBackpropUnits(const ComputationNodeBasePtr& rootNode)
+{
+    vector<pair<ComputationNodeBasePtr, vector<ComputationNodeBasePtr>>> units;
+    const std::list<ComputationNodeBasePtr>& nodes = GetEvalOrder(rootNode);
+    set<ComputationNodeBasePtr> loopsSeen;
+    for (auto iter = nodes.rbegin(); iter != nodes.rend(); iter++)
+    {
+        auto recInfo = (*iter)->IsPartOfLoop() ? FindInRecurrentLoops(m_allSEQNodes, *iter) : nullptr;
+        if (!recInfo)
+            units.push_back(make_pair(*iter, vector<ComputationNodeBasePtr>{*iter}));
+        else if (loopsSeen.insert(recInfo).second)
+            units.push_back(make_pair(recInfo, recInfo->m_nestedNodes));
+    }
+    return units;
+}
+
+// PlanValueRecomputation() -- decide which values to drop after forward prop and compute once more in backprop, to save memory in training
+// Otherwise, every value that backprop reads stays allocated from its forward prop until its backprop, so memory grows with depth and
+// minibatch size. Instead, we only keep the values of 'checkpoints':
+//  - every GetRecomputeSegmentLength()-th of the values that backprop reads, in evaluation order, and all nodes tagged 'checkpoint';
+//  - all values of nodes that cannot be recomputed (not IsValueRecomputable(), in a loop, computed in place of an input, roots, not needing a gradient, or not sharable).
+// The other values are released after their last consumer's forward prop, like in evaluation. Right before the first node in backprop
+// order that reads one, it is recomputed from the nearest checkpoints, into a second matrix that is in use until its own backprop.
+// This may recompute values that backprop itself does not read, too (e.g. the Times below a Sigmoid), for what recomputation reads.
+// This updates 'outputValueNeededDuringBackProp' (recomputed values are not, the checkpoints they are computed from are) and starts
+// the restore steps of the nested network of 'trainRootNode' afresh. Concurrent streams are not supported, since they plan wave by wave.
+void ComputationNetwork::PlanValueRecomputation(const ComputationNodeBasePtr& trainRootNode, std::unordered_map<ComputationNodeBasePtr, bool>& outputValueNeededDuringBackProp)
+{
+    auto network = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(trainRootNode));
+    network->m_stepsBeforeBackprop.clear();
+    for (const auto& iter : m_nameToNodeMap)
+        iter.second->m_isValueRecomputed = false;
+
+    const size_t segmentLength = GetRecomputeSegmentLength();
+    const std::list<ComputationNodeBasePtr>& nodes = GetEvalOrder(trainRootNode);
+    bool hasCheckpointTags = false;
+    for (auto& node : nodes)
+        hasCheckpointTags |= (node->GetTag() == L"checkpoint");
+    if (segmentLength == 0 && !hasCheckpointTags)
+        return;
+    if (!g_shareNodeValueMatrices || GetNumConcurrentStreams() > 1)
+    {
+        fprintf(stderr, "\nValue recomputation requires shareNodeValueMatrices=true and no concurrentStreams, and is disabled.\n");
+        return;
+    }
+
+    set<ComputationNodeBasePtr> roots(m_allRoots.begin(), m_allRoots.end());
+    roots.insert(m_pairNodes.begin(), m_pairNodes.end());
+    auto canRecompute = [&roots](const ComputationNodeBasePtr& node)
+    {
+        return node->IsValueRecomputable() && !node->IsPartOfLoop() && !node->IsFusedIntoConsumer() && node->GetInPlaceInputIndex() == SIZE_MAX &&
+               node->NeedGradient() && node->isValueSharable() && roots.find(node) == roots.end();
+    };
+
+    // drop all values that backprop reads, except for the checkpoints
+    set<ComputationNodeBasePtr> recomputed;
+    size_t numSinceCheckpoint = 0;
+    for (auto& node : nodes)
+    {
+        if (!canRecompute(node) || !outputValueNeededDuringBackProp[node])
+            continue;
+        bool isCheckpoint = (node->GetTag() == L"checkpoint");
+        if (!isCheckpoint && segmentLength > 0)
+            isCheckpoint = (++numSinceCheckpoint == segmentLength);
+        if (isCheckpoint)
+            numSinceCheckpoint = 0;
+        else
+            recomputed.insert(node);
+    }
+
+    // what recomputation reads must be recomputed as well if it was not kept anyway, or else be kept
+    for (auto iter = nodes.rbegin(); iter != nodes.rend(); iter++)
+    {
+        if (recomputed.find(*iter) == recomputed.end())
+            continue;
+        for (auto& input : GetValueInputs(*iter))
+        {
+            if (recomputed.find(input) != recomputed.end())
+                continue;
+            else if (canRecompute(input) && !outputValueNeededDuringBackProp[input])
+                recomputed.insert(input); // (inputs come earlier in evaluation order, so we still get to its own inputs)
+            else
+                outputValueNeededDuringBackProp[input] = true;
+        }
+    }
+
+    // recompute each value right before the first backprop that reads it, after what its recomputation reads
+    set<ComputationNodeBasePtr> scheduled;
+    function<void(const ComputationNodeBasePtr&, vector<ComputationNodeBasePtr>&)> schedule = [&](const ComputationNodeBasePtr& node, vector<ComputationNodeBasePtr>& steps)
+    {
+        if (recomputed.find(node) == recomputed.end() || !scheduled.insert(node).second)
+            return;
+        for (auto& input : GetValueInputs(node))
+            schedule(input, steps);
+        steps.push_back(node);
+    };
+    for (auto& unit : GetBackpropUnits(trainRootNode))
+    {
+        vector<ComputationNodeBasePtr> steps;
+        for (auto& member : unit.second)
+            for (auto& value : GetValuesReadByBackprop(member))
+                schedule(value, steps);
+        if (!steps.empty())
+            network->m_stepsBeforeBackprop[unit.first].recompute = steps;
+    }
+
+    // the dropped values are released after forward prop (those that backprop does not read after all are not recomputed)
+    for (auto& node : recomputed)
+    {
+        node->m_isValueRecomputed = (scheduled.find(node) != scheduled.end());
+        outputValueNeededDuringBackProp[node] = false;
+    }
+    fprintf(stderr, "\nRecomputing %d node values in backprop instead of keeping them from forward prop.\n", (int) scheduled.size());
+}
+
+// PlanValueOffloading() -- decide which values to park in host memory between forward prop and backprop, to save GPU memory in training
+// This is the alternative to recomputation for large values that cannot be recomputed, or not cheaply (e.g. convolution feature maps, or
+// the outputs of an LSTM over long sequences). Each value of at least GetOffloadMinValueSize() elements per sample that backprop reads
+//  - starts being copied to page-locked host memory right after its forward prop, while forward prop goes on with the next nodes;
+//  - is released after its last consumer's forward prop, like in evaluation (the compute stream waits for the copy at that point);
+//  - is copied back into a second matrix while backprop is a few nodes ahead of its first reader (which may be a recomputation),
+//    and the compute stream waits for that copy right before that reader. The second matrix is in use until the value's own backprop.
+// The copies run on the GPUDataTransferer streams (one per direction); the CPU never waits for them. This is planned on top of
+// PlanValueRecomputation(), under the same conditions, and updates 'outputValueNeededDuringBackProp' and the restore steps the same way.
+// Note that the host memory comes from the shared page-locked arena, whose limit (pinnedMemoryLimitMB) may have to be raised; beyond it,
+// the copies go through pageable memory, which is correct but does not overlap with computation.
+void ComputationNetwork::PlanValueOffloading(const ComputationNodeBasePtr& trainRootNode, std::unordered_map<ComputationNodeBasePtr, bool>& outputValueNeededDuringBackProp)
+{
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        iter.second->m_isValueOffloaded = false;
+        iter.second->m_offloadsToCompleteAfterForwardProp.clear();
+    }
+
+    const size_t minValueSize = GetOffloadMinValueSize();
+    if (minValueSize == 0)
+        return;
+    if (!g_shareNodeValueMatrices || GetNumConcurrentStreams() > 1)
+    {
+        fprintf(stderr, "\nValue offloading requires shareNodeValueMatrices=true and no concurrentStreams, and is disabled.\n");
+        return;
+    }
+
+    set<ComputationNodeBasePtr> roots(m_allRoots.begin(), m_allRoots.end());
+    roots.insert(m_pairNodes.begin(), m_pairNodes.end());
+    const std::list<ComputationNodeBasePtr>& nodes = GetEvalOrder(trainRootNode);
+    set<ComputationNodeBasePtr> candidates;
+    for (auto& node : nodes)
+    {
+        if (outputValueNeededDuringBackProp[node] && !node->IsValueRecomputed() && !node->IsFusedIntoConsumer() && !node->IsLeaf() &&
+            node->NeedGradient() && node->isValueSharable() && roots.find(node) == roots.end() &&
+            node->GetDeviceId() >= 0 && node->GetSampleLayout().GetNumElements() >= minValueSize)
+            candidates.insert(node);
+    }
+    if (candidates.empty())
+        return;
+
+    // copy each value back a few nodes ahead of the first reader in backprop, so that the copy overlaps with their backprop
+    const size_t prefetchDistance = 4;
+    auto network = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(trainRootNode));
+    auto units = GetBackpropUnits(trainRootNode);
+    set<ComputationNodeBasePtr> offloaded;
+    for (size_t k = 0; k < units.size(); k++)
+    {
+        auto& steps = network->m_stepsBeforeBackprop[units[k].first];
+        vector<ComputationNodeBasePtr> reads;
+        for (auto& member : units[k].second)
+        {
+            auto values = GetValuesReadByBackprop(member);
+            reads.insert(reads.end(), values.begin(), values.end());
+        }
+        for (auto& recomputed : steps.recompute)
+        {
+            auto values = GetValueInputs(recomputed);
+            reads.insert(reads.end(), values.begin(), values.end());
+        }
+        for (auto& value : reads)
+        {
+            if (candidates.find(value) == candidates.end() || !offloaded.insert(value).second)
+                continue;
+            network->m_stepsBeforeBackprop[units[k >= prefetchDistance ? k - prefetchDistance : 0].first].beginPrefetch.push_back(value);
+            steps.endPrefetch.push_back(value);
+        }
+    }
+    for (auto iter = network->m_stepsBeforeBackprop.begin(); iter != network->m_stepsBeforeBackprop.end();) // (we created entries for all units)
+    {
+        if (iter->second.beginPrefetch.empty() && iter->second.endPrefetch.empty() && iter->second.recompute.empty())
+            iter = network->m_stepsBeforeBackprop.erase(iter);
+        else
+            iter++;
+    }
+
+    // the copy to host memory must be complete before the value's matrix is reused, i.e. after its last reader in forward prop
+    map<ComputationNodeBasePtr, ComputationNodeBasePtr> lastReaders;
+    for (auto& node : nodes)
+    {
+        if (!node->IsFusedIntoConsumer())
+            for (auto& input : GetValueInputs(node))
+                lastReaders[input] = node;
+    }
+    size_t numElements = 0;
+    for (auto& node : offloaded)
+    {
+        node->m_isValueOffloaded = true;
+        auto reader = lastReaders.find(node);
+        (reader != lastReaders.end() ? reader->second : node)->m_offloadsToCompleteAfterForwardProp.push_back(node);
+        outputValueNeededDuringBackProp[node] = false;
+        numElements += node->GetSampleLayout().GetNumElements();
+    }
+    fprintf(stderr, "\nOffloading %d node values (%d elements per sample) to host memory between forward prop and backprop.\n", (int) offloaded.size(), (int) numElements);
+}
+
 // this function will need to be called before actual validation and execution to
 // predetermine how to share matrices to reduce memory usage.
 // TODO: find a simple topological order and allocateEvalMatrices on that order directly
@@ -707,9 +1338,21 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
 
     VerifyIsCompiled("AllocateAllMatrices");
 
+    // the values of all these nodes are read, so none of them may be skipped as fused into its consumer
+    KeepValuesOf(evalRootNodes);
+    KeepValuesOf(outValueRootNodes);
+    KeepValuesOf({trainRootNode});
+
     // Due to special topology, if a node is solely induced by parameters, its function value should not be shared
     MarkValueNonSharableNodes();
 
+    // elementwise nodes may compute their values in the matrices of their inputs
+    PlanInPlaceValues();
+
+    // nodes computed side by side in concurrent waves cannot share one workspace
+    m_matrixPool->SetShareWorkspaces(GetNumConcurrentStreams() <= 1);
+    m_matrixPool->BeginPlanning();
+
     bool performingBackPropagation = (trainRootNode != nullptr);
 
     // Create a composite Eval order with the specified nodes as roots
@@ -748,11 +1391,21 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
         }
     }
 
+    // optionally, trade memory for recomputation in backprop, or for copies to host memory and back
+    if (performingBackPropagation)
+    {
+        PlanValueRecomputation(trainRootNode, outputValueNeededDuringBackProp);
+        PlanValueOffloading(trainRootNode, outputValueNeededDuringBackProp);
+    }
+
     std::unordered_map<ComputationNodeBasePtr, int> parentCount;
     for (auto& keyValue : parentsMap)
     {
         parentCount[keyValue.first] = keyValue.second.size();
     }
+    // the values of the roots are read after the forward prop, also where one is the input of another (e.g. a bottleneck output), so they are never released
+    for (auto& rootNode : forwardPropRoots)
+        parentCount[rootNode]++;
 
     // Construct the composite forward prop eval order by enumerating the
     // nodes corresponding to each of our roots and then arranging them in the
@@ -768,11 +1421,34 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
         }
     }
 
+    // When PAR traversal runs the nodes of a wave concurrently, they are evaluated in the order of their waves,
+    // and none of them may get a matrix that is released by another one of the same wave. Hence we release at the end of each wave.
+    const bool concurrent = GetNumConcurrentStreams() > 1;
+    map<ComputationNodeBasePtr, int> waves;
+    if (concurrent)
+    {
+        waves = DetermineConcurrentWaves(m_allSEQNodes, allNodesEvalOrder);
+        stable_sort(compositeForwardPropEvalOrder.begin(), compositeForwardPropEvalOrder.end(), [&waves](const ComputationNodeBasePtr& a, const ComputationNodeBasePtr& b)
+                    {
+                        return waves.at(a) < waves.at(b);
+                    });
+    }
+    vector<ComputationNodeBasePtr> pendingReleases;
+    int currentWave = 0;
+
     set<ComputationNodeBasePtr> completedEvaluate;
     for (auto& nodeIter : compositeForwardPropEvalOrder)
     {
         nodeIter->SetOutputNeededDuringBackprop(outputValueNeededDuringBackProp[nodeIter]);
 
+        if (concurrent && waves.at(nodeIter) != currentWave)
+        {
+            for (auto& node : pendingReleases)
+                ReleaseMatricesAfterEvalForChildren(node, parentCount);
+            pendingReleases.clear();
+            currentWave = waves.at(nodeIter);
+        }
+
         if (nodeIter->IsPartOfLoop())
         {
             // TODO: use FormNestedNetwork() here to avoid completedEvaluate[] check
@@ -780,22 +1456,30 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
             assert(recInfo != nullptr);
             if (completedEvaluate.insert(recInfo).second)
             {
-                recInfo->RequestMatricesBeforeForwardProp(m_matrixPool);
+                recInfo->RequestMatricesBeforeForwardProp(*m_matrixPool);
 
                 for (auto& nodeLoopIter : recInfo->m_nestedNodes)
                 {
-                    ReleaseMatricesAfterEvalForChildren(nodeLoopIter, parentCount);
+                    if (concurrent)
+                        pendingReleases.push_back(nodeLoopIter);
+                    else
+                        ReleaseMatricesAfterEvalForChildren(nodeLoopIter, parentCount);
                 }
             }
         }
         else
         {
-            nodeIter->RequestMatricesBeforeForwardProp(m_matrixPool);
+            nodeIter->RequestMatricesBeforeForwardProp(*m_matrixPool);
             // we only release matrices for the children since the root node's informatioin will be used and should not be shared
             // with others
-            ReleaseMatricesAfterEvalForChildren(nodeIter, parentCount);
+            if (concurrent)
+                pendingReleases.push_back(nodeIter);
+            else
+                ReleaseMatricesAfterEvalForChildren(nodeIter, parentCount);
         }
     }
+    for (auto& node : pendingReleases)
+        ReleaseMatricesAfterEvalForChildren(node, parentCount);
 
     if (trainRootNode != nullptr)
     {
@@ -805,45 +1489,102 @@ void ComputationNetwork::AllocateAllMatrices(const std::vector<ComputationNodeBa
         set<ComputationNodeBasePtr> completedGradient;
 
         // we need to call it here since we always compute gradients for children and root node is not children of other node
-        trainRootNode->RequestMatricesBeforeBackprop(m_matrixPool);
+        trainRootNode->RequestMatricesBeforeBackprop(*m_matrixPool);
+
+        // values recomputed or copied back before a node's backprop need their second matrix from then on (see PlanValueRecomputation() and PlanValueOffloading())
+        const auto& stepsBeforeBackprop = dynamic_pointer_cast<PARTraversalFlowControlNode>(GetNestedNetwork(trainRootNode))->m_stepsBeforeBackprop;
+        auto requestBackpropValueMatrices = [&](const ComputationNodeBasePtr& node)
+        {
+            auto iter = stepsBeforeBackprop.find(node);
+            if (iter != stepsBeforeBackprop.end())
+            {
+                for (auto& prefetched : iter->second.beginPrefetch)
+                    prefetched->RequestBackpropValueMatrix(*m_matrixPool);
+                for (auto& recomputed : iter->second.recompute)
+                    recomputed->RequestBackpropValueMatrix(*m_matrixPool);
+            }
+        };
+
+        // As in forward, concurrent backprop runs wave by wave (in reverse), so gradients are only released at the end of each wave.
+        vector<ComputationNodeBasePtr> backPropOrder(backPropNodes.rbegin(), backPropNodes.rend()); // for gradient computation, traverse in reverse order
+        if (concurrent)
+        {
+            stable_sort(backPropOrder.begin(), backPropOrder.end(), [&waves](const ComputationNodeBasePtr& a, const ComputationNodeBasePtr& b)
+                        {
+                            return waves.at(a) > waves.at(b);
+                        });
+            currentWave = backPropOrder.empty() ? 0 : waves.at(backPropOrder.front());
+        }
+        pendingReleases.clear();
 
-        for (auto iter = backPropNodes.rbegin(); iter != backPropNodes.rend(); iter++) // for gradient computation, traverse in reverse order
+        for (auto& n : backPropOrder)
         {
-            auto n = *iter;
+            if (concurrent && waves.at(n) != currentWave)
+            {
+                for (auto& node : pendingReleases)
+                    node->ReleaseMatricesAfterBackprop(*m_matrixPool);
+                pendingReleases.clear();
+                currentWave = waves.at(n);
+            }
+
             if (n->IsPartOfLoop())
             {
                 std::vector<ComputationNodeBasePtr> recurrentNodes;
                 shared_ptr<SEQTraversalFlowControlNode> recInfo = FindInRecurrentLoops(m_allSEQNodes, n);
                 if (completedGradient.insert(recInfo).second)
                 {
+                    requestBackpropValueMatrices(recInfo);
                     // SEQ mode: allocate all in loop first, then deallocate again
                     // TODO: next step: use PARTraversalFlowControlNode::AllocateGradientMatricesForInputs() and ReleaseMatricesAfterBackprop()...
                     // BUGBUG: naw, ^^ would not work! Wrong order! Need to rethink this. Need to make AllocateEvalMatrices() and AllocateGradientMatrices() the virtual functions.
-                    recInfo->AllocateGradientMatricesForInputs(m_matrixPool);
+                    recInfo->AllocateGradientMatricesForInputs(*m_matrixPool);
                     // Loops are computed sample by sample so we have to allocate them all
-                    recInfo->ReleaseMatricesAfterBackprop(m_matrixPool);
+                    if (concurrent)
+                        pendingReleases.push_back(recInfo);
+                    else
+                        recInfo->ReleaseMatricesAfterBackprop(*m_matrixPool);
                 }
             }
             else
             {
                 // PAR mode: we can allocate and immediately deallocate one by one
-                n->AllocateGradientMatricesForInputs(m_matrixPool);
+                requestBackpropValueMatrices(n);
+                n->AllocateGradientMatricesForInputs(*m_matrixPool);
                 // Root node's information will be used and should not be shared with others, also it's small (1x1)
                 if ((n != trainRootNode) && n->NeedGradient())
-                    n->ReleaseMatricesAfterBackprop(m_matrixPool);
+                {
+                    if (concurrent)
+                        pendingReleases.push_back(n);
+                    else
+                        n->ReleaseMatricesAfterBackprop(*m_matrixPool);
+                }
             }
         }
+        for (auto& node : pendingReleases)
+            node->ReleaseMatricesAfterBackprop(*m_matrixPool);
     }
+
+    m_matrixPool->PrintStatistics();
 }
 
 void ComputationNetwork::ReleaseMatricesAfterEvalForChildren(ComputationNodeBasePtr n, std::unordered_map<ComputationNodeBasePtr, int>& parentCount)
 {
-    for (int i = 0; i < n->GetNumInputs(); i++)
+    // a node fused into its consumer does not read its inputs itself; they are read, and released, when the consumer is evaluated
+    if (n->IsFusedIntoConsumer())
+        return;
+    // (recursively, for a fused chain such as ReLU(Plus(Convolution(W, x), b)))
+    function<void(const ComputationNodeBasePtr&)> releaseInputs = [&](const ComputationNodeBasePtr& consumer)
     {
-        ComputationNodeBasePtr pNode = n->GetInputs()[i];
-        parentCount[pNode]--;
-        if (parentCount[pNode] == 0)
-            pNode->ReleaseMatricesAfterForwardProp(m_matrixPool);
-    }
+        for (int i = 0; i < consumer->GetNumInputs(); i++)
+        {
+            ComputationNodeBasePtr pNode = consumer->GetInputs()[i];
+            if (pNode->IsFusedIntoConsumer())
+                releaseInputs(pNode);
+            parentCount[pNode]--;
+            if (parentCount[pNode] == 0)
+                pNode->ReleaseMatricesAfterForwardProp(*m_matrixPool);
+        }
+    };
+    releaseInputs(n);
 }
 } } }
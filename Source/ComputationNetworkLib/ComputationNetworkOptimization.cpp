@@ -0,0 +1,469 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// ComputationNetworkOptimization.cpp -- rewriting a trained network into a smaller, faster one for inference
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "ComputationNode.h"
+#include "ComputationNetwork.h"
+#include "InputAndParamNodes.h"
+#include "LinearAlgebraNodes.h"
+#include "ConvolutionalNodes.h"
+#include "PreComputeNodes.h"
+#include "TrainingNodes.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+using namespace std;
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// inference-time graph optimization
+// -----------------------------------------------------------------------
+
+// OptimizeForInference() -- rewrite the network so that it computes the same outputs with fewer nodes and operations
+// This is meant for models that will no longer be trained, e.g. when loaded for evaluation or before saving a model for deployment:
+//  - Dropout nodes are bypassed.
+//  - Pre-computed nodes (mean, inverse standard deviation) become parameters with their values.
+//  - BatchNormalization after Times or Convolution (optionally followed by a bias Plus) is folded into the weights and a bias:
+//    scale * (W x + b - mean) * invStdDev + bias = (a W) x + (a b + bias - a mean) with a = scale * invStdDev.
+//    This also saves a pass over the output of the convolution.
+//  - PerDimMeanVarNormalization feeding a Times is folded into its weights and a bias: W ((x - mean) * s) = (W diag(s)) x - (W diag(s)) mean.
+//  - Subgraphs that depend on parameters only are computed once and replaced by parameters.
+//  - Nodes that none of 'outputNodes' (or, if empty, of the output nodes of the network) depend on are deleted, except for features and labels.
+// Folded parameters are modified in place, so a parameter is only folded into a node that is its only consumer.
+// The rewritten nodes keep the names of the nodes they replace, so that outputs can still be asked for by name.
+// The network is compiled again at the end.
+template <class ElemType>
+void ComputationNetwork::OptimizeForInference(const std::vector<ComputationNodeBasePtr>& outputNodes)
+{
+    fprintf(stderr, "\nOptimizing the network for inference...\n");
+    const size_t numNodesBefore = m_nameToNodeMap.size();
+
+    const size_t numDropout = BypassDropoutNodes();
+    const size_t numPreComputed = ReplacePreComputedNodesByParameters<ElemType>();
+    const size_t numBatchNormalization = FoldBatchNormalizationNodes<ElemType>();
+    const size_t numMeanVarNormalization = FoldMeanVarNormalizationNodes<ElemType>();
+
+    // constant folding needs validated nodes, and a compiled network to compute them
+    CompileNetwork();
+    const size_t numConstant = FoldConstantSubgraphs<ElemType>();
+
+    vector<ComputationNodeBasePtr> roots = outputNodes.empty() ? OutputNodes() : outputNodes;
+    const size_t numPruned = roots.empty() ? 0 : PruneNodesNotNeededFor(roots);
+    if (roots.empty())
+        fprintf(stderr, "OptimizeForInference: No output nodes given, no nodes were pruned.\n");
+
+    InvalidateCompiledNetwork();
+    CompileNetwork();
+
+    fprintf(stderr, "\nOptimized the network for inference from %d to %d nodes: bypassed %d Dropout, replaced %d pre-computed, folded %d BatchNormalization, %d PerDimMeanVarNormalization and %d constant subgraphs, pruned %d nodes.\n",
+            (int) numNodesBefore, (int) m_nameToNodeMap.size(), (int) numDropout, (int) numPreComputed, (int) numBatchNormalization, (int) numMeanVarNormalization, (int) numConstant, (int) numPruned);
+}
+
+// number of consumers of every node, where membership in a node group counts as one more
+map<ComputationNodeBasePtr, size_t> ComputationNetwork::CountNodeUses()
+{
+    map<ComputationNodeBasePtr, size_t> numUses;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        for (const auto& input : iter.second->GetInputs())
+            numUses[input]++;
+    }
+    for (auto group : GetAllNodeGroups())
+    {
+        for (const auto& node : *group)
+            numUses[node]++;
+    }
+    return numUses;
+}
+
+// a name that no node has yet, derived from 'name'
+wstring ComputationNetwork::GetUniqueNodeName(const wstring& name) const
+{
+    wstring uniqueName = name;
+    for (size_t i = 1; NodeNameExists(uniqueName); i++)
+        uniqueName = msra::strfun::wstrprintf(L"%ls%d", name.c_str(), (int) i);
+    return uniqueName;
+}
+
+// let all consumers and node groups of 'oldNode' use 'newNode' instead
+// If 'newNodeTakesName', newNode (which may or may not be in the network already) gets oldNode's name. If newNode consumes oldNode,
+// oldNode stays in the network under a new name; otherwise it is deleted.
+void ComputationNetwork::ReplaceNodeInNetwork(const ComputationNodeBasePtr& oldNode, const ComputationNodeBasePtr& newNode, bool newNodeTakesName)
+{
+    InvalidateCompiledNetwork();
+
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        const auto& node = iter.second;
+        if (node == newNode)
+            continue;
+        for (size_t i = 0; i < node->GetNumInputs(); i++)
+        {
+            if (node->Input(i) == oldNode)
+                node->SetInput(i, newNode);
+        }
+    }
+    for (auto group : GetAllNodeGroups())
+    {
+        for (auto& node : *group)
+        {
+            if (node == oldNode)
+                node = newNode;
+        }
+    }
+
+    const wstring name = oldNode->NodeName();
+    const auto& newNodeInputs = newNode->GetInputs();
+    if (find(newNodeInputs.begin(), newNodeInputs.end(), oldNode) != newNodeInputs.end())
+        RenameNode(oldNode, GetUniqueNodeName(name + L".unfolded"));
+    else
+    {
+        oldNode->DetachInputs();
+        m_nameToNodeMap.erase(name);
+    }
+
+    if (newNodeTakesName)
+    {
+        auto iter = m_nameToNodeMap.find(newNode->NodeName());
+        if (iter != m_nameToNodeMap.end() && iter->second == newNode)
+            m_nameToNodeMap.erase(iter);
+        newNode->SetNodeName(name);
+        AddNodeToNet(newNode);
+    }
+}
+
+// Dropout only does something in training
+size_t ComputationNetwork::BypassDropoutNodes()
+{
+    size_t numBypassed = 0;
+    for (const auto& node : GetNodesWithType(OperationNameOf(DropoutNode)))
+    {
+        // a Dropout that is asked for by name is kept, since its name would go away
+        bool isInNodeGroup = false;
+        for (auto group : GetAllNodeGroups())
+            isInNodeGroup |= find(group->begin(), group->end(), node) != group->end();
+        if (isInNodeGroup)
+            continue;
+        ReplaceNodeInNetwork(node, node->Input(0), /*newNodeTakesName=*/false);
+        numBypassed++;
+    }
+    return numBypassed;
+}
+
+// a parameter that holds a folded value; it is not updated if the network is trained after all
+template <class ElemType>
+static shared_ptr<LearnableParameter<ElemType>> NewFoldedParameter(DEVICEID_TYPE deviceId, const wstring& name, const TensorShape& shape)
+{
+    auto parameter = New<LearnableParameter<ElemType>>(deviceId, name, shape);
+    ComputationNodeBasePtr(parameter)->SetParameterUpdateRequired(false);
+    return parameter;
+}
+
+// after pre-computation, mean and inverse standard deviation are constants like any parameter
+template <class ElemType>
+size_t ComputationNetwork::ReplacePreComputedNodesByParameters()
+{
+    size_t numReplaced = 0;
+    vector<ComputationNodeBasePtr> nodes;
+    for (const auto& iter : m_nameToNodeMap)
+        nodes.push_back(iter.second);
+    for (const auto& node : nodes)
+    {
+        auto preComputedNode = dynamic_pointer_cast<PreComputedNodeBase<ElemType>>(node);
+        if (!preComputedNode || !preComputedNode->HasComputed())
+            continue;
+        auto parameter = NewFoldedParameter<ElemType>(node->GetDeviceId(), GetUniqueNodeName(node->NodeName() + L".value"), node->GetSampleLayout());
+        parameter->Value().SetValue(preComputedNode->Value());
+        ReplaceNodeInNetwork(node, parameter, /*newNodeTakesName=*/true);
+        numReplaced++;
+    }
+    return numReplaced;
+}
+
+// helpers for the folding functions below
+template <class ElemType>
+static shared_ptr<LearnableParameter<ElemType>> AsParameter(const ComputationNodeBasePtr& node, map<ComputationNodeBasePtr, size_t>& numUses)
+{
+    if (numUses[node] != 1) // we will modify it
+        return nullptr;
+    return dynamic_pointer_cast<LearnableParameter<ElemType>>(node);
+}
+
+// the value of a parameter node as a column vector, or an empty matrix if it does not have 'numElements' elements
+template <class ElemType>
+static Matrix<ElemType> ParameterAsColumn(const ComputationNodeBasePtr& node, size_t numElements)
+{
+    auto parameter = dynamic_pointer_cast<LearnableParameter<ElemType>>(node);
+    if (!parameter || parameter->Value().GetNumElements() != numElements)
+        return Matrix<ElemType>(node->GetDeviceId());
+    return parameter->Value().Reshaped(numElements, 1);
+}
+
+// the weight parameter of a Times or Convolution node, its rows being the outputs, or nullptr if it can't be modified
+template <class ElemType>
+static shared_ptr<LearnableParameter<ElemType>> GetFoldableWeights(const ComputationNodeBasePtr& node, bool spatial, map<ComputationNodeBasePtr, size_t>& numUses)
+{
+    if (numUses[node] != 1)
+        return nullptr;
+    if (!spatial && dynamic_pointer_cast<TimesNode<ElemType>>(node))
+        return AsParameter<ElemType>(node->Input(0), numUses);
+    else if (spatial && dynamic_pointer_cast<ConvolutionNode<ElemType>>(node))
+        return AsParameter<ElemType>(node->Input(0), numUses);
+    return nullptr;
+}
+
+// BatchNormalization(Times/Convolution(W, x)[ + b]) --> Times/Convolution(a W, x) + b'
+template <class ElemType>
+size_t ComputationNetwork::FoldBatchNormalizationNodes()
+{
+    size_t numFolded = 0;
+    auto numUses = CountNodeUses();
+    for (const auto& node : GetNodesWithType(OperationNameOf(BatchNormalizationNode)))
+    {
+        auto bnNode = dynamic_pointer_cast<BatchNormalizationNode<ElemType>>(node);
+        if (!bnNode)
+            continue;
+        const bool spatial = bnNode->IsSpatial();
+
+        // find the weights, and the bias if there is one
+        ComputationNodeBasePtr product = node->Input(0);
+        ComputationNodeBasePtr biasPlus;
+        shared_ptr<LearnableParameter<ElemType>> bias;
+        if (product->OperationName() == OperationNameOf(PlusNode) && numUses[product] == 1)
+        {
+            for (size_t i = 0; i < 2 && !bias; i++)
+            {
+                if (GetFoldableWeights<ElemType>(product->Input(i), spatial, numUses))
+                {
+                    bias = AsParameter<ElemType>(product->Input(1 - i), numUses);
+                    if (bias)
+                    {
+                        biasPlus = product;
+                        product = product->Input(i);
+                    }
+                }
+            }
+        }
+        auto weights = GetFoldableWeights<ElemType>(product, spatial, numUses);
+        if (!weights)
+            continue;
+        auto& weightsValue = weights->Value();
+        const size_t numOutputs = weightsValue.GetNumRows();
+        if (spatial)
+        {
+            auto convNode = dynamic_pointer_cast<IImageLayoutNode>(product);
+            if (!convNode || convNode->GetImageLayout() != bnNode->GetImageLayoutKind() ||
+                ImageDimensions(product->GetSampleLayout(), convNode->GetImageLayout()).m_numChannels != numOutputs)
+                continue;
+        }
+        else if (product->GetSampleLayout().GetNumElements() != numOutputs)
+            continue;
+
+        Matrix<ElemType> scale = ParameterAsColumn<ElemType>(node->Input(1), numOutputs);
+        Matrix<ElemType> bnBias = ParameterAsColumn<ElemType>(node->Input(2), numOutputs);
+        Matrix<ElemType> runMean = ParameterAsColumn<ElemType>(node->Input(3), numOutputs);
+        Matrix<ElemType> runInvStdDev = ParameterAsColumn<ElemType>(node->Input(4), numOutputs);
+        Matrix<ElemType> oldBias = bias ? ParameterAsColumn<ElemType>(bias, numOutputs) : Matrix<ElemType>(node->GetDeviceId());
+        if (scale.IsEmpty() || bnBias.IsEmpty() || runMean.IsEmpty() || runInvStdDev.IsEmpty() || (bias && oldBias.IsEmpty()))
+            continue;
+
+        // a = scale * invStdDev; c = bias - mean * a
+        Matrix<ElemType> a(node->GetDeviceId());
+        a.AssignElementProductOf(scale, runInvStdDev);
+        Matrix<ElemType> meanTimesA(node->GetDeviceId());
+        meanTimesA.AssignElementProductOf(runMean, a);
+        Matrix<ElemType> c(node->GetDeviceId());
+        c.SetValue(bnBias);
+        c -= meanTimesA;
+
+        weightsValue.ColumnElementMultiplyWith(a);
+        if (bias)
+        {
+            // b' = a b + c, in place (oldBias references the bias parameter's value)
+            oldBias.ElementMultiplyWith(a);
+            oldBias += c;
+            ReplaceNodeInNetwork(node, biasPlus, /*newNodeTakesName=*/true);
+        }
+        else
+        {
+            TensorShape biasShape(numOutputs);
+            if (spatial)
+                biasShape = ImageDimensions::AsTensorShape(1, 1, numOutputs, bnNode->GetImageLayoutKind());
+            auto newBias = AddNodeToNetWithElemType(NewFoldedParameter<ElemType>(node->GetDeviceId(), GetUniqueNodeName(node->NodeName() + L".b"), biasShape));
+            c.Reshape(newBias->Value().GetNumRows(), newBias->Value().GetNumCols());
+            newBias->Value().SetValue(c);
+            auto plus = New<PlusNode<ElemType>>(node->GetDeviceId(), GetUniqueNodeName(node->NodeName() + L".plus"));
+            plus->AttachInputs(vector<ComputationNodeBasePtr>{product, newBias});
+            ReplaceNodeInNetwork(node, plus, /*newNodeTakesName=*/true);
+        }
+        numFolded++;
+    }
+    return numFolded;
+}
+
+// Times(W, PerDimMeanVarNormalization(x, mean, s)) --> Times(W diag(s), x) + b'
+template <class ElemType>
+size_t ComputationNetwork::FoldMeanVarNormalizationNodes()
+{
+    size_t numFolded = 0;
+    auto numUses = CountNodeUses();
+
+    // find the consumer of each normalization
+    map<ComputationNodeBasePtr, ComputationNodeBasePtr> consumers;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        for (const auto& input : iter.second->GetInputs())
+            consumers[input] = iter.second;
+    }
+
+    for (const auto& node : GetNodesWithType(OperationNameOf(PerDimMeanVarNormalizationNode)))
+    {
+        if (numUses[node] != 1 || consumers.find(node) == consumers.end())
+            continue;
+        auto times = consumers[node];
+        if (!dynamic_pointer_cast<TimesNode<ElemType>>(times) || times->Input(1) != node)
+            continue;
+        auto weights = AsParameter<ElemType>(times->Input(0), numUses);
+        if (!weights)
+            continue;
+        auto& weightsValue = weights->Value();
+        const size_t numInputs = weightsValue.GetNumCols();
+        const size_t numOutputs = weightsValue.GetNumRows();
+        Matrix<ElemType> mean = ParameterAsColumn<ElemType>(node->Input(1), numInputs);
+        Matrix<ElemType> invStdDev = ParameterAsColumn<ElemType>(node->Input(2), numInputs);
+        if (mean.IsEmpty() || invStdDev.IsEmpty() || times->GetSampleLayout().GetNumElements() != numOutputs)
+            continue;
+
+        // Times() may already be followed by a bias
+        ComputationNodeBasePtr biasPlus;
+        Matrix<ElemType> oldBias(node->GetDeviceId());
+        if (numUses[times] == 1 && consumers[times]->OperationName() == OperationNameOf(PlusNode))
+        {
+            auto plus = consumers[times];
+            auto bias = plus->Input(0) == times ? plus->Input(1) : plus->Input(0);
+            if (AsParameter<ElemType>(bias, numUses))
+            {
+                oldBias = ParameterAsColumn<ElemType>(bias, numOutputs);
+                if (!oldBias.IsEmpty())
+                    biasPlus = plus;
+            }
+        }
+
+        // W' = W diag(s); b' = b - W' mean
+        weightsValue.RowElementMultiplyWith(invStdDev.Reshaped(1, numInputs));
+        Matrix<ElemType> c(node->GetDeviceId());
+        c.AssignProductOf(weightsValue, false, mean, false);
+        InvalidateCompiledNetwork();
+        times->SetInput(1, node->Input(0));
+        if (biasPlus)
+            oldBias -= c;
+        else
+        {
+            auto newBias = AddNodeToNetWithElemType(NewFoldedParameter<ElemType>(node->GetDeviceId(), GetUniqueNodeName(times->NodeName() + L".b"), TensorShape(numOutputs)));
+            newBias->Value().AssignProductOf(-1, c);
+            auto plus = New<PlusNode<ElemType>>(node->GetDeviceId(), GetUniqueNodeName(times->NodeName() + L".plus"));
+            plus->AttachInputs(vector<ComputationNodeBasePtr>{times, newBias});
+            ReplaceNodeInNetwork(times, plus, /*newNodeTakesName=*/true);
+        }
+        DeleteNode(node->NodeName());
+        numFolded++;
+    }
+    return numFolded;
+}
+
+// compute all nodes without MB layout that only depend on parameters, and replace the outermost ones by parameters
+template <class ElemType>
+size_t ComputationNetwork::FoldConstantSubgraphs()
+{
+    VerifyIsCompiled("FoldConstantSubgraphs");
+
+    // determine the constant nodes, in evaluation order (CompileNetwork() has validated them, so their dimensions are known)
+    set<ComputationNodeBasePtr> constantNodes;
+    for (const auto& node : GetEvalOrder(nullptr))
+    {
+        bool isConstant;
+        if (node->IsLeaf())
+            isConstant = node->OperationName() == OperationNameOf(LearnableParameter);
+        else
+        {
+            isConstant = !node->HasMBLayout() && !node->RequiresPreCompute() && dynamic_pointer_cast<ComputationNode<ElemType>>(node);
+            for (const auto& input : node->GetInputs())
+                isConstant &= constantNodes.find(input) != constantNodes.end();
+        }
+        if (isConstant)
+            constantNodes.insert(node);
+    }
+
+    // the outermost ones are those with a non-constant consumer, or that are asked for by themselves
+    set<ComputationNodeBasePtr> foldRootSet;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        const auto& node = iter.second;
+        if (constantNodes.find(node) != constantNodes.end())
+            continue;
+        for (const auto& input : node->GetInputs())
+        {
+            if (!input->IsLeaf() && constantNodes.find(input) != constantNodes.end())
+                foldRootSet.insert(input);
+        }
+    }
+    for (const auto& root : m_allRoots)
+    {
+        if (!root->IsLeaf() && constantNodes.find(root) != constantNodes.end())
+            foldRootSet.insert(root);
+    }
+    if (foldRootSet.empty())
+        return 0;
+    vector<ComputationNodeBasePtr> foldRoots(foldRootSet.begin(), foldRootSet.end());
+
+    // compute them
+    for (const auto& root : foldRoots)
+    {
+        FormEvalOrder(root);
+        FormRecurrentLoops(root);
+        FormNestedNetwork(root);
+    }
+    AllocateAllMatrices(foldRoots, {}, nullptr);
+    ForwardProp(foldRoots);
+
+    for (const auto& root : foldRoots)
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(root);
+        auto parameter = NewFoldedParameter<ElemType>(root->GetDeviceId(), GetUniqueNodeName(root->NodeName() + L".value"), root->GetSampleLayout());
+        parameter->Value().SetValue(node->Value());
+        ReplaceNodeInNetwork(root, parameter, /*newNodeTakesName=*/true);
+    }
+    return foldRoots.size();
+}
+
+// delete all nodes that 'roots' don't depend on, except for features and labels, which are the interface to the reader
+size_t ComputationNetwork::PruneNodesNotNeededFor(const std::vector<ComputationNodeBasePtr>& roots)
+{
+    set<ComputationNodeBasePtr> neededNodes(m_features.begin(), m_features.end());
+    neededNodes.insert(m_labels.begin(), m_labels.end());
+    for (const auto& node : ComputationNodeBase::EnumerateNodes(roots))
+        neededNodes.insert(node);
+
+    vector<wstring> unneededNodeNames;
+    for (const auto& iter : m_nameToNodeMap)
+    {
+        if (neededNodes.find(iter.second) == neededNodes.end())
+            unneededNodeNames.push_back(iter.first);
+    }
+    for (const auto& name : unneededNodeNames)
+        DeleteNode(name);
+    return unneededNodeNames.size();
+}
+
+template void ComputationNetwork::OptimizeForInference<float>(const std::vector<ComputationNodeBasePtr>& outputNodes);
+template void ComputationNetwork::OptimizeForInference<double>(const std::vector<ComputationNodeBasePtr>& outputNodes);
+} } }
@@ -93,7 +93,7 @@ ComputationNetwork::ComputationNetwork(const IConfigRecordPtr configp)
                 EvaluationNodes().push_back(node); // eval*
             else if (tag == L"output")
                 OutputNodes().push_back(node);
-            else if (!tag.empty())
+            else if (!tag.empty() && tag != L"checkpoint") // (a 'checkpoint' keeps its value for backprop, see PlanValueRecomputation())
                 RuntimeError("ComputationNetwork: unknown tag '%ls'", tag.c_str());
             // TODO: are there nodes without tag? Where do they go?
         }
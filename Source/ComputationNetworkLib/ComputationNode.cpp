@@ -9,6 +9,8 @@
 #include "InputAndParamNodes.h"
 #include "ComputationNetworkBuilder.h" // TODO: We should only pull in NewComputationNodeFromConfig(). Nodes should not know about network at large.
 #include "TensorShape.h"
+#include "GPUDataTransferer.h"
+#include "CUDAPageLockedMemAllocator.h"
 
 #ifndef let
 #define let const auto
@@ -251,6 +253,74 @@ template <class ElemType>
     }
 }
 
+// -----------------------------------------------------------------------
+// value offloading (see ComputationNetwork::PlanValueOffloading())
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+struct ComputationNode<ElemType>::ValueOffload
+{
+    ValueOffload(DEVICEID_TYPE deviceId)
+        : m_transferer(deviceId, true /*useConcurrentStreams*/), m_deviceId(deviceId), m_hostBufferSize(0), m_numRows(0), m_numCols(0)
+    {
+    }
+
+    GPUDataTransferer<ElemType> m_transferer; // copies on the transfer streams, each direction ordered after the compute stream
+    DEVICEID_TYPE m_deviceId;
+    shared_ptr<ElemType> m_hostBuffer; // page-locked, from the shared arena; kept across minibatches
+    size_t m_hostBufferSize;           // in elements
+    size_t m_numRows, m_numCols;       // of the value that is in the host buffer
+};
+
+template <class ElemType>
+/*virtual*/ void ComputationNode<ElemType>::BeginValueOffload()
+{
+    if (m_value->GetMatrixType() != DENSE || m_value->GetDeviceId() < 0)
+        LogicError("BeginValueOffload: %ls %ls operation: Only dense values on a GPU can be offloaded.", NodeName().c_str(), OperationName().c_str());
+    if (!m_valueOffload || m_valueOffload->m_deviceId != m_value->GetDeviceId())
+        m_valueOffload = make_shared<ValueOffload>(m_value->GetDeviceId());
+    auto& offload = *m_valueOffload;
+    const size_t numElements = m_value->GetNumElements();
+    if (offload.m_hostBufferSize < numElements)
+    {
+        // the old buffer may still be read or written by the last copies
+        offload.m_transferer.WaitForCopyGPUToCPUAsync();
+        offload.m_transferer.WaitForCopyCPUToGPUAsync();
+        auto& arena = CUDAPageLockedMemArena::GetSharedArena(offload.m_deviceId);
+        offload.m_hostBuffer = shared_ptr<ElemType>((ElemType*) arena.Malloc(numElements * sizeof(ElemType)), [&arena](ElemType* p)
+                                                    {
+                                                        arena.Free(p);
+                                                    });
+        offload.m_hostBufferSize = numElements;
+    }
+    offload.m_numRows = m_value->GetNumRows();
+    offload.m_numCols = m_value->GetNumCols();
+    if (numElements > 0)
+        offload.m_transferer.CopyGPUToCPUAfterComputeAsync(m_value->BufferPointer(), numElements, offload.m_hostBuffer.get());
+}
+
+template <class ElemType>
+/*virtual*/ void ComputationNode<ElemType>::EndValueOffload()
+{
+    m_valueOffload->m_transferer.WaitForCopyGPUToCPUOnComputeStream();
+}
+
+template <class ElemType>
+/*virtual*/ void ComputationNode<ElemType>::BeginValuePrefetch()
+{
+    auto& offload = *m_valueOffload;
+    SwapBackpropValue();
+    m_value->Resize(offload.m_numRows, offload.m_numCols);
+    if (m_value->GetNumElements() > 0)
+        offload.m_transferer.CopyCPUToGPUAfterComputeAsync(offload.m_hostBuffer.get(), m_value->GetNumElements(), m_value->BufferPointer());
+}
+
+template <class ElemType>
+/*virtual*/ void ComputationNode<ElemType>::EndValuePrefetch()
+{
+    m_valueOffload->m_transferer.WaitForCopyCPUToGPUOnComputeStream();
+}
+
 // -----------------------------------------------------------------------
 // instantiate the core class templates
 // -----------------------------------------------------------------------
@@ -30,7 +30,9 @@
 // version number to control how to read and write
 #define CNTK_MODEL_VERSION_1 1
 #define CNTK_MODEL_VERSION_2 2
-#define CURRENT_CNTK_MODEL_VERSION CNTK_MODEL_VERSION_2
+#define CNTK_MODEL_VERSION_3 3 // position of the index of memory-mappable parameter blobs after the version number (0 if none)
+#define CNTK_MODEL_VERSION_4 4 // matrices may be stored in 8 bits with a scale per row (fileOptionsQuantized8Bit)
+#define CURRENT_CNTK_MODEL_VERSION CNTK_MODEL_VERSION_4
 
 extern bool g_shareNodeValueMatrices;
 
@@ -142,7 +144,7 @@ struct ComputationNetworkOwnedNodeState
     friend class ComputationNetwork;
 
     ComputationNetworkOwnedNodeState()
-        : m_needsGradient(false), m_valueSharable(true)
+        : m_needsGradient(false), m_valueSharable(true), m_isFusedIntoConsumer(false), m_isBackpropFusedIntoConsumer(false), m_inPlaceInputIndex(SIZE_MAX), m_isValueTakenOverByConsumer(false), m_isValueRecomputed(false), m_isValueOffloaded(false)
     {
         PurgeStateForFormingRecurrentLoops();
         m_isPartOfLoop = false;
@@ -161,6 +163,16 @@ struct ComputationNetworkOwnedNodeState
     virtual void MarkValueSharable() { m_valueSharable = true; }
     bool isValueSharable() const { return m_valueSharable; }
 
+    bool IsFusedIntoConsumer() const { return m_isFusedIntoConsumer; }
+    bool IsBackpropFusedIntoConsumer() const { return m_isBackpropFusedIntoConsumer; }
+
+    size_t GetInPlaceInputIndex() const { return m_inPlaceInputIndex; } // SIZE_MAX if the value has a matrix of its own
+    bool IsValueTakenOverByConsumer() const { return m_isValueTakenOverByConsumer; }
+
+    bool IsValueRecomputed() const { return m_isValueRecomputed; }
+    bool IsValueOffloaded() const { return m_isValueOffloaded; }
+    const std::vector<std::shared_ptr<ComputationNodeBase>>& GetOffloadsToCompleteAfterForwardProp() const { return m_offloadsToCompleteAfterForwardProp; }
+
 protected:                // TODO: should be fully encapsulated here
 
     bool m_needsGradient; // true if this node or any children need a gradient to be computed (for own consumption or propagation to somewhere in the child tree)
@@ -168,6 +180,17 @@ protected:                // TODO: should be fully encapsulated here
     bool m_valueSharable; // a flag is needed for memory share.
                           // If it is false (e.g., learnableParameters/InputValue and those nodes are solely induced by learnableParameters),
                           // it will never be released to memory pool
+
+    bool m_isFusedIntoConsumer; // set by FuseElementwiseOperations(): this node's ForwardProp() is computed by its only consumer, and its value is never materialized
+    bool m_isBackpropFusedIntoConsumer; // set by FuseConvolutionBiasReLU(): this node's BackpropTo() is done by its only consumer as well, and its gradient is never materialized
+
+    size_t m_inPlaceInputIndex;        // set by PlanInPlaceValues(): this node's value overwrites the value of this input, in the same matrix
+    bool m_isValueTakenOverByConsumer; // set by PlanInPlaceValues(): this node's value matrix is the value of its only consumer from then on, which releases it
+
+    bool m_isValueRecomputed; // set by PlanValueRecomputation(): this node's value is dropped after forward prop and computed once more when backprop needs it
+
+    bool m_isValueOffloaded; // set by PlanValueOffloading(): this node's value is copied to host memory after forward prop, and back when backprop needs it
+    std::vector<std::shared_ptr<ComputationNodeBase>> m_offloadsToCompleteAfterForwardProp; // offloaded values whose last forward-prop reader this node is
 private:
 
     bool m_isPartOfLoop; // true if this loop is part of a recurrent loop
@@ -701,6 +724,34 @@ public:
     void SetOutputNeededDuringBackprop(bool f) { m_outputNeededDuringBackprop = f; }
     bool IsOutputNeededDuringBackprop() const { return !g_shareNodeValueMatrices || m_outputNeededDuringBackprop; }
 
+    // Can the value be dropped after forward prop and computed once more, from the input values, when backprop needs it?
+    // Only for nodes whose ForwardProp() is deterministic, has no side effects, and does not use matrices of its own besides the value.
+    // See ComputationNetwork::PlanValueRecomputation().
+    virtual bool IsValueRecomputable() const { return false; }
+
+    // Can ForwardProp() write the value into the matrix of input 'i' (read element by element at the same position)?
+    // Only for elementwise nodes whose output has the same shape as that input. Whether the input's value is still needed
+    // by anyone else is the network's business, see ComputationNetwork::PlanInPlaceValues().
+    virtual bool CanComputeValueInPlaceOfInput(size_t /*i*/) const { return false; }
+    // Is the value the elements of input 'i' in the same order, just with other tensor dims? Then it can be computed in place of
+    // an input of another shape (with the same number of elements), where it is a view of that input that costs nothing to compute.
+    virtual bool IsValueReshapeOfInput(size_t /*i*/) const { return false; }
+    // Can ForwardProp() and BackpropTo() be given a FrameRange that covers only the first parallel sequences of a time step
+    // (FrameRange::WithActiveSequences())? Only for nodes that access their own and their inputs' data through that FrameRange alone,
+    // and compute each column independently. Recurrent loops made only of such nodes skip the slots whose sequences have ended.
+    virtual bool SupportsActiveSequencePrefix() const { return false; }
+
+    // for nodes that IsValueRecomputed() or IsValueOffloaded(): the matrix the value is recomputed or copied back into for backprop,
+    // which is in use from then until the node's own backprop
+    virtual void RequestBackpropValueMatrix(MatrixPool& matrixPool) = 0;
+    virtual void SwapBackpropValue() = 0; // exchange the value matrices before recomputation or copying back, and after the node's backprop
+
+    // for nodes that IsValueOffloaded(), see ComputationNetwork::PlanValueOffloading(). None of these block the CPU.
+    virtual void BeginValueOffload() = 0;  // right after forward prop: start copying the value to host memory once it is computed
+    virtual void EndValueOffload() = 0;    // after its last forward-prop reader: the compute stream waits for that copy before the matrix is reused
+    virtual void BeginValuePrefetch() = 0; // swap in the backprop value matrix, and start copying the value back into it
+    virtual void EndValuePrefetch() = 0;   // before the first reader in backprop: the compute stream waits for that copy
+
     // -----------------------------------------------------------------------
     // helpers for network traversal
     // -----------------------------------------------------------------------
@@ -728,20 +779,28 @@ public:
 
 private:
 
-    // Recursive part of EnumerateNodes().
+    // Depth-first part of EnumerateNodes().
+    // This keeps its own stack rather than recursing, since generated networks (e.g. unrolled decoders) can be far deeper than the call stack allows.
     void EnumerateNodesRec(std::unordered_set<ComputationNodeBasePtr>& visited, std::list<ComputationNodeBasePtr>& result) /*const*/ // const not working due to shared_from_this()
     {
-        if (visited.find(shared_from_this()) == visited.end()) // do not include a node twice
+        if (!visited.insert(shared_from_this()).second) // do not include a node twice
+            return;                                     // (have visited tagged here to avoid infinite loop over children, children's children, etc)
+        std::vector<std::pair<ComputationNodeBasePtr, size_t>> stack(1, std::make_pair(shared_from_this(), (size_t) 0)); // (node, index of the next input to visit)
+        while (!stack.empty())
         {
-            visited.insert(shared_from_this()); // have visited tagged here to avoid infinite loop over children, children's children, etc
-
             // children first for function evaluation
-            for (int i = 0; i < m_inputs.size(); i++)
-                if (m_inputs[i])
-                    m_inputs[i]->EnumerateNodesRec(visited, result);
-
+            ComputationNodeBase* node = stack.back().first.get();
+            size_t i = stack.back().second++;
+            if (i < node->m_inputs.size())
+            {
+                const auto& input = node->m_inputs[i];
+                if (input && visited.insert(input).second)
+                    stack.push_back(std::make_pair(input, (size_t) 0));
+                continue;
+            }
             // now that all children are in list before us, put ourselves
-            result.push_back(shared_from_this());
+            result.push_back(stack.back().first);
+            stack.pop_back();
         }
     }
 
@@ -1093,6 +1152,11 @@ public:
 
     const Matrix<ElemType>& Gradient() const { return *m_gradient; }
     Matrix<ElemType>&       Gradient()       { return *m_gradient; }
+    shared_ptr<Matrix<ElemType>> ValuePtr() const    { return m_value; }
+    shared_ptr<Matrix<ElemType>> GradientPtr() const { return m_gradient; } // (null until requested from the MatrixPool)
+
+    // let this node use another node's value matrix (shallow), e.g. to share a parameter between copies of a network
+    void ShareValueWith(const ComputationNode<ElemType>& other) { m_value = other.m_value; }
 
 private:
 
@@ -1310,7 +1374,8 @@ public:
 #if DUMPOUTPUT
                 fprintf(stderr, "Backprop%d_%ls\n", i, NodeName().c_str());
 #endif
-                child->LazyZeroGradient(); // set gradient to 0 if this is the first time
+                if (!child->IsBackpropFusedIntoConsumer()) // (then we write the gradients of its inputs instead)
+                    child->LazyZeroGradient(); // set gradient to 0 if this is the first time
 
                 // If we propagate from a loop to a node that is outside the loop, we are not efficient.
                 // This case is handled by SEQTraversalFlowControlNode::Backprop().
@@ -1358,16 +1423,20 @@ public:
     // -----------------------------------------------------------------------
 
     // request matrices needed to do node function value evaluation
+    // A node computed in place of an input takes over the input's matrix instead.
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
     {
-        RequestMatrixFromPool(m_value, matrixPool);
+        if (GetInPlaceInputIndex() != SIZE_MAX && m_value == nullptr)
+            m_value = Input(GetInPlaceInputIndex())->m_value;
+        else
+            RequestMatrixFromPool(m_value, matrixPool);
     }
 
     // release temp matrices that are only used by forward computation
     // don't release matrices that need to be used in the gradient computation
     virtual void ReleaseMatricesAfterForwardProp(MatrixPool& matrixPool) override
     {
-        if (!IsOutputNeededDuringBackprop() && (m_value->GetMatrixType() != SPARSE) && isValueSharable())
+        if (!IsOutputNeededDuringBackprop() && (m_value->GetMatrixType() != SPARSE) && isValueSharable() && !IsValueTakenOverByConsumer())
             ReleaseMatrixToPool(m_value, matrixPool);
     }
 
@@ -1398,9 +1467,28 @@ public:
             // since in the case it isn't used, we release it during forward prop itself
             if (IsOutputNeededDuringBackprop() && m_value->GetMatrixType() != SPARSE && isValueSharable())
                 ReleaseMatrixToPool(m_value, matrixPool);
+
+            // a recomputed or offloaded value was released during forward prop as well, but its second matrix is only done now
+            if ((IsValueRecomputed() || IsValueOffloaded()) && m_backpropValue != nullptr)
+                ReleaseMatrixToPool(m_backpropValue, matrixPool);
         }
     }
 
+    virtual void RequestBackpropValueMatrix(MatrixPool& matrixPool) override
+    {
+        RequestMatrixFromPool(m_backpropValue, matrixPool);
+    }
+
+    virtual void SwapBackpropValue() override
+    {
+        swap(m_value, m_backpropValue);
+    }
+
+    virtual void BeginValueOffload() override;
+    virtual void EndValueOffload() override;
+    virtual void BeginValuePrefetch() override;
+    virtual void EndValuePrefetch() override;
+
     void CreateGradientMatrixIfNull()
     {
         CreateMatrixIfNull(m_gradient);
@@ -1423,12 +1511,15 @@ protected:
             matrixPtr = make_shared<Matrix<ElemType>>(m_deviceId);
     }
 
+    // The pool plans by size; we pass our own value size, which is also the typical size of temps and gradients.
     void RequestMatrixFromPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool)
     {
+        size_t rows, cols;
+        DetermineDataSize(rows, cols);
         if (matrixPtr == nullptr)
-        {
-            matrixPtr = matrixPool.Request<ElemType>(m_deviceId);
-        }
+            matrixPtr = matrixPool.Request<ElemType>(m_deviceId, HasMBLayout() ? rows : rows * cols, HasMBLayout());
+        else // kept from when the network was planned before
+            matrixPool.Keep<ElemType>(matrixPtr, HasMBLayout() ? rows : rows * cols, HasMBLayout());
     }
 
     void ReleaseMatrixToPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool)
@@ -1437,6 +1528,19 @@ protected:
         matrixPool.Release<ElemType>(matrixPtr);
     }
 
+    // scratch memory that is only used inside ForwardProp() and BackpropTo(), shared with the other nodes on the device (see MatrixPool)
+    void RequestWorkspaceFromPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool)
+    {
+        if (matrixPtr == nullptr)
+            matrixPtr = matrixPool.RequestWorkspace<ElemType>(m_deviceId);
+    }
+
+    void ReleaseWorkspaceToPool(shared_ptr<Matrix<ElemType>>& matrixPtr, MatrixPool& matrixPool)
+    {
+        assert(matrixPtr != nullptr);
+        matrixPool.ReleaseWorkspace<ElemType>(matrixPtr);
+    }
+
 public:
 
     // -----------------------------------------------------------------------
@@ -1548,6 +1652,10 @@ public:
 protected:
 
     shared_ptr<Matrix<ElemType>> m_value, m_gradient;
+    shared_ptr<Matrix<ElemType>> m_backpropValue; // see IsValueRecomputed() and IsValueOffloaded(); holds the forward-prop value matrix while the one for backprop is m_value
+
+    struct ValueOffload; // host copy of the value if IsValueOffloaded(), defined in ComputationNode.cpp
+    shared_ptr<ValueOffload> m_valueOffload;
 
     static std::map<size_t, std::map<size_t, Matrix<ElemType>*>> s_constOnes;
 };
@@ -1628,6 +1736,12 @@ public:
     virtual void ValidateInferInputDimsFrom(const TensorShape&) override { NOT_IMPLEMENTED; }
     virtual void SetInput(const size_t, const Microsoft::MSR::CNTK::ComputationNodeBase::ComputationNodeBasePtr&) override { NOT_IMPLEMENTED; }
     virtual void ZeroGradientsOfInputs(void) override { NOT_IMPLEMENTED; }
+    virtual void RequestBackpropValueMatrix(MatrixPool& matrixPool) override { NOT_IMPLEMENTED; }
+    virtual void SwapBackpropValue() override { NOT_IMPLEMENTED; }
+    virtual void BeginValueOffload() override { NOT_IMPLEMENTED; }
+    virtual void EndValueOffload() override { NOT_IMPLEMENTED; }
+    virtual void BeginValuePrefetch() override { NOT_IMPLEMENTED; }
+    virtual void EndValuePrefetch() override { NOT_IMPLEMENTED; }
     virtual void MaskMissingValueColumnsToZero(const Microsoft::MSR::CNTK::FrameRange&) override { NOT_IMPLEMENTED; }
     virtual void MaskMissingGradientColumnsToZero(const Microsoft::MSR::CNTK::FrameRange&) override { NOT_IMPLEMENTED; }
     virtual void InvalidateMissingValueColumns(const Microsoft::MSR::CNTK::FrameRange&) override { NOT_IMPLEMENTED; }
@@ -1682,6 +1796,52 @@ public:
 
 struct IRecurrentNode { virtual int GetRecurrenceSteppingDirection() const = 0; };
 
+// =======================================================================
+// IFusableElementwiseNode -- interface for elementwise nodes that take part in operator fusion
+// ComputationNetwork::FuseElementwiseOperations() offers the opcode of a binary
+// elementwise input to its unary consumer, which then computes both in one TensorOp.
+// =======================================================================
+
+struct IFusableChainHeadNode;
+
+struct IFusableElementwiseNode
+{
+    virtual ElementWiseOperator GetForwardOpCode() const = 0;                        // opcode that ForwardProp() applies to the inputs
+    virtual bool TryFuseInput(ElementWiseOperator /*inputOpCode*/) { return false; } // true if this node computes its input from now on
+    virtual bool TryFuseChain(const std::shared_ptr<IFusableChainHeadNode>& /*head*/) { return false; } // true if 'head' computes this node from now on
+    virtual void UnfuseInput() { }
+};
+
+// =======================================================================
+// IFusableChainHeadNode -- interface for nodes that can compute a short chain of their consumers in one kernel
+// E.g. for ReLU(Plus(Convolution(W, x), b)), ComputationNetwork::FuseConvolutionBiasReLU() lets the Convolution node
+// compute the ReLU's value with one cuDNN call. The last node of the chain (the tail) then calls ForwardPropChain()
+// instead of doing its own ForwardProp(), and BackpropChain() to propagate its gradient through the whole chain,
+// into the gradients of the head and of the other inputs of the nodes in between.
+// =======================================================================
+
+struct IFusableChainHeadNode
+{
+    virtual bool TryFuseChain(const ComputationNodeBasePtr& /*consumer*/) { return false; } // true if this node computes its consumer's consumer from now on
+    virtual void UnfuseChain() { }
+    virtual void ForwardPropChain(const FrameRange& fr, ComputationNodeBase& tail) = 0;
+    virtual void BackpropChain(const FrameRange& fr, ComputationNodeBase& tail) = 0;
+};
+
+// =======================================================================
+// IImageLayoutNode -- interface for image nodes whose engine may compute in a different layout than the model
+// By default such a node transposes its input and output at its boundaries. ComputationNetwork::ElideImageLayoutConversions()
+// lets neighboring image nodes that compute in the same layout pass their values in that layout instead.
+// =======================================================================
+
+struct IImageLayoutNode
+{
+    virtual ImageLayoutKind GetImageLayout() const = 0;       // the model's layout, in which input and output are by default
+    virtual ImageLayoutKind GetEngineImageLayout() const = 0; // the layout the node's engine computes in
+    virtual size_t GetImageInputIndex() const = 0;            // the input that is an image
+    virtual void SetValuesInEngineLayout(bool input, bool output) = 0;
+};
+
 // =======================================================================
 // helper macro to ease access to base members in presence of C++ two-phase name lookup
 // =======================================================================
@@ -1737,6 +1897,7 @@ protected:
     using Base::InvalidateMissingValueColumns;                                                                                                           \
     using Base::IsLeaf;                                                                                                                                  \
     using Base::IsOutputOlderThanInputs;                                                                                                                 \
+    using Base::IsValueRecomputed;                                                                                                                       \
     using Base::LinkToMBLayout;                                                                                                                          \
     using Base::Load;                                                                                                                                    \
     using Base::LoadValue;                                                                                                                               \
@@ -1745,15 +1906,18 @@ protected:
     using Base::MaskMissingValueColumnsToZero;                                                                                                           \
     using Base::MaskedGradientFor;                                                                                                                       \
     using Base::MaskedValueFor;                                                                                                                          \
+    using Base::NeedGradient;                                                                                                                            \
     using Base::OutputUsedInComputingInputNodesGradients;                                                                                                \
     using Base::PrintNodeValuesToFile;                                                                                                                   \
     using Base::PrintSelfBeforeValidation;                                                                                                               \
     using Base::ReleaseMatricesAfterBackprop;                                                                                                            \
     using Base::ReleaseMatricesAfterForwardProp;                                                                                                         \
     using Base::ReleaseMatrixToPool;                                                                                                                     \
+    using Base::ReleaseWorkspaceToPool;                                                                                                                  \
     using Base::RequestMatricesBeforeBackprop;                                                                                                           \
     using Base::RequestMatricesBeforeForwardProp;                                                                                                        \
     using Base::RequestMatrixFromPool;                                                                                                                   \
+    using Base::RequestWorkspaceFromPool;                                                                                                                \
     using Base::Save;                                                                                                                                    \
     using Base::SetDims1;                                                                                                                                \
     using Base::SetDims;                                                                                                                                 \
@@ -1836,6 +2000,8 @@ public:
     {
         ValidateUnaryMap(isFinalValidationPass);
     }
+
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override { return true; }
 };
 
 #define UsingUnaryElementwiseNodeBaseMembers UsingComputationNodeMembersBoilerplate;
@@ -1879,6 +2045,8 @@ public:
     {
         ValidateBinaryZip(isFinalValidationPass, true /*allowBroadcast*/);
     }
+
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override { return true; }
 };
 
 #define UsingBinaryElementwiseNodeBaseMembers UsingComputationNodeMembersBoilerplate;
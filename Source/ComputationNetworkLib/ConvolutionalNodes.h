@@ -25,12 +25,96 @@
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// ImageLayoutConversion -- transposes the images of an image node between the model's layout and its engine's layout
+// Values are converted only where the two differ, and not where ComputationNetwork::ElideImageLayoutConversions()
+// determined that the value stays in the engine layout because the neighboring image node computes in it, too.
+// The conversion buffers are only allocated when needed.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class ImageLayoutConversion
+{
+public:
+    ImageLayoutConversion()
+        : m_inputInEngineLayout(false), m_outputInEngineLayout(false)
+    {
+    }
+
+    void SetValuesInEngineLayout(bool input, bool output)
+    {
+        m_inputInEngineLayout = input;
+        m_outputInEngineLayout = output;
+    }
+
+    // layouts of the node's input and output values
+    ImageLayoutKind InputLayout(ImageLayoutKind modelLayout, ImageLayoutKind engineLayout) const
+    {
+        return m_inputInEngineLayout ? engineLayout : modelLayout;
+    }
+    ImageLayoutKind OutputLayout(ImageLayoutKind modelLayout, ImageLayoutKind engineLayout) const
+    {
+        return m_outputInEngineLayout ? engineLayout : modelLayout;
+    }
+
+    // 'value' (in 'layout') in the engine layout of t; this is 'value' itself or buffer 'id'
+    const Matrix<ElemType>& ToEngine(const ConvolutionTensor4D& t, const Matrix<ElemType>& value, ImageLayoutKind layout, size_t id)
+    {
+        if (layout == t.layout())
+            return value;
+        Matrix<ElemType>& buffer = Buffer(id, value.GetDeviceId());
+        ConvolutionEngineFactory<ElemType>::ConvertLayout(t, value, layout, buffer, t.layout(), false);
+        return buffer;
+    }
+
+    // where the engine writes into 'value' (in 'layout'): 'value' itself or buffer 'id', which is zeroed if the engine adds to it
+    Matrix<ElemType>& EngineTarget(const ConvolutionTensor4D& t, Matrix<ElemType>& value, ImageLayoutKind layout, size_t id, bool accumulate)
+    {
+        if (layout == t.layout())
+            return value;
+        Matrix<ElemType>& buffer = Buffer(id, value.GetDeviceId());
+        buffer.Resize(value.GetNumRows(), value.GetNumCols());
+        if (accumulate)
+            buffer.SetValue(0);
+        return buffer;
+    }
+
+    // complete EngineTarget(): transpose the buffer, if one was used, into 'value'
+    void FromEngine(const ConvolutionTensor4D& t, Matrix<ElemType>& value, ImageLayoutKind layout, size_t id, bool accumulate)
+    {
+        if (layout != t.layout())
+            ConvolutionEngineFactory<ElemType>::ConvertLayout(t, *m_buffers[id], t.layout(), value, layout, accumulate);
+    }
+
+private:
+    Matrix<ElemType>& Buffer(size_t id, DEVICEID_TYPE deviceId)
+    {
+        if (!m_buffers[id])
+            m_buffers[id] = make_shared<Matrix<ElemType>>(deviceId);
+        return *m_buffers[id];
+    }
+
+    bool m_inputInEngineLayout;
+    bool m_outputInEngineLayout;
+    shared_ptr<Matrix<ElemType>> m_buffers[4]; // input value, output value, output gradient, input gradient
+};
+
+enum ImageLayoutConversionBuffer
+{
+    inputValueBuffer,
+    outputValueBuffer,
+    outputGradientBuffer,
+    inputGradientBuffer
+};
+
 // -----------------------------------------------------------------------
 // ConvolutionNode (convolutionWeights, inputFeature)
 // -----------------------------------------------------------------------
 
-// Convolutions (incl. pooling) support two different storage formats:
-// BUGBUG: These are currently hard-selected depending on circumstances, without being reflected in TensoShape.
+// Convolutions (incl. pooling) support two different storage formats.
+// The model's imageLayout determines the format of the node values, the engine's format is ConvolutionTensor4D::layout().
+// Where they differ, the nodes transpose their images, but only at the boundaries of a chain of image nodes (see ImageLayoutConversion).
+// The filter is always in the engine's format.
 //
 // * legacy mode (CPU and GPU without cudnn): Channels are tuples of scalars
 //
@@ -56,7 +140,7 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 //     - for hidden layer: dimension of activation vector for each pixel
 //  - C' = output channels = dimension of activation vector for each pixel (also called N by NVidia, inconsistently)
 template <class ElemType>
-class ConvolutionNode : public ComputationNode<ElemType>, public NumInputs<2>
+class ConvolutionNode : public ComputationNode<ElemType>, public NumInputs<2>, public IImageLayoutNode, public IFusableChainHeadNode
 {
     typedef ComputationNode<ElemType> Base;
     UsingComputationNodeMembersBoilerplate;
@@ -143,8 +227,6 @@ public:
             node->m_maxTempMemSizeInSamples = m_maxTempMemSizeInSamples;
 
             node->m_imageLayoutKind = m_imageLayoutKind;
-
-            *node->m_tempMatrix = *m_tempMatrix;
         }
     }
 
@@ -157,16 +239,20 @@ public:
         m_inT->setN(batchSize);
         m_outT->setN(batchSize);
         assert(m_convEng != nullptr);
+        const auto& outputGrad = m_layoutConversion.ToEngine(*m_outT, sliceOutputGrad, OutputLayout(), outputGradientBuffer);
         if (inputIndex == 0) // derivative with respect to the weight matrix
         {
             auto& grad = Input(0)->GradientAsMatrix();
-            m_convEng->BackwardFilter(*m_outT, sliceOutputGrad, *m_inT, sliceInput1Value, *m_convDesc, *m_filterT, grad, fr.IsAllFrames(), *m_tempMatrix);
+            const auto& input1 = m_layoutConversion.ToEngine(*m_inT, sliceInput1Value, InputLayout(), inputValueBuffer);
+            m_convEng->BackwardFilter(*m_outT, outputGrad, *m_inT, input1, *m_convDesc, *m_filterT, grad, fr.IsAllFrames(), *m_tempMatrix);
         }
         else if (inputIndex == 1) // derivative with respect to the input feature
         {
             auto& input0 = Input(0)->ValueAsMatrix();
             auto sliceInput1Grad = Input(1)->GradientFor(fr);
-            m_convEng->BackwardData(*m_outT, sliceOutputGrad, *m_filterT, input0, *m_convDesc, *m_inT, sliceInput1Grad, *m_tempMatrix);
+            auto& input1Grad = m_layoutConversion.EngineTarget(*m_inT, sliceInput1Grad, InputLayout(), inputGradientBuffer, true);
+            m_convEng->BackwardData(*m_outT, outputGrad, *m_filterT, input0, *m_convDesc, *m_inT, input1Grad, *m_tempMatrix);
+            m_layoutConversion.FromEngine(*m_inT, sliceInput1Grad, InputLayout(), inputGradientBuffer, true);
         }
     }
 
@@ -192,7 +278,10 @@ public:
         input0.HasNan("Convolution-input0");
         sliceInput1Value.HasNan("Convolution-input1");
 #endif
-        m_convEng->Forward(*m_inT, sliceInput1Value, *m_filterT, input0, *m_convDesc, *m_outT, sliceOutputValue, *m_tempMatrix);
+        const auto& input1 = m_layoutConversion.ToEngine(*m_inT, sliceInput1Value, InputLayout(), inputValueBuffer);
+        auto& output = m_layoutConversion.EngineTarget(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
+        m_convEng->Forward(*m_inT, input1, *m_filterT, input0, *m_convDesc, *m_outT, output, *m_tempMatrix);
+        m_layoutConversion.FromEngine(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
 #if NANCHECK
         sliceOutputValue.HasNan("Convolution");
 #endif
@@ -211,6 +300,73 @@ public:
         m_convEng->BackwardBias(*m_outT, srcGrad, *m_biasT, biasGrad);
     }
 
+    // IFusableChainHeadNode: ReLU(Plus(this, b)) in one engine call, where b is a per-channel bias
+    // 'consumer' is the Plus node. This is only possible if the engine supports it, and b needs a gradient iff we do,
+    // since our gradient is what the bias gradient gets reduced from.
+    bool TryFuseChain(const ComputationNodeBasePtr& consumer) override
+    {
+        UnfuseChain();
+        if (!m_convEng || !m_convEng->SupportsFusedBiasReLU() || consumer->GetNumInputs() != 2)
+            return false;
+        auto bias = dynamic_pointer_cast<ComputationNode<ElemType>>(consumer->GetInputs()[consumer->GetInputs()[0].get() == this ? 1 : 0]);
+        if (!bias || bias.get() == this || bias->HasMBLayout() || bias->NeedGradient() != NeedGradient())
+            return false;
+        // one value per channel, broadcast over the pixels
+        const auto& biasShape = bias->GetSampleLayout();
+        auto channelShape = ImageDimensions::AsTensorShape(1, 1, m_outputChannels, OutputLayout());
+        if (biasShape.GetRank() > channelShape.GetRank())
+            return false;
+        for (size_t k = 0; k < channelShape.GetRank(); k++)
+        {
+            if ((k < biasShape.GetRank() ? biasShape[k] : 1) != channelShape[k])
+                return false;
+        }
+        m_fusedBias = bias;
+        return true;
+    }
+    void UnfuseChain() override
+    {
+        m_fusedBias = nullptr;
+    }
+
+    void ForwardPropChain(const FrameRange& fr, ComputationNodeBase& tail) override
+    {
+        assert(m_fusedBias != nullptr);
+        const Matrix<ElemType>& input0 = Input(0)->ValueAsMatrix();
+        Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
+        Matrix<ElemType> sliceOutputValue = dynamic_cast<ComputationNode<ElemType>&>(tail).ValueFor(fr);
+
+        size_t batchSize = sliceInput1Value.GetNumCols();
+        m_inT->setN(batchSize);
+        m_outT->setN(batchSize);
+        const auto& input1 = m_layoutConversion.ToEngine(*m_inT, sliceInput1Value, InputLayout(), inputValueBuffer);
+        auto& output = m_layoutConversion.EngineTarget(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
+        m_convEng->ForwardBiasReLU(*m_inT, input1, *m_filterT, input0, *m_convDesc, *m_biasT, m_fusedBias->ValueAsMatrix(), *m_outT, output, *m_tempMatrix);
+        m_layoutConversion.FromEngine(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
+    }
+
+    // the tail's gradient, through the ReLU, into our gradient and the bias gradient; our own BackpropTo() then continues from there
+    void BackpropChain(const FrameRange& fr, ComputationNodeBase& tail) override
+    {
+        assert(m_fusedBias != nullptr && m_fusedBias->NeedGradient());
+        auto& tailNode = dynamic_cast<ComputationNode<ElemType>&>(tail);
+        Matrix<ElemType> sliceTailValue = tailNode.ValueFor(fr);
+        Matrix<ElemType> sliceTailGrad = tailNode.GradientFor(fr);
+
+        // nothing else writes our gradient (our only consumer is skipped), so it gets assigned rather than zeroed and added to
+        this->UpdateDataSize(Gradient());
+        this->m_gradientInitialized = true;
+        m_fusedBias->LazyZeroGradient();
+        Matrix<ElemType> sliceOutputGrad = GradientFor(fr);
+
+        m_outT->setN(sliceTailValue.GetNumCols());
+        const auto& tailValue = m_layoutConversion.ToEngine(*m_outT, sliceTailValue, OutputLayout(), outputValueBuffer);
+        const auto& tailGrad = m_layoutConversion.ToEngine(*m_outT, sliceTailGrad, OutputLayout(), outputGradientBuffer);
+        auto& outputGrad = m_layoutConversion.EngineTarget(*m_outT, sliceOutputGrad, OutputLayout(), inputGradientBuffer, false);
+        m_convEng->BackwardBiasReLU(*m_outT, tailValue, tailGrad, outputGrad, *m_biasT, m_fusedBias->GradientAsMatrix());
+        m_layoutConversion.FromEngine(*m_outT, sliceOutputGrad, OutputLayout(), inputGradientBuffer, false);
+    }
+
     // note: this also infers dimensions from chilren
     void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
     {
@@ -218,7 +374,7 @@ public:
         InferMBLayoutFromInputsForStandardCase();
 
         // get input and output tensor shape and interpret as image dimensions
-        auto inDims = ImageDimensions(GetInputSampleLayout(1), m_imageLayoutKind);
+        auto inDims = ImageDimensions(GetInputSampleLayout(1), InputLayout());
 
         if (isFinalValidationPass && (inDims.m_width < m_kernelWidth || inDims.m_height < m_kernelHeight))
             InvalidArgument("%ls %ls operation requires that input width be >= kernelWidth and input height >= kernelHeight.", NodeName().c_str(), OperationName().c_str());
@@ -241,7 +397,7 @@ public:
             LogicError("convolutionWeight matrix %ls should have dimension [%d, %d] which is [outputChannels, kernelWidth * kernelHeight * inputChannels]", Input(0)->NodeName().c_str(), (int) m_outputChannels, (int) weightCols);
 
         // that's our dimension
-        SetDims(outDims.AsTensorShape(m_imageLayoutKind), true);
+        SetDims(outDims.AsTensorShape(OutputLayout()), true);
 
         if (isFinalValidationPass)
         {
@@ -272,8 +428,8 @@ public:
     {
         Base::DumpNodeInfo(printValues, fstream);
 
-        auto inDims = ImageDimensions(GetInputSampleLayout(1), m_imageLayoutKind);
-        auto outDims = ImageDimensions(m_sampleLayout, m_imageLayoutKind);
+        auto inDims = ImageDimensions(GetInputSampleLayout(1), InputLayout());
+        auto outDims = ImageDimensions(m_sampleLayout, OutputLayout());
 
         char str[4096];
         sprintf(str, "Input[Width:%lu, Height:%lu, Channels:%lu]  \n", inDims.m_width, inDims.m_height, inDims.m_numChannels);
@@ -291,18 +447,24 @@ public:
         m_maxTempMemSizeInSamples = maxTempMemSizeInSamples;
     }
 
+    // IImageLayoutNode
+    ImageLayoutKind GetImageLayout() const override { return m_imageLayoutKind; }
+    ImageLayoutKind GetEngineImageLayout() const override { return m_factory ? m_factory->GetImageLayout() : m_imageLayoutKind; }
+    size_t GetImageInputIndex() const override { return 1; }
+    void SetValuesInEngineLayout(bool input, bool output) override { m_layoutConversion.SetValuesInEngineLayout(input, output); }
+
     // request matrices needed to do node function value evaluation
     void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_tempMatrix, matrixPool);
+        RequestWorkspaceFromPool(m_tempMatrix, matrixPool);
     }
 
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
     void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
     {
         Base::ReleaseMatricesAfterBackprop(matrixPool);
-        ReleaseMatrixToPool(m_tempMatrix, matrixPool);
+        ReleaseWorkspaceToPool(m_tempMatrix, matrixPool);
     }
 
 private:
@@ -312,10 +474,14 @@ private:
     bool m_zeroPadding;
     bool m_1DConvolutionOnGPUSparse;
 
+    ImageLayoutKind InputLayout() const { return m_layoutConversion.InputLayout(m_imageLayoutKind, GetEngineImageLayout()); }
+    ImageLayoutKind OutputLayout() const { return m_layoutConversion.OutputLayout(m_imageLayoutKind, GetEngineImageLayout()); }
+
     shared_ptr<Matrix<ElemType>> m_tempMatrix;
     size_t m_maxTempMemSizeInSamples; // can change during runtime
 
     ImageLayoutKind m_imageLayoutKind; // how to interpret the tensor (which dimensions are X/Y and C)
+    ImageLayoutConversion<ElemType> m_layoutConversion;
 
     std::unique_ptr<ConvolutionEngineFactory<ElemType>> m_factory;
     std::unique_ptr<ConvolutionEngine<ElemType>> m_convEng;
@@ -325,6 +491,8 @@ private:
     std::unique_ptr<ConvolutionTensor4D> m_outT;
     std::unique_ptr<ConvolutionDescriptor> m_convDesc;
     std::unique_ptr<ConvolutionTensor4D> m_biasT;
+
+    ComputationNodePtr m_fusedBias; // set by TryFuseChain()
 };
 
 template class ConvolutionNode<float>;
@@ -335,7 +503,7 @@ template class ConvolutionNode<double>;
 // -----------------------------------------------------------------------
 
 template <class ElemType>
-class PoolingNodeBase : public ComputationNode<ElemType>, public NumInputs<1>
+class PoolingNodeBase : public ComputationNode<ElemType>, public NumInputs<1>, public IImageLayoutNode
 {
     typedef ComputationNode<ElemType> Base;
     UsingComputationNodeMembers;
@@ -418,7 +586,12 @@ public:
         m_outT->setN(batchSize);
         assert(m_poolEng != nullptr);
         assert(m_poolDesc != nullptr);
-        m_poolEng->Backward(*m_outT, sliceOutputValue, sliceOutputGrad, *m_poolDesc, *m_inT, sliceInput0Value, sliceInput0Grad);
+        const auto& outputValue = m_layoutConversion.ToEngine(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer);
+        const auto& outputGrad = m_layoutConversion.ToEngine(*m_outT, sliceOutputGrad, OutputLayout(), outputGradientBuffer);
+        const auto& input0Value = m_layoutConversion.ToEngine(*m_inT, sliceInput0Value, InputLayout(), inputValueBuffer);
+        auto& input0Grad = m_layoutConversion.EngineTarget(*m_inT, sliceInput0Grad, InputLayout(), inputGradientBuffer, true);
+        m_poolEng->Backward(*m_outT, outputValue, outputGrad, *m_poolDesc, *m_inT, input0Value, input0Grad);
+        m_layoutConversion.FromEngine(*m_inT, sliceInput0Grad, InputLayout(), inputGradientBuffer, true);
     }
 
     void ForwardProp(const FrameRange& fr) override
@@ -431,7 +604,10 @@ public:
         m_outT->setN(batchSize);
         assert(m_poolEng != nullptr);
         assert(m_poolDesc != nullptr);
-        m_poolEng->Forward(*m_inT, sliceInput0Value, *m_poolDesc, *m_outT, sliceOutputValue);
+        const auto& input0Value = m_layoutConversion.ToEngine(*m_inT, sliceInput0Value, InputLayout(), inputValueBuffer);
+        auto& outputValue = m_layoutConversion.EngineTarget(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
+        m_poolEng->Forward(*m_inT, input0Value, *m_poolDesc, *m_outT, outputValue);
+        m_layoutConversion.FromEngine(*m_outT, sliceOutputValue, OutputLayout(), outputValueBuffer, false);
     }
 
     void Validate(bool isFinalValidationPass) override
@@ -440,7 +616,7 @@ public:
         InferMBLayoutFromInputsForStandardCase();
 
         // get input tensor shape and interpret as image dimensions
-        auto inDims = ImageDimensions(GetInputSampleLayout(0), m_imageLayoutKind);
+        auto inDims = ImageDimensions(GetInputSampleLayout(0), InputLayout());
 
         if (isFinalValidationPass && (inDims.m_width < m_windowWidth || inDims.m_height < m_windowHeight))
             InvalidArgument("PoolingNodeBase: inputWidth must >= windowWidth and inputHeight must >= windowHeight.");
@@ -453,7 +629,7 @@ public:
 
         m_inputSizePerSample = inDims.m_width * inDims.m_height * inDims.m_numChannels;
 
-        SetDims(outDims.AsTensorShape(m_imageLayoutKind), true);
+        SetDims(outDims.AsTensorShape(OutputLayout()), true);
 
         if (isFinalValidationPass)
         {
@@ -488,12 +664,22 @@ public:
         fstream << string(str);
     }
 
+    // IImageLayoutNode
+    ImageLayoutKind GetImageLayout() const override { return m_imageLayoutKind; }
+    ImageLayoutKind GetEngineImageLayout() const override { return m_factory ? m_factory->GetImageLayout() : m_imageLayoutKind; }
+    size_t GetImageInputIndex() const override { return 0; }
+    void SetValuesInEngineLayout(bool input, bool output) override { m_layoutConversion.SetValuesInEngineLayout(input, output); }
+
 protected:
+    ImageLayoutKind InputLayout() const { return m_layoutConversion.InputLayout(m_imageLayoutKind, GetEngineImageLayout()); }
+    ImageLayoutKind OutputLayout() const { return m_layoutConversion.OutputLayout(m_imageLayoutKind, GetEngineImageLayout()); }
+
     size_t m_windowWidth, m_windowHeight;
     size_t m_horizontalSubsample, m_verticalSubsample;
     size_t m_inputSizePerSample, m_outputSizePerSample;
 
     ImageLayoutKind m_imageLayoutKind; // how to interpret the tensor (which dimensions are X/Y and C)
+    ImageLayoutConversion<ElemType> m_layoutConversion;
 
     std::unique_ptr<ConvolutionEngineFactory<ElemType>> m_factory;
     std::unique_ptr<PoolingEngine<ElemType>> m_poolEng;
@@ -8,7 +8,9 @@
 #include "ComputationNode.h"
 #include "ScriptableObjects.h"
 #include "Matrix.h"
+#include "Half.h" // for FP16 parameter blobs
 #include "File.h" // for LoadMatrixFromTextFile()
+#include "mappedfile.h"
 
 #include <unordered_set>
 #include <map>
@@ -22,6 +24,15 @@
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// Random-initialized LearnableParameters with at least this many elements (CNTK option initOnDeviceMinElements; 0 = none) are
+// initialized by the random generator of their own device (cuRAND on a GPU) even if initOnCPUOnly, instead of on the CPU and then
+// copied over, which for multi-GB layers dominates the job start. The values then differ from those of the CPU generator.
+inline size_t& LearnableParameterInitOnDeviceMinElements()
+{
+    static size_t minElements = 0;
+    return minElements;
+}
+
 // -----------------------------------------------------------------------
 // LearnableParameter (/*no input*/)
 // represents weight matrices and biases
@@ -94,7 +105,36 @@ public:
         fstream << m_parameterUpdateRequired;
         fstream << (size_t) 0 /*#rows in a legacy file format*/ << (size_t) 0 /*#cols in a legacy file format*/;
         m_sampleLayout.Save(fstream);
-        fstream << Value();
+        if (IsValueMappable(fstream)) // the value itself is written by the network, see ComputationNetwork::SaveToFileImpl()
+        {
+            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BMappedValue");
+            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EMappedValue");
+        }
+        else
+            fstream << SavedValue();
+    }
+
+    // SnapshotValue - copy the value to CPU memory, so that Save() can run on another thread while training goes on
+    // Until ReleaseValueSnapshot(), Save() writes the snapshot instead of the current value.
+    void SnapshotValue()
+    {
+        const auto& value = Value();
+        if (value.GetMatrixType() == DENSE)
+        {
+            auto snapshot = make_shared<Matrix<ElemType>>(value.GetNumRows(), value.GetNumCols(), CPUDEVICE);
+            value.CopySection(value.GetNumRows(), value.GetNumCols(), snapshot->BufferPointer(), value.GetNumRows());
+            m_valueSnapshot = snapshot;
+        }
+        else // (copied on its device)
+            m_valueSnapshot = make_shared<Matrix<ElemType>>(value);
+    }
+    void ReleaseValueSnapshot()
+    {
+        m_valueSnapshot.reset();
+    }
+    const Matrix<ElemType>& SavedValue() const
+    {
+        return m_valueSnapshot ? *m_valueSnapshot : Value();
     }
 
     virtual void Load(File& fstream, size_t modelVersion) override
@@ -114,9 +154,77 @@ public:
             if (cols > 1) // in some legacy format, last tensor dimension was split off as an explicit column dimension
                 sampleLayout.AppendInPlace(sampleLayout.GetRank(), cols);
         }
+        if (modelVersion >= CNTK_MODEL_VERSION_3 && fstream.TryGetMarker(FileMarker::fileMarkerBeginSection, L"BMappedValue"))
+        {
+            // the value is in a blob after the network description; the network will pass it to LoadMappedValue()
+            fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EMappedValue");
+            CreateMatrixIfNull(m_value);
+            SetDims(sampleLayout, false);
+            return;
+        }
         LoadValue(fstream);
         SetDims(sampleLayout, false); // note: call this after LoadValue() since LoadValue() overwrites m_sampleLayout
         VerifyDataSize(Value());      // sanity check
+        RestoreFlatBinding();
+    }
+
+    // whether Save() leaves the value to a memory-mappable blob
+    bool IsValueMappable(const File& fstream) const
+    {
+        return fstream.IsMappableParameters() && !fstream.IsQuantized8Bit() && SavedValue().GetMatrixType() == DENSE; // (8-bit values must be converted on load)
+    }
+
+    // write the value as a blob of elements for LoadMappedValue()
+    // returns - the element size written
+    size_t SaveMappedValue(File& fstream) const
+    {
+        const auto& value = SavedValue();
+        const size_t numElements = value.GetNumElements();
+        std::vector<ElemType> buffer(numElements);
+        value.CopySection(value.GetNumRows(), value.GetNumCols(), buffer.data(), value.GetNumRows());
+        if (fstream.IsHalfPrecision())
+        {
+            std::vector<unsigned short> bits(numElements);
+            for (size_t i = 0; i < numElements; i++)
+                bits[i] = half((float) buffer[i]).bits;
+            fwriteOrDie(bits.data(), sizeof(bits[0]), numElements, fstream);
+            return sizeof(bits[0]);
+        }
+        fwriteOrDie(buffer.data(), sizeof(buffer[0]), numElements, fstream);
+        return sizeof(buffer[0]);
+    }
+
+    // take the value from a blob in a memory-mapped model file
+    // On the CPU, the matrix is the mapped memory itself: it is read from disk page by page on first use, and shared with other
+    // processes that map the same model until written to (the mapping is copy-on-write). GPUs get a single copy from the mapping.
+    void LoadMappedValue(const shared_ptr<msra::files::mappedfile>& mapping, uint64_t offset, size_t rows, size_t cols, size_t elemSize)
+    {
+        if (offset + (uint64_t) rows * cols * elemSize > mapping->size())
+            RuntimeError("LoadMappedValue: %ls: the model file is truncated.", NodeName().c_str());
+        ElemType* data = (ElemType*) (mapping->data() + offset); // (writable, since mapped copy-on-write)
+        if (elemSize == sizeof(ElemType) && m_deviceId == CPUDEVICE)
+        {
+            Value().SetValue(rows, cols, CPUDEVICE, data, matrixFlagDontOwnBuffer);
+            m_valueMapping = mapping; // (keeps the memory alive as long as this node)
+        }
+        else if (elemSize == sizeof(ElemType))
+            Value().SetValue(rows, cols, m_deviceId, data);
+        else if (elemSize == sizeof(half)) // saved as FP16
+        {
+            const unsigned short* bits = (const unsigned short*) data;
+            std::vector<ElemType> buffer(rows * cols);
+            for (size_t i = 0; i < buffer.size(); i++)
+            {
+                half h;
+                h.bits = bits[i];
+                buffer[i] = (ElemType)(float) h;
+            }
+            Value().SetValue(rows, cols, m_deviceId, buffer.data());
+        }
+        else
+            RuntimeError("Template argument size doesn't match those in file");
+        VerifyDataSize(Value()); // sanity check
+        RestoreFlatBinding();
     }
 
     // initialize with random numbers
@@ -128,6 +236,9 @@ public:
         // fprintf(stderr, "%d x %d: %d  %ls\n", (int)GetNumRows(), (int)GetNumCols(), (int)randomSeed, NodeName().c_str());
 
         // the random seed offset is set via the "randomSeedOffset" parameter in config
+        const size_t initOnDeviceMinElements = LearnableParameterInitOnDeviceMinElements();
+        if (initOnCPUOnly && initOnDeviceMinElements > 0 && Value().GetNumElements() >= initOnDeviceMinElements)
+            initOnCPUOnly = false;
         if (initOnCPUOnly)
             Value().TransferToDeviceIfNotThereAndNotAutoPlace(CPUDEVICE, true);
 #if 1 // this more complex version is needed to repro test cases generated with an older version
@@ -158,6 +269,7 @@ public:
         size_t numCols = 0;
         auto array = File::LoadMatrixFromTextFile<ElemType>(msra::strfun::utf8(initFromFilePath), numRows, numCols); // TODO: change pathname to wstring
         Value().SetValue(numRows, numCols, m_deviceId, array.data(), matrixFlagNormal);
+        RestoreFlatBinding();
     }
 
     // TODO: share code with InitFromFile()
@@ -176,6 +288,29 @@ public:
         }
 
         Value().SetValue(numRows, numCols, m_deviceId, array.data(), matrixFlagNormal);
+        RestoreFlatBinding();
+    }
+
+    // BindToFlatBuffers - make the value and the gradient views into buffers shared by all parameters of the network,
+    // starting at element 'offset' of each (see ComputationNetwork::AllocateFlatParameterBuffers()). The current value is
+    // copied into the buffer. Anything that later replaces the value (loading a model or checkpoint) writes back into it.
+    void BindToFlatBuffers(const shared_ptr<Matrix<ElemType>>& flatValues, const shared_ptr<Matrix<ElemType>>& flatGradients, size_t offset)
+    {
+        const auto& value = Value();
+        if (value.GetMatrixType() != DENSE || offset + value.GetNumElements() > flatValues->GetNumElements() || flatGradients->GetNumElements() != flatValues->GetNumElements())
+            LogicError("BindToFlatBuffers: %ls: the parameter does not fit into the buffer.", NodeName().c_str());
+        m_flatValues = flatValues;
+        m_flatGradients = flatGradients;
+        m_flatOffset = offset;
+        m_flatNumElements = value.GetNumElements();
+        m_gradient = make_shared<Matrix<ElemType>>(value.GetNumRows(), value.GetNumCols(), flatGradients->BufferPointer() + offset, matrixFlagDontOwnBuffer, flatGradients->GetDeviceId());
+        this->m_gradientInitialized = false; // (the buffer is allocated zeroed, but the next LazyZeroGradient() will clear it again)
+        RestoreFlatBinding();
+    }
+    // (the gradient must have been allocated, see ComputationNetwork::AllocateAllMatrices(), so that we know whether it is sparse)
+    bool CanBindToFlatBuffers() const
+    {
+        return !m_flatValues && m_parameterUpdateRequired && Value().GetMatrixType() == DENSE && m_gradient && m_gradient->GetMatrixType() == DENSE;
     }
 
     // computation functions don't do anything for parameter nodes
@@ -208,6 +343,30 @@ public:
 
         PrintNodeValuesToFile(printValues, fstream);
     }
+
+private:
+    // if bound to flat buffers and the value no longer lives there (it was reloaded into a matrix of its own), copy it back
+    void RestoreFlatBinding()
+    {
+        if (!m_flatValues)
+            return;
+        ElemType* data = m_flatValues->BufferPointer() + m_flatOffset;
+        const auto& value = Value();
+        if (value.GetMatrixType() == DENSE && value.GetDeviceId() == m_flatValues->GetDeviceId() && value.BufferPointer() == data)
+            return;
+        if (value.GetNumElements() != m_flatNumElements)
+            RuntimeError("%ls: the parameter changed its size from %d to %d elements while bound to a flat parameter buffer.", NodeName().c_str(), (int) m_flatNumElements, (int) value.GetNumElements());
+        auto view = make_shared<Matrix<ElemType>>(value.GetNumRows(), value.GetNumCols(), data, matrixFlagDontOwnBuffer, m_flatValues->GetDeviceId());
+        view->SetValue(value);
+        m_value = view;
+    }
+
+    shared_ptr<msra::files::mappedfile> m_valueMapping; // if the value is a memory-mapped blob of the model file, see LoadMappedValue()
+    shared_ptr<Matrix<ElemType>> m_valueSnapshot;       // if not null: what Save() writes, see SnapshotValue()
+    shared_ptr<Matrix<ElemType>> m_flatValues;          // if not null: the value and the gradient are views into these, see BindToFlatBuffers()
+    shared_ptr<Matrix<ElemType>> m_flatGradients;
+    size_t m_flatOffset = 0;
+    size_t m_flatNumElements = 0;
 };
 
 // -----------------------------------------------------------------------
@@ -415,18 +574,40 @@ class LookupTableNode : public ComputationNode<ElemType>, public NumInputs<2>
 public:
     DeclareConstructorFromConfigWithNumInputs(LookupTableNode);
     LookupTableNode(DEVICEID_TYPE deviceId, const wstring& name)
-        : Base(deviceId, name)
+        : Base(deviceId, name), m_shardedNumColumns(0)
     {
     }
 
+    // When the embedding matrix is split across workers (ParameterShards in SGDLib), Input(0) holds only this worker's share of the columns.
+    // The columns a minibatch needs are then fetched from their owners into 'columns' before ForwardProp(), and BackpropTo() collects their
+    // gradients in 'gradients', which are sent back to the owners. Both are shared by all LookupTable nodes of the same parameter.
+    void SetSharded(size_t numColumns, const shared_ptr<Matrix<ElemType>>& columns, const shared_ptr<Matrix<ElemType>>& gradients)
+    {
+        m_shardedNumColumns = numColumns;
+        m_shardColumns = columns;
+        m_shardGradients = gradients;
+        m_columnOfSample = numColumns > 0 ? make_shared<Matrix<ElemType>>(m_deviceId) : nullptr;
+    }
+    bool IsSharded() const { return m_shardedNumColumns > 0; }
+    // for each sample of the minibatch, its column in the fetched columns, or -1 for gaps (a row vector)
+    Matrix<ElemType>& ShardColumnOfSample() { return *m_columnOfSample; }
+
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& t) override
     {
-        if (inputIndex == 0) // left derivative (embedding matrix)
+        if (inputIndex == 0 && IsSharded()) // (Input(0)'s own gradient is filled in by ParameterShards from what the workers send)
+        {
+            m_shardGradients->DoScatterColumnsOf(1, DataFor(*m_columnOfSample, t), GradientFor(t), 1);
+        }
+        else if (inputIndex == 0) // left derivative (embedding matrix)
         {
             // This is a reduction operation, hence we need to mask out gaps.
             Matrix<ElemType> sliceInput1Value = Input(1)->MaskedValueFor(t);
             Matrix<ElemType> sliceOutputGrad = MaskedGradientFor(t);
 
+            // with sparse inputs, the gradient only has values in the columns of the words seen in this minibatch
+            if (HasSparseGradient() && Input(0)->Gradient().GetMatrixType() == DENSE)
+                Input(0)->Gradient().SwitchToMatrixType(SPARSE, MatrixFormat::matrixFormatSparseBlockCol, false);
+
             BackpropToLeft(sliceInput1Value, Input(0)->GradientAsMatrix(), sliceOutputGrad);
         }
         else if (inputIndex == 1) // right derivative (input)
@@ -468,10 +649,35 @@ public:
         gradientValues.Reshape(rowsp, colsp);
     }
 
+    virtual void AllocateGradientMatricesForInputs(MatrixPool& matrixPool) override
+    {
+        // like TimesNode, we allocate the sparse gradient of the embedding directly instead of from the pool
+        if (Input(0)->NeedGradient() && HasSparseGradient())
+        {
+            Input(0)->CreateGradientMatrixIfNull();
+            Input(0)->Gradient().SwitchToMatrixType(SPARSE, MatrixFormat::matrixFormatSparseBlockCol, false);
+        }
+
+        Base::AllocateGradientMatricesForInputs(matrixPool);
+    }
+
+    // The gradient of the embedding matrix is row-sparse (in its layout: column-sparse) if the input is sparse with one word per sample,
+    // so that SGD only updates the embeddings of the words seen in the minibatch, and gradient aggregation only exchanges those.
+    // (Several words per sample would require reshaping the sparse input, which is not supported.)
+    bool HasSparseGradient() const
+    {
+        return !IsSharded() && Input(1)->Value().GetMatrixType() == SPARSE && Input(1)->GetSampleMatrixNumRows() == Input(0)->GetAsMatrixNumCols();
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& t) override
     {
         // input0 is the weight (each column is an embedding of one word), input 1 contains m_bnrLooked words in each column (sample)
         Matrix<ElemType> functionValues = ValueFor(t);
+        if (IsSharded()) // (one word per sample)
+        {
+            functionValues.DoGatherColumnsOf(0, DataFor(*m_columnOfSample, t), *m_shardColumns, 1);
+            return;
+        }
         const Matrix<ElemType>& input0 = Input(0)->ValueAsMatrix();
         Matrix<ElemType> input1 = Input(1)->ValueFor(t);
 
@@ -496,10 +702,11 @@ public:
 
         if (isFinalValidationPass && !HasMBLayout())
             InvalidArgument("%ls %ls operation can only operate on minibatches.", NodeName().c_str(), OperationName().c_str());
-        if (isFinalValidationPass && Input(1)->GetSampleMatrixNumRows() % Input(0)->GetAsMatrixNumCols() != 0)
+        const size_t vocabularySize = IsSharded() ? m_shardedNumColumns : Input(0)->GetAsMatrixNumCols();
+        if (isFinalValidationPass && Input(1)->GetSampleMatrixNumRows() % vocabularySize != 0)
             InvalidArgument("Mismatched dimension. Rows in input1 must be multiples of cols in input0.");
 
-        size_t wordsInEachSample = Input(1)->GetSampleMatrixNumRows() / Input(0)->GetAsMatrixNumCols() /*note: can never be 0*/;
+        size_t wordsInEachSample = Input(1)->GetSampleMatrixNumRows() / vocabularySize /*note: can never be 0*/;
 
         // TODO: Should this add a tensor dimension?
         SetDims(TensorShape(Input(0)->GetAsMatrixNumRows() * wordsInEachSample), true);
@@ -569,6 +776,11 @@ public:
         fprintf(stderr, "LookupTableNode unit test passed!\n");
         return true;
     }
+
+private:
+    size_t m_shardedNumColumns; // 0 unless sharded
+    shared_ptr<Matrix<ElemType>> m_shardColumns, m_shardGradients;
+    shared_ptr<Matrix<ElemType>> m_columnOfSample;
 };
 
 template class LookupTableNode<float>;
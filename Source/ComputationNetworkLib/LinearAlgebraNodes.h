@@ -9,6 +9,8 @@
 #include "ConvolutionalNodes.h"
 #include "Matrix.h"
 #include "TensorView.h"
+#include "Int8QuantizedMatrix.h"
+#include "PackedWeightMatrix.h"
 
 #include <unordered_set>
 #include <map>
@@ -28,7 +30,7 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 // -----------------------------------------------------------------------
 
 template <class ElemType>
-class PlusNode : public BinaryElementWiseNode<ElemType>
+class PlusNode : public BinaryElementWiseNode<ElemType>, public IFusableElementwiseNode
 {
     typedef BinaryElementWiseNode<ElemType> Base;
     UsingBinaryElementwiseNodeBaseMembers;
@@ -57,6 +59,22 @@ public:
         inputGradient.AddCopyOf(gradient);
     }
 
+    virtual bool /*ComputationNodeBase::*/ IsValueRecomputable() const override
+    {
+        return true;
+    }
+
+    // (if the shapes match, i.e. not in place of a broadcast input such as a bias)
+    virtual bool /*ComputationNodeBase::*/ CanComputeValueInPlaceOfInput(size_t /*i*/) const override
+    {
+        return true;
+    }
+
+    virtual ElementWiseOperator /*IFusableElementwiseNode::*/ GetForwardOpCode() const override
+    {
+        return opSum;
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
         // static int c = 0; if (c++ == 0) { fprintf(stderr, "#PLUS#\n"); }
@@ -106,6 +124,16 @@ public:
         inputGradient.AddCopyOf(gradient, sign);
     }
 
+    virtual bool /*ComputationNodeBase::*/ IsValueRecomputable() const override
+    {
+        return true;
+    }
+
+    virtual bool /*ComputationNodeBase::*/ CanComputeValueInPlaceOfInput(size_t /*i*/) const override
+    {
+        return true;
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
         size_t rank = DetermineElementwiseTensorRank();
@@ -195,6 +223,9 @@ public:
 
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
     {
+        if (SkipsGaps(fr) && m_compactGradient)
+            return BackpropToValidColumns(inputIndex);
+
         if (inputIndex == 0) // left derivative
         {
             // this potentially computes inner products over time, so we use the Masked- variants
@@ -228,6 +259,17 @@ public:
         return false;
     }
 
+    virtual bool /*ComputationNodeBase::*/ IsValueRecomputable() const override
+    {
+        return true;
+    }
+
+    // (gathering the valid columns, SkipsGaps(), only applies to the entire minibatch)
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override
+    {
+        return true;
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
         // right operand and output can have MB layout, while left operand cannot
@@ -236,8 +278,21 @@ public:
 #if DUMPOUTPUT
         Input(0)->ValueAsMatrix().Print("TimesNode - Input0");
 #endif
+        // multiply only the valid columns into a compact matrix, which is then scattered into the output with gaps set to 0
+        const bool skipGaps = SkipsGaps(fr) && m_compactInput;
+        Matrix<ElemType>& input1 = skipGaps ? m_compactInput->DoGatherColumnsOf(0, ValidColumnIndices(), sliceInput1Value, 1) : sliceInput1Value;
+        Matrix<ElemType>& output = skipGaps ? *m_compactOutput : sliceOutputValue;
         // BUGBUG: This uses correct Matrix dimensions when multiplying with a non-minibatch only by luck. To be fixed when we allow to apply TimesNode to a subset of tensor dimensions.
-        sliceOutputValue.AssignProductOf(Input(0)->ValueAsMatrix(), m_transpose, sliceInput1Value, false);
+        if (m_int8Weights && input1.GetMatrixType() == DENSE && input1.GetDeviceId() == CPUDEVICE)
+            m_int8Weights->Multiply(input1, output);
+        else if (m_packedWeights && input1.GetMatrixType() == DENSE && input1.GetDeviceId() == CPUDEVICE && input1.GetNumCols() <= PackedWeightMatrix<ElemType>::MaxColumns)
+            m_packedWeights->Multiply(input1, output);
+        else if (m_sparseWeights && input1.GetMatrixType() == DENSE)
+            output.AssignProductOf(*m_sparseWeights, !m_transpose, input1, false); // (the sparse copy is of the transposed weights)
+        else
+            output.AssignProductOf(Input(0)->ValueAsMatrix(), m_transpose, input1, false);
+        if (skipGaps)
+            sliceOutputValue.DoScatterColumnsOf(0, ValidColumnIndices(), output, 1);
 #if NANCHECK
         sliceOutputValue.HasNan("Times");
 #endif
@@ -300,6 +355,165 @@ public:
         // so that the default allocator will not allocate it again.
         Base::AllocateGradientMatricesForInputs(matrixPool);
     }
+
+    // the compact matrices for skipping gaps, if it may happen at all
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        if (MaySkipGaps())
+        {
+            RequestMatrixFromPool(m_compactInput, matrixPool);
+            RequestMatrixFromPool(m_compactOutput, matrixPool);
+        }
+    }
+
+    virtual void ReleaseMatricesAfterForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterForwardProp(matrixPool);
+        if (MaySkipGaps() && m_compactInput != nullptr)
+        {
+            ReleaseMatrixToPool(m_compactInput, matrixPool);
+            ReleaseMatrixToPool(m_compactOutput, matrixPool);
+        }
+    }
+
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        if (MaySkipGaps())
+        {
+            RequestMatrixFromPool(m_compactGradient, matrixPool);
+            RequestMatrixFromPool(m_compactBackpropTemp, matrixPool);
+        }
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        if (MaySkipGaps() && m_compactGradient != nullptr)
+        {
+            ReleaseMatrixToPool(m_compactGradient, matrixPool);
+            ReleaseMatrixToPool(m_compactBackpropTemp, matrixPool);
+        }
+    }
+
+    // for inference: compute the product with an int8 copy of the weights (see Int8QuantizedMatrix)
+    // This is only possible for non-transposed, dense weights on the CPU. Returns false if it is not possible.
+    // The copy is taken now, so this must not be used while the weights are being trained.
+    bool QuantizeWeightsToInt8()
+    {
+        bool transpose = m_transpose;
+        if (transpose || Input(0)->OperationName() != OperationNameOf(LearnableParameter))
+            return false;
+        const auto& weights = Input(0)->ValueAsMatrix();
+        if (weights.GetMatrixType() != DENSE || weights.GetDeviceId() != CPUDEVICE)
+            return false;
+        m_int8Weights = make_shared<Int8QuantizedMatrix<ElemType>>(weights);
+        return true;
+    }
+
+    // for inference: compute products with few columns (e.g. of a single frame) with a prepacked copy of the weights (see PackedWeightMatrix)
+    // This is only possible for dense weights on the CPU. Returns false if it is not possible. As for QuantizeWeightsToInt8(), the copy is taken now.
+    bool PackWeightsForSmallBatches()
+    {
+        if (Input(0)->OperationName() != OperationNameOf(LearnableParameter))
+            return false;
+        const auto& weights = Input(0)->ValueAsMatrix();
+        if (weights.GetMatrixType() != DENSE || weights.GetDeviceId() != CPUDEVICE)
+            return false;
+        m_packedWeights = make_shared<PackedWeightMatrix<ElemType>>(weights, m_transpose);
+        return true;
+    }
+
+    // for inference: compute the product with a sparse copy of the weights, e.g. of weights pruned in training (SGD option pruneSparsity)
+    // Returns false if less than 'minSparsity' of the weights are zero. As for QuantizeWeightsToInt8(), the copy is taken now.
+    bool SparsifyWeights(double minSparsity)
+    {
+        if (Input(0)->OperationName() != OperationNameOf(LearnableParameter))
+            return false;
+        const auto& weights = Input(0)->ValueAsMatrix();
+        if (weights.GetMatrixType() != DENSE)
+            return false;
+        const size_t numRows = weights.GetNumRows(), numCols = weights.GetNumCols();
+        std::vector<ElemType> values(numRows * numCols);
+        weights.CopySection(numRows, numCols, values.data(), numRows);
+
+        // The copy is the transpose in CSC format (i.e. the weights in CSR format), so that the rows of the product
+        // are inner products with contiguous rows of weights, and can be computed in parallel.
+        std::vector<CPUSPARSE_INDEX_TYPE> rowStarts(1, 0), colIndices;
+        std::vector<ElemType> nzValues;
+        for (size_t i = 0; i < numRows; i++)
+        {
+            for (size_t j = 0; j < numCols; j++)
+            {
+                const ElemType value = values[i + j * numRows];
+                if (value != 0)
+                {
+                    colIndices.push_back((CPUSPARSE_INDEX_TYPE) j);
+                    nzValues.push_back(value);
+                }
+            }
+            rowStarts.push_back((CPUSPARSE_INDEX_TYPE) nzValues.size());
+        }
+        if (nzValues.empty() || nzValues.size() > (1 - minSparsity) * values.size())
+            return false;
+        m_sparseWeights = make_shared<Matrix<ElemType>>(numCols, numRows, weights.GetDeviceId(), SPARSE, matrixFormatSparseCSC);
+        m_sparseWeights->SetMatrixFromCSCFormat(rowStarts.data(), colIndices.data(), nzValues.data(), nzValues.size(), numCols, numRows);
+        return true;
+    }
+
+    // use the int8, packed, and sparse weights of another copy of this node, if it has them (they are read-only)
+    void ShareInferenceWeightsWith(const TimesNodeBase& other)
+    {
+        m_int8Weights = other.m_int8Weights;
+        m_packedWeights = other.m_packedWeights;
+        m_sparseWeights = other.m_sparseWeights;
+    }
+
+private:
+    // Skipping gaps (see SkipsGapColumns()) needs dense input data. It is not done when recomputing the value in backprop,
+    // where the matrices of forward prop are no longer ours.
+    bool MaySkipGaps() const
+    {
+        return HasMBLayout() && !IsValueRecomputed();
+    }
+    bool SkipsGaps(const FrameRange& fr) const
+    {
+        return MaySkipGaps() && Input(1)->Value().GetMatrixType() == DENSE && SkipsGapColumns(GetMBLayout(), fr);
+    }
+    const Matrix<ElemType>& ValidColumnIndices() const
+    {
+        return GetMBLayout()->template GetValidColumnIndices<ElemType>(m_deviceId);
+    }
+
+    // the products of BackpropTo() on the valid columns only
+    void BackpropToValidColumns(const size_t inputIndex)
+    {
+        const auto& validColumnIndices = ValidColumnIndices();
+        m_compactGradient->DoGatherColumnsOf(0, validColumnIndices, Gradient(), 1);
+        if (inputIndex == 0) // left derivative: the gaps do not contribute to the inner products over time
+        {
+            auto& input0Grad = Input(0)->GradientAsMatrix();
+            m_compactBackpropTemp->DoGatherColumnsOf(0, validColumnIndices, Input(1)->Value(), 1);
+            bool transpose = m_transpose;
+            if (!transpose)
+                Matrix<ElemType>::MultiplyAndAdd(*m_compactGradient, false, *m_compactBackpropTemp, true, input0Grad);
+            else
+                Matrix<ElemType>::MultiplyAndAdd(*m_compactBackpropTemp, false, *m_compactGradient, true, input0Grad);
+        }
+        else // right derivative: the gaps of the input's gradient are left alone
+        {
+            m_compactBackpropTemp->AssignProductOf(Input(0)->ValueAsMatrix(), !m_transpose, *m_compactGradient, false);
+            Input(1)->Gradient().DoScatterColumnsOf(1, validColumnIndices, *m_compactBackpropTemp, 1);
+        }
+    }
+
+    shared_ptr<Int8QuantizedMatrix<ElemType>> m_int8Weights; // if not null, ForwardProp() uses this instead of Input(0)
+    shared_ptr<PackedWeightMatrix<ElemType>> m_packedWeights; // same, for inputs of at most PackedWeightMatrix::MaxColumns columns
+    shared_ptr<Matrix<ElemType>> m_sparseWeights;             // same, for the transpose of Input(0) as a sparse matrix
+
+    shared_ptr<Matrix<ElemType>> m_compactInput, m_compactOutput;          // forward prop: the valid columns of Input(1) and of the product
+    shared_ptr<Matrix<ElemType>> m_compactGradient, m_compactBackpropTemp; // backprop: the valid columns of our gradient, and of the other factor or the product
 };
 
 // -----------------------------------------------------------------------
@@ -360,7 +574,7 @@ template class TransposeTimesNode<double>;
 // -----------------------------------------------------------------------
 
 template <class ElemType>
-class ElementTimesNode : public BinaryElementWiseNode<ElemType>
+class ElementTimesNode : public BinaryElementWiseNode<ElemType>, public IFusableElementwiseNode
 {
     typedef BinaryElementWiseNode<ElemType> Base;
     UsingBinaryElementwiseNodeBaseMembers;
@@ -397,6 +611,16 @@ public:
         return true;
     }
 
+    virtual bool /*ComputationNodeBase::*/ IsValueRecomputable() const override
+    {
+        return true;
+    }
+
+    virtual ElementWiseOperator /*IFusableElementwiseNode::*/ GetForwardOpCode() const override
+    {
+        return opElementwiseProduct;
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
         size_t rank = DetermineElementwiseTensorRank();
@@ -779,41 +1003,17 @@ public:
 
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
     {
-        // functionValues, invNorm0, invNorm1 - output from the EvaluateNode() method
-        // temp, rightTerm, leftTerm - temporary matrices
-        if (inputIndex == 0) // left derivative
-            m_temp->AssignElementProductOf(*m_invNorm0, *m_invNorm0);
-        else // right derivative
-            m_temp->AssignElementProductOf(*m_invNorm1, *m_invNorm1);
-
-        m_temp->ElementMultiplyWith(ValueFor(fr));
-        m_rightTerm->SetValue(Input(inputIndex)->ValueFor(fr));
-        m_rightTerm->RowElementMultiplyWith(*m_temp);
-
-        m_temp->AssignElementProductOf(*m_invNorm0, *m_invNorm1);
-        m_leftTerm->SetValue(Input(1 - inputIndex)->ValueFor(fr));
-        m_leftTerm->RowElementMultiplyWith(*m_temp);
-
-        *m_leftTerm -= *m_rightTerm;
-        m_leftTerm->RowElementMultiplyWith(GradientFor(fr));
-        Input(inputIndex)->GradientFor(fr) += *m_leftTerm;
+        // invNorm0, invNorm1 - output from the ForwardProp() method
+        Matrix<ElemType> sliceInputGrad = Input(inputIndex)->GradientFor(fr);
+        Matrix<ElemType>::AddCosDistanceGradientWithShiftNeg(inputIndex, Input(0)->ValueFor(fr), Input(1)->ValueFor(fr), ValueFor(fr), GradientFor(fr),
+                                                             *m_invNorm0, *m_invNorm1, 0, 0, sliceInputGrad);
     }
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
-        Matrix<ElemType> sliceInput0Value = Input(0)->ValueFor(fr);
-        Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
         Matrix<ElemType> sliceOutputValue = ValueFor(fr);
-
-        m_invNorm0->AssignVectorNorm2Of(sliceInput0Value, true);
-        m_invNorm0->AssignElementInverseOf(*m_invNorm0);
-
-        m_invNorm1->AssignVectorNorm2Of(sliceInput1Value, true);
-        m_invNorm1->AssignElementInverseOf(*m_invNorm1);
-
-        sliceOutputValue.AssignInnerProductOf(sliceInput0Value, sliceInput1Value, true);
-        sliceOutputValue.ElementMultiplyWith(*m_invNorm0);
-        sliceOutputValue.ElementMultiplyWith(*m_invNorm1);
+        // one fused pass for the norms and the inner products (the plain case of the negative-samples version, with no negatives)
+        Matrix<ElemType>::CosDistanceWithShiftNeg(Input(0)->ValueFor(fr), Input(1)->ValueFor(fr), sliceOutputValue, *m_invNorm0, *m_invNorm1, 0, 0);
         // TODO: This formulation above allows to use the tensor lib for this, with automatic broadcasting.
     }
 
@@ -837,9 +1037,6 @@ public:
             auto node = dynamic_pointer_cast<CosDistanceNode<ElemType>>(nodeP);
             *node->m_invNorm0 = *m_invNorm0;
             *node->m_invNorm1 = *m_invNorm1;
-            *node->m_leftTerm = *m_leftTerm;
-            *node->m_rightTerm = *m_rightTerm;
-            *node->m_temp = *m_temp;
         }
     }
     // request matrices needed to do node function value evaluation
@@ -850,34 +1047,18 @@ public:
         RequestMatrixFromPool(m_invNorm1, matrixPool);
     }
 
-    // request matrices that are needed for gradient computation
-    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
-    {
-        Base::RequestMatricesBeforeBackprop(matrixPool);
-        RequestMatrixFromPool(m_leftTerm, matrixPool);
-        RequestMatrixFromPool(m_rightTerm, matrixPool);
-        RequestMatrixFromPool(m_temp, matrixPool);
-    }
-
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
     virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool)
     {
         Base::ReleaseMatricesAfterBackprop(matrixPool);
         ReleaseMatrixToPool(m_invNorm0, matrixPool);
         ReleaseMatrixToPool(m_invNorm1, matrixPool);
-        ReleaseMatrixToPool(m_leftTerm, matrixPool);
-        ReleaseMatrixToPool(m_rightTerm, matrixPool);
-        ReleaseMatrixToPool(m_temp, matrixPool);
     }
 
 private:
     // invNorm nodes tranfer data between ForwardProp and BackpropTo
     shared_ptr<Matrix<ElemType>> m_invNorm0;
     shared_ptr<Matrix<ElemType>> m_invNorm1;
-    // the rest are temporaries, values don't need to be maintained
-    shared_ptr<Matrix<ElemType>> m_leftTerm;
-    shared_ptr<Matrix<ElemType>> m_rightTerm;
-    shared_ptr<Matrix<ElemType>> m_temp;
 };
 
 template class CosDistanceNode<float>;
@@ -905,23 +1086,38 @@ public:
     {
     }
 
+    // Each output column is the outer product of the input columns, stored as a [rows0 x rows1] matrix.
+    // On the GPU, the output and both gradients have their own tiled kernels (AssignKhatriRaoProductOf(), AddColumnReshapeProductOf()).
+    // On the CPU, they are handled as a batch of one small GEMM per column. We view them
+    // as [rows0 x (rows1 * numCols)], i.e. numCols consecutive [rows0 x rows1] blocks.
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
     {
         Matrix<ElemType> sliceOutputGrad = GradientFor(fr);
+        if (sliceOutputGrad.GetDeviceId() != CPUDEVICE)
+        {
+            Matrix<ElemType> sliceInputGrad = Input(inputIndex)->GradientFor(fr);
+            if (inputIndex == 0) // left derivative
+                sliceInputGrad.AddColumnReshapeProductOf(sliceOutputGrad, Input(1)->ValueFor(fr), false);
+            else // right derivative
+                sliceInputGrad.AddColumnReshapeProductOf(sliceOutputGrad, Input(0)->ValueFor(fr), true);
+            return;
+        }
+        const size_t numCols = sliceOutputGrad.GetNumCols();
+        Matrix<ElemType> outputGradBlocks = sliceOutputGrad.Reshaped(Input(0)->GetSampleMatrixNumRows(), Input(1)->GetSampleMatrixNumRows() * numCols);
 
-        if (inputIndex == 0) // left derivative
+        if (inputIndex == 0) // left derivative: grad0_t += outputGrad_t * input1_t
         {
             Matrix<ElemType> sliceInput0Grad = Input(0)->GradientFor(fr);
             Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
 
-            sliceInput0Grad.AddColumnReshapeProductOf(sliceOutputGrad, sliceInput1Value, false);
+            Matrix<ElemType>::BatchMultiplyAndWeightedAdd(1, outputGradBlocks, false, sliceInput1Value, false, 1, sliceInput0Grad, numCols);
         }
-        else // right derivative
+        else // right derivative: grad1_t += outputGrad_t' * input0_t
         {
             Matrix<ElemType> sliceInput0Value = Input(0)->ValueFor(fr);
             Matrix<ElemType> sliceInput1Grad = Input(1)->GradientFor(fr);
 
-            sliceInput1Grad.AddColumnReshapeProductOf(sliceOutputGrad, sliceInput0Value, true);
+            Matrix<ElemType>::BatchMultiplyAndWeightedAdd(1, outputGradBlocks, true, sliceInput0Value, false, 1, sliceInput1Grad, numCols);
         }
     }
 
@@ -934,7 +1130,18 @@ public:
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
-        ValueFor(fr).AssignKhatriRaoProductOf(Input(0)->ValueFor(fr), Input(1)->ValueFor(fr));
+        // value_t = input0_t * input1_t'
+        Matrix<ElemType> sliceInput0Value = Input(0)->ValueFor(fr);
+        Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
+        if (sliceInput0Value.GetDeviceId() != CPUDEVICE)
+        {
+            Matrix<ElemType> sliceOutputValue = ValueFor(fr);
+            sliceOutputValue.AssignKhatriRaoProductOf(sliceInput0Value, sliceInput1Value);
+            return;
+        }
+        const size_t numCols = sliceInput0Value.GetNumCols();
+        Matrix<ElemType> outputBlocks = ValueFor(fr).Reshaped(sliceInput0Value.GetNumRows(), sliceInput1Value.GetNumRows() * numCols);
+        Matrix<ElemType>::BatchMultiplyAndWeightedAdd(1, sliceInput0Value, false, sliceInput1Value, true, 0, outputBlocks, numCols);
     }
 
     virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
@@ -981,149 +1188,24 @@ public:
     {
     }
 
+    // both directions are one fused pass each, see Matrix::CosDistanceWithShiftNeg()
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
     {
-        Matrix<ElemType> sliceInput0Value = Input(0)->ValueFor(fr);
-        Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
-        Matrix<ElemType> sliceOutputValue = ValueFor(fr);
+        // invNorm0, invNorm1 - output from the ForwardProp() method
         Matrix<ElemType> sliceInputGrad = Input(inputIndex)->GradientFor(fr);
-        Matrix<ElemType> sliceThisGrad = GradientFor(fr);
-
-        BackpropToS(inputIndex, *m_invNorm0, *m_invNorm1, sliceOutputValue, *m_temp, *m_rightTerm, *m_leftTerm, *m_invNormSquare, sliceInput0Value, sliceInput1Value, Input(2)->Value(), Input(3)->Value(), sliceInputGrad, sliceThisGrad);
-    }
-
-    // functionValues, invNorm0, invNorm1 - output from the EvaluateNode() method
-    // temp, rightTerm, leftTerm - temporary matrices
-    // in0, in1, in2, in3 - input functionValues from other nodes
-    // inputGradientValues(x) - gradients to update, where x matches inputIndex
-    /*TODO: merge with call site*/ void BackpropToS(const size_t inputIndex, const Matrix<ElemType>& invNorm0, const Matrix<ElemType>& invNorm1, const Matrix<ElemType>& functionValues,
-                                                    Matrix<ElemType>& temp, Matrix<ElemType>& rightTerm, Matrix<ElemType>& leftTerm, Matrix<ElemType>& invNormSquare, // the temporary variables
-                                                    const Matrix<ElemType>& in0, const Matrix<ElemType>& in1, const Matrix<ElemType>& in2, const Matrix<ElemType>& in3,
-                                                    Matrix<ElemType>& inputGradientValues, Matrix<ElemType>& thisGradientValues)
-    {
-        size_t shift = (size_t) in2.Get00Element();
-        size_t negNumber = (size_t) in3.Get00Element();
-        size_t numCols = in0.GetNumCols(); // used in computing right child's graident
-
-        if (inputIndex == 0) // left derivative
-        {
-            invNormSquare.AssignElementProductOf(invNorm0, invNorm0);
-
-            for (long m = 0; m < negNumber + 1; m++)
-            {
-                temp.GetARowByIndex(functionValues, m); // set this matrx to be the m-th row in functionValues
-                temp.ElementMultiplyWith(invNormSquare);
-
-                Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in0, rightTerm, 0, true);
-
-                if (m == 0)
-                {
-                    temp.AssignElementProductOf(invNorm0, invNorm1);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in1, leftTerm, 0, true);
-                }
-                else
-                {
-                    size_t currshift = m + shift - 1; // for current line, how much should we shift
-
-                    temp.AssignElementProductOfWithShift(invNorm0, invNorm1, currshift); // this is a row vector
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in1, leftTerm, currshift, true);
-                }
-
-                leftTerm = leftTerm - rightTerm;
-
-                temp.GetARowByIndex(thisGradientValues, m);
-
-                Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, leftTerm, rightTerm, 0, true);
-
-                inputGradientValues += rightTerm;
-            }
-        }
-        else // right part
-        {
-            invNormSquare.AssignElementProductOf(invNorm1, invNorm1); // this matrix should be save and unchanged. It should not be changed
-
-            for (long m = 0; m < negNumber + 1; m++)
-            {
-                temp.GetARowByIndex(functionValues, m); // set this matrx to be the m-th row in functionValues
-
-                if (m == 0) // this is the first line. computation should be symmetric
-                {
-                    // the following is for the right part
-                    temp.ElementMultiplyWith(invNormSquare);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in1, rightTerm, 0, true);
-
-                    // the following is for the left part
-                    temp.AssignElementProductOf(invNorm0, invNorm1);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in0, leftTerm, 0, true);
-
-                    leftTerm = leftTerm - rightTerm;
-
-                    temp.GetARowByIndex(thisGradientValues, m);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, leftTerm, rightTerm, 0, true);
-
-                    inputGradientValues += rightTerm;
-                }
-                else // this requires shift
-                {
-                    size_t currshift = (m + shift - 1) % numCols;
-                    size_t reverseshift = numCols - currshift;
-
-                    leftTerm.AssignElementProductOfWithShift(invNormSquare, temp, reverseshift); // use leftTerm as a temp variable here
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(leftTerm, in1, rightTerm, 0, true);
-
-                    temp.AssignElementProductOfWithShift(invNorm1, invNorm0, reverseshift);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, in0, leftTerm, reverseshift, true);
-
-                    leftTerm = leftTerm - rightTerm;
-
-                    temp.GetARowByIndex(thisGradientValues, m);
-
-                    Matrix<ElemType>::ConductRowElementMultiplyWithShift(temp, leftTerm, rightTerm, reverseshift, false);
-
-                    inputGradientValues += rightTerm;
-                }
-            }
-        }
+        size_t shift = (size_t) Input(2)->Get00Element();
+        size_t negNumber = (size_t) Input(3)->Get00Element();
+        Matrix<ElemType>::AddCosDistanceGradientWithShiftNeg(inputIndex, Input(0)->ValueFor(fr), Input(1)->ValueFor(fr), ValueFor(fr), GradientFor(fr),
+                                                             *m_invNorm0, *m_invNorm1, shift, negNumber, sliceInputGrad);
     }
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
-        Matrix<ElemType> sliceInput0Value = Input(0)->ValueFor(fr);
-        Matrix<ElemType> sliceInput1Value = Input(1)->ValueFor(fr);
         Matrix<ElemType> sliceOutputValue = ValueFor(fr);
-
-        ForwardPropS(*m_invNorm0, *m_invNorm1, sliceOutputValue, sliceInput0Value, sliceInput1Value, Input(2)->Value(), Input(3)->Value(), *m_leftTerm, *m_rightTerm);
-    }
-
-    /*TODO: merge with call site*/ void ForwardPropS(Matrix<ElemType>& invNorm0, Matrix<ElemType>& invNorm1, Matrix<ElemType>& functionValues, Matrix<ElemType>& in0, Matrix<ElemType>& in1, Matrix<ElemType>& in2, Matrix<ElemType>& in3, Matrix<ElemType>& leftTermTemp, Matrix<ElemType>& rightTermTemp)
-    {
-        invNorm0.AssignVectorNorm2Of(in0, true); // seems to modify input (in0)
-        invNorm0.AssignElementInverseOf(invNorm0);
-
-        invNorm1.AssignVectorNorm2Of(in1, true); // seems to modify the input (in1)
-        invNorm1.AssignElementInverseOf(invNorm1);
-
-        size_t shift = (size_t) in2.Get00Element();
-        size_t negNumber = (size_t) in3.Get00Element();
-
-        // mutiply invNorm0 and invNorm1 with shift and neg.
-        // The result is a matrix of (numberneg+1, invNorm0.Cols)
-        leftTermTemp.AssignElementProductOfWithShiftNeg(invNorm0, invNorm1, shift, negNumber);
-
-        // compute the right values
-        // Again, the ouput is a matrix of (negNumber+1, invNorm0.cols)
-        rightTermTemp.AssignInnerProductOfWithShiftNeg(in0, in1, true, shift, negNumber);
-
-        // compute the evaluation result matrix by multiply these two matrices, element by element
-        // we get a (negNumber+1, n) matrix
-        functionValues.AssignElementProductOf(leftTermTemp, rightTermTemp);
+        size_t shift = (size_t) Input(2)->Get00Element();
+        size_t negNumber = (size_t) Input(3)->Get00Element();
+        // the result is a matrix of (negNumber+1, numCols)
+        Matrix<ElemType>::CosDistanceWithShiftNeg(Input(0)->ValueFor(fr), Input(1)->ValueFor(fr), sliceOutputValue, *m_invNorm0, *m_invNorm1, shift, negNumber);
     }
 
     virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
@@ -1154,10 +1236,6 @@ public:
             auto node = dynamic_pointer_cast<CosDistanceWithNegativeSamplesNode<ElemType>>(nodeP);
             *node->m_invNorm0 = *m_invNorm0;
             *node->m_invNorm1 = *m_invNorm1;
-            *node->m_invNormSquare = *m_invNormSquare;
-            *node->m_leftTerm = *m_leftTerm;
-            *node->m_rightTerm = *m_rightTerm;
-            *node->m_temp = *m_temp;
         }
     }
     // request matrices needed to do node function value evaluation
@@ -1166,16 +1244,6 @@ public:
         Base::RequestMatricesBeforeForwardProp(matrixPool);
         RequestMatrixFromPool(m_invNorm0, matrixPool);
         RequestMatrixFromPool(m_invNorm1, matrixPool);
-        RequestMatrixFromPool(m_leftTerm, matrixPool);
-        RequestMatrixFromPool(m_rightTerm, matrixPool);
-    }
-
-    // request matrices that are needed for gradient computation
-    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
-    {
-        Base::RequestMatricesBeforeBackprop(matrixPool);
-        RequestMatrixFromPool(m_invNormSquare, matrixPool);
-        RequestMatrixFromPool(m_temp, matrixPool);
     }
 
     // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
@@ -1184,21 +1252,12 @@ public:
         Base::ReleaseMatricesAfterBackprop(matrixPool);
         ReleaseMatrixToPool(m_invNorm0, matrixPool);
         ReleaseMatrixToPool(m_invNorm1, matrixPool);
-        ReleaseMatrixToPool(m_leftTerm, matrixPool);
-        ReleaseMatrixToPool(m_rightTerm, matrixPool);
-        ReleaseMatrixToPool(m_invNormSquare, matrixPool);
-        ReleaseMatrixToPool(m_temp, matrixPool);
     }
 
 private:
     // invNorm nodes tranfer data between ForwardProp and BackpropTo
     shared_ptr<Matrix<ElemType>> m_invNorm0;
     shared_ptr<Matrix<ElemType>> m_invNorm1;
-    shared_ptr<Matrix<ElemType>> m_leftTerm;
-    shared_ptr<Matrix<ElemType>> m_rightTerm;
-    // the rest are temporaries, values don't need to be maintained
-    shared_ptr<Matrix<ElemType>> m_invNormSquare;
-    shared_ptr<Matrix<ElemType>> m_temp;
 };
 
 template class CosDistanceWithNegativeSamplesNode<float>;
@@ -8,6 +8,7 @@
 #include <string>
 #include <stdexcept>
 #include <vector>
+#include <map>
 #include <algorithm>
 #include <stdlib.h>
 
@@ -17,52 +18,232 @@
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// MatrixPool -- plans the sharing of node value/gradient/temp matrices
+//
+// AllocateAllMatrices() simulates the forward and backward traversal order and calls
+// Request() when a matrix becomes live and Release() when its last consumer has run.
+// Each pooled matrix remembers the largest size any of its users has asked for (its
+// 'planned size', in elements per sample for minibatch data, in elements otherwise).
+// Request() hands back the best-fitting released matrix on the same device, i.e. the
+// smallest one that is at least as large as requested, or, if none is large enough,
+// the largest one (so that it needs to grow the least). Since matrices only ever grow
+// (Resize() with growOnly), this puts each buffer's users into one size class, so that
+// buffers reach their final size in the first minibatch, and keeps the peak footprint
+// close to the sum of the live sizes instead of the sum of the maxima across LIFO chains.
+//
+// Workspaces, the scratch memory that engines such as cuDNN only use inside a node's
+// ForwardProp() or BackpropTo() call, are not planned like that: RequestWorkspace() hands
+// all nodes on a device the same matrix, which grows to the largest size any of them needs.
+// So workspace memory no longer adds up over the layers, and the per-layer limit
+// (e.g. maxTempMemSizeInSamples) can be raised for faster algorithms at the cost of one layer only.
+// This requires that nodes compute one at a time; with concurrentStreams, AllocateAllMatrices()
+// turns it off, and workspaces are pooled like all other matrices.
+// -----------------------------------------------------------------------
+
 class MatrixPool
 {
-    vector<shared_ptr<Matrix<float>>> m_releasedFloatMatrices;
-    vector<shared_ptr<Matrix<double>>> m_releasedDoubleMatrices;
+    template <class ElemType>
+    struct PooledMatrix
+    {
+        shared_ptr<Matrix<ElemType>> m_matrix;
+        size_t m_plannedSize; // largest size requested by any user of this matrix so far
+    };
+
+    vector<PooledMatrix<float>> m_releasedFloatMatrices;
+    vector<PooledMatrix<double>> m_releasedDoubleMatrices;
 
     template <class ElemType>
-    vector<shared_ptr<Matrix<ElemType>>>& GetReleasedMatrices();
+    vector<PooledMatrix<ElemType>>& GetReleasedMatrices();
+
+    // the shared workspace of each device
+    map<DEVICEID_TYPE, shared_ptr<Matrix<float>>> m_floatWorkspaces;
+    map<DEVICEID_TYPE, shared_ptr<Matrix<double>>> m_doubleWorkspaces;
+    bool m_shareWorkspaces;
+
+    template <class ElemType>
+    map<DEVICEID_TYPE, shared_ptr<Matrix<ElemType>>>& GetWorkspaces();
+
+    // planned size of every matrix handed out by this pool in the current planning run, for both precisions
+    // (keyed by the Matrix object, which its users keep alive; cleared by BeginPlanning(), so keys of deleted matrices cannot be reused)
+    map<const void*, size_t> m_plannedSizes;
 
 public:
+    // the memory a matrix handed out by this pool will take: the largest request of any of its users, separately for
+    // minibatch data (which scales with the number of minibatch columns) and for the others, see GetMatrixPlans()
+    struct MatrixPlan
+    {
+        DEVICEID_TYPE m_deviceId;
+        size_t m_elementSize;
+        size_t m_elementsPerColumn;
+        size_t m_elements;
+
+        size_t GetBytes(size_t numColumns) const
+        {
+            return m_elementSize * max(m_elementsPerColumn * numColumns, m_elements);
+        }
+    };
+
+private:
+    map<const void*, MatrixPlan> m_matrixPlans;
+
+    // statistics over the planning run
+    size_t m_numRequests;
+    size_t m_numMatricesCreated;
+    size_t m_totalRequestedSize; // sum over all requests, i.e. what we would need without sharing
+    bool m_statisticsPrinted;
+
+    // record the plan of a matrix for a request of 'requestedSize' (see Request())
+    template <class ElemType>
+    void AddToPlan(const shared_ptr<Matrix<ElemType>>& matrixPtr, size_t requestedSize, bool isMinibatchData)
+    {
+        size_t& plannedSize = m_plannedSizes[matrixPtr.get()];
+        plannedSize = max(plannedSize, requestedSize);
+        auto plan = m_matrixPlans.insert(make_pair(matrixPtr.get(), MatrixPlan{matrixPtr->GetDeviceId(), sizeof(ElemType), 0, 0})).first;
+        size_t& plannedElements = isMinibatchData ? plan->second.m_elementsPerColumn : plan->second.m_elements;
+        plannedElements = max(plannedElements, requestedSize);
+
+        m_numRequests++;
+        m_totalRequestedSize += requestedSize;
+    }
+
+public:
+    MatrixPool()
+        : m_shareWorkspaces(true), m_statisticsPrinted(false)
+    {
+        BeginPlanning();
+    }
+
+    void SetShareWorkspaces(bool share)
+    {
+        m_shareWorkspaces = share;
+    }
+
+    // the workspace matrix for a node on 'deviceId': the device's shared one, or (if not shared) a pooled one
+    template <class ElemType>
+    shared_ptr<Matrix<ElemType>> RequestWorkspace(DEVICEID_TYPE deviceId)
+    {
+        if (!m_shareWorkspaces)
+            return Request<ElemType>(deviceId);
+        auto& workspace = GetWorkspaces<ElemType>()[deviceId];
+        if (!workspace)
+            workspace = make_shared<Matrix<ElemType>>(deviceId);
+        return workspace;
+    }
+
+    // a shared workspace stays with the pool, a pooled one is released
+    template <class ElemType>
+    void ReleaseWorkspace(shared_ptr<Matrix<ElemType>> workspace)
+    {
+        const auto& workspaces = GetWorkspaces<ElemType>();
+        auto iter = workspaces.find(workspace->GetDeviceId());
+        if (iter == workspaces.end() || iter->second != workspace)
+            Release<ElemType>(workspace);
+    }
+
+    // start planning (again): forget the plans and statistics of the previous run
+    // Matrices that users keep from it are planned again through Keep().
+    void BeginPlanning()
+    {
+        m_plannedSizes.clear();
+        m_matrixPlans.clear();
+        m_numRequests = 0;
+        m_numMatricesCreated = 0;
+        m_totalRequestedSize = 0;
+    }
+
     // release here means the matrix can be put back and shared by others
     template <class ElemType>
     void Release(shared_ptr<Matrix<ElemType>> freeMatrix)
     {
-        vector<shared_ptr<Matrix<ElemType>>>& releasedMatrices = GetReleasedMatrices<ElemType>();
+        vector<PooledMatrix<ElemType>>& releasedMatrices = GetReleasedMatrices<ElemType>();
         if (freeMatrix == nullptr || freeMatrix->GetMatrixType() == SPARSE)
             RuntimeError("MatrixPool::Release: freeMatrix should not be null or sparse.");
-#ifdef _DEBUG
-        for (int i = 0; i < releasedMatrices.size(); i++)
+        // a network that is planned again releases the matrices its nodes kept from before; each must be listed only once,
+        // since it could otherwise be handed to two users at the same time (by a pool shared with other networks, see ComputationNetwork::SetMatrixPool())
+        for (const auto& released : releasedMatrices)
         {
-            if (releasedMatrices[i] == freeMatrix)
-                RuntimeError("MatrixPool::Release: freeMatrix is already in the released pool.");
+            if (released.m_matrix == freeMatrix)
+                return;
         }
-
-#endif
-        releasedMatrices.push_back(freeMatrix);
+        // matrices that did not come from this pool (e.g. created through CreateMatrixIfNull()) have no plan yet
+        auto iter = m_plannedSizes.find(freeMatrix.get());
+        size_t plannedSize = (iter != m_plannedSizes.end()) ? iter->second : 0;
+        releasedMatrices.push_back(PooledMatrix<ElemType>{freeMatrix, plannedSize});
     }
 
+    // 'requestedSize' is the size of the matrix the user is going to need, in elements per sample for minibatch data
+    // (use the node's GetSampleMatrixNumRows(), and pass isMinibatchData), or in elements otherwise. Pass 0 if not known.
     template <class ElemType>
-    shared_ptr<Matrix<ElemType>> Request(DEVICEID_TYPE deviceId)
+    shared_ptr<Matrix<ElemType>> Request(DEVICEID_TYPE deviceId, size_t requestedSize = 0, bool isMinibatchData = false)
     {
-        vector<shared_ptr<Matrix<ElemType>>>& releasedMatrices = GetReleasedMatrices<ElemType>();
+        vector<PooledMatrix<ElemType>>& releasedMatrices = GetReleasedMatrices<ElemType>();
+
+        // best fit: smallest matrix that is large enough, otherwise the largest one
+        const size_t none = SIZE_MAX;
+        size_t bestFit = none, largest = none;
+        for (size_t i = 0; i < releasedMatrices.size(); i++)
+        {
+            const auto& candidate = releasedMatrices[i];
+            if (candidate.m_matrix->GetDeviceId() != deviceId)
+                continue;
+            if (candidate.m_plannedSize >= requestedSize && (bestFit == none || candidate.m_plannedSize < releasedMatrices[bestFit].m_plannedSize))
+                bestFit = i;
+            if (largest == none || candidate.m_plannedSize > releasedMatrices[largest].m_plannedSize)
+                largest = i;
+        }
+        size_t chosen = (bestFit != none) ? bestFit : largest;
+
         shared_ptr<Matrix<ElemType>> matrixPtr;
-        if (releasedMatrices.empty())
+        if (chosen == none)
         {
             matrixPtr = make_shared<Matrix<ElemType>>(deviceId);
+            m_numMatricesCreated++;
         }
         else
         {
-            matrixPtr = releasedMatrices.back();
-            releasedMatrices.pop_back();
+            matrixPtr = releasedMatrices[chosen].m_matrix;
+            releasedMatrices.erase(releasedMatrices.begin() + chosen);
         }
 
         if (!matrixPtr) // this can't really happen
             LogicError("MatrixPool::Request: failed to get a valid matrix.");
 
+        AddToPlan(matrixPtr, requestedSize, isMinibatchData);
         return matrixPtr;
     }
+
+    // a matrix that its user kept from a previous planning run, instead of requesting one; it is planned as if requested anew
+    template <class ElemType>
+    void Keep(const shared_ptr<Matrix<ElemType>>& matrixPtr, size_t requestedSize = 0, bool isMinibatchData = false)
+    {
+        AddToPlan(matrixPtr, requestedSize, isMinibatchData);
+    }
+
+    // the plans of all matrices handed out by this pool, keyed by the Matrix object
+    // Since the matrices are only allocated by the first minibatch, this tells ahead of time what they will take.
+    const map<const void*, MatrixPlan>& GetMatrixPlans() const
+    {
+        return m_matrixPlans;
+    }
+
+    // sum of the planned sizes of all matrices created by this pool
+    size_t GetPlannedSize() const
+    {
+        size_t total = 0;
+        for (const auto& entry : m_plannedSizes)
+            total += entry.second;
+        return total;
+    }
+
+    // (only for the first planning run; networks are planned again, e.g. for each evaluation, with the same result)
+    void PrintStatistics()
+    {
+        if (m_statisticsPrinted)
+            return;
+        m_statisticsPrinted = true;
+        fprintf(stderr, "MatrixPool: %d requests served by %d shared matrices; planned size %llu elements (%llu without sharing).\n",
+                (int) m_numRequests, (int) m_numMatricesCreated, (unsigned long long) GetPlannedSize(), (unsigned long long) m_totalRequestedSize);
+    }
 };
 } } }
@@ -0,0 +1,166 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NodeProfiler.cpp -- per-node forward/backward time, memory and FLOP estimates
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "NodeProfiler.h"
+#include "LinearAlgebraNodes.h"
+#include "fileutil.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+NodeProfiler* NodeProfiler::s_current = nullptr;
+
+NodeProfiler::NodeProfiler()
+    : m_numPasses(0)
+{
+    if (s_current)
+        LogicError("NodeProfiler: Only one profiler can be active at a time.");
+    s_current = this;
+}
+
+NodeProfiler::~NodeProfiler()
+{
+    s_current = nullptr;
+}
+
+NodeProfiler::Entry* NodeProfiler::Begin(const ComputationNodeBasePtr& node, Direction direction)
+{
+    Entry* entry;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto& mappedEntry = m_entryMap[node.get()];
+        if (!mappedEntry)
+        {
+            m_entries.push_back(unique_ptr<Entry>(new Entry()));
+            mappedEntry = m_entries.back().get();
+            mappedEntry->node = node;
+            mappedEntry->elementSize = dynamic_pointer_cast<ComputationNode<float>>(node) ? sizeof(float) : sizeof(double);
+            for (int d = forward; d <= backward; d++)
+            {
+                mappedEntry->timers[d].reset(new DeviceTimer(node->GetDeviceId()));
+                mappedEntry->ranInPass[d] = false;
+                mappedEntry->numPasses[d] = 0;
+                mappedEntry->seconds[d] = 0;
+                mappedEntry->lastSeconds[d] = 0;
+                mappedEntry->flops[d] = 0;
+            }
+            mappedEntry->peakOutputBytes = 0;
+        }
+        entry = mappedEntry;
+    }
+    entry->ranInPass[direction] = true;
+    entry->timers[direction]->Start();
+    return entry;
+}
+
+// operations in one ForwardProp() over the whole minibatch: exact for matrix products, else one per output element
+// Backprop() is counted as twice that (a matrix product computes the gradients of both inputs).
+static double EstimateForwardFlops(const ComputationNodeBase& node)
+{
+    const double numOutputElements = (double) node.GetSampleMatrixNumRows() * node.GetSampleMatrixNumCols();
+    const wstring operation = node.OperationName();
+    if ((operation == OperationNameOf(TimesNode) || operation == OperationNameOf(TransposeTimesNode)) && node.GetNumInputs() == 2)
+        return 2 * numOutputElements * node.GetInputs()[1]->GetSampleMatrixNumRows();
+    return numOutputElements;
+}
+
+void NodeProfiler::EndPass()
+{
+    for (auto& entry : m_entries)
+    {
+        for (int d = forward; d <= backward; d++)
+        {
+            entry->lastSeconds[d] = 0;
+            if (!entry->ranInPass[d])
+                continue;
+            entry->ranInPass[d] = false;
+            entry->lastSeconds[d] = entry->timers[d]->ElapsedSeconds();
+            entry->seconds[d] += entry->lastSeconds[d];
+            entry->flops[d] += EstimateForwardFlops(*entry->node) * (d == backward ? 2 : 1);
+            entry->numPasses[d]++;
+        }
+        const size_t outputBytes = entry->node->GetSampleMatrixNumRows() * entry->node->GetSampleMatrixNumCols() * entry->elementSize;
+        entry->peakOutputBytes = max(entry->peakOutputBytes, outputBytes);
+    }
+    m_numPasses++;
+}
+
+void NodeProfiler::PrintTable(FILE* f, size_t maxNodes) const
+{
+    vector<const Entry*> entries;
+    double totalSeconds = 0;
+    for (const auto& entry : m_entries)
+    {
+        entries.push_back(entry.get());
+        totalSeconds += entry->seconds[forward] + entry->seconds[backward];
+    }
+    sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b)
+         {
+             return a->seconds[forward] + a->seconds[backward] > b->seconds[forward] + b->seconds[backward];
+         });
+
+    fprintf(f, "Node profile over %d passes, %.3f seconds in %d nodes (times per pass):\n", (int) m_numPasses, totalSeconds, (int) entries.size());
+    fprintf(f, "  %12s %12s %7s %10s %10s %10s  %s\n", "forward ms", "backward ms", "total", "fwd GF/s", "bwd GF/s", "output MB", "node");
+    const double numPasses = (double) max(m_numPasses, (size_t) 1);
+    for (size_t i = 0; i < entries.size() && i < maxNodes; i++)
+    {
+        const Entry& entry = *entries[i];
+        double gflopsPerSecond[2];
+        for (int d = forward; d <= backward; d++)
+            gflopsPerSecond[d] = entry.seconds[d] > 0 ? entry.flops[d] / entry.seconds[d] / 1e9 : 0;
+        fprintf(f, "  %12.3f %12.3f %6.2f%% %10.2f %10.2f %10.2f  %ls %ls\n",
+                1000 * entry.seconds[forward] / numPasses, 1000 * entry.seconds[backward] / numPasses,
+                totalSeconds > 0 ? 100 * (entry.seconds[forward] + entry.seconds[backward]) / totalSeconds : 0.0,
+                gflopsPerSecond[forward], gflopsPerSecond[backward], entry.peakOutputBytes / 1048576.0,
+                entry.node->OperationName().c_str(), entry.node->NodeName().c_str());
+    }
+}
+
+static string JsonString(const wstring& s)
+{
+    string json = "\"";
+    for (char c : string(msra::strfun::utf8(s)))
+    {
+        if (c == '"' || c == '\\')
+            json += '\\';
+        if ((unsigned char) c >= 0x20)
+            json += c;
+    }
+    return json + "\"";
+}
+
+void NodeProfiler::SaveChromeTrace(const wstring& path) const
+{
+    const double numPasses = (double) max(m_numPasses, (size_t) 1);
+    FILE* f = fopenOrDie(path, L"w");
+    fprintf(f, "{\"traceEvents\":[\n");
+    double time = 0; // in microseconds
+    bool first = true;
+    for (int d = forward; d <= backward; d++)
+    {
+        for (size_t k = 0; k < m_entries.size(); k++)
+        {
+            const Entry& entry = *m_entries[d == forward ? k : m_entries.size() - 1 - k]; // (backward runs in reverse order)
+            if (entry.numPasses[d] == 0)
+                continue;
+            const double duration = 1e6 * entry.seconds[d] / numPasses;
+            fprintf(f, "%s{\"name\":%s,\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"operation\":%s,\"gflop\":%.6f}}",
+                    first ? "" : ",\n", JsonString(entry.node->NodeName()).c_str(), d == forward ? "forward" : "backward", time, duration, d,
+                    JsonString(entry.node->OperationName()).c_str(), entry.flops[d] / numPasses / 1e9);
+            first = false;
+            time += duration;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fcloseOrDie(f);
+}
+} } }
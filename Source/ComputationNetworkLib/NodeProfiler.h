@@ -0,0 +1,92 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NodeProfiler.h -- per-node forward/backward time, memory and FLOP estimates, to find the slow nodes of a network
+//
+#pragma once
+
+#include "Basics.h"
+#include "CommonMatrix.h"
+#include "ComputationNode.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// NodeProfiler -- collects the time each node spends in ForwardProp() and Backprop()
+// While a NodeProfiler object exists, it is Current(), and the PAR and SEQ flow-control nodes report every node they run
+// to it through Begin() and End(). The time is measured with DeviceTimer, i.e. with CUDA events on the GPU, and is only
+// read back in EndPass(), which must therefore be called after every forward/backward pass over a minibatch.
+// Besides time, each node's output size (its value and gradient come from the MatrixPool, except for inputs and parameters)
+// and an estimate of its floating-point operations are recorded.
+// -----------------------------------------------------------------------
+
+class NodeProfiler
+{
+public:
+    enum Direction
+    {
+        forward = 0,
+        backward = 1
+    };
+
+    struct Entry
+    {
+        ComputationNodeBasePtr node;
+        size_t elementSize;
+        std::unique_ptr<DeviceTimer> timers[2];
+        bool ranInPass[2];     // Begin() was called in the current pass
+        size_t numPasses[2];   // passes in which the node ran
+        double seconds[2];     // total over all passes
+        double lastSeconds[2]; // in the last pass (0 if the node did not run in it)
+        double flops[2];       // estimated total over all passes
+        size_t peakOutputBytes;
+    };
+
+    NodeProfiler();
+    ~NodeProfiler();
+
+    // the profiler the flow-control nodes report to, or nullptr
+    static NodeProfiler* Current()
+    {
+        return s_current;
+    }
+
+    // bracket one ForwardProp() or Backprop() call of a node (in SEQ loops, of a single time step); thread-safe
+    Entry* Begin(const ComputationNodeBasePtr& node, Direction direction);
+    void End(Entry* entry, Direction direction)
+    {
+        entry->timers[direction]->Stop();
+    }
+
+    // collect the times of the pass that just ended; waits for the GPU
+    void EndPass();
+
+    // the nodes that ran so far, e.g. to read their times of the last pass
+    const std::vector<std::unique_ptr<Entry>>& Entries() const
+    {
+        return m_entries;
+    }
+
+    // table of the nodes sorted by total time, at most maxNodes of them
+    void PrintTable(FILE* f, size_t maxNodes = SIZE_MAX) const;
+    // Chrome trace (chrome://tracing, Perfetto) of an average pass: the nodes' forward and then backward times, laid out one after another
+    void SaveChromeTrace(const std::wstring& path) const;
+
+private:
+    NodeProfiler(const NodeProfiler&) = delete;
+    void operator=(const NodeProfiler&) = delete;
+
+    static NodeProfiler* s_current;
+
+    std::mutex m_mutex;                                      // guards m_entries for Begin() from concurrent nodes
+    std::map<const ComputationNodeBase*, Entry*> m_entryMap; // for lookup in Begin()
+    std::vector<std::unique_ptr<Entry>> m_entries;           // in the order the nodes first ran
+    size_t m_numPasses;
+};
+} } }
@@ -28,19 +28,39 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 // -----------------------------------------------------------------------
 
 template <class ElemType, ElementWiseOperator opForward, ElementWiseOperator opBackward, bool gradientFromOutput>
-class UnaryElementWiseWithOpCodeNodeBase : public ComputationNode<ElemType>, public NumInputs<1>
+class UnaryElementWiseWithOpCodeNodeBase : public ComputationNode<ElemType>, public NumInputs<1>, public IFusableElementwiseNode
 {
     typedef ComputationNode<ElemType> Base;
     UsingComputationNodeMembers;
 
 public:
     UnaryElementWiseWithOpCodeNodeBase(DEVICEID_TYPE deviceId, const wstring& name)
-        : Base(deviceId, name)
+        : Base(deviceId, name), m_isInputFused(false), m_fusedOp(opForward)
     {
     }
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
+        if (m_fusedChainHead)
+        {
+            // we are the last node of a chain computed by its head, e.g. ReLU(Plus(Convolution(W, x), b)) in one cuDNN call
+            m_fusedChainHead->ForwardPropChain(fr, *this);
+            return;
+        }
+        if (m_isInputFused)
+        {
+            // our input's ForwardProp() was skipped; apply its op and ours in a single pass over its inputs
+            const auto& fusedInputs = Input(0)->GetInputs();
+            size_t rank = DetermineElementwiseTensorRank();
+            for (const auto& fusedInput : fusedInputs)
+                rank = max(rank, fusedInput->GetSampleLayout().GetRank());
+            auto result = ValueTensorFor(rank, fr);
+            auto input0 = Base::UpCast(fusedInputs[0])->ValueTensorFor(rank, fr.AllowBroadcast());
+            auto input1 = Base::UpCast(fusedInputs[1])->ValueTensorFor(rank, fr.AllowBroadcast());
+            result.DoBinaryOpOf(0, input0, input1, 1, m_fusedOp);
+            return;
+        }
+
         size_t rank = DetermineElementwiseTensorRank();
         auto result = ValueTensorFor(rank, fr);
         auto input = Input(0)->ValueTensorFor(rank, fr);
@@ -52,6 +72,13 @@ public:
         assert(inputIndex == 0);
         inputIndex;
 
+        if (m_fusedChainHead)
+        {
+            // propagate through the whole chain; Input(0)'s own backprop is skipped
+            m_fusedChainHead->BackpropChain(fr, *this);
+            return;
+        }
+
         // get the args
         size_t rank = DetermineElementwiseTensorRank();
         auto sliceOutputGrad = GradientTensorFor(rank, fr);               // propagate from this one...
@@ -76,6 +103,61 @@ public:
     {
         return !gradientFromOutput;
     }
+
+    // (not if a fused chain head computes us, since that goes through cuDNN with the full time step)
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override
+    {
+        return !m_fusedChainHead;
+    }
+
+    virtual bool /*ComputationNodeBase::*/ IsValueRecomputable() const override
+    {
+        return true;
+    }
+
+    virtual bool /*ComputationNodeBase::*/ CanComputeValueInPlaceOfInput(size_t /*i*/) const override
+    {
+        return true;
+    }
+
+    virtual ElementWiseOperator /*IFusableElementwiseNode::*/ GetForwardOpCode() const override
+    {
+        return opForward;
+    }
+    // the input's value is never computed once fused, so this is only possible if our gradient does not need it
+    virtual bool /*IFusableElementwiseNode::*/ TryFuseInput(ElementWiseOperator inputOpCode) override
+    {
+        m_isInputFused = gradientFromOutput && TryGetFusedUnaryOfBinaryOp(opForward, inputOpCode, m_fusedOp);
+        return m_isInputFused;
+    }
+    // only ReLU, the activation that cuDNN fuses into the convolution
+    virtual bool /*IFusableElementwiseNode::*/ TryFuseChain(const std::shared_ptr<IFusableChainHeadNode>& head) override
+    {
+        if (opForward != opLinearRectifier)
+            return false;
+        UnfuseInput();
+        m_fusedChainHead = head;
+        return true;
+    }
+    virtual void /*IFusableElementwiseNode::*/ UnfuseInput() override
+    {
+        m_isInputFused = false;
+        m_fusedOp = opForward;
+        m_fusedChainHead = nullptr;
+    }
+
+    // our backprop writes the gradients that Input(0)'s backprop would, and they must not share a matrix with ours
+    virtual void /*ComputationNodeBase::*/ AllocateGradientMatricesForInputs(MatrixPool& matrixPool) override
+    {
+        Base::AllocateGradientMatricesForInputs(matrixPool);
+        if (m_fusedChainHead)
+            Input(0)->AllocateGradientMatricesForInputs(matrixPool);
+    }
+
+private:
+    bool m_isInputFused;           // true if Input(0)'s op is folded into ours (see ComputationNetwork::FuseElementwiseOperations())
+    ElementWiseOperator m_fusedOp; // opcode computing opForward(Input(0)'s op) if m_isInputFused
+    std::shared_ptr<IFusableChainHeadNode> m_fusedChainHead; // computes our value and backprop if we end a fused chain (see ComputationNetwork::FuseConvolutionBiasReLU())
 };
 
 #define UnaryElementWiseWithOpCodeNodeBaseMembers UsingComputationNodeMembersBoilerplate;
@@ -14,6 +14,8 @@
 #include <stdexcept>
 #include <list>
 #include <iostream>
+#include <functional>
+#include <vector>
 
 // this file will contain computation nodes that require several atomic computation.
 
@@ -119,6 +121,14 @@ public:
         m_hasComputed = true;
         SetDims(TensorShape(value.GetNumRows()), false);
     }
+    // same, keeping a given tensor shape (e.g. that of the input, for values computed by an earlier run, see PreComputeCache)
+    void SideLoadFromMatrix(const Matrix<ElemType>& value, const TensorShape& sampleLayout)
+    {
+        if (sampleLayout.GetNumElements() != value.GetNumRows())
+            InvalidArgument("SideLoadFromMatrix: The value does not match the sample layout [%s].", string(sampleLayout).c_str());
+        SideLoadFromMatrix(value);
+        SetDims(sampleLayout, false);
+    }
 
 public:
     bool m_hasComputed;
@@ -196,19 +206,41 @@ public:
         }
     }
 
+    // for distributed precomputation: combine the statistics that several workers have accumulated, each over its own share of the data
+    // 'allReduceSum' sums a buffer in place across the workers. All workers must call this, in the same order for all nodes, before MarkComputed(true).
+    typedef std::function<void(std::vector<double>&)> AllReduceFunction;
+    virtual void AggregateAcrossWorkers(const AllReduceFunction& allReduceSum) = 0;
+
 protected:
     size_t m_numSamples; // (SIZE_MAX while outside accumulation state)
     bool IsAccumulating() const
     {
         return m_numSamples != SIZE_MAX;
     }
+
+    // helpers for AggregateAcrossWorkers(): the values of a matrix in double precision on the CPU, and back
+    static std::vector<double> ToDoubles(const Matrix<ElemType>& m)
+    {
+        std::vector<ElemType> values(m.GetNumElements());
+        if (!values.empty())
+            m.CopySection(m.GetNumRows(), m.GetNumCols(), values.data(), m.GetNumRows());
+        return std::vector<double>(values.begin(), values.end());
+    }
+    static void FromDoubles(Matrix<ElemType>& m, const std::vector<double>& values)
+    {
+        std::vector<ElemType> converted(values.begin(), values.begin() + m.GetNumElements());
+        m.SetValue(m.GetNumRows(), m.GetNumCols(), m.GetDeviceId(), converted.data());
+    }
 };
 
 #define UsingMeanInvStdDevNodeBaseNodeMembers \
     ComputationNodeBoilerplate;               \
     UsingPreComputedNodeMembers;              \
     using Base::m_numSamples;                 \
-    using Base::IsAccumulating
+    using Base::IsAccumulating;               \
+    using Base::ToDoubles;                    \
+    using Base::FromDoubles;                  \
+    typedef typename Base::AllReduceFunction AllReduceFunction
 
 // -----------------------------------------------------------------------
 // MeanNode (features)
@@ -277,6 +309,23 @@ public:
 
         m_numSamples += numNewSamples;
     }
+
+    // the overall mean is the average of the workers' means, weighted by their numbers of samples
+    virtual void AggregateAcrossWorkers(const AllReduceFunction& allReduceSum) override
+    {
+        if (!IsAccumulating())
+            LogicError("%ls %ls operation: AggregateAcrossWorkers() called while not accumulating.", NodeName().c_str(), OperationName().c_str());
+        std::vector<double> sums = ToDoubles(Value());
+        for (auto& sum : sums)
+            sum *= m_numSamples;
+        sums.push_back((double) m_numSamples);
+        allReduceSum(sums);
+        const double totalNumSamples = sums.back();
+        for (auto& sum : sums)
+            sum = totalNumSamples > 0 ? sum / totalNumSamples : 0;
+        FromDoubles(Value(), sums);
+        m_numSamples = (size_t) totalNumSamples;
+    }
 };
 
 template class MeanNode<float>;
@@ -390,6 +439,37 @@ public:
 #endif
     }
 
+    // Chan et al.'s parallel variance: the squared deviations from the overall mean sum up, over the workers, to the workers' own
+    // sums of squared deviations (numSamples * variance) plus numSamples * (worker mean - overall mean)^2
+    virtual void AggregateAcrossWorkers(const AllReduceFunction& allReduceSum) override
+    {
+        if (!IsAccumulating())
+            LogicError("%ls %ls operation: AggregateAcrossWorkers() called while not accumulating.", NodeName().c_str(), OperationName().c_str());
+        const std::vector<double> mean = ToDoubles(m_mean);
+        const std::vector<double> var = ToDoubles(m_var);
+        const double numSamples = (double) m_numSamples;
+
+        std::vector<double> overallMean(mean.size() + 1);
+        for (size_t i = 0; i < mean.size(); i++)
+            overallMean[i] = numSamples * mean[i];
+        overallMean.back() = numSamples;
+        allReduceSum(overallMean);
+        const double totalNumSamples = overallMean.back();
+        for (auto& sum : overallMean)
+            sum = totalNumSamples > 0 ? sum / totalNumSamples : 0;
+
+        std::vector<double> overallVar(var.size());
+        for (size_t i = 0; i < var.size(); i++)
+            overallVar[i] = numSamples * (var[i] + (mean[i] - overallMean[i]) * (mean[i] - overallMean[i]));
+        allReduceSum(overallVar);
+        for (auto& sum : overallVar)
+            sum = totalNumSamples > 0 ? sum / totalNumSamples : 0;
+
+        FromDoubles(m_mean, overallMean);
+        FromDoubles(m_var, overallVar);
+        m_numSamples = (size_t) totalNumSamples;
+    }
+
     virtual void CopyTo(ComputationNodeBasePtr nodeP, const std::wstring& newName, const CopyNodeFlags flags) const override
     {
         Base::CopyTo(nodeP, newName, flags);
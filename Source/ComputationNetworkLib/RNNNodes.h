@@ -0,0 +1,350 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include "Basics.h"
+#include "ComputationNode.h"
+#include "CuDnnRNN.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// OptimizedRNNStackNode (weights, input)
+// A stack of numLayers recurrent layers (LSTM, GRU, or plain RNN with ReLU or tanh), optionally bidirectional, that runs
+// over all time steps of the minibatch at once through cuDNN, instead of as a loop of per-frame nodes.
+// The weights are a single column vector in cuDNN's layout; their dimension is inferred.
+// The output of a bidirectional stack is the forward and backward hidden states stacked on top of each other.
+// Each sequence starts with a zero state, so the minibatch must contain whole sequences (no truncated BPTT).
+// GPU only; needs cuDNN 5 or later.
+// For inference, a unidirectional LSTM stack can instead run layer by layer with a persistent kernel (see UsePersistentInference()),
+// which is faster for few parallel sequences, and can continue sequences from states given by the caller (streaming evaluation).
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class OptimizedRNNStackNode : public ComputationNodeNonLooping<ElemType>, public NumInputs<2>
+{
+    typedef ComputationNodeNonLooping<ElemType> Base;
+    UsingComputationNodeMembersBoilerplate;
+    static const std::wstring TypeName()
+    {
+        return L"OptimizedRNNStack";
+    }
+
+public:
+    OptimizedRNNStackNode(DEVICEID_TYPE deviceId, const wstring& name)
+        : Base(deviceId, name), m_hiddenSize(0), m_numLayers(0), m_bidirectional(false), m_recurrentOp(L"lstm"), m_hasBackwardData(false), m_persistentInference(false)
+    {
+    }
+    OptimizedRNNStackNode(DEVICEID_TYPE deviceId, const wstring& name, const size_t hiddenSize, const size_t numLayers, const bool bidirectional, const wstring& recurrentOp)
+        : Base(deviceId, name), m_hiddenSize(hiddenSize), m_numLayers(numLayers), m_bidirectional(bidirectional), m_recurrentOp(recurrentOp), m_hasBackwardData(false), m_persistentInference(false)
+    {
+        CuDnnRNNParams::ParseRecurrentOp(m_recurrentOp); // (validates the name)
+    }
+    OptimizedRNNStackNode(const ScriptableObjects::IConfigRecordPtr configp)
+        : OptimizedRNNStackNode(configp->Get(L"deviceId"), L"<placeholder>", configp->Get(L"hiddenSize"), configp->Get(L"numLayers"),
+                                configp->Get(L"bidirectional"), configp->Get(L"recurrentOp"))
+    {
+        // weights, input, hiddenSize, numLayers, bidirectional = false, recurrentOp = 'lstm'
+        AttachInputs(configp, this->GetExpectedNumInputs());
+    }
+
+    void Save(File& fstream) const override
+    {
+        Base::Save(fstream);
+        fstream << m_hiddenSize << m_numLayers << m_bidirectional << m_recurrentOp;
+    }
+
+    void Load(File& fstream, size_t modelVersion) override
+    {
+        Base::Load(fstream, modelVersion);
+        fstream >> m_hiddenSize >> m_numLayers >> m_bidirectional >> m_recurrentOp;
+        m_rnnExecutor.reset();
+        m_lstmLayers.clear();
+    }
+
+    void CopyTo(ComputationNodeBasePtr nodeP, const std::wstring& newName, const CopyNodeFlags flags) const override
+    {
+        Base::CopyTo(nodeP, newName, flags);
+        if (flags & CopyNodeFlags::copyNodeValue)
+        {
+            auto node = dynamic_pointer_cast<OptimizedRNNStackNode<ElemType>>(nodeP);
+            node->m_hiddenSize = m_hiddenSize;
+            node->m_numLayers = m_numLayers;
+            node->m_bidirectional = m_bidirectional;
+            node->m_recurrentOp = m_recurrentOp;
+        }
+    }
+
+    void ForwardPropNonLooping() override
+    {
+        if (m_persistentInference)
+            return ForwardPropPersistent();
+        if (!m_rnnExecutor)
+            m_rnnExecutor.reset(new CuDnnRNNExecutor<ElemType>(m_deviceId, GetRNNParams()));
+
+        PackSequences();
+        m_packedInput->DoGatherColumnsOf(0, *m_packingIndex, Input(1)->Value(), 1);
+        // only keep what backprop needs if there will be one
+        m_rnnExecutor->ForwardProp(Input(0)->Value(), *m_packedInput, *m_packedOutput, m_numSequencesPerFrame, NeedGradient(), *m_reserve, *m_workspace);
+        Value().DoScatterColumnsOf(0, *m_packingIndex, *m_packedOutput, 1); // (gaps are set to 0)
+        m_hasBackwardData = false;
+    }
+
+    void BackpropToNonLooping(size_t inputIndex) override
+    {
+        if (m_persistentInference)
+            LogicError("%ls %ls operation: Persistent inference cannot be used for training.", NodeName().c_str(), OperationName().c_str());
+        // cuDNN computes the weight gradient from the results of the data gradient, so the latter always comes first
+        EnsureBackwardData();
+        if (inputIndex == 0) // derivative with respect to the weights
+            m_rnnExecutor->BackwardWeights(*m_packedInput, *m_packedOutput, Input(0)->Gradient(), *m_reserve, *m_workspace);
+        else if (inputIndex == 1) // derivative with respect to the input
+            Input(1)->Gradient().DoScatterColumnsOf(1, *m_packingIndex, *m_packedInputGrad, 1);
+    }
+
+    // the packed copies of input and output are kept instead
+    virtual bool OutputUsedInComputingInputNodesGradients() const override { return false; }
+    virtual bool InputUsedInComputingInputNodesGradients(size_t childIndex) const override { return childIndex == 0; }
+
+    void Validate(bool isFinalValidationPass) override
+    {
+        Base::Validate(isFinalValidationPass);
+        InferMBLayoutFromInputsForStandardCase();
+
+        if (isFinalValidationPass)
+        {
+            if (Input(0)->HasMBLayout())
+                InvalidArgument("%ls %ls operation requires the weights (first input) to be a parameter, not a minibatch.", NodeName().c_str(), OperationName().c_str());
+            if (!Input(1)->HasMBLayout())
+                InvalidArgument("%ls %ls operation requires the second input to be a sequence.", NodeName().c_str(), OperationName().c_str());
+            if (m_hiddenSize == 0 || m_numLayers == 0)
+                InvalidArgument("%ls %ls operation requires hiddenSize and numLayers to be positive.", NodeName().c_str(), OperationName().c_str());
+            if (m_deviceId < 0)
+                InvalidArgument("%ls %ls operation is only implemented for GPUs (it uses cuDNN).", NodeName().c_str(), OperationName().c_str());
+        }
+
+        // infer the weight dimension from the input dimension
+        const size_t inputDim = GetInputSampleLayout(1).GetNumElements();
+        if (inputDim > 0 && m_hiddenSize > 0 && m_numLayers > 0)
+        {
+            const size_t numWeights = GetRNNParams().GetNumWeights();
+            Input(0)->ValidateInferInputDimsFrom(TensorShape(numWeights, 1));
+            if (isFinalValidationPass && Input(0)->GetSampleLayout().GetNumElements() != numWeights)
+                InvalidArgument("%ls %ls operation: The weights %ls must have %d elements for input dimension %d, hiddenSize %d, numLayers %d, but have %d.",
+                                NodeName().c_str(), OperationName().c_str(), Input(0)->NodeName().c_str(),
+                                (int) numWeights, (int) inputDim, (int) m_hiddenSize, (int) m_numLayers, (int) Input(0)->GetSampleLayout().GetNumElements());
+        }
+
+        SetDims(TensorShape(m_hiddenSize * (m_bidirectional ? 2 : 1)), true);
+        if (isFinalValidationPass)
+        {
+            m_rnnExecutor.reset(); // dimensions may have changed; recreated upon first use
+            m_lstmLayers.clear();
+        }
+    }
+
+    void DumpNodeInfo(const bool printValues, File& fstream) const override
+    {
+        Base::DumpNodeInfo(printValues, fstream);
+        char str[4096];
+        sprintf(str, "hiddenSize=%lu  numLayers=%lu  bidirectional=%ls  recurrentOp=%ls\n", m_hiddenSize, m_numLayers, m_bidirectional ? L"true" : L"false", m_recurrentOp.c_str());
+        fstream << string(str);
+    }
+
+    void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        RequestMatrixFromPool(m_packedInput, matrixPool);
+        RequestMatrixFromPool(m_packedOutput, matrixPool);
+        RequestMatrixFromPool(m_reserve, matrixPool);
+        RequestWorkspaceFromPool(m_workspace, matrixPool);
+        CreateMatrixIfNull(m_packingIndex);
+    }
+
+    void RequestMatricesBeforeBackprop(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        RequestMatrixFromPool(m_packedOutputGrad, matrixPool);
+        RequestMatrixFromPool(m_packedInputGrad, matrixPool);
+    }
+
+    void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool) override
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        ReleaseMatrixToPool(m_packedInput, matrixPool);
+        ReleaseMatrixToPool(m_packedOutput, matrixPool);
+        ReleaseMatrixToPool(m_reserve, matrixPool);
+        ReleaseWorkspaceToPool(m_workspace, matrixPool);
+        ReleaseMatrixToPool(m_packedOutputGrad, matrixPool);
+        ReleaseMatrixToPool(m_packedInputGrad, matrixPool);
+    }
+
+    // for inference with few parallel sequences: run the stack layer by layer with Matrix::LSTMForwardWithState() on the minibatch as it is,
+    // instead of through cuDNN. Only possible for unidirectional LSTM stacks on a GPU; returns false otherwise.
+    // The weights are taken upon the first ForwardProp(), so this must not be used while they are being trained.
+    bool UsePersistentInference()
+    {
+        if (m_recurrentOp != L"lstm" || m_bidirectional || m_deviceId < 0)
+            return false;
+        m_persistentInference = true;
+        return true;
+    }
+
+    // for callers that keep the state of each parallel sequence themselves (streaming evaluation in CNTKEval), with persistent inference:
+    // the states that sequences which began before the minibatch continue from, and after ForwardProp(), the states after the last frame
+    // of each sequence. [hiddenSize x 2 * numLayers * numParallelSequences]: per layer, the hidden and then the cell states of all sequences.
+    Matrix<ElemType>& CarriedState()
+    {
+        CreateMatrixIfNull(m_state);
+        return *m_state;
+    }
+    size_t GetHiddenSize() const { return m_hiddenSize; }
+    size_t GetNumLayers() const { return m_numLayers; }
+
+private:
+    CuDnnRNNParams GetRNNParams() const
+    {
+        return CuDnnRNNParams(GetInputSampleLayout(1).GetNumElements(), m_hiddenSize, m_numLayers, m_bidirectional, CuDnnRNNParams::ParseRecurrentOp(m_recurrentOp));
+    }
+
+    // determine the order in which cuDNN sees the frames: by time step, and within a time step, by decreasing sequence length
+    // m_packingIndex[j] is the minibatch column of the j-th packed column.
+    void PackSequences()
+    {
+        const auto& pMBLayout = GetMBLayout();
+        vector<MBLayout::SequenceInfo> sequences;
+        for (const auto& seq : pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            if (seq.tBegin < 0 || seq.tEnd > pMBLayout->GetNumTimeSteps())
+                InvalidArgument("%ls %ls operation requires each sequence to lie entirely within the minibatch (truncated BPTT is not supported).", NodeName().c_str(), OperationName().c_str());
+            sequences.push_back(seq);
+        }
+        if (sequences.empty())
+            InvalidArgument("%ls %ls operation: The minibatch contains no sequences.", NodeName().c_str(), OperationName().c_str());
+        stable_sort(sequences.begin(), sequences.end(), [](const MBLayout::SequenceInfo& a, const MBLayout::SequenceInfo& b)
+                    {
+                        return a.GetNumTimeSteps() > b.GetNumTimeSteps();
+                    });
+
+        const size_t numParallelSequences = pMBLayout->GetNumParallelSequences();
+        m_numSequencesPerFrame.clear();
+        vector<ElemType> packingIndex;
+        for (size_t t = 0; t < sequences.front().GetNumTimeSteps(); t++)
+        {
+            size_t numSequences = 0;
+            for (const auto& seq : sequences)
+            {
+                if (t >= seq.GetNumTimeSteps())
+                    break; // (sorted, so all further ones are shorter as well)
+                packingIndex.push_back((ElemType) ((seq.tBegin + t) * numParallelSequences + seq.s));
+                numSequences++;
+            }
+            m_numSequencesPerFrame.push_back(numSequences);
+        }
+        m_packingIndex->SetValue(1, packingIndex.size(), m_deviceId, packingIndex.data());
+    }
+
+    // persistent inference (see UsePersistentInference()): per layer, the gates' input projections of all frames with one GEMM,
+    // then all time steps in one kernel. The flags tell the kernel where sequences start, continue, or have gaps.
+    void ForwardPropPersistent()
+    {
+        const auto& pMBLayout = GetMBLayout();
+        const size_t numParallelSequences = pMBLayout->GetNumParallelSequences();
+        const size_t numTimeSteps = pMBLayout->GetNumTimeSteps();
+        CreateMatrixIfNull(m_state);
+        CreateMatrixIfNull(m_stateFlags);
+        const bool hasState = m_state->GetNumRows() == m_hiddenSize && m_state->GetNumCols() == 2 * m_numLayers * numParallelSequences;
+        vector<ElemType> flags(numTimeSteps * numParallelSequences, 0);
+        for (const auto& seq : pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            if (seq.tBegin < 0 && !hasState)
+                InvalidArgument("%ls %ls operation requires each sequence to lie entirely within the minibatch, unless the caller carries its state.", NodeName().c_str(), OperationName().c_str());
+            for (size_t t = (size_t) max(seq.tBegin, (ptrdiff_t) 0); t < min(seq.tEnd, numTimeSteps); t++)
+                flags[t * numParallelSequences + seq.s] = 1;
+            if (seq.tBegin >= 0)
+                flags[seq.tBegin * numParallelSequences + seq.s] = 2;
+        }
+        m_stateFlags->SetValue(1, flags.size(), m_deviceId, flags.data());
+        if (!hasState)
+        {
+            m_state->Resize(m_hiddenSize, 2 * m_numLayers * numParallelSequences);
+            m_state->SetValue(0);
+        }
+
+        if (m_lstmLayers.empty())
+        {
+            if (!m_rnnExecutor)
+                m_rnnExecutor.reset(new CuDnnRNNExecutor<ElemType>(m_deviceId, GetRNNParams()));
+            for (size_t layer = 0; layer < m_numLayers; layer++)
+            {
+                LSTMLayerWeights weights = {make_shared<Matrix<ElemType>>(m_deviceId), make_shared<Matrix<ElemType>>(m_deviceId), make_shared<Matrix<ElemType>>(m_deviceId)};
+                m_rnnExecutor->GetLSTMLayerWeights(Input(0)->Value(), layer, *weights.inputWeights, *weights.recurrentWeights, *weights.bias);
+                m_lstmLayers.push_back(weights);
+            }
+        }
+
+        // each layer's output is the next one's input, so one buffer suffices (the gates are computed before it is overwritten)
+        for (size_t layer = 0; layer < m_numLayers; layer++)
+        {
+            const auto& weights = m_lstmLayers[layer];
+            m_packedInput->AssignProductOf(*weights.inputWeights, true, layer == 0 ? Input(1)->Value() : *m_packedOutput, false);
+            Matrix<ElemType>::ScaleAndAdd(1, *weights.bias, *m_packedInput);
+            Matrix<ElemType> h = m_state->ColumnSlice(2 * layer * numParallelSequences, numParallelSequences);
+            Matrix<ElemType> c = m_state->ColumnSlice((2 * layer + 1) * numParallelSequences, numParallelSequences);
+            Matrix<ElemType>::LSTMForwardWithState(*m_packedInput, *weights.recurrentWeights, *m_stateFlags, h, c,
+                                                   layer + 1 == m_numLayers ? Value() : *m_packedOutput, numParallelSequences);
+        }
+        MaskMissingValueColumnsToZero(FrameRange(pMBLayout));
+    }
+
+    void EnsureBackwardData()
+    {
+        if (m_hasBackwardData)
+            return;
+        m_packedOutputGrad->DoGatherColumnsOf(0, *m_packingIndex, Gradient(), 1);
+        m_rnnExecutor->BackwardData(*m_packedOutput, *m_packedOutputGrad, Input(0)->Value(), *m_packedInputGrad, *m_reserve, *m_workspace);
+        m_hasBackwardData = true;
+    }
+
+    size_t m_hiddenSize;
+    size_t m_numLayers;
+    bool m_bidirectional;
+    wstring m_recurrentOp; // lstm, gru, rnnReLU, or rnnTanh
+
+    std::unique_ptr<CuDnnRNNExecutor<ElemType>> m_rnnExecutor;
+    vector<size_t> m_numSequencesPerFrame;
+    bool m_hasBackwardData; // BackwardData() was run for the current minibatch
+
+    shared_ptr<Matrix<ElemType>> m_packingIndex;
+    shared_ptr<Matrix<ElemType>> m_packedInput;
+    shared_ptr<Matrix<ElemType>> m_packedOutput;
+    shared_ptr<Matrix<ElemType>> m_packedOutputGrad;
+    shared_ptr<Matrix<ElemType>> m_packedInputGrad;
+    shared_ptr<Matrix<ElemType>> m_reserve; // state that cuDNN passes from ForwardProp() to the backward calls
+    shared_ptr<Matrix<ElemType>> m_workspace;
+
+    // persistent inference
+    struct LSTMLayerWeights
+    {
+        shared_ptr<Matrix<ElemType>> inputWeights, recurrentWeights, bias; // in the layout of Matrix::LSTMForwardWithState()
+    };
+    bool m_persistentInference;
+    vector<LSTMLayerWeights> m_lstmLayers;   // [layer], taken from the weights upon first use
+    shared_ptr<Matrix<ElemType>> m_state;      // see CarriedState()
+    shared_ptr<Matrix<ElemType>> m_stateFlags; // [1 x numTimeSteps * numParallelSequences] 0 = gap, 1 = continue, 2 = start
+};
+
+template class OptimizedRNNStackNode<float>;
+template class OptimizedRNNStackNode<double>;
+} } }
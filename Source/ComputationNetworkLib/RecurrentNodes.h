@@ -83,7 +83,7 @@ protected:
 //  - ranges of neighbor frames as a secondary tensor dimension (i.e. can be used to implement a rolling window)
 //  - full support/efficiency of non-recurrent use (in which case the range can be from negative to positive, e.g. a symmetric rolling window)
 //  - denoting which tensor dimension to loop over (this may not be completed, but I will plant a seed)
-//  - support for Yongqiangs sub-minibatching with truncated BPTT (export/import state)
+//  - support for Yongqiang�s sub-minibatching with truncated BPTT (export/import state)
 //  - more efficient storage of carried-over state (only store the needed frames, not a full copy of the previous MB as currently; which will on the other hand also allow windows that reach back beyond a minibatch)
 // -----------------------------------------------------------------------
 
@@ -236,6 +236,13 @@ public:
         return false;
     }
 
+    // A slot that is active at t but beyond the active ones of the delayed time step must have its sequence boundary at t,
+    // so it takes the initial value through the per-sequence path above, which does not depend on the prefix.
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override
+    {
+        return true;
+    }
+
     virtual bool InputUsedInComputingInputNodesGradients(size_t childIndex) const override
     {
         // The DelayedValueNode does not require any of it's input's values for computing
@@ -247,17 +254,67 @@ public:
     virtual void EndForwardProp() override // called after last iteration step of ForwardProp()
     {
         // In truncated BPTT, we carry over left-to-right state across minibatches.
-        // It is kept in m_delayedValue, m_delayedActivationMBLayout.
-        // This could be optimized as follows:
-        //  - only keep the required number of frames (m_timeStep)
-        //  - we don't need to keep anything in full-sequence mode
-        //  - we don't need to keep anything if all sequences are closed (sentence end)
-        //    This condition includes full-sequence mode.
-        // TODO: Can we optimize this and only copy if there is a sequence spanning across the end of the MB? And add a check to BeginForwardProp() to make sure we got one if there is a boundary at the start?
-        m_delayedValue = Input(0)->Value();
+        // It is kept in m_delayedValue, m_delayedActivationMBLayout: only the m_timeStep frames (at most the minibatch) that the next
+        // minibatch can reach, i.e. for each parallel sequence its last (PastValue) or first (FutureValue) frames, not counting gaps.
+        // m_delayedActivationMBLayout is the minibatch's layout shifted accordingly for each parallel sequence.
+        const auto& value = Input(0)->Value();
+        int dir = direction; // (this avoids a 'conditional expression is constant' warning)
+        const bool isPast = dir < 0;
+        const size_t numParallelSequences = GetNumParallelSequences();
+        const size_t numTimeSteps = GetNumTimeSteps();
+        const size_t numDelayed = min((size_t) m_timeStep, numTimeSteps);
+
+        // first time step to keep, for each parallel sequence
+        std::vector<ptrdiff_t> offsets(numParallelSequences, isPast ? (ptrdiff_t) numTimeSteps : 0); // (past: end of the frames; future: their begin)
+        std::vector<bool> hasFrames(numParallelSequences, false);
+        for (const auto& seq : m_pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            const ptrdiff_t begin = max(seq.tBegin, (ptrdiff_t) 0), end = (ptrdiff_t) min(seq.tEnd, numTimeSteps);
+            offsets[seq.s] = !hasFrames[seq.s] ? (isPast ? end : begin) : (isPast ? max(offsets[seq.s], end) : min(offsets[seq.s], begin));
+            hasFrames[seq.s] = true;
+        }
+        bool isUniform = true;
+        for (size_t s = 0; s < numParallelSequences; s++)
+        {
+            if (isPast)
+                offsets[s] -= (ptrdiff_t) numDelayed;
+            isUniform &= offsets[s] == offsets[0];
+        }
+
+        if (isUniform && offsets[0] >= 0 && offsets[0] + numDelayed <= numTimeSteps) // (the common case: one slice)
+            m_delayedValue.SetValue(value.ColumnSlice(offsets[0] * numParallelSequences, numDelayed * numParallelSequences));
+        else
+        {
+            m_delayedValue.Resize(value.GetNumRows(), numDelayed * numParallelSequences);
+            m_delayedValue.SetValue(0);
+            for (size_t s = 0; s < numParallelSequences; s++)
+                for (size_t k = 0; k < numDelayed; k++)
+                {
+                    const ptrdiff_t t = offsets[s] + (ptrdiff_t) k;
+                    if (t >= 0 && t < (ptrdiff_t) numTimeSteps)
+                        m_delayedValue.SetColumnSlice(value.ColumnSlice(t * numParallelSequences + s, 1), k * numParallelSequences + s, 1);
+                }
+        }
+
         if (!m_delayedActivationMBLayout)
             m_delayedActivationMBLayout = make_shared<MBLayout>();
-        m_delayedActivationMBLayout->CopyFrom(m_pMBLayout);
+        m_delayedActivationMBLayout->Init(numParallelSequences, numDelayed);
+        std::vector<bool> isDeclared(numDelayed * numParallelSequences, false); // [k * numParallelSequences + s]
+        for (const auto& seq : m_pMBLayout->GetAllSequences())
+        {
+            const ptrdiff_t tBegin = seq.tBegin - offsets[seq.s], tEnd = (ptrdiff_t) seq.tEnd - offsets[seq.s];
+            if (tEnd <= 0 || tBegin >= (ptrdiff_t) numDelayed)
+                continue;
+            m_delayedActivationMBLayout->AddSequence(seq.seqId, seq.s, tBegin, (size_t) tEnd);
+            for (ptrdiff_t k = max(tBegin, (ptrdiff_t) 0); k < min(tEnd, (ptrdiff_t) numDelayed); k++)
+                isDeclared[k * numParallelSequences + seq.s] = true;
+        }
+        for (size_t s = 0; s < numParallelSequences; s++) // time steps that the minibatch did not have are gaps
+            for (size_t k = 0; k < numDelayed; k++)
+                if (!isDeclared[k * numParallelSequences + s])
+                    m_delayedActivationMBLayout->AddGap(s, k, k + 1);
 
         Base::EndForwardProp();
     }
@@ -369,8 +426,8 @@ public:
     virtual NodeStatePtr /*IStatefulNode::*/ ExportState() override
     {
         NodeStatePtr pExportedState;
-        size_t nT = m_pMBLayout->GetNumTimeSteps();
-        size_t nU = m_pMBLayout->GetNumParallelSequences();
+        size_t nT = m_delayedActivationMBLayout->GetNumTimeSteps(); // (EndForwardProp() keeps only the frames the next minibatch can reach)
+        size_t nU = m_delayedActivationMBLayout->GetNumParallelSequences();
         int dir = direction;
         if (m_timeStep != 1)
         {
@@ -383,7 +440,7 @@ public:
             {
                 auto pState = make_shared<DelayedValueNodeState<ElemType>>(m_deviceId);
                 pState->CacheDelayedMBLayout(m_delayedActivationMBLayout);
-                // return an empty one
+                pExportedState = pState; // return an empty one
             }
             else
             {
@@ -433,6 +490,8 @@ public:
         size_t nT = m_delayedActivationMBLayout->GetNumTimeSteps();
         size_t nU = m_delayedActivationMBLayout->GetNumParallelSequences();
 
+        m_delayedValue.Resize(delayedActivation.GetNumRows(), nT * nU); // (the imported layout may differ from the last minibatch's, e.g. in sub-minibatches)
+
         int dir = direction;
         if (dir == -1) // looking backward
             m_delayedValue.SetColumnSlice(delayedActivation, (nT - 1) * nU, nU);
@@ -442,6 +501,24 @@ public:
             LogicError("Unrecognized direction in DelayedValueNodeBase");
     }
 
+    // direct access to the carried-over input frames and their layout, for callers that keep the history of each
+    // parallel sequence themselves (streaming evaluation in CNTKEval). m_delayedValue holds the frames of the last minibatch's input
+    // that EndForwardProp() kept: min(m_timeStep, #time steps) per parallel sequence, its last ones (or first ones for FutureValue).
+    int TimeStep() const
+    {
+        return m_timeStep;
+    }
+    Matrix<ElemType>& DelayedValue()
+    {
+        return m_delayedValue;
+    }
+    MBLayoutPtr DelayedValueMBLayout()
+    {
+        if (!m_delayedActivationMBLayout)
+            m_delayedActivationMBLayout = make_shared<MBLayout>();
+        return m_delayedActivationMBLayout;
+    }
+
 protected:
     ElemType m_initialActivationValue;       // starting value for hidden activation vector at boundary
     Matrix<ElemType> m_delayedValue;         // saves the activation of the previous step that this node points to
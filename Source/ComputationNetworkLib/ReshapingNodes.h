@@ -158,7 +158,10 @@ public:
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
-        ValueFor(fr).SetValue(Input(0)->ValueFor(fr));
+        auto result = ValueFor(fr);
+        auto input = Input(0)->ValueFor(fr);
+        if (result.BufferPointer() != input.BufferPointer()) // (nothing to do if our value is a view of the input's, see ComputationNetwork::PlanInPlaceValues())
+            result.SetValue(input);
     }
 
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
@@ -175,6 +178,15 @@ public:
         return false;
     }
 
+    virtual bool /*ComputationNodeBase::*/ CanComputeValueInPlaceOfInput(size_t /*i*/) const override
+    {
+        return true;
+    }
+    virtual bool /*ComputationNodeBase::*/ IsValueReshapeOfInput(size_t /*i*/) const override
+    {
+        return true;
+    }
+
 private:
     TensorShape m_replacementSampleLayout; // user-specified dimensions to replace dimensions [beginDim, endDim]
     int m_beginDimParameter;               // 1-based index range as specified
@@ -254,6 +266,71 @@ public:
 template class ReconcileMBLayoutNode<float>;
 template class ReconcileMBLayoutNode<double>;
 
+// -----------------------------------------------------------------------
+// DeviceTransfer (input)
+// Copies the input's value from the device it lives on to this node's device, and the gradient back.
+// These are inserted by ComputationNetwork::PartitionAcrossDevices() at the edges between the parts of a model
+// that is split across GPUs. On a single device (e.g. when such a model is loaded for evaluation) it is a plain copy.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class DeviceTransferNode : public ComputationNodeNonLooping<ElemType>, public NumInputs<1>
+{
+    typedef ComputationNodeNonLooping<ElemType> Base;
+    UsingComputationNodeMembersBoilerplate;
+    static const std::wstring TypeName()
+    {
+        return L"DeviceTransfer";
+    }
+
+public:
+    DeclareConstructorFromConfigWithNumInputs(DeviceTransferNode);
+    DeviceTransferNode(DEVICEID_TYPE deviceId, const wstring& name)
+        : Base(deviceId, name)
+    {
+    }
+
+    virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
+    {
+        Value().SetValueFromOtherDevice(Input(0)->Value());
+    }
+
+    virtual void /*ComputationNodeNonLooping::*/ BackpropToNonLooping(size_t /*inputIndex*/) override
+    {
+        auto& inputGradient = Input(0)->Gradient();
+        if (inputGradient.GetDeviceId() == Gradient().GetDeviceId())
+        {
+            inputGradient += Gradient();
+            return;
+        }
+        // pull our gradient over to the input's device first, for adding it there
+        if (!m_inputDeviceGradient || m_inputDeviceGradient->GetDeviceId() != inputGradient.GetDeviceId())
+            m_inputDeviceGradient = make_shared<Matrix<ElemType>>(inputGradient.GetDeviceId());
+        m_inputDeviceGradient->SetValueFromOtherDevice(Gradient());
+        inputGradient += *m_inputDeviceGradient;
+    }
+
+    virtual bool OutputUsedInComputingInputNodesGradients() const override
+    {
+        return false;
+    }
+    virtual bool InputUsedInComputingInputNodesGradients(size_t /*childIndex*/) const override
+    {
+        return false;
+    }
+
+    virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
+    {
+        ValidateUnaryMap(isFinalValidationPass);
+    }
+
+private:
+    shared_ptr<Matrix<ElemType>> m_inputDeviceGradient;
+};
+
+template class DeviceTransferNode<float>;
+template class DeviceTransferNode<double>;
+
 // -----------------------------------------------------------------------
 // RowSliceNode (input)
 // this node extracts part of the input by rows as the output
@@ -324,6 +401,11 @@ public:
         return false;
     }
 
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override
+    {
+        return true;
+    }
+
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
     {
         ValueFor(fr).AssignRowSliceValuesOf(Input(0)->ValueFor(fr), m_startIndex, m_sliceHeight);
@@ -428,6 +510,7 @@ public:
 
     virtual bool OutputUsedInComputingInputNodesGradients() const override { return false; }
     virtual bool InputUsedInComputingInputNodesGradients(size_t /*childIndex*/) const override { return false; }
+    virtual bool /*ComputationNodeBase::*/ SupportsActiveSequencePrefix() const override { return true; }
 
     virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
     {
@@ -583,6 +666,151 @@ private:
 template class RowRepeatNode<float>;
 template class RowRepeatNode<double>;
 
+// -----------------------------------------------------------------------
+// ContextWindowNode (input, leftContext, rightContext)
+// Stacks each frame with its leftContext preceding and rightContext following frames of the same sequence, like the
+// readers' contextWindow option (augmentneighbors), but on the device, so that only the raw frames need to be uploaded.
+// The output for frame t is [x(t-leftContext); ...; x(t); ...; x(t+rightContext)]. At the sequence boundaries, the first
+// and last frames are repeated. A sequence that extends beyond the minibatch is treated as ending at the minibatch boundary.
+// Normalization and deltas need no special support: apply PerDimMeanVarNormalization to the input, and compute deltas
+// as a Times of a constant matrix with the output (they are linear functions of the window).
+// This works across frames, and is thus not allowed inside a recurrent loop.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class ContextWindowNode : public ComputationNodeNonLooping<ElemType>, public NumInputs<1>
+{
+    typedef ComputationNodeNonLooping<ElemType> Base;
+    UsingComputationNodeMembersBoilerplate;
+    static const std::wstring TypeName()
+    {
+        return L"ContextWindow";
+    }
+
+public:
+    ContextWindowNode(DEVICEID_TYPE deviceId, const wstring& name, size_t leftContext = 0, size_t rightContext = 0)
+        : Base(deviceId, name),
+          m_leftContext(leftContext),
+          m_rightContext(rightContext)
+    {
+    }
+    ContextWindowNode(const ScriptableObjects::IConfigRecordPtr configp)
+        : ContextWindowNode(configp->Get(L"deviceId"), L"<placeholder>", configp->Get(L"leftContext"), configp->Get(L"rightContext"))
+    {
+        AttachInputs(configp, this->GetExpectedNumInputs());
+    }
+
+    virtual void CopyTo(ComputationNodeBasePtr nodeP, const std::wstring& newName, const CopyNodeFlags flags) const override
+    {
+        Base::CopyTo(nodeP, newName, flags);
+        if (flags & CopyNodeFlags::copyNodeValue)
+        {
+            auto node = dynamic_pointer_cast<ContextWindowNode<ElemType>>(nodeP);
+            node->m_leftContext = m_leftContext;
+            node->m_rightContext = m_rightContext;
+        }
+    }
+
+    virtual void Save(File& fstream) const override
+    {
+        Base::Save(fstream);
+        fstream << m_leftContext << m_rightContext;
+    }
+
+    virtual void Load(File& fstream, size_t modelVersion) override
+    {
+        Base::Load(fstream, modelVersion);
+        fstream >> m_leftContext >> m_rightContext;
+    }
+
+    virtual void PrintSelfBeforeValidation() const override
+    {
+        Base::PrintSelfBeforeValidation();
+        fprintf(stderr, ", leftContext=%lu, rightContext=%lu", m_leftContext, m_rightContext);
+    }
+
+    virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
+    {
+        Base::Validate(isFinalValidationPass);
+        InferMBLayoutFromInputsForStandardCase();
+
+        if (isFinalValidationPass && !HasMBLayout())
+            InvalidArgument("%ls %ls operation requires its input to be a sequence.", NodeName().c_str(), OperationName().c_str());
+
+        SetDims(TensorShape(GetInputSampleLayout(0).GetNumElements() * GetWindowSize()), HasMBLayout());
+    }
+
+    // The output, viewed as one column per window position, is a single gather of input columns.
+    virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
+    {
+        UpdateWindowIndex();
+        const auto& input = Input(0)->Value();
+        Value().Reshaped(input.GetNumRows(), m_windowIndex->GetNumCols()).DoGatherColumnsOf(0, *m_windowIndex, input, 1);
+    }
+
+    // Each input frame occurs in several windows; the scatter adds up all of them.
+    virtual void /*ComputationNodeNonLooping::*/ BackpropToNonLooping(size_t /*inputIndex*/) override
+    {
+        auto& inputGradient = Input(0)->Gradient();
+        inputGradient.DoScatterColumnsOf(1, *m_windowIndex, Gradient().Reshaped(inputGradient.GetNumRows(), m_windowIndex->GetNumCols()), 1);
+    }
+
+    virtual bool OutputUsedInComputingInputNodesGradients() const override
+    {
+        return false;
+    }
+    virtual bool InputUsedInComputingInputNodesGradients(size_t /*childIndex*/) const override
+    {
+        return false;
+    }
+
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool) override
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        CreateMatrixIfNull(m_windowIndex);
+    }
+
+private:
+    size_t GetWindowSize() const
+    {
+        return m_leftContext + 1 + m_rightContext;
+    }
+
+    // m_windowIndex[j * windowSize + k] is the input column of window position k of output column j, or -1 for gaps
+    void UpdateWindowIndex()
+    {
+        const auto& pMBLayout = GetMBLayout();
+        const size_t numParallelSequences = pMBLayout->GetNumParallelSequences();
+        const ptrdiff_t numTimeSteps = (ptrdiff_t) pMBLayout->GetNumTimeSteps();
+        const size_t windowSize = GetWindowSize();
+        vector<ElemType> windowIndex(pMBLayout->GetNumCols() * windowSize, (ElemType) -1);
+        for (const auto& seq : pMBLayout->GetAllSequences())
+        {
+            if (seq.seqId == GAP_SEQUENCE_ID)
+                continue;
+            const ptrdiff_t tBegin = max(seq.tBegin, (ptrdiff_t) 0);
+            const ptrdiff_t tEnd = min((ptrdiff_t) seq.tEnd, numTimeSteps);
+            for (ptrdiff_t t = tBegin; t < tEnd; t++)
+            {
+                const size_t j = t * numParallelSequences + seq.s;
+                for (size_t k = 0; k < windowSize; k++)
+                {
+                    const ptrdiff_t tIn = min(max(t + (ptrdiff_t) k - (ptrdiff_t) m_leftContext, tBegin), tEnd - 1);
+                    windowIndex[j * windowSize + k] = (ElemType) (tIn * numParallelSequences + seq.s);
+                }
+            }
+        }
+        m_windowIndex->SetValue(1, windowIndex.size(), m_deviceId, windowIndex.data());
+    }
+
+    size_t m_leftContext;
+    size_t m_rightContext;
+    shared_ptr<Matrix<ElemType>> m_windowIndex;
+};
+
+template class ContextWindowNode<float>;
+template class ContextWindowNode<double>;
+
 // -----------------------------------------------------------------------
 // DiagonalNode -- extract diagonal elements of a square matrix into a row vector
 // -----------------------------------------------------------------------
@@ -14,6 +14,7 @@
 #include <stdexcept>
 #include <list>
 #include <memory>
+#include <random>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -113,6 +114,8 @@ template class SquareErrorNode<double>;
 // -----------------------------------------------------------------------
 // CrossEntropyWithSoftmaxNode (labels, prediction)
 // calculates: -sum(left_i * log(softmax_i(right)))
+// The softmax is never materialized: forward runs a fused kernel that only keeps the per-column log-sum-exp of 'right',
+// from which the gradient kernel recomputes the softmax on the fly.
 // -----------------------------------------------------------------------
 
 template <class ElemType>
@@ -138,8 +141,11 @@ public:
         // left input is scalar
         if (inputIndex == 0) // left derivative
         {
+            // gradients w.r.t. the labels are rare, so only this path pays for a full log softmax
+            m_logSoftmaxOfRight->AssignLogSoftmaxOf(Input(1)->ValueFor(fr), true);
+            MaskMissingColumnsToZero(*m_logSoftmaxOfRight, Input(1)->GetMBLayout(), fr);
 #if DUMPOUTPUT
-            *m_logSoftmaxOfRight.Print("CrossEntropyWithSoftmax Partial-logSoftmaxOfRight");
+            m_logSoftmaxOfRight->Print("CrossEntropyWithSoftmax Partial-logSoftmaxOfRight");
             Gradient().Print("CrossEntropyWithSoftmax Partial-gradientValues");
             Input(0)->GradientFor(fr).Print("CrossEntropyWithSoftmaxNode Partial-Left-in");
 #endif
@@ -154,14 +160,15 @@ public:
         else if (inputIndex == 1) // right derivative
         {
 #if DUMPOUTPUT
-            *m_softmaxOfRight.Print("CrossEntropyWithSoftmax Partial-softmaxOfRight");
+            m_logSumExpOfRight->Print("CrossEntropyWithSoftmax Partial-logSumExpOfRight");
             Input(0)->ValueFor(fr).Print("CrossEntropyWithSoftmax Partial-inputFunctionValues");
             Gradient().Print("CrossEntropyWithSoftmax Partial-gradientValues");
             Input(1)->GradientFor(fr).Print("CrossEntropyWithSoftmaxNode Partial-Right-in");
 #endif
 
+            // gradient += Gradient() * (softmax(right) - left), in a single pass
             auto gradient = Input(1)->GradientFor(fr);
-            Matrix<ElemType>::AddScaledDifference(Gradient(), *m_softmaxOfRight, Input(0)->ValueFor(fr), gradient);
+            Matrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(Gradient(), Input(0)->ValueFor(fr), Input(1)->ValueFor(fr), *m_logSumExpOfRight, gradient);
 #if DUMPOUTPUT
             Input(1)->GradientFor(fr).Print("CrossEntropyWithSoftmaxNode Partial-Right");
 #endif
@@ -178,23 +185,15 @@ public:
 
     virtual void UpdateFunctionMBSize() override
     {
-        m_logSoftmaxOfRight->Resize(Input(1)->Value());
-        m_softmaxOfRight->Resize(*m_logSoftmaxOfRight);
+        m_logSumExpOfRight->Resize(1, Input(1)->Value().GetNumCols());
     }
 
     virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override // -sum(left_i * log(softmax_i(right)))
     {
         FrameRange fr(Input(0)->GetMBLayout());
-        // first compute the softmax (column-wise)
-        // Note that we need both log and non-log for gradient computation.
-        m_logSoftmaxOfRight->AssignLogSoftmaxOf(Input(1)->ValueFor(fr), true);
-        m_softmaxOfRight->SetValue(*m_logSoftmaxOfRight);
-        m_softmaxOfRight->InplaceExp();
-        // flatten all gaps to zero, such that gaps will contribute zero to the sum
-        MaskMissingColumnsToZero(*m_logSoftmaxOfRight, Input(1)->GetMBLayout(), fr);
-        // reduce over all frames
-        Value().AssignInnerProductOfMatrices(Input(0)->MaskedValueFor(fr), *m_logSoftmaxOfRight);
-        Value() *= -1;
+        // max, log-sum-exp and the reduction over all frames in one go, column-wise;
+        // gaps have zero (masked) labels, such that they contribute zero to the sum
+        Value().AssignCrossEntropyWithSoftmaxOf(Input(0)->MaskedValueFor(fr), Input(1)->ValueFor(fr), *m_logSumExpOfRight);
 #if NANCHECK
         Value().HasNan("CrossEntropyWithSoftmax");
 #endif
@@ -214,8 +213,7 @@ public:
         if (flags & CopyNodeFlags::copyNodeValue)
         {
             auto node = dynamic_pointer_cast<CrossEntropyWithSoftmaxNode<ElemType>>(nodeP);
-            *node->m_logSoftmaxOfRight = *m_logSoftmaxOfRight;
-            *node->m_softmaxOfRight = *m_softmaxOfRight;
+            *node->m_logSumExpOfRight = *m_logSumExpOfRight;
         }
     }
 
@@ -223,13 +221,27 @@ public:
     virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
     {
         Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool);
-        RequestMatrixFromPool(m_softmaxOfRight, matrixPool);
+        RequestMatrixFromPool(m_logSumExpOfRight, matrixPool);
+    }
+
+    // the full log softmax is only needed for the gradient w.r.t. the labels
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        if (Input(0)->NeedGradient())
+            RequestMatrixFromPool(m_logSoftmaxOfRight, matrixPool);
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool)
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        if (m_logSoftmaxOfRight)
+            ReleaseMatrixToPool(m_logSoftmaxOfRight, matrixPool);
     }
 
 protected:
-    shared_ptr<Matrix<ElemType>> m_logSoftmaxOfRight;
-    shared_ptr<Matrix<ElemType>> m_softmaxOfRight;
+    shared_ptr<Matrix<ElemType>> m_logSumExpOfRight; // 1 x T: log sum_i exp(right(i,t))
+    shared_ptr<Matrix<ElemType>> m_logSoftmaxOfRight; // only while computing the gradient w.r.t. the labels
 };
 
 template class CrossEntropyWithSoftmaxNode<float>;
@@ -695,6 +707,287 @@ private:
 template class NoiseContrastiveEstimationNode<float>;
 template class NoiseContrastiveEstimationNode<double>;
 
+// -----------------------------------------------------------------------
+// SampledCrossEntropyWithSoftmaxNode (labelIndices(.,t), inputdata(.,t), embeddingMatrix)
+// sampled-softmax training criterion for large output vocabularies
+//  - Input(0) [1 x T] word index of the label, e.g. the first row of the labels of ClassBasedCrossEntropyWithSoftmax
+//  - Input(1) [hdsize x T] hidden layer activation to the node
+//  - Input(2) [hdsize x vocab_size] weight matrix; the logit of word w is column w times the hidden activation
+// For each minibatch, numSamples words are drawn with replacement from the log-uniform (Zipfian) proposal
+// P(w) = log((w+2)/(w+1)) / log(vocab_size+1), i.e. the word indices are expected to be sorted by decreasing frequency.
+// The softmax of each frame then runs only over its label and the shared samples, with every logit corrected by the
+// log of the word's expected sample count, and with samples that hit the label removed. Only the needed weight columns
+// are gathered, and their gradients scattered back, so that the cost scales with numSamples x T instead of vocab_size x T.
+// The expected counts are a table on the device, as are all per-minibatch index vectors.
+// To evaluate, use CrossEntropyWithSoftmax over the full output, with the same weights.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class SampledCrossEntropyWithSoftmaxNode : public ComputationNodeNonLooping /*ComputationNode*/<ElemType>, public NumInputs<3>
+{
+    typedef ComputationNodeNonLooping<ElemType> Base;
+    UsingComputationNodeMembersBoilerplate;
+    static const std::wstring TypeName()
+    {
+        return L"SampledCrossEntropyWithSoftmax";
+    }
+
+public:
+    SampledCrossEntropyWithSoftmaxNode(DEVICEID_TYPE deviceId, const wstring& name, size_t numSamples = 0)
+        : Base(deviceId, name), m_numSamples(numSamples), m_needRecomputeGradientToLogits(false)
+    {
+        m_randomGenerator.seed((unsigned long) CreateUniqId());
+    }
+    SampledCrossEntropyWithSoftmaxNode(const ScriptableObjects::IConfigRecordPtr configp)
+        : SampledCrossEntropyWithSoftmaxNode(configp->Get(L"deviceId"), L"<placeholder>", configp->Get(L"numSamples"))
+    {
+        AttachInputs(configp, this->GetExpectedNumInputs());
+    }
+
+    virtual void Save(File& fstream) const override
+    {
+        Base::Save(fstream);
+        fstream << m_numSamples;
+    }
+
+    virtual void Load(File& fstream, size_t modelVersion) override
+    {
+        Base::Load(fstream, modelVersion);
+        fstream >> m_numSamples;
+        if (m_logExpectedCounts)
+            m_logExpectedCounts->Resize(0, 0); // (depends on m_numSamples)
+    }
+
+    virtual void CopyTo(ComputationNodeBasePtr nodeP, const std::wstring& newName, const CopyNodeFlags flags) const override
+    {
+        Base::CopyTo(nodeP, newName, flags);
+        if (flags & CopyNodeFlags::copyNodeValue)
+        {
+            auto node = dynamic_pointer_cast<SampledCrossEntropyWithSoftmaxNode<ElemType>>(nodeP);
+            node->m_numSamples = m_numSamples;
+        }
+    }
+
+    virtual void BackpropToNonLooping(size_t inputIndex) override
+    {
+        if (inputIndex == 0)
+            InvalidArgument("%ls %ls operation cannot compute the gradient with respect to the labels.", NodeName().c_str(), OperationName().c_str());
+
+        FrameRange fr(Input(0)->GetMBLayout());
+        if (m_needRecomputeGradientToLogits)
+            ComputeGradientToLogits(fr);
+
+        if (inputIndex == 1) // hidden activation: W(:,samples) * dSampledLogits + W(:,label) .* dLabelLogit
+        {
+            auto gradient = Input(1)->GradientFor(fr);
+            Matrix<ElemType>::MultiplyAndAdd(*m_sampledWeights, false, *m_sampledLogitsGradient, false, gradient);
+            TensorView<ElemType>(gradient).AddElementwiseProductOf(TensorView<ElemType>(*m_labelWeights), TensorView<ElemType>(*m_labelLogitsGradient));
+        }
+        else // weights: only the gathered columns receive a gradient
+        {
+            Matrix<ElemType> hidden = Input(1)->MaskedValueFor(fr); // (gap columns may hold NaNs)
+            auto& gradient = Input(2)->GradientAsMatrix();
+            m_weightsGradient->AssignProductOf(hidden, false, *m_sampledLogitsGradient, true);
+            gradient.DoScatterColumnsOf(1, *m_sampledIds, *m_weightsGradient, 1);
+            m_weightsGradient->Resize(hidden.GetNumRows(), hidden.GetNumCols());
+            TensorView<ElemType>(*m_weightsGradient).AssignElementwiseProductOf(TensorView<ElemType>(hidden), TensorView<ElemType>(*m_labelLogitsGradient));
+            gradient.DoScatterColumnsOf(1, Input(0)->MaskedValueFor(fr), *m_weightsGradient, 1);
+        }
+    }
+
+    virtual bool OutputUsedInComputingInputNodesGradients() const override
+    {
+        return false;
+    }
+
+    virtual void UpdateFunctionMBSize() override
+    {
+        // (the temporaries are resized by the operations that compute them)
+    }
+
+    virtual void /*ComputationNodeNonLooping::*/ ForwardPropNonLooping() override
+    {
+        FrameRange fr(Input(0)->GetMBLayout());
+        UpdateLogExpectedCounts();
+        DrawSamples();
+
+        Matrix<ElemType> labels = Input(0)->MaskedValueFor(fr); // (gaps become word 0; they are excluded from the criterion below)
+        Matrix<ElemType> hidden = Input(1)->ValueFor(fr);
+        const Matrix<ElemType>& weights = Input(2)->ValueAsMatrix();
+        const size_t K = m_numSamples;
+        const size_t T = hidden.GetNumCols();
+
+        // gather what is needed of the weights and expected counts
+        m_sampledWeights->DoGatherColumnsOf(0, *m_sampledIds, weights, 1);                           // [hdsize x K]
+        m_labelWeights->DoGatherColumnsOf(0, labels, weights, 1);                                    // [hdsize x T]
+        m_sampledLogExpectedCounts->DoGatherColumnsOf(0, *m_sampledIds, *m_logExpectedCounts, 1);    // [1 x K]
+        m_labelLogExpectedCounts->DoGatherColumnsOf(0, labels, *m_logExpectedCounts, 1);             // [1 x T]
+
+        // logits [(1+K) x T]: row 0 is the label, rows 1..K are the samples
+        m_logits->Resize(1 + K, T);
+        TensorView<ElemType> labelLogits(*m_logits, TensorShape(1 + K, T).NarrowTo(0, 0, 1));
+        TensorView<ElemType> sampledLogits(*m_logits, TensorShape(1 + K, T).NarrowTo(0, 1, 1 + K));
+        labelLogits.AssignElementwiseProductOf(TensorView<ElemType>(*m_labelWeights), TensorView<ElemType>(hidden)); // (reduces over hdsize)
+        labelLogits.AddCopyOf(TensorView<ElemType>(*m_labelLogExpectedCounts), -1);
+        m_sampledLogitsGradient->AssignProductOf(*m_sampledWeights, true, hidden, false); // (used as a temp here)
+        sampledLogits.AssignDifferenceOf(TensorView<ElemType>(*m_sampledLogitsGradient), TensorView<ElemType>(*m_sampledLogExpectedCounts, TensorShape(K, 1)));
+        // a sample that equals the frame's label must not compete with it
+        TensorView<ElemType>(*m_sampledLogitsGradient).AssignEQOf(TensorView<ElemType>(*m_sampledIds, TensorShape(K, 1)), TensorView<ElemType>(labels));
+        sampledLogits.AddCopyOf(TensorView<ElemType>(*m_sampledLogitsGradient), (ElemType) -1e30);
+
+        // the target is always row 0; gap frames get none, such that they contribute zero to the sum
+        m_targets->Resize(1 + K, T);
+        m_targets->SetValue(0);
+        m_one->Resize(1, 1);
+        m_one->SetValue(1);
+        TensorView<ElemType>(*m_targets, TensorShape(1 + K, T).NarrowTo(0, 0, 1)).AssignCopyOf(TensorView<ElemType>(*m_one));
+        MaskMissingColumnsToZero(*m_targets, Input(1)->GetMBLayout(), fr);
+
+        Value().AssignCrossEntropyWithSoftmaxOf(*m_targets, *m_logits, *m_logSumExp);
+        m_needRecomputeGradientToLogits = true;
+#if NANCHECK
+        Value().HasNan("SampledCrossEntropyWithSoftmax");
+#endif
+    }
+
+    virtual void /*ComputationNodeBase::*/ Validate(bool isFinalValidationPass) override
+    {
+        Base::Validate(isFinalValidationPass);
+        m_pMBLayout = nullptr; // this node does not hold mini-batch data
+
+        if (isFinalValidationPass)
+        {
+            if (!Input(0)->HasMBLayout() || !Input(1)->HasMBLayout() || Input(2)->HasMBLayout())
+                InvalidArgument("%ls %ls operation requires inputs 0 and 1 to be a minibatch, and input 2 to be a matrix.", NodeName().c_str(), OperationName().c_str());
+            if (Input(0)->GetMBLayout() != Input(1)->GetMBLayout())
+                InvalidArgument("%ls %ls operation requires the labels and the hidden activations to have the same layout.", NodeName().c_str(), OperationName().c_str());
+            if (Input(0)->GetSampleMatrixNumRows() != 1)
+                InvalidArgument("%ls %ls operation requires the labels to be word indices, i.e. a single row, but they have %d rows.", NodeName().c_str(), OperationName().c_str(), (int) Input(0)->GetSampleMatrixNumRows());
+            if (Input(1)->GetSampleMatrixNumRows() != Input(2)->GetAsMatrixNumRows())
+                InvalidArgument("%ls %ls operation: The hidden dimension %d does not match the %d rows of the weights.", NodeName().c_str(), OperationName().c_str(),
+                                (int) Input(1)->GetSampleMatrixNumRows(), (int) Input(2)->GetAsMatrixNumRows());
+            if (m_numSamples == 0 || m_numSamples >= Input(2)->GetAsMatrixNumCols())
+                InvalidArgument("%ls %ls operation requires numSamples to be positive and less than the vocabulary size %d.", NodeName().c_str(), OperationName().c_str(), (int) Input(2)->GetAsMatrixNumCols());
+        }
+
+        SetDims(TensorShape(1), false);
+    }
+
+    virtual void DumpNodeInfo(const bool printValues, File& fstream) const override
+    {
+        Base::DumpNodeInfo(printValues, fstream);
+        char str[4096];
+        sprintf(str, "numSamples=%lu\n", m_numSamples);
+        fstream << string(str);
+    }
+
+    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
+    {
+        Base::RequestMatricesBeforeForwardProp(matrixPool);
+        RequestMatrixFromPool(m_sampledWeights, matrixPool);
+        RequestMatrixFromPool(m_labelWeights, matrixPool);
+        RequestMatrixFromPool(m_sampledLogExpectedCounts, matrixPool);
+        RequestMatrixFromPool(m_labelLogExpectedCounts, matrixPool);
+        RequestMatrixFromPool(m_sampledLogitsGradient, matrixPool);
+        RequestMatrixFromPool(m_logits, matrixPool);
+        RequestMatrixFromPool(m_targets, matrixPool);
+        RequestMatrixFromPool(m_logSumExp, matrixPool);
+        CreateMatrixIfNull(m_logExpectedCounts);
+        CreateMatrixIfNull(m_sampledIds);
+        CreateMatrixIfNull(m_one);
+    }
+
+    virtual void RequestMatricesBeforeBackprop(MatrixPool& matrixPool)
+    {
+        Base::RequestMatricesBeforeBackprop(matrixPool);
+        RequestMatrixFromPool(m_logitsGradient, matrixPool);
+        RequestMatrixFromPool(m_labelLogitsGradient, matrixPool);
+        RequestMatrixFromPool(m_weightsGradient, matrixPool);
+    }
+
+    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool)
+    {
+        Base::ReleaseMatricesAfterBackprop(matrixPool);
+        ReleaseMatrixToPool(m_sampledWeights, matrixPool);
+        ReleaseMatrixToPool(m_labelWeights, matrixPool);
+        ReleaseMatrixToPool(m_sampledLogExpectedCounts, matrixPool);
+        ReleaseMatrixToPool(m_labelLogExpectedCounts, matrixPool);
+        ReleaseMatrixToPool(m_sampledLogitsGradient, matrixPool);
+        ReleaseMatrixToPool(m_logits, matrixPool);
+        ReleaseMatrixToPool(m_targets, matrixPool);
+        ReleaseMatrixToPool(m_logSumExp, matrixPool);
+        ReleaseMatrixToPool(m_logitsGradient, matrixPool);
+        ReleaseMatrixToPool(m_labelLogitsGradient, matrixPool);
+        ReleaseMatrixToPool(m_weightsGradient, matrixPool);
+    }
+
+private:
+    // log of the expected number of times each word is drawn among numSamples, log(numSamples * P(w)), as a [1 x vocab_size] table
+    // Computed once in double precision, since P(w) of the rare words is far below float resolution of 1 + 1/(w+1).
+    void UpdateLogExpectedCounts()
+    {
+        const size_t vocabSize = Input(2)->GetAsMatrixNumCols();
+        if (m_logExpectedCounts->GetNumCols() == vocabSize)
+            return;
+        const double logRange = log((double) vocabSize + 1);
+        vector<ElemType> table(vocabSize);
+        for (size_t w = 0; w < vocabSize; w++)
+            table[w] = (ElemType) log(m_numSamples * log1p(1.0 / (w + 1)) / logRange);
+        m_logExpectedCounts->SetValue(1, vocabSize, m_deviceId, table.data());
+    }
+
+    // draw m_numSamples word indices from the log-uniform proposal by inverting its CDF, log(w+1) / log(vocab_size+1)
+    void DrawSamples()
+    {
+        const size_t vocabSize = Input(2)->GetAsMatrixNumCols();
+        const double logRange = log((double) vocabSize + 1);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        vector<ElemType> ids(m_numSamples);
+        for (auto& id : ids)
+            id = (ElemType) min((size_t) (exp(uniform(m_randomGenerator) * logRange) - 1), vocabSize - 1);
+        m_sampledIds->SetValue(1, ids.size(), m_deviceId, ids.data());
+    }
+
+    // Gradient() * (softmax - targets), split into the label row [1 x T] and the contiguous sample rows [K x T]
+    void ComputeGradientToLogits(const FrameRange& fr)
+    {
+        const size_t K = m_numSamples;
+        const size_t T = m_logits->GetNumCols();
+        m_logitsGradient->Resize(1 + K, T);
+        m_logitsGradient->SetValue(0);
+        Matrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(Gradient(), *m_targets, *m_logits, *m_logSumExp, *m_logitsGradient);
+        MaskMissingColumnsToZero(*m_logitsGradient, Input(1)->GetMBLayout(), fr);
+
+        m_labelLogitsGradient->Resize(1, T);
+        TensorView<ElemType>(*m_labelLogitsGradient).AssignCopyOf(TensorView<ElemType>(*m_logitsGradient, TensorShape(1 + K, T).NarrowTo(0, 0, 1)));
+        m_sampledLogitsGradient->Resize(K, T);
+        TensorView<ElemType>(*m_sampledLogitsGradient).AssignCopyOf(TensorView<ElemType>(*m_logitsGradient, TensorShape(1 + K, T).NarrowTo(0, 1, 1 + K)));
+        m_needRecomputeGradientToLogits = false;
+    }
+
+    size_t m_numSamples;
+    std::mt19937 m_randomGenerator;
+    bool m_needRecomputeGradientToLogits;
+
+    shared_ptr<Matrix<ElemType>> m_logExpectedCounts;        // [1 x vocab_size]
+    shared_ptr<Matrix<ElemType>> m_sampledIds;               // [1 x K]
+    shared_ptr<Matrix<ElemType>> m_one;                      // [1 x 1]
+    shared_ptr<Matrix<ElemType>> m_sampledWeights;           // [hdsize x K]
+    shared_ptr<Matrix<ElemType>> m_labelWeights;             // [hdsize x T]
+    shared_ptr<Matrix<ElemType>> m_sampledLogExpectedCounts; // [1 x K]
+    shared_ptr<Matrix<ElemType>> m_labelLogExpectedCounts;   // [1 x T]
+    shared_ptr<Matrix<ElemType>> m_logits;                   // [(1+K) x T]
+    shared_ptr<Matrix<ElemType>> m_targets;                  // [(1+K) x T]
+    shared_ptr<Matrix<ElemType>> m_logSumExp;                // [1 x T]
+    shared_ptr<Matrix<ElemType>> m_logitsGradient;           // [(1+K) x T]
+    shared_ptr<Matrix<ElemType>> m_labelLogitsGradient;      // [1 x T]
+    shared_ptr<Matrix<ElemType>> m_sampledLogitsGradient;    // [K x T]
+    shared_ptr<Matrix<ElemType>> m_weightsGradient;          // [hdsize x K], then [hdsize x T]
+};
+
+template class SampledCrossEntropyWithSoftmaxNode<float>;
+template class SampledCrossEntropyWithSoftmaxNode<double>;
+
 // -----------------------------------------------------------------------
 // ClassBasedCrossEntropyWithSoftmaxNode (labeldata(.,t), inputdata(.,t), embeddingMatrix, clsProbBeforeSoftmaxData(.,t))
 //  - Input(0) [4 x T] label in dense matrix in
@@ -1187,9 +1480,6 @@ public:
                                const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores)
     {
         // to-do, shift more than 1 to support muliple sentences per minibatch
-        int iNumPos = lbls.GetNumCols();
-        int iNumLab = lbls.GetNumRows();
-
         int firstLbl = -1;
         for (int ik = 0; ik < lbls.GetNumRows(); ik++)
             if (lbls(ik, 0) != 0)
@@ -1198,25 +1488,8 @@ public:
                 break;
             }
 
-        // need to have
-        alpha.Resize(iNumLab, iNumPos);
-
-        for (int t = 0; t < iNumPos; t++)
-        {
-            for (int k = 0; k < iNumLab; k++)
-            {
-                ElemType fTmp = (ElemType) LZERO;
-                for (int j = 0; j < iNumLab; j++)
-                {
-                    ElemType fAlpha = (j == firstLbl) ? (ElemType) 0.0 : (ElemType) LZERO;
-                    if (t > 0)
-                        fAlpha = alpha(j, t - 1);
-                    fTmp = alpha.LogAdd(fTmp, fAlpha + pair_scores(k, j));
-                }
-                fTmp += pos_scores(k, t); // include position dependent score
-                alpha(k, t) = fTmp;
-            }
-        }
+        // alpha recursion on the device of the scores, all labels of a time step in parallel
+        Matrix<ElemType>::RCRFForwardCompute(pos_scores, pair_scores, alpha, firstLbl);
     }
 
     // compute backward algorithm
@@ -1462,6 +1735,8 @@ template class LogisticNode<double>;
 // -----------------------------------------------------------------------
 // DropoutNode (input) -- perform drop-out
 // Output is scaled such that no post-scaling is necessary.
+// The mask is not stored. It is a hash of a per-minibatch seed and the element's index in the
+// minibatch (see AssignDropoutOf()), so that the backward pass regenerates it.
 // -----------------------------------------------------------------------
 
 template <class ElemType>
@@ -1481,6 +1756,7 @@ public:
           m_dropoutRate(0)
     {
         m_randomSeed = (unsigned long) CreateUniqId();
+        m_maskSeed = m_randomSeed;
     }
 
     virtual void /*ComputationNode::*/ BackpropTo(const size_t inputIndex, const FrameRange& fr) override
@@ -1489,7 +1765,7 @@ public:
         Matrix<ElemType> sliceOutputGrad = GradientFor(fr);
 
         if (m_dropoutRate > 0)
-            sliceInput0Grad.AddElementProductOf(sliceOutputGrad, DataFor(*m_maskOfDropout, fr));
+            sliceInput0Grad.AddDropoutOf(sliceOutputGrad, m_dropoutRate, m_maskSeed, FirstElementIndexFor(fr));
         else
             sliceInput0Grad += sliceOutputGrad;
     }
@@ -1509,12 +1785,17 @@ public:
         return false;
     }
 
-    virtual void UpdateFunctionMBSize() override
+    virtual bool /*ComputationNodeBase::*/ CanComputeValueInPlaceOfInput(size_t /*i*/) const override
     {
-        Base::UpdateFunctionMBSize();
-        // resize temporaries to their proper size
-        if (m_dropoutRate > 0)
-            m_maskOfDropout->Resize(Input(0)->Value());
+        return true;
+    }
+
+    virtual void /*IComputationNode::*/ BeginForwardProp() override
+    {
+        Base::BeginForwardProp();
+        // determine the drop-out mask for this minibatch; inside a loop, all frames share the seed and differ by element index
+        m_maskSeed = m_randomSeed;
+        m_randomSeed += 1073807359; // 1073807359 is a very large prime number to avoid collision with other dropout nodes
     }
 
     virtual void /*ComputationNode::*/ ForwardProp(const FrameRange& fr) override
@@ -1523,15 +1804,8 @@ public:
         Matrix<ElemType> sliceOutputValue = ValueFor(fr);
 
         if (m_dropoutRate > 0)
-        {
-            // determine drop-out mask for this minibatch
-            auto sliceMask = DataFor(*m_maskOfDropout, fr);
-            sliceMask.SetUniformRandomMask((ElemType) m_dropoutRate, (ElemType)(1.0 / (1.0 - m_dropoutRate)) /*pre-scaled*/, m_randomSeed);
-            m_randomSeed += 1073807359; // 1073807359 is a very large prime number to avoid collision with other dropout nodes
-            // apply dropout mask
-            sliceOutputValue.AssignElementProductOf(sliceMask, sliceInput0Value);
-        }
-        else
+            sliceOutputValue.AssignDropoutOf(sliceInput0Value, m_dropoutRate, m_maskSeed, FirstElementIndexFor(fr));
+        else if (sliceOutputValue.BufferPointer() != sliceInput0Value.BufferPointer()) // (nothing to do if computed in place)
         {
             sliceOutputValue.SetValue(sliceInput0Value);
         }
@@ -1563,28 +1837,20 @@ public:
             auto node = dynamic_pointer_cast<DropoutNode<ElemType>>(nodeP);
             node->m_dropoutRate = m_dropoutRate;
             node->m_randomSeed = m_randomSeed;
-            node->m_maskOfDropout = m_maskOfDropout;
+            node->m_maskSeed = m_maskSeed;
         }
     }
-    // request matrices needed to do node function value evaluation
-    virtual void RequestMatricesBeforeForwardProp(MatrixPool& matrixPool)
-    {
-        Base::RequestMatricesBeforeForwardProp(matrixPool);
-        RequestMatrixFromPool(m_maskOfDropout, matrixPool);
-    }
 
-    // release gradient and temp matrices that no longer needed after all the children's gradients are computed.
-    virtual void ReleaseMatricesAfterBackprop(MatrixPool& matrixPool)
+private:
+    // index of the first element of the slice for 'fr' within the whole minibatch, which identifies the mask elements
+    size_t FirstElementIndexFor(const FrameRange& fr) const
     {
-        Base::ReleaseMatricesAfterBackprop(matrixPool);
-        ReleaseMatrixToPool(m_maskOfDropout, matrixPool);
+        return ColumnRangeWithMBLayoutFor(Value().GetNumCols(), fr, GetMBLayout()).first * Value().GetNumRows();
     }
 
-private:
     double m_dropoutRate;
-    unsigned long m_randomSeed;
-
-    shared_ptr<Matrix<ElemType>> m_maskOfDropout;
+    unsigned long m_randomSeed; // seed of the next minibatch
+    unsigned long m_maskSeed;   // seed of the current minibatch's mask
 };
 
 template class DropoutNode<float>;
@@ -1790,6 +2056,9 @@ public:
             if (m_spatial)
             {
                 auto dims = ImageDimensions(shape, m_imageLayoutKind);
+                // The values are not transposed into the engine's layout; the legacy engine, which also handles CHW, takes it from the tensor.
+                if (m_inT == nullptr && m_factory->GetImageLayout() != m_imageLayoutKind)
+                    m_inT = std::make_unique<ConvolutionTensor4D>(dims.m_width, dims.m_height, dims.m_numChannels, 1, m_imageLayoutKind);
                 if (m_inT == nullptr)
                     m_inT = m_factory->CreateTensor(dims.m_width, dims.m_height, dims.m_numChannels, 1);
                 if (m_scaleBiasT == nullptr)
@@ -1842,6 +2111,15 @@ public:
         m_eval = bnEvalMode;
     }
 
+    bool IsSpatial() const
+    {
+        return m_spatial;
+    }
+    ImageLayoutKind GetImageLayoutKind() const
+    {
+        return m_imageLayoutKind;
+    }
+
 private:
     struct VersionInfo
     {
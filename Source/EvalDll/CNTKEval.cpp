@@ -9,7 +9,11 @@
 #define EVAL_EXPORTS // creating the exports here
 #include "Eval.h"
 #include "CNTKEval.h"
-#include "CPUMatrix.h" // for SetNumThreads()
+#include "CPUMatrix.h"              // for SetNumThreads()
+#include "CuDnnConvolutionEngine.h" // for SetAlgorithmCacheFile()
+#include "LinearAlgebraNodes.h"     // for TimesNode
+#include "RecurrentNodes.h"         // for PastValueNode, FutureValueNode
+#include "RNNNodes.h"               // for OptimizedRNNStackNode
 #include "SimpleOutputWriter.h"
 #ifdef LEAKDETECT
 #include <vld.h> // leak detection
@@ -47,6 +51,8 @@ void CNTKEval<ElemType>::Init(const std::string& config)
 {
     m_start = 0;
     m_config.Parse(config);
+    // (before loading the model, since it affects how the network is compiled)
+    ComputationNetwork::SetNumConcurrentStreams(m_config(L"concurrentStreams", (size_t) 0));
     if (m_config.Exists("modelPath"))
     {
         std::wstring path = m_config("modelPath");
@@ -54,6 +60,8 @@ void CNTKEval<ElemType>::Init(const std::string& config)
     }
     size_t nThreads = m_config("numCPUThreads", "1");
     CPUMatrix<ElemType>::SetNumThreads(nThreads);
+    // lets eval-server warmups skip the cuDNN auto-tuner
+    CuDnnConvolutionEngineFactory<ElemType>::SetAlgorithmCacheFile(m_config(L"cudnnAlgorithmCacheFile", L""));
 
     g_shareNodeValueMatrices = m_config(L"shareNodeValueMatrices", false);
 }
@@ -64,7 +72,11 @@ template <class ElemType>
 void CNTKEval<ElemType>::Destroy()
 {
     // cleanup everything
-    m_net.reset();
+    m_batcher.reset(); // (waits for the scheduler thread)
+    {
+        auto lock = LockMemoryGroup();
+        m_net.reset();
+    }
     delete m_reader;
     delete m_writer;
     delete this;
@@ -74,10 +86,166 @@ void CNTKEval<ElemType>::Destroy()
 // modelFileName - file holding the model to load
 template <class ElemType>
 void CNTKEval<ElemType>::LoadModel(const std::wstring& modelFileName)
+{
+    LoadModel(modelFileName, nullptr);
+}
+
+// LoadModel - load a model, optionally replacing its parameters by those of the same model loaded into another evaluator
+template <class ElemType>
+void CNTKEval<ElemType>::LoadModel(const std::wstring& modelFileName, const CNTKEval<ElemType>* sharedWith)
 {
     DEVICEID_TYPE deviceId = DeviceFromConfig(m_config);
     fprintf(stderr, "DeviceID=%d\n", (int) deviceId);
+
+    // optionally plan the matrices in the pool of a group of evaluators, which then run one at a time (see EvalMemoryGroup)
+    const std::wstring memoryGroup = m_config(L"memoryGroup", L"");
+    m_memoryGroup = memoryGroup.empty() ? nullptr : EvalMemoryGroup::Get(memoryGroup);
+    auto lock = LockMemoryGroup();
     m_net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelFileName);
+    if (m_memoryGroup)
+    {
+        m_net->SetMatrixPool(m_memoryGroup->GetMatrixPool());
+        if (!sharedWith)
+            fprintf(stderr, "Sharing the value matrices and workspaces of the model with the other evaluators of memory group '%ls'.\n", memoryGroup.c_str());
+    }
+    m_modelFileName = modelFileName;
+    m_nodeHandles.clear();
+    m_preparedOutputNodes.clear();
+    m_outputNodes.clear();
+    m_sessions.clear();
+
+    // optionally collect latency histograms (see GetLatencyHistograms())
+    m_latencyStatistics.reset(m_config(L"latencyStatistics", false) ? new EvalLatencyStatistics() : nullptr);
+    m_forwardTimer.reset(m_latencyStatistics ? new DeviceTimer(m_net->GetDeviceId()) : nullptr);
+    m_nodeProfiler.reset(); // (before creating another one)
+    if (m_latencyStatistics && m_config(L"latencyStatisticsPerNodeType", false))
+    {
+        if (NodeProfiler::Current())
+            fprintf(stderr, "WARNING: Another evaluator in this process times its nodes already; latencyStatisticsPerNodeType is ignored.\n");
+        else
+            m_nodeProfiler.reset(new NodeProfiler());
+    }
+
+    // optionally fold normalizations and constants and prune what the outputs don't need (before int8 quantization, which copies the weights)
+    if (m_config(L"optimizeForInference", false))
+    {
+        ConfigArray outputNodeNames = m_config(L"outputNodeNames", "");
+        vector<ComputationNodeBasePtr> outputNodes;
+        for (int i = 0; i < outputNodeNames.size(); ++i)
+            outputNodes.push_back(m_net->GetNodeFromName(outputNodeNames[i]));
+        m_net->OptimizeForInference<ElemType>(outputNodes);
+    }
+
+    // optionally run unidirectional LSTM stacks with the persistent kernel, which is faster for few parallel sequences (EvaluateSessions() always does)
+    if (m_config(L"persistentRNNInference", false))
+    {
+        size_t numPersistent = 0;
+        for (auto& node : m_net->GetNodesWithType(OperationNameOf(OptimizedRNNStackNode)))
+        {
+            auto rnnNode = dynamic_pointer_cast<OptimizedRNNStackNode<ElemType>>(node);
+            if (rnnNode && rnnNode->UsePersistentInference())
+                numPersistent++;
+        }
+        if (!sharedWith)
+            fprintf(stderr, "Using the persistent kernel for %d OptimizedRNNStack operations.\n", (int) numPersistent);
+    }
+
+    if (sharedWith)
+    {
+        ShareParametersWith(*sharedWith->m_net);
+        return;
+    }
+
+    // optionally replace the weights of TimesNodes by int8 copies, for faster inference on the CPU
+    if (m_config(L"quantizeTimesWeightsToInt8", false))
+    {
+        size_t numQuantized = 0;
+        for (auto& node : m_net->GetNodesWithType(OperationNameOf(TimesNode)))
+        {
+            auto timesNode = dynamic_pointer_cast<TimesNode<ElemType>>(node);
+            if (timesNode && timesNode->QuantizeWeightsToInt8())
+                numQuantized++;
+        }
+        fprintf(stderr, "Quantized the weights of %d Times operations to int8.\n", (int) numQuantized);
+    }
+
+    // optionally prepack the weights of TimesNodes on the CPU, for faster products with few columns (single-request evaluation)
+    if (m_config(L"packTimesWeightsForSmallBatches", false))
+    {
+        size_t numPacked = 0;
+        for (auto& node : m_net->GetNodesWithType(OperationNameOf(TimesNode)))
+        {
+            auto timesNode = dynamic_pointer_cast<TimesNode<ElemType>>(node);
+            if (timesNode && timesNode->PackWeightsForSmallBatches())
+                numPacked++;
+        }
+        fprintf(stderr, "Packed the weights of %d Times operations for small batches.\n", (int) numPacked);
+    }
+
+    // optionally replace the weights of TimesNodes that are at least this sparse (e.g. pruned in training) by sparse copies
+    const double minSparsity = m_config(L"sparsifyTimesWeights", 0.0);
+    if (minSparsity > 0)
+    {
+        size_t numSparsified = 0;
+        for (auto& node : m_net->GetNodesWithType(OperationNameOf(TimesNode)))
+        {
+            auto timesNode = dynamic_pointer_cast<TimesNode<ElemType>>(node);
+            if (timesNode && timesNode->SparsifyWeights(minSparsity))
+                numSparsified++;
+        }
+        fprintf(stderr, "Made the weights of %d Times operations sparse.\n", (int) numSparsified);
+    }
+}
+
+// ShareParametersWith - use the parameter values (and int8, packed, or sparse weights) of the same model loaded into another network
+// Our own copies are freed. A parameter that the other network does not have with the same name and dimensions (which
+// can only happen if the inference optimizations did not create the same nodes in both) keeps its own copy.
+template <class ElemType>
+void CNTKEval<ElemType>::ShareParametersWith(ComputationNetwork& net)
+{
+    size_t numShared = 0, numParameters = 0;
+    for (auto& node : m_net->GetNodesWithType(OperationNameOf(LearnableParameter)))
+    {
+        numParameters++;
+        if (!net.NodeNameExists(node->NodeName()))
+            continue;
+        auto sharedNode = net.GetNodeFromName(node->NodeName());
+        if (sharedNode->OperationName() != node->OperationName() || sharedNode->GetSampleLayout() != node->GetSampleLayout())
+            continue;
+        node->template As<ComputationNode<ElemType>>()->ShareValueWith(*sharedNode->template As<ComputationNode<ElemType>>());
+        numShared++;
+    }
+    for (auto& node : m_net->GetNodesWithType(OperationNameOf(TimesNode)))
+    {
+        auto timesNode = dynamic_pointer_cast<TimesNode<ElemType>>(node);
+        auto sharedNode = net.NodeNameExists(node->NodeName()) ? dynamic_pointer_cast<TimesNode<ElemType>>(net.GetNodeFromName(node->NodeName())) : nullptr;
+        if (timesNode && sharedNode)
+            timesNode->ShareInferenceWeightsWith(*sharedNode);
+    }
+    fprintf(stderr, "Sharing %d of %d parameters with another evaluator.\n", (int) numShared, (int) numParameters);
+}
+
+// CreateWorkspace - create another evaluator of the same model that shares our parameters, for use by another thread
+// The workspace has its own network, and thus its own activations and MatrixPool; it must be prepared with
+// StartEvaluateMinibatchLoop() or the buffer-based Evaluate() like any evaluator, and released with Destroy().
+// With memoryGroup, it joins our group, and hence does not evaluate concurrently with us.
+template <class ElemType>
+IEvaluateModel<ElemType>* CNTKEval<ElemType>::CreateWorkspace()
+{
+    if (m_net == nullptr)
+        LogicError("CreateWorkspace: a model must be loaded first.");
+    CNTKEval<ElemType>* workspace = new CNTKEval<ElemType>();
+    workspace->m_config = m_config;
+    try
+    {
+        workspace->LoadModel(m_modelFileName, this);
+    }
+    catch (...)
+    {
+        workspace->Destroy();
+        throw;
+    }
+    return workspace;
 }
 
 // GetNodeDimensions - Get the node dimensions of the specified nodes
@@ -134,7 +302,42 @@ void CNTKEval<ElemType>::GetNodeDimensions(std::map<std::wstring, size_t>& dimen
 template <class ElemType>
 void CNTKEval<ElemType>::StartEvaluateMinibatchLoop(const std::wstring& outputNodeName)
 {
-    m_net->StartEvaluateMinibatchLoop(m_net->GetNodeFromName(outputNodeName));
+    StartEvaluateMinibatchLoop(std::vector<std::wstring>{outputNodeName});
+}
+
+// StartEvaluateMinibatchLoop - Prepare network for Evaluate() calls that ask for several outputs at once
+// outputNodeNames - names of the nodes that will be evaluated; they are computed together, with one pass over the union of their inputs
+template <class ElemType>
+void CNTKEval<ElemType>::StartEvaluateMinibatchLoop(const std::vector<std::wstring>& outputNodeNames)
+{
+    m_batcher.reset();
+    std::vector<ComputationNodeBasePtr> outputNodes;
+    for (const auto& outputNodeName : outputNodeNames)
+        outputNodes.push_back(m_net->GetNodeFromName(outputNodeName));
+    m_net->StartEvaluateMinibatchLoop(outputNodes);
+    m_outputNodes = outputNodes;
+
+    // dynamic batching: concurrent Evaluate() calls are merged into minibatches of up to maxBatchSamples samples,
+    // waiting at most maxBatchWaitMicroseconds for a minibatch to fill up
+    if (m_config(L"dynamicBatching", false))
+    {
+        if (!m_net->GetNodesWithType(OperationNameOf(PastValueNode)).empty() || !m_net->GetNodesWithType(OperationNameOf(FutureValueNode)).empty())
+            InvalidArgument("dynamicBatching cannot be used with recurrent models, since samples of different requests would be treated as one sequence.");
+        std::map<std::wstring, size_t> inputDimensions, outputDimensions;
+        GetNodeDimensions(inputDimensions, nodeInput);
+        for (const auto& outputNodeName : outputNodeNames)
+            outputDimensions[outputNodeName] = 0;
+        GetNodeDimensions(outputDimensions, nodeSpecified);
+        GetNodeDimensions(outputDimensions, nodeOutput);
+        const size_t minibatchSize = m_config(L"minibatchSize", (size_t) 10240);
+        const size_t maxBatchSamples = m_config(L"maxBatchSamples", minibatchSize);
+        const size_t maxWaitMicroseconds = m_config(L"maxBatchWaitMicroseconds", (size_t) 1000);
+        m_batcher.reset(new EvalBatcher<ElemType>([this](std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs)
+                                                  {
+                                                      EvaluateMinibatch(inputs, outputs);
+                                                  },
+                                                  inputDimensions, outputDimensions, maxBatchSamples, maxWaitMicroseconds));
+    }
 }
 
 // Evaluate - Evalute using the model with the given inputs and outputs
@@ -143,9 +346,29 @@ void CNTKEval<ElemType>::StartEvaluateMinibatchLoop(const std::wstring& outputNo
 template <class ElemType>
 void CNTKEval<ElemType>::Evaluate(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs)
 {
+    const auto start = std::chrono::steady_clock::now();
+    if (m_batcher)
+        m_batcher->Evaluate(inputs, outputs);
+    else
+        EvaluateMinibatch(inputs, outputs);
+    if (m_latencyStatistics) // (not RecordLatencies(), since with dynamic batching, this runs concurrently)
+        m_latencyStatistics->Add({make_pair(wstring(L"total"), EvalLatencyStatistics::SecondsSince(start))});
+}
+
+template <class ElemType>
+void CNTKEval<ElemType>::EvaluateMinibatch(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs)
+{
+    auto lock = LockMemoryGroup(); // (here, since with dynamic batching, this is called by the batcher's thread)
+    m_preparedOutputNodes.clear(); // (the output writer below prepares the network for its own set of outputs)
     size_t minibatchSize = m_config(L"minibatchSize", (size_t) 10240);
-    // get the evaluation names from the output string
+    // evaluate exactly the requested outputs, all in one forward pass; without any, the model's output nodes
     vector<wstring> outNodeNames;
+    std::map<std::wstring, size_t> outputDimensions;
+    for (const auto& output : outputs)
+    {
+        outNodeNames.push_back(output.first);
+        outputDimensions[output.first] = 0;
+    }
 
     ConfigParameters config;
     // config["deviceId"] = to_string(m_net->GetDeviceId());
@@ -167,7 +390,9 @@ void CNTKEval<ElemType>::Evaluate(std::map<std::wstring, std::vector<ElemType>*>
     }
 
     // now set the data in the reader
-    GetNodeDimensions(m_dimensions, nodeOutput);
+    GetNodeDimensions(outputDimensions, nodeSpecified);
+    for (const auto& dim : outputDimensions)
+        m_dimensions[dim.first] = dim.second;
     m_writer->SetData(&outputs, &m_dimensions);
 
     // call the evaluator
@@ -175,6 +400,616 @@ void CNTKEval<ElemType>::Evaluate(std::map<std::wstring, std::vector<ElemType>*>
     eval.WriteOutput(*m_reader, minibatchSize, *m_writer, outNodeNames);
 }
 
+// GetNodeHandle - look up a node once, for use in EvalBuffer::node
+template <class ElemType>
+size_t CNTKEval<ElemType>::GetNodeHandle(const std::wstring& nodeName)
+{
+    auto node = m_net->GetNodeFromName(nodeName);
+    auto iter = find(m_nodeHandles.begin(), m_nodeHandles.end(), node);
+    if (iter != m_nodeHandles.end())
+        return iter - m_nodeHandles.begin();
+    m_nodeHandles.push_back(node);
+    return m_nodeHandles.size() - 1;
+}
+
+template <class ElemType>
+ComputationNodeBasePtr CNTKEval<ElemType>::NodeFromHandle(size_t handle) const
+{
+    if (handle >= m_nodeHandles.size())
+        InvalidArgument("Evaluate: invalid node handle %d.", (int) handle);
+    return m_nodeHandles[handle];
+}
+
+// ValueBufferBinding - lets a node's value matrix use a caller-owned buffer in place of its own, until destroyed
+// The value matrices are swapped, which is shallow. Nodes only resize their values to the size they have when bound, which keeps the buffer.
+template <class ElemType>
+class ValueBufferBinding
+{
+    Matrix<ElemType>& m_value;
+    Matrix<ElemType> m_own;
+
+public:
+    ValueBufferBinding(Matrix<ElemType>& value, size_t numRows, size_t numCols, ElemType* data)
+        : m_value(value), m_own(value.GetDeviceId())
+    {
+        m_own.SetValue(numRows, numCols, value.GetDeviceId(), data, matrixFlagDontOwnBuffer);
+        std::swap(m_value, m_own);
+    }
+    ~ValueBufferBinding()
+    {
+        std::swap(m_value, m_own);
+    }
+};
+
+// Evaluate - evaluate numSamples samples, reading the inputs from and writing the outputs to caller-owned buffers
+// A densely packed buffer on the network's device is used in place. Other buffers are copied: CPU buffers to/from
+// any device, and strided buffers on the network's device with a single strided copy.
+template <class ElemType>
+void CNTKEval<ElemType>::Evaluate(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs)
+{
+    if (m_batcher)
+        InvalidArgument("Evaluate: evaluating from caller-owned buffers cannot be combined with dynamicBatching.");
+
+    auto lock = LockMemoryGroup();
+    const auto start = std::chrono::steady_clock::now();
+    auto outputNodes = PrepareOutputNodes(outputs);
+
+    // the samples form a single sequence
+    auto pMBLayout = m_net->GetMBLayoutPtr();
+    pMBLayout->Init(1, numSamples);
+    pMBLayout->AddSequence(0, 0, 0, numSamples);
+
+    ForwardPropBuffers(numSamples, inputs, outputs, outputNodes);
+    RecordLatencies(start);
+}
+
+// Warmup - evaluate a minibatch of maxSamples samples of zeros, for the outputs of the last StartEvaluateMinibatchLoop() (or the model's output nodes)
+// This allocates the values and workspaces of the nodes for up to maxSamples samples, since matrices only grow; creates the cuBLAS/cuDNN handles;
+// and tunes the convolution algorithms, which are then kept for smaller minibatches. Thus later calls of up to maxSamples samples do not allocate.
+template <class ElemType>
+void CNTKEval<ElemType>::Warmup(size_t maxSamples)
+{
+    if (maxSamples == 0)
+        InvalidArgument("Warmup: maxSamples must be positive.");
+    auto lock = LockMemoryGroup();
+    const auto outputNodes = m_outputNodes.empty() ? m_net->OutputNodes() : m_outputNodes;
+    if (outputNodes.empty())
+        InvalidArgument("Warmup: The model has no output nodes.");
+
+    std::set<ComputationNodeBasePtr> inputNodes;
+    for (const auto& outputNode : outputNodes)
+        for (const auto& inputNode : m_net->InputNodes(outputNode))
+            inputNodes.insert(inputNode);
+
+    // CPU buffers of zeros, which are copied to the network's device and hence size its matrices
+    std::list<std::vector<ElemType>> data;
+    auto makeBuffer = [&](const ComputationNodeBasePtr& node) -> EvalBuffer<ElemType>
+    {
+        data.emplace_back(node->GetSampleMatrixNumRows() * maxSamples, (ElemType) 0);
+        return EvalBuffer<ElemType>{GetNodeHandle(node->NodeName()), data.back().data(), 0, CPUDEVICE};
+    };
+    std::vector<EvalBuffer<ElemType>> inputs, outputs;
+    for (const auto& node : inputNodes)
+        inputs.push_back(makeBuffer(node));
+    for (const auto& node : outputNodes)
+        outputs.push_back(makeBuffer(node));
+
+    fprintf(stderr, "Warmup: Evaluating %d samples for %d outputs.\n", (int) maxSamples, (int) outputNodes.size());
+    auto preparedOutputNodes = PrepareOutputNodes(outputs);
+    auto pMBLayout = m_net->GetMBLayoutPtr();
+    pMBLayout->Init(1, maxSamples);
+    pMBLayout->AddSequence(0, 0, 0, maxSamples);
+    ForwardPropBuffers(maxSamples, inputs, outputs, preparedOutputNodes);
+}
+
+// prepare the network for the given set of outputs (only when it changed since the last call)
+template <class ElemType>
+std::vector<ComputationNodeBasePtr> CNTKEval<ElemType>::PrepareOutputNodes(const std::vector<EvalBuffer<ElemType>>& outputs)
+{
+    std::vector<ComputationNodeBasePtr> outputNodes;
+    for (const auto& output : outputs)
+        outputNodes.push_back(NodeFromHandle(output.node));
+    if (outputNodes != m_preparedOutputNodes)
+    {
+        m_net->AllocateAllMatrices({}, outputNodes, nullptr);
+        m_net->StartEvaluateMinibatchLoop(outputNodes);
+        m_preparedOutputNodes = outputNodes;
+    }
+    return outputNodes;
+}
+
+// evaluate the outputs for the numSamples columns of the network's current MBLayout, from and into the given buffers
+template <class ElemType>
+void CNTKEval<ElemType>::ForwardPropBuffers(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs, const std::vector<ComputationNodeBasePtr>& outputNodes)
+{
+    // (the parts of the call are timed if latencyStatistics, see RecordLatencies())
+    m_callLatencies.clear();
+    auto start = std::chrono::steady_clock::now();
+
+    // the bindings (in a list, since they must not move) put the caller's buffers in place until we return
+    std::list<ValueBufferBinding<ElemType>> bindings;
+    auto getValue = [numSamples](const ComputationNodeBasePtr& node, const EvalBuffer<ElemType>& buffer, size_t& dim, size_t& colStride) -> Matrix<ElemType>&
+    {
+        auto& value = node->As<ComputationNode<ElemType>>()->Value();
+        dim = node->GetSampleMatrixNumRows();
+        colStride = buffer.colStride ? buffer.colStride : dim;
+        if (colStride < dim)
+            InvalidArgument("Evaluate: %ls: the stride (%d) of the buffer is less than the node dimension (%d).", node->NodeName().c_str(), (int) colStride, (int) dim);
+        if (value.GetMatrixType() != DENSE)
+            InvalidArgument("Evaluate: %ls: only dense nodes can be evaluated from caller-owned buffers.", node->NodeName().c_str());
+        if (buffer.deviceId != CPUDEVICE && buffer.deviceId != value.GetDeviceId())
+            InvalidArgument("Evaluate: %ls: a buffer on device %d cannot be used with the network on device %d.", node->NodeName().c_str(), buffer.deviceId, (int) value.GetDeviceId());
+        return value;
+    };
+
+    std::vector<ComputationNodeBasePtr> inputNodes;
+    for (const auto& input : inputs)
+    {
+        auto node = NodeFromHandle(input.node);
+        size_t dim, colStride;
+        auto& value = getValue(node, input, dim, colStride);
+        if (input.deviceId == value.GetDeviceId() && colStride == dim)
+            bindings.emplace_back(value, dim, numSamples, input.data);
+        else if (input.deviceId == value.GetDeviceId()) // strided on the same device
+        {
+            Matrix<ElemType> strided(value.GetDeviceId());
+            strided.SetValue(colStride, numSamples, value.GetDeviceId(), input.data, matrixFlagDontOwnBuffer);
+            value.AssignRowSliceValuesOf(strided, 0, dim);
+        }
+        else if (colStride == dim) // CPU buffer, GPU network
+            value.SetValue(dim, numSamples, value.GetDeviceId(), input.data);
+        else
+            InvalidArgument("Evaluate: %ls: strided CPU buffers can only be used with a network on the CPU.", node->NodeName().c_str());
+        node->NotifyFunctionValuesMBSizeModified();
+        inputNodes.push_back(node);
+    }
+    ComputationNetwork::BumpEvalTimeStamp(inputNodes);
+
+    // outputs that can be computed in place
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        size_t dim, colStride;
+        auto& value = getValue(outputNodes[i], outputs[i], dim, colStride);
+        if (outputs[i].deviceId == value.GetDeviceId() && colStride == dim)
+            bindings.emplace_back(value, dim, numSamples, outputs[i].data);
+    }
+
+    if (m_latencyStatistics)
+    {
+        m_callLatencies.push_back(make_pair(wstring(L"input"), EvalLatencyStatistics::SecondsSince(start)));
+        m_forwardTimer->Start();
+    }
+
+    m_net->ForwardPropJointly(outputNodes);
+
+    if (m_latencyStatistics)
+    {
+        m_forwardTimer->Stop();
+        m_callLatencies.push_back(make_pair(wstring(L"forward"), m_forwardTimer->ElapsedSeconds())); // (waits for the device)
+        if (m_nodeProfiler)
+        {
+            m_nodeProfiler->EndPass();
+            std::map<std::wstring, double> secondsPerOperation;
+            for (const auto& entry : m_nodeProfiler->Entries())
+                if (entry->lastSeconds[NodeProfiler::forward] > 0)
+                    secondsPerOperation[L"forward:" + entry->node->OperationName()] += entry->lastSeconds[NodeProfiler::forward];
+            m_callLatencies.insert(m_callLatencies.end(), secondsPerOperation.begin(), secondsPerOperation.end());
+        }
+        start = std::chrono::steady_clock::now();
+    }
+
+    // copy the other outputs; the readbacks of all outputs into host buffers are started before waiting for the first one
+    if (m_outputReadbacks.size() < outputs.size())
+        m_outputReadbacks.resize(outputs.size());
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        size_t dim, colStride;
+        auto& value = getValue(outputNodes[i], outputs[i], dim, colStride);
+        if (outputs[i].deviceId == value.GetDeviceId() && colStride == dim)
+            continue; // (computed in place)
+        if (value.GetNumRows() != dim || value.GetNumCols() != numSamples)
+            LogicError("Evaluate: %ls: output has dimensions [%d x %d] instead of [%d x %d].", outputNodes[i]->NodeName().c_str(), (int) value.GetNumRows(), (int) value.GetNumCols(), (int) dim, (int) numSamples);
+        if (outputs[i].deviceId == CPUDEVICE)
+        {
+            if (value.GetMatrixType() != DENSE)
+                value.CopySection(dim, numSamples, outputs[i].data, colStride);
+            else
+            {
+                if (!m_outputReadbacks[i])
+                    m_outputReadbacks[i].reset(new MatrixReadback<ElemType>());
+                m_outputReadbacks[i]->Start(value);
+            }
+        }
+        else // strided on the same device
+        {
+            Matrix<ElemType> strided(value.GetDeviceId());
+            strided.SetValue(colStride, numSamples, value.GetDeviceId(), outputs[i].data, matrixFlagDontOwnBuffer);
+            strided.AssignToRowSliceValuesOf(value, 0, dim);
+        }
+    }
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        size_t dim, colStride;
+        auto& value = getValue(outputNodes[i], outputs[i], dim, colStride);
+        if (outputs[i].deviceId != CPUDEVICE || (value.GetDeviceId() == CPUDEVICE && colStride == dim) || value.GetMatrixType() != DENSE)
+            continue; // (done above)
+        m_outputReadbacks[i]->WaitAndCopyTo(outputs[i].data, colStride);
+    }
+
+    if (m_latencyStatistics)
+        m_callLatencies.push_back(make_pair(wstring(L"output"), EvalLatencyStatistics::SecondsSince(start)));
+}
+
+// add the latencies of the buffer-based call that began at 'start' to the histograms: its total, and its parts from ForwardPropBuffers()
+template <class ElemType>
+void CNTKEval<ElemType>::RecordLatencies(const std::chrono::steady_clock::time_point& start)
+{
+    if (!m_latencyStatistics)
+        return;
+    m_callLatencies.push_back(make_pair(wstring(L"total"), EvalLatencyStatistics::SecondsSince(start)));
+    m_latencyStatistics->Add(m_callLatencies);
+    m_callLatencies.clear();
+}
+
+// the lock of our memory group, held by calls that plan or run the network (none without a group)
+template <class ElemType>
+std::unique_lock<std::recursive_mutex> CNTKEval<ElemType>::LockMemoryGroup()
+{
+    return m_memoryGroup ? m_memoryGroup->Lock() : std::unique_lock<std::recursive_mutex>();
+}
+
+// GetLatencyHistograms - snapshot of the latencies of the calls so far
+template <class ElemType>
+std::vector<EvalLatencyHistogram> CNTKEval<ElemType>::GetLatencyHistograms()
+{
+    if (!m_latencyStatistics)
+        InvalidArgument("GetLatencyHistograms: latency statistics are only collected with latencyStatistics=true.");
+    return m_latencyStatistics->Snapshot();
+}
+
+// ResetLatencyHistograms - start collecting anew
+template <class ElemType>
+void CNTKEval<ElemType>::ResetLatencyHistograms()
+{
+    if (m_latencyStatistics)
+        m_latencyStatistics->Reset();
+}
+
+// OpenSession - start a new stream of frames with its own recurrent state
+template <class ElemType>
+size_t CNTKEval<ElemType>::OpenSession()
+{
+    m_sessions[m_nextSession] = Session();
+    return m_nextSession++;
+}
+
+// CloseSession - drop the state of a session
+template <class ElemType>
+void CNTKEval<ElemType>::CloseSession(size_t session)
+{
+    if (m_sessions.erase(session) == 0)
+        InvalidArgument("CloseSession: invalid session handle %d.", (int) session);
+}
+
+// EvaluateSessions - advance each of the given sessions by its next numFrames[i] frames
+// The sessions are the parallel sequences of one minibatch. A session that has seen frames before continues its
+// sequence from before the minibatch: its last frames of each PastValue node's input are put in place of the previous
+// minibatch that the node reaches back into, and are afterwards updated from this minibatch. Likewise, OptimizedRNNStack
+// nodes (which must be unidirectional LSTM stacks, run by the persistent kernel) continue from the sessions' last states.
+template <class ElemType>
+void CNTKEval<ElemType>::EvaluateSessions(const std::vector<size_t>& sessions, const std::vector<size_t>& numFrames, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs)
+{
+    if (m_batcher)
+        InvalidArgument("EvaluateSessions: streaming evaluation cannot be combined with dynamicBatching.");
+    auto lock = LockMemoryGroup();
+    const auto start = std::chrono::steady_clock::now();
+    if (sessions.empty() || numFrames.size() != sessions.size())
+        InvalidArgument("EvaluateSessions: expected the number of frames of each of at least one session.");
+    const size_t numSessions = sessions.size();
+    std::vector<Session*> states;
+    size_t numTimeSteps = 0;
+    for (size_t i = 0; i < numSessions; i++)
+    {
+        auto iter = m_sessions.find(sessions[i]);
+        if (iter == m_sessions.end())
+            InvalidArgument("EvaluateSessions: invalid session handle %d.", (int) sessions[i]);
+        if (find(states.begin(), states.end(), &iter->second) != states.end())
+            InvalidArgument("EvaluateSessions: session %d is given more than once.", (int) sessions[i]);
+        if (numFrames[i] == 0)
+            InvalidArgument("EvaluateSessions: session %d: a chunk must have at least one frame.", (int) sessions[i]);
+        states.push_back(&iter->second);
+        numTimeSteps = max(numTimeSteps, numFrames[i]);
+    }
+
+    auto outputNodes = PrepareOutputNodes(outputs);
+
+    // the PastValue nodes the outputs depend on; their delays determine how many frames the sessions must remember
+    std::vector<shared_ptr<PastValueNode<ElemType>>> pastValueNodes;
+    std::vector<size_t> pastValueDims;
+    size_t maxTimeStep = 0;
+    for (const auto& outputNode : outputNodes)
+    {
+        if (!m_net->GetNodesWithType(OperationNameOf(FutureValueNode), outputNode).empty())
+            InvalidArgument("EvaluateSessions: %ls depends on a FutureValue node, which cannot be evaluated chunk by chunk.", outputNode->NodeName().c_str());
+        for (const auto& node : m_net->GetNodesWithType(OperationNameOf(PastValueNode), outputNode))
+        {
+            auto pastValueNode = dynamic_pointer_cast<PastValueNode<ElemType>>(node);
+            if (find(pastValueNodes.begin(), pastValueNodes.end(), pastValueNode) != pastValueNodes.end())
+                continue;
+            pastValueNodes.push_back(pastValueNode);
+            pastValueDims.push_back(node->GetSampleMatrixNumRows());
+            maxTimeStep = max(maxTimeStep, (size_t) pastValueNode->TimeStep());
+        }
+    }
+    std::vector<shared_ptr<OptimizedRNNStackNode<ElemType>>> rnnNodes;
+    for (const auto& outputNode : outputNodes)
+    {
+        for (const auto& node : m_net->GetNodesWithType(OperationNameOf(OptimizedRNNStackNode), outputNode))
+        {
+            auto rnnNode = dynamic_pointer_cast<OptimizedRNNStackNode<ElemType>>(node);
+            if (find(rnnNodes.begin(), rnnNodes.end(), rnnNode) != rnnNodes.end())
+                continue;
+            if (!rnnNode->UsePersistentInference())
+                InvalidArgument("EvaluateSessions: %ls can only be evaluated chunk by chunk if it is a unidirectional LSTM stack on a GPU.", node->NodeName().c_str());
+            rnnNodes.push_back(rnnNode);
+        }
+    }
+    if (!rnnNodes.empty()) // (so that continued sequences begin before the minibatch even without PastValue nodes)
+        maxTimeStep = max(maxTimeStep, (size_t) 1);
+    for (size_t i = 0; i < numSessions; i++)
+    {
+        auto& session = *states[i];
+        if (session.numFrames == 0)
+        {
+            session.outputNodes = outputNodes;
+            session.history.clear();
+            for (size_t j = 0; j < pastValueNodes.size(); j++)
+                session.history.push_back(make_shared<Matrix<ElemType>>(pastValueDims[j], (size_t) pastValueNodes[j]->TimeStep(), m_net->GetDeviceId()));
+            session.rnnStates.clear();
+            for (const auto& rnnNode : rnnNodes)
+            {
+                session.rnnStates.push_back(make_shared<Matrix<ElemType>>(rnnNode->GetHiddenSize(), 2 * rnnNode->GetNumLayers(), m_net->GetDeviceId()));
+                session.rnnStates.back()->SetValue(0);
+            }
+        }
+        else if (session.outputNodes != outputNodes)
+            InvalidArgument("EvaluateSessions: session %d: all chunks of a session must evaluate the same output nodes.", (int) sessions[i]);
+    }
+
+    // one parallel sequence per session, which began before this minibatch if the session has history
+    auto pMBLayout = m_net->GetMBLayoutPtr();
+    pMBLayout->Init(numSessions, numTimeSteps);
+    for (size_t i = 0; i < numSessions; i++)
+    {
+        pMBLayout->AddSequence(sessions[i], i, -(ptrdiff_t) min(states[i]->numFrames, maxTimeStep), numFrames[i]);
+        pMBLayout->AddGap(i, numFrames[i], numTimeSteps);
+    }
+
+    // present the sessions' histories to the PastValue nodes as the previous minibatch, one time step per remembered frame
+    for (size_t j = 0; j < pastValueNodes.size(); j++)
+    {
+        const size_t timeStep = pastValueNodes[j]->TimeStep();
+        auto& delayedValue = pastValueNodes[j]->DelayedValue();
+        delayedValue.Resize(pastValueDims[j], timeStep * numSessions);
+        auto pDelayedMBLayout = pastValueNodes[j]->DelayedValueMBLayout();
+        pDelayedMBLayout->Init(numSessions, timeStep);
+        for (size_t i = 0; i < numSessions; i++)
+        {
+            const size_t numRemembered = min(states[i]->numFrames, timeStep);
+            pDelayedMBLayout->AddGap(i, 0, timeStep - numRemembered);
+            if (numRemembered > 0)
+                pDelayedMBLayout->AddSequence(sessions[i], i, (ptrdiff_t) timeStep - (ptrdiff_t) states[i]->numFrames, timeStep);
+            const auto& history = *states[i]->history[j];
+            for (size_t k = timeStep - numRemembered; k < timeStep; k++)
+                delayedValue.SetColumnSlice(history.ColumnSlice(k, 1), k * numSessions + i, 1);
+        }
+    }
+
+    // and the sessions' recurrent states to the OptimizedRNNStack nodes, as those of the parallel sequences
+    for (size_t j = 0; j < rnnNodes.size(); j++)
+    {
+        const size_t numBlocks = 2 * rnnNodes[j]->GetNumLayers();
+        auto& state = rnnNodes[j]->CarriedState();
+        state.Resize(rnnNodes[j]->GetHiddenSize(), numBlocks * numSessions);
+        for (size_t i = 0; i < numSessions; i++)
+            for (size_t b = 0; b < numBlocks; b++)
+                state.SetColumnSlice(states[i]->rnnStates[j]->ColumnSlice(b, 1), b * numSessions + i, 1);
+    }
+
+    ForwardPropBuffers(numTimeSteps * numSessions, inputs, outputs, outputNodes);
+
+    for (size_t j = 0; j < rnnNodes.size(); j++)
+    {
+        const size_t numBlocks = 2 * rnnNodes[j]->GetNumLayers();
+        const auto& state = rnnNodes[j]->CarriedState();
+        for (size_t i = 0; i < numSessions; i++)
+            for (size_t b = 0; b < numBlocks; b++)
+                states[i]->rnnStates[j]->SetColumnSlice(state.ColumnSlice(b * numSessions + i, 1), b, 1);
+    }
+
+    // remember the sessions' last frames; the PastValue nodes now hold the last ones of their inputs of this minibatch,
+    // for each session the frames [numFrames[i] - numDelayed, numFrames[i]) as time steps [0, numDelayed) (see EndForwardProp())
+    for (size_t j = 0; j < pastValueNodes.size(); j++)
+    {
+        const ptrdiff_t timeStep = pastValueNodes[j]->TimeStep();
+        const auto& value = pastValueNodes[j]->DelayedValue();
+        const ptrdiff_t numDelayed = pastValueNodes[j]->DelayedValueMBLayout()->GetNumTimeSteps(); // (min(timeStep, numTimeSteps))
+        for (size_t i = 0; i < numSessions; i++)
+        {
+            auto& history = *states[i]->history[j];
+            Matrix<ElemType> newHistory(history.GetNumRows(), (size_t) timeStep, history.GetDeviceId());
+            const ptrdiff_t begin = states[i]->numFrames; // first frame of this chunk, counted from the session's start
+            const ptrdiff_t end = begin + numFrames[i];
+            for (ptrdiff_t k = 0; k < timeStep; k++)
+            {
+                const ptrdiff_t frame = end - timeStep + k;
+                if (frame >= begin) // from this chunk (which are all kept, since numFrames[i] <= numTimeSteps)
+                    newHistory.SetColumnSlice(value.ColumnSlice((frame - (end - numDelayed)) * numSessions + i, 1), k, 1);
+                else if (frame >= 0) // from the previous history, whose last column is frame begin - 1
+                    newHistory.SetColumnSlice(history.ColumnSlice(frame - begin + timeStep, 1), k, 1);
+            }
+            history = std::move(newHistory);
+        }
+    }
+    for (size_t i = 0; i < numSessions; i++)
+        states[i]->numFrames += numFrames[i];
+    RecordLatencies(start);
+}
+
+// fork a session: a new session with a copy of its state, which then continues independently
+template <class ElemType>
+size_t CNTKEval<ElemType>::ForkSession(size_t session)
+{
+    auto iter = m_sessions.find(session);
+    if (iter == m_sessions.end())
+        InvalidArgument("BeamSearch: invalid session handle %d.", (int) session);
+    Session fork = iter->second;
+    for (auto& history : fork.history) // (deep copies, since EvaluateSessions() updates the histories in place)
+        history = make_shared<Matrix<ElemType>>(*history, history->GetDeviceId());
+    for (auto& rnnState : fork.rnnStates)
+        rnnState = make_shared<Matrix<ElemType>>(*rnnState, rnnState->GetDeviceId());
+    m_sessions[m_nextSession] = std::move(fork);
+    return m_nextSession++;
+}
+
+// BeamSearch - decode the continuations of the given sessions, all hypotheses of all of them as parallel sequences of one minibatch per step
+// Each step evaluates the previous tokens of all active hypotheses with EvaluateSessions() into a matrix on the network's device, selects
+// the best beamWidth tokens of each column there with VectorMax(), and copies only those to the host, where each request's candidates are
+// ranked. A surviving child takes over its parent's session; further children of the same parent get forks of it.
+template <class ElemType>
+std::vector<std::vector<BeamSearchHypothesis>> CNTKEval<ElemType>::BeamSearch(const std::vector<size_t>& sessions, const BeamSearchOptions& options)
+{
+    if (options.beamWidth == 0 || options.numBest == 0 || options.numBest > options.beamWidth)
+        InvalidArgument("BeamSearch: beamWidth must be at least 1, and numBest between 1 and beamWidth.");
+    auto lock = LockMemoryGroup();
+    const size_t inputDim = NodeFromHandle(options.inputNode)->GetSampleMatrixNumRows();
+    const size_t outputDim = NodeFromHandle(options.outputNode)->GetSampleMatrixNumRows();
+    if (outputDim > inputDim || options.startToken >= inputDim || options.endToken >= outputDim)
+        InvalidArgument("BeamSearch: the tokens of the output (dimension %d) must be valid inputs (dimension %d), as must the start and end tokens.", (int) outputDim, (int) inputDim);
+    const DEVICEID_TYPE deviceId = m_net->GetDeviceId();
+    const size_t numRequests = sessions.size();
+    const size_t topK = min(options.beamWidth, outputDim);
+
+    struct Hypothesis
+    {
+        size_t request;
+        size_t session; // its own, holding the state after its last token
+        std::vector<size_t> tokens;
+        double score;
+    };
+    std::vector<Hypothesis> active;
+    for (size_t r = 0; r < numRequests; r++)
+        active.push_back(Hypothesis{r, ForkSession(sessions[r]), std::vector<size_t>(), 0.0});
+    std::vector<std::vector<BeamSearchHypothesis>> results(numRequests);
+
+    // the numBest-th best score of a request's finished hypotheses, which an active one must beat to still matter
+    auto worstBestScore = [&](size_t r)
+    {
+        auto& finished = results[r];
+        sort(finished.begin(), finished.end(), [](const BeamSearchHypothesis& a, const BeamSearchHypothesis& b) { return a.score > b.score; });
+        return finished.size() < options.numBest ? -std::numeric_limits<double>::infinity() : finished[options.numBest - 1].score;
+    };
+
+    std::vector<ElemType> inputs;
+    Matrix<ElemType> scores(deviceId), topIndexes(deviceId), topScores(deviceId);
+    for (size_t step = 0; step < options.maxLength && !active.empty(); step++)
+    {
+        // the previous tokens of all hypotheses, one-hot
+        const size_t numActive = active.size();
+        inputs.assign(inputDim * numActive, 0);
+        std::vector<size_t> activeSessions;
+        for (size_t i = 0; i < numActive; i++)
+        {
+            inputs[i * inputDim + (active[i].tokens.empty() ? options.startToken : active[i].tokens.back())] = 1;
+            activeSessions.push_back(active[i].session);
+        }
+        scores.Resize(outputDim, numActive);
+        EvaluateSessions(activeSessions, std::vector<size_t>(numActive, 1),
+                         std::vector<EvalBuffer<ElemType>>{EvalBuffer<ElemType>{options.inputNode, inputs.data(), 0, CPUDEVICE}},
+                         std::vector<EvalBuffer<ElemType>>{EvalBuffer<ElemType>{options.outputNode, scores.BufferPointer(), 0, deviceId}});
+
+        // the best topK tokens of each hypothesis
+        scores.VectorMax(topIndexes, topScores, /*isColWise=*/true, (int) topK);
+        std::unique_ptr<ElemType[]> indexes(topIndexes.CopyToArray());
+        std::unique_ptr<ElemType[]> values(topScores.CopyToArray());
+
+        // rank the candidates of each request
+        struct Candidate
+        {
+            size_t parent; // index into 'active'
+            size_t token;
+            double score;
+        };
+        std::vector<std::vector<Candidate>> candidates(numRequests);
+        for (size_t i = 0; i < numActive; i++)
+        {
+            for (size_t k = 0; k < topK; k++)
+            {
+                const double value = values[i * topK + k];
+                const double logProbability = options.logProbabilities ? value : log(max(value, (double) std::numeric_limits<ElemType>::min()));
+                candidates[active[i].request].push_back(Candidate{i, (size_t) indexes[i * topK + k], active[i].score + logProbability});
+            }
+        }
+
+        // the best beamWidth candidates of each request continue, or finish with the end token
+        std::vector<Hypothesis> next;
+        std::vector<bool> sessionTaken(numActive, false);
+        for (size_t r = 0; r < numRequests; r++)
+        {
+            auto& requestCandidates = candidates[r];
+            const size_t numKept = min(options.beamWidth, requestCandidates.size());
+            partial_sort(requestCandidates.begin(), requestCandidates.begin() + numKept, requestCandidates.end(), [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+            for (size_t c = 0; c < numKept; c++)
+            {
+                const auto& candidate = requestCandidates[c];
+                const auto& parent = active[candidate.parent];
+                std::vector<size_t> tokens = parent.tokens;
+                tokens.push_back(candidate.token);
+                if (candidate.token == options.endToken)
+                    results[r].push_back(BeamSearchHypothesis{std::move(tokens), candidate.score});
+                else
+                {
+                    size_t session = parent.session;
+                    if (sessionTaken[candidate.parent])
+                        session = ForkSession(parent.session);
+                    sessionTaken[candidate.parent] = true;
+                    next.push_back(Hypothesis{r, session, std::move(tokens), candidate.score});
+                }
+            }
+        }
+        for (size_t i = 0; i < numActive; i++)
+            if (!sessionTaken[i])
+                CloseSession(active[i].session);
+
+        // scores only decrease, so a hypothesis that cannot make its request's numBest any more is dropped, and a request is done without any
+        std::vector<double> worstBestScores(numRequests);
+        for (size_t r = 0; r < numRequests; r++)
+            worstBestScores[r] = worstBestScore(r);
+        active.clear();
+        for (auto& hypothesis : next)
+        {
+            if (hypothesis.score > worstBestScores[hypothesis.request])
+                active.push_back(std::move(hypothesis));
+            else
+                CloseSession(hypothesis.session);
+        }
+    }
+
+    // hypotheses that reached maxLength count as they are
+    for (auto& hypothesis : active)
+    {
+        results[hypothesis.request].push_back(BeamSearchHypothesis{std::move(hypothesis.tokens), hypothesis.score});
+        CloseSession(hypothesis.session);
+    }
+    for (size_t r = 0; r < numRequests; r++)
+    {
+        worstBestScore(r); // (sorts them)
+        if (results[r].size() > options.numBest)
+            results[r].resize(options.numBest);
+    }
+    return results;
+}
+
 // ResetState - Reset the cell state when we get start of an utterance
 template <class ElemType>
 void CNTKEval<ElemType>::ResetState()
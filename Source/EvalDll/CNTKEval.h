@@ -6,15 +6,22 @@
 //
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 
 #include "Eval.h"
+#include "EvalBatcher.h"
+#include "EvalLatencyStatistics.h"
+#include "EvalMemoryGroup.h"
 #include "EvalReader.h"
 #include "EvalWriter.h"
 
 #include "ComputationNetwork.h"
+#include "NodeProfiler.h"
+#include "MatrixReadback.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -26,13 +33,55 @@ class CNTKEval : public IEvaluateModel<ElemType>
     EvalWriter<ElemType>* m_writer;
     ConfigParameters m_config;
     ComputationNetworkPtr m_net;
+    std::wstring m_modelFileName; // (for CreateWorkspace())
     std::map<std::wstring, size_t> m_dimensions;
     size_t m_start;
+    std::unique_ptr<EvalBatcher<ElemType>> m_batcher; // if dynamic batching: merges concurrent Evaluate() calls
+    std::vector<ComputationNodeBasePtr> m_nodeHandles;         // [handle] nodes handed out by GetNodeHandle()
+    std::vector<ComputationNodeBasePtr> m_preparedOutputNodes; // output nodes the network was last prepared for by Evaluate(numSamples, ...)
+    std::vector<ComputationNodeBasePtr> m_outputNodes;         // output nodes named in the last StartEvaluateMinibatchLoop()
+
+    // a stream of frames evaluated chunk by chunk with EvaluateSessions()
+    struct Session
+    {
+        size_t numFrames;                                  // frames evaluated so far
+        std::vector<ComputationNodeBasePtr> outputNodes;   // output nodes of the first chunk (since the history is kept for their PastValue nodes only)
+        std::vector<shared_ptr<Matrix<ElemType>>> history; // [PastValue node] its input's last timeStep frames, the last one in the last column
+        std::vector<shared_ptr<Matrix<ElemType>>> rnnStates; // [OptimizedRNNStack node] its states after the last frame, see CarriedState()
+        Session()
+            : numFrames(0)
+        {
+        }
+    };
+    std::map<size_t, Session> m_sessions; // [handle] open sessions
+    size_t m_nextSession;
+
+    // latency statistics (latencyStatistics option)
+    std::unique_ptr<EvalLatencyStatistics> m_latencyStatistics; // if enabled
+    std::unique_ptr<DeviceTimer> m_forwardTimer;                // times the forward pass on the device
+    std::unique_ptr<NodeProfiler> m_nodeProfiler;               // if latencyStatisticsPerNodeType: times every node
+    EvalLatencyStatistics::Latencies m_callLatencies;           // parts of the current buffer-based call, see ForwardPropBuffers()
+
+    std::vector<std::unique_ptr<MatrixReadback<ElemType>>> m_outputReadbacks; // [output index] of the buffer-based call, kept for their host buffers
+
+    std::shared_ptr<EvalMemoryGroup> m_memoryGroup; // if memoryGroup: the evaluators we share the matrices with, one at a time
+
+    void LoadModel(const std::wstring& modelFileName, const CNTKEval<ElemType>* sharedWith);
+    void ShareParametersWith(ComputationNetwork& net);
+    ComputationNodeBasePtr NodeFromHandle(size_t handle) const;
+    std::vector<ComputationNodeBasePtr> PrepareOutputNodes(const std::vector<EvalBuffer<ElemType>>& outputs);
+    void ForwardPropBuffers(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs, const std::vector<ComputationNodeBasePtr>& outputNodes);
+    void RecordLatencies(const std::chrono::steady_clock::time_point& start);
+    std::unique_lock<std::recursive_mutex> LockMemoryGroup();
+    size_t ForkSession(size_t session);
+
+    // EvaluateMinibatch - evaluate the given samples; not thread-safe
+    void EvaluateMinibatch(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs);
 
 public:
     // constructor
     CNTKEval()
-        : m_reader(nullptr), m_net(nullptr)
+        : m_reader(nullptr), m_writer(nullptr), m_net(nullptr), m_nextSession(0)
     {
     }
 
@@ -49,11 +98,42 @@ public:
     // ouputNodeName - name of node that will be evaluated
     virtual void StartEvaluateMinibatchLoop(const std::wstring& outputNodeName);
 
+    // StartEvaluateMinibatchLoop - Prepare network for Evaluate() calls that ask for several outputs at once
+    // outputNodeNames - names of the nodes that will be evaluated
+    virtual void StartEvaluateMinibatchLoop(const std::vector<std::wstring>& outputNodeNames);
+
     // Evaluate - Evalute using the model with the given inputs and outputs
     // inputs - map from node name to input vector
     // outputs - map from node name to output vector, outputs vectors need to be preallocated by caller, sizing will happen during evaluation
+    // With dynamicBatching=true, this may be called from several threads at once.
     virtual void Evaluate(std::map<std::wstring, std::vector<ElemType>*>& inputs, std::map<std::wstring, std::vector<ElemType>*>& outputs);
 
+    // GetNodeHandle - look up a node once, for use in EvalBuffer::node; valid until the next LoadModel()
+    virtual size_t GetNodeHandle(const std::wstring& nodeName);
+
+    // Evaluate - evaluate numSamples samples, reading the inputs from and writing the outputs to caller-owned buffers
+    virtual void Evaluate(size_t numSamples, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs);
+
+    // Warmup - allocate everything the evaluation of up to maxSamples samples needs, by evaluating that many once
+    virtual void Warmup(size_t maxSamples);
+
+    // OpenSession/CloseSession - create/drop a stream of frames with its own recurrent state
+    virtual size_t OpenSession();
+    virtual void CloseSession(size_t session);
+
+    // EvaluateSessions - advance each of the given sessions by its next numFrames[i] frames, as parallel sequences of one minibatch
+    virtual void EvaluateSessions(const std::vector<size_t>& sessions, const std::vector<size_t>& numFrames, const std::vector<EvalBuffer<ElemType>>& inputs, const std::vector<EvalBuffer<ElemType>>& outputs);
+
+    // BeamSearch - decode the continuations of the given sessions, all hypotheses of all of them as parallel sequences of one minibatch per step
+    virtual std::vector<std::vector<BeamSearchHypothesis>> BeamSearch(const std::vector<size_t>& sessions, const BeamSearchOptions& options);
+
+    // GetLatencyHistograms/ResetLatencyHistograms - latencies of the calls so far, with latencyStatistics=true
+    virtual std::vector<EvalLatencyHistogram> GetLatencyHistograms();
+    virtual void ResetLatencyHistograms();
+
+    // CreateWorkspace - create another evaluator that shares the parameters of this one, for use by another thread
+    virtual IEvaluateModel<ElemType>* CreateWorkspace();
+
     virtual void Init(const std::string& config);
     virtual void Destroy();
     virtual void ResetState();
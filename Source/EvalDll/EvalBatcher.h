@@ -0,0 +1,262 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// EvalBatcher.h - merges concurrent Evaluate() calls into shared minibatches (dynamic batching)
+//
+#pragma once
+
+#include "Basics.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// EvalBatcher -- thread-safe front end to an evaluation function that takes a set of samples at a time
+// Callers of Evaluate() block while a scheduler thread collects their requests into one minibatch,
+// until maxBatchSamples samples are pending or the oldest request has waited maxWaitMicroseconds.
+// It then evaluates them all at once and scatters the outputs back. Requests are only merged if they
+// use the same input and output nodes, and samples must be independent of each other (no recurrence).
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class EvalBatcher
+{
+public:
+    typedef std::map<std::wstring, std::vector<ElemType>*> Layer;
+    typedef std::function<void(Layer& inputs, Layer& outputs)> EvaluateFunction;
+
+    // evaluate - called on the scheduler thread only, hence need not be thread-safe
+    // inputDimensions, outputDimensions - number of rows of each input/output node
+    EvalBatcher(const EvaluateFunction& evaluate, const std::map<std::wstring, size_t>& inputDimensions, const std::map<std::wstring, size_t>& outputDimensions,
+                size_t maxBatchSamples, size_t maxWaitMicroseconds)
+        : m_evaluate(evaluate), m_inputDimensions(inputDimensions), m_outputDimensions(outputDimensions),
+          m_maxBatchSamples(std::max(maxBatchSamples, (size_t) 1)), m_maxWait(maxWaitMicroseconds), m_stop(false)
+    {
+        m_scheduler = std::thread([this]()
+                                  {
+                                      SchedulerLoop();
+                                  });
+    }
+    ~EvalBatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_requestAdded.notify_all();
+        m_scheduler.join();
+    }
+
+    // Evaluate - same as IEvaluateModel::Evaluate(); may be called from any number of threads at once
+    void Evaluate(Layer& inputs, Layer& outputs)
+    {
+        Request request(inputs, outputs, NumSamples(inputs));
+        if (request.numSamples == 0)
+        {
+            for (auto& output : outputs)
+                output.second->clear();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        request.arrival = std::chrono::steady_clock::now();
+        m_pending.push_back(&request);
+        m_requestAdded.notify_one();
+        m_requestDone.wait(lock, [&request]()
+                           {
+                               return request.done;
+                           });
+        if (request.error)
+            std::rethrow_exception(request.error);
+    }
+
+private:
+    struct Request
+    {
+        Layer& inputs;
+        Layer& outputs;
+        size_t numSamples;
+        std::chrono::steady_clock::time_point arrival;
+        bool done;
+        std::exception_ptr error;
+        Request(Layer& inputs, Layer& outputs, size_t numSamples)
+            : inputs(inputs), outputs(outputs), numSamples(numSamples), done(false)
+        {
+        }
+        // whether 'other' can be evaluated in the same minibatch
+        bool SameNodes(const Request& other) const
+        {
+            return SameKeys(inputs, other.inputs) && SameKeys(outputs, other.outputs);
+        }
+        static bool SameKeys(const Layer& a, const Layer& b)
+        {
+            if (a.size() != b.size())
+                return false;
+            for (auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib)
+                if (ia->first != ib->first)
+                    return false;
+            return true;
+        }
+    };
+
+    // validate a request in the caller's thread, so that bad requests fail alone
+    size_t NumSamples(const Layer& inputs) const
+    {
+        size_t numSamples = SIZE_MAX;
+        for (const auto& input : inputs)
+        {
+            auto dim = m_inputDimensions.find(input.first);
+            if (dim == m_inputDimensions.end())
+                RuntimeError("Input %ls not found in CNTK model.", input.first.c_str());
+            if (input.second->size() % dim->second != 0)
+                RuntimeError("Input %ls has %d values, which is not a multiple of its dimension %d.", input.first.c_str(), (int) input.second->size(), (int) dim->second);
+            const size_t n = input.second->size() / dim->second;
+            if (numSamples != SIZE_MAX && n != numSamples)
+                RuntimeError("Record Count of %ls (%lux%lu) does not match the record count of previous entries (%lu).", input.first.c_str(), dim->second, n, numSamples);
+            numSamples = n;
+        }
+        return numSamples == SIZE_MAX ? 0 : numSamples;
+    }
+
+    void SchedulerLoop()
+    {
+        std::vector<Request*> batch;
+        for (;;)
+        {
+            // wait for a minibatch to fill up
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_requestAdded.wait(lock, [this]()
+                                    {
+                                        return m_stop || !m_pending.empty();
+                                    });
+                if (m_pending.empty()) // (m_stop)
+                    return;
+                const auto deadline = m_pending.front()->arrival + m_maxWait;
+                m_requestAdded.wait_until(lock, deadline, [this]()
+                                          {
+                                              return m_stop || PendingSamples() >= m_maxBatchSamples;
+                                          });
+                // take the oldest request and those after it that fit with it
+                batch.clear();
+                size_t numSamples = 0;
+                for (auto iter = m_pending.begin(); iter != m_pending.end();)
+                {
+                    if (!batch.empty() && (numSamples + (*iter)->numSamples > m_maxBatchSamples || !(*iter)->SameNodes(*batch.front())))
+                    {
+                        ++iter;
+                        continue;
+                    }
+                    numSamples += (*iter)->numSamples;
+                    batch.push_back(*iter);
+                    iter = m_pending.erase(iter);
+                }
+            }
+
+            // evaluate them outside the lock, so that new requests can queue up meanwhile
+            std::exception_ptr error;
+            try
+            {
+                EvaluateBatch(batch);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto request : batch)
+                {
+                    request->error = error;
+                    request->done = true;
+                }
+            }
+            m_requestDone.notify_all();
+        }
+    }
+
+    // number of samples the oldest request could be batched with; call with m_mutex held
+    size_t PendingSamples() const
+    {
+        size_t numSamples = 0;
+        for (auto request : m_pending)
+            if (request->SameNodes(*m_pending.front()))
+                numSamples += request->numSamples;
+        return numSamples;
+    }
+
+    // concatenate the requests' samples, evaluate them in one go, and split the outputs
+    void EvaluateBatch(const std::vector<Request*>& batch)
+    {
+        if (batch.size() == 1) // nothing to merge
+        {
+            m_evaluate(batch[0]->inputs, batch[0]->outputs);
+            return;
+        }
+
+        Layer mergedInputs, mergedOutputs;
+        for (const auto& input : batch[0]->inputs)
+        {
+            auto& merged = m_mergedInputs[input.first];
+            merged.clear();
+            for (auto request : batch)
+            {
+                const auto& data = *request->inputs[input.first];
+                merged.insert(merged.end(), data.begin(), data.end());
+            }
+            mergedInputs[input.first] = &merged;
+        }
+        for (const auto& output : batch[0]->outputs)
+        {
+            auto& merged = m_mergedOutputs[output.first];
+            merged.clear();
+            mergedOutputs[output.first] = &merged;
+        }
+
+        m_evaluate(mergedInputs, mergedOutputs);
+
+        for (const auto& output : mergedOutputs)
+        {
+            const size_t rows = m_outputDimensions.at(output.first);
+            const auto& merged = *output.second;
+            size_t begin = 0;
+            for (auto request : batch)
+            {
+                const size_t end = begin + request->numSamples * rows;
+                if (end > merged.size())
+                    LogicError("EvalBatcher: output %ls has fewer samples than the minibatch.", output.first.c_str());
+                request->outputs[output.first]->assign(merged.begin() + begin, merged.begin() + end);
+                begin = end;
+            }
+        }
+    }
+
+    EvaluateFunction m_evaluate;
+    std::map<std::wstring, size_t> m_inputDimensions;
+    std::map<std::wstring, size_t> m_outputDimensions;
+    size_t m_maxBatchSamples;
+    std::chrono::microseconds m_maxWait;
+
+    std::mutex m_mutex; // guards all below
+    std::condition_variable m_requestAdded;
+    std::condition_variable m_requestDone;
+    std::deque<Request*> m_pending;
+    bool m_stop;
+    std::thread m_scheduler;
+
+    // buffers for the merged minibatch, reused across minibatches (scheduler thread only)
+    std::map<std::wstring, std::vector<ElemType>> m_mergedInputs;
+    std::map<std::wstring, std::vector<ElemType>> m_mergedOutputs;
+};
+} } }
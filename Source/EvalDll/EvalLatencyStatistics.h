@@ -0,0 +1,66 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// EvalLatencyStatistics.h - latency histograms of the parts of the evaluation (CNTKEval option latencyStatistics)
+//
+#pragma once
+
+#include "Basics.h"
+#include "Eval.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// EvalLatencyStatistics -- thread-safe collection of named EvalLatencyHistograms, see IEvaluateModel::GetLatencyHistograms()
+// The latencies of one call are added all at once, as a single short critical section per call.
+// -----------------------------------------------------------------------
+
+class EvalLatencyStatistics
+{
+public:
+    typedef std::vector<std::pair<std::wstring, double>> Latencies; // [name, seconds] of one call
+
+    void Add(const Latencies& latencies)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& latency : latencies)
+        {
+            auto iter = m_histograms.find(latency.first);
+            if (iter == m_histograms.end())
+                iter = m_histograms.insert(make_pair(latency.first, EvalLatencyHistogram(latency.first))).first;
+            iter->second.Add(latency.second);
+        }
+    }
+
+    std::vector<EvalLatencyHistogram> Snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<EvalLatencyHistogram> histograms;
+        for (const auto& histogram : m_histograms)
+            histograms.push_back(histogram.second);
+        return histograms;
+    }
+
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_histograms.clear();
+    }
+
+    // seconds since 'start', for the CPU-side parts
+    static double SecondsSince(const std::chrono::steady_clock::time_point& start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::wstring, EvalLatencyHistogram> m_histograms;
+};
+} } }
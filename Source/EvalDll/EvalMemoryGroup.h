@@ -0,0 +1,67 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// EvalMemoryGroup.h - evaluators of several models that share their device memory (CNTKEval option memoryGroup)
+//
+#pragma once
+
+#include "Basics.h"
+#include "ComputationNetwork.h" // for MatrixPool
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// EvalMemoryGroup -- the MatrixPool and the lock shared by all evaluators in the process with the same memoryGroup name
+// Device buffers are already shared by the whole process through the caching allocator underneath TracingGPUMemoryAllocator;
+// what each network has for itself is the MatrixPool that its value matrices and workspaces come from. Evaluators of a group
+// plan their networks in the group's pool instead, so that the intermediate values of one model reuse the matrices of
+// another, and all of them have a single workspace per device. Hence the memory of a group is that of its largest model,
+// not the sum over the models. In return, the evaluators of a group (including their workspaces, see CreateWorkspace())
+// evaluate one at a time: each call holds the group's lock while it plans or runs its network.
+// A group lives as long as any of its evaluators.
+// -----------------------------------------------------------------------
+
+class EvalMemoryGroup
+{
+public:
+    // the group of the given name, created by its first evaluator
+    static std::shared_ptr<EvalMemoryGroup> Get(const std::wstring& name)
+    {
+        static std::mutex s_mutex;
+        static std::map<std::wstring, std::weak_ptr<EvalMemoryGroup>> s_groups;
+        std::lock_guard<std::mutex> lock(s_mutex);
+        auto group = s_groups[name].lock();
+        if (!group)
+        {
+            group = std::make_shared<EvalMemoryGroup>(name);
+            s_groups[name] = group;
+        }
+        return group;
+    }
+
+    explicit EvalMemoryGroup(const std::wstring& name)
+        : m_name(name), m_matrixPool(std::make_shared<MatrixPool>())
+    {
+    }
+
+    const std::wstring& GetName() const { return m_name; }
+    const std::shared_ptr<MatrixPool>& GetMatrixPool() const { return m_matrixPool; }
+
+    // to be held while a network of the group is planned or evaluated (recursive, since public calls of CNTKEval nest)
+    std::unique_lock<std::recursive_mutex> Lock()
+    {
+        return std::unique_lock<std::recursive_mutex>(m_mutex);
+    }
+
+private:
+    std::wstring m_name;
+    std::shared_ptr<MatrixPool> m_matrixPool;
+    std::recursive_mutex m_mutex;
+};
+
+} } }
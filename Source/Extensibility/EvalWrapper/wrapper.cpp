@@ -19,6 +19,7 @@
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace System::Collections;
+using namespace System::Runtime::InteropServices;
 using namespace Microsoft::MSR::CNTK;
 
 namespace Microsoft {
@@ -161,6 +162,122 @@ public:
         return outputMap[outputKey];
     }
 
+    /// <summary>Looks up a node once, for the buffer-based Evaluate() methods</summary>
+    /// <param name="nodeName">The name of an input or output node</param>
+    /// <returns>A handle that stays valid until the next LoadModel()</returns>
+    int GetNodeHandle(String^ nodeName)
+    {
+        if (m_eval == nullptr)
+        {
+            throw gcnew ObjectDisposedException("Object has been disposed.");
+        }
+
+        pin_ptr<const WCHAR> key = PtrToStringChars(nodeName);
+        return (int) m_eval->GetNodeHandle(key);
+    }
+
+    /// <summary>Allocates everything the evaluation of up to maxSamples samples needs, by evaluating that many once, so that later calls do not allocate</summary>
+    /// <param name="maxSamples">The largest number of samples that later calls will evaluate</param>
+    void Warmup(int maxSamples)
+    {
+        if (m_eval == nullptr)
+        {
+            throw gcnew ObjectDisposedException("Object has been disposed.");
+        }
+
+        try
+        {
+            m_eval->Warmup((size_t) maxSamples);
+        }
+        catch (const std::exception& e)
+        {
+            throw gcnew InvalidOperationException(gcnew String(e.what()));
+        }
+    }
+
+    /// <summary>Evaluates numSamples samples from and into caller-owned arrays, without copying them across the managed/native boundary</summary>
+    /// <param name="numSamples">Number of samples; sample j of a node of dimension dim is at [j * dim ... j * dim + dim - 1]</param>
+    /// <param name="inputHandles">Input node handles from GetNodeHandle()</param>
+    /// <param name="inputs">One array of at least numSamples * dim values per input node</param>
+    /// <param name="outputHandles">Output node handles from GetNodeHandle()</param>
+    /// <param name="outputs">One preallocated array of at least numSamples * dim values per output node, overwritten with the results</param>
+    void Evaluate(int numSamples, array<int>^ inputHandles, array<array<ElemType>^>^ inputs, array<int>^ outputHandles, array<array<ElemType>^>^ outputs)
+    {
+        if (inputHandles->Length != inputs->Length || outputHandles->Length != outputs->Length)
+        {
+            throw gcnew ArgumentException("Evaluate: There must be one array per node handle.");
+        }
+
+        // pin all arrays for the duration of the call, so that the native side can use them in place
+        array<GCHandle>^ pins = gcnew array<GCHandle>(inputs->Length + outputs->Length);
+        int numPinned = 0;
+        try
+        {
+            array<IntPtr>^ inputPointers = gcnew array<IntPtr>(inputs->Length);
+            for (int i = 0; i < inputs->Length; i++)
+            {
+                pins[numPinned] = GCHandle::Alloc(inputs[i], GCHandleType::Pinned);
+                inputPointers[i] = pins[numPinned++].AddrOfPinnedObject();
+            }
+
+            array<IntPtr>^ outputPointers = gcnew array<IntPtr>(outputs->Length);
+            for (int i = 0; i < outputs->Length; i++)
+            {
+                pins[numPinned] = GCHandle::Alloc(outputs[i], GCHandleType::Pinned);
+                outputPointers[i] = pins[numPinned++].AddrOfPinnedObject();
+            }
+
+            Evaluate(numSamples, inputHandles, inputPointers, outputHandles, outputPointers);
+        }
+        finally
+        {
+            for (int i = 0; i < numPinned; i++)
+            {
+                pins[i].Free();
+            }
+        }
+    }
+
+    /// <summary>Evaluates numSamples samples from and into native or caller-pinned memory (e.g. a 'fixed' Span or Memory.Pin())</summary>
+    /// <param name="numSamples">Number of samples; sample j of a node of dimension dim is at [j * dim ... j * dim + dim - 1]</param>
+    /// <param name="inputHandles">Input node handles from GetNodeHandle()</param>
+    /// <param name="inputs">One pointer to numSamples * dim values per input node</param>
+    /// <param name="outputHandles">Output node handles from GetNodeHandle()</param>
+    /// <param name="outputs">One pointer to room for numSamples * dim values per output node</param>
+    void Evaluate(int numSamples, array<int>^ inputHandles, array<IntPtr>^ inputs, array<int>^ outputHandles, array<IntPtr>^ outputs)
+    {
+        if (m_eval == nullptr)
+        {
+            throw gcnew ObjectDisposedException("Object has been disposed.");
+        }
+
+        if (numSamples < 0 || inputHandles->Length != inputs->Length || outputHandles->Length != outputs->Length)
+        {
+            throw gcnew ArgumentException("Evaluate: There must be one buffer per node handle.");
+        }
+
+        std::vector<EvalBuffer<ElemType>> stdInputs(inputs->Length);
+        for (int i = 0; i < inputs->Length; i++)
+        {
+            stdInputs[i] = EvalBuffer<ElemType>{(size_t) inputHandles[i], (ElemType*) inputs[i].ToPointer(), 0, -1 /*CPU*/};
+        }
+
+        std::vector<EvalBuffer<ElemType>> stdOutputs(outputs->Length);
+        for (int i = 0; i < outputs->Length; i++)
+        {
+            stdOutputs[i] = EvalBuffer<ElemType>{(size_t) outputHandles[i], (ElemType*) outputs[i].ToPointer(), 0, -1 /*CPU*/};
+        }
+
+        try
+        {
+            m_eval->Evaluate((size_t) numSamples, stdInputs, stdOutputs);
+        }
+        catch (const std::exception& e)
+        {
+            throw gcnew InvalidOperationException(gcnew String(e.what()));
+        }
+    }
+
     ~IEvaluateModelManaged()
     {
         if (m_eval == nullptr)
@@ -193,6 +310,7 @@ private:
         shared_ptr<std::vector<ElemType>> lower(new std::vector<ElemType>());
         if (list != nullptr)
         {
+            lower->reserve(list->Count);
             for each (ElemType item in list)
             {
                 lower->push_back(item);
@@ -233,12 +351,20 @@ void emit()
     f.Init("");
     f.Evaluate(nullptr, nullptr);
     f.Evaluate(nullptr, "", 0);
+    f.GetNodeHandle("");
+    f.Warmup(1);
+    f.Evaluate(0, nullptr, (array<array<float>^>^) nullptr, nullptr, (array<array<float>^>^) nullptr);
+    f.Evaluate(0, nullptr, (array<IntPtr>^) nullptr, nullptr, (array<IntPtr>^) nullptr);
     f.LoadModel("");
 
     IEvaluateModelManagedD d;
     d.Init("");
     d.Evaluate(nullptr, nullptr);
     d.Evaluate(nullptr, "", 0);
+    d.GetNodeHandle("");
+    d.Warmup(1);
+    d.Evaluate(0, nullptr, (array<array<double>^>^) nullptr, nullptr, (array<array<double>^>^) nullptr);
+    d.Evaluate(0, nullptr, (array<IntPtr>^) nullptr, nullptr, (array<IntPtr>^) nullptr);
     d.LoadModel("");
 }
 }
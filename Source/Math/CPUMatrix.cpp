@@ -11,6 +11,9 @@
 
 #include "CPUMatrix.h"
 #include "TensorOps.h"
+#include "CPUVectorKernels.h"
+#include "NumaPlacement.h"
+#include "AlignedMemory.h"
 #include <assert.h>
 #include <stdexcept>
 #include <omp.h>
@@ -19,6 +22,7 @@
 #include <chrono>
 #include <exception>
 #include <thread>
+#include <type_traits>
 #include <iostream>
 #include <algorithm>
 #ifdef _WIN32
@@ -78,6 +82,67 @@ bool TracingGPUMemoryAllocator::IsTraceEnabled()
     return (m_traceLevel > 0);
 }
 
+bool MATH_API TracingGPUMemoryAllocator::m_cachingEnabled = true;
+
+void TracingGPUMemoryAllocator::SetCachingEnabled(bool enabled)
+{
+    m_cachingEnabled = enabled;
+}
+
+bool TracingGPUMemoryAllocator::IsCachingEnabled()
+{
+    return m_cachingEnabled;
+}
+
+// -----------------------------------------------------------------------
+// parallel loops
+// -----------------------------------------------------------------------
+
+// Loops over fewer elements than this run single-threaded ('#pragma omp parallel for if (IsParallelWorthIt(...))'), since the
+// OpenMP fork/join would cost more than the work, e.g. for the small matrices of the steps of a recurrent loop.
+// See CPUMatrix<ElemType>::SetParallelMinElements().
+static size_t s_parallelMinElements = 16384;
+
+static inline bool IsParallelWorthIt(size_t numElements)
+{
+    return numElements >= s_parallelMinElements;
+}
+
+// -----------------------------------------------------------------------
+// helpers for CPUVectorKernels, which only exist for float
+// -----------------------------------------------------------------------
+
+// for double, this is false at compile time, so the casts below never happen for anything but float
+template <class ElemType>
+static inline bool UseVectorKernels()
+{
+    return std::is_same<ElemType, float>::value && CPUVectorKernels::IsAvailable();
+}
+template <class ElemType>
+static inline bool UseFastVectorKernels()
+{
+    return UseVectorKernels<ElemType>() && CPUVectorKernels::UseFastApproximations();
+}
+template <class ElemType>
+static inline float* AsFloats(ElemType* p)
+{
+    return reinterpret_cast<float*>(p);
+}
+
+// run a CPUVectorKernels function fn(begin, count) in parallel over chunks of [0, n)
+template <class F>
+static void ForVectorChunks(size_t n, const F& fn)
+{
+    const size_t chunkSize = 4096; // large enough for the OpenMP overhead not to matter, small enough for load balancing
+    long numChunks = (long) ((n + chunkSize - 1) / chunkSize);
+#pragma omp parallel for if (IsParallelWorthIt(n))
+    for (long k = 0; k < numChunks; k++)
+    {
+        size_t begin = k * chunkSize;
+        fn(begin, min(chunkSize, n - begin));
+    }
+}
+
 #pragma region Helpful Enum Definitions
 enum class MatrixOrder
 {
@@ -137,12 +202,27 @@ CPUMatrix<ElemType>::CPUMatrix(FILE* f, const char* matrixName)
     ReadFromFile(f, matrixName);
 }
 
-// helper to allocate an array of ElemType
-// Use this instead of new[] to get NaN initialization for debugging.
+// NUMA placement of large allocations, see SetNumaPlacement(); small ones are not worth fanning out to the threads
+static NumaMemoryPolicy s_numaMemoryPolicy = NumaMemoryPolicy::none;
+static const size_t s_numaPlacementMinBytes = 1024 * 1024;
+
+// helper to allocate an array of ElemType, zeroed, MemoryAlignment-aligned and, if so configured, on huge pages (see SetHugePages())
+// Use this instead of new[] to get NaN initialization for debugging. Free with FreeArray().
 template <class ElemType>
 static ElemType* NewArray(size_t n)
 {
-    ElemType* p = new ElemType[n]();
+    ElemType* p = (ElemType*) AllocateAlignedMemory(n * sizeof(ElemType)); // (uninitialized, so that no page has been touched yet)
+    if (s_numaMemoryPolicy == NumaMemoryPolicy::none || n * sizeof(ElemType) < s_numaPlacementMinBytes)
+        memset(p, 0, n * sizeof(ElemType));
+    else
+    {
+        if (s_numaMemoryPolicy == NumaMemoryPolicy::interleave)
+            InterleaveMemoryAcrossNumaNodes(p, n * sizeof(ElemType));
+        // zero it with the same static schedule as the element-wise loops, so that each page is placed on the node of the thread that will work on it
+#pragma omp parallel for schedule(static) if (IsParallelWorthIt((size_t) n))
+        for (long i = 0; i < (long) n; i++)
+            p[i] = 0;
+    }
 #if 0 // _DEBUG
         ElemType nan = Matrix<ElemType>::MakeNan(__LINE__);
         for (size_t i = 0; i < n; i++)
@@ -151,6 +231,12 @@ static ElemType* NewArray(size_t n)
     return p;
 }
 
+template <class ElemType>
+static void FreeArray(ElemType* p)
+{
+    FreeAlignedMemory(p);
+}
+
 template <class ElemType>
 CPUMatrix<ElemType>::CPUMatrix(const size_t numRows, const size_t numCols)
 {
@@ -215,7 +301,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::operator=(CPUMatrix<ElemType>&& moveFr
     if (this != &moveFrom)
     {
         if (OwnBuffer() && m_pArray != nullptr)
-            delete[] m_pArray; // always delete the data pointer since we will use the pointer from moveFrom
+            FreeArray(m_pArray); // always delete the data pointer since we will use the pointer from moveFrom
 
         m_computeDevice = moveFrom.m_computeDevice;
         m_numRows = moveFrom.m_numRows;
@@ -242,7 +328,7 @@ void CPUMatrix<ElemType>::Clear()
 {
     if (m_pArray != nullptr && OwnBuffer())
     {
-        delete[] m_pArray;
+        FreeArray(m_pArray);
         m_pArray = nullptr;
         m_elemSizeAllocated = 0;
     }
@@ -331,7 +417,7 @@ void CPUMatrix<ElemType>::CopyColumnsStrided(const CPUMatrix<ElemType>& fromMatr
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -368,7 +454,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignToRowSliceValuesOf(const CPUMatr
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -401,7 +487,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignRowSliceValuesOf(const CPUMatrix
     long n = (long) a.GetNumCols(); // note: OpenMP requires loop indices to be long, not size_t
     long k = (long) a.GetNumRows();
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * numRows))
     for (long j = 0; j < n; j++)
     {
         // memory copy might be faster?
@@ -445,7 +531,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddToRowSliceValuesOf(const CPUMatrix<
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -486,7 +572,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddWithRowSliceValuesOf(const CPUMatri
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -548,7 +634,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignRepeatOf(const CPUMatrix<ElemTyp
     long n = (long) a.GetNumCols(), m = (long) a.GetNumRows();
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     for (long q = 0; q < numColRepeats; q++)
     {
         for (long p = 0; p < numRowRepeats; p++)
@@ -592,7 +678,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddToRowRepeatValuesOf(const CPUMatrix
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -664,7 +750,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignTransposeOf(const CPUMatrix<Elem
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -718,6 +804,33 @@ void CPUMatrix<ElemType>::SetValue(const ElemType v)
     }
 }
 
+template <class ElemType>
+CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignAugmentedImagesOf(const CPUMatrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const CPUMatrix<ElemType>& mean)
+{
+    const size_t pixelsPerImage = width * height;
+    Resize(pixelsPerImage * channels, numImages);
+
+    auto& us = *this;
+    const unsigned char* buffer = (const unsigned char*) images.BufferPointer();
+    const ImageAugmentationDesc* descs = (const ImageAugmentationDesc*) buffer;
+    const ElemType* meanValues = mean.IsEmpty() ? nullptr : mean.BufferPointer();
+#pragma omp parallel for if (IsParallelWorthIt(GetNumElements()))
+    for (long j = 0; j < (long) numImages; j++)
+    {
+        for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++)
+                for (size_t c = 0; c < channels; c++)
+                {
+                    size_t pixel = y * width + x;
+                    ElemType value = ScaledImagePixel<ElemType>(buffer, descs[j], (int) width, (int) height, (int) channels, (int) x, (int) y, (int) c);
+                    if (meanValues)
+                        value -= meanValues[pixel * channels + c];
+                    us(channelsFirst ? c * pixelsPerImage + pixel : pixel * channels + c, j) = value;
+                }
+    }
+    return *this;
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::MaskColumnsValue(const CPUMatrix<char>& columnsMask, ElemType val)
 {
@@ -726,7 +839,7 @@ void CPUMatrix<ElemType>::MaskColumnsValue(const CPUMatrix<char>& columnsMask, E
 
     auto& us = *this;
     long n = (long) GetNumCols(), m = (long) GetNumRows();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n))
     for (long j = 0; j < n; j++)
     {
         if (columnsMask(0, j) == 1)
@@ -759,7 +872,7 @@ void CPUMatrix<ElemType>::SetColumn(const ElemType* colPointer, size_t j)
 
     auto& us = *this;
     long m = (long) GetNumRows();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -783,7 +896,7 @@ void CPUMatrix<ElemType>::SetColumn(const ElemType val, size_t j)
 
     auto& us = *this;
     long m = (long) GetNumRows();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -808,7 +921,7 @@ void CPUMatrix<ElemType>::SetColumn(const CPUMatrix<ElemType>& valMat, size_t j)
 
     auto& us = *this;
     long m = (long) GetNumRows();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -847,8 +960,8 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
     if (matrixFlags & matrixFlagDontOwnBuffer)
     {
         // free previous array allocation if any before overwriting
-        if (m_pArray != nullptr)
-            delete[] m_pArray;
+        if (m_pArray != nullptr && OwnBuffer())
+            FreeArray(m_pArray);
 
         m_pArray = pArray;
         m_numRows = numRows;
@@ -875,7 +988,7 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
                 auto& us = *this;
                 if (sizeof(ElemType) == sizeof(double))
                 {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
                     foreach_column (j, us)
                     {
 #ifndef USE_MKL
@@ -887,7 +1000,7 @@ void CPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, E
                 }
                 else
                 {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
                     foreach_column (j, us)
                     {
                         {
@@ -916,7 +1029,7 @@ void CPUMatrix<ElemType>::SetDiagonalValue(const ElemType v)
 
     auto& us = *this;
     long m = (long) GetNumRows();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -955,7 +1068,7 @@ void CPUMatrix<ElemType>::SetDiagonalValue(const CPUMatrix<ElemType>& vector)
         long m = (long) GetNumRows();
         if (vector.GetNumRows() == 1) // row vector
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
             // four-way unrolling
             for (long i = 0; i < (m & ~3); i += 4)
             {
@@ -972,7 +1085,7 @@ void CPUMatrix<ElemType>::SetDiagonalValue(const CPUMatrix<ElemType>& vector)
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
             // four-way unrolling
             for (long i = 0; i < (m & ~3); i += 4)
             {
@@ -1210,7 +1323,7 @@ void CPUMatrix<ElemType>::FSAdagrad(CPUMatrix<ElemType>& gradients,
     ElemType* smoothAda = m_pArray;
     ElemType* smoothMom = m_pArray + n;
     ElemType* val = functionValues.m_pArray;
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(n))
     // TODO: Unroll 4-times for better performance leveraging vectorization
     for (long i = 0; i < n; i++)
     {
@@ -1238,6 +1351,81 @@ void CPUMatrix<ElemType>::FSAdagrad(CPUMatrix<ElemType>& gradients,
     }
 }
 
+// Adam, or with layerwiseAdaptive LAMB, whose step is scaled by the trust ratio ||w|| / ||r|| of the tensor, see AdamUpdateOp
+// The state (this) is a column of AdamStateSize() elements, and is (re-)initialized to 0 if it is not.
+template <class ElemType>
+void CPUMatrix<ElemType>::Adam(CPUMatrix<ElemType>& gradients, CPUMatrix<ElemType>& functionValues, ElemType learnRate,
+                               ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive)
+{
+    const size_t n = gradients.GetNumElements();
+    if (GetNumElements() != AdamStateSize(n))
+    {
+        Resize(AdamStateSize(n), 1);
+        SetValue(0.0);
+    }
+
+    ElemType* grad = gradients.m_pArray;
+    ElemType* m = m_pArray;
+    ElemType* v = m_pArray + n;
+    ElemType* val = functionValues.m_pArray;
+    ElemType& step = m_pArray[2 * n];
+    step += 1;
+    const AdamUpdateOp<ElemType> op(beta1, beta2, epsilon, weightDecay, step);
+    if (!layerwiseAdaptive)
+    {
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n))
+        for (long i = 0; i < (long) n; i++)
+            val[i] -= learnRate * op(grad[i], m[i], v[i], val[i]);
+        return;
+    }
+
+    // LAMB: the directions go into the gradient until the norms are known
+    double sumOfSquaresW = 0, sumOfSquaresR = 0;
+#pragma omp parallel for reduction(+ : sumOfSquaresW, sumOfSquaresR)
+    for (long i = 0; i < (long) n; i++)
+    {
+        const ElemType r = op(grad[i], m[i], v[i], val[i]);
+        grad[i] = r;
+        sumOfSquaresW += (double) val[i] * val[i];
+        sumOfSquaresR += (double) r * r;
+    }
+    const ElemType rate = learnRate * LayerwiseTrustRatio<ElemType>((ElemType) sumOfSquaresW, (ElemType) sumOfSquaresR, 1);
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n))
+    for (long i = 0; i < (long) n; i++)
+        val[i] -= rate * grad[i];
+}
+
+// LARS: momentum SGD (v = momentum * v + rate * g, w -= v) with rate = learnRate * trustCoefficient * ||w|| / ||g||
+// The state (this) is a column of LarsStateSize() elements, and is (re-)initialized to 0 if it is not.
+template <class ElemType>
+void CPUMatrix<ElemType>::Lars(CPUMatrix<ElemType>& gradients, CPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType momentum, ElemType trustCoefficient)
+{
+    const size_t n = gradients.GetNumElements();
+    if (GetNumElements() != LarsStateSize(n))
+    {
+        Resize(LarsStateSize(n), 1);
+        SetValue(0.0);
+    }
+
+    const ElemType* grad = gradients.m_pArray;
+    ElemType* smoothMom = m_pArray;
+    ElemType* val = functionValues.m_pArray;
+    double sumOfSquaresW = 0, sumOfSquaresG = 0;
+#pragma omp parallel for reduction(+ : sumOfSquaresW, sumOfSquaresG)
+    for (long i = 0; i < (long) n; i++)
+    {
+        sumOfSquaresW += (double) val[i] * val[i];
+        sumOfSquaresG += (double) grad[i] * grad[i];
+    }
+    const ElemType rate = learnRate * LayerwiseTrustRatio<ElemType>((ElemType) sumOfSquaresW, (ElemType) sumOfSquaresG, trustCoefficient);
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n))
+    for (long i = 0; i < (long) n; i++)
+    {
+        smoothMom[i] = momentum * smoothMom[i] + rate * grad[i];
+        val[i] -= smoothMom[i];
+    }
+}
+
 template <class ElemType>
 ElemType CPUMatrix<ElemType>::RmsProp(CPUMatrix<ElemType>& gradients,
                                       ElemType RMS_GAMMA,
@@ -1334,6 +1522,45 @@ ElemType CPUMatrix<ElemType>::RmsProp(CPUMatrix<ElemType>& gradients,
         return 1;
 }
 
+// fused clipping, regularization and momentum update of a list of parameters, see MultiTensorUpdateOp
+template <class ElemType>
+/*static*/ void CPUMatrix<ElemType>::MultiTensorNormalGrad(const std::vector<CPUMatrix<ElemType>*>& functionValues, const std::vector<CPUMatrix<ElemType>*>& gradients,
+                                                         const std::vector<CPUMatrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc)
+{
+    const MultiTensorUpdateOp<ElemType> op(desc);
+    const bool clipNorm = !desc.clippingWithTruncation && desc.clippingThreshold != std::numeric_limits<double>::infinity();
+    auto gradientScaleFor = [&](const std::vector<CPUMatrix<ElemType>*>& tensors) -> ElemType
+    {
+        double sumOfSquares = 0;
+        for (auto tensor : tensors)
+        {
+            const ElemType* g = tensor->m_pArray;
+            const long n = (long) tensor->GetNumElements();
+#pragma omp parallel for reduction(+ : sumOfSquares)
+            for (long k = 0; k < n; k++)
+                sumOfSquares += (double) g[k] * g[k];
+        }
+        const double norm = sqrt(sumOfSquares);
+        return norm > desc.clippingThreshold ? (ElemType) (desc.clippingThreshold / norm) : 1;
+    };
+    const ElemType globalGradientScale = clipNorm && desc.clippingByGlobalNorm ? gradientScaleFor(gradients) : 1;
+    for (size_t t = 0; t < functionValues.size(); t++)
+    {
+        ElemType* w = functionValues[t]->m_pArray;
+        ElemType* g = gradients[t]->m_pArray;
+        ElemType* v = smoothedGradients[t]->m_pArray;
+        const long n = (long) functionValues[t]->GetNumElements();
+
+        ElemType gradientScale = globalGradientScale;
+        if (clipNorm && !desc.clippingByGlobalNorm)
+            gradientScale = gradientScaleFor({gradients[t]});
+
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n))
+        for (long k = 0; k < n; k++)
+            op(w[k], g[k], v[k], gradientScale);
+    }
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::Reshape(const size_t numRows, const size_t numCols)
 {
@@ -1371,7 +1598,7 @@ void CPUMatrix<ElemType>::Resize(const size_t numRows, const size_t numCols, boo
         }
         // success: update the object
         if (OwnBuffer())
-            delete[] m_pArray;
+            FreeArray(m_pArray);
         else
             assert(pArray == nullptr); // (if !OwnBuffer we can still resize to 0)
         m_pArray = pArray;
@@ -1391,7 +1618,7 @@ ElemType* CPUMatrix<ElemType>::CopyToArray() const
     size_t numElements = GetNumElements();
     if (numElements != 0)
     {
-        ElemType* arrayCopyTo = NewArray<ElemType>(numElements);
+        ElemType* arrayCopyTo = new ElemType[numElements]; // (the caller delete[]s it)
         memcpy(arrayCopyTo, m_pArray, sizeof(ElemType) * numElements);
         return arrayCopyTo;
     }
@@ -1410,8 +1637,8 @@ size_t CPUMatrix<ElemType>::CopyToArray(ElemType*& arrayCopyTo, size_t& currentA
 
     if (numElements > currentArraySize)
     {
-        delete arrayCopyTo;
-        arrayCopyTo = NewArray<ElemType>(numElements);
+        delete[] arrayCopyTo;
+        arrayCopyTo = new ElemType[numElements];
         currentArraySize = numElements;
     }
 
@@ -1473,7 +1700,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSumOf(const ElemType alpha, cons
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1573,7 +1800,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignDifferenceOf(const ElemType alph
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1602,7 +1829,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignDifferenceOf(const CPUMatrix<Ele
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1791,8 +2018,17 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignElementProductOf(const CPUMatrix
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
+    if (UseVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::ElementProduct(AsFloats(a.m_pArray) + begin, AsFloats(b.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1828,8 +2064,17 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddElementProductOf(const CPUMatrix<El
 
     auto& us = *this;
 
+    if (UseVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::AddElementProduct(AsFloats(a.m_pArray) + begin, AsFloats(b.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1850,6 +2095,52 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddElementProductOf(const CPUMatrix<El
     return *this;
 }
 
+//[this]=a .* mask / (1 - dropoutRate)   (or [this] += ... if accumulate)
+// The mask is not stored: element k is kept if DropoutKeeps(seed, firstElementIndex + k) holds, so that
+// the backward pass regenerates exactly the mask of the forward pass. We hash once per group of four elements.
+template <class ElemType>
+CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignDropoutOf(const CPUMatrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex, const bool accumulate)
+{
+    if (a.IsEmpty())
+        LogicError("AssignDropoutOf: Matrix is empty.");
+
+    if (accumulate)
+    {
+        if (!(a.GetNumRows() == GetNumRows() && a.GetNumCols() == GetNumCols()))
+            InvalidArgument("AssignDropoutOf: The input matrix dimensions do not match [this].");
+    }
+    else if (this != &a)
+        Resize(a.GetNumRows(), a.GetNumCols());
+
+    const unsigned int threshold = DropoutThreshold(dropoutRate);
+    const ElemType scale = (ElemType) (1.0 / (1.0 - dropoutRate));
+    const size_t n = GetNumElements();
+    const size_t firstGroup = firstElementIndex / 4;
+    const long numGroups = (long) ((firstElementIndex + n - 1) / 4 - firstGroup + 1);
+    ElemType* us = m_pArray;
+    const ElemType* in = a.m_pArray;
+#pragma omp parallel for if (IsParallelWorthIt(n))
+    for (long g = 0; g < numGroups; g++)
+    {
+        unsigned int lanes[4];
+        Philox4x32(seed, firstGroup + g, lanes);
+        for (size_t lane = 0; lane < 4; lane++)
+        {
+            const size_t index = (firstGroup + g) * 4 + lane;
+            if (index < firstElementIndex || index - firstElementIndex >= n)
+                continue;
+            const size_t k = index - firstElementIndex;
+            const ElemType v = lanes[lane] >= threshold ? in[k] * scale : 0;
+            if (accumulate)
+                us[k] += v;
+            else
+                us[k] = v;
+        }
+    }
+
+    return *this;
+}
+
 //[this]=a ./ b
 // TODO: This clips the divisor by a small value. Is that really what one would want?
 template <class ElemType>
@@ -1868,7 +2159,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignElementDivisionOf(const CPUMatri
 
     ElemType smallValue = EPS_IN_INVERSE;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         ElemType v = b(i, j);
@@ -1896,7 +2187,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::ColumnElementMultiplyWith(const CPUMat
     auto& us = *this;
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -1930,7 +2221,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::RowElementMultiplyWith(const CPUMatrix
     auto& us = *this;
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         ElemType v = a(0, j);
@@ -1965,7 +2256,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::RowElementDivideBy(const CPUMatrix<Ele
     auto& us = *this;
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n))
     for (long j = 0; j < n; j++)
     {
         ElemType v = a(0, j);
@@ -2006,7 +2297,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::ColumnElementDivideBy(const CPUMatrix<
     long m = (long) GetNumRows(), n = (long) GetNumCols();
 
     ElemType smallValue = EPS_IN_INVERSE;
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         for (long i = 0; i < m; i++)
@@ -2024,6 +2315,80 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::ColumnElementDivideBy(const CPUMatrix<
     return *this;
 }
 
+// this(:,j) = beta * this(:,j) + alpha * a(:,idx(j))
+template <class ElemType>
+CPUMatrix<ElemType>& CPUMatrix<ElemType>::DoGatherColumnsOf(ElemType beta, const CPUMatrix<ElemType>& idx, const CPUMatrix<ElemType>& a, ElemType alpha)
+{
+    if (idx.GetNumRows() != 1) // index is 1-dimensional only
+        InvalidArgument("DoGatherColumnsOf: Map must be a row vector.");
+
+    if (beta)
+        VerifySize(a.GetNumRows(), idx.GetNumCols());
+    else
+        Resize(a.GetNumRows(), idx.GetNumCols());
+
+    auto& us = *this;
+    long m = (long) GetNumRows(), n = (long) GetNumCols();
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n))
+    for (long j = 0; j < n; j++)
+    {
+        auto jInF = idx(0, j); // this is the column we need to get
+        if (jInF < 0)          // negative index means no data
+        {
+            for (long i = 0; i < m; i++)
+                us(i, j) = beta ? beta * us(i, j) : 0;
+            continue;
+        }
+        size_t jIn = (size_t) jInF;
+        if (jIn >= a.GetNumCols())
+            InvalidArgument("DoGatherColumnsOf: Map out of bounds. %ld >= %ld", (long) jIn, (long) a.GetNumCols());
+        for (long i = 0; i < m; i++)
+            us(i, j) = (beta ? beta * us(i, j) : 0) + alpha * a(i, jIn);
+    }
+
+    return *this;
+}
+
+// this = beta * this; this(:,idx(j)) += alpha * a(:,j)
+template <class ElemType>
+CPUMatrix<ElemType>& CPUMatrix<ElemType>::DoScatterColumnsOf(ElemType beta, const CPUMatrix<ElemType>& idx, const CPUMatrix<ElemType>& a, ElemType alpha)
+{
+    if (idx.GetNumRows() != 1) // index is 1-dimensional only
+        InvalidArgument("DoScatterColumnsOf: Map must be a row vector.");
+    if (idx.GetNumCols() != a.GetNumCols())
+        InvalidArgument("DoScatterColumnsOf: Map must have width of input vector.");
+    if (a.GetNumRows() != GetNumRows())
+        InvalidArgument("DoScatterColumnsOf: Output must have same height as input vector.");
+
+    auto& us = *this;
+    if (beta == 0)
+        SetValue(0);
+    else if (beta != 1)
+        us *= beta;
+
+    long m = (long) GetNumRows(), n = (long) a.GetNumCols();
+    for (long j = 0; j < n; j++)
+    {
+        auto jOutF = idx(0, j);
+        if (jOutF >= 0 && (size_t) jOutF >= GetNumCols())
+            InvalidArgument("DoScatterColumnsOf: Map out of bounds.");
+    }
+    // parallel over rows, since the same target column may occur multiple times
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n))
+    for (long i = 0; i < m; i++)
+    {
+        for (long j = 0; j < n; j++)
+        {
+            auto jOutF = idx(0, j); // this is the column we copy/add into
+            if (jOutF < 0)          // negative index means no data
+                continue;
+            us(i, (size_t) jOutF) += alpha * a(i, j);
+        }
+    }
+
+    return *this;
+}
+
 //[this]=1 ./ a
 template <class ElemType>
 CPUMatrix<ElemType>& CPUMatrix<ElemType>::ElementInverse()
@@ -2043,7 +2408,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignElementInverseOf(const CPUMatrix
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         if (a(i, j) < 0 && a(i, j) > -smallValue)
@@ -2074,7 +2439,16 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSigmoidOf(const CPUMatrix<ElemTy
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+    if (UseFastVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::Sigmoid(AsFloats(a.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         if (a(i, j) >= 0)
@@ -2106,7 +2480,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLinearRectifierDerivativeOf(cons
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2144,7 +2518,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSigmoidDerivativeOf(const CPUMat
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2190,8 +2564,17 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignTanhOf(const CPUMatrix<ElemType>
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
+    if (UseFastVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::Tanh(AsFloats(a.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2229,9 +2612,16 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLogSoftmaxOf(const CPUMatrix<Ele
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-    if (isColWise)
+    if (isColWise && UseVectorKernels<ElemType>())
     {
-#pragma omp parallel for
+        const size_t m = a.GetNumRows();
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
+        foreach_column (j, a)
+            CPUVectorKernels::LogSoftmax(AsFloats(a.m_pArray) + j * m, AsFloats(m_pArray) + j * m, m);
+    }
+    else if (isColWise)
+    {
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_column (j, a)
         {
             // we need to extract max before applying exp to avoid overflow
@@ -2249,7 +2639,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLogSoftmaxOf(const CPUMatrix<Ele
     }
     else
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_row (i, a)
         {
             // we need to extract max before applying exp to avoid overflow
@@ -2269,6 +2659,57 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLogSoftmaxOf(const CPUMatrix<Ele
     return *this;
 }
 
+// fused column-wise softmax + cross entropy: [this] (1x1) = -sum_j sum_i labels(i,j) * log softmax(logits(:,j))_i
+// Two passes over each column (max, then sum of exp together with the label terms); the softmax itself is never stored.
+// Only the per-column log-sum-exp is kept, from which AddCrossEntropyWithSoftmaxGradient() recomputes the softmax.
+template <class ElemType>
+CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignCrossEntropyWithSoftmaxOf(const CPUMatrix<ElemType>& labels, const CPUMatrix<ElemType>& logits, CPUMatrix<ElemType>& logSumExp)
+{
+    if (logits.IsEmpty())
+        LogicError("AssignCrossEntropyWithSoftmaxOf: Matrix logits is empty.");
+    if (labels.GetNumRows() != logits.GetNumRows() || labels.GetNumCols() != logits.GetNumCols())
+        InvalidArgument("AssignCrossEntropyWithSoftmaxOf: labels and logits must have the same dimensions.");
+
+    const long m = (long) logits.GetNumRows();
+    logSumExp.Resize(1, logits.GetNumCols());
+
+    double criterion = 0;
+#pragma omp parallel for reduction(+ : criterion)
+    foreach_column (j, logits)
+    {
+        const ElemType* z = logits.m_pArray + j * m;
+        const ElemType* y = labels.m_pArray + j * m;
+
+        ElemType maxV = z[0];
+        for (long i = 1; i < m; i++)
+            maxV = max(maxV, z[i]);
+
+        // everything relative to the max, so that neither exp() overflows nor the criterion suffers from cancellation
+        ElemType sumExp = 0;
+        ElemType sumLabels = 0;
+        ElemType sumLabelledDistances = 0;
+        for (long i = 0; i < m; i++)
+        {
+            sumExp += exp(z[i] - maxV);
+            if (y[i] != 0)
+            {
+                sumLabels += y[i];
+                sumLabelledDistances += y[i] * (maxV - z[i]);
+            }
+        }
+        const ElemType logSumExpRel = log(sumExp);
+        logSumExp.m_pArray[j] = maxV + logSumExpRel;
+
+        // gap columns have all-zero (masked) labels and contribute nothing, even if their logits are garbage
+        if (sumLabels != 0)
+            criterion += sumLabels * logSumExpRel + sumLabelledDistances;
+    }
+
+    Resize(1, 1);
+    m_pArray[0] = (ElemType) criterion;
+    return *this;
+}
+
 //[this]=hardmax([this])
 //the max element is 1 else is 0
 template <class ElemType>
@@ -2289,7 +2730,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignHardmaxOf(const CPUMatrix<ElemTy
 
     if (isColWise)
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_column (j, a)
         {
             // we need to extract max
@@ -2310,7 +2751,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignHardmaxOf(const CPUMatrix<ElemTy
     }
     else
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_row (i, a)
         {
             // we need to extract max
@@ -2353,7 +2794,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSqrtOf(const CPUMatrix<ElemType>
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2391,8 +2832,17 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignExpOf(const CPUMatrix<ElemType>&
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
+    if (UseFastVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::Exp(AsFloats(a.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2431,7 +2881,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignAbsOf(const CPUMatrix<ElemType>&
         Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2476,7 +2926,16 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLogOf(const CPUMatrix<ElemType>&
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+    if (UseFastVectorKernels<ElemType>())
+    {
+        ForVectorChunks(GetNumElements(), [&](size_t begin, size_t count)
+                        {
+                            CPUVectorKernels::Log(AsFloats(a.m_pArray) + begin, AsFloats(m_pArray) + begin, count);
+                        });
+        return *this;
+    }
+
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         const ElemType v = a(i, j);
@@ -2501,7 +2960,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignLog10Of(const CPUMatrix<ElemType
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         const ElemType v = a(i, j);
@@ -2535,7 +2994,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignCosineOf(const CPUMatrix<ElemTyp
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         const ElemType v = a(i, j);
@@ -2562,7 +3021,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignNegativeSineOf(const CPUMatrix<E
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         const ElemType v = a(i, j);
@@ -2582,7 +3041,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::InplaceTruncateBottom(const ElemType t
     auto& us = *this;
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2622,7 +3081,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::InplaceTruncate(const ElemType thresho
     ElemType locTHresholdNeg = -locThresholdPos;
 
     long m = (long) GetNumRows(), n = (long) GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
     for (long j = 0; j < n; j++)
     {
         // four-way unrolling
@@ -2670,7 +3129,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::InplaceSoftThreshold(const ElemType th
 
     long m = (long) GetNumElements();
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     for (long i = 0; i < (m & ~3); i += 4) // four-way unrolling
     {
         if (m_pArray[i] > threshold)
@@ -2726,7 +3185,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignTruncateBottomOf(const CPUMatrix
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         if (a(i, j) < threshold)
@@ -2747,7 +3206,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::InplaceTruncateTop(const ElemType thre
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         if (us(i, j) > threshold)
@@ -2768,7 +3227,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignTruncateTopOf(const CPUMatrix<El
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         if (a(i, j) > threshold)
@@ -2789,7 +3248,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::SetToZeroIfAbsLessThan(const ElemType
 
     auto& us = *this;
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         if (abs(us(i, j)) < threshold)
@@ -2835,6 +3294,15 @@ ElemType CPUMatrix<ElemType>::SumOfElements() const
     ElemType sum = 0;
     long m = (long) GetNumElements(); // note: OpenMP requires loop indices to be long, not size_t
 
+    if (UseVectorKernels<ElemType>())
+    {
+        const long chunkSize = 4096;
+#pragma omp parallel for reduction(+ : sum)
+        for (long k = 0; k < (m + chunkSize - 1) / chunkSize; k++)
+            sum += CPUVectorKernels::Sum(AsFloats(m_pArray) + k * chunkSize, min(chunkSize, m - k * chunkSize));
+        return sum;
+    }
+
 //four-way unrolling
 #pragma omp parallel for reduction(+ : sum)
     for (long i = 0; i < (m & ~3); i += 4)
@@ -2880,11 +3348,19 @@ void CPUMatrix<ElemType>::VectorSum(const CPUMatrix<ElemType>& a, CPUMatrix<Elem
 
     assert(m > 0 && n > 0); // converting from size_t to int may cause overflow
 
-    if (isColWise) // col-wise
+    if (isColWise && UseVectorKernels<ElemType>())
     {
         c.Resize(1, n);
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
+        foreach_column (j, a)
+            c(0, j) = CPUVectorKernels::Sum(AsFloats(a.m_pArray) + (size_t) j * m, m);
+    }
+    else if (isColWise) // col-wise
+    {
+        c.Resize(1, n);
+
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_column (j, a)
         {
             ElemType v = 0;
@@ -2900,7 +3376,7 @@ void CPUMatrix<ElemType>::VectorSum(const CPUMatrix<ElemType>& a, CPUMatrix<Elem
     {
         c.Resize(m, 1);
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_row (i, a)
         {
             ElemType v = 0;
@@ -2931,7 +3407,7 @@ void CPUMatrix<ElemType>::VectorNorm1(CPUMatrix<ElemType>& c, const bool isColWi
     {
         c.Resize(1, n);
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
         foreach_column (j, us)
         {
             ElemType v = 0;
@@ -2947,7 +3423,7 @@ void CPUMatrix<ElemType>::VectorNorm1(CPUMatrix<ElemType>& c, const bool isColWi
     {
         c.Resize(m, 1);
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
         foreach_row (i, us)
         {
             ElemType v = 0;
@@ -2987,7 +3463,7 @@ void CPUMatrix<ElemType>::VectorNorm2(CPUMatrix<ElemType>& c, const bool isColWi
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #ifndef USE_MKL
@@ -2999,7 +3475,7 @@ void CPUMatrix<ElemType>::VectorNorm2(CPUMatrix<ElemType>& c, const bool isColWi
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #pragma warning(suppress : 4244)
@@ -3017,7 +3493,7 @@ void CPUMatrix<ElemType>::VectorNorm2(CPUMatrix<ElemType>& c, const bool isColWi
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #ifndef USE_MKL
@@ -3029,7 +3505,7 @@ void CPUMatrix<ElemType>::VectorNorm2(CPUMatrix<ElemType>& c, const bool isColWi
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #pragma warning(suppress : 4244)
@@ -3128,7 +3604,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignKhatriRaoProductOf(const CPUMatr
 #ifdef __INTEL_COMPILER // TODO: check this
 #pragma simd statement
 #endif
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) cols * rowsB))
     for (long k = 0; k < cols; k++)
     {
         long jj = 0;
@@ -3181,7 +3657,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddColumnReshapeProductOf(const CPUMat
 #ifdef __INTEL_COMPILER // TODO: check this
 #pragma simd statement
 #endif
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_column (t, a)
         {
             size_t k = 0;
@@ -3205,7 +3681,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddColumnReshapeProductOf(const CPUMat
 #ifdef __INTEL_COMPILER // TODO: check this
 #pragma simd statement
 #endif
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
         foreach_column (t, a)
         {
             size_t k = 0;
@@ -3277,7 +3753,7 @@ ElemType CPUMatrix<ElemType>::MatrixNormInf() const
     auto& us = *this;
 
     ElemType v = 0;
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
 #pragma omp critical
@@ -3297,7 +3773,7 @@ ElemType CPUMatrix<ElemType>::MatrixNorm0() const
     auto& us = *this;
 
     ElemType v = 0;
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_coord (i, j, us)
     {
         if (us(i, j) != 0)
@@ -3338,7 +3814,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSignOf(const CPUMatrix<ElemType>
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_column (j, us)
     {
         foreach_row (i, us)
@@ -3364,7 +3840,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddSignOf(const CPUMatrix<ElemType>& a
     if (this != &a)
         Resize(a.GetNumRows(), a.GetNumCols());
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(us.GetNumElements()))
     foreach_column (j, us)
     {
         foreach_row (i, us)
@@ -3789,7 +4265,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignMaxPoolingResult(const CPUMatrix
 // OUT_ELEM_ROWPOS(channel, wrow, wcol) = (channel + (wrow + wcol * outputHeight) * channels)
 // OUT_ELEM_COLPOS = sample
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) batchSize * outputSizePerSample))
     for (long sample = 0; sample < (long) batchSize; sample++)
     {
         for (long outputIndexWithinSample = 0; outputIndexWithinSample < outputSizePerSample; outputIndexWithinSample++)
@@ -3838,7 +4314,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddMaxPoolingGradient(const CPUMatrix<
 // OUT_ELEM_ROWPOS(channel, wrow, wcol) = (channel + (wrow + wcol * outputHeight) * channels)
 // OUT_ELEM_COLPOS = sample
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) batchSize * inputSizePerSample))
     for (long sample = 0; sample < batchSize; sample++)
     {
         for (long inputIndexWithinSample = 0; inputIndexWithinSample < inputSizePerSample; inputIndexWithinSample++)
@@ -3886,7 +4362,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignAveragePoolingResult(const CPUMa
 // OUT_ELEM_ROWPOS(channel, wrow, wcol) = (channel + (wrow + wcol * outputHeight) * channels)
 // OUT_ELEM_COLPOS = sample
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) batchSize * outputSizePerSample))
     for (long sample = 0; sample < batchSize; sample++)
     {
         for (long outputIndexWithinSample = 0; outputIndexWithinSample < outputSizePerSample; outputIndexWithinSample++)
@@ -3933,7 +4409,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AddAveragePoolingGradient(const CPUMat
 // OUT_ELEM_ROWPOS(channel, wrow, wcol) = (channel + (wrow + wcol * outputHeight) * channels)
 // OUT_ELEM_COLPOS = sample
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) batchSize * inputSizePerSample))
     for (long sample = 0; sample < batchSize; sample++)
     {
         for (long inputIndexWithinSample = 0; inputIndexWithinSample < inputSizePerSample; inputIndexWithinSample++)
@@ -4066,6 +4542,42 @@ void CPUMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const CPUMatrix
     }
 }
 
+/// <summary>Batched matrix-matrix multiply: c_i = alpha * op(a_i) * op(b_i) + beta * c_i for i = 0..batchCount-1</summary>
+/// a_i, b_i, and c_i are the i-th of batchCount consecutive column blocks of equal width of a, b, and c
+/// (e.g. for 3 blocks of [m x k], a is [m x 3k]). Blocks are multiplied in parallel if they are small,
+/// since BLAS does not parallelize those well; otherwise they are multiplied one after another.
+template <class ElemType>
+void CPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd(ElemType alpha, const CPUMatrix<ElemType>& a, const bool transposeA, const CPUMatrix<ElemType>& b, const bool transposeB,
+                                                      ElemType beta, CPUMatrix<ElemType>& c, const size_t batchCount)
+{
+    if (a.IsEmpty() || b.IsEmpty() || batchCount == 0)
+        return;
+    if (a.GetNumCols() % batchCount != 0 || b.GetNumCols() % batchCount != 0)
+        InvalidArgument("CPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd : The number of columns of a and b must be multiples of the batch count.");
+
+    const size_t colsA = a.GetNumCols() / batchCount;
+    const size_t colsB = b.GetNumCols() / batchCount;
+    const size_t m = transposeA ? colsA : a.GetNumRows();
+    const size_t k = transposeA ? a.GetNumRows() : colsA;
+    const size_t l = transposeB ? colsB : b.GetNumRows();
+    const size_t n = transposeB ? b.GetNumRows() : colsB;
+    if (k != l)
+        InvalidArgument("CPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd : The inner dimensions of a and b must match.");
+
+    if (beta == 0)
+        c.Resize(m, n * batchCount);
+    else
+        c.VerifySize(m, n * batchCount); // Can't resize if beta != 0
+
+    const bool parallelizeBatch = (double) m * n * k < 64 * 64 * 64;
+#pragma omp parallel for if (parallelizeBatch)
+    for (long i = 0; i < (long) batchCount; i++)
+    {
+        CPUMatrix<ElemType> ci = c.ColumnSlice(i * n, n);
+        MultiplyAndWeightedAdd(alpha, a.ColumnSlice(i * colsA, colsA), transposeA, b.ColumnSlice(i * colsB, colsB), transposeB, beta, ci);
+    }
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::Multiply1x1AndWeightedAdd(ElemType alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b,
                                                     ElemType beta, CPUMatrix<ElemType>& c)
@@ -4074,11 +4586,11 @@ void CPUMatrix<ElemType>::Multiply1x1AndWeightedAdd(ElemType alpha, const CPUMat
 
     ElemType f = alpha * a.Get00Element();
     if (beta == 0) // don't even read the memory if beta is 0
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
         foreach_coord (i, j, c)
             c(i, j) = b(i, j) * f;
     else
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
         foreach_coord (i, j, c)
             c(i, j) = b(i, j) * f + c(i, j) * beta;
 }
@@ -4345,7 +4857,7 @@ void CPUMatrix<ElemType>::ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>&
     {
         ElemType v = alpha * a(0, 0);
         long m = (long) c.GetNumRows(), n = (long) c.GetNumCols();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n * m))
         for (long j = 0; j < n; j++)
         {
             // four-way unrolling
@@ -4372,7 +4884,7 @@ void CPUMatrix<ElemType>::ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>&
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #ifndef USE_MKL
@@ -4384,7 +4896,7 @@ void CPUMatrix<ElemType>::ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>&
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #pragma warning(suppress : 4244)
@@ -4406,7 +4918,7 @@ void CPUMatrix<ElemType>::ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>&
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #ifndef USE_MKL
@@ -4418,7 +4930,7 @@ void CPUMatrix<ElemType>::ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>&
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #pragma warning(suppress : 4244)
@@ -4453,7 +4965,7 @@ void CPUMatrix<ElemType>::AddScaledDifference(const ElemType alpha, const CPUMat
         LogicError("AddScaledDifference:  Input matrix a is empty.");
 
     long m = (long) c.GetNumElements();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -4492,7 +5004,7 @@ void CPUMatrix<ElemType>::AssignScaledDifference(const ElemType alpha, const CPU
         c.Resize(a.GetNumRows(), a.GetNumCols());
 
     long m = (long) c.GetNumElements();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m))
     // four-way unrolling
     for (long i = 0; i < (m & ~3); i += 4)
     {
@@ -4558,6 +5070,37 @@ void CPUMatrix<ElemType>::AddScaledDifference(const CPUMatrix<ElemType>& alpha,
     AddScaledDifference(alpha(0, 0), a, b, c);
 }
 
+/// <summary> c += alpha * (softmax(logits) - labels), column-wise</summary>
+/// The softmax is recomputed on the fly from the per-column log-sum-exp left by AssignCrossEntropyWithSoftmaxOf().
+/// <param name="alpha">1X1 matrix</param>
+/// <param name="labels">Input matrix</param>
+/// <param name="logits">Input matrix</param>
+/// <param name="logSumExp">1 x cols matrix</param>
+/// <param name="c">Resulting matrix, user is responsible for allocating this</param>
+template <class ElemType>
+void CPUMatrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& labels, const CPUMatrix<ElemType>& logits,
+                                                             const CPUMatrix<ElemType>& logSumExp, CPUMatrix<ElemType>& c)
+{
+    if (!(alpha.GetNumElements() == 1))
+        InvalidArgument("AddCrossEntropyWithSoftmaxGradient:  alpha must be a 1X1 matrix.");
+    if (!(labels.GetNumRows() == logits.GetNumRows() && labels.GetNumRows() == c.GetNumRows() &&
+          labels.GetNumCols() == logits.GetNumCols() && labels.GetNumCols() == c.GetNumCols() && logSumExp.GetNumElements() == logits.GetNumCols()))
+        InvalidArgument("AddCrossEntropyWithSoftmaxGradient:  labels, logits, and c must have same dimension, and logSumExp one element per column.");
+
+    const ElemType a = alpha(0, 0);
+    const long m = (long) c.GetNumRows();
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
+    foreach_column (j, c)
+    {
+        const ElemType* z = logits.m_pArray + j * m;
+        const ElemType* y = labels.m_pArray + j * m;
+        ElemType* g = c.m_pArray + j * m;
+        const ElemType lse = logSumExp.m_pArray[j];
+        for (long i = 0; i < m; i++)
+            g[i] += a * (exp(z[i] - lse) - y[i]);
+    }
+}
+
 /// <summary> c = alpha * (a-b)</summary>
 /// if a, b, c  must have same dim
 /// <param name="alpha">1X1 matrix</param>
@@ -4590,7 +5133,7 @@ void CPUMatrix<ElemType>::Scale(ElemType alpha, const CPUMatrix<ElemType>& a, CP
     c.Resize(m, n);
 
     long size = (long) c.GetNumElements();
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) size))
     // four-way unrolling
     for (long i = 0; i < (size & ~3); i += 4)
     {
@@ -4680,7 +5223,7 @@ void CPUMatrix<ElemType>::InnerProduct(const CPUMatrix<ElemType>& a, const CPUMa
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #ifndef USE_MKL
@@ -4692,7 +5235,7 @@ void CPUMatrix<ElemType>::InnerProduct(const CPUMatrix<ElemType>& a, const CPUMa
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_column (j, c)
             {
 #pragma warning(suppress : 4244)
@@ -4710,7 +5253,7 @@ void CPUMatrix<ElemType>::InnerProduct(const CPUMatrix<ElemType>& a, const CPUMa
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #ifndef USE_MKL
@@ -4722,7 +5265,7 @@ void CPUMatrix<ElemType>::InnerProduct(const CPUMatrix<ElemType>& a, const CPUMa
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #pragma warning(suppress : 4244)
@@ -4782,7 +5325,7 @@ void CPUMatrix<ElemType>::ElementWisePower(ElemType alpha, const CPUMatrix<ElemT
 
     if (alpha == 2)
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
         foreach_coord (i, j, c)
         {
             c(i, j) = a(i, j) * a(i, j);
@@ -4790,7 +5333,7 @@ void CPUMatrix<ElemType>::ElementWisePower(ElemType alpha, const CPUMatrix<ElemT
     }
     else if (alpha == 3)
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
         foreach_coord (i, j, c)
         {
             c(i, j) = a(i, j) * a(i, j) * a(i, j);
@@ -4798,7 +5341,7 @@ void CPUMatrix<ElemType>::ElementWisePower(ElemType alpha, const CPUMatrix<ElemT
     }
     else
     {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
         foreach_coord (i, j, c)
         {
             c(i, j) = pow(a(i, j), alpha);
@@ -4813,7 +5356,7 @@ bool CPUMatrix<ElemType>::AreEqual(const CPUMatrix<ElemType>& a, const CPUMatrix
         return false;
 
     bool result = true;
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(a.GetNumElements()))
     foreach_coord (i, j, a)
     {
         if (abs(a(i, j) - b(i, j)) > threshold)
@@ -4900,7 +5443,7 @@ bool CPUMatrix<ElemType>::HasElement(const CPUMatrix<ElemType>& mat, const ElemT
     bool bHas = false;
 
     bool isvFinite = std::isfinite(v);
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(mat.GetNumElements()))
     for (long j = 0; j < mat.GetNumElements(); j++)
     {
 #pragma omp flush(bHas)
@@ -5043,7 +5586,7 @@ void CPUMatrix<ElemType>::InnerProductWithShiftNeg(const CPUMatrix<ElemType>& a,
 
         if (sizeof(ElemType) == sizeof(double))
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #ifndef USE_MKL
@@ -5055,7 +5598,7 @@ void CPUMatrix<ElemType>::InnerProductWithShiftNeg(const CPUMatrix<ElemType>& a,
         }
         else
         {
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(c.GetNumElements()))
             foreach_row (i, c)
             {
 #pragma warning(suppress : 4244)
@@ -5193,7 +5736,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignElementProductOfWithShift(const
 
     // long m = (long)GetNumRows(), n = (long)GetNumCols();  // a and b are of size (1,n)
     long n = (long) GetNumCols(); // a and b are of size (1,n)
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt((size_t) n))
     for (long j = 0; j < n; j++)
     {
         us(0, j) = a(0, j) * b(0, (j + shift) % n);
@@ -5201,6 +5744,84 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignElementProductOfWithShift(const
     return *this;
 }
 
+// c = the cosine similarities of the columns of a and b, with negative samples:
+//   c(0, j) = cos (a_j, b_j), and c(i, j) = cos (a_j, b_k) with k = (j + shift + i - 1) % n for i = 1..negNumber
+// invNormA/B = 1 / the column norms of a and b (row vectors), as needed by AddCosDistanceGradientWithShiftNeg().
+// This is the fused form of the row-vector operations above (AssignElementProductOfWithShiftNeg(), InnerProductWithShiftNeg()).
+template <class ElemType>
+void CPUMatrix<ElemType>::CosDistanceWithShiftNeg(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c,
+                                                  CPUMatrix<ElemType>& invNormA, CPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber)
+{
+    const long m = (long) a.GetNumRows(), n = (long) a.GetNumCols();
+    if (b.GetNumRows() != m || b.GetNumCols() != n)
+        InvalidArgument("CosDistanceWithShiftNeg: The input matrix dimensions do not match.");
+    c.Resize(negNumber + 1, n);
+    invNormA.Resize(1, n);
+    invNormB.Resize(1, n);
+
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n))
+    for (long j = 0; j < n; j++)
+    {
+        const ElemType* pa = a.m_pArray + a.LocateColumn(j);
+        const ElemType* pb = b.m_pArray + b.LocateColumn(j);
+        ElemType sumA = 0, sumB = 0;
+        for (long r = 0; r < m; r++)
+        {
+            sumA += pa[r] * pa[r];
+            sumB += pb[r] * pb[r];
+        }
+        invNormA(0, j) = 1 / sqrt(sumA);
+        invNormB(0, j) = 1 / sqrt(sumB);
+    }
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n * (negNumber + 1)))
+    for (long j = 0; j < n; j++)
+    {
+        const ElemType* pa = a.m_pArray + a.LocateColumn(j);
+        for (long i = 0; i <= (long) negNumber; i++)
+        {
+            const long k = i == 0 ? j : (long) ((j + shift + i - 1) % n);
+            const ElemType* pb = b.m_pArray + b.LocateColumn(k);
+            ElemType dot = 0;
+            for (long r = 0; r < m; r++)
+                dot += pa[r] * pb[r];
+            c(i, j) = dot * invNormA(0, j) * invNormB(0, k);
+        }
+    }
+}
+
+// gradient += d c / d a (inputIndex 0) or d c / d b (inputIndex 1), for c = CosDistanceWithShiftNeg (a, b) and its gradient gradientC:
+//   d cos (a_j, b_k) / d a_j = b_k / (|a_j| |b_k|) - cos (a_j, b_k) a_j / |a_j|^2, and symmetrically for b_k.
+// Each column of b pairs with exactly one column of a per row i of c, so both cases are a loop over the columns of the gradient.
+template <class ElemType>
+void CPUMatrix<ElemType>::AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, const CPUMatrix<ElemType>& c, const CPUMatrix<ElemType>& gradientC,
+                                                             const CPUMatrix<ElemType>& invNormA, const CPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber, CPUMatrix<ElemType>& gradient)
+{
+    const long m = (long) a.GetNumRows(), n = (long) a.GetNumCols();
+    const CPUMatrix<ElemType>& self = inputIndex == 0 ? a : b;
+    const CPUMatrix<ElemType>& other = inputIndex == 0 ? b : a;
+    const CPUMatrix<ElemType>& invNormSelf = inputIndex == 0 ? invNormA : invNormB;
+    const CPUMatrix<ElemType>& invNormOther = inputIndex == 0 ? invNormB : invNormA;
+
+#pragma omp parallel for if (IsParallelWorthIt((size_t) m * n * (negNumber + 1)))
+    for (long k = 0; k < n; k++) // column of the gradient
+    {
+        const ElemType* pself = self.m_pArray + self.LocateColumn(k);
+        ElemType* pg = gradient.m_pArray + gradient.LocateColumn(k);
+        for (long i = 0; i <= (long) negNumber; i++)
+        {
+            const long s = i == 0 ? 0 : (long) ((shift + i - 1) % n);
+            const long j = inputIndex == 0 ? (k + s) % n : (k + n - s) % n; // paired column of the other input; c's column is that of a
+            const long cj = inputIndex == 0 ? k : j;
+            const ElemType gc = gradientC(i, cj);
+            const ElemType otherWeight = gc * invNormSelf(0, k) * invNormOther(0, j);
+            const ElemType selfWeight = gc * c(i, cj) * invNormSelf(0, k) * invNormSelf(0, k);
+            const ElemType* pother = other.m_pArray + other.LocateColumn(j);
+            for (long r = 0; r < m; r++)
+                pg[r] += otherWeight * pother[r] - selfWeight * pself[r];
+        }
+    }
+}
+
 #pragma endregion Static BLAS Functions
 
 // 'double' version of LogAdd
@@ -5218,6 +5839,198 @@ ElemType CPUMatrix<ElemType>::LogAddSumOfElements() const
     return fAlpha;
 }
 
+// alpha(k, t) = log sum_j exp(alpha(j, t - 1) + pair_scores(k, j)) + pos_scores(k, t), where alpha(., -1) is 0 for startLbl and LZERO otherwise
+// The sequences are independent and so are the labels of one time step, so we parallelize over both.
+template <class ElemType>
+void CPUMatrix<ElemType>::RCRFForwardCompute(const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores, CPUMatrix<ElemType>& alpha,
+                                             const int startLbl, const size_t numParallelSequences)
+{
+    const long iNumLab = (long) pos_scores.GetNumRows();
+    const long S = (long) numParallelSequences;
+    if (S == 0 || pos_scores.GetNumCols() % S != 0)
+        InvalidArgument("RCRFForwardCompute: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) pos_scores.GetNumCols(), (int) S);
+    if (pair_scores.GetNumRows() != iNumLab || pair_scores.GetNumCols() != iNumLab)
+        InvalidArgument("RCRFForwardCompute: the transition scores must be a [%d x %d] matrix.", (int) iNumLab, (int) iNumLab);
+    const long iNumPos = (long) pos_scores.GetNumCols() / S;
+
+    alpha.Resize(iNumLab, pos_scores.GetNumCols());
+
+    for (long t = 0; t < iNumPos; t++)
+    {
+#pragma omp parallel for if (IsParallelWorthIt((size_t) iNumLab * iNumLab * S))
+        for (long ks = 0; ks < iNumLab * S; ks++)
+        {
+            const long k = ks % iNumLab;
+            const long col = t * S + ks / iNumLab;
+            ElemType fSum = (ElemType) LZERO;
+            for (long j = 0; j < iNumLab; j++)
+            {
+                const ElemType fAlpha = t > 0 ? alpha(j, col - S) : (j == startLbl) ? (ElemType) 0.0 : (ElemType) LZERO;
+                fSum = (ElemType) LogAddD(fSum, fAlpha + pair_scores(k, j));
+            }
+            alpha(k, col) = fSum + pos_scores(k, col); // include position dependent score
+        }
+    }
+}
+
+// Viterbi version of RCRFForwardCompute(): alpha(k, t) = max_j (alpha(j, t - 1) + pair_scores(k, j)) + pos_scores(k, t), with backtrace(k, t)
+// the maximizing j. The first label of each sequence is constrained to be startLbl, so time steps 0 and 1 have a single predecessor.
+template <class ElemType>
+void CPUMatrix<ElemType>::ViterbiForwardCompute(const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                                                CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& backtrace,
+                                                const int startLbl, const size_t numParallelSequences)
+{
+    const long iNumLab = (long) pos_scores.GetNumRows();
+    const long S = (long) numParallelSequences;
+    if (S == 0 || pos_scores.GetNumCols() % S != 0)
+        InvalidArgument("ViterbiForwardCompute: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) pos_scores.GetNumCols(), (int) S);
+    if (pair_scores.GetNumRows() != iNumLab || pair_scores.GetNumCols() != iNumLab)
+        InvalidArgument("ViterbiForwardCompute: the transition scores must be a [%d x %d] matrix.", (int) iNumLab, (int) iNumLab);
+    const long iNumPos = (long) pos_scores.GetNumCols() / S;
+
+    alpha.Resize(iNumLab, pos_scores.GetNumCols());
+    backtrace.Resize(iNumLab, pos_scores.GetNumCols());
+
+    for (long t = 0; t < iNumPos; t++)
+    {
+#pragma omp parallel for if (IsParallelWorthIt((size_t) iNumLab * iNumLab * S))
+        for (long ks = 0; ks < iNumLab * S; ks++)
+        {
+            const long k = ks % iNumLab;
+            const long col = t * S + ks / iNumLab;
+            ElemType fMax;
+            long jMax = startLbl;
+            if (t == 0)
+                fMax = (k == startLbl) ? pos_scores(k, col) : (ElemType) LZERO;
+            else if (t == 1)
+                fMax = alpha(startLbl, col - S) + pair_scores(k, startLbl) + pos_scores(k, col);
+            else
+            {
+                fMax = (ElemType) LZERO;
+                for (long j = 0; j < iNumLab; j++)
+                {
+                    const ElemType fAlpha = alpha(j, col - S) + pair_scores(k, j);
+                    if (fAlpha > fMax)
+                    {
+                        fMax = fAlpha;
+                        jMax = j;
+                    }
+                }
+                fMax += pos_scores(k, col); // include position dependent score
+            }
+            alpha(k, col) = fMax;
+            backtrace(k, col) = (ElemType) jMax;
+        }
+    }
+}
+
+// log N(x; mean_c, stddev_c^2 I) + log prior_c, log-summed over the components c, one sample (column) per thread
+// The parameters have one column or one per sample; Matrix::GMMLogLikelihood() has verified the dimensions.
+template <class ElemType>
+void CPUMatrix<ElemType>::GMMLogLikelihood(const CPUMatrix<ElemType>& unnormedPrior, const CPUMatrix<ElemType>& mean, const CPUMatrix<ElemType>& logStddev, const CPUMatrix<ElemType>& feature,
+                                           CPUMatrix<ElemType>& logLikelihood, CPUMatrix<ElemType>& posterior, CPUMatrix<ElemType>& normedDeviation)
+{
+    const long numComponents = (long) unnormedPrior.GetNumRows();
+    const long featureDim = (long) feature.GetNumRows();
+    const long numSamples = (long) feature.GetNumCols();
+    const ElemType logNormalizer = (ElemType) (0.5 * featureDim * log(TWO_PI));
+
+    logLikelihood.Resize(1, numSamples);
+    posterior.Resize(numComponents, numSamples);
+    normedDeviation.Resize(numComponents, numSamples);
+
+#pragma omp parallel for
+    for (long n = 0; n < numSamples; n++)
+    {
+        const long priorCol = unnormedPrior.GetNumCols() == 1 ? 0 : n;
+        const long meanCol = mean.GetNumCols() == 1 ? 0 : n;
+        const long stddevCol = logStddev.GetNumCols() == 1 ? 0 : n;
+
+        // log prior = log softmax(unnormedPrior)
+        ElemType priorLogSum = (ElemType) LZERO;
+        for (long c = 0; c < numComponents; c++)
+            priorLogSum = (ElemType) LogAddD(priorLogSum, unnormedPrior(c, priorCol));
+
+        // per-component joint log-likelihood, kept in posterior until we know the total
+        ElemType total = (ElemType) LZERO;
+        for (long c = 0; c < numComponents; c++)
+        {
+            ElemType dist = 0;
+            for (long i = 0; i < featureDim; i++)
+            {
+                const ElemType d = feature(i, n) - mean(c * featureDim + i, meanCol);
+                dist += d * d;
+            }
+            const ElemType logSigma = logStddev(c, stddevCol);
+            const ElemType q = dist * exp(-2 * logSigma); // ||x-u_c||^2/(stddev^2)
+            const ElemType ll = unnormedPrior(c, priorCol) - priorLogSum - q / 2 - featureDim * logSigma - logNormalizer;
+            normedDeviation(c, n) = q;
+            posterior(c, n) = ll;
+            total = (ElemType) LogAddD(total, ll);
+        }
+        for (long c = 0; c < numComponents; c++)
+            posterior(c, n) = exp(posterior(c, n) - total);
+        logLikelihood(0, n) = total;
+    }
+}
+
+// Gradients of GMMLogLikelihood(), computed elementwise from the posteriors and normed distances without intermediate matrices.
+// A parameter with a single column receives the sum over all samples.
+template <class ElemType>
+void CPUMatrix<ElemType>::AddGMMLogLikelihoodGradient(const size_t inputIndex, const CPUMatrix<ElemType>& gradient,
+                                                      const CPUMatrix<ElemType>& posterior, const CPUMatrix<ElemType>& normedDeviation,
+                                                      const CPUMatrix<ElemType>& unnormedPrior, const CPUMatrix<ElemType>& mean, const CPUMatrix<ElemType>& logStddev, const CPUMatrix<ElemType>& feature,
+                                                      CPUMatrix<ElemType>& inputGradient)
+{
+    const long numComponents = (long) unnormedPrior.GetNumRows();
+    const long featureDim = (long) feature.GetNumRows();
+    const long numSamples = (long) feature.GetNumCols();
+    const long numRows = (long) inputGradient.GetNumRows();
+    const long numCols = (long) inputGradient.GetNumCols();
+    const bool meanShared = mean.GetNumCols() == 1;
+    const bool stddevShared = logStddev.GetNumCols() == 1;
+
+#pragma omp parallel for if (IsParallelWorthIt((size_t) numRows * numCols))
+    for (long rc = 0; rc < numRows * numCols; rc++)
+    {
+        const long r = rc % numRows;
+        const long col = rc / numRows;
+        // a shared parameter accumulates over all samples; feature gradients are always per sample
+        const long nBegin = (numCols == 1 && inputIndex != 3) ? 0 : col;
+        const long nEnd = (numCols == 1 && inputIndex != 3) ? numSamples : col + 1;
+        ElemType sum = 0;
+        switch (inputIndex)
+        {
+        case 0: // unnormedPrior: (posterior - prior) * gradient
+        {
+            ElemType priorLogSum = (ElemType) LZERO;
+            for (long c = 0; c < numComponents; c++)
+                priorLogSum = (ElemType) LogAddD(priorLogSum, unnormedPrior(c, col));
+            const ElemType prior = exp(unnormedPrior(r, col) - priorLogSum);
+            for (long n = nBegin; n < nEnd; n++)
+                sum += gradient(0, n) * (posterior(r, n) - prior);
+            break;
+        }
+        case 1: // mean: posterior * (x-u_c)/(stddev^2) * gradient
+        {
+            const long c = r / featureDim, i = r % featureDim;
+            for (long n = nBegin; n < nEnd; n++)
+                sum += gradient(0, n) * posterior(c, n) * (feature(i, n) - mean(r, col)) * exp(-2 * logStddev(c, stddevShared ? 0 : n));
+            break;
+        }
+        case 2: // logStddev: posterior * (||x-u_c||^2/(stddev^2) - featureDim) * gradient
+            for (long n = nBegin; n < nEnd; n++)
+                sum += gradient(0, n) * posterior(r, n) * (normedDeviation(r, n) - featureDim);
+            break;
+        case 3: // feature: -sum_c posterior * (x-u_c)/(stddev^2) * gradient
+            for (long c = 0; c < numComponents; c++)
+                sum -= gradient(0, col) * posterior(c, col) * (feature(r, col) - mean(c * featureDim + r, meanShared ? 0 : col)) * exp(-2 * logStddev(c, stddevShared ? 0 : col));
+            break;
+        }
+        inputGradient(r, col) += sum;
+    }
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::RCRFBackwardCompute(const CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta,
                                               const CPUMatrix<ElemType>& lbls,
@@ -5284,6 +6097,64 @@ void CPUMatrix<ElemType>::_rcrfBackwardCompute(size_t t, size_t k, const CPUMatr
     }
 }
 
+// one LSTM layer over all time steps, see Matrix::LSTMForwardWithState()
+// The units and sequences of one time step are independent, so we parallelize over both. Each (unit, sequence) pair owns its cell state.
+template <class ElemType>
+void CPUMatrix<ElemType>::LSTMForwardWithState(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& recurrentWeights, const CPUMatrix<ElemType>& flags,
+                                               CPUMatrix<ElemType>& h, CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& output, const size_t numParallelSequences)
+{
+    const long H = (long) recurrentWeights.GetNumRows();
+    const long S = (long) numParallelSequences;
+    if (recurrentWeights.GetNumCols() != 4 * H || gates.GetNumRows() != 4 * H)
+        InvalidArgument("LSTMForwardWithState: the recurrent weights must be [%d x %d] and the gates must have %d rows.", (int) H, (int) (4 * H), (int) (4 * H));
+    if (S == 0 || gates.GetNumCols() % S != 0)
+        InvalidArgument("LSTMForwardWithState: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) gates.GetNumCols(), (int) S);
+    if (flags.GetNumElements() != gates.GetNumCols() || h.GetNumRows() != H || h.GetNumCols() != S || c.GetNumRows() != H || c.GetNumCols() != S)
+        InvalidArgument("LSTMForwardWithState: flags must have one element per column, and the states must be [%d x %d].", (int) H, (int) S);
+    const long T = (long) gates.GetNumCols() / S;
+
+    output.Resize(H, T * S);
+    if (T == 0)
+        return;
+
+    for (long t = 0; t < T; t++)
+    {
+#pragma omp parallel for if (IsParallelWorthIt((size_t) 4 * H * H * S))
+        for (long js = 0; js < H * S; js++)
+        {
+            const long j = js % H;
+            const long s = js / H;
+            const long col = t * S + s;
+            const ElemType flag = flags.m_pArray[col];
+            const ElemType* hPrev = flag == 2 ? nullptr : t == 0 ? h.m_pArray + s * H : output.m_pArray + (col - S) * H;
+            if (flag == 0) // gap: keep the state
+            {
+                output(j, col) = hPrev[j];
+                continue;
+            }
+            ElemType sums[4];
+            for (long g = 0; g < 4; g++)
+            {
+                ElemType sum = gates(g * H + j, col);
+                if (hPrev)
+                {
+                    const ElemType* w = recurrentWeights.m_pArray + (g * H + j) * H;
+                    for (long k = 0; k < H; k++)
+                        sum += w[k] * hPrev[k];
+                }
+                sums[g] = sum;
+            }
+            const ElemType cPrev = flag == 2 ? 0 : c(j, s);
+            const ElemType cNew = Sigmoid(sums[1]) * cPrev + Sigmoid(sums[0]) * tanh(sums[2]);
+            c(j, s) = cNew;
+            output(j, col) = Sigmoid(sums[3]) * tanh(cNew);
+        }
+    }
+
+    // the states after the last step (gaps carry them forward, so these are those after the last frame of each sequence)
+    memcpy(h.m_pArray, output.m_pArray + (T - 1) * S * H, sizeof(ElemType) * H * S);
+}
+
 template <class ElemType>
 void CPUMatrix<ElemType>::RCRFTransGrdCompute(const CPUMatrix<ElemType>& lbls,
                                               const CPUMatrix<ElemType>& alpha,
@@ -5425,7 +6296,7 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::DropFrame(const CPUMatrix<ElemType>& l
     if (us.GetNumCols() != gamma.GetNumCols() || us.GetNumRows() != gamma.GetNumRows())
         LogicError("DropFrame: target matrix is not in the same size as gamm matrix.");
 
-#pragma omp parallel for
+#pragma omp parallel for if (IsParallelWorthIt(label.GetNumElements()))
     foreach_column (j, label)
     {
 
@@ -5459,6 +6330,67 @@ CPUMatrix<ElemType>& CPUMatrix<ElemType>::AssignSequenceError(const ElemType hsm
     return *this;
 }
 
+// enable polynomial approximations of exp(), log(), sigmoid() and tanh() in the AVX2/AVX-512 code paths
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+void CPUMatrix<ElemType>::SetUseFastMathApproximations(bool enable)
+{
+    CPUVectorKernels::SetUseFastApproximations(enable);
+}
+
+// note: this function does not depend on the <ElemType> parameter
+// Huge pages save TLB misses on multi-GB parameter and feature matrices; this applies to the matrices allocated from now on.
+template <class ElemType>
+void CPUMatrix<ElemType>::SetHugePages(HugePageMode hugePages, size_t minBytes)
+{
+    SetAlignedMemoryHugePages(hugePages, minBytes);
+}
+
+// note: this function does not depend on the <ElemType> parameter
+// With pinThreads, the OpenMP workers are pinned to one logical processor each, in contiguous blocks per NUMA node,
+// so that what a static schedule hands to a thread (and, with a policy other than 'none', the pages it first touched)
+// stays on the same node from one parallel loop to the next.
+template <class ElemType>
+void CPUMatrix<ElemType>::SetNumaPlacement(NumaMemoryPolicy memoryPolicy, bool pinThreads)
+{
+    s_numaMemoryPolicy = memoryPolicy;
+#ifdef _OPENMP
+    if (!pinThreads)
+        return;
+    const size_t numNodes = GetNumNumaNodes();
+    std::vector<std::vector<int>> nodeCpus;
+    for (size_t node = 0; node < numNodes; node++)
+    {
+        auto cpus = GetNumaNodeCpus((int) node);
+        if (!cpus.empty()) // (memory-only nodes have none)
+            nodeCpus.push_back(move(cpus));
+    }
+    if (nodeCpus.empty())
+    {
+        fprintf(stderr, "SetNumaPlacement: Cannot determine the processors of the NUMA nodes; CPU threads are not pinned.\n");
+        return;
+    }
+#pragma omp parallel
+    {
+        const size_t numThreads = omp_get_num_threads();
+        const size_t thread = omp_get_thread_num();
+        const size_t node = thread * nodeCpus.size() / numThreads;
+        const size_t firstThreadOfNode = (node * numThreads + nodeCpus.size() - 1) / nodeCpus.size();
+        const auto& cpus = nodeCpus[node];
+        BindCurrentThreadToCpus(std::vector<int>(1, cpus[(thread - firstThreadOfNode) % cpus.size()]));
+    }
+#else
+    UNUSED(pinThreads);
+#endif
+}
+
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+const char* CPUMatrix<ElemType>::GetVectorInstructionSetName()
+{
+    return CPUVectorKernels::GetInstructionSetName();
+}
+
 // note: this function does not depend on the <ElemType> parameter
 template <class ElemType>
 int CPUMatrix<ElemType>::SetNumThreads(int numThreads)
@@ -5486,6 +6418,45 @@ int CPUMatrix<ElemType>::SetNumThreads(int numThreads)
     return numThreads;
 }
 
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+void CPUMatrix<ElemType>::SetParallelMinElements(size_t numElements)
+{
+    s_parallelMinElements = numElements;
+}
+
+// take 'numThreads' out of the OpenMP (and BLAS) threads of the calling thread, for threads that run beside the math, such as a reader's
+// prefetching threads, so that together they do not oversubscribe the cores; at least one thread is left to the math
+// Returns the number of threads actually taken, to be passed to ReleaseThreads(). Call both on the thread that runs the math.
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+int CPUMatrix<ElemType>::ReserveThreads(int numThreads)
+{
+#ifdef _OPENMP
+    const int current = omp_get_max_threads();
+    const int remaining = max(1, current - max(0, numThreads));
+    if (remaining == current)
+        return 0;
+    SetNumThreads(remaining);
+    return current - omp_get_max_threads();
+#else
+    UNUSED(numThreads);
+    return 0;
+#endif
+}
+
+// note: this function does not depend on the <ElemType> parameter
+template <class ElemType>
+void CPUMatrix<ElemType>::ReleaseThreads(int numReservedThreads)
+{
+#ifdef _OPENMP
+    if (numReservedThreads > 0)
+        SetNumThreads(omp_get_max_threads() + numReservedThreads);
+#else
+    UNUSED(numReservedThreads);
+#endif
+}
+
 // =======================================================================
 // TensorView support
 // =======================================================================
@@ -5537,8 +6508,31 @@ struct TensorOpReduction<ElemType, OPFN, N, -1>
 // perform loop over regular index k for N-nary operations (N counting the output)
 // -----------------------------------------------------------------------
 
+// Ops below this many elements (counting reduced ones) run single-threaded, since OpenMP overhead would dominate.
+static const size_t TensorOpParallelThreshold = 8192;
+
+// The innermost regular loop is specialized on the stride pattern of its operands, given as 'broadcastMask':
+//  - broadcastMask = 0: all operands are contiguous (stride 1), e.g. adding two vectors or computing the Sigmoid
+//  - bit i set: input i is broadcast (stride 0) along the innermost dimension, all others are contiguous, e.g. scaling a column by a scalar
+//  - broadcastMask = -1: generic; strides are read from regularStrides
+// With hard-coded strides, the compiler can unroll and vectorize.
+template <int broadcastMask>
+static inline ptrdiff_t InnermostStride(size_t i, ptrdiff_t stride)
+{
+    return broadcastMask < 0 ? stride : ((broadcastMask >> i) & 1) ? 0 : 1;
+}
+
+template <class ElemType, size_t N>
+static inline array<ElemType*, N> OffsetPointers(const array<ElemType*, N>& pointers, const array<ptrdiff_t, N>& strides, ptrdiff_t index)
+{
+    array<ElemType*, N> result;
+    for (size_t i = 0; i < N; i++) // (only used outside of the innermost loops)
+        result[i] = pointers[i] + index * strides[i];
+    return result;
+}
+
 // perform loop over regular index k and reducing index m for N operands (counting the output)
-template <class ElemType, typename OPFN, size_t N, bool vectorizable, int m, int k>
+template <class ElemType, typename OPFN, size_t N, int broadcastMask, int m, int k>
 struct TensorOpIteration
 {
     static inline void Loop(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, const OPFN& opfn,
@@ -5552,7 +6546,7 @@ struct TensorOpIteration
         for (size_t dim = regularOpDims[(size_t) k]; dim-- > 0;)
         {
             // need to descend into one loop deeper
-            TensorOpIteration<ElemType, OPFN, N, vectorizable, m, k - 1>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            TensorOpIteration<ElemType, OPFN, N, broadcastMask, m, k - 1>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
             // advance the pointers
             for (size_t i = 0; i < N; i++)
                 pointers[i] += strides[i];
@@ -5560,10 +6554,11 @@ struct TensorOpIteration
     }
 };
 
-// Special version for innermost loop with strides all being 1 and no further reduction. Compiler can use SSE.
-// This is a very common case, e.g. adding vectors or computing the Sigmoid.
-template <class ElemType, typename OPFN>
-struct TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, 0 /*innermost loop*/>
+// Special version for the innermost loop without further reduction, specialized on the stride pattern.
+// This is the most common case, e.g. adding vectors or computing the Sigmoid.
+// The pointers are spelled out per N, so that the strides become compile-time constants.
+template <class ElemType, typename OPFN, int broadcastMask>
+struct TensorOpIteration<ElemType, OPFN, 3, broadcastMask, -1 /*no reduction*/, 0 /*innermost loop*/>
 {
     static inline void Loop(ElemType beta, array<ElemType*, 3> pointers, ElemType alpha, const OPFN& opfn,
                             const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 3>& regularStrides,
@@ -5572,28 +6567,27 @@ struct TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduc
         ElemType* pa = pointers[0];
         ElemType* pb = pointers[1];
         ElemType* pc = pointers[2];
+        const ptrdiff_t sa = InnermostStride<broadcastMask>(0, regularStrides[0][0]);
+        const ptrdiff_t sb = InnermostStride<broadcastMask>(1, regularStrides[1][0]);
+        const ptrdiff_t sc = InnermostStride<broadcastMask>(2, regularStrides[2][0]);
         size_t K = regularOpDims[0];
         // special-case beta and alpha to allow the compiler to short-circuit it
+        // This loop is single-threaded; TensorOpParallelIteration() splits it across threads if it is large.
         if (beta != 0)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 3>{pa + k, pb + k, pc + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 3, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 3>{pa + k * sa, pb + k * sb, pc + k * sc}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
         else if (alpha != 1)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k, pb + k, pc + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 3, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k * sa, pb + k * sb, pc + k * sc}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
         else
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 3, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k, pb + k, pc + k}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 3, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 3>{pa + k * sa, pb + k * sb, pc + k * sc}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
         // TODO: According to Amit, the VS compiler is not able to vectorize into lambdas. Solution: change the lambda to take an N, or to implement the loop inside (with 1 element by default).
-        // TODO: The signedness of k (required for omp) causes an extra sign-extend.
-        // TODO: OMP adds LOTS of overhead. Do we need a guard, a min size when to use it?
     }
 };
 // and unary
-template <class ElemType, typename OPFN>
-struct TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, 0 /*innermost loop*/>
+template <class ElemType, typename OPFN, int broadcastMask>
+struct TensorOpIteration<ElemType, OPFN, 2, broadcastMask, -1 /*no reduction*/, 0 /*innermost loop*/>
 {
     static inline void Loop(ElemType beta, array<ElemType*, 2> pointers, ElemType alpha, const OPFN& opfn,
                             const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 2>& regularStrides,
@@ -5601,25 +6595,24 @@ struct TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduc
     {
         ElemType* pa = pointers[0];
         ElemType* pb = pointers[1];
+        const ptrdiff_t sa = InnermostStride<broadcastMask>(0, regularStrides[0][0]);
+        const ptrdiff_t sb = InnermostStride<broadcastMask>(1, regularStrides[1][0]);
         size_t K = regularOpDims[0];
         // special-case beta and alpha to allow the compiler to short-circuit it
         if (beta != 0)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 2>{pa + k, pb + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 2, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(beta, array<ElemType*, 2>{pa + k * sa, pb + k * sb}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
         else if (alpha != 1)
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k, pb + k}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 2, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k * sa, pb + k * sb}, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
         else
-#pragma omp parallel for
-            for (int k = 0; k < (int) K; k++)
-                TensorOpIteration<ElemType, OPFN, 2, true /*vectorizable*/, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k, pb + k}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+            for (size_t k = 0; k < K; k++)
+                TensorOpIteration<ElemType, OPFN, 2, broadcastMask, -1 /*no reduction*/, -1 /*scalar*/>::Loop(0, array<ElemType*, 2>{pa + k * sa, pb + k * sb}, 1, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
     }
 };
 
-template <class ElemType, typename OPFN, size_t N, bool vectorizable, int m>
-struct TensorOpIteration<ElemType, OPFN, N, vectorizable, m, -1>
+template <class ElemType, typename OPFN, size_t N, int broadcastMask, int m>
+struct TensorOpIteration<ElemType, OPFN, N, broadcastMask, m, -1>
 {
     static inline void Loop(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, const OPFN& opfn,
                             const SmallVector<size_t>&, const array<SmallVector<ptrdiff_t>, N>&,
@@ -5639,10 +6632,149 @@ struct TensorOpIteration<ElemType, OPFN, N, vectorizable, m, -1>
     }
 };
 
+// -----------------------------------------------------------------------
+// parallelization and cache blocking
+// -----------------------------------------------------------------------
+
+static size_t TensorOpNumElements(const SmallVector<size_t>& regularOpDims, const SmallVector<size_t>& reducingOpDims)
+{
+    size_t numElements = 1;
+    for (size_t i = 0; i < regularOpDims.size(); i++)
+        numElements *= regularOpDims[i];
+    for (size_t i = 0; i < reducingOpDims.size(); i++)
+        numElements *= reducingOpDims[i];
+    return numElements;
+}
+
+// run the outermost regular loop k in parallel if the op is large enough
+// If there is only one regular loop, it is split into chunks instead, so that each thread runs a vectorizable inner loop.
+template <class ElemType, typename OPFN, size_t N, int broadcastMask, int m, int k>
+static void TensorOpParallelIteration(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn,
+                                      const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>& regularStrides,
+                                      const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    if (k < 0 || TensorOpNumElements(regularOpDims, reducingOpDims) < TensorOpParallelThreshold)
+        return TensorOpIteration<ElemType, OPFN, N, broadcastMask, m, k>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+
+    if (k == 0 && m < 0)
+    {
+        const size_t chunkSize = TensorOpParallelThreshold / 2;
+        const size_t K = regularOpDims[0];
+        array<ptrdiff_t, N> strides;
+        for (size_t i = 0; i < N; i++)
+            strides[i] = regularStrides[i][0];
+        long numChunks = (long) ((K + chunkSize - 1) / chunkSize);
+#pragma omp parallel for
+        for (long c = 0; c < numChunks; c++)
+        {
+            SmallVector<size_t> chunkOpDims = regularOpDims;
+            chunkOpDims[0] = min(chunkSize, K - c * chunkSize);
+            TensorOpIteration<ElemType, OPFN, N, broadcastMask, m, k>::Loop(beta, OffsetPointers(pointers, strides, c * chunkSize), alpha, opfn, chunkOpDims, regularStrides, reducingOpDims, reducingStrides);
+        }
+        return;
+    }
+
+    array<ptrdiff_t, N> strides;
+    for (size_t i = 0; i < N; i++)
+        strides[i] = regularStrides[i][(size_t) k];
+    long K = (long) regularOpDims[(size_t) k];
+#pragma omp parallel for
+    for (long j = 0; j < K; j++) // (k < 0 never gets here; this avoids instantiating k = -2)
+        TensorOpIteration<ElemType, OPFN, N, broadcastMask, m, (k > 0 ? k - 1 : -1)>::Loop(beta, OffsetPointers(pointers, strides, j), alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+}
+
+// reduction of all elements into a scalar, in parallel over the outermost reduction index m
+template <class ElemType, typename OPFN, size_t N, int m>
+static void TensorOpParallelReductionToScalar(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn,
+                                              const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    array<ptrdiff_t, N> strides;
+    for (size_t i = 0; i < N; i++)
+        strides[i] = reducingStrides[i][(size_t) m];
+    strides[N - 1] = 0; // the result pointer is unused in the reduction
+    double aggregate = 0;
+    long J = (long) reducingOpDims[(size_t) m];
+#pragma omp parallel for reduction(+ : aggregate)
+    for (long j = 0; j < J; j++)
+        aggregate += TensorOpReduction<ElemType, OPFN, N, m - 1>::Loop(OffsetPointers(pointers, strides, j), opfn, reducingOpDims, reducingStrides);
+    ElemType val = alpha * (ElemType) aggregate;
+    auto* pout = pointers.back();
+    if (beta != 0)
+        val += beta * *pout;
+    *pout = val;
+}
+
+// reduction over a single dimension into a contiguous vector, e.g. the gradient of a bias (sum over all columns)
+// The regular loop order walks the reduced dimension innermost, which for column-major data strides over whole columns.
+// Instead, we loop over blocks of rows whose accumulators fit into L1, and accumulate one column at a time,
+// so that the inputs are read sequentially. Blocks are processed in parallel.
+template <class ElemType, typename OPFN, size_t N>
+static void TensorOpBlockedReduction(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn,
+                                     const SmallVector<size_t>& regularOpDims,
+                                     const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    const size_t I = regularOpDims[0];
+    const size_t J = reducingOpDims[0];
+    const size_t blockSize = 512; // 4 KB of accumulators
+    array<ptrdiff_t, N> reducingStride;
+    for (size_t i = 0; i < N; i++)
+        reducingStride[i] = reducingStrides[i][0];
+    reducingStride[N - 1] = 0; // the result pointer is unused in the reduction
+    long numBlocks = (long) ((I + blockSize - 1) / blockSize);
+#pragma omp parallel for if (I * J >= TensorOpParallelThreshold)
+    for (long b = 0; b < numBlocks; b++)
+    {
+        const size_t i0 = b * blockSize;
+        const size_t blockRows = min(blockSize, I - i0);
+        double aggregate[blockSize] = {0};
+        array<ElemType*, N> blockPointers = pointers;
+        for (size_t n = 0; n < N; n++)
+            blockPointers[n] += i0; // all regular strides are 1
+        for (size_t j = 0; j < J; j++)
+        {
+            array<ElemType*, N> pp = OffsetPointers(blockPointers, reducingStride, j);
+            for (size_t i = 0; i < blockRows; i++)
+            {
+                aggregate[i] += opfn(pp);
+                for (size_t n = 0; n < N - 1; n++)
+                    pp[n]++;
+            }
+        }
+        ElemType* pout = blockPointers.back();
+        for (size_t i = 0; i < blockRows; i++)
+        {
+            ElemType val = alpha * (ElemType) aggregate[i];
+            if (beta != 0)
+                val += beta * pout[i];
+            pout[i] = val;
+        }
+    }
+}
+
 // -----------------------------------------------------------------------
 // map runtime parameters N to template parameters
 // -----------------------------------------------------------------------
 
+// determine the broadcastMask of the innermost loop (see InnermostStride())
+// Only all-contiguous and a single broadcast input are specialized, to limit code size.
+template <size_t N>
+static int DetermineBroadcastMask(const array<SmallVector<ptrdiff_t>, N>& regularStrides)
+{
+    if (regularStrides[N - 1][0] != 1)
+        return -1;
+    int broadcastMask = 0;
+    for (size_t i = 0; i < N - 1; i++)
+    {
+        if (regularStrides[i][0] == 0)
+            broadcastMask |= 1 << i;
+        else if (regularStrides[i][0] != 1)
+            return -1;
+    }
+    if (broadcastMask != 0 && broadcastMask != 1 && broadcastMask != 2)
+        return -1;
+    return broadcastMask;
+}
+
 // tensor operation with k+1 dimensions (-1 means scalar)
 template <class ElemType, typename OPFN, size_t N, int k>
 static void TensorOpWithRegularLoop(ElemType beta, const array<ElemType*, N>& pointers, ElemType alpha, const OPFN& opfn,
@@ -5653,19 +6785,30 @@ static void TensorOpWithRegularLoop(ElemType beta, const array<ElemType*, N>& po
     switch (dims)
     {
     case 2:
-        return TensorOpIteration<ElemType, OPFN, N, false /*vectorizable*/, 1, k>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        if (k < 0 && TensorOpNumElements(regularOpDims, reducingOpDims) >= TensorOpParallelThreshold)
+            return TensorOpParallelReductionToScalar<ElemType, OPFN, N, 1>(beta, pointers, alpha, opfn, reducingOpDims, reducingStrides);
+        return TensorOpParallelIteration<ElemType, OPFN, N, -1, 1, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
     case 1:
-        return TensorOpIteration<ElemType, OPFN, N, false /*vectorizable*/, 0, k>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        if (k < 0 && TensorOpNumElements(regularOpDims, reducingOpDims) >= TensorOpParallelThreshold)
+            return TensorOpParallelReductionToScalar<ElemType, OPFN, N, 0>(beta, pointers, alpha, opfn, reducingOpDims, reducingStrides);
+        if (k == 0 && DetermineBroadcastMask(regularStrides) == 0) // contiguous result, e.g. column-wise sum
+            return TensorOpBlockedReduction(beta, pointers, alpha, opfn, regularOpDims, reducingOpDims, reducingStrides);
+        return TensorOpParallelIteration<ElemType, OPFN, N, -1, 0, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
     case 0:
     {
-        // if all leading dimensions are 1, we can let the compiler do some unrolling
-        bool leadingAllOne = true;
-        for (size_t i = 0; i < N; i++)
-            leadingAllOne &= k >= 0 && regularStrides[i][0] == 1;
-        if (leadingAllOne) // special version that uses a hard-coded increment of 1 for all leading dimensions
-            return TensorOpIteration<ElemType, OPFN, N, true /*vectorizable*/, -1, k>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
-        else
-            return TensorOpIteration<ElemType, OPFN, N, false /*vectorizable*/, -1, k>::Loop(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        // select a version with hard-coded innermost strides, so that the compiler can unroll and vectorize
+        int broadcastMask = k >= 0 ? DetermineBroadcastMask(regularStrides) : -1;
+        switch (broadcastMask)
+        {
+        case 0:
+            return TensorOpParallelIteration<ElemType, OPFN, N, 0, -1, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        case 1:
+            return TensorOpParallelIteration<ElemType, OPFN, N, 1, -1, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        case 2:
+            return TensorOpParallelIteration<ElemType, OPFN, N, 2, -1, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        default:
+            return TensorOpParallelIteration<ElemType, OPFN, N, -1, -1, k>(beta, pointers, alpha, opfn, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+        }
     }
     default:
         LogicError("TensorOp: %d non-flattened reduction dimensions are not supported.", (int) dims);
@@ -8,6 +8,8 @@
 #include "File.h"
 #include "Helpers.h"
 #include "CommonMatrix.h"
+#include "Half.h"
+#include "AlignedMemory.h" // for HugePageMode
 #include <vector>
 #include <stdio.h>
 #include <ctime>
@@ -56,6 +58,7 @@ public:
     using B::GetNumCols;
     using B::SetOwnBuffer;
     using B::SetMatrixName;
+    using B::VerifySize;
 
     size_t BufferSize() const
     {
@@ -76,6 +79,8 @@ public:
 
     ElemType Adagrad(CPUMatrix<ElemType>& gradients, const bool needAveMultiplier);
     void FSAdagrad(CPUMatrix<ElemType>& gradients, CPUMatrix<ElemType>& functionValues, ElemType learnRatePerSample, ElemType momentum, ElemType adaWeight, ElemType adaMul);
+    void Adam(CPUMatrix<ElemType>& gradients, CPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive);
+    void Lars(CPUMatrix<ElemType>& gradients, CPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType momentum, ElemType trustCoefficient);
     ElemType RmsProp(CPUMatrix<ElemType>& gradients,
                      ElemType RMS_GAMMA,
                      ElemType RMS_WGT_INC,
@@ -83,6 +88,8 @@ public:
                      ElemType RMS_WGT_DEC,
                      ElemType RMS_WGT_MIN,
                      const bool needAveMultiplier);
+    static void MultiTensorNormalGrad(const std::vector<CPUMatrix<ElemType>*>& functionValues, const std::vector<CPUMatrix<ElemType>*>& gradients,
+                                      const std::vector<CPUMatrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc);
 
     void Reshape(const size_t numRows, const size_t numCols);
     void Resize(const size_t numRows, const size_t numCols, bool growOnly = true); // by default we only reallocate if need to grow
@@ -108,6 +115,7 @@ public:
     void SetValue(const size_t numRows, const size_t numCols, ElemType* pArray, size_t matrixFlags = matrixFlagNormal);
 
     void MaskColumnsValue(const CPUMatrix<char>& columnsMask, ElemType val);
+    CPUMatrix<ElemType>& AssignAugmentedImagesOf(const CPUMatrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const CPUMatrix<ElemType>& mean);
 
     void SetColumn(const ElemType* colPointer, size_t colInd);
     void SetColumn(const CPUMatrix<ElemType>& valMat, size_t colInd);
@@ -157,6 +165,7 @@ public:
     CPUMatrix<ElemType>& ElementMultiplyWith(const CPUMatrix<ElemType>& a);
     CPUMatrix<ElemType>& AssignElementProductOf(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b);
     CPUMatrix<ElemType>& AddElementProductOf(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b);
+    CPUMatrix<ElemType>& AssignDropoutOf(const CPUMatrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex, const bool accumulate);
 
     CPUMatrix<ElemType>& AssignElementDivisionOf(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b);
     CPUMatrix<ElemType>& ElementDivideBy(const CPUMatrix<ElemType>& a);
@@ -167,6 +176,9 @@ public:
     CPUMatrix<ElemType>& ColumnElementDivideBy(const CPUMatrix<ElemType>& a);
     CPUMatrix<ElemType>& RowElementDivideBy(const CPUMatrix<ElemType>& a);
 
+    CPUMatrix<ElemType>& DoGatherColumnsOf(ElemType beta, const CPUMatrix<ElemType>& idx, const CPUMatrix<ElemType>& a, ElemType alpha);
+    CPUMatrix<ElemType>& DoScatterColumnsOf(ElemType beta, const CPUMatrix<ElemType>& idx, const CPUMatrix<ElemType>& a, ElemType alpha);
+
     CPUMatrix<ElemType>& ElementInverse();
     CPUMatrix<ElemType>& AssignElementInverseOf(const CPUMatrix<ElemType>& a);
 
@@ -184,6 +196,7 @@ public:
 
     CPUMatrix<ElemType>& InplaceLogSoftmax(const bool isColWise);
     CPUMatrix<ElemType>& AssignLogSoftmaxOf(const CPUMatrix<ElemType>& a, const bool isColWise);
+    CPUMatrix<ElemType>& AssignCrossEntropyWithSoftmaxOf(const CPUMatrix<ElemType>& labels, const CPUMatrix<ElemType>& logits, CPUMatrix<ElemType>& logSumExp);
 
     CPUMatrix<ElemType>& InplaceHardmax(const bool isColWise);
     CPUMatrix<ElemType>& AssignHardmaxOf(const CPUMatrix<ElemType>& a, const bool isColWise);
@@ -318,6 +331,13 @@ public:
 
 public:
     static int SetNumThreads(int numThreads); // note: this does not depend on <ElemType>, i.e. you can call it on any <ElemType>
+    static void SetParallelMinElements(size_t numElements); // (same) loops over fewer elements run single-threaded
+    static int ReserveThreads(int numThreads);              // (same) take threads out of the math's for other work, e.g. reading
+    static void ReleaseThreads(int numReservedThreads);     // (same) give back what ReserveThreads() returned
+    static void SetUseFastMathApproximations(bool enable); // (same)
+    static void SetNumaPlacement(NumaMemoryPolicy memoryPolicy, bool pinThreads); // (same) call after SetNumThreads()
+    static void SetHugePages(HugePageMode hugePages, size_t minBytes);          // (same) for the elements of matrices of at least minBytes
+    static const char* GetVectorInstructionSetName();      // (same)
 
     // static BLAS functions
     static void SVD(const CPUMatrix<ElemType>& A, CPUMatrix<ElemType>& SIGMA, CPUMatrix<ElemType>& U, CPUMatrix<ElemType>& VT, CPUMatrix<ElemType>& W);
@@ -327,11 +347,14 @@ public:
     static void Multiply(const CPUMatrix<ElemType>& a, const bool transposeA, const CPUMatrix<ElemType>& b, const bool transposeB, CPUMatrix<ElemType>& c);
     static void Multiply(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c);
     static void Multiply1x1AndWeightedAdd(ElemType alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, ElemType beta, CPUMatrix<ElemType>& c);
+    static void BatchMultiplyAndWeightedAdd(ElemType alpha, const CPUMatrix<ElemType>& a, const bool transposeA, const CPUMatrix<ElemType>& b, const bool transposeB, ElemType beta, CPUMatrix<ElemType>& c, const size_t batchCount);
 
     static void ScaleAndAdd(ElemType alpha, const CPUMatrix<ElemType>& a, CPUMatrix<ElemType>& c);
     static void AddScaledDifference(const ElemType alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c);
     static void AssignScaledDifference(const ElemType alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c);
     static void AddScaledDifference(const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c);    // alpha must be 1X1
+    static void AddCrossEntropyWithSoftmaxGradient(const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& labels, const CPUMatrix<ElemType>& logits,
+                                                   const CPUMatrix<ElemType>& logSumExp, CPUMatrix<ElemType>& c); // c += alpha * (softmax(logits) - labels), alpha must be 1X1
     static void AssignScaledDifference(const CPUMatrix<ElemType>& alpha, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c); // alpha must be 1X1
 
     static void AddElementToElement(const CPUMatrix<ElemType>& a, const size_t ai, const size_t aj, CPUMatrix<ElemType>& c, const size_t ci, const size_t cj);
@@ -380,6 +403,9 @@ public:
     CPUMatrix<ElemType>& GetARowByIndex(const CPUMatrix<ElemType>& a, const size_t index);
     static void ConductRowElementMultiplyWithShift(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c, const size_t shift, bool bFirstmatrixfixed);
     CPUMatrix<ElemType>& AssignElementProductOfWithShift(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, const size_t shift);
+    static void CosDistanceWithShiftNeg(const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& invNormA, CPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber);
+    static void AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const CPUMatrix<ElemType>& a, const CPUMatrix<ElemType>& b, const CPUMatrix<ElemType>& c, const CPUMatrix<ElemType>& gradientC,
+                                                   const CPUMatrix<ElemType>& invNormA, const CPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber, CPUMatrix<ElemType>& gradient);
 
 public:
     friend File& operator>>(File& stream, CPUMatrix<ElemType>& us)
@@ -387,15 +413,14 @@ public:
         stream.GetMarker(fileMarkerBeginSection, std::wstring(L"BMAT"));
         size_t elsize;
         stream >> elsize;
-        if (sizeof(ElemType) != elsize)
+        if (!IsSerializedElementSize<ElemType>(elsize))
             RuntimeError("Template argument size doesn't match those in file");
         std::wstring matrixName;
         size_t numRows, numCols;
         int format;
         stream >> matrixName >> format >> numRows >> numCols;
         ElemType* d_array = new ElemType[numRows * numCols];
-        for (size_t i = 0; i < numRows * numCols; ++i)
-            stream >> d_array[i];
+        ReadMatrixElements(stream, d_array, numRows, numCols, elsize); // (may be stored as FP16 or 8 bits)
         stream.GetMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
         us.SetValue(numRows, numCols, d_array, matrixFlagNormal);
         if (us.m_matrixName)
@@ -409,15 +434,15 @@ public:
     friend File& operator<<(File& stream, const CPUMatrix<ElemType>& us)
     {
         stream.PutMarker(fileMarkerBeginSection, std::wstring(L"BMAT"));
-        stream << sizeof(ElemType);
+        size_t elsize = GetSerializedElementSize<ElemType>(stream);
+        stream << elsize;
 
         std::wstring s = (us.m_matrixName == NULL) ? std::wstring(L"unnamed") : std::wstring(us.m_matrixName);
         int format = us.m_format;
         stream << s << format;
 
         stream << us.m_numRows << us.m_numCols;
-        for (size_t i = 0; i < us.GetNumElements(); ++i)
-            stream << us.m_pArray[i];
+        WriteMatrixElements(stream, us.m_pArray, us.m_numRows, us.m_numCols, elsize);
         stream.PutMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
         return stream;
     }
@@ -427,6 +452,17 @@ public:
 
 public:
     // for RCRF
+    static void RCRFForwardCompute(const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores, CPUMatrix<ElemType>& alpha,
+                                   const int startLbl, const size_t numParallelSequences);
+    static void ViterbiForwardCompute(const CPUMatrix<ElemType>& pos_scores, const CPUMatrix<ElemType>& pair_scores,
+                                      CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& backtrace,
+                                      const int startLbl, const size_t numParallelSequences);
+    static void GMMLogLikelihood(const CPUMatrix<ElemType>& unnormedPrior, const CPUMatrix<ElemType>& mean, const CPUMatrix<ElemType>& logStddev, const CPUMatrix<ElemType>& feature,
+                                 CPUMatrix<ElemType>& logLikelihood, CPUMatrix<ElemType>& posterior, CPUMatrix<ElemType>& normedDeviation);
+    static void AddGMMLogLikelihoodGradient(const size_t inputIndex, const CPUMatrix<ElemType>& gradient,
+                                            const CPUMatrix<ElemType>& posterior, const CPUMatrix<ElemType>& normedDeviation,
+                                            const CPUMatrix<ElemType>& unnormedPrior, const CPUMatrix<ElemType>& mean, const CPUMatrix<ElemType>& logStddev, const CPUMatrix<ElemType>& feature,
+                                            CPUMatrix<ElemType>& inputGradient);
     static void RCRFBackwardCompute(const CPUMatrix<ElemType>& alpha, CPUMatrix<ElemType>& beta,
                                     const CPUMatrix<ElemType>& lbls,
                                     const CPUMatrix<ElemType>& pair_scores);
@@ -440,6 +476,9 @@ public:
                                     const CPUMatrix<ElemType>& pair_scores,
                                     CPUMatrix<ElemType>& grd);
 
+    static void LSTMForwardWithState(const CPUMatrix<ElemType>& gates, const CPUMatrix<ElemType>& recurrentWeights, const CPUMatrix<ElemType>& flags,
+                                     CPUMatrix<ElemType>& h, CPUMatrix<ElemType>& c, CPUMatrix<ElemType>& output, const size_t numParallelSequences);
+
     static void _rcrfTransGrdCompute(size_t i,
                                      const CPUMatrix<ElemType>& lbls,
                                      const CPUMatrix<ElemType>& alpha,
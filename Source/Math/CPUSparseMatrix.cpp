@@ -14,6 +14,7 @@
 #include <math.h>
 #include "CPUMatrix.h"
 #include "CPUSparseMatrix.h"
+#include "AlignedMemory.h"
 #include <random>
 #include <chrono>
 #include <iostream>
@@ -89,6 +90,26 @@ enum class MatrixOpSide : char
 };
 #pragma endregion Helpful Enum Definitions
 
+// c[0..n) += val * a[0..n), as a unit-stride loop that the compiler vectorizes
+template <class ElemType>
+static inline void AddScaledColumn(const ElemType* a, const ElemType val, ElemType* c, const size_t n)
+{
+    for (size_t h = 0; h < n; h++)
+        c[h] += val * a[h];
+}
+
+// run f(rowBegin, rowEnd) in parallel for ranges of the rows, for products whose updates would conflict if split by columns
+// The ranges are at least a cache line of floats, so that different threads do not write to the same lines.
+template <class F>
+static void ForEachRowRange(const size_t numRows, const F& f)
+{
+    const size_t minRangeSize = 16;
+    const long numRanges = (long) max((size_t) 1, min((size_t) omp_get_max_threads(), numRows / minRangeSize));
+#pragma omp parallel for
+    for (long r = 0; r < numRanges; r++)
+        f(numRows * r / numRanges, numRows * (r + 1) / numRanges);
+}
+
 #pragma region Constructors and Destructor
 
 //should only be used by constructors.
@@ -250,7 +271,7 @@ void CPUSparseMatrix<ElemType>::ReleaseMemory()
 
         if (m_format == MatrixFormat::matrixFormatSparseCSC || m_format == MatrixFormat::matrixFormatSparseCSR)
         {
-            delete[] m_pArray;
+            FreeAlignedMemory(m_pArray);
             m_pArray = nullptr;
             m_nzValues = nullptr;
 
@@ -262,7 +283,7 @@ void CPUSparseMatrix<ElemType>::ReleaseMemory()
         }
         else if (m_format == MatrixFormat::matrixFormatSparseBlockCol || m_format == MatrixFormat::matrixFormatSparseBlockRow)
         {
-            delete[] m_pArray;
+            FreeAlignedMemory(m_pArray);
             m_pArray = nullptr;
             m_nzValues = nullptr;
 
@@ -529,6 +550,65 @@ void CPUSparseMatrix<ElemType>::SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYP
     memcpy(NzValues(), h_Val, NzSize());
 }
 
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols)
+{
+    const ElemType* h_Val = (const ElemType*) h_buffer;
+    const CPUSPARSE_INDEX_TYPE* h_Row = (const CPUSPARSE_INDEX_TYPE*) (h_Val + numNZReserved);
+    const CPUSPARSE_INDEX_TYPE* h_CSCCol = h_Row + numNZReserved;
+    SetMatrixFromCSCFormat(h_CSCCol, h_Row, h_Val, nz, numRows, numCols);
+}
+
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::GetCSCFormat(std::vector<CPUSPARSE_INDEX_TYPE>& colStarts, std::vector<CPUSPARSE_INDEX_TYPE>& rows, std::vector<ElemType>& values) const
+{
+    if (m_format != matrixFormatSparseCSC)
+        NOT_IMPLEMENTED;
+
+    // m_compIndex of a column slice is shifted but still indexes the arrays of the whole matrix, see ColumnSlice()
+    colStarts.resize(m_numCols + 1);
+    const CPUSPARSE_INDEX_TYPE first = m_numCols > 0 ? m_compIndex[0] : 0;
+    for (size_t j = 0; j <= m_numCols; j++)
+        colStarts[j] = m_numCols > 0 ? m_compIndex[j] - first : 0;
+    const size_t nz = colStarts[m_numCols];
+    rows.assign(m_unCompIndex + first, m_unCompIndex + first + nz);
+    values.assign(m_pArray + first, m_pArray + first + nz);
+}
+
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const
+{
+    if (m_format != matrixFormatSparseBlockCol)
+        NOT_IMPLEMENTED;
+
+    columnIds.resize(m_blockSize);
+    for (size_t j = 0; j < m_blockSize; j++)
+        columnIds[j] = m_blockIds[j] - m_blockIdShift;
+    values.assign(m_nzValues, m_nzValues + m_numRows * m_blockSize);
+}
+
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values)
+{
+    if (!OwnBuffer())
+        LogicError("Cannot modify since the buffer is managed externally.");
+    if (m_format != matrixFormatSparseBlockCol)
+        NOT_IMPLEMENTED;
+
+    const size_t numBlocks = columnIds.size();
+    Reset();
+    Resize(m_numRows, m_numCols, m_numRows * numBlocks, true, false);
+    for (size_t j = 0; j < numBlocks; j++)
+    {
+        if (columnIds[j] >= m_numCols)
+            InvalidArgument("SetMatrixFromBlockColumns: Column id %d out of range for %d columns.", (int) columnIds[j], (int) m_numCols);
+        m_blockIds[j] = columnIds[j];
+    }
+    memcpy(m_nzValues, values, sizeof(ElemType) * m_numRows * numBlocks);
+    m_blockSize = numBlocks;
+    m_nz = m_numRows * numBlocks;
+}
+
 template <class ElemType>
 ElemType* CPUSparseMatrix<ElemType>::BufferPointer() const
 {
@@ -556,7 +636,7 @@ void CPUSparseMatrix<ElemType>::Resize(const size_t numRows, const size_t numCol
         if (m_format == MatrixFormat::matrixFormatSparseCSC || m_format == MatrixFormat::matrixFormatSparseCSR)
         {
             ElemType* pArray = NULL;
-            pArray = new ElemType[numNZElemToReserve];
+            pArray = (ElemType*) AllocateAlignedMemory(sizeof(ElemType) * numNZElemToReserve);
             CPUSPARSE_INDEX_TYPE* unCompIndex = NULL;
             unCompIndex = new CPUSPARSE_INDEX_TYPE[numNZElemToReserve];
             CPUSPARSE_INDEX_TYPE* compIndex = NULL;
@@ -575,7 +655,7 @@ void CPUSparseMatrix<ElemType>::Resize(const size_t numRows, const size_t numCol
                 memcpy(compIndex, m_compIndex, SecondaryIndexSize());
             }
 
-            delete[] m_pArray;
+            FreeAlignedMemory(m_pArray);
             delete[] m_unCompIndex;
             delete[] m_compIndex;
 
@@ -586,7 +666,7 @@ void CPUSparseMatrix<ElemType>::Resize(const size_t numRows, const size_t numCol
         }
         else if (m_format == MatrixFormat::matrixFormatSparseBlockCol || m_format == MatrixFormat::matrixFormatSparseBlockRow)
         {
-            ElemType* blockVal = new ElemType[numNZElemToReserve];
+            ElemType* blockVal = (ElemType*) AllocateAlignedMemory(sizeof(ElemType) * numNZElemToReserve);
             size_t* blockIds = new size_t[newCompIndexSize];
 
             if (keepExistingValues && (m_nz > numNZElemToReserve || m_compIndexSize > newCompIndexSize))
@@ -599,7 +679,7 @@ void CPUSparseMatrix<ElemType>::Resize(const size_t numRows, const size_t numCol
                 memcpy(blockIds, m_blockIds, sizeof(size_t) * m_compIndexSize);
             }
 
-            delete[] m_pArray;
+            FreeAlignedMemory(m_pArray);
             delete[] m_blockIds;
 
             m_pArray = blockVal;
@@ -663,41 +743,44 @@ void CPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const CPU
     if (rhs.GetFormat() != matrixFormatSparseCSC)
         NOT_IMPLEMENTED;
 
+    const size_t numRows = lhs.GetNumRows();
     if (!transposeA && !transposeB)
     {
-        for (size_t j = 0; j < rhs.GetNumCols(); j++)
+        // column j of c only depends on column j of rhs, so the columns are independent
+#pragma omp parallel for
+        for (long j = 0; j < (long) rhs.GetNumCols(); j++)
         {
+            ElemType* cCol = &c(0, j);
             size_t start = rhs.m_compIndex[j]; // ColLocation
             size_t end = rhs.m_compIndex[j + 1];
             for (size_t p = start; p < end; p++)
             {
                 size_t i = rhs.m_unCompIndex[p]; // RowLocation
-                ElemType val = rhs.m_pArray[p];
-
-                for (size_t h = 0; h < lhs.GetNumRows(); h++)
-                {
-                    c(h, j) += alpha * lhs(h, i) * val;
-                }
+                const ElemType* lhsCol = &lhs(0, i);
+                ElemType val = alpha * rhs.m_pArray[p];
+                AddScaledColumn(lhsCol, val, cCol, numRows);
             }
         }
     }
     else if (!transposeA && transposeB)
     {
-        for (size_t j = 0; j < rhs.GetNumCols(); j++)
+        // Different columns of rhs add into the same columns of c, so we split by rows of c instead.
+        ForEachRowRange(numRows, [&](size_t rowBegin, size_t rowEnd)
         {
-            size_t start = rhs.m_compIndex[j];
-            size_t end = rhs.m_compIndex[j + 1];
-
-            for (size_t p = start; p < end; p++)
+            for (size_t j = 0; j < rhs.GetNumCols(); j++)
             {
-                size_t i = rhs.m_unCompIndex[p];
-                ElemType val = rhs.m_pArray[p];
-                for (size_t h = 0; h < lhs.GetNumRows(); h++)
+                size_t start = rhs.m_compIndex[j];
+                size_t end = rhs.m_compIndex[j + 1];
+                const ElemType* lhsCol = &lhs(rowBegin, j);
+
+                for (size_t p = start; p < end; p++)
                 {
-                    c(h, i) += alpha * lhs(h, j) * val;
+                    size_t i = rhs.m_unCompIndex[p];
+                    ElemType val = alpha * rhs.m_pArray[p];
+                    AddScaledColumn(lhsCol, val, &c(rowBegin, i), rowEnd - rowBegin);
                 }
             }
-        }
+        });
     }
     else if (transposeA && !transposeB)
     {
@@ -709,6 +792,86 @@ void CPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const CPU
     }
 }
 
+//c = alpha*op(lhs) * rhs + beta*c, with sparse lhs
+template <class ElemType>
+void CPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const CPUSparseMatrix<ElemType>& lhs, const bool transposeA,
+                                                       const CPUMatrix<ElemType>& rhs, const bool transposeB, ElemType beta, CPUMatrix<ElemType>& c)
+{
+    if (lhs.IsEmpty() || rhs.IsEmpty())
+        LogicError("MultiplyAndWeightedAdd:  one of the input matrix is empty.");
+
+    if (transposeB || (lhs.GetFormat() != matrixFormatSparseCSC && lhs.GetFormat() != matrixFormatSparseCSR))
+        NOT_IMPLEMENTED;
+
+    size_t m = transposeA ? lhs.GetNumCols() : lhs.GetNumRows();
+    size_t k = transposeA ? lhs.GetNumRows() : lhs.GetNumCols();
+    size_t n = rhs.GetNumCols();
+    if (k != rhs.GetNumRows())
+        InvalidArgument("CPUSparseMatrix::MultiplyAndWeightedAdd: The inner dimensions of a and b must match.");
+
+    if (beta == 0)
+        c.Resize(m, n);
+    else
+        c.VerifySize(m, n); // Can't resize if beta != 0
+
+    if (beta == 0)
+    {
+        memset(c.GetArray(), 0, sizeof(ElemType) * c.GetNumElements());
+    }
+    else if (beta != 1)
+    {
+#pragma omp parallel for
+        foreach_coord (i, j, c)
+        {
+            c(i, j) = beta * c(i, j);
+        }
+    }
+
+    // The compressed index of lhs either runs over the rows of the result, which are then inner products of a compressed
+    // row or column with the columns of rhs (CSR, or transposed CSC), or over the inner dimension, whose compressed
+    // entries are then scattered into the columns of the result (CSC, or transposed CSR).
+    const bool compressedAlongResultRows = (lhs.GetFormat() == matrixFormatSparseCSR) != transposeA;
+    const CPUSPARSE_INDEX_TYPE* compIndex = lhs.m_compIndex;
+    const CPUSPARSE_INDEX_TYPE* unCompIndex = lhs.m_unCompIndex;
+    const ElemType* values = lhs.m_pArray;
+    if (compressedAlongResultRows)
+    {
+        // each thread computes entire rows of c
+#pragma omp parallel for
+        for (long i = 0; i < (long) m; i++)
+        {
+            const size_t start = compIndex[i];
+            const size_t end = compIndex[i + 1];
+            for (size_t j = 0; j < n; j++)
+            {
+                const ElemType* rhsCol = &rhs(0, j);
+                ElemType sum = 0;
+                for (size_t p = start; p < end; p++)
+                    sum += values[p] * rhsCol[unCompIndex[p]];
+                c(i, j) += alpha * sum;
+            }
+        }
+    }
+    else
+    {
+        // column j of c only depends on column j of rhs, so the columns are independent
+#pragma omp parallel for
+        for (long j = 0; j < (long) n; j++)
+        {
+            ElemType* cCol = &c(0, j);
+            const ElemType* rhsCol = &rhs(0, j);
+            for (size_t h = 0; h < k; h++)
+            {
+                const ElemType val = alpha * rhsCol[h];
+                if (val == 0)
+                    continue;
+                for (size_t p = compIndex[h]; p < compIndex[h + 1]; p++)
+                    cCol[unCompIndex[p]] += values[p] * val;
+            }
+        }
+    }
+}
+
 //c = alpha * op(lhs) * op(rhs)
 template <class ElemType>
 void CPUSparseMatrix<ElemType>::MultiplyAndAdd(ElemType alpha, const CPUMatrix<ElemType>& lhs, const bool transposeA,
@@ -749,45 +912,42 @@ void CPUSparseMatrix<ElemType>::MultiplyAndAdd(ElemType alpha, const CPUMatrix<E
         c.SetFormat(matrixFormatSparseBlockCol);
         c.Resize(m, n, m * min(n, rhs.m_nz), true, false);
 
-        map<size_t, size_t> w2Id;
-        for (size_t j = 0; j < rhs.GetNumCols(); j++)
-        { // j ranges over batches
-            size_t start = rhs.m_compIndex[j];
-            size_t end = rhs.m_compIndex[j + 1];
+        // first determine the blocks, one per distinct word, in order of appearance
+        std::vector<size_t> blockOfNz(rhs.m_nz);
+        unordered_map<size_t, size_t> w2Id;
+        size_t firstNz = rhs.m_compIndex[0];
+        for (size_t p = firstNz; p < rhs.m_compIndex[rhs.GetNumCols()]; p++)
+        {
+            size_t i = rhs.m_unCompIndex[p]; // i ranges over words
+            auto iter = w2Id.find(i);
+            if (iter == w2Id.end())
+            {
+                iter = w2Id.insert(make_pair(i, w2Id.size())).first;
+                c.m_blockIds[c.m_blockSize] = i;
+                c.m_blockSize++;
+            }
+            blockOfNz[p - firstNz] = iter->second;
+        }
+        c.m_nz = c.m_blockSize * m;
+        memset(c.m_pArray, 0, sizeof(ElemType) * c.m_nz);
 
-            for (size_t p = start; p < end; p++)
+        // then accumulate, split by rows (h ranges over the hidden layer), since the same word may occur in several columns (j ranges over batches)
+        const size_t numRows = lhs.GetNumRows();
+        ForEachRowRange(numRows, [&](size_t rowBegin, size_t rowEnd)
+        {
+            for (size_t j = 0; j < rhs.GetNumCols(); j++)
             {
-                size_t i = rhs.m_unCompIndex[p]; // i ranges over words
-                ElemType val = rhs.m_pArray[p];  // 1 for(i, j)
+                size_t start = rhs.m_compIndex[j];
+                size_t end = rhs.m_compIndex[j + 1];
+                const ElemType* lhsCol = &lhs(rowBegin, j);
 
-                bool first = true;
-                if (w2Id.find(i) == w2Id.end())
-                {
-                    size_t id = w2Id.size();
-                    w2Id[i] = id;
-                    c.m_blockIds[c.m_blockSize] = i;
-                    c.m_blockSize++;
-                }
-                else
+                for (size_t p = start; p < end; p++)
                 {
-                    first = false;
-                }
-                size_t pos = w2Id[i] * lhs.GetNumRows();
-                for (size_t h = 0; h < lhs.GetNumRows(); h++)
-                { // h range over hidden layer
-                    if (first == true)
-                    {
-                        c.m_pArray[pos] = alpha * lhs(h, j) * val;
-                    }
-                    else
-                    {
-                        c.m_pArray[pos] += alpha * lhs(h, j) * val;
-                    }
-                    pos++;
+                    ElemType val = alpha * rhs.m_pArray[p]; // 1 for(i, j)
+                    AddScaledColumn(lhsCol, val, c.m_pArray + blockOfNz[p - firstNz] * numRows + rowBegin, rowEnd - rowBegin);
                 }
             }
-        }
-        c.m_nz = c.m_blockSize * m;
+        });
 
         if (c.m_nz > c.GetSizeAllocated())
         {
@@ -820,8 +980,10 @@ void CPUSparseMatrix<ElemType>::ScaleAndAdd(const ElemType alpha, const CPUSpars
 
     if (lhs.GetFormat() == MatrixFormat::matrixFormatSparseCSC || lhs.GetFormat() == MatrixFormat::matrixFormatSparseCSR)
     {
-        size_t col_num = (lhs.m_format == MatrixFormat::matrixFormatSparseCSC) ? lhs.GetNumCols() : lhs.GetNumRows();
-        for (size_t j = 0; j < col_num; j++)
+        // each compressed column (row for CSR) goes to a different column (row) of rhs
+        long col_num = (long) ((lhs.m_format == MatrixFormat::matrixFormatSparseCSC) ? lhs.GetNumCols() : lhs.GetNumRows());
+#pragma omp parallel for
+        for (long j = 0; j < col_num; j++)
         {
             size_t start = lhs.m_compIndex[j];
             size_t end = lhs.m_compIndex[j + 1];
@@ -837,7 +999,9 @@ void CPUSparseMatrix<ElemType>::ScaleAndAdd(const ElemType alpha, const CPUSpars
     }
     else if (lhs.m_format == MatrixFormat::matrixFormatSparseBlockCol || lhs.m_format == MatrixFormat::matrixFormatSparseBlockRow)
     {
-        for (size_t j = 0; j < lhs.m_blockSize; j++)
+        // the blocks are distinct columns (rows)
+#pragma omp parallel for
+        for (long j = 0; j < (long) lhs.m_blockSize; j++)
         {
             size_t i = lhs.m_blockIds[j] - lhs.m_blockIdShift;
             size_t len = (lhs.m_format == MatrixFormat::matrixFormatSparseBlockCol) ? lhs.GetNumRows() : lhs.GetNumCols();
@@ -895,7 +1059,8 @@ void CPUSparseMatrix<ElemType>::NormalGrad(CPUMatrix<ElemType>& c, const ElemTyp
 
     if (m_format == MatrixFormat::matrixFormatSparseBlockCol || m_format == MatrixFormat::matrixFormatSparseBlockRow)
     {
-        for (size_t j = 0; j < m_blockSize; j++)
+#pragma omp parallel for
+        for (long j = 0; j < (long) m_blockSize; j++)
         {
             size_t i = m_blockIds[j] - m_blockIdShift;
             size_t len = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? GetNumRows() : GetNumCols();
@@ -957,11 +1122,13 @@ ElemType CPUSparseMatrix<ElemType>::Adagrad(CPUMatrix<ElemType>& c, const bool n
     else if (m_format == MatrixFormat::matrixFormatSparseBlockCol || m_format == MatrixFormat::matrixFormatSparseBlockRow)
     {
         size_t len = (m_format == MatrixFormat::matrixFormatSparseBlockCol) ? GetNumRows() : GetNumCols();
-        size_t p = 0;
-        for (long j = 0; j < m_blockSize; j++)
+        double sumMultipliers = 0; // (in double, since it sums over all elements)
+#pragma omp parallel for reduction(+ : sumMultipliers)
+        for (long j = 0; j < (long) m_blockSize; j++)
         {
             size_t colOrRow = m_blockIds[j] - m_blockIdShift;
-            for (long i = 0; i < len; i++, p++)
+            size_t p = j * len;
+            for (long i = 0; i < (long) len; i++, p++)
             {
                 ElemType val = m_pArray[p];
 
@@ -972,9 +1139,10 @@ ElemType CPUSparseMatrix<ElemType>::Adagrad(CPUMatrix<ElemType>& c, const bool n
                 m_pArray[p] /= a;
 
                 if (needAveMultiplier)
-                    aveMultiplier += 1 / a;
+                    sumMultipliers += 1 / a;
             }
         }
+        aveMultiplier = (ElemType) sumMultipliers;
     }
 
     if (needAveMultiplier && m_nz > 0)
@@ -1261,18 +1429,9 @@ MATH_API File& operator>>(File& stream, CPUSparseMatrix<ElemType>& us)
         CPUSPARSE_INDEX_TYPE* compressedIndex = us.SecondaryIndexLocation();
 
         // read in the sparse matrix info
-        for (size_t i = 0; i < nz; ++i)
-        {
-            stream >> dataBuffer[i];
-        }
-        for (size_t i = 0; i < nz; ++i)
-        {
-            stream >> unCompressedIndex[i];
-        }
-        for (size_t i = 0; i < compressedSize; ++i)
-        {
-            stream >> compressedIndex[i];
-        }
+        stream.ReadArray(dataBuffer, nz);
+        stream.ReadArray(unCompressedIndex, nz);
+        stream.ReadArray(compressedIndex, compressedSize);
     }
     stream.GetMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
 
@@ -1314,18 +1473,9 @@ MATH_API File& operator<<(File& stream, const CPUSparseMatrix<ElemType>& us)
         CPUSPARSE_INDEX_TYPE* unCompressedIndex = us.MajorIndexLocation();
         CPUSPARSE_INDEX_TYPE* compressedIndex = us.SecondaryIndexLocation();
 
-        for (size_t i = 0; i < nz; ++i)
-        {
-            stream << dataBuffer[i];
-        }
-        for (size_t i = 0; i < nz; ++i)
-        {
-            stream << unCompressedIndex[i];
-        }
-        for (size_t i = 0; i < compressedSize; ++i)
-        {
-            stream << compressedIndex[i];
-        }
+        stream.WriteArray(dataBuffer, nz);
+        stream.WriteArray(unCompressedIndex, nz);
+        stream.WriteArray(compressedIndex, compressedSize);
     }
     stream.PutMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
 
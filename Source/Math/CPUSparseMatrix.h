@@ -86,6 +86,12 @@ public:
 
     void SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYPE* h_CSCCol, const CPUSPARSE_INDEX_TYPE* h_Row, const ElemType* h_Val,
                                 const size_t nz, const size_t numRows, const size_t numCols);
+    void SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols);
+    // CSC format only, see Matrix::GetCSCFormat()
+    void GetCSCFormat(std::vector<CPUSPARSE_INDEX_TYPE>& colStarts, std::vector<CPUSPARSE_INDEX_TYPE>& rows, std::vector<ElemType>& values) const;
+    // block-col format only, see Matrix::GetBlockColumns()
+    void GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const;
+    void SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values);
 
     static void MultiplyAndWeightedAdd(ElemType alpha, const CPUMatrix<ElemType>& lhs, const bool transposeA,
                                        const CPUSparseMatrix<ElemType>& rhs, const bool transposeB, ElemType beta, CPUMatrix<ElemType>& c);
@@ -93,6 +99,10 @@ public:
     static void MultiplyAndAdd(ElemType alpha, const CPUMatrix<ElemType>& lhs, const bool transposeA,
                                const CPUSparseMatrix<ElemType>& rhs, const bool transposeB, CPUSparseMatrix<ElemType>& c);
 
+    // sparse x dense = dense, e.g. pruned weights times activations (CSC or CSR; rhs not transposed)
+    static void MultiplyAndWeightedAdd(ElemType alpha, const CPUSparseMatrix<ElemType>& lhs, const bool transposeA,
+                                       const CPUMatrix<ElemType>& rhs, const bool transposeB, ElemType beta, CPUMatrix<ElemType>& c);
+
     static void ScaleAndAdd(const ElemType alpha, const CPUSparseMatrix<ElemType>& lhs, CPUMatrix<ElemType>& c);
 
     static bool AreEqual(const CPUSparseMatrix<ElemType>& a, const CPUSparseMatrix<ElemType>& b, const ElemType threshold = 1e-8);
@@ -0,0 +1,364 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// CPUVectorKernels.cpp -- AVX2 and AVX-512 implementations of CPUVectorKernels, and runtime dispatch
+//
+// The rest of Math is compiled for SSE3, so the kernels for each instruction set are compiled
+// with a function-level target (gcc) and only called if the CPU supports that instruction set.
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "CommonMatrix.h" // for EPS_IN_LOG
+#include "CPUVectorKernels.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <math.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// AVX-512 intrinsics are only available as of gcc 4.9 and VS 2017
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1910)
+#define HAS_AVX512_KERNELS
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// AVX2 (+ FMA) kernels
+// -----------------------------------------------------------------------
+
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace AVX2 {
+
+struct V
+{
+    typedef __m256 Reg;
+    static const size_t width = 8;
+
+    static Reg Load(const float* p) { return _mm256_loadu_ps(p); }
+    static void Store(float* p, Reg x) { _mm256_storeu_ps(p, x); }
+    static Reg Set1(float x) { return _mm256_set1_ps(x); }
+    static Reg Add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg Sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static Reg Mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg Div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+    static Reg Max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+    static Reg Min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+    static Reg FMAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); } // a * b + c
+    static Reg Round(Reg x) { return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg SelectGreater(Reg a, Reg b, Reg ifGreater, Reg otherwise) { return _mm256_blendv_ps(otherwise, ifGreater, _mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+
+    // bit manipulation for exp() and log(); these assume an integral k in [-126, 127] and normalized positive x, respectively
+    static Reg Pow2(Reg k) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23)); }
+    static Reg Exponent(Reg x) { return _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(127))); }
+    static Reg Mantissa(Reg x) { return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(_mm256_castps_si256(x), _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000))); }
+
+    static float HorizontalSum(Reg x)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        s = _mm_hadd_ps(s, s);
+        s = _mm_hadd_ps(s, s);
+        return _mm_cvtss_f32(s);
+    }
+    static float HorizontalMax(Reg x)
+    {
+        __m128 m = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+};
+
+#include "CPUVectorKernelsImpl.h"
+
+// Integer kernels do not fit the float wrapper 'V', so they are written out here.
+// The AVX-512 build uses these as well: 512-bit byte and word multiplies need AVX-512BW, not just AVX-512F.
+
+static inline int32_t HorizontalSumInt32(__m256i x)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s);
+}
+
+// 16 products per step: sign-extend to int16, then multiply and add adjacent pairs into int32
+static inline __m256i MultiplyAddInt8(__m256i acc, const int8_t* a, __m256i b16)
+{
+    __m256i a16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) a));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(a16, b16));
+}
+
+static void Int8DotProducts(const int8_t* a, size_t lda, size_t numRows, const int8_t* b, size_t n, int32_t* us)
+{
+    size_t i = 0;
+    for (; i + 4 <= numRows; i += 4) // 4 rows at a time, to share the loads of b
+    {
+        const int8_t* a0 = a + i * lda;
+        const int8_t* a1 = a0 + lda;
+        const int8_t* a2 = a1 + lda;
+        const int8_t* a3 = a2 + lda;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        __m256i acc2 = _mm256_setzero_si256();
+        __m256i acc3 = _mm256_setzero_si256();
+        size_t k = 0;
+        for (; k + 16 <= n; k += 16)
+        {
+            __m256i b16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (b + k)));
+            acc0 = MultiplyAddInt8(acc0, a0 + k, b16);
+            acc1 = MultiplyAddInt8(acc1, a1 + k, b16);
+            acc2 = MultiplyAddInt8(acc2, a2 + k, b16);
+            acc3 = MultiplyAddInt8(acc3, a3 + k, b16);
+        }
+        int32_t sum0 = HorizontalSumInt32(acc0);
+        int32_t sum1 = HorizontalSumInt32(acc1);
+        int32_t sum2 = HorizontalSumInt32(acc2);
+        int32_t sum3 = HorizontalSumInt32(acc3);
+        for (; k < n; k++)
+        {
+            sum0 += a0[k] * b[k];
+            sum1 += a1[k] * b[k];
+            sum2 += a2[k] * b[k];
+            sum3 += a3[k] * b[k];
+        }
+        us[i] = sum0;
+        us[i + 1] = sum1;
+        us[i + 2] = sum2;
+        us[i + 3] = sum3;
+    }
+    for (; i < numRows; i++)
+    {
+        const int8_t* ai = a + i * lda;
+        __m256i acc = _mm256_setzero_si256();
+        size_t k = 0;
+        for (; k + 16 <= n; k += 16)
+            acc = MultiplyAddInt8(acc, ai + k, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (b + k))));
+        int32_t sum = HorizontalSumInt32(acc);
+        for (; k < n; k++)
+            sum += ai[k] * b[k];
+        us[i] = sum;
+    }
+}
+
+} // namespace AVX2
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+// -----------------------------------------------------------------------
+// AVX-512 kernels
+// -----------------------------------------------------------------------
+
+#ifdef HAS_AVX512_KERNELS
+
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace AVX512 {
+
+struct V
+{
+    typedef __m512 Reg;
+    static const size_t width = 16;
+
+    static Reg Load(const float* p) { return _mm512_loadu_ps(p); }
+    static void Store(float* p, Reg x) { _mm512_storeu_ps(p, x); }
+    static Reg Set1(float x) { return _mm512_set1_ps(x); }
+    static Reg Add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+    static Reg Sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+    static Reg Mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+    static Reg Div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+    static Reg Max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+    static Reg Min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+    static Reg FMAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); } // a * b + c
+    static Reg Round(Reg x) { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg SelectGreater(Reg a, Reg b, Reg ifGreater, Reg otherwise) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), otherwise, ifGreater); }
+
+    static Reg Pow2(Reg k) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(k), _mm512_set1_epi32(127)), 23)); }
+    static Reg Exponent(Reg x) { return _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(_mm512_castps_si512(x), 23), _mm512_set1_epi32(127))); }
+    static Reg Mantissa(Reg x) { return _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x007fffff)), _mm512_set1_epi32(0x3f800000))); }
+
+    // these are only used once per call, so we do not bother with shuffles
+    static float HorizontalSum(Reg x)
+    {
+        float v[width];
+        _mm512_storeu_ps(v, x);
+        float sum = 0;
+        for (size_t i = 0; i < width; i++)
+            sum += v[i];
+        return sum;
+    }
+    static float HorizontalMax(Reg x)
+    {
+        float v[width];
+        _mm512_storeu_ps(v, x);
+        return *std::max_element(v, v + width);
+    }
+};
+
+#include "CPUVectorKernelsImpl.h"
+
+} // namespace AVX512
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+#endif // HAS_AVX512_KERNELS
+
+// -----------------------------------------------------------------------
+// runtime dispatch
+// -----------------------------------------------------------------------
+
+static CPUVectorKernels::InstructionSet DetectInstructionSet()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    bool hasAVX2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool hasAVX512 = __builtin_cpu_supports("avx512f");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool hasFMA = (info[2] & (1 << 12)) != 0;
+    bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = hasOSXSAVE ? _xgetbv(0) : 0;
+    bool osSavesYmm = (xcr0 & 0x06) == 0x06;
+    bool osSavesZmm = (xcr0 & 0xe6) == 0xe6;
+    int ebx7 = 0;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        ebx7 = info[1];
+    }
+    bool hasAVX2 = hasFMA && osSavesYmm && (ebx7 & (1 << 5)) != 0;
+    bool hasAVX512 = osSavesZmm && (ebx7 & (1 << 16)) != 0;
+#else
+    bool hasAVX2 = false;
+    bool hasAVX512 = false;
+#endif
+#ifdef HAS_AVX512_KERNELS
+    if (hasAVX512 && hasAVX2)
+        return CPUVectorKernels::InstructionSet::AVX512;
+#else
+    hasAVX512;
+#endif
+    if (hasAVX2)
+        return CPUVectorKernels::InstructionSet::AVX2;
+    return CPUVectorKernels::InstructionSet::None;
+}
+
+/*static*/ CPUVectorKernels::InstructionSet CPUVectorKernels::GetInstructionSet()
+{
+    static const InstructionSet instructionSet = DetectInstructionSet(); // (thread-safe in C++11)
+    return instructionSet;
+}
+
+/*static*/ const char* CPUVectorKernels::GetInstructionSetName()
+{
+    switch (GetInstructionSet())
+    {
+    case InstructionSet::AVX512: return "AVX-512";
+    case InstructionSet::AVX2:   return "AVX2";
+    default:                     return "none";
+    }
+}
+
+static bool s_useFastApproximations = false;
+
+/*static*/ void CPUVectorKernels::SetUseFastApproximations(bool enable)
+{
+    s_useFastApproximations = enable;
+}
+
+/*static*/ bool CPUVectorKernels::UseFastApproximations()
+{
+    return s_useFastApproximations;
+}
+
+#ifdef HAS_AVX512_KERNELS
+#define CaseAVX512(call)                   \
+    case InstructionSet::AVX512:           \
+        return AVX512::call;
+#else
+#define CaseAVX512(call)
+#endif
+
+#define DispatchVectorKernel(call)                                                      \
+    switch (GetInstructionSet())                                                        \
+    {                                                                                   \
+        CaseAVX512(call)                                                                \
+    case InstructionSet::AVX2:                                                          \
+        return AVX2::call;                                                              \
+    default:                                                                            \
+        LogicError("CPUVectorKernels: Called on a CPU without AVX2 support.");          \
+    }
+
+/*static*/ void CPUVectorKernels::ElementProduct(const float* a, const float* b, float* us, size_t n)
+{
+    DispatchVectorKernel(ElementProduct(a, b, us, n));
+}
+
+/*static*/ void CPUVectorKernels::AddElementProduct(const float* a, const float* b, float* us, size_t n)
+{
+    DispatchVectorKernel(AddElementProduct(a, b, us, n));
+}
+
+/*static*/ float CPUVectorKernels::Sum(const float* a, size_t n)
+{
+    DispatchVectorKernel(Sum(a, n));
+}
+
+/*static*/ float CPUVectorKernels::Max(const float* a, size_t n)
+{
+    DispatchVectorKernel(Max(a, n));
+}
+
+/*static*/ void CPUVectorKernels::LogSoftmax(const float* a, float* us, size_t n)
+{
+    DispatchVectorKernel(LogSoftmax(a, us, n, UseFastApproximations()));
+}
+
+/*static*/ void CPUVectorKernels::Exp(const float* a, float* us, size_t n)
+{
+    DispatchVectorKernel(Exp(a, us, n));
+}
+
+/*static*/ void CPUVectorKernels::Log(const float* a, float* us, size_t n)
+{
+    DispatchVectorKernel(Log(a, us, n));
+}
+
+/*static*/ void CPUVectorKernels::Sigmoid(const float* a, float* us, size_t n)
+{
+    DispatchVectorKernel(Sigmoid(a, us, n));
+}
+
+/*static*/ void CPUVectorKernels::Tanh(const float* a, float* us, size_t n)
+{
+    DispatchVectorKernel(Tanh(a, us, n));
+}
+
+/*static*/ void CPUVectorKernels::Int8DotProducts(const int8_t* a, size_t lda, size_t numRows, const int8_t* b, size_t n, int32_t* us)
+{
+    if (!IsAvailable())
+        LogicError("CPUVectorKernels: Called on a CPU without AVX2 support.");
+    AVX2::Int8DotProducts(a, lda, numRows, b, n, us); // (also on AVX-512 CPUs, see above)
+}
+
+#undef DispatchVectorKernel
+#undef CaseAVX512
+
+} } }
@@ -0,0 +1,63 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// CPUVectorKernels.h -- SIMD kernels for the hot loops of CPUMatrix<float>, with runtime dispatch to AVX2 or AVX-512
+//
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// CPUVectorKernels -- vectorized elementwise, softmax, and reduction kernels
+// The instruction set is detected once, on first use. On CPUs without AVX2,
+// IsAvailable() returns false and callers use their scalar loops.
+// All functions operate on contiguous arrays and are single-threaded; callers parallelize.
+// Exp(), Log(), Sigmoid() and Tanh() use polynomial approximations that are accurate
+// to a few ulps but not bit-identical to the C runtime. Callers must only use them
+// if UseFastApproximations() is true.
+// -----------------------------------------------------------------------
+
+class CPUVectorKernels
+{
+public:
+    enum class InstructionSet
+    {
+        None,
+        AVX2,  // AVX2 + FMA, 8 floats
+        AVX512 // AVX-512F, 16 floats
+    };
+
+    static InstructionSet GetInstructionSet();
+    static const char* GetInstructionSetName();
+    static bool IsAvailable() { return GetInstructionSet() != InstructionSet::None; }
+
+    static void SetUseFastApproximations(bool enable);
+    static bool UseFastApproximations();
+
+    // elementwise
+    static void ElementProduct(const float* a, const float* b, float* us, size_t n);    // us = a .* b
+    static void AddElementProduct(const float* a, const float* b, float* us, size_t n); // us += a .* b
+
+    // reductions
+    static float Sum(const float* a, size_t n);
+    static float Max(const float* a, size_t n);
+
+    // us = a - log(sum(exp(a))) over a single column; exp() is vectorized only if UseFastApproximations()
+    static void LogSoftmax(const float* a, float* us, size_t n);
+
+    // fast approximations (only if UseFastApproximations())
+    static void Exp(const float* a, float* us, size_t n);
+    static void Log(const float* a, float* us, size_t n); // clips at EPS_IN_LOG like CPUMatrix::AssignLogOf()
+    static void Sigmoid(const float* a, float* us, size_t n);
+    static void Tanh(const float* a, float* us, size_t n);
+
+    // int8 dot products of 'numRows' rows of a (row stride 'lda') with b, accumulated exactly in int32
+    // Used by Int8QuantizedMatrix. n must be less than 2^17 to rule out overflow.
+    static void Int8DotProducts(const int8_t* a, size_t lda, size_t numRows, const int8_t* b, size_t n, int32_t* us);
+};
+
+} } }
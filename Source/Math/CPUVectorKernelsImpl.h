@@ -0,0 +1,178 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// CPUVectorKernelsImpl.h -- instruction-set independent bodies of the CPUVectorKernels
+//
+// This file is included once per instruction set by CPUVectorKernels.cpp, inside a namespace
+// that defines 'V', a wrapper around the SIMD register type and intrinsics of that instruction set,
+// and with the compiler's target set accordingly. Do not include it anywhere else.
+// Every function handles full registers first and the remainder with scalar code.
+//
+
+// note: no #pragma once, this is included multiple times
+
+static inline V::Reg ExpApprox(V::Reg x)
+{
+    // Cephes-style expf(): exp(x) = 2^k * exp(r), k = round(x / ln 2), |r| <= ln(2) / 2
+    x = V::Min(V::Max(x, V::Set1(-87.33654f)), V::Set1(88.0f)); // keeps k within the range of normalized floats
+    V::Reg k = V::Round(V::Mul(x, V::Set1(1.44269504088896341f)));
+    V::Reg r = V::FMAdd(k, V::Set1(-0.693359375f), x); // ln 2 split into two parts for precision
+    r = V::FMAdd(k, V::Set1(2.12194440e-4f), r);
+    V::Reg p = V::Set1(1.9875691500e-4f);
+    p = V::FMAdd(p, r, V::Set1(1.3981999507e-3f));
+    p = V::FMAdd(p, r, V::Set1(8.3334519073e-3f));
+    p = V::FMAdd(p, r, V::Set1(4.1665795894e-2f));
+    p = V::FMAdd(p, r, V::Set1(1.6666665459e-1f));
+    p = V::FMAdd(p, r, V::Set1(5.0000001201e-1f));
+    p = V::FMAdd(p, V::Mul(r, r), V::Add(r, V::Set1(1.0f)));
+    return V::Mul(p, V::Pow2(k));
+}
+
+static inline V::Reg LogApprox(V::Reg x)
+{
+    // Cephes-style logf(): log(x) = e ln 2 + log(m), m in [sqrt(1/2), sqrt(2))
+    const V::Reg xIn = x;
+    x = V::Max(x, V::Set1(EPS_IN_LOG));
+    V::Reg e = V::Exponent(x);
+    V::Reg m = V::Mantissa(x); // in [1, 2)
+    const V::Reg sqrt2 = V::Set1(1.41421356237f);
+    e = V::SelectGreater(m, sqrt2, V::Add(e, V::Set1(1.0f)), e);
+    m = V::SelectGreater(m, sqrt2, V::Mul(m, V::Set1(0.5f)), m);
+    V::Reg t = V::Sub(m, V::Set1(1.0f));
+    V::Reg t2 = V::Mul(t, t);
+    V::Reg p = V::Set1(7.0376836292e-2f);
+    p = V::FMAdd(p, t, V::Set1(-1.1514610310e-1f));
+    p = V::FMAdd(p, t, V::Set1(1.1676998740e-1f));
+    p = V::FMAdd(p, t, V::Set1(-1.2420140846e-1f));
+    p = V::FMAdd(p, t, V::Set1(1.4249322787e-1f));
+    p = V::FMAdd(p, t, V::Set1(-1.6668057665e-1f));
+    p = V::FMAdd(p, t, V::Set1(2.0000714765e-1f));
+    p = V::FMAdd(p, t, V::Set1(-2.4999993993e-1f));
+    p = V::FMAdd(p, t, V::Set1(3.3333331174e-1f));
+    p = V::Mul(V::Mul(p, t), t2);
+    p = V::FMAdd(e, V::Set1(-2.12194440e-4f), p);
+    p = V::FMAdd(t2, V::Set1(-0.5f), p);
+    V::Reg result = V::FMAdd(e, V::Set1(0.693359375f), V::Add(t, p));
+    return V::SelectGreater(V::Set1(EPS_IN_LOG), xIn, V::Set1(LOG_OF_EPS_IN_LOG), result); // same clipping as CPUMatrix::AssignLogOf()
+}
+
+static void ElementProduct(const float* a, const float* b, float* us, size_t n)
+{
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, V::Mul(V::Load(a + i), V::Load(b + i)));
+    for (; i < n; i++)
+        us[i] = a[i] * b[i];
+}
+
+static void AddElementProduct(const float* a, const float* b, float* us, size_t n)
+{
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, V::FMAdd(V::Load(a + i), V::Load(b + i), V::Load(us + i)));
+    for (; i < n; i++)
+        us[i] += a[i] * b[i];
+}
+
+static float Sum(const float* a, size_t n)
+{
+    // two accumulators to hide the latency of the adds
+    V::Reg sum0 = V::Set1(0.0f);
+    V::Reg sum1 = V::Set1(0.0f);
+    size_t i = 0;
+    for (; i + 2 * V::width <= n; i += 2 * V::width)
+    {
+        sum0 = V::Add(sum0, V::Load(a + i));
+        sum1 = V::Add(sum1, V::Load(a + i + V::width));
+    }
+    for (; i + V::width <= n; i += V::width)
+        sum0 = V::Add(sum0, V::Load(a + i));
+    float sum = V::HorizontalSum(V::Add(sum0, sum1));
+    for (; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+static float Max(const float* a, size_t n)
+{
+    if (n < V::width)
+        return *std::max_element(a, a + n);
+    V::Reg maxV = V::Load(a);
+    size_t i = V::width;
+    for (; i + V::width <= n; i += V::width)
+        maxV = V::Max(maxV, V::Load(a + i));
+    float result = V::HorizontalMax(maxV);
+    for (; i < n; i++)
+        result = std::max(result, a[i]);
+    return result;
+}
+
+static void Exp(const float* a, float* us, size_t n)
+{
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, ExpApprox(V::Load(a + i)));
+    for (; i < n; i++)
+        us[i] = exp(a[i]);
+}
+
+static void Log(const float* a, float* us, size_t n)
+{
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, LogApprox(V::Load(a + i)));
+    for (; i < n; i++)
+        us[i] = a[i] < EPS_IN_LOG ? LOG_OF_EPS_IN_LOG : log(a[i]);
+}
+
+static void Sigmoid(const float* a, float* us, size_t n)
+{
+    // 1 / (1 + exp(-x)); ExpApprox() clips its argument, so this cannot overflow to NaN
+    const V::Reg one = V::Set1(1.0f);
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, V::Div(one, V::Add(one, ExpApprox(V::Sub(V::Set1(0.0f), V::Load(a + i))))));
+    for (; i < n; i++)
+        us[i] = a[i] >= 0 ? 1 / (1 + exp(-a[i])) : exp(a[i]) / (1 + exp(a[i]));
+}
+
+static void Tanh(const float* a, float* us, size_t n)
+{
+    // 1 - 2 / (exp(2x) + 1)
+    const V::Reg one = V::Set1(1.0f);
+    const V::Reg two = V::Set1(2.0f);
+    size_t i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, V::Sub(one, V::Div(two, V::Add(ExpApprox(V::Mul(two, V::Load(a + i))), one))));
+    for (; i < n; i++)
+        us[i] = tanh(a[i]);
+}
+
+static void LogSoftmax(const float* a, float* us, size_t n, bool fast)
+{
+    // subtract the max before exp() to avoid overflow
+    const float maxA = Max(a, n);
+    const V::Reg maxV = V::Set1(maxA);
+    V::Reg sumV = V::Set1(0.0f);
+    size_t i = 0;
+    if (fast)
+    {
+        for (; i + V::width <= n; i += V::width)
+        {
+            V::Reg x = V::Sub(V::Load(a + i), maxV);
+            V::Store(us + i, x);
+            sumV = V::Add(sumV, ExpApprox(x));
+        }
+    }
+    float sum = V::HorizontalSum(sumV);
+    for (; i < n; i++)
+        sum += exp(us[i] = a[i] - maxA);
+    const float logSum = log(sum);
+    const V::Reg logSumV = V::Set1(logSum);
+    i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::Store(us + i, V::Sub(V::Load(us + i), logSumV));
+    for (; i < n; i++)
+        us[i] -= logSum;
+}
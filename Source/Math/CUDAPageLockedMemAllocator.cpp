@@ -4,6 +4,11 @@
 #ifndef CPUONLY
 #include <cuda_runtime_api.h>
 #endif
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdlib.h>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -44,6 +49,184 @@ int CUDAPageLockedMemAllocator::GetDeviceId() const
 {
     return m_deviceID;
 }
+
+// -----------------------------------------------------------------------
+// CUDAPageLockedMemArena
+// -----------------------------------------------------------------------
+
+struct CUDAPageLockedMemArena::Impl
+{
+    static const size_t alignment = 256; // enough for any element type and for DMA
+
+    struct Chunk
+    {
+        char* m_base;
+        size_t m_size;
+        std::map<size_t, size_t> m_freeBlocks; // offset -> size, non-adjacent
+    };
+
+    mutable std::mutex m_mutex;
+    std::vector<Chunk> m_chunks;
+    std::map<char*, std::pair<size_t, size_t>> m_usedBlocks; // pointer -> (chunk index, size)
+    size_t m_maxPageLockedBytes;
+    size_t m_chunkBytes;
+    size_t m_pageLockedBytes;
+    size_t m_bytesInUse;
+
+    static size_t RoundUp(size_t size)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // first fit; returns nullptr if no chunk has a large enough free block
+    char* AllocateFromChunks(size_t size)
+    {
+        for (size_t c = 0; c < m_chunks.size(); c++)
+        {
+            auto& freeBlocks = m_chunks[c].m_freeBlocks;
+            for (auto iter = freeBlocks.begin(); iter != freeBlocks.end(); iter++)
+            {
+                if (iter->second < size)
+                    continue;
+                size_t offset = iter->first;
+                size_t remaining = iter->second - size;
+                freeBlocks.erase(iter);
+                if (remaining > 0)
+                    freeBlocks[offset + size] = remaining;
+                char* p = m_chunks[c].m_base + offset;
+                m_usedBlocks[p] = std::make_pair(c, size);
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    void ReturnToChunk(size_t c, size_t offset, size_t size)
+    {
+        auto& freeBlocks = m_chunks[c].m_freeBlocks;
+        auto next = freeBlocks.lower_bound(offset);
+        // merge with the following block
+        if (next != freeBlocks.end() && next->first == offset + size)
+        {
+            size += next->second;
+            next = freeBlocks.erase(next);
+        }
+        // merge with the preceding block
+        if (next != freeBlocks.begin())
+        {
+            auto prev = next;
+            prev--;
+            if (prev->first + prev->second == offset)
+            {
+                prev->second += size;
+                return;
+            }
+        }
+        freeBlocks[offset] = size;
+    }
+};
+
+CUDAPageLockedMemArena::CUDAPageLockedMemArena(int deviceID, size_t maxPageLockedBytes, size_t chunkBytes)
+    : m_impl(new Impl()), m_deviceID(deviceID)
+{
+    m_impl->m_maxPageLockedBytes = maxPageLockedBytes;
+    m_impl->m_chunkBytes = Impl::RoundUp(chunkBytes);
+    m_impl->m_pageLockedBytes = 0;
+    m_impl->m_bytesInUse = 0;
+}
+
+CUDAPageLockedMemArena::~CUDAPageLockedMemArena()
+{
+    for (auto& chunk : m_impl->m_chunks)
+        CUDAPageLockedMemAllocator::Free(chunk.m_base, m_deviceID);
+    delete m_impl;
+}
+
+int CUDAPageLockedMemArena::GetDeviceId() const
+{
+    return m_deviceID;
+}
+
+void* CUDAPageLockedMemArena::Malloc(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_impl->m_mutex);
+    size = Impl::RoundUp(max(size, (size_t) 1));
+
+    char* p = m_impl->AllocateFromChunks(size);
+    if (!p)
+    {
+        size_t chunkSize = max(m_impl->m_chunkBytes, size);
+        if (m_impl->m_pageLockedBytes + chunkSize <= m_impl->m_maxPageLockedBytes)
+        {
+            Impl::Chunk chunk;
+            chunk.m_base = (char*) CUDAPageLockedMemAllocator::Malloc(chunkSize, m_deviceID);
+            chunk.m_size = chunkSize;
+            chunk.m_freeBlocks[0] = chunkSize;
+            m_impl->m_chunks.push_back(chunk);
+            m_impl->m_pageLockedBytes += chunkSize;
+            p = m_impl->AllocateFromChunks(size);
+        }
+        else
+        {
+            // over budget: fall back to pageable memory; SIZE_MAX marks it as not owned by any chunk
+            p = (char*) malloc(size);
+            if (!p)
+                RuntimeError("CUDAPageLockedMemArena: Out of memory allocating %d bytes.", (int) size);
+            m_impl->m_usedBlocks[p] = std::make_pair(SIZE_MAX, size);
+        }
+    }
+    m_impl->m_bytesInUse += size;
+    return p;
+}
+
+void CUDAPageLockedMemArena::Free(void* p)
+{
+    if (!p)
+        return;
+    std::lock_guard<std::mutex> lock(m_impl->m_mutex);
+    auto iter = m_impl->m_usedBlocks.find((char*) p);
+    if (iter == m_impl->m_usedBlocks.end())
+        LogicError("CUDAPageLockedMemArena::Free: Pointer was not allocated from this arena.");
+    size_t c = iter->second.first;
+    size_t size = iter->second.second;
+    m_impl->m_usedBlocks.erase(iter);
+    m_impl->m_bytesInUse -= size;
+    if (c == SIZE_MAX)
+        free(p);
+    else
+        m_impl->ReturnToChunk(c, (char*) p - m_impl->m_chunks[c].m_base, size);
+}
+
+size_t CUDAPageLockedMemArena::GetPageLockedBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->m_mutex);
+    return m_impl->m_pageLockedBytes;
+}
+
+size_t CUDAPageLockedMemArena::GetBytesInUse() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->m_mutex);
+    return m_impl->m_bytesInUse;
+}
+
+static size_t s_sharedArenaLimit = CUDAPageLockedMemArena::s_defaultMaxPageLockedBytes;
+
+void CUDAPageLockedMemArena::SetSharedArenaLimit(size_t maxPageLockedBytes)
+{
+    s_sharedArenaLimit = maxPageLockedBytes;
+}
+
+CUDAPageLockedMemArena& CUDAPageLockedMemArena::GetSharedArena(int deviceID)
+{
+    static std::mutex s_mutex;
+    // never destroyed, since buffers may be freed during static destruction, and since the CUDA runtime may be gone by then
+    static std::map<int, CUDAPageLockedMemArena*>* s_arenas = new std::map<int, CUDAPageLockedMemArena*>();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto& arena = (*s_arenas)[deviceID];
+    if (!arena)
+        arena = new CUDAPageLockedMemArena(deviceID, s_sharedArenaLimit);
+    return *arena;
+}
 #else
 // Dummy definitions when compiling for CPUONLY
 CUDAPageLockedMemAllocator::CUDAPageLockedMemAllocator(int)
@@ -63,5 +246,52 @@ void* CUDAPageLockedMemAllocator::Malloc(size_t)
 void CUDAPageLockedMemAllocator::Free(void*)
 {
 }
+
+struct CUDAPageLockedMemArena::Impl
+{
+};
+
+CUDAPageLockedMemArena::CUDAPageLockedMemArena(int, size_t, size_t)
+    : m_impl(nullptr), m_deviceID(-1)
+{
+}
+
+CUDAPageLockedMemArena::~CUDAPageLockedMemArena()
+{
+}
+
+int CUDAPageLockedMemArena::GetDeviceId() const
+{
+    return -1;
+}
+
+void* CUDAPageLockedMemArena::Malloc(size_t)
+{
+    return nullptr;
+}
+
+void CUDAPageLockedMemArena::Free(void*)
+{
+}
+
+size_t CUDAPageLockedMemArena::GetPageLockedBytes() const
+{
+    return 0;
+}
+
+size_t CUDAPageLockedMemArena::GetBytesInUse() const
+{
+    return 0;
+}
+
+void CUDAPageLockedMemArena::SetSharedArenaLimit(size_t)
+{
+}
+
+CUDAPageLockedMemArena& CUDAPageLockedMemArena::GetSharedArena(int deviceID)
+{
+    static CUDAPageLockedMemArena s_dummyArena(deviceID);
+    return s_dummyArena;
+}
 #endif
 } } }
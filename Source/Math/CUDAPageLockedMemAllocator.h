@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Basics.h"
 #include "MemAllocator.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -28,4 +29,41 @@ public:
 private:
     int m_deviceID;
 };
+
+// -----------------------------------------------------------------------
+// CUDAPageLockedMemArena -- sub-allocates page-locked host memory out of a few large chunks.
+// Freed blocks are recycled (and merged with free neighbors), so that many small or short-lived
+// staging buffers (gradient download, minibatch upload) do not each cost a cudaHostAlloc().
+// The total page-locked footprint per arena is bounded; requests beyond the limit are served
+// from regular pageable memory, which is still correct but loses true async DMA.
+// Use GetSharedArena() to share one arena per device across readers and gradient aggregation.
+// -----------------------------------------------------------------------
+
+class MATH_API CUDAPageLockedMemArena : public MemAllocator
+{
+public:
+    CUDAPageLockedMemArena(int deviceID, size_t maxPageLockedBytes = s_defaultMaxPageLockedBytes, size_t chunkBytes = s_defaultChunkBytes);
+    ~CUDAPageLockedMemArena();
+
+    DISABLE_COPY_AND_MOVE(CUDAPageLockedMemArena);
+
+    int GetDeviceId() const;
+    void* Malloc(size_t size) override;
+    void Free(void* p) override;
+
+    size_t GetPageLockedBytes() const; // total size of the chunks allocated from CUDA
+    size_t GetBytesInUse() const;      // part of that currently handed out
+
+    // one arena per device, shared by everyone in the process
+    static CUDAPageLockedMemArena& GetSharedArena(int deviceID);
+    static void SetSharedArenaLimit(size_t maxPageLockedBytes); // must be called before the first GetSharedArena()
+
+    static const size_t s_defaultMaxPageLockedBytes = (size_t) 1 << 30;
+    static const size_t s_defaultChunkBytes = (size_t) 64 << 20;
+
+private:
+    struct Impl;
+    Impl* m_impl;
+    int m_deviceID;
+};
 } } }
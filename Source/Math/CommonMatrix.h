@@ -17,6 +17,17 @@
 #include "Basics.h"
 #include <string>
 #include <stdint.h>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+// predeclare the CUDA types used below
+struct CUstream_st;
+typedef struct CUstream_st* cudaStream_t;
+struct CUevent_st;
+typedef struct CUevent_st* cudaEvent_t;
+struct CUgraphExec_st;
+typedef struct CUgraphExec_st* cudaGraphExec_t;
 
 #define DEVICEID_TYPE int
 // and the following magic values
@@ -37,18 +48,49 @@
 #define CPUSPARSE_INDEX_TYPE int // to be consistent with cuSparse but limited the possible size of the matrix.
 
 MATH_API DEVICEID_TYPE EnforceOneGPUOnly(DEVICEID_TYPE requestedDeviceId);
+MATH_API void AllowAdditionalGPU(DEVICEID_TYPE deviceId); // let EnforceOneGPUOnly() pass this GPU, for code that uses several on purpose
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// statistics of the caching layer underneath TracingGPUMemoryAllocator, per device
+struct GPUMemoryCacheStatistics
+{
+    size_t m_numRequests;    // number of Allocate() calls
+    size_t m_numCacheHits;   // number of Allocate() calls served from the cache without cudaMalloc()
+    size_t m_cachedBytes;    // bytes held in the cache, not currently handed out
+    size_t m_allocatedBytes; // bytes currently handed out, in bucket sizes
+    size_t m_requestedBytes; // bytes currently handed out, as requested
+    size_t m_peakAllocatedBytes; // high-water mark of m_allocatedBytes since the last ResetPeakAllocatedBytes()
+
+    GPUMemoryCacheStatistics()
+        : m_numRequests(0), m_numCacheHits(0), m_cachedBytes(0), m_allocatedBytes(0), m_requestedBytes(0), m_peakAllocatedBytes(0)
+    {
+    }
+    double HitRate() const { return m_numRequests > 0 ? (double) m_numCacheHits / m_numRequests : 0.0; }
+    // fraction of the handed-out bytes that is lost to rounding up to bucket sizes
+    double Fragmentation() const { return m_allocatedBytes > 0 ? 1.0 - (double) m_requestedBytes / m_allocatedBytes : 0.0; }
+};
+
 class MATH_API TracingGPUMemoryAllocator
 {
 private:
     static int m_traceLevel;
+    static bool m_cachingEnabled;
 
 public:
     static void SetTraceLevel(int traceLevel);
     static bool IsTraceEnabled();
 
+    // Freed device buffers are kept in size-bucketed free lists per device and stream, and reused by
+    // later allocations of the same bucket, instead of calling cudaFree()/cudaMalloc() every time.
+    static void SetCachingEnabled(bool enabled);
+    static bool IsCachingEnabled();
+    static void EmptyCache(int deviceId); // return all cached buffers of a device to CUDA
+    static GPUMemoryCacheStatistics GetCacheStatistics(int deviceId);
+    static void ResetPeakAllocatedBytes(int deviceId); // restart the high-water mark from the bytes currently in use
+    static void PrintCacheStatistics(int deviceId);
+    static std::pair<size_t, size_t> GetFreeAndTotalMemoryInMBs(int deviceId); // ({0, 0} if unknown)
+
     template <typename AllocatedElemType>
     static AllocatedElemType* Allocate(int deviceId, size_t numRows, size_t numCols);
 
@@ -61,8 +103,98 @@ public:
 private:
     template <typename AllocatedElemType>
     static AllocatedElemType* AllocateNoTrace(int deviceId, size_t numElements);
+};
 
-    static std::pair<size_t, size_t> GetFreeAndTotalMemoryInMBs(int deviceId);
+// -----------------------------------------------------------------------
+// ConcurrentStreams -- a small pool of CUDA streams for overlapping independent work on one device
+// Fork() makes all streams of the pool wait for the work issued so far on the current stream (GetStream()),
+// Select(i) directs all following GPU calls of this thread to stream i % GetNumStreams(),
+// and Join() makes the original stream wait for all streams of the pool, and selects it again.
+// This is done with events only; none of these calls blocks the CPU.
+// Overlap only happens if the kernels themselves do not synchronize (cf. NO_SYNC in GPUMatrix.cu).
+// -----------------------------------------------------------------------
+
+class MATH_API ConcurrentStreams
+{
+public:
+    ConcurrentStreams(int deviceId, size_t numStreams);
+    ~ConcurrentStreams();
+
+    size_t GetNumStreams() const { return m_streams.size(); }
+    void Fork();
+    void Select(size_t i);
+    void Join();
+
+private:
+    ConcurrentStreams(const ConcurrentStreams&) = delete;
+    void operator=(const ConcurrentStreams&) = delete;
+
+    int m_deviceId;
+    cudaStream_t m_originalStream; // the stream that was current when Fork() was called
+    cudaEvent_t m_forkEvent;
+    std::vector<cudaStream_t> m_streams;
+    std::vector<cudaEvent_t> m_joinEvents;
+};
+
+// -----------------------------------------------------------------------
+// CapturedGPUWork -- the GPU work of a piece of code, recorded once into a CUDA graph and replayed with a single launch
+// Capture() runs 'body' with all GPU calls of this thread directed to a private stream that is being captured, so none of
+// its kernels execute then; on success, it replays the graph once, in place of running 'body'. Each Replay() then issues
+// the same kernels with the same arguments and memory addresses again, without running any CPU code. So it is only correct
+// while 'body' would do exactly the same on the GPU: same shapes, same buffers, no CPU-side state such as random seeds.
+// Capture fails, and returns false without having done any GPU work, if 'body' throws, or calls anything that cannot be
+// captured (e.g. synchronous copies or synchronization, which includes GPUMatrix kernels in builds without NO_SYNC).
+// The caller then has to run 'body' normally. Replays are ordered with the work of the current stream (GetStream()).
+// Requires CUDA 10; otherwise Capture() always fails.
+// -----------------------------------------------------------------------
+
+class MATH_API CapturedGPUWork
+{
+public:
+    CapturedGPUWork(int deviceId);
+    ~CapturedGPUWork();
+
+    bool Capture(const std::function<void()>& body);
+    void Replay();
+    void Reset(); // forget the graph
+    bool IsCaptured() const { return m_graphExec != nullptr; }
+
+private:
+    CapturedGPUWork(const CapturedGPUWork&) = delete;
+    void operator=(const CapturedGPUWork&) = delete;
+
+    int m_deviceId;
+    cudaStream_t m_stream; // captured on, and replayed on
+    cudaEvent_t m_forkEvent, m_joinEvent;
+    cudaGraphExec_t m_graphExec;
+};
+
+// -----------------------------------------------------------------------
+// DeviceTimer -- accumulates how long the work issued between Start() and Stop() takes, over any number of such intervals
+// On a GPU, it records CUDA events on the current stream, so it only blocks the CPU in ElapsedSeconds();
+// on the CPU (deviceId < 0), it reads a steady clock.
+// -----------------------------------------------------------------------
+
+class MATH_API DeviceTimer
+{
+public:
+    DeviceTimer(int deviceId);
+    ~DeviceTimer();
+
+    void Start();
+    void Stop();
+    // total time of the intervals since the last call, after waiting for them to complete
+    double ElapsedSeconds();
+
+private:
+    DeviceTimer(const DeviceTimer&) = delete;
+    void operator=(const DeviceTimer&) = delete;
+
+    int m_deviceId;
+    std::vector<cudaEvent_t> m_events; // interval i is from m_events[2i] to m_events[2i+1]; kept for reuse
+    size_t m_numEventsRecorded;
+    std::chrono::steady_clock::time_point m_cpuStart;
+    double m_cpuSeconds;
 };
 
 // -----------------------------------------------------------------------
@@ -113,6 +245,13 @@ enum ElementWiseOperator
     opElementwiseProductWithLinearRectifierDerivativeFromOutput,
     opElementwiseProductWithLogDerivativeFromOutput,
     opElementwiseProductWithCosDerivative,
+    // binary ops that fuse a unary op onto a binary one, for use by elementwise operator fusion
+    opSigmoidOfSum,
+    opTanhOfSum,
+    opLinearRectifierOfSum,
+    opSigmoidOfElementwiseProduct,
+    opTanhOfElementwiseProduct,
+    opLinearRectifierOfElementwiseProduct,
     // binary ops for indexing
     // opIndex,
     // ternary
@@ -160,13 +299,43 @@ enum ElementWiseOperator
     Macro(ElementwiseProductWithTanhDerivativeFromOutput);            \
     Macro(ElementwiseProductWithLinearRectifierDerivativeFromOutput); \
     Macro(ElementwiseProductWithLogDerivativeFromOutput);             \
-    Macro(ElementwiseProductWithCosDerivative); \
+    Macro(ElementwiseProductWithCosDerivative);                       \
+    Macro(SigmoidOfSum);                                              \
+    Macro(TanhOfSum);                                                 \
+    Macro(LinearRectifierOfSum);                                      \
+    Macro(SigmoidOfElementwiseProduct);                               \
+    Macro(TanhOfElementwiseProduct);                                  \
+    Macro(LinearRectifierOfElementwiseProduct);
 //Macro(Index);
 
 #define ForAllTernaryOps(Macro) \
     Macro(Cond);                \
     Macro(Clip);
 
+// all (unary, binary) pairs that have a fused binary opcode op<unary>Of<binary>
+#define ForAllFusedUnaryOfBinaryOps(Macro)        \
+    Macro(Sigmoid, Sum);                          \
+    Macro(Tanh, Sum);                             \
+    Macro(LinearRectifier, Sum);                  \
+    Macro(Sigmoid, ElementwiseProduct);           \
+    Macro(Tanh, ElementwiseProduct);              \
+    Macro(LinearRectifier, ElementwiseProduct);
+
+// look up the fused opcode that computes unaryOp(binaryOp(a, b)) in a single pass
+// Returns false if there is none.
+static inline bool TryGetFusedUnaryOfBinaryOp(ElementWiseOperator unaryOp, ElementWiseOperator binaryOp, ElementWiseOperator& fusedOp)
+{
+#define CaseFusedUnaryOfBinaryOp(unary, binary)                                                   \
+    if (unaryOp == ElementWiseOperator::op##unary && binaryOp == ElementWiseOperator::op##binary) \
+    {                                                                                             \
+        fusedOp = ElementWiseOperator::op##unary##Of##binary;                                     \
+        return true;                                                                              \
+    }
+    ForAllFusedUnaryOfBinaryOps(CaseFusedUnaryOfBinaryOp);
+#undef CaseFusedUnaryOfBinaryOp
+    return false;
+}
+
 // -----------------------------------------------------------------------
 // various enums to describe
 // -----------------------------------------------------------------------
@@ -206,6 +375,74 @@ enum MatrixFlags
     matrixFlagSetValueOnDevice = 1 << bitPosSetValueOnDevice, // SetValue() call has a buffer that is already on the device
 };
 
+// -----------------------------------------------------------------------
+// ImageAugmentationDesc -- one image in the input of Matrix::AssignAugmentedImagesOf()
+// The input is a byte buffer that starts with one of these per image, followed by the 8-bit pixels
+// they refer to, stored the way OpenCV does (rows of interleaved channels, e.g. BGR).
+// -----------------------------------------------------------------------
+
+struct ImageAugmentationDesc
+{
+    uint64_t offset; // of the first pixel, in bytes from the start of the buffer
+    int32_t rows;
+    int32_t cols;
+    int32_t flip; // nonzero: mirror horizontally
+    int32_t reserved;
+};
+
+// -----------------------------------------------------------------------
+// MultiTensorUpdateDesc -- hyper-parameters of Matrix::MultiTensorNormalGrad()
+// That is the fused form of what SGD::UpdateWeightsS() does for the 'None' update type step by
+// step: gradient clipping, L2 regularization, NormalGrad() and the L1 soft threshold.
+// -----------------------------------------------------------------------
+
+struct MultiTensorUpdateDesc
+{
+    double learnRatePerSample;
+    double momentum; // per minibatch
+    bool useNesterovMomentum;
+    double L2RegWeight;           // already multiplied by the minibatch size
+    double L1Threshold;           // learnRatePerSample * L1RegWeight * minibatch size; 0 for none
+    double clippingThreshold;     // per minibatch; infinity for no clipping
+    bool clippingWithTruncation;  // clip each element rather than the Frobenius norm of each tensor
+    bool clippingByGlobalNorm;    // (norm clipping) clip by the norm of all gradients together rather than of each tensor
+};
+
+// -----------------------------------------------------------------------
+// NumaMemoryPolicy -- where the pages of newly allocated CPU matrices go on a NUMA machine
+//  - none: the OS default, i.e. all on the node of the allocating (main) thread, which zeroes them
+//  - firstTouch: zeroed by the OpenMP workers, so each page lives with the thread that later works on it
+//  - interleave: spread round-robin over all nodes (Linux only; elsewhere same as firstTouch)
+// -----------------------------------------------------------------------
+
+enum class NumaMemoryPolicy
+{
+    none,
+    firstTouch,
+    interleave
+};
+
+static inline NumaMemoryPolicy ParseNumaMemoryPolicy(const std::wstring& s)
+{
+    if (s == L"none")
+        return NumaMemoryPolicy::none;
+    else if (s == L"firstTouch")
+        return NumaMemoryPolicy::firstTouch;
+    else if (s == L"interleave")
+        return NumaMemoryPolicy::interleave;
+    InvalidArgument("Unknown numaMemoryPolicy '%ls'. Must be one of none, firstTouch, interleave.", s.c_str());
+}
+
+// -----------------------------------------------------------------------
+// AllocateMatrixObject(), FreeMatrixObject() -- heap storage for the CPU/GPU matrix objects (not their elements)
+// Every Matrix::ColumnSlice() and TensorView creates such an object on the heap. In recurrent loops, where each node
+// slices its inputs and outputs once per time step, that adds up to many small allocations per step. Their storage
+// is recycled through per-thread free lists instead, so that after the first step slicing does not touch the heap.
+// -----------------------------------------------------------------------
+
+MATH_API void* AllocateMatrixObject(size_t size);
+MATH_API void FreeMatrixObject(void* p, size_t size);
+
 // -----------------------------------------------------------------------
 // BaseMatrix -- base class for all matrix types (CPU, GPU) x (dense, sparse)
 // -----------------------------------------------------------------------
@@ -295,6 +532,16 @@ public:
         }
     }
 
+    // (objects are always deleted through their own type, so 'size' is that of the object)
+    static void* operator new(size_t size)
+    {
+        return AllocateMatrixObject(size);
+    }
+    static void operator delete(void* p, size_t size)
+    {
+        FreeMatrixObject(p, size);
+    }
+
     BaseMatrix()
     {
         m_numRows = m_numCols = m_elemSizeAllocated = 0;
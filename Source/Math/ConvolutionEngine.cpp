@@ -6,9 +6,392 @@
 #include "stdafx.h"
 #include "ConvolutionEngine.h"
 #include "CuDnnConvolutionEngine.h"
+#include <complex>
+#include <vector>
+#include <math.h>
+#include <omp.h>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// CPU kernels for stride-1 convolutions, used by the legacy engine instead of unpacking + GEMM where they apply.
+// All work on the legacy HWC layout: element (channel, row, col) of a sample is at channel + (row + col * height) * channels,
+// and the filter is a [outC x (inC * kH * kW)] matrix with element (k, c, kRow, kCol) in column c * kH * kW + kRow + kCol * kH.
+//   out(k, row, col) = sum_{c, kRow, kCol} filter(k, c, kRow, kCol) * in(c, row + kRow - padH, col + kCol - padW)
+// where the input is zero outside its bounds.
+// -----------------------------------------------------------------------
+
+enum class DefaultConvolutionAlgorithm
+{
+    Unpack,   // AssignPackedConvolutionInput() + GEMM, works for everything
+    Gemm,     // 1x1 kernels with stride 1: in HWC, the input of a minibatch is a [inC x pixels] matrix already, so a single GEMM without unpacking
+    Winograd, // F(2x2, 3x3): 2.25x fewer multiplications than the direct method, and a smaller workspace than unpacking
+    Fft       // cost does not depend on the kernel size, so it pays off for large kernels only
+};
+
+// FFT is chosen for stride-1 kernels with at least this many elements (7x7)
+static const size_t FftConvolutionMinKernelSize = 49;
+
+// added to the variance in batch normalization, the same as CUDNN_BN_MIN_EPSILON of the cuDNN engine
+static const double BatchNormEpsilon = 1e-5;
+
+template <class ElemType>
+static bool IsDenseOnCpu(const Matrix<ElemType>& m)
+{
+    return m.GetMatrixType() == MatrixType::DENSE && m.GetCurrentMatrixLocation() == CurrentDataLocation::CPU;
+}
+
+struct StrideOneConvolutionGeometry
+{
+    size_t inC, inH, inW;
+    size_t outC, outH, outW;
+    size_t kH, kW;
+    long padH, padW; // input row = output row + kernel row - padH
+};
+
+template <class ElemType>
+class StrideOneConvolutionKernel
+{
+public:
+    virtual ~StrideOneConvolutionKernel() = default;
+    virtual DefaultConvolutionAlgorithm Algorithm() const = 0;
+    // transform the filter (in the layout above) for subsequent Convolve() calls
+    virtual void SetFilter(const ElemType* filter, const StrideOneConvolutionGeometry& g) = 0;
+    // out = filter * in (or out += filter * in) for numSamples consecutive samples
+    virtual void Convolve(const ElemType* in, ElemType* out, size_t numSamples, bool accumulate) = 0;
+
+protected:
+    StrideOneConvolutionGeometry m_g;
+};
+
+// Winograd F(2x2, 3x3), see Lavin and Gray, "Fast Algorithms for Convolutional Neural Networks".
+// Each 2x2 output tile is Y = A' [(G g G') .* (B' d B)] A, where d is the 4x4 input tile and g the 3x3 filter.
+// The 16 elementwise products, summed over the input channels, are 16 independent GEMMs [outC x inC] * [inC x numTiles].
+template <class ElemType>
+class WinogradConvolution : public StrideOneConvolutionKernel<ElemType>
+{
+    using StrideOneConvolutionKernel<ElemType>::m_g;
+
+public:
+    WinogradConvolution()
+        : m_U(CPUDEVICE), m_V(CPUDEVICE), m_M(CPUDEVICE)
+    {
+    }
+
+    DefaultConvolutionAlgorithm Algorithm() const override
+    {
+        return DefaultConvolutionAlgorithm::Winograd;
+    }
+
+    void SetFilter(const ElemType* filter, const StrideOneConvolutionGeometry& g) override
+    {
+        assert(g.kH == 3 && g.kW == 3);
+        m_g = g;
+        const size_t K = g.outC;
+        const size_t C = g.inC;
+        m_U.Resize(K, 16 * C);
+        ElemType* pU = m_U.BufferPointer();
+#pragma omp parallel for
+        for (long kc = 0; kc < (long) (K * C); kc++)
+        {
+            const size_t k = kc % K;
+            const size_t c = kc / K;
+            ElemType f[3][3];
+            for (size_t r = 0; r < 3; r++)
+                for (size_t s = 0; s < 3; s++)
+                    f[r][s] = filter[k + (c * 9 + r + s * 3) * K];
+            ElemType t[4][3]; // G g
+            for (size_t s = 0; s < 3; s++)
+            {
+                t[0][s] = f[0][s];
+                t[1][s] = (f[0][s] + f[1][s] + f[2][s]) / 2;
+                t[2][s] = (f[0][s] - f[1][s] + f[2][s]) / 2;
+                t[3][s] = f[2][s];
+            }
+            for (size_t a = 0; a < 4; a++) // (G g) G'
+            {
+                const ElemType u[4] = {t[a][0], (t[a][0] + t[a][1] + t[a][2]) / 2, (t[a][0] - t[a][1] + t[a][2]) / 2, t[a][2]};
+                for (size_t b = 0; b < 4; b++)
+                    pU[((a * 4 + b) * C + c) * K + k] = u[b]; // block a * 4 + b is [K x C]
+            }
+        }
+    }
+
+    void Convolve(const ElemType* in, ElemType* out, size_t numSamples, bool accumulate) override
+    {
+        const size_t K = m_g.outC;
+        const size_t C = m_g.inC;
+        const size_t inDim = m_g.inC * m_g.inH * m_g.inW;
+        const size_t outDim = m_g.outC * m_g.outH * m_g.outW;
+        const size_t tilesH = (m_g.outH + 1) / 2;
+        const size_t tilesPerSample = tilesH * ((m_g.outW + 1) / 2);
+        const size_t numTiles = tilesPerSample * numSamples;
+
+        // input transform, block a * 4 + b of m_V is [C x numTiles]
+        m_V.Resize(C, 16 * numTiles);
+        ElemType* pV = m_V.BufferPointer();
+#pragma omp parallel for
+        for (long t = 0; t < (long) numTiles; t++)
+        {
+            const size_t tile = t % tilesPerSample;
+            const long row0 = (long) (2 * (tile % tilesH)) - m_g.padH;
+            const long col0 = (long) (2 * (tile / tilesH)) - m_g.padW;
+            const ElemType* sample = in + (t / tilesPerSample) * inDim;
+            const ElemType* d[16]; // channel vectors of the tile, nullptr where it is outside of the input
+            for (long a = 0; a < 4; a++)
+                for (long b = 0; b < 4; b++)
+                {
+                    const long row = row0 + a;
+                    const long col = col0 + b;
+                    bool inside = row >= 0 && row < (long) m_g.inH && col >= 0 && col < (long) m_g.inW;
+                    d[a * 4 + b] = inside ? sample + (row + col * m_g.inH) * C : nullptr;
+                }
+            for (size_t c = 0; c < C; c++)
+            {
+                ElemType x[4][4];
+                for (size_t i = 0; i < 16; i++)
+                    x[i / 4][i % 4] = d[i] ? d[i][c] : 0;
+                ElemType y[4][4]; // B' d
+                for (size_t b = 0; b < 4; b++)
+                {
+                    y[0][b] = x[0][b] - x[2][b];
+                    y[1][b] = x[1][b] + x[2][b];
+                    y[2][b] = x[2][b] - x[1][b];
+                    y[3][b] = x[1][b] - x[3][b];
+                }
+                for (size_t a = 0; a < 4; a++) // (B' d) B
+                {
+                    const ElemType v[4] = {y[a][0] - y[a][2], y[a][1] + y[a][2], y[a][2] - y[a][1], y[a][1] - y[a][3]};
+                    for (size_t b = 0; b < 4; b++)
+                        pV[((a * 4 + b) * numTiles + t) * C + c] = v[b];
+                }
+            }
+        }
+
+        Matrix<ElemType>::BatchMultiplyAndWeightedAdd(1, m_U, false, m_V, false, 0, m_M, 16);
+
+        // output transform
+        const ElemType* pM = m_M.BufferPointer();
+#pragma omp parallel for
+        for (long t = 0; t < (long) numTiles; t++)
+        {
+            const size_t tile = t % tilesPerSample;
+            const size_t row0 = 2 * (tile % tilesH);
+            const size_t col0 = 2 * (tile / tilesH);
+            ElemType* sample = out + (t / tilesPerSample) * outDim;
+            ElemType* o[2][2]; // nullptr where the tile extends beyond the output
+            for (size_t i = 0; i < 2; i++)
+                for (size_t j = 0; j < 2; j++)
+                    o[i][j] = row0 + i < m_g.outH && col0 + j < m_g.outW ? sample + (row0 + i + (col0 + j) * m_g.outH) * K : nullptr;
+            for (size_t k = 0; k < K; k++)
+            {
+                ElemType m[4][4];
+                for (size_t i = 0; i < 16; i++)
+                    m[i / 4][i % 4] = pM[(i * numTiles + t) * K + k];
+                ElemType s[2][4]; // A' m
+                for (size_t b = 0; b < 4; b++)
+                {
+                    s[0][b] = m[0][b] + m[1][b] + m[2][b];
+                    s[1][b] = m[1][b] - m[2][b] - m[3][b];
+                }
+                for (size_t i = 0; i < 2; i++) // (A' m) A
+                {
+                    const ElemType y[2] = {s[i][0] + s[i][1] + s[i][2], s[i][1] - s[i][2] - s[i][3]};
+                    for (size_t j = 0; j < 2; j++)
+                    {
+                        if (o[i][j])
+                            o[i][j][k] = accumulate ? o[i][j][k] + y[j] : y[j];
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    Matrix<ElemType> m_U; // transformed filter, 16 blocks of [outC x inC]
+    Matrix<ElemType> m_V; // transformed input tiles, 16 blocks of [inC x numTiles]
+    Matrix<ElemType> m_M; // products, 16 blocks of [outC x numTiles]
+};
+
+// Convolution as an elementwise product of 2D spectra. The planes are zero-padded to powers of two
+// no smaller than outSize + kernelSize - 1, so that the circular correlation equals the linear one.
+template <class ElemType>
+class FftConvolution : public StrideOneConvolutionKernel<ElemType>
+{
+    using StrideOneConvolutionKernel<ElemType>::m_g;
+    typedef std::complex<ElemType> Complex;
+
+public:
+    DefaultConvolutionAlgorithm Algorithm() const override
+    {
+        return DefaultConvolutionAlgorithm::Fft;
+    }
+
+    void SetFilter(const ElemType* filter, const StrideOneConvolutionGeometry& g) override
+    {
+        m_g = g;
+        m_P = NextPowerOfTwo(g.outH + g.kH - 1);
+        m_Q = NextPowerOfTwo(g.outW + g.kW - 1);
+        const size_t K = g.outC;
+        const size_t C = g.inC;
+        const size_t planeSize = m_P * m_Q;
+        m_filterSpectra.assign(K * C * planeSize, Complex(0));
+#pragma omp parallel for
+        for (long kc = 0; kc < (long) (K * C); kc++)
+        {
+            const size_t k = kc / C;
+            const size_t c = kc % C;
+            Complex* plane = m_filterSpectra.data() + kc * planeSize; // planes for the same k are adjacent
+            for (size_t s = 0; s < g.kW; s++)
+                for (size_t r = 0; r < g.kH; r++)
+                    plane[r + s * m_P] = filter[k + (c * g.kH * g.kW + r + s * g.kH) * K];
+            Fft2D(plane, false);
+        }
+    }
+
+    void Convolve(const ElemType* in, ElemType* out, size_t numSamples, bool accumulate) override
+    {
+        const size_t K = m_g.outC;
+        const size_t C = m_g.inC;
+        const size_t inDim = m_g.inC * m_g.inH * m_g.inW;
+        const size_t outDim = m_g.outC * m_g.outH * m_g.outW;
+        const size_t planeSize = m_P * m_Q;
+        const long extentH = (long) (m_g.outH + m_g.kH - 1); // input rows and columns that contribute to the output
+        const long extentW = (long) (m_g.outW + m_g.kW - 1);
+
+        m_inputSpectra.assign(numSamples * C * planeSize, Complex(0));
+#pragma omp parallel for
+        for (long nc = 0; nc < (long) (numSamples * C); nc++)
+        {
+            const ElemType* sample = in + (nc / C) * inDim + (nc % C);
+            Complex* plane = m_inputSpectra.data() + nc * planeSize;
+            for (long col = 0; col < (long) m_g.inW; col++)
+            {
+                const long j = col + m_g.padW;
+                if (j < 0 || j >= extentW)
+                    continue;
+                for (long row = 0; row < (long) m_g.inH; row++)
+                {
+                    const long i = row + m_g.padH;
+                    if (i >= 0 && i < extentH)
+                        plane[i + j * m_P] = sample[(row + col * m_g.inH) * C];
+                }
+            }
+            Fft2D(plane, false);
+        }
+
+        const ElemType scale = (ElemType) 1 / planeSize;
+#pragma omp parallel for
+        for (long nk = 0; nk < (long) (numSamples * K); nk++)
+        {
+            const size_t n = nk / K;
+            const size_t k = nk % K;
+            std::vector<Complex> product(planeSize, Complex(0));
+            for (size_t c = 0; c < C; c++)
+            {
+                const Complex* x = m_inputSpectra.data() + (n * C + c) * planeSize;
+                const Complex* f = m_filterSpectra.data() + (k * C + c) * planeSize;
+                for (size_t i = 0; i < planeSize; i++)
+                    product[i] += x[i] * std::conj(f[i]); // conj() makes this a correlation
+            }
+            Fft2D(product.data(), true);
+            ElemType* sample = out + n * outDim + k;
+            for (size_t col = 0; col < m_g.outW; col++)
+                for (size_t row = 0; row < m_g.outH; row++)
+                {
+                    ElemType& o = sample[(row + col * m_g.outH) * K];
+                    const ElemType value = product[row + col * m_P].real() * scale;
+                    o = accumulate ? o + value : value;
+                }
+        }
+    }
+
+private:
+    static size_t NextPowerOfTwo(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p *= 2;
+        return p;
+    }
+
+    // unnormalized in-place 2D FFT of a column-major [m_P x m_Q] plane
+    void Fft2D(Complex* plane, bool inverse) const
+    {
+        for (size_t s = 0; s < m_Q; s++)
+            Fft(plane + s * m_P, m_P, 1, inverse);
+        for (size_t r = 0; r < m_P; r++)
+            Fft(plane + r, m_Q, m_P, inverse);
+    }
+
+    // iterative radix-2 FFT of n (a power of two) elements with the given stride
+    static void Fft(Complex* data, size_t n, size_t stride, bool inverse)
+    {
+        for (size_t i = 1, j = 0; i < n; i++) // bit-reversal permutation
+        {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i * stride], data[j * stride]);
+        }
+        const double pi = 3.14159265358979323846;
+        for (size_t len = 2; len <= n; len *= 2)
+        {
+            const double angle = (inverse ? 2 : -2) * pi / len;
+            const std::complex<double> step(cos(angle), sin(angle)); // twiddles in double, they are accumulated
+            for (size_t i = 0; i < n; i += len)
+            {
+                std::complex<double> w(1);
+                for (size_t j = 0; j < len / 2; j++, w *= step)
+                {
+                    Complex& a = data[(i + j) * stride];
+                    Complex& b = data[(i + j + len / 2) * stride];
+                    const Complex v = b * Complex((ElemType) w.real(), (ElemType) w.imag());
+                    b = a - v;
+                    a += v;
+                }
+            }
+        }
+    }
+
+    size_t m_P, m_Q;                     // padded plane height and width
+    std::vector<Complex> m_filterSpectra; // [outC x inC] planes
+    std::vector<Complex> m_inputSpectra;  // [numSamples x inC] planes
+};
+
+// ConvolutionDescriptor of the legacy engine, which also records the algorithm for stride-1 convolutions on the CPU
+class DefaultConvolutionDescriptor : public ConvolutionDescriptor
+{
+public:
+    DefaultConvolutionDescriptor(const ConvolutionFilter& filterT, size_t wStride, size_t hStride, bool padding)
+        : ConvolutionDescriptor(wStride, hStride, padding), m_algorithm(ChooseAlgorithm(filterT, wStride, hStride))
+    {
+    }
+
+    DefaultConvolutionAlgorithm algorithm() const
+    {
+        return m_algorithm;
+    }
+
+private:
+    static DefaultConvolutionAlgorithm ChooseAlgorithm(const ConvolutionFilter& filterT, size_t wStride, size_t hStride)
+    {
+        if (wStride != 1 || hStride != 1)
+            return DefaultConvolutionAlgorithm::Unpack;
+        if (filterT.w() == 1 && filterT.h() == 1)
+            return DefaultConvolutionAlgorithm::Gemm;
+        if (filterT.w() == 3 && filterT.h() == 3)
+            return DefaultConvolutionAlgorithm::Winograd;
+        if (filterT.w() * filterT.h() >= FftConvolutionMinKernelSize)
+            return DefaultConvolutionAlgorithm::Fft;
+        return DefaultConvolutionAlgorithm::Unpack;
+    }
+
+    DefaultConvolutionAlgorithm m_algorithm;
+};
+
 template <class ElemType>
 class DefaultConvolutionEngine : public ConvolutionEngine<ElemType>
 {
@@ -21,7 +404,7 @@ public:
 
 public:
     DefaultConvolutionEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples)
-        : m_ones(deviceId), m_maxTempMemSizeInSamples(maxTempMemSizeInSamples)
+        : m_ones(deviceId), m_maxTempMemSizeInSamples(maxTempMemSizeInSamples), m_gpuSparseOpt(false), m_gpuSparse1D(false), m_workspaceHasPackedInput(false)
     {
     }
 
@@ -56,6 +439,29 @@ public:
                           in.GetMatrixType() == MatrixType::SPARSE);
         m_gpuSparse1D = (m_gpuSparseOpt && inT.h() == 1);
 
+        DefaultConvolutionAlgorithm algorithm = FastAlgorithm(convDesc, in, filter, out);
+        if (algorithm == DefaultConvolutionAlgorithm::Gemm)
+        {
+            // out [outC x (pixels * N)] = filter [outC x inC] * in [inC x (pixels * N)]
+            Mat outAsPixels = out.Reshaped(outT.c(), outT.w() * outT.h() * batchSize);
+            Mat::Multiply(filter, false, in.Reshaped(inT.c(), inT.w() * inT.h() * batchSize), false, outAsPixels);
+            m_workspaceHasPackedInput = false;
+            return;
+        }
+        if (algorithm != DefaultConvolutionAlgorithm::Unpack)
+        {
+            StrideOneConvolutionGeometry g = {inT.c(), inT.h(), inT.w(), outT.c(), outT.h(), outT.w(), filterT.h(), filterT.w(),
+                                              convDesc.padding() ? (long) filterT.h() / 2 : 0, convDesc.padding() ? (long) filterT.w() / 2 : 0};
+            StrideOneConvolutionKernel<ElemType>* kernel = GetKernel(m_forwardKernel, algorithm);
+            kernel->SetFilter(filter.BufferPointer(), g);
+            ForEachSubBatch(batchSize, maxTempMemSizeInSamples, [&](size_t startSampleId, size_t smallBatchSize)
+                            {
+                                kernel->Convolve(in.BufferPointer() + startSampleId * in.GetNumRows(), out.BufferPointer() + startSampleId * out.GetNumRows(), smallBatchSize, false);
+                            });
+            m_workspaceHasPackedInput = false;
+            return;
+        }
+
         out.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
 
         // Reshaping is only necessary if we are going to use the unpacking trick
@@ -111,6 +517,7 @@ public:
         }
 
         out.Reshape(outT.c() * outputSizePerChannel, batchSize); // each sample becomes a column
+        m_workspaceHasPackedInput = !m_gpuSparseOpt;
 
         assert(outT.w() * outT.h() * outT.c() == out.GetNumRows());
         assert(outT.n() == out.GetNumCols());
@@ -138,12 +545,49 @@ public:
 
         size_t maxTempMemSizeInSamples = (m_maxTempMemSizeInSamples == 0 ? batchSize : m_maxTempMemSizeInSamples);
 
+        // Stride 1: the input gradient is a convolution of the output gradient with the flipped filter, with input and output channels swapped.
+        DefaultConvolutionAlgorithm algorithm = FastAlgorithm(convDesc, srcGrad, filter, grad);
+        if (algorithm == DefaultConvolutionAlgorithm::Gemm)
+        {
+            // grad [inC x (pixels * N)] += filter' * srcGrad [outC x (pixels * N)]
+            Mat gradAsPixels = grad.Reshaped(gradT.c(), gradT.w() * gradT.h() * batchSize);
+            Mat::MultiplyAndAdd(filter, true, srcGrad.Reshaped(srcGradT.c(), srcGradT.w() * srcGradT.h() * batchSize), false, gradAsPixels);
+            return;
+        }
+        if (algorithm != DefaultConvolutionAlgorithm::Unpack)
+        {
+            const size_t kH = filterT.h();
+            const size_t kW = filterT.w();
+            const long padH = convDesc.padding() ? (long) kH / 2 : 0;
+            const long padW = convDesc.padding() ? (long) kW / 2 : 0;
+            StrideOneConvolutionGeometry g = {srcGradT.c(), srcGradT.h(), srcGradT.w(), gradT.c(), gradT.h(), gradT.w(), kH, kW,
+                                              (long) kH - 1 - padH, (long) kW - 1 - padW};
+            const size_t K = filterT.k();
+            const size_t C = filterT.c();
+            const ElemType* pFilter = filter.BufferPointer();
+            m_flippedFilter.resize(K * C * kH * kW);
+            for (size_t k = 0; k < K; k++)
+                for (size_t c = 0; c < C; c++)
+                    for (size_t s = 0; s < kW; s++)
+                        for (size_t r = 0; r < kH; r++)
+                            m_flippedFilter[c + (k * kH * kW + r + s * kH) * C] = pFilter[k + (c * kH * kW + (kH - 1 - r) + (kW - 1 - s) * kH) * K];
+            StrideOneConvolutionKernel<ElemType>* kernel = GetKernel(m_backwardDataKernel, algorithm);
+            kernel->SetFilter(m_flippedFilter.data(), g);
+            ForEachSubBatch(batchSize, maxTempMemSizeInSamples, [&](size_t startSampleId, size_t smallBatchSize)
+                            {
+                                // accumulate, like UnpackConvolutionInput() does
+                                kernel->Convolve(srcGrad.BufferPointer() + startSampleId * srcGrad.GetNumRows(), grad.BufferPointer() + startSampleId * grad.GetNumRows(), smallBatchSize, true);
+                            });
+            return;
+        }
+
         // Create slice which is the same as full matrix so we can reshape it.
         Matrix<ElemType> srcGradTmp = srcGrad.ColumnSlice(0, srcGrad.GetNumCols());
         srcGradTmp.Reshape(srcGradT.c(), outputSizePerChannel * batchSize); // reshape to match the longernal operation
 
         size_t subBatchSize = min(batchSize, maxTempMemSizeInSamples);
         size_t numSubBatches = (batchSize + subBatchSize - 1) / subBatchSize;
+        m_workspaceHasPackedInput = false; // the workspace is overwritten below
 
         for (size_t i = 0; i < numSubBatches; i++)
         {
@@ -189,6 +633,14 @@ public:
 
         size_t maxTempMemSizeInSamples = (m_maxTempMemSizeInSamples == 0 ? batchSize : m_maxTempMemSizeInSamples);
 
+        if (FastAlgorithm(convDesc, in, filter, srcGrad) == DefaultConvolutionAlgorithm::Gemm)
+        {
+            // filter [outC x inC] += srcGrad [outC x (pixels * N)] * in' [(pixels * N) x inC]
+            Mat::MultiplyAndAdd(srcGrad.Reshaped(srcGradT.c(), srcGradT.w() * srcGradT.h() * batchSize), false,
+                                in.Reshaped(inT.c(), inT.w() * inT.h() * batchSize), true, filter);
+            return;
+        }
+
         // const Matrix<ElemType> & weightMatrix = input0;
         // inputGradientValues.Resize(weightMatrix.GetNumRows(), weightMatrix.GetNumCols()); // should have been resized when preparing gradient computation
 
@@ -199,7 +651,7 @@ public:
         size_t subBatchSize = min(batchSize, maxTempMemSizeInSamples);
         size_t numSubBatches = (batchSize + subBatchSize - 1) / subBatchSize;
 
-        if (numSubBatches == 1 && allowReuse && !m_gpuSparseOpt) // reuse packed input from evaluation step if it's not changed by either subbatch or recurrent steps.
+        if (numSubBatches == 1 && allowReuse && !m_gpuSparseOpt && m_workspaceHasPackedInput) // reuse packed input from evaluation step if it's not changed by either subbatch or recurrent steps.
             // REVIEW alexeyk: the following makes an assumption that data in workspace was filled by Forward call and remained unchanged. Find way to enforce/verify that.
             Matrix<ElemType>::MultiplyAndAdd(srcGradTmp, false, workspace, true, filter);
         else
@@ -283,55 +735,368 @@ public:
         Mat::MultiplyAndAdd(sg.Reshaped(biasT.c(), ccol), false, m_ones, false, biasGrad);
     }
 
-    void NormalizeBatch(const Tensor4D& inT, const Mat& in, const Tensor4D& scaleBiasT, const Mat& scale, const Mat& bias,
+    // one pass over the values for the statistics (see ComputeBatchMoments()), and one that normalizes them; the running averages
+    // are updated along with the latter
+    void NormalizeBatch(const Tensor4D& inT, const Mat& in, const Tensor4D& /*scaleBiasT*/, const Mat& scale, const Mat& bias,
                         bool spatial, double expAvgFactor, Mat& runMean, Mat& runInvStdDev, Mat& out, Mat& saveMean, Mat& saveInvStdDev) override
     {
-        UNUSED(inT);
-        UNUSED(in);
-        UNUSED(scaleBiasT);
-        UNUSED(scale);
-        UNUSED(bias);
-        UNUSED(out);
-        UNUSED(spatial);
-        UNUSED(expAvgFactor);
-        UNUSED(runMean);
-        UNUSED(runInvStdDev);
-        UNUSED(saveMean);
-        UNUSED(saveInvStdDev);
-        RuntimeError("Not yet implemented.");
-    }
-
-    void NormalizeBatchInference(const Tensor4D& inT, const Mat& in, const Tensor4D& scaleBiasT, const Mat& scale, const Mat& bias,
+        BatchNormGeometry g(inT, spatial);
+        VerifyBatchNormMatrices({&in, &scale, &bias, &runMean, &runInvStdDev, &out, &saveMean, &saveInvStdDev});
+        assert(runMean.GetNumElements() == g.numChannels && runInvStdDev.GetNumElements() == g.numChannels);
+        assert(out.GetNumRows() == in.GetNumRows() && out.GetNumCols() == in.GetNumCols());
+        assert(saveMean.GetNumElements() >= g.numChannels && saveInvStdDev.GetNumElements() >= g.numChannels);
+        const ElemType* x = in.BufferPointer();
+        ElemType* y = out.BufferPointer();
+        const ElemType* pScale = scale.BufferPointer();
+        const ElemType* pBias = bias.BufferPointer();
+        ElemType* pRunMean = runMean.BufferPointer();
+        ElemType* pRunInvStdDev = runInvStdDev.BufferPointer();
+        ElemType* pSaveMean = saveMean.BufferPointer();
+        ElemType* pSaveInvStdDev = saveInvStdDev.BufferPointer();
+
+        ComputeBatchMoments(g, x, m_batchNormMean, m_batchNormVariance);
+        m_batchNormScale.resize(g.numChannels);
+        m_batchNormShift.resize(g.numChannels);
+        for (size_t c = 0; c < g.numChannels; c++)
+        {
+            const double mean = m_batchNormMean[c];
+            const double invStdDev = 1 / sqrt(m_batchNormVariance[c] + BatchNormEpsilon);
+            m_batchNormScale[c] = (ElemType) (pScale[c] * invStdDev);
+            m_batchNormShift[c] = (ElemType) (pBias[c] - mean * m_batchNormScale[c]);
+            pSaveMean[c] = (ElemType) mean;
+            pSaveInvStdDev[c] = (ElemType) invStdDev;
+            pRunMean[c] = (ElemType) ((1 - expAvgFactor) * pRunMean[c] + expAvgFactor * mean);
+            pRunInvStdDev[c] = (ElemType) ((1 - expAvgFactor) * pRunInvStdDev[c] + expAvgFactor * invStdDev);
+        }
+        ApplyChannelAffine(g, x, m_batchNormScale.data(), m_batchNormShift.data(), y);
+    }
+
+    void NormalizeBatchInference(const Tensor4D& inT, const Mat& in, const Tensor4D& /*scaleBiasT*/, const Mat& scale, const Mat& bias,
                                  bool spatial, const Mat& runMean, const Mat& runInvStdDev, Mat& out) override
     {
-        UNUSED(inT);
-        UNUSED(in);
-        UNUSED(scaleBiasT);
-        UNUSED(scale);
-        UNUSED(bias);
-        UNUSED(out);
-        UNUSED(spatial);
-        UNUSED(runMean);
-        UNUSED(runInvStdDev);
-        RuntimeError("Not yet implemented.");
+        BatchNormGeometry g(inT, spatial);
+        VerifyBatchNormMatrices({&in, &scale, &bias, &runMean, &runInvStdDev, &out});
+        assert(runMean.GetNumElements() == g.numChannels && runInvStdDev.GetNumElements() == g.numChannels);
+        assert(out.GetNumRows() == in.GetNumRows() && out.GetNumCols() == in.GetNumCols());
+        const ElemType* pScale = scale.BufferPointer();
+        const ElemType* pBias = bias.BufferPointer();
+        const ElemType* pRunMean = runMean.BufferPointer();
+        const ElemType* pRunInvStdDev = runInvStdDev.BufferPointer();
+        m_batchNormScale.resize(g.numChannels);
+        m_batchNormShift.resize(g.numChannels);
+        for (size_t c = 0; c < g.numChannels; c++)
+        {
+            m_batchNormScale[c] = pScale[c] * pRunInvStdDev[c];
+            m_batchNormShift[c] = pBias[c] - pRunMean[c] * m_batchNormScale[c];
+        }
+        ApplyChannelAffine(g, in.BufferPointer(), m_batchNormScale.data(), m_batchNormShift.data(), out.BufferPointer());
     }
 
+    // grad += dL/dx; scaleGrad and biasGrad are overwritten, as with cuDNN
+    // One pass over x and dy for the sums of each channel, and one for dx.
     void BackwardNormalizeBatch(const Tensor4D& inT, const Mat& in, const Mat& srcGrad, Mat& grad,
-                                const Tensor4D& scaleBiasT, const Mat& scale, bool spatial, const Mat& saveMean, const Mat& saveInvStdDev,
+                                const Tensor4D& /*scaleBiasT*/, const Mat& scale, bool spatial, const Mat& saveMean, const Mat& saveInvStdDev,
                                 Mat& scaleGrad, Mat& biasGrad) override
     {
-        UNUSED(inT);
-        UNUSED(in);
-        UNUSED(srcGrad);
-        UNUSED(grad);
-        UNUSED(scaleBiasT);
-        UNUSED(scale);
-        UNUSED(scaleGrad);
-        UNUSED(biasGrad);
-        UNUSED(spatial);
-        UNUSED(saveMean);
-        UNUSED(saveInvStdDev);
-        RuntimeError("Not yet implemented.");
+        BatchNormGeometry g(inT, spatial);
+        VerifyBatchNormMatrices({&in, &srcGrad, &grad, &scale, &saveMean, &saveInvStdDev, &scaleGrad, &biasGrad});
+        assert(grad.GetNumRows() == in.GetNumRows() && grad.GetNumCols() == in.GetNumCols());
+        assert(scaleGrad.GetNumElements() == g.numChannels && biasGrad.GetNumElements() == g.numChannels);
+        const ElemType* x = in.BufferPointer();
+        const ElemType* dy = srcGrad.BufferPointer();
+        ElemType* dx = grad.BufferPointer();
+        const ElemType* pScale = scale.BufferPointer();
+        const ElemType* pSaveMean = saveMean.BufferPointer();
+        const ElemType* pSaveInvStdDev = saveInvStdDev.BufferPointer();
+        ElemType* pScaleGrad = scaleGrad.BufferPointer();
+        ElemType* pBiasGrad = biasGrad.BufferPointer();
+        const double count = (double) (g.numSamples * g.numPixels);
+
+        // with xHat = (x - mean) * invStdDev: dBias = sum(dy), dScale = sum(dy * xHat),
+        // dx = scale * invStdDev * (dy - (dBias + xHat * dScale) / count), i.e. a * dy + b * (x - mean) + d for each channel
+        ComputeGradientSums(g, x, dy, pSaveMean, m_batchNormMean, m_batchNormVariance); // sum(dy), sum(dy * (x - mean))
+        m_batchNormScale.resize(g.numChannels);
+        m_batchNormShift.resize(g.numChannels);
+        m_batchNormOffset.resize(g.numChannels);
+        for (size_t c = 0; c < g.numChannels; c++)
+        {
+            const double invStdDev = pSaveInvStdDev[c];
+            const double dBias = m_batchNormMean[c];
+            const double dScale = m_batchNormVariance[c] * invStdDev;
+            pBiasGrad[c] = (ElemType) dBias;
+            pScaleGrad[c] = (ElemType) dScale;
+            const double a = pScale[c] * invStdDev;
+            m_batchNormScale[c] = (ElemType) a;
+            m_batchNormShift[c] = (ElemType) (-a * invStdDev * dScale / count);
+            m_batchNormOffset[c] = (ElemType) (-a * dBias / count);
+        }
+        const ElemType* pa = m_batchNormScale.data();
+        const ElemType* pb = m_batchNormShift.data();
+        const ElemType* pd = m_batchNormOffset.data();
+        ForEachChannelRun(g,
+                          [&](size_t begin, size_t c, size_t length)
+                          {
+                              const ElemType a = pa[c], b = pb[c], d = pd[c], mean = pSaveMean[c];
+                              for (size_t i = begin; i < begin + length; i++)
+                                  dx[i] += a * dy[i] + b * (x[i] - mean) + d;
+                          });
+    }
+
+private:
+    // Batch normalization normalizes each channel (spatial), or each element of a sample, over the minibatch (and all pixels).
+    // BatchNormalization does not transpose its images, so the layout of inT is that of the values, HWC or CHW.
+    struct BatchNormGeometry
+    {
+        size_t numChannels, numPixels, numSamples, sampleSize;
+        bool channelsPlanar; // (CHW) the pixels of a channel are adjacent; otherwise its values are numChannels apart
+
+        BatchNormGeometry(const Tensor4D& inT, bool spatial)
+            : numChannels(spatial ? inT.c() : inT.w() * inT.h() * inT.c()), numPixels(spatial ? inT.w() * inT.h() : 1),
+              numSamples(inT.n()), sampleSize(inT.w() * inT.h() * inT.c()), channelsPlanar(spatial && inT.layout() == ImageLayoutKind::CHW)
+        {
+        }
+
+        // f(index) for the index of each value of channel c
+        template <class F>
+        void ForEach(size_t c, const F& f) const
+        {
+            for (size_t n = 0; n < numSamples; n++)
+            {
+                if (channelsPlanar)
+                {
+                    const size_t begin = n * sampleSize + c * numPixels;
+                    for (size_t p = 0; p < numPixels; p++)
+                        f(begin + p);
+                }
+                else
+                {
+                    for (size_t p = 0; p < numPixels; p++)
+                        f(n * sampleSize + p * numChannels + c);
+                }
+            }
+        }
+    };
+
+    static void VerifyBatchNormMatrices(std::initializer_list<const Mat*> matrices)
+    {
+        for (auto m : matrices)
+        {
+            if (!IsDenseOnCpu(*m))
+                RuntimeError("Batch normalization of the legacy convolution engine requires dense matrices on the CPU; on the GPU, use the cuDNN engine.");
+        }
+    }
+
+    // f(begin, c, length) for runs of adjacent values of channel c, in parallel and in the order of memory: the pixels of a channel
+    // in a sample (CHW), or else single values, pixel by pixel
+    template <class F>
+    static void ForEachChannelRun(const BatchNormGeometry& g, const F& f)
+    {
+        if (g.channelsPlanar)
+        {
+#pragma omp parallel for
+            for (long r = 0; r < (long) (g.numSamples * g.numChannels); r++)
+                f(r * g.numPixels, r % g.numChannels, g.numPixels);
+        }
+        else
+        {
+#pragma omp parallel for
+            for (long o = 0; o < (long) (g.numSamples * g.numPixels); o++)
+                for (size_t c = 0; c < g.numChannels; c++)
+                    f(o * g.numChannels + c, c, 1);
+        }
+    }
+
+    // y = a * x + b, with a and b per channel
+    static void ApplyChannelAffine(const BatchNormGeometry& g, const ElemType* x, const ElemType* a, const ElemType* b, ElemType* y)
+    {
+        ForEachChannelRun(g, [&](size_t begin, size_t c, size_t length)
+                          {
+                              const ElemType ac = a[c], bc = b[c];
+                              for (size_t i = begin; i < begin + length; i++)
+                                  y[i] = ac * x[i] + bc;
+                          });
+    }
+
+    // the values of all channels are split into this many blocks of pixels for reductions (unless planar), one per thread
+    static size_t NumReductionBlocks(const BatchNormGeometry& g)
+    {
+        return std::max((size_t) 1, std::min(g.numSamples * g.numPixels, (size_t) omp_get_max_threads()));
+    }
+
+    // merge the moments (count, mean, sum of squared deviations from the mean) of another part of the values into those of the first
+    // (the pairwise update of Chan et al.), so that parts can be reduced separately
+    static void MergeMoments(double& count, double& mean, double& m2, double countB, double meanB, double m2B)
+    {
+        const double total = count + countB;
+        if (total == 0)
+            return;
+        const double delta = meanB - mean;
+        mean += delta * countB / total;
+        m2 += m2B + delta * delta * count * countB / total;
+        count = total;
+    }
+
+    // per-channel mean and (biased) variance of the values, in a single pass over them. Unlike E[x^2] - E[x]^2, this keeps the
+    // precision of small variances. For CHW, the moments of each run of pixels are computed while it is in the cache, and merged.
+    // Otherwise, the values of a pixel are the channels, so Welford's update runs over the channels in the inner loop, with one
+    // reciprocal per pixel, over one block of pixels per thread; then the blocks are merged.
+    void ComputeBatchMoments(const BatchNormGeometry& g, const ElemType* x, std::vector<double>& mean, std::vector<double>& variance)
+    {
+        const size_t C = g.numChannels;
+        mean.resize(C);
+        variance.resize(C);
+        if (g.channelsPlanar)
+        {
+#pragma omp parallel for
+            for (long c = 0; c < (long) C; c++)
+            {
+                double count = 0, m = 0, m2 = 0;
+                for (size_t n = 0; n < g.numSamples; n++)
+                {
+                    const ElemType* run = x + n * g.sampleSize + c * g.numPixels;
+                    double sum = 0;
+                    for (size_t p = 0; p < g.numPixels; p++)
+                        sum += run[p];
+                    const double runMean = sum / g.numPixels;
+                    double runM2 = 0;
+                    for (size_t p = 0; p < g.numPixels; p++)
+                        runM2 += (run[p] - runMean) * (run[p] - runMean);
+                    MergeMoments(count, m, m2, (double) g.numPixels, runMean, runM2);
+                }
+                mean[c] = m;
+                variance[c] = m2 / count;
+            }
+            return;
+        }
+
+        const size_t numPixels = g.numSamples * g.numPixels;
+        const size_t numBlocks = NumReductionBlocks(g);
+        m_batchNormBlocks.assign(2 * numBlocks * C, 0); // [block][mean or m2][channel]
+#pragma omp parallel for
+        for (long b = 0; b < (long) numBlocks; b++)
+        {
+            double* pMean = &m_batchNormBlocks[2 * b * C];
+            double* pM2 = pMean + C;
+            const size_t begin = numPixels * b / numBlocks;
+            const size_t end = numPixels * (b + 1) / numBlocks;
+            for (size_t o = begin; o < end; o++)
+            {
+                const ElemType* v = x + o * C;
+                const double r = 1.0 / (o - begin + 1);
+                for (size_t c = 0; c < C; c++)
+                {
+                    const double delta = v[c] - pMean[c];
+                    pMean[c] += delta * r;
+                    pM2[c] += delta * (v[c] - pMean[c]);
+                }
+            }
+        }
+#pragma omp parallel for
+        for (long c = 0; c < (long) C; c++)
+        {
+            double count = 0, m = 0, m2 = 0;
+            for (size_t b = 0; b < numBlocks; b++)
+            {
+                const double blockCount = (double) (numPixels * (b + 1) / numBlocks - numPixels * b / numBlocks);
+                MergeMoments(count, m, m2, blockCount, m_batchNormBlocks[2 * b * C + c], m_batchNormBlocks[(2 * b + 1) * C + c]);
+            }
+            mean[c] = m;
+            variance[c] = m2 / count;
+        }
+    }
+
+    // per-channel sum(dy) and sum(dy * (x - mean)) for the backward pass, in a single pass over x and dy, the same way
+    void ComputeGradientSums(const BatchNormGeometry& g, const ElemType* x, const ElemType* dy, const ElemType* mean,
+                             std::vector<double>& sumDy, std::vector<double>& sumDyXCentered)
+    {
+        const size_t C = g.numChannels;
+        sumDy.resize(C);
+        sumDyXCentered.resize(C);
+        if (g.channelsPlanar)
+        {
+#pragma omp parallel for
+            for (long c = 0; c < (long) C; c++)
+            {
+                double s1 = 0, s2 = 0;
+                const double m = mean[c];
+                g.ForEach(c, [&](size_t i)
+                          {
+                              s1 += dy[i];
+                              s2 += dy[i] * (x[i] - m);
+                          });
+                sumDy[c] = s1;
+                sumDyXCentered[c] = s2;
+            }
+            return;
+        }
+
+        const size_t numPixels = g.numSamples * g.numPixels;
+        const size_t numBlocks = NumReductionBlocks(g);
+        m_batchNormBlocks.assign(2 * numBlocks * C, 0); // [block][sum(dy) or sum(dy * (x - mean))][channel]
+#pragma omp parallel for
+        for (long b = 0; b < (long) numBlocks; b++)
+        {
+            double* pSum1 = &m_batchNormBlocks[2 * b * C];
+            double* pSum2 = pSum1 + C;
+            for (size_t o = numPixels * b / numBlocks; o < numPixels * (b + 1) / numBlocks; o++)
+            {
+                const ElemType* vx = x + o * C;
+                const ElemType* vdy = dy + o * C;
+                for (size_t c = 0; c < C; c++)
+                {
+                    pSum1[c] += vdy[c];
+                    pSum2[c] += vdy[c] * ((double) vx[c] - mean[c]);
+                }
+            }
+        }
+#pragma omp parallel for
+        for (long c = 0; c < (long) C; c++)
+        {
+            double s1 = 0, s2 = 0;
+            for (size_t b = 0; b < numBlocks; b++)
+            {
+                s1 += m_batchNormBlocks[2 * b * C + c];
+                s2 += m_batchNormBlocks[(2 * b + 1) * C + c];
+            }
+            sumDy[c] = s1;
+            sumDyXCentered[c] = s2;
+        }
+    }
+
+    // the algorithm chosen by the descriptor, if all matrices are dense and on the CPU (for Gemm: dense anywhere); otherwise Unpack
+    static DefaultConvolutionAlgorithm FastAlgorithm(const ConvDesc& convDesc, const Mat& in, const Mat& filter, const Mat& out)
+    {
+        auto desc = dynamic_cast<const DefaultConvolutionDescriptor*>(&convDesc);
+        if (!desc)
+            return DefaultConvolutionAlgorithm::Unpack;
+        if (desc->algorithm() == DefaultConvolutionAlgorithm::Gemm)
+        {
+            bool allDense = in.GetMatrixType() == MatrixType::DENSE && filter.GetMatrixType() == MatrixType::DENSE && out.GetMatrixType() == MatrixType::DENSE;
+            return allDense ? DefaultConvolutionAlgorithm::Gemm : DefaultConvolutionAlgorithm::Unpack;
+        }
+        if (!IsDenseOnCpu(in) || !IsDenseOnCpu(filter) || !IsDenseOnCpu(out))
+            return DefaultConvolutionAlgorithm::Unpack;
+        return desc->algorithm();
+    }
+
+    static StrideOneConvolutionKernel<ElemType>* GetKernel(std::unique_ptr<StrideOneConvolutionKernel<ElemType>>& kernel, DefaultConvolutionAlgorithm algorithm)
+    {
+        if (!kernel || kernel->Algorithm() != algorithm)
+        {
+            if (algorithm == DefaultConvolutionAlgorithm::Winograd)
+                kernel = std::make_unique<WinogradConvolution<ElemType>>();
+            else
+                kernel = std::make_unique<FftConvolution<ElemType>>();
+        }
+        return kernel.get();
+    }
+
+    template <class F>
+    static void ForEachSubBatch(size_t batchSize, size_t maxTempMemSizeInSamples, const F& f)
+    {
+        size_t subBatchSize = min(batchSize, maxTempMemSizeInSamples);
+        for (size_t startSampleId = 0; startSampleId < batchSize; startSampleId += subBatchSize)
+            f(startSampleId, min(subBatchSize, batchSize - startSampleId));
     }
 
 private:
@@ -339,11 +1104,57 @@ private:
     Mat m_ones;
     bool m_gpuSparseOpt;
     bool m_gpuSparse1D;
+    bool m_workspaceHasPackedInput; // Forward() left the unpacked input in the workspace, for BackwardFilter()
+    std::unique_ptr<StrideOneConvolutionKernel<ElemType>> m_forwardKernel;
+    std::unique_ptr<StrideOneConvolutionKernel<ElemType>> m_backwardDataKernel;
+    std::vector<ElemType> m_flippedFilter;
+    // scratch of batch normalization
+    std::vector<double> m_batchNormMean, m_batchNormVariance; // per channel (the backward pass: its two sums)
+    std::vector<double> m_batchNormBlocks;                    // partial reductions of the blocks of pixels
+    std::vector<ElemType> m_batchNormScale, m_batchNormShift, m_batchNormOffset; // per-channel coefficients of the elementwise pass
 };
 
 template class ConvolutionEngine<float>;
 template class ConvolutionEngine<double>;
 
+// -----------------------------------------------------------------------
+// Pooling of the legacy engine. On the CPU, the kernels work on whole pixels of the HWC layout: the values of a pixel are its
+// channels, adjacent in memory, so a window is reduced for a tile of channels at a time, with the index math once per pixel of
+// the window instead of once per value, and an inner loop over the channels that the compiler vectorizes. Max pooling records
+// where the maximum of each output came from, so that the backward pass scatters the gradient instead of searching the windows
+// for inputs equal to the output. (Of several inputs equal to the maximum of a window, the first one gets the gradient.)
+// -----------------------------------------------------------------------
+
+struct PoolingGeometry
+{
+    size_t numChannels;
+    size_t inH, inW, outH, outW;
+    size_t kH, kW;
+    size_t hStride, wStride;
+
+    size_t InSize() const
+    {
+        return inH * inW * numChannels;
+    }
+    size_t OutSize() const
+    {
+        return outH * outW * numChannels;
+    }
+    // index within a sample of the first value of the window of output pixel (outRow, outCol)
+    size_t WindowBegin(size_t outRow, size_t outCol) const
+    {
+        return (outRow * hStride + outCol * wStride * inH) * numChannels;
+    }
+    // offset of pixel (kRow, kCol) of a window from its first value
+    size_t WindowOffset(size_t kRow, size_t kCol) const
+    {
+        return (kRow + kCol * inH) * numChannels;
+    }
+};
+
+// channels reduced together; the running results of a tile stay in registers while the pixels of a window are visited
+static const size_t PoolingChannelTile = 32;
+
 template <class ElemType>
 class DefaultPoolingEngine : public PoolingEngine<ElemType>
 {
@@ -354,6 +1165,11 @@ public:
     using typename Base::Mat;
 
 public:
+    DefaultPoolingEngine()
+        : m_maxPositionsIn(nullptr), m_maxPositionsOut(nullptr), m_maxPositionsSamples(0)
+    {
+    }
+
     void Forward(const Tensor4D& inT, const Mat& in, const PoolDesc& poolDesc, const Tensor4D& outT, Mat& out) override
     {
         assert(inT.w() * inT.h() * inT.c() == in.GetNumRows());
@@ -361,6 +1177,21 @@ public:
         assert(outT.w() * outT.h() * outT.c() == out.GetNumRows());
         assert(outT.n() == out.GetNumCols());
 
+        m_maxPositionsOut = nullptr;
+        if (IsDenseOnCpu(in) && IsDenseOnCpu(out))
+        {
+            const PoolingGeometry g = Geometry(inT, poolDesc, outT);
+            const size_t batchSize = in.GetNumCols();
+            out.Resize(g.OutSize(), batchSize);
+            if (poolDesc.kind() == PoolDesc::PoolKind::Max)
+                MaxPool(g, in, out);
+            else if (poolDesc.kind() == PoolDesc::PoolKind::Average)
+                AveragePool(g, in.BufferPointer(), batchSize, out.BufferPointer());
+            else
+                assert(false);
+            return;
+        }
+
         if (poolDesc.kind() == PoolDesc::PoolKind::Max)
         {
             out.AssignMaxPoolingResult(in, inT.c(), inT.w(), inT.h(), inT.w() * inT.h() * inT.c(),
@@ -388,6 +1219,28 @@ public:
         assert(in.GetNumRows() == grad.GetNumRows());
         assert(in.GetNumCols() == grad.GetNumCols());
 
+        if (IsDenseOnCpu(out) && IsDenseOnCpu(srcGrad) && IsDenseOnCpu(in) && IsDenseOnCpu(grad))
+        {
+            const PoolingGeometry g = Geometry(inT, poolDesc, outT);
+            const size_t batchSize = in.GetNumCols();
+            if (poolDesc.kind() == PoolDesc::PoolKind::Max)
+            {
+                if (m_maxPositionsOut != out.BufferPointer() || m_maxPositionsIn != in.BufferPointer() || m_maxPositionsSamples != batchSize)
+                {
+                    // 'out' is not from the last Forward(): find the maxima again
+                    Mat maxima(g.OutSize(), batchSize, CPUDEVICE);
+                    MaxPool(g, in, maxima);
+                    m_maxPositionsOut = out.BufferPointer();
+                }
+                AddMaxPoolingGradient(g, srcGrad.BufferPointer(), batchSize, grad.BufferPointer());
+            }
+            else if (poolDesc.kind() == PoolDesc::PoolKind::Average)
+                AddAveragePoolingGradient(g, srcGrad.BufferPointer(), batchSize, grad.BufferPointer());
+            else
+                assert(false);
+            return;
+        }
+
         if (poolDesc.kind() == PoolDesc::PoolKind::Max)
         {
             grad.AddMaxPoolingGradient(srcGrad, in, out,
@@ -404,6 +1257,156 @@ public:
         else
             assert(false);
     }
+
+private:
+    static PoolingGeometry Geometry(const Tensor4D& inT, const PoolDesc& poolDesc, const Tensor4D& outT)
+    {
+        const PoolingGeometry g = {inT.c(), inT.h(), inT.w(), outT.h(), outT.w(), poolDesc.h(), poolDesc.w(), poolDesc.hStride(), poolDesc.wStride()};
+        if ((g.outH - 1) * g.hStride + g.kH > g.inH || (g.outW - 1) * g.wStride + g.kW > g.inW || outT.c() != g.numChannels)
+            InvalidArgument("Pooling: The output [%d x %d x %d] does not fit the input [%d x %d x %d] and the window [%d x %d].",
+                            (int) outT.w(), (int) outT.h(), (int) outT.c(), (int) g.inW, (int) g.inH, (int) g.numChannels, (int) g.kW, (int) g.kH);
+        return g;
+    }
+
+    // f(n, outRow, outCol) for every output pixel of every sample, in parallel
+    template <class F>
+    static void ForEachOutputPixel(const PoolingGeometry& g, size_t batchSize, const F& f)
+    {
+        const size_t pixelsPerSample = g.outH * g.outW;
+#pragma omp parallel for
+        for (long o = 0; o < (long) (batchSize * pixelsPerSample); o++)
+        {
+            const size_t pixel = o % pixelsPerSample;
+            f(o / pixelsPerSample, pixel % g.outH, pixel / g.outH);
+        }
+    }
+
+    // out = the maxima of the windows of 'in', and m_maxPositions = their indices within the sample
+    void MaxPool(const PoolingGeometry& g, const Mat& in, Mat& out)
+    {
+        const size_t batchSize = in.GetNumCols();
+        const size_t C = g.numChannels;
+        m_maxPositions.resize(g.OutSize() * batchSize);
+        const ElemType* x = in.BufferPointer();
+        ElemType* y = out.BufferPointer();
+        int* positions = m_maxPositions.data();
+        ForEachOutputPixel(g, batchSize, [&](size_t n, size_t outRow, size_t outCol)
+                           {
+                               const ElemType* xs = x + n * g.InSize();
+                               const size_t o = n * g.OutSize() + (outRow + outCol * g.outH) * C;
+                               const size_t begin = g.WindowBegin(outRow, outCol);
+                               for (size_t c0 = 0; c0 < C; c0 += PoolingChannelTile)
+                               {
+                                   const size_t tile = std::min(PoolingChannelTile, C - c0);
+                                   ElemType best[PoolingChannelTile];
+                                   int bestPos[PoolingChannelTile];
+                                   for (size_t c = 0; c < tile; c++)
+                                   {
+                                       best[c] = xs[begin + c0 + c];
+                                       bestPos[c] = (int) (begin + c0 + c);
+                                   }
+                                   for (size_t kCol = 0; kCol < g.kW; kCol++)
+                                       for (size_t kRow = 0; kRow < g.kH; kRow++)
+                                       {
+                                           const int p = (int) (begin + g.WindowOffset(kRow, kCol) + c0);
+                                           const ElemType* v = xs + p;
+                                           for (size_t c = 0; c < tile; c++)
+                                           {
+                                               const bool greater = v[c] > best[c];
+                                               best[c] = greater ? v[c] : best[c];
+                                               bestPos[c] = greater ? p + (int) c : bestPos[c];
+                                           }
+                                       }
+                                   for (size_t c = 0; c < tile; c++)
+                                   {
+                                       y[o + c0 + c] = best[c];
+                                       positions[o + c0 + c] = bestPos[c];
+                                   }
+                               }
+                           });
+        m_maxPositionsIn = in.BufferPointer();
+        m_maxPositionsOut = out.BufferPointer();
+        m_maxPositionsSamples = batchSize;
+    }
+
+    void AveragePool(const PoolingGeometry& g, const ElemType* x, size_t batchSize, ElemType* y)
+    {
+        const size_t C = g.numChannels;
+        const ElemType windowSize = (ElemType) (g.kH * g.kW);
+        ForEachOutputPixel(g, batchSize, [&](size_t n, size_t outRow, size_t outCol)
+                           {
+                               const ElemType* xs = x + n * g.InSize() + g.WindowBegin(outRow, outCol);
+                               ElemType* ys = y + n * g.OutSize() + (outRow + outCol * g.outH) * C;
+                               for (size_t c0 = 0; c0 < C; c0 += PoolingChannelTile)
+                               {
+                                   const size_t tile = std::min(PoolingChannelTile, C - c0);
+                                   ElemType sum[PoolingChannelTile] = {};
+                                   for (size_t kCol = 0; kCol < g.kW; kCol++)
+                                       for (size_t kRow = 0; kRow < g.kH; kRow++)
+                                       {
+                                           const ElemType* v = xs + g.WindowOffset(kRow, kCol) + c0;
+                                           for (size_t c = 0; c < tile; c++)
+                                               sum[c] += v[c];
+                                       }
+                                   for (size_t c = 0; c < tile; c++)
+                                       ys[c0 + c] = sum[c] / windowSize;
+                               }
+                           });
+    }
+
+    // The windows of a sample may overlap, so the backward passes scatter into the gradient of one sample per thread.
+
+    // dx[m_maxPositions] += dy
+    void AddMaxPoolingGradient(const PoolingGeometry& g, const ElemType* dy, size_t batchSize, ElemType* dx) const
+    {
+        const size_t outSize = g.OutSize(), inSize = g.InSize();
+        const int* positions = m_maxPositions.data();
+#pragma omp parallel for
+        for (long n = 0; n < (long) batchSize; n++)
+        {
+            const ElemType* dys = dy + n * outSize;
+            const int* ps = positions + n * outSize;
+            ElemType* dxs = dx + n * inSize;
+            for (size_t i = 0; i < outSize; i++)
+                dxs[ps[i]] += dys[i];
+        }
+    }
+
+    void AddAveragePoolingGradient(const PoolingGeometry& g, const ElemType* dy, size_t batchSize, ElemType* dx) const
+    {
+        const size_t C = g.numChannels;
+        const ElemType windowSize = (ElemType) (g.kH * g.kW);
+#pragma omp parallel for
+        for (long n = 0; n < (long) batchSize; n++)
+        {
+            for (size_t outCol = 0; outCol < g.outW; outCol++)
+                for (size_t outRow = 0; outRow < g.outH; outRow++)
+                {
+                    const ElemType* dys = dy + n * g.OutSize() + (outRow + outCol * g.outH) * C;
+                    ElemType* dxs = dx + n * g.InSize() + g.WindowBegin(outRow, outCol);
+                    for (size_t c0 = 0; c0 < C; c0 += PoolingChannelTile)
+                    {
+                        const size_t tile = std::min(PoolingChannelTile, C - c0);
+                        ElemType share[PoolingChannelTile];
+                        for (size_t c = 0; c < tile; c++)
+                            share[c] = dys[c0 + c] / windowSize;
+                        for (size_t kCol = 0; kCol < g.kW; kCol++)
+                            for (size_t kRow = 0; kRow < g.kH; kRow++)
+                            {
+                                ElemType* v = dxs + g.WindowOffset(kRow, kCol) + c0;
+                                for (size_t c = 0; c < tile; c++)
+                                    v[c] += share[c];
+                            }
+                    }
+                }
+        }
+    }
+
+    // the positions of the maxima of the last MaxPool(), and the matrices it was for
+    std::vector<int> m_maxPositions; // [output value] index within the sample of the input it came from
+    const ElemType* m_maxPositionsIn;
+    const ElemType* m_maxPositionsOut;
+    size_t m_maxPositionsSamples;
 };
 
 template class PoolingEngine<float>;
@@ -429,7 +1432,7 @@ public:
 public:
     Tensor4DPtr CreateTensor(size_t w, size_t h, size_t c, size_t n) override
     {
-        return std::make_unique<ConvolutionTensor4D>(w, h, c, n);
+        return std::make_unique<ConvolutionTensor4D>(w, h, c, n, ImageLayoutKind::HWC);
     }
 
     FilterPtr CreateFilter(size_t w, size_t h, size_t c, size_t k) override
@@ -437,10 +1440,10 @@ public:
         return std::make_unique<Filter>(w, h, c, k);
     }
 
-    ConvDescPtr CreateConvDescriptor(const Tensor4D& /*inT*/, const Filter& /*filterT*/,
+    ConvDescPtr CreateConvDescriptor(const Tensor4D& /*inT*/, const Filter& filterT,
                                      size_t wStride, size_t hStride, bool padding) override
     {
-        return std::make_unique<ConvDesc>(wStride, hStride, padding);
+        return std::make_unique<DefaultConvolutionDescriptor>(filterT, wStride, hStride, padding);
     }
 
     PoolDescPtr CreatePoolDescriptor(typename PoolDesc::PoolKind kind, size_t w, size_t h, size_t wStride, size_t hStride, size_t wPad, size_t hPad) override
@@ -457,6 +1460,11 @@ public:
     {
         return std::make_unique<DefaultPoolingEngine<ElemType>>();
     }
+
+    ImageLayoutKind GetImageLayout() const override
+    {
+        return ImageLayoutKind::HWC;
+    }
 };
 
 template <class ElemType>
@@ -480,16 +1488,35 @@ std::unique_ptr<ConvolutionEngineFactory<ElemType>> ConvolutionEngineFactory<Ele
     }
     else if (engType == EngineType::Legacy)
     {
-        // REVIEW alexeyk: temp hack to allow this to work in MEL scenarios. InvalidArgument should be used instead.
-        if (imageLayoutKind != ImageLayoutKind::HWC)
-            fprintf(stderr, "WARNING: trying to use cuDNN on unsupported platform. It is safe to ignore the warning if it's produced during model editing command.\n");
-        // InvalidArgument("ConvolutionEngineFactory: ImageLayout '%s' is not compatible with the legacy convolution engine.", ToString(imageLayoutKind).c_str());
+        // The legacy engine computes in HWC. Nodes of a model in another layout transpose their images with ConvertLayout().
         return std::make_unique<DefaultConvolutionEngineFactory<ElemType>>();
     }
 
     RuntimeError("Not supported convolution engine type: %d.", (int)engType);
 }
 
+template <class ElemType>
+/*static*/ void ConvolutionEngineFactory<ElemType>::ConvertLayout(const Tensor4D& t, const Matrix<ElemType>& src, ImageLayoutKind srcLayout,
+                                                               Matrix<ElemType>& dst, ImageLayoutKind dstLayout, bool accumulate)
+{
+    assert(t.w() * t.h() * t.c() == src.GetNumRows());
+    if (!accumulate && (dst.GetNumRows() != src.GetNumRows() || dst.GetNumCols() != src.GetNumCols()))
+        dst.Resize(src.GetNumRows(), src.GetNumCols());
+    if (srcLayout == dstLayout)
+    {
+        if (accumulate)
+            dst += src;
+        else
+            dst.SetValue(src);
+        return;
+    }
+    // HWC is [C x W x H] and CHW is [W x H x C], so either way this swaps the channel axis with the two spatial ones
+    const size_t pixels = t.w() * t.h();
+    const size_t S = srcLayout == ImageLayoutKind::HWC ? t.c() : pixels;
+    const size_t K = srcLayout == ImageLayoutKind::HWC ? pixels : t.c();
+    Matrix<ElemType>::TensorShuffleScaleAndAdd(accumulate ? 1 : 0, src, 1, S, 1, K, src.GetNumCols(), 1, dst, dst);
+}
+
 template class ConvolutionEngineFactory<float>;
 template class ConvolutionEngineFactory<double>;
 } } }
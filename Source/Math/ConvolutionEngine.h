@@ -22,6 +22,7 @@
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 // REVIEW alexeyk: this is a temp class until we have generic tensor suport in CNTK.
+// The layout says how the engine that created the tensor stores images in memory (HWC for the legacy engine, CHW for cuDNN).
 class ConvolutionTensor4D
 {
 public:
@@ -41,18 +42,23 @@ public:
     {
         return m_n;
     }
+    ImageLayoutKind layout() const
+    {
+        return m_layout;
+    }
     virtual void setN(size_t n)
     {
         m_n = n;
     }
 
 public:
-    ConvolutionTensor4D(size_t w = 1, size_t h = 1, size_t c = 1, size_t n = 1)
+    ConvolutionTensor4D(size_t w = 1, size_t h = 1, size_t c = 1, size_t n = 1, ImageLayoutKind layout = ImageLayoutKind::HWC)
     {
         m_w = w;
         m_h = h;
         m_c = c;
         m_n = n;
+        m_layout = layout;
     }
 
 public:
@@ -69,6 +75,7 @@ private:
     size_t m_h;
     size_t m_c;
     size_t m_n;
+    ImageLayoutKind m_layout;
 };
 
 class ConvolutionFilter
@@ -250,6 +257,23 @@ public:
     virtual void AddBias(const Tensor4D& outT, const Mat& out, const Tensor4D& biasT, const Mat& bias, Mat& dst) = 0;
     virtual void BackwardBias(const Tensor4D& srcGradT, const Mat& srcGrad, const Tensor4D& biasT, Mat& biasGrad) = 0;
 
+    // Forward(), AddBias() and ReLU in a single pass over the output, for engines that can fuse them (cuDNN 6 and later).
+    // out = max(0, conv(in, filter) + bias)
+    virtual bool SupportsFusedBiasReLU() const
+    {
+        return false;
+    }
+    virtual void ForwardBiasReLU(const Tensor4D& /*inT*/, const Mat& /*in*/, const Filter& /*filterT*/, const Mat& /*filter*/, const ConvDesc& /*convDesc*/,
+                                 const Tensor4D& /*biasT*/, const Mat& /*bias*/, const Tensor4D& /*outT*/, Mat& /*out*/, Mat& /*workspace*/)
+    {
+        LogicError("This convolution engine does not support fused convolution, bias and ReLU.");
+    }
+    // the matching backward: sets convGrad to the gradient w.r.t. the convolution output, srcGrad * (out > 0), and adds its per-channel sum to biasGrad
+    virtual void BackwardBiasReLU(const Tensor4D& /*outT*/, const Mat& /*out*/, const Mat& /*srcGrad*/, Mat& /*convGrad*/, const Tensor4D& /*biasT*/, Mat& /*biasGrad*/)
+    {
+        LogicError("This convolution engine does not support fused convolution, bias and ReLU.");
+    }
+
     virtual void NormalizeBatch(const Tensor4D& inT, const Mat& in, const Tensor4D& scaleBiasT, const Mat& scale, const Mat& bias,
                                 bool spatial, double expAvgFactor, Mat& runMean, Mat& runInvStdDev, Mat& out, Mat& saveMean, Mat& saveInvStdDev) = 0;
 
@@ -319,6 +343,13 @@ public:
     virtual ConvEnginePtr CreateConvEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples) = 0;
     virtual PoolEnginePtr CreatePoolEngine(DEVICEID_TYPE deviceId) = 0;
 
+    // layout of the tensors created by this factory, which its engines compute in
+    virtual ImageLayoutKind GetImageLayout() const = 0;
+
+    // dst = src (or dst += src) with the images of src, as described by t, transposed from srcLayout to dstLayout.
+    // Nodes use this at the boundaries of a chain of image nodes whose engine layout differs from the model's layout.
+    static void ConvertLayout(const Tensor4D& t, const Matrix<ElemType>& src, ImageLayoutKind srcLayout, Matrix<ElemType>& dst, ImageLayoutKind dstLayout, bool accumulate);
+
     enum class EngineType
     {
         Auto,
@@ -6,6 +6,9 @@
 #include "stdafx.h"
 #include "CuDnnConvolutionEngine.h"
 #include "GPUMatrix.h"
+#include "fileutil.h"
+#include <map>
+#include <mutex>
 #ifdef USE_CUDNN
 #include <cudnn.h>
 
@@ -37,13 +40,105 @@ bool CuDnnConvolutionEngineFactory<ElemType>::IsSupported(DEVICEID_TYPE deviceId
 #endif
 }
 
+// -----------------------------------------------------------------------
+// CuDnnAlgorithmCache -- the algorithms picked by the cuDNN auto-tuner, persisted in a text file
+// Each line is "<algo> <key>", where the key describes GPU model, cuDNN version, operation, all
+// descriptors, and the workspace limit. Lines are appended as new configurations get tuned, so that
+// several processes can share one file; if a key occurs more than once, the last entry wins.
+// -----------------------------------------------------------------------
+
+class CuDnnAlgorithmCache
+{
+public:
+    static CuDnnAlgorithmCache& Instance()
+    {
+        static CuDnnAlgorithmCache cache;
+        return cache;
+    }
+
+    void SetFile(const std::wstring& path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_path = path;
+        m_algos.clear();
+        m_loaded = false;
+    }
+
+    bool Find(const std::string& key, int& algo)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_path.empty())
+            return false;
+        // on a miss, re-read the file, since another worker may have tuned the same configuration meanwhile
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            if (!m_loaded || attempt > 0)
+                Load();
+            auto iter = m_algos.find(key);
+            if (iter != m_algos.end())
+            {
+                algo = iter->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Add(const std::string& key, int algo)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_path.empty())
+            return;
+        m_algos[key] = algo;
+        FILE* f = fopenOrDie(m_path, L"a");
+        fprintf(f, "%d %s\n", algo, key.c_str()); // (a single short write, so appends from several processes do not interleave)
+        fclose(f);
+    }
+
+private:
+    CuDnnAlgorithmCache()
+        : m_loaded(false)
+    {
+    }
+
+    void Load()
+    {
+        m_loaded = true;
+        if (!fexists(m_path))
+            return;
+        FILE* f = fopenOrDie(m_path, L"r");
+        char line[2048];
+        while (fgets(line, sizeof(line), f))
+        {
+            int algo;
+            char key[2048];
+            if (sscanf(line, "%d %2047[^\n]", &algo, key) == 2)
+                m_algos[key] = algo;
+        }
+        fclose(f);
+    }
+
+    std::mutex m_mutex;
+    std::wstring m_path;
+    bool m_loaded;
+    std::map<std::string, int> m_algos;
+};
+
+template <class ElemType>
+void CuDnnConvolutionEngineFactory<ElemType>::SetAlgorithmCacheFile(const std::wstring& path)
+{
+    CuDnnAlgorithmCache::Instance().SetFile(path);
+    if (!path.empty())
+        fprintf(stderr, "Using cuDNN algorithm cache file %ls.\n", path.c_str());
+}
+
 #ifdef USE_CUDNN
 
 class CuDnnTensor4D : public ConvolutionTensor4D
 {
 public:
     CuDnnTensor4D(size_t w, size_t h, size_t c, size_t n, cudnnDataType_t dataType)
-        : ConvolutionTensor4D(w, h, c, n), m_dataType(dataType), m_tensor(nullptr)
+        : ConvolutionTensor4D(w, h, c, n, ImageLayoutKind::CHW), m_dataType(dataType), m_tensor(nullptr)
     {
         CUDNN_CALL(cudnnCreateTensorDescriptor(&m_tensor));
         CUDNN_CALL(cudnnSetTensor4dDescriptor(m_tensor, TENSOR_FORMAT, dataType,
@@ -233,18 +328,33 @@ public:
     using typename Base::Filter;
     using typename Base::ConvDesc;
 
-    CuDnnConvolutionEngine(size_t maxTempMemSizeInSamples)
-        : m_maxTempMemSizeInSamples(maxTempMemSizeInSamples), m_cudnn(nullptr), m_curMBSize(0)
+    CuDnnConvolutionEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples)
+        : m_maxTempMemSizeInSamples(maxTempMemSizeInSamples), m_cudnn(nullptr), m_fwdMBSize(0), m_backDataMBSize(0), m_backFiltMBSize(0)
     {
+        // the GPU model is part of the keys of the algorithm cache, since the best algorithm depends on it
+        cudaDeviceProp props = {0};
+        CUDA_CALL(cudaGetDeviceProperties(&props, deviceId));
+        m_gpuModel = msra::strfun::strprintf("%s (sm_%d%d)", props.name, props.major, props.minor);
         CUDNN_CALL(cudnnCreate(&m_cudnn));
         CUDNN_CALL(cudnnSetStream(m_cudnn, GetStream()));
         m_fwdAlgo.status = CUDNN_STATUS_NOT_INITIALIZED;
         m_backDataAlgo.status = CUDNN_STATUS_NOT_INITIALIZED;
         m_backFiltAlgo.status = CUDNN_STATUS_NOT_INITIALIZED;
+#if CUDNN_VERSION >= 6000
+        CUDNN_CALL(cudnnCreateActivationDescriptor(&m_reluDesc));
+        CUDNN_CALL(cudnnSetActivationDescriptor(m_reluDesc, CUDNN_ACTIVATION_RELU, CUDNN_PROPAGATE_NAN, 0));
+#endif
     }
 
     ~CuDnnConvolutionEngine()
     {
+#if CUDNN_VERSION >= 6000
+        if (m_reluDesc != nullptr)
+        {
+            cudnnDestroyActivationDescriptor(m_reluDesc);
+            m_reluDesc = nullptr;
+        }
+#endif
         if (m_cudnn != nullptr)
         {
             cudnnDestroy(m_cudnn);
@@ -337,6 +447,49 @@ public:
         CUDNN_CALL(cudnnConvolutionBackwardBias(m_cudnn, &C::One, t(srcGradT), ptr(srcGrad), &C::One, t(biasT), ptr(biasGrad)));
     }
 
+#if CUDNN_VERSION >= 6000
+    bool SupportsFusedBiasReLU() const override
+    {
+        return true;
+    }
+
+    void ForwardBiasReLU(const Tensor4D& inT, const Mat& in, const Filter& filterT, const Mat& filter, const ConvDesc& convDesc,
+                         const Tensor4D& biasT, const Mat& bias, const Tensor4D& outT, Mat& out, Mat& workspace) override
+    {
+        assert(inT.w() * inT.h() * inT.c() == in.GetNumRows());
+        assert(inT.n() == in.GetNumCols());
+        assert(filterT.k() == filter.GetNumRows());
+        assert(filterT.w() * filterT.h() * filterT.c() == filter.GetNumCols());
+        assert(inT.c() == filterT.c());
+        assert(outT.c() == filterT.k());
+        assert(biasT.c() == outT.c());
+        assert(biasT.w() == 1 && biasT.h() == 1 && biasT.n() == 1);
+
+        // The ReLU works with all forward algorithms, so the tuned one for Forward() applies.
+        FindBestForwardAlgo(t(inT), f(filterT), cd(convDesc), t(outT));
+        if (m_fwdAlgo.memory > 0)
+            workspace.Resize((m_fwdAlgo.memory + sizeof(ElemType) - 1) / sizeof(ElemType), 1);
+        // out = ReLU(1 * conv(in) + 0 * z + bias); z must be a valid tensor, so it is 'out' itself
+        CUDNN_CALL(cudnnConvolutionBiasActivationForward(m_cudnn, &C::One, t(inT), ptr(in), f(filterT), ptr(filter), cd(convDesc), m_fwdAlgo.algo,
+                                                         ptr(workspace), m_fwdAlgo.memory, &C::Zero, t(outT), ptr(out), t(biasT), ptr(bias),
+                                                         m_reluDesc, t(outT), ptr(out)));
+    }
+
+    void BackwardBiasReLU(const Tensor4D& outT, const Mat& out, const Mat& srcGrad, Mat& convGrad, const Tensor4D& biasT, Mat& biasGrad) override
+    {
+        assert(outT.w() * outT.h() * outT.c() == out.GetNumRows());
+        assert(outT.n() == out.GetNumCols());
+        assert(srcGrad.GetNumRows() == out.GetNumRows() && srcGrad.GetNumCols() == out.GetNumCols());
+        assert(convGrad.GetNumRows() == out.GetNumRows() && convGrad.GetNumCols() == out.GetNumCols());
+        assert(biasT.c() == outT.c());
+
+        // The ReLU's derivative only depends on the sign, and out > 0 exactly where its input is, so 'out' serves as x as well.
+        CUDNN_CALL(cudnnActivationBackward(m_cudnn, m_reluDesc, &C::One, t(outT), ptr(out), t(outT), ptr(srcGrad), t(outT), ptr(out),
+                                           &C::Zero, t(outT), ptr(convGrad)));
+        CUDNN_CALL(cudnnConvolutionBackwardBias(m_cudnn, &C::One, t(outT), ptr(convGrad), &C::One, t(biasT), ptr(biasGrad)));
+    }
+#endif
+
     void NormalizeBatch(const Tensor4D& inT, const Mat& in, const Tensor4D& scaleBiasT, const Mat& scale, const Mat& bias,
                         bool spatial, double expAvgFactor, Mat& runMean, Mat& runInvStdDev, Mat& out, Mat& saveMean, Mat& saveInvStdDev) override
     {
@@ -440,19 +593,49 @@ public:
     }
 
 private:
+    // key into the CuDnnAlgorithmCache; x and y are the input and output of the forward convolution
+    std::string AlgoCacheKey(const char* op, const CuDnnTensor4D& x, const CuDnnFilter& filtT, const CuDnnConvolutionDescriptor& convDesc, const CuDnnTensor4D& y, size_t maxMem) const
+    {
+        return msra::strfun::strprintf("%s cudnn%d %s %s x=%dx%dx%dx%d w=%dx%dx%dx%d stride=%dx%d pad=%d y=%dx%dx%dx%d maxMem=%llu",
+                                       m_gpuModel.c_str(), (int) cudnnGetVersion(), sizeof(ElemType) == sizeof(float) ? "float" : "double", op,
+                                       (int) x.w(), (int) x.h(), (int) x.c(), (int) x.n(),
+                                       (int) filtT.w(), (int) filtT.h(), (int) filtT.c(), (int) filtT.k(),
+                                       (int) convDesc.wStride(), (int) convDesc.hStride(), (int) convDesc.padding(),
+                                       (int) y.w(), (int) y.h(), (int) y.c(), (int) y.n(), (unsigned long long) maxMem);
+    }
+
     void FindBestForwardAlgo(const CuDnnTensor4D& inT, const CuDnnFilter& filtT, const CuDnnConvolutionDescriptor& convDesc, const CuDnnTensor4D& outT)
     {
-        // Need to re-run auto-tuner in case batch size has been changed.
+        // Need to re-run auto-tuner in case batch size has grown. An algorithm tuned for a larger minibatch is kept for smaller ones
+        // (e.g. the last minibatch of a sweep, or evaluation requests of varying size) if it fits into the workspace it was tuned with,
+        // so that tuning for the largest size once (see CNTKEval::Warmup()) avoids re-tuning for the others.
         // We assume no other dimensions of tensors can change so we don't check it.
         // REVIEW alexeyk: is this a safe assumption? Can convolution configuration change in runtime?
-        if (m_fwdAlgo.status == CUDNN_STATUS_SUCCESS && inT.n() == m_curMBSize && outT.n() == m_curMBSize)
+        size_t workspaceSize;
+        if (m_fwdAlgo.status == CUDNN_STATUS_SUCCESS && inT.n() == outT.n() && inT.n() <= m_fwdMBSize &&
+            (inT.n() == m_fwdMBSize || (cudnnGetConvolutionForwardWorkspaceSize(m_cudnn, inT, filtT, convDesc, outT, m_fwdAlgo.algo, &workspaceSize) == CUDNN_STATUS_SUCCESS && workspaceSize <= m_fwdAlgo.memory)))
             return;
+        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : inT.w() * inT.h() * inT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
+        std::string key = AlgoCacheKey("fwd", inT, filtT, convDesc, outT, maxMem);
+        int algo;
+        if (CuDnnAlgorithmCache::Instance().Find(key, algo))
+        {
+            size_t memory;
+            if (cudnnGetConvolutionForwardWorkspaceSize(m_cudnn, inT, filtT, convDesc, outT, (cudnnConvolutionFwdAlgo_t) algo, &memory) == CUDNN_STATUS_SUCCESS && memory <= maxMem)
+            {
+                m_fwdMBSize = inT.n();
+                m_fwdAlgo.algo = (cudnnConvolutionFwdAlgo_t) algo;
+                m_fwdAlgo.status = CUDNN_STATUS_SUCCESS;
+                m_fwdAlgo.time = 0;
+                m_fwdAlgo.memory = memory;
+                return;
+            }
+        }
         const int MaxAlgoCount = 10;
         int calgo = 0;
         cudnnConvolutionFwdAlgoPerf_t algoPerf[MaxAlgoCount];
         CUDNN_CALL(cudnnFindConvolutionForwardAlgorithm(m_cudnn, inT, filtT, convDesc, outT, MaxAlgoCount, &calgo, algoPerf));
         assert(calgo > 0);
-        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : inT.w() * inT.h() * inT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
         auto res = std::find_if(algoPerf, algoPerf + calgo,
                                 [=](const cudnnConvolutionFwdAlgoPerf_t& cur)
                                 {
@@ -460,20 +643,39 @@ private:
                                 });
         if (res == algoPerf + calgo)
             RuntimeError("cuDNN could not find suitable algorithm for cudnnConvolutionForward.");
-        m_curMBSize = inT.n();
+        m_fwdMBSize = inT.n();
         m_fwdAlgo = *res;
+        CuDnnAlgorithmCache::Instance().Add(key, (int) m_fwdAlgo.algo);
     }
 
     void FindBestBackwardDataAlgo(const CuDnnFilter& filtT, const CuDnnTensor4D& srcGradT, const CuDnnConvolutionDescriptor& convDesc, const CuDnnTensor4D& gradT)
     {
-        if (m_backDataAlgo.status == CUDNN_STATUS_SUCCESS && srcGradT.n() == m_curMBSize && gradT.n() == m_curMBSize)
+        // (kept for smaller minibatches, see FindBestForwardAlgo())
+        size_t workspaceSize;
+        if (m_backDataAlgo.status == CUDNN_STATUS_SUCCESS && srcGradT.n() == gradT.n() && srcGradT.n() <= m_backDataMBSize &&
+            (srcGradT.n() == m_backDataMBSize || (cudnnGetConvolutionBackwardDataWorkspaceSize(m_cudnn, filtT, srcGradT, convDesc, gradT, m_backDataAlgo.algo, &workspaceSize) == CUDNN_STATUS_SUCCESS && workspaceSize <= m_backDataAlgo.memory)))
             return;
+        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : gradT.w() * gradT.h() * gradT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
+        std::string key = AlgoCacheKey("bwdData", gradT, filtT, convDesc, srcGradT, maxMem);
+        int algo;
+        if (CuDnnAlgorithmCache::Instance().Find(key, algo))
+        {
+            size_t memory;
+            if (cudnnGetConvolutionBackwardDataWorkspaceSize(m_cudnn, filtT, srcGradT, convDesc, gradT, (cudnnConvolutionBwdDataAlgo_t) algo, &memory) == CUDNN_STATUS_SUCCESS && memory <= maxMem)
+            {
+                m_backDataMBSize = srcGradT.n();
+                m_backDataAlgo.algo = (cudnnConvolutionBwdDataAlgo_t) algo;
+                m_backDataAlgo.status = CUDNN_STATUS_SUCCESS;
+                m_backDataAlgo.time = 0;
+                m_backDataAlgo.memory = memory;
+                return;
+            }
+        }
         const int MaxAlgoCount = 10;
         int calgo = 0;
         cudnnConvolutionBwdDataAlgoPerf_t algoPerf[MaxAlgoCount];
         CUDNN_CALL(cudnnFindConvolutionBackwardDataAlgorithm(m_cudnn, filtT, srcGradT, convDesc, gradT, MaxAlgoCount, &calgo, algoPerf));
         assert(calgo > 0);
-        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : gradT.w() * gradT.h() * gradT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
         auto res = std::find_if(algoPerf, algoPerf + calgo,
                                 [=](const cudnnConvolutionBwdDataAlgoPerf_t& cur)
                                 {
@@ -481,20 +683,39 @@ private:
                                 });
         if (res == algoPerf + calgo)
             RuntimeError("cuDNN could not find suitable algorithm for cudnnConvolutionBackwardData.");
-        m_curMBSize = srcGradT.n();
+        m_backDataMBSize = srcGradT.n();
         m_backDataAlgo = *res;
+        CuDnnAlgorithmCache::Instance().Add(key, (int) m_backDataAlgo.algo);
     }
 
     void FindBestBackwardFilterAlgo(const CuDnnTensor4D& inT, const CuDnnTensor4D& srcGradT, const CuDnnConvolutionDescriptor& convDesc, const CuDnnFilter& filtT)
     {
-        if (m_backFiltAlgo.status == CUDNN_STATUS_SUCCESS && inT.n() == m_curMBSize && srcGradT.n() == m_curMBSize)
+        // (kept for smaller minibatches, see FindBestForwardAlgo())
+        size_t workspaceSize;
+        if (m_backFiltAlgo.status == CUDNN_STATUS_SUCCESS && inT.n() == srcGradT.n() && inT.n() <= m_backFiltMBSize &&
+            (inT.n() == m_backFiltMBSize || (cudnnGetConvolutionBackwardFilterWorkspaceSize(m_cudnn, inT, srcGradT, convDesc, filtT, m_backFiltAlgo.algo, &workspaceSize) == CUDNN_STATUS_SUCCESS && workspaceSize <= m_backFiltAlgo.memory)))
             return;
+        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : inT.w() * inT.h() * inT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
+        std::string key = AlgoCacheKey("bwdFilter", inT, filtT, convDesc, srcGradT, maxMem);
+        int algo;
+        if (CuDnnAlgorithmCache::Instance().Find(key, algo))
+        {
+            size_t memory;
+            if (cudnnGetConvolutionBackwardFilterWorkspaceSize(m_cudnn, inT, srcGradT, convDesc, filtT, (cudnnConvolutionBwdFilterAlgo_t) algo, &memory) == CUDNN_STATUS_SUCCESS && memory <= maxMem)
+            {
+                m_backFiltMBSize = inT.n();
+                m_backFiltAlgo.algo = (cudnnConvolutionBwdFilterAlgo_t) algo;
+                m_backFiltAlgo.status = CUDNN_STATUS_SUCCESS;
+                m_backFiltAlgo.time = 0;
+                m_backFiltAlgo.memory = memory;
+                return;
+            }
+        }
         const int MaxAlgoCount = 10;
         int calgo = 0;
         cudnnConvolutionBwdFilterAlgoPerf_t algoPerf[MaxAlgoCount];
         CUDNN_CALL(cudnnFindConvolutionBackwardFilterAlgorithm(m_cudnn, inT, srcGradT, convDesc, filtT, MaxAlgoCount, &calgo, algoPerf));
         assert(calgo > 0);
-        size_t maxMem = m_maxTempMemSizeInSamples == 0 ? (std::numeric_limits<size_t>::max)() : inT.w() * inT.h() * inT.c() * m_maxTempMemSizeInSamples * sizeof(ElemType);
         auto res = std::find_if(algoPerf, algoPerf + calgo,
                                 [=](const cudnnConvolutionBwdFilterAlgoPerf_t& cur)
                                 {
@@ -502,8 +723,9 @@ private:
                                 });
         if (res == algoPerf + calgo)
             RuntimeError("cuDNN could not find suitable algorithm for cudnnConvolutionBackwardFilter.");
-        m_curMBSize = inT.n();
+        m_backFiltMBSize = inT.n();
         m_backFiltAlgo = *res;
+        CuDnnAlgorithmCache::Instance().Add(key, (int) m_backFiltAlgo.algo);
     }
 
 private:
@@ -512,11 +734,17 @@ private:
     // REVIEW alexeyk: currently limit is set once in ctor though in CNTK it can be, theoretically, changed in runtime.
     size_t m_maxTempMemSizeInSamples;
     cudnnHandle_t m_cudnn;
-    // Current mini-batch size, needed for re-computing statistics in auto-tuner.
-    size_t m_curMBSize;
+    std::string m_gpuModel;
+    // Mini-batch sizes the algorithms were tuned for, needed for re-computing statistics in auto-tuner.
+    size_t m_fwdMBSize;
+    size_t m_backDataMBSize;
+    size_t m_backFiltMBSize;
     cudnnConvolutionFwdAlgoPerf_t m_fwdAlgo;
     cudnnConvolutionBwdDataAlgoPerf_t m_backDataAlgo;
     cudnnConvolutionBwdFilterAlgoPerf_t m_backFiltAlgo;
+#if CUDNN_VERSION >= 6000
+    cudnnActivationDescriptor_t m_reluDesc;
+#endif
 };
 
 template <class ElemType>
@@ -629,9 +857,9 @@ typename CuDnnConvolutionEngineFactory<ElemType>::PoolDescPtr CuDnnConvolutionEn
 
 template <class ElemType>
 typename CuDnnConvolutionEngineFactory<ElemType>::ConvEnginePtr CuDnnConvolutionEngineFactory<ElemType>::CreateConvEngine(
-    DEVICEID_TYPE /*deviceId*/, size_t maxTempMemSizeInSamples)
+    DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples)
 {
-    return std::make_unique<CuDnnConvolutionEngine<ElemType>>(maxTempMemSizeInSamples);
+    return std::make_unique<CuDnnConvolutionEngine<ElemType>>(deviceId, maxTempMemSizeInSamples);
 }
 
 template <class ElemType>
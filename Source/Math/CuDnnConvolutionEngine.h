@@ -10,7 +10,7 @@
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 template <class ElemType>
-class CuDnnConvolutionEngineFactory : public ConvolutionEngineFactory<ElemType>
+class MATH_API CuDnnConvolutionEngineFactory : public ConvolutionEngineFactory<ElemType>
 {
 public:
     using Base = ConvolutionEngineFactory<ElemType>;
@@ -36,6 +36,15 @@ public:
     ConvEnginePtr CreateConvEngine(DEVICEID_TYPE deviceId, size_t maxTempMemSizeInSamples) override;
     PoolEnginePtr CreatePoolEngine(DEVICEID_TYPE deviceId) override;
 
+    ImageLayoutKind GetImageLayout() const override
+    {
+        return ImageLayoutKind::CHW;
+    }
+
     static bool IsSupported(DEVICEID_TYPE deviceId);
+
+    // Persist the algorithms picked by the cuDNN auto-tuner in a file, such that later runs (and other
+    // workers sharing the file) skip the benchmarking. Empty path disables it (default).
+    static void SetAlgorithmCacheFile(const std::wstring& path); // note: this does not depend on <ElemType>, i.e. you can call it on any <ElemType>
 };
 } } }
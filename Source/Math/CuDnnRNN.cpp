@@ -0,0 +1,371 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#include "stdafx.h"
+#include "CuDnnRNN.h"
+#include "GPUMatrix.h"
+#ifdef USE_CUDNN
+#include <cudnn.h>
+
+template <>
+const char* CudaErrString<cudnnStatus_t>(cudnnStatus_t x); // defined in CuDnnConvolutionEngine.cpp
+
+// The RNN API was introduced in cuDNN 5. Against older versions, this compiles to an executor that cannot be constructed.
+#if CUDNN_MAJOR >= 5
+#define CUDNN_RNN_AVAILABLE
+#endif
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+#ifdef CUDNN_RNN_AVAILABLE
+
+template <typename ElemType>
+static cudnnDataType_t GetDataType();
+template <>
+cudnnDataType_t GetDataType<float>()
+{
+    return CUDNN_DATA_FLOAT;
+}
+template <>
+cudnnDataType_t GetDataType<double>()
+{
+    return CUDNN_DATA_DOUBLE;
+}
+
+template <typename ElemType>
+static ElemType* ptr(Matrix<ElemType>& src)
+{
+    return src.BufferPointer();
+}
+template <typename ElemType>
+static const ElemType* ptr(const Matrix<ElemType>& src)
+{
+    return src.BufferPointer();
+}
+
+// size workspace-like matrices in bytes
+template <typename ElemType>
+static void ResizeToBytes(Matrix<ElemType>& m, size_t numBytes)
+{
+    m.Resize((numBytes + sizeof(ElemType) - 1) / sizeof(ElemType), 1);
+}
+
+template <class ElemType>
+struct CuDnnRNNExecutor<ElemType>::Impl
+{
+    CuDnnRNNParams m_params;
+    cudnnDataType_t m_dataType;
+    cudnnHandle_t m_cudnn;
+    cudnnDropoutDescriptor_t m_dropout;
+    Matrix<ElemType> m_dropoutStates;
+    cudnnRNNDescriptor_t m_rnn;
+    cudnnFilterDescriptor_t m_weights;
+    cudnnTensorDescriptor_t m_state; // of the (zero) initial and the (unused) final states
+    std::vector<cudnnTensorDescriptor_t> m_xDescs, m_yDescs;
+    std::vector<size_t> m_numSequencesPerFrame; // that m_xDescs and m_yDescs describe
+    size_t m_workspaceBytes;
+    size_t m_reserveBytes;
+
+    Impl(DEVICEID_TYPE deviceId, const CuDnnRNNParams& params)
+        : m_params(params), m_dataType(GetDataType<ElemType>()), m_cudnn(nullptr), m_dropout(nullptr), m_dropoutStates(deviceId),
+          m_rnn(nullptr), m_weights(nullptr), m_state(nullptr), m_workspaceBytes(0), m_reserveBytes(0)
+    {
+        CUDNN_CALL(cudnnCreate(&m_cudnn));
+        CUDNN_CALL(cudnnSetStream(m_cudnn, GetStream()));
+
+        // cuDNN wants a dropout descriptor even when there is no dropout
+        size_t dropoutStateBytes;
+        CUDNN_CALL(cudnnDropoutGetStatesSize(m_cudnn, &dropoutStateBytes));
+        ResizeToBytes(m_dropoutStates, dropoutStateBytes);
+        CUDNN_CALL(cudnnCreateDropoutDescriptor(&m_dropout));
+        CUDNN_CALL(cudnnSetDropoutDescriptor(m_dropout, m_cudnn, 0.0f, ptr(m_dropoutStates), dropoutStateBytes, 0));
+
+        cudnnRNNMode_t mode;
+        switch (params.m_recurrentOp)
+        {
+        case CuDnnRNNParams::RecurrentOp::lstm:    mode = CUDNN_LSTM; break;
+        case CuDnnRNNParams::RecurrentOp::gru:     mode = CUDNN_GRU; break;
+        case CuDnnRNNParams::RecurrentOp::rnnReLU: mode = CUDNN_RNN_RELU; break;
+        default:                                   mode = CUDNN_RNN_TANH; break;
+        }
+        CUDNN_CALL(cudnnCreateRNNDescriptor(&m_rnn));
+#if CUDNN_MAJOR >= 6
+        CUDNN_CALL(cudnnSetRNNDescriptor_v5(m_rnn, (int) params.m_hiddenSize, (int) params.m_numLayers, m_dropout, CUDNN_LINEAR_INPUT,
+                                            params.m_bidirectional ? CUDNN_BIDIRECTIONAL : CUDNN_UNIDIRECTIONAL, mode, m_dataType));
+#else
+        CUDNN_CALL(cudnnSetRNNDescriptor(m_rnn, (int) params.m_hiddenSize, (int) params.m_numLayers, m_dropout, CUDNN_LINEAR_INPUT,
+                                         params.m_bidirectional ? CUDNN_BIDIRECTIONAL : CUDNN_UNIDIRECTIONAL, mode, m_dataType));
+#endif
+
+        // the weights are one opaque vector; check that our layout formula agrees with cuDNN's
+        cudnnTensorDescriptor_t xDesc = CreateTensor(1, params.m_inputDim);
+        size_t weightBytes;
+        CUDNN_CALL(cudnnGetRNNParamsSize(m_cudnn, m_rnn, xDesc, &weightBytes, m_dataType));
+        cudnnDestroyTensorDescriptor(xDesc);
+        if (weightBytes != params.GetNumWeights() * sizeof(ElemType))
+            LogicError("CuDnnRNNExecutor: cuDNN expects %d weights, but %d were computed.", (int) (weightBytes / sizeof(ElemType)), (int) params.GetNumWeights());
+        const int weightDims[3] = {(int) params.GetNumWeights(), 1, 1};
+        CUDNN_CALL(cudnnCreateFilterDescriptor(&m_weights));
+        CUDNN_CALL(cudnnSetFilterNdDescriptor(m_weights, m_dataType, CUDNN_TENSOR_NCHW, 3, weightDims));
+    }
+
+    ~Impl()
+    {
+        for (auto desc : m_xDescs)
+            cudnnDestroyTensorDescriptor(desc);
+        for (auto desc : m_yDescs)
+            cudnnDestroyTensorDescriptor(desc);
+        if (m_state)
+            cudnnDestroyTensorDescriptor(m_state);
+        if (m_weights)
+            cudnnDestroyFilterDescriptor(m_weights);
+        if (m_rnn)
+            cudnnDestroyRNNDescriptor(m_rnn);
+        if (m_dropout)
+            cudnnDestroyDropoutDescriptor(m_dropout);
+        if (m_cudnn)
+            cudnnDestroy(m_cudnn);
+    }
+
+    // [batch x dim x 1] tensor, as cuDNN wants for each time step
+    cudnnTensorDescriptor_t CreateTensor(size_t batch, size_t dim) const
+    {
+        cudnnTensorDescriptor_t desc;
+        const int dims[3] = {(int) batch, (int) dim, 1};
+        const int strides[3] = {(int) dim, 1, 1};
+        CUDNN_CALL(cudnnCreateTensorDescriptor(&desc));
+        CUDNN_CALL(cudnnSetTensorNdDescriptor(desc, m_dataType, 3, dims, strides));
+        return desc;
+    }
+
+    // (re-)create the per-time-step descriptors and sizes for a new minibatch layout
+    void SetLayout(const std::vector<size_t>& numSequencesPerFrame)
+    {
+        if (numSequencesPerFrame.empty())
+            InvalidArgument("CuDnnRNNExecutor: The minibatch is empty.");
+        for (size_t t = 1; t < numSequencesPerFrame.size(); t++)
+            if (numSequencesPerFrame[t] > numSequencesPerFrame[t - 1])
+                InvalidArgument("CuDnnRNNExecutor: Sequences must be sorted by decreasing length.");
+        // re-bind the stream each time, since the current stream may differ from the one at construction
+        CUDNN_CALL(cudnnSetStream(m_cudnn, GetStream()));
+        if (numSequencesPerFrame == m_numSequencesPerFrame)
+            return;
+
+        for (auto desc : m_xDescs)
+            cudnnDestroyTensorDescriptor(desc);
+        for (auto desc : m_yDescs)
+            cudnnDestroyTensorDescriptor(desc);
+        m_xDescs.clear();
+        m_yDescs.clear();
+        if (m_state)
+            cudnnDestroyTensorDescriptor(m_state);
+        m_state = nullptr;
+        m_numSequencesPerFrame.clear();
+
+        for (size_t numSequences : numSequencesPerFrame)
+        {
+            m_xDescs.push_back(CreateTensor(numSequences, m_params.m_inputDim));
+            m_yDescs.push_back(CreateTensor(numSequences, m_params.GetOutputDim()));
+        }
+        const int stateDims[3] = {(int) (m_params.m_numLayers * m_params.GetNumDirections()), (int) numSequencesPerFrame[0], (int) m_params.m_hiddenSize};
+        const int stateStrides[3] = {stateDims[1] * stateDims[2], stateDims[2], 1};
+        CUDNN_CALL(cudnnCreateTensorDescriptor(&m_state));
+        CUDNN_CALL(cudnnSetTensorNdDescriptor(m_state, m_dataType, 3, stateDims, stateStrides));
+
+        CUDNN_CALL(cudnnGetRNNWorkspaceSize(m_cudnn, m_rnn, (int) m_xDescs.size(), m_xDescs.data(), &m_workspaceBytes));
+        CUDNN_CALL(cudnnGetRNNTrainingReserveSize(m_cudnn, m_rnn, (int) m_xDescs.size(), m_xDescs.data(), &m_reserveBytes));
+        m_numSequencesPerFrame = numSequencesPerFrame;
+    }
+
+    int GetSeqLength() const
+    {
+        return (int) m_numSequencesPerFrame.size();
+    }
+};
+
+template <class ElemType>
+CuDnnRNNExecutor<ElemType>::CuDnnRNNExecutor(DEVICEID_TYPE deviceId, const CuDnnRNNParams& params)
+    : m_impl(new Impl(deviceId, params))
+{
+}
+
+template <class ElemType>
+bool CuDnnRNNExecutor<ElemType>::IsSupported(DEVICEID_TYPE deviceId)
+{
+    cudaDeviceProp props = {0};
+    return deviceId >= 0 && cudaGetDeviceProperties(&props, deviceId) == cudaSuccess && props.major >= 3;
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::ForwardProp(const Matrix<ElemType>& weights, const Matrix<ElemType>& x, Matrix<ElemType>& y,
+                                             const std::vector<size_t>& numSequencesPerFrame, bool training, Matrix<ElemType>& reserve, Matrix<ElemType>& workspace)
+{
+    Impl& impl = *m_impl;
+    impl.SetLayout(numSequencesPerFrame);
+    if (weights.GetNumElements() != impl.m_params.GetNumWeights())
+        InvalidArgument("CuDnnRNNExecutor: Expected %d weights, but got %d.", (int) impl.m_params.GetNumWeights(), (int) weights.GetNumElements());
+    if (x.GetNumRows() != impl.m_params.m_inputDim)
+        InvalidArgument("CuDnnRNNExecutor: Expected input dimension %d, but got %d.", (int) impl.m_params.m_inputDim, (int) x.GetNumRows());
+    y.Resize(impl.m_params.GetOutputDim(), x.GetNumCols());
+    ResizeToBytes(workspace, impl.m_workspaceBytes);
+    if (training)
+    {
+        ResizeToBytes(reserve, impl.m_reserveBytes);
+        CUDNN_CALL(cudnnRNNForwardTraining(impl.m_cudnn, impl.m_rnn, impl.GetSeqLength(),
+                                           impl.m_xDescs.data(), ptr(x),
+                                           impl.m_state, nullptr, impl.m_state, nullptr, // zero initial states
+                                           impl.m_weights, ptr(weights),
+                                           impl.m_yDescs.data(), ptr(y),
+                                           impl.m_state, nullptr, impl.m_state, nullptr, // final states not needed
+                                           ptr(workspace), impl.m_workspaceBytes, ptr(reserve), impl.m_reserveBytes));
+    }
+    else
+    {
+        CUDNN_CALL(cudnnRNNForwardInference(impl.m_cudnn, impl.m_rnn, impl.GetSeqLength(),
+                                            impl.m_xDescs.data(), ptr(x),
+                                            impl.m_state, nullptr, impl.m_state, nullptr,
+                                            impl.m_weights, ptr(weights),
+                                            impl.m_yDescs.data(), ptr(y),
+                                            impl.m_state, nullptr, impl.m_state, nullptr,
+                                            ptr(workspace), impl.m_workspaceBytes));
+    }
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardData(const Matrix<ElemType>& y, const Matrix<ElemType>& dy, const Matrix<ElemType>& weights, Matrix<ElemType>& dx,
+                                              Matrix<ElemType>& reserve, Matrix<ElemType>& workspace)
+{
+    Impl& impl = *m_impl;
+    impl.SetLayout(impl.m_numSequencesPerFrame);
+    dx.Resize(impl.m_params.m_inputDim, y.GetNumCols());
+    ResizeToBytes(workspace, impl.m_workspaceBytes);
+    CUDNN_CALL(cudnnRNNBackwardData(impl.m_cudnn, impl.m_rnn, impl.GetSeqLength(),
+                                    impl.m_yDescs.data(), ptr(y),
+                                    impl.m_yDescs.data(), ptr(dy),
+                                    impl.m_state, nullptr, impl.m_state, nullptr, // no gradients from the final states
+                                    impl.m_weights, ptr(weights),
+                                    impl.m_state, nullptr, impl.m_state, nullptr, // zero initial states
+                                    impl.m_xDescs.data(), ptr(dx),
+                                    impl.m_state, nullptr, impl.m_state, nullptr, // initial-state gradients not needed
+                                    ptr(workspace), impl.m_workspaceBytes, ptr(reserve), impl.m_reserveBytes));
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardWeights(const Matrix<ElemType>& x, const Matrix<ElemType>& y, Matrix<ElemType>& dw,
+                                                 const Matrix<ElemType>& reserve, Matrix<ElemType>& workspace)
+{
+    Impl& impl = *m_impl;
+    impl.SetLayout(impl.m_numSequencesPerFrame);
+    ResizeToBytes(workspace, impl.m_workspaceBytes);
+    CUDNN_CALL(cudnnRNNBackwardWeights(impl.m_cudnn, impl.m_rnn, impl.GetSeqLength(),
+                                       impl.m_xDescs.data(), ptr(x),
+                                       impl.m_state, nullptr,
+                                       impl.m_yDescs.data(), ptr(y),
+                                       ptr(workspace), impl.m_workspaceBytes,
+                                       impl.m_weights, ptr(dw),
+                                       ptr(reserve), impl.m_reserveBytes));
+}
+
+// cuDNN's linear layers 0..3 act on the layer input, 4..7 on the recurrent state, each for the gates i, f, c, o (in this order).
+// Each matrix is [H x dim] row-major, i.e. exactly one [dim x H] column block of our (column-major) transposed layout.
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::GetLSTMLayerWeights(const Matrix<ElemType>& weights, size_t layer, Matrix<ElemType>& inputWeights, Matrix<ElemType>& recurrentWeights, Matrix<ElemType>& bias)
+{
+    Impl& impl = *m_impl;
+    const auto& params = impl.m_params;
+    if (params.m_recurrentOp != CuDnnRNNParams::RecurrentOp::lstm || params.m_bidirectional || layer >= params.m_numLayers)
+        LogicError("GetLSTMLayerWeights: Only the layers of unidirectional LSTM stacks can be extracted.");
+    const size_t H = params.m_hiddenSize;
+    const size_t layerInputDim = layer == 0 ? params.m_inputDim : H;
+    inputWeights.Resize(layerInputDim, 4 * H);
+    recurrentWeights.Resize(H, 4 * H);
+    Matrix<ElemType> biases(4 * H, 2, weights.GetDeviceId()); // the input biases, and the recurrent ones
+
+    cudnnTensorDescriptor_t xDesc = impl.CreateTensor(1, params.m_inputDim);
+    cudnnFilterDescriptor_t linLayerDesc;
+    CUDNN_CALL(cudnnCreateFilterDescriptor(&linLayerDesc));
+    for (int linLayer = 0; linLayer < 8; linLayer++)
+    {
+        const size_t g = linLayer % 4;
+        const bool recurrent = linLayer >= 4;
+        for (int isBias = 0; isBias < 2; isBias++)
+        {
+            void* p;
+            if (isBias)
+                CUDNN_CALL(cudnnGetRNNLinLayerBiasParams(impl.m_cudnn, impl.m_rnn, (int) layer, xDesc, impl.m_weights, (void*) ptr(weights), linLayer, linLayerDesc, &p));
+            else
+                CUDNN_CALL(cudnnGetRNNLinLayerMatrixParams(impl.m_cudnn, impl.m_rnn, (int) layer, xDesc, impl.m_weights, (void*) ptr(weights), linLayer, linLayerDesc, &p));
+            cudnnDataType_t dataType;
+            cudnnTensorFormat_t format;
+            int numDims, dims[3];
+            CUDNN_CALL(cudnnGetFilterNdDescriptor(linLayerDesc, 3, &dataType, &format, &numDims, dims));
+            size_t numElements = 1;
+            for (int i = 0; i < numDims; i++)
+                numElements *= dims[i];
+            const size_t expected = isBias ? H : H * (recurrent ? H : layerInputDim);
+            if (numElements != expected)
+                LogicError("GetLSTMLayerWeights: cuDNN has %d weights for linear layer %d, but %d were expected.", (int) numElements, linLayer, (int) expected);
+            ElemType* dest = isBias ? ptr(biases) + (recurrent ? 4 * H : 0) + g * H : recurrent ? ptr(recurrentWeights) + g * H * H : ptr(inputWeights) + g * H * layerInputDim;
+            CUDA_CALL(cudaMemcpyAsync(dest, p, sizeof(ElemType) * numElements, cudaMemcpyDeviceToDevice, GetStream()));
+        }
+    }
+    cudnnDestroyFilterDescriptor(linLayerDesc);
+    cudnnDestroyTensorDescriptor(xDesc);
+    bias.AssignSumOf(biases.ColumnSlice(0, 1), biases.ColumnSlice(1, 1));
+}
+
+#else // !CUDNN_RNN_AVAILABLE
+
+template <class ElemType>
+struct CuDnnRNNExecutor<ElemType>::Impl
+{
+};
+
+template <class ElemType>
+CuDnnRNNExecutor<ElemType>::CuDnnRNNExecutor(DEVICEID_TYPE, const CuDnnRNNParams&)
+{
+    RuntimeError("CuDnnRNNExecutor: The code was compiled without cuDNN 5 or later, which is needed for the cuDNN RNN implementation.");
+}
+
+template <class ElemType>
+bool CuDnnRNNExecutor<ElemType>::IsSupported(DEVICEID_TYPE)
+{
+    return false;
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::ForwardProp(const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                             const std::vector<size_t>&, bool, Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardData(const Matrix<ElemType>&, const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                              Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardWeights(const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                                 const Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::GetLSTMLayerWeights(const Matrix<ElemType>&, size_t, Matrix<ElemType>&, Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+#endif
+
+template <class ElemType>
+CuDnnRNNExecutor<ElemType>::~CuDnnRNNExecutor()
+{
+}
+
+template class CuDnnRNNExecutor<float>;
+template class CuDnnRNNExecutor<double>;
+} } }
@@ -0,0 +1,127 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+
+#pragma once
+
+#include "Matrix.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// CuDnnRNNParams -- shape of a stack of recurrent layers for cuDNN
+// -----------------------------------------------------------------------
+
+struct CuDnnRNNParams
+{
+    enum class RecurrentOp
+    {
+        lstm,
+        gru,
+        rnnReLU,
+        rnnTanh
+    };
+
+    size_t m_inputDim;
+    size_t m_hiddenSize;
+    size_t m_numLayers;
+    bool m_bidirectional;
+    RecurrentOp m_recurrentOp;
+
+    CuDnnRNNParams(size_t inputDim, size_t hiddenSize, size_t numLayers, bool bidirectional, RecurrentOp recurrentOp)
+        : m_inputDim(inputDim), m_hiddenSize(hiddenSize), m_numLayers(numLayers), m_bidirectional(bidirectional), m_recurrentOp(recurrentOp)
+    {
+    }
+
+    size_t GetNumDirections() const
+    {
+        return m_bidirectional ? 2 : 1;
+    }
+    size_t GetOutputDim() const
+    {
+        return m_hiddenSize * GetNumDirections();
+    }
+    size_t GetNumGates() const
+    {
+        return m_recurrentOp == RecurrentOp::lstm ? 4 : m_recurrentOp == RecurrentOp::gru ? 3 : 1;
+    }
+
+    // number of elements of the (opaque) weight vector as cuDNN lays it out: per layer and direction, an input and a
+    // recurrent matrix and two bias vectors for each gate; layers above the first see the outputs of all directions
+    size_t GetNumWeights() const
+    {
+        size_t numWeights = 0;
+        for (size_t layer = 0; layer < m_numLayers; layer++)
+        {
+            const size_t layerInputDim = layer == 0 ? m_inputDim : GetOutputDim();
+            numWeights += GetNumDirections() * GetNumGates() * (m_hiddenSize * layerInputDim + m_hiddenSize * m_hiddenSize + 2 * m_hiddenSize);
+        }
+        return numWeights;
+    }
+
+    static RecurrentOp ParseRecurrentOp(const std::wstring& name)
+    {
+        if (name == L"lstm")
+            return RecurrentOp::lstm;
+        else if (name == L"gru")
+            return RecurrentOp::gru;
+        else if (name == L"rnnReLU")
+            return RecurrentOp::rnnReLU;
+        else if (name == L"rnnTanh")
+            return RecurrentOp::rnnTanh;
+        InvalidArgument("Unknown recurrentOp '%ls'. Must be one of lstm, gru, rnnReLU, rnnTanh.", name.c_str());
+    }
+    static std::wstring RecurrentOpName(RecurrentOp op)
+    {
+        switch (op)
+        {
+        case RecurrentOp::lstm:    return L"lstm";
+        case RecurrentOp::gru:     return L"gru";
+        case RecurrentOp::rnnReLU: return L"rnnReLU";
+        default:                   return L"rnnTanh";
+        }
+    }
+};
+
+// -----------------------------------------------------------------------
+// CuDnnRNNExecutor -- runs a whole stack of recurrent layers over all time steps of a minibatch in single cuDNN calls
+// The data are packed: column t-major, i.e. first the numSequencesPerFrame[0] sequences of time step 0, then those of step 1,
+// etc., where the sequences are sorted by decreasing length, so that numSequencesPerFrame[] never increases.
+// Initial states are zero. BackwardData() must be called before BackwardWeights(), both after ForwardProp(training=true),
+// which fills 'reserve' with what they need. Requires cuDNN 5 or later.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class MATH_API CuDnnRNNExecutor
+{
+public:
+    CuDnnRNNExecutor(DEVICEID_TYPE deviceId, const CuDnnRNNParams& params);
+    ~CuDnnRNNExecutor();
+
+    static bool IsSupported(DEVICEID_TYPE deviceId);
+
+    void ForwardProp(const Matrix<ElemType>& weights, const Matrix<ElemType>& x, Matrix<ElemType>& y,
+                     const std::vector<size_t>& numSequencesPerFrame, bool training, Matrix<ElemType>& reserve, Matrix<ElemType>& workspace);
+    // dx = gradient of the input (overwritten)
+    void BackwardData(const Matrix<ElemType>& y, const Matrix<ElemType>& dy, const Matrix<ElemType>& weights, Matrix<ElemType>& dx,
+                      Matrix<ElemType>& reserve, Matrix<ElemType>& workspace);
+    // dw += gradient of the weights
+    void BackwardWeights(const Matrix<ElemType>& x, const Matrix<ElemType>& y, Matrix<ElemType>& dw,
+                         const Matrix<ElemType>& reserve, Matrix<ElemType>& workspace);
+
+    // the weights of one layer of a unidirectional LSTM stack, for Matrix::LSTMForwardWithState(): inputWeights [layer input dim x 4H] and
+    // recurrentWeights [H x 4H] with those of gate g (i, f, c, o) of unit j in column g * H + j, and bias [4H x 1] (cuDNN's two biases added)
+    void GetLSTMLayerWeights(const Matrix<ElemType>& weights, size_t layer, Matrix<ElemType>& inputWeights, Matrix<ElemType>& recurrentWeights, Matrix<ElemType>& bias);
+
+private:
+    CuDnnRNNExecutor(const CuDnnRNNExecutor&) = delete;
+    void operator=(const CuDnnRNNExecutor&) = delete;
+
+    struct Impl; // cuDNN descriptors; kept out of this header so that users need no cuDNN headers
+    std::unique_ptr<Impl> m_impl;
+};
+} } }
@@ -2,6 +2,7 @@
 #include "Basics.h"
 #include "GPUDataTransferer.h"
 #include "GPUMatrix.h"
+#include "TimelineTrace.h"
 
 #pragma comment(lib, "cudart.lib")
 
@@ -85,6 +86,7 @@ GPUDataTransferer<ElemType>::GPUDataTransferer(int deviceId, bool useConcurrentS
     // Note: Do NOT use cudaEventBlockingSync (which supposedly yields the process)--it will totally break cudaEventSynchronize(), causing it to take 50 or 100 ms randomly.
     cudaEventCreateWithFlags(&m_fetchCompleteEvent, cudaEventDisableTiming) || "cudaEventCreateWithFlags failed";
     cudaEventCreateWithFlags(&m_assignCompleteEvent, cudaEventDisableTiming) || "cudaEventCreateWithFlags failed";
+    cudaEventCreateWithFlags(&m_computeEvent, cudaEventDisableTiming) || "cudaEventCreateWithFlags failed";
 
 #pragma warning(disable : 4127)
     if (useConcurrentStreams && (m_fetchStream == NULL))
@@ -98,6 +100,7 @@ template <class ElemType>
 GPUDataTransferer<ElemType>::~GPUDataTransferer()
 {
     // BUGBUG: we don't destroy our streams (they are static variables); we need a static destructor, I am too lazy now
+    cudaEventDestroy(m_computeEvent);
     cudaEventDestroy(m_assignCompleteEvent);
     cudaEventDestroy(m_fetchCompleteEvent);
 }
@@ -114,6 +117,7 @@ void GPUDataTransferer<ElemType>::CopyGPUToCPUAsync(ElemType* gpuBuffer, size_t
 template <class ElemType>
 void GPUDataTransferer<ElemType>::WaitForCopyGPUToCPUAsync()
 {
+    TimelineScope scope("WaitForCopyGPUToCPU", "transfer");
     PrepareDevice(m_deviceId);
 
     SyncEvent(m_fetchCompleteEvent);
@@ -131,11 +135,48 @@ void GPUDataTransferer<ElemType>::CopyCPUToGPUAsync(ElemType* cpuBuffer, size_t
 template <class ElemType>
 void GPUDataTransferer<ElemType>::WaitForCopyCPUToGPUAsync()
 {
+    TimelineScope scope("WaitForCopyCPUToGPU", "transfer");
     PrepareDevice(m_deviceId);
 
     SyncEvent(m_assignCompleteEvent);
 }
 
+template <class ElemType>
+void GPUDataTransferer<ElemType>::CopyGPUToCPUAfterComputeAsync(ElemType* gpuBuffer, size_t numElements, ElemType* cpuBuffer)
+{
+    PrepareDevice(m_deviceId);
+
+    cudaEventRecord(m_computeEvent, GetStream()) || "cudaEventRecord failed";
+    cudaStreamWaitEvent(m_fetchStream, m_computeEvent, 0 /*flags 'must be 0'*/) || "cudaStreamWaitEvent failed";
+    CopyGPUToCPUAsync(gpuBuffer, numElements, cpuBuffer);
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::WaitForCopyGPUToCPUOnComputeStream()
+{
+    PrepareDevice(m_deviceId);
+
+    cudaStreamWaitEvent(GetStream(), m_fetchCompleteEvent, 0 /*flags 'must be 0'*/) || "cudaStreamWaitEvent failed";
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::CopyCPUToGPUAfterComputeAsync(ElemType* cpuBuffer, size_t numElements, ElemType* gpuBuffer)
+{
+    PrepareDevice(m_deviceId);
+
+    cudaEventRecord(m_computeEvent, GetStream()) || "cudaEventRecord failed";
+    cudaStreamWaitEvent(m_assignStream, m_computeEvent, 0 /*flags 'must be 0'*/) || "cudaStreamWaitEvent failed";
+    CopyCPUToGPUAsync(cpuBuffer, numElements, gpuBuffer);
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::WaitForCopyCPUToGPUOnComputeStream()
+{
+    PrepareDevice(m_deviceId);
+
+    cudaStreamWaitEvent(GetStream(), m_assignCompleteEvent, 0 /*flags 'must be 0'*/) || "cudaStreamWaitEvent failed";
+}
+
 //explicit
 template class GPUDataTransferer<float>;
 template class GPUDataTransferer<double>;
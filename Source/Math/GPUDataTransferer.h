@@ -25,6 +25,13 @@ public:
     void CopyCPUToGPUAsync(ElemType* cpuBuffer, size_t numElements, ElemType* gpuBuffer);
     void WaitForCopyCPUToGPUAsync();
 
+    // for copies that overlap with computation: these start once the work issued so far on the compute stream (GetStream()) is done,
+    // and the ...OnComputeStream() functions make the compute stream, rather than the CPU, wait for them
+    void CopyGPUToCPUAfterComputeAsync(ElemType* gpuBuffer, size_t numElements, ElemType* cpuBuffer);
+    void WaitForCopyGPUToCPUOnComputeStream();
+    void CopyCPUToGPUAfterComputeAsync(ElemType* cpuBuffer, size_t numElements, ElemType* gpuBuffer);
+    void WaitForCopyCPUToGPUOnComputeStream();
+
 #ifndef CPUONLY
     static cudaStream_t GetFetchStream();
 #endif // !CPUONLY
@@ -41,6 +48,7 @@ private:
 
     mutable cudaEvent_t m_fetchCompleteEvent;
     mutable cudaEvent_t m_assignCompleteEvent;
+    cudaEvent_t m_computeEvent; // for the ...AfterComputeAsync() functions
 #endif // !CPUONLY
 
     int m_deviceId;
@@ -25,6 +25,10 @@
 #include "cublas_v2.h"
 #include <assert.h>
 #include <memory>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <tuple>
 
 #pragma comment(lib, "cudart.lib") // instruct linker to reference these libs
 #pragma comment(lib, "cublas.lib")
@@ -108,6 +112,171 @@ const char* CudaErrString<curandStatus>(curandStatus)
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// -----------------------------------------------------------------------
+// GPUMemoryCache -- caching layer underneath TracingGPUMemoryAllocator
+//
+// cudaMalloc() and cudaFree() synchronize the device, which hurts whenever matrices get resized,
+// e.g. when the minibatch size changes. Instead, we round requests up to a bucket size, and keep freed
+// buffers in per-(device, stream, bucket) free lists from which later requests of the same bucket are
+// served. Buckets are powers of two; above 1 MB each octave is split into 4 buckets, to bound the
+// waste for large buffers to 25%. Buffers are only returned to CUDA by EmptyCache(), or when cudaMalloc()
+// fails, after which we retry.
+// A buffer is only reused on the stream it was freed on, since work using it may still be in flight there.
+// -----------------------------------------------------------------------
+
+class GPUMemoryCache
+{
+    struct BufferInfo
+    {
+        int m_deviceId;
+        cudaStream_t m_stream;
+        size_t m_bucketBytes;
+        size_t m_requestedBytes;
+    };
+    typedef std::tuple<int, cudaStream_t, size_t> BucketKey; // (device, stream, bucket size)
+
+    std::mutex m_mutex;
+    std::map<BucketKey, std::vector<void*>> m_freeBuffers;
+    std::unordered_map<void*, BufferInfo> m_liveBuffers;
+    std::map<int, GPUMemoryCacheStatistics> m_statistics;
+
+    static size_t BucketSize(size_t numBytes)
+    {
+        const size_t minBucket = 512; // also the alignment cudaMalloc() gives us
+        const size_t fineBucketsFrom = 1 << 20;
+        size_t bucket = minBucket;
+        while (bucket < numBytes && bucket < fineBucketsFrom)
+            bucket *= 2;
+        if (bucket >= numBytes)
+            return bucket;
+        // large: find the octave, then round up to a quarter of it
+        while (bucket < numBytes)
+            bucket *= 2;
+        size_t quarter = bucket / 8; // octave is [bucket/2, bucket]
+        return (numBytes + quarter - 1) / quarter * quarter;
+    }
+
+    // free all cached buffers of a device; called with m_mutex held
+    void EmptyCacheNoLock(int deviceId)
+    {
+        for (auto iter = m_freeBuffers.begin(); iter != m_freeBuffers.end();)
+        {
+            if (std::get<0>(iter->first) != deviceId)
+            {
+                iter++;
+                continue;
+            }
+            PrepareDevice(deviceId);
+            for (void* p : iter->second)
+                CUDA_CALL(cudaFree(p));
+            m_statistics[deviceId].m_cachedBytes -= std::get<2>(iter->first) * iter->second.size();
+            iter = m_freeBuffers.erase(iter);
+        }
+    }
+
+public:
+    static GPUMemoryCache& Instance()
+    {
+        // Intentionally never destroyed: at process exit the CUDA runtime may already be shut down.
+        static GPUMemoryCache* cache = new GPUMemoryCache();
+        return *cache;
+    }
+
+    void* Allocate(int deviceId, size_t numBytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& stats = m_statistics[deviceId];
+        stats.m_numRequests++;
+
+        size_t bucketBytes = BucketSize(numBytes);
+        void* p = nullptr;
+        auto& freeList = m_freeBuffers[BucketKey(deviceId, t_stream, bucketBytes)];
+        if (!freeList.empty())
+        {
+            p = freeList.back();
+            freeList.pop_back();
+            stats.m_cachedBytes -= bucketBytes;
+            stats.m_numCacheHits++;
+        }
+        else
+        {
+            PrepareDevice(deviceId);
+            if (cudaMalloc(&p, bucketBytes) != cudaSuccess)
+            {
+                // out of memory: give back what we hold for this device, and try once more
+                cudaGetLastError(); // clear the error state
+                EmptyCacheNoLock(deviceId);
+                CUDA_CALL(cudaMalloc(&p, bucketBytes));
+            }
+        }
+
+        m_liveBuffers[p] = BufferInfo{deviceId, t_stream, bucketBytes, numBytes};
+        stats.m_allocatedBytes += bucketBytes;
+        stats.m_requestedBytes += numBytes;
+        stats.m_peakAllocatedBytes = std::max(stats.m_peakAllocatedBytes, stats.m_allocatedBytes);
+        return p;
+    }
+
+    // returns false if the buffer did not come from the cache
+    bool Free(void* p)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_liveBuffers.find(p);
+        if (iter == m_liveBuffers.end())
+            return false;
+        const BufferInfo& info = iter->second;
+        auto& stats = m_statistics[info.m_deviceId];
+        stats.m_allocatedBytes -= info.m_bucketBytes;
+        stats.m_requestedBytes -= info.m_requestedBytes;
+        stats.m_cachedBytes += info.m_bucketBytes;
+        m_freeBuffers[BucketKey(info.m_deviceId, info.m_stream, info.m_bucketBytes)].push_back(p);
+        m_liveBuffers.erase(iter);
+        return true;
+    }
+
+    void EmptyCache(int deviceId)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        EmptyCacheNoLock(deviceId);
+    }
+
+    GPUMemoryCacheStatistics GetStatistics(int deviceId)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_statistics[deviceId];
+    }
+
+    void ResetPeakAllocatedBytes(int deviceId)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& stats = m_statistics[deviceId];
+        stats.m_peakAllocatedBytes = stats.m_allocatedBytes;
+    }
+};
+
+void TracingGPUMemoryAllocator::EmptyCache(int deviceId)
+{
+    GPUMemoryCache::Instance().EmptyCache(deviceId);
+}
+
+GPUMemoryCacheStatistics TracingGPUMemoryAllocator::GetCacheStatistics(int deviceId)
+{
+    return GPUMemoryCache::Instance().GetStatistics(deviceId);
+}
+
+void TracingGPUMemoryAllocator::ResetPeakAllocatedBytes(int deviceId)
+{
+    GPUMemoryCache::Instance().ResetPeakAllocatedBytes(deviceId);
+}
+
+void TracingGPUMemoryAllocator::PrintCacheStatistics(int deviceId)
+{
+    auto stats = GetCacheStatistics(deviceId);
+    fprintf(stderr, "GPU memory cache on DeviceId = %d: %d MB in use, %d MB cached; hit rate = %.2f%% of %d allocations, fragmentation = %.2f%%\n",
+            (int) deviceId, (int) (stats.m_allocatedBytes >> 20), (int) (stats.m_cachedBytes >> 20),
+            100.0 * stats.HitRate(), (int) stats.m_numRequests, 100.0 * stats.Fragmentation());
+}
+
 template <typename AllocatedElemType>
 AllocatedElemType* TracingGPUMemoryAllocator::Allocate(int deviceId, size_t numRows, size_t numCols)
 {
@@ -141,11 +310,14 @@ AllocatedElemType* TracingGPUMemoryAllocator::Allocate(int deviceId, size_t numE
 template <typename AllocatedElemType>
 void TracingGPUMemoryAllocator::Free(int deviceId, AllocatedElemType* bufferPtr, bool ignoreCUDARetCode /*= false*/)
 {
-    PrepareDevice(deviceId);
-    if (ignoreCUDARetCode)
-        cudaFree((void*) bufferPtr);
-    else
-        CUDA_CALL(cudaFree((void*) bufferPtr));
+    if (!GPUMemoryCache::Instance().Free((void*) bufferPtr))
+    {
+        PrepareDevice(deviceId);
+        if (ignoreCUDARetCode)
+            cudaFree((void*) bufferPtr);
+        else
+            CUDA_CALL(cudaFree((void*) bufferPtr));
+    }
 
     if (IsTraceEnabled())
     {
@@ -160,6 +332,9 @@ AllocatedElemType* TracingGPUMemoryAllocator::AllocateNoTrace(int deviceId, size
 {
     AllocatedElemType* deviceBufferPtr;
 
+    if (IsCachingEnabled())
+        return (AllocatedElemType*) GPUMemoryCache::Instance().Allocate(deviceId, sizeof(AllocatedElemType) * numElements);
+
     PrepareDevice(deviceId);
     CUDA_CALL(cudaMalloc((void**) &deviceBufferPtr, sizeof(AllocatedElemType) * numElements));
 
@@ -185,7 +360,12 @@ std::pair<size_t, size_t> TracingGPUMemoryAllocator::GetFreeAndTotalMemoryInMBs(
 // deviceId - the device on which the operation will take place
 void PrepareDevice(DEVICEID_TYPE deviceId)
 {
-    static DEVICEID_TYPE currentDevice = AUTOPLACEMATRIX; // set to anything valid
+    // The current CUDA device is per host thread, so is our cache of it (e.g. the read-ahead thread of DataReader uploads to the GPU too).
+#ifdef _WIN32
+    static __declspec(thread) DEVICEID_TYPE currentDevice = AUTOPLACEMATRIX; // set to anything valid
+#else
+    static __thread DEVICEID_TYPE currentDevice = AUTOPLACEMATRIX;
+#endif
     // and if we last set the device to be this device we are good
     if (deviceId == currentDevice)
         return;
@@ -193,6 +373,237 @@ void PrepareDevice(DEVICEID_TYPE deviceId)
     currentDevice = deviceId;
 }
 
+// -----------------------------------------------------------------------
+// ConcurrentStreams
+// -----------------------------------------------------------------------
+
+ConcurrentStreams::ConcurrentStreams(int deviceId, size_t numStreams)
+    : m_deviceId(deviceId), m_originalStream(cudaStreamDefault), m_forkEvent(nullptr), m_streams(numStreams, nullptr), m_joinEvents(numStreams, nullptr)
+{
+    if (numStreams == 0)
+        InvalidArgument("ConcurrentStreams: At least one stream is needed.");
+    PrepareDevice(deviceId);
+    // These are blocking streams, so that they still synchronize with the legacy default stream, which is used e.g. by cudaMemcpy().
+    for (auto& stream : m_streams)
+        CUDA_CALL(cudaStreamCreate(&stream));
+    for (auto& event : m_joinEvents)
+        CUDA_CALL(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+    CUDA_CALL(cudaEventCreateWithFlags(&m_forkEvent, cudaEventDisableTiming));
+}
+
+ConcurrentStreams::~ConcurrentStreams()
+{
+    // (no CUDA_CALL since we must not throw from a destructor)
+    try
+    {
+        PrepareDevice(m_deviceId);
+    }
+    catch (...)
+    {
+        return;
+    }
+    cudaEventDestroy(m_forkEvent);
+    for (auto& event : m_joinEvents)
+        cudaEventDestroy(event);
+    for (auto& stream : m_streams)
+        cudaStreamDestroy(stream);
+}
+
+void ConcurrentStreams::Fork()
+{
+    m_originalStream = t_stream;
+    CUDA_CALL(cudaEventRecord(m_forkEvent, m_originalStream));
+    for (auto& stream : m_streams)
+        CUDA_CALL(cudaStreamWaitEvent(stream, m_forkEvent, 0));
+}
+
+void ConcurrentStreams::Select(size_t i)
+{
+    t_stream = m_streams[i % m_streams.size()];
+}
+
+void ConcurrentStreams::Join()
+{
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        CUDA_CALL(cudaEventRecord(m_joinEvents[i], m_streams[i]));
+        CUDA_CALL(cudaStreamWaitEvent(m_originalStream, m_joinEvents[i], 0));
+    }
+    t_stream = m_originalStream;
+}
+
+// -----------------------------------------------------------------------
+// CapturedGPUWork
+// -----------------------------------------------------------------------
+
+CapturedGPUWork::CapturedGPUWork(int deviceId)
+    : m_deviceId(deviceId), m_stream(nullptr), m_forkEvent(nullptr), m_joinEvent(nullptr), m_graphExec(nullptr)
+{
+    PrepareDevice(deviceId);
+    // a blocking stream, so that anything on the legacy default stream during capture is an error instead of going unnoticed
+    CUDA_CALL(cudaStreamCreate(&m_stream));
+    CUDA_CALL(cudaEventCreateWithFlags(&m_forkEvent, cudaEventDisableTiming));
+    CUDA_CALL(cudaEventCreateWithFlags(&m_joinEvent, cudaEventDisableTiming));
+}
+
+CapturedGPUWork::~CapturedGPUWork()
+{
+    // (no CUDA_CALL since we must not throw from a destructor)
+    try
+    {
+        PrepareDevice(m_deviceId);
+    }
+    catch (...)
+    {
+        return;
+    }
+#if CUDA_VERSION >= 10000
+    if (m_graphExec)
+        cudaGraphExecDestroy(m_graphExec);
+#endif
+    cudaEventDestroy(m_forkEvent);
+    cudaEventDestroy(m_joinEvent);
+    cudaStreamDestroy(m_stream);
+}
+
+void CapturedGPUWork::Reset()
+{
+#if CUDA_VERSION >= 10000
+    if (m_graphExec)
+    {
+        PrepareDevice(m_deviceId);
+        CUDA_CALL(cudaGraphExecDestroy(m_graphExec));
+    }
+#endif
+    m_graphExec = nullptr;
+}
+
+bool CapturedGPUWork::Capture(const std::function<void()>& body)
+{
+    Reset();
+#if CUDA_VERSION >= 10000
+    PrepareDevice(m_deviceId);
+    cudaStream_t originalStream = t_stream;
+    CUDA_CALL(cudaEventRecord(m_forkEvent, originalStream));
+    CUDA_CALL(cudaStreamWaitEvent(m_stream, m_forkEvent, 0));
+    // thread-local mode: other threads (e.g. readers copying the next minibatch) may go on with their own GPU calls
+    CUDA_CALL(cudaStreamBeginCapture(m_stream, cudaStreamCaptureModeThreadLocal));
+    t_stream = m_stream;
+    bool succeeded = true;
+    try
+    {
+        body();
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "CapturedGPUWork: cannot capture: %s\n", e.what());
+        succeeded = false;
+    }
+    t_stream = originalStream;
+    cudaGraph_t graph = nullptr;
+    cudaError_t err = cudaStreamEndCapture(m_stream, &graph); // (fails if the capture was invalidated by an illegal call)
+    if (succeeded && err == cudaSuccess)
+        err = cudaGraphInstantiate(&m_graphExec, graph, nullptr, nullptr, 0);
+    if (graph)
+        cudaGraphDestroy(graph);
+    if (!succeeded || err != cudaSuccess)
+    {
+        if (succeeded)
+            fprintf(stderr, "CapturedGPUWork: cannot capture: %s\n", cudaGetErrorString(err));
+        cudaGetLastError(); // clear the error state
+        m_graphExec = nullptr;
+        return false;
+    }
+    Replay();
+    return true;
+#else
+    (void) body;
+    return false;
+#endif
+}
+
+void CapturedGPUWork::Replay()
+{
+    if (!m_graphExec)
+        LogicError("CapturedGPUWork: Replay() without a successful Capture().");
+#if CUDA_VERSION >= 10000
+    PrepareDevice(m_deviceId);
+    CUDA_CALL(cudaEventRecord(m_forkEvent, t_stream));
+    CUDA_CALL(cudaStreamWaitEvent(m_stream, m_forkEvent, 0));
+    CUDA_CALL(cudaGraphLaunch(m_graphExec, m_stream));
+    CUDA_CALL(cudaEventRecord(m_joinEvent, m_stream));
+    CUDA_CALL(cudaStreamWaitEvent(t_stream, m_joinEvent, 0));
+#endif
+}
+
+// -----------------------------------------------------------------------
+// DeviceTimer
+// -----------------------------------------------------------------------
+
+DeviceTimer::DeviceTimer(int deviceId)
+    : m_deviceId(deviceId), m_numEventsRecorded(0), m_cpuSeconds(0)
+{
+}
+
+DeviceTimer::~DeviceTimer()
+{
+    if (m_events.empty())
+        return;
+    // (no CUDA_CALL since we must not throw from a destructor)
+    try
+    {
+        PrepareDevice(m_deviceId);
+    }
+    catch (...)
+    {
+        return;
+    }
+    for (auto& event : m_events)
+        cudaEventDestroy(event);
+}
+
+void DeviceTimer::Start()
+{
+    if (m_deviceId < 0)
+    {
+        m_cpuStart = std::chrono::steady_clock::now();
+        return;
+    }
+    if (m_numEventsRecorded + 2 > m_events.size())
+    {
+        PrepareDevice(m_deviceId);
+        m_events.resize(m_numEventsRecorded + 2, nullptr);
+        for (size_t i = m_numEventsRecorded; i < m_events.size(); i++)
+            CUDA_CALL(cudaEventCreate(&m_events[i]));
+    }
+    CUDA_CALL(cudaEventRecord(m_events[m_numEventsRecorded++], t_stream));
+}
+
+void DeviceTimer::Stop()
+{
+    if (m_deviceId < 0)
+    {
+        m_cpuSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_cpuStart).count();
+        return;
+    }
+    CUDA_CALL(cudaEventRecord(m_events[m_numEventsRecorded++], t_stream));
+}
+
+double DeviceTimer::ElapsedSeconds()
+{
+    double seconds = m_cpuSeconds;
+    m_cpuSeconds = 0;
+    for (size_t i = 0; i + 1 < m_numEventsRecorded; i += 2)
+    {
+        float milliseconds;
+        CUDA_CALL(cudaEventSynchronize(m_events[i + 1]));
+        CUDA_CALL(cudaEventElapsedTime(&milliseconds, m_events[i], m_events[i + 1]));
+        seconds += milliseconds / 1000.0;
+    }
+    m_numEventsRecorded = 0;
+    return seconds;
+}
+
 #pragma region DeviceBoundNumber class
 
 template <class ElemType>
@@ -1165,6 +1576,32 @@ void GPUMatrix<ElemType>::SetValue(const ElemType* d_v) // d_v is pointer to the
         CUDA_CALL(cudaEventDestroy(done));
 }
 
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignAugmentedImagesOf(const GPUMatrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const GPUMatrix<ElemType>& mean)
+{
+    if (GetComputeDeviceId() != images.GetComputeDeviceId())
+        RuntimeError("AssignAugmentedImagesOf: Images and target must be on the same device.");
+
+    Resize(width * height * channels, numImages);
+    CUDA_LONG N = (CUDA_LONG) GetNumElements();
+    if (N == 0)
+        return *this;
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    PrepareDevice();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _assignAugmentedImages<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, (const unsigned char*) images.m_pArray, mean.IsEmpty() ? nullptr : mean.m_pArray,
+                                                                                                   (int) width, (int) height, (int) channels, channelsFirst, N);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+    return *this;
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::MaskColumnsValue(const GPUMatrix<char>& columnsMask, ElemType val)
 {
@@ -1221,6 +1658,33 @@ void GPUMatrix<ElemType>::SetValue(const GPUMatrix<ElemType>& deepCopyFrom)
         CUDA_CALL(cudaMemcpy(m_pArray, deepCopyFrom.m_pArray, cpSize * sizeof(ElemType), cudaMemcpyDeviceToDevice));
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::SetValueFromOtherDevice(const GPUMatrix<ElemType>& deepCopyFrom)
+{
+    if (deepCopyFrom.m_computeDevice == m_computeDevice)
+        return SetValue(deepCopyFrom);
+
+    Resize(deepCopyFrom.GetNumRows(), deepCopyFrom.GetNumCols());
+    m_format = deepCopyFrom.m_format;
+    size_t cpSize = deepCopyFrom.GetNumRows() * deepCopyFrom.GetNumCols();
+    if (cpSize == 0)
+        return;
+
+    // enable peer access from our device once per pair; without it, cudaMemcpyPeer() stages through host memory
+    int canAccessPeer = false;
+    CUDA_CALL(cudaDeviceCanAccessPeer(&canAccessPeer, m_computeDevice, deepCopyFrom.m_computeDevice));
+    if (canAccessPeer)
+    {
+        PrepareDevice();
+        cudaError_t cudaStatus = cudaDeviceEnablePeerAccess(deepCopyFrom.m_computeDevice, 0);
+        if (cudaStatus == cudaErrorPeerAccessAlreadyEnabled)
+            cudaGetLastError(); // (clear the error)
+        else
+            CUDA_CALL(cudaStatus);
+    }
+    CUDA_CALL(cudaMemcpyPeer(m_pArray, m_computeDevice, deepCopyFrom.m_pArray, deepCopyFrom.m_computeDevice, cpSize * sizeof(ElemType)));
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, int deviceId, ElemType* pArray, size_t matrixFlags)
 {
@@ -1338,7 +1802,7 @@ template <class ElemType>
 void GPUMatrix<ElemType>::SetUniformRandomValue(const ElemType low, const ElemType high, unsigned long seed)
 {
     PrepareDevice();
-    CreateCurandObject(seed, __FUNCTION__); // TODO call ResetCurandObject() instead?
+    ResetCurandObject(seed, __FUNCTION__); // (restart the sequence, so that the values depend only on the seed, as on the CPU)
 
     cudaEvent_t done = nullptr;
     CUDA_CALL(cudaEventCreate(&done));
@@ -1373,7 +1837,7 @@ template <class ElemType>
 void GPUMatrix<ElemType>::SetGaussianRandomValue(const ElemType mean, const ElemType sigma, unsigned long seed)
 {
     PrepareDevice();
-    CreateCurandObject(seed, __FUNCTION__); // TODO call ResetCurandObject() instead?
+    ResetCurandObject(seed, __FUNCTION__); // (restart the sequence, so that the values depend only on the seed, as on the CPU)
 
     if (sizeof(ElemType) == sizeof(float))
     {
@@ -1422,6 +1886,40 @@ void GPUMatrix<ElemType>::SetUniformRandomMask(const ElemType maskRate, const El
         CUDA_CALL(cudaEventDestroy(done));
 }
 
+//[this]=a .* mask / (1 - dropoutRate)   (or [this] += ... if accumulate)
+// The mask is regenerated in the kernel from seed and element index, see DropoutKeeps() in TensorOps.h.
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignDropoutOf(const GPUMatrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex, const bool accumulate)
+{
+    if (a.IsEmpty())
+        LogicError("AssignDropoutOf: Matrix is empty.");
+
+    if (accumulate)
+    {
+        if (!(a.GetNumRows() == GetNumRows() && a.GetNumCols() == GetNumCols()))
+            InvalidArgument("AssignDropoutOf: The input matrix dimensions do not match [this].");
+    }
+    else if (this != &a)
+        Resize(a.GetNumRows(), a.GetNumCols());
+
+    const size_t N = GetNumElements();
+    const size_t numGroups = (firstElementIndex + N - 1) / 4 - firstElementIndex / 4 + 1;
+    int blocksPerGrid = (int) ceil(((double) numGroups) / GridDim::maxThreadsPerBlock);
+    a.PrepareDevice();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _assignDropoutOf<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, N, firstElementIndex, seed,
+                                                                                            DropoutThreshold(dropoutRate), (ElemType) (1.0 / (1.0 - dropoutRate)), accumulate);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+    return *this;
+}
+
 template <class ElemType>
 ElemType GPUMatrix<ElemType>::Adagrad(GPUMatrix<ElemType>& gradients, const bool needAveMultiplier)
 {
@@ -1488,6 +1986,51 @@ void GPUMatrix<ElemType>::FSAdagrad(GPUMatrix<ElemType>& gradients,
                                                                          learnRatePerSample, momentum, adaWeight, adaMul);
 }
 
+// Adam and LAMB, see CPUMatrix::Adam(). The update count and the norms of LAMB stay on the device.
+template <class ElemType>
+void GPUMatrix<ElemType>::Adam(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate,
+                               ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive)
+{
+    const size_t n = gradients.GetNumElements();
+    if (GetNumElements() != AdamStateSize(n))
+    {
+        Resize(AdamStateSize(n), 1);
+        SetValue(0.0);
+    }
+
+    PrepareDevice();
+    ElemType* state = m_pArray + 2 * n; // update count, two sums of squares
+    const int blocksPerGrid = (int) ((n + GridDim::maxThreadsPerBlock - 1) / GridDim::maxThreadsPerBlock);
+    if (layerwiseAdaptive)
+        CUDA_CALL(cudaMemsetAsync(state + 1, 0, 2 * sizeof(ElemType), t_stream));
+    _adam<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) n, gradients.m_pArray, m_pArray, m_pArray + n, functionValues.m_pArray, state,
+                                                                                learnRate, beta1, beta2, epsilon, weightDecay, layerwiseAdaptive);
+    if (layerwiseAdaptive)
+        _layerwiseAdaptiveStep<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) n, gradients.m_pArray, nullptr, functionValues.m_pArray, state + 1,
+                                                                                                      learnRate, 0, 1);
+    _incrementUpdateCount<ElemType><<<1, 1, 0, t_stream>>>(state);
+}
+
+// LARS, see CPUMatrix::Lars()
+template <class ElemType>
+void GPUMatrix<ElemType>::Lars(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType momentum, ElemType trustCoefficient)
+{
+    const size_t n = gradients.GetNumElements();
+    if (GetNumElements() != LarsStateSize(n))
+    {
+        Resize(LarsStateSize(n), 1);
+        SetValue(0.0);
+    }
+
+    PrepareDevice();
+    ElemType* sumsOfSquares = m_pArray + n;
+    const int blocksPerGrid = (int) ((n + GridDim::maxThreadsPerBlock - 1) / GridDim::maxThreadsPerBlock);
+    CUDA_CALL(cudaMemsetAsync(sumsOfSquares, 0, 2 * sizeof(ElemType), t_stream));
+    _sumsOfSquaresOfTwo<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) n, functionValues.m_pArray, gradients.m_pArray, sumsOfSquares);
+    _layerwiseAdaptiveStep<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) n, gradients.m_pArray, m_pArray, functionValues.m_pArray, sumsOfSquares,
+                                                                                                  learnRate, momentum, trustCoefficient);
+}
+
 template <class ElemType>
 ElemType GPUMatrix<ElemType>::RmsProp(GPUMatrix<ElemType>& gradients,
                                       ElemType RMS_GAMMA,
@@ -1569,6 +2112,102 @@ ElemType GPUMatrix<ElemType>::RmsProp(GPUMatrix<ElemType>& gradients,
     }
 }
 
+// fused clipping, regularization and momentum update of a list of parameters, see MultiTensorUpdateOp
+// The tensors are packed into MultiTensorLists that go to the kernels by value, so there is no host-to-device copy.
+// With norm clipping, all norms are computed (into 'workspace') before any parameter is updated. A global norm is a
+// single sum of squares over all tensors, so it never leaves the device either.
+template <class ElemType>
+/*static*/ void GPUMatrix<ElemType>::MultiTensorNormalGrad(const std::vector<GPUMatrix<ElemType>*>& functionValues, const std::vector<GPUMatrix<ElemType>*>& gradients,
+                                                         const std::vector<GPUMatrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc, GPUMatrix<ElemType>& workspace)
+{
+    if (functionValues.empty())
+        return;
+    functionValues[0]->PrepareDevice();
+
+    std::vector<MultiTensorList<ElemType>> lists;
+    std::vector<int> numBlocks;
+    int numTensorsInList = 0;
+    for (size_t t = 0; t < functionValues.size(); t++)
+    {
+        const size_t n = functionValues[t]->GetNumElements();
+        const int numChunks = (int) ((n + MultiTensorChunkSize - 1) / MultiTensorChunkSize);
+        for (int c = 0; c < numChunks; c++)
+        {
+            // start a new list when the current one is full; a tensor may continue in the next one
+            if (lists.empty() || numBlocks.back() == MultiTensorMaxBlocks || (c == 0 && numTensorsInList == MultiTensorMaxTensors))
+            {
+                lists.push_back(MultiTensorList<ElemType>());
+                numBlocks.push_back(0);
+                numTensorsInList = 0;
+            }
+            MultiTensorList<ElemType>& list = lists.back();
+            if (c == 0 || numBlocks.back() == 0) // tensor not yet in this list
+            {
+                list.w[numTensorsInList] = functionValues[t]->m_pArray;
+                list.g[numTensorsInList] = gradients[t]->m_pArray;
+                list.v[numTensorsInList] = smoothedGradients[t]->m_pArray;
+                list.n[numTensorsInList] = n;
+                list.tensorIndex[numTensorsInList] = (int) t;
+                numTensorsInList++;
+            }
+            list.blockTensor[numBlocks.back()] = (unsigned char) (numTensorsInList - 1);
+            list.blockChunk[numBlocks.back()] = c;
+            numBlocks.back()++;
+        }
+    }
+
+    const bool clipNorm = !desc.clippingWithTruncation && desc.clippingThreshold != std::numeric_limits<double>::infinity();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    if (clipNorm)
+    {
+        workspace.Resize(desc.clippingByGlobalNorm ? 1 : functionValues.size(), 1);
+        workspace.SetValue(0);
+        for (size_t i = 0; i < lists.size(); i++)
+            _multiTensorSumOfSquares<ElemType><<<numBlocks[i], GridDim::maxThreadsPerBlock, 0, t_stream>>>(lists[i], workspace.m_pArray, desc.clippingByGlobalNorm);
+    }
+    const MultiTensorUpdateOp<ElemType> op(desc);
+    for (size_t i = 0; i < lists.size(); i++)
+        _multiTensorNormalGrad<ElemType><<<numBlocks[i], GridDim::maxThreadsPerBlock, 0, t_stream>>>(lists[i], op, clipNorm ? workspace.m_pArray : nullptr, desc.clippingByGlobalNorm, (ElemType) desc.clippingThreshold);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+}
+
+// move the elements into CUDA managed memory that lives in host memory and is mapped into the device, for matrices that do
+// not fit into the GPU next to everything else (SGD option hostOffloadParameters). Kernels then access the elements over the bus.
+// (Needs CUDA 8 and a Pascal or later GPU; before, managed memory is allocated on the device.) A reallocation (Resize to a
+// larger size) returns the matrix to device memory.
+template <class ElemType>
+void GPUMatrix<ElemType>::PlaceInHostMemory()
+{
+    if (IsEmpty())
+        return;
+    if (!OwnBuffer())
+        InvalidArgument("PlaceInHostMemory: Can't move an externally managed matrix.");
+
+    PrepareDevice();
+    const size_t numBytes = sizeof(ElemType) * GetNumElements();
+    ElemType* managed = nullptr;
+    CUDA_CALL(cudaMallocManaged((void**) &managed, numBytes, cudaMemAttachGlobal));
+#if CUDART_VERSION >= 8000
+    CUDA_CALL(cudaMemAdvise(managed, numBytes, cudaMemAdviseSetPreferredLocation, cudaCpuDeviceId));
+    CUDA_CALL(cudaMemAdvise(managed, numBytes, cudaMemAdviseSetAccessedBy, m_computeDevice)); // (map, instead of migrating on access)
+#endif
+    CUDA_CALL(cudaMemcpy(managed, m_pArray, numBytes, cudaMemcpyDefault));
+#if CUDART_VERSION >= 8000
+    CUDA_CALL(cudaMemPrefetchAsync(managed, numBytes, cudaCpuDeviceId, t_stream));
+    CUDA_CALL(cudaStreamSynchronize(t_stream));
+#endif
+    TracingGPUMemoryAllocator::Free<ElemType>(m_computeDevice, m_pArray);
+    m_pArray = managed;
+    m_elemSizeAllocated = GetNumElements();
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::Reshape(const size_t numRows, const size_t numCols)
 {
@@ -2067,6 +2706,73 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::ColumnElementDivideBy(const GPUMatrix<
     return *this;
 }
 
+// this(:,j) = beta * this(:,j) + alpha * a(:,idx(j))
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::DoGatherColumnsOf(ElemType beta, const GPUMatrix<ElemType>& idx, const GPUMatrix<ElemType>& a, ElemType alpha)
+{
+    if (idx.GetNumRows() != 1) // index is 1-dimensional only
+        InvalidArgument("DoGatherColumnsOf: Map must be a row vector.");
+
+    if (beta)
+        VerifySize(a.GetNumRows(), idx.GetNumCols());
+    else
+        Resize(a.GetNumRows(), idx.GetNumCols());
+    if (IsEmpty())
+        return *this;
+
+    // note: column indices beyond a's width are not checked here, unlike on the CPU
+    CUDA_LONG numElements = (CUDA_LONG) GetNumElements();
+    int blocksPerGrid = (int) ceil(1.0 * numElements / GridDim::maxThreadsPerBlock);
+    a.PrepareDevice();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _doGatherColumnsOf<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, beta, idx.m_pArray, a.m_pArray, alpha, (CUDA_LONG) GetNumRows(), numElements);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+
+    return *this;
+}
+
+// this = beta * this; this(:,idx(j)) += alpha * a(:,j)
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::DoScatterColumnsOf(ElemType beta, const GPUMatrix<ElemType>& idx, const GPUMatrix<ElemType>& a, ElemType alpha)
+{
+    if (idx.GetNumRows() != 1) // index is 1-dimensional only
+        InvalidArgument("DoScatterColumnsOf: Map must be a row vector.");
+    if (idx.GetNumCols() != a.GetNumCols())
+        InvalidArgument("DoScatterColumnsOf: Map must have width of input vector.");
+    if (a.GetNumRows() != GetNumRows())
+        InvalidArgument("DoScatterColumnsOf: Output must have same height as input vector.");
+
+    if (beta == 0)
+        SetValue(0);
+    else if (beta != 1)
+        Scale(beta, *this);
+    if (a.IsEmpty())
+        return *this;
+
+    CUDA_LONG numElements = (CUDA_LONG) a.GetNumElements();
+    int blocksPerGrid = (int) ceil(1.0 * numElements / GridDim::maxThreadsPerBlock);
+    a.PrepareDevice();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _doScatterColumnsOf<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, idx.m_pArray, a.m_pArray, alpha, (CUDA_LONG) GetNumRows(), numElements);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+
+    return *this;
+}
+
 template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::ElementInverse()
 {
@@ -2344,6 +3050,38 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignLogSoftmaxOf(const GPUMatrix<Ele
     return *this;
 }
 
+// fused column-wise softmax + cross entropy, see CPUMatrix::AssignCrossEntropyWithSoftmaxOf()
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignCrossEntropyWithSoftmaxOf(const GPUMatrix<ElemType>& labels, const GPUMatrix<ElemType>& logits, GPUMatrix<ElemType>& logSumExp)
+{
+    if (logits.IsEmpty())
+        LogicError("AssignCrossEntropyWithSoftmaxOf: Matrix logits is empty.");
+    if (labels.GetNumRows() != logits.GetNumRows() || labels.GetNumCols() != logits.GetNumCols())
+        InvalidArgument("AssignCrossEntropyWithSoftmaxOf: labels and logits must have the same dimensions.");
+    if (labels.GetComputeDeviceId() != logits.GetComputeDeviceId() || GetComputeDeviceId() != logits.GetComputeDeviceId())
+        InvalidArgument("All matrices must be on the same GPU");
+
+    logSumExp.Resize(1, logits.GetNumCols());
+    Resize(1, 1);
+    SetValue(0); // the kernel accumulates the per-column criteria into this
+
+    PrepareDevice();
+    CUDA_LONG N = (CUDA_LONG) logits.GetNumCols();
+    CUDA_LONG M = (CUDA_LONG) logits.GetNumRows();
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _assignColumnwiseCrossEntropyWithSoftmaxOf<<<N, 512, 0, t_stream>>>(labels.m_pArray, logits.m_pArray, logSumExp.m_pArray, m_pArray, M);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+
+    return *this;
+}
+
 template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::InplaceHardmax(const bool isColWise)
 {
@@ -2892,13 +3630,16 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignKhatriRaoProductOf(const GPUMatr
     CUDA_LONG rowsA = (CUDA_LONG) a.GetNumRows();
     CUDA_LONG rowsB = (CUDA_LONG) b.GetNumRows();
     Resize(rowsA * rowsB, cols);
-    float N = (float) GetNumElements();
-    int blocksPerGrid = (int) ceil(N / GridDim::maxThreadsPerBlock);
+    if (cols == 0)
+        return *this;
+    // one thread block per tile of each column's [rowsA x rowsB] block, see _assignKhatriRaoProductOfTiled()
+    const dim3 threadsPerBlock(KhatriRaoTile, KhatriRaoRows);
+    const dim3 blocksPerGrid(cols, (rowsA + KhatriRaoTile - 1) / KhatriRaoTile, (rowsB + KhatriRaoTile - 1) / KhatriRaoTile);
     a.PrepareDevice();
     cudaEvent_t done = nullptr;
     if (do_sync)
         CUDA_CALL(cudaEventCreate(&done));
-    _assignKhatriRaoProductOf<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, b.m_pArray, rowsA, rowsB, cols);
+    _assignKhatriRaoProductOfTiled<ElemType><<<blocksPerGrid, threadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, b.m_pArray, rowsA, rowsB);
     if (do_sync)
         CUDA_CALL(cudaEventRecord(done));
     if (do_sync)
@@ -2934,13 +3675,20 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::AddColumnReshapeProductOf(const GPUMat
     if (rowsC != GetNumRows() || cols != GetNumCols())
         InvalidArgument("AddColumnReshapeProductOf: This matrix does not have the right size.");
 
-    float N = (float) GetNumElements();
-    int blocksPerGrid = (int) ceil(N / GridDim::maxThreadsPerBlock);
+    if (cols == 0)
+        return *this;
+    // These are the gradients of the Khatri-Rao product. Not transposed, each column of a is a [rowsC x rowsB] block, and this is
+    // the gradient of its left factor; transposed, each column of a is [rowsB x rowsC], and this is the gradient of its right factor.
+    const dim3 threadsPerBlock(KhatriRaoTile, KhatriRaoRows);
+    const dim3 blocksPerGrid(cols, (rowsC + KhatriRaoTile - 1) / KhatriRaoTile);
     a.PrepareDevice();
     cudaEvent_t done = nullptr;
     if (do_sync)
         CUDA_CALL(cudaEventCreate(&done));
-    _addColumnReshapeProductOf<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, b.m_pArray, rowsB, rowsC, cols, transposeAColumn);
+    if (!transposeAColumn)
+        _addKhatriRaoProductGradientA<ElemType><<<blocksPerGrid, threadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, b.m_pArray, rowsC, rowsB);
+    else
+        _addKhatriRaoProductGradientB<ElemType><<<blocksPerGrid, threadsPerBlock, 0, t_stream>>>(m_pArray, a.m_pArray, b.m_pArray, rowsB, rowsC);
     if (do_sync)
         CUDA_CALL(cudaEventRecord(done));
     if (do_sync)
@@ -3547,6 +4295,31 @@ static cublasStatus_t cublas_gemm(cublasHandle_t handle, cublasOperation_t trans
 {
     return cublasDgemm(handle, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
 }
+#if CUDA_VERSION >= 8000
+// float/double overloads of cublasSgemmStridedBatched()/cublasDgemmStridedBatched()
+static cublasStatus_t cublas_gemmStridedBatched(cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k, const float* alpha, const float* A, int lda, long long strideA,
+                                                const float* B, int ldb, long long strideB, const float* beta, float* C, int ldc, long long strideC, int batchCount)
+{
+    return cublasSgemmStridedBatched(handle, transa, transb, m, n, k, alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+static cublasStatus_t cublas_gemmStridedBatched(cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k, const double* alpha, const double* A, int lda, long long strideA,
+                                                const double* B, int ldb, long long strideB, const double* beta, double* C, int ldc, long long strideC, int batchCount)
+{
+    return cublasDgemmStridedBatched(handle, transa, transb, m, n, k, alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+#else
+// float/double overloads of cublasSgemmBatched()/cublasDgemmBatched()
+static cublasStatus_t cublas_gemmBatched(cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k, const float* alpha, const float** A, int lda,
+                                         const float** B, int ldb, const float* beta, float** C, int ldc, int batchCount)
+{
+    return cublasSgemmBatched(handle, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, batchCount);
+}
+static cublasStatus_t cublas_gemmBatched(cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k, const double* alpha, const double** A, int lda,
+                                         const double** B, int ldb, const double* beta, double** C, int ldc, int batchCount)
+{
+    return cublasDgemmBatched(handle, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, batchCount);
+}
+#endif
 static cublasStatus_t cublas_axpy(cublasHandle_t handle, int n, const float* alpha, const float* x, int incx, float* y, int incy)
 {
     return cublasSaxpy(handle, n, alpha, x, incx, y, incy);
@@ -3586,6 +4359,62 @@ void GPUMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPUMatrix
     c.m_numCols = n;
 }
 
+// batched version of MultiplyAndWeightedAdd(): c_i = alpha * op(a_i) * op(b_i) + beta * c_i,
+// where a_i, b_i, c_i are the i-th of batchCount consecutive column blocks of equal width of a, b, c
+template <class ElemType>
+void GPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& a, const bool transposeA, const GPUMatrix<ElemType>& b, const bool transposeB,
+                                                      ElemType beta, GPUMatrix<ElemType>& c, const size_t batchCount)
+{
+    a.PrepareDevice();
+    if ((a.GetComputeDeviceId() != b.GetComputeDeviceId()) || (b.GetComputeDeviceId() != c.GetComputeDeviceId())) // different GPUs
+        InvalidArgument("All matrices must be on the same GPU");
+    if (batchCount == 0 || a.m_numCols % batchCount != 0 || b.m_numCols % batchCount != 0)
+        InvalidArgument("BatchMultiplyAndWeightedAdd: The number of columns of a and b must be multiples of the batch count.");
+
+    cublasHandle_t cuHandle = GetCublasHandle(b.GetComputeDeviceId());
+    cublasOperation_t transA = transposeA ? CUBLAS_OP_T : CUBLAS_OP_N;
+    cublasOperation_t transB = transposeB ? CUBLAS_OP_T : CUBLAS_OP_N;
+    const size_t colsA = a.m_numCols / batchCount;
+    const size_t colsB = b.m_numCols / batchCount;
+    int m = int(transposeA ? colsA : a.m_numRows);
+    int n = int(transposeB ? b.m_numRows : colsB);
+    int k = int(transposeA ? a.m_numRows : colsA);
+    int l = int(transposeB ? colsB : b.m_numRows);
+
+    if (beta == 0)
+        c.Resize(m, n * batchCount);
+    else
+        c.VerifySize(m, n * batchCount); // Can't resize if beta != 0
+
+    if (!(m > 0 && k > 0 && l > 0 && n > 0))
+        RuntimeError("!(m>0 && k>0 && l>0 && n>0)"); // converting from size_t to int may cause overflow
+    if (k != l)
+        RuntimeError("matrix dim mismatch in BatchMultiplyAndWeightedAdd");
+    const size_t strideA = a.m_numRows * colsA;
+    const size_t strideB = b.m_numRows * colsB;
+    const size_t strideC = (size_t) m * n;
+#if CUDA_VERSION >= 8000
+    CUBLAS_CALL(cublas_gemmStridedBatched(cuHandle, transA, transB, m, n, k, &alpha, a.m_pArray, (int) a.m_numRows, strideA, b.m_pArray, (int) b.m_numRows, strideB,
+                                          &beta, c.m_pArray, m, strideC, (int) batchCount));
+#else
+    // older CUBLAS only has the pointer-array interface, so build the pointer arrays and copy them to the device
+    std::vector<ElemType*> pointers(3 * batchCount);
+    for (size_t i = 0; i < batchCount; i++)
+    {
+        pointers[i] = a.m_pArray + i * strideA;
+        pointers[batchCount + i] = b.m_pArray + i * strideB;
+        pointers[2 * batchCount + i] = c.m_pArray + i * strideC;
+    }
+    const size_t pointerBytes = sizeof(ElemType*) * pointers.size();
+    char* devicePointers = TracingGPUMemoryAllocator::Allocate<char>(c.GetComputeDeviceId(), pointerBytes);
+    CUDA_CALL(cudaMemcpy(devicePointers, pointers.data(), pointerBytes, cudaMemcpyHostToDevice));
+    ElemType** pointersA = (ElemType**) devicePointers;
+    CUBLAS_CALL(cublas_gemmBatched(cuHandle, transA, transB, m, n, k, &alpha, (const ElemType**) pointersA, (int) a.m_numRows, (const ElemType**) (pointersA + batchCount), (int) b.m_numRows,
+                                   &beta, pointersA + 2 * batchCount, m, (int) batchCount));
+    TracingGPUMemoryAllocator::Free<char>(c.GetComputeDeviceId(), devicePointers);
+#endif
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::Multiply1x1AndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, ElemType beta, GPUMatrix<ElemType>& c)
 {
@@ -3992,6 +4821,42 @@ void GPUMatrix<ElemType>::AddScaledDifference(const GPUMatrix<ElemType>& alpha,
     }
 }
 
+/// <summary> c += alpha * (softmax(logits) - labels), column-wise</summary>
+/// The softmax is recomputed on the fly from the per-column log-sum-exp left by AssignCrossEntropyWithSoftmaxOf().
+/// <param name="alpha">1X1 matrix</param>
+/// <param name="labels">Input matrix</param>
+/// <param name="logits">Input matrix</param>
+/// <param name="logSumExp">1 x cols matrix</param>
+/// <param name="c">Resulting matrix, user is responsible for allocating this</param>
+template <class ElemType>
+void GPUMatrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(const GPUMatrix<ElemType>& alpha, const GPUMatrix<ElemType>& labels, const GPUMatrix<ElemType>& logits,
+                                                             const GPUMatrix<ElemType>& logSumExp, GPUMatrix<ElemType>& c)
+{
+    if (!(alpha.GetNumElements() == 1))
+        InvalidArgument("AddCrossEntropyWithSoftmaxGradient:  alpha must be a 1X1 matrix.");
+    if (!(labels.GetNumRows() == logits.GetNumRows() && labels.GetNumRows() == c.GetNumRows() &&
+          labels.GetNumCols() == logits.GetNumCols() && labels.GetNumCols() == c.GetNumCols() && logSumExp.GetNumElements() == logits.GetNumCols()))
+        InvalidArgument("AddCrossEntropyWithSoftmaxGradient:  labels, logits, and c must have same dimension, and logSumExp one element per column.");
+    if (logits.GetComputeDeviceId() != c.GetComputeDeviceId())
+        InvalidArgument("All matrices must be on the same GPU");
+    if (c.IsEmpty())
+        LogicError("AddCrossEntropyWithSoftmaxGradient:  Input matrix c is empty.");
+
+    c.PrepareDevice();
+    cudaEvent_t done = nullptr;
+    CUDA_LONG n = (CUDA_LONG) c.GetNumElements();
+    int blocksPerGrid = (int) ceil(1.0 * n / GridDim::maxThreadsPerBlock);
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _addCrossEntropyWithSoftmaxGradient<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(alpha.m_pArray, labels.m_pArray, logits.m_pArray, logSumExp.m_pArray, c.m_pArray, (CUDA_LONG) c.GetNumRows(), n);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+}
+
 /// <summary> c = alpha * (a-b)</summary>
 /// if a, b, c  must have same dim
 /// <param name="alpha">Scalar</param>
@@ -4537,6 +5402,41 @@ void GPUMatrix<ElemType>::InnerProductWithShiftNeg(const GPUMatrix<ElemType>& a,
     }
 }
 
+// fused cosine similarities with negative samples, see CPUMatrix::CosDistanceWithShiftNeg()
+template <class ElemType>
+void GPUMatrix<ElemType>::CosDistanceWithShiftNeg(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c,
+                                                  GPUMatrix<ElemType>& invNormA, GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber)
+{
+    if (a.GetComputeDeviceId() != b.GetComputeDeviceId() || b.GetComputeDeviceId() != c.GetComputeDeviceId()) // different GPUs
+        InvalidArgument("All matrices must be on the same GPU");
+    const CUDA_LONG m = (CUDA_LONG) a.GetNumRows(), n = (CUDA_LONG) a.GetNumCols();
+    if (b.GetNumRows() != m || b.GetNumCols() != n)
+        InvalidArgument("CosDistanceWithShiftNeg: The input matrix dimensions do not match.");
+    c.Resize(negNumber + 1, n);
+    invNormA.Resize(1, n);
+    invNormB.Resize(1, n);
+
+    c.PrepareDevice();
+    const int threadsPerBlock = m >= 256 ? 256 : 64; // threads reduce over the rows of a column
+    _cosDistanceWithShiftNeg<ElemType><<<n, threadsPerBlock, 0, t_stream>>>(m, n, a.m_pArray, b.m_pArray, c.m_pArray, invNormA.m_pArray, invNormB.m_pArray,
+                                                                          (CUDA_LONG) shift, (CUDA_LONG) negNumber);
+}
+
+// gradient of CosDistanceWithShiftNeg(), see CPUMatrix::AddCosDistanceGradientWithShiftNeg()
+template <class ElemType>
+void GPUMatrix<ElemType>::AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& gradientC,
+                                                             const GPUMatrix<ElemType>& invNormA, const GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber, GPUMatrix<ElemType>& gradient)
+{
+    const CUDA_LONG m = (CUDA_LONG) a.GetNumRows(), n = (CUDA_LONG) a.GetNumCols();
+    gradient.PrepareDevice();
+    const int blocksPerGrid = (int) ((m * n + GridDim::maxThreadsPerBlock - 1) / GridDim::maxThreadsPerBlock);
+    _addCosDistanceGradientWithShiftNeg<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(m, n, (CUDA_LONG) inputIndex,
+                                                                                                            (inputIndex == 0 ? a : b).m_pArray, (inputIndex == 0 ? b : a).m_pArray,
+                                                                                                            c.m_pArray, gradientC.m_pArray,
+                                                                                                            (inputIndex == 0 ? invNormA : invNormB).m_pArray, (inputIndex == 0 ? invNormB : invNormA).m_pArray,
+                                                                                                            (CUDA_LONG) shift, (CUDA_LONG) negNumber, gradient.m_pArray);
+}
+
 template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::GetARowByIndex(const GPUMatrix<ElemType>& a, const size_t m)
 {
@@ -4717,6 +5617,94 @@ ElemType GPUMatrix<ElemType>::LogAddSumOfElements() const
     return h_sum;
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::GMMLogLikelihood(const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                           GPUMatrix<ElemType>& logLikelihood, GPUMatrix<ElemType>& posterior, GPUMatrix<ElemType>& normedDeviation)
+{
+    const size_t numComponents = unnormedPrior.GetNumRows();
+    const size_t featureDim = feature.GetNumRows();
+    const size_t numSamples = feature.GetNumCols();
+
+    feature.PrepareDevice();
+    logLikelihood.Resize(1, numSamples);
+    posterior.Resize(numComponents, numSamples);
+    normedDeviation.Resize(numComponents, numSamples);
+
+    CUDA_LONG N = (CUDA_LONG) numSamples;
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    _gmmLogLikelihood<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(unnormedPrior.m_pArray, (CUDA_LONG) unnormedPrior.GetNumCols(),
+                                                                                            mean.m_pArray, (CUDA_LONG) mean.GetNumCols(),
+                                                                                            logStddev.m_pArray, (CUDA_LONG) logStddev.GetNumCols(),
+                                                                                            feature.m_pArray, logLikelihood.m_pArray, posterior.m_pArray, normedDeviation.m_pArray,
+                                                                                            (CUDA_LONG) numComponents, (CUDA_LONG) featureDim, N,
+                                                                                            (ElemType) (0.5 * featureDim * log(TWO_PI)));
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::AddGMMLogLikelihoodGradient(const size_t inputIndex, const GPUMatrix<ElemType>& gradient,
+                                                      const GPUMatrix<ElemType>& posterior, const GPUMatrix<ElemType>& normedDeviation,
+                                                      const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                                      GPUMatrix<ElemType>& inputGradient)
+{
+    feature.PrepareDevice();
+    CUDA_LONG N = (CUDA_LONG) inputGradient.GetNumElements();
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    _addGMMLogLikelihoodGradient<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) inputIndex, gradient.m_pArray, posterior.m_pArray, normedDeviation.m_pArray,
+                                                                                                       unnormedPrior.m_pArray,
+                                                                                                       mean.m_pArray, (CUDA_LONG) mean.GetNumCols(),
+                                                                                                       logStddev.m_pArray, (CUDA_LONG) logStddev.GetNumCols(),
+                                                                                                       feature.m_pArray,
+                                                                                                       inputGradient.m_pArray, (CUDA_LONG) inputGradient.GetNumRows(), (CUDA_LONG) inputGradient.GetNumCols(),
+                                                                                                       (CUDA_LONG) unnormedPrior.GetNumRows(), (CUDA_LONG) feature.GetNumRows(), (CUDA_LONG) feature.GetNumCols());
+}
+
+// The time steps are inherently sequential, so we launch one kernel per time step, each parallel over all labels and sequences.
+template <class ElemType>
+void GPUMatrix<ElemType>::RCRFForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores, GPUMatrix<ElemType>& alpha,
+                                             const int startLbl, const size_t numParallelSequences)
+{
+    const size_t iNumLab = pos_scores.GetNumRows();
+    const size_t S = numParallelSequences;
+    if (S == 0 || pos_scores.GetNumCols() % S != 0)
+        InvalidArgument("RCRFForwardCompute: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) pos_scores.GetNumCols(), (int) S);
+    if (pair_scores.GetNumRows() != iNumLab || pair_scores.GetNumCols() != iNumLab)
+        InvalidArgument("RCRFForwardCompute: the transition scores must be a [%d x %d] matrix.", (int) iNumLab, (int) iNumLab);
+    const size_t iNumPos = pos_scores.GetNumCols() / S;
+
+    pos_scores.PrepareDevice();
+    alpha.Resize(iNumLab, pos_scores.GetNumCols());
+
+    CUDA_LONG N = (CUDA_LONG) (iNumLab * S);
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    for (size_t t = 0; t < iNumPos; t++)
+        _rcrfForwardCompute<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) t, pos_scores.m_pArray, pair_scores.m_pArray, alpha.m_pArray,
+                                                                                                  startLbl, (CUDA_LONG) iNumLab, (CUDA_LONG) S);
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::ViterbiForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores,
+                                                GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& backtrace,
+                                                const int startLbl, const size_t numParallelSequences)
+{
+    const size_t iNumLab = pos_scores.GetNumRows();
+    const size_t S = numParallelSequences;
+    if (S == 0 || pos_scores.GetNumCols() % S != 0)
+        InvalidArgument("ViterbiForwardCompute: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) pos_scores.GetNumCols(), (int) S);
+    if (pair_scores.GetNumRows() != iNumLab || pair_scores.GetNumCols() != iNumLab)
+        InvalidArgument("ViterbiForwardCompute: the transition scores must be a [%d x %d] matrix.", (int) iNumLab, (int) iNumLab);
+    const size_t iNumPos = pos_scores.GetNumCols() / S;
+
+    pos_scores.PrepareDevice();
+    alpha.Resize(iNumLab, pos_scores.GetNumCols());
+    backtrace.Resize(iNumLab, pos_scores.GetNumCols());
+
+    CUDA_LONG N = (CUDA_LONG) (iNumLab * S);
+    int blocksPerGrid = (int) ceil(1.0 * N / GridDim::maxThreadsPerBlock);
+    for (size_t t = 0; t < iNumPos; t++)
+        _viterbiForwardCompute<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>((CUDA_LONG) t, pos_scores.m_pArray, pair_scores.m_pArray, alpha.m_pArray, backtrace.m_pArray,
+                                                                                                     startLbl, (CUDA_LONG) iNumLab, (CUDA_LONG) S);
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::RCRFBackwardCompute(
     const GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& beta,
@@ -4793,6 +5781,87 @@ void GPUMatrix<ElemType>::RCRFTransGrdCompute(const GPUMatrix<ElemType>& lbls,
     TracingGPUMemoryAllocator::Free<ElemType>(alpha.GetComputeDeviceId(), d_zeta);
 };
 
+// one LSTM layer over all time steps, see Matrix::LSTMForwardWithState()
+// A kernel launch per time step would leave the GPU mostly idle at the small numbers of sequences of streaming inference.
+// Instead, one launch runs all time steps, with the blocks synchronizing after each step (see _lstmForwardWithState). This needs all
+// blocks to be resident at once, so we pick the number of units per block accordingly: preferably with the recurrent weights in shared
+// memory, and as many units per block as still leave a block for every multiprocessor. If no such grid exists, we launch once per step.
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMForwardWithState(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& recurrentWeights, const GPUMatrix<ElemType>& flags,
+                                               GPUMatrix<ElemType>& h, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& output, const size_t numParallelSequences)
+{
+    if (gates.GetComputeDeviceId() != recurrentWeights.GetComputeDeviceId() || gates.GetComputeDeviceId() != output.GetComputeDeviceId() ||
+        gates.GetComputeDeviceId() != h.GetComputeDeviceId() || gates.GetComputeDeviceId() != c.GetComputeDeviceId())
+        InvalidArgument("All matrices must be on the same GPU");
+    const CUDA_LONG H = (CUDA_LONG) recurrentWeights.GetNumRows();
+    const CUDA_LONG S = (CUDA_LONG) numParallelSequences;
+    if (recurrentWeights.GetNumCols() != 4 * H || gates.GetNumRows() != 4 * H)
+        InvalidArgument("LSTMForwardWithState: the recurrent weights must be [%d x %d] and the gates must have %d rows.", (int) H, (int) (4 * H), (int) (4 * H));
+    if (S == 0 || gates.GetNumCols() % S != 0)
+        InvalidArgument("LSTMForwardWithState: the number of columns (%d) is not a multiple of the number of parallel sequences (%d).", (int) gates.GetNumCols(), (int) S);
+    if (4 * S > GridDim::maxThreadsPerBlock)
+        InvalidArgument("LSTMForwardWithState: at most %d parallel sequences are supported.", (int) (GridDim::maxThreadsPerBlock / 4));
+    if (flags.GetNumElements() != gates.GetNumCols() || h.GetNumRows() != H || h.GetNumCols() != S || c.GetNumRows() != H || c.GetNumCols() != S)
+        InvalidArgument("LSTMForwardWithState: flags must have one element per column, and the states must be [%d x %d].", (int) H, (int) S);
+    const CUDA_LONG T = (CUDA_LONG) gates.GetNumCols() / S;
+
+    output.Resize(H, T * S);
+    if (T == 0)
+        return;
+    output.PrepareDevice();
+
+    const auto& props = GridDim::GetDeviceProps();
+    CUDA_LONG unitsPerBlock = 0;
+    bool sharedWeights = false;
+    for (int pass = 0; pass < 2 && unitsPerBlock == 0; pass++)
+    {
+        const bool useSharedWeights = pass == 0;
+        for (CUDA_LONG U = 1; U <= H && 4 * U * S <= GridDim::maxThreadsPerBlock; U++)
+        {
+            const size_t sharedBytes = sizeof(ElemType) * (LSTMStateTileRows * S + 4 * U * S + (useSharedWeights ? 4 * U * H : 0));
+            if (sharedBytes > props.sharedMemPerBlock)
+                break;
+            int blocksPerProc = 0;
+            if (useSharedWeights)
+                CUDA_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerProc, _lstmForwardWithState<ElemType, true>, (int) (4 * U * S), sharedBytes));
+            else
+                CUDA_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerProc, _lstmForwardWithState<ElemType, false>, (int) (4 * U * S), sharedBytes));
+            const CUDA_LONG numBlocks = CeilDiv(H, U);
+            if (numBlocks > blocksPerProc * props.multiProcessorCount) // not resident at once
+                continue;
+            if (unitsPerBlock == 0 || numBlocks >= props.multiProcessorCount)
+            {
+                unitsPerBlock = U;
+                sharedWeights = useSharedWeights;
+            }
+        }
+    }
+    const bool persistent = unitsPerBlock > 0;
+    if (!persistent)
+        unitsPerBlock = min(H, (CUDA_LONG) GridDim::maxThreadsPerBlock / (4 * S));
+
+    const int blocksPerGrid = (int) CeilDiv(H, unitsPerBlock);
+    const int threadsPerBlock = (int) (4 * unitsPerBlock * S);
+    const size_t sharedBytes = sizeof(ElemType) * (LSTMStateTileRows * S + 4 * unitsPerBlock * S + (sharedWeights ? 4 * unitsPerBlock * H : 0));
+    int* barrier = TracingGPUMemoryAllocator::Allocate<int>(output.GetComputeDeviceId(), 1);
+    const CUDA_LONG stepsPerLaunch = persistent ? T : 1;
+    for (CUDA_LONG t0 = 0; t0 < T; t0 += stepsPerLaunch)
+    {
+        const CUDA_LONG t1 = min(T, t0 + stepsPerLaunch);
+        CUDA_CALL(cudaMemsetAsync(barrier, 0, sizeof(int), t_stream));
+        if (sharedWeights)
+            _lstmForwardWithState<ElemType, true><<<blocksPerGrid, threadsPerBlock, sharedBytes, t_stream>>>(gates.m_pArray, recurrentWeights.m_pArray, flags.m_pArray,
+                                                                                                          h.m_pArray, c.m_pArray, output.m_pArray, H, S, unitsPerBlock, t0, t1, barrier);
+        else
+            _lstmForwardWithState<ElemType, false><<<blocksPerGrid, threadsPerBlock, sharedBytes, t_stream>>>(gates.m_pArray, recurrentWeights.m_pArray, flags.m_pArray,
+                                                                                                           h.m_pArray, c.m_pArray, output.m_pArray, H, S, unitsPerBlock, t0, t1, barrier);
+    }
+    TracingGPUMemoryAllocator::Free<int>(output.GetComputeDeviceId(), barrier);
+
+    // the hidden states after the last step (gaps carry them forward, so these are those after the last frame of each sequence)
+    CUDA_CALL(cudaMemcpyAsync(h.m_pArray, output.m_pArray + (T - 1) * S * H, sizeof(ElemType) * H * S, cudaMemcpyDeviceToDevice, t_stream));
+}
+
 // -----------------------------------------------------------------------
 // TensorView entry points from Matrix.cpp
 // -----------------------------------------------------------------------
@@ -8,6 +8,7 @@
 #include "File.h"
 #include "Helpers.h"
 #include "CommonMatrix.h"
+#include "Half.h"
 #include "TensorShape.h" // only for SmallVector; I was hoping to keep this out
 #include "DebugUtil.h"
 #include "BestGpu.h" // for CPUONLY macro
@@ -111,6 +112,7 @@ public:
     using BaseMatrix<ElemType>::GetNumRows;
     using BaseMatrix<ElemType>::GetNumCols;
     using BaseMatrix<ElemType>::SetMatrixName;
+    using BaseMatrix<ElemType>::VerifySize;
 
 private:
     static cublasHandle_t s_cuHandle[MaxGpus];
@@ -177,10 +179,15 @@ public:
 
     ElemType Adagrad(GPUMatrix<ElemType>& gradients, const bool needAveMultiplier);
     void FSAdagrad(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRatePerSample, ElemType momentum, ElemType adaWeight, ElemType adaMul);
+    void Adam(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive);
+    void Lars(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType momentum, ElemType trustCoefficient);
     ElemType RmsProp(GPUMatrix<ElemType>& gradients, ElemType RMS_GAMMA, ElemType RMS_WGT_INC, ElemType RMS_WGT_MAX, ElemType RMS_WGT_DEC, ElemType RMS_WGT_MIN, const bool needAveMultiplier);
+    static void MultiTensorNormalGrad(const std::vector<GPUMatrix<ElemType>*>& functionValues, const std::vector<GPUMatrix<ElemType>*>& gradients,
+                                      const std::vector<GPUMatrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc, GPUMatrix<ElemType>& workspace);
 
     void Reshape(const size_t numRows, const size_t numCols);
     void Resize(const size_t numRows, const size_t numCols, bool growOnly = true); // by default we only reallocate if need to grow
+    void PlaceInHostMemory();
 
     ElemType& operator()(const size_t /*row*/, const size_t /*col*/)
     {
@@ -198,9 +205,11 @@ public:
     void SetColumn(const GPUMatrix<ElemType>& valMat, size_t colInd);
 
     void MaskColumnsValue(const GPUMatrix<char>& columnsMask, ElemType val);
+    GPUMatrix<ElemType>& AssignAugmentedImagesOf(const GPUMatrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const GPUMatrix<ElemType>& mean);
 
     void SetValue(const GPUMatrix<ElemType>& deepCopyFrom);
     void SetValue(const size_t numRows, const size_t numCols, int deviceId, ElemType* pArray, size_t matrixFlags = matrixFlagNormal);
+    void SetValueFromOtherDevice(const GPUMatrix<ElemType>& deepCopyFrom); // copy from another GPU, peer to peer where possible; this stays on its device
 
     void SetDiagonalValue(const ElemType v);
     void SetDiagonalValue(const GPUMatrix<ElemType>& vector);
@@ -245,6 +254,7 @@ public:
     GPUMatrix<ElemType>& ElementMultiplyWith(const GPUMatrix<ElemType>& a);
     GPUMatrix<ElemType>& AssignElementProductOf(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b);
     GPUMatrix<ElemType>& AddElementProductOf(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b);
+    GPUMatrix<ElemType>& AssignDropoutOf(const GPUMatrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex, const bool accumulate);
 
     GPUMatrix<ElemType>& AssignElementDivisionOf(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b);
     GPUMatrix<ElemType>& ElementDivideBy(const GPUMatrix<ElemType>& a);
@@ -255,6 +265,9 @@ public:
     GPUMatrix<ElemType>& ColumnElementDivideBy(const GPUMatrix<ElemType>& a);
     GPUMatrix<ElemType>& RowElementDivideBy(const GPUMatrix<ElemType>& a);
 
+    GPUMatrix<ElemType>& DoGatherColumnsOf(ElemType beta, const GPUMatrix<ElemType>& idx, const GPUMatrix<ElemType>& a, ElemType alpha);
+    GPUMatrix<ElemType>& DoScatterColumnsOf(ElemType beta, const GPUMatrix<ElemType>& idx, const GPUMatrix<ElemType>& a, ElemType alpha);
+
     GPUMatrix<ElemType>& ElementInverse();
     GPUMatrix<ElemType>& AssignElementInverseOf(const GPUMatrix<ElemType>& a);
 
@@ -272,6 +285,7 @@ public:
 
     GPUMatrix<ElemType>& InplaceLogSoftmax(const bool isColWise);
     GPUMatrix<ElemType>& AssignLogSoftmaxOf(const GPUMatrix<ElemType>& a, const bool isColWise);
+    GPUMatrix<ElemType>& AssignCrossEntropyWithSoftmaxOf(const GPUMatrix<ElemType>& labels, const GPUMatrix<ElemType>& logits, GPUMatrix<ElemType>& logSumExp);
 
     GPUMatrix<ElemType>& InplaceHardmax(const bool isColWise);
     GPUMatrix<ElemType>& AssignHardmaxOf(const GPUMatrix<ElemType>& a, const bool isColWise);
@@ -409,12 +423,15 @@ public:
     static void Multiply(const GPUMatrix<ElemType>& a, const bool transposeA, const GPUMatrix<ElemType>& b, const bool transposeB, GPUMatrix<ElemType>& c);
     static void Multiply(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
     static void Multiply1x1AndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, ElemType beta, GPUMatrix<ElemType>& c);
+    static void BatchMultiplyAndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& a, const bool transposeA, const GPUMatrix<ElemType>& b, const bool transposeB, ElemType beta, GPUMatrix<ElemType>& c, const size_t batchCount);
 
     static void ScaleAndAdd(ElemType alpha, const GPUMatrix<ElemType>& a, GPUMatrix<ElemType>& c);
     static void ScaleAndAdd(ElemType alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
     static void AddScaledDifference(const ElemType alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
     static void AssignScaledDifference(const ElemType alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
     static void AddScaledDifference(const GPUMatrix<ElemType>& alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
+    static void AddCrossEntropyWithSoftmaxGradient(const GPUMatrix<ElemType>& alpha, const GPUMatrix<ElemType>& labels, const GPUMatrix<ElemType>& logits,
+                                                   const GPUMatrix<ElemType>& logSumExp, GPUMatrix<ElemType>& c);
     static void AssignScaledDifference(const GPUMatrix<ElemType>& alpha, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c);
 
     static void AddElementToElement(const GPUMatrix<ElemType>& a, const size_t ai, const size_t aj, GPUMatrix<ElemType>& c, const size_t ci, const size_t cj);
@@ -467,8 +484,22 @@ public:
     static void ConductRowElementMultiplyWithShift(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c, const size_t shift, const bool isafixed);
 
     GPUMatrix<ElemType>& AssignElementProductOfWithShift(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, const size_t shift);
+    static void CosDistanceWithShiftNeg(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& invNormA, GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber);
+    static void AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& gradientC,
+                                                   const GPUMatrix<ElemType>& invNormA, const GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber, GPUMatrix<ElemType>& gradient);
 
 public:
+    static void RCRFForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores, GPUMatrix<ElemType>& alpha,
+                                   const int startLbl, const size_t numParallelSequences);
+    static void ViterbiForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores,
+                                      GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& backtrace,
+                                      const int startLbl, const size_t numParallelSequences);
+    static void GMMLogLikelihood(const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                 GPUMatrix<ElemType>& logLikelihood, GPUMatrix<ElemType>& posterior, GPUMatrix<ElemType>& normedDeviation);
+    static void AddGMMLogLikelihoodGradient(const size_t inputIndex, const GPUMatrix<ElemType>& gradient,
+                                            const GPUMatrix<ElemType>& posterior, const GPUMatrix<ElemType>& normedDeviation,
+                                            const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                            GPUMatrix<ElemType>& inputGradient);
     static void RCRFBackwardCompute(
         const GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& beta,
         const GPUMatrix<ElemType>& lbls,
@@ -480,6 +511,8 @@ public:
                                     GPUMatrix<ElemType>& grd,
                                     const int startLbl, // the time 0 start symbol in the output layer
                                     const int shift);
+    static void LSTMForwardWithState(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& recurrentWeights, const GPUMatrix<ElemType>& flags,
+                                     GPUMatrix<ElemType>& h, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& output, const size_t numParallelSequences);
 
 public:
     friend File& operator>>(File& stream, GPUMatrix<ElemType>& us)
@@ -487,15 +520,14 @@ public:
         stream.GetMarker(fileMarkerBeginSection, std::wstring(L"BMAT"));
         size_t elsize;
         stream >> elsize;
-        if (sizeof(ElemType) != elsize)
+        if (!IsSerializedElementSize<ElemType>(elsize))
             LogicError("Template argument size doesn't match those in file");
         std::wstring matrixName;
         size_t numRows, numCols;
         int format;
         stream >> matrixName >> format >> numRows >> numCols;
         ElemType* d_array = new ElemType[numRows * numCols];
-        for (size_t i = 0; i < numRows * numCols; ++i)
-            stream >> d_array[i];
+        ReadMatrixElements(stream, d_array, numRows, numCols, elsize); // (may be stored as FP16 or 8 bits)
         stream.GetMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
         us.SetValue(numRows, numCols, us.GetComputeDeviceId(), d_array, matrixFlagNormal | format);
         delete[] d_array;
@@ -507,7 +539,8 @@ public:
     friend File& operator<<(File& stream, const GPUMatrix<ElemType>& us)
     {
         stream.PutMarker(fileMarkerBeginSection, std::wstring(L"BMAT"));
-        stream << sizeof(ElemType);
+        size_t elsize = GetSerializedElementSize<ElemType>(stream);
+        stream << elsize;
 
         std::wstring s = (us.m_matrixName == NULL) ? std::wstring(L"unnamed") : std::wstring(us.m_matrixName);
         int format = us.m_format;
@@ -515,8 +548,7 @@ public:
 
         stream << us.m_numRows << us.m_numCols;
         ElemType* pArray = us.CopyToArray();
-        for (size_t i = 0; i < us.GetNumElements(); ++i)
-            stream << pArray[i];
+        WriteMatrixElements(stream, pArray, us.m_numRows, us.m_numCols, elsize);
         delete[] pArray;
         stream.PutMarker(fileMarkerEndSection, std::wstring(L"EMAT"));
         return stream;
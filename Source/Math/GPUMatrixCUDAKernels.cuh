@@ -654,68 +654,104 @@ __global__ void _assignElementProductOf(
     us[id] = a[id] * b[id];
 }
 
-template <class ElemType>
-__global__ void _assignKhatriRaoProductOf(
-    ElemType* us,
-    const ElemType* a,
-    const ElemType* b,
-    const CUDA_LONG rowsA,
-    const CUDA_LONG rowsB,
-    const CUDA_LONG cols)
-{
-    CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
-
-    const CUDA_LONG rows = rowsA * rowsB;
-    const CUDA_LONG col = id / rows;
-    if (col >= cols)
+// Khatri-Rao product and its gradients: each column t of the product is the outer product of a_t [rowsA] and b_t [rowsB],
+// stored as a [rowsA x rowsB] block (element (i, j) at row i + j * rowsA). The kernels below work on KhatriRaoTile x KhatriRaoTile
+// tiles of a block with KhatriRaoTile x KhatriRaoRows threads (gridDim.x = columns, gridDim.y/z = tiles). The operand
+// sections of a tile are staged in shared memory once, and each staged value is used for a whole row or column of the tile.
+static const int KhatriRaoTile = 32;
+static const int KhatriRaoRows = 8; // threads in y; each handles KhatriRaoTile / KhatriRaoRows rows of a tile
+
+// us_t = a_t * b_t'; grid: (cols, tiles over rowsA, tiles over rowsB)
+template <class ElemType>
+__global__ void _assignKhatriRaoProductOfTiled(ElemType* us, const ElemType* a, const ElemType* b, const CUDA_LONG rowsA, const CUDA_LONG rowsB)
+{
+    __shared__ ElemType aTile[KhatriRaoTile];
+    __shared__ ElemType bTile[KhatriRaoTile];
+    const CUDA_LONG col = blockIdx.x;
+    const CUDA_LONG i = blockIdx.y * KhatriRaoTile + threadIdx.x;
+    const CUDA_LONG j0 = blockIdx.z * KhatriRaoTile;
+    if (threadIdx.y == 0 && i < rowsA)
+        aTile[threadIdx.x] = a[i + col * rowsA];
+    else if (threadIdx.y == 1 && j0 + threadIdx.x < rowsB)
+        bTile[threadIdx.x] = b[j0 + threadIdx.x + col * rowsB];
+    __syncthreads();
+    if (i >= rowsA)
         return;
-
-    const CUDA_LONG row = id % rows;
-    const CUDA_LONG rowB = row / rowsA;
-    const CUDA_LONG rowA = row % rowsA;
-
-    us[id] = a[rowA + col * rowsA] * b[rowB + col * rowsB];
+    ElemType* usCol = us + col * rowsA * rowsB;
+    for (CUDA_LONG j = threadIdx.y; j < KhatriRaoTile && j0 + j < rowsB; j += KhatriRaoRows)
+        usCol[i + (j0 + j) * rowsA] = aTile[threadIdx.x] * bTile[j];
 }
 
+// gradient of a: us_t += g_t * b_t, with g_t the [rowsA x rowsB] block; grid: (cols, tiles over rowsA)
+// Each thread sums over every KhatriRaoRows-th element of b_t, which is staged a tile at a time; the partial sums are then added over y.
 template <class ElemType>
-__global__ void _addColumnReshapeProductOf(
-    ElemType* us,
-    const ElemType* a,
-    const ElemType* b,
-    const CUDA_LONG rowsB,
-    const CUDA_LONG rowsC,
-    const CUDA_LONG cols,
-    const bool transposeAColumn)
+__global__ void _addKhatriRaoProductGradientA(ElemType* us, const ElemType* g, const ElemType* b, const CUDA_LONG rowsA, const CUDA_LONG rowsB)
 {
-    CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
-
-    const CUDA_LONG col = id / rowsC;
-    if (col >= cols)
-        return;
-
-    const CUDA_LONG row = id % rowsC;
-    CUDA_LONG bBase = col * rowsB;
-    CUDA_LONG aBase = bBase * rowsC;
-    ElemType v = 0;
+    __shared__ ElemType bTile[KhatriRaoTile];
+    __shared__ ElemType partials[KhatriRaoRows][KhatriRaoTile];
+    const CUDA_LONG col = blockIdx.x;
+    const CUDA_LONG i = blockIdx.y * KhatriRaoTile + threadIdx.x;
+    const ElemType* gCol = g + col * rowsA * rowsB;
+    ElemType sum = 0;
+    for (CUDA_LONG j0 = 0; j0 < rowsB; j0 += KhatriRaoTile)
+    {
+        if (threadIdx.y == 0 && j0 + threadIdx.x < rowsB)
+            bTile[threadIdx.x] = b[j0 + threadIdx.x + col * rowsB];
+        __syncthreads();
+        if (i < rowsA)
+            for (CUDA_LONG j = threadIdx.y; j < KhatriRaoTile && j0 + j < rowsB; j += KhatriRaoRows)
+                sum += gCol[i + (j0 + j) * rowsA] * bTile[j];
+        __syncthreads(); // (before the next tile is staged)
+    }
+    partials[threadIdx.y][threadIdx.x] = sum;
+    __syncthreads();
+    if (threadIdx.y == 0 && i < rowsA)
+    {
+        for (int y = 1; y < KhatriRaoRows; y++)
+            sum += partials[y][threadIdx.x];
+        us[i + col * rowsA] += sum;
+    }
+}
 
-    if (transposeAColumn)
+// gradient of b: us_t += g_t' * a_t; grid: (cols, tiles over rowsB)
+// Threads in x run along the contiguous rows of g_t with a_t staged a tile at a time; each sums for KhatriRaoTile / KhatriRaoRows
+// elements of b, and the partial sums are then added over x through shared memory.
+template <class ElemType>
+__global__ void _addKhatriRaoProductGradientB(ElemType* us, const ElemType* g, const ElemType* a, const CUDA_LONG rowsA, const CUDA_LONG rowsB)
+{
+    __shared__ ElemType aTile[KhatriRaoTile];
+    __shared__ ElemType partials[KhatriRaoTile][KhatriRaoTile + 1]; // [j][x] (+1 against bank conflicts)
+    const int jPerThread = KhatriRaoTile / KhatriRaoRows;
+    const CUDA_LONG col = blockIdx.x;
+    const CUDA_LONG j0 = blockIdx.y * KhatriRaoTile;
+    const ElemType* gCol = g + col * rowsA * rowsB;
+    ElemType sums[jPerThread] = {};
+    for (CUDA_LONG i0 = 0; i0 < rowsA; i0 += KhatriRaoTile)
     {
-        aBase += row * rowsB;
-        for (CUDA_LONG i = 0; i < rowsB; i++)
-        {
-            v += a[aBase++] * b[bBase++];
-        }
+        const CUDA_LONG i = i0 + threadIdx.x;
+        if (threadIdx.y == 0 && i < rowsA)
+            aTile[threadIdx.x] = a[i + col * rowsA];
+        __syncthreads();
+        if (i < rowsA)
+            for (int q = 0; q < jPerThread; q++)
+            {
+                const CUDA_LONG j = j0 + threadIdx.y + q * KhatriRaoRows;
+                if (j < rowsB)
+                    sums[q] += gCol[i + j * rowsA] * aTile[threadIdx.x];
+            }
+        __syncthreads(); // (before the next tile is staged)
     }
-    else
+    for (int q = 0; q < jPerThread; q++)
+        partials[threadIdx.y + q * KhatriRaoRows][threadIdx.x] = sums[q];
+    __syncthreads();
+    const int t = threadIdx.y * KhatriRaoTile + threadIdx.x;
+    if (t < KhatriRaoTile && j0 + t < rowsB)
     {
-        aBase += row;
-        for (CUDA_LONG i = 0; i < rowsB; i++)
-        {
-            v += a[aBase] * b[bBase++];
-            aBase += rowsC;
-        }
+        ElemType sum = 0;
+        for (int x = 0; x < KhatriRaoTile; x++)
+            sum += partials[t][x];
+        us[j0 + t + col * rowsB] += sum;
     }
-    us[row + col * rowsC] += v;
 }
 
 template <class ElemType>
@@ -973,6 +1009,95 @@ __global__ void _assignColumnwiseLogSoftmaxOf(
     }
 }
 
+// fused softmax + cross entropy: each block processes one column, 512 threads per block.
+// Writes logSumExp[col] and adds the column's criterion -sum_i labels(i,col) * log softmax_i to criterion[0] (which the caller zeroes).
+// Everything is accumulated relative to the column max; the softmax itself is never written.
+template <class ElemType>
+__global__ void _assignColumnwiseCrossEntropyWithSoftmaxOf(
+    const ElemType* labels,
+    const ElemType* logits,
+    ElemType* logSumExp,
+    ElemType* criterion,
+    const CUDA_LONG m_numRows)
+{
+    __shared__ ElemType partials[512];
+    __shared__ ElemType partialLabels[512];
+    __shared__ ElemType partialDistances[512];
+    const ElemType* z = logits + IDX2C(0, blockIdx.x, m_numRows);
+    const ElemType* y = labels + IDX2C(0, blockIdx.x, m_numRows);
+
+    // pass 1: column max
+    ElemType maxV = z[0];
+    for (int i = threadIdx.x; i < m_numRows; i += 512)
+        maxV = max(maxV, z[i]);
+    partials[threadIdx.x] = maxV;
+    __syncthreads();
+    for (int s = 256; s > 0; s >>= 1)
+    {
+        if (threadIdx.x < s)
+            partials[threadIdx.x] = max(partials[threadIdx.x], partials[threadIdx.x + s]);
+        __syncthreads();
+    }
+    maxV = partials[0];
+    __syncthreads();
+
+    // pass 2: sum of exp, and the label terms
+    ElemType sumExp = 0;
+    ElemType sumLabels = 0;
+    ElemType sumDistances = 0;
+    for (int i = threadIdx.x; i < m_numRows; i += 512)
+    {
+        const ElemType d = z[i] - maxV;
+        sumExp += (sizeof(ElemType) == sizeof(float)) ? expf(d) : exp(d);
+        if (y[i] != 0) // (gap columns have zero labels and garbage logits)
+        {
+            sumLabels += y[i];
+            sumDistances -= y[i] * d;
+        }
+    }
+    partials[threadIdx.x] = sumExp;
+    partialLabels[threadIdx.x] = sumLabels;
+    partialDistances[threadIdx.x] = sumDistances;
+    __syncthreads();
+    for (int s = 256; s > 0; s >>= 1)
+    {
+        if (threadIdx.x < s)
+        {
+            partials[threadIdx.x] += partials[threadIdx.x + s];
+            partialLabels[threadIdx.x] += partialLabels[threadIdx.x + s];
+            partialDistances[threadIdx.x] += partialDistances[threadIdx.x + s];
+        }
+        __syncthreads();
+    }
+
+    if (threadIdx.x == 0)
+    {
+        const ElemType logSumExpRel = (sizeof(ElemType) == sizeof(float)) ? logf(partials[0]) : log(partials[0]);
+        logSumExp[blockIdx.x] = maxV + logSumExpRel;
+        if (partialLabels[0] != 0)
+            atomicAdd(criterion, partialLabels[0] * logSumExpRel + partialDistances[0]);
+    }
+}
+
+// c += alpha[0] * (softmax(logits) - labels), with the softmax recomputed from the per-column log-sum-exp
+template <class ElemType>
+__global__ void _addCrossEntropyWithSoftmaxGradient(
+    const ElemType* alpha,
+    const ElemType* labels,
+    const ElemType* logits,
+    const ElemType* logSumExp,
+    ElemType* c,
+    const CUDA_LONG m_numRows,
+    const CUDA_LONG N)
+{
+    CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= N)
+        return;
+    const ElemType d = logits[id] - logSumExp[id / m_numRows];
+    const ElemType softmax = (sizeof(ElemType) == sizeof(float)) ? expf(d) : exp(d);
+    c[id] += alpha[0] * (softmax - labels[id]);
+}
+
 template <class ElemType>
 __global__ void _logSoftMaxRowWise(
     ElemType* a,
@@ -1442,6 +1567,92 @@ __global__ void _fsadagrad(CUDA_LONG size, ElemType* grad, ElemType* smoothAda,
     }
 }
 
+// adds a and b over the block to sums[0] and sums[1]; requires blockDim.x == GridDim::maxThreadsPerBlock
+template <class ElemType>
+__device__ void _blockSumsOfTwo(ElemType a, ElemType b, ElemType* sums)
+{
+    __shared__ ElemType partialA[GridDim::maxThreadsPerBlock];
+    __shared__ ElemType partialB[GridDim::maxThreadsPerBlock];
+    partialA[threadIdx.x] = a;
+    partialB[threadIdx.x] = b;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+    {
+        if (threadIdx.x < stride)
+        {
+            partialA[threadIdx.x] += partialA[threadIdx.x + stride];
+            partialB[threadIdx.x] += partialB[threadIdx.x + stride];
+        }
+        __syncthreads();
+    }
+    if (threadIdx.x == 0)
+    {
+        atomicAdd(&sums[0], partialA[0]);
+        atomicAdd(&sums[1], partialB[0]);
+    }
+}
+
+template <class ElemType>
+__global__ void _sumsOfSquaresOfTwo(CUDA_LONG n, const ElemType* a, const ElemType* b, ElemType* sumsOfSquares)
+{
+    ElemType sumA = 0, sumB = 0;
+    for (CUDA_LONG i = blockIdx.x * blockDim.x + threadIdx.x; i < n; i += blockDim.x * gridDim.x)
+    {
+        sumA += a[i] * a[i];
+        sumB += b[i] * b[i];
+    }
+    _blockSumsOfTwo(sumA, sumB, sumsOfSquares);
+}
+
+// Adam (val -= learnRate * r) or, if layerwiseAdaptive, the first half of LAMB: grad = r, and the squared norms of val and r
+// are added to state[1] and state[2]; state[0] is the update count so far, see AdamUpdateOp
+template <class ElemType>
+__global__ void _adam(CUDA_LONG n, ElemType* grad, ElemType* m, ElemType* v, ElemType* val, ElemType* state,
+                      ElemType learnRate, ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive)
+{
+    const AdamUpdateOp<ElemType> op(beta1, beta2, epsilon, weightDecay, state[0] + 1);
+    ElemType sumW = 0, sumR = 0;
+    for (CUDA_LONG i = blockIdx.x * blockDim.x + threadIdx.x; i < n; i += blockDim.x * gridDim.x)
+    {
+        const ElemType r = op(grad[i], m[i], v[i], val[i]);
+        if (!layerwiseAdaptive)
+            val[i] -= learnRate * r;
+        else
+        {
+            grad[i] = r;
+            sumW += val[i] * val[i];
+            sumR += r * r;
+        }
+    }
+    if (layerwiseAdaptive) // (uniform across the block)
+        _blockSumsOfTwo(sumW, sumR, state + 1);
+}
+
+// step scaled by the trust ratio from sumsOfSquares (of the parameter and the direction 'grad'), for LAMB and LARS;
+// with smoothMom (LARS) through momentum, else directly
+template <class ElemType>
+__global__ void _layerwiseAdaptiveStep(CUDA_LONG n, const ElemType* grad, ElemType* smoothMom, ElemType* val, const ElemType* sumsOfSquares,
+                                       ElemType learnRate, ElemType momentum, ElemType trustCoefficient)
+{
+    const ElemType rate = learnRate * LayerwiseTrustRatio(sumsOfSquares[0], sumsOfSquares[1], trustCoefficient);
+    for (CUDA_LONG i = blockIdx.x * blockDim.x + threadIdx.x; i < n; i += blockDim.x * gridDim.x)
+    {
+        if (smoothMom)
+        {
+            smoothMom[i] = momentum * smoothMom[i] + rate * grad[i];
+            val[i] -= smoothMom[i];
+        }
+        else
+            val[i] -= rate * grad[i];
+    }
+}
+
+template <class ElemType>
+__global__ void _incrementUpdateCount(ElemType* count)
+{
+    *count += 1;
+}
+
 template <class ElemType>
 __global__ void _rmsprop_init(
     ElemType* avars, ElemType* signs, ElemType* steps,
@@ -1537,6 +1748,104 @@ __global__ void _setMaskAndScale(
     a[id] = a[id] <= maskRate ? 0 : scaleValue;
 }
 
+// dropout with a regenerated mask, see DropoutKeeps(); each thread handles one group of four elements, which share one Philox hash
+template <class ElemType>
+__global__ void _assignDropoutOf(
+    ElemType* us,
+    const ElemType* a,
+    const size_t N,
+    const size_t firstElementIndex,
+    const unsigned long long seed,
+    const unsigned int threshold,
+    const ElemType scale,
+    const bool accumulate)
+{
+    const size_t group = firstElementIndex / 4 + (size_t) blockDim.x * blockIdx.x + threadIdx.x;
+    if (group * 4 >= firstElementIndex + N)
+        return;
+    unsigned int lanes[4];
+    Philox4x32(seed, group, lanes);
+    for (int lane = 0; lane < 4; lane++)
+    {
+        const size_t index = group * 4 + lane;
+        if (index < firstElementIndex || index - firstElementIndex >= N)
+            continue;
+        const size_t k = index - firstElementIndex;
+        const ElemType v = lanes[lane] >= threshold ? a[k] * scale : 0;
+        if (accumulate)
+            us[k] += v;
+        else
+            us[k] = v;
+    }
+}
+
+// -----------------------------------------------------------------------
+// multi-tensor apply: a list of tensors is passed by value as a kernel argument, and each thread block
+// processes one chunk of one of them; see GPUMatrix::MultiTensorNormalGrad(). The sizes keep the
+// argument well below the 4 KB limit; longer lists are split over several launches.
+// -----------------------------------------------------------------------
+
+static const int MultiTensorMaxTensors = 36;
+static const int MultiTensorMaxBlocks = 320;
+static const size_t MultiTensorChunkSize = 16384;
+
+template <class ElemType>
+struct MultiTensorList
+{
+    ElemType* w[MultiTensorMaxTensors]; // parameters
+    ElemType* g[MultiTensorMaxTensors]; // gradients
+    ElemType* v[MultiTensorMaxTensors]; // smoothed gradients
+    size_t n[MultiTensorMaxTensors];
+    int tensorIndex[MultiTensorMaxTensors]; // index into the whole list, to address the per-tensor norms
+    unsigned char blockTensor[MultiTensorMaxBlocks];
+    int blockChunk[MultiTensorMaxBlocks];
+};
+
+// sumsOfSquares[tensorIndex] += squared Frobenius norm of the gradient; launched with GridDim::maxThreadsPerBlock threads
+template <class ElemType>
+__global__ void _multiTensorSumOfSquares(const MultiTensorList<ElemType> list, ElemType* sumsOfSquares, const bool globalSum)
+{
+    __shared__ ElemType partialSums[GridDim::maxThreadsPerBlock];
+    const int t = list.blockTensor[blockIdx.x];
+    const size_t begin = list.blockChunk[blockIdx.x] * MultiTensorChunkSize;
+    const size_t end = min(begin + MultiTensorChunkSize, list.n[t]);
+    const ElemType* g = list.g[t];
+    ElemType sum = 0;
+    for (size_t k = begin + threadIdx.x; k < end; k += blockDim.x)
+        sum += g[k] * g[k];
+    partialSums[threadIdx.x] = sum;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+    {
+        if (threadIdx.x < stride)
+            partialSums[threadIdx.x] += partialSums[threadIdx.x + stride];
+        __syncthreads();
+    }
+    if (threadIdx.x == 0)
+        atomicAdd(&sumsOfSquares[globalSum ? 0 : list.tensorIndex[t]], partialSums[0]);
+}
+
+// the update itself; sumsOfSquares is nullptr unless the gradients are clipped by their norm (or their global norm, which is sumsOfSquares[0])
+template <class ElemType>
+__global__ void _multiTensorNormalGrad(const MultiTensorList<ElemType> list, const MultiTensorUpdateOp<ElemType> op, const ElemType* sumsOfSquares, const bool globalSum, const ElemType clippingThreshold)
+{
+    const int t = list.blockTensor[blockIdx.x];
+    const size_t begin = list.blockChunk[blockIdx.x] * MultiTensorChunkSize;
+    const size_t end = min(begin + MultiTensorChunkSize, list.n[t]);
+    ElemType gradientScale = 1;
+    if (sumsOfSquares != nullptr)
+    {
+        const ElemType norm = sqrt_(sumsOfSquares[globalSum ? 0 : list.tensorIndex[t]]);
+        if (norm > clippingThreshold)
+            gradientScale = clippingThreshold / norm;
+    }
+    ElemType* w = list.w[t];
+    ElemType* g = list.g[t];
+    ElemType* v = list.v[t];
+    for (size_t k = begin + threadIdx.x; k < end; k += blockDim.x)
+        op(w[k], g[k], v[k], gradientScale);
+}
+
 template <class ElemType>
 __global__ void _vectorSum(
     ElemType* c,       // output
@@ -2130,6 +2439,41 @@ __global__ void _ColumnElementDivideBy(
     }
 }
 
+// one thread per element of the target: us(:,j) = beta * us(:,j) + alpha * a(:,idx(j))
+template <class ElemType>
+__global__ void _doGatherColumnsOf(ElemType* us, const ElemType beta, const ElemType* idx, const ElemType* a, const ElemType alpha,
+                                   const CUDA_LONG numRows, const CUDA_LONG numElements)
+{
+    CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= numElements)
+        return;
+    CUDA_LONG i = id % numRows; // row
+    CUDA_LONG j = id / numRows; // column
+
+    ElemType value = beta ? beta * us[id] : 0;
+    CUDA_LONG jIn = (CUDA_LONG) idx[j];
+    if (idx[j] >= 0)
+        value += alpha * a[IDX2C(i, jIn, numRows)];
+    us[id] = value;
+}
+
+// one thread per element of the source: us(:,idx(j)) += alpha * a(:,j), after us has been scaled
+template <class ElemType>
+__global__ void _doScatterColumnsOf(ElemType* us, const ElemType* idx, const ElemType* a, const ElemType alpha,
+                                    const CUDA_LONG numRows, const CUDA_LONG numElements)
+{
+    CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= numElements)
+        return;
+    CUDA_LONG i = id % numRows; // row
+    CUDA_LONG j = id / numRows; // column
+
+    if (idx[j] < 0)
+        return;
+    CUDA_LONG jOut = (CUDA_LONG) idx[j];
+    atomicAdd(&us[IDX2C(i, jOut, numRows)], alpha * a[id]); // (the same target column may occur multiple times)
+}
+
 template <class ElemType>
 __global__ void _innerProduct(
     ElemType* c,
@@ -2815,8 +3159,133 @@ __global__ void _shiftColCSCIndexFromSliceViewToAbsolute(
         colCSCIndex[cols] = nz;
 }
 
+// c = alpha * op(a) * b + beta * c, for a plain product of a dense a [m x k] (or its transpose) and a sparse CSC b [k x n]
+// Each thread block computes rows [blockIdx.y * BlockSize, +BlockSize) of column blockIdx.x of c. The nonzeros of that column
+// are loaded into shared memory tile by tile, once per block instead of once per thread, and columns with many nonzeros just
+// take more tiles, so that skewed (power-law) nonzero counts do not leave threads of a warp idle.
+// Launch with BlockSize threads per block and a grid of n x ceil(m / BlockSize) blocks.
+template <class ElemType, int BlockSize>
+__global__ void _denseMultSparseCSCAndWeightedAddToDense(
+    const int m, // rowDense
+    const int k, // colDense
+    const ElemType alpha,
+    const ElemType* a, // dense
+    const bool transposeA,
+    const ElemType* bnzValues, // sparse nz values
+    const GPUSPARSE_INDEX_TYPE* rowIndex,
+    const GPUSPARSE_INDEX_TYPE* colCSCIndex,
+    const ElemType beta,
+    ElemType* c) // dense target
+{
+    __shared__ ElemType values[BlockSize];
+    __shared__ GPUSPARSE_INDEX_TYPE rows[BlockSize];
+
+    const int colInC = blockIdx.x;
+    const int rowInC = blockIdx.y * BlockSize + threadIdx.x;
+    const int start = colCSCIndex[colInC];
+    const int end = colCSCIndex[colInC + 1];
+
+    ElemType s = 0;
+    for (int tile = start; tile < end; tile += BlockSize)
+    {
+        const int numInTile = min(BlockSize, end - tile);
+        if (threadIdx.x < numInTile)
+        {
+            values[threadIdx.x] = bnzValues[tile + threadIdx.x];
+            rows[threadIdx.x] = rowIndex[tile + threadIdx.x];
+        }
+        __syncthreads();
+
+        if (rowInC < m)
+        {
+            // (size_t offsets, since embedding-sized dense matrices can exceed 2^31 elements)
+            if (!transposeA)
+            {
+                for (int j = 0; j < numInTile; j++)
+                    s += a[(size_t) rows[j] * m + rowInC] * values[j];
+            }
+            else
+            {
+                for (int j = 0; j < numInTile; j++)
+                    s += a[(size_t) rowInC * k + rows[j]] * values[j];
+            }
+        }
+        __syncthreads();
+    }
+
+    if (rowInC < m)
+    {
+        const size_t idx = (size_t) colInC * m + rowInC;
+        c[idx] = alpha * s + (beta == 0 ? 0 : beta * c[idx]); // If beta is zero then don't lookup c
+    }
+}
+
+// c = alpha * op(a) * b + beta * c, like _denseMultSparseCSCAndWeightedAddToDense, for b with only a few nonzeros per column
+// (one-hot or few-hot words): each thread gathers its row of the few columns of op(a) directly, and sums them up;
+// there are too few nonzeros to be worth staging in shared memory.
+// Launch with a grid of n x ceil(m / blockDim.x) blocks.
+template <class ElemType>
+__global__ void _denseGatherSparseCSCColumnsAndWeightedAddToDense(
+    const int m, // rowDense
+    const int k, // colDense
+    const ElemType alpha,
+    const ElemType* a, // dense
+    const bool transposeA,
+    const ElemType* bnzValues, // sparse nz values
+    const GPUSPARSE_INDEX_TYPE* rowIndex,
+    const GPUSPARSE_INDEX_TYPE* colCSCIndex,
+    const ElemType beta,
+    ElemType* c) // dense target
+{
+    const int colInC = blockIdx.x;
+    const int rowInC = blockIdx.y * blockDim.x + threadIdx.x;
+    if (rowInC >= m)
+        return;
+    const int start = colCSCIndex[colInC];
+    const int end = colCSCIndex[colInC + 1];
+
+    ElemType s = 0;
+    for (int p = start; p < end; p++)
+    {
+        const size_t i = rowIndex[p];
+        s += (transposeA ? a[(size_t) rowInC * k + i] : a[i * m + rowInC]) * bnzValues[p];
+    }
+    const size_t idx = (size_t) colInC * m + rowInC;
+    c[idx] = alpha * s + (beta == 0 ? 0 : beta * c[idx]); // If beta is zero then don't lookup c
+}
+
+// c += alpha * op(a) * b^T, for a dense a [m x l] (or its transpose) and a sparse CSC b [n x l]: the gradient of an
+// embedding-like product w.r.t. its dense weights. Column j of op(a) is scattered into those columns of c that are
+// the rows of the nonzeros of column j of b, with atomics since a word may occur in several columns of b.
+// Launch with a grid of l x ceil(m / blockDim.x) blocks.
+template <class ElemType>
+__global__ void _denseMultSparseCSCTransposeAndScatterAddToDense(
+    const int m, // rowDense
+    const int l, // colDense
+    const ElemType alpha,
+    const ElemType* a, // dense
+    const bool transposeA,
+    const ElemType* bnzValues, // sparse nz values
+    const GPUSPARSE_INDEX_TYPE* rowIndex,
+    const GPUSPARSE_INDEX_TYPE* colCSCIndex,
+    ElemType* c) // dense target [m x n]
+{
+    const int j = blockIdx.x; // column of b, i.e. of op(a)
+    const int rowInC = blockIdx.y * blockDim.x + threadIdx.x;
+    if (rowInC >= m)
+        return;
+    const int start = colCSCIndex[j];
+    const int end = colCSCIndex[j + 1];
+    if (start == end)
+        return;
+
+    const ElemType aValue = alpha * (transposeA ? a[(size_t) rowInC * l + j] : a[(size_t) j * m + rowInC]);
+    for (int p = start; p < end; p++)
+        atomicAdd(&c[(size_t) rowIndex[p] * m + rowInC], aValue * bnzValues[p]);
+}
+
 //c = alpha * op(a) * op(b) + beta*c
-// TODO: This function can be further improved by loading the kernel in shared memory
+// For plain products, see _denseMultSparseCSCAndWeightedAddToDense, which loads the sparse values into shared memory.
 template <class ElemType>
 __global__ void _dense1DConvMultSparseCSCAndWeightedAddToDense(
     const int m,                   // rowDense
@@ -3038,6 +3507,19 @@ __global__ void _determineBlockIds(
         blockId2Col[blockIndex] = index;
 }
 
+// the inverse of the blockId2Col mapping of a SparseBlockCol matrix, for GPUSparseMatrix::SetMatrixFromBlockColumns()
+// col2BlockId must be preset for the columns without values
+template <class ElemType>
+__global__ void _setCol2BlockId(
+    const GPUSPARSE_INDEX_TYPE* blockId2Col, GPUSPARSE_INDEX_TYPE* col2BlockId, const size_t numBlocks)
+{
+    const size_t index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= numBlocks)
+        return;
+
+    col2BlockId[blockId2Col[index]] = (GPUSPARSE_INDEX_TYPE) index;
+}
+
 // backward pass from hidden layer to feature weight
 //result (sparse BlockCol)= alpha * (lhs (dense) X rhs^T (sparse CSC)
 //assume resultValues are 0-initialized
@@ -4484,6 +4966,95 @@ __global__ void _innerProductWithShiftNeg(
     c[IDX2C(idx, idy, NTPlusOne)] = sum;
 }
 
+// sums a, b, and c over the block, leaving the sums in every thread; blockDim.x must be a power of 2, at most GridDim::maxThreadsPerBlock
+template <class ElemType>
+__device__ void _blockAllSumsOfThree(ElemType& a, ElemType& b, ElemType& c)
+{
+    __shared__ ElemType partialA[GridDim::maxThreadsPerBlock];
+    __shared__ ElemType partialB[GridDim::maxThreadsPerBlock];
+    __shared__ ElemType partialC[GridDim::maxThreadsPerBlock];
+    partialA[threadIdx.x] = a;
+    partialB[threadIdx.x] = b;
+    partialC[threadIdx.x] = c;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+    {
+        if (threadIdx.x < stride)
+        {
+            partialA[threadIdx.x] += partialA[threadIdx.x + stride];
+            partialB[threadIdx.x] += partialB[threadIdx.x + stride];
+            partialC[threadIdx.x] += partialC[threadIdx.x + stride];
+        }
+        __syncthreads();
+    }
+    a = partialA[0];
+    b = partialB[0];
+    c = partialC[0];
+    __syncthreads(); // (before the next call overwrites the partials)
+}
+
+// cosine similarities with negative samples, see CPUMatrix::CosDistanceWithShiftNeg(); one block per column j of a, which is reduced
+// with each of its negNumber + 1 columns of b in turn, each column of b giving its dot product and its norm in the same pass
+template <class ElemType>
+__global__ void _cosDistanceWithShiftNeg(CUDA_LONG m, CUDA_LONG n, const ElemType* a, const ElemType* b, ElemType* c,
+                                         ElemType* invNormA, ElemType* invNormB, CUDA_LONG shift, CUDA_LONG negNumber)
+{
+    const CUDA_LONG j = blockIdx.x;
+    const ElemType* aj = a + IDX2C(0, j, m);
+    ElemType invNormAj = 0;
+    for (CUDA_LONG i = 0; i <= negNumber; i++)
+    {
+        const CUDA_LONG k = i == 0 ? j : (j + shift + i - 1) % n;
+        const ElemType* bk = b + IDX2C(0, k, m);
+        ElemType dot = 0, sumB = 0, sumA = 0;
+        for (CUDA_LONG r = threadIdx.x; r < m; r += blockDim.x)
+        {
+            const ElemType ar = aj[r], br = bk[r];
+            dot += ar * br;
+            sumB += br * br;
+            if (i == 0)
+                sumA += ar * ar;
+        }
+        _blockAllSumsOfThree(dot, sumB, sumA);
+        const ElemType invNormBk = 1 / sqrt_(sumB);
+        if (i == 0)
+        {
+            invNormAj = 1 / sqrt_(sumA);
+            if (threadIdx.x == 0)
+            {
+                invNormA[j] = invNormAj;
+                invNormB[j] = invNormBk;
+            }
+        }
+        if (threadIdx.x == 0)
+            c[IDX2C(i, j, negNumber + 1)] = dot * invNormAj * invNormBk;
+    }
+}
+
+// gradient += the gradient of CosDistanceWithShiftNeg with respect to a (inputIndex 0) or b (1), see CPUMatrix::AddCosDistanceGradientWithShiftNeg();
+// one thread per element of the gradient
+template <class ElemType>
+__global__ void _addCosDistanceGradientWithShiftNeg(CUDA_LONG m, CUDA_LONG n, CUDA_LONG inputIndex, const ElemType* self, const ElemType* other,
+                                                    const ElemType* c, const ElemType* gradientC, const ElemType* invNormSelf, const ElemType* invNormOther,
+                                                    CUDA_LONG shift, CUDA_LONG negNumber, ElemType* gradient)
+{
+    const CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= m * n)
+        return;
+    const CUDA_LONG r = id % m, k = id / m;
+    const ElemType selfValue = self[id];
+    ElemType sum = 0;
+    for (CUDA_LONG i = 0; i <= negNumber; i++)
+    {
+        const CUDA_LONG s = i == 0 ? 0 : (shift + i - 1) % n;
+        const CUDA_LONG j = inputIndex == 0 ? (k + s) % n : (k + n - s) % n;
+        const CUDA_LONG cIndex = IDX2C(i, inputIndex == 0 ? k : j, negNumber + 1);
+        const ElemType gc = gradientC[cIndex];
+        sum += gc * invNormSelf[k] * (invNormOther[j] * other[IDX2C(r, j, m)] - c[cIndex] * invNormSelf[k] * selfValue);
+    }
+    gradient[id] += sum;
+}
+
 template <class ElemType>
 __global__ void _getARowByIndex(
     ElemType* us,
@@ -4684,6 +5255,295 @@ __global__ void _rcrfBackwardCompute(
     gbeta[IDX2C(id, t, iNumLab)] = fTmp;
 }
 
+/// GMM log-likelihood of one sample (column) per thread, see CPUMatrix::GMMLogLikelihood().
+/// The parameters have either one column (cols == 1) or one per sample.
+template <class ElemType>
+__global__ void _gmmLogLikelihood(
+    const ElemType* unnormedPrior, const CUDA_LONG priorCols,
+    const ElemType* mean, const CUDA_LONG meanCols,
+    const ElemType* logStddev, const CUDA_LONG stddevCols,
+    const ElemType* feature,
+    ElemType* logLikelihood,
+    ElemType* posterior,
+    ElemType* normedDeviation,
+    const CUDA_LONG numComponents, const CUDA_LONG featureDim, const CUDA_LONG numSamples,
+    const ElemType logNormalizer)
+{
+    const CUDA_LONG n = blockDim.x * blockIdx.x + threadIdx.x;
+    if (n >= numSamples)
+        return;
+
+    const ElemType* prior = unnormedPrior + (priorCols == 1 ? 0 : n) * numComponents;
+    const ElemType* mu = mean + (meanCols == 1 ? 0 : n) * numComponents * featureDim;
+    const ElemType* logSigma = logStddev + (stddevCols == 1 ? 0 : n) * numComponents;
+    const ElemType* x = feature + n * featureDim;
+
+    ElemType priorLogSum = (ElemType) LZERO;
+    for (CUDA_LONG c = 0; c < numComponents; c++)
+        priorLogSum = logaddk(priorLogSum, prior[c]);
+
+    ElemType total = (ElemType) LZERO;
+    for (CUDA_LONG c = 0; c < numComponents; c++)
+    {
+        ElemType dist = 0;
+        for (CUDA_LONG i = 0; i < featureDim; i++)
+        {
+            const ElemType d = x[i] - mu[c * featureDim + i];
+            dist += d * d;
+        }
+        const ElemType q = dist * exp_(-2 * logSigma[c]);
+        const ElemType ll = prior[c] - priorLogSum - q / 2 - featureDim * logSigma[c] - logNormalizer;
+        normedDeviation[IDX2C(c, n, numComponents)] = q;
+        posterior[IDX2C(c, n, numComponents)] = ll;
+        total = logaddk(total, ll);
+    }
+    for (CUDA_LONG c = 0; c < numComponents; c++)
+        posterior[IDX2C(c, n, numComponents)] = exp_(posterior[IDX2C(c, n, numComponents)] - total);
+    logLikelihood[n] = total;
+}
+
+/// Gradient of _gmmLogLikelihood w.r.t. input 'inputIndex', one element of the input gradient per thread, see CPUMatrix::AddGMMLogLikelihoodGradient().
+template <class ElemType>
+__global__ void _addGMMLogLikelihoodGradient(
+    const CUDA_LONG inputIndex,
+    const ElemType* gradient,
+    const ElemType* posterior,
+    const ElemType* normedDeviation,
+    const ElemType* unnormedPrior,
+    const ElemType* mean, const CUDA_LONG meanCols,
+    const ElemType* logStddev, const CUDA_LONG stddevCols,
+    const ElemType* feature,
+    ElemType* inputGradient, const CUDA_LONG numRows, const CUDA_LONG numCols,
+    const CUDA_LONG numComponents, const CUDA_LONG featureDim, const CUDA_LONG numSamples)
+{
+    const CUDA_LONG rc = blockDim.x * blockIdx.x + threadIdx.x;
+    if (rc >= numRows * numCols)
+        return;
+
+    const CUDA_LONG r = rc % numRows;
+    const CUDA_LONG col = rc / numRows;
+    const bool shared = numCols == 1 && inputIndex != 3;
+    const CUDA_LONG nBegin = shared ? 0 : col;
+    const CUDA_LONG nEnd = shared ? numSamples : col + 1;
+    ElemType sum = 0;
+    if (inputIndex == 0)
+    {
+        ElemType priorLogSum = (ElemType) LZERO;
+        for (CUDA_LONG c = 0; c < numComponents; c++)
+            priorLogSum = logaddk(priorLogSum, unnormedPrior[IDX2C(c, col, numComponents)]);
+        const ElemType prior = exp_(unnormedPrior[IDX2C(r, col, numComponents)] - priorLogSum);
+        for (CUDA_LONG n = nBegin; n < nEnd; n++)
+            sum += gradient[n] * (posterior[IDX2C(r, n, numComponents)] - prior);
+    }
+    else if (inputIndex == 1)
+    {
+        const CUDA_LONG c = r / featureDim;
+        const CUDA_LONG i = r % featureDim;
+        for (CUDA_LONG n = nBegin; n < nEnd; n++)
+            sum += gradient[n] * posterior[IDX2C(c, n, numComponents)] * (feature[IDX2C(i, n, featureDim)] - mean[IDX2C(r, col, numRows)]) *
+                   exp_(-2 * logStddev[IDX2C(c, stddevCols == 1 ? 0 : n, numComponents)]);
+    }
+    else if (inputIndex == 2)
+    {
+        for (CUDA_LONG n = nBegin; n < nEnd; n++)
+            sum += gradient[n] * posterior[IDX2C(r, n, numComponents)] * (normedDeviation[IDX2C(r, n, numComponents)] - featureDim);
+    }
+    else
+    {
+        for (CUDA_LONG c = 0; c < numComponents; c++)
+            sum -= gradient[col] * posterior[IDX2C(c, col, numComponents)] *
+                   (feature[IDX2C(r, col, featureDim)] - mean[IDX2C(c * featureDim + r, meanCols == 1 ? 0 : col, numComponents * featureDim)]) *
+                   exp_(-2 * logStddev[IDX2C(c, stddevCols == 1 ? 0 : col, numComponents)]);
+    }
+    inputGradient[IDX2C(r, col, numRows)] += sum;
+}
+
+/// $\alpha_t(k) = log {\sum_j exp(\alpha_{t-1}(j) + a_{kj})} + s_k(t)$ for all labels k and parallel sequences at time t.
+/// One thread per (label, sequence); alpha is column-major with the sequences of a time step in adjacent columns.
+template <class ElemType>
+__global__ void _rcrfForwardCompute(
+    const CUDA_LONG t,
+    const ElemType* pos_scores,
+    const ElemType* pair_scores,
+    ElemType* alpha,
+    const int startLbl,
+    const CUDA_LONG iNumLab,
+    const CUDA_LONG numParallelSequences)
+{
+    const CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= iNumLab * numParallelSequences)
+        return;
+
+    const CUDA_LONG k = id % iNumLab;
+    const CUDA_LONG col = t * numParallelSequences + id / iNumLab;
+    ElemType fSum = (ElemType) LZERO;
+    for (CUDA_LONG j = 0; j < iNumLab; j++)
+    {
+        const ElemType fAlpha = t > 0 ? alpha[IDX2C(j, col - numParallelSequences, iNumLab)] : (j == startLbl) ? (ElemType) 0.0 : (ElemType) LZERO;
+        fSum = logaddk(fSum, fAlpha + pair_scores[IDX2C(k, j, iNumLab)]);
+    }
+    alpha[IDX2C(k, col, iNumLab)] = fSum + pos_scores[IDX2C(k, col, iNumLab)];
+}
+
+/// Viterbi counterpart of _rcrfForwardCompute: max instead of log-add, recording the argmax in backtrace.
+/// The first label is constrained to be startLbl, as in CPUMatrix::ViterbiForwardCompute().
+template <class ElemType>
+__global__ void _viterbiForwardCompute(
+    const CUDA_LONG t,
+    const ElemType* pos_scores,
+    const ElemType* pair_scores,
+    ElemType* alpha,
+    ElemType* backtrace,
+    const int startLbl,
+    const CUDA_LONG iNumLab,
+    const CUDA_LONG numParallelSequences)
+{
+    const CUDA_LONG id = blockDim.x * blockIdx.x + threadIdx.x;
+    if (id >= iNumLab * numParallelSequences)
+        return;
+
+    const CUDA_LONG k = id % iNumLab;
+    const CUDA_LONG col = t * numParallelSequences + id / iNumLab;
+    const CUDA_LONG prevCol = col - numParallelSequences;
+    ElemType fMax;
+    CUDA_LONG jMax = startLbl;
+    if (t == 0)
+        fMax = (k == startLbl) ? pos_scores[IDX2C(k, col, iNumLab)] : (ElemType) LZERO;
+    else if (t == 1)
+        fMax = alpha[IDX2C(startLbl, prevCol, iNumLab)] + pair_scores[IDX2C(k, startLbl, iNumLab)] + pos_scores[IDX2C(k, col, iNumLab)];
+    else
+    {
+        fMax = (ElemType) LZERO;
+        for (CUDA_LONG j = 0; j < iNumLab; j++)
+        {
+            const ElemType fAlpha = alpha[IDX2C(j, prevCol, iNumLab)] + pair_scores[IDX2C(k, j, iNumLab)];
+            if (fAlpha > fMax)
+            {
+                fMax = fAlpha;
+                jMax = j;
+            }
+        }
+        fMax += pos_scores[IDX2C(k, col, iNumLab)];
+    }
+    alpha[IDX2C(k, col, iNumLab)] = fMax;
+    backtrace[IDX2C(k, col, iNumLab)] = (ElemType) jMax;
+}
+
+/// rows of the previous hidden states that _lstmForwardWithState stages in shared memory at a time
+static const CUDA_LONG LSTMStateTileRows = 32;
+
+/// Time steps [t0, t1) of one LSTM layer, see GPUMatrix::LSTMForwardWithState(). Block b owns the hidden units [b U, (b + 1) U).
+/// Thread r * S + s computes the recurrent product of gate row r = g * U + u of these units for sequence s; then the first U S threads
+/// update the cell of unit tid / S for sequence s, whose state stays in a register across the time steps.
+/// After each step, the blocks wait until all have written their units' hidden states (a counter in global memory, which
+/// counts the blocks that have arrived). This only works if all blocks are resident at once, which the caller ensures for t1 - t0 > 1.
+/// With sharedWeights, each block copies its 4 U rows of the recurrent weights into shared memory once, for all time steps.
+template <class ElemType, bool sharedWeights>
+__global__ void _lstmForwardWithState(
+    const ElemType* gates,
+    const ElemType* recurrentWeights,
+    const ElemType* flags,
+    const ElemType* h0,
+    ElemType* c,
+    ElemType* output,
+    const CUDA_LONG H,
+    const CUDA_LONG S,
+    const CUDA_LONG U,
+    const CUDA_LONG t0,
+    const CUDA_LONG t1,
+    int* barrier)
+{
+    extern __shared__ double lstmSharedMemory[]; // (double, so that all instantiations agree on the declaration)
+    ElemType* hTile = (ElemType*) lstmSharedMemory;              // [LSTMStateTileRows x S], element k * S + s
+    ElemType* gateValues = hTile + LSTMStateTileRows * S;        // [4 U x S]
+    ElemType* weights = gateValues + 4 * U * S;                  // (sharedWeights) [4 U x H], row-major
+
+    const CUDA_LONG tid = threadIdx.x;
+    const CUDA_LONG s = tid % S;
+    const CUDA_LONG r = tid / S;
+    const CUDA_LONG j = blockIdx.x * U + r % U; // unit of the gate row
+    const bool hasRow = j < H;
+    const CUDA_LONG col = (r / U) * H + j; // column of the gate row in recurrentWeights
+    if (sharedWeights)
+    {
+        for (CUDA_LONG i = tid; i < 4 * U * H; i += blockDim.x)
+        {
+            const CUDA_LONG rr = i / H;
+            const CUDA_LONG jj = blockIdx.x * U + rr % U;
+            weights[i] = jj < H ? recurrentWeights[((rr / U) * H + jj) * H + i % H] : 0;
+        }
+    }
+    const ElemType* w = !hasRow ? recurrentWeights : sharedWeights ? weights + r * H : recurrentWeights + col * H;
+
+    const CUDA_LONG cellUnit = blockIdx.x * U + tid / S;
+    const bool hasCell = tid < U * S && cellUnit < H;
+    ElemType cState = hasCell ? c[IDX2C(cellUnit, s, H)] : 0;
+
+    for (CUDA_LONG t = t0; t < t1; t++)
+    {
+        // the previous hidden states, written by all blocks; volatile, so that they are not taken from a stale cache
+        const volatile ElemType* hPrev = t == 0 ? h0 : output + (t - 1) * S * H;
+        const ElemType flag = flags[t * S + s];
+
+        ElemType sum = hasRow ? gates[IDX2C(col, t * S + s, 4 * H)] : 0;
+        for (CUDA_LONG k0 = 0; k0 < H; k0 += LSTMStateTileRows)
+        {
+            const CUDA_LONG rows = min(LSTMStateTileRows, H - k0);
+            __syncthreads(); // (the previous tile has been used)
+            for (CUDA_LONG i = tid; i < rows * S; i += blockDim.x)
+            {
+                const CUDA_LONG ss = i % S;
+                hTile[i] = flags[t * S + ss] == 2 ? 0 : hPrev[IDX2C(k0 + i / S, ss, H)];
+            }
+            __syncthreads();
+            if (hasRow)
+            {
+                for (CUDA_LONG k = 0; k < rows; k++)
+                    sum += w[k0 + k] * hTile[k * S + s];
+            }
+        }
+        if (hasRow)
+            gateValues[r * S + s] = sum;
+        __syncthreads();
+
+        if (hasCell)
+        {
+            const CUDA_LONG u = tid / S;
+            ElemType hNew;
+            if (flag == 0) // gap: keep the state
+                hNew = hPrev[IDX2C(cellUnit, s, H)];
+            else
+            {
+                if (flag == 2)
+                    cState = 0;
+                const ElemType inputGate = Microsoft::MSR::CNTK::Sigmoid(gateValues[(0 * U + u) * S + s]);
+                const ElemType forgetGate = Microsoft::MSR::CNTK::Sigmoid(gateValues[(1 * U + u) * S + s]);
+                const ElemType cellInput = tanh_(gateValues[(2 * U + u) * S + s]);
+                const ElemType outputGate = Microsoft::MSR::CNTK::Sigmoid(gateValues[(3 * U + u) * S + s]);
+                cState = forgetGate * cState + inputGate * cellInput;
+                hNew = outputGate * tanh_(cState);
+            }
+            output[IDX2C(cellUnit, t * S + s, H)] = hNew;
+        }
+
+        if (t + 1 < t1) // wait for all blocks to finish this step
+        {
+            __threadfence();
+            __syncthreads();
+            if (tid == 0)
+            {
+                atomicAdd(barrier, 1);
+                const int numArrived = (int) (t - t0 + 1) * gridDim.x;
+                while (*(volatile int*) barrier < numArrived)
+                    ;
+            }
+            __syncthreads();
+        }
+    }
+    if (hasCell)
+        c[IDX2C(cellUnit, s, H)] = cState;
+}
+
 /// $\zeta_t(j) = {\sum_k exp(\delta_{t-1}(k) + a_{kj}(t))}$.
 template <class ElemType>
 __global__ void _rcrfBackwardComputeZeta(
@@ -4979,6 +5839,33 @@ __global__ void _assignNumOfDiffCol(const ElemType* a, const ElemType* b, ElemTy
         *c = res;
 }
 
+// one thread per output value; see GPUMatrix::AssignAugmentedImagesOf()
+template <class ElemType>
+__global__ void _assignAugmentedImages(ElemType* res, const unsigned char* images, const ElemType* mean, int width, int height, int channels, bool channelsFirst, const CUDA_LONG N)
+{
+    CALCULATE_ELEMENTWISE_INDEX_OR_EXIT(id, N);
+    const CUDA_LONG pixelsPerImage = width * height;
+    const CUDA_LONG valuesPerImage = pixelsPerImage * channels;
+    const CUDA_LONG j = id / valuesPerImage;
+    const CUDA_LONG i = id - j * valuesPerImage;
+    CUDA_LONG pixel, c;
+    if (channelsFirst)
+    {
+        c = i / pixelsPerImage;
+        pixel = i - c * pixelsPerImage;
+    }
+    else
+    {
+        pixel = i / channels;
+        c = i - pixel * channels;
+    }
+    const ImageAugmentationDesc& desc = ((const ImageAugmentationDesc*) images)[j];
+    ElemType value = ScaledImagePixel<ElemType>(images, desc, width, height, channels, pixel % width, pixel / width, c);
+    if (mean)
+        value -= mean[pixel * channels + c];
+    res[id] = value;
+}
+
 template <class ElemType>
 __global__ void _maskColumnsValue(ElemType* a, const char* columnsMask, CUDA_LONG numCols, CUDA_LONG numRows, ElemType val)
 {
@@ -936,6 +936,107 @@ void GPUSparseMatrix<ElemType>::SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYP
     }
 }
 
+// SetMatrixFromCSCBuffer - set from values[numNZReserved], row indices[numNZReserved], column starts[numCols + 1] in one host buffer
+// If our buffer gets the same layout, which it does unless it was larger already, this is a single copy.
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols)
+{
+    if (!OwnBuffer())
+        LogicError("Cannot Set since the buffer is managed externally.");
+
+    if (h_buffer == nullptr)
+        LogicError("SetMatrixFromCSCBuffer: nullptr passed in.");
+
+    static_assert(sizeof(CPUSPARSE_INDEX_TYPE) == sizeof(GPUSPARSE_INDEX_TYPE), "SetMatrixFromCSCBuffer: host and device index types must agree.");
+
+    PrepareDevice();
+    m_format = matrixFormatSparseCSC;
+    Resize(numRows, numCols, numNZReserved, true, false);
+    SetNzCount(nz);
+
+    const ElemType* h_Val = (const ElemType*) h_buffer;
+    const GPUSPARSE_INDEX_TYPE* h_Row = (const GPUSPARSE_INDEX_TYPE*) (h_Val + numNZReserved);
+    const GPUSPARSE_INDEX_TYPE* h_CSCCol = h_Row + numNZReserved;
+    if (m_elemSizeAllocated == numNZReserved)
+        CUDA_CALL(cudaMemcpyAsync(BufferPointer(), h_buffer, BufferSizeNeeded(numRows, numCols, numNZReserved, m_format), cudaMemcpyHostToDevice, t_stream));
+    else
+    {
+        CUDA_CALL(cudaMemcpyAsync(BufferPointer(), h_Val, NzSize(), cudaMemcpyHostToDevice, t_stream));
+        CUDA_CALL(cudaMemcpyAsync(RowLocation(), h_Row, RowSize(), cudaMemcpyHostToDevice, t_stream));
+        CUDA_CALL(cudaMemcpyAsync(ColLocation(), h_CSCCol, ColSize(), cudaMemcpyHostToDevice, t_stream));
+    }
+
+    // wait for the copy only (not the whole device), so that the caller can refill its buffer
+    cudaEvent_t done = nullptr;
+    CUDA_CALL(cudaEventCreate(&done));
+    CUDA_CALL(cudaEventRecord(done, t_stream));
+    CUDA_CALL(cudaEventSynchronize(done));
+    CUDA_CALL(cudaEventDestroy(done));
+}
+
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const
+{
+    if (m_format != matrixFormatSparseBlockCol)
+        NOT_IMPLEMENTED;
+
+    std::vector<GPUSPARSE_INDEX_TYPE> blockId2Col(m_blockSize);
+    values.resize(m_numRows * m_blockSize);
+    if (m_blockSize > 0)
+    {
+        PrepareDevice();
+        // on the compute stream, so that we get the values once they are computed
+        CUDA_CALL(cudaMemcpyAsync(blockId2Col.data(), BlockId2ColOrRow(), sizeof(GPUSPARSE_INDEX_TYPE) * m_blockSize, cudaMemcpyDeviceToHost, t_stream));
+        CUDA_CALL(cudaMemcpyAsync(values.data(), BufferPointer(), sizeof(ElemType) * values.size(), cudaMemcpyDeviceToHost, t_stream));
+        cudaEvent_t done = nullptr;
+        CUDA_CALL(cudaEventCreate(&done));
+        CUDA_CALL(cudaEventRecord(done, t_stream));
+        CUDA_CALL(cudaEventSynchronize(done));
+        CUDA_CALL(cudaEventDestroy(done));
+    }
+    columnIds.assign(blockId2Col.begin(), blockId2Col.end());
+}
+
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values)
+{
+    if (!OwnBuffer())
+        LogicError("Cannot Set since the buffer is managed externally.");
+    if (m_format != matrixFormatSparseBlockCol)
+        NOT_IMPLEMENTED;
+
+    const size_t numBlocks = columnIds.size();
+    std::vector<GPUSPARSE_INDEX_TYPE> blockId2Col(numBlocks);
+    for (size_t j = 0; j < numBlocks; j++)
+    {
+        if (columnIds[j] >= m_numCols)
+            InvalidArgument("SetMatrixFromBlockColumns: Column id %d out of range for %d columns.", (int) columnIds[j], (int) m_numCols);
+        blockId2Col[j] = (GPUSPARSE_INDEX_TYPE) columnIds[j];
+    }
+
+    PrepareDevice();
+    Resize(m_numRows, m_numCols, m_numRows * numBlocks, matrixFormatSparseBlockCol, true, false);
+    m_blockSize = numBlocks;
+    m_nz = m_numRows * numBlocks;
+
+    // col2BlockId is -1 for the columns without values
+    CUDA_CALL(cudaMemsetAsync(ColOrRow2BlockId(), 0xff, sizeof(GPUSPARSE_INDEX_TYPE) * m_numCols, t_stream));
+    if (numBlocks > 0)
+    {
+        CUDA_CALL(cudaMemcpyAsync(BlockId2ColOrRow(), blockId2Col.data(), sizeof(GPUSPARSE_INDEX_TYPE) * numBlocks, cudaMemcpyHostToDevice, t_stream));
+        CUDA_CALL(cudaMemcpyAsync(BufferPointer(), values, sizeof(ElemType) * m_nz, cudaMemcpyHostToDevice, t_stream));
+        int blocksPerGrid = (int) ceil(((double) numBlocks) / GridDim::maxThreadsPerBlock);
+        _setCol2BlockId<ElemType><<<blocksPerGrid, GridDim::maxThreadsPerBlock, 0, t_stream>>>(BlockId2ColOrRow(), ColOrRow2BlockId(), numBlocks);
+    }
+
+    // wait for the copies, since blockId2Col is a local and the caller may reuse 'values'
+    cudaEvent_t done = nullptr;
+    CUDA_CALL(cudaEventCreate(&done));
+    CUDA_CALL(cudaEventRecord(done, t_stream));
+    CUDA_CALL(cudaEventSynchronize(done));
+    CUDA_CALL(cudaEventDestroy(done));
+}
+
 // this function will allocate memory while the caller needs to release it
 template <class ElemType>
 void GPUSparseMatrix<ElemType>::GetMatrixFromCSCFormat(GPUSPARSE_INDEX_TYPE*& h_CSCCol, GPUSPARSE_INDEX_TYPE*& h_Row, ElemType*& h_Val, size_t& numElemAllocated, size_t& nz, size_t& numRows, size_t& numCols) const
@@ -1011,9 +1112,73 @@ void GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPU
         c.VerifySize(m, n); // Can't resize if beta != 0
 
     c.PrepareDevice();
-    if (rhs.m_format == MatrixFormat::matrixFormatSparseCSC)
+    if (rhs.m_format == MatrixFormat::matrixFormatSparseCSC && !transposeB && UseTiledDenseTimesSparseKernel(m, rhs.GetNumNZElements(), n))
+    {
+        cudaEvent_t done = nullptr;
+        if (do_sync)
+            CUDA_CALL(cudaEventCreate(&done));
+        const ElemType* a = reinterpret_cast<const ElemType*>(lhs.BufferPointer());
+        const ElemType* bnzValues = reinterpret_cast<const ElemType*>(rhs.BufferPointer());
+        ElemType* pc = reinterpret_cast<ElemType*>(c.BufferPointer());
+        // the smaller tile for dense dimensions that would leave most of a large one idle
+        if (m >= 128)
+        {
+            const dim3 grid(n, (m + 127) / 128);
+            _denseMultSparseCSCAndWeightedAddToDense<ElemType, 128><<<grid, 128, 0, t_stream>>>(m, k, alpha, a, transposeA, bnzValues, rhs.RowLocation(), rhs.ColLocation(), beta, pc);
+        }
+        else
+        {
+            const dim3 grid(n, (m + 31) / 32);
+            _denseMultSparseCSCAndWeightedAddToDense<ElemType, 32><<<grid, 32, 0, t_stream>>>(m, k, alpha, a, transposeA, bnzValues, rhs.RowLocation(), rhs.ColLocation(), beta, pc);
+        }
+        if (do_sync)
+            CUDA_CALL(cudaEventRecord(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventSynchronize(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventDestroy(done));
+    }
+    else if (rhs.m_format == MatrixFormat::matrixFormatSparseCSC && !transposeB)
     {
-        ConvolveAndWeightedAdd(alpha, lhs, transposeA, rhs, transposeB, beta, c, 1, 1, false, false);
+        // one-hot or few-hot columns: gather the columns of op(lhs) directly
+        const int threadsPerBlock = m >= 128 ? 128 : 32;
+        const dim3 grid(n, (m + threadsPerBlock - 1) / threadsPerBlock);
+        cudaEvent_t done = nullptr;
+        if (do_sync)
+            CUDA_CALL(cudaEventCreate(&done));
+        _denseGatherSparseCSCColumnsAndWeightedAddToDense<ElemType><<<grid, threadsPerBlock, 0, t_stream>>>(
+            m, k, alpha, reinterpret_cast<const ElemType*>(lhs.BufferPointer()), transposeA,
+            reinterpret_cast<const ElemType*>(rhs.BufferPointer()), rhs.RowLocation(), rhs.ColLocation(), beta,
+            reinterpret_cast<ElemType*>(c.BufferPointer()));
+        if (do_sync)
+            CUDA_CALL(cudaEventRecord(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventSynchronize(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventDestroy(done));
+    }
+    else if (rhs.m_format == MatrixFormat::matrixFormatSparseCSC)
+    {
+        // the gradient of the product w.r.t. lhs: scatter-add the columns of op(lhs) into the columns of c that the words select
+        if (beta == 0)
+            c.SetValue(0);
+        else if (beta != 1)
+            GPUMatrix<ElemType>::Scale(beta, c);
+        const int threadsPerBlock = m >= 128 ? 128 : 32;
+        const dim3 grid(l, (m + threadsPerBlock - 1) / threadsPerBlock);
+        cudaEvent_t done = nullptr;
+        if (do_sync)
+            CUDA_CALL(cudaEventCreate(&done));
+        _denseMultSparseCSCTransposeAndScatterAddToDense<ElemType><<<grid, threadsPerBlock, 0, t_stream>>>(
+            m, l, alpha, reinterpret_cast<const ElemType*>(lhs.BufferPointer()), transposeA,
+            reinterpret_cast<const ElemType*>(rhs.BufferPointer()), rhs.RowLocation(), rhs.ColLocation(),
+            reinterpret_cast<ElemType*>(c.BufferPointer()));
+        if (do_sync)
+            CUDA_CALL(cudaEventRecord(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventSynchronize(done));
+        if (do_sync)
+            CUDA_CALL(cudaEventDestroy(done));
     }
     else if (rhs.m_format == matrixFormatSparseCSR)
     {
@@ -1027,6 +1192,15 @@ void GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPU
     }
 }
 
+// Choose the kernel for dense [m x k] x sparse CSC [k x n] by the sparsity profile of the sparse one: the tiled kernel shares each
+// nonzero among a tile of at least a warp of rows; that pays off once there are a few nonzeros per column to share, and the
+// dense dimension fills a warp. One-hot-like inputs and narrow products use the plain gather kernel.
+template <class ElemType>
+/*static*/ bool GPUSparseMatrix<ElemType>::UseTiledDenseTimesSparseKernel(size_t m, size_t nz, size_t n)
+{
+    return m >= 32 && nz >= 2 * n;
+}
+
 template <class ElemType>
 void GPUSparseMatrix<ElemType>::ConvolveAndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& lhs, const bool transposeA,
                                                        const GPUSparseMatrix<ElemType>& rhs, const bool transposeB, ElemType beta, GPUMatrix<ElemType>& c, size_t numChannels, size_t horizontalSubsample, bool padding, bool channelwise)
@@ -1551,15 +1725,27 @@ template <class ElemType>
 void GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPUSparseMatrix<ElemType>& a, const bool transposeA,
                                                        const GPUMatrix<ElemType>& b, const bool transposeD, ElemType beta, GPUMatrix<ElemType>& c)
 {
-    if (a.m_format != matrixFormatSparseCSR)
-        NOT_IMPLEMENTED;
-
-    if (transposeD)
+    if (a.m_format != matrixFormatSparseCSR && a.m_format != matrixFormatSparseCSC)
         NOT_IMPLEMENTED;
 
     if (a.GetComputeDeviceId() != b.GetComputeDeviceId() || (b.GetComputeDeviceId() != a.GetComputeDeviceId()))
         RuntimeError("MultiplyAndWeightedAdd: All matrices must be on the same GPU");
 
+    // a CSC matrix is the CSR representation of its transpose
+    const bool isCSR = a.m_format == matrixFormatSparseCSR;
+    const bool transposeCSR = transposeA == isCSR;
+
+    // csrmm2 reads a transposed dense operand in place, but only together with a non-transposed sparse one
+    if (transposeCSR && transposeD)
+        return MultiplyAndWeightedAdd(alpha, a, transposeA, b.Transpose(), false, beta, c);
+
+    const size_t numRowsC = transposeA ? a.GetNumCols() : a.GetNumRows();
+    const size_t numColsC = transposeD ? b.GetNumRows() : b.GetNumCols();
+    if (beta == 0)
+        c.Resize(numRowsC, numColsC);
+    else
+        c.VerifySize(numRowsC, numColsC); // Can't resize if beta != 0
+
     a.PrepareDevice();
     cusparseHandle_t cusparseHandle = 0;
     CUSPARSE_CALL(cusparseCreate(&cusparseHandle));
@@ -1567,26 +1753,30 @@ void GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPU
     CUSPARSE_CALL(cusparseCreateMatDescr(&descr));
     cusparseSetMatType(descr, CUSPARSE_MATRIX_TYPE_GENERAL);
     cusparseSetMatIndexBase(descr, CUSPARSE_INDEX_BASE_ZERO);
-    cusparseOperation_t oper = transposeA ? CUSPARSE_OPERATION_TRANSPOSE : CUSPARSE_OPERATION_NON_TRANSPOSE;
+    cusparseOperation_t oper = transposeCSR ? CUSPARSE_OPERATION_TRANSPOSE : CUSPARSE_OPERATION_NON_TRANSPOSE;
+    cusparseOperation_t operD = transposeD ? CUSPARSE_OPERATION_TRANSPOSE : CUSPARSE_OPERATION_NON_TRANSPOSE;
 
-    int m = (int) a.GetNumRows();
-    int n = (int) b.GetNumCols();
+    // dimensions and indices of the CSR matrix
+    int m = isCSR ? (int) a.GetNumRows() : (int) a.GetNumCols();
+    int n = transposeD ? (int) b.GetNumRows() : (int) b.GetNumCols();
     assert(n == (int) c.GetNumCols());
-    int k = (int) a.GetNumCols();
+    int k = isCSR ? (int) a.GetNumCols() : (int) a.GetNumRows();
+    const GPUSPARSE_INDEX_TYPE* rowLocation = isCSR ? a.RowLocation() : a.ColLocation();
+    const GPUSPARSE_INDEX_TYPE* colLocation = isCSR ? a.ColLocation() : a.RowLocation();
 
     cudaEvent_t done = nullptr;
     if (do_sync)
         CUDA_CALL(cudaEventCreate(&done));
     if (sizeof(ElemType) == sizeof(float))
     {
-        CUSPARSE_CALL(cusparseScsrmm(cusparseHandle, oper, m, n, k, (int) a.GetNumElemAllocated(), reinterpret_cast<float*>(&alpha), descr, reinterpret_cast<const float*>(a.BufferPointer()),
-                                     a.RowLocation(), a.ColLocation(), reinterpret_cast<float*>(b.BufferPointer()),
+        CUSPARSE_CALL(cusparseScsrmm2(cusparseHandle, oper, operD, m, n, k, (int) a.GetNumElemAllocated(), reinterpret_cast<float*>(&alpha), descr, reinterpret_cast<const float*>(a.BufferPointer()),
+                                     rowLocation, colLocation, reinterpret_cast<float*>(b.BufferPointer()),
                                      (int) b.GetNumRows(), reinterpret_cast<float*>(&beta), reinterpret_cast<float*>(c.BufferPointer()), (int) c.GetNumRows()));
     }
     else
     {
-        CUSPARSE_CALL(cusparseDcsrmm(cusparseHandle, oper, m, n, k, (int) a.GetNumElemAllocated(), reinterpret_cast<double*>(&alpha), descr, reinterpret_cast<const double*>(a.BufferPointer()),
-                                     a.RowLocation(), a.ColLocation(), reinterpret_cast<double*>(b.BufferPointer()),
+        CUSPARSE_CALL(cusparseDcsrmm2(cusparseHandle, oper, operD, m, n, k, (int) a.GetNumElemAllocated(), reinterpret_cast<double*>(&alpha), descr, reinterpret_cast<const double*>(a.BufferPointer()),
+                                     rowLocation, colLocation, reinterpret_cast<double*>(b.BufferPointer()),
                                      (int) b.GetNumRows(), reinterpret_cast<double*>(&beta), reinterpret_cast<double*>(c.BufferPointer()), (int) c.GetNumRows()));
     }
     if (do_sync)
@@ -1965,6 +2155,7 @@ ElemType GPUSparseMatrix<ElemType>::InnerProductOfMatrices(const GPUSparseMatrix
     cusparseAction_t cpVals = CUSPARSE_ACTION_NUMERIC;
     cusparseIndexBase_t idxBase = CUSPARSE_INDEX_BASE_ZERO;
     cusparseHandle_t cusparseHandle = 0;
+    CUSPARSE_CALL(cusparseCreate(&cusparseHandle));
 
     if (a.m_format == matrixFormatSparseCSR) // need to put a in ColumnMajor format
     {
@@ -1972,7 +2163,6 @@ ElemType GPUSparseMatrix<ElemType>::InnerProductOfMatrices(const GPUSparseMatrix
         cscRowIndA = TracingGPUMemoryAllocator::Allocate<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), nnz);
         cscColPtrA = TracingGPUMemoryAllocator::Allocate<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), (n + 1));
 
-        CUSPARSE_CALL(cusparseCreate(&cusparseHandle));
         if (do_sync)
             CUDA_CALL(cudaEventCreate(&done));
         if (sizeof(ElemType) == sizeof(float))
@@ -2015,8 +2205,11 @@ ElemType GPUSparseMatrix<ElemType>::InnerProductOfMatrices(const GPUSparseMatrix
         CUDA_CALL(cudaEventSynchronize(done));
     if (do_sync)
         CUDA_CALL(cudaEventDestroy(done));
-    TracingGPUMemoryAllocator::Free<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), cscRowIndA);
-    TracingGPUMemoryAllocator::Free<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), cscColPtrA);
+    if (a.m_format == matrixFormatSparseCSR) // (a CSC matrix is used in place)
+    {
+        TracingGPUMemoryAllocator::Free<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), cscRowIndA);
+        TracingGPUMemoryAllocator::Free<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), cscColPtrA);
+    }
     // CUDA_CALL(cudaMemcpy(h_vectArray,vectArray,sizeof(GPUSPARSE_INDEX_TYPE)*a.m_nz,cudaMemcpyDeviceToHost));
 
     // Actual dot product
@@ -2034,7 +2227,8 @@ ElemType GPUSparseMatrix<ElemType>::InnerProductOfMatrices(const GPUSparseMatrix
                                     reinterpret_cast<double*>(&res), idxBase));
     }
     TracingGPUMemoryAllocator::Free<GPUSPARSE_INDEX_TYPE>(a.GetComputeDeviceId(), vectArray);
-    TracingGPUMemoryAllocator::Free<ElemType>(a.GetComputeDeviceId(), cscValA);
+    if (a.m_format == matrixFormatSparseCSR)
+        TracingGPUMemoryAllocator::Free<ElemType>(a.GetComputeDeviceId(), cscValA);
     CUSPARSE_CALL(cusparseDestroy(cusparseHandle));
     return res;
 }
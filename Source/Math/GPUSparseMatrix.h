@@ -264,6 +264,11 @@ public:
                                 const size_t nz, const size_t numRows, const size_t numCols, const bool IsOnDevice = false, const DEVICEID_TYPE devId = -1);
     void SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYPE* h_CSCCol, const CPUSPARSE_INDEX_TYPE* h_Row, const ElemType* h_Val,
                                 const size_t nz, const size_t numRows, const size_t numCols, const bool IsOnDevice = false, const DEVICEID_TYPE devId = -1);
+    // Sets sparse matrix in CSC format from a host buffer in our own layout, see Matrix::SetMatrixFromCSCBuffer()
+    void SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols);
+    // block-col format only, see Matrix::GetBlockColumns()
+    void GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const;
+    void SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values);
 
     // Gets sparse matrix in CSR format. this acts as deep copy. All passed pointers must be NULL. the function will allocate memory itself.
     void GetMatrixFromCSRFormat(CPUSPARSE_INDEX_TYPE*& h_CSRRow, CPUSPARSE_INDEX_TYPE*& h_Col, ElemType*& h_Val, size_t& numElemAllocated, size_t& nz, size_t& numRows, size_t& numCols) const;
@@ -381,6 +386,7 @@ private:
     size_t ElemCountFromBufferSize() const;
     DEVICEID_TYPE PrepareDevice(const DEVICEID_TYPE deviceId = -1) const;
     size_t IdentifyRowsWithValues() const;
+    static bool UseTiledDenseTimesSparseKernel(size_t m, size_t nz, size_t n);
 
 private:
     size_t m_totalBufferSizeAllocated;
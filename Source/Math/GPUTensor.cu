@@ -68,6 +68,9 @@ struct FixedArray
     {
         return m_data[n];
     }
+    __device__ __host__ FixedArray() // (to be filled in by the caller)
+    {
+    }
     template <class VEC>
     FixedArray(const VEC& data) // construct from CPU-side STL array or vector
     {
@@ -695,6 +698,289 @@ void LaunchUnaryTensorOp(ElemType beta, const ElemType* pa, ElemType* pb, ElemTy
         CUDA_CALL(cudaEventDestroy(done));
 }
 
+// -----------------------------------------------------------------------
+// kernels and launch  --specialized for frequent patterns
+// -----------------------------------------------------------------------
+
+// The kernels above locate each operand from the thread index with a division per dimension and a multiplication
+// per operand and dimension. TensorOpN() selects these instead where the pattern allows:
+//  - linear: all operands contiguous in a single dimension, no reduction  -->  flat loop; for 'float', 4 elements per thread with float4 loads and stores
+//  - 2D: two dimensions, output contiguous along the first  -->  rows from the thread index, columns from the block index, no division;
+//    this is where row and column broadcasting (inputs with stride 0) and column slices with gaps end up after flattening
+//  - full reduction to a scalar  -->  grid-stride loop, then reduction within warps by shuffles and across warps through shared memory
+
+// set *pout = alpha * val + beta * *pout, like the general kernels do
+template <class ElemType>
+static __device__ ElemType CombineWithOutput(ElemType val, ElemType beta, ElemType alpha, ElemType out)
+{
+    val *= alpha;
+    if (beta != 0)
+        val += beta * out;
+    return val;
+}
+
+template <class ElemType, C_size_t N>
+__global__ void _launchLinearTensorOp(ElemType beta, FixedArray<ElemType*, N> pointers, ElemType alpha, ElementWiseOperator op, CUDA_LONG numElements)
+{
+    CUDA_LONG id = GridDim::GetLinearThreadId();
+    if (id >= numElements)
+        return;
+#pragma unroll
+    for (C_size_t i = 0; i < N; i++)
+        pointers[i] += id;
+    ElemType* pout = pointers[N - 1];
+    *pout = CombineWithOutput(TensorOps<ElemType>::Compute(pointers, op), beta, alpha, beta != 0 ? *pout : 0);
+}
+
+// float version: thread id < numVectors computes elements [4 id, 4 id + 4), the remaining threads one element of the tail each
+// All pointers must be 16-byte aligned.
+template <C_size_t N>
+__global__ void _launchLinearTensorOpFloat4(float beta, FixedArray<float*, N> pointers, float alpha, ElementWiseOperator op, CUDA_LONG numVectors, CUDA_LONG numElements)
+{
+    CUDA_LONG id = GridDim::GetLinearThreadId();
+    if (id >= numVectors)
+    {
+        id += 3 * numVectors; // = 4 numVectors + (id - numVectors)
+        if (id >= numElements)
+            return;
+#pragma unroll
+        for (C_size_t i = 0; i < N; i++)
+            pointers[i] += id;
+        float* pout = pointers[N - 1];
+        *pout = CombineWithOutput(TensorOps<float>::Compute(pointers, op), beta, alpha, beta != 0 ? *pout : 0);
+        return;
+    }
+    float4 values[N]; // inputs, then output
+#pragma unroll
+    for (C_size_t i = 0; i < N; i++)
+    {
+        if (i < N - 1 || beta != 0)
+            values[i] = ((const float4*) pointers[i])[id];
+    }
+    float4 result;
+    float* results = (float*) &result;
+#pragma unroll
+    for (int j = 0; j < 4; j++)
+    {
+        FixedArray<float*, N> elementPointers;
+#pragma unroll
+        for (C_size_t i = 0; i < N; i++)
+            elementPointers[i] = (float*) &values[i] + j;
+        results[j] = CombineWithOutput(TensorOps<float>::Compute(elementPointers, op), beta, alpha, beta != 0 ? *elementPointers[N - 1] : 0);
+    }
+    ((float4*) pointers[N - 1])[id] = result;
+}
+
+// float4 version where the pointers allow; returns false if they don't, or for 'double'
+template <C_size_t N>
+static bool LaunchLinearTensorOpFloat4(float beta, const array<float*, N>& pointerVector, float alpha, ElementWiseOperator op, size_t regularOpDim)
+{
+    for (C_size_t i = 0; i < N; i++)
+    {
+        if (((size_t) pointerVector[i] % sizeof(float4)) != 0) // e.g. a column slice at an odd offset
+            return false;
+    }
+
+    FixedArray<float*, N> pointers(pointerVector);
+    CUDA_LONG NN = (CUDA_LONG) regularOpDim;
+    CUDA_LONG numVectors = NN / 4;
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    GridDim grid(numVectors + NN % 4);
+    _launchLinearTensorOpFloat4<N><<<grid.m_blocksPerGrid, grid.m_threadsPerBlock, 0, t_stream>>>(beta, pointers, alpha, op, numVectors, NN);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+    return true;
+}
+template <C_size_t N>
+static bool LaunchLinearTensorOpFloat4(double, const array<double*, N>&, double, ElementWiseOperator, size_t)
+{
+    return false;
+}
+
+template <class ElemType, C_size_t N>
+static void LaunchLinearTensorOp(ElemType beta, const array<ElemType*, N>& pointerVector, ElemType alpha, ElementWiseOperator op, size_t regularOpDim)
+{
+    if (LaunchLinearTensorOpFloat4<N>(beta, pointerVector, alpha, op, regularOpDim))
+        return;
+
+    FixedArray<ElemType*, N> pointers(pointerVector);
+    CUDA_LONG NN = (CUDA_LONG) regularOpDim;
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    GridDim grid(NN);
+    _launchLinearTensorOp<ElemType, N><<<grid.m_blocksPerGrid, grid.m_threadsPerBlock, 0, t_stream>>>(beta, pointers, alpha, op, NN);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+}
+
+// Each thread walks one row across the columns blockIdx.y, blockIdx.y + gridDim.y, ...
+template <class ElemType, C_size_t N>
+__global__ void _launchTensorOp2D(ElemType beta, FixedArray<ElemType*, N> pointers, ElemType alpha, ElementWiseOperator op,
+                                  FixedArray<C_int, N> rowStrides, FixedArray<C_int, N> colStrides, CUDA_LONG numRows, CUDA_LONG numCols)
+{
+    CUDA_LONG row = blockIdx.x * blockDim.x + threadIdx.x;
+    if (row >= numRows)
+        return;
+    CUDA_LONG col = blockIdx.y;
+#pragma unroll
+    for (C_size_t i = 0; i < N; i++)
+        pointers[i] += row * rowStrides[i] + col * colStrides[i];
+    for (; col < numCols; col += gridDim.y)
+    {
+        ElemType* pout = pointers[N - 1];
+        *pout = CombineWithOutput(TensorOps<ElemType>::Compute(pointers, op), beta, alpha, beta != 0 ? *pout : 0);
+#pragma unroll
+        for (C_size_t i = 0; i < N; i++)
+            pointers[i] += gridDim.y * colStrides[i];
+    }
+}
+
+template <class ElemType, C_size_t N>
+static void LaunchTensorOp2D(ElemType beta, const array<ElemType*, N>& pointerVector, ElemType alpha, ElementWiseOperator op,
+                             const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, N>& regularStrides)
+{
+    FixedArray<ElemType*, N> pointers(pointerVector);
+    array<ptrdiff_t, N> rowStrideVector, colStrideVector;
+    for (C_size_t i = 0; i < N; i++)
+    {
+        rowStrideVector[i] = regularStrides[i][0];
+        colStrideVector[i] = regularStrides[i][1];
+    }
+    FixedArray<C_int, N> rowStrides(rowStrideVector);
+    FixedArray<C_int, N> colStrides(colStrideVector);
+    CUDA_LONG numRows = (CUDA_LONG) regularOpDims[0];
+    CUDA_LONG numCols = (CUDA_LONG) regularOpDims[1];
+
+    let& props = GridDim::GetDeviceProps();
+    let numThreadsX = min(CeilDiv(numRows, props.warpSize) * props.warpSize, GridDim::maxThreadsPerBlock);
+    let numBlocksX = CeilDiv(numRows, numThreadsX);
+    let numBlocksY = min(numCols, (CUDA_LONG) props.maxGridSize[1]);
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    _launchTensorOp2D<ElemType, N><<<dim3(numBlocksX, numBlocksY), numThreadsX, 0, t_stream>>>(beta, pointers, alpha, op, rowStrides, colStrides, numRows, numCols);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+}
+
+static __device__ float ShuffleDown(float value, int delta)
+{
+#if CUDA_VERSION >= 9000
+    return __shfl_down_sync(0xffffffff, value, delta);
+#else
+    return __shfl_down(value, delta);
+#endif
+}
+static __device__ double ShuffleDown(double value, int delta) // (older CUDA versions can only shuffle 32 bits)
+{
+    int hi = __double2hiint(value);
+    int lo = __double2loint(value);
+#if CUDA_VERSION >= 9000
+    hi = __shfl_down_sync(0xffffffff, hi, delta);
+    lo = __shfl_down_sync(0xffffffff, lo, delta);
+#else
+    hi = __shfl_down(hi, delta);
+    lo = __shfl_down(lo, delta);
+#endif
+    return __hiloint2double(hi, lo);
+}
+
+// sum of the value over the threads of a warp, in lane 0
+template <class ElemType>
+static __device__ ElemType WarpSum(ElemType value)
+{
+    for (int delta = warpSize / 2; delta > 0; delta /= 2)
+        value += ShuffleDown(value, delta);
+    return value;
+}
+
+// reduce all elements into pointers[N - 1]; blockDim.x must be a multiple of the warp size
+// With multiple blocks, each adds its part with atomicAdd(), and beta must have been applied already.
+template <class ElemType, C_size_t N>
+__global__ void _launchTensorOpFullReduction(ElemType beta, FixedArray<ElemType*, N> pointers, ElemType alpha, ElementWiseOperator op,
+                                             FixedArray<C_int, N> strides, CUDA_LONG numElements)
+{
+    ReduceElemType sum = 0;
+    for (CUDA_LONG id = blockIdx.x * blockDim.x + threadIdx.x; id < numElements; id += gridDim.x * blockDim.x)
+    {
+        FixedArray<ElemType*, N> elementPointers;
+#pragma unroll
+        for (C_size_t i = 0; i < N - 1; i++)
+            elementPointers[i] = pointers[i] + id * strides[i];
+        sum += TensorOps<ElemType>::Compute(elementPointers, op);
+    }
+
+    __shared__ ReduceElemType warpSums[GridDim::maxThreadsPerBlock / 32];
+    CUDA_LONG lane = threadIdx.x % warpSize;
+    CUDA_LONG warp = threadIdx.x / warpSize;
+    sum = WarpSum(sum);
+    if (lane == 0)
+        warpSums[warp] = sum;
+    __syncthreads();
+    if (warp != 0)
+        return;
+    sum = lane < blockDim.x / warpSize ? warpSums[lane] : 0;
+    sum = WarpSum(sum);
+    if (lane == 0)
+    {
+        ElemType* pout = pointers[N - 1];
+        ElemType val = alpha * (ElemType) sum;
+        if (gridDim.x > 1)
+            atomicAdd(pout, val);
+        else
+            *pout = CombineWithOutput((ElemType) sum, beta, alpha, beta != 0 ? *pout : 0);
+    }
+}
+
+template <class ElemType>
+__global__ void _scaleTensorScalar(ElemType beta, ElemType* p)
+{
+    *p = beta != 0 ? beta * *p : 0; // (beta = 0 overwrites, even NaN)
+}
+
+template <class ElemType, C_size_t N>
+static void LaunchTensorOpFullReduction(ElemType beta, const array<ElemType*, N>& pointerVector, ElemType alpha, ElementWiseOperator op,
+                                        size_t reducingOpDim, const array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    FixedArray<ElemType*, N> pointers(pointerVector);
+    array<ptrdiff_t, N> strideVector;
+    for (C_size_t i = 0; i < N; i++)
+        strideVector[i] = reducingStrides[i][0];
+    FixedArray<C_int, N> strides(strideVector);
+    CUDA_LONG NN = (CUDA_LONG) reducingOpDim;
+
+    let& props = GridDim::GetDeviceProps();
+    let numThreads = min(CeilDiv(NN, props.warpSize) * props.warpSize, GridDim::maxThreadsPerBlock);
+    let numBlocks = min(CeilDiv(NN, numThreads), (CUDA_LONG) props.multiProcessorCount * 4); // (each thread loops over several elements)
+    cudaEvent_t done = nullptr;
+    if (do_sync)
+        CUDA_CALL(cudaEventCreate(&done));
+    if (numBlocks > 1 && beta != 1)
+        _scaleTensorScalar<ElemType><<<1, 1, 0, t_stream>>>(beta, pointerVector[N - 1]);
+    _launchTensorOpFullReduction<ElemType, N><<<numBlocks, numThreads, 0, t_stream>>>(beta, pointers, alpha, op, strides, NN);
+    if (do_sync)
+        CUDA_CALL(cudaEventRecord(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventSynchronize(done));
+    if (do_sync)
+        CUDA_CALL(cudaEventDestroy(done));
+}
+
 // -----------------------------------------------------------------------
 // map runtime parameters N to template parameters
 // -----------------------------------------------------------------------
@@ -729,6 +1015,19 @@ void TensorOpN(ElemType beta, array<ElemType*, N> pointers, ElemType alpha, Elem
 {
     for (C_size_t i = 0; i < N; i++) // N = a small constant, this will be unrolled
         pointers[i] += offsets[i];
+
+    // special cases, see the specialized kernels above
+    bool allContiguous = regularOpDims.size() == 1;
+    for (C_size_t i = 0; i < N && allContiguous; i++)
+        allContiguous = regularStrides[i][0] == 1;
+    if (allContiguous && reducingOpDims.size() == 0)
+        return LaunchLinearTensorOp<ElemType, N>(beta, pointers, alpha, op, regularOpDims[0]);
+    else if (regularOpDims.size() == 2 && regularStrides[N - 1][0] == 1 && reducingOpDims.size() == 0 &&
+             regularOpDims[0] >= 32 && regularOpDims[1] > 0) // (for fewer rows, most threads of a warp would idle)
+        return LaunchTensorOp2D<ElemType, N>(beta, pointers, alpha, op, regularOpDims, regularStrides);
+    else if (regularOpDims.size() == 0 && reducingOpDims.size() == 1 && reducingOpDims[0] > 0)
+        return LaunchTensorOpFullReduction<ElemType, N>(beta, pointers, alpha, op, reducingOpDims[0], reducingStrides);
+
     size_t dims = regularOpDims.size();
     switch (dims)
     {
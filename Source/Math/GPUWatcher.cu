@@ -9,8 +9,13 @@
 #ifndef CPUONLY
 
 #include "GPUWatcher.h"
+#include "NumaPlacement.h"
 #include <cuda.h>
 #include <cuda_runtime.h>
+#include <nvml.h>                // see BestGpu.cpp for where to get it
+#pragma comment(lib, "nvml.lib") // (delay-loaded)
+#include <algorithm>
+#include <chrono>
 
 int GPUWatcher::GetGPUIdWithTheMostFreeMemory()
 {
@@ -53,12 +58,162 @@ size_t GPUWatcher::GetFreeMemoryOnCUDADevice(int devId)
         return free;
 }
 
+int GPUWatcher::GetNumaNodeOfCUDADevice(int devId)
+{
+    char busId[32];
+    if (cudaDeviceGetPCIBusId(busId, (int) sizeof(busId), devId) != cudaSuccess)
+        return Microsoft::MSR::CNTK::NoNumaNode;
+    return Microsoft::MSR::CNTK::GetNumaNodeOfPciDevice(busId);
+}
+
+// NVML handle of a CUDA device; found by PCI bus id, since NVML may enumerate the devices in a different order
+// Returns false if NVML is not available, in which case we just go without utilization figures.
+static bool GetNvmlDevice(int devId, nvmlDevice_t& device)
+{
+    static const bool nvmlInitialized = (nvmlInit() == NVML_SUCCESS); // (thread-safe; never shut down, as the watcher may outlive main())
+    char busId[32];
+    return nvmlInitialized &&
+           cudaDeviceGetPCIBusId(busId, (int) sizeof(busId), devId) == cudaSuccess &&
+           nvmlDeviceGetHandleByPciBusId(busId, &device) == NVML_SUCCESS;
+}
+
+GPUDeviceSample GPUWatcher::Sample(int devId)
+{
+    GPUDeviceSample sample;
+    sample.m_deviceId = devId;
+    if (cudaSetDevice(devId) != cudaSuccess || cudaMemGetInfo(&sample.m_freeBytes, &sample.m_totalBytes) != cudaSuccess)
+    {
+        cudaGetLastError(); // clear the error state
+        return sample;
+    }
+    sample.m_peakUsedBytes = sample.UsedBytes();
+    sample.m_cache = Microsoft::MSR::CNTK::TracingGPUMemoryAllocator::GetCacheStatistics(devId);
+
+    nvmlDevice_t device;
+    if (GetNvmlDevice(devId, device))
+    {
+        nvmlUtilization_t utilization;
+        if (nvmlDeviceGetUtilizationRates(device, &utilization) == NVML_SUCCESS)
+            sample.m_smUtilization = (int) utilization.gpu;
+        unsigned int kbPerSecond;
+        if (nvmlDeviceGetPcieThroughput(device, NVML_PCIE_UTIL_TX_BYTES, &kbPerSecond) == NVML_SUCCESS)
+            sample.m_pcieTxKBPerSecond = (int) kbPerSecond;
+        if (nvmlDeviceGetPcieThroughput(device, NVML_PCIE_UTIL_RX_BYTES, &kbPerSecond) == NVML_SUCCESS)
+            sample.m_pcieRxKBPerSecond = (int) kbPerSecond;
+    }
+    return sample;
+}
+
+void GPUWatcher::PrintSample(FILE* f, const GPUDeviceSample& sample)
+{
+    fprintf(f, "GPU DeviceId = %d: %d MB of %d MB in use (peak %d MB), of which %d MB by CNTK and %d MB cached",
+            sample.m_deviceId, (int) (sample.UsedBytes() >> 20), (int) (sample.m_totalBytes >> 20), (int) (sample.m_peakUsedBytes >> 20),
+            (int) (sample.m_cache.m_allocatedBytes >> 20), (int) (sample.m_cache.m_cachedBytes >> 20));
+    if (sample.m_smUtilization >= 0)
+        fprintf(f, "; SM utilization = %d%%, PCIe = %.1f MB/s out, %.1f MB/s in",
+                sample.m_smUtilization, sample.m_pcieTxKBPerSecond / 1024.0, sample.m_pcieRxKBPerSecond / 1024.0);
+    fprintf(f, "\n");
+}
+
 GPUWatcher::GPUWatcher(void)
+    : m_deviceId(-1), m_intervalSeconds(0), m_warnFreeBytes(0), m_stopRequested(false), m_warned(false),
+      m_numSamples(0), m_numUtilizationSamples(0), m_smUtilizationSum(0), m_pcieTxSum(0), m_pcieRxSum(0)
 {
 }
 
 GPUWatcher::~GPUWatcher(void)
 {
+    Stop();
+}
+
+void GPUWatcher::Start(int devId, double intervalSeconds, size_t warnFreeMB)
+{
+    if (IsRunning())
+        LogicError("GPUWatcher::Start: already started.");
+    if (devId < 0 || intervalSeconds <= 0)
+        InvalidArgument("GPUWatcher::Start: needs a GPU and a positive sampling interval.");
+    m_deviceId = devId;
+    m_intervalSeconds = intervalSeconds;
+    m_warnFreeBytes = warnFreeMB << 20;
+    m_stopRequested = false;
+    m_warned = false;
+    m_sample = GPUDeviceSample();
+    m_numSamples = m_numUtilizationSamples = 0;
+    m_smUtilizationSum = m_pcieTxSum = m_pcieRxSum = 0;
+    TakeSample(); // (so that there is a sample before the first interval has passed)
+    m_thread = std::thread([this]() { SamplingLoop(); });
+}
+
+void GPUWatcher::Stop()
+{
+    if (!IsRunning())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_stopCondition.notify_one();
+    m_thread.join();
+}
+
+void GPUWatcher::SamplingLoop()
+{
+    const auto interval = std::chrono::duration<double>(m_intervalSeconds);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopCondition.wait_for(lock, interval, [this]() { return m_stopRequested; }))
+    {
+        lock.unlock();
+        TakeSample();
+        lock.lock();
+    }
+}
+
+void GPUWatcher::TakeSample()
+{
+    const GPUDeviceSample sample = Sample(m_deviceId);
+    if (sample.m_totalBytes == 0) // (the query failed; try again next time)
+        return;
+
+    bool warn;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const size_t peakUsedBytes = std::max(sample.m_peakUsedBytes, m_numSamples > 0 ? m_sample.m_peakUsedBytes : 0);
+        m_sample = sample;
+        m_sample.m_peakUsedBytes = peakUsedBytes;
+        m_numSamples++;
+        if (sample.m_smUtilization >= 0)
+        {
+            m_numUtilizationSamples++;
+            m_smUtilizationSum += sample.m_smUtilization;
+            m_pcieTxSum += std::max(sample.m_pcieTxKBPerSecond, 0);
+            m_pcieRxSum += std::max(sample.m_pcieRxKBPerSecond, 0);
+        }
+        warn = sample.m_freeBytes < m_warnFreeBytes && !m_warned;
+        m_warned = sample.m_freeBytes < m_warnFreeBytes;
+    }
+    if (warn)
+        fprintf(stderr, "WARNING: GPUWatcher: only %d MB of %d MB left free on DeviceId = %d (%d MB in use and %d MB cached by CNTK, fragmentation = %.2f%%). "
+                        "Allocations of new sizes may run out of memory; consider smaller minibatches.\n",
+                (int) (sample.m_freeBytes >> 20), (int) (sample.m_totalBytes >> 20), sample.m_deviceId,
+                (int) (sample.m_cache.m_allocatedBytes >> 20), (int) (sample.m_cache.m_cachedBytes >> 20), 100.0 * sample.m_cache.Fragmentation());
+}
+
+GPUDeviceSample GPUWatcher::GetSampleAndReset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    GPUDeviceSample sample = m_sample;
+    if (m_numUtilizationSamples > 0)
+    {
+        sample.m_smUtilization = (int) (m_smUtilizationSum / m_numUtilizationSamples + 0.5);
+        sample.m_pcieTxKBPerSecond = (int) (m_pcieTxSum / m_numUtilizationSamples + 0.5);
+        sample.m_pcieRxKBPerSecond = (int) (m_pcieRxSum / m_numUtilizationSamples + 0.5);
+    }
+    // the peak of the next period starts from where we are now
+    m_sample.m_peakUsedBytes = m_sample.UsedBytes();
+    m_numSamples = m_numSamples > 0 ? 1 : 0;
+    m_numUtilizationSamples = 0;
+    m_smUtilizationSum = m_pcieTxSum = m_pcieRxSum = 0;
+    return sample;
 }
 
 #endif // CPUONLY
@@ -6,12 +6,66 @@
 #pragma once
 
 #include "GPUMatrix.h"
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// the state of a GPU, as sampled by GPUWatcher
+// The utilization and PCIe figures come from NVML and are -1 where it is not available.
+struct GPUDeviceSample
+{
+    int m_deviceId;
+    size_t m_totalBytes;    // device memory, as CUDA reports it
+    size_t m_freeBytes;
+    size_t m_peakUsedBytes; // high-water mark of m_totalBytes - m_freeBytes over the samples since the last reset
+    Microsoft::MSR::CNTK::GPUMemoryCacheStatistics m_cache; // of TracingGPUMemoryAllocator, which all matrices (incl. the MatrixPool's) come from
+    int m_smUtilization;     // percent of the time a kernel was running, averaged over the samples since the last reset
+    int m_pcieTxKBPerSecond; // PCIe throughput from and to the device, averaged likewise
+    int m_pcieRxKBPerSecond;
+
+    GPUDeviceSample()
+        : m_deviceId(-1), m_totalBytes(0), m_freeBytes(0), m_peakUsedBytes(0), m_smUtilization(-1), m_pcieTxKBPerSecond(-1), m_pcieRxKBPerSecond(-1)
+    {
+    }
+    size_t UsedBytes() const { return m_totalBytes - m_freeBytes; }
+};
 
 class MATH_API GPUWatcher
 {
 public:
     static size_t GetFreeMemoryOnCUDADevice(int devId);
     static int GetGPUIdWithTheMostFreeMemory();
+    static int GetNumaNodeOfCUDADevice(int devId); // NUMA node of the PCIe root complex the GPU hangs off; -1 if unknown
+    static GPUDeviceSample Sample(int devId);      // query the state of a device right now
+    static void PrintSample(FILE* f, const GPUDeviceSample& sample); // one line, for the log
+
+    // Background sampling of one device every 'intervalSeconds', until Stop() or destruction.
+    // It warns when the free device memory drops below 'warnFreeMB': memory the cache holds for other
+    // sizes is only given back once cudaMalloc() fails, so a new size (e.g. a longer minibatch) may then run out of memory.
     GPUWatcher(void);
     ~GPUWatcher(void);
+    void Start(int devId, double intervalSeconds, size_t warnFreeMB);
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable(); }
+    // the last sample, with the peak and averages over the samples since the previous call
+    GPUDeviceSample GetSampleAndReset();
+
+private:
+    void SamplingLoop();
+    void TakeSample();
+
+    int m_deviceId;
+    double m_intervalSeconds;
+    size_t m_warnFreeBytes;
+
+    std::thread m_thread;
+    std::mutex m_mutex; // for all below
+    std::condition_variable m_stopCondition;
+    bool m_stopRequested;
+    bool m_warned; // (once per dip below m_warnFreeBytes)
+    GPUDeviceSample m_sample;
+    size_t m_numSamples; // since the last reset, and the sums to average over them
+    size_t m_numUtilizationSamples;
+    double m_smUtilizationSum, m_pcieTxSum, m_pcieRxSum;
 };
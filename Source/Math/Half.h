@@ -0,0 +1,202 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// Half.h -- IEEE 754 half-precision (FP16) storage type, and matrix serialization in FP16 or 8 bits
+//
+// Computation is always done in float or double. 'half' is only a storage format, used to
+// halve the size of model files. Conversions round to nearest even and preserve Inf and NaN;
+// values beyond the FP16 range (65504) become Inf, and tiny values become denormals or zero.
+// The 8-bit format quarters the size: each row m is stored as round(M(m,n) / scale[m]) with
+// scale[m] = max_n |M(m,n)| / 127 (like Int8QuantizedMatrix, so quantizing a loaded matrix for
+// int8 inference reproduces the stored values). Column vectors, e.g. biases, thus stay exact.
+//
+#pragma once
+
+#include "File.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+struct half
+{
+    uint16_t bits;
+
+    half() : bits(0) {}
+    explicit half(float f) : bits(FromFloat(f)) {}
+    explicit operator float() const { return ToFloat(bits); }
+
+    static uint16_t FromFloat(float f)
+    {
+        uint32_t x;
+        memcpy(&x, &f, sizeof(x));
+        const uint32_t sign = (x >> 16) & 0x8000;
+        const uint32_t absx = x & 0x7fffffff;
+        if (absx >= 0x7f800000) // Inf or NaN (keep NaNs quiet)
+            return (uint16_t)(sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0));
+        if (absx >= 0x477ff000) // rounds to a value beyond 65504
+            return (uint16_t)(sign | 0x7c00);
+        if (absx < 0x38800000) // below the smallest normalized half: denormal or zero
+        {
+            if (absx < 0x33000000) // less than half of the smallest denormal
+                return (uint16_t) sign;
+            const uint32_t shift = 125 - (absx >> 23) + 1; // shift in [14, 24]
+            const uint32_t mantissa = (absx & 0x007fffff) | 0x00800000;
+            uint32_t result = mantissa >> shift;
+            const uint32_t remainder = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (result & 1)))
+                result++;
+            return (uint16_t)(sign | result);
+        }
+        // normalized: rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+        uint32_t result = (absx - 0x38000000) >> 13;
+        const uint32_t remainder = absx & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+            result++; // (may carry into the exponent, which is correct)
+        return (uint16_t)(sign | result);
+    }
+
+    static float ToFloat(uint16_t h)
+    {
+        const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t x;
+        if (exponent == 0x1f) // Inf or NaN
+            x = sign | 0x7f800000 | (mantissa << 13);
+        else if (exponent != 0)
+            x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        else if (mantissa == 0)
+            x = sign;
+        else // denormal: normalize it
+        {
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+        float f;
+        memcpy(&f, &x, sizeof(f));
+        return f;
+    }
+};
+
+// -----------------------------------------------------------------------
+// element serialization for CPUMatrix and GPUMatrix
+// The element size is stored in the file, so the reader can tell whether a matrix was saved as FP16 or 8 bits.
+// -----------------------------------------------------------------------
+
+// element size to write for a matrix of ElemType, considering fileOptionsQuantized8Bit and fileOptionsHalfPrecision
+template <class ElemType>
+static inline size_t GetSerializedElementSize(const File& stream)
+{
+    return stream.IsQuantized8Bit() ? sizeof(int8_t) : stream.IsHalfPrecision() ? sizeof(half) : sizeof(ElemType);
+}
+
+// whether elements of this size can be read into a matrix of ElemType
+template <class ElemType>
+static inline bool IsSerializedElementSize(size_t elemSize)
+{
+    return elemSize == sizeof(ElemType) || elemSize == sizeof(half) || elemSize == sizeof(int8_t);
+}
+
+// FP16 values are converted through a buffer of this many elements, so that they, too, are written and read in bulk
+static const size_t halfConversionChunkSize = 1 << 16;
+
+// the per-row scales of the 8-bit format
+template <class ElemType>
+static inline std::vector<float> GetQuantizationScales(const ElemType* pArray, size_t numRows, size_t numCols)
+{
+    std::vector<float> scales(numRows, 0.0f);
+    for (size_t n = 0; n < numCols; n++)
+        for (size_t m = 0; m < numRows; m++)
+            scales[m] = std::max(scales[m], (float) fabs(pArray[m + n * numRows]));
+    for (auto& scale : scales)
+        scale /= 127;
+    return scales;
+}
+
+// write the column-major numRows x numCols elements with element size 'elemSize' (see GetSerializedElementSize())
+template <class ElemType>
+static inline void WriteMatrixElements(File& stream, const ElemType* pArray, size_t numRows, size_t numCols, size_t elemSize)
+{
+    const size_t numElements = numRows * numCols;
+    if (elemSize == sizeof(int8_t))
+    {
+        const std::vector<float> scales = GetQuantizationScales(pArray, numRows, numCols);
+        stream.WriteArray(scales.data(), numRows);
+        std::vector<int8_t> values(std::min(numElements, halfConversionChunkSize));
+        for (size_t begin = 0; begin < numElements; begin += values.size())
+        {
+            size_t n = std::min(values.size(), numElements - begin);
+            for (size_t i = 0; i < n; ++i)
+            {
+                const float scale = scales[(begin + i) % numRows];
+                values[i] = scale > 0 ? (int8_t) std::max(-127.0f, std::min(127.0f, roundf((float) pArray[begin + i] / scale))) : 0;
+            }
+            stream.WriteArray(values.data(), n);
+        }
+    }
+    else if (elemSize == sizeof(half))
+    {
+        std::vector<uint16_t> bits(std::min(numElements, halfConversionChunkSize));
+        for (size_t begin = 0; begin < numElements; begin += bits.size())
+        {
+            size_t n = std::min(bits.size(), numElements - begin);
+            for (size_t i = 0; i < n; ++i)
+                bits[i] = half((float) pArray[begin + i]).bits;
+            stream.WriteArray(bits.data(), n);
+        }
+    }
+    else
+        stream.WriteArray(pArray, numElements);
+}
+
+// read elements that were saved with element size 'elemSize', which must be ElemType, FP16 or 8 bits
+template <class ElemType>
+static inline void ReadMatrixElements(File& stream, ElemType* pArray, size_t numRows, size_t numCols, size_t elemSize)
+{
+    const size_t numElements = numRows * numCols;
+    if (elemSize == sizeof(ElemType))
+        stream.ReadArray(pArray, numElements);
+    else if (elemSize == sizeof(int8_t))
+    {
+        std::vector<float> scales(numRows);
+        stream.ReadArray(scales.data(), numRows);
+        std::vector<int8_t> values(std::min(numElements, halfConversionChunkSize));
+        for (size_t begin = 0; begin < numElements; begin += values.size())
+        {
+            size_t n = std::min(values.size(), numElements - begin);
+            stream.ReadArray(values.data(), n);
+            for (size_t i = 0; i < n; ++i)
+                pArray[begin + i] = (ElemType)(values[i] * scales[(begin + i) % numRows]);
+        }
+    }
+    else if (elemSize == sizeof(half))
+    {
+        std::vector<uint16_t> bits(std::min(numElements, halfConversionChunkSize));
+        half h;
+        for (size_t begin = 0; begin < numElements; begin += bits.size())
+        {
+            size_t n = std::min(bits.size(), numElements - begin);
+            stream.ReadArray(bits.data(), n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                h.bits = bits[i];
+                pArray[begin + i] = (ElemType)(float) h;
+            }
+        }
+    }
+    else
+        RuntimeError("Template argument size doesn't match those in file");
+}
+
+} } }
@@ -0,0 +1,117 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// Int8QuantizedMatrix.cpp -- int8 copy of a weight matrix for quantized inference on the CPU
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "Int8QuantizedMatrix.h"
+#include "CPUVectorKernels.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// this limits the int32 accumulators in CPUVectorKernels::Int8DotProducts()
+static const size_t Int8MaxInnerDimension = 1 << 17;
+
+template <class ElemType>
+Int8QuantizedMatrix<ElemType>::Int8QuantizedMatrix(const Matrix<ElemType>& weights)
+    : m_numRows(weights.GetNumRows()), m_numCols(weights.GetNumCols())
+{
+    if (weights.GetMatrixType() != DENSE || weights.GetDeviceId() != CPUDEVICE)
+        InvalidArgument("Int8QuantizedMatrix: Only dense matrices on the CPU can be quantized.");
+    if (m_numCols >= Int8MaxInnerDimension)
+        InvalidArgument("Int8QuantizedMatrix: Matrix has too many columns (%d) for int8 accumulation.", (int) m_numCols);
+
+    m_values.resize(m_numRows * m_numCols);
+    m_scales.resize(m_numRows);
+    const ElemType* pWeights = weights.BufferPointer(); // column-major, so rows have stride m_numRows
+#pragma omp parallel for
+    for (long m = 0; m < (long) m_numRows; m++)
+        m_scales[m] = QuantizeVector(pWeights + m, m_numCols, m_numRows, m_values.data() + m * m_numCols);
+}
+
+template <class ElemType>
+/*static*/ float Int8QuantizedMatrix<ElemType>::QuantizeVector(const ElemType* values, size_t n, size_t stride, int8_t* quantized)
+{
+    ElemType maxAbs = 0;
+    for (size_t i = 0; i < n; i++)
+        maxAbs = std::max(maxAbs, (ElemType) fabs(values[i * stride]));
+    if (maxAbs == 0)
+    {
+        memset(quantized, 0, n);
+        return 0;
+    }
+    const ElemType invScale = 127 / maxAbs;
+    for (size_t i = 0; i < n; i++)
+    {
+        int q = (int) floor(values[i * stride] * invScale + (ElemType) 0.5);
+        quantized[i] = (int8_t) std::max(-127, std::min(127, q));
+    }
+    return (float) (maxAbs / 127);
+}
+
+template <class ElemType>
+void Int8QuantizedMatrix<ElemType>::Multiply(const Matrix<ElemType>& X, Matrix<ElemType>& C) const
+{
+    if (X.GetMatrixType() != DENSE || X.GetDeviceId() != CPUDEVICE || C.GetMatrixType() != DENSE || C.GetDeviceId() != CPUDEVICE)
+        InvalidArgument("Int8QuantizedMatrix::Multiply: Only dense matrices on the CPU are supported.");
+    const size_t M = m_numRows;
+    const size_t K = m_numCols;
+    const size_t N = X.GetNumCols();
+    if (X.GetNumRows() != K || C.GetNumRows() != M || C.GetNumCols() != N)
+        LogicError("Int8QuantizedMatrix::Multiply: Dimension mismatch ([%d x %d] * [%d x %d] -> [%d x %d]).",
+                   (int) M, (int) K, (int) X.GetNumRows(), (int) N, (int) C.GetNumRows(), (int) C.GetNumCols());
+    if (M == 0 || N == 0)
+        return;
+
+    // quantize the activations, one scale per column since their dynamic range varies from frame to frame
+    const ElemType* pX = X.BufferPointer();
+    std::vector<int8_t> xValues(K * N);
+    std::vector<float> xScales(N);
+#pragma omp parallel for
+    for (long n = 0; n < (long) N; n++)
+        xScales[n] = QuantizeVector(pX + n * K, K, 1, xValues.data() + n * K);
+
+    // loop over blocks of rows, such that a block of weights stays in cache while we loop over all columns
+    const size_t blockRows = 64; // 64 rows * 1024 columns = 64 KB
+    const bool useVectorKernels = CPUVectorKernels::IsAvailable();
+    ElemType* pC = C.BufferPointer();
+    long numBlocks = (long) ((M + blockRows - 1) / blockRows);
+#pragma omp parallel for
+    for (long b = 0; b < numBlocks; b++)
+    {
+        const size_t m0 = b * blockRows;
+        const size_t rows = std::min(blockRows, M - m0);
+        const int8_t* wValues = m_values.data() + m0 * K;
+        int32_t dots[blockRows];
+        for (size_t n = 0; n < N; n++)
+        {
+            const int8_t* xColumn = xValues.data() + n * K;
+            if (useVectorKernels)
+                CPUVectorKernels::Int8DotProducts(wValues, K, rows, xColumn, K, dots);
+            else
+            {
+                for (size_t i = 0; i < rows; i++)
+                {
+                    int32_t sum = 0;
+                    for (size_t k = 0; k < K; k++)
+                        sum += wValues[i * K + k] * xColumn[k];
+                    dots[i] = sum;
+                }
+            }
+            ElemType* cColumn = pC + n * M + m0;
+            for (size_t i = 0; i < rows; i++)
+                cColumn[i] = (ElemType) (dots[i] * (m_scales[m0 + i] * xScales[n]));
+        }
+    }
+}
+
+template class Int8QuantizedMatrix<float>;
+template class Int8QuantizedMatrix<double>;
+
+} } }
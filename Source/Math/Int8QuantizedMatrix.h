@@ -0,0 +1,57 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// Int8QuantizedMatrix.h -- int8 copy of a weight matrix for quantized inference on the CPU
+//
+#pragma once
+
+#include "Matrix.h"
+#include <vector>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef MATH_EXPORTS
+#define MATH_API __declspec(dllexport)
+#else
+#define MATH_API __declspec(dllimport)
+#endif
+#else // no DLLs on Linux
+#define MATH_API
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// Int8QuantizedMatrix -- a dense matrix quantized to int8 per row, for computing W * X in inference
+// Each row m is stored as round(W(m,k) / scale[m]) with scale[m] = max_k |W(m,k)| / 127.
+// Multiply() quantizes each column of X the same way, on the fly, computes the products
+// with exact int32 accumulation, and scales the result back to ElemType.
+// The quantization is symmetric (no zero points), so the rounding error is at most half a step per factor.
+// Rows are stored contiguously, so that each output element is a dot product of two contiguous int8 vectors.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class MATH_API Int8QuantizedMatrix
+{
+public:
+    // quantize a dense CPU matrix
+    Int8QuantizedMatrix(const Matrix<ElemType>& weights);
+
+    size_t GetNumRows() const { return m_numRows; }
+    size_t GetNumCols() const { return m_numCols; }
+
+    // C = W * X, where X and C are dense CPU matrices (or column slices); C must have the right dimensions already
+    void Multiply(const Matrix<ElemType>& X, Matrix<ElemType>& C) const;
+
+private:
+    // quantize n values with a common scale; returns the scale
+    static float QuantizeVector(const ElemType* values, size_t n, size_t stride, int8_t* quantized);
+
+    size_t m_numRows;
+    size_t m_numCols;
+    std::vector<int8_t> m_values; // [m_numRows x m_numCols], row-major
+    std::vector<float> m_scales;  // [m_numRows]
+};
+
+} } }
@@ -14,6 +14,7 @@
 #include "File.h"
 #include <assert.h>
 #include <math.h>
+#include <set>
 #include "GPUWatcher.h" // bring in this class as well so that it gets exported from this DLL
 #ifndef CPUONLY
 #pragma comment(lib, "MathCUDA.lib") // built by CNTKMathCUDA project
@@ -67,6 +68,19 @@
         }                                                                                                               \
     }
 
+// fast path of DISPATCH_MATRIX_ON_FLAG for operations on matrices that AreDenseOnSameDevice(); their location and type stay as they are
+#define DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(MatrixPointerToCheck, CPUDense, GPUDense)               \
+    {                                                                                               \
+        if ((MatrixPointerToCheck)->GetCurrentMatrixLocation() == CurrentDataLocation::CPU)         \
+        {                                                                                           \
+            CPUDense;                                                                               \
+        }                                                                                           \
+        else                                                                                        \
+        {                                                                                           \
+            GPUDense;                                                                               \
+        }                                                                                           \
+    }
+
 //before calling the following macro the current matrix location and matrix type on MatrixPointerToCheck must have been set correctly
 #define DISPATCH_MATRIX_ON_FLAG_USECPU_4BOTH(MatrixPointerToCheck, MatrixPointerToSetFlag, CPUDense, GPUDense, CPUSparse, GPUSparse) \
     {                                                                                                                                \
@@ -171,6 +185,18 @@
 // After selecting a device id, always run the result through this function, which will cache the first choice.
 // TODO: This is a stop-gap. It will be cleaned up once we also fix the GPU late-locking bug.
 //       The correct fix is to always route GPU selection through a single function in the first place.
+// The GPUs that SGD places model replicas on are exempt, see AllowAdditionalGPU(); those are chosen explicitly, not by device selection.
+static std::set<DEVICEID_TYPE>& AdditionalGPUIds()
+{
+    static std::set<DEVICEID_TYPE> additionalGPUIds;
+    return additionalGPUIds;
+}
+
+void AllowAdditionalGPU(DEVICEID_TYPE deviceId)
+{
+    AdditionalGPUIds().insert(deviceId);
+}
+
 DEVICEID_TYPE EnforceOneGPUOnly(DEVICEID_TYPE requestedDeviceId)
 {
     if (requestedDeviceId < 0) // only apply this to GPU ids
@@ -178,6 +204,8 @@ DEVICEID_TYPE EnforceOneGPUOnly(DEVICEID_TYPE requestedDeviceId)
     static DEVICEID_TYPE theGPUId = DEVICEID_NOTYETDETERMINED;
     if (theGPUId == DEVICEID_NOTYETDETERMINED)
         theGPUId = requestedDeviceId;
+    else if (AdditionalGPUIds().find(requestedDeviceId) != AdditionalGPUIds().end())
+        return requestedDeviceId;
     else if (theGPUId != requestedDeviceId)
     {
         static bool shown = false;
@@ -192,6 +220,50 @@ DEVICEID_TYPE EnforceOneGPUOnly(DEVICEID_TYPE requestedDeviceId)
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
+// free lists for AllocateMatrixObject(), one per 16-byte size class, per thread
+// A block freed by another thread than the one that allocated it simply joins the freeing thread's list.
+// The lists are bounded, and whatever they hold when a thread ends is not returned (a few KB at most).
+static const size_t matrixObjectSizeGranularity = 16;
+static const size_t matrixObjectNumSizeClasses = 32; // objects of up to 512 bytes are recycled
+static const size_t matrixObjectMaxFreeListLength = 1024;
+struct MatrixObjectFreeBlock
+{
+    MatrixObjectFreeBlock* next;
+};
+#ifdef _WIN32
+static __declspec(thread) MatrixObjectFreeBlock* t_matrixObjectFreeLists[matrixObjectNumSizeClasses];
+static __declspec(thread) size_t t_matrixObjectFreeListLengths[matrixObjectNumSizeClasses];
+#else
+static __thread MatrixObjectFreeBlock* t_matrixObjectFreeLists[matrixObjectNumSizeClasses];
+static __thread size_t t_matrixObjectFreeListLengths[matrixObjectNumSizeClasses];
+#endif
+
+void* AllocateMatrixObject(size_t size)
+{
+    size_t sizeClass = (size + matrixObjectSizeGranularity - 1) / matrixObjectSizeGranularity;
+    if (sizeClass >= matrixObjectNumSizeClasses)
+        return ::operator new(size);
+    MatrixObjectFreeBlock* block = t_matrixObjectFreeLists[sizeClass];
+    if (!block)
+        return ::operator new(sizeClass * matrixObjectSizeGranularity);
+    t_matrixObjectFreeLists[sizeClass] = block->next;
+    t_matrixObjectFreeListLengths[sizeClass]--;
+    return block;
+}
+
+void FreeMatrixObject(void* p, size_t size)
+{
+    if (!p)
+        return;
+    size_t sizeClass = (size + matrixObjectSizeGranularity - 1) / matrixObjectSizeGranularity;
+    if (sizeClass >= matrixObjectNumSizeClasses || t_matrixObjectFreeListLengths[sizeClass] >= matrixObjectMaxFreeListLength)
+        return ::operator delete(p);
+    MatrixObjectFreeBlock* block = (MatrixObjectFreeBlock*) p;
+    block->next = t_matrixObjectFreeLists[sizeClass];
+    t_matrixObjectFreeLists[sizeClass] = block;
+    t_matrixObjectFreeListLengths[sizeClass]++;
+}
+
 #pragma region Constructors, destructors and other static matrix builders
 
 //This function will only initialize default bland matrix. The actual matrices need to allocated
@@ -1157,6 +1229,26 @@ void Matrix<ElemType>::MaskColumnsValue(const Matrix<char>& columnsMask, ElemTyp
                             NOT_IMPLEMENTED);
 }
 
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::AssignAugmentedImagesOf(const Matrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const Matrix<ElemType>& mean)
+{
+    if (GetDeviceId() != images.GetDeviceId() || GetDeviceId() != mean.GetDeviceId())
+        RuntimeError("AssignAugmentedImagesOf: Images, mean and target must be on the same device.");
+    if (images.GetNumElements() < numImages * sizeof(ImageAugmentationDesc))
+        InvalidArgument("AssignAugmentedImagesOf: Image buffer is too small to hold %d image descriptors.", (int) numImages);
+    if (!mean.IsEmpty() && mean.GetNumElements() != width * height * channels)
+        InvalidArgument("AssignAugmentedImagesOf: Mean must have width x height x channels elements.");
+
+    SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            this,
+                            m_CPUMatrix->AssignAugmentedImagesOf(*images.m_CPUMatrix, numImages, width, height, channels, channelsFirst, *mean.m_CPUMatrix),
+                            m_GPUMatrix->AssignAugmentedImagesOf(*images.m_GPUMatrix, numImages, width, height, channels, channelsFirst, *mean.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+    return *this;
+}
+
 template <class ElemType>
 void Matrix<ElemType>::SetColumn(const ElemType* colPointer, size_t colInd)
 {
@@ -1202,6 +1294,14 @@ void Matrix<ElemType>::SetValue(const Matrix<ElemType>& deepCopyFrom, const Matr
         return;
 
     m_preferredDeviceId = deepCopyFrom.m_preferredDeviceId;
+    if (AreDenseOnSameDevice(deepCopyFrom, *this)) // fast path
+    {
+        DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(this,
+                                             m_CPUMatrix->SetValue(*deepCopyFrom.m_CPUMatrix),
+                                             m_GPUMatrix->SetValue(*deepCopyFrom.m_GPUMatrix));
+        return;
+    }
+
     DecideAndMoveToRightDevice(deepCopyFrom, *this);
     SwitchToMatrixType(deepCopyFrom.GetMatrixType(), format, false);
 
@@ -1213,6 +1313,21 @@ void Matrix<ElemType>::SetValue(const Matrix<ElemType>& deepCopyFrom, const Matr
                             m_GPUSparseMatrix->SetValue(*deepCopyFrom.m_GPUSparseMatrix));
 }
 
+template <class ElemType>
+void Matrix<ElemType>::SetValueFromOtherDevice(const Matrix<ElemType>& deepCopyFrom)
+{
+    if (GetDeviceId() == deepCopyFrom.GetDeviceId())
+        return SetValue(deepCopyFrom);
+    auto onGPU = [](const Matrix<ElemType>& m)
+    {
+        return m.GetMatrixType() == MatrixType::DENSE && (m.GetCurrentMatrixLocation() == CurrentDataLocation::GPU || m.GetCurrentMatrixLocation() == CurrentDataLocation::BOTH);
+    };
+    if (!onGPU(*this) || !onGPU(deepCopyFrom))
+        LogicError("SetValueFromOtherDevice: Only implemented for dense matrices that are both on GPUs.");
+    m_GPUMatrix->SetValueFromOtherDevice(*deepCopyFrom.m_GPUMatrix);
+    SetDataLocation(CurrentDataLocation::GPU, MatrixType::DENSE);
+}
+
 template <class ElemType>
 void Matrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, int deviceId, ElemType* pArray, const size_t matrixFlags)
 {
@@ -1251,6 +1366,53 @@ void Matrix<ElemType>::SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYPE* h_CSCC
                             m_GPUSparseMatrix->SetMatrixFromCSCFormat(h_CSCCol, h_Row, h_Val, nz, numRows, numCols));
 }
 
+template <class ElemType>
+void Matrix<ElemType>::SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols)
+{
+    if (nz > numNZReserved)
+        InvalidArgument("SetMatrixFromCSCBuffer: nz exceeds the number of reserved elements.");
+
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            this,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            m_CPUSparseMatrix->SetMatrixFromCSCBuffer(h_buffer, numNZReserved, nz, numRows, numCols),
+                            m_GPUSparseMatrix->SetMatrixFromCSCBuffer(h_buffer, numNZReserved, nz, numRows, numCols));
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GetCSCFormat(std::vector<CPUSPARSE_INDEX_TYPE>& colStarts, std::vector<CPUSPARSE_INDEX_TYPE>& rows, std::vector<ElemType>& values) const
+{
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            nullptr,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            m_CPUSparseMatrix->GetCSCFormat(colStarts, rows, values),
+                            Matrix<ElemType>(*this, CPUDEVICE).GetCSCFormat(colStarts, rows, values));
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const
+{
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            nullptr,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            m_CPUSparseMatrix->GetBlockColumns(columnIds, values),
+                            m_GPUSparseMatrix->GetBlockColumns(columnIds, values));
+}
+
+template <class ElemType>
+void Matrix<ElemType>::SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values)
+{
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            this,
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED,
+                            m_CPUSparseMatrix->SetMatrixFromBlockColumns(columnIds, values),
+                            m_GPUSparseMatrix->SetMatrixFromBlockColumns(columnIds, values));
+}
+
 template <class ElemType>
 void Matrix<ElemType>::SetDiagonalValue(const ElemType v)
 {
@@ -1473,6 +1635,33 @@ void Matrix<ElemType>::FSAdagrad(size_t mbSize, Matrix<ElemType>& gradients, Mat
                             NOT_IMPLEMENTED);
 }
 
+template <class ElemType>
+void Matrix<ElemType>::Adam(Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRate, const ElemType beta1, const ElemType beta2,
+                            const ElemType epsilon, const ElemType weightDecay, const bool layerwiseAdaptive)
+{
+    DISPATCH_MATRIX_ON_FLAG(&gradients,
+                            &gradients,
+                            m_CPUMatrix->Adam(*gradients.m_CPUMatrix, *functionValues.m_CPUMatrix, learnRate, beta1, beta2, epsilon, weightDecay, layerwiseAdaptive);
+                            SetDataLocation(CPU),
+                            m_GPUMatrix->Adam(*gradients.m_GPUMatrix, *functionValues.m_GPUMatrix, learnRate, beta1, beta2, epsilon, weightDecay, layerwiseAdaptive);
+                            SetDataLocation(GPU),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::Lars(Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRate, const ElemType momentum, const ElemType trustCoefficient)
+{
+    DISPATCH_MATRIX_ON_FLAG(&gradients,
+                            &gradients,
+                            m_CPUMatrix->Lars(*gradients.m_CPUMatrix, *functionValues.m_CPUMatrix, learnRate, momentum, trustCoefficient);
+                            SetDataLocation(CPU),
+                            m_GPUMatrix->Lars(*gradients.m_GPUMatrix, *functionValues.m_GPUMatrix, learnRate, momentum, trustCoefficient);
+                            SetDataLocation(GPU),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 template <class ElemType>
 ElemType Matrix<ElemType>::RmsProp(Matrix<ElemType>& gradients,
                                    ElemType RMS_GAMMA,
@@ -1494,6 +1683,65 @@ ElemType Matrix<ElemType>::RmsProp(Matrix<ElemType>& gradients,
                             NOT_IMPLEMENTED);
 }
 
+// All matrices must be dense, on the same device, and the three lists parallel with equal sizes per entry.
+// Each entry is updated as SGD::UpdateWeightsS() would for the 'None' update type; see MultiTensorUpdateOp.
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::MultiTensorNormalGrad(const std::vector<Matrix<ElemType>*>& functionValues, const std::vector<Matrix<ElemType>*>& gradients,
+                                                      const std::vector<Matrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc, Matrix<ElemType>& workspace)
+{
+    if (functionValues.size() != gradients.size() || functionValues.size() != smoothedGradients.size())
+        InvalidArgument("MultiTensorNormalGrad: The parameter, gradient and smoothed gradient lists must have the same length.");
+    if (functionValues.empty())
+        return;
+
+    const DEVICEID_TYPE deviceId = functionValues[0]->GetDeviceId();
+    for (size_t t = 0; t < functionValues.size(); t++)
+    {
+        DecideAndMoveToRightDevice(*functionValues[t], *gradients[t], *smoothedGradients[t]);
+        if (functionValues[t]->GetDeviceId() != deviceId)
+            InvalidArgument("MultiTensorNormalGrad: All parameters must be on the same device.");
+        if (functionValues[t]->GetMatrixType() != MatrixType::DENSE || gradients[t]->GetMatrixType() != MatrixType::DENSE || smoothedGradients[t]->GetMatrixType() != MatrixType::DENSE)
+            NOT_IMPLEMENTED;
+        if (gradients[t]->GetNumElements() != functionValues[t]->GetNumElements() || smoothedGradients[t]->GetNumElements() != functionValues[t]->GetNumElements())
+            InvalidArgument("MultiTensorNormalGrad: The gradient and smoothed gradient must have the dimensions of their parameter.");
+    }
+
+    const CurrentDataLocation location = deviceId == CPUDEVICE ? CurrentDataLocation::CPU : CurrentDataLocation::GPU;
+    if (location == CurrentDataLocation::CPU)
+    {
+        std::vector<CPUMatrix<ElemType>*> w, g, v;
+        for (size_t t = 0; t < functionValues.size(); t++)
+        {
+            w.push_back(functionValues[t]->m_CPUMatrix);
+            g.push_back(gradients[t]->m_CPUMatrix);
+            v.push_back(smoothedGradients[t]->m_CPUMatrix);
+        }
+        CPUMatrix<ElemType>::MultiTensorNormalGrad(w, g, v, desc);
+    }
+    else
+    {
+        workspace.TransferToDeviceIfNotThere(deviceId, true);
+        workspace.SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+        std::vector<GPUMatrix<ElemType>*> w, g, v;
+        for (size_t t = 0; t < functionValues.size(); t++)
+        {
+            w.push_back(functionValues[t]->m_GPUMatrix);
+            g.push_back(gradients[t]->m_GPUMatrix);
+            v.push_back(smoothedGradients[t]->m_GPUMatrix);
+        }
+        GPUMatrix<ElemType>::MultiTensorNormalGrad(w, g, v, desc, *workspace.m_GPUMatrix);
+        workspace.SetDataLocation(location, MatrixType::DENSE);
+    }
+
+    // the updates were written to the device copies only
+    for (size_t t = 0; t < functionValues.size(); t++)
+    {
+        functionValues[t]->SetDataLocation(location, MatrixType::DENSE);
+        gradients[t]->SetDataLocation(location, MatrixType::DENSE);
+        smoothedGradients[t]->SetDataLocation(location, MatrixType::DENSE);
+    }
+}
+
 template <class ElemType>
 void Matrix<ElemType>::Reshape(const size_t numRows, const size_t numCols)
 {
@@ -1508,6 +1756,17 @@ void Matrix<ElemType>::Reshape(const size_t numRows, const size_t numCols)
     }
 }
 
+template <class ElemType>
+void Matrix<ElemType>::PlaceInHostMemory()
+{
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            this,
+                            {}, // (already there)
+                            m_GPUMatrix->PlaceInHostMemory(),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 // Note: Resize() will leave the matrix content undefined.
 template <class ElemType>
 void Matrix<ElemType>::Resize(const size_t numRows, const size_t numCols, const size_t numNZElemToReserve /*=0*/, bool growOnly /*=true*/)
@@ -2169,6 +2428,51 @@ Matrix<ElemType>& Matrix<ElemType>::AddElementProductOf(const Matrix<ElemType>&
     return *this;
 }
 
+//[this]=a .* mask / (1 - dropoutRate), where the mask is regenerated from seed and firstElementIndex
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::AssignDropoutOf(const Matrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex)
+{
+    if (a.IsEmpty())
+        LogicError("AssignDropoutOf: Matrix is empty.");
+
+    DecideAndMoveToRightDevice(a, *this);
+    SwitchToMatrixType(a.GetMatrixType(), a.GetFormat(), false);
+
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            this,
+                            m_CPUMatrix->AssignDropoutOf(*a.m_CPUMatrix, dropoutRate, seed, firstElementIndex, false),
+                            m_GPUMatrix->AssignDropoutOf(*a.m_GPUMatrix, dropoutRate, seed, firstElementIndex, false),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+
+    return *this;
+}
+
+//[this]+=a .* mask / (1 - dropoutRate), with the same mask as AssignDropoutOf() for the same seed and firstElementIndex
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::AddDropoutOf(const Matrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex)
+{
+    if (a.IsEmpty())
+        LogicError("AddDropoutOf: Matrix is empty.");
+
+    if (!(a.GetNumRows() == GetNumRows() && a.GetNumCols() == GetNumCols()))
+        InvalidArgument("AddDropoutOf: The input matrix dimensions do not match [this].");
+
+    DecideAndMoveToRightDevice(*this, a);
+
+    if (a.GetMatrixType() != GetMatrixType())
+        NOT_IMPLEMENTED;
+
+    DISPATCH_MATRIX_ON_FLAG(this,
+                            nullptr,
+                            m_CPUMatrix->AssignDropoutOf(*a.m_CPUMatrix, dropoutRate, seed, firstElementIndex, true),
+                            m_GPUMatrix->AssignDropoutOf(*a.m_GPUMatrix, dropoutRate, seed, firstElementIndex, true),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+
+    return *this;
+}
+
 //[this]=a ./ b
 template <class ElemType>
 Matrix<ElemType>& Matrix<ElemType>::AssignElementDivisionOf(const Matrix<ElemType>& a, const Matrix<ElemType>& b)
@@ -2299,6 +2603,46 @@ Matrix<ElemType>& Matrix<ElemType>::ColumnElementDivideBy(const Matrix<ElemType>
     return *this;
 }
 
+// this(:,j) = beta * this(:,j) + alpha * a(:,idx(j))
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::DoGatherColumnsOf(ElemType beta, const Matrix<ElemType>& idx, const Matrix<ElemType>& a, ElemType alpha)
+{
+    DecideAndMoveToRightDevice(*this, idx, a); // TODO: only move target if beta != 0
+
+    if (a.GetMatrixType() != DENSE || idx.GetMatrixType() != DENSE)
+        NOT_IMPLEMENTED;
+
+    SwitchToMatrixType(DENSE, matrixFormatDense, beta != 0);
+
+    DISPATCH_MATRIX_ON_FLAG(&a,
+                            this,
+                            m_CPUMatrix->DoGatherColumnsOf(beta, *idx.m_CPUMatrix, *a.m_CPUMatrix, alpha),
+                            m_GPUMatrix->DoGatherColumnsOf(beta, *idx.m_GPUMatrix, *a.m_GPUMatrix, alpha),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+
+    return *this;
+}
+
+// this = beta * this; this(:,idx(j)) += alpha * a(:,j)
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::DoScatterColumnsOf(ElemType beta, const Matrix<ElemType>& idx, const Matrix<ElemType>& a, ElemType alpha)
+{
+    DecideAndMoveToRightDevice(*this, idx, a);
+
+    if (a.GetMatrixType() != DENSE || idx.GetMatrixType() != DENSE || GetMatrixType() != DENSE)
+        NOT_IMPLEMENTED;
+
+    DISPATCH_MATRIX_ON_FLAG(&a,
+                            this,
+                            m_CPUMatrix->DoScatterColumnsOf(beta, *idx.m_CPUMatrix, *a.m_CPUMatrix, alpha),
+                            m_GPUMatrix->DoScatterColumnsOf(beta, *idx.m_GPUMatrix, *a.m_GPUMatrix, alpha),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+
+    return *this;
+}
+
 //[this]=1 ./ a
 template <class ElemType>
 Matrix<ElemType>& Matrix<ElemType>::ElementInverse()
@@ -2502,6 +2846,29 @@ Matrix<ElemType>& Matrix<ElemType>::AssignLogSoftmaxOf(const Matrix<ElemType>& a
     return *this;
 }
 
+template <class ElemType>
+Matrix<ElemType>& Matrix<ElemType>::AssignCrossEntropyWithSoftmaxOf(const Matrix<ElemType>& labels, const Matrix<ElemType>& logits, Matrix<ElemType>& logSumExp)
+{
+    if (logits.IsEmpty())
+        LogicError("AssignCrossEntropyWithSoftmaxOf: Matrix logits is empty.");
+    DecideAndMoveToRightDevice(logits, labels, *this);
+    logSumExp._transferToDevice(logits.GetDeviceId());
+
+    if (labels.GetMatrixType() != DENSE || logits.GetMatrixType() != DENSE)
+        NOT_IMPLEMENTED;
+    SwitchToMatrixType(DENSE, matrixFormatDense, false);
+    logSumExp.SwitchToMatrixType(DENSE, matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&logits,
+                            this,
+                            m_CPUMatrix->AssignCrossEntropyWithSoftmaxOf(*labels.m_CPUMatrix, *logits.m_CPUMatrix, *logSumExp.m_CPUMatrix),
+                            m_GPUMatrix->AssignCrossEntropyWithSoftmaxOf(*labels.m_GPUMatrix, *logits.m_GPUMatrix, *logSumExp.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+
+    return *this;
+}
+
 //[this]=softmax([this]) element wise
 template <class ElemType>
 Matrix<ElemType>& Matrix<ElemType>::InplaceHardmax(const bool isColWise)
@@ -3544,6 +3911,30 @@ void Matrix<ElemType>::DecideAndMoveToRightDevice(const Matrix<ElemType>& a, con
     d._transferToDevice(a.GetDeviceId()); // BUGBUG: Is this correct in case a,b,c share the same preferredDevice?
 }
 
+// (a location of BOTH does not qualify, since the operation would have to invalidate the other copy)
+template <class ElemType>
+/*static*/ bool Matrix<ElemType>::AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b)
+{
+    if (a.m_matrixType != MatrixType::DENSE || b.m_matrixType != MatrixType::DENSE || a.m_currentDataLocation != b.m_currentDataLocation)
+        return false;
+    else if (a.m_currentDataLocation == CurrentDataLocation::CPU)
+        return true;
+    else
+        return a.m_currentDataLocation == CurrentDataLocation::GPU && a.m_GPUMatrix->GetComputeDeviceId() == b.m_GPUMatrix->GetComputeDeviceId();
+}
+
+template <class ElemType>
+/*static*/ bool Matrix<ElemType>::AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c)
+{
+    return AreDenseOnSameDevice(a, b) && AreDenseOnSameDevice(a, c);
+}
+
+template <class ElemType>
+/*static*/ bool Matrix<ElemType>::AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c, const Matrix<ElemType>& d)
+{
+    return AreDenseOnSameDevice(a, b, c) && AreDenseOnSameDevice(a, d);
+}
+
 template <class ElemType>
 void Matrix<ElemType>::_transferToDevice(int to_id, bool ismoved, bool emptyTransfer) const
 {
@@ -4046,13 +4437,27 @@ template <class ElemType>
 void Matrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB,
                                               ElemType beta, Matrix<ElemType>& c)
 {
+    if (AreDenseOnSameDevice(a, b, c)) // fast path, e.g. for the small products in recurrent loops
+    {
+        DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(&c,
+                                             CPUMatrix<ElemType>::MultiplyAndWeightedAdd(alpha, *a.m_CPUMatrix, transposeA, *b.m_CPUMatrix, transposeB, beta, *c.m_CPUMatrix),
+                                             GPUMatrix<ElemType>::MultiplyAndWeightedAdd(alpha, *a.m_GPUMatrix, transposeA, *b.m_GPUMatrix, transposeB, beta, *c.m_GPUMatrix));
+        return;
+    }
+
     DecideAndMoveToRightDevice(a, b, c);
 
     if (c.GetDeviceId() < 0) // CPU
     {
         if (a.GetMatrixType() == MatrixType::SPARSE)
-            NOT_IMPLEMENTED;
-        if (b.GetMatrixType() == MatrixType::SPARSE)
+        {
+            if (b.GetMatrixType() == MatrixType::SPARSE)
+                NOT_IMPLEMENTED;
+            c.SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+            CPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(alpha, *a.m_CPUSparseMatrix, transposeA, *b.m_CPUMatrix, transposeB, beta, *c.m_CPUMatrix);
+            c.SetDataLocation(CPU, DENSE);
+        }
+        else if (b.GetMatrixType() == MatrixType::SPARSE)
         {
             if (c.GetMatrixType() == MatrixType::DENSE)
             {
@@ -4083,8 +4488,7 @@ void Matrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const Matrix<ElemT
         }
         else if (a.m_matrixType == MatrixType::SPARSE && b.m_matrixType == c.m_matrixType && b.m_matrixType == MatrixType::DENSE) // Sparse*Dense+Dense
         {
-            GPUMatrix<ElemType> second = transposeB ? b.m_GPUMatrix->Transpose() : *b.m_GPUMatrix;
-            GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(alpha, *a.m_GPUSparseMatrix, transposeA, second, false, beta, *c.m_GPUMatrix);
+            GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(alpha, *a.m_GPUSparseMatrix, transposeA, *b.m_GPUMatrix, transposeB, beta, *c.m_GPUMatrix);
             c.SetDataLocation(GPU, DENSE);
         }
         else if (a.m_matrixType == MatrixType::DENSE && b.m_matrixType == MatrixType::SPARSE && c.m_matrixType == MatrixType::DENSE) // Dense*Sparse + Dense
@@ -4165,6 +4569,27 @@ template <class ElemType>
                             NOT_IMPLEMENTED);
 }
 
+/// <summary>Batched matrix-matrix multiply: c_i = alpha * op(a_i) * op(b_i) + beta * c_i for i = 0..batchCount-1</summary>
+/// a_i, b_i, and c_i are the i-th of batchCount consecutive column blocks of equal width of a, b, and c.
+/// This replaces loops of many small MultiplyAndWeightedAdd() calls by a single call. Only dense matrices are supported.
+template <class ElemType>
+/*static*/ void Matrix<ElemType>::BatchMultiplyAndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB,
+                                                              ElemType beta, Matrix<ElemType>& c, const size_t batchCount)
+{
+    DecideAndMoveToRightDevice(a, b, c);
+
+    if (a.GetMatrixType() != MatrixType::DENSE || b.GetMatrixType() != MatrixType::DENSE)
+        NOT_IMPLEMENTED;
+    c.SwitchToMatrixType(MatrixType::DENSE, matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&c,
+                            &c,
+                            CPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd(alpha, *a.m_CPUMatrix, transposeA, *b.m_CPUMatrix, transposeB, beta, *c.m_CPUMatrix, batchCount),
+                            GPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd(alpha, *a.m_GPUMatrix, transposeA, *b.m_GPUMatrix, transposeB, beta, *c.m_GPUMatrix, batchCount),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 /// <summary>Matrix-matrix multiply with col-major matrices (a and b may be transposed): c =  op(a) * op(b) + c</summary>
 /// <param name="a">Input matrix</param>
 /// <param name="transposeA">Whether matrix a is transposed</param>
@@ -4404,6 +4829,31 @@ void Matrix<ElemType>::AddScaledDifference(const Matrix<ElemType>& alpha, const
                             NOT_IMPLEMENTED);
 }
 
+/// <summary> c += alpha * (softmax(logits) - labels), column-wise</summary>
+/// <param name="alpha">1X1 matrix</param>
+/// <param name="labels">Input matrix</param>
+/// <param name="logits">Input matrix</param>
+/// <param name="logSumExp">1 x cols matrix as left by AssignCrossEntropyWithSoftmaxOf()</param>
+/// <param name="c">Resulting matrix, user is responsible for allocating this</param>
+template <class ElemType>
+void Matrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(const Matrix<ElemType>& alpha, const Matrix<ElemType>& labels, const Matrix<ElemType>& logits,
+                                                          const Matrix<ElemType>& logSumExp, Matrix<ElemType>& c)
+{
+    DecideAndMoveToRightDevice(c, labels, logits);
+    alpha._transferToDevice(c.GetDeviceId());
+    logSumExp._transferToDevice(c.GetDeviceId());
+
+    if (!(labels.GetMatrixType() == DENSE && logits.GetMatrixType() == DENSE && c.GetMatrixType() == DENSE && alpha.GetMatrixType() == DENSE && logSumExp.GetMatrixType() == DENSE))
+        NOT_IMPLEMENTED;
+
+    DISPATCH_MATRIX_ON_FLAG(&c,
+                            &c,
+                            CPUMatrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(*alpha.m_CPUMatrix, *labels.m_CPUMatrix, *logits.m_CPUMatrix, *logSumExp.m_CPUMatrix, *c.m_CPUMatrix),
+                            GPUMatrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(*alpha.m_GPUMatrix, *labels.m_GPUMatrix, *logits.m_GPUMatrix, *logSumExp.m_GPUMatrix, *c.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 /// <summary> c = alpha * (a-b)</summary>
 /// if a, b, c  must have same dim
 /// <param name="alpha">Scalar</param>
@@ -4929,6 +5379,177 @@ Matrix<ElemType>& Matrix<ElemType>::AssignElementProductOfWithShift(const Matrix
     return *this;
 }
 
+template <class ElemType>
+void Matrix<ElemType>::CosDistanceWithShiftNeg(const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c, Matrix<ElemType>& invNormA, Matrix<ElemType>& invNormB, size_t shift, size_t negNumber)
+{
+    if (a.IsEmpty() || b.IsEmpty())
+        LogicError("CosDistanceWithShiftNeg: one of the input matrices is empty.");
+    if (a.GetNumRows() != b.GetNumRows() || a.GetNumCols() != b.GetNumCols())
+        InvalidArgument("CosDistanceWithShiftNeg: The input matrix dimensions do not match.");
+
+    DecideAndMoveToRightDevice(a, b, c, invNormA);
+    DecideAndMoveToRightDevice(a, b, invNormB);
+    if (a.GetMatrixType() != DENSE || b.GetMatrixType() != DENSE)
+        NOT_IMPLEMENTED;
+    c.SwitchToMatrixType(DENSE, matrixFormatDense, false);
+    invNormA.SwitchToMatrixType(DENSE, matrixFormatDense, false);
+    invNormB.SwitchToMatrixType(DENSE, matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&c,
+                            &c,
+                            CPUMatrix<ElemType>::CosDistanceWithShiftNeg(*a.m_CPUMatrix, *b.m_CPUMatrix, *c.m_CPUMatrix, *invNormA.m_CPUMatrix, *invNormB.m_CPUMatrix, shift, negNumber);
+                            invNormA.SetDataLocation(CPU, DENSE); invNormB.SetDataLocation(CPU, DENSE),
+                            GPUMatrix<ElemType>::CosDistanceWithShiftNeg(*a.m_GPUMatrix, *b.m_GPUMatrix, *c.m_GPUMatrix, *invNormA.m_GPUMatrix, *invNormB.m_GPUMatrix, shift, negNumber);
+                            invNormA.SetDataLocation(GPU, DENSE); invNormB.SetDataLocation(GPU, DENSE),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c, const Matrix<ElemType>& gradientC,
+                                                          const Matrix<ElemType>& invNormA, const Matrix<ElemType>& invNormB, size_t shift, size_t negNumber, Matrix<ElemType>& gradient)
+{
+    if (gradient.GetNumRows() != a.GetNumRows() || gradient.GetNumCols() != a.GetNumCols() ||
+        gradientC.GetNumRows() != c.GetNumRows() || gradientC.GetNumCols() != c.GetNumCols() || c.GetNumRows() != negNumber + 1)
+        InvalidArgument("AddCosDistanceGradientWithShiftNeg: The input matrix dimensions do not match.");
+
+    DecideAndMoveToRightDevice(gradient, a, b, c);
+    DecideAndMoveToRightDevice(gradient, gradientC, invNormA, invNormB);
+    if (gradient.GetMatrixType() != DENSE || a.GetMatrixType() != DENSE || b.GetMatrixType() != DENSE)
+        NOT_IMPLEMENTED;
+
+    DISPATCH_MATRIX_ON_FLAG(&gradient,
+                            &gradient,
+                            CPUMatrix<ElemType>::AddCosDistanceGradientWithShiftNeg(inputIndex, *a.m_CPUMatrix, *b.m_CPUMatrix, *c.m_CPUMatrix, *gradientC.m_CPUMatrix,
+                                                                                    *invNormA.m_CPUMatrix, *invNormB.m_CPUMatrix, shift, negNumber, *gradient.m_CPUMatrix),
+                            GPUMatrix<ElemType>::AddCosDistanceGradientWithShiftNeg(inputIndex, *a.m_GPUMatrix, *b.m_GPUMatrix, *c.m_GPUMatrix, *gradientC.m_GPUMatrix,
+                                                                                    *invNormA.m_GPUMatrix, *invNormB.m_GPUMatrix, shift, negNumber, *gradient.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::RCRFForwardCompute(const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores, Matrix<ElemType>& alpha,
+                                          const int startLbl, const size_t numParallelSequences)
+{
+    DecideAndMoveToRightDevice(pos_scores, pair_scores, alpha);
+    alpha.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&pos_scores,
+                            &alpha,
+                            CPUMatrix<ElemType>::RCRFForwardCompute(
+                                *pos_scores.m_CPUMatrix,
+                                *pair_scores.m_CPUMatrix,
+                                *alpha.m_CPUMatrix,
+                                startLbl, numParallelSequences),
+                            GPUMatrix<ElemType>::RCRFForwardCompute(
+                                *pos_scores.m_GPUMatrix,
+                                *pair_scores.m_GPUMatrix,
+                                *alpha.m_GPUMatrix,
+                                startLbl, numParallelSequences),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::ViterbiForwardCompute(const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                                             Matrix<ElemType>& alpha, Matrix<ElemType>& backtrace,
+                                             const int startLbl, const size_t numParallelSequences)
+{
+    DecideAndMoveToRightDevice(pos_scores, pair_scores, alpha, backtrace);
+    alpha.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+    backtrace.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&pos_scores,
+                            &alpha,
+                            CPUMatrix<ElemType>::ViterbiForwardCompute(
+                                *pos_scores.m_CPUMatrix,
+                                *pair_scores.m_CPUMatrix,
+                                *alpha.m_CPUMatrix,
+                                *backtrace.m_CPUMatrix,
+                                startLbl, numParallelSequences),
+                            GPUMatrix<ElemType>::ViterbiForwardCompute(
+                                *pos_scores.m_GPUMatrix,
+                                *pair_scores.m_GPUMatrix,
+                                *alpha.m_GPUMatrix,
+                                *backtrace.m_GPUMatrix,
+                                startLbl, numParallelSequences),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+// verify the dimensions of the GMM parameters against the features; the parameters have one column or one per sample
+template <class ElemType>
+static void VerifyGMMParameterDimensions(const char* who, const Matrix<ElemType>& unnormedPrior, const Matrix<ElemType>& mean, const Matrix<ElemType>& logStddev, const Matrix<ElemType>& feature)
+{
+    const size_t numComponents = unnormedPrior.GetNumRows();
+    if (mean.GetNumRows() != numComponents * feature.GetNumRows() || logStddev.GetNumRows() != numComponents)
+        InvalidArgument("%s: mean must have %d rows and logStddev %d, for %d components of dimension %d.", who,
+                        (int) (numComponents * feature.GetNumRows()), (int) numComponents, (int) numComponents, (int) feature.GetNumRows());
+    for (const Matrix<ElemType>* parameter : {&unnormedPrior, &mean, &logStddev})
+        if (parameter->GetNumCols() != 1 && parameter->GetNumCols() != feature.GetNumCols())
+            InvalidArgument("%s: the GMM parameters must have either one column or as many as the features (%d).", who, (int) feature.GetNumCols());
+}
+
+template <class ElemType>
+void Matrix<ElemType>::GMMLogLikelihood(const Matrix<ElemType>& unnormedPrior, const Matrix<ElemType>& mean, const Matrix<ElemType>& logStddev, const Matrix<ElemType>& feature,
+                                        Matrix<ElemType>& logLikelihood, Matrix<ElemType>& posterior, Matrix<ElemType>& normedDeviation)
+{
+    VerifyGMMParameterDimensions("GMMLogLikelihood", unnormedPrior, mean, logStddev, feature);
+
+    DecideAndMoveToRightDevice(feature, unnormedPrior, mean, logStddev);
+    logLikelihood._transferToDevice(feature.GetDeviceId());
+    posterior._transferToDevice(feature.GetDeviceId());
+    normedDeviation._transferToDevice(feature.GetDeviceId());
+    logLikelihood.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+    posterior.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+    normedDeviation.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&feature,
+                            &logLikelihood,
+                            CPUMatrix<ElemType>::GMMLogLikelihood(
+                                *unnormedPrior.m_CPUMatrix, *mean.m_CPUMatrix, *logStddev.m_CPUMatrix, *feature.m_CPUMatrix,
+                                *logLikelihood.m_CPUMatrix, *posterior.m_CPUMatrix, *normedDeviation.m_CPUMatrix),
+                            GPUMatrix<ElemType>::GMMLogLikelihood(
+                                *unnormedPrior.m_GPUMatrix, *mean.m_GPUMatrix, *logStddev.m_GPUMatrix, *feature.m_GPUMatrix,
+                                *logLikelihood.m_GPUMatrix, *posterior.m_GPUMatrix, *normedDeviation.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
+template <class ElemType>
+void Matrix<ElemType>::AddGMMLogLikelihoodGradient(const size_t inputIndex, const Matrix<ElemType>& gradient,
+                                                   const Matrix<ElemType>& posterior, const Matrix<ElemType>& normedDeviation,
+                                                   const Matrix<ElemType>& unnormedPrior, const Matrix<ElemType>& mean, const Matrix<ElemType>& logStddev, const Matrix<ElemType>& feature,
+                                                   Matrix<ElemType>& inputGradient)
+{
+    VerifyGMMParameterDimensions("AddGMMLogLikelihoodGradient", unnormedPrior, mean, logStddev, feature);
+    const Matrix<ElemType>* inputs[] = {&unnormedPrior, &mean, &logStddev, &feature};
+    if (inputIndex >= _countof(inputs))
+        InvalidArgument("AddGMMLogLikelihoodGradient: invalid input index %d.", (int) inputIndex);
+    if (inputGradient.GetNumRows() != inputs[inputIndex]->GetNumRows() || inputGradient.GetNumCols() != inputs[inputIndex]->GetNumCols())
+        InvalidArgument("AddGMMLogLikelihoodGradient: the gradient must have the dimensions of input %d.", (int) inputIndex);
+    if (gradient.GetNumElements() != feature.GetNumCols() || posterior.GetNumCols() != feature.GetNumCols() || normedDeviation.GetNumCols() != feature.GetNumCols())
+        InvalidArgument("AddGMMLogLikelihoodGradient: gradient, posterior and normedDeviation must have one column per sample.");
+
+    DecideAndMoveToRightDevice(feature, unnormedPrior, mean, logStddev);
+    DecideAndMoveToRightDevice(feature, gradient, posterior, normedDeviation);
+    inputGradient._transferToDevice(feature.GetDeviceId());
+
+    DISPATCH_MATRIX_ON_FLAG(&feature,
+                            &inputGradient,
+                            CPUMatrix<ElemType>::AddGMMLogLikelihoodGradient(
+                                inputIndex, *gradient.m_CPUMatrix, *posterior.m_CPUMatrix, *normedDeviation.m_CPUMatrix,
+                                *unnormedPrior.m_CPUMatrix, *mean.m_CPUMatrix, *logStddev.m_CPUMatrix, *feature.m_CPUMatrix,
+                                *inputGradient.m_CPUMatrix),
+                            GPUMatrix<ElemType>::AddGMMLogLikelihoodGradient(
+                                inputIndex, *gradient.m_GPUMatrix, *posterior.m_GPUMatrix, *normedDeviation.m_GPUMatrix,
+                                *unnormedPrior.m_GPUMatrix, *mean.m_GPUMatrix, *logStddev.m_GPUMatrix, *feature.m_GPUMatrix,
+                                *inputGradient.m_GPUMatrix),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 template <class ElemType>
 void Matrix<ElemType>::RCRFBackwardCompute(const Matrix<ElemType>& alpha, Matrix<ElemType>& beta,
                                            Matrix<ElemType>& functionValues, const Matrix<ElemType>& lbls,
@@ -4987,6 +5608,26 @@ void Matrix<ElemType>::RCRFTransGrdCompute(const Matrix<ElemType>& lbls,
                             NOT_IMPLEMENTED);
 }
 
+template <class ElemType>
+void Matrix<ElemType>::LSTMForwardWithState(const Matrix<ElemType>& gates, const Matrix<ElemType>& recurrentWeights, const Matrix<ElemType>& flags,
+                                            Matrix<ElemType>& h, Matrix<ElemType>& c, Matrix<ElemType>& output, const size_t numParallelSequences)
+{
+    DecideAndMoveToRightDevice(gates, recurrentWeights, flags, output);
+    DecideAndMoveToRightDevice(gates, h, c);
+    output.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense, false);
+
+    DISPATCH_MATRIX_ON_FLAG(&gates,
+                            &output,
+                            CPUMatrix<ElemType>::LSTMForwardWithState(*gates.m_CPUMatrix, *recurrentWeights.m_CPUMatrix, *flags.m_CPUMatrix,
+                                                                      *h.m_CPUMatrix, *c.m_CPUMatrix, *output.m_CPUMatrix, numParallelSequences);
+                            h.SetDataLocation(CPU, DENSE); c.SetDataLocation(CPU, DENSE),
+                            GPUMatrix<ElemType>::LSTMForwardWithState(*gates.m_GPUMatrix, *recurrentWeights.m_GPUMatrix, *flags.m_GPUMatrix,
+                                                                      *h.m_GPUMatrix, *c.m_GPUMatrix, *output.m_GPUMatrix, numParallelSequences);
+                            h.SetDataLocation(GPU, DENSE); c.SetDataLocation(GPU, DENSE),
+                            NOT_IMPLEMENTED,
+                            NOT_IMPLEMENTED);
+}
+
 template <class ElemType>
 Matrix<ElemType>& Matrix<ElemType>::DropFrame(const Matrix<ElemType>& label, const Matrix<ElemType>& gamma, const ElemType& threshhold)
 {
@@ -5039,6 +5680,14 @@ void Matrix<ElemType>::TensorOp(ElemType beta, const Matrix<ElemType>& a, ElemTy
                                 const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 2>& regularStrides,
                                 const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 2>& reducingStrides)
 {
+    if (AreDenseOnSameDevice(*this, a)) // fast path
+    {
+        DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(this,
+                                             m_CPUMatrix->TensorOp(beta, *a.m_CPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides),
+                                             m_GPUMatrix->TensorOp(beta, *a.m_GPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides));
+        return;
+    }
+
     DecideAndMoveToRightDevice(*this, a);
 
     DISPATCH_MATRIX_ON_FLAG(this,
@@ -5055,6 +5704,14 @@ void Matrix<ElemType>::TensorOp(ElemType beta, const Matrix<ElemType>& a, const
                                 const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 3>& regularStrides,
                                 const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 3>& reducingStrides)
 {
+    if (AreDenseOnSameDevice(*this, a, b)) // fast path
+    {
+        DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(this,
+                                             m_CPUMatrix->TensorOp(beta, *a.m_CPUMatrix, *b.m_CPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides),
+                                             m_GPUMatrix->TensorOp(beta, *a.m_GPUMatrix, *b.m_GPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides));
+        return;
+    }
+
     DecideAndMoveToRightDevice(*this, a, b);
 
     DISPATCH_MATRIX_ON_FLAG(this,
@@ -5071,6 +5728,14 @@ void Matrix<ElemType>::TensorOp(ElemType beta, const Matrix<ElemType>& a, const
                                 const SmallVector<size_t>& regularOpDims, const array<SmallVector<ptrdiff_t>, 4>& regularStrides,
                                 const SmallVector<size_t>& reducingOpDims, const array<SmallVector<ptrdiff_t>, 4>& reducingStrides)
 {
+    if (AreDenseOnSameDevice(*this, a, b, c)) // fast path
+    {
+        DISPATCH_DENSE_MATRIX_ON_SAME_DEVICE(this,
+                                             m_CPUMatrix->TensorOp(beta, *a.m_CPUMatrix, *b.m_CPUMatrix, *c.m_CPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides),
+                                             m_GPUMatrix->TensorOp(beta, *a.m_GPUMatrix, *b.m_GPUMatrix, *c.m_GPUMatrix, alpha, op, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides));
+        return;
+    }
+
     DecideAndMoveToRightDevice(*this, a, b, c);
 
     DISPATCH_MATRIX_ON_FLAG(this,
@@ -84,6 +84,12 @@ private:
     static void DecideAndMoveToRightDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b);
     static void DecideAndMoveToRightDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c);
     static void DecideAndMoveToRightDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c, const Matrix<ElemType>& d);
+    // Fast-path test for the hot operations: the matrices are all dense and current on the same single device (the CPU or one GPU),
+    // as node values are once the network is validated. Then nothing needs to be moved or switched, and the operation goes straight to the
+    // CPUMatrix or GPUMatrix, without DecideAndMoveToRightDevice() and DISPATCH_MATRIX_ON_FLAG.
+    static bool AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b);
+    static bool AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c);
+    static bool AreDenseOnSameDevice(const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c, const Matrix<ElemType>& d);
     static void CopyElementsFromDenseToSparse(CPUMatrix<ElemType>& from, CPUSparseMatrix<ElemType>& dest);
 
 public:
@@ -197,7 +203,17 @@ public:
     void NormalGrad(Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRatePerSample, const ElemType momentum, const bool useNAG);
     ElemType Adagrad(Matrix<ElemType>& gradients, const bool needAveMultiplier);
     void FSAdagrad(size_t mbSize, Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRatePerSample, const ElemType momentum);
+    // Adam, or LAMB if layerwiseAdaptive; this = the optimizer state, (re-)initialized when it does not match the gradient,
+    // see CPUMatrix::Adam(). 'learnRate' is the step size per update. LAMB overwrites the gradient.
+    void Adam(Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRate, const ElemType beta1, const ElemType beta2,
+              const ElemType epsilon, const ElemType weightDecay, const bool layerwiseAdaptive);
+    // LARS: momentum SGD with the learning rate scaled by the trust ratio of the tensor; this = the optimizer state, see CPUMatrix::Lars()
+    void Lars(Matrix<ElemType>& gradients, Matrix<ElemType>& functionValues, const ElemType learnRate, const ElemType momentum, const ElemType trustCoefficient);
     ElemType RmsProp(Matrix<ElemType>& gradients, ElemType RMS_GAMMA, ElemType RMS_WGT_INC, ElemType RMS_WGT_MAX, ElemType RMS_WGT_DEC, ElemType RMS_WGT_MIN, const bool needAveMultiplier);
+    // clipping, regularization and NormalGrad() of many dense parameters at once, in a few kernel launches; see MultiTensorUpdateDesc
+    // 'workspace' holds the per-tensor norms for clipping; keep it across calls to avoid reallocation
+    static void MultiTensorNormalGrad(const std::vector<Matrix<ElemType>*>& functionValues, const std::vector<Matrix<ElemType>*>& gradients,
+                                      const std::vector<Matrix<ElemType>*>& smoothedGradients, const MultiTensorUpdateDesc& desc, Matrix<ElemType>& workspace);
 
     void Resize(const size_t numRows, const size_t numCols, const size_t numNZElemToReserve = 10000, bool growOnly = true); // by default we only reallocate if need to grow
     void Resize(const Matrix<ElemType>& other)
@@ -214,6 +230,7 @@ public:
         return ColumnSlice(0, GetNumCols());
     }                                                                           // get a reference (e.g. this is not resizable but can be reshaped)
     void Reshape(const size_t numRows, const size_t numCols);                   // note: reshapes in place. To get a reshaped reference, use Reshaped()
+    void PlaceInHostMemory();                                                   // GPU: keep the elements in host memory, mapped into the device (for matrices too large for it)
     Matrix<ElemType> Reshaped(const size_t numRows, const size_t numCols) const // get a reshaped reference
     {
         Matrix<ElemType> result = AsReference();
@@ -240,6 +257,8 @@ public:
     void SetValue(const ElemType v);
     void SetValue(const DeviceBoundNumber<ElemType>& db_number);
     void SetValue(const Matrix<ElemType>& deepCopyFrom, const MatrixFormat format = matrixFormatSparseCSR);
+    // deep copy of a dense GPU matrix that lives on another GPU, without moving either one (SetValue() would move this one over)
+    void SetValueFromOtherDevice(const Matrix<ElemType>& deepCopyFrom);
     void SetValue(const size_t numRows, const size_t numCols, int deviceId, ElemType* pArray, const size_t matrixFlags = matrixFlagNormal);
     void SetValue(const size_t rIdx, const size_t cIdx, ElemType val); // set matrix sparsely
     void SetValue(const size_t numRows, const size_t numCols, std::initializer_list<ElemType> l)
@@ -255,9 +274,23 @@ public:
     }
     void SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYPE* h_CSCCol, const CPUSPARSE_INDEX_TYPE* h_Row, const ElemType* h_Val,
                                 const size_t nz, const size_t numRows, const size_t numCols);
+    // same from one host buffer laid out the way GPUSparseMatrix stores CSC: ElemType values[numNZReserved], row indices[numNZReserved], column starts[numCols + 1]
+    // For a GPU, this is one host-to-device copy, without conversions (best from page-locked memory). It returns when the copy is done.
+    void SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols);
+    // the CSC arrays of a matrixFormatSparseCSC matrix on the host: column starts [numCols + 1] (from 0), row indices and values [nz]
+    void GetCSCFormat(std::vector<CPUSPARSE_INDEX_TYPE>& colStarts, std::vector<CPUSPARSE_INDEX_TYPE>& rows, std::vector<ElemType>& values) const;
+    // access to matrixFormatSparseBlockCol matrices (e.g. sparse gradients) by their stored columns: the column ids, and the values
+    // of those columns on the host, GetNumRows() each, column-major. Setting keeps the dimensions; the column ids must be distinct.
+    void GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const;
+    void SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values);
 
     void MaskColumnsValue(const Matrix<char>& columnsMask, ElemType val);
 
+    // scale, optionally mirror, and mean-subtract a batch of 8-bit images (see ImageAugmentationDesc) into the columns of this matrix
+    // mean: empty, or one column of width x height x channels values in the pixel layout of the images
+    // channelsFirst: store the pixels channel by channel (CHW) rather than interleaved (HWC)
+    Matrix<ElemType>& AssignAugmentedImagesOf(const Matrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const Matrix<ElemType>& mean);
+
     void SetColumn(const ElemType* colPointer, size_t colInd);
     void SetColumn(const ElemType val, size_t colInd);
     void SetColumn(const Matrix<ElemType>& valMat, size_t colInd);
@@ -312,6 +345,10 @@ public:
     Matrix<ElemType>& ElementMultiplyWith(const Matrix<ElemType>& a);
     Matrix<ElemType>& AssignElementProductOf(const Matrix<ElemType>& a, const Matrix<ElemType>& b);
     Matrix<ElemType>& AddElementProductOf(const Matrix<ElemType>& a, const Matrix<ElemType>& b);
+    // dropout with a mask that is not stored but regenerated from seed and element index, see DropoutKeeps() in TensorOps.h;
+    // firstElementIndex is the index of a's first element within the whole minibatch, so that frame slices agree with the full matrix
+    Matrix<ElemType>& AssignDropoutOf(const Matrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex);
+    Matrix<ElemType>& AddDropoutOf(const Matrix<ElemType>& a, const double dropoutRate, const unsigned long seed, const size_t firstElementIndex);
 
     Matrix<ElemType>& AssignElementDivisionOf(const Matrix<ElemType>& a, const Matrix<ElemType>& b);
     Matrix<ElemType>& ElementDivideBy(const Matrix<ElemType>& a);
@@ -322,6 +359,12 @@ public:
     Matrix<ElemType>& ColumnElementDivideBy(const Matrix<ElemType>& a);
     Matrix<ElemType>& RowElementDivideBy(const Matrix<ElemType>& a);
 
+    // column gather and scatter; idx is a row vector of column indices, where negative entries stand for no column
+    // gather: this(:,j) = beta * this(:,j) + alpha * a(:,idx(j)), for idx(j) < 0 only the first term
+    Matrix<ElemType>& DoGatherColumnsOf(ElemType beta, const Matrix<ElemType>& idx, const Matrix<ElemType>& a, ElemType alpha);
+    // scatter: this = beta * this, then this(:,idx(j)) += alpha * a(:,j); repeated entries of idx accumulate
+    Matrix<ElemType>& DoScatterColumnsOf(ElemType beta, const Matrix<ElemType>& idx, const Matrix<ElemType>& a, ElemType alpha);
+
     Matrix<ElemType>& ElementInverse();
     Matrix<ElemType>& AssignElementInverseOf(const Matrix<ElemType>& a);
 
@@ -339,6 +382,9 @@ public:
 
     Matrix<ElemType>& InplaceLogSoftmax(const bool isColWise);
     Matrix<ElemType>& AssignLogSoftmaxOf(const Matrix<ElemType>& a, const bool isColWise);
+    // fused column-wise softmax + cross entropy: [this] (1x1) = -sum_j sum_i labels(i,j) * log softmax(logits(:,j))_i.
+    // Only the 1 x cols log-sum-exp is written besides; AddCrossEntropyWithSoftmaxGradient() recomputes the softmax from it.
+    Matrix<ElemType>& AssignCrossEntropyWithSoftmaxOf(const Matrix<ElemType>& labels, const Matrix<ElemType>& logits, Matrix<ElemType>& logSumExp);
 
     Matrix<ElemType>& InplaceHardmax(const bool isColWise);
     Matrix<ElemType>& AssignHardmaxOf(const Matrix<ElemType>& a, const bool isColWise);
@@ -486,6 +532,7 @@ public:
     static void Multiply(const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB, Matrix<ElemType>& c);
     static void Multiply(const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c);
     static void Multiply1x1AndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, ElemType beta, Matrix<ElemType>& c);
+    static void BatchMultiplyAndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB, ElemType beta, Matrix<ElemType>& c, const size_t batchCount); // batched SGEMM over column blocks
     static void ConvolveAndWeightedAdd(ElemType alpha, const Matrix<ElemType>& a, const bool transposeA, const Matrix<ElemType>& b, const bool transposeB, ElemType beta, Matrix<ElemType>& c, size_t numChannels, size_t horizontalSubsample, bool padding, bool channelwise);
 
     static void ScaleAndAdd(ElemType alpha, const Matrix<ElemType>& a, Matrix<ElemType>& c);
@@ -493,6 +540,8 @@ public:
     static void AddScaledDifference(const ElemType alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c);
     static void AssignScaledDifference(const ElemType alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c);
     static void AddScaledDifference(const Matrix<ElemType>& alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c); // c += alpha * (a - b)
+    static void AddCrossEntropyWithSoftmaxGradient(const Matrix<ElemType>& alpha, const Matrix<ElemType>& labels, const Matrix<ElemType>& logits,
+                                                   const Matrix<ElemType>& logSumExp, Matrix<ElemType>& c); // c += alpha * (softmax(logits) - labels)
     static void AssignScaledDifference(const Matrix<ElemType>& alpha, const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c);
 
     static void AddElementToElement(const Matrix<ElemType>& a, const size_t ai, const size_t aj, Matrix<ElemType>& c, const size_t ci, const size_t cj);
@@ -537,8 +586,35 @@ public:
     Matrix<ElemType>& GetARowByIndex(const Matrix<ElemType>& a, size_t index);
     static void ConductRowElementMultiplyWithShift(const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c, size_t shift, bool bFirstmatrixfixed);
     Matrix<ElemType>& AssignElementProductOfWithShift(const Matrix<ElemType>& a, const Matrix<ElemType>& b, size_t shift);
+    // cosine similarities of the columns of a and b, in one pass: c(0, j) = cos(a_j, b_j), and c(i, j) = cos(a_j, b_((j + shift + i - 1) % n))
+    // for the negNumber negative samples; invNormA/B get the inverse column norms, for the gradient. negNumber = 0 is the plain cosine distance.
+    static void CosDistanceWithShiftNeg(const Matrix<ElemType>& a, const Matrix<ElemType>& b, Matrix<ElemType>& c, Matrix<ElemType>& invNormA, Matrix<ElemType>& invNormB, size_t shift, size_t negNumber);
+    // gradient += the gradient of c = CosDistanceWithShiftNeg (a, b) with respect to a (inputIndex 0) or b (1), given that of c (gradientC)
+    static void AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const Matrix<ElemType>& a, const Matrix<ElemType>& b, const Matrix<ElemType>& c, const Matrix<ElemType>& gradientC,
+                                                   const Matrix<ElemType>& invNormA, const Matrix<ElemType>& invNormB, size_t shift, size_t negNumber, Matrix<ElemType>& gradient);
 
 public:
+    // CRF forward (alpha) recursion in the log domain; the columns of pos_scores are time steps, each holding
+    // numParallelSequences interleaved sequences (column t * numParallelSequences + s), which are processed in parallel
+    static void RCRFForwardCompute(const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores, Matrix<ElemType>& alpha,
+                                   const int startLbl, // the time 0 start symbol in the output layer
+                                   const size_t numParallelSequences = 1);
+    // same recursion with max instead of log-add; backtrace receives the best predecessor of each label
+    static void ViterbiForwardCompute(const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores,
+                                      Matrix<ElemType>& alpha, Matrix<ElemType>& backtrace,
+                                      const int startLbl, const size_t numParallelSequences = 1);
+
+    // log-likelihood of each feature column under a GMM whose components have a single stddev each (see GMMLogLikelihoodNode)
+    // unnormedPrior, mean and logStddev have one column, or one column per sample. This also returns the component posteriors
+    // and the normed squared distances ||x - mean_c||^2 / stddev_c^2, which is all the gradients need.
+    static void GMMLogLikelihood(const Matrix<ElemType>& unnormedPrior, const Matrix<ElemType>& mean, const Matrix<ElemType>& logStddev, const Matrix<ElemType>& feature,
+                                 Matrix<ElemType>& logLikelihood, Matrix<ElemType>& posterior, Matrix<ElemType>& normedDeviation);
+    // add the gradient of GMMLogLikelihood() w.r.t. one of its inputs (0..3 in the order of the arguments above) to inputGradient
+    static void AddGMMLogLikelihoodGradient(const size_t inputIndex, const Matrix<ElemType>& gradient,
+                                            const Matrix<ElemType>& posterior, const Matrix<ElemType>& normedDeviation,
+                                            const Matrix<ElemType>& unnormedPrior, const Matrix<ElemType>& mean, const Matrix<ElemType>& logStddev, const Matrix<ElemType>& feature,
+                                            Matrix<ElemType>& inputGradient);
+
     static void RCRFBackwardCompute(const Matrix<ElemType>& alpha, Matrix<ElemType>& beta,
                                     Matrix<ElemType>& functionValues, const Matrix<ElemType>& lbls,
                                     const Matrix<ElemType>& pos_scores, const Matrix<ElemType>& pair_scores, const int shift);
@@ -551,6 +627,15 @@ public:
                                     const int startLbl, // the time 0 start symbol in the output layer
                                     const int shift);
 
+    // one LSTM layer over all time steps of a minibatch, for inference; the columns are time steps of numParallelSequences
+    // interleaved sequences (column t * numParallelSequences + s). gates [4H x T*S] are the input projections W x + b of the gates
+    // i, f, c, o; recurrentWeights [H x 4H] has the recurrent weights of gate g of unit j in column g * H + j. flags [1 x T*S] are
+    // 0 for gaps (the state is kept), 1 where a sequence continues, and 2 where it starts (from zero states). h and c [H x S] are the
+    // states that sequences continue from at time 0; they are updated to the states after the last step. On the GPU, the time steps
+    // are run by a single persistent kernel if all its blocks fit on the device at once, each keeping its rows of the recurrent weights in shared memory.
+    static void LSTMForwardWithState(const Matrix<ElemType>& gates, const Matrix<ElemType>& recurrentWeights, const Matrix<ElemType>& flags,
+                                     Matrix<ElemType>& h, Matrix<ElemType>& c, Matrix<ElemType>& output, const size_t numParallelSequences);
+
     template <typename T>
     friend class MatrixQuantizer;
 
@@ -0,0 +1,155 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// MatrixReadback.cpp -- copies of dense matrices to the host that do not block the host thread
+//
+#include "stdafx.h"
+#include "Basics.h"
+#include "MatrixReadback.h"
+#include "GPUDataTransferer.h"
+#include "CUDAPageLockedMemAllocator.h"
+#include <memory>
+#include <string.h>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+struct MatrixReadback<ElemType>::Impl
+{
+    Impl()
+        : m_deviceId(CPUDEVICE), m_hostBuffer(nullptr), m_hostBufferSize(0), m_values(nullptr), m_numRows(0), m_numCols(0), m_started(false), m_copyPending(false)
+    {
+    }
+    ~Impl()
+    {
+        FreeHostBuffer();
+    }
+
+    void WaitForCopy()
+    {
+        if (m_copyPending)
+            m_transferer->WaitForCopyGPUToCPUAsync();
+        m_copyPending = false;
+    }
+    void FreeHostBuffer()
+    {
+        WaitForCopy(); // (the copy may still write into it)
+        if (m_hostBuffer)
+            CUDAPageLockedMemArena::GetSharedArena(m_deviceId).Free(m_hostBuffer);
+        m_hostBuffer = nullptr;
+        m_hostBufferSize = 0;
+    }
+
+    DEVICEID_TYPE m_deviceId;                                 // of m_transferer and m_hostBuffer
+    std::unique_ptr<GPUDataTransferer<ElemType>> m_transferer; // for GPU matrices
+    ElemType* m_hostBuffer;                                   // page-locked, from the shared arena of m_deviceId
+    size_t m_hostBufferSize;                                  // in elements
+    std::vector<ElemType> m_cpuValues;                        // the copy of a CPU matrix
+    const ElemType* m_values;                                 // m_hostBuffer or m_cpuValues, once the copy is complete
+    size_t m_numRows, m_numCols;
+    bool m_started;
+    bool m_copyPending; // on the fetch stream, not waited for yet
+};
+
+template <class ElemType>
+MatrixReadback<ElemType>::MatrixReadback()
+    : m_impl(new Impl())
+{
+}
+
+template <class ElemType>
+MatrixReadback<ElemType>::~MatrixReadback()
+{
+    delete m_impl;
+}
+
+template <class ElemType>
+void MatrixReadback<ElemType>::Start(const Matrix<ElemType>& matrix)
+{
+    if (matrix.GetMatrixType() != DENSE)
+        LogicError("MatrixReadback: Only dense matrices can be read back asynchronously.");
+    Impl& impl = *m_impl;
+    impl.WaitForCopy();
+    impl.m_numRows = matrix.GetNumRows();
+    impl.m_numCols = matrix.GetNumCols();
+    impl.m_started = true;
+    const size_t numElements = matrix.GetNumElements();
+    const DEVICEID_TYPE deviceId = matrix.GetDeviceId();
+
+    if (deviceId == CPUDEVICE || numElements == 0)
+    {
+        impl.m_cpuValues.resize(numElements);
+        if (numElements > 0)
+            matrix.CopySection(impl.m_numRows, impl.m_numCols, impl.m_cpuValues.data(), impl.m_numRows);
+        impl.m_values = impl.m_cpuValues.data();
+        return;
+    }
+
+    if (!impl.m_transferer || impl.m_deviceId != deviceId)
+    {
+        impl.FreeHostBuffer();
+        impl.m_transferer.reset(new GPUDataTransferer<ElemType>(deviceId, true /*useConcurrentStreams*/));
+        impl.m_deviceId = deviceId;
+    }
+    if (impl.m_hostBufferSize < numElements)
+    {
+        impl.FreeHostBuffer();
+        impl.m_hostBuffer = (ElemType*) CUDAPageLockedMemArena::GetSharedArena(deviceId).Malloc(numElements * sizeof(ElemType));
+        impl.m_hostBufferSize = numElements;
+    }
+    impl.m_transferer->CopyGPUToCPUAfterComputeAsync(matrix.BufferPointer(), numElements, impl.m_hostBuffer);
+    impl.m_transferer->WaitForCopyGPUToCPUOnComputeStream(); // (later work on the matrix must not overtake the copy)
+    impl.m_copyPending = true;
+    impl.m_values = impl.m_hostBuffer;
+}
+
+template <class ElemType>
+bool MatrixReadback<ElemType>::IsStarted() const
+{
+    return m_impl->m_started;
+}
+
+template <class ElemType>
+const ElemType* MatrixReadback<ElemType>::Wait()
+{
+    if (!m_impl->m_started)
+        LogicError("MatrixReadback: Wait() called before Start().");
+    m_impl->WaitForCopy();
+    return m_impl->m_values;
+}
+
+template <class ElemType>
+void MatrixReadback<ElemType>::WaitAndCopyTo(ElemType* dst, size_t colStride)
+{
+    const ElemType* values = Wait();
+    const size_t numRows = m_impl->m_numRows;
+    if (colStride < numRows)
+        InvalidArgument("MatrixReadback: The stride (%d) is less than the number of rows (%d).", (int) colStride, (int) numRows);
+    if (colStride == numRows)
+    {
+        if (numRows * m_impl->m_numCols > 0)
+            memcpy(dst, values, numRows * m_impl->m_numCols * sizeof(ElemType));
+        return;
+    }
+    for (size_t j = 0; j < m_impl->m_numCols; j++)
+        memcpy(dst + j * colStride, values + j * numRows, numRows * sizeof(ElemType));
+}
+
+template <class ElemType>
+size_t MatrixReadback<ElemType>::GetNumRows() const
+{
+    return m_impl->m_numRows;
+}
+
+template <class ElemType>
+size_t MatrixReadback<ElemType>::GetNumCols() const
+{
+    return m_impl->m_numCols;
+}
+
+template class MatrixReadback<float>;
+template class MatrixReadback<double>;
+
+} } }
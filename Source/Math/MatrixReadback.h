@@ -0,0 +1,52 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// MatrixReadback.h -- copies of dense matrices to the host that do not block the host thread
+//
+#pragma once
+
+#include "Matrix.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// MatrixReadback -- the values of a dense matrix on their way into host memory
+// For a GPU matrix, Start() queues the copy on the fetch stream (see GPUDataTransferer), into page-locked memory from the
+// shared arena, behind the work issued so far on the compute stream; and the work issued on the compute stream after Start()
+// waits for the copy. So Start() does not block, and later work may overwrite the matrix right away. Wait() blocks
+// until the values are there. A CPU matrix is copied right away.
+// The host buffer is kept for the next Start(), so that a readback per minibatch does not allocate.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class MATH_API MatrixReadback
+{
+public:
+    MatrixReadback();
+    ~MatrixReadback(); // (waits for a copy that is still going on)
+
+    DISABLE_COPY_AND_MOVE(MatrixReadback);
+
+    // start copying all of 'matrix' (after waiting for the copy of the previous Start(), whose values are lost)
+    void Start(const Matrix<ElemType>& matrix);
+    bool IsStarted() const;
+
+    // wait for the copy; the values are column-major, GetNumRows() x GetNumCols(), and valid until the next Start()
+    const ElemType* Wait();
+    // same, copied into 'dst' with leading dimension colStride (like Matrix::CopySection())
+    void WaitAndCopyTo(ElemType* dst, size_t colStride);
+
+    size_t GetNumRows() const;
+    size_t GetNumCols() const;
+    size_t GetNumElements() const
+    {
+        return GetNumRows() * GetNumCols();
+    }
+
+private:
+    struct Impl;
+    Impl* m_impl;
+};
+
+} } }
@@ -0,0 +1,140 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NcclComm.cpp -- NCCL communicator among the GPUs of one machine, for reductions that stay in GPU memory
+//
+
+#include "stdafx.h"
+#include "NcclComm.h"
+#ifdef USE_NCCL
+#include "GPUMatrix.h"
+#include <nccl.h>
+
+template <>
+const char* CudaErrString<ncclResult_t>(ncclResult_t x)
+{
+    return ncclGetErrorString(x);
+}
+
+#define NCCL_CALL(expr) (CudaCall((expr), #expr, "NCCL", ncclSuccess))
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+#ifdef USE_NCCL
+
+static ncclDataType_t GetNcclDataType(float*)
+{
+    return ncclFloat;
+}
+static ncclDataType_t GetNcclDataType(double*)
+{
+    return ncclDouble;
+}
+
+/*static*/ bool NcclComm::IsSupported()
+{
+    return true;
+}
+
+/*static*/ std::vector<char> NcclComm::CreateUniqueId()
+{
+    ncclUniqueId id;
+    NCCL_CALL(ncclGetUniqueId(&id));
+    return std::vector<char>((const char*) &id, (const char*) &id + sizeof(id));
+}
+
+NcclComm::NcclComm(DEVICEID_TYPE deviceId, int rank, int numRanks, const std::vector<char>& uniqueId)
+    : m_comm(nullptr), m_deviceId(deviceId)
+{
+    ncclUniqueId id;
+    if (uniqueId.size() != sizeof(id))
+        InvalidArgument("NcclComm: Unique id has the wrong size (%d instead of %d bytes).", (int) uniqueId.size(), (int) sizeof(id));
+    memcpy(&id, uniqueId.data(), sizeof(id));
+    PrepareDevice(m_deviceId);
+    NCCL_CALL(ncclCommInitRank(&m_comm, numRanks, id, rank));
+}
+
+NcclComm::~NcclComm()
+{
+    if (m_comm != nullptr)
+        ncclCommDestroy(m_comm);
+}
+
+template <class ElemType>
+void NcclComm::Reduce(ElemType* gpuBuffer, size_t numElements, int root)
+{
+    PrepareDevice(m_deviceId);
+    NCCL_CALL(ncclReduce(gpuBuffer, gpuBuffer, numElements, GetNcclDataType(gpuBuffer), ncclSum, root, m_comm, GetStream()));
+}
+
+template <class ElemType>
+void NcclComm::Broadcast(ElemType* gpuBuffer, size_t numElements, int root)
+{
+    PrepareDevice(m_deviceId);
+    NCCL_CALL(ncclBcast(gpuBuffer, numElements, GetNcclDataType(gpuBuffer), root, m_comm, GetStream()));
+}
+
+void NcclComm::GroupStart()
+{
+    NCCL_CALL(ncclGroupStart());
+}
+
+void NcclComm::GroupEnd()
+{
+    NCCL_CALL(ncclGroupEnd());
+}
+
+#else
+
+/*static*/ bool NcclComm::IsSupported()
+{
+    return false;
+}
+
+/*static*/ std::vector<char> NcclComm::CreateUniqueId()
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+NcclComm::NcclComm(DEVICEID_TYPE deviceId, int, int, const std::vector<char>&)
+    : m_comm(nullptr), m_deviceId(deviceId)
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+NcclComm::~NcclComm()
+{
+}
+
+template <class ElemType>
+void NcclComm::Reduce(ElemType*, size_t, int)
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+template <class ElemType>
+void NcclComm::Broadcast(ElemType*, size_t, int)
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+void NcclComm::GroupStart()
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+void NcclComm::GroupEnd()
+{
+    RuntimeError("The code is compiled without USE_NCCL macro.");
+}
+
+#endif
+
+template void NcclComm::Reduce<float>(float*, size_t, int);
+template void NcclComm::Reduce<double>(double*, size_t, int);
+template void NcclComm::Broadcast<float>(float*, size_t, int);
+template void NcclComm::Broadcast<double>(double*, size_t, int);
+
+} } }
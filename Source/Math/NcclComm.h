@@ -0,0 +1,54 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NcclComm.h -- NCCL communicator among the GPUs of one machine, for reductions that stay in GPU memory
+//
+#pragma once
+
+#include "CommonMatrix.h"
+#include "Basics.h"
+#include <vector>
+
+// predeclare ncclComm_t
+struct ncclComm;
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// NcclComm -- one rank of an NCCL communicator; each rank owns one GPU
+// All ranks construct it with the same unique id, which one of them creates with CreateUniqueId()
+// and distributes by other means (e.g. MPI_Bcast). The collectives are asynchronous on the current
+// compute stream (GetStream()), and must be issued in the same order on all ranks.
+// Without USE_NCCL, IsSupported() returns false and everything else throws.
+// -----------------------------------------------------------------------
+
+class MATH_API NcclComm
+{
+public:
+    static bool IsSupported();
+    static std::vector<char> CreateUniqueId();
+
+    NcclComm(DEVICEID_TYPE deviceId, int rank, int numRanks, const std::vector<char>& uniqueId);
+    ~NcclComm();
+
+    DISABLE_COPY_AND_MOVE(NcclComm);
+
+    // sum up the buffers of all ranks into the one of 'root' (the others are unchanged)
+    template <class ElemType>
+    void Reduce(ElemType* gpuBuffer, size_t numElements, int root);
+
+    // copy the buffer of 'root' to all others
+    template <class ElemType>
+    void Broadcast(ElemType* gpuBuffer, size_t numElements, int root);
+
+    // collectives issued between these are launched together, which is much faster for many small buffers
+    void GroupStart();
+    void GroupEnd();
+
+private:
+    ncclComm* m_comm;
+    DEVICEID_TYPE m_deviceId;
+};
+
+} } }
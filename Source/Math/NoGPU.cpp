@@ -13,6 +13,7 @@
 #include "GPUSparseMatrix.h"
 #include "MatrixQuantizerGPU.h"
 #include "CuDnnConvolutionEngine.h"
+#include "CuDnnRNN.h"
 #include "TensorShape.h"
 #include "GPUDataTransferer.h"
 
@@ -25,6 +26,100 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 
 void PrepareDevice(DEVICEID_TYPE deviceId);
 
+void TracingGPUMemoryAllocator::EmptyCache(int deviceId)
+{
+}
+
+GPUMemoryCacheStatistics TracingGPUMemoryAllocator::GetCacheStatistics(int deviceId)
+{
+    return GPUMemoryCacheStatistics();
+}
+
+void TracingGPUMemoryAllocator::ResetPeakAllocatedBytes(int deviceId)
+{
+}
+
+void TracingGPUMemoryAllocator::PrintCacheStatistics(int deviceId)
+{
+}
+
+std::pair<size_t, size_t> TracingGPUMemoryAllocator::GetFreeAndTotalMemoryInMBs(int deviceId)
+{
+    return {size_t(0), size_t(0)};
+}
+
+ConcurrentStreams::ConcurrentStreams(int deviceId, size_t numStreams)
+    : m_deviceId(deviceId), m_originalStream(nullptr), m_forkEvent(nullptr), m_streams(numStreams, nullptr), m_joinEvents(numStreams, nullptr)
+{
+}
+
+ConcurrentStreams::~ConcurrentStreams()
+{
+}
+
+void ConcurrentStreams::Fork()
+{
+}
+
+void ConcurrentStreams::Select(size_t i)
+{
+}
+
+void ConcurrentStreams::Join()
+{
+}
+
+// CapturedGPUWork -- nothing to capture without a GPU
+CapturedGPUWork::CapturedGPUWork(int deviceId)
+    : m_deviceId(deviceId), m_stream(nullptr), m_forkEvent(nullptr), m_joinEvent(nullptr), m_graphExec(nullptr)
+{
+}
+
+CapturedGPUWork::~CapturedGPUWork()
+{
+}
+
+bool CapturedGPUWork::Capture(const std::function<void()>& body)
+{
+    return false;
+}
+
+void CapturedGPUWork::Replay()
+{
+    LogicError("CapturedGPUWork: Replay() without a successful Capture().");
+}
+
+void CapturedGPUWork::Reset()
+{
+}
+
+// DeviceTimer -- CPU only
+DeviceTimer::DeviceTimer(int deviceId)
+    : m_deviceId(deviceId), m_numEventsRecorded(0), m_cpuSeconds(0)
+{
+}
+
+DeviceTimer::~DeviceTimer()
+{
+}
+
+void DeviceTimer::Start()
+{
+    m_cpuStart = std::chrono::steady_clock::now();
+}
+
+void DeviceTimer::Stop()
+{
+    m_cpuSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_cpuStart).count();
+}
+
+double DeviceTimer::ElapsedSeconds()
+{
+    double seconds = m_cpuSeconds;
+    m_cpuSeconds = 0;
+    return seconds;
+}
+
 template <class ElemType>
 GPUSPARSE_INDEX_TYPE GPUSparseMatrix<ElemType>::SecondaryIndexValueAt(size_t idx) const
 {
@@ -176,6 +271,21 @@ void GPUSparseMatrix<ElemType>::SetMatrixFromCSCFormat(const CPUSPARSE_INDEX_TYP
 {
 }
 
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::SetMatrixFromCSCBuffer(const void* h_buffer, const size_t numNZReserved, const size_t nz, const size_t numRows, const size_t numCols)
+{
+}
+
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::GetBlockColumns(std::vector<size_t>& columnIds, std::vector<ElemType>& values) const
+{
+}
+
+template <class ElemType>
+void GPUSparseMatrix<ElemType>::SetMatrixFromBlockColumns(const std::vector<size_t>& columnIds, const ElemType* values)
+{
+}
+
 // forward pass from feature to hidden layer
 template <class ElemType>
 void GPUSparseMatrix<ElemType>::MultiplyAndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& lhs, const bool transposeA,
@@ -968,6 +1078,12 @@ void GPUMatrix<ElemType>::MaskColumnsValue(const GPUMatrix<char>& columnsMask, E
 {
 }
 
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignAugmentedImagesOf(const GPUMatrix<char>& images, size_t numImages, size_t width, size_t height, size_t channels, bool channelsFirst, const GPUMatrix<ElemType>& mean)
+{
+    return *this;
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::CopyColumnsStrided(const GPUMatrix<ElemType>& fromMatrix, size_t numCols, size_t srcNumColsStride, size_t destNumColsStride)
 {
@@ -977,6 +1093,11 @@ void GPUMatrix<ElemType>::SetValue(const GPUMatrix<ElemType>& deepCopyFrom)
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::SetValueFromOtherDevice(const GPUMatrix<ElemType>& deepCopyFrom)
+{
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::SetValue(const size_t numRows, const size_t numCols, int deviceId, ElemType* pArray, size_t matrixFlags)
 {
@@ -1009,6 +1130,12 @@ void GPUMatrix<ElemType>::SetUniformRandomMask(const ElemType maskRate, const El
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::MultiTensorNormalGrad(const std::vector<GPUMatrix<ElemType>*>& /*functionValues*/, const std::vector<GPUMatrix<ElemType>*>& /*gradients*/,
+                                                const std::vector<GPUMatrix<ElemType>*>& /*smoothedGradients*/, const MultiTensorUpdateDesc& /*desc*/, GPUMatrix<ElemType>& /*workspace*/)
+{
+}
+
 template <class ElemType>
 ElemType GPUMatrix<ElemType>::Adagrad(GPUMatrix<ElemType>& gradients, const bool needAveMultiplier)
 {
@@ -1019,6 +1146,16 @@ void GPUMatrix<ElemType>::FSAdagrad(GPUMatrix<ElemType>& gradients, GPUMatrix<El
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::Adam(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, bool layerwiseAdaptive)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::Lars(GPUMatrix<ElemType>& gradients, GPUMatrix<ElemType>& functionValues, ElemType learnRate, ElemType momentum, ElemType trustCoefficient)
+{
+}
+
 template <class ElemType>
 ElemType GPUMatrix<ElemType>::RmsProp(GPUMatrix<ElemType>& gradients, ElemType RMS_GAMMA, ElemType RMS_WGT_INC, ElemType RMS_WGT_MAX, ElemType RMS_WGT_DEC, ElemType RMS_WGT_MIN, const bool needAveMultiplier)
 {
@@ -1030,6 +1167,11 @@ void GPUMatrix<ElemType>::Reshape(const size_t numRows, const size_t numCols)
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::PlaceInHostMemory()
+{
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::Resize(const size_t numRows, const size_t numCols, bool growOnly)
 {
@@ -1212,6 +1354,12 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::AddElementProductOf(const GPUMatrix<El
     return *this;
 }
 
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignDropoutOf(const GPUMatrix<ElemType>& /*a*/, const double /*dropoutRate*/, const unsigned long /*seed*/, const size_t /*firstElementIndex*/, const bool /*accumulate*/)
+{
+    return *this;
+}
+
 template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::ColumnElementMultiplyWith(const GPUMatrix<ElemType>& /*a*/)
 {
@@ -1229,6 +1377,16 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::ColumnElementDivideBy(const GPUMatrix<
     return *this;
 }
 template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::DoGatherColumnsOf(ElemType /*beta*/, const GPUMatrix<ElemType>& /*idx*/, const GPUMatrix<ElemType>& /*a*/, ElemType /*alpha*/)
+{
+    return *this;
+}
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::DoScatterColumnsOf(ElemType /*beta*/, const GPUMatrix<ElemType>& /*idx*/, const GPUMatrix<ElemType>& /*a*/, ElemType /*alpha*/)
+{
+    return *this;
+}
+template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::RowElementDivideBy(const GPUMatrix<ElemType>& /*a*/)
 {
     return *this;
@@ -1294,6 +1452,12 @@ GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignLogSoftmaxOf(const GPUMatrix<Ele
     return *this;
 }
 
+template <class ElemType>
+GPUMatrix<ElemType>& GPUMatrix<ElemType>::AssignCrossEntropyWithSoftmaxOf(const GPUMatrix<ElemType>& /*labels*/, const GPUMatrix<ElemType>& /*logits*/, GPUMatrix<ElemType>& /*logSumExp*/)
+{
+    return *this;
+}
+
 template <class ElemType>
 GPUMatrix<ElemType>& GPUMatrix<ElemType>::InplaceHardmax(const bool isColWise)
 {
@@ -1497,6 +1661,17 @@ void GPUMatrix<ElemType>::ConductRowElementMultiplyWithShift(const GPUMatrix<Ele
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::CosDistanceWithShiftNeg(const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& invNormA, GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::AddCosDistanceGradientWithShiftNeg(size_t inputIndex, const GPUMatrix<ElemType>& a, const GPUMatrix<ElemType>& b, const GPUMatrix<ElemType>& c, const GPUMatrix<ElemType>& gradientC,
+                                                             const GPUMatrix<ElemType>& invNormA, const GPUMatrix<ElemType>& invNormB, size_t shift, size_t negNumber, GPUMatrix<ElemType>& gradient)
+{
+}
+
 template <class ElemType>
 DeviceBoundNumber<ElemType> GPUMatrix<ElemType>::Sum_AsDeviceBoundNum() const
 {
@@ -1764,6 +1939,11 @@ template <class ElemType>
 void GPUMatrix<ElemType>::Multiply1x1AndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& lhs, const GPUMatrix<ElemType>& rhs, ElemType beta, GPUMatrix<ElemType>& c)
 {
 }
+template <class ElemType>
+void GPUMatrix<ElemType>::BatchMultiplyAndWeightedAdd(ElemType alpha, const GPUMatrix<ElemType>& /*a*/, const bool transposeA, const GPUMatrix<ElemType>& /*b*/, const bool transposeB,
+                                                      ElemType beta, GPUMatrix<ElemType>& c, const size_t batchCount)
+{
+}
 
 template <class ElemType>
 void GPUMatrix<ElemType>::MultiplyAndAdd(const GPUMatrix<ElemType>& /*a*/, const bool transposeA, const GPUMatrix<ElemType>& /*b*/, const bool transposeB, GPUMatrix<ElemType>& c)
@@ -1838,6 +2018,12 @@ void GPUMatrix<ElemType>::AddScaledDifference(const GPUMatrix<ElemType>& /*alpha
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::AddCrossEntropyWithSoftmaxGradient(const GPUMatrix<ElemType>& /*alpha*/, const GPUMatrix<ElemType>& /*labels*/, const GPUMatrix<ElemType>& /*logits*/,
+                                                             const GPUMatrix<ElemType>& /*logSumExp*/, GPUMatrix<ElemType>& c)
+{
+}
+
 /// <summary> c = alpha * (a-b)</summary>
 /// if a, b, c  must have same dim
 /// <param name="alpha">Scalar</param>
@@ -1988,6 +2174,33 @@ ElemType GPUMatrix<ElemType>::LogAddSumOfElements() const
     return ElemType(0);
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::RCRFForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores, GPUMatrix<ElemType>& alpha,
+                                             const int startLbl, const size_t numParallelSequences)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::ViterbiForwardCompute(const GPUMatrix<ElemType>& pos_scores, const GPUMatrix<ElemType>& pair_scores,
+                                                GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& backtrace,
+                                                const int startLbl, const size_t numParallelSequences)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::GMMLogLikelihood(const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                           GPUMatrix<ElemType>& logLikelihood, GPUMatrix<ElemType>& posterior, GPUMatrix<ElemType>& normedDeviation)
+{
+}
+
+template <class ElemType>
+void GPUMatrix<ElemType>::AddGMMLogLikelihoodGradient(const size_t inputIndex, const GPUMatrix<ElemType>& gradient,
+                                                      const GPUMatrix<ElemType>& posterior, const GPUMatrix<ElemType>& normedDeviation,
+                                                      const GPUMatrix<ElemType>& unnormedPrior, const GPUMatrix<ElemType>& mean, const GPUMatrix<ElemType>& logStddev, const GPUMatrix<ElemType>& feature,
+                                                      GPUMatrix<ElemType>& inputGradient)
+{
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::RCRFBackwardCompute(
     const GPUMatrix<ElemType>& alpha, GPUMatrix<ElemType>& beta,
@@ -1996,6 +2209,12 @@ void GPUMatrix<ElemType>::RCRFBackwardCompute(
 {
 }
 
+template <class ElemType>
+void GPUMatrix<ElemType>::LSTMForwardWithState(const GPUMatrix<ElemType>& gates, const GPUMatrix<ElemType>& recurrentWeights, const GPUMatrix<ElemType>& flags,
+                                               GPUMatrix<ElemType>& h, GPUMatrix<ElemType>& c, GPUMatrix<ElemType>& output, const size_t numParallelSequences)
+{
+}
+
 template <class ElemType>
 void GPUMatrix<ElemType>::RCRFTransGrdCompute(const GPUMatrix<ElemType>& lbls,
                                               const GPUMatrix<ElemType>& alpha,
@@ -2115,6 +2334,26 @@ void GPUDataTransferer<ElemType>::WaitForCopyCPUToGPUAsync()
 {
 }
 
+template <class ElemType>
+void GPUDataTransferer<ElemType>::CopyGPUToCPUAfterComputeAsync(ElemType*, size_t, ElemType*)
+{
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::WaitForCopyGPUToCPUOnComputeStream()
+{
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::CopyCPUToGPUAfterComputeAsync(ElemType*, size_t, ElemType*)
+{
+}
+
+template <class ElemType>
+void GPUDataTransferer<ElemType>::WaitForCopyCPUToGPUOnComputeStream()
+{
+}
+
 #pragma endregion GPUDataTransferer functions
 
 template class GPUMatrix<char>;
@@ -2180,8 +2419,56 @@ bool CuDnnConvolutionEngineFactory<ElemType>::IsSupported(DEVICEID_TYPE)
     return false;
 }
 
+template <class ElemType>
+void CuDnnConvolutionEngineFactory<ElemType>::SetAlgorithmCacheFile(const std::wstring&)
+{
+}
+
 template class CuDnnConvolutionEngineFactory<float>;
 template class CuDnnConvolutionEngineFactory<double>;
+
+template <class ElemType>
+struct CuDnnRNNExecutor<ElemType>::Impl
+{
+};
+
+template <class ElemType>
+CuDnnRNNExecutor<ElemType>::CuDnnRNNExecutor(DEVICEID_TYPE, const CuDnnRNNParams&)
+{
+    RuntimeError("The code is compiled with CPUONLY macro.");
+}
+
+template <class ElemType>
+CuDnnRNNExecutor<ElemType>::~CuDnnRNNExecutor()
+{
+}
+
+template <class ElemType>
+bool CuDnnRNNExecutor<ElemType>::IsSupported(DEVICEID_TYPE)
+{
+    return false;
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::ForwardProp(const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                             const std::vector<size_t>&, bool, Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardData(const Matrix<ElemType>&, const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                              Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template <class ElemType>
+void CuDnnRNNExecutor<ElemType>::BackwardWeights(const Matrix<ElemType>&, const Matrix<ElemType>&, Matrix<ElemType>&,
+                                                 const Matrix<ElemType>&, Matrix<ElemType>&)
+{
+}
+
+template class CuDnnRNNExecutor<float>;
+template class CuDnnRNNExecutor<double>;
 }
 }
 }
@@ -2199,7 +2486,25 @@ size_t GPUWatcher::GetFreeMemoryOnCUDADevice(int /*devId*/)
     return 0;
 }
 
+int GPUWatcher::GetNumaNodeOfCUDADevice(int /*devId*/)
+{
+    return -1;
+}
+
+GPUDeviceSample GPUWatcher::Sample(int devId)
+{
+    GPUDeviceSample sample;
+    sample.m_deviceId = devId;
+    return sample;
+}
+
+void GPUWatcher::PrintSample(FILE* /*f*/, const GPUDeviceSample& /*sample*/)
+{
+}
+
 GPUWatcher::GPUWatcher(void)
+    : m_deviceId(-1), m_intervalSeconds(0), m_warnFreeBytes(0), m_stopRequested(false), m_warned(false),
+      m_numSamples(0), m_numUtilizationSamples(0), m_smUtilizationSum(0), m_pcieTxSum(0), m_pcieRxSum(0)
 {
 }
 
@@ -2207,4 +2512,25 @@ GPUWatcher::~GPUWatcher(void)
 {
 }
 
+void GPUWatcher::Start(int /*devId*/, double /*intervalSeconds*/, size_t /*warnFreeMB*/)
+{
+}
+
+void GPUWatcher::Stop()
+{
+}
+
+void GPUWatcher::SamplingLoop()
+{
+}
+
+void GPUWatcher::TakeSample()
+{
+}
+
+GPUDeviceSample GPUWatcher::GetSampleAndReset()
+{
+    return m_sample;
+}
+
 #endif // CPUONLY
@@ -0,0 +1,112 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// PackedWeightMatrix.cpp -- prepacked copy of a weight matrix for products with few columns (low-latency inference on the CPU)
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "PackedWeightMatrix.h"
+#include <algorithm>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// below this many weights, a product is not worth distributing over threads
+static const size_t PackedParallelMinWeights = 1 << 16;
+
+template <class ElemType>
+const size_t PackedWeightMatrix<ElemType>::PanelRows;
+template <class ElemType>
+const size_t PackedWeightMatrix<ElemType>::MaxColumns;
+
+template <class ElemType>
+PackedWeightMatrix<ElemType>::PackedWeightMatrix(const Matrix<ElemType>& weights, bool transpose)
+    : m_numRows(transpose ? weights.GetNumCols() : weights.GetNumRows()), m_numCols(transpose ? weights.GetNumRows() : weights.GetNumCols())
+{
+    if (weights.GetMatrixType() != DENSE || weights.GetDeviceId() != CPUDEVICE)
+        InvalidArgument("PackedWeightMatrix: Only dense matrices on the CPU can be packed.");
+
+    const size_t numPanels = (m_numRows + PanelRows - 1) / PanelRows;
+    m_values.assign(numPanels * m_numCols * PanelRows, 0);
+    const ElemType* pWeights = weights.BufferPointer(); // column-major
+    const size_t ld = weights.GetNumRows();
+#pragma omp parallel for
+    for (long p = 0; p < (long) numPanels; p++)
+    {
+        ElemType* panel = m_values.data() + p * m_numCols * PanelRows;
+        const size_t m0 = p * PanelRows;
+        const size_t rows = std::min(PanelRows, m_numRows - m0);
+        for (size_t k = 0; k < m_numCols; k++)
+            for (size_t r = 0; r < rows; r++)
+                panel[k * PanelRows + r] = transpose ? pWeights[(m0 + r) * ld + k] : pWeights[k * ld + m0 + r];
+    }
+}
+
+// the microkernel: N columns of C for all panels of W
+template <class ElemType>
+template <size_t N>
+void PackedWeightMatrix<ElemType>::MultiplyColumns(const ElemType* pX, ElemType* pC) const
+{
+    const size_t M = m_numRows;
+    const size_t K = m_numCols;
+    const long numPanels = (long) ((M + PanelRows - 1) / PanelRows);
+#pragma omp parallel for if (m_values.size() >= PackedParallelMinWeights)
+    for (long p = 0; p < numPanels; p++)
+    {
+        const ElemType* panel = m_values.data() + p * K * PanelRows;
+        ElemType acc[N][PanelRows] = {};
+        for (size_t k = 0; k < K; k++)
+        {
+            const ElemType* w = panel + k * PanelRows;
+            for (size_t n = 0; n < N; n++)
+            {
+                const ElemType x = pX[n * K + k];
+                for (size_t r = 0; r < PanelRows; r++)
+                    acc[n][r] += w[r] * x;
+            }
+        }
+        const size_t m0 = p * PanelRows;
+        const size_t rows = std::min(PanelRows, M - m0);
+        for (size_t n = 0; n < N; n++)
+            for (size_t r = 0; r < rows; r++)
+                pC[n * M + m0 + r] = acc[n][r];
+    }
+}
+
+template <class ElemType>
+void PackedWeightMatrix<ElemType>::Multiply(const Matrix<ElemType>& X, Matrix<ElemType>& C) const
+{
+    if (X.GetMatrixType() != DENSE || X.GetDeviceId() != CPUDEVICE || C.GetMatrixType() != DENSE || C.GetDeviceId() != CPUDEVICE)
+        InvalidArgument("PackedWeightMatrix::Multiply: Only dense matrices on the CPU are supported.");
+    const size_t M = m_numRows;
+    const size_t K = m_numCols;
+    const size_t N = X.GetNumCols();
+    if (X.GetNumRows() != K || C.GetNumRows() != M || C.GetNumCols() != N)
+        LogicError("PackedWeightMatrix::Multiply: Dimension mismatch ([%d x %d] * [%d x %d] -> [%d x %d]).",
+                   (int) M, (int) K, (int) X.GetNumRows(), (int) N, (int) C.GetNumRows(), (int) C.GetNumCols());
+
+    const ElemType* pX = X.BufferPointer();
+    ElemType* pC = C.BufferPointer();
+    for (size_t n0 = 0; n0 < N; n0 += MaxColumns)
+    {
+        const ElemType* pXn = pX + n0 * K;
+        ElemType* pCn = pC + n0 * M;
+        switch (std::min(MaxColumns, N - n0))
+        {
+        case 1: MultiplyColumns<1>(pXn, pCn); break;
+        case 2: MultiplyColumns<2>(pXn, pCn); break;
+        case 3: MultiplyColumns<3>(pXn, pCn); break;
+        case 4: MultiplyColumns<4>(pXn, pCn); break;
+        case 5: MultiplyColumns<5>(pXn, pCn); break;
+        case 6: MultiplyColumns<6>(pXn, pCn); break;
+        case 7: MultiplyColumns<7>(pXn, pCn); break;
+        case 8: MultiplyColumns<8>(pXn, pCn); break;
+        }
+    }
+}
+
+template class PackedWeightMatrix<float>;
+template class PackedWeightMatrix<double>;
+
+} } }
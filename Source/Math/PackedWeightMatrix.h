@@ -0,0 +1,57 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// PackedWeightMatrix.h -- prepacked copy of a weight matrix for products with few columns (low-latency inference on the CPU)
+//
+#pragma once
+
+#include "Matrix.h"
+#include <vector>
+
+#ifdef _WIN32
+#ifdef MATH_EXPORTS
+#define MATH_API __declspec(dllexport)
+#else
+#define MATH_API __declspec(dllimport)
+#endif
+#else // no DLLs on Linux
+#define MATH_API
+#endif
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// PackedWeightMatrix -- a dense matrix W (or the transpose of one) packed for computing W * X where X has only a few columns
+// A BLAS GEMM spends most of its time on dispatch and on packing W for such products, e.g. when evaluating a single frame.
+// Here, W is packed once into panels of PanelRows rows, each stored k-major (the PanelRows values of column k are contiguous),
+// and Multiply() runs a microkernel that is specialized for the number of columns (1..MaxColumns), which keeps all
+// PanelRows x N accumulators in registers while it streams through the panel. Wider X is done in groups of MaxColumns columns.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class MATH_API PackedWeightMatrix
+{
+public:
+    static const size_t PanelRows = 8;
+    static const size_t MaxColumns = 8; // products with more columns are better left to BLAS
+
+    // pack a dense CPU matrix, or its transpose
+    PackedWeightMatrix(const Matrix<ElemType>& weights, bool transpose);
+
+    size_t GetNumRows() const { return m_numRows; }
+    size_t GetNumCols() const { return m_numCols; }
+
+    // C = W * X, where X and C are dense CPU matrices (or column slices); C must have the right dimensions already
+    void Multiply(const Matrix<ElemType>& X, Matrix<ElemType>& C) const;
+
+private:
+    template <size_t N>
+    void MultiplyColumns(const ElemType* pX, ElemType* pC) const;
+
+    size_t m_numRows;
+    size_t m_numCols;
+    std::vector<ElemType> m_values; // [panel][k][PanelRows], the last panel padded with zeroes
+};
+
+} } }
@@ -226,6 +226,12 @@ DefBinaryOp(ElementwiseProductWithTanhDerivativeFromOutput, a*(1 - b * b));
 DefBinaryOp(ElementwiseProductWithLinearRectifierDerivativeFromOutput, b > 0 ? a : 0);
 DefBinaryOp(ElementwiseProductWithLogDerivativeFromOutput, a* exp_(-b));
 DefBinaryOp(ElementwiseProductWithCosDerivative, a * -sin_(b)); // note: b = input for cos()
+DefBinaryOp(SigmoidOfSum, Sigmoid(a + b));
+DefBinaryOp(TanhOfSum, tanh_(a + b));
+DefBinaryOp(LinearRectifierOfSum, a + b > 0 ? a + b : 0);
+DefBinaryOp(SigmoidOfElementwiseProduct, Sigmoid(a * b));
+DefBinaryOp(TanhOfElementwiseProduct, tanh_(a * b));
+DefBinaryOp(LinearRectifierOfElementwiseProduct, a * b > 0 ? a * b : 0);
 //DefBinaryOp(Index, IndexElement(a, b, i));  // note: this one uses the third argument
 
 #pragma pop_macro("DefBinaryOp")
@@ -241,6 +247,188 @@ DefBinaryOp(ElementwiseProductWithCosDerivative, a * -sin_(b)); // note: b = inp
 DefTernaryOp(Cond, a ? b : c);
 DefTernaryOp(Clip, a < b ? b : (a > c ? c : a));
 #pragma pop_macro("DefTernaryOp")
+
+// -----------------------------------------------------------------------
+// ScaledImagePixel() -- value of output pixel (x, y), channel c, of an 8-bit image scaled to width x height
+// This samples bilinearly like cv::resize(INTER_LINEAR), after mirroring the image if desc.flip is set.
+// Shared by the CPU and GPU implementations of AssignAugmentedImagesOf().
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+DECL ElemType ScaledImagePixel(const unsigned char* buffer, const ImageAugmentationDesc& desc, int width, int height, int channels, int x, int y, int c)
+{
+    const int rows = desc.rows;
+    const int cols = desc.cols;
+    ElemType sx = (x + (ElemType) 0.5) * cols / width - (ElemType) 0.5;
+    ElemType sy = (y + (ElemType) 0.5) * rows / height - (ElemType) 0.5;
+    if (sx < 0)
+        sx = 0;
+    if (sy < 0)
+        sy = 0;
+    int x0 = (int) sx;
+    int y0 = (int) sy;
+    ElemType fx = sx - x0;
+    ElemType fy = sy - y0;
+    if (x0 >= cols - 1)
+    {
+        x0 = cols - 1;
+        fx = 0;
+    }
+    if (y0 >= rows - 1)
+    {
+        y0 = rows - 1;
+        fy = 0;
+    }
+    int x1 = x0 + (fx > 0);
+    int y1 = y0 + (fy > 0);
+    if (desc.flip)
+    {
+        x0 = cols - 1 - x0;
+        x1 = cols - 1 - x1;
+    }
+    const unsigned char* row0 = buffer + desc.offset + (size_t) y0 * cols * channels;
+    const unsigned char* row1 = buffer + desc.offset + (size_t) y1 * cols * channels;
+    ElemType top = (1 - fx) * row0[x0 * channels + c] + fx * row0[x1 * channels + c];
+    ElemType bottom = (1 - fx) * row1[x0 * channels + c] + fx * row1[x1 * channels + c];
+    return (1 - fy) * top + fy * bottom;
+}
+
+// -----------------------------------------------------------------------
+// DropoutKeeps() -- whether dropout keeps element 'index' of a minibatch for a given seed
+// The random number is a counter-based hash (Philox4x32-10) of seed and index, so the forward
+// and backward pass can regenerate the same mask without storing it. Each hash yields four
+// 32-bit lanes, which are used for four consecutive elements. An element is dropped if its
+// lane is below 'threshold' = dropoutRate * 2^32, see DropoutThreshold().
+// Shared by the CPU and GPU implementations of AssignDropoutOf().
+// -----------------------------------------------------------------------
+
+DECL void Philox4x32(unsigned long long seed, unsigned long long counter, unsigned int* lanes /*[4]*/)
+{
+    unsigned int c0 = (unsigned int) counter, c1 = (unsigned int) (counter >> 32), c2 = 0, c3 = 0;
+    unsigned int k0 = (unsigned int) seed, k1 = (unsigned int) (seed >> 32);
+    for (int round = 0; round < 10; round++)
+    {
+        const unsigned long long p0 = 0xD2511F53ull * c0;
+        const unsigned long long p1 = 0xCD9E8D57ull * c2;
+        const unsigned int hi0 = (unsigned int) (p0 >> 32), lo0 = (unsigned int) p0;
+        const unsigned int hi1 = (unsigned int) (p1 >> 32), lo1 = (unsigned int) p1;
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    lanes[0] = c0;
+    lanes[1] = c1;
+    lanes[2] = c2;
+    lanes[3] = c3;
+}
+
+static inline unsigned int DropoutThreshold(double dropoutRate)
+{
+    return (unsigned int) (dropoutRate * 4294967296.0); // dropoutRate < 1, so this fits
+}
+
+DECL bool DropoutKeeps(unsigned long long seed, size_t index, unsigned int threshold)
+{
+    unsigned int lanes[4];
+    Philox4x32(seed, index / 4, lanes);
+    return lanes[index % 4] >= threshold;
+}
+
+// -----------------------------------------------------------------------
+// MultiTensorUpdateOp -- update of one parameter element by Matrix::MultiTensorNormalGrad()
+// w = parameter, g = gradient (updated in place as the step-by-step code does), v = smoothed gradient.
+// 'gradientScale' is the factor from clipping the tensor's Frobenius norm, or 1.
+// Shared by the CPU and GPU implementations.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+struct MultiTensorUpdateOp
+{
+    ElemType learnRatePerSample;
+    ElemType momentum;
+    ElemType L2RegWeight;
+    ElemType L1Threshold;
+    ElemType truncation; // 0 for none
+    bool useNesterovMomentum;
+
+    MultiTensorUpdateOp(const MultiTensorUpdateDesc& desc)
+        : learnRatePerSample((ElemType) desc.learnRatePerSample),
+          momentum((ElemType) desc.momentum),
+          L2RegWeight((ElemType) desc.L2RegWeight),
+          L1Threshold((ElemType) desc.L1Threshold),
+          truncation(desc.clippingWithTruncation ? (ElemType) desc.clippingThreshold : 0),
+          useNesterovMomentum(desc.useNesterovMomentum)
+    {
+    }
+
+    TENSOR_OPS_DECL void operator()(ElemType& w, ElemType& g, ElemType& v, ElemType gradientScale) const
+    {
+        ElemType grad = g * gradientScale;
+        if (truncation > 0)
+            grad = grad < -truncation ? -truncation : (grad > truncation ? truncation : grad);
+        grad += L2RegWeight * w;
+        g = grad;
+        const ElemType step = (1 - momentum) * learnRatePerSample * grad;
+        v = step + momentum * v;
+        ElemType p = useNesterovMomentum ? w - momentum * v - step : w - v;
+        if (L1Threshold > 0)
+            p = p > L1Threshold ? p - L1Threshold : (p < -L1Threshold ? p + L1Threshold : 0);
+        w = p;
+    }
+};
+
+// -----------------------------------------------------------------------
+// AdamUpdateOp -- moment update of one parameter element by Matrix::Adam() (Adam and LAMB)
+// Updates the moments m and v in place and returns the direction r = mHat / (sqrt(vHat) + epsilon) + weightDecay * w,
+// which Adam applies as is, and LAMB after scaling by the trust ratio of the whole tensor.
+// 'step' is the 1-based update count of the tensor, for the bias correction of the moments.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+struct AdamUpdateOp
+{
+    ElemType beta1;
+    ElemType beta2;
+    ElemType epsilon;
+    ElemType weightDecay;
+    ElemType biasCorrection1; // 1 - beta1^step
+    ElemType biasCorrection2; // 1 - beta2^step
+
+    TENSOR_OPS_DECL AdamUpdateOp(ElemType beta1, ElemType beta2, ElemType epsilon, ElemType weightDecay, ElemType step)
+        : beta1(beta1), beta2(beta2), epsilon(epsilon), weightDecay(weightDecay),
+          biasCorrection1(1 - exp_(step * log_(beta1))),
+          biasCorrection2(1 - exp_(step * log_(beta2)))
+    {
+    }
+
+    TENSOR_OPS_DECL ElemType operator()(ElemType g, ElemType& m, ElemType& v, ElemType w) const
+    {
+        m = beta1 * m + (1 - beta1) * g;
+        v = beta2 * v + (1 - beta2) * g * g;
+        return (m / biasCorrection1) / (sqrt_(v / biasCorrection2) + epsilon) + weightDecay * w;
+    }
+};
+
+// the state of Matrix::Adam(): first moments [n], second moments [n], update count, two scratch elements (LAMB norms)
+static inline size_t AdamStateSize(size_t numElements)
+{
+    return 2 * numElements + 3;
+}
+// the state of Matrix::Lars(): smoothed gradient [n], two scratch elements (norms)
+static inline size_t LarsStateSize(size_t numElements)
+{
+    return numElements + 2;
+}
+
+// trust ratio of LAMB and LARS: coefficient * ||w|| / ||r||, or 1 if either is 0 (e.g. for biases that start at 0)
+template <class ElemType>
+DECL ElemType LayerwiseTrustRatio(ElemType sumOfSquaresW, ElemType sumOfSquaresR, ElemType coefficient)
+{
+    return sumOfSquaresW > 0 && sumOfSquaresR > 0 ? coefficient * sqrt_(sumOfSquaresW / sumOfSquaresR) : 1;
+}
 }
 }
 }
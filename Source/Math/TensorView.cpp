@@ -216,6 +216,85 @@ static void PrepareTensorOperands(array<TensorShape, N> shapes, array<size_t, N>
         offsets[i] = shapes[i].GetOffset();
 }
 
+// -------------------------------------------------------------------
+// memoization of PrepareTensorOperands()
+// The preparation above (padding, flattening, broadcasting checks) depends only on the operands' dimensions and strides,
+// which for a given node change only with the minibatch dimensions; in loops, only the offsets change from step to step.
+// Yet nodes run it in every ForwardProp() and BackpropTo(). So the prepared plans are kept in a small direct-mapped
+// per-thread cache keyed by dimensions and strides, and only the offsets are taken from the operands each time.
+// -------------------------------------------------------------------
+
+template <size_t N>
+struct TensorOpPlan
+{
+    bool m_valid;
+    array<SmallVector<size_t>, N> m_dims; // (key)
+    array<SmallVector<ptrdiff_t>, N> m_strides;
+    SmallVector<size_t> m_regularOpDims, m_reducingOpDims;
+    array<SmallVector<ptrdiff_t>, N> m_regularStrides, m_reducingStrides;
+    TensorOpPlan() : m_valid(false) { }
+};
+
+template <size_t N>
+struct TensorOpPlanCache
+{
+    static const size_t numEntries = 64;
+    TensorOpPlan<N> m_entries[numEntries];
+};
+
+// (one per thread and arity; not freed when a thread ends, like TimelineTrace's thread buffers)
+template <size_t N>
+static TensorOpPlanCache<N>& GetTensorOpPlanCache()
+{
+#ifdef _WIN32
+    static __declspec(thread) TensorOpPlanCache<N>* t_cache = nullptr;
+#else
+    static __thread TensorOpPlanCache<N>* t_cache = nullptr;
+#endif
+    if (!t_cache)
+        t_cache = new TensorOpPlanCache<N>();
+    return *t_cache;
+}
+
+template <class ElemType, size_t N>
+static void PrepareTensorOperandsCached(const array<TensorShape, N>& shapes, array<size_t, N>& offsets,
+                                        SmallVector<size_t>& regularOpDims,
+                                        array<SmallVector<ptrdiff_t>, N>& regularStrides,
+                                        SmallVector<size_t>& reducingOpDims,
+                                        array<SmallVector<ptrdiff_t>, N>& reducingStrides)
+{
+    size_t hash = N;
+    for (size_t i = 0; i < N; i++)
+    {
+        const auto& dims = shapes[i].GetDims();
+        const auto& strides = shapes[i].GetStrides();
+        hash = hash * 31 + dims.size();
+        for (size_t k = 0; k < dims.size(); k++)
+            hash = (hash * 31 + dims[k]) * 31 + (size_t) strides[k];
+    }
+    auto& plan = GetTensorOpPlanCache<N>().m_entries[hash % TensorOpPlanCache<N>::numEntries];
+    bool hit = plan.m_valid;
+    for (size_t i = 0; i < N && hit; i++)
+        hit = plan.m_dims[i] == shapes[i].GetDims() && plan.m_strides[i] == shapes[i].GetStrides();
+    if (!hit)
+    {
+        plan.m_valid = false; // (in case this throws)
+        PrepareTensorOperands<ElemType, N>(shapes, offsets, plan.m_regularOpDims, plan.m_regularStrides, plan.m_reducingOpDims, plan.m_reducingStrides);
+        for (size_t i = 0; i < N; i++)
+        {
+            plan.m_dims[i] = shapes[i].GetDims();
+            plan.m_strides[i] = shapes[i].GetStrides();
+        }
+        plan.m_valid = true;
+    }
+    regularOpDims = plan.m_regularOpDims;
+    regularStrides = plan.m_regularStrides;
+    reducingOpDims = plan.m_reducingOpDims;
+    reducingStrides = plan.m_reducingStrides;
+    for (size_t i = 0; i < N; i++)
+        offsets[i] = shapes[i].GetOffset(); // (not changed by the preparation)
+}
+
 // enforce that in case of broadcasting, the output must not be an input
 template <class ElemType>
 static bool CheckDifferentObject(const TensorView<ElemType>& a, const TensorView<ElemType>& b)
@@ -235,7 +314,7 @@ void TensorView<ElemType>::DoUnaryOpOf(ElemType beta, const TensorView& a, ElemT
     array<size_t, 2> offsets;
     array<SmallVector<ptrdiff_t>, 2> regularStrides, reducingStrides;
     SmallVector<size_t> regularOpDims, reducingOpDims;
-    PrepareTensorOperands<ElemType, 2>(array<TensorShape, 2>{a.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    PrepareTensorOperandsCached<ElemType, 2>(array<TensorShape, 2>{a.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
 
     // output cannot be input when reducing
     if (reducingOpDims.size() > 0)
@@ -254,7 +333,7 @@ void TensorView<ElemType>::DoBinaryOpOf(ElemType beta, const TensorView& a, cons
     array<size_t, 3> offsets;
     array<SmallVector<ptrdiff_t>, 3> regularStrides, reducingStrides;
     SmallVector<size_t> regularOpDims, reducingOpDims;
-    PrepareTensorOperands<ElemType, 3>(array<TensorShape, 3>{a.GetShape(), b.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    PrepareTensorOperandsCached<ElemType, 3>(array<TensorShape, 3>{a.GetShape(), b.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
 
     // output cannot be input when reducing
     if (reducingOpDims.size() > 0)
@@ -272,7 +351,7 @@ void TensorView<ElemType>::DoTernaryOpOf(ElemType beta, const TensorView& a, con
     array<size_t, 4> offsets;
     array<SmallVector<ptrdiff_t>, 4> regularStrides, reducingStrides;
     SmallVector<size_t> regularOpDims, reducingOpDims;
-    PrepareTensorOperands<ElemType, 4>(array<TensorShape, 4>{a.GetShape(), b.GetShape(), c.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
+    PrepareTensorOperandsCached<ElemType, 4>(array<TensorShape, 4>{a.GetShape(), b.GetShape(), c.GetShape(), GetShape()}, offsets, regularOpDims, regularStrides, reducingOpDims, reducingStrides);
 
     // output cannot be input when reducing
     if (reducingOpDims.size() > 0)
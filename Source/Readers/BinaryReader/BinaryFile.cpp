@@ -8,8 +8,16 @@
 #include "stdafx.h"
 #include "DataReader.h"
 #include "BinaryReader.h"
+#include <float.h>
 #include <limits.h>
 #include <stdint.h>
+#ifndef __WINDOWS__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -29,22 +37,21 @@ DWORD LODWORD(size_t size)
 // size - size of the file to map, will expand/contract existing files to given size. zero means keep current size
 BinaryFile::BinaryFile(std::wstring fileName, FileOptions options, size_t size)
 {
+    m_writeFile = options == fileOptionsReadWrite;
+    m_name = fileName;
+    m_maxViewSize = 0x10000000; // 256MB initial max size
 
+#ifdef __WINDOWS__
     SYSTEM_INFO sysInfo;
     GetSystemInfo(&sysInfo);
     m_viewAlignment = sysInfo.dwAllocationGranularity;
     /* If file created, continue to map file. */
 
-    m_writeFile = options == fileOptionsReadWrite;
-    m_name = fileName;
-    m_maxViewSize = 0x10000000; // 256MB initial max size
     m_hndFile = CreateFile(fileName.c_str(), m_writeFile ? (GENERIC_WRITE | GENERIC_READ) : GENERIC_READ,
                            FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
     if (m_hndFile == INVALID_HANDLE_VALUE)
     {
-        char message[256];
-        sprintf_s(message, "Unable to Open/Create file %ls, error %x", fileName.c_str(), GetLastError());
-        RuntimeError(message);
+        RuntimeError("Unable to Open/Create file %ls, error %x", fileName.c_str(), GetLastError());
     }
 
     // code to detect type of file (network/local)
@@ -70,10 +77,24 @@ BinaryFile::BinaryFile(std::wstring fileName, FileOptions options, size_t size)
                           NULL);
     if (m_hndMapped == NULL)
     {
-        char message[256];
-        sprintf_s(message, "Unable to map file %ls, error 0x%x", fileName.c_str(), GetLastError());
-        RuntimeError(message);
+        RuntimeError("Unable to map file %ls, error 0x%x", fileName.c_str(), GetLastError());
     }
+#else
+    m_viewAlignment = sysconf(_SC_PAGESIZE);
+    m_fd = open(wtocharpath(fileName).c_str(), m_writeFile ? (O_RDWR | O_CREAT) : O_RDONLY, 0666);
+    if (m_fd < 0)
+        RuntimeError("Unable to Open/Create file %ls, error %d", fileName.c_str(), errno);
+
+    // get the actual size of the file, or make the file the requested size, so that views may be mapped anywhere within it
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0)
+        RuntimeError("Unable to get size of file %ls, error %d", fileName.c_str(), errno);
+    if (size == 0)
+        size = fileStat.st_size;
+    else if (m_writeFile && (size_t) fileStat.st_size < size && ftruncate(m_fd, size) != 0)
+        RuntimeError("Unable to extend file %ls to %zu bytes, error %d", fileName.c_str(), size, errno);
+    m_filePositionMax = size;
+#endif
     m_mappedSize = size;
 
     // if writing the file, the inital size of the file is zero
@@ -91,6 +112,7 @@ BinaryFile::~BinaryFile()
         // the view
         iter = ReleaseView(iter, true);
     }
+#ifdef __WINDOWS__
     CloseHandle(m_hndMapped);
 
     // if we are writing the file, truncate to actual size
@@ -100,6 +122,12 @@ BinaryFile::~BinaryFile()
         SetEndOfFile(m_hndFile);
     }
     CloseHandle(m_hndFile);
+#else
+    // if we are writing the file, truncate to actual size
+    if (m_writeFile && ftruncate(m_fd, m_filePositionMax) != 0)
+        fprintf(stderr, "Warning: unable to truncate file %ls, error %d\n", m_name.c_str(), errno);
+    close(m_fd);
+#endif
 }
 
 void BinaryFile::SetFilePositionMax(size_t filePositionMax)
@@ -107,9 +135,7 @@ void BinaryFile::SetFilePositionMax(size_t filePositionMax)
     m_filePositionMax = filePositionMax;
     if (m_filePositionMax > m_mappedSize)
     {
-        char message[128];
-        sprintf_s(message, "Setting max position larger than mapped file size: %ld > %ld", m_filePositionMax, m_mappedSize);
-        RuntimeError(message);
+        RuntimeError("Setting max position larger than mapped file size: %ld > %ld", m_filePositionMax, m_mappedSize);
     }
 }
 
@@ -144,7 +170,7 @@ vector<ViewPosition>::iterator BinaryFile::FindDataView(void* data)
     auto iter = m_views.begin();
     for (; iter != m_views.end(); ++iter)
     {
-        byte* viewBegin = (byte*) iter->view;
+        BYTE* viewBegin = (BYTE*) iter->view;
         if (viewBegin <= data && viewBegin + iter->size > data)
             break;
     }
@@ -191,10 +217,16 @@ vector<ViewPosition>::iterator BinaryFile::ReleaseView(vector<ViewPosition>::ite
     }
     else
     {
+#ifdef __WINDOWS__
         if (m_writeFile)
             FlushViewOfFile(iter->view, iter->size);
         bool ret = UnmapViewOfFile(iter->view) != FALSE;
         ret;
+#else
+        if (m_writeFile)
+            msync(iter->view, iter->size, MS_ASYNC);
+        munmap(iter->view, iter->size);
+#endif
         iter = m_views.erase(iter);
     }
     return iter;
@@ -206,6 +238,7 @@ vector<ViewPosition>::iterator BinaryFile::ReleaseView(vector<ViewPosition>::ite
 // returns - pointer to the view
 void* BinaryFile::GetView(size_t filePosition, size_t size)
 {
+#ifdef __WINDOWS__
     void* pBuf = MapViewOfFile(m_hndMapped,                                  // handle to map object
                                m_writeFile ? FILE_MAP_WRITE : FILE_MAP_READ, // get correct permissions
                                HIDWORD(filePosition),
@@ -213,10 +246,16 @@ void* BinaryFile::GetView(size_t filePosition, size_t size)
                                size);
     if (pBuf == NULL)
     {
-        char message[128];
-        sprintf_s(message, "Unable to map file %ls @ %lld, error %x", m_name.c_str(), filePosition, GetLastError());
-        RuntimeError(message);
+        RuntimeError("Unable to map file %ls @ %lld, error %x", m_name.c_str(), filePosition, GetLastError());
     }
+#else
+    // like MapViewOfFile(), don't map past the end of the mapping (touching such pages would raise SIGBUS instead of failing here)
+    if (filePosition % m_viewAlignment != 0 || filePosition + size > m_mappedSize)
+        RuntimeError("Unable to map file %ls @ %zu, size %zu exceeds the file size %zu or is not aligned", m_name.c_str(), filePosition, size, m_mappedSize);
+    void* pBuf = mmap(NULL, size, m_writeFile ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fd, filePosition);
+    if (pBuf == MAP_FAILED)
+        RuntimeError("Unable to map file %ls @ %zu, error %d", m_name.c_str(), filePosition, errno);
+#endif
     m_views.push_back(ViewPosition(pBuf, filePosition, size));
 
     // update file position max if neccesary
@@ -303,7 +342,7 @@ void* BinaryFile::EnsureMapped(void* data, size_t size)
     auto viewPos = FindDataView(data);
     if (viewPos != m_views.end())
     {
-        int64_t offset = (byte*) data - (byte*) viewPos->view;
+        int64_t offset = (BYTE*) data - (BYTE*) viewPos->view;
         int64_t dataEnd = offset + size;
 
         // if our end of data is beyond the size of the view, need to reallocate
@@ -312,7 +351,7 @@ void* BinaryFile::EnsureMapped(void* data, size_t size)
             // TODO: this view change only accomidates this request
             size_t filePosition = viewPos->filePosition;
             ReleaseView(viewPos);
-            byte* view = (byte*) GetView(filePosition, dataEnd);
+            BYTE* view = (BYTE*) GetView(filePosition, dataEnd);
             data = view + offset;
         }
     }
@@ -340,7 +379,7 @@ size_t BinaryFile::RoundUp(size_t filePosition)
 SectionFile::SectionFile(std::wstring fileName, FileOptions options, size_t size)
     : BinaryFile(fileName, options, size)
 {
-    m_fileSection = new Section(this, 0, NULL, mappingFile, sectionHeaderMin);
+    m_fileSection = new Section(this, NULL, 0, mappingFile, sectionHeaderMin);
     if (m_writeFile)
     {
         m_fileSection->InitHeader(sectionTypeFile, string("Binary Data File"), sectionDataNone, 0);
@@ -349,9 +388,7 @@ SectionFile::SectionFile(std::wstring fileName, FileOptions options, size_t size
     // check for a file header
     if (!m_fileSection->ValidateHeader(m_writeFile))
     {
-        char message[128];
-        sprintf_s(message, "Invalid File format for binary file %ls", fileName.c_str());
-        RuntimeError(message);
+        RuntimeError("Invalid File format for binary file %ls", fileName.c_str());
     }
 }
 
@@ -389,7 +426,7 @@ void Section::InitHeader(SectionType type, std::string description, SectionData
     m_sectionHeader->flags = flagNone;                                                  // bit flags, dependent on sectionType
     m_sectionHeader->elementsCount = 0;                                                 // number of total elements stored
     memset(m_sectionHeader->nameDescription, 0, descriptionSize);                       // clear out the string buffer to all zeros first
-    strcpy_s(m_sectionHeader->nameDescription, description.c_str());                    // name and description of section contents in this format (name: description) (string, with extra bytes zeroed out, at least one null terminator required)
+    strcpy_s(m_sectionHeader->nameDescription, descriptionSize, description.c_str());    // name and description of section contents in this format (name: description) (string, with extra bytes zeroed out, at least one null terminator required)
     m_sectionHeader->size = sectionHeaderMin;                                           // size of this section (including header)
     m_sectionHeader->sizeAll = sectionHeaderMin;                                        // size of this section (including header and all sub-sections)
     m_sectionHeader->sectionFilePosition[0] = 0;                                        // sub-section file offsets (if needed), assumed to be in File Position order
@@ -497,9 +534,7 @@ Section* Section::ReadSection(size_t index, MappingType mapping, size_t sizeElem
     // make sure the header is valid
     if (!section->ValidateHeader())
     {
-        char message[256];
-        sprintf_s(message, "Invalid header in file %ls, in header %s\n", m_file->GetName(), section->GetName());
-        RuntimeError(message);
+        RuntimeError("Invalid header in file %ls, in header %ls\n", m_file->GetName().c_str(), section->GetName().c_str());
     }
 
     // setup the element mapping and pointers as needed
@@ -536,9 +571,7 @@ char* Section::EnsureElements(size_t element, size_t bytesRequested)
     size_t elementsRequested = bytesRequested / GetElementSize();
     if (element + elementsRequested > GetElementCount())
     {
-        char message[256];
-        sprintf_s(message, "Element out of range, error accesing element %lld, size=%lld\n", element, bytesRequested);
-        RuntimeError(message);
+        RuntimeError("Element out of range, error accesing element %lld, size=%lld\n", element, bytesRequested);
     }
 
     // make sure we have the buffer in the range to handle the request
@@ -559,9 +592,7 @@ char* Section::GetElementBuffer(size_t element, size_t windowSize)
     // check element range
     if (!m_file->Writing() && element >= GetElementCount())
     {
-        char message[256];
-        sprintf_s(message, "Element out of range, error accesing element %lld, max element=%lld\n", element, GetElementCount());
-        RuntimeError(message);
+        RuntimeError("Element out of range, error accesing element %lld, max element=%lld\n", element, GetElementCount());
     }
 
     // section is mapped as a whole, so no separate mapping for element buffer
@@ -700,7 +731,7 @@ void* Section::EnsureMapped(void* dataStart, size_t size)
         // Element Window is mapped separately so won't no need to remap
         if (m_mappingType != mappingElementWindow)
         {
-            int64_t offset = (byte*) view - (byte*) dataStart;
+            int64_t offset = (BYTE*) view - (BYTE*) dataStart;
             m_sectionHeader = (SectionHeader*) ((char*) m_sectionHeader + offset);
             m_elementBuffer = (char*) m_sectionHeader + m_sectionHeader->sizeHeader;
             RemapHeader(m_sectionHeader, m_filePosition);
@@ -1069,9 +1100,7 @@ void SectionString::SetLabelMapping(const std::map<SectionString::LabelIdType, S
         auto iter = labelMapping.find(i);
         if (iter == labelMapping.end())
         {
-            char message[256];
-            sprintf_s(message, "Mapping table doesn't contain an entry for label Id#%d\n", i);
-            RuntimeError(message);
+            RuntimeError("Mapping table doesn't contain an entry for label Id#%d\n", i);
         }
 
         // add to reverse mapping table
@@ -1081,9 +1110,7 @@ void SectionString::SetLabelMapping(const std::map<SectionString::LabelIdType, S
         errno_t err = strcpy_s(curStr, size, str.c_str());
         if (err)
         {
-            char message[256];
-            sprintf_s(message, "Not enough room in mapping buffer, %lld bytes insufficient for string %d - %s\n", originalSize, i, str.c_str());
-            RuntimeError(message);
+            RuntimeError("Not enough room in mapping buffer, %lld bytes insufficient for string %d - %s\n", originalSize, i, str.c_str());
         }
         size_t len = str.length() + 1; // don't forget the null
         size -= len;
@@ -1103,9 +1130,7 @@ void* SectionString::GetElement(size_t index) const
     char* str = (char*) m_elementBuffer;
     if (index >= GetElementCount())
     {
-        char message[256];
-        sprintf_s(message, "GetElement: invalid index, %lld requested when there are only %lld elements\n", index, GetElementCount());
-        RuntimeError(message);
+        RuntimeError("GetElement: invalid index, %lld requested when there are only %lld elements\n", index, GetElementCount());
     }
 
     // now skip all the strings before the one that we want
@@ -1129,9 +1154,7 @@ char* SectionString::EnsureElements(size_t element, size_t bytesRequested)
     assert(GetMappingType() != mappingElementWindow); // not supported for string tables currently
     if (element >= GetElementCount())
     {
-        char message[256];
-        sprintf_s(message, "Element out of range, error accesing element %lld, size=%lld\n", element, bytesRequested);
-        RuntimeError(message);
+        RuntimeError("Element out of range, error accesing element %lld, size=%lld\n", element, bytesRequested);
     }
 
     // make sure we have the buffer in the range to handle the request
@@ -1220,7 +1243,7 @@ void SectionStats::InitCompute(const ConfigArray& compute)
     {
         std::string name = compute[i];
         auto stat = GetElement<NumericStatistics>(i);
-        strcpy_s(stat->statistic, name.c_str());
+        strcpy_s(stat->statistic, sizeof(stat->statistic), name.c_str());
         stat->value = 0.0;
     }
 
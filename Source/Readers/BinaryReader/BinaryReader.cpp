@@ -52,6 +52,9 @@ void BinaryReader<ElemType>::LoadSections(Section* sectionRoot, MappingType mapp
 //  # reader to use
 //  readerType=BinaryReader
 //  miniBatchMode=Partial
+//  # read chunks of 65536 records in a different random order every sweep (default: randomize=None)
+//  randomize=Auto
+//  chunkSize=65536
 //  file={,
 //    c:\speech\mnist\mnist_features.bin
 //      c:\speech\mnist\mnist_labels.bin
@@ -128,6 +131,23 @@ void BinaryReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig
     std::string minibatchMode(readerConfig(L"minibatchMode", "Partial"));
     m_partialMinibatch = !_stricmp(minibatchMode.c_str(), "Partial");
 
+    // randomize=auto (or a randomization range, as given to the text readers) reads the chunks of records in a different order each sweep
+    m_randomizeChunks = false;
+    if (readerConfig.Exists(L"randomize"))
+    {
+        std::string randomizeString = readerConfig(L"randomize");
+        m_randomizeChunks = _stricmp(randomizeString.c_str(), "none") && randomizeString != "0";
+    }
+    m_chunkSize = readerConfig(L"chunkSize", (size_t) 65536);
+    if (m_chunkSize == 0)
+        InvalidArgument("BinaryReader: chunkSize must be at least 1");
+    if (m_randomizeChunks && !mOneLinePerFile && m_totalSamples > 0)
+    {
+        size_t numChunks = (m_totalSamples + m_chunkSize - 1) / m_chunkSize;
+        m_chunkOrdering.Resize(numChunks, 2 * numChunks); // (a range of twice the size allows any chunk to move anywhere)
+    }
+    m_chunkOrderSweep = SIZE_MAX;
+
     // Initial load is complete
     DisplayProperties();
 }
@@ -264,6 +284,16 @@ bool BinaryReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType
     if (endOfDataset)
         return false;
 
+    // where the records of this minibatch are in the file (one contiguous run unless randomizing chunks)
+    vector<std::pair<size_t, size_t>> runs;
+    if (m_randomizeChunks)
+    {
+        RandomizeChunks(m_mbStartSample / m_totalSamples);
+        GetRecordRuns(epochStartSample, actualmbsize, runs);
+    }
+    else
+        runs.push_back(std::make_pair(epochStartSample, actualmbsize));
+
     for (auto value : matrices)
     {
         wstring matrixName = value.first;
@@ -313,17 +343,34 @@ bool BinaryReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType
                 RuntimeError("Category Labels not saved in file, either save, or support creation in BinaryReader");
             }
         }
-        size_t size = rows * dataSize * actualmbsize;
-        size_t index = epochStartSample * section->GetElementsPerRecord();
-        ElemType* data = (ElemType*) section->EnsureElements(index, size);
-        // ElemType* data = section->GetElement<ElemType>(epochStartSample*section->GetElementsPerRecord());
-        // data = (ElemType*)section->EnsureMapped(data, size);
-
         // make sure that the data is as expected
         if (!!(section->GetFlags() & flagAuxilarySection) || section->GetElementSize() != sizeof(ElemType))
         {
             RuntimeError("GetMinibatch: Section %ls Auxilary section specified, and/or element size %lld mismatch", section->GetName().c_str(), section->GetElementSize());
         }
+
+        ElemType* data;
+        if (runs.size() == 1) // contiguous: take it straight from the mapped file
+        {
+            size_t size = rows * dataSize * actualmbsize;
+            size_t index = runs[0].first * section->GetElementsPerRecord();
+            data = (ElemType*) section->EnsureElements(index, size);
+            // ElemType* data = section->GetElement<ElemType>(epochStartSample*section->GetElementsPerRecord());
+            // data = (ElemType*)section->EnsureMapped(data, size);
+        }
+        else // spans chunks: copy the pieces together
+        {
+            m_gatherBuffer.resize(rows * actualmbsize);
+            data = m_gatherBuffer.data();
+            size_t column = 0;
+            for (const auto& run : runs)
+            {
+                size_t size = rows * dataSize * run.second;
+                size_t index = run.first * section->GetElementsPerRecord();
+                memcpy(data + rows * column, section->EnsureElements(index, size), size);
+                column += run.second;
+            }
+        }
         gpuData->SetValue(rows, actualmbsize, gpuData->GetDeviceId(), data);
     }
 
@@ -334,6 +381,48 @@ bool BinaryReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType
     return true;
 }
 
+// RandomizeChunks - determine the order in which the chunks are read in a sweep
+// sweep - sweep number through the data set, used as the random seed
+template <class ElemType>
+void BinaryReader<ElemType>::RandomizeChunks(size_t sweep)
+{
+    if (sweep == m_chunkOrderSweep)
+        return;
+
+    size_t numChunks = (m_totalSamples + m_chunkSize - 1) / m_chunkSize;
+    const auto& ordering = m_chunkOrdering(sweep);
+    m_chunkOrder.assign(ordering.begin(), ordering.end());
+    assert(m_chunkOrder.size() == numChunks);
+    m_chunkStarts.resize(numChunks + 1);
+    m_chunkStarts[0] = 0;
+    for (size_t k = 0; k < numChunks; k++)
+    {
+        size_t chunkBegin = m_chunkOrder[k] * m_chunkSize;
+        m_chunkStarts[k + 1] = m_chunkStarts[k] + min(m_chunkSize, m_totalSamples - chunkBegin);
+    }
+    m_chunkOrderSweep = sweep;
+}
+
+// GetRecordRuns - find the records in the file for a range of samples of the current sweep
+// sampleStart - first sample (within the sweep)
+// numSamples - number of samples, must not go past the end of the sweep
+// runs - [out] (first record, number of records) of each contiguous piece in the file
+template <class ElemType>
+void BinaryReader<ElemType>::GetRecordRuns(size_t sampleStart, size_t numSamples, vector<std::pair<size_t, size_t>>& runs)
+{
+    runs.clear();
+    size_t k = std::upper_bound(m_chunkStarts.begin(), m_chunkStarts.end(), sampleStart) - m_chunkStarts.begin() - 1;
+    while (numSamples > 0)
+    {
+        size_t offset = sampleStart - m_chunkStarts[k];
+        size_t count = min(numSamples, m_chunkStarts[k + 1] - sampleStart);
+        runs.push_back(std::make_pair(m_chunkOrder[k] * m_chunkSize + offset, count));
+        sampleStart += count;
+        numSamples -= count;
+        k++;
+    }
+}
+
 //SetupEpoch - Setup the proper position in the file, and other variable settings to start a particular epoch
 template <class ElemType>
 void BinaryReader<ElemType>::SetupEpoch()
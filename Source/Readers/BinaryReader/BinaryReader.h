@@ -8,6 +8,7 @@
 #include "DataReader.h"
 #include "DataWriter.h"
 #include "Config.h"
+#include "RandomOrdering.h"
 #include <string>
 #include <map>
 #include <vector>
@@ -130,8 +131,12 @@ struct ViewPosition
 class BinaryFile
 {
 protected:
+#ifdef __WINDOWS__
     HANDLE m_hndFile;         // handle to the file
     HANDLE m_hndMapped;       // handle to the mapped file object
+#else
+    int m_fd;                 // file descriptor of the file (views are mapped with mmap())
+#endif
     size_t m_mappedSize;      // size of mapped file (zero for size of file being read)
     size_t m_maxViewSize;     // maximum size we want a single view to contain
     size_t m_viewAlignment;   // address alignment required by views
@@ -567,7 +572,19 @@ private:
     size_t m_dim;
     vector<FILE*> m_fStream;
 
+    // chunk randomization: each sweep reads the records in chunks of m_chunkSize consecutive records, in a random order of the chunks
+    // This keeps the accesses to the mapped file sequential within a chunk.
+    bool m_randomizeChunks;
+    size_t m_chunkSize;
+    RandomOrdering m_chunkOrdering;
+    vector<size_t> m_chunkOrder;   // [k] -> chunk read k-th in the current sweep
+    vector<size_t> m_chunkStarts;  // [k] -> first sample of the k-th chunk within the sweep (plus the end)
+    size_t m_chunkOrderSweep;      // sweep m_chunkOrder and m_chunkStarts were computed for
+    vector<ElemType> m_gatherBuffer; // minibatches that span chunks are copied together here
+
     void SetupEpoch();
+    void RandomizeChunks(size_t sweep);
+    void GetRecordRuns(size_t sampleStart, size_t numSamples, vector<std::pair<size_t, size_t>>& runs);
     void LoadSections(Section* parentSection, MappingType mapping, size_t windowSize);
     void DisplayProperties();
     bool CheckEndDataset(size_t actualmbsize);
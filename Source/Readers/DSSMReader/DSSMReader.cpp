@@ -13,24 +13,34 @@
 #include <vld.h> // leak detection
 #endif
 #include "fileutil.h" // for fexists()
+#include <random>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
-DWORD HIDWORD(size_t size)
-{
-    return size >> 32;
-}
-DWORD LODWORD(size_t size)
-{
-    return size & 0xFFFFFFFF;
-}
+// default number of consecutive rows shuffled together for randomize=Auto
+static const size_t randomizeAutoWindow = 1024 * 1024;
 
-std::string ws2s(const std::wstring& wstr)
+// GetShardFiles - the files of one input: 'fileList', a text file with one shard per line, or a single 'file'
+static std::vector<std::wstring> GetShardFiles(const ConfigParameters& config)
 {
-    int size_needed = WideCharToMultiByte(CP_ACP, 0, wstr.c_str(), int(wstr.length() + 1), 0, 0, 0, 0);
-    std::string strTo(size_needed, 0);
-    WideCharToMultiByte(CP_ACP, 0, wstr.c_str(), int(wstr.length() + 1), &strTo[0], size_needed, 0, 0);
-    return strTo;
+    std::vector<std::wstring> files;
+    if (config.Exists(L"fileList"))
+    {
+        std::wstring fileList = config(L"fileList");
+        for (const auto& line : msra::files::fgetfilelines(fileList))
+        {
+            if (!line.empty())
+                files.push_back(msra::strfun::utf16(line));
+        }
+        if (files.empty())
+            RuntimeError("DSSMReader: file list %ls is empty", fileList.c_str());
+    }
+    else
+    {
+        std::wstring file = config(L"file");
+        files.push_back(file);
+    }
+    return files;
 }
 
 template <class ElemType>
@@ -125,11 +135,16 @@ void DSSMReader<ElemType>::Destroy()
 //  # reader to use
 //  readerType=DSSMReader
 //  miniBatchMode=Partial
+//  # shuffle the query/doc pairs within windows of this many rows (Auto: 1M rows)
 //  randomize=None
+//  # gather the next minibatch on a background thread (default)
+//  prefetch=true
 //  features=[
 //    dim=784
 //    start=1
 //    file=c:\speech\mnist\mnist_test.txt
+//    # or the shards of the input, one file per line, read in this order
+//    # fileList=c:\speech\mnist\shards.txt
 //  ]
 //  labels=[
 //    dim=1
@@ -171,7 +186,7 @@ void DSSMReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig)
     m_labelIdMax = m_labelDim = 0;
     m_partialMinibatch = m_endReached = false;
     m_labelType = labelCategory;
-    m_readNextSample = 0;
+    m_epochEndSample = 0;
     m_traceLevel = readerConfig(L"traceLevel", 0);
 
     if (readerConfig.Exists(L"randomize"))
@@ -196,6 +211,15 @@ void DSSMReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig)
         m_randomizeRange = randomizeNone;
     }
 
+    // randomize=Auto or a number of rows shuffles the query/doc pairs within windows of that many consecutive rows, anew every sweep.
+    // Besides the usual SGD benefit, that gives CosDistanceWithNegativeSamples, which takes the docs of neighboring columns as
+    // negative samples, different negatives for each query every sweep.
+    m_randomizeWindow = m_randomizeRange == randomizeAuto ? randomizeAutoWindow : m_randomizeRange;
+    m_windowId = SIZE_MAX;
+
+    // prefetch=true (default) gathers the next minibatch on a background thread
+    m_prefetch = readerConfig(L"prefetch", true);
+
     std::string minibatchMode(readerConfig(L"minibatchMode", "Partial"));
     m_partialMinibatch = !_stricmp(minibatchMode.c_str(), "Partial");
 
@@ -213,27 +237,21 @@ void DSSMReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig)
     m_featuresDimQuery = configFeaturesQuery(L"dim");
     m_featuresDimDoc = configFeaturesDoc(L"dim");
 
-    std::wstring fileQ = configFeaturesQuery("file");
-    std::wstring fileD = configFeaturesDoc("file");
-
-    dssm_queryInput.Init(fileQ, m_featuresDimQuery);
-    dssm_docInput.Init(fileD, m_featuresDimDoc);
+    dssm_queryInput.Init(GetShardFiles(configFeaturesQuery), m_featuresDimQuery);
+    dssm_docInput.Init(GetShardFiles(configFeaturesDoc), m_featuresDimDoc);
+    if (dssm_queryInput.numRows != dssm_docInput.numRows)
+        RuntimeError("DSSMReader: the query files have %lld rows, but the doc files have %lld", (long long) dssm_queryInput.numRows, (long long) dssm_docInput.numRows);
 
     m_totalSamples = dssm_queryInput.numRows;
-    if (read_order == NULL)
-    {
-        read_order = new int[m_totalSamples];
-        for (int c = 0; c < m_totalSamples; c++)
-        {
-            read_order[c] = c;
-        }
-    }
+    if (m_randomizeWindow > m_totalSamples)
+        m_randomizeWindow = m_totalSamples;
     m_mbSize = 0;
 }
 // destructor - virtual so it gets called properly
 template <class ElemType>
 DSSMReader<ElemType>::~DSSMReader()
 {
+    WaitForReadAhead();
     ReleaseMemory();
 }
 
@@ -275,36 +293,103 @@ size_t RoundUp(size_t value, size_t size)
 // mbSize - [in] size of the minibatch (number of Samples, etc.)
 // epoch - [in] epoch number for this loop, if > 0 the requestedEpochSamples must be specified (unless epoch zero was completed this run)
 // requestedEpochSamples - [in] number of samples to randomize, defaults to requestDataSize which uses the number of samples there are in the dataset
-//   this value must be a multiple of mbSize, if it is not, it will be rounded up to one.
+//   An epoch smaller than the dataset starts where the previous one ended, so that epochs walk through all shards.
 template <class ElemType>
 void DSSMReader<ElemType>::StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples)
 {
-    size_t mbStartSample = m_epoch * m_epochSize;
-    if (m_totalSamples == 0)
-    {
-        m_totalSamples = dssm_queryInput.numRows;
-    }
+    WaitForReadAhead(); // (a leftover read of the previous loop)
 
-    size_t fileRecord = m_totalSamples ? mbStartSample % m_totalSamples : 0;
-    fprintf(stderr, "starting epoch %lld at record count %lld, and file position %lld\n", m_epoch, mbStartSample, fileRecord);
-
-    // reset the next read sample
-    m_readNextSample = 0;
-    m_epochStartSample = m_mbStartSample = mbStartSample;
     m_mbSize = mbSize;
-    m_epochSize = requestedEpochSamples;
-    dssm_queryInput.SetupEpoch(mbSize);
-    dssm_docInput.SetupEpoch(mbSize);
-    if (m_epochSize > (size_t) dssm_queryInput.numRows)
+    m_epoch = epoch;
+    m_epochSize = requestedEpochSamples == requestDataSize ? m_totalSamples : requestedEpochSamples;
+    m_epochStartSample = m_mbStartSample = m_epoch * m_epochSize;
+    m_epochEndSample = m_epochStartSample + m_epochSize;
+
+    size_t fileRecord = m_totalSamples ? m_mbStartSample % m_totalSamples : 0;
+    fprintf(stderr, "starting epoch %lld at record count %lld, and file position %lld\n", (long long) m_epoch, (long long) m_mbStartSample, (long long) fileRecord);
+
+    if (m_totalSamples > 0 && m_prefetch)
+        StartReadAhead(m_mbStartSample);
+}
+
+// SampleToRow - the file row (over all shards) of a sample in global sample space
+// With randomization, rows are shuffled within windows of m_randomizeWindow rows, with a different order every sweep.
+template <class ElemType>
+size_t DSSMReader<ElemType>::SampleToRow(size_t sample)
+{
+    size_t sweep = sample / m_totalSamples;
+    size_t row = sample % m_totalSamples;
+    if (!Randomize())
+        return row;
+
+    size_t windowsPerSweep = (m_totalSamples + m_randomizeWindow - 1) / m_randomizeWindow;
+    size_t window = row / m_randomizeWindow;
+    size_t windowId = sweep * windowsPerSweep + window;
+    if (windowId != m_windowId)
     {
-        m_epochSize = (size_t) dssm_queryInput.numRows;
+        size_t windowBegin = window * m_randomizeWindow;
+        size_t windowEnd = min(windowBegin + m_randomizeWindow, m_totalSamples);
+        m_windowRows.resize(windowEnd - windowBegin);
+        for (size_t k = 0; k < m_windowRows.size(); k++)
+            m_windowRows[k] = windowBegin + k;
+        std::mt19937_64 rng(windowId);
+        std::shuffle(m_windowRows.begin(), m_windowRows.end(), rng);
+        m_windowId = windowId;
+
+        // the window is read in random order, so ask the OS to read all of it (and the next one) sequentially instead
+        size_t nextEnd = min(windowEnd + m_randomizeWindow, m_totalSamples);
+        dssm_queryInput.Prefetch(windowBegin, nextEnd);
+        dssm_docInput.Prefetch(windowBegin, nextEnd);
     }
-    if (Randomize())
+    return m_windowRows[row - window * m_randomizeWindow];
+}
+
+// ReadMinibatch - gather the query and doc rows of the minibatch that starts at a sample into host buffers
+// returns - the number of samples read, 0 at the end of the epoch
+// Only touches the mapped files and mb, so it may run on the read-ahead thread.
+template <class ElemType>
+size_t DSSMReader<ElemType>::ReadMinibatch(Minibatch& mb, size_t mbStartSample)
+{
+    if (mbStartSample >= m_epochEndSample)
+        return 0;
+    size_t actualMBSize = min(m_mbSize, m_epochEndSample - mbStartSample);
+
+    std::vector<size_t> rows(actualMBSize);
+    for (size_t c = 0; c < actualMBSize; c++)
+        rows[c] = SampleToRow(mbStartSample + c);
+    if (!Randomize()) // sequential: read ahead the next minibatch while we copy this one
     {
-        random_shuffle(&read_order[0], &read_order[m_epochSize]);
+        size_t next = (mbStartSample + actualMBSize) % m_totalSamples;
+        size_t nextEnd = min(next + m_mbSize, m_totalSamples);
+        dssm_queryInput.Prefetch(next, nextEnd);
+        dssm_docInput.Prefetch(next, nextEnd);
     }
-    m_epoch = epoch;
-    m_mbStartSample = epoch * m_epochSize;
+
+    dssm_queryInput.Fill(mb.query, rows);
+    dssm_docInput.Fill(mb.doc, rows);
+    return actualMBSize;
+}
+
+// StartReadAhead - start gathering the minibatch at a sample into the next buffers in the background
+template <class ElemType>
+void DSSMReader<ElemType>::StartReadAhead(size_t mbStartSample)
+{
+    assert(!m_pendingMinibatch.valid());
+    m_pendingSlot = 1 - m_pendingSlot;
+    Minibatch* mb = &m_minibatches[m_pendingSlot];
+    m_pendingMinibatch = std::async(std::launch::async, [this, mb, mbStartSample]()
+                                    {
+                                        return ReadMinibatch(*mb, mbStartSample);
+                                    });
+}
+
+// WaitForReadAhead - finish and drop a pending read, e.g. before the epoch changes under it
+template <class ElemType>
+void DSSMReader<ElemType>::WaitForReadAhead()
+{
+    if (m_pendingMinibatch.valid())
+        m_pendingMinibatch.wait();
+    m_pendingMinibatch = std::future<size_t>();
 }
 
 // function to store the LabelType in an ElemType
@@ -322,10 +407,6 @@ void DSSMReader<ElemType>::StoreLabel(ElemType& labelStore, const LabelType& lab
 template <class ElemType>
 bool DSSMReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
 {
-    if (m_readNextSample >= m_totalSamples)
-    {
-        return false;
-    }
     // In my unit test example, the input matrices contain 5: N, S, fD, fQ and labels
     // Both N and S serve as a pre-set constant values, no need to change them
     // In this node, we only need to fill in these matrices: fD, fQ, labels
@@ -333,61 +414,26 @@ bool DSSMReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*
     Matrix<ElemType>& featuresD = *matrices[m_featuresNameDoc];
     Matrix<ElemType>& labels = *matrices[m_labelsName]; // will change this part later.
 
-    size_t actualMBSize = (m_readNextSample + m_mbSize > m_totalSamples) ? m_totalSamples - m_readNextSample : m_mbSize;
+    // take the minibatch that was read ahead, or read it now
+    size_t actualMBSize;
+    if (m_pendingMinibatch.valid())
+        actualMBSize = m_pendingMinibatch.get();
+    else
+        actualMBSize = ReadMinibatch(m_minibatches[m_pendingSlot], m_mbStartSample);
+    if (actualMBSize == 0)
+        return false;
+    const Minibatch& mb = m_minibatches[m_pendingSlot];
+    m_mbStartSample += actualMBSize;
+
+    // start on the next one while the network works on this one (the other buffers are free again by now)
+    if (m_prefetch && m_mbStartSample < m_epochEndSample)
+        StartReadAhead(m_mbStartSample);
 
     featuresQ.SwitchToMatrixType(MatrixType::SPARSE, MatrixFormat::matrixFormatSparseCSC, false);
     featuresD.SwitchToMatrixType(MatrixType::SPARSE, MatrixFormat::matrixFormatSparseCSC, false);
-
-    /*
-    featuresQ.Resize(dssm_queryInput.numRows, actualMBSize);
-    featuresD.Resize(dssm_docInput.numRows, actualMBSize);
-    */
-
-    // fprintf(stderr, "featuresQ\n");
-    dssm_queryInput.Next_Batch(featuresQ, m_readNextSample, actualMBSize, read_order);
-    // fprintf(stderr, "\n\n\nfeaturesD\n");
-    dssm_docInput.Next_Batch(featuresD, m_readNextSample, actualMBSize, read_order);
-    // fprintf(stderr, "\n\n\n\n\n");
-    m_readNextSample += actualMBSize;
-    /*
-                featuresQ.Print("featuresQ");
-                fprintf(stderr, "\n");
-                featuresD.Print("featuresD");
-                fprintf(stderr, "\n");
-                */
-
-    /*
-    GPUSPARSE_INDEX_TYPE* h_CSCCol;
-    GPUSPARSE_INDEX_TYPE* h_Row;
-    ElemType* h_val;
-    size_t nz;
-    size_t nrs;
-    size_t ncols;
-    featuresQ.GetMatrixFromCSCFormat(&h_CSCCol, &h_Row, &h_val, &nz, &nrs, &ncols);
-
-    for (int j = 0, k=0; j < nz; j++)
-    {
-        if (h_CSCCol[k] >= j)
-        {
-            fprintf(stderr, "\n");
-            k++;
-        }
-        fprintf(stderr, "%d:%.f ", h_Row[j], h_val[j]);
-
-    }
-    */
-
-    /*
-    featuresQ.TransferFromDeviceToDevice(featuresQ.GetDeviceId(), -1);
-    featuresQ.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense);
-    featuresQ.Print("featuresQ");
-
-    featuresD.TransferFromDeviceToDevice(featuresD.GetDeviceId(), -1);
-    featuresD.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense);
-    featuresD.Print("featuresD");
-
-    exit(1);
-    */
+    dssm_queryInput.Upload(mb.query, featuresQ);
+    dssm_docInput.Upload(mb.doc, featuresD);
+    m_pMBLayout->InitAsFrameMode(actualMBSize);
 
     if (actualMBSize > m_mbSize || m_labelsBuffer == NULL)
     {
@@ -456,10 +502,10 @@ bool DSSMReader<ElemType>::DataEnd(EndDataType endDataType)
         break;
     case endDataEpoch:
         // ret = (m_mbStartSample / m_epochSize < m_epoch);
-        ret = (m_readNextSample >= m_totalSamples);
+        ret = (m_mbStartSample >= m_epochEndSample);
         break;
     case endDataSet:
-        ret = (m_readNextSample >= m_totalSamples);
+        ret = (m_mbStartSample >= m_epochEndSample);
         break;
     case endDataSentence: // for fast reader each minibatch is considered a "sentence", so always true
         ret = true;
@@ -470,6 +516,7 @@ bool DSSMReader<ElemType>::DataEnd(EndDataType endDataType)
 
 template <class ElemType>
 DSSM_BinaryInput<ElemType>::DSSM_BinaryInput()
+    : m_dim(0), numRows(0), totalNNz(0)
 {
 }
 template <class ElemType>
@@ -477,202 +524,145 @@ DSSM_BinaryInput<ElemType>::~DSSM_BinaryInput()
 {
     Dispose();
 }
+
+// Init - map the shard files of this input
+// fileNames - the shards, their rows are concatenated in this order
+// dim - feature dimension
 template <class ElemType>
-void DSSM_BinaryInput<ElemType>::Init(wstring fileName, size_t dim)
+void DSSM_BinaryInput<ElemType>::Init(const std::vector<std::wstring>& fileNames, size_t dim)
 {
+    const size_t headerSize = sizeof(int64_t) * 2 + sizeof(int32_t);
 
+    Dispose();
     m_dim = dim;
-    mbSize = 0;
-    /*
-    m_hndl = CreateFileA(fileName.c_str(), GENERIC_READ,
-        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    */
-    m_hndl = CreateFile(fileName.c_str(), GENERIC_READ,
-                        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (m_hndl == INVALID_HANDLE_VALUE)
+    for (const auto& fileName : fileNames)
     {
-        char message[256];
-        sprintf_s(message, "Unable to Open/Create file %ls, error %x", fileName.c_str(), GetLastError());
-        RuntimeError(message);
+        Shard shard;
+        shard.file.reset(new msra::files::mappedfile(fileName));
+        shard.path = fileName;
+        const char* base = shard.file->data();
+        size_t size = shard.file->size();
+        if (size < headerSize)
+            RuntimeError("DSSMReader: %ls is too short for a header", fileName.c_str());
+
+        int64_t rows, nnz;
+        memcpy(&rows, base, sizeof(int64_t));
+        memcpy(&nnz, base + sizeof(int64_t) + sizeof(int32_t), sizeof(int64_t));
+        if (rows < 0 || (size - headerSize) / sizeof(int64_t) < (size_t) rows)
+            RuntimeError("DSSMReader: %ls is too short for its %lld rows", fileName.c_str(), (long long) rows);
+
+        shard.firstRow = (size_t) numRows;
+        shard.numRows = (size_t) rows;
+        shard.offsets = base + headerSize;
+        shard.data = shard.offsets + rows * sizeof(int64_t);
+        shard.dataSize = size - headerSize - rows * sizeof(int64_t);
+        numRows += rows;
+        totalNNz += nnz;
+        m_shards.push_back(std::move(shard));
     }
+    fprintf(stderr, "DSSMReader: %lld rows with %lld non-zeros in %d file(s)\n", (long long) numRows, (long long) totalNNz, (int) m_shards.size());
+}
 
-    m_filemap = CreateFileMapping(m_hndl, NULL, PAGE_READONLY, 0, 0, NULL);
-
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
-    DWORD sysGran = sysinfo.dwAllocationGranularity;
-
-    header_buffer = MapViewOfFile(m_filemap,     // handle to map object
-                                  FILE_MAP_READ, // get correct permissions
-                                  HIDWORD(0),
-                                  LODWORD(0),
-                                  sizeof(int64_t) * 2 + sizeof(int32_t));
-
-    // cout << "After mapviewoffile" << endl;
-
-    memcpy(&numRows, header_buffer, sizeof(int64_t));
-    memcpy(&numCols, (char*) header_buffer + sizeof(int64_t), sizeof(int32_t));
-    memcpy(&totalNNz, (char*) header_buffer + sizeof(int64_t) + sizeof(int32_t), sizeof(int64_t));
-
-    // cout << "After gotvalues" << endl;
-    int64_t base_offset = sizeof(int64_t) * 2 + sizeof(int32_t);
-
-    int64_t offsets_padding = base_offset % sysGran;
-    base_offset -= offsets_padding;
-
-    int64_t header_size = numRows * sizeof(int64_t) + offsets_padding;
+// ShardOf - the shard that holds a row
+template <class ElemType>
+const typename DSSM_BinaryInput<ElemType>::Shard& DSSM_BinaryInput<ElemType>::ShardOf(size_t row) const
+{
+    auto iter = std::upper_bound(m_shards.begin(), m_shards.end(), row, [](size_t r, const Shard& shard)
+                                 {
+                                     return r < shard.firstRow;
+                                 });
+    assert(iter != m_shards.begin());
+    return *(iter - 1);
+}
 
-    void* offsets_orig = MapViewOfFile(m_filemap,     // handle to map object
-                                       FILE_MAP_READ, // get correct permissions
-                                       HIDWORD(base_offset),
-                                       LODWORD(base_offset),
-                                       header_size);
+// RowOffset - where a row starts in the data of its shard
+template <class ElemType>
+int64_t DSSM_BinaryInput<ElemType>::RowOffset(const Shard& shard, size_t shardRow) const
+{
+    int64_t offset;
+    memcpy(&offset, shard.offsets + shardRow * sizeof(int64_t), sizeof(int64_t)); // (the offsets follow a 20-byte header, so they are unaligned)
+    return offset;
+}
 
-    offsets_buffer = (char*) offsets_orig + offsets_padding;
+// Fill - gather rows (over all shards) as the columns of a minibatch
+// buffer - [in,out] grown as needed, keeps its size across minibatches
+// rows - the rows to read, in column order
+template <class ElemType>
+void DSSM_BinaryInput<ElemType>::Fill(CSCBuffer& buffer, const std::vector<size_t>& rows) const
+{
+    const size_t numCols = rows.size();
 
-    if (offsets != NULL)
+    // locate the rows and count their non-zeros first, so that the buffer can be sized once
+    std::vector<const char*> records(numCols);
+    size_t nnz = 0;
+    for (size_t c = 0; c < numCols; c++)
     {
-        free(offsets);
+        const Shard& shard = ShardOf(rows[c]);
+        size_t offset = (size_t) RowOffset(shard, rows[c] - shard.firstRow);
+        if (offset + sizeof(int32_t) > shard.dataSize)
+            RuntimeError("DSSMReader: row %d of %ls lies outside the file", (int) (rows[c] - shard.firstRow), shard.path.c_str());
+        records[c] = shard.data + offset;
+        int32_t rowNNz;
+        memcpy(&rowNNz, records[c], sizeof(int32_t));
+        if (rowNNz < 0 || offset + sizeof(int32_t) + (sizeof(ElemType) + sizeof(int32_t)) * rowNNz > shard.dataSize)
+            RuntimeError("DSSMReader: row %d of %ls lies outside the file", (int) (rows[c] - shard.firstRow), shard.path.c_str());
+        nnz += rowNNz;
     }
-    offsets = (int64_t*) malloc(sizeof(int64_t) * numRows);
-    memcpy(offsets, offsets_buffer, numRows * sizeof(int64_t));
-
-    int64_t header_offset = base_offset + offsets_padding + numRows * sizeof(int64_t);
 
-    int64_t data_padding = header_offset % sysGran;
-    header_offset -= data_padding;
-
-    void* data_orig = MapViewOfFile(m_filemap,     // handle to map object
-                                    FILE_MAP_READ, // get correct permissions
-                                    HIDWORD(header_offset),
-                                    LODWORD(header_offset),
-                                    0);
-    data_buffer = (char*) data_orig + data_padding;
-}
-template <class ElemType>
-bool DSSM_BinaryInput<ElemType>::SetupEpoch(size_t minibatchSize)
-{
-    if (values == NULL || mbSize < minibatchSize)
+    if (nnz > buffer.maxNNz || numCols > buffer.maxCols)
     {
-        if (values != NULL)
-        {
-            free(values);
-            free(colIndices);
-            free(rowIndices);
-        }
-
-        values = (ElemType*) malloc(sizeof(ElemType) * MAX_BUFFER * minibatchSize);
-        colIndices = (int32_t*) malloc(sizeof(int32_t) * (minibatchSize + 1));
-        rowIndices = (int32_t*) malloc(sizeof(int32_t) * MAX_BUFFER * minibatchSize);
-        // fprintf(stderr, "values  size: %d",sizeof(ElemType)*MAX_BUFFER*minibatchSize);
-        // fprintf(stderr, "colindi size: %d",sizeof(int32_t)*MAX_BUFFER*(1+minibatchSize));
-        // fprintf(stderr, "rowindi size: %d",sizeof(int32_t)*MAX_BUFFER*minibatchSize);
+        buffer.maxNNz = max(nnz + nnz / 4, buffer.maxNNz); // (some headroom, the number of non-zeros varies between minibatches)
+        buffer.maxCols = max(numCols, buffer.maxCols);
+        buffer.bytes.resize((sizeof(ElemType) + sizeof(int32_t)) * buffer.maxNNz + sizeof(int32_t) * (buffer.maxCols + 1));
     }
-    if (minibatchSize > mbSize)
+    ElemType* values = (ElemType*) buffer.bytes.data();
+    int32_t* rowIndices = (int32_t*) (values + buffer.maxNNz);
+    int32_t* colIndices = rowIndices + buffer.maxNNz;
+
+    size_t curIndex = 0;
+    for (size_t c = 0; c < numCols; c++)
     {
-        mbSize = minibatchSize;
+        int32_t rowNNz;
+        memcpy(&rowNNz, records[c], sizeof(int32_t));
+        colIndices[c] = (int32_t) curIndex;
+        memcpy(values + curIndex, records[c] + sizeof(int32_t), sizeof(ElemType) * rowNNz);
+        memcpy(rowIndices + curIndex, records[c] + sizeof(int32_t) + sizeof(ElemType) * rowNNz, sizeof(int32_t) * rowNNz);
+        curIndex += rowNNz;
     }
-
-    return true;
+    colIndices[numCols] = (int32_t) curIndex;
+    buffer.nnz = curIndex;
+    buffer.numCols = numCols;
 }
+
+// Upload - hand a filled buffer to the minibatch matrix, with a single copy
 template <class ElemType>
-bool DSSM_BinaryInput<ElemType>::Next_Batch(Matrix<ElemType>& matrices, size_t cur, size_t numToRead, int* /*ordering*/)
+void DSSM_BinaryInput<ElemType>::Upload(const CSCBuffer& buffer, Matrix<ElemType>& matrix) const
 {
-    /*
-    int devId = matrices.GetDeviceId();
-    matrices.TransferFromDeviceToDevice(devId, -1);
-    */
-
-    int32_t cur_index = 0;
-
-    for (int c = 0; c < numToRead; c++, cur++)
-    {
-        // int64_t cur_offset = offsets[ordering[cur]];
-        int64_t cur_offset = offsets[cur];
-        // int64_t cur_offset = offsets[ordering[c]];
-        // int32_t nnz;
-        colIndices[c] = cur_index;
-        int32_t nnz = *(int32_t*) ((char*) data_buffer + cur_offset);
-        // memcpy(&nnz, (char*)data_buffer + cur_offset, sizeof(int32_t));
-        memcpy(values + cur_index, (char*) data_buffer + cur_offset + sizeof(int32_t), sizeof(ElemType) * nnz);
-        memcpy(rowIndices + cur_index, (char*) data_buffer + cur_offset + sizeof(int32_t) + sizeof(ElemType) * nnz, sizeof(int32_t) * nnz);
-        /**
-        fprintf(stderr, "%4d (%3d, %6d): ", c, nnz, cur_index + nnz);
-        for (int i = 0; i < nnz; i++)
-        {
-            fprintf(stderr, "%d:%.f ", rowIndices[cur_index+i], values[cur_index+i]);
-            // matrices.SetValue(rowIndices[cur_index + i], c, values[cur_index + i]);
-        }
-        fprintf(stderr, "\n");
-        **/
+    matrix.SetMatrixFromCSCBuffer(buffer.bytes.data(), buffer.maxNNz, buffer.nnz, m_dim, buffer.numCols);
+}
 
-        cur_index += nnz;
-    }
-    colIndices[numToRead] = cur_index;
-    /*
-    int col = 0;
-    for (int c = 0; c < cur_index; c++)
+// Prefetch - ask the OS to read rows [begin, end) of the shards ahead
+template <class ElemType>
+void DSSM_BinaryInput<ElemType>::Prefetch(size_t begin, size_t end) const
+{
+    while (begin < end)
     {
-        if (colIndices[col] == c)
-        {
-            fprintf(stderr, "\n%4d: ", col);
-            col++;
-        }
-        fprintf(stderr, "%d:%.f ", rowIndices[c], values[c]);
+        const Shard& shard = ShardOf(begin);
+        size_t shardEnd = min(end, shard.firstRow + shard.numRows);
+        size_t from = (size_t) RowOffset(shard, begin - shard.firstRow);
+        size_t to = shardEnd < shard.firstRow + shard.numRows ? (size_t) RowOffset(shard, shardEnd - shard.firstRow) : shard.dataSize;
+        if (from < to && to <= shard.dataSize)
+            shard.file->prefetch(shard.data - shard.file->data() + from, to - from);
+        begin = shardEnd;
     }
-    */
-    /*
-    fprintf(stderr, "\nXXXX nnz: %d\n", cur_index);
-    fprintf(stderr, "XXXX max values read: %d vs %d\n", sizeof(ElemType)*cur_index, sizeof(ElemType)*MAX_BUFFER*numToRead);
-    fprintf(stderr, "XXXX max indices read: %d vs %d\n", sizeof(int32_t)*cur_index, sizeof(int32_t)*MAX_BUFFER*numToRead);
-    fprintf(stderr, "XXXX sizeof(int32_t) = %d, sizeof(int) = %d\n", sizeof(int32_t), sizeof(int));
-    */
-    /*
-        values = (ElemType*)malloc(sizeof(ElemType)*MAX_BUFFER*minibatchSize);
-        colIndices = (int32_t*)malloc(sizeof(int32_t)*MAX_BUFFER*(minibatchSize+1));
-        rowIndices = (int32_t*)malloc(sizeof(int32_t)*MAX_BUFFER*minibatchSize);
-        */
-
-    matrices.SetMatrixFromCSCFormat(colIndices, rowIndices, values, cur_index, m_dim, numToRead);
-    // matrices.Print("actual values");
-    // exit(1);
-    /*
-    matrices.SwitchToMatrixType(MatrixType::DENSE, MatrixFormat::matrixFormatDense);
-    matrices.Print("featuresQ");
-    exit(1);
-    matrices.TransferFromDeviceToDevice(-1,devId);
-    */
-    return true;
 }
 
 template <class ElemType>
 void DSSM_BinaryInput<ElemType>::Dispose()
 {
-    if (offsets_orig != NULL)
-    {
-        UnmapViewOfFile(offsets_orig);
-    }
-    if (data_orig != NULL)
-    {
-        UnmapViewOfFile(data_orig);
-    }
-
-    if (offsets != NULL)
-    {
-        free(offsets); // = (ElemType*)malloc(sizeof(float)* 230 * 1024);
-    }
-    if (values != NULL)
-    {
-        free(values); // = (ElemType*)malloc(sizeof(float)* 230 * 1024);
-    }
-    if (rowIndices != NULL)
-    {
-        free(rowIndices); // = (int*)malloc(sizeof(float)* 230 * 1024);
-    }
-    if (colIndices != NULL)
-    {
-        free(colIndices); // = (int*)malloc(sizeof(float)* 230 * 1024);
-    }
+    m_shards.clear();
+    numRows = 0;
+    totalNNz = 0;
 }
 
 template <class ElemType>
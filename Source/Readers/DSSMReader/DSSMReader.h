@@ -9,9 +9,12 @@
 #include "DataWriter.h"
 #include "Config.h"
 #include "RandomOrdering.h"
+#include "mappedfile.h"
 #include <string>
 #include <map>
 #include <vector>
+#include <memory>
+#include <future>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -23,43 +26,59 @@ enum LabelKind
     labelOther = 3,      // some other type of label
 };
 
+// -----------------------------------------------------------------------
+// DSSM_BinaryInput -- one input (query or doc) in the DSSM binary format, split over one or more shard files
+// Each shard: int64 numRows, int32 numCols, int64 totalNNz, int64 offsets[numRows], then per row at data + offsets[row]:
+// int32 nnz, ElemType values[nnz], int32 rowIndices[nnz]. The rows of all shards form one sequence, in the order of the shards.
+// -----------------------------------------------------------------------
+
 template <class ElemType>
 class DSSM_BinaryInput
 {
-private:
-    HANDLE m_hndl;
-    HANDLE m_filemap;
-    HANDLE m_header;
-    HANDLE m_offsets;
-    HANDLE m_data;
-
-    // void* header_orig; // Don't need this since the header is at the start of the file
-    void* offsets_orig;
-    void* data_orig;
-
-    void* header_buffer;
-    void* offsets_buffer;
-    void* data_buffer;
+public:
+    // host buffer for one minibatch, in the layout of Matrix::SetMatrixFromCSCBuffer(): values[maxNNz], row indices[maxNNz], column starts[maxCols + 1]
+    struct CSCBuffer
+    {
+        std::vector<char> bytes;
+        size_t maxNNz;
+        size_t maxCols;
+        size_t nnz;     // valid values in this minibatch
+        size_t numCols; // samples in this minibatch
+        CSCBuffer()
+            : maxNNz(0), maxCols(0), nnz(0), numCols(0)
+        {
+        }
+    };
 
+private:
+    struct Shard
+    {
+        std::unique_ptr<msra::files::mappedfile> file;
+        std::wstring path;
+        size_t firstRow; // index of our first row in the whole input
+        size_t numRows;
+        const char* offsets; // int64 each, not necessarily aligned
+        const char* data;
+        size_t dataSize;
+    };
+    std::vector<Shard> m_shards;
     size_t m_dim;
-    size_t mbSize;
-    size_t MAX_BUFFER = 300;
 
-    ElemType* values;    // = (ElemType*)malloc(sizeof(float)* 230 * 1024);
-    int64_t* offsets;    // = (int*)malloc(sizeof(int)* 230 * 1024);
-    int32_t* colIndices; // = (int*)malloc(sizeof(int)* (batchsize + 1));
-    int32_t* rowIndices; // = (int*)malloc(sizeof(int)* MAX_BUFFER * batchsize);
+    const Shard& ShardOf(size_t row) const;
+    int64_t RowOffset(const Shard& shard, size_t shardRow) const;
 
 public:
-    int64_t numRows;
-    int32_t numCols;
+    int64_t numRows; // over all shards
     int64_t totalNNz;
 
     DSSM_BinaryInput();
     ~DSSM_BinaryInput();
-    void Init(std::wstring fileName, size_t dim);
-    bool SetupEpoch(size_t minibatchSize);
-    bool Next_Batch(Matrix<ElemType>& matrices, size_t cur, size_t numToRead, int* ordering);
+    void Init(const std::vector<std::wstring>& fileNames, size_t dim);
+    // gather the given rows into a host buffer; only reads the mapped files, so it may run on another thread
+    void Fill(CSCBuffer& buffer, const std::vector<size_t>& rows) const;
+    void Upload(const CSCBuffer& buffer, Matrix<ElemType>& matrix) const;
+    // hint the OS to read rows [begin, end) ahead, as sequential reads
+    void Prefetch(size_t begin, size_t end) const;
     void Dispose();
 };
 
@@ -70,7 +89,6 @@ class DSSMReader : public IDataReader<ElemType>
     //    typedef std::string LabelType;
     //    typedef unsigned LabelIdType;
 private:
-    int* read_order; // array to shuffle to reorder the dataset
     std::wstring m_featuresNameQuery;
     std::wstring m_featuresNameDoc;
     size_t m_featuresDimQuery;
@@ -86,9 +104,10 @@ private:
     size_t m_epoch;                  // which epoch are we on
     size_t m_epochStartSample;       // the starting sample for the epoch
     size_t m_totalSamples;           // number of samples in the dataset
+    size_t m_epochEndSample;         // first sample past the epoch
     size_t m_randomizeRange;         // randomization range
+    size_t m_randomizeWindow;        // number of consecutive rows shuffled together (0: no randomization)
     size_t m_featureCount;           // feature count
-    size_t m_readNextSample;         // next sample to read
     bool m_labelFirst;               // the label is the first element in a line
     bool m_partialMinibatch;         // a partial minibatch is allowed
     LabelKind m_labelType;           // labels are categories, create mapping table
@@ -123,12 +142,30 @@ private:
     DataWriter<ElemType>* m_cachingWriter;
     ConfigParameters m_readerConfig;
 
+    // read-ahead: while one minibatch is handed to the network, the next one is gathered into the other buffers
+    struct Minibatch
+    {
+        typename DSSM_BinaryInput<ElemType>::CSCBuffer query;
+        typename DSSM_BinaryInput<ElemType>::CSCBuffer doc;
+    };
+    Minibatch m_minibatches[2];
+    size_t m_pendingSlot;                   // which of m_minibatches the pending read fills
+    std::future<size_t> m_pendingMinibatch; // number of samples read
+    bool m_prefetch;
+
+    // the current randomization window, in file rows in random order
+    std::vector<size_t> m_windowRows;
+    size_t m_windowId; // sweep * (windows per sweep) + window, or SIZE_MAX
+
     size_t RandomizeSweep(size_t epochSample);
-    // bool Randomize() {return m_randomizeRange != randomizeNone;}
     bool Randomize()
     {
-        return false;
+        return m_randomizeWindow != 0;
     }
+    size_t SampleToRow(size_t sample);
+    size_t ReadMinibatch(Minibatch& mb, size_t mbStartSample);
+    void StartReadAhead(size_t mbStartSample);
+    void WaitForReadAhead();
     void SetupEpoch();
     void StoreLabel(ElemType& labelStore, const LabelType& labelValue);
     size_t RecordsToRead(size_t mbStartSample, bool tail = false);
@@ -150,11 +187,12 @@ public:
     }
     virtual void Destroy();
     DSSMReader()
-        : m_pMBLayout(make_shared<MBLayout>())
+        : m_pMBLayout(make_shared<MBLayout>()), m_pendingSlot(0), m_prefetch(true), m_windowId(SIZE_MAX)
     {
         m_qfeaturesBuffer = NULL;
         m_dfeaturesBuffer = NULL;
         m_labelsBuffer = NULL;
+        m_labelsIdBuffer = NULL;
     }
     virtual ~DSSMReader();
     virtual void StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples = requestDataSize);
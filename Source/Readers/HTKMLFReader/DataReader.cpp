@@ -20,6 +20,7 @@
 #define DATAREADER_EXPORTS
 #include "DataReader.h"
 #include "HTKMLFReader.h"
+#include "HTKDeserializer.h"
 #include "Config.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -38,6 +39,16 @@ extern "C" DATAREADER_API void GetReaderD(IDataReader<double>** preader)
 {
     GetReader(preader);
 }
+
+// the same data through the reader pipeline (pipeline=true)
+extern "C" DATAREADER_API void GetPipelineReaderF(IDataReader<float>** preader)
+{
+    *preader = new HTKPipelineReader<float>();
+}
+extern "C" DATAREADER_API void GetPipelineReaderD(IDataReader<double>** preader)
+{
+    *preader = new HTKPipelineReader<double>();
+}
 #ifdef _WIN32
 // Utility function, in ConfigFile.cpp, but HTKMLFReader doesn't need that code...
 
@@ -0,0 +1,541 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// HTKDeserializer.cpp -- HTK features and MLF state alignments as a deserializer of the reader pipeline
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "htkfeatio.h"      // for reading HTK features
+#include "latticearchive.h" // (for the MLF reader's word sequences)
+#include "Config.h"
+#include "ScriptableObjects.h"
+#include "HTKDeserializer.h"
+#include "mappedfile.h"
+#include <regex>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// (the frames of an utterance as the MATRIX that htkfeatreader::read() writes into)
+struct FrameStripe
+{
+    float* values;
+    size_t dim, numFrames;
+    size_t rows() const
+    {
+        return dim;
+    }
+    size_t cols() const
+    {
+        return numFrames;
+    }
+    float& operator()(size_t i, size_t t)
+    {
+        return values[t * dim + i];
+    }
+};
+
+// chunk index file layout:
+//  - header, then the table of chunks [numChunks]
+//  - the record of each chunk: #frames [utterance] (uint32), for each feature stream the paths [utterance] (uint32 #bytes, then UTF-8),
+//    and if there are labels the state [frame in chunk] (uint32)
+struct ChunkIndexHeader
+{
+    char magic[8]; // "HTKCHIX\0"
+    uint32_t version;
+    uint32_t numFeatureStreams;
+    uint64_t signature; // of the text files and options it was made from
+    uint64_t numChunks;
+    uint64_t hasLabels;
+};
+struct ChunkIndexEntry
+{
+    uint64_t numUtterances;
+    uint64_t numFrames;
+    uint64_t offset, size; // of its record
+};
+
+static void InitChunkIndexHeader(ChunkIndexHeader& header)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "HTKCHIX", 8);
+    header.version = 1;
+}
+
+template <class ConfigRecordType>
+HTKDeserializer::HTKDeserializer(const ConfigRecordType& config)
+{
+    m_frameMode = config(L"frameMode", true);
+
+    std::vector<std::wstring> featureNames, labelNames;
+    for (const auto& id : config.GetMemberIds())
+    {
+        if (!config.CanBeConfigRecord(id))
+            continue;
+        const ConfigRecordType& section = config(id);
+        if (section.ExistsCurrent(L"scpFile"))
+            featureNames.push_back(id);
+        else if (section.ExistsCurrent(L"mlfFile") || section.ExistsCurrent(L"mlfFileList"))
+            labelNames.push_back(id);
+    }
+    if (featureNames.empty() || labelNames.size() > 1)
+        InvalidArgument("HTKDeserializer: expected feature sections, and at most one label section.");
+    m_hasLabels = !labelNames.empty();
+
+    uint64_t signature = 14695981039346656037ull; // FNV-1a over the sizes and modification times of the text files, and the options the chunks depend on
+    auto sign = [&signature](uint64_t value)
+    {
+        for (size_t k = 0; k < 8; k++, value >>= 8)
+            signature = (signature ^ (value & 0xff)) * 1099511628211ull;
+    };
+    auto signString = [&sign](const wstring& s)
+    {
+        sign(s.size());
+        for (wchar_t c : s)
+            sign((uint64_t) c);
+    };
+    auto signFile = [&sign](const wstring& path)
+    {
+        sign(path.empty() ? 0 : filesize64(path.c_str()));
+        sign(path.empty() ? 0 : filemodtime64(path.c_str()));
+    };
+
+    // the feature streams
+    std::vector<wstring> scpFiles, rootPaths;
+    for (const auto& name : featureNames)
+    {
+        const ConfigRecordType& section = config(name);
+        FeatureStream stream;
+        stream.dim = section(L"dim");
+        intargvector contextWindow = section(L"contextWindow", ConfigRecordType::Array(intargvector(vector<int>{1})));
+        if (contextWindow.size() == 1) // symmetric
+        {
+            if (contextWindow[0] % 2 == 0)
+                InvalidArgument("HTKDeserializer: contextWindow %d of '%ls' is not symmetrical.", (int) contextWindow[0], name.c_str());
+            stream.contextLeft = stream.contextRight = contextWindow[0] / 2;
+        }
+        else if (contextWindow.size() == 2) // left context, right context
+        {
+            stream.contextLeft = contextWindow[0];
+            stream.contextRight = contextWindow[1];
+        }
+        else
+            InvalidArgument("HTKDeserializer: contextWindow must have 1 or 2 values, found %d.", (int) contextWindow.size());
+
+        scpFiles.push_back(section(L"scpFile"));
+        wstring rootPath = section(L"prefixPathInSCP", L"");
+        std::replace(rootPath.begin(), rootPath.end(), L'\\', L'/');
+        rootPaths.push_back(std::regex_replace(rootPath, std::wregex(L"/+$"), wstring()));
+        signFile(scpFiles.back());
+        signString(rootPaths.back());
+        m_streams.push_back(StreamDescription{name, m_streams.size(), StorageType::dense, stream.dim * (1 + stream.contextLeft + stream.contextRight)});
+        m_features.push_back(stream);
+    }
+
+    // the label stream
+    std::vector<wstring> mlfPaths;
+    wstring stateListPath;
+    if (m_hasLabels)
+    {
+        const ConfigRecordType& section = config(labelNames[0]);
+        if (section.ExistsCurrent(L"mlfFile"))
+            mlfPaths.push_back(section(L"mlfFile"));
+        else
+            for (msra::files::textreader reader((const wstring&) section(L"mlfFileList")); reader;)
+                mlfPaths.push_back(reader.wgetline());
+        const wstring labelMappingFile = section(L"labelMappingFile", L"");
+        stateListPath = labelMappingFile;
+        for (const auto& path : mlfPaths)
+            signFile(path);
+        signFile(stateListPath);
+        const size_t labelDim = section.Exists(L"labelDim") ? (size_t) section(L"labelDim") : (size_t) section(L"dim");
+        m_streams.push_back(StreamDescription{labelNames[0], m_streams.size(), StorageType::category, labelDim});
+    }
+
+    const size_t chunkSize = config(L"chunkSizeInSamples", (size_t) 90000);
+    if (chunkSize == 0)
+        InvalidArgument("HTKDeserializer: chunkSizeInSamples must not be 0.");
+    sign(chunkSize);
+    sign(m_features.size());
+    sign(m_hasLabels ? 1 : 0);
+
+    const wstring chunkIndexPath = config(L"chunkIndex", L"");
+    if (!chunkIndexPath.empty() && ReadChunkIndex(chunkIndexPath, signature))
+        return;
+
+    // the scp files
+    std::vector<std::vector<wstring>> paths(m_features.size()); // [feature stream][utterance]
+    for (size_t s = 0; s < m_features.size(); s++)
+    {
+        for (msra::files::textreader reader(scpFiles[s]); reader;)
+        {
+            wstring path = reader.wgetline();
+            if (!rootPaths[s].empty())
+            {
+                const size_t pos = path.find(L'='); // (the archive, not the logical path, is relative)
+                path = pos == wstring::npos ? rootPaths[s] + L"/" + path : path.substr(0, pos + 1) + rootPaths[s] + L"/" + path.substr(pos + 1);
+            }
+            paths[s].push_back(path);
+        }
+        if (paths[s].size() != paths[0].size())
+            RuntimeError("HTKDeserializer: %ls has %d entries instead of %d.", scpFiles[s].c_str(), (int) paths[s].size(), (int) paths[0].size());
+    }
+
+    // the MLF
+    std::map<std::wstring, std::vector<msra::asr::htkmlfentry>> labels;
+    if (m_hasLabels)
+    {
+        msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence> reader(mlfPaths, std::set<wstring>(), stateListPath, 100000.0);
+        labels = std::move(static_cast<std::map<std::wstring, std::vector<msra::asr::htkmlfentry>>&>(reader));
+    }
+
+    // the utterances, and their chunks
+    size_t numUtterances = 0, numFrames = 0, numSkipped = 0;
+    std::shared_ptr<ChunkUtterances> chunkUtterances;
+    for (size_t u = 0; u < paths[0].size(); u++)
+    {
+        const msra::asr::htkfeatreader::parsedpath ppath(paths[0][u]);
+        const size_t utteranceFrames = ppath.numframes();
+        for (size_t s = 1; s < m_features.size(); s++)
+            if (msra::asr::htkfeatreader::parsedpath(paths[s][u]).numframes() != utteranceFrames)
+                RuntimeError("HTKDeserializer: utterance %ls has different numbers of frames in the feature streams.", ((const wstring&) ppath).c_str());
+        const std::vector<msra::asr::htkmlfentry>* entries = nullptr;
+        if (m_hasLabels)
+        {
+            const wstring key = std::regex_replace((wstring) ppath, std::wregex(L"\\.[^\\.\\\\/:]*$"), wstring()); // delete extension (or not if none)
+            auto iter = labels.find(key);
+            if (iter == labels.end() || iter->second.empty() || iter->second.back().firstframe + iter->second.back().numframes != utteranceFrames)
+            {
+                if (numSkipped++ < 5)
+                    fprintf(stderr, "HTKDeserializer: skipping utterance %ls, which has %s\n", key.c_str(), iter == labels.end() ? "no labels" : "labels of a different length");
+                continue;
+            }
+            entries = &iter->second;
+        }
+        if (m_chunks.empty() || m_chunks.back().numFrames >= chunkSize)
+        {
+            m_chunks.push_back(ChunkInfo{numUtterances, 0, numFrames, 0, 0, 0});
+            chunkUtterances = make_shared<ChunkUtterances>();
+            chunkUtterances->paths.resize(m_features.size());
+            m_chunkUtterances.push_back(chunkUtterances);
+        }
+        chunkUtterances->numFrames.push_back(utteranceFrames);
+        for (size_t s = 0; s < m_features.size(); s++)
+            chunkUtterances->paths[s].push_back(std::move(paths[s][u]));
+        if (entries)
+            for (const auto& entry : *entries)
+                chunkUtterances->classIds.insert(chunkUtterances->classIds.end(), entry.numframes, (unsigned int) entry.classid);
+        m_chunks.back().numUtterances++;
+        m_chunks.back().numFrames += utteranceFrames;
+        numUtterances++;
+        numFrames += utteranceFrames;
+    }
+    fprintf(stderr, "HTKDeserializer: %d utterances of %d frames in %d chunks; %d utterances skipped\n",
+            (int) numUtterances, (int) numFrames, (int) m_chunks.size(), (int) numSkipped);
+
+    // from now on from the index, like the runs that find it
+    if (!chunkIndexPath.empty())
+    {
+        WriteChunkIndex(chunkIndexPath, signature);
+        m_chunkUtterances.clear();
+        if (!ReadChunkIndex(chunkIndexPath, signature))
+            RuntimeError("HTKDeserializer: %ls was changed while it was written.", chunkIndexPath.c_str());
+    }
+}
+
+template HTKDeserializer::HTKDeserializer(const ConfigParameters& config);
+template HTKDeserializer::HTKDeserializer(const ScriptableObjects::IConfigRecord& config);
+
+// the table of chunks of the chunk index (keeping the file mapped for their records); false if there is none, or it is outdated
+bool HTKDeserializer::ReadChunkIndex(const std::wstring& path, uint64_t signature)
+{
+    if (!fexists(path))
+        return false;
+
+    auto file = make_shared<msra::files::mappedfile>(path);
+    const char* base = file->data();
+    ChunkIndexHeader expected;
+    InitChunkIndexHeader(expected);
+    const ChunkIndexHeader* header = (const ChunkIndexHeader*) base;
+    if (file->size() < sizeof(ChunkIndexHeader) || memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 || header->version != expected.version)
+        RuntimeError("HTKDeserializer: %ls is not a chunk index of the expected version.", path.c_str());
+    if (header->signature != signature)
+    {
+        fprintf(stderr, "HTKDeserializer: %ls is out of date, regenerating it\n", path.c_str());
+        return false;
+    }
+    const size_t numChunks = (size_t) header->numChunks;
+    if (header->numFeatureStreams != m_features.size() || (header->hasLabels != 0) != m_hasLabels ||
+        sizeof(ChunkIndexHeader) + numChunks * sizeof(ChunkIndexEntry) > file->size())
+        RuntimeError("HTKDeserializer: %ls is truncated or corrupt.", path.c_str());
+
+    const ChunkIndexEntry* entries = (const ChunkIndexEntry*) (base + sizeof(ChunkIndexHeader));
+    m_chunks.clear();
+    size_t numUtterances = 0, numFrames = 0;
+    for (size_t c = 0; c < numChunks; c++)
+    {
+        const ChunkIndexEntry& entry = entries[c];
+        if (entry.offset > file->size() || entry.size > file->size() - entry.offset)
+            RuntimeError("HTKDeserializer: %ls is truncated or corrupt.", path.c_str());
+        m_chunks.push_back(ChunkInfo{numUtterances, (size_t) entry.numUtterances, numFrames, (size_t) entry.numFrames, (size_t) entry.offset, (size_t) entry.size});
+        numUtterances += (size_t) entry.numUtterances;
+        numFrames += (size_t) entry.numFrames;
+    }
+    m_chunkIndex = file;
+    fprintf(stderr, "HTKDeserializer: %d utterances of %d frames in %d chunks, from %ls\n", (int) numUtterances, (int) numFrames, (int) numChunks, path.c_str());
+    return true;
+}
+
+// Write the chunk index. This happens via a temp file (one per process, see uniquetemppath()), so that concurrent readers and writers never see a partial file.
+void HTKDeserializer::WriteChunkIndex(const std::wstring& path, uint64_t signature)
+{
+    ChunkIndexHeader header;
+    InitChunkIndexHeader(header);
+    header.numFeatureStreams = (uint32_t) m_features.size();
+    header.signature = signature;
+    header.numChunks = m_chunks.size();
+    header.hasLabels = m_hasLabels ? 1 : 0;
+    std::vector<ChunkIndexEntry> entries(m_chunks.size());
+
+    const std::wstring tempPath = uniquetemppath(path);
+    {
+        auto_file_ptr f(fopenOrDie(tempPath, L"wb"));
+        fwriteOrDie(&header, sizeof(header), 1, f);
+        fwriteOrDie(entries, f); // (placeholder, rewritten below)
+        uint64_t offset = sizeof(header) + entries.size() * sizeof(ChunkIndexEntry);
+        std::vector<char> record;
+        auto put = [&record](uint32_t value)
+        {
+            record.insert(record.end(), (const char*) &value, (const char*) &value + sizeof(value));
+        };
+        for (size_t c = 0; c < m_chunks.size(); c++)
+        {
+            const ChunkUtterances& utterances = *m_chunkUtterances[c];
+            record.clear();
+            for (size_t numFrames : utterances.numFrames)
+                put((uint32_t) numFrames);
+            for (const auto& streamPaths : utterances.paths)
+            {
+                for (const auto& streamPath : streamPaths)
+                {
+                    const std::string utf8Path = msra::strfun::utf8(streamPath);
+                    put((uint32_t) utf8Path.size());
+                    record.insert(record.end(), utf8Path.begin(), utf8Path.end());
+                }
+            }
+            for (unsigned int classId : utterances.classIds)
+                put(classId);
+            fwriteOrDie(record, f);
+            entries[c] = ChunkIndexEntry{m_chunks[c].numUtterances, m_chunks[c].numFrames, offset, record.size()};
+            offset += record.size();
+        }
+        fsetpos(f, sizeof(header));
+        fwriteOrDie(entries, f);
+        fflushOrDie(f);
+    }
+    renameOrDie(tempPath, path);
+    fprintf(stderr, "HTKDeserializer: wrote %d chunks to %ls\n", (int) m_chunks.size(), path.c_str());
+}
+
+// the utterances of a chunk, read from the chunk index if they are not in use already
+HTKDeserializer::ChunkUtterancesPtr HTKDeserializer::GetChunkUtterances(size_t chunkId) const
+{
+    if (!m_chunkUtterances.empty())
+        return m_chunkUtterances[chunkId];
+
+    std::lock_guard<std::mutex> lock(m_loadMutex);
+    ChunkUtterancesPtr loaded = m_loadedChunkUtterances[chunkId].lock();
+    if (loaded)
+        return loaded;
+
+    const ChunkInfo& chunk = m_chunks[chunkId];
+    const char* p = m_chunkIndex->data() + chunk.indexOffset;
+    const char* end = p + chunk.indexSize;
+    auto get = [&p, end, chunkId](void* value, size_t size)
+    {
+        if ((size_t) (end - p) < size)
+            RuntimeError("HTKDeserializer: the record of chunk %d in the chunk index is truncated.", (int) chunkId);
+        memcpy(value, p, size);
+        p += size;
+    };
+    auto utterances = make_shared<ChunkUtterances>();
+    std::vector<uint32_t> values(chunk.numUtterances);
+    if (!values.empty())
+        get(values.data(), values.size() * sizeof(uint32_t));
+    utterances->numFrames.assign(values.begin(), values.end());
+    utterances->paths.resize(m_features.size());
+    for (auto& streamPaths : utterances->paths)
+    {
+        for (size_t u = 0; u < chunk.numUtterances; u++)
+        {
+            uint32_t size;
+            get(&size, sizeof(size));
+            std::string utf8Path(size, '\0');
+            if (size > 0)
+                get(&utf8Path[0], size);
+            streamPaths.push_back(msra::strfun::utf16(utf8Path));
+        }
+    }
+    if (m_hasLabels)
+    {
+        utterances->classIds.resize(chunk.numFrames);
+        if (chunk.numFrames > 0)
+            get(utterances->classIds.data(), chunk.numFrames * sizeof(unsigned int));
+    }
+    if (p != end)
+        RuntimeError("HTKDeserializer: the record of chunk %d in the chunk index is corrupt.", (int) chunkId);
+
+    for (auto iter = m_loadedChunkUtterances.begin(); iter != m_loadedChunkUtterances.end();) // (forget those no longer in use)
+    {
+        if (iter->second.expired())
+            iter = m_loadedChunkUtterances.erase(iter);
+        else
+            ++iter;
+    }
+    m_loadedChunkUtterances[chunkId] = utterances;
+    return utterances;
+}
+
+std::vector<ChunkDescription> HTKDeserializer::GetChunkDescriptions() const
+{
+    std::vector<ChunkDescription> chunks;
+    for (size_t c = 0; c < m_chunks.size(); c++)
+        chunks.push_back(ChunkDescription{c, m_chunks[c].numFrames, m_frameMode ? m_chunks[c].numFrames : m_chunks[c].numUtterances});
+    return chunks;
+}
+
+// sequences are frames (id: the frame over all utterances) in frame mode, else utterances (id: the utterance)
+void HTKDeserializer::GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const
+{
+    const auto& chunk = m_chunks[chunkId];
+    if (m_frameMode) // (without reading the utterances)
+    {
+        for (size_t t = 0; t < chunk.numFrames; t++)
+            sequences.push_back(SequenceDescription{chunk.firstFrame + t, 1, chunkId});
+        return;
+    }
+    auto utterances = GetChunkUtterances(chunkId);
+    for (size_t u = 0; u < chunk.numUtterances; u++)
+        sequences.push_back(SequenceDescription{chunk.firstUtterance + u, utterances->numFrames[u], chunkId});
+}
+
+// the frames of one chunk's utterances
+class HTKChunk : public Chunk
+{
+public:
+    bool m_frameMode;
+    size_t m_firstUtterance, m_firstFrame;
+    std::vector<size_t> m_utteranceFrames;         // [utterance in chunk] its first frame in the chunk; one more for the end
+    std::vector<size_t> m_dims, m_contextLeft, m_contextRight; // [feature stream]
+    std::vector<std::vector<float>> m_features;    // [feature stream][frame in chunk * dim + i]
+    HTKDeserializer::ChunkUtterancesPtr m_utterances; // (for the states of the frames)
+    // the utterance and the frames [begin, end) of it to copy, of a sequence
+    void Locate(size_t sequenceId, size_t& utteranceBegin, size_t& utteranceEnd, size_t& begin, size_t& end) const
+    {
+        if (m_frameMode)
+        {
+            begin = sequenceId - m_firstFrame;
+            end = begin + 1;
+            const size_t u = std::upper_bound(m_utteranceFrames.begin(), m_utteranceFrames.end(), begin) - m_utteranceFrames.begin() - 1;
+            utteranceBegin = m_utteranceFrames[u];
+            utteranceEnd = m_utteranceFrames[u + 1];
+        }
+        else
+        {
+            const size_t u = sequenceId - m_firstUtterance;
+            begin = utteranceBegin = m_utteranceFrames[u];
+            end = utteranceEnd = m_utteranceFrames[u + 1];
+        }
+    }
+
+    // each frame with its context window; frames beyond the utterance's ends are replicated from its first or last frame
+    virtual void CopyDenseSequence(size_t sequenceId, size_t streamId, float* values, size_t colStride) const override
+    {
+        size_t utteranceBegin, utteranceEnd, begin, end;
+        Locate(sequenceId, utteranceBegin, utteranceEnd, begin, end);
+        const size_t dim = m_dims[streamId];
+        const float* features = m_features[streamId].data();
+        for (size_t t = begin; t < end; t++, values += colStride)
+        {
+            float* column = values;
+            for (size_t c = 0; c < m_contextLeft[streamId] + 1 + m_contextRight[streamId]; c++, column += dim)
+            {
+                ptrdiff_t source = (ptrdiff_t) t + (ptrdiff_t) c - (ptrdiff_t) m_contextLeft[streamId];
+                source = std::max((ptrdiff_t) utteranceBegin, std::min(source, (ptrdiff_t) utteranceEnd - 1));
+                memcpy(column, &features[source * dim], dim * sizeof(float));
+            }
+        }
+    }
+    virtual void CopyCategorySequence(size_t sequenceId, size_t /*streamId*/, size_t* categories) const override
+    {
+        size_t utteranceBegin, utteranceEnd, begin, end;
+        Locate(sequenceId, utteranceBegin, utteranceEnd, begin, end);
+        for (size_t t = begin; t < end; t++)
+            *categories++ = m_utterances->classIds[t];
+    }
+};
+
+// start fetching the remote feature files of a chunk (once per archive, which consecutive utterances usually share)
+void HTKDeserializer::PrefetchChunk(size_t chunkId)
+{
+    auto utterances = GetChunkUtterances(chunkId);
+    for (const auto& streamPaths : utterances->paths)
+    {
+        wstring previous;
+        for (const auto& streamPath : streamPaths)
+        {
+            const wstring path = msra::asr::htkfeatreader::parsedpath(streamPath).physicallocation();
+            if (path != previous && isremotepath(path))
+                prefetchremotefile(path);
+            previous = path;
+        }
+    }
+}
+
+ChunkPtr HTKDeserializer::GetChunk(size_t chunkId)
+{
+    const auto& info = m_chunks[chunkId];
+    auto chunk = make_shared<HTKChunk>();
+    chunk->m_frameMode = m_frameMode;
+    chunk->m_firstUtterance = info.firstUtterance;
+    chunk->m_firstFrame = info.firstFrame;
+    chunk->m_utterances = GetChunkUtterances(chunkId);
+    const ChunkUtterances& utterances = *chunk->m_utterances;
+    size_t numFrames = 0;
+    for (size_t utteranceFrames : utterances.numFrames)
+    {
+        chunk->m_utteranceFrames.push_back(numFrames);
+        numFrames += utteranceFrames;
+    }
+    chunk->m_utteranceFrames.push_back(numFrames);
+
+    msra::asr::htkfeatreader reader; // (own reader, since chunks are paged in concurrently)
+    for (size_t s = 0; s < m_features.size(); s++)
+    {
+        const auto& stream = m_features[s];
+        chunk->m_dims.push_back(stream.dim);
+        chunk->m_contextLeft.push_back(stream.contextLeft);
+        chunk->m_contextRight.push_back(stream.contextRight);
+        std::vector<float> features(numFrames * stream.dim);
+        string featKind;
+        unsigned int samplePeriod = 0;
+        for (size_t u = 0; u < utterances.numFrames.size(); u++)
+        {
+            const msra::asr::htkfeatreader::parsedpath ppath(utterances.paths[s][u]);
+            if (featKind.empty())
+            {
+                size_t featDim;
+                reader.getinfo(ppath, featKind, featDim, samplePeriod);
+                if (featDim != stream.dim)
+                    RuntimeError("HTKDeserializer: %ls has features of dimension %d instead of %d.", ((const wstring&) ppath).c_str(), (int) featDim, (int) stream.dim);
+            }
+            FrameStripe frames{&features[chunk->m_utteranceFrames[u] * stream.dim], stream.dim, utterances.numFrames[u]};
+            reader.read(ppath, (const string&) featKind, (const unsigned int) samplePeriod, frames); // (the stripe overload: no resize)
+        }
+        chunk->m_features.push_back(std::move(features));
+    }
+    return chunk;
+}
+
+} } }
@@ -0,0 +1,111 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// HTKDeserializer.h -- HTK features and MLF state alignments as a deserializer of the reader pipeline (pipeline=true, see PipelineReader.h)
+//
+
+#pragma once
+
+#include "DataDeserializer.h"
+#include "PipelineReader.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace msra { namespace files {
+class mappedfile;
+} }
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// HTKDeserializer -- utterances of HTK feature files, listed in scp files, with their state labels from MLFs
+// The configuration is that of HTKMLFReader's blockRandomize mode: feature sections (scpFile, dim, contextWindow, prefixPathInSCP)
+// and at most one label section (mlfFile or mlfFileList, labelMappingFile, labelDim). The scp files must give the frame ranges
+// (a=b[s,e] syntax). With frameMode=true (default) each frame is a sequence of its own, otherwise each utterance.
+// Each chunk is the consecutive utterances of about chunkSizeInSamples frames (default 90000, 15 minutes of speech), which are
+// read when it is paged in. Utterances without labels, or whose labels have a different number of frames, are skipped.
+// Feature files may be remote paths (see isremotepath()); those of upcoming chunks are fetched ahead (storagePrefetchChunks).
+// Not supported (use HTKMLFReader itself): lattices, feature caches, label-to-target mappings, truncated BPTT.
+//
+// chunkIndex=path: the utterances of each chunk (their lengths, feature paths and state labels) in a binary file, so that
+// the scp files and MLFs need not be parsed at all. Only the table of chunks is read at startup; the utterances of a chunk
+// are read from the memory-mapped file when its sequences or its data are asked for, and dropped after. With the
+// pipeline's shardChunks=true, each worker of a distributed run thus only ever reads the metadata of its own chunks.
+// The file is written (via a temp file) when it does not exist, or was made from text files of other sizes or another
+// chunkSizeInSamples; with several workers, let one run create it first, or all of them parse the text files once.
+// -----------------------------------------------------------------------
+
+class HTKDeserializer : public IDataDeserializer
+{
+public:
+    template <class ConfigRecordType>
+    HTKDeserializer(const ConfigRecordType& config);
+
+    virtual std::vector<StreamDescription> GetStreamDescriptions() const override
+    {
+        return m_streams;
+    }
+    virtual std::vector<ChunkDescription> GetChunkDescriptions() const override;
+    virtual void GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const override;
+    virtual ChunkPtr GetChunk(size_t chunkId) override;
+    virtual void PrefetchChunk(size_t chunkId) override;
+
+    // the utterances of one chunk
+    struct ChunkUtterances
+    {
+        std::vector<size_t> numFrames;               // [utterance in chunk]
+        std::vector<std::vector<std::wstring>> paths; // [feature stream][utterance in chunk]
+        std::vector<unsigned int> classIds;          // [frame in chunk] its state, if there are labels
+    };
+    typedef std::shared_ptr<const ChunkUtterances> ChunkUtterancesPtr;
+
+private:
+    struct FeatureStream
+    {
+        size_t dim;                  // of a frame in the files
+        size_t contextLeft, contextRight; // frames added on either side
+    };
+    struct ChunkInfo
+    {
+        size_t firstUtterance, numUtterances;
+        size_t firstFrame, numFrames; // over all utterances
+        size_t indexOffset, indexSize; // of its record in the chunk index
+    };
+
+    ChunkUtterancesPtr GetChunkUtterances(size_t chunkId) const;
+    bool ReadChunkIndex(const std::wstring& path, uint64_t signature);
+    void WriteChunkIndex(const std::wstring& path, uint64_t signature);
+
+    bool m_frameMode;
+    bool m_hasLabels;
+    std::vector<FeatureStream> m_features;
+    std::vector<StreamDescription> m_streams; // the features, then the labels
+    std::vector<ChunkInfo> m_chunks;
+
+    // the utterances: all of them (parsed from the text files), or read from the chunk index on demand
+    std::vector<ChunkUtterancesPtr> m_chunkUtterances;                            // [chunk], or empty if from the index
+    std::shared_ptr<msra::files::mappedfile> m_chunkIndex;
+    mutable std::map<size_t, std::weak_ptr<const ChunkUtterances>> m_loadedChunkUtterances; // [chunk] those still in use
+    mutable std::mutex m_loadMutex;
+};
+
+// HTKPipelineReader - the pipeline reader for HTK features and MLFs, exported as GetPipelineReaderF/D
+template <class ElemType>
+class HTKPipelineReader : public PipelineReader<ElemType>
+{
+protected:
+    virtual IDataDeserializerPtr CreateDeserializer(const ConfigParameters& config) override
+    {
+        return make_shared<HTKDeserializer>(config);
+    }
+    virtual IDataDeserializerPtr CreateDeserializer(const ScriptableObjects::IConfigRecord& config) override
+    {
+        return make_shared<HTKDeserializer>(config);
+    }
+};
+
+} } }
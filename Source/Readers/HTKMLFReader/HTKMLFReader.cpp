@@ -12,6 +12,7 @@
 #include "Basics.h"
 
 #include "htkfeatio.h"       // for reading HTK features
+#include "binarymlf.h"       // for fast loading of state alignments
 #include "latticearchive.h"  // for reading HTK phoneme lattices (MMI training)
 #include "simplesenonehmm.h" // for MMI scoring
 #include "msra_mgram.h"      // for unigram scores of ground-truth path in sequence training
@@ -26,6 +27,8 @@
 #include "ScriptableObjects.h"
 #include "HTKMLFReader.h"
 #include "TimerUtility.h"
+#include "GPUWatcher.h"
+#include "NumaPlacement.h"
 #ifdef LEAKDETECT
 #include <vld.h> // for memory leak detection
 #endif
@@ -58,6 +61,12 @@ template <class ConfigRecordType>
 void HTKMLFReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig)
 {
     m_truncated = readerConfig(L"truncated", false);
+    m_bucketByLength = readerConfig(L"bucketByLength", false); // group parallel utterances by length (whole-utterance mode)
+    m_stackFrames = readerConfig(L"stackFrames", (size_t) 1);   // low frame rate: stack this many frames into one, subsample the labels accordingly
+    if (m_stackFrames == 0)
+        InvalidArgument("'stackFrames' must be at least 1.");
+    m_numLayoutFrames = 0;
+    m_numLayoutGapFrames = 0;
     m_convertLabelsToTargets = false;
 
     intargvector numberOfuttsPerMinibatchForAllEpochs = readerConfig(L"nbruttsineachrecurrentiter", ConfigRecordType::Array(intargvector(vector<int>{1})));
@@ -74,6 +83,11 @@ void HTKMLFReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig
     m_numSeqsPerMB = m_numSeqsPerMBForAllEpochs[0];
     m_pMBLayout->Init(m_numSeqsPerMB, 0); // (SGD will ask before entering actual reading --TODO: This is hacky.)
 
+    // truncated BPTT: instead of a number of parallel sequences, a number of frames per minibatch can be asked for (0: use nbruttsineachrecurrentiter)
+    m_framesPerMBForAllEpochs = readerConfig(L"framesPerMinibatch", ConfigRecordType::Array(intargvector(vector<int>{0})));
+    if (!m_truncated && m_framesPerMBForAllEpochs[0] > 0)
+        InvalidArgument("framesPerMinibatch is only supported with truncated=true.");
+
     m_noData = false;
 
     wstring command(readerConfig(L"action", L"")); // look up in the config for the master command to determine whether we're writing output (inputs only) or training/evaluating (inputs and outputs)
@@ -103,13 +117,18 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
 {
     vector<wstring> scriptpaths;
     vector<wstring> RootPathInScripts;
+    vector<wstring> featureCachePaths;
+    vector<msra::dbn::packedfeaturecache::encodingkind> featureCacheEncodings;
     wstring RootPathInLatticeTocs;
+    float latticePruningBeam = 0, latticeMinPosterior = 0;
     vector<wstring> mlfpaths;
     vector<vector<wstring>> mlfpathsmulti;
+    vector<wstring> mlfCachePaths;
     size_t firstfilesonly = SIZE_MAX; // set to a lower value for testing
     vector<vector<wstring>> infilesmulti;
     size_t numFiles;
     wstring unigrampath(L"");
+    wstring unigramCachePath(L"");
     // wstring statelistpath(L"");
     size_t randomize = randomizeAuto;
     size_t iFeat, iLabel;
@@ -170,7 +189,10 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
         m_featureNameToIdMap[featureNames[i]] = iFeat;
         scriptpaths.push_back(thisFeature(L"scpFile"));
         RootPathInScripts.push_back(thisFeature(L"prefixPathInSCP", L""));
-        m_featureNameToDimMap[featureNames[i]] = m_featDims[i];
+        featureCachePaths.push_back(thisFeature(L"featureCacheFile", L"")); // packed copy of all features of this stream, see packedfeaturecache.h
+        wstring featureCacheEncoding = thisFeature(L"featureCacheEncoding", L"float32"); // how a newly packed cache stores the frames: float32, float16, or uint8
+        featureCacheEncodings.push_back(msra::dbn::packedfeaturecache::parseencoding(featureCacheEncoding));
+        m_featureNameToDimMap[featureNames[i]] = m_featDims[i] * m_stackFrames; // (the source delivers the frames unstacked)
 
         m_featuresBufferMultiIO.push_back(nullptr);
         m_featuresBufferAllocatedMultiIO.push_back(0);
@@ -221,6 +243,7 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
             }
         }
         mlfpathsmulti.push_back(mlfpaths);
+        mlfCachePaths.push_back(thisLabel(L"mlfCacheFile", L"")); // binary copy of the state alignments, see binarymlf.h
 
         m_labelsBufferMultiIO.push_back(nullptr);
         m_labelsBufferAllocatedMultiIO.push_back(0);
@@ -267,6 +290,9 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
             latticetocs.first.insert(latticetocs.first.end(), paths.begin(), paths.end());
         }
         RootPathInLatticeTocs = (wstring) thisLattice(L"prefixPathInToc", L"");
+        // optional pruning of the denominator lattices when they are loaded: a beam on the best path, and a posterior threshold (0 = off)
+        latticePruningBeam = thisLattice(L"pruningBeam", 0.0f);
+        latticeMinPosterior = thisLattice(L"minPosterior", 0.0f);
     }
 
     // get HMM related file names
@@ -299,6 +325,8 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
 
     m_frameMode = readerConfig(L"frameMode", true);
     m_verbosity = readerConfig(L"verbosity", 2);
+    m_utteranceSource = nullptr;
+    m_prefetchNearGPU = false;
 
     // determine if we partial minibatches are desired
     wstring minibatchMode(readerConfig(L"minibatchMode", L"partial"));
@@ -310,6 +338,11 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
     if (readMethod == L"blockRandomize" && randomize == randomizeNone)
         InvalidArgument("'randomize' cannot be 'none' when 'readMethod' is 'blockRandomize'.");
 
+    if (m_bucketByLength && (m_frameMode || m_truncated || readMethod != L"blockRandomize"))
+        InvalidArgument("'bucketByLength' requires 'frameMode=false', 'truncated=false', and 'readMethod=blockRandomize'.");
+    if (m_stackFrames > 1 && (m_frameMode || readMethod != L"blockRandomize" || !latticeNames.empty()))
+        InvalidArgument("'stackFrames' requires 'frameMode=false' and 'readMethod=blockRandomize', and cannot be used with lattices.");
+
     // read all input files (from multiple inputs)
     // TO DO: check for consistency (same number of files in each script file)
     numFiles = 0;
@@ -394,17 +427,30 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
 
     if (readerConfig.Exists(L"unigram"))
         unigrampath = (const wstring&) readerConfig(L"unigram");
+    if (readerConfig.Exists(L"unigramCacheFile"))
+        unigramCachePath = (const wstring&) readerConfig(L"unigramCacheFile"); // binary copy of the unigram, see mgram_binary in msra_mgram.h
 
     // load a unigram if needed (this is used for MMI training)
     msra::lm::CSymbolSet unigramsymbols;
-    std::unique_ptr<msra::lm::CMGramLM> unigram;
+    std::unique_ptr<msra::lm::ILM> unigram;
     size_t silencewordid = SIZE_MAX;
     size_t startwordid = SIZE_MAX;
     size_t endwordid = SIZE_MAX;
     if (unigrampath != L"")
     {
-        unigram.reset(new msra::lm::CMGramLM());
-        unigram->read(unigrampath, unigramsymbols, false /*filterVocabulary--false will build the symbol map*/, 1 /*maxM--unigram only*/);
+        // if a binary cache of the unigram is given and up to date, map that instead of parsing the ARPA file
+        const uint64_t unigramSignature = unigramCachePath.empty() ? 0 : msra::lm::mgram_binary::signature(unigrampath);
+        std::unique_ptr<msra::lm::CMappedMGramLM> mappedUnigram(new msra::lm::CMappedMGramLM());
+        if (!unigramCachePath.empty() && mappedUnigram->read(unigramCachePath, unigramSignature, unigramsymbols, false /*filterVocabulary*/, 1 /*maxM*/))
+            unigram = std::move(mappedUnigram);
+        else
+        {
+            std::unique_ptr<msra::lm::CMGramLM> arpaUnigram(new msra::lm::CMGramLM());
+            arpaUnigram->read(unigrampath, unigramsymbols, false /*filterVocabulary--false will build the symbol map*/, 1 /*maxM--unigram only*/);
+            if (!unigramCachePath.empty())
+                arpaUnigram->writebinary(unigramCachePath, unigramSignature);
+            unigram = std::move(arpaUnigram);
+        }
         silencewordid = unigramsymbols["!silence"]; // give this an id (even if not in the LM vocabulary)
         startwordid = unigramsymbols["<s>"];
         endwordid = unigramsymbols["</s>"];
@@ -435,14 +481,24 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
     // std::vector<std::wstring> pagepath;
     foreach_index (i, mlfpathsmulti)
     {
-        const msra::lm::CSymbolSet* wordmap = unigram ? &unigramsymbols : NULL;
-        msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>
-        labels(mlfpathsmulti[i], restrictmlftokeys, statelistpaths[i], wordmap, (map<string, size_t>*) NULL, htktimetoframe); // label MLF
-        // get the temp file name for the page file
-
-        // Make sure 'msra::asr::htkmlfreader' type has a move constructor
-        static_assert(std::is_move_constructible<msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>>::value,
-                      "Type 'msra::asr::htkmlfreader' should be move constructible!");
+        // if a binary cache of the MLF is given and up to date, load that instead of parsing the text
+        std::map<std::wstring, std::vector<msra::asr::htkmlfentry>> labels;
+        const uint64_t mlfSignature = mlfCachePaths[i].empty() ? 0 : msra::asr::binarymlf::signature(mlfpathsmulti[i], statelistpaths[i]);
+        if (mlfCachePaths[i].empty() || !msra::asr::binarymlf::read(mlfCachePaths[i], mlfSignature, restrictmlftokeys, labels))
+        {
+            const msra::lm::CSymbolSet* wordmap = unigram ? &unigramsymbols : NULL;
+            msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>
+            reader(mlfpathsmulti[i], restrictmlftokeys, statelistpaths[i], wordmap, (map<string, size_t>*) NULL, htktimetoframe); // label MLF
+            // get the temp file name for the page file
+
+            // Make sure 'msra::asr::htkmlfreader' type has a move constructor
+            static_assert(std::is_move_constructible<msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence>>::value,
+                          "Type 'msra::asr::htkmlfreader' should be move constructible!");
+
+            labels = std::move(static_cast<std::map<std::wstring, std::vector<msra::asr::htkmlfentry>>&>(reader));
+            if (!mlfCachePaths[i].empty() && restrictmlftokeys.empty()) // (a partial read must not end up in the cache)
+                msra::asr::binarymlf::write(mlfCachePaths[i], mlfSignature, labels);
+        }
 
         labelsmulti.push_back(std::move(labels));
     }
@@ -453,10 +509,42 @@ void HTKMLFReader<ElemType>::PrepareForTrainingOrTesting(const ConfigRecordType&
 
         m_lattices.reset(new msra::dbn::latticesource(latticetocs, m_hset.getsymmap(), RootPathInLatticeTocs));
         m_lattices->setverbosity(m_verbosity);
+        m_lattices->setpruning(latticePruningBeam, latticeMinPosterior);
 
         // now get the frame source. This has better randomization and doesn't create temp files
-        m_frameSource.reset(new msra::dbn::minibatchutterancesourcemulti(infilesmulti, labelsmulti, m_featDims, m_labelDims, numContextLeft, numContextRight, randomize, *m_lattices, m_latticeMap, m_frameMode));
+        auto utteranceSource = new msra::dbn::minibatchutterancesourcemulti(infilesmulti, labelsmulti, m_featDims, m_labelDims, numContextLeft, numContextRight, randomize, *m_lattices, m_latticeMap, m_frameMode);
+        m_frameSource.reset(utteranceSource);
         m_frameSource->setverbosity(m_verbosity);
+        if (std::any_of(featureCachePaths.begin(), featureCachePaths.end(), [](const wstring& path) { return !path.empty(); }))
+        {
+            // shareFeatureCache: use float32 caches in place from their mapping, so that all processes on a host share one copy of the features
+            const bool shareFeatureCache = readerConfig(L"shareFeatureCache", false);
+            utteranceSource->usefeaturecaches(featureCachePaths, featureCacheEncodings, shareFeatureCache);
+        }
+        // back the feature chunks with huge pages (none, transparent, reserved), as CNTK's option of the same name does for the matrices
+        SetAlignedMemoryHugePages(ParseHugePageMode((wstring) readerConfig(L"hugePages", L"none")), readerConfig(L"hugePageMinMB", (size_t) 64) * 1024 * 1024);
+        // read chunks ahead on background threads, so that getbatch() does not wait for the disk when it enters new chunks
+        const size_t numPrefetchThreads = readerConfig(L"numPrefetchThreads", (size_t) 0);
+        const size_t prefetchMemoryMB = readerConfig(L"prefetchMemoryMB", (size_t) 1024);
+        utteranceSource->setprefetching(numPrefetchThreads, prefetchMemoryMB * 1024 * 1024);
+        // and take these threads out of the math's, so that both together do not oversubscribe the cores (reserveCPUThreads=false: leave them)
+        if (numPrefetchThreads > 0 && readerConfig(L"reserveCPUThreads", true))
+        {
+            CPUMatrix<ElemType>::ReleaseThreads(m_numReservedCPUThreads);
+            m_numReservedCPUThreads = CPUMatrix<ElemType>::ReserveThreads((int) numPrefetchThreads);
+            if (m_numReservedCPUThreads > 0)
+                fprintf(stderr, "HTKMLFReader: %d of the CPU threads are reserved for prefetching.\n", m_numReservedCPUThreads);
+        }
+        // keep paged-out chunks in RAM across epochs, up to this budget, so that corpora that fit are read from disk only once
+        const size_t chunkCacheMemoryMB = readerConfig(L"chunkCacheMemoryMB", (size_t) 0);
+        utteranceSource->setchunkcache(chunkCacheMemoryMB * 1024 * 1024);
+        // place them on a NUMA node: 'auto' = the one the GPU hangs off, or a node number; default: wherever the OS puts them
+        const wstring prefetchNumaNode = readerConfig(L"prefetchNumaNode", L"none");
+        m_utteranceSource = utteranceSource;
+        if (prefetchNumaNode == L"auto")
+            m_prefetchNearGPU = true;
+        else if (prefetchNumaNode != L"none")
+            utteranceSource->setprefetchnumanode(msra::strfun::toint(prefetchNumaNode));
     }
     else if (!_wcsicmp(readMethod.c_str(), L"rollingWindow"))
     {
@@ -645,6 +733,12 @@ void HTKMLFReader<ElemType>::StartDistributedMinibatchLoop(size_t requestedMBSiz
     m_mbNumTimeSteps = requestedMBSize; // note: ignored in frame mode and full-sequence mode
 
     m_numSeqsPerMB = m_numSeqsPerMBForAllEpochs[epoch];
+    if (m_truncated && m_framesPerMBForAllEpochs[epoch] > 0 && m_mbNumTimeSteps > 0)
+    {
+        // since utterances are packed back to back into each parallel sequence, all but the epoch's last minibatches have exactly this many frames
+        m_numSeqsPerMB = max((size_t) 1, ((size_t) m_framesPerMBForAllEpochs[epoch] + m_mbNumTimeSteps / 2) / m_mbNumTimeSteps);
+        fprintf(stderr, "HTKMLFReader: %d parallel sequences of %d frames for framesPerMinibatch=%d\n", (int) m_numSeqsPerMB, (int) m_mbNumTimeSteps, (int) m_framesPerMBForAllEpochs[epoch]);
+    }
 
     // For distributed reading under utterance mode, we distribute the utterances per minibatch among all the subsets
     if (m_trainOrTest && !m_frameMode)
@@ -667,6 +761,8 @@ void HTKMLFReader<ElemType>::StartDistributedMinibatchLoop(size_t requestedMBSiz
     m_numFramesToProcess.assign(m_numSeqsPerMB, 0);
     m_switchFrame.assign(m_numSeqsPerMB, 0);
     m_numValidFrames.assign(m_numSeqsPerMB, 0);
+    m_bufferStartFrame.assign(m_numSeqsPerMB, SIZE_MAX);
+    m_bufferDataPass.assign(m_numSeqsPerMB, 0);
 
     if (m_trainOrTest)
     {
@@ -735,6 +831,12 @@ void HTKMLFReader<ElemType>::StartMinibatchLoopToTrainOrTest(size_t mbSize, size
         requestedEpochSamples = totalFrames;
     }
 
+    // group utterances by length for this epoch's number of parallel sequences (across all subsets); this must precede creating the iterator
+    if (m_bucketByLength)
+        m_frameSource->setlengthbucketing(m_numSeqsPerMBForAllEpochs[epoch]);
+    m_numLayoutFrames = 0;
+    m_numLayoutGapFrames = 0;
+
     m_mbiter.reset(new msra::dbn::minibatchiterator(*m_frameSource, epoch, requestedEpochSamples, mbSize, subsetNum, numSubsets, datapasses));
     // Advance the MB iterator until we find some data or reach the end of epoch
     while ((m_mbiter->currentmbframes() == 0) && *m_mbiter)
@@ -889,6 +991,16 @@ bool HTKMLFReader<ElemType>::GetMinibatchToTrainOrTest(std::map<std::wstring, Ma
         m_checkDictionaryKeys = false;
     }
 
+    if (m_prefetchNearGPU && !matrices.empty())
+    {
+        const int deviceId = matrices.begin()->second->GetDeviceId();
+        const int node = deviceId >= 0 ? GPUWatcher::GetNumaNodeOfCUDADevice(deviceId) : NoNumaNode;
+        if (m_verbosity > 0)
+            fprintf(stderr, "HTKMLFReader: prefetching on NUMA node %d (%s)\n", node, node == NoNumaNode ? "unknown, not bound" : "that of the GPU");
+        m_utteranceSource->setprefetchnumanode(node);
+        m_prefetchNearGPU = false;
+    }
+
     Timer aggregateTimer;
     if (m_verbosity > 2)
         aggregateTimer.Start();
@@ -907,6 +1019,12 @@ bool HTKMLFReader<ElemType>::GetMinibatchToTrainOrTest(std::map<std::wstring, Ma
             m_extraSeqsPerMB.clear();
             if (m_noData && m_numFramesToProcess[0] == 0) // no data left for the first channel of this minibatch,
             {
+                // report the padding of this epoch's minibatch layouts (once)
+                if (m_numLayoutFrames > 0 && m_verbosity > 0)
+                    fprintf(stderr, "HTKMLFReader: %.2f%% of the %d frames of the minibatch layouts of this epoch were gaps (padding)%s\n",
+                            100.0 * m_numLayoutGapFrames / m_numLayoutFrames, (int) m_numLayoutFrames, m_bucketByLength ? ", with utterances grouped by length" : "");
+                m_numLayoutFrames = 0;
+                m_numLayoutGapFrames = 0;
                 return false;
             }
 
@@ -1041,7 +1159,11 @@ bool HTKMLFReader<ElemType>::GetMinibatchToTrainOrTest(std::map<std::wstring, Ma
 
                     // and declare the remaining gaps as such
                     for (size_t i = 0; i < m_numSeqsPerMB; i++)
+                    {
                         m_pMBLayout->AddGap(i, m_numValidFrames[i], m_mbNumTimeSteps);
+                        m_numLayoutGapFrames += m_mbNumTimeSteps - m_numValidFrames[i];
+                    }
+                    m_numLayoutFrames += m_mbNumTimeSteps * m_numSeqsPerMB;
                 } // if (!frameMode)
 
                 for (auto iter = matrices.begin(); iter != matrices.end(); iter++)
@@ -1243,78 +1365,23 @@ bool HTKMLFReader<ElemType>::GetMinibatchToTrainOrTest(std::map<std::wstring, Ma
                     //    m_pMBLayout->Set(i, actualmbsize[i] - 1, MinibatchPackingFlags::SequenceEnd); // NOTE: this ORs, while original code overwrote in matrix but ORed into vector
                     // at this point, we completed an utterance--fill the rest with the next utterance
 
-                    // BUGBUG: We should fill in a loop until we fill the minibatch for the case where just one ReNew is not sufficient
-                    // to fill up the remaining slots in the minibatch
+                    // Keep packing utterances into this slot until it is full. Each starts a new sequence in the MBLayout,
+                    // which is what resets the state of PastValue nodes. The one that does not fit continues in the next minibatch.
+                    size_t t = actualmbsize[i]; // first free time step in this slot
                     bool reNewSucc = ReNewBufferForMultiIO(i);
-                    if (actualmbsize[i] < m_mbNumTimeSteps) // we actually have space
+                    while (t < m_mbNumTimeSteps && reNewSucc)
                     {
-                        if (reNewSucc) // we actually have another utterance to start here
-                        {
-                            const size_t startT = m_switchFrame[i];
-                            const size_t endT = m_mbNumTimeSteps;
-                            // Note: Don't confuse startT/endT with startFr/endFr above.
-
-                            // add sequence to MBLayout
-                            m_pMBLayout->AddSequence(NEW_SEQUENCE_ID, i, startT, startT + m_numFramesToProcess[i]);
-
-                            // copy the data
-                            for (auto iter = matrices.begin(); iter != matrices.end(); iter++)
-                            {
-                                // dereference matrix that corresponds to key (input/output name) and
-                                // populate based on whether its a feature or a label
-                                // Matrix<ElemType>& data = *matrices[iter->first]; // can be features or labels
-
-                                if (m_nameToTypeMap[iter->first] == InputOutputTypes::real)
-                                {
-                                    id = m_featureNameToIdMap[iter->first];
-                                    dim = m_featureNameToDimMap[iter->first];
-                                    if (sizeof(ElemType) == sizeof(float))
-                                    {
-                                        for (size_t t = startT, fr = 0; t < endT; t++, fr++) // column major, so iterate columns
-                                        {
-                                            // copy over the entire column at once, need to do this because SSEMatrix may have gaps at the end of the columns (for SSE alignment)
-                                            memcpy_s(&m_featuresBufferMultiIO[id].get()[(t * m_numSeqsPerMB + i) * dim], sizeof(ElemType) * dim, &m_featuresBufferMultiUtt[i].get()[fr * dim + m_featuresStartIndexMultiUtt[id + i * numOfFea]], sizeof(ElemType) * dim);
-                                        }
-                                    }
-                                    else
-                                    {
-                                        for (size_t t = startT, fr = 0; t < endT; t++, fr++) // column major, so iterate columns in outside loop
-                                        {
-                                            for (int d = 0; d < dim; d++)
-                                                m_featuresBufferMultiIO[id].get()[(t * m_numSeqsPerMB + i) * dim + d] = m_featuresBufferMultiUtt[i].get()[fr * dim + d + m_featuresStartIndexMultiUtt[id + i * numOfFea]];
-                                        }
-                                    }
-                                }
-                                else if (m_nameToTypeMap[iter->first] == InputOutputTypes::category)
-                                {
-                                    id = m_labelNameToIdMap[iter->first];
-                                    dim = m_labelNameToDimMap[iter->first];
-                                    for (size_t t = startT, fr = 0; t < endT; t++, fr++)
-                                    {
-                                        for (int d = 0; d < dim; d++)
-                                            m_labelsBufferMultiIO[id].get()[(t * m_numSeqsPerMB + i) * dim + d] = m_labelsBufferMultiUtt[i].get()[fr * dim + d + m_labelsStartIndexMultiUtt[id + i * numOfLabel]];
-                                    }
-                                }
-                            }
-
-                            m_processedFrame[i] += (endT - startT);
-
-                            // BUGBUG: since we currently cannot fill >1 utterances, at least let's check
-                            size_t a = actualmbsize[i] + (endT - startT);
-                            // actualmbsize[i] += (endT - startT);          // BUGBUG: don't we need something like this?
-                            if (a < m_mbNumTimeSteps)
-                            {
-                                fprintf(stderr, "GetMinibatchToTrainOrTest(): WARNING: Packing a second utterance did still not fill all time slots; filling slots from %d on as gaps.\n", (int) a);
-                                // declare the rest as a gap
-                                m_pMBLayout->AddGap(i, a, m_mbNumTimeSteps);
-                            }
-                        }
-                        else // we did have space for more, but no more data is available. BUGBUG: we should update actualmbsize[i] above and re-test here
-                        {
-                            // declare the rest as a gap
-                            m_pMBLayout->AddGap(i, actualmbsize[i], m_mbNumTimeSteps);
-                        }
-                    } // if (actualmbsize[i] < m_mbNumTimeSteps)         // we actually have space
+                        m_pMBLayout->AddSequence(NEW_SEQUENCE_ID, i, t, t + m_numFramesToProcess[i]);
+                        const size_t framenum = min(m_numFramesToProcess[i], m_mbNumTimeSteps - t);
+                        fillOneUttDataforParallelmode(matrices, t, framenum, i, i);
+                        m_processedFrame[i] += framenum;
+                        t += framenum;
+                        if (m_processedFrame[i] < m_numFramesToProcess[i]) // to be continued
+                            break;
+                        reNewSucc = ReNewBufferForMultiIO(i); // used up, too (or it ended exactly with the minibatch)
+                    }
+                    if (t < m_mbNumTimeSteps) // no more data is available: declare the rest as a gap
+                        m_pMBLayout->AddGap(i, t, m_mbNumTimeSteps);
                 }
             } // for (size_t i = 0; i < m_numSeqsPerMB; i++)
             // we are done filling all parallel sequences
@@ -1548,15 +1615,26 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
         return false;
     }
 
+    m_bufferStartFrame[i] = m_mbiter->currentmbstartframe();
+    m_bufferDataPass[i] = m_mbiter->currentdatapass();
+
     size_t numOfFea = m_featuresBufferMultiIO.size();
     size_t numOfLabel = m_labelsBufferMultiIO.size();
 
+    // With frame stacking, stacked frame j is the source frames j * m_stackFrames ... (j + 1) * m_stackFrames - 1, which are consecutive
+    // in the column-major buffer already; the utterance is padded to a multiple of m_stackFrames by repeating its last frame.
+    // The label of stacked frame j is that of its middle source frame.
+    const auto numStackedFrames = [this](size_t numFrames)
+    {
+        return (numFrames + m_stackFrames - 1) / m_stackFrames;
+    };
+
     size_t totalFeatNum = 0;
     foreach_index (id, m_featuresBufferAllocatedMultiIO)
     {
         const msra::dbn::matrixstripe featOri = m_mbiter->frames(id);
         size_t fdim = featOri.rows();
-        const size_t actualmbsizeOri = featOri.cols();
+        const size_t actualmbsizeOri = numStackedFrames(featOri.cols()) * m_stackFrames;
         m_featuresStartIndexMultiUtt[id + i * numOfFea] = totalFeatNum;
         totalFeatNum = fdim * actualmbsizeOri + m_featuresStartIndexMultiUtt[id + i * numOfFea];
     }
@@ -1573,7 +1651,7 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
         size_t dim = m_labelNameToDimMap[it->first];
 
         const vector<size_t>& uids = m_mbiter->labels(id);
-        size_t actualmbsizeOri = uids.size();
+        size_t actualmbsizeOri = numStackedFrames(uids.size());
         m_labelsStartIndexMultiUtt[id + i * numOfLabel] = totalLabelsNum;
         totalLabelsNum = m_labelsStartIndexMultiUtt[id + i * numOfLabel] + dim * actualmbsizeOri;
     }
@@ -1590,7 +1668,8 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
     foreach_index (id, m_featuresBufferMultiIO)
     {
         const msra::dbn::matrixstripe featOri = m_mbiter->frames(id);
-        const size_t actualmbsizeOri = featOri.cols();
+        const size_t numSourceFrames = featOri.cols();
+        const size_t actualmbsizeOri = numStackedFrames(numSourceFrames);
         size_t fdim = featOri.rows();
         if (first)
         {
@@ -1604,23 +1683,24 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
                 RuntimeError("The multi-IO features has inconsistent number of frames!");
             }
         }
-        assert(actualmbsizeOri == m_mbiter->currentmbframes());
+        assert(numSourceFrames == m_mbiter->currentmbframes());
 
+        const size_t numPaddedFrames = actualmbsizeOri * m_stackFrames;
         if (sizeof(ElemType) == sizeof(float))
         {
-            for (int k = 0; k < actualmbsizeOri; k++) // column major, so iterate columns
+            for (int k = 0; k < numPaddedFrames; k++) // column major, so iterate columns
             {
                 // copy over the entire column at once, need to do this because SSEMatrix may have gaps at the end of the columns
-                memcpy_s(&m_featuresBufferMultiUtt[i].get()[k * fdim + m_featuresStartIndexMultiUtt[id + i * numOfFea]], sizeof(ElemType) * fdim, &featOri(0, k), sizeof(ElemType) * fdim);
+                memcpy_s(&m_featuresBufferMultiUtt[i].get()[k * fdim + m_featuresStartIndexMultiUtt[id + i * numOfFea]], sizeof(ElemType) * fdim, &featOri(0, min((size_t) k, numSourceFrames - 1)), sizeof(ElemType) * fdim);
             }
         }
         else
         {
-            for (int k = 0; k < actualmbsizeOri; k++) // column major, so iterate columns in outside loop
+            for (int k = 0; k < numPaddedFrames; k++) // column major, so iterate columns in outside loop
             {
                 for (int d = 0; d < featOri.rows(); d++)
                 {
-                    m_featuresBufferMultiUtt[i].get()[k * featOri.rows() + d + m_featuresStartIndexMultiUtt[id + i * numOfFea]] = featOri(d, k);
+                    m_featuresBufferMultiUtt[i].get()[k * featOri.rows() + d + m_featuresStartIndexMultiUtt[id + i * numOfFea]] = featOri(d, min((size_t) k, numSourceFrames - 1));
                 }
             }
         }
@@ -1632,16 +1712,20 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
         size_t dim = m_labelNameToDimMap[it->first];
 
         const vector<size_t>& uids = m_mbiter->labels(id);
-        size_t actualmbsizeOri = uids.size();
+        size_t actualmbsizeOri = numStackedFrames(uids.size());
+        const auto uid = [&](size_t k)
+        {
+            return uids[min(k * m_stackFrames + m_stackFrames / 2, uids.size() - 1)];
+        };
 
         if (m_convertLabelsToTargetsMultiIO[id])
         {
             size_t labelDim = m_labelToTargetMapMultiIO[id].size();
             for (int k = 0; k < actualmbsizeOri; k++)
             {
-                assert(uids[k] < labelDim);
+                assert(uid(k) < labelDim);
                 labelDim;
-                size_t labelId = uids[k];
+                size_t labelId = uid(k);
                 for (int j = 0; j < dim; j++)
                 {
                     m_labelsBufferMultiUtt[i].get()[k * dim + j + m_labelsStartIndexMultiUtt[id + i * numOfLabel]] = m_labelToTargetMapMultiIO[id][labelId][j];
@@ -1654,8 +1738,8 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
             // in the future we want to use a sparse matrix here
             for (int k = 0; k < actualmbsizeOri; k++)
             {
-                assert(uids[k] < dim);
-                m_labelsBufferMultiUtt[i].get()[k * dim + uids[k] + m_labelsStartIndexMultiUtt[id + i * numOfLabel]] = (ElemType) 1;
+                assert(uid(k) < dim);
+                m_labelsBufferMultiUtt[i].get()[k * dim + uid(k) + m_labelsStartIndexMultiUtt[id + i * numOfLabel]] = (ElemType) 1;
             }
         }
     }
@@ -1699,6 +1783,66 @@ bool HTKMLFReader<ElemType>::ReNewBufferForMultiIO(size_t i)
     return true;
 }
 
+// GetState - the position within the epoch: that of m_mbiter, and for each parallel sequence, where its current utterance was read from and how far it was returned
+// The utterances themselves are not part of the state; SetState() reads them again, which gives the same data since the randomization only depends on the frame position.
+template <class ElemType>
+bool HTKMLFReader<ElemType>::GetState(ReaderState& state)
+{
+    if (!m_trainOrTest || !m_mbiter)
+        return false;
+
+    state.clear();
+    state[L"iterator"] = {m_mbiter->currentmbstartframe(), m_mbiter->currentdatapass(), (size_t) (m_noData ? 1 : 0)};
+    auto& sequences = state[L"sequences"];
+    for (size_t i = 0; i < m_numSeqsPerMB; i++)
+    {
+        const size_t values[] = {m_bufferStartFrame[i], m_bufferDataPass[i], m_numFramesToProcess[i], m_processedFrame[i], m_switchFrame[i], (size_t) (m_sentenceEnd[i] ? 1 : 0)};
+        sequences.insert(sequences.end(), begin(values), end(values));
+    }
+    state[L"layoutFrames"] = {m_numLayoutFrames, m_numLayoutGapFrames};
+    return true;
+}
+
+// SetState - continue from a position obtained through GetState(), after StartMinibatchLoop() for the same epoch
+template <class ElemType>
+bool HTKMLFReader<ElemType>::SetState(const ReaderState& state)
+{
+    if (!m_trainOrTest || !m_mbiter)
+        return false;
+
+    const size_t valuesPerSequence = 6;
+    auto iterator = state.find(L"iterator");
+    auto sequences = state.find(L"sequences");
+    auto layoutFrames = state.find(L"layoutFrames");
+    if (iterator == state.end() || iterator->second.size() != 3 ||
+        sequences == state.end() || sequences->second.size() != m_numSeqsPerMB * valuesPerSequence ||
+        layoutFrames == state.end() || layoutFrames->second.size() != 2)
+        InvalidArgument("HTKMLFReader: The reader state does not match the configuration (e.g. it was saved with a different number of parallel sequences).");
+
+    // get each parallel sequence's utterance again from where it was read, and restore its cursor
+    for (size_t i = 0; i < m_numSeqsPerMB; i++)
+    {
+        const size_t* values = &sequences->second[i * valuesPerSequence];
+        if (values[0] != SIZE_MAX)
+        {
+            m_noData = false;
+            m_mbiter->seek(values[0], values[1]);
+            if (!*m_mbiter || !ReNewBufferForMultiIO(i) || (values[2] != 0 && m_numFramesToProcess[i] != values[2]))
+                RuntimeError("HTKMLFReader: The utterances at the saved reader state differ from those read when it was saved. Has the data changed?");
+        }
+        m_numFramesToProcess[i] = values[2];
+        m_processedFrame[i] = values[3];
+        m_switchFrame[i] = values[4];
+        m_sentenceEnd[i] = values[5] != 0;
+    }
+
+    m_mbiter->seek(iterator->second[0], iterator->second[1]);
+    m_noData = iterator->second[2] != 0;
+    m_numLayoutFrames = layoutFrames->second[0];
+    m_numLayoutGapFrames = layoutFrames->second[1];
+    return true;
+}
+
 // GetLabelMapping - Gets the label mapping from integer to type in file
 // mappingTable - a map from numeric datatype to native label type stored as a string
 template <class ElemType>
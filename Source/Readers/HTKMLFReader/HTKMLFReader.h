@@ -8,6 +8,11 @@
 #include "DataReader.h"
 #include "Config.h" // for intargvector
 #include "CUDAPageLockedMemAllocator.h"
+#include "CPUMatrix.h" // for ReserveThreads()
+
+namespace msra { namespace dbn {
+class minibatchutterancesourcemulti; // (utterancesourcemulti.h)
+} }
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -20,15 +25,23 @@ private:
 
     unique_ptr<msra::dbn::minibatchiterator> m_mbiter;
     unique_ptr<msra::dbn::minibatchsource> m_frameSource;
+    msra::dbn::minibatchutterancesourcemulti* m_utteranceSource; // (m_frameSource if that is one, else null) for binding its prefetching threads
+    bool m_prefetchNearGPU;                                       // bind them to the NUMA node of the GPU once the first minibatch tells us which
+    int m_numReservedCPUThreads;                                  // taken from the math's OpenMP threads for the prefetching threads
     unique_ptr<msra::dbn::FileEvalSource> m_fileEvalSource;
     unique_ptr<msra::dbn::latticesource> m_lattices;
     map<wstring, msra::lattices::lattice::htkmlfwordsequence> m_latticeMap;
 
     vector<bool> m_sentenceEnd;
     bool m_truncated;
+    bool m_bucketByLength;       // group the utterances of a minibatch by length (whole-utterance mode only)
+    size_t m_stackFrames;        // stack this many consecutive frames into one and keep every m_stackFrames-th label (low frame rate; not in frame mode)
+    size_t m_numLayoutFrames;    // frames of all minibatch layouts of this epoch (whole-utterance mode), for reporting the padding
+    size_t m_numLayoutGapFrames; // and how many of them were gaps
     bool m_frameMode;
     vector<size_t> m_processedFrame; // [seq index] (truncated BPTT only) current time step (cursor)
     intargvector m_numSeqsPerMBForAllEpochs;
+    intargvector m_framesPerMBForAllEpochs; // (truncated BPTT only) if > 0, determines m_numSeqsPerMB from the truncation length
     size_t m_numSeqsPerMB;      // requested number of parallel sequences
     size_t m_mbNumTimeSteps;    // number of time steps  to fill/filled (note: for frame randomization, this the #frames, and not 1 as later reported)
     size_t m_mbMaxNumTimeSteps; // max time steps we take in a MB layout; any setence longer than this max will be discarded (and a warning will be issued )
@@ -37,6 +50,8 @@ private:
     vector<size_t> m_numFramesToProcess; // [seq index] number of frames available (left to return) in each parallel sequence
     vector<size_t> m_switchFrame;        // TODO: something like the position where a new sequence starts; still supported?
     vector<size_t> m_numValidFrames;     // [seq index] valid #frames in each parallel sequence. Frames (s, t) with t >= m_numValidFrames[s] are NoInput.
+    vector<size_t> m_bufferStartFrame;   // [seq index] m_mbiter position the utterance in each parallel sequence was read from (SIZE_MAX: none yet), for GetState()
+    vector<size_t> m_bufferDataPass;     // [seq index] and its data pass
     vector<size_t> m_extraSeqsPerMB;
     size_t m_extraNumSeqs;
     bool m_noData;
@@ -140,7 +155,7 @@ public:
     // TODO: this ^^ does not seem to belong here.
 
     HTKMLFReader()
-        : m_pMBLayout(make_shared<MBLayout>())
+        : m_numReservedCPUThreads(0), m_pMBLayout(make_shared<MBLayout>())
     {
     }
     template <class ConfigRecordType>
@@ -159,6 +174,7 @@ public:
     }
     virtual ~HTKMLFReader()
     {
+        CPUMatrix<ElemType>::ReleaseThreads(m_numReservedCPUThreads);
     }
 
     virtual void StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples = requestDataSize)
@@ -186,6 +202,9 @@ public:
     void SetSentenceEnd(int /*actualMbSize*/){};
     void SetRandomSeed(int){NOT_IMPLEMENTED};
 
+    virtual bool GetState(ReaderState& state) override;
+    virtual bool SetState(const ReaderState& state) override;
+
     bool RequireSentenceSeg() const override
     {
         return !m_frameMode;
@@ -69,6 +69,21 @@ void HTKMLFWriter<ElemType>::InitFromConfig(const ConfigRecordType& writerConfig
         {
             RuntimeError("HTKMLFWriter::Init: output type for writer output expected to be Real");
         }
+
+        // optionally, all utterances go into one chunked archive, with FP16 (default) or 8-bit values; the scp names the
+        // utterances (archiveFile.scp then lists them as name=archiveFile[s,e], for HTKMLFReader to read them back)
+        ArchiveOutput archive;
+        archive.scp = nullptr;
+        if (thisOutput.Exists("archiveFile"))
+        {
+            archive.path = (wstring) thisOutput(L"archiveFile");
+            const auto encoding = FeatureArchive::ParseEncoding(wstring(thisOutput(L"archiveEncoding", L"float16")));
+            const size_t chunkFrames = thisOutput(L"archiveChunkFrames", (size_t) 65536);
+            archive.writer.reset(new FeatureArchive::Writer(archive.path, udims[i], "USER", 100000, encoding, chunkFrames));
+            archive.scp = fopenOrDie(archive.path + L".scp", L"w");
+            fprintf(stderr, "HTKMLFWriter::Init: writing output %ls into archive %ls, as %s\n", outputNames[i].c_str(), archive.path.c_str(), FeatureArchive::EncodingName(encoding));
+        }
+        archives.push_back(archive);
     }
 
     numFiles = 0;
@@ -103,6 +118,17 @@ void HTKMLFWriter<ElemType>::Destroy()
     delete[] m_tempArray;
     m_tempArray = nullptr;
     m_tempArraySize = 0;
+
+    for (auto& archive : archives)
+    {
+        if (!archive.writer)
+            continue;
+        archive.writer->Close();
+        archive.writer.reset();
+        fflushOrDie(archive.scp);
+        fcloseOrDie(archive.scp);
+        archive.scp = nullptr;
+    }
 }
 
 template <class ElemType>
@@ -129,7 +155,10 @@ bool HTKMLFWriter<ElemType>::SaveData(size_t /*recordStart*/, const std::map<std
         assert(outputData.GetNumRows() == dim);
         dim;
 
-        Save(outFile, outputData);
+        if (archives[id].writer)
+            SaveToArchive(archives[id], outFile, outputData);
+        else
+            Save(outFile, outputData);
     }
 
     outputFileIndex++;
@@ -166,6 +195,22 @@ void HTKMLFWriter<ElemType>::Save(std::wstring& outputFile, Matrix<ElemType>& ou
     fprintf(stderr, "evaluate: writing %d frames of %ls\n", (int) output.cols(), outputFile.c_str());
 }
 
+// append an utterance to the archive, under the name of its output file in the scp
+template <class ElemType>
+void HTKMLFWriter<ElemType>::SaveToArchive(ArchiveOutput& archive, const std::wstring& name, Matrix<ElemType>& outputData)
+{
+    const size_t numFrames = outputData.GetNumCols();
+    if (numFrames == 0) // (cannot be listed as a range)
+    {
+        fprintf(stderr, "HTKMLFWriter: WARNING: skipping '%ls', which has no frames\n", name.c_str());
+        return;
+    }
+    outputData.CopyToArray(m_tempArray, m_tempArraySize);
+    archiveFrames.assign(m_tempArray, m_tempArray + outputData.GetNumElements());
+    const size_t firstFrame = archive.writer->Write(archiveFrames.data(), numFrames, outputData.GetNumRows());
+    fprintfOrDie(archive.scp, "%ls=%ls[%d,%d]\n", name.c_str(), archive.path.c_str(), (int) firstFrame, (int) (firstFrame + numFrames - 1));
+}
+
 template <class ElemType>
 void HTKMLFWriter<ElemType>::SaveMapping(std::wstring saveId, const std::map<LabelIdType, LabelType>& /*labelMapping*/)
 {
@@ -7,7 +7,9 @@
 #pragma once
 #include "DataWriter.h"
 #include "ScriptableObjects.h"
+#include "FeatureArchive.h"
 #include <map>
+#include <memory>
 #include <vector>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
@@ -26,6 +28,17 @@ private:
     unsigned int sampPeriod;
     size_t outputFileIndex;
     void Save(std::wstring& outputFile, Matrix<ElemType>& outputData);
+
+    // outputs written into a FeatureArchive (archiveFile) instead of one HTK file per utterance
+    struct ArchiveOutput
+    {
+        std::shared_ptr<FeatureArchive::Writer> writer;
+        FILE* scp; // lists the utterances as name=archive[s,e], for HTKMLFReader
+        std::wstring path;
+    };
+    std::vector<ArchiveOutput> archives; // [output id] (writer null if HTK files)
+    std::vector<float> archiveFrames;
+    void SaveToArchive(ArchiveOutput& archive, const std::wstring& name, Matrix<ElemType>& outputData);
     ElemType* m_tempArray;
     size_t m_tempArraySize;
 
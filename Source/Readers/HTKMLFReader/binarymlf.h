@@ -0,0 +1,184 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// binarymlf.h -- compact binary form of the state alignments of MLF files, which loads much faster than parsing the text
+//
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include "htkfeatio.h" // for htkmlfentry
+#include "mappedfile.h"
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace msra { namespace asr {
+
+// -----------------------------------------------------------------------
+// binarymlf -- what htkmlfreader makes of a set of MLF files (without word-level transcripts), stored for memory-mapping
+//
+// File layout:
+//  - header: magic, version, signature of the text files it was made from, counts
+//  - key offsets [numkeys + 1] into the key blob, and entry offsets [numkeys + 1] into the entries (i.e. an offset table)
+//  - entries: one state-ID run (first frame, #frames, state id, phone start) per MLF line, all utterances concatenated
+//  - key blob: all keys in UTF-8, in sort order of the keys, without separators
+// The text MLF stays the reference: if the signature (sizes of the MLF and state list files) has changed, read() fails,
+// and the caller parses the text and writes a new cache.
+// -----------------------------------------------------------------------
+
+class binarymlf
+{
+    struct fileheader
+    {
+        char magic[8]; // "BINMLF\0\0"
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t signature;
+        uint64_t numkeys;
+        uint64_t numentries;
+        uint64_t keyblobsize;
+    };
+    struct run
+    {
+        uint32_t firstframe;
+        uint32_t numframes;
+        uint32_t classid;
+        uint32_t phonestart;
+    };
+
+    static void initheader(fileheader &header)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "BINMLF\0", 8);
+        header.version = 1;
+    }
+
+public:
+    typedef std::map<std::wstring, std::vector<htkmlfentry>> labelmap;
+
+    // fingerprint of the text files, to detect an outdated cache
+    static uint64_t signature(const std::vector<std::wstring> &mlfpaths, const std::wstring &statelistpath)
+    {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a over the file sizes and modification times
+        auto add = [&hash](uint64_t value)
+        {
+            for (size_t k = 0; k < 8; k++, value >>= 8)
+                hash = (hash ^ (value & 0xff)) * 1099511628211ull;
+        };
+        add(mlfpaths.size());
+        for (const auto &path : mlfpaths)
+        {
+            add(filesize64(path.c_str()));
+            add(filemodtime64(path.c_str()));
+        }
+        add(statelistpath.empty() ? 0 : filesize64(statelistpath.c_str()));
+        add(statelistpath.empty() ? 0 : filemodtime64(statelistpath.c_str()));
+        return hash;
+    }
+
+    // load the labels; returns false if there is no cache, or it is outdated
+    // If 'restricttokeys' is not empty, only those utterances are loaded, like htkmlfreader does.
+    static bool read(const std::wstring &path, uint64_t signature, const std::set<std::wstring> &restricttokeys, labelmap &labels)
+    {
+        if (!fexists(path))
+            return false;
+
+        msra::files::mappedfile file(path);
+        const char *base = file.data();
+        fileheader expected;
+        initheader(expected);
+        const fileheader *header = (const fileheader *) base;
+        if (file.size() < sizeof(fileheader) || memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 || header->version != expected.version)
+            RuntimeError("binarymlf: %ls is not a binary MLF of the expected version", path.c_str());
+        if (header->signature != signature)
+        {
+            fprintf(stderr, "binarymlf: %ls is out of date, regenerating it\n", path.c_str());
+            return false;
+        }
+
+        const size_t numkeys = (size_t) header->numkeys;
+        const uint64_t *keyoffsets = (const uint64_t *) (base + sizeof(fileheader));
+        const uint64_t *entryoffsets = keyoffsets + numkeys + 1;
+        const run *runs = (const run *) (entryoffsets + numkeys + 1);
+        const char *keyblob = (const char *) (runs + header->numentries);
+        if ((size_t) (keyblob - base) + header->keyblobsize != file.size() ||
+            keyoffsets[numkeys] != header->keyblobsize || entryoffsets[numkeys] != header->numentries)
+            RuntimeError("binarymlf: %ls is truncated or corrupt", path.c_str());
+
+        fprintf(stderr, "binarymlf: reading %d utterances from %ls ...", (int) numkeys, path.c_str());
+        labels.clear();
+        for (size_t i = 0; i < numkeys; i++)
+        {
+            if (keyoffsets[i] > keyoffsets[i + 1] || entryoffsets[i] > entryoffsets[i + 1])
+                RuntimeError("binarymlf: %ls is truncated or corrupt", path.c_str());
+            std::wstring key = msra::strfun::utf16(std::string(keyblob + keyoffsets[i], keyblob + keyoffsets[i + 1]));
+            if (!restricttokeys.empty() && restricttokeys.find(key) == restricttokeys.end())
+                continue;
+            std::vector<htkmlfentry> &entries = labels.emplace_hint(labels.end(), std::move(key), std::vector<htkmlfentry>())->second; // (keys come sorted)
+            entries.resize((size_t) (entryoffsets[i + 1] - entryoffsets[i]));
+            for (size_t j = 0; j < entries.size(); j++)
+            {
+                const run &r = runs[entryoffsets[i] + j];
+                entries[j].firstframe = r.firstframe;
+                entries[j].numframes = r.numframes;
+                entries[j].classid = (msra::dbn::CLASSIDTYPE) r.classid;
+                entries[j].phonestart = (msra::dbn::HMMIDTYPE) r.phonestart;
+            }
+        }
+        fprintf(stderr, " %d utterances loaded\n", (int) labels.size());
+        return true;
+    }
+
+    // Write the labels. This happens via a temp file of our own (uniquetemppath()), so that concurrent readers and writers never see a partial file.
+    static void write(const std::wstring &path, uint64_t signature, const labelmap &labels)
+    {
+        fileheader header;
+        initheader(header);
+        header.signature = signature;
+        header.numkeys = labels.size();
+
+        std::vector<uint64_t> keyoffsets(1, 0), entryoffsets(1, 0);
+        std::string keyblob;
+        for (const auto &utterance : labels)
+        {
+            keyblob += msra::strfun::utf8(utterance.first);
+            keyoffsets.push_back(keyblob.size());
+            entryoffsets.push_back(entryoffsets.back() + utterance.second.size());
+        }
+        header.numentries = entryoffsets.back();
+        header.keyblobsize = keyblob.size();
+
+        const std::wstring temppath = uniquetemppath(path);
+        {
+            auto_file_ptr f(fopenOrDie(temppath, L"wb"));
+            fwriteOrDie(&header, sizeof(header), 1, f);
+            fwriteOrDie(keyoffsets, f);
+            fwriteOrDie(entryoffsets, f);
+            std::vector<run> runs;
+            for (const auto &utterance : labels)
+            {
+                runs.resize(utterance.second.size());
+                for (size_t j = 0; j < runs.size(); j++)
+                {
+                    const auto &e = utterance.second[j];
+                    runs[j].firstframe = e.firstframe;
+                    runs[j].numframes = e.numframes;
+                    runs[j].classid = e.classid;
+                    runs[j].phonestart = e.phonestart;
+                }
+                fwriteOrDie(runs, f);
+            }
+            if (!keyblob.empty())
+                fwriteOrDie(keyblob.data(), 1, keyblob.size(), f);
+            fflushOrDie(f);
+        }
+        renameOrDie(temppath, path);
+        fprintf(stderr, "binarymlf: wrote %d utterances to %ls\n", (int) labels.size(), path.c_str());
+    }
+};
+} }
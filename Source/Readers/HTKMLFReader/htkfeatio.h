@@ -11,6 +11,7 @@
 #include "basetypes.h"
 #include "fileutil.h"
 #include "simple_checked_arrays.h"
+#include "FeatureArchive.h"
 
 #include <string>
 #include <regex>
@@ -21,6 +22,7 @@
 #include <wchar.h>
 #include "simplesenonehmm.h"
 #include <array>
+#include <memory>
 #include "minibatchsourcehelpers.h"
 
 namespace msra { namespace asr {
@@ -337,6 +339,10 @@ class htkfeatreader : protected htkfeatio
     size_t numframes;                    // number of samples for current logical file
     size_t energyElements;               // how many energy elements to add if addEnergy is true
 
+    // the physical file may also be a FeatureArchive (e.g. written by HTKMLFWriter), whose frames are read through this
+    unique_ptr<Microsoft::MSR::CNTK::FeatureArchive::Reader> archive;
+    size_t archivestart; // first frame of the current logical file in the archive
+
 public:
     // parser for complex a=b[s,e] syntax
     struct parsedpath
@@ -441,6 +447,26 @@ private:
         // auto_file_ptr f = fopenOrDie (physpath, L"rbS");
         auto_file_ptr f(fopenOrDie(physpath, L"rb")); // removed 'S' for now, as we mostly run local anyway, and this will speed up debugging
 
+        // a FeatureArchive instead of an HTK file
+        char magic[Microsoft::MSR::CNTK::FeatureArchive::MagicSize] = {};
+        if (!ppath.isidxformat && fread(magic, 1, sizeof(magic), f) == sizeof(magic) && Microsoft::MSR::CNTK::FeatureArchive::HasMagic(magic))
+        {
+            unique_ptr<Microsoft::MSR::CNTK::FeatureArchive::Reader> archive(new Microsoft::MSR::CNTK::FeatureArchive::Reader(physpath));
+            setkind(archive->GetFeatKind(), archive->GetFeatDim(), archive->GetSampPeriod(), ppath); // this checks consistency
+            this->physicalpath.swap(physpath);
+            this->physicaldatastart = 0;
+            this->physicalframes = archive->GetNumFrames();
+            this->f.swap(f); // (only to tell that the file is open, see open())
+            this->archive.swap(archive);
+            this->isidxformat = false;
+            this->needbyteswapping = false;
+            this->compressed = false;
+            this->vecbytesize = featdim * sizeof(float);
+            this->hascrcc = false;
+            return;
+        }
+        fsetpos(f, (uint64_t) 0);
+
         // read the header (12 bytes for htk feature files)
         fileheader H;
         isidxformat = ppath.isidxformat;
@@ -528,6 +554,7 @@ private:
         }
 
         // done: swap it in
+        archive.reset();
         int64_t bytepos = fgetpos(f);
         setkind(kind, dim, H.sampperiod, ppath); // this checks consistency
         this->physicalpath.swap(physpath);
@@ -552,6 +579,7 @@ public:
     {
         addEnergy = false;
         energyElements = 0;
+        archivestart = 0;
     }
 
     // helper to create a parsed-path object
@@ -578,7 +606,9 @@ public:
                 RuntimeError("open: end frame exceeds archive's total number of frames %d in '%ls'", (int) physicalframes, ppath.logicalpath.c_str());
 
             int64_t dataoffset = physicaldatastart + ppath.s * vecbytesize;
-            fsetpos(f, dataoffset); // we assume fsetpos(), which is our own, is smart to not flush the read buffer
+            if (!archive)
+                fsetpos(f, dataoffset); // we assume fsetpos(), which is our own, is smart to not flush the read buffer
+            archivestart = ppath.s;
             curframe = 0;
             numframes = ppath.e + 1 - ppath.s;
         }
@@ -586,7 +616,8 @@ public:
         {
             curframe = 0;
             numframes = physicalframes;
-            assert(fgetpos(f) == physicaldatastart);
+            archivestart = 0;
+            assert(archive || fgetpos(f) == physicaldatastart);
         }
         return numframes;
     }
@@ -619,7 +650,12 @@ public:
     {
         if (curframe >= numframes)
             RuntimeError("htkfeatreader:attempted to read beyond end");
-        if (!compressed && !isidxformat) // not compressed--the easy one
+        if (archive)
+        {
+            v.resize(featdim);
+            archive->Read(archivestart + curframe, 1, v.data(), featdim);
+        }
+        else if (!compressed && !isidxformat) // not compressed--the easy one
         {
             freadOrDie(v, featdim, f);
             if (needbyteswapping)
@@ -650,6 +686,19 @@ public:
     template <class MATRIX>
     void read(MATRIX& feat, size_t ts, size_t te)
     {
+        // an archive is read in one go
+        if (archive && !addEnergy)
+        {
+            if (curframe + (te - ts) > numframes)
+                RuntimeError("htkfeatreader:attempted to read beyond end");
+            vector<float> frames((te - ts) * featdim);
+            archive->Read(archivestart + curframe, te - ts, frames.data(), featdim);
+            for (size_t t = ts; t < te; t++)
+                for (size_t k = 0; k < featdim; k++)
+                    feat(k, t) = frames[(t - ts) * featdim + k];
+            curframe += te - ts;
+            return;
+        }
         // read vectors from file and push to our target structure
         vector<float> v(featdim + energyElements);
         for (size_t t = ts; t < te; t++)
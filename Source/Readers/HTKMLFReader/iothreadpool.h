@@ -0,0 +1,107 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// iothreadpool.h -- a fixed set of threads that run queued jobs (used for reading data in the background)
+//
+#pragma once
+
+#include "NumaPlacement.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace msra { namespace dbn {
+
+// ---------------------------------------------------------------------------
+// iothreadpool -- runs jobs in FIFO order on 'numthreads' threads
+// Results and exceptions of a job are delivered through the std::future returned by submit().
+// Jobs still in the queue upon destruction are dropped (their futures report a broken promise); running ones are completed.
+// bindtonumanode() restricts the threads to the processors of one NUMA node, e.g. the one the GPU is attached to, so that what
+// they read lands in memory close to where it is copied to the device; each thread applies it before its next job.
+// ---------------------------------------------------------------------------
+class iothreadpool
+{
+    iothreadpool(const iothreadpool &) = delete;
+    iothreadpool &operator=(const iothreadpool &) = delete;
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobavailable;
+    bool terminating;
+    std::atomic<int> numanode; // NUMA node the threads should run on, or NoNumaNode
+
+    void threadproc()
+    {
+        int boundnode = Microsoft::MSR::CNTK::NoNumaNode;
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobavailable.wait(lock, [this]()
+                                  {
+                                      return terminating || !jobs.empty();
+                                  });
+                if (terminating)
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            const int node = numanode;
+            if (node != boundnode && Microsoft::MSR::CNTK::BindCurrentThreadToNumaNode(node))
+                boundnode = node;
+            job(); // (exceptions are caught by the packaged_task inside)
+        }
+    }
+
+public:
+    iothreadpool(size_t numthreads)
+        : terminating(false), numanode(Microsoft::MSR::CNTK::NoNumaNode)
+    {
+        for (size_t i = 0; i < numthreads; i++)
+            threads.push_back(std::thread([this]()
+                                          {
+                                              threadproc();
+                                          }));
+    }
+    ~iothreadpool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            terminating = true;
+            jobs.clear();
+        }
+        jobavailable.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    void bindtonumanode(int node)
+    {
+        numanode = node;
+    }
+
+    template <class RESULT>
+    std::future<RESULT> submit(std::function<RESULT()> f)
+    {
+        auto task = std::make_shared<std::packaged_task<RESULT()>>(std::move(f));
+        std::future<RESULT> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back([task]()
+                           {
+                               (*task)();
+                           });
+        }
+        jobavailable.notify_one();
+        return result;
+    }
+};
+} }
@@ -68,6 +68,14 @@ public:
         return false;
     }
 
+    // return utterances in groups of 'groupsize' of similar length, to reduce padding of parallel sequences; 0 = off
+    // Default implementation: only supported for turning it off.
+    virtual void setlengthbucketing(size_t groupsize)
+    {
+        if (groupsize > 1)
+            LogicError("setlengthbucketing: this minibatch source does not support grouping utterances by length");
+    }
+
     virtual size_t totalframes() const = 0;
 
     virtual double gettimegetbatch() = 0;                         // used to report runtime
@@ -234,6 +242,17 @@ public:
         fillorclear();
     }
 
+    // reposition to a minibatch of this epoch, as identified by currentmbstartframe() and currentdatapass() when it was current
+    // This is used to resume in the middle of an epoch; the source's randomization only depends on the frame position.
+    void seek(size_t startframe, size_t pass)
+    {
+        if (startframe < firstvalidepochstartframe || pass >= datapasses)
+            LogicError("minibatchiterator: seek to frame %d of data pass %d, which is outside this epoch", (int) startframe, (int) pass);
+        mbstartframe = startframe;
+        datapass = pass;
+        fillorclear();
+    }
+
     // accessors to current minibatch
     size_t currentmbstartframe() const
     {
@@ -24,14 +24,18 @@ namespace msra { namespace dbn {
 // ---------------------------------------------------------------------------
 
 // implant a sub-vector into a vector, for use in augmentneighbors
+// All vector types used here (std::vector, array_ref, matrix columns) store their elements contiguously,
+// so this is a block copy (a memmove if the element types agree), not an element-wise loop through operator[].
 template <class INV, class OUTV>
 static void copytosubvector(const INV& inv, size_t subvecindex, OUTV& outv)
 {
     size_t subdim = inv.size();
+    if (subdim == 0)
+        return;
     assert(outv.size() % subdim == 0);
     size_t k0 = subvecindex * subdim;
-    foreach_index (k, inv)
-        outv[k + k0] = inv[k];
+    assert(&inv[subdim - 1] == &inv[0] + subdim - 1 && &outv[k0 + subdim - 1] == &outv[k0] + subdim - 1);
+    std::copy(&inv[0], &inv[0] + subdim, &outv[k0]);
 }
 
 // compute the augmentation extent (how many frames added on each side)
@@ -8,7 +8,10 @@
 #pragma once
 
 #include "Basics.h"
-#include "fileutil.h" // for opening/reading the ARPA file
+#include "fileutil.h"   // for opening/reading the ARPA file
+#include "mappedfile.h" // for CMappedMGramLM
+#include <stdint.h>
+#include <memory>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -25,6 +28,13 @@ class ILM // generic interface -- mostly the score() function
 {
 public:
     virtual double score(const int *mgram, int m) const = 0;
+    // score 'n' m-grams stored one after another in 'mgrams' ([n][m]), e.g. all word arcs of a lattice
+    // Models may override this to share the work among m-grams with the same history.
+    virtual void score_batch(const int *mgrams, int m, size_t n, double *scores) const
+    {
+        for (size_t k = 0; k < n; k++)
+            scores[k] = score(mgrams + k * m, m);
+    }
     virtual bool oov(int w) const = 0; // needed for perplexity calculation
     // ... TODO (?): return true/false to indicate whether anything changed.
     // Intended as a signal to derived LMs that cache values.
@@ -351,6 +361,7 @@ public:
 // maps from m-grams to m-gram storage locations.
 class mgram_map
 {
+    friend class CMGramLM; // for writebinary()
     typedef unsigned int index_t; // (-> size_t when we really need it)
     // typedef size_t index_t;                   // (tested once, seems to work)
     static const index_t nindex; // invalid index
@@ -1144,6 +1155,178 @@ public:
     }
 };
 
+// ===========================================================================
+// mgram_binary -- binary form of what CMGramLM::read() makes of an ARPA file, for memory-mapping by CMappedMGramLM
+//
+// File layout (every section starts at a multiple of 8 bytes):
+//  - header: magic, version, order, signature of the ARPA file it was made from, counts
+//  - #m-grams for m=0..M ([0] = 1, the zerogram)
+//  - symbols: offsets [numsymbols + 1] into the string blob, LM ids [numsymbols], string blob (0-terminated, in strcmp() order)
+//  - trie: ids [#m-grams] for m=1..M; firsts [#m-grams + 1] for m=0..M-1 (as in mgram_map); unigram index of each LM id
+//  - scores: logP for m=0..M, then logB for m=0..M-1, each either float [#m-grams], or, if quantized,
+//    a codebook [2^quantbits] followed by one code of quantbits per m-gram
+// The arrays are used in place, so loading only pages in what is touched, and all processes that map
+// the same file share the same physical pages.
+// ===========================================================================
+
+struct mgram_binary
+{
+    struct fileheader
+    {
+        char magic[8]; // "BINMGRAM"
+        uint32_t version;
+        uint32_t order;       // M as loaded
+        uint32_t arpaorder;   // M of the ARPA file (order is less if read() was restricted through maxM)
+        uint32_t quantbits;   // 0 (floats), 8, or 16
+        uint64_t signature;   // fingerprint of the ARPA file
+        uint64_t numsymbols;  // = #LM ids
+        uint64_t symbolblobsize;
+    };
+
+    static void initheader(fileheader &header)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "BINMGRAM", 8);
+        header.version = 1;
+    }
+
+    // fingerprint of the ARPA file, to detect an outdated binary file
+    static uint64_t signature(const std::wstring &arpapath)
+    {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a over the file size and modification time
+        for (uint64_t value : {(uint64_t) filesize64(arpapath.c_str()), (uint64_t) filemodtime64(arpapath.c_str())})
+        {
+            for (size_t k = 0; k < 8; k++, value >>= 8)
+                hash = (hash ^ (value & 0xff)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static size_t align(size_t offset)
+    {
+        return (offset + 7) / 8 * 8;
+    }
+    static size_t scoresbytes(size_t n, unsigned int quantbits)
+    {
+        if (quantbits == 0)
+            return n * sizeof(float);
+        return (sizeof(float) << quantbits) + n * (quantbits / 8); // codebook, then the codes
+    }
+
+    // file offsets of all sections, as determined by the header and the counts
+    struct layout
+    {
+        size_t symboloffsets, symbolids, symbolblob;
+        std::vector<size_t> ids;    // [m] m=1..M ([0] is not used)
+        std::vector<size_t> firsts; // [m] m=0..M-1
+        size_t unigramindex;
+        std::vector<size_t> logP;   // [m] m=0..M
+        std::vector<size_t> logB;   // [m] m=0..M-1
+        size_t end;                 // = file size
+
+        layout(const fileheader &header, const uint64_t *counts)
+        {
+            const int M = (int) header.order;
+            const size_t numsymbols = (size_t) header.numsymbols;
+            end = sizeof(fileheader) + (M + 1) * sizeof(uint64_t); // (the counts follow the header)
+            symboloffsets = section((numsymbols + 1) * sizeof(uint64_t));
+            symbolids = section(numsymbols * sizeof(int32_t));
+            symbolblob = section((size_t) header.symbolblobsize);
+            ids.assign(M + 1, 0);
+            for (int m = 1; m <= M; m++)
+                ids[m] = section((size_t) counts[m] * sizeof(int32_t));
+            firsts.assign(M, 0);
+            for (int m = 0; m < M; m++)
+                firsts[m] = section(((size_t) counts[m] + 1) * sizeof(uint32_t));
+            unigramindex = section(numsymbols * sizeof(uint32_t));
+            logP.assign(M + 1, 0);
+            for (int m = 0; m <= M; m++)
+                logP[m] = section(scoresbytes((size_t) counts[m], header.quantbits));
+            logB.assign(M, 0);
+            for (int m = 0; m < M; m++)
+                logB[m] = section(scoresbytes((size_t) counts[m], header.quantbits));
+        }
+
+    private:
+        size_t section(size_t bytes) // allocate the next section
+        {
+            const size_t offset = align(end);
+            end = offset + bytes;
+            return offset;
+        }
+    };
+
+    // write a section at 'offset'; 'pos' is the current file position, the gap up to 'offset' gets zero-padded
+    static void writeat(FILE *f, size_t &pos, size_t offset, const void *data, size_t bytes)
+    {
+        static const char zeros[8] = {0};
+        if (offset < pos || offset - pos > sizeof(zeros))
+            LogicError("mgram_binary::writeat: inconsistent section offset");
+        fwriteOrDie(zeros, 1, offset - pos, f);
+        fwriteOrDie(data, 1, bytes, f);
+        pos = offset + bytes;
+    }
+
+    // quantize to 2^bits values: bins of equal counts, represented by their means
+    // Code 0 is reserved for the smallest value, so that disabled tokens (ARPA score -99) keep their score exactly.
+    static void quantize(const std::vector<float> &values, unsigned int bits, std::vector<float> &codebook, std::vector<uint16_t> &codes)
+    {
+        const size_t numcodes = (size_t) 1 << bits;
+        std::vector<float> sorted(values);
+        std::sort(sorted.begin(), sorted.end());
+        const size_t n = sorted.size();
+        codebook.assign(numcodes, n > 0 ? sorted.front() : 0.0f);
+        codes.clear();
+        if (n == 0)
+            return;
+        for (size_t k = 1; k < numcodes; k++)
+        {
+            const size_t begin = 1 + (k - 1) * (n - 1) / (numcodes - 1);
+            const size_t end = 1 + k * (n - 1) / (numcodes - 1);
+            if (begin == end) // (fewer values than codes)
+            {
+                codebook[k] = codebook[k - 1];
+                continue;
+            }
+            double sum = 0.0;
+            for (size_t i = begin; i < end; i++)
+                sum += sorted[i];
+            codebook[k] = (float) (sum / (end - begin));
+        }
+        // the codebook is sorted, so we can binary-search it for the nearest value
+        codes.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const float v = values[i];
+            size_t k = std::lower_bound(codebook.begin(), codebook.end(), v) - codebook.begin();
+            if (k == numcodes || (k > 0 && v - codebook[k - 1] <= codebook[k] - v))
+                k--;
+            codes[i] = (uint16_t) k;
+        }
+    }
+
+    // write the scores of one level, as floats or quantized
+    static void writescores(FILE *f, size_t &pos, size_t offset, const std::vector<float> &values, unsigned int quantbits)
+    {
+        if (quantbits == 0)
+        {
+            writeat(f, pos, offset, values.data(), values.size() * sizeof(float));
+            return;
+        }
+        std::vector<float> codebook;
+        std::vector<uint16_t> codes;
+        quantize(values, quantbits, codebook, codes);
+        writeat(f, pos, offset, codebook.data(), codebook.size() * sizeof(float));
+        if (quantbits == 16)
+            writeat(f, pos, pos, codes.data(), codes.size() * sizeof(uint16_t));
+        else
+        {
+            std::vector<uint8_t> bytecodes(codes.begin(), codes.end());
+            writeat(f, pos, pos, bytecodes.data(), bytecodes.size());
+        }
+    }
+};
+
 // ===========================================================================
 // CMGramLM -- a back-off M-gram language model in memory, loaded from an ARPA file
 // ===========================================================================
@@ -1162,6 +1345,8 @@ protected:
 #endif
     int M; // e.g. M=3 for trigram
     // ^^ TODO: can we do away with this entirely and replace it by map.order()/this->order()
+    int fileM;               // M of the ARPA file read() read from (M may be less)
+    bool filteredVocabulary; // read() skipped m-grams not covered by the user's symbols
     mgram_map map;
     mgram_data<float> logP; // [M+1][i] probabilities
     mgram_data<float> logB; // [M][i] back-off weights (stored for histories only)
@@ -1181,7 +1366,7 @@ protected:
 
 public:
     CMGramLM()
-        : M(-1)
+        : M(-1), fileM(-1), filteredVocabulary(false)
     {
     } // needs explicit initialization through read() or init()
 
@@ -1479,7 +1664,8 @@ public:
         M = (int) dims.size() - 1;
         if (M == 0)
             RuntimeError("read: mal-formed LM file, no dimension information (%d): %ls", lineNo, pathname.c_str());
-        int fileM = M;
+        fileM = M;
+        filteredVocabulary = filterVocabulary;
         if (M > maxM)
             M = maxM;
 
@@ -1641,6 +1827,95 @@ public:
         map.created(userToLMSymMap);
     }
 
+    // write the model in the binary format of mgram_binary, for use through CMappedMGramLM
+    // 'signature' identifies the ARPA file (mgram_binary::signature()), so that readers can detect an outdated file.
+    // With 'quantbits' = 8 or 16, scores are stored as codes into a codebook per level, otherwise as floats.
+    // This is only for models as read() leaves them: it relies on the LM symbols, which sort() does not update,
+    // and vocabulary filtering is done by CMappedMGramLM::read() instead.
+    // This happens via a temp file, so that concurrent readers never see a partial file.
+    void writebinary(const std::wstring &pathname, uint64_t signature, unsigned int quantbits = 0) const
+    {
+        if (quantbits != 0 && quantbits != 8 && quantbits != 16)
+            InvalidArgument("writebinary: quantbits must be 0, 8, or 16");
+        if (filteredVocabulary)
+            InvalidArgument("writebinary: model was read with vocabulary filtering, which is not supported in binary files");
+        static_assert(sizeof(mgram_map::index_t) == sizeof(uint32_t), "writebinary: mgram_map::index_t does not match the file format");
+
+        mgram_binary::fileheader header;
+        mgram_binary::initheader(header);
+        header.order = M;
+        header.arpaorder = fileM;
+        header.quantbits = quantbits;
+        header.signature = signature;
+        header.numsymbols = lmSymbols.size();
+        std::vector<uint64_t> counts(M + 1);
+        for (int m = 0; m <= M; m++)
+            counts[m] = map.size(m);
+
+        // symbol table, in sort order of the symbols (lmSymbols is sorted)
+        std::vector<uint64_t> symboloffsets(1, 0);
+        std::vector<int32_t> symbolids;
+        std::string symbolblob;
+        for (const auto &sym : lmSymbols)
+        {
+            symbolblob.append(sym.symbol.c_str(), sym.symbol.size() + 1);
+            symboloffsets.push_back(symbolblob.size());
+            symbolids.push_back(sym.id);
+        }
+        header.symbolblobsize = symbolblob.size();
+        const mgram_binary::layout layout(header, counts.data());
+
+        const std::wstring temppath = uniquetemppath(pathname);
+        {
+            auto_file_ptr f(fopenOrDie(temppath, L"wb"));
+            size_t pos = 0;
+            mgram_binary::writeat(f, pos, 0, &header, sizeof(header));
+            mgram_binary::writeat(f, pos, pos, counts.data(), counts.size() * sizeof(uint64_t));
+            mgram_binary::writeat(f, pos, layout.symboloffsets, symboloffsets.data(), symboloffsets.size() * sizeof(uint64_t));
+            mgram_binary::writeat(f, pos, layout.symbolids, symbolids.data(), symbolids.size() * sizeof(int32_t));
+            mgram_binary::writeat(f, pos, layout.symbolblob, symbolblob.data(), symbolblob.size());
+
+            // trie
+            std::vector<int32_t> ids;
+            for (int m = 1; m <= M; m++)
+            {
+                const int24_vector &ids_m = map.ids[m];
+                ids.resize(ids_m.size());
+                for (size_t i = 0; i < ids.size(); i++)
+                    ids[i] = ids_m[i];
+                mgram_binary::writeat(f, pos, layout.ids[m], ids.data(), ids.size() * sizeof(int32_t));
+            }
+            for (int m = 0; m < M; m++)
+                mgram_binary::writeat(f, pos, layout.firsts[m], map.firsts[m].data(), map.firsts[m].size() * sizeof(uint32_t));
+            std::vector<uint32_t> unigramindex(lmSymbols.size(), mgram_map::nindex);
+            for (size_t i = 0; i < (size_t) map.size(1); i++)
+                unigramindex[map.ids[1][i]] = (uint32_t) i;
+            mgram_binary::writeat(f, pos, layout.unigramindex, unigramindex.data(), unigramindex.size() * sizeof(uint32_t));
+
+            // scores
+            std::vector<float> values;
+            for (int m = 0; m <= M; m++)
+            {
+                values.resize((size_t) counts[m]);
+                for (size_t i = 0; i < values.size(); i++)
+                    values[i] = logP[mgram_map::coord(m, (mgram_map::index_t) i)];
+                mgram_binary::writescores(f, pos, layout.logP[m], values, quantbits);
+            }
+            for (int m = 0; m < M; m++)
+            {
+                values.resize((size_t) counts[m]);
+                for (size_t i = 0; i < values.size(); i++)
+                    values[i] = logB[mgram_map::coord(m, (mgram_map::index_t) i)];
+                mgram_binary::writescores(f, pos, layout.logB[m], values, quantbits);
+            }
+            if (pos != layout.end)
+                LogicError("writebinary: inconsistent file layout");
+            fflushOrDie(f);
+        }
+        renameOrDie(temppath, pathname);
+        fprintf(stderr, "writebinary: wrote %d-gram LM to %ls\n", M, pathname.c_str());
+    }
+
 protected:
     // sort LM such that iterators will iterate in increasing order w.r.t. w2id[w]
     // This is achieved by replacing all internal ids by w2id[w].
@@ -1964,4 +2239,320 @@ public:
     }
 };
 
+// ===========================================================================
+// CMappedMGramLM -- a back-off M-gram language model used in place from a memory-mapped mgram_binary file
+// Scores are the same as CMGramLM's for the same ARPA file (up to quantization, if the file is quantized).
+// Read-only: this does not support iter().
+// ===========================================================================
+
+class CMappedMGramLM : public ILM
+{
+    typedef uint32_t index_t;
+    static const index_t nindex = (index_t) -1; // invalid index
+
+    // scores of one level, stored as floats or as codes into a codebook
+    struct scorearray
+    {
+        unsigned int quantbits;
+        const float *values; // the scores, or the codebook if quantized
+        const void *codes;
+        __forceinline float operator[](index_t i) const
+        {
+            if (quantbits == 0)
+                return values[i];
+            else if (quantbits == 8)
+                return values[((const uint8_t *) codes)[i]];
+            else
+                return values[((const uint16_t *) codes)[i]];
+        }
+    };
+
+    std::unique_ptr<msra::files::mappedfile> file;
+    int M; // e.g. M=3 for trigram
+    std::vector<size_t> counts;           // [m] #m-grams
+    size_t numsymbols;                    // (= #LM ids)
+    const uint64_t *symboloffsets;        // [numsymbols + 1] into symbolblob
+    const int32_t *symbolids;             // [numsymbols] LM id of each symbol, in strcmp() order
+    const char *symbolblob;               // the symbols as 0-terminated strings
+    std::vector<const int32_t *> ids;     // [m][i] LM ids ([0] = not used)
+    std::vector<const uint32_t *> firsts; // [m][i] first child in level m+1, [m][i+1] is the end
+    const uint32_t *unigramindex;         // LM id -> index in level 1
+    std::vector<scorearray> logP;         // [m][i]
+    std::vector<scorearray> logB;         // [m][i] (histories only)
+
+    std::vector<int> w2id; // user's w -> LM id
+
+    // diagnostics of previous score() call
+    mutable int longestMGramFound;   // longest m-gram (incl. predicted token) found
+    mutable int longestHistoryFound; // longest history (excl. predicted token) found
+
+    inline int map(int w) const
+    {
+        if (w < 0 || w >= (int) w2id.size())
+            return -1;
+        else
+            return w2id[w];
+    }
+
+    // get index for 'id' in level m+1, as a child of index i in level m (same as mgram_map::find_child())
+    inline index_t find_child(int m, index_t i, int id) const
+    {
+        if (id < 0)
+            return nindex;
+        if (m == 0)
+            return ((size_t) id < numsymbols) ? unigramindex[id] : nindex;
+        index_t beg = firsts[m][i];
+        index_t end = firsts[m][i + 1];
+        const int32_t *ids_m1 = ids[m + 1];
+        while (beg < end)
+        {
+            index_t i = (beg + end) / 2;
+            int v = ids_m1[i];
+            if (id == v)
+                return i; // found it
+            else if (id < v)
+                end = i; // id is left of i
+            else
+                beg = i + 1; // id is right of i
+        }
+        return nindex; // not found
+    }
+
+    // index of the history mgram[0..m-1] in level m; nindex if it does not exist
+    inline index_t find_history(const int *mgram, int m) const
+    {
+        index_t i = 0; // root
+        for (int n = 0; n < m && i != nindex; n++)
+            i = find_child(n, i, map(mgram[n]));
+        return i;
+    }
+
+    // search for a word in the sorted symbol table; -1 if not found
+    int symbolToId(const char *word) const
+    {
+        size_t beg = 0;
+        size_t end = numsymbols;
+        while (beg < end)
+        {
+            size_t i = (beg + end) / 2;
+            int cmp = strcmp(word, symbolblob + symboloffsets[i]);
+            if (cmp == 0)
+                return symbolids[i]; // found it
+            else if (cmp < 0)
+                end = i; // word is left of i
+            else
+                beg = i + 1; // word is right of i
+        }
+        return -1; // not found
+    }
+
+    scorearray mapscores(size_t offset, unsigned int quantbits) const
+    {
+        scorearray scores;
+        scores.quantbits = quantbits;
+        scores.values = (const float *) (file->data() + offset);
+        scores.codes = (quantbits == 0) ? nullptr : file->data() + offset + (sizeof(float) << quantbits);
+        return scores;
+    }
+
+public:
+    CMappedMGramLM()
+        : M(-1), numsymbols(0)
+    {
+    } // needs explicit initialization through read()
+
+    // map a binary LM file as written by CMGramLM::writebinary()
+    // Returns false if the file does not exist or is outdated, i.e. made from a different ARPA file ('signature'),
+    // or for a different 'maxM'. 'userSymMap', 'filterVocabulary', and 'maxM' are as for CMGramLM::read(), except
+    // that filtering only drops the mapping of unknown words, and does not change the OOV score.
+    template <class SYMMAP>
+    bool read(const std::wstring &pathname, uint64_t signature, SYMMAP &userSymMap, bool filterVocabulary, int maxM)
+    {
+        if (!fexists(pathname))
+            return false;
+
+        file.reset(new msra::files::mappedfile(pathname));
+        const char *base = file->data();
+        mgram_binary::fileheader expected;
+        mgram_binary::initheader(expected);
+        const mgram_binary::fileheader *header = (const mgram_binary::fileheader *) base;
+        if (file->size() < sizeof(expected) || memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 || header->version != expected.version)
+            RuntimeError("read: %ls is not a binary LM of the expected version", pathname.c_str());
+        if (header->signature != signature || (int) header->order != std::min(maxM, (int) header->arpaorder))
+        {
+            fprintf(stderr, "read: %ls is out of date\n", pathname.c_str());
+            file.reset();
+            return false;
+        }
+        if (header->order == 0 || (header->quantbits != 0 && header->quantbits != 8 && header->quantbits != 16) ||
+            file->size() < sizeof(expected) + (header->order + 1) * sizeof(uint64_t))
+            RuntimeError("read: %ls is truncated or corrupt", pathname.c_str());
+        const uint64_t *filecounts = (const uint64_t *) (base + sizeof(expected));
+        const mgram_binary::layout layout(*header, filecounts);
+        if (layout.end != file->size())
+            RuntimeError("read: %ls is truncated or corrupt", pathname.c_str());
+
+        // point into the file
+        M = (int) header->order;
+        counts.assign(filecounts, filecounts + M + 1);
+        numsymbols = (size_t) header->numsymbols;
+        symboloffsets = (const uint64_t *) (base + layout.symboloffsets);
+        symbolids = (const int32_t *) (base + layout.symbolids);
+        symbolblob = base + layout.symbolblob;
+        ids.assign(M + 1, nullptr);
+        for (int m = 1; m <= M; m++)
+            ids[m] = (const int32_t *) (base + layout.ids[m]);
+        firsts.assign(M, nullptr);
+        for (int m = 0; m < M; m++)
+        {
+            firsts[m] = (const uint32_t *) (base + layout.firsts[m]);
+            if (firsts[m][counts[m]] != counts[m + 1])
+                RuntimeError("read: %ls is truncated or corrupt", pathname.c_str());
+        }
+        unigramindex = (const uint32_t *) (base + layout.unigramindex);
+        logP.resize(M + 1);
+        for (int m = 0; m <= M; m++)
+            logP[m] = mapscores(layout.logP[m], header->quantbits);
+        logB.resize(M);
+        for (int m = 0; m < M; m++)
+            logB[m] = mapscores(layout.logB[m], header->quantbits);
+        if (symboloffsets[numsymbols] != header->symbolblobsize)
+            RuntimeError("read: %ls is truncated or corrupt", pathname.c_str());
+
+        fprintf(stderr, "read: mapping %ls", pathname.c_str());
+        for (int m = 1; m <= M; m++)
+            fprintf(stderr, ", %d %d-grams", (int) counts[m], m);
+        fprintf(stderr, "\n");
+
+        // unless filtering, create the LM's words in the user's space, in the order CMGramLM::read() does (that of the LM ids)
+        if (!filterVocabulary)
+        {
+            std::vector<const char *> idToSymbol(numsymbols, nullptr);
+            for (size_t i = 0; i < numsymbols; i++)
+            {
+                if (symbolids[i] < 0 || (size_t) symbolids[i] >= numsymbols)
+                    RuntimeError("read: %ls is truncated or corrupt", pathname.c_str());
+                idToSymbol[symbolids[i]] = symbolblob + symboloffsets[i];
+            }
+            for (const char *sym : idToSymbol)
+            {
+                if (sym && userSymMap.sym2existingId(sym) == -1)
+                    userSymMap.sym2id(sym);
+            }
+        }
+
+        // establish mapping of word ids from user to LM space
+        w2id.resize(userSymMap.size());
+        for (int i = 0; i < (int) userSymMap.size(); i++)
+            w2id[i] = symbolToId(userSymMap.id2sym(i)); // may be -1 if not found
+        return true;
+    }
+
+    virtual int getLastLongestHistoryFound() const
+    {
+        return longestHistoryFound;
+    }
+    virtual int getLastLongestMGramFound() const
+    {
+        return longestMGramFound;
+    }
+
+    // compute an m-gram score (incl. back-off and fallback), like CMGramLM::score()
+    virtual double score(const int *mgram, int m) const
+    {
+        longestHistoryFound = 0; // (diagnostics)
+        if (m > M)               // truncate
+        {
+            mgram += m - M;
+            m = M;
+        }
+
+        double totalLogB = 0.0; // accumulated back-off
+        for (; m > 0; mgram++, m--) // shorten the history by one each time
+        {
+            const index_t h = find_history(mgram, m - 1);
+            if (h == nindex)
+                continue; // history not found -> fall back
+            if (m - 1 > longestHistoryFound)
+                longestHistoryFound = m - 1;
+            const index_t i = find_child(m - 1, h, map(mgram[m - 1]));
+            if (i != nindex) // full m-gram found -> return it
+            {
+                longestMGramFound = m;
+                return totalLogB + logP[m][i];
+            }
+            totalLogB += logB[m - 1][h]; // history found but predicted word not -> back-off
+        }
+        longestMGramFound = 0;
+        return totalLogB + logP[0][0]; // zerogram
+    }
+
+    // score a batch of m-grams
+    // The histories of consecutive m-grams that have the same history (e.g. the arcs leaving a lattice node) are looked up only once.
+    // This does not update the diagnostics.
+    virtual void score_batch(const int *mgrams, int m, size_t n, double *scores) const
+    {
+        const int skip = (m > M) ? m - M : 0; // truncate
+        const int mm = m - skip;
+        if (mm == 0) // zerograms
+        {
+            std::fill(scores, scores + n, (double) logP[0][0]);
+            return;
+        }
+        std::vector<index_t> histories(mm); // [j] index of the history mgram[j..mm-2], in level mm-1-j
+        const int *prevmgram = nullptr;
+        for (size_t k = 0; k < n; k++)
+        {
+            const int *mgram = mgrams + k * m + skip;
+            if (!prevmgram || !std::equal(mgram, mgram + mm - 1, prevmgram))
+            {
+                for (int j = 0; j < mm; j++)
+                    histories[j] = find_history(mgram + j, mm - 1 - j);
+                prevmgram = mgram;
+            }
+            const int id = map(mgram[mm - 1]);
+            double totalLogB = 0.0;
+            double thisscore = 0.0;
+            int j;
+            for (j = 0; j < mm; j++) // shorten the history by one each time
+            {
+                const index_t h = histories[j];
+                if (h == nindex)
+                    continue; // history not found -> fall back
+                const index_t i = find_child(mm - 1 - j, h, id);
+                if (i != nindex) // full m-gram found
+                {
+                    thisscore = totalLogB + logP[mm - j][i];
+                    break;
+                }
+                totalLogB += logB[mm - 1 - j][h]; // back-off
+            }
+            scores[k] = (j < mm) ? thisscore : totalLogB + logP[0][0];
+        }
+    }
+
+    virtual bool oov(int w) const
+    {
+        return map(w) < 0;
+    }
+
+    virtual void adapt(const int *, size_t)
+    {
+    } // this LM does not adapt
+
+    virtual IIter *iter(int, int) const
+    {
+        LogicError("iter: not supported for memory-mapped LMs");
+    }
+
+    virtual int order() const
+    {
+        return M;
+    }
+    virtual size_t size(int m) const
+    {
+        return counts[m];
+    }
+};
+
 }; }; // namespace
@@ -0,0 +1,383 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// packedfeaturecache.h -- all features of one stream, packed chunk by chunk into one large file that is memory-mapped for reading
+//
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include "mappedfile.h"
+#include "Half.h"
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace msra { namespace dbn {
+
+// -----------------------------------------------------------------------
+// packedfeaturecache -- replaces reading thousands of small HTK feature files per chunk by one sequential read
+//
+// File layout (all offsets page-aligned):
+//  - header (one page): magic, version, feature kind/dimension/frame shift, number of chunks
+//  - chunk index: for each chunk, its offset in the file, and its number of utterances and frames
+//  - chunk data: the frames of each chunk in the memory layout of msra::dbn::matrix (column stride padded to 4 floats),
+//    so paging in a chunk is a single memcpy() from the mapping.
+//    Version 2 can instead store the frames quantized, to read less from (network) storage (see encoding):
+//     - float16: featdim FP16 values per frame (half the size)
+//     - uint8: per chunk and dimension, the minimum and the quantization step as floats, then featdim bytes per frame
+//       (a quarter of the size; the error is at most half a step, i.e. 1/510 of the range of the dimension within the chunk)
+//    Decoding happens in readchunk(), i.e. on the read-ahead threads of the utterance source.
+// The chunking itself is not stored: the cache is only valid for the chunking that it was packed from, which the user of the cache must check.
+// The file is written to a temp name of its own for each process (uniquetemppath(), with host and process id) and renamed at the end, so readers
+// never see a partial cache, and processes on different hosts that pack the same cache concurrently do not corrupt it (the last rename wins).
+// On one host, usefeaturecaches() lets only one process pack it. (On Windows, the rename fails while another host has the cache open.)
+// float32 chunks can also be used in place (mappedchunk()); since the mapping is shared, all processes on a host then share one copy.
+// -----------------------------------------------------------------------
+
+class packedfeaturecache
+{
+public:
+    enum encodingkind
+    {
+        float32 = 0, // as in memory (version 1)
+        float16 = 1,
+        uint8 = 2,
+    };
+    // parse the featureCacheEncoding reader option
+    static encodingkind parseencoding(const std::wstring &name)
+    {
+        if (name == L"float32" || name.empty())
+            return float32;
+        else if (name == L"float16")
+            return float16;
+        else if (name == L"uint8")
+            return uint8;
+        InvalidArgument("packedfeaturecache: encoding must be 'float32', 'float16', or 'uint8', not '%ls'", name.c_str());
+    }
+    static const char *encodingname(encodingkind encoding)
+    {
+        return encoding == float16 ? "float16" : encoding == uint8 ? "uint8" : "float32";
+    }
+
+private:
+    static const size_t pagesize = 4096;
+    static const size_t featkindsize = 16;
+
+    struct fileheader
+    {
+        char magic[8]; // "PFCACHE\0"
+        uint32_t version;
+        uint32_t featdim;
+        uint32_t colstride; // (featdim + 3) & ~3
+        uint32_t sampperiod;
+        char featkind[featkindsize];
+        uint64_t numchunks;
+        uint32_t encoding; // encodingkind (version 2; 0 = float32 in version 1 files, whose header page is zero-padded)
+        uint32_t reserved;
+    };
+    struct chunkentry
+    {
+        uint64_t offset; // byte offset of the frames of this chunk
+        uint64_t numutterances;
+        uint64_t numframes;
+    };
+
+    static size_t pagealigned(size_t n)
+    {
+        return (n + pagesize - 1) / pagesize * pagesize;
+    }
+    static size_t indexoffset()
+    {
+        return pagesize;
+    }
+    static size_t dataoffset(size_t numchunks)
+    {
+        return indexoffset() + pagealigned(numchunks * sizeof(chunkentry));
+    }
+    static void initheader(fileheader &header)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "PFCACHE", 8);
+        header.version = 1;
+    }
+    // bytes of the frames of a chunk in the file
+    static size_t chunkbytes(const fileheader &header, size_t numframes)
+    {
+        switch (header.encoding)
+        {
+        case float16:
+            return numframes * header.featdim * sizeof(uint16_t);
+        case uint8:
+            return header.featdim * 2 * sizeof(float) + numframes * header.featdim;
+        default:
+            return numframes * header.colstride * sizeof(float);
+        }
+    }
+
+public:
+    // -----------------------------------------------------------------------
+    // writer -- used by the one-time packing step; chunks must be written in order
+    // -----------------------------------------------------------------------
+
+    class writer
+    {
+        std::wstring path;
+        std::wstring temppath;
+        FILE *f;
+        std::vector<chunkentry> index;
+        fileheader header;
+        size_t pos;
+        std::vector<char> encoded; // (buffer for writechunk())
+
+    public:
+        writer(const std::wstring &path, size_t numchunks, encodingkind encoding = float32)
+            : path(path), temppath(uniquetemppath(path)), pos(dataoffset(numchunks))
+        {
+            initheader(header);
+            if (encoding != float32) // (float32 caches stay readable by version 1 readers)
+                header.version = 2;
+            header.encoding = encoding;
+            index.reserve(numchunks);
+            f = fopenOrDie(temppath, L"wb");
+        }
+        ~writer()
+        {
+            if (f) // not completed
+            {
+                fclose(f);
+                _wunlink(temppath.c_str());
+            }
+        }
+
+        // 'frames' is in msra::dbn::matrix layout: numframes columns of 'colstride' floats each
+        void writechunk(const float *frames, size_t numutterances, size_t numframes, const std::string &featkind, size_t featdim, unsigned int sampperiod)
+        {
+            if (index.empty())
+            {
+                if (featkind.size() >= featkindsize)
+                    RuntimeError("packedfeaturecache: feature kind '%s' too long", featkind.c_str());
+                strcpy(header.featkind, featkind.c_str());
+                header.featdim = (uint32_t) featdim;
+                header.colstride = (uint32_t)((featdim + 3) & ~3);
+                header.sampperiod = sampperiod;
+            }
+            else if (featkind != header.featkind || featdim != header.featdim || sampperiod != header.sampperiod)
+                RuntimeError("packedfeaturecache: inconsistent feature kind, dimension, or frame shift across chunks");
+
+            chunkentry entry;
+            entry.offset = pos;
+            entry.numutterances = numutterances;
+            entry.numframes = numframes;
+            index.push_back(entry);
+
+            const size_t numbytes = chunkbytes(header, numframes);
+            fsetpos(f, (uint64_t) pos);
+            if (header.encoding == float32)
+                fwriteOrDie(frames, sizeof(float), numframes * header.colstride, f);
+            else
+            {
+                encode(frames, numframes);
+                fwriteOrDie(encoded.data(), 1, numbytes, f);
+            }
+            pos = pagealigned(pos + numbytes);
+        }
+
+    private:
+        // quantize the frames of a chunk into 'encoded', in the layout described at the top
+        void encode(const float *frames, size_t numframes)
+        {
+            const size_t featdim = header.featdim;
+            const size_t colstride = header.colstride;
+            encoded.resize(chunkbytes(header, numframes));
+            if (header.encoding == float16)
+            {
+                uint16_t *p = (uint16_t *) encoded.data();
+                for (size_t t = 0; t < numframes; t++)
+                    for (size_t i = 0; i < featdim; i++)
+                        *p++ = Microsoft::MSR::CNTK::half(frames[t * colstride + i]).bits;
+            }
+            else // uint8
+            {
+                float *mins = (float *) encoded.data();
+                float *steps = mins + featdim;
+                unsigned char *p = (unsigned char *) (steps + featdim);
+                for (size_t i = 0; i < featdim; i++)
+                {
+                    float lo = numframes > 0 ? frames[i] : 0.0f;
+                    float hi = lo;
+                    for (size_t t = 1; t < numframes; t++)
+                    {
+                        lo = std::min(lo, frames[t * colstride + i]);
+                        hi = std::max(hi, frames[t * colstride + i]);
+                    }
+                    mins[i] = lo;
+                    steps[i] = (hi - lo) / 255;
+                }
+                for (size_t t = 0; t < numframes; t++)
+                    for (size_t i = 0; i < featdim; i++)
+                    {
+                        float code = steps[i] > 0 ? floorf((frames[t * colstride + i] - mins[i]) / steps[i] + 0.5f) : 0.0f;
+                        *p++ = (unsigned char) std::min(std::max(code, 0.0f), 255.0f);
+                    }
+            }
+        }
+
+    public:
+
+        // write the header and index, and move the file into place
+        void close()
+        {
+            header.numchunks = index.size();
+            // pad the file up to the last page, so that all mapped pages are backed by the file
+            fsetpos(f, (uint64_t)(pos - 1));
+            fputc(0, f);
+            fsetpos(f, (uint64_t) 0);
+            fwriteOrDie(&header, sizeof(header), 1, f);
+            fsetpos(f, (uint64_t) indexoffset());
+            if (!index.empty())
+                fwriteOrDie(index.data(), sizeof(chunkentry), index.size(), f);
+            fflushOrDie(f);
+            fcloseOrDie(f);
+            f = nullptr;
+            renameOrDie(temppath, path);
+        }
+    };
+
+    // -----------------------------------------------------------------------
+    // reading
+    // -----------------------------------------------------------------------
+
+    packedfeaturecache(const std::wstring &path)
+        : path(path), file(path), base(file.data()), mappedsize(file.size())
+    {
+        validate();
+    }
+
+    size_t numchunks() const
+    {
+        return (size_t) getheader().numchunks;
+    }
+    std::string featkind() const
+    {
+        return getheader().featkind;
+    }
+    size_t featdim() const
+    {
+        return getheader().featdim;
+    }
+    unsigned int sampperiod() const
+    {
+        return getheader().sampperiod;
+    }
+    encodingkind encoding() const
+    {
+        return (encodingkind) getheader().encoding;
+    }
+    size_t numutterances(size_t k) const
+    {
+        return (size_t) getentry(k).numutterances;
+    }
+    size_t numframes(size_t k) const
+    {
+        return (size_t) getentry(k).numframes;
+    }
+
+    // copy chunk 'k' into 'frames', which must be in msra::dbn::matrix layout (featdim rows, numframes(k) columns)
+    void readchunk(size_t k, float *frames, size_t colstride) const
+    {
+        const auto &header = getheader();
+        if (colstride != header.colstride)
+            LogicError("packedfeaturecache: readchunk: column stride mismatch");
+        const auto &entry = getentry(k);
+        const size_t numframes = (size_t) entry.numframes;
+        const size_t numbytes = chunkbytes(header, numframes);
+        file.prefetch((size_t) entry.offset, numbytes);
+        if (header.encoding == float32)
+        {
+            memcpy(frames, base + entry.offset, numbytes);
+            return;
+        }
+        const size_t featdim = header.featdim;
+        if (header.encoding == float16)
+        {
+            const uint16_t *p = (const uint16_t *) (base + entry.offset);
+            Microsoft::MSR::CNTK::half h;
+            for (size_t t = 0; t < numframes; t++)
+            {
+                for (size_t i = 0; i < featdim; i++)
+                {
+                    h.bits = *p++;
+                    frames[t * colstride + i] = (float) h;
+                }
+                for (size_t i = featdim; i < colstride; i++)
+                    frames[t * colstride + i] = 0.0f;
+            }
+        }
+        else // uint8
+        {
+            const float *mins = (const float *) (base + entry.offset);
+            const float *steps = mins + featdim;
+            const unsigned char *p = (const unsigned char *) (steps + featdim);
+            for (size_t t = 0; t < numframes; t++)
+            {
+                for (size_t i = 0; i < featdim; i++)
+                    frames[t * colstride + i] = mins[i] + steps[i] * *p++;
+                for (size_t i = featdim; i < colstride; i++)
+                    frames[t * colstride + i] = 0.0f;
+            }
+        }
+    }
+
+    // the frames of chunk 'k' in place in the read-only mapping, in the layout of readchunk(); null unless stored as float32
+    const float *mappedchunk(size_t k) const
+    {
+        const auto &header = getheader();
+        if (header.encoding != float32)
+            return nullptr;
+        const auto &entry = getentry(k);
+        file.prefetch((size_t) entry.offset, chunkbytes(header, (size_t) entry.numframes));
+        return (const float *) (base + entry.offset);
+    }
+
+private:
+    void validate() const
+    {
+        if (mappedsize < pagesize)
+            RuntimeError("packedfeaturecache: %ls is truncated or corrupt", path.c_str());
+        const fileheader &header = getheader();
+        fileheader expected;
+        initheader(expected);
+        if (memcmp(header.magic, expected.magic, sizeof(expected.magic)) != 0 || header.version < 1 || header.version > 2)
+            RuntimeError("packedfeaturecache: %ls is not a feature cache of the expected version", path.c_str());
+        if (header.featkind[featkindsize - 1] != 0 || header.encoding > uint8 || mappedsize < dataoffset((size_t) header.numchunks))
+            RuntimeError("packedfeaturecache: %ls is truncated or corrupt", path.c_str());
+        for (size_t k = 0; k < numchunks(); k++)
+        {
+            const auto &entry = getentry(k);
+            if (entry.offset + chunkbytes(header, (size_t) entry.numframes) > mappedsize)
+                RuntimeError("packedfeaturecache: %ls is truncated or corrupt", path.c_str());
+        }
+    }
+
+    const fileheader &getheader() const
+    {
+        return *(const fileheader *) base;
+    }
+    const chunkentry &getentry(size_t k) const
+    {
+        if (k >= numchunks())
+            LogicError("packedfeaturecache: chunk index %d out of range", (int) k);
+        return ((const chunkentry *) (base + indexoffset()))[k];
+    }
+
+    std::wstring path;
+    msra::files::mappedfile file;
+    const char *base; // file.data()
+    size_t mappedsize;
+};
+} }
@@ -12,7 +12,14 @@
 #include "latticearchive.h" // for reading HTK phoneme lattices (MMI training)
 #include "minibatchsourcehelpers.h"
 #include "minibatchiterator.h"
+#include "packedfeaturecache.h"
+#include "iothreadpool.h"
+#include "CrossProcessMutex.h"
 #include "unordered_set"
+#include <list>
+#include <deque>
+#include <future>
+#include <random>
 
 namespace msra { namespace dbn {
 
@@ -75,6 +82,28 @@ class minibatchutterancesourcemulti : public minibatchsource
     // Make sure type 'utterancedesc' has a move constructor
     static_assert(std::is_move_constructible<utterancedesc>::value, "Type 'utterancedesc' should be move constructible!");
 
+    // a matrix that refers to frames owned elsewhere, i.e. to a chunk in the shared mapping of a feature cache (read-only)
+    class mappedframes : public msra::dbn::matrixbase
+    {
+    public:
+        mappedframes()
+        {
+            this->clear();
+        }
+        mappedframes(const mappedframes &other) // (chunk data is copied and moved into place when the chunks are built; this is just a view)
+        {
+            set(other.p, other.numrows, other.numcols);
+        }
+        void set(const float *data, size_t rows, size_t cols)
+        {
+            this->p = const_cast<float *>(data); // (the mapping is read-only; nothing writes through here)
+            this->numrows = rows;
+            this->numcols = cols;
+            this->colstride = (rows + 3) & ~3;
+        }
+        using msra::dbn::matrixbase::clear;
+    };
+
     struct utterancechunkdata // data for a chunk of utterances
     {
         std::vector<utterancedesc> utteranceset; // utterances in this set
@@ -85,6 +114,7 @@ class minibatchutterancesourcemulti : public minibatchsource
 
         std::vector<size_t> firstframes;                                            // [utteranceindex] first frame for given utterance
         mutable msra::dbn::matrix frames;                                           // stores all frames consecutively (mutable since this is a cache)
+        mutable mappedframes sharedframes;                                          // or refers to them in a shared feature-cache mapping instead
         size_t totalframes;                                                         // total #frames for all utterances in this chunk
         mutable std::vector<shared_ptr<const latticesource::latticepair>> lattices; // (may be empty if none)
 
@@ -117,6 +147,8 @@ class minibatchutterancesourcemulti : public minibatchsource
                 LogicError("getutteranceframes: called when data have not been paged in");
             const size_t ts = firstframes[i];
             const size_t n = numframes(i);
+            if (issharedinram())
+                return msra::dbn::matrixstripe(sharedframes, ts, n);
             return msra::dbn::matrixstripe(frames, ts, n);
         }
         shared_ptr<const latticesource::latticepair> getutterancelattice(size_t i) const // return the frame set for a given utterance
@@ -130,11 +162,38 @@ class minibatchutterancesourcemulti : public minibatchsource
         // test if data is in memory at the moment
         bool isinram() const
         {
-            return !frames.empty();
+            return !frames.empty() || issharedinram();
         }
-        // page in data for this chunk
+        // test if the frames are used in place from a shared feature-cache mapping (i.e. they take no memory of our own)
+        bool issharedinram() const
+        {
+            return !sharedframes.empty();
+        }
+        // read the features of all utterances of this chunk from their HTK files into 'chunkframes'
         // We pass in the feature info variables by ref which will be filled lazily upon first read
-        void requiredata(string &featkind, size_t &featdim, unsigned int &sampperiod, const latticesource &latticesource, int verbosity = 0) const
+        void readfeatures(msra::dbn::matrix &chunkframes, string &featkind, size_t &featdim, unsigned int &sampperiod) const
+        {
+            msra::asr::htkfeatreader reader; // feature reader (we reinstantiate it for each block, i.e. we reopen the file actually)
+            // if this is the first feature read ever, we explicitly open the first file to get the information such as feature dimension
+            if (featdim == 0)
+            {
+                reader.getinfo(utteranceset[0].parsedpath, featkind, featdim, sampperiod);
+                fprintf(stderr, "requiredata: determined feature kind as %d-dimensional '%s' with frame shift %.1f ms\n", (int) featdim, featkind.c_str(), sampperiod / 1e4);
+            }
+            // read all utterances; if they are in the same archive, htkfeatreader will be efficient in not closing the file
+            chunkframes.resize(featdim, totalframes);
+            foreach_index (i, utteranceset)
+            {
+                // read features for this file
+                msra::dbn::matrixstripe uttframes(chunkframes, firstframes[i], numframes(i));             // matrix stripe for this utterance (currently unfilled)
+                reader.read(utteranceset[i].parsedpath, (const string &) featkind, sampperiod, uttframes); // note: file info here used for checkuing only
+            }
+        }
+        // page in data for this chunk
+        // If a feature cache is given, the features are copied from its chunk 'cachechunkindex' instead of being read from the HTK files,
+        // or, with 'shared', used in place from its mapping if it stores them as float32.
+        void requiredata(string &featkind, size_t &featdim, unsigned int &sampperiod, const latticesource &latticesource,
+                         const packedfeaturecache *featurecache, size_t cachechunkindex, bool shared, int verbosity = 0) const
         {
             if (numutterances() == 0)
                 LogicError("requiredata: cannot page in virgin block");
@@ -142,27 +201,16 @@ class minibatchutterancesourcemulti : public minibatchsource
                 LogicError("requiredata: called when data is already in memory");
             try // this function supports retrying since we read from the unrealible network, i.e. do not return in a broken state
             {
-                msra::asr::htkfeatreader reader; // feature reader (we reinstantiate it for each block, i.e. we reopen the file actually)
-                // if this is the first feature read ever, we explicitly open the first file to get the information such as feature dimension
-                if (featdim == 0)
-                {
-                    reader.getinfo(utteranceset[0].parsedpath, featkind, featdim, sampperiod);
-                    fprintf(stderr, "requiredata: determined feature kind as %d-dimensional '%s' with frame shift %.1f ms\n", (int) featdim, featkind.c_str(), sampperiod / 1e4);
-                }
-                // read all utterances; if they are in the same archive, htkfeatreader will be efficient in not closing the file
-                frames.resize(featdim, totalframes);
-                if (!latticesource.empty())
-                    lattices.resize(utteranceset.size());
-                foreach_index (i, utteranceset)
+                if (featurecache && shared && featurecache->mappedchunk(cachechunkindex))
+                    sharedframes.set(featurecache->mappedchunk(cachechunkindex), featdim, totalframes);
+                else if (featurecache)
                 {
-                    // fprintf (stderr, ".");
-                    // read features for this file
-                    auto uttframes = getutteranceframes(i);                                                    // matrix stripe for this utterance (currently unfilled)
-                    reader.read(utteranceset[i].parsedpath, (const string &) featkind, sampperiod, uttframes); // note: file info here used for checkuing only
-                    // page in lattice data
-                    if (!latticesource.empty())
-                        latticesource.getlattices(utteranceset[i].key(), lattices[i], uttframes.cols());
+                    frames.resize(featdim, totalframes);
+                    featurecache->readchunk(cachechunkindex, &frames(0, 0), frames.getcolstride());
                 }
+                else
+                    readfeatures(frames, featkind, featdim, sampperiod);
+                readlattices(latticesource);
                 // fprintf (stderr, "\n");
                 if (verbosity)
                     fprintf(stderr, "requiredata: %d utterances read\n", (int) utteranceset.size());
@@ -173,6 +221,58 @@ class minibatchutterancesourcemulti : public minibatchsource
                 throw;
             }
         }
+        // page in data for this chunk, taking over features and lattices that were read ahead by readfeatures() and readlatticesinto()
+        // (they are swapped out of 'chunkframes' and 'chunklattices')
+        void adoptdata(msra::dbn::matrix &chunkframes, std::vector<shared_ptr<const latticesource::latticepair>> &chunklattices, int verbosity = 0) const
+        {
+            if (numutterances() == 0)
+                LogicError("adoptdata: cannot page in virgin block");
+            if (isinram())
+                LogicError("adoptdata: called when data is already in memory");
+            if (chunkframes.cols() != totalframes)
+                LogicError("adoptdata: read-ahead features have the wrong number of frames");
+            try
+            {
+                frames.swap(chunkframes);
+                lattices.swap(chunklattices);
+                if (verbosity)
+                    fprintf(stderr, "adoptdata: %d read-ahead utterances taken over\n", (int) utteranceset.size());
+            }
+            catch (...)
+            {
+                releasedata();
+                throw;
+            }
+        }
+        // page out data for this chunk by handing features and lattices over to the caller (the counterpart of adoptdata())
+        void surrenderdata(msra::dbn::matrix &chunkframes, std::vector<shared_ptr<const latticesource::latticepair>> &chunklattices) const
+        {
+            if (numutterances() == 0)
+                LogicError("surrenderdata: cannot page out virgin block");
+            if (!isinram() || issharedinram())
+                LogicError("surrenderdata: called when data is not memory");
+            chunkframes.swap(frames);
+            chunklattices.swap(lattices);
+            frames.resize(0, 0);
+            lattices.clear();
+        }
+        // page in lattice data
+        void readlattices(const latticesource &latticesource) const
+        {
+            readlatticesinto(latticesource, lattices);
+        }
+        // read the lattices of all utterances of this chunk into 'chunklattices' (left empty if there are none)
+        // Like readfeatures(), this only uses the utterance list, and may run on a read-ahead thread.
+        void readlatticesinto(const latticesource &latticesource, std::vector<shared_ptr<const latticesource::latticepair>> &chunklattices) const
+        {
+            chunklattices.clear();
+            if (!latticesource.empty())
+            {
+                chunklattices.resize(utteranceset.size());
+                foreach_index (i, utteranceset)
+                    latticesource.getlattices(utteranceset[i].key(), chunklattices[i], numframes(i));
+            }
+        }
         // page out data for this chunk
         void releasedata() const
         {
@@ -182,11 +282,14 @@ class minibatchutterancesourcemulti : public minibatchsource
                 LogicError("releasedata: called when data is not memory");
             // release frames
             frames.resize(0, 0);
+            sharedframes.clear();
             // release lattice data
             lattices.clear();
         }
     };
     std::vector<std::vector<utterancechunkdata>> allchunks;           // set of utterances organized in chunks, referred to by an iterator (not an index)
+    std::vector<unique_ptr<packedfeaturecache>> featurecaches;        // [m] if not null, the features of allchunks[m] are read from here
+    bool sharefeaturecaches;                                          // use float32 feature caches in place from their mapping, see usefeaturecaches()
     std::vector<unique_ptr<biggrowablevector<CLASSIDTYPE>>> classids; // [classidsbegin+t] concatenation of all state sequences
     std::vector<unique_ptr<biggrowablevector<HMMIDTYPE>>> phoneboundaries;
     bool issupervised() const
@@ -240,6 +343,29 @@ class minibatchutterancesourcemulti : public minibatchsource
     };
     std::vector<std::vector<chunk>> randomizedchunks; // utterance chunks after being brought into random order (we randomize within a rolling window over them)
     size_t chunksinram;                               // (for diagnostics messages)
+    std::vector<size_t> randomizedchunksubsets;       // MPI node (subset) that reads each randomized chunk, see chunksubset()
+    size_t randomizedchunksubsetsnum;                 // the number of subsets that randomizedchunksubsets[] was computed for
+    // read-ahead of the features (and lattices) of upcoming chunks, see prefetchchunks()
+    struct prefetchedframes
+    {
+        std::vector<msra::dbn::matrix> frames;                                            // [m] features of one chunk for all streams
+        std::vector<std::vector<shared_ptr<const latticesource::latticepair>>> lattices; // [m] lattices of its utterances, if any
+    };
+    std::map<size_t, std::future<shared_ptr<prefetchedframes>>> prefetchedchunks; // [randomized chunk index] features being read or already read
+    size_t prefetchbudget;                                                        // max. number of bytes of features read ahead
+    unique_ptr<iothreadpool> prefetchthreads;                                     // (declared after all chunk data, so it is destroyed, i.e. joined, first)
+    // RAM cache of paged-out chunks, so that later sweeps need not read them again, see setchunkcache()
+    struct cachedchunk
+    {
+        prefetchedframes data;
+        size_t bytes;
+        std::list<size_t>::iterator lrupos; // position in cachedchunkslru
+    };
+    std::map<size_t, cachedchunk> cachedchunks; // [chunk index into allchunks[]] data of released chunks
+    std::list<size_t> cachedchunkslru;          // their indices, least recently released first
+    size_t chunkcachebudget;                    // max. number of bytes of features cached this way; 0 = no caching
+    size_t chunkcachebytes;                     // bytes cached currently
+    size_t chunkcachehits, chunkcachemisses;    // chunks paged in from the cache or not, in this sweep (for the log)
     struct utteranceref                               // describes the underlying random utterance associated with an utterance position
     {
         size_t chunkindex;     // lives in this chunk (index into randomizedchunks[])
@@ -262,6 +388,7 @@ class minibatchutterancesourcemulti : public minibatchsource
         }
     };
     std::vector<utteranceref> randomizedutterancerefs;            // [pos] randomized utterance ids
+    size_t lengthbucketsize;                                      // if > 1 then randomized utterances are grouped by length in groups of this many, see bucketutterancesbylength()
     std::unordered_map<size_t, size_t> randomizedutteranceposmap; // [globalts] -> pos lookup table
     struct positionchunkwindow                                    // chunk window required in memory when at a certain position, for controlling paging
     {
@@ -305,7 +432,18 @@ class minibatchutterancesourcemulti : public minibatchsource
         {
         }
     };
-    biggrowablevector<frameref> randomizedframerefs; // [globalt-sweepts] -> (chunk, utt, frame) lookup table for randomized frames  --this can be REALLY big!
+    // The frame positions of a sweep are randomized in order, each by swapping it with a later position of its chunk window (such that both frames
+    // stay within the windows of their new positions), so only the positions from the first one still needed to the end of the last randomized
+    // one's window are held (memory in the order of the randomization range, not the corpus). The randomization of upcoming positions runs
+    // on a background thread while a minibatch is being returned. Going back within a sweep (e.g. restarting an epoch) replays it from its start.
+    std::deque<frameref> windowframerefs; // [t - windowframerefsbegin] -> (chunk, utt, frame) for frame positions t (relative to the sweep start)
+    size_t windowframerefsbegin;          // first frame position held
+    size_t framesrandomized;              // frame positions [0, framesrandomized) are final
+    size_t framesneededfrom;              // frame positions before this are not needed anymore
+    size_t framecursorchunk, framecursorutterance, framecursorframe; // underlying frame of the next position appended to windowframerefs[]
+    size_t framerandomizationchunk;                                  // randomized chunk of position framesrandomized
+    std::mt19937_64 framerng;                                        // (not ::rand(), since this runs on a background thread)
+    std::future<void> framerandomization;                            // the running background randomization, if any
 
     // TODO: this may go away if we store classids directly in the utterance data
     template <class VECTOR>
@@ -389,7 +527,8 @@ public:
     minibatchutterancesourcemulti(const std::vector<std::vector<wstring>> &infiles, const std::vector<map<wstring, std::vector<msra::asr::htkmlfentry>>> &labels,
                                   std::vector<size_t> vdim, std::vector<size_t> udim, std::vector<size_t> leftcontext, std::vector<size_t> rightcontext, size_t randomizationrange,
                                   const latticesource &lattices, const map<wstring, msra::lattices::lattice::htkmlfwordsequence> &allwordtranscripts, const bool framemode)
-        : vdim(vdim), leftcontext(leftcontext), rightcontext(rightcontext), sampperiod(0), featdim(0), randomizationrange(randomizationrange), currentsweep(SIZE_MAX), lattices(lattices), allwordtranscripts(allwordtranscripts), framemode(framemode), chunksinram(0), timegetbatch(0), verbosity(2)
+        : vdim(vdim), leftcontext(leftcontext), rightcontext(rightcontext), sampperiod(0), featdim(0), sharefeaturecaches(false), randomizationrange(randomizationrange), currentsweep(SIZE_MAX), lattices(lattices), allwordtranscripts(allwordtranscripts), framemode(framemode), chunksinram(0), randomizedchunksubsetsnum(0), prefetchbudget(0), chunkcachebudget(0), chunkcachebytes(0), chunkcachehits(0), chunkcachemisses(0), lengthbucketsize(0), timegetbatch(0), verbosity(2),
+          windowframerefsbegin(0), framesrandomized(0), framesneededfrom(0), framecursorchunk(0), framecursorutterance(0), framecursorframe(0), framerandomizationchunk(0)
     // [v-hansu] change framemode (lattices.empty()) into framemode (false) to run utterance mode without lattice
     // you also need to change another line, search : [v-hansu] comment out to run utterance mode without lattice
     {
@@ -720,21 +859,89 @@ private:
             RuntimeError("checkoverflow: bit field %s too small for value 0x%x (cut from 0x%x)", fieldname, (int) targetval, (int) fieldval);
     }
 
-    // helper for testing whether a swapped frame position is valid (w.r.t. beign in RAM when being at position 't')
-    bool isframepositionvalid(const size_t t, const biggrowablevector<unsigned short> &ttochunk) const
+    // frame mode: start randomizing the frame positions of a sweep (whose chunks have just been randomized)
+    void resetframerandomization(const size_t sweep)
+    {
+        waitforframerandomization();
+        windowframerefs.clear();
+        windowframerefsbegin = framesrandomized = framesneededfrom = 0;
+        framecursorchunk = framecursorutterance = framecursorframe = 0;
+        framerandomizationchunk = 0;
+        framerng.seed(sweep + 1);
+    }
+
+    // wait for the background randomization, if any (rethrowing its error)
+    void waitforframerandomization()
     {
-        // look up valid range for time position
-        const size_t positionchunkindex = ttochunk[t]; // position 't' lies within this original chunk (relationship is monotonous, not random)
-        const auto &chunk = randomizedchunks[0][positionchunkindex];
-        // get in-RAM chunk range for this frame position (shared across all frame positions within the same chunk)
-        const size_t poswindowbegin = chunk.windowbegin; // rolling window over chunks (which under the hood have been randomized)
-        const size_t poswindowend = chunk.windowend;
-        // Chunk implies that if we are at position 't', we are guaranteed to have chunks [poswindowbegin, poswindowend) in RAM.
-
-        // now see if the randomized location is within that window
-        const size_t actualchunkindexforpos = randomizedframerefs[t].chunkindex; // where this frame pos has been mapped to
-        return actualchunkindexforpos >= poswindowbegin && actualchunkindexforpos < poswindowend;
-        // We only need to test the chunk index. Utterance and frame can be randomized within a chunk as we want, as long it is in RAM.
+        if (framerandomization.valid())
+            framerandomization.get();
+    }
+
+    frameref &windowframeref(const size_t t)
+    {
+        assert(t >= windowframerefsbegin && t < windowframerefsbegin + windowframerefs.size());
+        return windowframerefs[t - windowframerefsbegin];
+    }
+
+    // randomize frame positions [framesrandomized, te) of the current sweep
+    // Positions before framesneededfrom are dropped as soon as they are final. This is what the background job runs; it only
+    // reads the metadata of the randomized chunks, which getbatch() does not change.
+    void randomizeframesupto(const size_t te)
+    {
+        const auto &chunks = randomizedchunks[0];
+        const size_t sweepts = chunks[0].globalts;
+        while (framesrandomized < te)
+        {
+            const size_t t = framesrandomized;
+            while (chunks[framerandomizationchunk].globalte() - sweepts <= t)
+                framerandomizationchunk++;
+            const auto &chunk = chunks[framerandomizationchunk];
+            // frames of positions [t, postend) can be swapped to t: their window is in RAM when at 't'
+            const size_t postend = chunks[chunk.windowend - 1].globalte() - sweepts;
+
+            // append the positions up to there, with their frames in randomized-chunk order
+            while (windowframerefsbegin + windowframerefs.size() < postend)
+            {
+                windowframerefs.push_back(frameref(framecursorchunk, framecursorutterance, framecursorframe)); // (checks the bit fields)
+                const auto &chunkdata = chunks[framecursorchunk].getchunkdata();
+                if (++framecursorframe == chunkdata.numframes(framecursorutterance))
+                {
+                    framecursorframe = 0;
+                    if (++framecursorutterance == chunkdata.numutterances())
+                    {
+                        framecursorutterance = 0;
+                        framecursorchunk++;
+                    }
+                }
+            }
+
+            // swap position t with a random later one, such that both frames stay within the chunk windows of their new positions
+            // This terminates, since the frame at 't' (which got there by a valid swap, or was there) may always stay.
+            for (;;)
+            {
+                const size_t tswap = t + (size_t)(framerng() % (postend - t));
+                const size_t tswapchunkindex = windowframeref(tswap).chunkindex;
+                if (tswapchunkindex < chunk.windowbegin || tswapchunkindex >= chunk.windowend)
+                    continue;
+                const auto &targetchunk = chunks[chunkforframepos(sweepts + tswap)];
+                const size_t sourcechunkindex = windowframeref(t).chunkindex;
+                if (sourcechunkindex < targetchunk.windowbegin || sourcechunkindex >= targetchunk.windowend)
+                    continue;
+                ::swap(windowframeref(t), windowframeref(tswap));
+                break;
+            }
+            framesrandomized++;
+            dropframerefs();
+        }
+        dropframerefs();
+    }
+    void dropframerefs()
+    {
+        while (windowframerefsbegin < min(framesrandomized, framesneededfrom))
+        {
+            windowframerefs.pop_front();
+            windowframerefsbegin++;
+        }
     }
 
     // big long helper to update all cached randomization information
@@ -750,6 +957,12 @@ private:
         if (sweep == currentsweep)                    // already got this one--nothing to do
             return sweep;
 
+        if (chunkcachebudget > 0 && chunkcachehits + chunkcachemisses > 0)
+            fprintf(stderr, "lazyrandomization: chunk cache: %d of %d chunks paged in from RAM in sweep %d (%.1f%% hit rate), %d chunks (%.1f MB) cached\n",
+                    (int) chunkcachehits, (int) (chunkcachehits + chunkcachemisses), (int) currentsweep, 100.0 * chunkcachehits / (chunkcachehits + chunkcachemisses),
+                    (int) cachedchunks.size(), chunkcachebytes / 1e6);
+        chunkcachehits = chunkcachemisses = 0;
+
         currentsweep = sweep;
         if (verbosity > 0)
             fprintf(stderr, "lazyrandomization: re-randomizing for sweep %d in %s mode\n", (int) currentsweep, framemode ? "frame" : "utterance");
@@ -778,7 +991,10 @@ private:
         // We are processing with randomization within a rolling window over this chunk sequence.
         // Paging will happen on a chunk-by-chunk basis.
         // The global time stamp is needed to determine the paging window.
+        waitforframerandomization(); // (it reads randomizedchunks[])
         randomizedchunks.clear(); // data chunks after being brought into random order (we randomize within a rolling window over them)
+        randomizedchunksubsets.clear();
+        prefetchedchunks.clear(); // (keyed by randomized chunk index; jobs still running will just complete into the void)
 
         foreach_index (i, allchunks)
             randomizedchunks.push_back(std::vector<chunk>());
@@ -904,6 +1120,10 @@ private:
                 }
             }
 
+            // optionally bring utterances of similar length together, so that the parallel sequences of a minibatch need little padding
+            if (lengthbucketsize > 1)
+                bucketutterancesbylength();
+
             // place the randomized utterances on the global timeline so we can find them by globalts
             size_t t = sweepts;
             foreach_index (i, randomizedutterancerefs)
@@ -933,134 +1153,110 @@ private:
                 randomizedutteranceposmap[uttref.globalts] = (size_t) pos;
             }
         }
-        else // frame mode
-        {
-            // This sets up the following members:
-            //  - randomizedframerefs
+        else // frame mode: randomized incrementally as getbatch() advances, see randomizeframesupto()
+            resetframerandomization(sweep);
 
-            // Lazy mem allocation for frame references
-            if (randomizedframerefs.size() != _totalframes)
-                randomizedframerefs.resize(_totalframes);
+        return sweep;
+    }
 
-            srand((unsigned int) sweep + 1);
-            // An original timeline is established by the randomized chunks, denoted by 't'.
-            // Returned frames are indexed by frame position j = (globalt - sweept), which have an associated underlying 't'.
-            // It is guaranteed that uttterance frame position j maps to an underlying frame within the corresponding chunk window.
-            biggrowablevector<unsigned short> ttochunk; // randomized chunk index associated with frame position
-            ttochunk.resize(_totalframes);
-            size_t t = 0;
-            frameref frameref;
-            // enumerate chunks in their randomized order and assign frame indices in that order -> randomizedframerefs[t]
-            // At this point, chunks are in randomized order, but utterances and frames within utterances are not randomized.
-            // Later we will randomize those as well.
+    // which subset (MPI node) reads randomized chunk 'k'
+    // Chunks are dealt out in randomized order, each to the subset that has the fewest frames so far. Unlike 'k % numsubsets',
+    // this keeps the subsets' shares of any stretch of the sweep, and thus of each minibatch's randomization window, within
+    // about a chunk of each other, so that no node waits for one that got the long chunks. All nodes compute the same assignment.
+    size_t chunksubset(const size_t k, const size_t numsubsets)
+    {
+        if (numsubsets == 1)
+            return 0;
+
+        if (randomizedchunksubsets.size() != randomizedchunks[0].size() || randomizedchunksubsetsnum != numsubsets)
+        {
+            std::vector<size_t> subsetframes(numsubsets, 0);
+            randomizedchunksubsets.resize(randomizedchunks[0].size());
             foreach_index (i, randomizedchunks[0])
             {
-                frameref.chunkindex = (unsigned short) i;
-                checkoverflow(frameref.chunkindex, i, "frameref::chunkindex");
-                const auto &chunk = randomizedchunks[0][i];
-                const auto &chunkdata = chunk.getchunkdata();
-                const size_t numutt = chunkdata.numutterances();
-                for (size_t k = 0; k < numutt; k++)
-                {
-                    frameref.utteranceindex = (short) k;
-                    checkoverflow(frameref.utteranceindex, k, "frameref::utteranceindex");
-                    const size_t n = chunkdata.numframes(k);
-                    for (size_t m = 0; m < n; m++)
-                    {
-                        frameref.frameindex = (short) m;
-                        checkoverflow(frameref.frameindex, m, "frameref::utteranceindex");
-                        randomizedframerefs[t] = frameref; // hopefully this is a memory copy, not a bit-wise assignment! If not, then code it explicitly
-                        ttochunk[t] = (unsigned short) i;
-                        checkoverflow(ttochunk[t], i, "ttochunk[]");
-                        t++;
-                    }
-                }
+                const size_t subset = std::min_element(subsetframes.begin(), subsetframes.end()) - subsetframes.begin(); // (ties go to the lowest subset)
+                randomizedchunksubsets[i] = subset;
+                subsetframes[subset] += randomizedchunks[0][i].numframes();
             }
-            assert(t == _totalframes);
+            randomizedchunksubsetsnum = numsubsets;
+        }
+        return randomizedchunksubsets[k];
+    }
 
-            // now randomize them --we use the nested loop again to avoid storing a backpointer
-            // The condition is that a randomized frame may not be moved out of its associated chunk window.
-            foreach_index (t, randomizedframerefs)
-            {
-                const size_t positionchunkindex = ttochunk[t];               // position 't' lies within this chunk (relationship is monotonous, not random)
-                const auto &chunk = randomizedchunks[0][positionchunkindex]; // for window
-
-                // get in-RAM chunk range for this frame position (shared across all frame positions within the same chunk)
-                const size_t poswindowbegin = chunk.windowbegin; // rolling window over chunks (which under the hood have been randomized)
-                const size_t poswindowend = chunk.windowend;
-                // Chunk implies that if we are at position 't', we are guaranteed to have chunks [poswindowbegin, poswindowend) in RAM.
-                // These chunks are associated with a range of frame positions.
-                // It is implied that if we are at position 't', the frames covered by chunks [poswindowbegin, poswindowend) are in RAM.
-                const size_t postbegin = randomizedchunks[0][poswindowbegin].globalts - sweepts;
-                const size_t postend = randomizedchunks[0][poswindowend - 1].globalte() - sweepts;
-                // The position that this frame gets randomized to must be guaranteed to belong to a chunk within [postbegin, postend).
-
-                for (;;) // (randomization retry loop)
-                {
-                    size_t tswap = msra::dbn::rand(postbegin, postend); // random frame position within allowed range
-                    // We want to swap 't' to 'tswap' and 'tswap' to 't'.
-                    //  - Both may have been swapped before.
-                    //  - Both must stay within the randomization window of their respective position.
-                    // check admissibility of where the element at 'tswap' gets swapped to 't' (range = [windowbegin,windowend))
-                    size_t tswapchunkindex = randomizedframerefs[tswap].chunkindex;
-                    if (tswapchunkindex < poswindowbegin || tswapchunkindex >= poswindowend)
-                        continue;
-                    // check admissibility of where the element at t gets swapped to (which is frame position 'tswap')
-                    const size_t sourcechunkindex = randomizedframerefs[t].chunkindex;
-                    size_t targetchunkindex = ttochunk[tswap]; // chunk associated with this frame position defines value range
-                    const auto &targetchunk = randomizedchunks[0][targetchunkindex];
-                    const size_t targetwindowbegin = targetchunk.windowbegin;
-                    const size_t targetwindowend = targetchunk.windowend;
-                    if (sourcechunkindex < targetwindowbegin || sourcechunkindex >= targetwindowend)
-                        continue;
-                    // admissible--swap the two
-                    ::swap(randomizedframerefs[t], randomizedframerefs[tswap]);
-#if 0
-                    break;
-#else // post-check  --so far did not trigger, can be removed
-
-                    // do a post-check if we got it right  --we seem not to
-                    if (isframepositionvalid(t, ttochunk) && isframepositionvalid(tswap, ttochunk))
-                        break;
-                    // not valid: swap them back and try again  --we actually discovered a bug in the code above
-                    ::swap(randomizedframerefs[t], randomizedframerefs[tswap]);
-                    fprintf(stderr, "lazyrandomization: BUGBUG --invalid swapping condition detected\n");
-#endif
-                }
-            }
+    // reorder the randomized utterances such that runs of 'lengthbucketsize' consecutive positions have similar lengths
+    // Within the position range of each defining chunk, the utterances are sorted by length and cut into groups of 'lengthbucketsize',
+    // and then the groups are brought into random order. All positions of a defining chunk share the same chunk window,
+    // so this does not violate the paging constraints, and the randomization across the window is retained.
+    // This continues the random sequence of the utterance randomization in lazyrandomization().
+    void bucketutterancesbylength()
+    {
+        std::vector<utteranceref> bucketed;
+        std::vector<size_t> grouporder;
+        foreach_index (k, randomizedchunks[0])
+        {
+            const chunk &definingchunk = randomizedchunks[0][k];
+            const auto begin = randomizedutterancerefs.begin() + definingchunk.utteranceposbegin;
+            const auto end = randomizedutterancerefs.begin() + definingchunk.utteranceposend();
+            std::stable_sort(begin, end, [&](const utteranceref &a, const utteranceref &b)
+                             {
+                                 return randomizedchunks[0][a.chunkindex].getchunkdata().numframes(a.utteranceindex) < randomizedchunks[0][b.chunkindex].getchunkdata().numframes(b.utteranceindex);
+                             });
+
+            const size_t numgroups = (definingchunk.numutterances() + lengthbucketsize - 1) / lengthbucketsize;
+            grouporder.resize(numgroups);
+            foreach_index (g, grouporder)
+                grouporder[g] = g;
+            foreach_index (g, grouporder)
+                ::swap(grouporder[g], grouporder[msra::dbn::rand(0, numgroups)]);
+
+            bucketed.clear();
+            for (size_t g : grouporder)
+                bucketed.insert(bucketed.end(), begin + g * lengthbucketsize, begin + min((g + 1) * lengthbucketsize, definingchunk.numutterances()));
+            std::copy(bucketed.begin(), bucketed.end(), begin);
+        }
+    }
 
-            // check it --my head spins
-            t = 0;
-            foreach_index (i, randomizedchunks[0])
-            {
-                const auto &chunk = randomizedchunks[0][i]; // for window and chunkdata
-                const size_t poswindowbegin = chunk.windowbegin;
-                const size_t poswindowend = chunk.windowend;
+    // the index of randomized chunk k in allchunks[] (the same for all streams), which identifies it across sweeps
+    size_t chunkid(size_t k) const
+    {
+        return randomizedchunks[0][k].uttchunkdata - allchunks[0].begin();
+    }
 
-                const auto &chunkdata = chunk.getchunkdata(); // for numutterances/numframes
-                const size_t numutt = chunkdata.numutterances();
-                for (size_t k = 0; k < numutt; k++)
-                {
-                    const size_t n = chunkdata.numframes(k);
-                    for (size_t m = 0; m < n; m++)
-                    {
-                        const size_t randomizedchunkindex = randomizedframerefs[t].chunkindex;
-                        if (randomizedchunkindex < poswindowbegin || randomizedchunkindex >= poswindowend)
-                            LogicError("lazyrandomization: nope, you got frame randomization wrong, dude");
-                        t++;
-                    }
-                }
-            }
-            assert(t == _totalframes);
-        }
+    // move the data of a chunk that is being paged out into the chunk cache, dropping the least recently released chunks beyond the budget
+    void cacherandomizedchunk(size_t k)
+    {
+        const size_t id = chunkid(k);
+        auto &entry = cachedchunks[id];
+        entry.data.frames.resize(randomizedchunks.size());
+        entry.data.lattices.resize(randomizedchunks.size());
+        foreach_index (m, randomizedchunks)
+            randomizedchunks[m][k].getchunkdata().surrenderdata(entry.data.frames[m], entry.data.lattices[m]);
+        entry.bytes = chunkbytes(k);
+        entry.lrupos = cachedchunkslru.insert(cachedchunkslru.end(), id);
+        chunkcachebytes += entry.bytes;
+        while (chunkcachebytes > chunkcachebudget)
+            uncachechunk(cachedchunkslru.front());
+    }
 
-        return sweep;
+    void uncachechunk(size_t id)
+    {
+        auto cached = cachedchunks.find(id);
+        chunkcachebytes -= cached->second.bytes;
+        cachedchunkslru.erase(cached->second.lrupos);
+        cachedchunks.erase(cached);
     }
 
     // helper to page out a chunk with log message
     void releaserandomizedchunk(size_t k)
     {
         size_t numreleased = 0;
+        if (chunkcachebudget > 0 && randomizedchunks[0][k].getchunkdata().isinram() && !randomizedchunks[0][k].getchunkdata().issharedinram())
+        {
+            if (verbosity)
+                fprintf(stderr, "releaserandomizedchunk: paging out randomized chunk %d into the chunk cache, %d resident in RAM\n", (int) k, (int) (chunksinram - 1));
+            cacherandomizedchunk(k);
+            numreleased = randomizedchunks.size();
+        }
         foreach_index (m, randomizedchunks)
         {
             auto &chunkdata = randomizedchunks[m][k].getchunkdata();
@@ -1105,6 +1301,34 @@ private:
             return false;
         else if (numinram == 0)
         {
+            auto cached = cachedchunks.find(chunkid(chunkindex));
+            if (cached != cachedchunks.end()) // paged out in an earlier sweep and still in the chunk cache
+            {
+                if (verbosity)
+                    fprintf(stderr, "requirerandomizedchunk: paging in randomized chunk %d from the chunk cache, %d resident in RAM\n", (int) chunkindex, (int) (chunksinram + 1));
+                foreach_index (m, randomizedchunks)
+                    randomizedchunks[m][chunkindex].getchunkdata().adoptdata(cached->second.data.frames[m], cached->second.data.lattices[m], verbosity);
+                uncachechunk(cached->first);
+                chunkcachehits++;
+                chunksinram++;
+                return true;
+            }
+            chunkcachemisses++;
+            auto prefetched = prefetchedchunks.find(chunkindex);
+            if (prefetched != prefetchedchunks.end()) // features were read ahead: take them over (this waits if their reading is not yet complete)
+            {
+                shared_ptr<prefetchedframes> frames = prefetched->second.get(); // (rethrows errors of the reading thread)
+                prefetchedchunks.erase(prefetched);
+                foreach_index (m, randomizedchunks)
+                {
+                    auto &chunk = randomizedchunks[m][chunkindex];
+                    if (verbosity)
+                        fprintf(stderr, "feature set %d: requirerandomizedchunk: paging in read-ahead randomized chunk %d (frame range [%d..%d]), %d resident in RAM\n", m, (int) chunkindex, (int) chunk.globalts, (int) (chunk.globalte() - 1), (int) (chunksinram + 1));
+                    chunk.getchunkdata().adoptdata(frames->frames[m], frames->lattices[m], verbosity);
+                }
+                chunksinram++;
+                return true;
+            }
             foreach_index (m, randomizedchunks)
             {
                 auto &chunk = randomizedchunks[m][chunkindex];
@@ -1113,7 +1337,8 @@ private:
                     fprintf(stderr, "feature set %d: requirerandomizedchunk: paging in randomized chunk %d (frame range [%d..%d]), %d resident in RAM\n", m, (int) chunkindex, (int) chunk.globalts, (int) (chunk.globalte() - 1), (int) (chunksinram + 1));
                 msra::util::attempt(5, [&]() // (reading from network)
                                     {
-                                        chunkdata.requiredata(featkind[m], featdim[m], sampperiod[m], this->lattices, verbosity);
+                                        const packedfeaturecache *featurecache = featurecaches.empty() ? nullptr : featurecaches[m].get();
+                                        chunkdata.requiredata(featkind[m], featdim[m], sampperiod[m], this->lattices, featurecache, chunk.uttchunkdata - allchunks[m].begin(), sharefeaturecaches, verbosity);
                                     });
             }
             chunksinram++;
@@ -1125,6 +1350,99 @@ private:
         }
     }
 
+    // number of bytes the features of a randomized chunk take in RAM, for all streams
+    size_t chunkbytes(size_t k) const
+    {
+        size_t bytes = 0;
+        foreach_index (m, randomizedchunks)
+            bytes += randomizedchunks[m][k].numframes() * ((featdim[m] + 3) & ~3) * sizeof(float); // (column stride of msra::dbn::matrix)
+        return bytes;
+    }
+
+    // the job of the read-ahead threads: read the features of one chunk [m] for all streams, from the HTK files or the feature caches,
+    // and its lattices, which includes decoding them
+    static shared_ptr<prefetchedframes> readahead(const std::vector<const utterancechunkdata *> &chunkdata, const std::vector<const packedfeaturecache *> &featurecache,
+                                                  const std::vector<size_t> &cachechunkindex, const std::vector<string> &featkind, const std::vector<size_t> &featdim,
+                                                  const std::vector<unsigned int> &sampperiod, const latticesource *lattices)
+    {
+        auto frames = make_shared<prefetchedframes>();
+        frames->frames.resize(chunkdata.size());
+        frames->lattices.resize(chunkdata.size());
+        foreach_index (m, chunkdata)
+        {
+            msra::dbn::matrix &chunkframes = frames->frames[m];
+            msra::util::attempt(5, [&]() // (reading from network)
+                                {
+                                    if (featurecache[m])
+                                    {
+                                        chunkframes.resize(featdim[m], chunkdata[m]->totalframes);
+                                        featurecache[m]->readchunk(cachechunkindex[m], &chunkframes(0, 0), chunkframes.getcolstride());
+                                    }
+                                    else
+                                    {
+                                        string kind = featkind[m]; // (readfeatures() only fills these in if not known yet, which they are here)
+                                        size_t dim = featdim[m];
+                                        unsigned int period = sampperiod[m];
+                                        chunkdata[m]->readfeatures(chunkframes, kind, dim, period);
+                                    }
+                                    chunkdata[m]->readlatticesinto(*lattices, frames->lattices[m]);
+                                });
+        }
+        return frames;
+    }
+
+    // helper to read ahead the features of the chunks that getbatch() will page in next
+    // The paging window only moves forward through the randomized chunks, so these are the chunks of this subset from 'windowbegin' on
+    // that are not in RAM yet. They are given to the read-ahead threads in this order, as long as they fit into the memory budget.
+    // Read-ahead data of chunks before 'windowbegin' is no longer needed and dropped.
+    void prefetchchunks(const size_t windowbegin, const size_t subsetnum, const size_t numsubsets)
+    {
+        if (!prefetchthreads || (sharefeaturecaches && lattices.empty() && allfeaturecachesmapped()))
+            return; // (nothing to read: the chunks are used in place)
+        foreach_index (m, featdim) // feature dimensions are determined lazily by the first synchronous read
+            if (featdim[m] == 0)
+                return;
+
+        prefetchedchunks.erase(prefetchedchunks.begin(), prefetchedchunks.lower_bound(windowbegin));
+        size_t bytes = 0;
+        for (const auto &prefetched : prefetchedchunks)
+            bytes += chunkbytes(prefetched.first);
+
+        for (size_t k = windowbegin; k < randomizedchunks[0].size(); k++)
+        {
+            if (chunksubset(k, numsubsets) != subsetnum || randomizedchunks[0][k].getchunkdata().isinram() || prefetchedchunks.find(k) != prefetchedchunks.end() ||
+                cachedchunks.find(chunkid(k)) != cachedchunks.end())
+                continue;
+            const size_t kbytes = chunkbytes(k);
+            if (bytes + kbytes > prefetchbudget)
+                break;
+            bytes += kbytes;
+
+            // everything the job needs is captured by value; of the chunk data, readfeatures() only uses the utterance lists, which never change
+            std::vector<const utterancechunkdata *> chunkdata;
+            std::vector<const packedfeaturecache *> featurecache;
+            std::vector<size_t> cachechunkindex;
+            foreach_index (m, randomizedchunks)
+            {
+                const auto &chunk = randomizedchunks[m][k];
+                chunkdata.push_back(&chunk.getchunkdata());
+                featurecache.push_back(featurecaches.empty() ? nullptr : featurecaches[m].get());
+                cachechunkindex.push_back(chunk.uttchunkdata - allchunks[m].begin());
+            }
+            const std::vector<string> kinds = featkind;
+            const std::vector<size_t> dims = featdim;
+            const std::vector<unsigned int> periods = sampperiod;
+            const latticesource *latsource = &this->lattices; // (outlives the read-ahead threads)
+            if (verbosity)
+                fprintf(stderr, "prefetchchunks: reading ahead randomized chunk %d (%.1f MB)\n", (int) k, kbytes / 1e6);
+            std::function<shared_ptr<prefetchedframes>()> job = [=]()
+            {
+                return readahead(chunkdata, featurecache, cachechunkindex, kinds, dims, periods, latsource);
+            };
+            prefetchedchunks[k] = prefetchthreads->submit(job);
+        }
+    }
+
     class matrixasvectorofvectors // wrapper around a matrix that views it as a vector of column vectors
     {
         void operator=(const matrixasvectorofvectors &); // non-assignable
@@ -1164,6 +1482,119 @@ public:
         verbosity = newverbosity;
     }
 
+    // group the randomized utterances by length in groups of 'groupsize' (the number of parallel sequences); 0 disables the grouping
+    // e.g. for whole-utterance BPTT, where a minibatch is as long as its longest utterance. Changing this re-randomizes.
+    void setlengthbucketing(size_t groupsize) override
+    {
+        if (groupsize == lengthbucketsize)
+            return;
+        if (framemode && groupsize > 1)
+            LogicError("setlengthbucketing: length bucketing requires utterance mode");
+        lengthbucketsize = groupsize;
+        currentsweep = SIZE_MAX; // force re-randomization
+    }
+
+    // read the features of upcoming chunks ahead on 'numthreads' background threads, holding at most 'budgetbytes' of features that way
+    // With numthreads = 0 (default), chunks are read when getbatch() first touches them.
+    void setprefetching(size_t numthreads, size_t budgetbytes)
+    {
+        prefetchedchunks.clear();
+        prefetchthreads.reset(numthreads > 0 ? new iothreadpool(numthreads) : nullptr);
+        prefetchbudget = budgetbytes;
+    }
+
+    // keep up to 'budgetbytes' of features of paged-out chunks in RAM, so that the next sweeps take them from there instead of reading them again
+    // The least recently paged-out chunks are dropped first. With budgetbytes = 0 (default), chunks are freed when paged out.
+    void setchunkcache(size_t budgetbytes)
+    {
+        chunkcachebudget = budgetbytes;
+        while (chunkcachebytes > chunkcachebudget)
+            uncachechunk(cachedchunkslru.front());
+    }
+
+    // run the prefetching threads on the processors of this NUMA node (NoNumaNode: wherever the OS puts them)
+    void setprefetchnumanode(int node)
+    {
+        if (prefetchthreads)
+            prefetchthreads->bindtonumanode(node);
+    }
+
+    // whether all feature streams come from float32 feature caches, which can be used in place
+    bool allfeaturecachesmapped() const
+    {
+        if (featurecaches.empty())
+            return false;
+        foreach_index (m, featurecaches)
+            if (!featurecaches[m] || featurecaches[m]->encoding() != packedfeaturecache::float32)
+                return false;
+        return true;
+    }
+
+    // read the features of stream m from a packed cache file instead of the many HTK files (empty path: keep reading those)
+    // If the file does not exist yet, it is packed from the HTK files first; this is a one-time step that reads all data once.
+    // The cache is tied to the chunking of the utterances in the SCP file, and must be deleted if that changes.
+    // 'encodings' (one per stream, or empty for float32) select how a newly packed cache stores the frames, see packedfeaturecache.
+    // With 'shared', float32 caches are not copied into RAM chunk by chunk but used in place from their mapping, which the OS shares
+    // among all processes on the host that read the same file (e.g. all MPI ranks), so that the features are held in memory only once.
+    // Only one process per host packs a missing cache; the others wait for it.
+    void usefeaturecaches(const std::vector<wstring> &cachepaths, const std::vector<packedfeaturecache::encodingkind> &encodings = std::vector<packedfeaturecache::encodingkind>(),
+                          bool shared = false)
+    {
+        if (cachepaths.size() != allchunks.size() || (!encodings.empty() && encodings.size() != allchunks.size()))
+            LogicError("usefeaturecaches: expected one path per feature stream");
+        featurecaches.resize(allchunks.size());
+        sharefeaturecaches = shared;
+        foreach_index (m, cachepaths)
+        {
+            if (cachepaths[m].empty())
+                continue;
+            if (!fexists(cachepaths[m]))
+            {
+                // (if the lock cannot be had, e.g. for lack of permissions, we pack it ourselves; that is safe, just redundant)
+                CrossProcessMutex packlock(msra::strfun::strprintf("CNTK.packedfeaturecache.%llx", (unsigned long long) std::hash<wstring>()(cachepaths[m])));
+                const bool locked = packlock.Acquire(/*wait=*/true);
+                if (!fexists(cachepaths[m])) // (another process may have packed it while we waited)
+                    packfeaturecache(m, cachepaths[m], encodings.empty() ? packedfeaturecache::float32 : encodings[m]);
+                if (locked)
+                    packlock.Release();
+            }
+
+            unique_ptr<packedfeaturecache> featurecache(new packedfeaturecache(cachepaths[m]));
+            bool matches = (featurecache->numchunks() == allchunks[m].size()) && (featdim[m] == 0 || featdim[m] == featurecache->featdim());
+            for (size_t k = 0; matches && k < allchunks[m].size(); k++)
+                matches = (featurecache->numutterances(k) == allchunks[m][k].numutterances()) && (featurecache->numframes(k) == allchunks[m][k].totalframes);
+            if (!matches)
+                RuntimeError("usefeaturecaches: %ls does not match the utterances of feature stream %d; delete it to have it packed again", cachepaths[m].c_str(), m);
+            featkind[m] = featurecache->featkind();
+            featdim[m] = featurecache->featdim();
+            sampperiod[m] = featurecache->sampperiod();
+            fprintf(stderr, "usefeaturecaches: reading feature stream %d (%d chunks of %d-dimensional '%s' features, stored as %s) from %ls%s\n",
+                    m, (int) featurecache->numchunks(), (int) featdim[m], featkind[m].c_str(), packedfeaturecache::encodingname(featurecache->encoding()), cachepaths[m].c_str(),
+                    shared && featurecache->encoding() == packedfeaturecache::float32 ? ", in place (shared)" : "");
+            featurecaches[m] = std::move(featurecache);
+        }
+    }
+
+private:
+    void packfeaturecache(size_t m, const wstring &cachepath, packedfeaturecache::encodingkind encoding)
+    {
+        fprintf(stderr, "packfeaturecache: packing %d chunks of feature stream %d into %ls, as %s\n", (int) allchunks[m].size(), (int) m, cachepath.c_str(), packedfeaturecache::encodingname(encoding));
+        packedfeaturecache::writer writer(cachepath, allchunks[m].size(), encoding);
+        msra::dbn::matrix chunkframes;
+        foreach_index (k, allchunks[m])
+        {
+            const auto &chunkdata = allchunks[m][k];
+            msra::util::attempt(5, [&]() // (reading from network)
+                                {
+                                    chunkdata.readfeatures(chunkframes, featkind[m], featdim[m], sampperiod[m]);
+                                });
+            writer.writechunk(&chunkframes(0, 0), chunkdata.numutterances(), chunkdata.totalframes, featkind[m], featdim[m], sampperiod[m]);
+        }
+        writer.close();
+    }
+
+public:
+
     // get the next minibatch
     // A minibatch is made up of one or more utterances.
     // We will return less than 'framesrequested' unless the first utterance is too long.
@@ -1219,18 +1650,21 @@ public:
             for (size_t k = windowend; k < randomizedchunks[0].size(); k++)
                 releaserandomizedchunk(k);
             for (size_t pos = spos; pos < epos; pos++)
-                if ((randomizedutterancerefs[pos].chunkindex % numsubsets) == subsetnum)
+                if (chunksubset(randomizedutterancerefs[pos].chunkindex, numsubsets) == subsetnum)
                     readfromdisk |= requirerandomizedchunk(randomizedutterancerefs[pos].chunkindex, windowbegin, windowend); // (window range passed in for checking only)
 
             // Note that the above loop loops over all chunks incl. those that we already should have.
             // This has an effect, e.g., if 'numsubsets' has changed (we will fill gaps).
 
+            // read ahead what the next calls will page in
+            prefetchchunks(windowbegin, subsetnum, numsubsets);
+
             // determine the true #frames we return, for allocation--it is less than mbframes in the case of MPI/data-parallel sub-set mode
             size_t tspos = 0;
             for (size_t pos = spos; pos < epos; pos++)
             {
                 const auto &uttref = randomizedutterancerefs[pos];
-                if ((uttref.chunkindex % numsubsets) != subsetnum) // chunk not to be returned for this MPI node
+                if (chunksubset(uttref.chunkindex, numsubsets) != subsetnum) // chunk not to be returned for this MPI node
                     continue;
 
                 tspos += uttref.numframes;
@@ -1277,7 +1711,7 @@ public:
             for (size_t pos = spos; pos < epos; pos++)
             {
                 const auto &uttref = randomizedutterancerefs[pos];
-                if ((uttref.chunkindex % numsubsets) != subsetnum) // chunk not to be returned for this MPI node
+                if (chunksubset(uttref.chunkindex, numsubsets) != subsetnum) // chunk not to be returned for this MPI node
                     continue;
 
                 size_t n = 0;
@@ -1365,14 +1799,24 @@ public:
             if (verbosity > 0)
                 fprintf(stderr, "getbatch: getting randomized frames [%d..%d] (%d frames out of %d requested) in sweep %d; chunks [%d..%d] -> chunk window [%d..%d)\n",
                         (int) globalts, (int) globalte, (int) mbframes, (int) framesrequested, (int) sweep, (int) firstchunk, (int) lastchunk, (int) windowbegin, (int) windowend);
+
+            // randomize the frame positions of this minibatch, unless done in the background already
+            waitforframerandomization();
+            const size_t ts = globalts - sweepts;
+            if (ts < windowframerefsbegin) // going back: replay the sweep
+                resetframerandomization(sweep);
+            framesneededfrom = ts;
+            randomizeframesupto(globalte - sweepts);
+
             // release all data outside, and page in all data inside
             for (size_t k = 0; k < windowbegin; k++)
                 releaserandomizedchunk(k);
             for (size_t k = windowbegin; k < windowend; k++)
-                if ((k % numsubsets) == subsetnum)                                     // in MPI mode, we skip chunks this way
+                if (chunksubset(k, numsubsets) == subsetnum)                           // in MPI mode, we skip chunks this way
                     readfromdisk |= requirerandomizedchunk(k, windowbegin, windowend); // (window range passed in for checking only, redundant here)
             for (size_t k = windowend; k < randomizedchunks[0].size(); k++)
                 releaserandomizedchunk(k);
+            prefetchchunks(windowbegin, subsetnum, numsubsets); // read ahead what the next calls will page in
 
             // determine the true #frames we return--it is less than mbframes in the case of MPI/data-parallel sub-set mode
             // First determine it for all nodes, then pick the min over all nodes, as to give all the same #frames for better load balancing.
@@ -1380,9 +1824,8 @@ public:
             std::vector<size_t> subsetsizes(numsubsets, 0);
             for (size_t i = 0; i < mbframes; i++) // i is input frame index; j < i in case of MPI/data-parallel sub-set mode
             {
-                const size_t framepos = (globalts + i) % _totalframes; // (for comments, see main loop below)
-                const frameref &frameref = randomizedframerefs[framepos];
-                subsetsizes[frameref.chunkindex % numsubsets]++;
+                const frameref &frameref = windowframeref(ts + i); // (for comments, see main loop below)
+                subsetsizes[chunksubset(frameref.chunkindex, numsubsets)]++;
             }
             size_t j = subsetsizes[subsetnum];                                           // return what we have  --TODO: we can remove the above full computation again now
             const size_t allocframes = max(j, (mbframes + numsubsets - 1) / numsubsets); // we leave space for the desired #frames, assuming caller will try to pad them later
@@ -1419,11 +1862,10 @@ public:
                     break;
 
                 // map to time index inside arrays
-                const size_t framepos = (globalts + j) % _totalframes; // using mod because we may actually run beyond the sweep for the last call
-                const frameref &frameref = randomizedframerefs[framepos];
+                const frameref &frameref = windowframeref(ts + j);
 
                 // in MPI/data-parallel mode, skip frames that are not in chunks loaded for this MPI node
-                if ((frameref.chunkindex % numsubsets) != subsetnum)
+                if (chunksubset(frameref.chunkindex, numsubsets) != subsetnum)
                     continue;
 
                 // random utterance
@@ -1465,6 +1907,14 @@ public:
 
                 currmpinodeframecount++;
             }
+
+            // meanwhile, randomize the positions through the next chunk
+            const size_t aheadte = randomizedchunks[0][min(lastchunk + 1, randomizedchunks[0].size() - 1)].globalte() - sweepts;
+            if (framesrandomized < aheadte)
+                framerandomization = std::async(std::launch::async, [this, aheadte]()
+                                                {
+                                                    randomizeframesupto(aheadte);
+                                                });
         }
         timegetbatch = timergetbatch;
 
@@ -9,7 +9,9 @@
 #include "ImageReader.h"
 #include "Config.h"
 #include "ScriptableObjects.h"
-#include "ConcStack.h"
+#include "fileutil.h"
+#include "mappedfile.h"
+#include "CUDAPageLockedMemAllocator.h"
 #include <algorithm>
 #include <fstream>
 #include <sstream> // TODO: this should go away once we update the parameter parsing
@@ -35,7 +37,8 @@ class ITransform
 public:
     virtual void Init(const ConfigParameters& config) = 0;
     // virtual void Init(const ScriptableObjects::IConfigRecord & config) = 0;
-    virtual void Apply(cv::Mat& mat) = 0;
+    // rng - random generator of the image being transformed (seeded per image, so that results do not depend on thread scheduling)
+    virtual void Apply(cv::Mat& mat, std::mt19937& rng) = 0;
 
     ITransform(){};
     virtual ~ITransform(){};
@@ -50,8 +53,7 @@ public:
 class CropTransform : public ITransform
 {
 public:
-    CropTransform(unsigned int seed)
-        : m_seed(seed)
+    CropTransform()
     {
     }
 
@@ -94,14 +96,19 @@ public:
     }
     // virtual void Init(const ScriptableObjects::IConfigRecord & config) override { InitFromConfig(config); }
 
-    void Apply(cv::Mat& mat)
+    void Apply(cv::Mat& mat, std::mt19937& rng)
     {
-        auto seed = m_seed;
-        auto rng = m_rngs.pop_or_create([seed]()
-                                        {
-                                            return std::make_unique<std::mt19937>(seed);
-                                        });
+        cv::Rect rect;
+        bool flip;
+        GetCropAndFlip(mat.rows, mat.cols, rng, rect, flip);
+        mat = mat(rect);
+        if (flip)
+            cv::flip(mat, mat, 1);
+    }
 
+    // the random part of Apply(), for when cropping and flipping happen elsewhere
+    void GetCropAndFlip(int crow, int ccol, std::mt19937& rng, cv::Rect& rect, bool& flip)
+    {
         double ratio = 1;
         switch (m_jitterType)
         {
@@ -113,18 +120,15 @@ public:
                 ratio = m_cropRatioMin;
             else
             {
-                ratio = UniRealT(m_cropRatioMin, m_cropRatioMax)(*rng);
+                ratio = UniRealT(m_cropRatioMin, m_cropRatioMax)(rng);
                 assert(m_cropRatioMin <= ratio && ratio < m_cropRatioMax);
             }
             break;
         default:
             RuntimeError("Jitter type currently not implemented.");
         }
-        mat = mat(GetCropRect(m_cropType, mat.rows, mat.cols, ratio, *rng));
-        if (m_hFlip && std::bernoulli_distribution()(*rng))
-            cv::flip(mat, mat, 1);
-
-        m_rngs.push(std::move(rng));
+        rect = GetCropRect(m_cropType, crow, ccol, ratio, rng);
+        flip = m_hFlip && std::bernoulli_distribution()(rng);
     }
 
 private:
@@ -197,9 +201,6 @@ private:
     }
 
 private:
-    unsigned int m_seed;
-    conc_stack<std::unique_ptr<std::mt19937>> m_rngs;
-
     CropType m_cropType;
     double m_cropRatioMin;
     double m_cropRatioMax;
@@ -210,8 +211,8 @@ private:
 class ScaleTransform : public ITransform
 {
 public:
-    ScaleTransform(int dataType, unsigned int seed)
-        : m_dataType(dataType), m_seed(seed)
+    ScaleTransform(int dataType)
+        : m_dataType(dataType)
     {
         assert(m_dataType == CV_32F || m_dataType == CV_64F);
 
@@ -251,31 +252,28 @@ public:
     }
     // virtual void Init(const ScriptableObjects::IConfigRecord & config) override { InitFromConfig(config); }
 
-    void Apply(cv::Mat& mat)
+    void Apply(cv::Mat& mat, std::mt19937& rng)
     {
         // If matrix has not been converted to the right type, do it now as rescaling requires floating point type.
         if (mat.type() != CV_MAKETYPE(m_dataType, m_imgChannels))
             mat.convertTo(mat, m_dataType);
 
-        auto seed = m_seed;
-        auto rng = m_rngs.pop_or_create([seed]()
-                                        {
-                                            return std::make_unique<std::mt19937>(seed);
-                                        });
-
         assert(m_interp.size() > 0);
         cv::resize(mat, mat, cv::Size(static_cast<int>(m_imgWidth), static_cast<int>(m_imgHeight)), 0, 0,
-                   m_interp[UniIntT(0, static_cast<int>(m_interp.size()) - 1)(*rng)]);
+                   m_interp[UniIntT(0, static_cast<int>(m_interp.size()) - 1)(rng)]);
+    }
 
-        m_rngs.push(std::move(rng));
+    bool IsLinearOnly() const
+    {
+        return std::all_of(m_interp.begin(), m_interp.end(), [](int interp)
+                           {
+                               return interp == cv::INTER_LINEAR;
+                           });
     }
 
 private:
     using UniIntT = std::uniform_int_distribution<int>;
 
-    unsigned int m_seed;
-    conc_stack<std::unique_ptr<std::mt19937>> m_rngs;
-
     int m_dataType;
 
     using StrToIntMapT = std::unordered_map<std::string, int>;
@@ -326,7 +324,7 @@ public:
     }
     // virtual void Init(const ScriptableObjects::IConfigRecord & config) override { InitFromConfig(config); }
 
-    void Apply(cv::Mat& mat)
+    void Apply(cv::Mat& mat, std::mt19937& /*rng*/)
     {
         assert(m_meanImg.size() == cv::Size(0, 0) || (m_meanImg.size() == mat.size() && m_meanImg.channels() == mat.channels()));
 
@@ -335,6 +333,11 @@ public:
             mat = mat - m_meanImg;
     }
 
+    const cv::Mat& GetMean() const
+    {
+        return m_meanImg;
+    }
+
 private:
     cv::Mat m_meanImg;
 };
@@ -343,25 +346,85 @@ private:
 // ImageReader
 
 template <class ElemType>
-static void CopyFromImage(const cv::Mat& src, std::vector<ElemType>& dst, size_t ivDst, bool transpose);
+static void CopyFromImage(const cv::Mat& src, ElemType* dst, size_t ivDst, size_t dstSize, bool transpose);
 
 static std::launch GetLaunchPolicy(bool prefetch)
 {
     return prefetch ? std::launch::async : std::launch::deferred;
 }
 
+//-------------------
+// Packed image file: images decoded and resized once, so that later epochs skip the image decoding.
+// Layout: header, then for each image (in map file order) a record header and the raw pixels (8-bit BGR), then the table of record offsets.
+
+struct PackedImageFileHeader
+{
+    char magic[8]; // "IMGPACK\0"
+    uint32_t version;
+    uint32_t shorterSide; // images were resized so that their shorter side is at most this (0: original size)
+    uint64_t numImages;
+    uint64_t signature; // of the map file contents, to detect an outdated file
+    uint64_t tableOffset;
+};
+
+struct PackedImageHeader
+{
+    int32_t rows;
+    int32_t cols;
+    int32_t type; // OpenCV type, always CV_8UC3
+    int32_t reserved;
+};
+
+static void InitPackedImageFileHeader(PackedImageFileHeader& header)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "IMGPACK", 8);
+    header.version = 1;
+}
+
+static uint64_t PackedImageFileSignature(const std::vector<std::pair<std::string, int>>& files, size_t shorterSide)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto add = [&hash](const void* data, size_t size)
+    {
+        for (size_t k = 0; k < size; k++)
+            hash = (hash ^ ((const unsigned char*) data)[k]) * 1099511628211ull;
+    };
+    uint64_t value = shorterSide;
+    add(&value, sizeof(value));
+    for (const auto& file : files)
+    {
+        add(file.first.data(), file.first.size() + 1);
+        add(&file.second, sizeof(file.second));
+    }
+    return hash;
+}
+
+static cv::Mat ReadImageFile(const std::string& path)
+{
+    cv::Mat img{cv::imread(path, cv::IMREAD_COLOR)};
+    if (!img.data)
+        RuntimeError("Cannot read image file %s", path.c_str());
+    return img;
+}
+
 template <class ElemType>
 ImageReader<ElemType>::ImageReader()
-    : m_seed(0), m_rng(m_seed), m_imgListRand(true), m_pMBLayout(make_shared<MBLayout>()), m_mbFmt(DataFormat::NCHW)
+    : m_seed(0), m_rng(m_seed), m_imgListRand(true), m_pMBLayout(make_shared<MBLayout>()), m_mbFmt(DataFormat::NCHW), m_deviceId(CPUDEVICE), m_packedOffsets(nullptr)
 {
-    m_transforms.push_back(std::make_unique<CropTransform>(m_seed));
-    m_transforms.push_back(std::make_unique<ScaleTransform>(sizeof(ElemType) == 4 ? CV_32F : CV_64F, m_seed));
+    m_transforms.push_back(std::make_unique<CropTransform>());
+    m_cropTransform = static_cast<CropTransform*>(m_transforms.back().get());
+    m_transforms.push_back(std::make_unique<ScaleTransform>(sizeof(ElemType) == 4 ? CV_32F : CV_64F));
+    m_scaleTransform = static_cast<ScaleTransform*>(m_transforms.back().get());
     m_transforms.push_back(std::make_unique<MeanTransform>());
+    m_meanTransform = static_cast<MeanTransform*>(m_transforms.back().get());
 }
 
 template <class ElemType>
 ImageReader<ElemType>::~ImageReader()
 {
+    // wait for the read-ahead, it uses our members
+    m_prefetched.clear();
 }
 
 template <class ElemType>
@@ -385,10 +448,10 @@ void ImageReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
     SectionT featSect{gettter("width")};
     m_featName = msra::strfun::utf16(featSect.first);
     // REVIEW alexeyk: w, h and c will be read again in ScaleTransform.
-    size_t w = featSect.second("width");
-    size_t h = featSect.second("height");
-    size_t c = featSect.second("channels");
-    m_featDim = w * h * c;
+    m_imgWidth = featSect.second("width");
+    m_imgHeight = featSect.second("height");
+    m_imgChannels = featSect.second("channels");
+    m_featDim = m_imgWidth * m_imgHeight * m_imgChannels;
 
     // Get mini-batch format.
     std::string mbFmt = featSect.second("mbFormat", "nchw");
@@ -401,6 +464,12 @@ void ImageReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
     for (auto& t : m_transforms)
         t->Init(featSect.second);
 
+    // With deviceTransforms, minibatches for a GPU are cropped, scaled and mean-subtracted there.
+    // We then only transfer the cropped 8-bit pixels, and the CPUs can spend their time on decoding.
+    m_deviceTransforms = featSect.second(L"deviceTransforms", false);
+    if (m_deviceTransforms && (m_imgChannels != 3 || !m_scaleTransform->IsLinearOnly()))
+        RuntimeError("ImageReader: deviceTransforms requires 3 channels and linear interpolation.");
+
     SectionT labSect{gettter("labelDim")};
     m_labName = msra::strfun::utf16(labSect.first);
     m_labDim = labSect.second("labelDim");
@@ -420,6 +489,9 @@ void ImageReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
             RuntimeError("Invalid map file format, must contain 2 tab-delimited columns: %s, line: %d.", mapPath.c_str(), static_cast<int>(cline));
         m_files.push_back({imgPath, std::stoi(clsId)});
     }
+    m_order.resize(m_files.size());
+    for (size_t i = 0; i < m_order.size(); i++)
+        m_order[i] = i;
 
     std::string rand = config(L"randomize", "auto");
     if (AreEqual(rand, "none"))
@@ -428,17 +500,130 @@ void ImageReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
         RuntimeError("Only Auto and None are currently supported.");
 
     m_prefetch = config(L"prefetch", true);
+    m_prefetchDepth = config(L"prefetchDepth", (size_t) 2);
+    if (m_prefetchDepth == 0)
+        RuntimeError("prefetchDepth must be at least 1.");
 
     int cthread = config(L"numCPUThreads", 0);
     if (cthread > 0)
         omp_set_num_threads(cthread);
 
+    // optionally read the images from a packed file of decoded images, created here if it does not exist yet
+    std::wstring packedPath = config(L"packedImageFile", L"");
+    if (!packedPath.empty())
+    {
+        size_t shorterSide = config(L"packedImageSize", (size_t) 0);
+        if (!OpenPackedImageFile(packedPath, shorterSide))
+        {
+            WritePackedImageFile(packedPath, shorterSide);
+            if (!OpenPackedImageFile(packedPath, shorterSide))
+                RuntimeError("Could not read back packed image file %ls.", packedPath.c_str());
+        }
+    }
+
     m_epochStart = 0;
     m_mbStart = 0;
 }
 //template<class ElemType> virtual void ImageReader<ElemType>::Init(const ConfigParameters & config);
 //template<class ElemType> virtual void ImageReader<ElemType>::Init(const ScriptableObjects::IConfigRecord & config);
 
+// OpenPackedImageFile - map the packed image file; returns false if it does not exist or does not match the map file
+template <class ElemType>
+bool ImageReader<ElemType>::OpenPackedImageFile(const std::wstring& path, size_t shorterSide)
+{
+    if (!fexists(path))
+        return false;
+    auto file = std::make_unique<msra::files::mappedfile>(path);
+    PackedImageFileHeader expected;
+    InitPackedImageFileHeader(expected);
+    const auto* header = reinterpret_cast<const PackedImageFileHeader*>(file->data());
+    if (file->size() < sizeof(PackedImageFileHeader) || memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 || header->version != expected.version)
+        RuntimeError("%ls is not a packed image file of the expected version.", path.c_str());
+    if (header->shorterSide != shorterSide || header->numImages != m_files.size() || header->signature != PackedImageFileSignature(m_files, shorterSide))
+    {
+        fprintf(stderr, "ImageReader: packed image file %ls does not match the map file, recreating it.\n", path.c_str());
+        return false;
+    }
+    if (header->tableOffset + m_files.size() * sizeof(uint64_t) != file->size())
+        RuntimeError("Packed image file %ls is truncated or corrupt.", path.c_str());
+
+    m_packedOffsets = reinterpret_cast<const uint64_t*>(file->data() + header->tableOffset);
+    m_packedFile = std::move(file);
+    fprintf(stderr, "ImageReader: reading %d images from packed image file %ls\n", (int) m_files.size(), path.c_str());
+    return true;
+}
+
+// WritePackedImageFile - decode (and shrink) all images once, and store them in a packed image file
+// This goes via a temp file, so that nobody reads a partial file.
+template <class ElemType>
+void ImageReader<ElemType>::WritePackedImageFile(const std::wstring& path, size_t shorterSide)
+{
+    fprintf(stderr, "ImageReader: writing %d images to packed image file %ls ...", (int) m_files.size(), path.c_str());
+    const std::wstring tempPath = path + L".tmp";
+    {
+        auto_file_ptr f(fopenOrDie(tempPath, L"wb"));
+        PackedImageFileHeader header;
+        InitPackedImageFileHeader(header);
+        header.shorterSide = (uint32_t) shorterSide;
+        header.numImages = m_files.size();
+        header.signature = PackedImageFileSignature(m_files, shorterSide);
+        fwriteOrDie(&header, sizeof(header), 1, f);
+
+        // decode blocks of images in parallel, and write them in order
+        std::vector<uint64_t> offsets;
+        offsets.reserve(m_files.size());
+        uint64_t offset = sizeof(header);
+        const size_t blockSize = 1024;
+        std::vector<cv::Mat> block;
+        for (size_t blockStart = 0; blockStart < m_files.size(); blockStart += blockSize)
+        {
+            block.resize(std::min(blockSize, m_files.size() - blockStart));
+#pragma omp parallel for schedule(dynamic)
+            for (long long i = 0; i < static_cast<long long>(block.size()); i++)
+            {
+                cv::Mat img = ReadImageFile(m_files[blockStart + i].first);
+                int shorter = std::min(img.rows, img.cols);
+                if (shorterSide > 0 && shorter > (int) shorterSide)
+                {
+                    double scale = (double) shorterSide / shorter;
+                    cv::resize(img, img, cv::Size(std::max(1, (int) (img.cols * scale + 0.5)), std::max(1, (int) (img.rows * scale + 0.5))), 0, 0, cv::INTER_AREA);
+                }
+                block[i] = img.isContinuous() ? img : img.clone();
+            }
+            for (const auto& img : block)
+            {
+                PackedImageHeader imgHeader = {img.rows, img.cols, img.type(), 0};
+                size_t bytes = img.total() * img.elemSize();
+                fwriteOrDie(&imgHeader, sizeof(imgHeader), 1, f);
+                fwriteOrDie(img.ptr(), 1, bytes, f);
+                offsets.push_back(offset);
+                offset += sizeof(imgHeader) + bytes;
+            }
+        }
+
+        // table of offsets, and where to find it
+        fwriteOrDie(offsets, f);
+        header.tableOffset = offset;
+        fseekOrDie(f, 0);
+        fwriteOrDie(&header, sizeof(header), 1, f);
+        fflushOrDie(f);
+    }
+    renameOrDie(tempPath, path);
+    fprintf(stderr, " done\n");
+}
+
+// LoadImage - decoded image of m_files[fileIndex], from the packed image file if we have one
+template <class ElemType>
+cv::Mat ImageReader<ElemType>::LoadImage(size_t fileIndex) const
+{
+    if (!m_packedFile)
+        return ReadImageFile(m_files[fileIndex].first);
+    const char* record = m_packedFile->data() + m_packedOffsets[fileIndex];
+    const auto* imgHeader = reinterpret_cast<const PackedImageHeader*>(record);
+    // copy, as the transforms may modify the pixels in place, and the mapping is read-only
+    return cv::Mat(imgHeader->rows, imgHeader->cols, imgHeader->type, const_cast<char*>(record + sizeof(PackedImageHeader))).clone();
+}
+
 template <class ElemType>
 void ImageReader<ElemType>::Destroy()
 {
@@ -452,11 +637,15 @@ void ImageReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t
     assert(subsetNum < numSubsets);
     assert(requestedEpochSamples > 0);
 
+    // drop what was read ahead for the previous loop before changing the order (this waits for it)
+    m_prefetched.clear();
+    m_freeBuffers.clear();
+
     m_subsetNum = subsetNum;
     m_numSubsets = numSubsets;
 
     if (m_imgListRand)
-        std::shuffle(m_files.begin(), m_files.end(), m_rng);
+        std::shuffle(m_order.begin(), m_order.end(), m_rng);
 
     m_epochSize = (requestedEpochSamples == requestDataSize ? m_files.size() : requestedEpochSamples);
     m_mbSize = mbSize;
@@ -470,12 +659,9 @@ void ImageReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t
         m_mbStart = 0;
     }
 
-    m_featBuf.resize(m_mbSize * m_featDim);
-    m_labBuf.resize(m_mbSize * m_labDim);
-    m_mbPrefetchFut = std::async(GetLaunchPolicy(m_prefetch), [this]()
-                                 {
-                                     return ReadImages();
-                                 });
+    m_readStart = m_mbStart;
+    for (size_t i = 0; i < m_prefetchDepth; i++)
+        ReadAhead();
 }
 
 template <class ElemType>
@@ -485,28 +671,69 @@ bool ImageReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>
     assert(matrices.find(m_featName) != matrices.end());
     assert(m_mbSize > 0);
 
-    size_t mbSize = m_mbPrefetchFut.valid() ? m_mbPrefetchFut.get() : 0;
+    if (m_prefetched.empty())
+        return false;
+    PrefetchedMB mb = m_prefetched.front();
+    m_prefetched.pop_front();
+    size_t mbSize = mb.subsetSize.get();
+    m_mbStart = mb.mbStart + mb.actualMBSize;
 
     if (mbSize == 0)
         return false;
 
     Matrix<ElemType>& features = *matrices[m_featName];
-    features.SetValue(m_featDim, mbSize, features.GetDeviceId(), m_featBuf.data(), matrixFlagNormal);
+    if (mb.imageBuf && features.GetDeviceId() == mb.bufferDeviceId)
+        TransformOnDevice(*mb.imageBuf, mbSize, features);
+    else if (mb.imageBuf)
+        LogicError("ImageReader: Minibatch was read for device transforms on a different device.");
+    else
+        features.SetValue(m_featDim, mbSize, features.GetDeviceId(), mb.featBuf.get(), matrixFlagNormal);
 
     Matrix<ElemType>& labels = *matrices[m_labName];
-    labels.SetValue(m_labDim, mbSize, labels.GetDeviceId(), m_labBuf.data(), matrixFlagNormal);
+    labels.SetValue(m_labDim, mbSize, labels.GetDeviceId(), mb.labBuf.get(), matrixFlagNormal);
 
     m_pMBLayout->InitAsFrameMode(mbSize);
 
-    // It is safe to run prefetching with just one buffer as SetValue is synchronous so there will be no race.
-    m_mbPrefetchFut = std::async(GetLaunchPolicy(m_prefetch), [this]()
-                                 {
-                                     return ReadImages();
-                                 });
+    // SetValue is synchronous, so the buffers can be reused right away. Once we know the device, new buffers are page-locked for it.
+    if (features.GetDeviceId() != m_deviceId)
+    {
+        m_deviceId = features.GetDeviceId();
+        m_freeBuffers.clear();
+        m_freeImageBuffers.clear();
+    }
+    if (mb.bufferDeviceId == m_deviceId)
+    {
+        m_freeBuffers.push_back(std::make_pair(mb.featBuf, mb.labBuf));
+        if (mb.imageBuf)
+            m_freeImageBuffers.push_back(mb.imageBuf);
+    }
+    ReadAhead();
 
     return true;
 }
 
+// TransformOnDevice - crop, scale and mean-subtract the 8-bit images of a minibatch on the device of 'features'
+template <class ElemType>
+void ImageReader<ElemType>::TransformOnDevice(std::vector<char>& images, size_t mbSize, Matrix<ElemType>& features)
+{
+    DEVICEID_TYPE deviceId = features.GetDeviceId();
+    if (!m_deviceImages || m_deviceImages->GetDeviceId() != deviceId)
+    {
+        m_deviceImages = std::make_unique<Matrix<char>>(deviceId);
+        m_deviceMean = std::make_unique<Matrix<ElemType>>(deviceId);
+        // the mean is only subtracted if it has the size of the scaled images, like MeanTransform does
+        const cv::Mat& mean = m_meanTransform->GetMean();
+        if (mean.total() * mean.channels() == m_featDim)
+        {
+            cv::Mat meanValues;
+            mean.convertTo(meanValues, sizeof(ElemType) == 4 ? CV_32F : CV_64F);
+            m_deviceMean->SetValue(m_featDim, 1, deviceId, reinterpret_cast<ElemType*>(meanValues.ptr()), matrixFlagNormal);
+        }
+    }
+    m_deviceImages->SetValue(images.size(), 1, deviceId, images.data(), matrixFlagNormal);
+    features.AssignAugmentedImagesOf(*m_deviceImages, mbSize, m_imgWidth, m_imgHeight, m_imgChannels, m_mbFmt == DataFormat::NCHW, *m_deviceMean);
+}
+
 template <class ElemType>
 bool ImageReader<ElemType>::DataEnd(EndDataType endDataType)
 {
@@ -536,59 +763,185 @@ void ImageReader<ElemType>::SetRandomSeed(unsigned int seed)
     m_rng.seed(m_seed);
 }
 
+// AllocateBuffer - host buffer for a minibatch, page-locked if the data goes to a GPU
+template <class ElemType>
+std::shared_ptr<ElemType> ImageReader<ElemType>::AllocateBuffer(size_t numElements) const
+{
+    if (m_deviceId >= 0)
+    {
+        MemAllocator* allocator = &CUDAPageLockedMemArena::GetSharedArena(m_deviceId);
+        return std::shared_ptr<ElemType>((ElemType*) allocator->Malloc(sizeof(ElemType) * numElements), [allocator](ElemType* p)
+                                         {
+                                             allocator->Free((char*) p);
+                                         });
+    }
+    else
+        return std::shared_ptr<ElemType>(new ElemType[numElements], [](ElemType* p)
+                                         {
+                                             delete[] p;
+                                         });
+}
+
+// ReadAhead - start reading the next minibatch in the background
+// Minibatches are read one after the other, each of them by all OpenMP threads.
 template <class ElemType>
-size_t ImageReader<ElemType>::ReadImages()
+void ImageReader<ElemType>::ReadAhead()
 {
-    if (m_mbStart >= m_files.size() || m_mbStart >= m_epochStart + m_epochSize)
-        return 0;
+    if (m_readStart >= m_files.size() || m_readStart >= m_epochStart + m_epochSize)
+        return;
+
+    PrefetchedMB mb;
+    mb.bufferDeviceId = m_deviceId;
+    mb.mbStart = m_readStart;
+    mb.actualMBSize = std::min(m_readStart + m_mbSize, m_files.size()) - m_readStart;
+    if (!m_freeBuffers.empty())
+    {
+        std::tie(mb.featBuf, mb.labBuf) = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+    else
+    {
+        mb.featBuf = AllocateBuffer(m_mbSize * m_featDim);
+        mb.labBuf = AllocateBuffer(m_mbSize * m_labDim);
+    }
+    if (m_deviceTransforms && m_deviceId >= 0)
+    {
+        if (!m_freeImageBuffers.empty())
+        {
+            mb.imageBuf = m_freeImageBuffers.back();
+            m_freeImageBuffers.pop_back();
+        }
+        else
+            mb.imageBuf = std::make_shared<std::vector<char>>();
+    }
 
-    size_t mbLim = m_mbStart + m_mbSize;
-    if (mbLim > m_files.size())
-        mbLim = m_files.size();
+    std::shared_future<size_t> previous;
+    if (!m_prefetched.empty())
+        previous = m_prefetched.back().subsetSize;
+    size_t mbStart = mb.mbStart;
+    size_t actualMBSize = mb.actualMBSize;
+    size_t epoch = m_epoch;
+    ElemType* featBuf = mb.featBuf.get();
+    ElemType* labBuf = mb.labBuf.get();
+    std::vector<char>* imageBuf = mb.imageBuf.get();
+    mb.subsetSize = std::async(GetLaunchPolicy(m_prefetch), [this, previous, mbStart, actualMBSize, epoch, featBuf, labBuf, imageBuf]()
+                               {
+                                   if (previous.valid())
+                                       previous.wait();
+                                   return ReadImages(mbStart, actualMBSize, epoch, featBuf, labBuf, imageBuf);
+                               }).share();
+    m_prefetched.push_back(mb);
+    m_readStart += mb.actualMBSize;
+}
 
-    std::fill(m_labBuf.begin(), m_labBuf.end(), static_cast<ElemType>(0));
+// ReadImages - decode and transform the images of our subset of a minibatch
+// mbStart, actualMBSize - samples of the sweep that make up the minibatch (all subsets)
+// imageBuf - if not null, only crop the images, and store their 8-bit pixels there for TransformOnDevice() instead of into 'featBuf'
+// returns - number of samples of our subset
+template <class ElemType>
+size_t ImageReader<ElemType>::ReadImages(size_t mbStart, size_t actualMBSize, size_t epoch, ElemType* featBuf, ElemType* labBuf, std::vector<char>* imageBuf)
+{
+    std::fill(labBuf, labBuf + m_mbSize * m_labDim, static_cast<ElemType>(0));
 
-    size_t actualMBSize = mbLim - m_mbStart;
     size_t iStart = actualMBSize * m_subsetNum / m_numSubsets;
     size_t iLim = actualMBSize * (m_subsetNum + 1) / m_numSubsets;
     size_t subsetSize = iLim - iStart;
 
+    if (imageBuf)
+    {
+        ReadCroppedImages(mbStart + iStart, subsetSize, epoch, labBuf, *imageBuf);
+        return subsetSize;
+    }
+
 #pragma omp parallel for ordered schedule(dynamic)
     for (long long i = 0; i < static_cast<long long>(subsetSize); i++)
     {
-        const auto& p = m_files[m_mbStart + iStart + i];
-        cv::Mat img{cv::imread(p.first, cv::IMREAD_COLOR)};
-        if (!img.data)
-            RuntimeError("Cannot read image file %s", p.first.c_str());
+        size_t sample = mbStart + iStart + i;
+        const auto& p = m_files[m_order[sample]];
+        cv::Mat img = LoadImage(m_order[sample]);
+
+        // The random choices of the transforms depend only on the seed, the epoch and the position of the image in the sweep,
+        // not on which thread happens to process it, so results are reproducible.
+        std::seed_seq seeds{m_seed, static_cast<unsigned int>(epoch), static_cast<unsigned int>(sample)};
+        std::mt19937 rng(seeds);
         for (auto& t : m_transforms)
-            t->Apply(img);
+            t->Apply(img, rng);
 
         assert(img.rows * img.cols * img.channels() == m_featDim);
         // When IMREAD_COLOR is used, OpenCV stores image in BGR format.
         // Transpose is required if requested mini-batch format is NCHW.
-        CopyFromImage(img, m_featBuf, m_featDim * i, m_mbFmt == DataFormat::NCHW);
-        m_labBuf[m_labDim * i + p.second] = 1;
+        CopyFromImage(img, featBuf, m_featDim * i, m_mbSize * m_featDim, m_mbFmt == DataFormat::NCHW);
+        labBuf[m_labDim * i + p.second] = 1;
     }
 
-    m_mbStart += actualMBSize;
     return subsetSize;
 }
 
+// ReadCroppedImages - the part of ReadImages() for device transforms: decode and crop the images, in the layout of ImageAugmentationDesc
+template <class ElemType>
+void ImageReader<ElemType>::ReadCroppedImages(size_t sampleStart, size_t numSamples, size_t epoch, ElemType* labBuf, std::vector<char>& imageBuf)
+{
+    std::vector<cv::Mat> crops(numSamples);
+    std::vector<char> flips(numSamples); // (not vector<bool>, which cannot be written concurrently)
+#pragma omp parallel for schedule(dynamic)
+    for (long long i = 0; i < static_cast<long long>(numSamples); i++)
+    {
+        size_t sample = sampleStart + i;
+        cv::Mat img = LoadImage(m_order[sample]);
+        assert(img.type() == CV_8UC3);
+
+        // same random choices as ReadImages() makes for this image
+        std::seed_seq seeds{m_seed, static_cast<unsigned int>(epoch), static_cast<unsigned int>(sample)};
+        std::mt19937 rng(seeds);
+        cv::Rect rect;
+        bool flip;
+        m_cropTransform->GetCropAndFlip(img.rows, img.cols, rng, rect, flip);
+        crops[i] = img(rect);
+        flips[i] = flip;
+        labBuf[m_labDim * i + m_files[m_order[sample]].second] = 1;
+    }
+
+    // descriptors first, then the pixels
+    size_t offset = numSamples * sizeof(ImageAugmentationDesc);
+    std::vector<ImageAugmentationDesc> descs(numSamples);
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        descs[i].offset = offset;
+        descs[i].rows = crops[i].rows;
+        descs[i].cols = crops[i].cols;
+        descs[i].flip = flips[i];
+        descs[i].reserved = 0;
+        offset += crops[i].total() * crops[i].elemSize();
+    }
+    imageBuf.resize(offset);
+    if (numSamples > 0)
+        memcpy(imageBuf.data(), descs.data(), numSamples * sizeof(ImageAugmentationDesc));
+#pragma omp parallel for schedule(dynamic)
+    for (long long i = 0; i < static_cast<long long>(numSamples); i++)
+    {
+        // the crop is a view into the image; copy it row by row
+        size_t rowBytes = crops[i].cols * crops[i].elemSize();
+        for (int row = 0; row < crops[i].rows; row++)
+            memcpy(imageBuf.data() + descs[i].offset + row * rowBytes, crops[i].ptr(row), rowBytes);
+    }
+}
+
 template class ImageReader<double>;
 template class ImageReader<float>;
 
 template <class ElemType>
-static void CopyFromImage(const cv::Mat& src, std::vector<ElemType>& dst, size_t ivDst, bool transpose)
+static void CopyFromImage(const cv::Mat& src, ElemType* dst, size_t ivDst, size_t dstSize, bool transpose)
 {
     assert(src.isContinuous());
     assert(src.channels() == 3);
 
     size_t count = src.rows * src.cols * src.channels();
-    assert(ivDst + count <= dst.size());
+    assert(ivDst + count <= dstSize);
+    UNUSED(dstSize);
 
     auto data = reinterpret_cast<const ElemType*>(src.ptr());
     if (!transpose)
-        std::copy(data, data + count, dst.begin() + ivDst);
+        std::copy(data, data + count, dst + ivDst);
     else
     {
         size_t crow = src.rows * src.cols;
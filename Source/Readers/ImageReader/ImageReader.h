@@ -11,11 +11,22 @@
 #include <memory>
 #include <future>
 #include <array>
+#include <deque>
+
+namespace cv {
+class Mat;
+}
+namespace msra { namespace files {
+class mappedfile;
+} }
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 // REVIEW alexeyk: can't put it into ImageReader itself as ImageReader is a template.
 class ITransform;
+class CropTransform;
+class ScaleTransform;
+class MeanTransform;
 
 template <class ElemType>
 class ImageReader : public IDataReader<ElemType>
@@ -83,10 +94,21 @@ private:
     std::mt19937 m_rng;
 
     std::vector<std::unique_ptr<ITransform>> m_transforms;
+    CropTransform* m_cropTransform; // (these point into m_transforms)
+    ScaleTransform* m_scaleTransform;
+    MeanTransform* m_meanTransform;
+
+    // optionally crop, scale and mean-subtract on the GPU
+    bool m_deviceTransforms;
+    std::unique_ptr<Matrix<char>> m_deviceImages;
+    std::unique_ptr<Matrix<ElemType>> m_deviceMean;
 
     std::wstring m_featName;
     std::wstring m_labName;
 
+    size_t m_imgWidth;
+    size_t m_imgHeight;
+    size_t m_imgChannels;
     size_t m_featDim;
     size_t m_labDim;
 
@@ -103,10 +125,30 @@ private:
     size_t m_subsetNum;
     size_t m_numSubsets;
 
+    std::vector<size_t> m_order; // sweep position -> index into m_files
+
+    // Minibatches being read ahead, in order. Each of them is read into its own buffers, which are recycled.
+    struct PrefetchedMB
+    {
+        std::shared_future<size_t> subsetSize; // ready when the minibatch has been read
+        std::shared_ptr<ElemType> featBuf;
+        std::shared_ptr<ElemType> labBuf;
+        std::shared_ptr<std::vector<char>> imageBuf; // with device transforms: the cropped 8-bit images (then featBuf is not used)
+        DEVICEID_TYPE bufferDeviceId; // device the buffers were allocated for
+        size_t mbStart;
+        size_t actualMBSize;
+    };
     bool m_prefetch;
-    std::future<size_t> m_mbPrefetchFut;
-    std::vector<ElemType> m_featBuf;
-    std::vector<ElemType> m_labBuf;
+    size_t m_prefetchDepth; // number of minibatches to read ahead
+    size_t m_readStart;     // sweep position of the next minibatch to read ahead
+    std::deque<PrefetchedMB> m_prefetched;
+    std::vector<std::pair<std::shared_ptr<ElemType>, std::shared_ptr<ElemType>>> m_freeBuffers;
+    std::vector<std::shared_ptr<std::vector<char>>> m_freeImageBuffers;
+    DEVICEID_TYPE m_deviceId; // where the minibatches go, to allocate page-locked buffers for GPUs
+
+    // optional file of decoded images
+    std::unique_ptr<msra::files::mappedfile> m_packedFile;
+    const uint64_t* m_packedOffsets;
 
     bool m_imgListRand;
 
@@ -114,6 +156,13 @@ private:
     DataFormat m_mbFmt;
 
 private:
-    size_t ReadImages();
+    bool OpenPackedImageFile(const std::wstring& path, size_t shorterSide);
+    void WritePackedImageFile(const std::wstring& path, size_t shorterSide);
+    cv::Mat LoadImage(size_t fileIndex) const;
+    std::shared_ptr<ElemType> AllocateBuffer(size_t numElements) const;
+    void ReadAhead();
+    size_t ReadImages(size_t mbStart, size_t actualMBSize, size_t epoch, ElemType* featBuf, ElemType* labBuf, std::vector<char>* imageBuf);
+    void ReadCroppedImages(size_t sampleStart, size_t numSamples, size_t epoch, ElemType* labBuf, std::vector<char>& imageBuf);
+    void TransformOnDevice(std::vector<char>& images, size_t mbSize, Matrix<ElemType>& features);
 };
 } } }
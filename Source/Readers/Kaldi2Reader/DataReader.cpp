@@ -14,7 +14,7 @@
 //#include "msra_mgram.h"                 // for unigram scores of ground-truth path in sequence training
 
 #include "rollingwindowsource.h" // minibatch sources
-//#include "readaheadsource.h"
+#include "readaheadsource.h"
 #include "chunkevalsource.h"
 #define DATAREADER_EXPORTS
 #include "DataReader.h"
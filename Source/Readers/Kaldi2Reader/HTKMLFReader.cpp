@@ -13,9 +13,7 @@
 
 #include "rollingwindowsource.h" // minibatch sources
 #include "utterancesourcemulti.h"
-#ifdef _WIN32
 #include "readaheadsource.h"
-#endif
 #include "chunkevalsource.h"
 #include "minibatchiterator.h"
 #define DATAREADER_EXPORTS // creating the exports here
@@ -46,6 +44,7 @@ void HTKMLFReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig
 {
     m_mbiter = NULL;
     m_frameSource = NULL;
+    m_readAheadSource = NULL;
     m_lattices = NULL;
     m_seqTrainDeriv = NULL;
     m_uttDerivBuffer = NULL;
@@ -107,6 +106,9 @@ void HTKMLFReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfig
         LogicError("frameMode has to be false in sequence training.\n");
     }
 
+    // Reads the next minibatches on a background thread while the current one is being processed.
+    m_readAhead = readerConfig(L"readAhead", true);
+
     // Checks if partial minibatches are allowed.
     std::string minibatchMode(readerConfig(L"minibatchMode", "Partial"));
     m_partialMinibatch = !_stricmp(minibatchMode.c_str(), "Partial");
@@ -174,6 +176,10 @@ void HTKMLFReader<ElemType>::PrepareForSequenceTraining(const ConfigRecordType&
     acousticScale = denlatConfig(L"acousticScale", 0.2);
     lmScale = denlatConfig(L"lmScale", 1.0);
     oneSilenceClass = denlatConfig(L"oneSilenceClass", true);
+    // Derivatives are computed in the background while the network computes
+    // the next minibatch; 0 computes them synchronously. By default one
+    // thread per parallel utterance.
+    size_t numDerivativeThreads = denlatConfig(L"numThreads", m_numberOfuttsPerMinibatch);
 
     // Processes "alignments" section.
     const ConfigRecordType& aliConfig = readerConfig(L"alignments");
@@ -227,7 +233,7 @@ void HTKMLFReader<ElemType>::PrepareForSequenceTraining(const ConfigRecordType&
                    "buffering?\n");
     }
     m_uttDerivBuffer = new UtteranceDerivativeBuffer<ElemType>(
-        m_numberOfuttsPerMinibatch, m_seqTrainDeriv);
+        m_numberOfuttsPerMinibatch, m_seqTrainDeriv, numDerivativeThreads);
 }
 
 // Loads input and output data for training and testing. Below we list the
@@ -674,6 +680,11 @@ HTKMLFReader<ElemType>::~HTKMLFReader()
         delete m_mbiter;
         m_mbiter = NULL;
     }
+    if (m_readAheadSource != NULL)
+    {
+        delete m_readAheadSource; // (stops the thread, which reads from m_frameSource)
+        m_readAheadSource = NULL;
+    }
     if (m_frameSource != NULL)
     {
         delete m_frameSource;
@@ -813,6 +824,17 @@ void HTKMLFReader<ElemType>::StartMinibatchLoopToTrainOrTest(size_t mbSize, size
         m_mbiter = NULL;
     }
     msra::dbn::minibatchsource* source = m_frameSource;
+    if (m_readAhead)
+    {
+        // A new read-ahead thread per epoch, since the epoch size may change.
+        if (m_readAheadSource != NULL)
+        {
+            delete m_readAheadSource;
+            m_readAheadSource = NULL;
+        }
+        m_readAheadSource = new msra::dbn::minibatchreadaheadsource(*m_frameSource, requestedEpochSamples);
+        source = m_readAheadSource;
+    }
     size_t currentMBSize = (m_framemode == true) ? mbSize : 1;
     m_mbiter = new msra::dbn::minibatchiterator(*source, epoch, requestedEpochSamples, currentMBSize, datapasses);
 
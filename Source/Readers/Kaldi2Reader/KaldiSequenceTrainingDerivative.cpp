@@ -71,7 +71,8 @@ bool KaldiSequenceTrainingDerivative<ElemType>::ComputeDerivative(
                      (int) m_transModel.NumPdfs());
     }
 
-    // Reads alignment.
+    // Reads alignment and denominator lattice.
+    std::unique_lock<std::mutex> readerLock(m_readerLock);
     if (!m_aliReader->HasKey(uttIDStr))
     {
         RuntimeError("Alignment not found for utterance %s\n",
@@ -85,13 +86,13 @@ bool KaldiSequenceTrainingDerivative<ElemType>::ComputeDerivative(
                      uttID.c_str(), (int) logLikelihood.GetNumCols(), (int) ali.size());
     }
 
-    // Reads denominator lattice.
     if (!m_denlatReader->HasKey(uttIDStr))
     {
         RuntimeError("Denominator lattice not found for utterance %S\n",
                      uttID.c_str());
     }
     kaldi::CompactLattice clat = m_denlatReader->Value(uttIDStr);
+    readerLock.unlock();
     fst::CreateSuperFinal(&clat); /* One final state with weight One() */
     kaldi::Lattice lat;
     fst::ConvertLattice(clat, &lat);
@@ -241,6 +242,7 @@ bool KaldiSequenceTrainingDerivative<ElemType>::HasResourceForDerivative(
     }
 
     std::string uttIDStr = msra::asr::toStr(uttID);
+    std::lock_guard<std::mutex> readerLock(m_readerLock);
     if (!m_aliReader->HasKey(uttIDStr) || !m_denlatReader->HasKey(uttIDStr))
     {
         return false;
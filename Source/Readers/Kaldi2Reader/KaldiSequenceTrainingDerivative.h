@@ -4,6 +4,7 @@
 #include "Matrix.h"
 #include "basetypes.h"
 #include "UtteranceDerivativeComputationInterface.h"
+#include <mutex>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -23,6 +24,10 @@ private:
     kaldi::RandomAccessCompactLatticeReader* m_denlatReader;
     kaldi::RandomAccessInt32VectorReader* m_aliReader;
 
+    // The Kaldi readers are not thread-safe; everything else in
+    // ComputeDerivative() can run for several utterances at the same time.
+    mutable std::mutex m_readerLock;
+
     // Rescores the lattice with the lastest posteriors from the neural network.
     void LatticeAcousticRescore(const wstring& uttID,
                                 const Matrix<ElemType>& outputs,
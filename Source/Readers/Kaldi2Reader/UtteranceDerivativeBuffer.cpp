@@ -8,7 +8,8 @@ namespace Microsoft { namespace MSR { namespace CNTK {
 template <class ElemType>
 UtteranceDerivativeBuffer<ElemType>::UtteranceDerivativeBuffer(
     size_t numberOfuttsPerMinibatch,
-    UtteranceDerivativeComputationInterface<ElemType>* derivativeInterface)
+    UtteranceDerivativeComputationInterface<ElemType>* derivativeInterface,
+    size_t numComputeThreads)
 {
     assert(derivativeInterface != NULL);
     m_derivativeInterface = derivativeInterface;
@@ -18,6 +19,56 @@ UtteranceDerivativeBuffer<ElemType>::UtteranceDerivativeBuffer(
     m_uttReady.assign(m_numUttsPerMinibatch, false);
     m_epochEnd = false;
     m_dimension = 0;
+    if (numComputeThreads > 0)
+    {
+        m_computeThreads.reset(new msra::dbn::iothreadpool(numComputeThreads));
+    }
+}
+
+template <class ElemType>
+void UtteranceDerivativeBuffer<ElemType>::ComputeDerivative(
+    const wstring& uttID,
+    UtteranceDerivativeUnit* uttUnit)
+{
+    if (!m_computeThreads)
+    {
+        m_derivativeInterface->ComputeDerivative(
+            uttID, uttUnit->logLikelihood,
+            &uttUnit->derivative, &uttUnit->objective);
+        return;
+    }
+
+    // The unit stays where it is in <m_uttPool> (elements of an unordered_map
+    // do not move), and is not erased before the job is done.
+    UtteranceDerivativeComputationInterface<ElemType>* derivativeInterface = m_derivativeInterface;
+    uttUnit->pendingDerivative = m_computeThreads->submit<bool>([derivativeInterface, uttID, uttUnit]()
+                                                                {
+                                                                    return derivativeInterface->ComputeDerivative(
+                                                                        uttID, uttUnit->logLikelihood,
+                                                                        &uttUnit->derivative, &uttUnit->objective);
+                                                                });
+}
+
+template <class ElemType>
+void UtteranceDerivativeBuffer<ElemType>::WaitForDerivative(
+    UtteranceDerivativeUnit* uttUnit)
+{
+    if (uttUnit->pendingDerivative.valid())
+    {
+        uttUnit->pendingDerivative.get();
+    }
+}
+
+template <class ElemType>
+void UtteranceDerivativeBuffer<ElemType>::WaitForAllDerivatives()
+{
+    for (auto iter = m_uttPool.begin(); iter != m_uttPool.end(); ++iter)
+    {
+        if (iter->second.pendingDerivative.valid())
+        {
+            iter->second.pendingDerivative.wait(); // (exceptions are of no interest anymore here)
+        }
+    }
 }
 
 template <class ElemType>
@@ -107,14 +158,13 @@ bool UtteranceDerivativeBuffer<ElemType>::SetLikelihood(
             wstring uttID = uttInfo[i][j].first;
             if (m_uttPool.find(uttID) == m_uttPool.end())
             {
-                UtteranceDerivativeUnit tmpUttUnit;
-                tmpUttUnit.hasDerivative = false;
-                tmpUttUnit.uttLength = uttInfo[i][j].second;
-                tmpUttUnit.progress = 0;
-                tmpUttUnit.streamID = i;
-                tmpUttUnit.logLikelihood.Resize(logLikelihood.GetNumRows(),
-                                                tmpUttUnit.uttLength);
-                m_uttPool[uttID] = tmpUttUnit;
+                UtteranceDerivativeUnit& newUttUnit = m_uttPool[uttID];
+                newUttUnit.hasDerivative = false;
+                newUttUnit.uttLength = uttInfo[i][j].second;
+                newUttUnit.progress = 0;
+                newUttUnit.streamID = i;
+                newUttUnit.logLikelihood.Resize(logLikelihood.GetNumRows(),
+                                                newUttUnit.uttLength);
             }
 
             // Sets the likelihood and computes derivatives.
@@ -138,11 +188,9 @@ bool UtteranceDerivativeBuffer<ElemType>::SetLikelihood(
                 m_uttPool[uttID].progress += numFrames;
                 if (m_uttPool[uttID].progress == m_uttPool[uttID].uttLength)
                 {
-                    m_derivativeInterface->ComputeDerivative(
-                        uttID,
-                        m_uttPool[uttID].logLikelihood,
-                        &m_uttPool[uttID].derivative,
-                        &m_uttPool[uttID].objective);
+                    // (with compute threads, "has derivative" means it is on
+                    // its way)
+                    ComputeDerivative(uttID, &m_uttPool[uttID]);
                     m_uttPool[uttID].hasDerivative = true;
                     m_uttPool[uttID].progress = 0;
                     m_uttReady[m_uttPool[uttID].streamID] = true;
@@ -161,6 +209,7 @@ bool UtteranceDerivativeBuffer<ElemType>::SetLikelihood(
             break;
         }
     }
+    return true;
 }
 
 // Suppose we have a, b, c 3 streams, the <derivativesOut> should be in the
@@ -199,6 +248,7 @@ bool UtteranceDerivativeBuffer<ElemType>::GetDerivative(
             }
 
             // Assign the derivatives.
+            WaitForDerivative(&m_uttPool[uttID]);
             assert(uttID == uttInfoInMinibatch[i][j].first);
             size_t startFrame = uttInfoInMinibatch[i][j].second.first;
             size_t startFrameInUtt = m_uttPool[uttID].progress;
@@ -307,6 +357,7 @@ bool UtteranceDerivativeBuffer<ElemType>::CompareUttInfo(
 template <class ElemType>
 void UtteranceDerivativeBuffer<ElemType>::ResetEpoch()
 {
+    WaitForAllDerivatives();
     m_needLikelihood = true;
     m_currentObj = 0;
     m_epochEnd = false;
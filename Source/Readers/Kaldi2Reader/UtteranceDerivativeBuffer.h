@@ -4,12 +4,20 @@
 #include "basetypes.h"
 #include "Sequences.h"
 #include "UtteranceDerivativeComputationInterface.h"
+#include "iothreadpool.h"
+#include <future>
+#include <memory>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
 // This class "gules" together the log-likelihood from different minibatches,
 // and then calls <UtteranceDerivativeComputationInterface> class to compute
 // the derivative for given utterance.
+// With compute threads, the derivative of a complete utterance is computed in
+// the background, while the network computes the log-likelihood of the next
+// minibatch; GetDerivative() waits for it. Each utterance has its own
+// log-likelihood and derivative buffer, which the main thread does not touch
+// until the computation is done.
 template <class ElemType>
 class UtteranceDerivativeBuffer
 {
@@ -23,6 +31,7 @@ private:
         Matrix<ElemType> logLikelihood;
         Matrix<ElemType> derivative;
         ElemType objective;
+        std::future<bool> pendingDerivative; // valid while computed in background
 
         UtteranceDerivativeUnit()
             : logLikelihood(CPUDEVICE), derivative(CPUDEVICE)
@@ -44,6 +53,19 @@ private:
     unordered_map<wstring, UtteranceDerivativeUnit> m_uttPool;
     UtteranceDerivativeComputationInterface<ElemType>* m_derivativeInterface;
 
+    // Declared after <m_uttPool> so that it is destroyed first: the running
+    // jobs write into the units.
+    std::unique_ptr<msra::dbn::iothreadpool> m_computeThreads;
+
+    void ComputeDerivative(const wstring& uttID,
+                           UtteranceDerivativeUnit* uttUnit);
+
+    // Waits for the background computation of the derivative, and passes on
+    // its exception, if any.
+    void WaitForDerivative(UtteranceDerivativeUnit* uttUnit);
+
+    void WaitForAllDerivatives();
+
     // <uttInfoInMinibatch> is a vector of vector of the following:
     //     uttID startFrameIndexInMinibatch numFrames
     void ProcessUttInfo(
@@ -58,14 +80,20 @@ private:
 
 public:
     // Constructor.
-    // Does not take ownership of <derivativeInterface>.
+    // Does not take ownership of <derivativeInterface>. If <numComputeThreads>
+    // is 0, derivatives are computed synchronously in SetLikelihood();
+    // otherwise <derivativeInterface> must allow concurrent
+    // ComputeDerivative() calls for different utterances.
     UtteranceDerivativeBuffer(
         size_t numberOfuttsPerMinibatch,
-        UtteranceDerivativeComputationInterface<ElemType>* derivativeInterface);
+        UtteranceDerivativeComputationInterface<ElemType>* derivativeInterface,
+        size_t numComputeThreads = 0);
 
     // Destructor.
     ~UtteranceDerivativeBuffer()
     {
+        // Lets the running jobs finish before the units go away.
+        m_computeThreads.reset();
     }
 
     bool NeedLikelihoodToComputeDerivative() const
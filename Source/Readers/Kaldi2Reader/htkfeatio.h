@@ -22,6 +22,7 @@
 //#include <iostream>
 
 #include "htkfeatio_utils.h"
+#include "kaldiarkreader.h"
 #include "kaldi.h"
 
 namespace msra { namespace asr {
@@ -34,7 +35,8 @@ public:
     string feature_transform;
 
 private:
-    kaldi::RandomAccessBaseFloatMatrixReader *feature_reader;
+    kaldi::RandomAccessBaseFloatMatrixReader *feature_reader; // NULL if arkreader is used
+    kaldiarkreader arkreader;                                 // for scripts of binary arks without feature transform
     kaldi::nnet1::Nnet nnet_transf;
     kaldi::CuMatrix<kaldi::BaseFloat> feats_transf;
     kaldi::Matrix<kaldi::BaseFloat> buf;
@@ -46,21 +48,30 @@ public:
         this->rx = trimmed(fileToStr(toStr(rx_file)));
         this->feature_transform = toStr(feature_transform);
 
-        feature_reader = new kaldi::RandomAccessBaseFloatMatrixReader(rx);
-
-        // std::wcout << "Kaldi2Reader: created feature reader " << feature_reader << " [" << rx.c_str() << "]" << std::endl;
-
         if (this->feature_transform == "NO_FEATURE_TRANSFORM")
         {
             this->feature_transform = "";
         }
 
+        // read binary arks ourselves if we can, otherwise through Kaldi
+        feature_reader = NULL;
+        if (!this->feature_transform.empty() || !arkreader.open(rx))
+            feature_reader = new kaldi::RandomAccessBaseFloatMatrixReader(rx);
+
+        // std::wcout << "Kaldi2Reader: created feature reader " << feature_reader << " [" << rx.c_str() << "]" << std::endl;
+
         if (!this->feature_transform.empty())
         {
             nnet_transf.Read(this->feature_transform);
         }
     }
 
+    // the native reader, or NULL if read() must be used
+    kaldiarkreader *nativereader()
+    {
+        return feature_reader ? NULL : &arkreader;
+    }
+
     kaldi::Matrix<kaldi::BaseFloat> &read(wstring wkey)
     {
         string key = toStr(wkey);
@@ -331,6 +342,12 @@ public:
 
     void getinfo(const parsedpath &ppath, size_t &featdim)
     {
+        if (kaldiarkreader *arkreader = ppath.featuresection->nativereader())
+        {
+            size_t numrows;
+            arkreader->locate(toStr(ppath), numrows, featdim);
+            return;
+        }
         kaldi::Matrix<kaldi::BaseFloat> &kaldifeat = ppath.featuresection->read(ppath);
         featdim = kaldifeat.NumCols();
     }
@@ -346,6 +363,16 @@ public:
         // read vectors from file and push to our target structure
         try
         {
+            if (kaldiarkreader *arkreader = ppath.featuresection->nativereader()) // decode straight into 'feat'
+            {
+                size_t numrows, featdim;
+                arkreader->locate(toStr(ppath), numrows, featdim);
+                if (feat.cols() != numframes || feat.rows() != featdim || numrows != numframes)
+                    throw std::logic_error("read: stripe read called with wrong dimensions");
+                arkreader->readdata(feat);
+                return;
+            }
+
             kaldi::Matrix<kaldi::BaseFloat> &kaldifeat = ppath.featuresection->read(ppath);
             size_t featdim = kaldifeat.NumCols();
 
@@ -383,6 +410,17 @@ public:
         // read vectors from file and push to our target structure
         try
         {
+            if (kaldiarkreader *arkreader = ppath.featuresection->nativereader()) // decode straight into 'feat'
+            {
+                size_t numrows, featdim;
+                arkreader->locate(toStr(ppath), numrows, featdim);
+                if (numrows != numframes)
+                    throw std::logic_error("read: number of frames in archive does not match the script");
+                feat.resize(featdim, numframes); // result matrix--columns are features
+                arkreader->readdata(feat);
+                return;
+            }
+
             kaldi::Matrix<kaldi::BaseFloat> &kaldifeat = ppath.featuresection->read(ppath);
             size_t featdim = kaldifeat.NumCols();
 
@@ -0,0 +1,304 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// kaldiarkreader.h -- reads Kaldi binary feature matrices (incl. compressed ones) from ark files, straight into CNTK matrices
+//
+
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace msra { namespace asr {
+
+// ---------------------------------------------------------------------------
+// kaldiarkreader -- random access to the matrices listed in a Kaldi script ('scp:') of 'arkfile:offset' entries
+//
+// This does what kaldi::RandomAccessBaseFloatMatrixReader does for such scripts, but decodes the binary
+// matrices (FM, DM, and the compressed CM, CM2, CM3) directly into the caller's matrix, with one column per
+// Kaldi row (i.e. frame), without creating a kaldi::Matrix for each utterance. The only buffer it uses is
+// kept across utterances. Anything else (pipes, text archives, row ranges, options the script
+// cannot be used without) is left to Kaldi's reader: open() returns false for those.
+// ---------------------------------------------------------------------------
+
+class kaldiarkreader
+{
+    struct location
+    {
+        size_t file;     // index into arkpaths
+        uint64_t offset; // of the binary marker ("\0B") of the matrix in that file
+    };
+    std::vector<std::string> arkpaths;
+    std::unordered_map<std::string, location> locations; // [utterance key]
+
+    // the ark file currently open (utterances are mostly read in chunks from the same file)
+    size_t currentfile;
+    auto_file_ptr f;
+
+    // the matrix found by the last locate()
+    enum format
+    {
+        floatmatrix,              // FM: float [rows][cols]
+        doublematrix,             // DM: double [rows][cols]
+        compressedwithcolheaders, // CM: per column 4 uint16 percentiles, then uint8 [cols][rows]
+        compressed16,             // CM2: uint16 [rows][cols]
+        compressed8               // CM3: uint8 [rows][cols]
+    } currentformat;
+    size_t currentrows, currentcols;
+    float currentmin, currentrange; // global header of compressed matrices
+    std::string currentkey;
+
+    std::vector<char> buffer; // raw data of the current matrix, reused across utterances
+
+    void fail(const char *msg) const
+    {
+        RuntimeError("kaldiarkreader: %s for %s in %s", msg, currentkey.c_str(), arkpaths[currentfile].c_str());
+    }
+
+    // Kaldi's binary basic types are preceded by their size
+    int32_t readint32()
+    {
+        if (fgetc(f) != sizeof(int32_t))
+            fail("malformed matrix dimensions");
+        int32_t value;
+        freadOrDie(&value, sizeof(value), 1, f);
+        return value;
+    }
+
+    bool clear() // (returns false for open())
+    {
+        arkpaths.clear();
+        locations.clear();
+        return false;
+    }
+
+    void readdatabytes(size_t bytes)
+    {
+        if (buffer.size() < bytes)
+            buffer.resize(bytes);
+        if (bytes > 0)
+            freadOrDie(buffer.data(), 1, bytes, f);
+    }
+
+    // decoding of compressed matrices, as in Kaldi's compressed-matrix.cc
+    float uint16tofloat(uint16_t value) const
+    {
+        return currentmin + currentrange * 1.52590218966964e-05f * value;
+    }
+    static float chartofloat(float p0, float p25, float p75, float p100, uint8_t value)
+    {
+        if (value <= 64)
+            return p0 + (p25 - p0) * value * (1 / 64.0f);
+        else if (value <= 192)
+            return p25 + (p75 - p25) * (value - 64) * (1 / 128.0f);
+        else
+            return p75 + (p100 - p75) * (value - 192) * (1 / 63.0f);
+    }
+
+public:
+    kaldiarkreader()
+        : currentfile(SIZE_MAX), currentrows(0), currentcols(0)
+    {
+    }
+
+    // Parse an rspecifier such as 'scp:feats.scp'. Returns false if it is anything but a script (without the
+    // 'p' option) of binary ark locations, in which case the caller should use Kaldi's own reader.
+    bool open(const std::string &rspecifier)
+    {
+        const size_t colon = rspecifier.find(':');
+        if (colon == std::string::npos)
+            return false;
+        const std::vector<std::string> options = msra::strfun::split(rspecifier.substr(0, colon), ",");
+        if (options.empty() || options[0] != "scp")
+            return false;
+        for (size_t k = 1; k < options.size(); k++)
+        {
+            if (options[k] == "p") // (permissive: missing files are not errors)
+                return false;
+        }
+        const std::string scriptpath = rspecifier.substr(colon + 1);
+        if (scriptpath.empty() || scriptpath == "-" || scriptpath.back() == '|')
+            return false;
+
+        std::unordered_map<std::string, size_t> fileindex;
+        for (msra::files::textreader reader(msra::strfun::utf16(scriptpath)); reader;)
+        {
+            const std::string line = reader.getline();
+            const size_t keyend = line.find_first_of(" \t");
+            if (keyend == std::string::npos)
+            {
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue; // empty line
+                return clear();
+            }
+            const std::string key = line.substr(0, keyend);
+            const size_t begin = line.find_first_not_of(" \t", keyend);
+            const size_t end = line.find_last_not_of(" \t\r") + 1;
+            const std::string rxfilename = line.substr(begin, end - begin);
+            // we can only do 'path:offset'; row ranges ('...[0:10]') and pipes are Kaldi's
+            const size_t offsetcolon = rxfilename.rfind(':');
+            if (offsetcolon == std::string::npos || offsetcolon == 0 || offsetcolon + 1 == rxfilename.size() ||
+                rxfilename.find_first_not_of("0123456789", offsetcolon + 1) != std::string::npos || rxfilename.back() == '|')
+                return clear();
+            const std::string arkpath = rxfilename.substr(0, offsetcolon);
+            auto iter = fileindex.find(arkpath);
+            if (iter == fileindex.end())
+            {
+                iter = fileindex.insert(std::make_pair(arkpath, arkpaths.size())).first;
+                arkpaths.push_back(arkpath);
+            }
+            location loc;
+            loc.file = iter->second;
+            loc.offset = strtoull(rxfilename.c_str() + offsetcolon + 1, nullptr, 10);
+            locations[key] = loc;
+        }
+        fprintf(stderr, "kaldiarkreader: %d utterances in %d ark files from %s\n", (int) locations.size(), (int) arkpaths.size(), scriptpath.c_str());
+        return true;
+    }
+
+    // find an utterance's matrix and read its header; afterwards, readdata() reads the matrix itself
+    void locate(const std::string &key, size_t &numrows, size_t &numcols)
+    {
+        auto iter = locations.find(key);
+        if (iter == locations.end())
+            RuntimeError("Missing features for: %s", key.c_str());
+        const location &loc = iter->second;
+        currentkey = key;
+        if (loc.file != currentfile)
+        {
+            f = fopenOrDie(arkpaths[loc.file], "rb");
+            currentfile = loc.file;
+        }
+        fsetpos(f, loc.offset);
+
+        char marker[2];
+        freadOrDie(marker, 1, 2, f);
+        if (marker[0] != 0 || marker[1] != 'B')
+            fail("not a binary matrix");
+        char token[4] = {0};
+        size_t len = 0;
+        for (int c = fgetc(f); c != ' '; c = fgetc(f))
+        {
+            if (c == EOF || len + 1 >= sizeof(token))
+                fail("malformed matrix token");
+            token[len++] = (char) c;
+        }
+        if (strcmp(token, "FM") == 0 || strcmp(token, "DM") == 0)
+        {
+            currentformat = (token[0] == 'F') ? floatmatrix : doublematrix;
+            const int32_t rows = readint32();
+            const int32_t cols = readint32();
+            if (rows < 0 || cols < 0)
+                fail("negative matrix dimensions");
+            currentrows = rows;
+            currentcols = cols;
+        }
+        else if (strcmp(token, "CM") == 0 || strcmp(token, "CM2") == 0 || strcmp(token, "CM3") == 0)
+        {
+            currentformat = (token[2] == 0) ? compressedwithcolheaders : (token[2] == '2') ? compressed16 : compressed8;
+            struct
+            {
+                float minvalue;
+                float range;
+                int32_t numrows;
+                int32_t numcols;
+            } header; // (Kaldi's GlobalHeader without its format field)
+            freadOrDie(&header, sizeof(header), 1, f);
+            if (header.numrows < 0 || header.numcols < 0)
+                fail("negative matrix dimensions");
+            currentmin = header.minvalue;
+            currentrange = header.range;
+            currentrows = header.numrows;
+            currentcols = header.numcols;
+        }
+        else
+            fail("unsupported matrix type (only FM, DM, CM, CM2, and CM3 are supported)");
+        numrows = currentrows;
+        numcols = currentcols;
+    }
+
+    // read the matrix found by the last locate() into 'feat', which must have one column per Kaldi row (i.e. be [numcols x numrows])
+    // MATRIX needs operator(i,j) and contiguous columns.
+    template <class MATRIX>
+    void readdata(MATRIX &feat)
+    {
+        if (feat.rows() != currentcols || feat.cols() != currentrows)
+            LogicError("kaldiarkreader::readdata: matrix of %s (%d x %d) read into a matrix of wrong dimensions %d x %d",
+                       currentkey.c_str(), (int) currentcols, (int) currentrows, (int) feat.rows(), (int) feat.cols());
+        const size_t numrows = currentrows;
+        const size_t numcols = currentcols;
+        switch (currentformat)
+        {
+        case floatmatrix:
+        {
+            readdatabytes(numrows * numcols * sizeof(float));
+            const float *src = (const float *) buffer.data();
+            for (size_t r = 0; r < numrows; r++, src += numcols)
+                std::copy(src, src + numcols, &feat(0, r));
+            break;
+        }
+        case doublematrix:
+        {
+            readdatabytes(numrows * numcols * sizeof(double));
+            const double *src = (const double *) buffer.data();
+            for (size_t r = 0; r < numrows; r++)
+                for (size_t c = 0; c < numcols; c++)
+                    feat(c, r) = (float) *src++;
+            break;
+        }
+        case compressedwithcolheaders:
+        {
+            struct percolheader
+            {
+                uint16_t percentile0, percentile25, percentile75, percentile100;
+            };
+            readdatabytes(numcols * sizeof(percolheader) + numrows * numcols);
+            const percolheader *colheaders = (const percolheader *) buffer.data();
+            const uint8_t *src = (const uint8_t *) (colheaders + numcols); // [cols][rows]
+            for (size_t c = 0; c < numcols; c++)
+            {
+                const float p0 = uint16tofloat(colheaders[c].percentile0);
+                const float p25 = uint16tofloat(colheaders[c].percentile25);
+                const float p75 = uint16tofloat(colheaders[c].percentile75);
+                const float p100 = uint16tofloat(colheaders[c].percentile100);
+                for (size_t r = 0; r < numrows; r++)
+                    feat(c, r) = chartofloat(p0, p25, p75, p100, *src++);
+            }
+            break;
+        }
+        case compressed16:
+        {
+            readdatabytes(numrows * numcols * sizeof(uint16_t));
+            const uint16_t *src = (const uint16_t *) buffer.data();
+            const float increment = currentrange * (1.0f / 65535.0f);
+            for (size_t r = 0; r < numrows; r++)
+            {
+                float *dst = &feat(0, r);
+                for (size_t c = 0; c < numcols; c++)
+                    dst[c] = currentmin + *src++ * increment;
+            }
+            break;
+        }
+        case compressed8:
+        {
+            readdatabytes(numrows * numcols);
+            const uint8_t *src = (const uint8_t *) buffer.data();
+            const float increment = currentrange * (1.0f / 255.0f);
+            for (size_t r = 0; r < numrows; r++)
+            {
+                float *dst = &feat(0, r);
+                for (size_t c = 0; c < numcols; c++)
+                    dst[c] = currentmin + *src++ * increment;
+            }
+            break;
+        }
+        }
+    }
+};
+} }
@@ -91,7 +91,7 @@ static size_t tryfind(const MAPTYPE &map, const KEYTYPE &key, VALTYPE deflt)
 /*static*/ void archive::build(const std::vector<std::wstring> &infiles, const std::wstring &outpath,
                                const std::unordered_map<std::string, size_t> &modelsymmap,
                                const msra::asr::htkmlfreader<msra::asr::htkmlfentry, msra::lattices::lattice::htkmlfwordsequence> &labels, // non-empty: build numer lattices
-                               const msra::lm::CMGramLM &unigram, const msra::lm::CSymbolSet &unigramsymbols)                              // for numer lattices
+                               const msra::lm::ILM &unigram, const msra::lm::CSymbolSet &unigramsymbols)                              // for numer lattices
 {
 #if 0 // little unit test helper for testing the read function
     bool test = true;
@@ -417,7 +417,7 @@ void lattice::dedup()
 //  - empty ("") -> don't output, just check the format
 //  - dash ("-") -> dump lattice to stdout instead
 /*static*/ void archive::convert(const std::wstring &intocpath, const std::wstring &intocpath2, const std::wstring &outpath,
-                                 const msra::asr::simplesenonehmm &hset)
+                                 const msra::asr::simplesenonehmm &hset, bool compressed)
 {
     const auto &modelsymmap = hset.getsymmap();
 
@@ -504,7 +504,7 @@ void lattice::dedup()
         {
             // write to archive
             uint64_t offset = fgetpos(f);
-            L.fwrite(f);
+            L.fwrite(f, compressed);
             fflushOrDie(f);
 
             // write reference to TOC file   --note: TOC file is a headerless UTF8 file; so don't use fprintf %S format (default code page)
@@ -666,7 +666,7 @@ void lattice::fromhtklattice(const wstring &path, const std::unordered_map<std::
 // The lattice is expected to be freshly constructed (I did not bother to check).
 void lattice::frommlf(const wstring &key, const std::unordered_map<std::string, size_t> &unitmap,
                       const msra::asr::htkmlfreader<msra::asr::htkmlfentry, lattice::htkmlfwordsequence> &labels,
-                      const msra::lm::CMGramLM &unigram, const msra::lm::CSymbolSet &unigramsymbols)
+                      const msra::lm::ILM &unigram, const msra::lm::CSymbolSet &unigramsymbols)
 {
     const auto &transcripts = labels.allwordtranscripts(); // (TODO: we could just pass the transcripts map--does not really matter)
 
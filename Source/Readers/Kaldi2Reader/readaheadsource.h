@@ -10,9 +10,7 @@
 #include "basetypes.h"
 #include "minibatchiterator.h"
 #include "latticearchive.h"
-#ifdef _WIN32
 #include "simplethread.h"
-#endif
 #include <deque>
 #include <stdexcept>
 
@@ -34,8 +32,9 @@ class minibatchreadaheadsource : public minibatchsource /*the interface we imple
     {
         size_t globalts; // time for which we get the data
         // return values
-        msra::dbn::matrix feat;
-        std::vector<size_t> uids;
+        std::vector<msra::dbn::matrix> feat;
+        std::vector<std::vector<size_t>> uids;
+        std::vector<std::pair<wstring, size_t>> utteranceinfo;
         std::vector<const_array_ref<msra::lattices::lattice::htkmlfwordsequence::word>> transcripts;
         std::vector<shared_ptr<const latticesource::latticepair>> lattices;
         batchdata(size_t globalts)
@@ -136,15 +135,15 @@ class minibatchreadaheadsource : public minibatchsource /*the interface we imple
                     // get batch and append to FIFO (outside the lock)
                     batchdata batch(globalts);
                     const size_t requestedframes = min(epochreqframes, epochendframe - globalts); // we must not request beyond the epoch
-                    readfromdisk = source.getbatch(globalts, requestedframes, batch.feat, batch.uids, batch.transcripts, batch.lattices);
+                    readfromdisk = source.getbatch(globalts, requestedframes, batch.feat, batch.uids, batch.utteranceinfo, batch.transcripts, batch.lattices);
                     batchesread++;
                     // Note: We may still get data beyond the end of the epoch, in utterance mode, since the epoch boundary likely falls within an utterance.
                     CAutoLock lock(*this);
-                    if (!fifo.empty() && globalts != fifo.back().globalts + fifo.back().feat.cols())
+                    if (!fifo.empty() && globalts != fifo.back().globalts + fifo.back().feat[0].cols())
                         throw std::logic_error("minibatchreadaheadsource: FIFO got out of order while pre-reading new batch");
                     if (newglobalts != SIZE_MAX)
                         throw std::logic_error("minibatchreadaheadsource: main thread reset to new epoch while current epoch not yet finished");
-                    globalts += batch.feat.cols();
+                    globalts += batch.feat[0].cols();
                     fifo.push_back(std::move(batch));
                     flagthreadchanged(); // signal state change so caller can pick up the new batch
                 }
@@ -190,7 +189,8 @@ public:
         verbosity = newverbosity;
     }
     bool getbatch(const size_t globalts,
-                  const size_t framesrequested, msra::dbn::matrix& feat, std::vector<size_t>& uids,
+                  const size_t framesrequested, std::vector<msra::dbn::matrix>& feat, std::vector<std::vector<size_t>>& uids,
+                  std::vector<std::pair<wstring, size_t>>& utteranceinfo,
                   std::vector<const_array_ref<msra::lattices::lattice::htkmlfwordsequence::word>>& transcripts,
                   std::vector<shared_ptr<const latticesource::latticepair>>& lattices)
     {
@@ -232,6 +232,7 @@ public:
                     // return it
                     feat = std::move(front.feat);
                     uids = std::move(front.uids);
+                    utteranceinfo = std::move(front.utteranceinfo);
                     transcripts = std::move(front.transcripts);
                     lattices = std::move(front.lattices);
                     return readfromdisk;
@@ -242,20 +243,21 @@ public:
             readfromdisk = true; // we had to wait --use to indicate that we needed to read data (does not really matter...)
         }
 #else
-        return source.getbatch(globalts, framesrequested, feat, uids, transcripts, lattices);
+        return source.getbatch(globalts, framesrequested, feat, uids, utteranceinfo, transcripts, lattices);
 #endif
     }
     bool getbatch(const size_t globalts,
-                  const size_t framesrequested, std::vector<msra::dbn::matrix>& feat, std::vector<std::vector<size_t>>& uids,
+                  const size_t framesrequested, msra::dbn::matrix& feat, std::vector<size_t>& uids,
+                  std::vector<std::pair<wstring, size_t>>& utteranceinfo,
                   std::vector<const_array_ref<msra::lattices::lattice::htkmlfwordsequence::word>>& transcripts,
                   std::vector<shared_ptr<const latticesource::latticepair>>& lattices)
     {
-
-        feat.resize(1);
-        uids.resize(1);
-        // transcripts.resize(1);
-        // lattices.resize(1);
-        return getbatch(globalts, framesrequested, feat[0], uids[0], transcripts, lattices);
+        std::vector<msra::dbn::matrix> featmulti;
+        std::vector<std::vector<size_t>> uidsmulti;
+        const bool readfromdisk = getbatch(globalts, framesrequested, featmulti, uidsmulti, utteranceinfo, transcripts, lattices);
+        feat = std::move(featmulti[0]);
+        uids = std::move(uidsmulti[0]);
+        return readfromdisk;
     }
 
     size_t totalframes() const
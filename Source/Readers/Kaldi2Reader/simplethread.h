@@ -10,10 +10,17 @@
 #include "basetypes.h"
 #ifdef _WIN32
 #include <process.h> // for _beginthread()
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <limits.h>
 #endif
 
 namespace msra { namespace util {
 
+#ifdef _WIN32
+
 // ---------------------------------------------------------------------------
 // signallingevent  -- wrapper around Windows events
 // ---------------------------------------------------------------------------
@@ -169,5 +176,131 @@ public:
         ::CloseHandle(threadhandle);
     }
 };
+#else // the same on top of the C++11 thread library
+
+// ---------------------------------------------------------------------------
+// signallingevent  -- auto-reset event: wait() blocks until flagged, and clears the flag
+// ---------------------------------------------------------------------------
+class signallingevent
+{
+    std::mutex mutex;
+    std::condition_variable flaggedcondition;
+    bool flagged;
+
+public:
+    signallingevent(bool initialstate = true)
+        : flagged(initialstate)
+    {
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        flaggedcondition.wait(lock, [this]()
+                              {
+                                  return flagged;
+                              });
+        flagged = false;
+    }
+    void flag()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            flagged = true;
+        }
+        flaggedcondition.notify_one();
+    }
+};
+
+// ---------------------------------------------------------------------------
+// simplethread  -- simple thread wrapper
+// ---------------------------------------------------------------------------
+class simplethread : CCritSec
+{
+    std::shared_ptr<std::runtime_error> badallocexceptionptr; // in case we fail to copy the exception
+    std::shared_ptr<std::runtime_error> exceptionptr;         // if non-NULL, then thread failed with exception (thrown as runtime_error, which keeps the message)
+    std::mutex finishedmutex;
+    std::condition_variable finishedcondition;
+    bool finished; // thread proc has returned
+    std::thread thread;
+    template <typename FUNCTION>
+    void threadproc(const FUNCTION &body)
+    {
+        try
+        {
+            body(); // execute the function
+        }
+        catch (const std::exception &e)
+        {
+            fail(e);
+        }
+        catch (...) // we do not catch anything that is not based on std::exception
+        {
+            fprintf(stderr, "simplethread: thread proc failed with unexpected unknown exception, which is not allowed. Terminating\n");
+            fflush(stderr); // (needed?)
+            abort();        // should never happen
+        }
+        {
+            std::lock_guard<std::mutex> lock(finishedmutex);
+            finished = true;
+        }
+        finishedcondition.notify_all();
+    }
+
+public:
+    template <typename FUNCTION>
+    simplethread(const FUNCTION &body)
+        : badallocexceptionptr(new std::runtime_error("simplethread: out of memory")), finished(false)
+    {
+        thread = std::thread([this, body]()
+                             {
+                                 threadproc(body);
+                             });
+    }
+    // check if the thread is still alive and without error
+    void check()
+    {
+        CAutoLock lock(*this);
+        // pass on a pending exception
+        if (exceptionptr)
+            throw * exceptionptr.get();
+        // the thread going away without error is also unexpected at this point
+        if (wait(0)) // (0 means don't block, so OK to call inside lock)
+            throw std::runtime_error("check: thread terminated unexpectedly");
+    }
+    bool wait(unsigned int milliseconds = UINT_MAX)
+    {
+        std::unique_lock<std::mutex> lock(finishedmutex);
+        auto isfinished = [this]()
+        {
+            return finished;
+        };
+        if (milliseconds == UINT_MAX)
+        {
+            finishedcondition.wait(lock, isfinished);
+            return true;
+        }
+        return finishedcondition.wait_for(lock, std::chrono::milliseconds(milliseconds), isfinished);
+    }
+    // thread itself can set the failure condition, e.g. before it signals some other thread to pick it up
+    void fail(const std::exception &e)
+    {
+        // exception: remember it  --this will remove the type info :(
+        CAutoLock lock(*this);
+        try // copy the exception--this may fail if we are out of memory
+        {
+            exceptionptr.reset(new std::runtime_error(e.what()));
+        }
+        catch (...) // failed to alloc: fall back to bad_alloc, which is most likely the cause in such situation
+        {
+            exceptionptr = badallocexceptionptr;
+        }
+    }
+    ~simplethread() throw()
+    {
+        // wait until it shuts down
+        thread.join();
+    }
+};
+#endif
 };
 };
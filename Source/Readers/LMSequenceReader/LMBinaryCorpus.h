@@ -0,0 +1,154 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// LMBinaryCorpus.h -- pre-tokenized language-model corpus: word and class IDs with a sentence index, read through a memory mapping
+//
+#pragma once
+
+#include "Basics.h"
+#include "fileutil.h"
+#include "mappedfile.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// LMBinaryCorpus -- a text corpus compiled once into the IDs the reader would look up for it
+// File layout (all little endian, every array 8-byte aligned):
+//   char magic[8] "CNTKLMB1"
+//   int64 numSentences, numTokens, vocabulary dimension (to detect a changed vocabulary)
+//   Token tokens[numTokens]                 word ID and class ID (-1 if none) of each token, sentences back to back
+//   int64 sentenceBegins[numSentences + 1]  index of the first token of each sentence, and numTokens
+// -----------------------------------------------------------------------
+
+class LMBinaryCorpus
+{
+public:
+    struct Token
+    {
+        int32_t wordId;
+        int32_t classId;
+    };
+
+private:
+    struct Header
+    {
+        char magic[8];
+        int64_t numSentences;
+        int64_t numTokens;
+        int64_t vocabularyDim;
+    };
+    static const char* Magic()
+    {
+        return "CNTKLMB1";
+    }
+
+    std::unique_ptr<msra::files::mappedfile> m_file;
+    const Token* m_tokens;
+    const char* m_sentenceBegins; // int64 each
+    size_t m_numSentences;
+    size_t m_numTokens;
+
+public:
+    LMBinaryCorpus()
+        : m_tokens(nullptr), m_sentenceBegins(nullptr), m_numSentences(0), m_numTokens(0)
+    {
+    }
+
+    // Open - map a compiled corpus
+    // returns - false if the file is not a corpus for this vocabulary dimension, e.g. written by an older version
+    bool Open(const std::wstring& path, size_t vocabularyDim)
+    {
+        m_file.reset(new msra::files::mappedfile(path));
+        Header header;
+        if (m_file->size() < sizeof(header))
+            return false;
+        memcpy(&header, m_file->data(), sizeof(header));
+        if (memcmp(header.magic, Magic(), sizeof(header.magic)) || header.vocabularyDim != (int64_t) vocabularyDim || header.numSentences < 0 || header.numTokens < 0)
+            return false;
+        m_numSentences = (size_t) header.numSentences;
+        m_numTokens = (size_t) header.numTokens;
+        if (m_file->size() != sizeof(header) + sizeof(Token) * m_numTokens + sizeof(int64_t) * (m_numSentences + 1))
+            return false; // (e.g. an interrupted compile)
+        m_tokens = (const Token*) (m_file->data() + sizeof(header));
+        m_sentenceBegins = (const char*) (m_tokens + m_numTokens);
+        return true;
+    }
+
+    size_t NumSentences() const
+    {
+        return m_numSentences;
+    }
+    size_t NumTokens() const
+    {
+        return m_numTokens;
+    }
+    size_t SentenceBegin(size_t sentence) const
+    {
+        int64_t begin;
+        memcpy(&begin, m_sentenceBegins + sentence * sizeof(int64_t), sizeof(begin));
+        return (size_t) begin;
+    }
+    const Token& operator[](size_t token) const
+    {
+        return m_tokens[token];
+    }
+
+    // -----------------------------------------------------------------------
+    // Writer -- streams sentences into a new corpus file; the file only appears under its name once complete
+    // -----------------------------------------------------------------------
+
+    class Writer
+    {
+        std::wstring m_path;
+        std::wstring m_tmpPath;
+        FILE* m_f;
+        Header m_header;
+        std::vector<int64_t> m_sentenceBegins;
+
+    public:
+        Writer(const std::wstring& path, size_t vocabularyDim)
+            : m_path(path), m_tmpPath(path + L".tmp")
+        {
+            memcpy(m_header.magic, Magic(), sizeof(m_header.magic));
+            m_header.numSentences = 0;
+            m_header.numTokens = 0;
+            m_header.vocabularyDim = (int64_t) vocabularyDim;
+            m_f = fopenOrDie(m_tmpPath, L"wb");
+            fwriteOrDie(&m_header, sizeof(m_header), 1, m_f); // (placeholder, rewritten by Close())
+            m_sentenceBegins.push_back(0);
+        }
+        ~Writer()
+        {
+            if (m_f) // not closed: drop the partial file
+            {
+                fclose(m_f);
+                _wunlink(m_tmpPath.c_str());
+            }
+        }
+
+        void AddSentence(const std::vector<Token>& tokens)
+        {
+            fwriteOrDie(tokens, m_f);
+            m_header.numTokens += tokens.size();
+            m_header.numSentences++;
+            m_sentenceBegins.push_back(m_header.numTokens);
+        }
+
+        void Close()
+        {
+            fwriteOrDie(m_sentenceBegins, m_f);
+            fseekOrDie(m_f, 0, SEEK_SET);
+            fwriteOrDie(&m_header, sizeof(m_header), 1, m_f);
+            fcloseOrDie(m_f);
+            m_f = nullptr;
+            if (fexists(m_path))
+                unlinkOrDie(m_path);
+            renameOrDie(m_tmpPath, m_path);
+        }
+    };
+};
+} } }
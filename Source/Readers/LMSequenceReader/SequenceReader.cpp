@@ -1011,6 +1011,14 @@ void SequenceReader<ElemType>::GetLabelOutput(std::map<std::wstring, Matrix<Elem
     else if (readerMode == ReaderMode::Softmax)
         labels->Resize(1, actualmbsize);
 
+    // all noise words of the minibatch in one draw
+    std::vector<int> noiseWords;
+    if (readerMode == ReaderMode::NCE)
+    {
+        noiseWords.resize(actualmbsize * this->noise_sample_size);
+        m_noiseSampler.sample(noiseWords.size(), noiseWords.data());
+    }
+
     for (size_t jSample = m_mbStartSample; j < actualmbsize; ++j, ++jSample)
     {
         // pick the right sample with randomization if desired
@@ -1023,7 +1031,7 @@ void SequenceReader<ElemType>::GetLabelOutput(std::map<std::wstring, Matrix<Elem
             labels->SetValue(1, j, (ElemType) m_noiseSampler.logprob(wrd));
             for (size_t noiseid = 0; noiseid < this->noise_sample_size; noiseid++)
             {
-                int wid = m_noiseSampler.sample();
+                int wid = noiseWords[j * this->noise_sample_size + noiseid];
                 labels->SetValue(2 * (noiseid + 1), j, (ElemType) wid);
                 labels->SetValue(2 * (noiseid + 1) + 1, j, -(ElemType) m_noiseSampler.logprob(wid));
             }
@@ -1551,7 +1559,7 @@ void BatchSequenceReader<ElemType>::InitFromConfig(const ConfigRecordType& reade
     //    m_featureCount = m_featureDim + m_labelInfo[labelInfoIn].dim;
     m_featureCount = 1;
 
-    std::wstring m_file = readerConfig(L"file", L"");
+    m_file = (wstring) readerConfig(L"file", L"");
     if (m_traceLevel > 0)
     {
         fwprintf(stderr, L"reading sequence file %s\n", m_file.c_str());
@@ -1563,6 +1571,80 @@ void BatchSequenceReader<ElemType>::InitFromConfig(const ConfigRecordType& reade
     m_parser.ParseInit(m_file.c_str(), m_featureDim, labelIn.dim, labelOut.dim, labelIn.beginSequence, labelIn.endSequence, labelOut.beginSequence, labelOut.endSequence);
 
     mRequestedNumParallelSequences = readerConfig(L"nbruttsineachrecurrentiter", (size_t) 1);
+
+    // binaryCorpus=path: compile the text into word and class IDs once (again when the text is newer), and read those in every epoch
+    std::wstring binaryCorpus = readerConfig(L"binaryCorpus", L"");
+    m_useCorpus = !binaryCorpus.empty();
+    if (m_useCorpus)
+    {
+        if (labelIn.type != labelCategory || labelOut.type != labelNextWord)
+            InvalidArgument("BatchSequenceReader: binaryCorpus requires a Category input label and a NextWord output label");
+        if (!msra::files::fuptodate(binaryCorpus, m_file, false /*the text may be gone*/) || !m_corpus.Open(binaryCorpus, labelIn.dim))
+        {
+            CompileCorpus(binaryCorpus);
+            if (!m_corpus.Open(binaryCorpus, labelIn.dim))
+                RuntimeError("BatchSequenceReader: %ls is not a valid corpus after compiling it", binaryCorpus.c_str());
+        }
+        if (m_traceLevel > 0)
+            fprintf(stderr, "BatchSequenceReader: using %ls, %d sentences, %llu tokens\n", binaryCorpus.c_str(), (int) m_corpus.NumSentences(), (unsigned long long) m_corpus.NumTokens());
+    }
+}
+
+// CompileCorpus - parse the whole text file and write the IDs of its words as a corpus file
+// The IDs are those EnsureDataAvailable() would look up: input label IDs, with the class of each word if there is a word class file.
+template <class ElemType>
+void BatchSequenceReader<ElemType>::CompileCorpus(const std::wstring& path)
+{
+    LabelInfo& labelIn = m_labelInfo[labelInfoIn];
+    fprintf(stderr, "BatchSequenceReader: compiling %ls into %ls\n", m_file.c_str(), path.c_str());
+
+    LMBinaryCorpus::Writer writer(path, labelIn.dim);
+    std::vector<SequencePosition> seqPos;
+    std::vector<LMBinaryCorpus::Token> tokens;
+    m_parser.ParseReset();
+    for (;;)
+    {
+        Reset();
+        seqPos.clear();
+        long numRead = m_parser.Parse(CACHE_BLOG_SIZE, &m_labelTemp, &m_featureTemp, &seqPos);
+        if (numRead == 0)
+            break;
+        for (const auto& sentence : m_parser.mSentenceIndex2SentenceInfo)
+        {
+            tokens.resize(sentence.sLen);
+            for (size_t i = 0; i < sentence.sLen; i++)
+            {
+                LabelIdType id = GetIdFromLabel(m_labelTemp[sentence.sBegin + i], labelIn);
+                auto cls = idx4class.find((int) id);
+                tokens[i].wordId = (int32_t) id;
+                tokens[i].classId = cls != idx4class.end() ? (int32_t) cls->second : -1;
+            }
+            writer.AddSentence(tokens);
+        }
+    }
+    writer.Close();
+
+    m_parser.ParseReset();
+    Reset();
+}
+
+// ReadCorpusSentences - the counterpart of m_parser.Parse() for the corpus: the next sentences of the epoch, as indices into m_corpus
+// returns - number of sentences, 0 at the end of the corpus
+template <class ElemType>
+long BatchSequenceReader<ElemType>::ReadCorpusSentences(size_t numSentences)
+{
+    size_t end = min(m_corpusNextSentence + numSentences, m_corpus.NumSentences());
+    for (size_t s = m_corpusNextSentence; s < end; s++)
+    {
+        stSentenceInfo sentence;
+        sentence.sBegin = m_corpus.SentenceBegin(s);
+        sentence.sEnd = m_corpus.SentenceBegin(s + 1);
+        sentence.sLen = sentence.sEnd - sentence.sBegin;
+        m_parser.mSentenceIndex2SentenceInfo.push_back(sentence);
+    }
+    long numRead = (long) (end - m_corpusNextSentence);
+    m_corpusNextSentence = end;
+    return numRead;
 }
 
 template <class ElemType>
@@ -1669,6 +1751,7 @@ void BatchSequenceReader<ElemType>::StartMinibatchLoop(size_t mbSize, size_t epo
     m_idx2clsRead = false;
 
     m_parser.ParseReset();
+    m_corpusNextSentence = 0;
 
     Reset();
 }
@@ -1742,6 +1825,7 @@ bool BatchSequenceReader<ElemType>::EnsureDataAvailable(size_t /*mbStartSample*/
 
     m_featureData.clear();
     m_labelIdData.clear();
+    m_labelClassIdData.clear();
 
     // now get the labels
     LabelInfo& labelIn = m_labelInfo[labelInfoIn];
@@ -1761,7 +1845,10 @@ bool BatchSequenceReader<ElemType>::EnsureDataAvailable(size_t /*mbStartSample*/
     {
         Reset();
 
-        mNumRead = m_parser.Parse(CACHE_BLOG_SIZE, &m_labelTemp, &m_featureTemp, &seqPos);
+        if (m_useCorpus)
+            mNumRead = ReadCorpusSentences(CACHE_BLOG_SIZE);
+        else
+            mNumRead = m_parser.Parse(CACHE_BLOG_SIZE, &m_labelTemp, &m_featureTemp, &seqPos);
         firstPosInSentence = mLastPosInSentence;
         if (mNumRead == 0)
             return false;
@@ -1784,6 +1871,17 @@ bool BatchSequenceReader<ElemType>::EnsureDataAvailable(size_t /*mbStartSample*/
             size_t seq = mToProcess[k];
             size_t label = m_parser.mSentenceIndex2SentenceInfo[seq].sBegin + i;
 
+            // from the corpus: the IDs are already there, the output is the next word
+            if (m_useCorpus)
+            {
+                const LMBinaryCorpus::Token& nextToken = m_corpus[label + 1];
+                m_featureData.push_back((ElemType) m_corpus[label].wordId);
+                m_labelIdData.push_back((LabelIdType) nextToken.wordId);
+                m_labelClassIdData.push_back(nextToken.classId);
+                m_totalSamples++;
+                continue;
+            }
+
             // labelIn should be a category label
             LabelType labelValue = m_labelTemp[label++];
 
@@ -2078,6 +2176,14 @@ void BatchSequenceReader<ElemType>::GetLabelOutput(std::map<std::wstring,
     labels->TransferFromDeviceToDevice(curDevId, CPUDEVICE, true, false, false);
     ElemType epsilon = (ElemType) 1e-6; // avoid all zero, although this is almost impossible.
 
+    // all noise words of the minibatch in one draw
+    std::vector<int> noiseWords;
+    if (readerMode == ReaderMode::NCE)
+    {
+        noiseWords.resize(actualmbsize * this->noise_sample_size);
+        m_noiseSampler.sample(noiseWords.size(), noiseWords.data());
+    }
+
     if (labels->GetCurrentMatrixLocation() == CPU)
         for (size_t jSample = m_mbStartSample; j < actualmbsize; ++j, ++jSample)
         {
@@ -2092,14 +2198,14 @@ void BatchSequenceReader<ElemType>::GetLabelOutput(std::map<std::wstring,
                 labels->SetValue(1, j, (ElemType) m_noiseSampler.logprob(wrd));
                 for (size_t noiseid = 0; noiseid < this->noise_sample_size; noiseid++)
                 {
-                    int wid = m_noiseSampler.sample();
+                    int wid = noiseWords[j * this->noise_sample_size + noiseid];
                     labels->SetValue(2 * (noiseid + 1), j, (ElemType) wid);
                     labels->SetValue(2 * (noiseid + 1) + 1, j, -(ElemType) m_noiseSampler.logprob(wid));
                 }
             }
             else if (readerMode == ReaderMode::Class)
             {
-                int clsidx = idx4class[wrd];
+                int clsidx = m_labelClassIdData.empty() || m_labelClassIdData[jRand] < 0 ? idx4class[wrd] : m_labelClassIdData[jRand];
                 if (class_size > 0)
                 {
 
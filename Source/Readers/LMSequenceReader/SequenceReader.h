@@ -11,6 +11,7 @@
 #include "DataWriter.h"
 #include "Config.h"
 #include "SequenceParser.h"
+#include "LMBinaryCorpus.h"
 #include "RandomOrdering.h"
 #include <string>
 #include <map>
@@ -44,36 +45,74 @@ enum ReaderMode
     None = 4, // some other type of label
 };
 
+// noiseSampler -- draws NCE noise words from the unigram distribution (or uniformly)
+// Uses a Walker alias table, so that a draw is one uniform integer and one uniform real, independent of the vocabulary size.
 template <typename Count>
 class noiseSampler
 {
     std::vector<double> m_prob, m_log_prob;
+    std::vector<double> m_aliasThreshold; // keep word k if a uniform draw in [0,1) is below this, else take m_alias[k]
+    std::vector<Count> m_alias;
     std::uniform_int_distribution<Count> unif_int;
+    std::uniform_real_distribution<double> unif_real;
     bool uniform_sampling;
     double uniform_prob;
     double uniform_log_prob;
-    std::piecewise_constant_distribution<double> d;
     std::mt19937 rng;
 
+    // build the alias table (Vose's method) for m_prob
+    void BuildAliasTable()
+    {
+        const size_t k = m_prob.size();
+        m_aliasThreshold.resize(k);
+        m_alias.resize(k);
+        std::vector<Count> small, large;
+        for (size_t i = 0; i < k; i++)
+        {
+            m_aliasThreshold[i] = m_prob[i] * k;
+            m_alias[i] = (Count) i;
+            (m_aliasThreshold[i] < 1.0 ? small : large).push_back((Count) i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            Count s = small.back(), l = large.back();
+            small.pop_back();
+            m_alias[s] = l; // the rest of s's slot goes to l
+            m_aliasThreshold[l] -= 1.0 - m_aliasThreshold[s];
+            if (m_aliasThreshold[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        for (Count i : small) // (only rounding errors are left)
+            m_aliasThreshold[i] = 1.0;
+        for (Count i : large)
+            m_aliasThreshold[i] = 1.0;
+    }
+
 public:
     noiseSampler()
     {
     }
     noiseSampler(const std::vector<double>& counts, bool xuniform_sampling = false)
-        : uniform_sampling(xuniform_sampling), rng(1234)
+        : unif_real(0.0, 1.0), uniform_sampling(xuniform_sampling), rng(1234)
     {
         size_t k = counts.size();
         uniform_prob = 1.0 / k;
         uniform_log_prob = std::log(uniform_prob);
-        std::vector<double> vn(counts.size() + 1);
-        for (int i = 0; i < vn.size(); i++)
-            vn[i] = i;
-        d = std::piecewise_constant_distribution<double>(vn.begin(), vn.end(), counts.begin());
-        unif_int = std::uniform_int_distribution<Count>(0, (long) counts.size() - 1);
-        m_prob = d.densities();
-        m_log_prob.resize(m_prob.size());
-        for (int i = 0; i < k; i++)
+        double total = 0;
+        for (double c : counts)
+            total += c;
+        m_prob.resize(k);
+        m_log_prob.resize(k);
+        for (size_t i = 0; i < k; i++)
+        {
+            m_prob[i] = counts[i] / total;
             m_log_prob[i] = std::log(m_prob[i]);
+        }
+        unif_int = std::uniform_int_distribution<Count>(0, (long) counts.size() - 1);
+        BuildAliasTable();
     }
     int size() const
     {
@@ -97,16 +136,23 @@ public:
     template <typename Engine>
     int sample(Engine& eng)
     {
-        int m = unif_int(eng);
+        Count m = unif_int(eng);
         if (uniform_sampling)
-            return m;
-        return (int) d(eng);
+            return (int) m;
+        return (int) (unif_real(eng) < m_aliasThreshold[m] ? m : m_alias[m]);
     }
 
     int sample()
     {
         return sample(this->rng);
     }
+
+    // draw n samples at once, e.g. all noise words of a minibatch
+    void sample(size_t n, int* samples)
+    {
+        for (size_t i = 0; i < n; i++)
+            samples[i] = sample(this->rng);
+    }
 };
 
 template <class ElemType>
@@ -312,6 +358,7 @@ public:
     using SequenceReader<ElemType>::m_cachingReader;
     using SequenceReader<ElemType>::m_cachingWriter;
     using SequenceReader<ElemType>::m_featuresName;
+    using SequenceReader<ElemType>::m_file;
     using SequenceReader<ElemType>::labelInfoMin;
     using SequenceReader<ElemType>::labelInfoMax;
     using SequenceReader<ElemType>::m_labelsName;
@@ -388,6 +435,15 @@ private:
 
     MBLayoutPtr m_pMBLayout;
 
+    // binaryCorpus: the text file compiled once into word and class IDs, read instead of parsing the text every epoch
+    bool m_useCorpus;
+    LMBinaryCorpus m_corpus;
+    size_t m_corpusNextSentence;         // next sentence of m_corpus to read in this epoch
+    std::vector<int> m_labelClassIdData; // class IDs parallel to m_labelIdData when reading m_corpus (-1: look up idx4class)
+
+    void CompileCorpus(const std::wstring& path);
+    long ReadCorpusSentences(size_t numSentences);
+
 public:
     vector<bool> mProcessed;
     LMBatchSequenceParser<ElemType, LabelType> m_parser;
@@ -399,6 +455,8 @@ public:
         mLastPosInSentence = 0;
         mNumRead = 0;
         mSentenceEnd = false;
+        m_useCorpus = false;
+        m_corpusNextSentence = 0;
     }
 
     template <class ConfigRecordType>
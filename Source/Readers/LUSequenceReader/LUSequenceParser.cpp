@@ -45,7 +45,7 @@ template class LUSequenceParser<double, std::string>;
 template class LUSequenceParser<double, std::wstring>;
 
 template <class NumType, class LabelType>
-long BatchLUSequenceParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<long> *labels, std::vector<vector<long>> *input, std::vector<SequencePosition> *seqPos, const map<wstring, long> &inputlabel2id, const map<wstring, long> &outputlabel2id, bool canMultiplePassData)
+long BatchLUSequenceParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<long> *labels, std::vector<vector<long>> *input, std::vector<SequencePosition> *seqPos, const map<wstring, long> &inputlabel2id, const map<wstring, long> &outputlabel2id, bool canMultiplePassData, vector<stSentenceInfo> *sentences)
 {
     fprintf(stderr, "BatchLUSequenceParser: Parsing input data...\n");
 
@@ -140,7 +140,7 @@ long BatchLUSequenceParser<NumType, LabelType>::Parse(size_t recordsRequested, s
         stinfo.sLen = iln;
         stinfo.sBegin = prvat;
         stinfo.sEnd = (int) ptr->labelPos;
-        mSentenceIndex2SentenceInfo.push_back(stinfo);
+        (sentences ? *sentences : mSentenceIndex2SentenceInfo).push_back(stinfo);
 
         prvat = (int) ptr->labelPos;
     }
@@ -34,6 +34,7 @@ long LUSequenceReader<ElemType>::GetIdFromLabel(const LabelType& labelValue, Lab
 template <class ElemType>
 BatchLUSequenceReader<ElemType>::~BatchLUSequenceReader()
 {
+    WaitForParseAhead();
     for (int index = labelInfoMin; index < labelInfoMax; ++index)
     {
         delete[] m_labelInfo[index].m_id2classLocal;
@@ -444,6 +445,9 @@ void BatchLUSequenceReader<ElemType>::InitFromConfig(const ConfigRecordType& rea
     mAllowMultPassData = readerConfig(L"dataMultiPass", false);
 
     mIgnoreSentenceBeginTag = readerConfig(L"ignoresentencebegintag", false);
+
+    // parse the next block of sentences on a background thread (default)
+    m_parseAhead = readerConfig(L"parseAhead", true);
 }
 
 template <class ElemType>
@@ -511,9 +515,60 @@ void BatchLUSequenceReader<ElemType>::StartMinibatchLoop(size_t mbSize, size_t e
 
     Reset();
 
+    WaitForParseAhead();   // (a block parsed ahead in the previous epoch)
     m_parser.ParseReset(); // restart from the corpus beginning
 }
 
+// ParseNextBlock - get the next block of sentences into m_labelTemp, m_featureTemp and m_parser.mSentenceIndex2SentenceInfo
+// Takes the block parsed ahead if there is one, and starts on the one after.
+// returns - number of sentences, 0 at the end of the data
+template <class ElemType>
+long BatchLUSequenceReader<ElemType>::ParseNextBlock()
+{
+    long numRead;
+    if (m_pendingParse.valid())
+    {
+        numRead = m_pendingParse.get();
+        m_labelTemp.swap(m_nextBlock.labels);
+        m_featureTemp.swap(m_nextBlock.features);
+        m_parser.mSentenceIndex2SentenceInfo.swap(m_nextBlock.sentences);
+    }
+    else
+    {
+        std::vector<SequencePosition> seqPos;
+        numRead = m_parser.Parse(CACHE_BLOG_SIZE, &m_labelTemp, &m_featureTemp, &seqPos, m_labelInfo[labelInfoIn].word4idx, m_labelInfo[labelInfoOut].word4idx, mAllowMultPassData);
+    }
+
+    if (m_parseAhead && numRead > 0)
+        StartParseAhead();
+    return numRead;
+}
+
+// StartParseAhead - parse the next block into m_nextBlock in the background
+// The parser and m_nextBlock belong to that thread until m_pendingParse is ready. The vocabularies are only read.
+template <class ElemType>
+void BatchLUSequenceReader<ElemType>::StartParseAhead()
+{
+    m_nextBlock.labels.clear();
+    m_nextBlock.features.clear();
+    m_nextBlock.sentences.clear();
+    m_pendingParse = std::async(std::launch::async, [this]()
+                                {
+                                    std::vector<SequencePosition> seqPos;
+                                    return m_parser.Parse(CACHE_BLOG_SIZE, &m_nextBlock.labels, &m_nextBlock.features, &seqPos,
+                                                          m_labelInfo[labelInfoIn].word4idx, m_labelInfo[labelInfoOut].word4idx, mAllowMultPassData, &m_nextBlock.sentences);
+                                });
+}
+
+// WaitForParseAhead - finish and drop a pending parse, e.g. before the parser is reset
+template <class ElemType>
+void BatchLUSequenceReader<ElemType>::WaitForParseAhead()
+{
+    if (m_pendingParse.valid())
+        m_pendingParse.wait();
+    m_pendingParse = std::future<long>();
+}
+
 template <class ElemType>
 size_t BatchLUSequenceReader<ElemType>::FindNextSentences(size_t numRead)
 {
@@ -630,10 +685,6 @@ bool BatchLUSequenceReader<ElemType>::EnsureDataAvailable(size_t /*mbStartSample
 
     // now get the labels
     LabelInfo& featIn = m_labelInfo[labelInfoIn];
-    LabelInfo& labelIn = m_labelInfo[labelInfoOut];
-
-    // see how many we already read
-    std::vector<SequencePosition> seqPos;
 
     if (mTotalSentenceSofar > m_epochSize)
     {
@@ -655,7 +706,7 @@ bool BatchLUSequenceReader<ElemType>::EnsureDataAvailable(size_t /*mbStartSample
         {
             Reset();
 
-            mNumRead = m_parser.Parse(CACHE_BLOG_SIZE, &m_labelTemp, &m_featureTemp, &seqPos, featIn.word4idx, labelIn.word4idx, mAllowMultPassData);
+            mNumRead = ParseNextBlock();
             if (mNumRead == 0)
             {
                 fprintf(stderr, "EnsureDataAvailable: No more data.\n");
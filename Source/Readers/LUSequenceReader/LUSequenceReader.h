@@ -16,6 +16,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <future>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -269,6 +270,22 @@ private:
     bool mSentenceEnd;
     bool mSentenceBegin;
 
+    // parse-ahead: the next block of sentences is parsed on a background thread while the current one is consumed
+    // Blocks are still parsed one after the other, so the data order is the same as without.
+    struct ParsedBlock
+    {
+        std::vector<LabelIdType> labels;
+        std::vector<vector<LabelIdType>> features;
+        vector<stSentenceInfo> sentences;
+    };
+    ParsedBlock m_nextBlock;
+    std::future<long> m_pendingParse; // number of sentences parsed into m_nextBlock
+    bool m_parseAhead;
+
+    long ParseNextBlock();
+    void StartParseAhead();
+    void WaitForParseAhead();
+
 public:
     vector<bool> mProcessed;
     BatchLUSequenceParser<ElemType, LabelType> m_parser;
@@ -282,6 +299,7 @@ public:
         mSentenceEnd = false;
         mSentenceBegin = true;
         mIgnoreSentenceBeginTag = false;
+        m_parseAhead = true;
     }
 
     ~BatchLUSequenceReader();
@@ -103,32 +103,46 @@ template <class ElemType>
 SparseBinaryMatrix<ElemType>::SparseBinaryMatrix(wstring name, int deviceId, size_t numRows, size_t numCols)
     : BinaryMatrix<ElemType>(name, deviceId, numRows, numCols), m_rowIndices(nullptr), m_colIndices(nullptr), m_nnz(0), m_maxNNz(0)
 {
-    // m_colIndices = (int32_t*)malloc(sizeof(int32_t)*(numRows + 1));
-    m_colIndices = (int32_t*) CUDAPageLockedMemAllocator::Malloc(sizeof(int32_t) * (numRows + 1), deviceId);
+    Reallocate(0, numRows);
     m_colIndices[0] = 0;
 }
 
 template <class ElemType>
 void SparseBinaryMatrix<ElemType>::Dispose()
 {
+    // m_rowIndices and m_colIndices point into the same buffer
     if (this->m_values != nullptr)
     {
-        // free(this->m_values);
         CUDAPageLockedMemAllocator::Free(this->m_values, this->m_deviceID);
     }
     this->m_values = nullptr;
-    if (m_colIndices != nullptr)
-    {
-        // free(m_colIndices);
-        CUDAPageLockedMemAllocator::Free(this->m_colIndices, this->m_deviceID);
-    }
     m_colIndices = nullptr;
-    if (m_rowIndices != nullptr)
+    m_rowIndices = nullptr;
+}
+
+// (re-)allocate the buffer in the layout of Matrix::SetMatrixFromCSCBuffer(): values[maxNNz], row indices[maxNNz], column starts[maxRows + 1]
+// Note that our rows are the columns of the matrix.
+template <class ElemType>
+void SparseBinaryMatrix<ElemType>::Reallocate(size_t maxNNz, size_t maxRows)
+{
+    size_t bytes = (sizeof(ElemType) + sizeof(int32_t)) * maxNNz + sizeof(int32_t) * (maxRows + 1);
+    ElemType* values = (ElemType*) CUDAPageLockedMemAllocator::Malloc(bytes, this->m_deviceID);
+    int32_t* rowIndices = (int32_t*) (values + maxNNz);
+    int32_t* colIndices = rowIndices + maxNNz;
+
+    if (this->m_values != nullptr)
     {
-        // free(m_rowIndices);
-        CUDAPageLockedMemAllocator::Free(this->m_rowIndices, this->m_deviceID);
+        memcpy(values, this->m_values, sizeof(ElemType) * m_nnz);
+        memcpy(rowIndices, m_rowIndices, sizeof(int32_t) * m_nnz);
+        memcpy(colIndices, m_colIndices, sizeof(int32_t) * (this->m_numRows + 1));
+        CUDAPageLockedMemAllocator::Free(this->m_values, this->m_deviceID);
     }
-    m_rowIndices = nullptr;
+
+    this->m_values = values;
+    m_rowIndices = rowIndices;
+    m_colIndices = colIndices;
+    this->m_maxNNz = maxNNz;
+    this->m_maxNumRows = maxRows;
 }
 
 template <class ElemType>
@@ -136,19 +150,7 @@ void SparseBinaryMatrix<ElemType>::SetMaxRows(size_t maxRows)
 {
     if (maxRows > this->m_maxNumRows)
     {
-        // int32_t* colIndices = (int32_t*)malloc(sizeof(int32_t)*(maxRows+1));
-        int32_t* colIndices = (int32_t*) CUDAPageLockedMemAllocator::Malloc(sizeof(int32_t) * (maxRows + 1), this->m_deviceID);
-        if (this->m_colIndices != nullptr)
-        {
-            if (this->m_numRows > 0)
-            {
-                memcpy(colIndices, m_colIndices, sizeof(int32_t) * (this->m_numRows + 1));
-            }
-            // free(this->m_colIndices);
-            CUDAPageLockedMemAllocator::Free(this->m_colIndices, this->m_deviceID);
-        }
-        this->m_colIndices = colIndices;
-        this->m_maxNumRows = maxRows;
+        Reallocate(this->m_maxNNz, maxRows);
     }
 }
 
@@ -160,32 +162,7 @@ void SparseBinaryMatrix<ElemType>::ResizeArrays(size_t newNNz)
     {
         return;
     }
-    size_t newMaxNNz = (size_t)((newNNz + m_nnz) * 1.3);
-    // int32_t* rowIndices = (int32_t*)malloc(sizeof(int32_t)*newMaxNNz);
-    // ElemType* values = (ElemType*)malloc(sizeof(ElemType)*newMaxNNz);
-    int32_t* rowIndices = (int32_t*) CUDAPageLockedMemAllocator::Malloc(sizeof(int32_t) * newMaxNNz, this->m_deviceID);
-    ElemType* values = (ElemType*) CUDAPageLockedMemAllocator::Malloc(sizeof(ElemType) * newMaxNNz, this->m_deviceID);
-
-    if (m_nnz > 0)
-    {
-        memcpy(rowIndices, m_rowIndices, sizeof(int32_t) * this->m_maxNNz);
-        memcpy(values, this->m_values, sizeof(ElemType) * this->m_maxNNz);
-    }
-
-    if (m_rowIndices != nullptr)
-    {
-        // free(m_rowIndices);
-        CUDAPageLockedMemAllocator::Free(this->m_rowIndices, this->m_deviceID);
-    }
-    if (this->m_values != nullptr)
-    {
-        // free(this->m_values);
-        CUDAPageLockedMemAllocator::Free(this->m_values, this->m_deviceID);
-    }
-
-    m_rowIndices = rowIndices;
-    this->m_values = values;
-    this->m_maxNNz = newMaxNNz;
+    Reallocate((size_t)((newNNz + m_nnz) * 1.3), this->m_maxNumRows);
 }
 
 template <class ElemType>
@@ -220,7 +197,8 @@ void SparseBinaryMatrix<ElemType>::AddRowIndices(void* rowIndices, size_t nnz)
 template <class ElemType>
 void SparseBinaryMatrix<ElemType>::Fill(Matrix<ElemType>* matrix)
 {
-    matrix->SetMatrixFromCSCFormat(m_colIndices, m_rowIndices, this->m_values, this->m_nnz, this->m_maxNumCols, this->m_numRows);
+    // single copy of our (page-locked) buffer, no per-array transfers or index conversion
+    matrix->SetMatrixFromCSCBuffer(this->m_values, this->m_maxNNz, this->m_nnz, this->m_maxNumCols, this->m_numRows);
 #if DEBUG
     matrix->Print("testname");
 #endif
@@ -137,6 +137,9 @@ public:
     virtual void SetMaxRows(size_t maxRows) override;
 
 protected:
+    void Reallocate(size_t maxNNz, size_t maxRows);
+
+    // m_values is the start of one buffer that also holds the row indices and column starts
     int32_t* m_rowIndices;
     int32_t* m_colIndices;
     size_t m_nnz;
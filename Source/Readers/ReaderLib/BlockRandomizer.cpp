@@ -0,0 +1,336 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// BlockRandomizer.cpp -- the randomization, caching, prefetch and MPI decimation stages of the reader pipeline
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "BlockRandomizer.h"
+#include <algorithm>
+#include <random>
+#include <set>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+BlockRandomizer::BlockRandomizer(IDataDeserializerPtr deserializer, size_t randomizationRange, size_t numPrefetchChunks, size_t storagePrefetchChunks, bool shardChunks, int verbosity)
+    : m_deserializer(deserializer), m_randomizationRange(randomizationRange), m_numPrefetchChunks(numPrefetchChunks), m_storagePrefetchChunks(storagePrefetchChunks), m_shardChunks(shardChunks), m_verbosity(verbosity),
+      m_numberOfSamples(0), m_sweep(SIZE_MAX), m_epochEnd(0), m_sequencePosition(0), m_workerRank(0), m_numWorkers(1), m_requiredChunkPosition(SIZE_MAX)
+{
+    // all descriptions, once (with shardChunks, those of the sequences per epoch); empty chunks are left out
+    size_t numSequences = 0;
+    for (const auto& chunk : m_deserializer->GetChunkDescriptions())
+    {
+        if (chunk.numberOfSamples == 0)
+            continue;
+        m_chunks.push_back(chunk);
+        m_numberOfSamples += chunk.numberOfSamples;
+        numSequences += chunk.numberOfSequences;
+    }
+    if (m_numberOfSamples == 0)
+        RuntimeError("BlockRandomizer: there is no data.");
+    std::vector<size_t> all(m_chunks.size());
+    for (size_t k = 0; k < all.size(); k++)
+        all[k] = k;
+    if (!m_shardChunks)
+        LoadSequences(all);
+    if (m_verbosity > 0)
+        fprintf(stderr, "BlockRandomizer: %d chunks, %d sequences, %d samples; randomization range %d samples, prefetching %d chunks%s\n",
+                (int) m_chunks.size(), (int) numSequences, (int) m_numberOfSamples, (int) m_randomizationRange, (int) m_numPrefetchChunks,
+                m_shardChunks ? "; chunks sharded across workers" : "");
+}
+
+// the descriptions of the sequences of the given chunks (indices into m_chunks), each chunk once
+void BlockRandomizer::LoadSequences(const std::vector<size_t>& chunks)
+{
+    m_sequences.clear();
+    m_chunkSequenceBegin.clear();
+    std::vector<SequenceDescription> sequences;
+    for (size_t k : chunks)
+    {
+        const auto& chunk = m_chunks[k];
+        if (m_chunkSequenceBegin.size() <= chunk.id)
+            m_chunkSequenceBegin.resize(chunk.id + 1, SIZE_MAX);
+        if (m_chunkSequenceBegin[chunk.id] != SIZE_MAX)
+            continue;
+        sequences.clear();
+        m_deserializer->GetSequencesForChunk(chunk.id, sequences);
+        if (sequences.size() != chunk.numberOfSequences)
+            LogicError("BlockRandomizer: chunk %d has %d sequences instead of %d.", (int) chunk.id, (int) sequences.size(), (int) chunk.numberOfSequences);
+        m_chunkSequenceBegin[chunk.id] = m_sequences.size();
+        m_sequences.insert(m_sequences.end(), sequences.begin(), sequences.end());
+    }
+    m_chunkPositions.assign(m_chunkSequenceBegin.size(), SIZE_MAX);
+}
+
+// shuffle the chunks, then the sequences within the randomization windows, each sweep with its own seed, so that
+// each epoch (and each worker) sees the same order regardless of where training was restarted
+void BlockRandomizer::RandomizeSweep(size_t sweep)
+{
+    if (sweep == m_sweep)
+        return;
+    m_sweep = sweep;
+    std::mt19937_64 rng(sweep); // (std::mt19937_64 produces the same values everywhere, unlike std::shuffle() or the distributions)
+    std::vector<size_t> order;
+    RandomizeChunks(rng, order);
+    RandomizePositions(rng, order, m_randomizationRange);
+
+    if (m_verbosity > 1)
+    {
+        double windowChunks = 0;
+        for (const auto& chunk : m_randomizedChunks)
+            windowChunks += chunk.windowEnd - chunk.windowBegin;
+        fprintf(stderr, "BlockRandomizer: randomized sweep %d, windows of %.1f chunks on average\n", (int) sweep, windowChunks / m_randomizedChunks.size());
+    }
+}
+
+// the chunks of a sweep in randomized order (indices into m_chunks)
+void BlockRandomizer::RandomizeChunks(std::mt19937_64& rng, std::vector<size_t>& order) const
+{
+    const size_t numChunks = m_chunks.size();
+    order.resize(numChunks);
+    for (size_t k = 0; k < numChunks; k++)
+        order[k] = k;
+    if (m_randomizationRange > 0)
+        for (size_t k = numChunks; k > 1; k--)
+            std::swap(order[k - 1], order[rng() % k]);
+}
+
+// the chunk positions for the given chunks (indices into m_chunks, whose sequences are in m_sequences), their windows, and the sequence positions
+void BlockRandomizer::RandomizePositions(std::mt19937_64& rng, const std::vector<size_t>& order, size_t randomizationRange)
+{
+    const size_t numChunks = order.size();
+    m_randomizedChunks.resize(numChunks);
+    size_t sequencePosition = 0, samplePosition = 0;
+    for (size_t k = 0; k < numChunks; k++)
+    {
+        const auto& chunk = m_chunks[order[k]];
+        m_randomizedChunks[k] = RandomizedChunk{chunk.id, sequencePosition, samplePosition, k, k + 1};
+        m_chunkPositions[chunk.id] = k;
+        sequencePosition += chunk.numberOfSequences;
+        samplePosition += chunk.numberOfSamples;
+    }
+    const size_t numSequences = sequencePosition;
+    auto sampleEnd = [&](size_t k) { return m_randomizedChunks[k].samplePositionBegin + m_chunks[order[k]].numberOfSamples; };
+
+    // their windows: the chunks that overlap with randomizationRange / 2 samples before and after each
+    if (randomizationRange > 0)
+    {
+        const size_t halfRange = randomizationRange / 2;
+        size_t windowBegin = 0, windowEnd = 0;
+        for (size_t k = 0; k < numChunks; k++)
+        {
+            auto& chunk = m_randomizedChunks[k];
+            while (windowBegin < k && sampleEnd(windowBegin) + halfRange <= chunk.samplePositionBegin)
+                windowBegin++;
+            windowEnd = std::max(windowEnd, k + 1);
+            while (windowEnd < numChunks && m_randomizedChunks[windowEnd].samplePositionBegin < sampleEnd(k) + halfRange)
+                windowEnd++;
+            chunk.windowBegin = windowBegin;
+            chunk.windowEnd = windowEnd;
+        }
+    }
+
+    // the sequences, in the order of their chunks
+    m_positions.clear();
+    m_positions.reserve(numSequences);
+    std::vector<unsigned int> positionChunk; // [sequence position] its chunk position
+    positionChunk.reserve(numSequences);
+    for (size_t k = 0; k < numChunks; k++)
+    {
+        const size_t chunkId = m_randomizedChunks[k].chunkId;
+        for (size_t i = 0; i < m_chunks[order[k]].numberOfSequences; i++)
+        {
+            m_positions.push_back(m_chunkSequenceBegin[chunkId] + i);
+            positionChunk.push_back((unsigned int) k);
+        }
+    }
+
+    // shuffled such that each sequence comes to a position whose window contains its chunk
+    if (randomizationRange > 0)
+    {
+        auto inWindow = [&](size_t chunkPosition, size_t sequenceChunkPosition)
+        {
+            const auto& chunk = m_randomizedChunks[chunkPosition];
+            return sequenceChunkPosition >= chunk.windowBegin && sequenceChunkPosition < chunk.windowEnd;
+        };
+        std::vector<unsigned int> sequenceChunk = positionChunk; // [sequence position] chunk position of the sequence now there
+        for (size_t t = 0; t < numSequences; t++)
+        {
+            const auto& chunk = m_randomizedChunks[positionChunk[t]];
+            const size_t begin = m_randomizedChunks[chunk.windowBegin].sequencePositionBegin;
+            const size_t end = chunk.windowEnd < numChunks ? m_randomizedChunks[chunk.windowEnd].sequencePositionBegin : numSequences;
+            for (;;) // (terminates, since u == t always qualifies)
+            {
+                const size_t u = begin + rng() % (end - begin);
+                if (inWindow(positionChunk[t], sequenceChunk[u]) && inWindow(positionChunk[u], sequenceChunk[t]))
+                {
+                    std::swap(m_positions[t], m_positions[u]);
+                    std::swap(sequenceChunk[t], sequenceChunk[u]);
+                    break;
+                }
+            }
+        }
+    }
+
+    m_positionSampleBegin.resize(numSequences + 1);
+    m_positionSampleBegin[0] = 0;
+    for (size_t t = 0; t < numSequences; t++)
+        m_positionSampleBegin[t + 1] = m_positionSampleBegin[t] + m_sequences[m_positions[t]].numberOfSamples;
+    m_requiredChunkPosition = SIZE_MAX;
+    m_storagePrefetchedChunks.clear();
+}
+
+void BlockRandomizer::StartEpoch(size_t epoch, size_t epochSize, size_t workerRank, size_t numWorkers)
+{
+    if (epochSize == 0 || numWorkers == 0 || workerRank >= numWorkers)
+        InvalidArgument("BlockRandomizer: invalid epoch size or worker.");
+    m_workerRank = workerRank;
+    m_numWorkers = numWorkers;
+    const size_t epochBegin = epoch * epochSize;
+    m_epochEnd = epochBegin + epochSize;
+    if (m_shardChunks)
+        return StartShardedEpoch(epoch, epochBegin);
+
+    // the first sequence that begins at or after the epoch's first sample
+    RandomizeSweep(epochBegin / m_numberOfSamples);
+    const size_t offset = epochBegin % m_numberOfSamples;
+    m_sequencePosition = std::lower_bound(m_positionSampleBegin.begin(), m_positionSampleBegin.end(), offset) - m_positionSampleBegin.begin();
+    m_requiredChunkPosition = SIZE_MAX; // (the ownership of the chunks may have changed)
+    m_storagePrefetchedChunks.clear();
+}
+
+// this worker's chunks of the epoch, and their sequences in randomized order (see shardChunks in BlockRandomizer.h)
+void BlockRandomizer::StartShardedEpoch(size_t epoch, size_t epochBegin)
+{
+    std::vector<size_t> own, order;
+    std::vector<size_t> workerSamples(m_numWorkers, 0);
+    size_t epochSamples = 0;
+    for (size_t sweep = epochBegin / m_numberOfSamples; sweep * m_numberOfSamples < m_epochEnd; sweep++)
+    {
+        std::mt19937_64 rng(sweep); // (the chunk order of the sweep without shardChunks)
+        RandomizeChunks(rng, order);
+        size_t chunkBegin = sweep * m_numberOfSamples;
+        for (size_t k : order)
+        {
+            const size_t numSamples = m_chunks[k].numberOfSamples;
+            if (chunkBegin >= epochBegin && chunkBegin < m_epochEnd)
+            {
+                const size_t worker = std::min_element(workerSamples.begin(), workerSamples.end()) - workerSamples.begin();
+                workerSamples[worker] += numSamples;
+                epochSamples += numSamples;
+                if (worker == m_workerRank)
+                    own.push_back(k);
+            }
+            chunkBegin += numSamples;
+        }
+    }
+
+    LoadSequences(own);
+    std::mt19937_64 rng(epoch * m_numWorkers + m_workerRank);
+    RandomizePositions(rng, own, m_randomizationRange > 0 ? std::max(m_randomizationRange / m_numWorkers, (size_t) 1) : 0);
+    m_sweep = SIZE_MAX;
+    m_sequencePosition = 0;
+
+    if (m_verbosity > 0)
+        fprintf(stderr, "BlockRandomizer: epoch %d: worker %d of %d has %d chunks, %d of %d samples\n",
+                (int) epoch, (int) m_workerRank, (int) m_numWorkers, (int) own.size(), (int) workerSamples[m_workerRank], (int) epochSamples);
+}
+
+bool BlockRandomizer::GetNextSequences(size_t numSamples, std::vector<RandomizedSequence>& sequences)
+{
+    sequences.clear();
+    if (m_shardChunks) // (this worker's share of the minibatch)
+        numSamples = (numSamples + m_numWorkers - 1) / m_numWorkers;
+    size_t numTaken = 0;
+    bool anyPosition = false;
+    for (;;)
+    {
+        if (m_shardChunks)
+        {
+            if (m_sequencePosition == m_positions.size()) // (its chunks of the epoch are used up)
+                break;
+        }
+        else
+        {
+            if (m_sequencePosition == m_positions.size())
+            {
+                RandomizeSweep(m_sweep + 1);
+                m_sequencePosition = 0;
+            }
+            if (m_sweep * m_numberOfSamples + m_positionSampleBegin[m_sequencePosition] >= m_epochEnd)
+                break;
+        }
+        const auto& sequence = m_sequences[m_positions[m_sequencePosition]];
+        if (anyPosition && numTaken + sequence.numberOfSamples > numSamples)
+            break;
+
+        // the window of the position's chunk must be in memory
+        const size_t chunkPosition = std::upper_bound(m_randomizedChunks.begin(), m_randomizedChunks.end(), m_sequencePosition,
+                                                      [](size_t position, const RandomizedChunk& chunk) { return position < chunk.sequencePositionBegin; }) -
+                                     m_randomizedChunks.begin() - 1;
+        RequireChunks(chunkPosition);
+
+        if (IsOwnChunk(m_chunkPositions[sequence.chunkId]))
+            sequences.push_back(RandomizedSequence{sequence, GetChunk(sequence.chunkId)});
+        numTaken += sequence.numberOfSamples;
+        anyPosition = true;
+        m_sequencePosition++;
+    }
+    return anyPosition;
+}
+
+// page in this worker's chunks of the window of the chunk at 'chunkPosition', and of the next numPrefetchChunks chunks' windows,
+// each on its own thread, and release the others; tell the deserializer of those of the next storagePrefetchChunks windows after
+// Prefetch does not reach into the next sweep, whose order is not known yet.
+void BlockRandomizer::RequireChunks(size_t chunkPosition)
+{
+    if (chunkPosition == m_requiredChunkPosition)
+        return;
+    m_requiredChunkPosition = chunkPosition;
+
+    std::set<size_t> required; // [chunkId]
+    const size_t last = std::min(chunkPosition + m_numPrefetchChunks, m_randomizedChunks.size() - 1);
+    for (size_t k = chunkPosition; k <= last; k++)
+        for (size_t j = m_randomizedChunks[k].windowBegin; j < m_randomizedChunks[k].windowEnd; j++)
+            if (IsOwnChunk(j))
+                required.insert(m_randomizedChunks[j].chunkId);
+
+    for (auto iter = m_chunkCache.begin(); iter != m_chunkCache.end();)
+    {
+        if (required.find(iter->first) == required.end())
+            iter = m_chunkCache.erase(iter); // (a chunk stays alive while minibatches still use it)
+        else
+            ++iter;
+    }
+    for (size_t chunkId : required)
+    {
+        if (m_chunkCache.find(chunkId) != m_chunkCache.end())
+            continue;
+        IDataDeserializerPtr deserializer = m_deserializer;
+        m_chunkCache[chunkId] = std::async(std::launch::async, [deserializer, chunkId]() { return deserializer->GetChunk(chunkId); }).share();
+    }
+
+    const size_t storageLast = std::min(last + m_storagePrefetchChunks, m_randomizedChunks.size() - 1);
+    for (size_t k = last + 1; k <= storageLast; k++)
+    {
+        for (size_t j = m_randomizedChunks[k].windowBegin; j < m_randomizedChunks[k].windowEnd; j++)
+        {
+            const size_t chunkId = m_randomizedChunks[j].chunkId;
+            if (IsOwnChunk(j) && (required.find(chunkId) == required.end()) && m_storagePrefetchedChunks.insert(chunkId).second)
+                m_deserializer->PrefetchChunk(chunkId);
+        }
+    }
+}
+
+ChunkPtr BlockRandomizer::GetChunk(size_t chunkId)
+{
+    auto iter = m_chunkCache.find(chunkId);
+    if (iter == m_chunkCache.end())
+        LogicError("BlockRandomizer: chunk %d is not in the window.", (int) chunkId);
+    return iter->second.get(); // (waits for it, and rethrows an error from paging it in)
+}
+
+} } }
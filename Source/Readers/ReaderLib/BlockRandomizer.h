@@ -0,0 +1,118 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// BlockRandomizer.h -- the randomization, caching, prefetch and MPI decimation stages of the reader pipeline, shared by all deserializers
+//
+
+#pragma once
+
+#include "DataDeserializer.h"
+#include <future>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// a sequence handed out by the randomizer, with the chunk that holds its data
+struct RandomizedSequence
+{
+    SequenceDescription description;
+    ChunkPtr chunk;
+};
+
+// -----------------------------------------------------------------------
+// BlockRandomizer -- sequences in the order of a (block-)randomized sweep over the data, and the chunks they are in
+//
+// Each sweep over the data first shuffles the chunks, then shuffles the sequences such that the sequence at each position comes from a
+// chunk within the randomization window of that position's chunk (the chunks that are at most about randomizationRange / 2 samples away).
+// So only the chunks of one window need to be in memory. Each chunk is paged in on a background thread before it is needed
+// (numPrefetchChunks positions ahead), and released when no window needs it any more. The deserializer is told of the chunks
+// another storagePrefetchChunks positions ahead (IDataDeserializer::PrefetchChunk()), e.g. to fetch them from remote storage.
+// Epochs are consecutive stretches of epochSize samples of the endless series of sweeps, each sweep randomized with its index as seed.
+// With several workers, each one takes the sequences of every numWorkers-th chunk (of the randomized order), and thus only pages
+// in those chunks; all workers step through the same sequence positions, so that they have the same number of minibatches.
+// randomizationRange 0 means no randomization: the data in its original order.
+//
+// With shardChunks, the workers do not share the sequences of a sweep; instead, each epoch's chunks (those of the randomized
+// sweeps that begin within it, so epochs are rounded to whole chunks) are dealt out to the workers, each to the one with the
+// fewest samples so far. This depends only on the chunk descriptions, the epoch and the number of workers, so every worker
+// computes the same assignment by itself, anew for each epoch (also when the number of workers changed). A worker only asks
+// the deserializer for the sequences of its own chunks, and randomizes them among themselves, in windows of
+// randomizationRange / numWorkers samples. It takes numSamples / numWorkers samples per minibatch, until its chunks are used up:
+// the workers may end an epoch a few minibatches apart.
+// -----------------------------------------------------------------------
+
+class BlockRandomizer
+{
+public:
+    BlockRandomizer(IDataDeserializerPtr deserializer, size_t randomizationRange, size_t numPrefetchChunks, size_t storagePrefetchChunks, bool shardChunks, int verbosity);
+
+    // total number of samples of one sweep
+    size_t GetNumberOfSamples() const
+    {
+        return m_numberOfSamples;
+    }
+
+    // position at the start of 'epoch', epochSize samples after the start of the previous one
+    void StartEpoch(size_t epoch, size_t epochSize, size_t workerRank, size_t numWorkers);
+
+    // the next sequences of this worker, from the next sequence positions of about numSamples samples (at least one position)
+    // Returns false at the end of the epoch. 'sequences' may be empty if none of the positions belongs to this worker.
+    bool GetNextSequences(size_t numSamples, std::vector<RandomizedSequence>& sequences);
+
+private:
+    void RandomizeSweep(size_t sweep);
+    void RandomizeChunks(std::mt19937_64& rng, std::vector<size_t>& order) const;
+    void RandomizePositions(std::mt19937_64& rng, const std::vector<size_t>& order, size_t randomizationRange);
+    void LoadSequences(const std::vector<size_t>& chunks);
+    void StartShardedEpoch(size_t epoch, size_t epochBegin);
+    void RequireChunks(size_t chunkPosition);
+    ChunkPtr GetChunk(size_t chunkId);
+    bool IsOwnChunk(size_t chunkPosition) const
+    {
+        return m_shardChunks || chunkPosition % m_numWorkers == m_workerRank; // (with shardChunks, the randomized chunks are this worker's only)
+    }
+
+    IDataDeserializerPtr m_deserializer;
+    size_t m_randomizationRange;
+    size_t m_numPrefetchChunks;
+    size_t m_storagePrefetchChunks;
+    bool m_shardChunks;
+    int m_verbosity;
+
+    // the data, in its original order
+    std::vector<ChunkDescription> m_chunks;
+    std::vector<SequenceDescription> m_sequences; // all sequences (with shardChunks: those of this worker's chunks of the epoch), chunk by chunk
+    std::vector<size_t> m_chunkSequenceBegin;     // [chunkId] index of its first sequence in m_sequences
+    size_t m_numberOfSamples;
+
+    // the current sweep, randomized
+    struct RandomizedChunk
+    {
+        size_t chunkId;
+        size_t sequencePositionBegin; // its positions in m_positions
+        size_t samplePositionBegin;
+        size_t windowBegin, windowEnd; // [chunk positions] the chunks whose sequences may be placed at its positions
+    };
+    size_t m_sweep;                                // index of the sweep below, or SIZE_MAX (always with shardChunks)
+    std::vector<RandomizedChunk> m_randomizedChunks; // [chunk position] (with shardChunks: this worker's chunks of the epoch)
+    std::vector<size_t> m_chunkPositions;           // [chunkId] its chunk position
+    std::vector<size_t> m_positions;                // [sequence position] index into m_sequences
+    std::vector<size_t> m_positionSampleBegin;      // [sequence position] samples of the sweep before it; one more for the end
+
+    // the current epoch
+    size_t m_epochEnd;       // first sample after the epoch, counted from the start of the first sweep
+    size_t m_sequencePosition; // next sequence position of the current sweep
+    size_t m_workerRank, m_numWorkers;
+
+    // the chunks that are in memory or on their way
+    std::map<size_t, std::shared_future<ChunkPtr>> m_chunkCache; // [chunkId]
+    size_t m_requiredChunkPosition;                              // chunk position RequireChunks() was last called for, SIZE_MAX if none
+    std::set<size_t> m_storagePrefetchedChunks;                   // [chunkId] PrefetchChunk() was called for in this sweep
+};
+
+} } }
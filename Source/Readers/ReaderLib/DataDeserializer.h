@@ -0,0 +1,91 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// DataDeserializer.h -- the data paging stage of the composable reader pipeline (see DataReader_v2.txt and PipelineReader.h)
+// A deserializer knows a data format, and nothing else: it describes the data as chunks of sequences, and pages in a chunk on request.
+// Randomization, caching, prefetch, MPI decimation and packing into minibatches are done by the stages behind it, the same for all formats.
+//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// how the samples of a stream are stored
+enum class StorageType
+{
+    dense,   // 'dim' values per sample
+    category // one class index per sample, presented as a one-hot vector of dimension 'dim'
+};
+
+// StreamDescription - one kind of data a deserializer provides, e.g. the features or the labels; it feeds the input node of the same name
+struct StreamDescription
+{
+    std::wstring name; // name of the config section, and of the input node that it feeds
+    size_t id;         // index of the stream in GetStreamDescriptions()
+    StorageType storageType;
+    size_t dim;
+};
+
+// SequenceDescription - one sequence (an utterance, a sentence, an image; in frame mode a single frame), the unit of randomization
+// All streams of a sequence have the same number of samples.
+struct SequenceDescription
+{
+    size_t id;              // unique within the deserializer; also the sequence id in the MBLayout
+    size_t numberOfSamples; // e.g. frames
+    size_t chunkId;         // the chunk it is stored in
+};
+
+// ChunkDescription - a group of sequences that are read together (e.g. consecutive utterances of one archive), the unit of paging
+struct ChunkDescription
+{
+    size_t id; // index of the chunk in GetChunkDescriptions()
+    size_t numberOfSamples;
+    size_t numberOfSequences;
+};
+
+// Chunk - the paged-in data of one chunk; freed when the last reference to it goes away
+// The Copy functions are called concurrently for different sequences, while the chunk is shared by the minibatches that use it.
+class Chunk
+{
+public:
+    virtual ~Chunk()
+    {
+    }
+
+    // copy the samples of a sequence of a dense stream into 'values': sample t becomes the 'dim' values at values + t * colStride
+    virtual void CopyDenseSequence(size_t sequenceId, size_t streamId, float* values, size_t colStride) const = 0;
+
+    // copy the class indices of the samples of a sequence of a category stream into 'categories'
+    virtual void CopyCategorySequence(size_t sequenceId, size_t streamId, size_t* categories) const = 0;
+};
+typedef std::shared_ptr<const Chunk> ChunkPtr;
+
+// IDataDeserializer - the interface of the data paging stage
+// The descriptions are queried once at the start; GetChunk() is called on the prefetch threads, and must be thread-safe.
+class IDataDeserializer
+{
+public:
+    virtual ~IDataDeserializer()
+    {
+    }
+
+    virtual std::vector<StreamDescription> GetStreamDescriptions() const = 0;
+    virtual std::vector<ChunkDescription> GetChunkDescriptions() const = 0;
+    virtual void GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const = 0;
+
+    // page in a chunk (e.g. read and parse its part of the files)
+    virtual ChunkPtr GetChunk(size_t chunkId) = 0;
+
+    // a chunk will be paged in later: e.g. start fetching its files from remote storage (see isremotepath()); must not block
+    virtual void PrefetchChunk(size_t /*chunkId*/)
+    {
+    }
+};
+typedef std::shared_ptr<IDataDeserializer> IDataDeserializerPtr;
+
+} } }
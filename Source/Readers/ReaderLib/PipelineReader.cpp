@@ -0,0 +1,175 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// PipelineReader.cpp -- IDataReader on top of the composable reader pipeline; the packing stage
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "PipelineReader.h"
+#include "Config.h"
+#include "ScriptableObjects.h"
+#include <algorithm>
+#include <exception>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+template <class ConfigRecordType>
+void PipelineReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
+{
+    IDataDeserializerPtr deserializer = CreateDeserializer(config);
+    m_streams = deserializer->GetStreamDescriptions();
+
+    size_t randomizationRange = 24 * 3600 * 100;
+    if (config.Exists(L"randomize"))
+    {
+        wstring randomize = config.CanBeString(L"randomize") ? config(L"randomize") : wstring();
+        if (!_wcsicmp(randomize.c_str(), L"none"))
+            randomizationRange = 0;
+        else if (_wcsicmp(randomize.c_str(), L"auto"))
+            randomizationRange = config(L"randomize");
+    }
+    const size_t numPrefetchChunks = config(L"numPrefetchChunks", (size_t) 2);
+    const size_t storagePrefetchChunks = config(L"storagePrefetchChunks", (size_t) 16);
+    const bool shardChunks = config(L"shardChunks", false);
+    const int verbosity = config(L"verbosity", 0);
+    m_randomizer.reset(new BlockRandomizer(deserializer, randomizationRange, numPrefetchChunks, storagePrefetchChunks, shardChunks, verbosity));
+}
+
+template <class ElemType>
+void PipelineReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t epoch, size_t subsetNum, size_t numSubsets, size_t requestedEpochSamples)
+{
+    if (mbSize == 0)
+        InvalidArgument("PipelineReader: the minibatch size must not be 0.");
+    m_mbSize = mbSize;
+    m_randomizer->StartEpoch(epoch, requestedEpochSamples == requestDataSize ? m_randomizer->GetNumberOfSamples() : requestedEpochSamples, subsetNum, numSubsets);
+    m_endOfEpoch = false;
+}
+
+// the next minibatch: the sequences of the next mbSize samples (some of which may belong to other workers), packed into parallel sequences
+// Frames (sequences of one sample) become a frame-mode minibatch. Longer sequences are placed longest first, each into the first parallel
+// sequence that still has room for it within the length of the longest (first-fit decreasing), so that short sequences share one.
+template <class ElemType>
+bool PipelineReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
+{
+    if (m_endOfEpoch || !m_randomizer->GetNextSequences(m_mbSize, m_sequences))
+    {
+        m_endOfEpoch = true;
+        return false;
+    }
+
+    const size_t numSequences = m_sequences.size();
+    size_t numTimeSteps = 0;
+    for (const auto& sequence : m_sequences)
+        numTimeSteps = max(numTimeSteps, sequence.description.numberOfSamples);
+    m_placements.assign(numSequences, Placement{0, 0});
+    if (numTimeSteps <= 1)
+    {
+        for (size_t i = 0; i < numSequences; i++)
+            m_placements[i].slot = i;
+        m_pMBLayout->InitAsFrameMode(numSequences);
+    }
+    else
+    {
+        std::vector<size_t> order(numSequences);
+        for (size_t i = 0; i < numSequences; i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_sequences[a].description.numberOfSamples > m_sequences[b].description.numberOfSamples; });
+        std::vector<size_t> slotLengths;
+        for (size_t i : order)
+        {
+            const size_t length = m_sequences[i].description.numberOfSamples;
+            size_t slot = 0;
+            while (slot < slotLengths.size() && slotLengths[slot] + length > numTimeSteps)
+                slot++;
+            if (slot == slotLengths.size())
+                slotLengths.push_back(0);
+            m_placements[i] = Placement{slot, slotLengths[slot]};
+            slotLengths[slot] += length;
+        }
+        m_pMBLayout->Init(slotLengths.size(), numTimeSteps);
+        for (size_t i = 0; i < numSequences; i++)
+        {
+            const auto& placement = m_placements[i];
+            m_pMBLayout->AddSequence(m_sequences[i].description.id, placement.slot, placement.begin, placement.begin + m_sequences[i].description.numberOfSamples);
+        }
+        for (size_t slot = 0; slot < slotLengths.size(); slot++)
+            if (slotLengths[slot] < numTimeSteps)
+                m_pMBLayout->AddGap(slot, slotLengths[slot], numTimeSteps);
+    }
+
+    for (auto& input : matrices)
+    {
+        auto stream = std::find_if(m_streams.begin(), m_streams.end(), [&input](const StreamDescription& s) { return s.name == input.first; });
+        if (stream == m_streams.end())
+            InvalidArgument("PipelineReader: the reader has no data for input '%ls'.", input.first.c_str());
+        PackStream(*stream, *input.second);
+    }
+    return true;
+}
+
+// (the staging buffer as ElemType; a copy unless that is float)
+template <class ElemType>
+static ElemType* AsElemType(std::vector<float>& values, std::vector<ElemType>& converted)
+{
+    converted.assign(values.begin(), values.end());
+    return converted.data();
+}
+static float* AsElemType(std::vector<float>& values, std::vector<float>&)
+{
+    return values.data();
+}
+
+// copy the samples of all sequences of one stream into their columns, in parallel; gaps are 0
+template <class ElemType>
+void PipelineReader<ElemType>::PackStream(const StreamDescription& stream, Matrix<ElemType>& matrix)
+{
+    if (matrix.GetMatrixType() != DENSE)
+        InvalidArgument("PipelineReader: input '%ls' must be dense.", stream.name.c_str());
+    const size_t numSlots = m_pMBLayout->GetNumParallelSequences();
+    const size_t numCols = m_pMBLayout->GetNumCols();
+    m_values.assign(stream.dim * numCols, 0);
+
+    std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) m_sequences.size(); i++)
+    {
+        try
+        {
+            const auto& sequence = m_sequences[i];
+            const size_t length = sequence.description.numberOfSamples;
+            const size_t firstCol = m_placements[i].begin * numSlots + m_placements[i].slot;
+            if (stream.storageType == StorageType::dense)
+                sequence.chunk->CopyDenseSequence(sequence.description.id, stream.id, &m_values[firstCol * stream.dim], stream.dim * numSlots);
+            else
+            {
+                std::vector<size_t> categories(length);
+                sequence.chunk->CopyCategorySequence(sequence.description.id, stream.id, categories.data());
+                for (size_t t = 0; t < length; t++)
+                {
+                    if (categories[t] >= stream.dim)
+                        RuntimeError("PipelineReader: class %d of input '%ls' is out of range (dimension %d).", (int) categories[t], stream.name.c_str(), (int) stream.dim);
+                    m_values[(firstCol + t * numSlots) * stream.dim + categories[t]] = 1;
+                }
+            }
+        }
+        catch (...)
+        {
+#pragma omp critical
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+
+    matrix.SetValue(stream.dim, numCols, matrix.GetDeviceId(), AsElemType(m_values, m_converted), matrixFlagNormal);
+}
+
+template class PipelineReader<float>;
+template class PipelineReader<double>;
+
+} } }
@@ -0,0 +1,110 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// PipelineReader.h -- IDataReader on top of the composable reader pipeline (the design of DataReader_v2.txt):
+//
+//   deserializer (format-specific: paging in chunks of sequences)
+//     -> BlockRandomizer (randomization, chunk caching, prefetch on background threads, MPI decimation by chunk)
+//     -> packing (sequences into parallel streams of a minibatch, with its MBLayout)
+//
+// A reader plugin only implements a deserializer, and exports a PipelineReader for it as GetPipelineReaderF/D, which DataReader
+// loads instead of GetReaderF/D when the reader section says pipeline=true. Options of the pipeline, for all formats:
+//   randomize=auto|none|<samples> (randomization range; auto is 24 hours of 10 ms frames), numPrefetchChunks=2, verbosity=0,
+//   storagePrefetchChunks=16 (how many chunks further ahead the files of remote paths are fetched into the local cache, see isremotepath()),
+//   shardChunks=false (distributed reading: each worker reads and randomizes the chunks assigned to it for the epoch, and only
+//   asks the deserializer for their sequences; see BlockRandomizer.h)
+//
+
+#pragma once
+
+#include "DataReader.h"
+#include "DataDeserializer.h"
+#include "BlockRandomizer.h"
+#include "Sequences.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+class PipelineReader : public IDataReader<ElemType>
+{
+public:
+    PipelineReader()
+        : m_pMBLayout(make_shared<MBLayout>()), m_mbSize(0), m_endOfEpoch(true)
+    {
+    }
+    virtual ~PipelineReader()
+    {
+    }
+
+    virtual void Init(const ConfigParameters& config) override
+    {
+        InitFromConfig(config);
+    }
+    virtual void Init(const ScriptableObjects::IConfigRecord& config) override
+    {
+        InitFromConfig(config);
+    }
+    virtual void Destroy() override
+    {
+        delete this;
+    }
+
+    virtual void StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples = requestDataSize) override
+    {
+        StartDistributedMinibatchLoop(mbSize, epoch, 0, 1, requestedEpochSamples);
+    }
+    virtual bool SupportsDistributedMBRead() const override
+    {
+        return true;
+    }
+    virtual void StartDistributedMinibatchLoop(size_t mbSize, size_t epoch, size_t subsetNum, size_t numSubsets, size_t requestedEpochSamples = requestDataSize) override;
+    virtual bool GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices) override;
+
+    virtual size_t GetNumParallelSequences() override
+    {
+        return m_pMBLayout->GetNumParallelSequences();
+    }
+    virtual void CopyMBLayoutTo(MBLayoutPtr pMBLayout) override
+    {
+        pMBLayout->CopyFrom(m_pMBLayout);
+    }
+    virtual bool DataEnd(EndDataType endDataType) override
+    {
+        // each minibatch ends its sequences
+        return endDataType == endDataSentence || m_endOfEpoch;
+    }
+
+protected:
+    // the deserializer of the reader's format, configured from the reader section
+    virtual IDataDeserializerPtr CreateDeserializer(const ConfigParameters& config) = 0;
+    virtual IDataDeserializerPtr CreateDeserializer(const ScriptableObjects::IConfigRecord& config) = 0;
+
+private:
+    template <class ConfigRecordType>
+    void InitFromConfig(const ConfigRecordType& config);
+    void PackStream(const StreamDescription& stream, Matrix<ElemType>& matrix);
+
+    std::vector<StreamDescription> m_streams;
+    std::unique_ptr<BlockRandomizer> m_randomizer;
+
+    // the current minibatch
+    MBLayoutPtr m_pMBLayout;
+    size_t m_mbSize;
+    bool m_endOfEpoch;
+    std::vector<RandomizedSequence> m_sequences;
+    struct Placement
+    {
+        size_t slot; // parallel sequence
+        size_t begin; // first time step
+    };
+    std::vector<Placement> m_placements; // [sequence]
+    std::vector<float> m_values;         // staging buffer of one stream
+    std::vector<ElemType> m_converted;   // same, as ElemType (unless float)
+};
+
+} } }
@@ -0,0 +1,144 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// RemoteReader.cpp -- reader that receives its minibatches over TCP from data servers
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "RemoteReader.h"
+#include "Config.h"
+#include "ScriptableObjects.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+template <class ElemType>
+template <class ConfigRecordType>
+void RemoteReader<ElemType>::InitFromConfig(const ConfigRecordType& config)
+{
+    const std::string servers = msra::strfun::utf8(config(L"servers", L""));
+    m_servers.clear();
+    size_t begin = 0;
+    for (;;)
+    {
+        begin = servers.find_first_not_of(", \t", begin);
+        if (begin == std::string::npos)
+            break;
+        const size_t end = std::min(servers.find_first_of(", \t", begin), servers.size());
+        m_servers.push_back(servers.substr(begin, end - begin));
+        begin = end;
+    }
+    if (m_servers.empty())
+        InvalidArgument("RemoteReader: No data servers given (servers=host:port,...).");
+
+    m_prefetchMinibatches = config(L"prefetchMinibatches", (size_t) 4);
+    if (m_prefetchMinibatches == 0)
+        InvalidArgument("RemoteReader: prefetchMinibatches must be at least 1.");
+    m_connectTimeout = config(L"connectTimeout", (size_t) 300);
+    m_traceLevel = config(L"traceLevel", 0);
+}
+
+template <class ElemType>
+void RemoteReader<ElemType>::StartDistributedMinibatchLoop(size_t mbSize, size_t epoch, size_t subsetNum, size_t numSubsets, size_t requestedEpochSamples)
+{
+    if (mbSize == 0)
+        InvalidArgument("RemoteReader: the minibatch size must not be 0.");
+    const EpochRequest request = {mbSize, epoch, subsetNum, numSubsets, requestedEpochSamples};
+    m_request = request;
+
+    const size_t serverIndex = subsetNum % m_servers.size();
+    if (!m_socket || serverIndex != m_serverIndex)
+    {
+        m_socket.reset();
+        m_socket = DataSocket::Connect(m_servers[serverIndex], m_connectTimeout);
+        m_serverIndex = serverIndex;
+        if (m_traceLevel > 0)
+            fprintf(stderr, "RemoteReader: Worker %d of %d reads from data server %s.\n", (int) subsetNum, (int) numSubsets, m_servers[serverIndex].c_str());
+    }
+
+    m_generation++;
+    m_epochRequested = false;
+    m_numMinibatches = 0;
+    m_endOfEpoch = false;
+    // with the inputs of the previous epoch, so that the server starts reading right away; GetMinibatch() asks again if they differ
+    if (!m_inputs.empty())
+        SendStartEpoch();
+}
+
+template <class ElemType>
+void RemoteReader<ElemType>::SendStartEpoch()
+{
+    DataMessage message;
+    message.Put(m_request.mbSize);
+    message.Put(m_request.epoch);
+    message.Put(m_request.subsetNum);
+    message.Put(m_request.numSubsets);
+    message.Put(m_request.requestedEpochSamples);
+    message.Put(m_prefetchMinibatches);
+    message.Put(sizeof(ElemType));
+    message.Put(m_inputs.size());
+    for (const auto& input : m_inputs)
+    {
+        message.PutString(msra::strfun::utf8(input.first));
+        message.Put(input.second);
+    }
+    message.Send(*m_socket, DataServerStartEpoch, m_generation);
+    m_epochRequested = true;
+}
+
+template <class ElemType>
+bool RemoteReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices)
+{
+    if (m_endOfEpoch)
+        return false;
+    if (!m_socket)
+        LogicError("RemoteReader: GetMinibatch() called before StartMinibatchLoop().");
+
+    std::vector<std::pair<std::wstring, bool>> inputs;
+    for (const auto& input : matrices)
+        inputs.push_back(std::make_pair(input.first, input.second->GetMatrixType() == SPARSE));
+    if (!m_epochRequested || inputs != m_inputs)
+    {
+        if (m_numMinibatches > 0)
+            LogicError("RemoteReader: The inputs must not change within an epoch.");
+        if (m_epochRequested) // the guess from the previous epoch was wrong: start over
+            m_generation++;
+        m_inputs = inputs;
+        SendStartEpoch();
+    }
+
+    for (;;)
+    {
+        uint64_t tag, generation;
+        if (!m_socket->ReceiveMessageOrEnd(tag, generation, m_payload))
+            RuntimeError("RemoteReader: Data server %s closed the connection.", m_servers[m_serverIndex].c_str());
+        if (generation != m_generation) // the rest of an earlier epoch
+            continue;
+
+        DataMessageReader message(m_payload);
+        if (tag == DataServerMinibatch)
+        {
+            UnpackDataServerMinibatch(message, matrices, *m_pMBLayout);
+            m_numMinibatches++;
+            DataMessage credit;
+            credit.Put(1);
+            credit.Send(*m_socket, DataServerCredit, m_generation);
+            return true;
+        }
+        else if (tag == DataServerEndOfEpoch)
+        {
+            m_endOfEpoch = true;
+            return false;
+        }
+        else if (tag == DataServerError)
+            RuntimeError("RemoteReader: Data server %s failed: %s", m_servers[m_serverIndex].c_str(), message.GetString().c_str());
+        else
+            RuntimeError("RemoteReader: Unexpected message %d from data server %s.", (int) tag, m_servers[m_serverIndex].c_str());
+    }
+}
+
+template class RemoteReader<float>;
+template class RemoteReader<double>;
+
+} } }
@@ -0,0 +1,111 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// RemoteReader.h -- reader that receives its minibatches over TCP from data servers (CNTK action serveData, see DataServer.h)
+//
+
+#pragma once
+
+#include "DataServer.h"
+#include "DataReader.h"
+#include "Sequences.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// RemoteReader -- minibatches read by another process, e.g. on a machine with the data and spare cores
+// Configuration:
+//   servers=host:port[,host:port...] -- the data servers; worker (subset) r of a distributed epoch reads from server r % #servers,
+//                                      whose reader for this connection then reads subset r of numSubsets
+//   prefetchMinibatches=4            -- how many minibatches a server may read ahead of the trainer
+//   connectTimeout=300               -- seconds to keep trying while a server is not up yet
+// The servers must run with the same precision. The minibatch layout and the matrices that the network asks for are forwarded;
+// anything else a reader may provide (lattices for sequence training, HMMs, label mappings) is not.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+class RemoteReader : public IDataReader<ElemType>
+{
+public:
+    RemoteReader()
+        : m_prefetchMinibatches(4), m_connectTimeout(300), m_traceLevel(0), m_serverIndex(SIZE_MAX),
+          m_generation(0), m_epochRequested(false), m_numMinibatches(0), m_endOfEpoch(true), m_pMBLayout(make_shared<MBLayout>())
+    {
+    }
+    virtual ~RemoteReader()
+    {
+    }
+
+    virtual void Init(const ConfigParameters& config) override
+    {
+        InitFromConfig(config);
+    }
+    virtual void Init(const ScriptableObjects::IConfigRecord& config) override
+    {
+        InitFromConfig(config);
+    }
+    virtual void Destroy() override
+    {
+        delete this;
+    }
+
+    virtual void StartMinibatchLoop(size_t mbSize, size_t epoch, size_t requestedEpochSamples = requestDataSize) override
+    {
+        StartDistributedMinibatchLoop(mbSize, epoch, 0, 1, requestedEpochSamples);
+    }
+    virtual bool SupportsDistributedMBRead() const override
+    {
+        return true;
+    }
+    virtual void StartDistributedMinibatchLoop(size_t mbSize, size_t epoch, size_t subsetNum, size_t numSubsets, size_t requestedEpochSamples = requestDataSize) override;
+    virtual bool GetMinibatch(std::map<std::wstring, Matrix<ElemType>*>& matrices) override;
+
+    virtual size_t GetNumParallelSequences() override
+    {
+        return m_pMBLayout->GetNumParallelSequences();
+    }
+    virtual void CopyMBLayoutTo(MBLayoutPtr pMBLayout) override
+    {
+        pMBLayout->CopyFrom(m_pMBLayout);
+    }
+    virtual bool DataEnd(EndDataType endDataType) override
+    {
+        // each minibatch ends its sequences, as far as the client can tell
+        return endDataType == endDataSentence || m_endOfEpoch;
+    }
+
+private:
+    template <class ConfigRecordType>
+    void InitFromConfig(const ConfigRecordType& config);
+    void SendStartEpoch();
+
+    std::vector<std::string> m_servers;
+    size_t m_prefetchMinibatches;
+    size_t m_connectTimeout;
+    int m_traceLevel;
+
+    std::unique_ptr<DataSocket> m_socket;
+    size_t m_serverIndex; // into m_servers, of m_socket
+
+    // the current epoch
+    struct EpochRequest
+    {
+        size_t mbSize, epoch, subsetNum, numSubsets, requestedEpochSamples;
+    };
+    EpochRequest m_request;
+    uint64_t m_generation;                         // of the current epoch, see DataServer.h
+    bool m_epochRequested;                         // whether the server was sent m_request
+    size_t m_numMinibatches;                       // received in the current epoch
+    std::vector<std::pair<std::wstring, bool>> m_inputs; // the inputs requested from the server, and whether they are sparse
+    bool m_endOfEpoch;
+
+    MBLayoutPtr m_pMBLayout;
+    std::vector<char> m_payload; // of the message being received
+};
+
+} } }
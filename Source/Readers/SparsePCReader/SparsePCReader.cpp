@@ -39,22 +39,13 @@ SparsePCReader<ElemType>::~SparsePCReader()
 
     CloseHandle(m_hndl);
 
+    // (m_rowIndices and m_colIndices point into the buffer of m_values)
     for (int i = 0; i < m_featureCount; i++)
     {
         if (m_values[i] != NULL)
         {
             free(m_values[i]);
         }
-
-        if (m_rowIndices[i] != NULL)
-        {
-            free(m_rowIndices[i]);
-        }
-
-        if (m_colIndices[i] != NULL)
-        {
-            free(m_colIndices[i]);
-        }
     }
 
     if (m_labelsBuffer != NULL)
@@ -112,6 +103,7 @@ void SparsePCReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConf
     m_values = std::vector<ElemType*>(m_featureCount);
     m_rowIndices = std::vector<int32_t*>(m_featureCount);
     m_colIndices = std::vector<int32_t*>(m_featureCount);
+    m_labelsBuffer = NULL;
 
     for (int i = 0; i < m_featureCount; i++)
     {
@@ -156,21 +148,22 @@ void SparsePCReader<ElemType>::StartMinibatchLoop(size_t mbSize, size_t /*epoch*
     {
         m_miniBatchSize = mbSize;
 
+        // one buffer per feature, laid out as Matrix::SetMatrixFromCSCBuffer() expects: values, row indices, column starts
+        // We parse straight into it, and the matrix takes it over with a single copy.
         for (int i = 0; i < m_featureCount; i++)
         {
             if (m_values[i] != NULL)
-            {
                 free(m_values[i]);
-                free(m_colIndices[i]);
-                free(m_rowIndices[i]);
-                free(m_labelsBuffer);
-            }
 
-            m_values[i] = (ElemType*) malloc(sizeof(ElemType) * m_dims[i] * m_miniBatchSize / m_sparsenessFactor);
-            m_rowIndices[i] = (int32_t*) malloc(sizeof(int32_t) * m_dims[i] * m_miniBatchSize / m_sparsenessFactor);
-            m_colIndices[i] = (int32_t*) malloc(sizeof(int32_t) * (m_miniBatchSize + 1));
-            m_labelsBuffer = (ElemType*) malloc(sizeof(ElemType) * m_miniBatchSize);
+            const size_t maxNNz = MaxNNz(i);
+            m_values[i] = (ElemType*) malloc((sizeof(ElemType) + sizeof(int32_t)) * maxNNz + sizeof(int32_t) * (m_miniBatchSize + 1));
+            m_rowIndices[i] = (int32_t*) (m_values[i] + maxNNz);
+            m_colIndices[i] = m_rowIndices[i] + maxNNz;
         }
+
+        if (m_labelsBuffer != NULL)
+            free(m_labelsBuffer);
+        m_labelsBuffer = (ElemType*) malloc(sizeof(ElemType) * m_miniBatchSize);
     }
 
     // reset the next read sample
@@ -262,7 +255,7 @@ bool SparsePCReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemTy
         if (features.GetFormat() != MatrixFormat::matrixFormatSparseCSC)
             features.SwitchToMatrixType(MatrixType::SPARSE, MatrixFormat::matrixFormatSparseCSC, false);
 
-        features.SetMatrixFromCSCFormat(m_colIndices[i], m_rowIndices[i], m_values[i], currIndex[i], m_dims[i], j);
+        features.SetMatrixFromCSCBuffer(m_values[i], MaxNNz(i), currIndex[i], m_dims[i], j);
     }
 
     if (m_returnDense || m_doGradientCheck)
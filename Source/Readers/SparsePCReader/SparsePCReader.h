@@ -48,6 +48,12 @@ private:
     std::map<LabelIdType, LabelType> m_mapIdToLabel;
     std::map<LabelType, LabelIdType> m_mapLabelToId;
 
+    // capacity of the CSC buffer of feature i
+    size_t MaxNNz(int i) const
+    {
+        return m_dims[i] * m_miniBatchSize / m_sparsenessFactor;
+    }
+
 public:
     SparsePCReader()
         : m_pMBLayout(make_shared<MBLayout>()){};
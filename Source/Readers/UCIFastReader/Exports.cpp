@@ -9,6 +9,7 @@
 #define DATAREADER_EXPORTS
 #include "DataReader.h"
 #include "UCIFastReader.h"
+#include "UCIDeserializer.h"
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -26,4 +27,14 @@ extern "C" DATAREADER_API void GetReaderD(IDataReader<double>** preader)
 {
     GetReader(preader);
 }
+
+// the same format in the composable reader pipeline (pipeline=true)
+extern "C" DATAREADER_API void GetPipelineReaderF(IDataReader<float>** preader)
+{
+    *preader = new UCIPipelineReader<float>();
+}
+extern "C" DATAREADER_API void GetPipelineReaderD(IDataReader<double>** preader)
+{
+    *preader = new UCIPipelineReader<double>();
+}
 } } }
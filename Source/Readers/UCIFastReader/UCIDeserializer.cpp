@@ -0,0 +1,206 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// UCIDeserializer.cpp -- the UCIFastReader format as a deserializer of the reader pipeline
+//
+
+#include "stdafx.h"
+#include "Basics.h"
+#include "Config.h"
+#include "ScriptableObjects.h"
+#include "fileutil.h"
+#include "UCIDeserializer.h"
+#include <stdlib.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// split a line into its fields at spaces and tabs, in place
+static void SplitFields(char* line, std::vector<const char*>& fields)
+{
+    fields.clear();
+    for (char* p = line; *p;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            *p++ = 0;
+        if (!*p)
+            break;
+        fields.push_back(p);
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+    }
+}
+
+static float ParseField(const char* field, size_t lineIndex)
+{
+    char* end;
+    const float value = strtof(field, &end);
+    if (*end)
+        RuntimeError("UCIDeserializer: sample %d: '%s' is not a number.", (int) lineIndex + 1, field);
+    return value;
+}
+
+template <class ConfigRecordType>
+UCIDeserializer::UCIDeserializer(const ConfigRecordType& config)
+{
+    std::vector<std::wstring> featureNames, labelNames;
+    GetFileConfigNames(config, featureNames, labelNames);
+    if (featureNames.size() != 1 || labelNames.size() > 1)
+        InvalidArgument("UCIDeserializer: expected one features section, and at most one labels section.");
+    const ConfigRecordType& features = config(featureNames[0]);
+    m_file = (const wstring&) features(L"file");
+    m_featureStart = features(L"start", (size_t) 0);
+    m_featureDim = features(L"dim");
+    m_streams.push_back(StreamDescription{featureNames[0], 0, StorageType::dense, m_featureDim});
+
+    m_labelType = LabelType::none;
+    m_labelStart = m_labelFields = 0;
+    if (!labelNames.empty())
+    {
+        const ConfigRecordType& labels = config(labelNames[0]);
+        if (labels(L"file", m_file) != m_file)
+            RuntimeError("UCIDeserializer: features and labels must be in the same file.");
+        const wstring labelType = labels(L"labelType", L"category");
+        m_labelStart = labels(L"start", (size_t) 0);
+        if (!_wcsicmp(labelType.c_str(), L"category"))
+        {
+            m_labelType = LabelType::category;
+            m_labelFields = 1;
+            const wstring labelMappingFile = labels(L"labelMappingFile");
+            if (!fexists(labelMappingFile))
+                RuntimeError("UCIDeserializer: label mapping file %ls not found; it can be created with UCIFastReader's 'createLabelMap' action.", labelMappingFile.c_str());
+            for (const auto& line : msra::files::fgetfilelines(labelMappingFile))
+            {
+                const size_t begin = line.find_first_not_of(" \t\r");
+                if (begin == string::npos)
+                    continue;
+                m_labelIds.insert(make_pair(line.substr(begin, line.find_last_not_of(" \t\r") + 1 - begin), m_labelIds.size()));
+            }
+            const size_t labelDim = max((size_t) labels(L"labelDim", (size_t) 0), m_labelIds.size());
+            m_streams.push_back(StreamDescription{labelNames[0], 1, StorageType::category, labelDim});
+        }
+        else if (!_wcsicmp(labelType.c_str(), L"regression"))
+        {
+            m_labelType = LabelType::regression;
+            m_labelFields = labels(L"dim");
+            m_streams.push_back(StreamDescription{labelNames[0], 1, StorageType::dense, m_labelFields});
+        }
+        else if (_wcsicmp(labelType.c_str(), L"none"))
+            InvalidArgument("UCIDeserializer: labelType must be category, regression, or none.");
+    }
+
+    // one pass over the file, to find the chunks' lines
+    const size_t chunkSize = config(L"chunkSizeInSamples", (size_t) 100000);
+    if (chunkSize == 0)
+        InvalidArgument("UCIDeserializer: chunkSizeInSamples must not be 0.");
+    FILE* f = fopenOrDie(m_file, L"rb");
+    std::vector<char> buffer(1000000);
+    size_t numSamples = 0;
+    for (;;)
+    {
+        const uint64_t offset = fgetpos(f);
+        fgetline(f, buffer.data(), (int) buffer.size());
+        if (buffer[0] == 0 && feof(f))
+            break;
+        if (strspn(buffer.data(), " \t\r") == strlen(buffer.data())) // (empty lines are skipped)
+            continue;
+        if (numSamples % chunkSize == 0)
+        {
+            m_chunkOffsets.push_back(offset);
+            m_chunkFirstSamples.push_back(numSamples);
+        }
+        numSamples++;
+    }
+    fclose(f);
+    m_chunkFirstSamples.push_back(numSamples);
+    fprintf(stderr, "UCIDeserializer: %d samples in %d chunks in %ls\n", (int) numSamples, (int) m_chunkOffsets.size(), m_file.c_str());
+}
+
+template UCIDeserializer::UCIDeserializer(const ConfigParameters& config);
+template UCIDeserializer::UCIDeserializer(const ScriptableObjects::IConfigRecord& config);
+
+std::vector<ChunkDescription> UCIDeserializer::GetChunkDescriptions() const
+{
+    std::vector<ChunkDescription> chunks;
+    for (size_t c = 0; c < m_chunkOffsets.size(); c++)
+    {
+        const size_t numSamples = m_chunkFirstSamples[c + 1] - m_chunkFirstSamples[c];
+        chunks.push_back(ChunkDescription{c, numSamples, numSamples});
+    }
+    return chunks;
+}
+
+void UCIDeserializer::GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const
+{
+    for (size_t s = m_chunkFirstSamples[chunkId]; s < m_chunkFirstSamples[chunkId + 1]; s++)
+        sequences.push_back(SequenceDescription{s, 1, chunkId});
+}
+
+// the parsed lines of one chunk
+class UCIChunk : public Chunk
+{
+public:
+    size_t m_firstSample;
+    size_t m_featureDim, m_labelDim;
+    std::vector<float> m_features;  // [sample * m_featureDim + i]
+    std::vector<float> m_labels;    // (regression) [sample * m_labelDim + i]
+    std::vector<size_t> m_classes;  // (category) [sample]
+
+    virtual void CopyDenseSequence(size_t sequenceId, size_t streamId, float* values, size_t /*colStride: one sample*/) const override
+    {
+        const size_t sample = sequenceId - m_firstSample;
+        if (streamId == 0)
+            memcpy(values, &m_features[sample * m_featureDim], m_featureDim * sizeof(float));
+        else
+            memcpy(values, &m_labels[sample * m_labelDim], m_labelDim * sizeof(float));
+    }
+    virtual void CopyCategorySequence(size_t sequenceId, size_t /*streamId*/, size_t* categories) const override
+    {
+        categories[0] = m_classes[sequenceId - m_firstSample];
+    }
+};
+
+ChunkPtr UCIDeserializer::GetChunk(size_t chunkId)
+{
+    auto chunk = make_shared<UCIChunk>();
+    chunk->m_firstSample = m_chunkFirstSamples[chunkId];
+    chunk->m_featureDim = m_featureDim;
+    chunk->m_labelDim = m_labelFields;
+    const size_t numSamples = m_chunkFirstSamples[chunkId + 1] - chunk->m_firstSample;
+    chunk->m_features.reserve(numSamples * m_featureDim);
+
+    FILE* f = fopenOrDie(m_file, L"rb"); // (own handle, since chunks are paged in concurrently)
+    fsetpos(f, m_chunkOffsets[chunkId]);
+    std::vector<char> buffer(1000000);
+    std::vector<const char*> fields;
+    for (size_t sample = chunk->m_firstSample; sample < chunk->m_firstSample + numSamples;)
+    {
+        fgetline(f, buffer.data(), (int) buffer.size());
+        if (buffer[0] == 0 && feof(f))
+            RuntimeError("UCIDeserializer: %ls ended early; was it changed?", m_file.c_str());
+        SplitFields(buffer.data(), fields);
+        if (fields.empty())
+            continue;
+        if (fields.size() < m_featureStart + m_featureDim || fields.size() < m_labelStart + m_labelFields)
+            RuntimeError("UCIDeserializer: sample %d has only %d fields.", (int) sample + 1, (int) fields.size());
+        for (size_t i = 0; i < m_featureDim; i++)
+            chunk->m_features.push_back(ParseField(fields[m_featureStart + i], sample));
+        if (m_labelType == LabelType::category)
+        {
+            auto iter = m_labelIds.find(fields[m_labelStart]);
+            if (iter == m_labelIds.end())
+                RuntimeError("UCIDeserializer: sample %d: label '%s' is not in the label mapping file.", (int) sample + 1, fields[m_labelStart]);
+            chunk->m_classes.push_back(iter->second);
+        }
+        else if (m_labelType == LabelType::regression)
+        {
+            for (size_t i = 0; i < m_labelFields; i++)
+                chunk->m_labels.push_back(ParseField(fields[m_labelStart + i], sample));
+        }
+        sample++;
+    }
+    fclose(f);
+    return chunk;
+}
+
+} } }
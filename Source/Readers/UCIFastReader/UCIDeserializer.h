@@ -0,0 +1,73 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// UCIDeserializer.h -- the UCIFastReader format as a deserializer of the reader pipeline (pipeline=true, see PipelineReader.h)
+//
+
+#pragma once
+
+#include "DataDeserializer.h"
+#include "PipelineReader.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// -----------------------------------------------------------------------
+// UCIDeserializer -- one sample per line of a text file, its features and label being fields of the line (separated by spaces or tabs)
+// The configuration is that of UCIFastReader: a features section (file, start, dim) and a labels section (start, dim, labelType=category
+// with labelDim and labelMappingFile, regression, or none) of the same file. Each sample is a sequence of its own; each chunk is
+// chunkSizeInSamples (default 100000) consecutive lines, which are parsed when it is paged in. Label maps are not created.
+// -----------------------------------------------------------------------
+
+class UCIDeserializer : public IDataDeserializer
+{
+public:
+    template <class ConfigRecordType>
+    UCIDeserializer(const ConfigRecordType& config);
+
+    virtual std::vector<StreamDescription> GetStreamDescriptions() const override
+    {
+        return m_streams;
+    }
+    virtual std::vector<ChunkDescription> GetChunkDescriptions() const override;
+    virtual void GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const override;
+    virtual ChunkPtr GetChunk(size_t chunkId) override;
+
+private:
+    enum class LabelType
+    {
+        none,
+        category,
+        regression
+    };
+
+    std::wstring m_file;
+    size_t m_featureStart, m_featureDim; // fields of the features
+    LabelType m_labelType;
+    size_t m_labelStart, m_labelFields; // fields of the label (one for a category)
+    std::map<std::string, size_t> m_labelIds; // (category) [label] its class
+    std::vector<StreamDescription> m_streams; // features, and labels unless none
+
+    std::vector<uint64_t> m_chunkOffsets;     // [chunk] file offset of its first line
+    std::vector<size_t> m_chunkFirstSamples; // [chunk] its first sample; one more for the end
+};
+
+// UCIPipelineReader - the pipeline reader for the UCIFastReader format, exported as GetPipelineReaderF/D
+template <class ElemType>
+class UCIPipelineReader : public PipelineReader<ElemType>
+{
+protected:
+    virtual IDataDeserializerPtr CreateDeserializer(const ConfigParameters& config) override
+    {
+        return make_shared<UCIDeserializer>(config);
+    }
+    virtual IDataDeserializerPtr CreateDeserializer(const ScriptableObjects::IConfigRecord& config) override
+    {
+        return make_shared<UCIDeserializer>(config);
+    }
+};
+
+} } }
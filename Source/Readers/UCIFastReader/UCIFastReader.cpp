@@ -101,6 +101,14 @@ bool UCIFastReader<ElemType>::EnsureDataAvailable(size_t mbStartSample, bool end
         m_labelData.resize(epochSample);
     }
 
+    // remember where this read starts, so that SetState() can repeat it
+    m_readStartSample = mbStartSample;
+    m_readStartPosition = m_parser.GetRecordPosition();
+    m_readStartTotalSamples = m_totalSamples;
+    m_readStartEpochSize = m_epochSize;
+    m_readStartRandomizeRange = m_randomizeRange;
+    m_readStartEndReached = m_endReached;
+
     int recordsRead = 0;
     do
     {
@@ -317,8 +325,12 @@ void UCIFastReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfi
     m_labelType = labelCategory;
     m_featureCount = vdim;
     m_readNextSample = 0;
+    m_readStartSample = SIZE_MAX;
+    m_hasPrefetchState = false;
     m_traceLevel = readerConfig(L"traceLevel", 0);
     m_parser.SetTraceLevel(m_traceLevel);
+    size_t numParseThreads = readerConfig(L"numParseThreads", (size_t) 1);
+    m_parser.SetNumThreads(numParseThreads);
 
     m_prefetchEnabled = readerConfig(L"prefetch", false);
     // set the feature count to at least one (we better have one feature...)
@@ -384,6 +396,9 @@ void UCIFastReader<ElemType>::InitFromConfig(const ConfigRecordType& readerConfi
 
     // Simple heuristic to ensure buffer size and avoid breaking existing experiments.
     size_t bufSize = max(dimFeatures * 16, (size_t) 256 * 1024);
+    // parsing on multiple threads needs a buffer that holds enough lines to share out
+    if (numParseThreads > 1)
+        bufSize = max(bufSize, numParseThreads * 4 * 1024 * 1024);
     m_parser.ParseInit(file.c_str(), startFeatures, dimFeatures, startLabels, dimLabels, bufSize);
 
     // if we have labels, we need a label Mapping file, it will be a file with one label per line
@@ -482,6 +497,9 @@ void UCIFastReader<ElemType>::InitCache(const ConfigParameters& readerConfig)
             // mmodify the config so the reader types look correct
             config["readerType"] = config("writerType");
             config["file"] = filesList;
+            // this reader randomizes by default, so should the cache (it does so by chunks)
+            if (!config.Exists(L"randomize"))
+                config["randomize"] = string("auto");
             m_cachingReader = new DataReader<ElemType>(config);
         }
         else
@@ -550,6 +568,8 @@ void UCIFastReader<ElemType>::ReleaseMemory()
 template <class ElemType>
 void UCIFastReader<ElemType>::SetupEpoch()
 {
+    m_readStartSample = SIZE_MAX; // (no read in this epoch yet)
+
     // if we are starting fresh (epoch zero and no data read), init everything
     // however if we are using cachingWriter, we need to know record count, so do that first
     if (m_epoch == 0 && m_totalSamples == 0 && m_cachingWriter != NULL)
@@ -785,6 +805,7 @@ bool UCIFastReader<ElemType>::GetMinibatch(std::map<std::wstring, Matrix<ElemTyp
     // Fire a new prefetch if there are any minibatches remaining
     if (minibatchesRemaining && m_prefetchEnabled)
     {
+        m_hasPrefetchState = GetCurrentState(m_prefetchState);
         Matrix<ElemType>& features = *matrices[m_featuresName];
         int deviceId = features.GetDeviceId();
         m_pendingAsyncGetMinibatch = std::async(std::launch::async, [this, deviceId]()
@@ -1084,23 +1105,80 @@ bool UCIFastReader<ElemType>::DataEnd(EndDataType endDataType)
     return ret;
 }
 
+// GetCurrentState - the position after the minibatch last read: the next minibatch's sample, and the last read from the file that is still in use
+// This is only possible if the last read was in this epoch (so that it is known where it started) and the label mapping does not change while reading.
 template <class ElemType>
-unique_ptr<CUDAPageLockedMemAllocator>& UCIFastReader<ElemType>::GetCUDAAllocator(int deviceID)
+bool UCIFastReader<ElemType>::GetCurrentState(ReaderState& state)
 {
-    if (m_cudaAllocator != nullptr)
-    {
-        if (m_cudaAllocator->GetDeviceId() != deviceID)
-        {
-            m_cudaAllocator.reset(nullptr);
-        }
-    }
+    if (m_cachingReader || m_cachingWriter || !m_labelFileToWrite.empty() || m_readStartSample == SIZE_MAX)
+        return false;
+
+    state.clear();
+    state[L"position"] = {m_epochStartSample, m_mbStartSample};
+    state[L"lastRead"] = {m_readStartSample, (size_t) m_readStartPosition, m_readStartTotalSamples, m_readStartEpochSize, m_readStartRandomizeRange, (size_t) (m_readStartEndReached ? 1 : 0)};
+    return true;
+}
 
-    if (m_cudaAllocator == nullptr)
+// GetState - position after the minibatch last returned; with prefetching, the reader is already past it, so this is the position before the prefetch
+template <class ElemType>
+bool UCIFastReader<ElemType>::GetState(ReaderState& state)
+{
+    if (m_pendingAsyncGetMinibatch.valid())
     {
-        m_cudaAllocator.reset(new CUDAPageLockedMemAllocator(deviceID));
+        state = m_prefetchState;
+        return m_hasPrefetchState;
     }
+    return GetCurrentState(state);
+}
 
-    return m_cudaAllocator;
+// SetState - continue from a position obtained through GetState(), after StartMinibatchLoop() for the same epoch
+// This seeks to the last read from the file and repeats it, which gives the data of the current randomization range (or minibatch).
+template <class ElemType>
+bool UCIFastReader<ElemType>::SetState(const ReaderState& state)
+{
+    if (m_cachingReader || m_cachingWriter || !m_labelFileToWrite.empty())
+        return false;
+
+    auto position = state.find(L"position");
+    auto lastRead = state.find(L"lastRead");
+    if (position == state.end() || position->second.size() != 2 || lastRead == state.end() || lastRead->second.size() != 6)
+        InvalidArgument("UCIFastReader: Invalid reader state.");
+    if (position->second[0] != m_epochStartSample)
+        InvalidArgument("UCIFastReader: The reader state is for an epoch starting at sample %d, but this epoch starts at sample %d.", (int) position->second[0], (int) m_epochStartSample);
+
+    // drop a prefetched minibatch
+    if (m_pendingAsyncGetMinibatch.valid())
+        m_pendingAsyncGetMinibatch.get();
+
+    // restore the dataset variables to what they were before the last read, position the parser there, and read again
+    const auto& values = lastRead->second;
+    const size_t readStartSample = values[0];
+    m_totalSamples = values[2];
+    m_epochSize = values[3];
+    m_randomizeRange = values[4];
+    m_endReached = values[5] != 0;
+    if (Randomize() && m_randomizeRange != randomizeAuto)
+        m_randomordering.Resize(m_randomizeRange, m_randomizeRange); // (this also makes the read below cover the entire randomization range)
+
+    const size_t epochSample = readStartSample % m_epochSize;
+    m_featureData.resize(epochSample * m_featureCount); // (samples before the read are not used anymore)
+    if (m_labelType == labelCategory)
+        m_labelIdData.resize(epochSample);
+    if (m_labelType != labelNone)
+        m_labelData.resize(epochSample);
+    m_parser.SetFilePosition((int64_t) values[1]);
+    m_readNextSample = readStartSample;
+    EnsureDataAvailable(readStartSample);
+
+    m_mbStartSample = position->second[1];
+    return true;
+}
+
+// staging buffers for host-to-device copies come out of the device's shared page-locked arena
+template <class ElemType>
+MemAllocator* UCIFastReader<ElemType>::GetCUDAAllocator(int deviceID)
+{
+    return &CUDAPageLockedMemArena::GetSharedArena(deviceID);
 }
 
 template <class ElemType>
@@ -83,6 +83,18 @@ private:
     bool m_endReached;
     int m_traceLevel;
 
+    // the last read from the file in this epoch, from which SetState() reads again: its first sample (SIZE_MAX: none yet),
+    // the file position of that sample, and the dataset variables as they were before the read
+    size_t m_readStartSample;
+    int64_t m_readStartPosition;
+    size_t m_readStartTotalSamples;
+    size_t m_readStartEpochSize;
+    size_t m_readStartRandomizeRange;
+    bool m_readStartEndReached;
+    ReaderState m_prefetchState; // GetState() before the prefetch in flight
+    bool m_hasPrefetchState;
+    bool GetCurrentState(ReaderState& state);
+
     // feature and label data are parallel arrays
     std::vector<ElemType> m_featureData;
     std::vector<LabelIdType> m_labelIdData;
@@ -99,7 +111,6 @@ private:
         */
     bool mOneLinePerFile;
 
-    unique_ptr<CUDAPageLockedMemAllocator> m_cudaAllocator;
 
     // caching support
     DataReader<ElemType>* m_cachingReader;
@@ -124,7 +135,7 @@ private:
     virtual bool ReadRecord(size_t readSample);
 
     // Helper functions
-    unique_ptr<CUDAPageLockedMemAllocator>& GetCUDAAllocator(int deviceID);
+    MemAllocator* GetCUDAAllocator(int deviceID);
     std::shared_ptr<ElemType> AllocateIntermediateBuffer(int deviceID, size_t numElements);
 
 public:
@@ -182,5 +193,8 @@ public:
     {
         NOT_IMPLEMENTED;
     }
+
+    virtual bool GetState(ReaderState& state) override;
+    virtual bool SetState(const ReaderState& state) override;
 };
 } } }
@@ -10,6 +10,7 @@
 #include "UCIParser.h"
 #include <stdexcept>
 #include <stdint.h>
+#include <string.h>
 
 #if WIN32
 #define ftell64 _ftelli64
@@ -235,6 +236,7 @@ void UCIParser<NumType, LabelType>::Init()
     PrepareStartPosition(0);
     m_fileBuffer = NULL;
     m_pFile = NULL;
+    m_numThreads = 1;
     m_stateTable = new DWORD[AllStateMax * 256];
     SetupStateTables();
 }
@@ -439,13 +441,11 @@ size_t UCIParser<NumType, LabelType>::UpdateBuffer()
     size_t saveBytes = m_byteCounter - m_spaceDelimitedStart;
     assert(saveBytes < m_bufferSize);
     if (saveBytes)
-    {
         memcpy_s(m_fileBuffer, m_bufferSize, &m_fileBuffer[m_byteCounter - m_bufferStart - saveBytes], saveBytes);
-        m_bufferStart = m_byteCounter - saveBytes;
-    }
+    m_bufferStart = m_byteCounter - saveBytes;
 
     // read the next block
-    size_t bytesToRead = min(m_bufferSize, m_fileSize - m_bufferStart) - saveBytes;
+    size_t bytesToRead = std::min(m_bufferSize, m_fileSize - m_bufferStart) - saveBytes;
     size_t bytesRead = fread(m_fileBuffer + saveBytes, 1, bytesToRead, m_pFile);
     if (bytesRead == 0 && ferror(m_pFile))
         RuntimeError("UCIParser::UpdateBuffer - error reading file");
@@ -479,6 +479,307 @@ void UCIParser<NumType, LabelType>::SetTraceLevel(int traceLevel)
     m_traceLevel = traceLevel;
 }
 
+// SetNumThreads - Set the number of threads used to parse complete lines in the buffer
+template <typename NumType, typename LabelType>
+void UCIParser<NumType, LabelType>::SetNumThreads(size_t numThreads)
+{
+    m_numThreads = std::max(numThreads, (size_t) 1);
+}
+
+// TraceProgress - print progress dots for the record just completed
+template <typename NumType, typename LabelType>
+void UCIParser<NumType, LabelType>::TraceProgress(long recordCount)
+{
+    if (m_traceLevel > 1 && recordCount % 100 == 0)
+    {
+        if (recordCount % 10000 == 0)
+            fprintf(stderr, "#");
+        else if (recordCount % 1000 == 0)
+            fprintf(stderr, "+");
+        else
+            fprintf(stderr, ".");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// bulk parsing of complete lines
+// Parse() hands over to this whenever the state machine is at the start of a line. It finds the ends of the lines in the buffer
+// with memchr(), and converts the lines in parallel ranges, with results identical to the state machine:
+//  - a line is split into tokens at ' ', '\t', and '\r'; every byte that is not one of these or '\n' belongs to a token
+//  - a token is a number if it has the syntax [-+]digits[.digits][(e|E)[-+]digits]; the digits are accumulated in doubles like the state machine does
+//    (a leading '+' on the first token of a line is not a sign, since the state machine treats it as a label character after a newline)
+//  - incomplete numbers ("-", "1.", "1e", "1e-") are skipped without counting as an element
+//  - all other tokens are labels
+//  - a '\n' completes a record unless it directly follows another '\n', i.e. empty lines are skipped
+// ---------------------------------------------------------------------------
+
+// character classes for the bulk parser
+enum CharClass
+{
+    CharOther = 0,
+    CharDigit = 1,
+    CharWhitespace = 2,
+    CharNewline = 3
+};
+
+static const struct CharClassTable
+{
+    unsigned char table[256];
+    CharClassTable()
+    {
+        memset(table, CharOther, sizeof(table));
+        for (int ch = '0'; ch <= '9'; ch++)
+            table[ch] = CharDigit;
+        table[' '] = table['\t'] = table['\r'] = CharWhitespace;
+        table['\n'] = CharNewline;
+    }
+} s_charClasses;
+
+static inline bool IsDigit(char ch)
+{
+    return s_charClasses.table[(unsigned char) ch] == CharDigit;
+}
+
+// ConvertToken - classify a token [begin, end) and convert it if it is a number
+// atLineStart - the token begins right after a '\n' (a '+' is no sign there)
+template <typename NumType, typename LabelType>
+typename UCIParser<NumType, LabelType>::TokenType UCIParser<NumType, LabelType>::ConvertToken(const char *p, const char *end, bool atLineStart, NumType &value)
+{
+    double wholeNumberMultiplier = 1;
+    double exponentMultiplier = 1;
+    double partialResult = 0;
+    double builtUpNumber = 0;
+    double divider = 0;
+
+    if (*p == '-' || (*p == '+' && !atLineStart))
+    {
+        if (*p == '-')
+            wholeNumberMultiplier = -1;
+        if (++p == end)
+            return TokenNone;
+    }
+    if (!IsDigit(*p))
+        return TokenLabel;
+    for (; p != end && IsDigit(*p); p++)
+        builtUpNumber = builtUpNumber * 10 + (*p - '0');
+
+    bool hasExponent = false;
+    if (p != end && *p == '.')
+    {
+        partialResult = builtUpNumber;
+        divider = 1;
+        builtUpNumber = 0;
+        if (++p == end)
+            return TokenNone;
+        if (!IsDigit(*p))
+            return TokenLabel;
+        for (; p != end && IsDigit(*p); p++)
+        {
+            builtUpNumber = builtUpNumber * 10 + (*p - '0');
+            divider *= 10;
+        }
+    }
+    if (p != end && (*p == 'e' || *p == 'E'))
+    {
+        if (divider != 0) // decimal number
+            partialResult += builtUpNumber / divider;
+        else // integer
+            partialResult = builtUpNumber;
+        builtUpNumber = 0;
+        if (++p == end)
+            return TokenNone;
+        if (*p == '-' || *p == '+')
+        {
+            if (*p == '-')
+                exponentMultiplier = -1;
+            if (++p == end)
+                return TokenNone;
+        }
+        if (!IsDigit(*p))
+            return TokenLabel;
+        for (; p != end && IsDigit(*p); p++)
+            builtUpNumber = builtUpNumber * 10 + (*p - '0');
+        hasExponent = true;
+    }
+    if (p != end)
+        return TokenLabel;
+
+    // same arithmetic and rounding as DoneWithValue()
+    NumType finalResult;
+    if (hasExponent)
+        finalResult = (NumType)(partialResult * pow(10.0, exponentMultiplier * builtUpNumber));
+    else if (divider != 0)
+        finalResult = (NumType)(partialResult + (builtUpNumber / divider));
+    else
+        finalResult = (NumType) builtUpNumber;
+    value = (NumType)(finalResult * wholeNumberMultiplier);
+    return TokenNumber;
+}
+
+// StoreNumericLabel - store a number in a label column, as the number or as its text (see StoreLabel())
+// returns - true if it counts as a number converted
+template <typename NumType, typename LabelType>
+template <typename ValueType>
+bool UCIParser<NumType, LabelType>::StoreNumericLabel(std::vector<ValueType> &labels, NumType value, const char * /*begin*/, const char * /*end*/)
+{
+    labels.push_back((ValueType) value);
+    return true;
+}
+
+template <typename NumType, typename LabelType>
+bool UCIParser<NumType, LabelType>::StoreNumericLabel(std::vector<std::string> &labels, NumType /*value*/, const char *begin, const char *end)
+{
+    labels.push_back(std::string(begin, end));
+    return false;
+}
+
+// StoreStringLabel - handle a token that is not a number (see DoneWithLabel()); returns true if it counts as an element
+template <typename NumType, typename LabelType>
+template <typename ValueType>
+bool UCIParser<NumType, LabelType>::StoreStringLabel(std::vector<ValueType> * /*labels*/, const char *begin, const char *end)
+{
+    std::string label(begin, end);
+    fprintf(stderr, "\n** String found in numeric-only file: %s\n", label.c_str());
+    return true;
+}
+
+template <typename NumType, typename LabelType>
+bool UCIParser<NumType, LabelType>::StoreStringLabel(std::vector<std::string> *labels, const char *begin, const char *end)
+{
+    if (labels == NULL)
+        return false;
+    labels->push_back(std::string(begin, end));
+    return true;
+}
+
+// ParseLines - convert the complete lines [lineBegins[i], lineEnds[i]) for i in [first, last); thread-safe, as it only writes to its arguments
+template <typename NumType, typename LabelType>
+void UCIParser<NumType, LabelType>::ParseLines(size_t first, size_t last, std::vector<NumType> &numbers, std::vector<LabelType> *labels, int64_t &numbersConverted) const
+{
+    for (size_t i = first; i < last; i++)
+    {
+        const char *lineBegin = m_lineBegins[i];
+        const char *lineEnd = m_lineEnds[i];
+        size_t elementsConverted = 0;
+        for (const char *p = lineBegin;;)
+        {
+            // skip whitespace, then find the end of the token
+            while (p != lineEnd && s_charClasses.table[(unsigned char) *p] == CharWhitespace)
+                p++;
+            if (p == lineEnd)
+                break;
+            const char *tokenBegin = p;
+            while (p != lineEnd && s_charClasses.table[(unsigned char) *p] != CharWhitespace)
+                p++;
+
+            NumType value;
+            TokenType tokenType = ConvertToken(tokenBegin, p, tokenBegin == lineBegin, value);
+            if (tokenType == TokenNumber) // same logic as DoneWithValue()
+            {
+                size_t index = elementsConverted;
+                bool stored = false;
+                if (m_startLabels <= index && index < m_startLabels + m_dimLabels)
+                {
+                    if (StoreNumericLabel(*labels, value, tokenBegin, p))
+                        numbersConverted++;
+                    elementsConverted++;
+                    stored = true;
+                }
+                if (m_startFeatures <= index && index < m_startFeatures + m_dimFeatures)
+                {
+                    numbers.push_back(value);
+                    numbersConverted++;
+                    elementsConverted++;
+                    stored = true;
+                }
+                if (!stored)
+                    elementsConverted++;
+            }
+            else if (tokenType == TokenLabel)
+            {
+                if (StoreStringLabel(labels, tokenBegin, p))
+                    elementsConverted++;
+            }
+        }
+    }
+}
+
+// ParseCompleteLines - parse up to 'recordsRequested' complete lines from the current position, which must be right after a '\n'
+// returns - number of records parsed; the parser is positioned right after the '\n' of the last one (still in EndOfLine state)
+template <typename NumType, typename LabelType>
+long UCIParser<NumType, LabelType>::ParseCompleteLines(size_t recordsRequested)
+{
+    assert(m_current_state == EndOfLine && m_parseMode == ParseNormal && m_numbers != NULL);
+
+    // find the complete lines in the buffer
+    const char *bufferBegin = (const char *) m_fileBuffer;
+    const char *p = bufferBegin + (m_byteCounter - m_bufferStart);
+    const char *bufferEnd = bufferBegin + std::min((int64_t) m_bufferSize, m_fileSize - (int64_t) m_bufferStart);
+    m_lineBegins.clear();
+    m_lineEnds.clear();
+    while (m_lineEnds.size() < recordsRequested && p < bufferEnd)
+    {
+        const char *newline = (const char *) memchr(p, '\n', bufferEnd - p);
+        if (newline == NULL)
+            break;
+        if (newline != p) // (an empty line is no record)
+        {
+            m_lineBegins.push_back(p);
+            m_lineEnds.push_back(newline);
+        }
+        p = newline + 1;
+    }
+    // only consume up to the end of the last complete line found; empty lines after it are left to the state machine
+    if (m_lineEnds.empty())
+        return 0;
+    const size_t numLines = m_lineEnds.size();
+    const char *consumedEnd = m_lineEnds.back() + 1;
+
+    // split into ranges of about equal size, one per thread; small amounts are not worth starting threads
+    const size_t minBytesPerThread = 256 * 1024;
+    const size_t totalBytes = consumedEnd - m_lineBegins.front();
+    const size_t numRanges = std::max(std::min(m_numThreads, totalBytes / minBytesPerThread), (size_t) 1);
+    std::vector<size_t> rangeBegins(1, 0);
+    for (size_t i = 0; i < numLines && rangeBegins.size() < numRanges; i++)
+    {
+        if ((size_t)(m_lineEnds[i] + 1 - m_lineBegins.front()) >= totalBytes * rangeBegins.size() / numRanges)
+            rangeBegins.push_back(i + 1);
+    }
+    rangeBegins.push_back(numLines);
+
+    // the first range is converted by this thread straight into the output; the others into their own buffers, appended in order below
+    const size_t numOtherRanges = rangeBegins.size() - 2;
+    std::vector<std::vector<NumType>> otherNumbers(numOtherRanges);
+    std::vector<std::vector<LabelType>> otherLabels(numOtherRanges);
+    std::vector<int64_t> numbersConverted(numOtherRanges + 1, 0);
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < numOtherRanges; r++)
+    {
+        threads.push_back(std::thread([this, r, &rangeBegins, &otherNumbers, &otherLabels, &numbersConverted]()
+                                      {
+                                          ParseLines(rangeBegins[r + 1], rangeBegins[r + 2], otherNumbers[r], m_labels ? &otherLabels[r] : NULL, numbersConverted[r + 1]);
+                                      }));
+    }
+    ParseLines(rangeBegins[0], rangeBegins[1], *m_numbers, m_labels, numbersConverted[0]);
+    for (auto &thread : threads)
+        thread.join();
+    for (size_t r = 0; r < numOtherRanges; r++)
+    {
+        m_numbers->insert(m_numbers->end(), otherNumbers[r].begin(), otherNumbers[r].end());
+        if (m_labels)
+            m_labels->insert(m_labels->end(), std::make_move_iterator(otherLabels[r].begin()), std::make_move_iterator(otherLabels[r].end()));
+    }
+    for (auto n : numbersConverted)
+        m_totalNumbersConverted += n;
+
+    // advance the state machine past the consumed lines
+    m_byteCounter = m_bufferStart + (consumedEnd - bufferBegin);
+    m_spaceDelimitedStart = m_byteCounter;
+    m_spaceDelimitedMax = m_byteCounter;
+    PrepareStartNumber();
+    return (long) numLines;
+}
+
 // Parse - Parse the data
 // recordsRequested - number of records requested
 // numbers - pointer to vector to return the numbers (must be allocated)
@@ -506,18 +807,23 @@ long UCIParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<N
             bufferIndex = m_byteCounter - m_bufferStart;
         }
 
+        // at the start of a line, parse the complete lines in the buffer in bulk
+        if (m_current_state == EndOfLine && m_parseMode == ParseNormal && m_numbers != NULL)
+        {
+            long linesParsed = ParseCompleteLines(recordsRequested - recordCount);
+            for (long i = 0; i < linesParsed; i++)
+                TraceProgress(++recordCount);
+            if (linesParsed > 0)
+            {
+                bufferIndex = m_byteCounter - m_bufferStart;
+                continue;
+            }
+        }
+
         char ch = m_fileBuffer[bufferIndex];
 
         ParseState nextState = (ParseState) m_stateTable[(m_current_state << 8) + ch];
 
-        if (nextState <= Exponent)
-        {
-            m_builtUpNumber = m_builtUpNumber * 10 + (ch - '0');
-            // if we are in the decimal portion of a number increase the divider
-            if (nextState == Remainder)
-                m_divider *= 10;
-        }
-
         // only do a test on a state transition
         if (m_current_state != nextState)
         {
@@ -557,6 +863,10 @@ long UCIParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<N
                     DoneWithValue();
                     break;
                 }
+                // an incomplete number (e.g. "-", "1.", "1e") is skipped, don't let it leak into the next one
+                if ((nextState == Whitespace || nextState == EndOfLine) &&
+                    (m_current_state == Sign || m_current_state == Period || m_current_state == TheLetterE || m_current_state == ExponentSign))
+                    PrepareStartNumber();
             }
 
             // label handling
@@ -610,28 +920,7 @@ long UCIParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<N
             // intentional fall-through
             case LineCountEOL:
                 recordCount++; // done with another record
-                if (m_traceLevel > 1)
-                {
-                    // print progress dots
-                    if (recordCount % 100 == 0)
-                    {
-                        if (recordCount % 1000 == 0)
-                        {
-                            if (recordCount % 10000 == 0)
-                            {
-                                fprintf(stderr, "#");
-                            }
-                            else
-                            {
-                                fprintf(stderr, "+");
-                            }
-                        }
-                        else
-                        {
-                            fprintf(stderr, ".");
-                        }
-                    }
-                }
+                TraceProgress(recordCount);
                 break;
             case LineCountOther:
                 m_spaceDelimitedStart = m_byteCounter;
@@ -639,6 +928,15 @@ long UCIParser<NumType, LabelType>::Parse(size_t recordsRequested, std::vector<N
             }
         }
 
+        // accumulate the digit (after the transition processing above, which may have moved the digits so far into m_partialResult)
+        if (nextState <= Exponent)
+        {
+            m_builtUpNumber = m_builtUpNumber * 10 + (ch - '0');
+            // if we are in the decimal portion of a number increase the divider
+            if (nextState == Remainder)
+                m_divider *= 10;
+        }
+
         m_current_state = nextState;
 
         // move to next character
@@ -11,11 +11,11 @@
 #include <assert.h>
 #include <stdint.h>
 #include <algorithm>
+#include <thread>
 
 #ifdef min
 #undef min
 #endif
-#define min std::min
 
 // UCI label location types
 enum LabelMode
@@ -92,6 +92,11 @@ private:
     int64_t m_totalNumbersConverted;
     int64_t m_totalLabelsConverted;
 
+    // bulk parsing of complete lines (see ParseCompleteLines())
+    size_t m_numThreads;
+    std::vector<const char *> m_lineBegins; // complete lines in the buffer, without the '\n'
+    std::vector<const char *> m_lineEnds;
+
     // file positions/buffer
     FILE *m_pFile;
     int64_t m_byteCounter;
@@ -155,6 +160,35 @@ private:
     // string label types handled in specialization
     void StoreLastLabel();
 
+    // TraceProgress - print progress dots for the record just completed
+    void TraceProgress(long recordCount);
+
+    // kinds of space delimited tokens, for bulk parsing
+    enum TokenType
+    {
+        TokenNone = 0,   // incomplete number, skipped
+        TokenNumber = 1,
+        TokenLabel = 2
+    };
+
+    // ConvertToken - classify a token and convert it if it is a number, same as the state machine
+    static TokenType ConvertToken(const char *begin, const char *end, bool atLineStart, NumType &value);
+
+    // store a number in a label column, or a token that is not a number (overloaded for string labels)
+    template <typename ValueType>
+    static bool StoreNumericLabel(std::vector<ValueType> &labels, NumType value, const char *begin, const char *end);
+    static bool StoreNumericLabel(std::vector<std::string> &labels, NumType value, const char *begin, const char *end);
+    template <typename ValueType>
+    static bool StoreStringLabel(std::vector<ValueType> *labels, const char *begin, const char *end);
+    static bool StoreStringLabel(std::vector<std::string> *labels, const char *begin, const char *end);
+
+    // ParseLines - convert a range of the complete lines found by ParseCompleteLines()
+    void ParseLines(size_t first, size_t last, std::vector<NumType> &numbers, std::vector<LabelType> *labels, int64_t &numbersConverted) const;
+
+    // ParseCompleteLines - parse the complete lines in the buffer in bulk, on multiple threads
+    // returns - number of records parsed
+    long ParseCompleteLines(size_t recordsRequested);
+
 public:
     // SetParseMode - Set the parsing mode
     // mode - set mode to either ParseLineCount, or ParseNormal
@@ -164,6 +198,9 @@ public:
     // traceLevel - traceLevel, zero means no output, 1 epoch related output, > 1 all output
     void SetTraceLevel(int traceLevel);
 
+    // SetNumThreads - Set the number of threads used to parse complete lines in the buffer
+    void SetNumThreads(size_t numThreads);
+
     // ParseInit - Initialize a parse of a file
     // fileName - path to the file to open
     // startFeatures - column (zero based) where features start
@@ -184,6 +221,12 @@ public:
     int64_t GetFilePosition();
     void SetFilePosition(int64_t position);
 
+    // GetRecordPosition - file position of the next record Parse() will return, which SetFilePosition() accepts to continue from there
+    int64_t GetRecordPosition() const
+    {
+        return m_byteCounter;
+    }
+
     // HasMoreData - test if the current dataset have more data
     // returns - true if it does, false if not
     bool HasMoreData();
@@ -0,0 +1,171 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include "ComputationNetwork.h"
+#include "ComputationNode.h"
+#include "CommonMatrix.h"
+#include "Sequences.h"
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// The forward and backward pass of a training step, replayed from a CUDA graph while the minibatches keep their shape (SGD option cudaGraph).
+// Once the inputs have had the same dimensions, buffers and MBLayout for 'numWarmupSteps' minibatches (so that all matrices have
+// been allocated), the step is captured (CapturedGPUWork), and then replayed with a single launch as long as that holds. When it
+// changes, the step runs normally again, and is captured anew once it is stable. If capturing fails, as it does e.g. when a node
+// synchronizes with the CPU, capturing is given up for good. The parameter update is not captured, since its learning rates,
+// momentum and clipping thresholds are CPU-side values that change over time.
+// Nodes that keep CPU-side state across minibatches (random seeds, running statistics, recurrence) would be replayed with stale
+// state, so networks that have them are not captured at all (WhyNotCapturable()); same for sparse inputs.
+template <class ElemType>
+class CapturedTrainingStep
+{
+    typedef shared_ptr<ComputationNode<ElemType>> ComputationNodePtr;
+
+    struct InputState
+    {
+        const ElemType* m_data;
+        size_t m_numRows, m_numCols;
+        bool operator==(const InputState& other) const { return m_data == other.m_data && m_numRows == other.m_numRows && m_numCols == other.m_numCols; }
+    };
+
+public:
+    // returns an empty string if the network can be captured, otherwise the reason why not
+    static std::wstring WhyNotCapturable(ComputationNetworkPtr net, const vector<ComputationNodeBasePtr>& inputNodes, const ComputationNodeBasePtr& criterionNode)
+    {
+        if (net->GetDeviceId() < 0)
+            return L"the model is on the CPU";
+        static const std::set<std::wstring> statefulOperations = {
+            L"Dropout", L"BatchNormalization", L"SampledCrossEntropyWithSoftmax", L"NCEBasedCrossEntropyWithSoftmax", L"SequenceWithSoftmax"};
+        for (const auto& node : net->GetEvalOrder(criterionNode))
+        {
+            if (node->IsPartOfLoop())
+                return L"it has a recurrent loop";
+            if (statefulOperations.find(node->OperationName()) != statefulOperations.end())
+                return L"it has a " + node->OperationName() + L" node";
+        }
+        for (const auto& node : inputNodes)
+        {
+            auto input = dynamic_pointer_cast<ComputationNode<ElemType>>(node);
+            if (!input)
+                return L"input " + node->NodeName() + L" has a different element type";
+            if (input->Value().GetMatrixType() != MatrixType::DENSE)
+                return L"input " + node->NodeName() + L" is sparse";
+        }
+        return L"";
+    }
+
+    CapturedTrainingStep(ComputationNetworkPtr net, const vector<ComputationNodeBasePtr>& inputNodes, size_t numWarmupSteps = 2)
+        : m_numWarmupSteps(max(numWarmupSteps, (size_t) 1)), m_numStableSteps(0), m_givenUp(false), m_numReplays(0), m_numCaptures(0),
+          m_graph(new CapturedGPUWork(net->GetDeviceId()))
+    {
+        for (const auto& node : inputNodes)
+        {
+            m_inputs.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(node));
+            m_lastInputs.push_back(InputState{nullptr, 0, 0});
+            m_layouts.push_back(node->GetMBLayout());
+            m_lastLayouts.push_back(node->GetMBLayout() ? make_shared<MBLayout>() : nullptr);
+        }
+    }
+
+    // run 'step' (forward and backprop of the current minibatch), or replay it
+    void Run(const std::function<void()>& step)
+    {
+        if (m_givenUp)
+            return step();
+        if (!SameAsLastMinibatch())
+        {
+            Invalidate();
+            return step();
+        }
+        if (m_graph->IsCaptured())
+        {
+            m_graph->Replay();
+            m_numReplays++;
+            return;
+        }
+        if (++m_numStableSteps < m_numWarmupSteps)
+            return step();
+        if (m_graph->Capture(step))
+        {
+            m_numCaptures++;
+            return;
+        }
+        fprintf(stderr, "CapturedTrainingStep: Cannot capture the training step into a CUDA graph; running it normally from now on.\n");
+        m_givenUp = true;
+        step();
+    }
+
+    // for a minibatch that is processed differently (e.g. without backprop), and after anything else that invalidates the graph
+    void Invalidate()
+    {
+        m_graph->Reset();
+        m_numStableSteps = 0;
+    }
+
+    // print and reset how many minibatches were replayed
+    void PrintStatistics(size_t numMinibatches)
+    {
+        if (numMinibatches > 0)
+            fprintf(stderr, "CapturedTrainingStep: %d of %d minibatches were replayed from a CUDA graph (%d captures).\n", (int) m_numReplays, (int) numMinibatches, (int) m_numCaptures);
+        m_numReplays = 0;
+        m_numCaptures = 0;
+    }
+
+private:
+    // compare the inputs with the last minibatch, and remember them for the next
+    bool SameAsLastMinibatch()
+    {
+        bool same = true;
+        for (size_t i = 0; i < m_inputs.size(); i++)
+        {
+            const auto& value = m_inputs[i]->Value();
+            InputState state{value.BufferPointer(), value.GetNumRows(), value.GetNumCols()};
+            if (!(state == m_lastInputs[i]))
+            {
+                same = false;
+                m_lastInputs[i] = state;
+            }
+            if (m_layouts[i] && !SameStructure(*m_layouts[i], *m_lastLayouts[i]))
+            {
+                same = false;
+                m_lastLayouts[i]->CopyFrom(m_layouts[i]);
+            }
+        }
+        return same;
+    }
+
+    // like MBLayout::operator==, but ignoring the sequence ids, which do not change the GPU work
+    static bool SameStructure(const MBLayout& a, const MBLayout& b)
+    {
+        if (a.GetNumTimeSteps() != b.GetNumTimeSteps() || a.GetNumParallelSequences() != b.GetNumParallelSequences() || a.GetAllSequences().size() != b.GetAllSequences().size())
+            return false;
+        for (size_t k = 0; k < a.GetAllSequences().size(); k++)
+        {
+            const auto& sa = a.GetAllSequences()[k];
+            const auto& sb = b.GetAllSequences()[k];
+            if (sa.s != sb.s || sa.tBegin != sb.tBegin || sa.tEnd != sb.tEnd || (sa.seqId == GAP_SEQUENCE_ID) != (sb.seqId == GAP_SEQUENCE_ID))
+                return false;
+        }
+        return true;
+    }
+
+    const size_t m_numWarmupSteps;
+    size_t m_numStableSteps; // consecutive minibatches that were like the last
+    bool m_givenUp;
+    size_t m_numReplays, m_numCaptures; // (for PrintStatistics())
+    std::vector<ComputationNodePtr> m_inputs;
+    std::vector<InputState> m_lastInputs;
+    std::vector<MBLayoutPtr> m_layouts;
+    std::vector<MBLayoutPtr> m_lastLayouts;
+    std::unique_ptr<CapturedGPUWork> m_graph;
+};
+
+} } }
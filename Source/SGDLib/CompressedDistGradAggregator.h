@@ -0,0 +1,319 @@
+#pragma once
+
+#include "IDistGradAggregator.h"
+#include "CUDAPageLockedMemAllocator.h"
+#include "GPUDataTransferer.h"
+#include "MatrixQuantizerImpl.h"
+#include "TimerUtility.h"
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Gradient aggregation that exchanges compressed gradients, for slow networks. There are two modes:
+//  - quantization: each column is quantized to numGradientBits (e.g. 1-bit SGD) with the MatrixQuantizer
+//  - top-k sparsification: only the topKFraction largest-magnitude values of each gradient are sent
+// Either way, what is not sent (the quantization error, or the values below the top k) is carried over as a residual,
+// and added to the next minibatch's gradient (error feedback), so that no gradient is lost, just delayed.
+// Every worker gathers the compressed gradients of all workers, and sums them up in rank order,
+// so that all workers end up with the same aggregate. The traffic per worker is (NumProc() - 1) compressed gradients,
+// which beats a full-precision all-reduce as long as NumProc() is well below the compression ratio.
+template <class ElemType>
+class CompressedDistGradAggregator : public IDistGradAggregator<ElemType>
+{
+    UsingIDistGradAggregatorMembers;
+
+    // one value of a top-k sparsified gradient
+    struct SparseValue
+    {
+        uint32_t index;
+        ElemType value;
+    };
+
+public:
+    // topKFraction > 0 selects top-k sparsification, otherwise gradients are quantized to numGradientBits
+    CompressedDistGradAggregator(MPIWrapper* mpi, size_t numGradientBits, bool zeroThresholdFor1Bit, double topKFraction, int syncStatsTrace)
+        : IDistGradAggregator<ElemType>(mpi), m_numGradientBits(numGradientBits), m_zeroThresholdFor1Bit(zeroThresholdFor1Bit), m_topKFraction(topKFraction), m_allocator(nullptr), m_initialized(false), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0)
+    {
+        if ((m_topKFraction < 0) || (m_topKFraction > 1))
+            InvalidArgument("CompressedDistGradAggregator: topKFraction must be in the range [0, 1].");
+    }
+
+    ~CompressedDistGradAggregator()
+    {
+        for (size_t i = 0; i < m_recvHeaders.size(); ++i)
+        {
+            DistGradHeader::Destroy(m_recvHeaders[i]);
+        }
+    }
+
+    // Aggregate the gradient matrices across all nodes
+    bool AggregateGradients(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, int /*epochNumber*/) override
+    {
+        if (!m_initialized)
+            Initialize(gradients, headerCPU->numEvalNode);
+
+        bool showSyncPerfStats = (m_syncStatsTrace > 0) && ((m_iterationCount % m_syncStatsTrace) == 0);
+        m_iterationCount++;
+
+        Timer aggregationTimer;
+        int deviceId = gradients[0]->GetDeviceId();
+        if (showSyncPerfStats)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+            aggregationTimer.Start();
+        }
+
+        // If the current node did not process any samples, the gradients should be zero'd
+        // (the residuals are still sent)
+        if (headerCPU->numSamples == 0)
+        {
+            for (size_t i = 0; i < gradients.size(); ++i)
+            {
+                gradients[i]->SetValue(0);
+            }
+        }
+
+        if (m_topKFraction > 0)
+            AggregateTopK(gradients);
+        else
+            AggregateQuantized(gradients);
+
+        AggregateHeader(headerCPU, m_recvHeaders, gradients.size());
+
+        if (showSyncPerfStats)
+        {
+            aggregationTimer.Stop();
+            double epochTime = aggregationTimer.ElapsedSeconds();
+            fprintf(stderr, "Actual gradient aggregation time: %.6g\n", epochTime);
+        }
+
+        return (headerCPU->numSamples != 0);
+    }
+
+private:
+    void Initialize(const std::vector<Matrix<ElemType>*>& gradients, int numEvalNode)
+    {
+        m_initialized = true;
+
+        int deviceId = gradients[0]->GetDeviceId();
+        if (deviceId != CPUDEVICE)
+            m_allocator = &CUDAPageLockedMemArena::GetSharedArena(deviceId);
+
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            // Make sure none of the gradient matrixes are sparse - we currently do not support aggregation of sparse gradient matrices
+            if (gradients[i]->GetMatrixType() != DENSE)
+                RuntimeError("Gradient aggregation for sparse gradient matrices is currently unsupported!");
+
+            size_t numRows = gradients[i]->GetNumRows();
+            size_t numCols = gradients[i]->GetNumCols();
+            if (m_topKFraction > 0)
+            {
+                // top-k selection is done on the CPU, so the residuals live there
+                size_t numElements = gradients[i]->GetNumElements();
+                if (numElements > UINT32_MAX)
+                    RuntimeError("CompressedDistGradAggregator: Gradient matrix is too large for top-k sparsification.");
+                size_t k = std::max((size_t) 1, (size_t) ceil(m_topKFraction * numElements));
+                m_hostResiduals.push_back(std::vector<ElemType>(numElements, 0));
+                m_sendValues.push_back(std::vector<SparseValue>(k));
+                m_recvValues.push_back(std::vector<SparseValue>(k * NumProc()));
+                if (deviceId != CPUDEVICE)
+                {
+                    m_gpuDataTransferers.push_back(std::unique_ptr<GPUDataTransferer<ElemType>>(new GPUDataTransferer<ElemType>(deviceId, true /*useConcurrentStreams*/)));
+                    m_intermediateCPUBuffers.push_back(AllocateIntermediateBuffer(numElements));
+                }
+            }
+            else
+            {
+                // We gather the quantized gradients of all workers into one quantized matrix, side by side;
+                // columns are quantized independently, so each worker's part is a column slice.
+                m_residuals.push_back(std::unique_ptr<Matrix<ElemType>>(new Matrix<ElemType>(numRows, numCols, deviceId)));
+                m_residuals.back()->SetValue(0);
+                m_quantizers.push_back(std::unique_ptr<MatrixQuantizerImpl<ElemType>>(MatrixQuantizerImpl<ElemType>::Create(deviceId, false /*useAsync*/)));
+                m_gatheredQuantizedGradients.push_back(std::unique_ptr<QuantizedMatrix<ElemType>>(new QuantizedMatrix<ElemType>(numRows, numCols * NumProc(), m_numGradientBits, CPUDEVICE, m_allocator)));
+                if (m_gatheredQuantizedGradients.back()->GetSize() / NumProc() > INT_MAX)
+                    RuntimeError("CompressedDistGradAggregator: Gradient matrix is too large for quantized aggregation.");
+
+                // On GPUs, each unquantization goes through a separate GPU buffer, so that they can all be in flight at the same time.
+                m_unquantizers.push_back(std::vector<std::unique_ptr<MatrixQuantizerImpl<ElemType>>>());
+                if (deviceId != CPUDEVICE)
+                {
+                    for (size_t j = 0; j < NumProc(); j++)
+                        m_unquantizers.back().push_back(std::unique_ptr<MatrixQuantizerImpl<ElemType>>(MatrixQuantizerImpl<ElemType>::Create(deviceId, false /*useAsync*/)));
+                }
+            }
+        }
+
+        if (m_mpi->IsMainNode())
+        {
+            for (size_t i = 0; i < NumProc() - 1; ++i)
+            {
+                m_recvHeaders.push_back(DistGradHeader::Create(numEvalNode));
+            }
+        }
+    }
+
+    std::shared_ptr<ElemType> AllocateIntermediateBuffer(size_t numElements)
+    {
+        size_t totalSize = sizeof(ElemType) * numElements;
+        return std::shared_ptr<ElemType>((ElemType*) m_allocator->Malloc(totalSize), [this](ElemType* p)
+                                         {
+                                             m_allocator->Free(p);
+                                         });
+    }
+
+    void AggregateQuantized(const std::vector<Matrix<ElemType>*>& gradients)
+    {
+        size_t numGradMatrices = gradients.size();
+        int deviceId = gradients[0]->GetDeviceId();
+
+        // quantize gradient + residual into our own slice of the gathered matrix; this leaves the new residual
+        for (size_t i = 0; i < numGradMatrices; ++i)
+        {
+            size_t numCols = gradients[i]->GetNumCols();
+            QuantizedMatrix<ElemType> ownSlice = m_gatheredQuantizedGradients[i]->ColumnSlice(MyRank() * numCols, numCols);
+            m_quantizers[i]->QuantizeAsync(*gradients[i], *m_residuals[i], ownSlice, *m_residuals[i], m_zeroThresholdFor1Bit);
+        }
+
+        std::vector<MPI_Request> allGatherRequests(numGradMatrices);
+        for (size_t i = 0; i < numGradMatrices; ++i)
+        {
+            m_quantizers[i]->WaitQuantizeAsyncDone();
+            int sliceSize = (int) (m_gatheredQuantizedGradients[i]->GetSize() / NumProc());
+            MPI_Iallgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, m_gatheredQuantizedGradients[i]->GetArray(), sliceSize, MPI_CHAR, m_mpi->Communicator(), &allGatherRequests[i]) || MpiFail("MPI_Iallgather");
+            m_numGradientBytesSent += sliceSize;
+        }
+
+        // sum up the unquantized gradients of all workers, in rank order
+        for (size_t i = 0; i < numGradMatrices; ++i)
+        {
+            m_mpi->Wait(&allGatherRequests[i]);
+            size_t numCols = gradients[i]->GetNumCols();
+            for (size_t j = 0; j < NumProc(); j++)
+            {
+                QuantizedMatrix<ElemType> slice = m_gatheredQuantizedGradients[i]->ColumnSlice(j * numCols, numCols);
+                auto& unquantizer = (deviceId != CPUDEVICE) ? *m_unquantizers[i][j] : *m_quantizers[i];
+                unquantizer.UnquantizeAsync(slice, *gradients[i], j > 0 /*add*/);
+            }
+        }
+
+        // the gathered buffers must not be overwritten while they are being copied to the GPU
+        if (deviceId != CPUDEVICE)
+        {
+            for (size_t i = 0; i < numGradMatrices; ++i)
+            {
+                for (size_t j = 0; j < NumProc(); j++)
+                    m_unquantizers[i][j]->WaitUnquantizeAsyncDone();
+            }
+        }
+    }
+
+    void AggregateTopK(const std::vector<Matrix<ElemType>*>& gradients)
+    {
+        size_t numGradMatrices = gradients.size();
+        int deviceId = gradients[0]->GetDeviceId();
+
+        if (deviceId != CPUDEVICE)
+        {
+            // the copies run on the fetch stream, which must wait until the main compute stream has completed the gradients
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+            for (size_t i = 0; i < numGradMatrices; ++i)
+            {
+                m_gpuDataTransferers[i]->CopyGPUToCPUAsync(gradients[i]->BufferPointer(), gradients[i]->GetNumElements(), m_intermediateCPUBuffers[i].get());
+            }
+        }
+
+        // select the k largest values of gradient + residual; the others remain in the residual
+        std::vector<MPI_Request> allGatherRequests(numGradMatrices);
+        for (size_t i = 0; i < numGradMatrices; ++i)
+        {
+            ElemType* hostGradient = gradients[i]->BufferPointer();
+            if (deviceId != CPUDEVICE)
+            {
+                m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
+                hostGradient = m_intermediateCPUBuffers[i].get();
+            }
+
+            auto& residual = m_hostResiduals[i];
+            auto& sendValues = m_sendValues[i];
+            size_t numElements = residual.size();
+            m_indices.resize(numElements);
+            for (size_t n = 0; n < numElements; n++)
+            {
+                residual[n] += hostGradient[n];
+                m_indices[n] = (uint32_t) n;
+            }
+            size_t k = sendValues.size();
+            std::nth_element(m_indices.begin(), m_indices.begin() + (k - 1), m_indices.end(), [&residual](uint32_t a, uint32_t b)
+                             {
+                                 return fabs(residual[a]) > fabs(residual[b]);
+                             });
+            for (size_t n = 0; n < k; n++)
+            {
+                uint32_t index = m_indices[n];
+                sendValues[n].index = index;
+                sendValues[n].value = residual[index];
+                residual[index] = 0;
+            }
+
+            int sendSize = (int) (k * sizeof(SparseValue));
+            MPI_Iallgather(sendValues.data(), sendSize, MPI_CHAR, m_recvValues[i].data(), sendSize, MPI_CHAR, m_mpi->Communicator(), &allGatherRequests[i]) || MpiFail("MPI_Iallgather");
+            m_numGradientBytesSent += sendSize;
+        }
+
+        // scatter the values of all workers into the zeroed gradient, in rank order
+        for (size_t i = 0; i < numGradMatrices; ++i)
+        {
+            m_mpi->Wait(&allGatherRequests[i]);
+            ElemType* hostGradient = (deviceId != CPUDEVICE) ? m_intermediateCPUBuffers[i].get() : gradients[i]->BufferPointer();
+            memset(hostGradient, 0, m_hostResiduals[i].size() * sizeof(ElemType));
+            for (const auto& v : m_recvValues[i])
+                hostGradient[v.index] += v.value;
+            if (deviceId != CPUDEVICE)
+                m_gpuDataTransferers[i]->CopyCPUToGPUAsync(hostGradient, gradients[i]->GetNumElements(), gradients[i]->BufferPointer());
+        }
+
+        // Wait for all the transfers to finish
+        if (deviceId != CPUDEVICE)
+        {
+            for (size_t i = 0; i < numGradMatrices; ++i)
+            {
+                m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
+            }
+        }
+    }
+
+private:
+    size_t m_numGradientBits;
+    bool m_zeroThresholdFor1Bit;
+    double m_topKFraction;
+
+    MemAllocator* m_allocator; // not owned
+    bool m_initialized;
+
+    // quantization
+    std::vector<std::unique_ptr<Matrix<ElemType>>> m_residuals;
+    std::vector<std::unique_ptr<MatrixQuantizerImpl<ElemType>>> m_quantizers;
+    std::vector<std::vector<std::unique_ptr<MatrixQuantizerImpl<ElemType>>>> m_unquantizers; // [gradient][worker], only on GPUs
+    std::vector<std::unique_ptr<QuantizedMatrix<ElemType>>> m_gatheredQuantizedGradients; // [rows x (cols * NumProc())]
+
+    // top-k sparsification
+    std::vector<std::vector<ElemType>> m_hostResiduals;
+    std::vector<std::vector<SparseValue>> m_sendValues;
+    std::vector<std::vector<SparseValue>> m_recvValues; // (k values from each worker)
+    std::vector<uint32_t> m_indices;                    // scratch for the top-k selection
+    std::vector<std::shared_ptr<ElemType>> m_intermediateCPUBuffers;
+    std::vector<std::unique_ptr<GPUDataTransferer<ElemType>>> m_gpuDataTransferers;
+
+    std::vector<DistGradHeader*> m_recvHeaders;
+
+    int m_syncStatsTrace;
+
+    // Only used for controlling frequency of measuring/showing gradient aggregation perf stats
+    size_t m_iterationCount;
+};
+} } }
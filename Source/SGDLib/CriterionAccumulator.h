@@ -0,0 +1,144 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include "ComputationNode.h"
+#include "Matrix.h"
+#include "MatrixReadback.h"
+#include <memory>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// CriterionAccumulator -- sums of the training criterion and the evaluation nodes over an epoch, kept on the device
+// Each minibatch's values are added on the device (Accumulate()), so the training loop does not wait for the GPU.
+// The host reads them only when it needs them (progress log, checkpoint, end of epoch): StartReadback() snapshots the
+// sums and starts copying them to the host (MatrixReadback), and FinishReadback() waits for that copy, so that
+// the work issued in between (the parameter update) is already queued when the host blocks.
+// ReadMinibatchValues() does the same for the values of a single minibatch (as needed for the DistGradHeader),
+// in one transfer rather than one per node.
+template <class ElemType>
+class CriterionAccumulator
+{
+public:
+    CriterionAccumulator(DEVICEID_TYPE deviceId, size_t numEvalNodes)
+        : m_deviceId(deviceId),
+          m_criterion(1, 1, deviceId),
+          m_evalErrors(1, numEvalNodes, deviceId),
+          m_snapshot(1, 1 + numEvalNodes, deviceId),
+          m_readbackPending(false)
+    {
+        m_criterion.SetValue(0);
+        m_evalErrors.SetValue(0);
+    }
+
+    DISABLE_COPY_AND_MOVE(CriterionAccumulator);
+
+    // the sums themselves, e.g. for Hogwild and for restoring them from a checkpoint
+    Matrix<ElemType>& Criterion() { return m_criterion; }
+    Matrix<ElemType>& EvalErrors() { return m_evalErrors; }
+
+    // add the minibatch's criterion values (in Value()(0,0) of each node)
+    void Accumulate(const ComputationNodeBasePtr& criterionNode, const std::vector<ComputationNodeBasePtr>& evaluationNodes)
+    {
+        Matrix<ElemType>::AddElementToElement(ValueOf(criterionNode), 0, 0, m_criterion, 0, 0);
+        for (size_t i = 0; i < evaluationNodes.size(); i++)
+            Matrix<ElemType>::AddElementToElement(ValueOf(evaluationNodes[i]), 0, 0, m_evalErrors, 0, i);
+    }
+
+    // add the minibatch's values of the evaluation nodes only (evaluation without a training criterion, see SimpleEvaluator)
+    void AccumulateEvalErrors(const std::vector<ComputationNodeBasePtr>& evaluationNodes)
+    {
+        for (size_t i = 0; i < evaluationNodes.size(); i++)
+            Matrix<ElemType>::AddElementToElement(ValueOf(evaluationNodes[i]), 0, 0, m_evalErrors, 0, i);
+    }
+
+    // start over from zero, e.g. after the sums so far were read and added up on the host in double precision
+    void Reset()
+    {
+        DiscardPendingReadback();
+        m_criterion.SetValue(0);
+        m_evalErrors.SetValue(0);
+    }
+
+    // divide the sums, e.g. by the number of samples at the end of the epoch
+    void Normalize(size_t numSamples)
+    {
+        m_criterion /= (ElemType) numSamples;
+        m_evalErrors /= (ElemType) numSamples;
+    }
+
+    // snapshot the current sums and start copying them to the host
+    void StartReadback()
+    {
+        DiscardPendingReadback();
+        Matrix<ElemType>::AssignElementToElement(m_criterion, 0, 0, m_snapshot, 0, 0);
+        for (size_t i = 0; i < m_evalErrors.GetNumCols(); i++)
+            Matrix<ElemType>::AssignElementToElement(m_evalErrors, 0, i, m_snapshot, 0, 1 + i);
+        StartSnapshotReadback();
+    }
+
+    // wait for the copy started by StartReadback() (or start and wait if none was started)
+    void FinishReadback(double& criterion, std::vector<double>& evalErrors)
+    {
+        if (!m_readbackPending)
+            StartReadback();
+        FinishSnapshotReadback(criterion, evalErrors);
+    }
+
+    // the current sums, regardless of any readback started earlier
+    void Read(double& criterion, std::vector<double>& evalErrors)
+    {
+        StartReadback();
+        FinishSnapshotReadback(criterion, evalErrors);
+    }
+
+    // the values of the current minibatch, in a single transfer
+    void ReadMinibatchValues(const ComputationNodeBasePtr& criterionNode, const std::vector<ComputationNodeBasePtr>& evaluationNodes,
+                             double& criterion, std::vector<double>& evalErrors)
+    {
+        DiscardPendingReadback();
+        Matrix<ElemType>::AssignElementToElement(ValueOf(criterionNode), 0, 0, m_snapshot, 0, 0);
+        for (size_t i = 0; i < evaluationNodes.size(); i++)
+            Matrix<ElemType>::AssignElementToElement(ValueOf(evaluationNodes[i]), 0, 0, m_snapshot, 0, 1 + i);
+        StartSnapshotReadback();
+        FinishSnapshotReadback(criterion, evalErrors);
+    }
+
+private:
+    static const Matrix<ElemType>& ValueOf(const ComputationNodeBasePtr& node)
+    {
+        return dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+    }
+
+    // a readback that was started but not consumed (the snapshot may change right away: later work waits for the copy)
+    void DiscardPendingReadback()
+    {
+        m_readbackPending = false;
+    }
+
+    void StartSnapshotReadback()
+    {
+        m_readback.Start(m_snapshot);
+        m_readbackPending = true;
+    }
+
+    void FinishSnapshotReadback(double& criterion, std::vector<double>& evalErrors)
+    {
+        m_readbackPending = false;
+        const ElemType* values = m_readback.Wait();
+        criterion = values[0];
+        evalErrors.assign(values + 1, values + m_readback.GetNumElements());
+    }
+
+    DEVICEID_TYPE m_deviceId;
+    Matrix<ElemType> m_criterion;
+    Matrix<ElemType> m_evalErrors;
+    Matrix<ElemType> m_snapshot; // [criterion, evalErrors...] as of StartReadback()
+    MatrixReadback<ElemType> m_readback; // of m_snapshot
+    bool m_readbackPending;
+};
+
+} } }
@@ -7,9 +7,12 @@
 #include "ComputationNetwork.h"
 #include "MPIWrapper.h"
 #include "SpecialPurposeNodes.h"        // for SequenceWithSoftmaxNode
+#include "CPUMatrix.h"                  // for SetNumThreads()
 #include <string>
 #include <map>
 #include <set>
+#include <thread>
+#include <exception>
 
 namespace Microsoft { namespace MSR { namespace CNTK {
 
@@ -583,5 +586,562 @@ namespace Microsoft { namespace MSR { namespace CNTK {
             m_NetEvaluationAccumulator->SetValue((ElemType) 0);
         }
     };
+
+    // ===================================================================
+    // GradientAccumulator -- sums up gradients and criteria over several minibatches, for a single model update
+    // ===================================================================
+
+    // This trades GPU memory for a larger effective minibatch: each minibatch is read and processed as usual, but the model is
+    // only updated after several of them. Each minibatch is a regular reader minibatch, so truncated BPTT and MBLayout
+    // do not change. The usage would be:
+    //        GradientAccumulator<ElemType> accumulator;
+    //        accumulator.Init(net, learnableNodes, criterionNodes, evaluationNodes);
+    //        for (;;)
+    //        {
+    //            for (size_t i = 0; i < numMBsToAccumulate && GetMinibatchIntoNetwork(...); i++)
+    //            {
+    //                net.ForwardProp(...); net.Backprop(...);
+    //                accumulator.Accumulate();
+    //            }
+    //            accumulator.MoveToNet(); // gradients and criteria now are the sums
+    //            UpdateWeights(...);
+    //        }
+
+    template <class ElemType>
+    class GradientAccumulator
+    {
+    public:
+        GradientAccumulator()
+            : m_numAccumulated(0)
+        {
+        }
+
+        void Init(ComputationNetworkPtr& net,
+                  const std::list<ComputationNodeBasePtr>& learnableNodes,
+                  const std::vector<ComputationNodeBasePtr>& criterionNodes,
+                  const std::vector<ComputationNodeBasePtr>& evaluationNodes)
+        {
+            for (auto& x : learnableNodes)
+            {
+                if (x->IsParameterUpdateRequired())
+                    m_learnableNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(x));
+            }
+            m_criterionNode = dynamic_pointer_cast<ComputationNode<ElemType>>(criterionNodes[0]);
+            for (auto& x : evaluationNodes)
+            {
+                m_evaluationNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(x));
+            }
+            m_criterionAccumulator = make_shared<Matrix<ElemType>>(1, 1, net->GetDeviceId());
+            m_evaluationAccumulator = make_shared<Matrix<ElemType>>(1, evaluationNodes.size(), net->GetDeviceId());
+            m_criterionAccumulator->SetValue((ElemType) 0);
+            m_evaluationAccumulator->SetValue((ElemType) 0);
+        }
+
+        // number of minibatches accumulated since the last MoveToNet()
+        size_t NumAccumulated() const
+        {
+            return m_numAccumulated;
+        }
+
+        // add the gradients and criteria of the minibatch that was just processed
+        void Accumulate()
+        {
+            if (m_accumulatedGradients.empty())
+            {
+                for (auto& node : m_learnableNodes)
+                {
+                    const auto& value = node->Value();
+                    m_accumulatedGradients.push_back(make_shared<Matrix<ElemType>>(value.GetNumRows(), value.GetNumCols(), value.GetDeviceId()));
+                    m_accumulatedGradients.back()->SetValue((ElemType) 0);
+                }
+            }
+
+            for (size_t i = 0; i < m_learnableNodes.size(); i++)
+                *m_accumulatedGradients[i] += m_learnableNodes[i]->Gradient();
+
+            Matrix<ElemType>::AddElementToElement(m_criterionNode->Value(), 0, 0, *m_criterionAccumulator, 0, 0);
+            for (size_t i = 0; i < m_evaluationNodes.size(); i++)
+                Matrix<ElemType>::AddElementToElement(m_evaluationNodes[i]->Value(), 0, 0, *m_evaluationAccumulator, 0, i);
+            m_numAccumulated++;
+        }
+
+        // replace the gradients and criteria in the network by the sums, and start over
+        void MoveToNet()
+        {
+            if (m_numAccumulated == 0)
+                LogicError("GradientAccumulator: MoveToNet() called without any accumulated minibatch.");
+
+            for (size_t i = 0; i < m_learnableNodes.size(); i++)
+            {
+                m_learnableNodes[i]->Gradient().SetValue(*m_accumulatedGradients[i]);
+                m_accumulatedGradients[i]->SetValue((ElemType) 0);
+            }
+
+            m_criterionNode->Value().SetValue((ElemType) 0);
+            Matrix<ElemType>::AddElementToElement(*m_criterionAccumulator, 0, 0, m_criterionNode->Value(), 0, 0);
+            m_criterionAccumulator->SetValue((ElemType) 0);
+            for (size_t i = 0; i < m_evaluationNodes.size(); i++)
+            {
+                m_evaluationNodes[i]->Value().SetValue((ElemType) 0);
+                Matrix<ElemType>::AddElementToElement(*m_evaluationAccumulator, 0, i, m_evaluationNodes[i]->Value(), 0, 0);
+            }
+            m_evaluationAccumulator->SetValue((ElemType) 0);
+            m_numAccumulated = 0;
+        }
+
+    private:
+        std::vector<shared_ptr<ComputationNode<ElemType>>> m_learnableNodes; // those that require an update
+        std::vector<shared_ptr<Matrix<ElemType>>> m_accumulatedGradients;   // [i] for m_learnableNodes[i]
+        shared_ptr<ComputationNode<ElemType>> m_criterionNode;
+        std::vector<shared_ptr<ComputationNode<ElemType>>> m_evaluationNodes;
+        shared_ptr<Matrix<ElemType>> m_criterionAccumulator;
+        shared_ptr<Matrix<ElemType>> m_evaluationAccumulator;
+        size_t m_numAccumulated;
+    };
+
+    // ===================================================================
+    // DeviceReplicaDispatcher -- data parallelism over several GPUs within one process
+    // ===================================================================
+
+    // The main network keeps the first shard of each minibatch, and a replica of it on each additional GPU gets one of the
+    // other shards. Shards are ranges of parallel sequences, as for sub-minibatches. The replicas run forward and backward
+    // on worker threads while the caller runs the main network, and their gradients and criteria are then summed up into
+    // the main network, GPU to GPU. Only the main network is updated; each replica copies its parameters at the start
+    // of a minibatch. So the reader, PreCompute() and the model update exist once, however many GPUs there are.
+    // Node state that the forward pass updates, like the running statistics of BatchNormalization, only comes from the
+    // main network's shard. The usage is:
+    //        dispatcher.Init(net, modelFileName, deviceIds, learnableNodes, criterionNodes, evaluationNodes);
+    //        for (;;)
+    //        {
+    //            GetMinibatchIntoNetwork(..., inputMatrices, ...);
+    //            dispatcher.StartMinibatch(inputMatrices, needGradients); // net now has its shard, the replicas are running
+    //            net.ForwardProp(...); net.Backprop(...);
+    //            dispatcher.FinishMinibatch(); // net has the gradients and criteria of the whole minibatch again
+    //            UpdateWeights(...);
+    //        }
+
+    template <class ElemType>
+    class DeviceReplicaDispatcher
+    {
+        typedef std::map<std::wstring, Matrix<ElemType>*> Matrices;
+
+        struct Replica
+        {
+            ComputationNetworkPtr net;
+            Matrices inputMatrices;                                              // by name, like the main network's
+            std::vector<shared_ptr<ComputationNode<ElemType>>> learnableNodes;  // [i] is the replica of m_learnableNodes[i]
+            ComputationNodeBasePtr criterionNode;
+            std::vector<ComputationNodeBasePtr> evaluationNodes;
+            std::thread thread;
+            std::exception_ptr exception;
+        };
+
+    public:
+        DeviceReplicaDispatcher()
+            : m_numShards(0), m_needGradients(false)
+        {
+        }
+
+        ~DeviceReplicaDispatcher()
+        {
+            for (auto& replica : m_replicas) // (only if FinishMinibatch() was skipped by an exception)
+                if (replica->thread.joinable())
+                    replica->thread.join();
+        }
+
+        // create a replica on each of 'deviceIds' from 'modelFileName', which must hold the model of 'net'
+        void Init(ComputationNetworkPtr net, const std::wstring& modelFileName, const std::vector<DEVICEID_TYPE>& deviceIds,
+                  const std::list<ComputationNodeBasePtr>& learnableNodes,
+                  const std::vector<ComputationNodeBasePtr>& criterionNodes,
+                  const std::vector<ComputationNodeBasePtr>& evaluationNodes)
+        {
+            m_net = net;
+            m_fullMBLayout = make_shared<MBLayout>();
+            for (auto& x : learnableNodes)
+                m_learnableNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(x));
+            m_criterionNode = dynamic_pointer_cast<ComputationNode<ElemType>>(criterionNodes[0]);
+            for (auto& x : evaluationNodes)
+                m_evaluationNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(x));
+            m_criterionBuffer = make_shared<Matrix<ElemType>>(1, 1, net->GetDeviceId());
+            for (auto& x : m_learnableNodes)
+                m_gradientBuffers.push_back(x->IsParameterUpdateRequired() ? make_shared<Matrix<ElemType>>(net->GetDeviceId()) : nullptr);
+
+            for (auto deviceId : deviceIds)
+            {
+                fprintf(stderr, "DeviceReplicaDispatcher: Creating a replica of the model on GPU %d.\n", (int) deviceId);
+                unique_ptr<Replica> replica(new Replica());
+                replica->net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, modelFileName);
+                replica->criterionNode = replica->net->GetNodeFromName(m_criterionNode->NodeName());
+                for (auto& x : m_evaluationNodes)
+                    replica->evaluationNodes.push_back(replica->net->GetNodeFromName(x->NodeName()));
+                for (auto& x : m_learnableNodes)
+                    replica->learnableNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(replica->net->GetNodeFromName(x->NodeName())));
+                for (auto& node : replica->net->FeatureNodes())
+                    replica->inputMatrices[node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                for (auto& node : replica->net->LabelNodes())
+                    replica->inputMatrices[node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                replica->net->AllocateAllMatrices(replica->evaluationNodes, {}, replica->criterionNode);
+                m_replicas.push_back(std::move(replica));
+            }
+        }
+
+        size_t NumReplicas() const
+        {
+            return m_replicas.size();
+        }
+
+        ComputationNetworkPtr GetReplicaNetwork(size_t i) const
+        {
+            return m_replicas[i]->net;
+        }
+
+        // call together with the main network's StartEvaluateMinibatchLoop()
+        void StartEvaluateMinibatchLoop()
+        {
+            for (auto& replica : m_replicas)
+            {
+                replica->net->StartEvaluateMinibatchLoop(replica->evaluationNodes);
+                replica->net->StartEvaluateMinibatchLoop(replica->criterionNode);
+            }
+        }
+
+        // cut the minibatch in 'inputMatrices' (the main network's) into shards, leave the first one in the main network,
+        // and start the replicas on the others
+        void StartMinibatch(Matrices& inputMatrices, bool needGradients)
+        {
+            m_fullMBLayout->CopyFrom(m_net->GetMBLayoutPtr());
+            // each shard needs at least one parallel sequence, so with fewer sequences than GPUs some replicas sit out
+            m_numShards = min(m_replicas.size() + 1, m_fullMBLayout->GetNumParallelSequences());
+            m_needGradients = needGradients;
+
+            for (size_t k = m_numShards; k-- > 0;) // (the main network's shard last, since it overwrites the full minibatch)
+            {
+                Matrices decimatedMatrices;
+                MBLayoutPtr decimatedLayout;
+                DecimateMinibatch(inputMatrices, decimatedMatrices, m_fullMBLayout, decimatedLayout, (int) m_numShards, (int) k);
+                ComputationNetworkPtr net = (k == 0) ? m_net : m_replicas[k - 1]->net;
+                const Matrices& netInputMatrices = (k == 0) ? inputMatrices : m_replicas[k - 1]->inputMatrices;
+                for (auto& x : decimatedMatrices)
+                {
+                    // the shards are cut on the main GPU, and then moved; that works for sparse inputs as well
+                    x.second->TransferToDeviceIfNotThere(net->GetDeviceId(), true);
+                    netInputMatrices.at(x.first)->SetValue(*x.second);
+                    delete x.second;
+                }
+                net->GetMBLayoutPtr()->CopyFrom(decimatedLayout);
+                for (auto& node : net->FeatureNodes())
+                    node->NotifyFunctionValuesMBSizeModified();
+                for (auto& node : net->LabelNodes())
+                    node->NotifyFunctionValuesMBSizeModified();
+                net->DetermineActualMBSizeFromFeatures();
+                ComputationNetwork::BumpEvalTimeStamp(net->FeatureNodes());
+                ComputationNetwork::BumpEvalTimeStamp(net->LabelNodes());
+            }
+
+            for (size_t k = 1; k < m_numShards; k++)
+            {
+                Replica* replica = m_replicas[k - 1].get();
+                replica->exception = nullptr;
+                replica->thread = std::thread([this, replica]()
+                                              {
+                                                  try
+                                                  {
+                                                      RunReplica(*replica);
+                                                  }
+                                                  catch (...)
+                                                  {
+                                                      replica->exception = std::current_exception();
+                                                  }
+                                              });
+            }
+        }
+
+        // wait for the replicas, and sum their gradients and criteria into the main network's
+        void FinishMinibatch()
+        {
+            for (size_t k = 1; k < m_numShards; k++)
+                m_replicas[k - 1]->thread.join();
+            for (size_t k = 1; k < m_numShards; k++)
+                if (m_replicas[k - 1]->exception)
+                    std::rethrow_exception(m_replicas[k - 1]->exception);
+
+            for (size_t k = 1; k < m_numShards; k++)
+            {
+                const Replica& replica = *m_replicas[k - 1];
+                if (m_needGradients)
+                {
+                    for (size_t i = 0; i < m_learnableNodes.size(); i++)
+                    {
+                        if (!m_gradientBuffers[i])
+                            continue;
+                        m_gradientBuffers[i]->SetValueFromOtherDevice(replica.learnableNodes[i]->Gradient());
+                        m_learnableNodes[i]->Gradient() += *m_gradientBuffers[i];
+                    }
+                }
+                m_criterionBuffer->SetValueFromOtherDevice(dynamic_pointer_cast<ComputationNode<ElemType>>(replica.criterionNode)->Value());
+                Matrix<ElemType>::AddElementToElement(*m_criterionBuffer, 0, 0, m_criterionNode->Value(), 0, 0);
+                for (size_t i = 0; i < m_evaluationNodes.size(); i++)
+                {
+                    m_criterionBuffer->SetValueFromOtherDevice(dynamic_pointer_cast<ComputationNode<ElemType>>(replica.evaluationNodes[i])->Value());
+                    Matrix<ElemType>::AddElementToElement(*m_criterionBuffer, 0, 0, m_evaluationNodes[i]->Value(), 0, 0);
+                }
+            }
+
+            // the caller counts the samples of the whole minibatch
+            m_net->GetMBLayoutPtr()->CopyFrom(m_fullMBLayout);
+            m_numShards = 0;
+        }
+
+    private:
+        // on the replica's worker thread
+        void RunReplica(Replica& replica)
+        {
+            for (size_t i = 0; i < m_learnableNodes.size(); i++)
+                replica.learnableNodes[i]->Value().SetValueFromOtherDevice(m_learnableNodes[i]->Value());
+            replica.net->ForwardProp(replica.evaluationNodes);
+            replica.net->ForwardProp(replica.criterionNode);
+            if (m_needGradients)
+                replica.net->Backprop(replica.criterionNode);
+        }
+
+        ComputationNetworkPtr m_net;
+        std::vector<shared_ptr<ComputationNode<ElemType>>> m_learnableNodes;
+        shared_ptr<ComputationNode<ElemType>> m_criterionNode;
+        std::vector<shared_ptr<ComputationNode<ElemType>>> m_evaluationNodes;
+        std::vector<unique_ptr<Replica>> m_replicas;
+        std::vector<shared_ptr<Matrix<ElemType>>> m_gradientBuffers; // [i] for m_learnableNodes[i] (null if not updated), on the main GPU
+        shared_ptr<Matrix<ElemType>> m_criterionBuffer;
+        MBLayoutPtr m_fullMBLayout; // of the current minibatch, before it was cut into shards
+        size_t m_numShards;         // of the current minibatch
+        bool m_needGradients;
+    };
+
+    // ===================================================================
+    // HogwildDispatcher -- lock-free asynchronous SGD on several CPU threads
+    // ===================================================================
+
+    // Each worker thread has its own copy of the network, whose parameters are views of the main network's values, so the
+    // workers share one set of parameters and only the activations are per worker. The caller reads the minibatches and hands
+    // each to the next worker in turn, without waiting unless that worker is still busy with its previous one. A worker runs
+    // forward and backward, and subtracts learning rate times its gradient from the shared values right away, without locks
+    // (Hogwild!). Sparse gradients (e.g. of LookupTable or of Times with a sparse input) only touch the columns seen in the
+    // minibatch, so the workers rarely write to the same memory. With 'atomicUpdates', each element is updated atomically.
+    // The main network itself runs no minibatches. The criteria of a minibatch are handed to the caller when its worker is
+    // taken for another one, or in Finish(). The usage is:
+    //        dispatcher.Init(net, modelFileName, numWorkers, atomicUpdates, learnableNodes, criterionNodes, evaluationNodes);
+    //        dispatcher.StartEvaluateMinibatchLoop();
+    //        while (GetMinibatchIntoNetwork(..., inputMatrices, ...))
+    //            dispatcher.Dispatch(inputMatrices, learnRatePerSample, criterion, evalErrors);
+    //        dispatcher.Finish(criterion, evalErrors);
+
+    template <class ElemType>
+    class HogwildDispatcher
+    {
+        typedef std::map<std::wstring, Matrix<ElemType>*> Matrices;
+
+        struct Worker
+        {
+            ComputationNetworkPtr net;
+            Matrices inputMatrices;                                             // by name, like the main network's
+            std::vector<shared_ptr<ComputationNode<ElemType>>> learnableNodes; // [i] is the copy of m_learnableNodes[i]
+            ComputationNodeBasePtr criterionNode;
+            std::vector<ComputationNodeBasePtr> evaluationNodes;
+            std::thread thread;
+            std::exception_ptr exception;
+            bool hasCriteria; // of a minibatch not yet handed to the caller
+        };
+
+    public:
+        HogwildDispatcher()
+            : m_atomicUpdates(false), m_threadsPerWorker(1), m_nextWorker(0)
+        {
+        }
+
+        ~HogwildDispatcher()
+        {
+            for (auto& worker : m_workers) // (only if Finish() was skipped by an exception)
+                if (worker->thread.joinable())
+                    worker->thread.join();
+        }
+
+        // create 'numWorkers' copies of 'net' from 'modelFileName', which must hold its model
+        void Init(ComputationNetworkPtr net, const std::wstring& modelFileName, size_t numWorkers, bool atomicUpdates,
+                  const std::list<ComputationNodeBasePtr>& learnableNodes,
+                  const std::vector<ComputationNodeBasePtr>& criterionNodes,
+                  const std::vector<ComputationNodeBasePtr>& evaluationNodes)
+        {
+            if (net->GetDeviceId() != CPUDEVICE)
+                InvalidArgument("HogwildDispatcher: The model must be on the CPU.");
+            m_net = net;
+            m_atomicUpdates = atomicUpdates;
+            // the workers share the cores; each uses its share for the OpenMP loops and BLAS calls within its matrix operations
+            m_threadsPerWorker = max(1, (int) std::thread::hardware_concurrency() / (int) numWorkers);
+            for (auto& x : learnableNodes)
+                m_learnableNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(x));
+            fprintf(stderr, "HogwildDispatcher: Creating %d copies of the model, for training threads with %d cores each%s.\n",
+                    (int) numWorkers, m_threadsPerWorker, atomicUpdates ? " and atomic updates" : "");
+            for (size_t k = 0; k < numWorkers; k++)
+            {
+                unique_ptr<Worker> worker(new Worker());
+                worker->net = ComputationNetwork::CreateFromFile<ElemType>(CPUDEVICE, modelFileName);
+                worker->criterionNode = worker->net->GetNodeFromName(criterionNodes[0]->NodeName());
+                for (auto& x : evaluationNodes)
+                    worker->evaluationNodes.push_back(worker->net->GetNodeFromName(x->NodeName()));
+                for (auto& x : m_learnableNodes)
+                    worker->learnableNodes.push_back(dynamic_pointer_cast<ComputationNode<ElemType>>(worker->net->GetNodeFromName(x->NodeName())));
+                for (auto& node : worker->net->FeatureNodes())
+                    worker->inputMatrices[node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                for (auto& node : worker->net->LabelNodes())
+                    worker->inputMatrices[node->NodeName()] = &dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                worker->net->AllocateAllMatrices(worker->evaluationNodes, {}, worker->criterionNode);
+                worker->hasCriteria = false;
+                m_workers.push_back(std::move(worker));
+            }
+        }
+
+        size_t NumWorkers() const
+        {
+            return m_workers.size();
+        }
+
+        ComputationNetworkPtr GetWorkerNetwork(size_t k) const
+        {
+            return m_workers[k]->net;
+        }
+
+        // call together with the main network's StartEvaluateMinibatchLoop()
+        // This also points the workers' parameters at the main network's values again, which may have been reallocated since
+        // (e.g. by reading back the best model).
+        void StartEvaluateMinibatchLoop()
+        {
+            for (auto& worker : m_workers)
+            {
+                for (size_t i = 0; i < m_learnableNodes.size(); i++)
+                {
+                    auto& value = m_learnableNodes[i]->Value();
+                    worker->learnableNodes[i]->Value().SetValue(value.GetNumRows(), value.GetNumCols(), CPUDEVICE, value.BufferPointer(), matrixFlagDontOwnBuffer);
+                }
+                worker->net->StartEvaluateMinibatchLoop(worker->evaluationNodes);
+                worker->net->StartEvaluateMinibatchLoop(worker->criterionNode);
+            }
+            m_nextWorker = 0;
+        }
+
+        // hand the minibatch in 'inputMatrices' (the main network's) to the next worker; learnRatePerSample = 0 runs it without updates
+        // If that worker was still busy, this waits for it, and adds the criteria of its previous minibatch to 'criterion' and 'evalErrors'.
+        void Dispatch(const Matrices& inputMatrices, double learnRatePerSample, Matrix<ElemType>& criterion, Matrix<ElemType>& evalErrors)
+        {
+            Worker* worker = m_workers[m_nextWorker].get();
+            m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+            Collect(*worker, criterion, evalErrors);
+
+            for (auto& x : inputMatrices)
+                worker->inputMatrices.at(x.first)->SetValue(*x.second);
+            worker->net->GetMBLayoutPtr()->CopyFrom(m_net->GetMBLayoutPtr());
+            for (auto& node : worker->net->FeatureNodes())
+                node->NotifyFunctionValuesMBSizeModified();
+            for (auto& node : worker->net->LabelNodes())
+                node->NotifyFunctionValuesMBSizeModified();
+            worker->net->DetermineActualMBSizeFromFeatures();
+            ComputationNetwork::BumpEvalTimeStamp(worker->net->FeatureNodes());
+            ComputationNetwork::BumpEvalTimeStamp(worker->net->LabelNodes());
+
+            worker->exception = nullptr;
+            worker->hasCriteria = true;
+            worker->thread = std::thread([this, worker, learnRatePerSample]()
+                                         {
+                                             try
+                                             {
+                                                 RunWorker(*worker, (ElemType) learnRatePerSample);
+                                             }
+                                             catch (...)
+                                             {
+                                                 worker->exception = std::current_exception();
+                                             }
+                                         });
+        }
+
+        // wait for all workers, and add the criteria of their last minibatches
+        void Finish(Matrix<ElemType>& criterion, Matrix<ElemType>& evalErrors)
+        {
+            for (auto& worker : m_workers)
+                Collect(*worker, criterion, evalErrors);
+        }
+
+    private:
+        void Collect(Worker& worker, Matrix<ElemType>& criterion, Matrix<ElemType>& evalErrors)
+        {
+            if (worker.thread.joinable())
+                worker.thread.join();
+            if (worker.exception)
+            {
+                worker.hasCriteria = false;
+                std::rethrow_exception(worker.exception);
+            }
+            if (!worker.hasCriteria)
+                return;
+            Matrix<ElemType>::AddElementToElement(dynamic_pointer_cast<ComputationNode<ElemType>>(worker.criterionNode)->Value(), 0, 0, criterion, 0, 0);
+            for (size_t i = 0; i < worker.evaluationNodes.size(); i++)
+                Matrix<ElemType>::AddElementToElement(dynamic_pointer_cast<ComputationNode<ElemType>>(worker.evaluationNodes[i])->Value(), 0, 0, evalErrors, 0, i);
+            worker.hasCriteria = false;
+        }
+
+        // on the worker's thread
+        void RunWorker(Worker& worker, ElemType learnRatePerSample)
+        {
+            CPUMatrix<ElemType>::SetNumThreads(m_threadsPerWorker); // (for this thread's OpenMP loops)
+            worker.net->ForwardProp(worker.evaluationNodes);
+            worker.net->ForwardProp(worker.criterionNode);
+            if (learnRatePerSample == 0)
+                return;
+            worker.net->Backprop(worker.criterionNode);
+
+            // value -= learnRatePerSample * gradient, in the shared values
+            std::vector<size_t> columnIds;
+            std::vector<ElemType> columns;
+            for (size_t i = 0; i < m_learnableNodes.size(); i++)
+            {
+                if (!m_learnableNodes[i]->IsParameterUpdateRequired())
+                    continue;
+                ElemType* value = worker.learnableNodes[i]->Value().BufferPointer();
+                auto& gradient = worker.learnableNodes[i]->Gradient();
+                if (gradient.GetMatrixType() == SPARSE) // (block-col: only the columns seen in the minibatch)
+                {
+                    const size_t numRows = gradient.GetNumRows();
+                    gradient.GetBlockColumns(columnIds, columns);
+                    for (size_t j = 0; j < columnIds.size(); j++)
+                        AddScaled(value + columnIds[j] * numRows, columns.data() + j * numRows, numRows, -learnRatePerSample);
+                }
+                else
+                    AddScaled(value, gradient.BufferPointer(), gradient.GetNumElements(), -learnRatePerSample);
+            }
+        }
+
+        // to[j] += alpha * from[j], without locks; atomically per element if m_atomicUpdates
+        void AddScaled(ElemType* to, const ElemType* from, size_t n, ElemType alpha) const
+        {
+            if (m_atomicUpdates)
+            {
+                for (size_t j = 0; j < n; j++)
+                {
+                    const ElemType delta = alpha * from[j];
+#pragma omp atomic
+                    to[j] += delta;
+                }
+            }
+            else
+            {
+                for (size_t j = 0; j < n; j++)
+                    to[j] += alpha * from[j];
+            }
+        }
+
+        ComputationNetworkPtr m_net;
+        std::vector<shared_ptr<ComputationNode<ElemType>>> m_learnableNodes;
+        std::vector<unique_ptr<Worker>> m_workers;
+        bool m_atomicUpdates;
+        int m_threadsPerWorker;
+        size_t m_nextWorker; // the one that gets the next minibatch
+    };
 };
 } } }
@@ -10,7 +10,7 @@ class IDistGradAggregator
 {
 public:
     IDistGradAggregator(MPIWrapper* mpi)
-        : m_mpi(mpi)
+        : m_mpi(mpi), m_numGradientBytesSent(0)
     {
     }
 
@@ -21,6 +21,16 @@ public:
     // Returns a boolean indicating if any samples were processed
     virtual bool AggregateGradients(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, int epochNumber) = 0;
 
+    // Aggregators that overlap aggregation with backprop want to be told as soon as gradients[i] is final,
+    // so that they can start aggregating it; AggregateGradients() then completes the aggregation of all gradients.
+    virtual bool OverlapsWithBackprop() const
+    {
+        return false;
+    }
+    virtual void GradientIsFinal(const std::vector<Matrix<ElemType>*>& gradients, size_t i)
+    {
+    }
+
     size_t NumProc()
     {
         return m_mpi->NumNodesInUse();
@@ -36,14 +46,50 @@ public:
         m_mpi->WaitAll();
     }
 
+    // bytes of gradients (as quantized or sparsified, not counting headers) this rank has put into collectives so far
+    size_t GetNumGradientBytesSent() const
+    {
+        return m_numGradientBytesSent;
+    }
+
+protected:
+    // Sum up the headers on the main node, and send the result back to everyone.
+    // recvHeaders are NumProc() - 1 receive buffers, only used on the main node.
+    // (The tags are based on the number of gradient matrices, to not collide with their own messages.)
+    void AggregateHeader(DistGradHeader* headerCPU, const std::vector<DistGradHeader*>& recvHeaders, size_t numGradMatrices)
+    {
+        if (m_mpi->IsMainNode())
+        {
+            for (size_t j = 0; j < NumProc() - 1; ++j)
+            {
+                int source = (j >= MyRank()) ? (j + 1) : j;
+                MPI_Recv(recvHeaders[j], recvHeaders[j]->Size(), MPI_CHAR, source, numGradMatrices, m_mpi->Communicator(), MPI_STATUS_IGNORE) || MpiFail("MPI_Recv");
+                headerCPU->Aggregate(recvHeaders[j], true);
+            }
+            for (size_t j = 0; j < NumProc() - 1; ++j)
+            {
+                int dest = (j >= MyRank()) ? (j + 1) : j;
+                MPI_Send(headerCPU, headerCPU->Size(), MPI_CHAR, dest, numGradMatrices + 1 + numGradMatrices, m_mpi->Communicator()) || MpiFail("MPI_Send");
+            }
+        }
+        else
+        {
+            MPI_Send(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), numGradMatrices, m_mpi->Communicator()) || MpiFail("MPI_Send");
+            MPI_Recv(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), numGradMatrices + 1 + numGradMatrices, m_mpi->Communicator(), MPI_STATUS_IGNORE) || MpiFail("MPI_Recv");
+        }
+    }
+
 protected:
     MPIWrapper* m_mpi;
+    size_t m_numGradientBytesSent;
 };
 
-#define UsingIDistGradAggregatorMembers           \
-    \
-protected:                                        \
-    using IDistGradAggregator<ElemType>::m_mpi;   \
-    using IDistGradAggregator<ElemType>::NumProc; \
-    using IDistGradAggregator<ElemType>::MyRank
+#define UsingIDistGradAggregatorMembers                          \
+                                                                 \
+protected:                                                       \
+    using IDistGradAggregator<ElemType>::m_mpi;                  \
+    using IDistGradAggregator<ElemType>::m_numGradientBytesSent; \
+    using IDistGradAggregator<ElemType>::NumProc;                \
+    using IDistGradAggregator<ElemType>::MyRank;                 \
+    using IDistGradAggregator<ElemType>::AggregateHeader
 } } }
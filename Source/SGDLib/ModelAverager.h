@@ -0,0 +1,321 @@
+#pragma once
+
+#include "ComputationNode.h"
+#include "MPIWrapper.h"
+#include "CUDAPageLockedMemAllocator.h"
+#include "GPUDataTransferer.h"
+#include "MatrixQuantizerImpl.h"
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Model averaging for ModelAveragingSGD, with options beyond the plain synchronous average of SGD::ModelAveragingSync():
+//  - useAsync: the average is computed with MPI_Iallreduce() while the workers go on training. It is applied
+//    at the next sync point, keeping whatever the worker has learned since: W += A - S, where S is the snapshot
+//    that went into the average A. So a slow worker delays nobody, it just contributes an older model.
+//  - elasticity (alpha in (0, 1]): instead of replacing the models by the average, move them only
+//    part of the way towards it, W += alpha (A - S), as in elastic averaging SGD.
+//  - blockMomentum (mu in [0, 1)): block-wise model update filtering. The averaged progress since the last
+//    global model G is treated as a gradient of the block, with momentum: v = mu v + blockLearningRate (A - G),
+//    G += v, and the workers continue from G + mu v (Nesterov-style), i.e. W += G + mu v - S.
+// Each model is weighted by the number of samples it has seen since the last sync (and at least 1).
+// In the asynchronous case, each worker decides on its own when to sync. A worker that has run out of data keeps
+// taking part in the averages in Finish() until all workers have, and the last of these makes all models the same.
+// With useCudaAwareMpi (and a CUDA-aware MPI), the weighted models are summed up in their device memory, without host buffers.
+template <class ElemType>
+class ModelAverager
+{
+public:
+    ModelAverager(MPIWrapper* mpi, bool useAsync, double elasticity, double blockMomentum, double blockLearningRate, bool useCudaAwareMpi = false)
+        : m_mpi(mpi), m_useAsync(useAsync), m_elasticity(elasticity), m_blockMomentum(blockMomentum), m_blockLearningRate(blockLearningRate), m_useCudaAwareMpi(useCudaAwareMpi && mpi->IsCudaAware()), m_allocator(nullptr), m_hasGlobalModel(false), m_pending(false), m_countsRequest(MPI_REQUEST_NULL)
+    {
+        if ((m_elasticity <= 0) || (m_elasticity > 1))
+            InvalidArgument("ModelAverager: elasticity must be in the range (0, 1].");
+        if ((m_blockMomentum < 0) || (m_blockMomentum >= 1))
+            InvalidArgument("ModelAverager: blockMomentum must be in the range [0, 1).");
+        if ((m_blockMomentum > 0) && (m_elasticity != 1))
+            InvalidArgument("ModelAverager: elasticity and blockMomentum cannot be combined.");
+    }
+
+    // Called at each sync point. Returns the number of samples that went into the average that was applied
+    // (in the asynchronous case, the one started at the previous sync point; 0 if there was none).
+    size_t Sync(const std::list<ComputationNodeBasePtr>& learnableNodes, size_t numSamplesSinceLastSync)
+    {
+        auto parameters = GetParameters(learnableNodes);
+        size_t numSamplesAveraged = 0;
+        if (m_pending)
+            numSamplesAveraged = Complete(parameters);
+
+        Start(parameters, numSamplesSinceLastSync, true /*isTraining*/);
+        if (!m_useAsync)
+            numSamplesAveraged = Complete(parameters);
+        return numSamplesAveraged;
+    }
+
+    // Called once per minibatch, gives MPI a chance to make progress on the pending average.
+    void Progress()
+    {
+        if (!m_pending)
+            return;
+        m_mpi->Test(&m_countsRequest);
+        for (auto& p : m_parameterStates)
+            m_mpi->Test(&p.m_request);
+    }
+
+    // Called at the end of an epoch. Afterwards, all workers have the same model.
+    // Returns the number of samples that went into the averages, like Sync().
+    size_t Finish(const std::list<ComputationNodeBasePtr>& learnableNodes, size_t numSamplesSinceLastSync)
+    {
+        auto parameters = GetParameters(learnableNodes);
+        size_t numSamplesAveraged = 0;
+        if (m_pending)
+            numSamplesAveraged += Complete(parameters);
+
+        // These take the full average, since there is no local progress. Once no worker is training any more,
+        // the models and their weights are all final, so after that round all models are the same.
+        double elasticity = m_elasticity;
+        m_elasticity = 1;
+        do
+        {
+            Start(parameters, numSamplesSinceLastSync, false /*isTraining*/);
+            numSamplesAveraged += Complete(parameters);
+            numSamplesSinceLastSync = 0;
+        } while (m_countsTotal[NumTraining] > 0);
+        m_elasticity = elasticity;
+        return numSamplesAveraged;
+    }
+
+private:
+    struct ParameterState
+    {
+        std::unique_ptr<Matrix<ElemType>> m_snapshot;      // S; only if asynchronous
+        std::unique_ptr<Matrix<ElemType>> m_average;       // A, then scratch; what MPI sums up in the device memory with useCudaAwareMpi
+        std::unique_ptr<Matrix<ElemType>> m_globalModel;   // G; only with block momentum
+        std::unique_ptr<Matrix<ElemType>> m_blockVelocity; // v; only with block momentum
+        std::shared_ptr<ElemType> m_buffer;                // host buffer for MPI, in pinned memory for GPU devices
+        std::unique_ptr<GPUDataTransferer<ElemType>> m_gpuDataTransferer;
+        MPI_Request m_request;
+
+        ParameterState()
+            : m_request(MPI_REQUEST_NULL)
+        {
+        }
+    };
+
+    std::vector<Matrix<ElemType>*> GetParameters(const std::list<ComputationNodeBasePtr>& learnableNodes)
+    {
+        std::vector<Matrix<ElemType>*> parameters;
+        for (auto& node : learnableNodes)
+        {
+            if (node->IsParameterUpdateRequired())
+                parameters.push_back(&dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value());
+        }
+
+        if (m_parameterStates.empty())
+        {
+            for (auto* parameter : parameters)
+                m_parameterStates.push_back(CreateState(*parameter));
+        }
+        else if (m_parameterStates.size() != parameters.size())
+            LogicError("ModelAverager: The set of parameters has changed.");
+
+        return parameters;
+    }
+
+    ParameterState CreateState(const Matrix<ElemType>& parameter)
+    {
+        int deviceId = parameter.GetDeviceId();
+        size_t numRows = parameter.GetNumRows();
+        size_t numCols = parameter.GetNumCols();
+        ParameterState state;
+        if (m_useAsync)
+            state.m_snapshot.reset(new Matrix<ElemType>(numRows, numCols, deviceId));
+        state.m_average.reset(new Matrix<ElemType>(numRows, numCols, deviceId));
+        if (m_blockMomentum > 0)
+        {
+            state.m_globalModel.reset(new Matrix<ElemType>(numRows, numCols, deviceId));
+            state.m_blockVelocity.reset(new Matrix<ElemType>(numRows, numCols, deviceId));
+            state.m_blockVelocity->SetValue(0);
+        }
+
+        size_t numElements = parameter.GetNumElements();
+        if ((deviceId != CPUDEVICE) && m_useCudaAwareMpi)
+        {
+            // no host buffer
+        }
+        else if (deviceId != CPUDEVICE)
+        {
+            if (m_allocator == nullptr)
+                m_allocator = &CUDAPageLockedMemArena::GetSharedArena(deviceId);
+            MemAllocator* allocator = m_allocator;
+            state.m_buffer.reset((ElemType*) allocator->Malloc(numElements * sizeof(ElemType)), [allocator](ElemType* p)
+                                 {
+                                     allocator->Free(p);
+                                 });
+            state.m_gpuDataTransferer.reset(new GPUDataTransferer<ElemType>(deviceId, false /*useConcurrentStreams*/));
+        }
+        else
+        {
+            state.m_buffer.reset(new ElemType[numElements], [](ElemType* p)
+                                 {
+                                     delete[] p;
+                                 });
+        }
+        return state;
+    }
+
+    // start the all-reduce of the weighted models
+    void Start(const std::vector<Matrix<ElemType>*>& parameters, size_t numSamplesSinceLastSync, bool isTraining)
+    {
+        // (a worker without samples still takes part, but with a negligible weight; this keeps the total positive)
+        m_counts[Weight] = (int) std::max(numSamplesSinceLastSync, (size_t) 1);
+        m_counts[NumSamples] = (int) numSamplesSinceLastSync;
+        m_counts[NumTraining] = isTraining ? 1 : 0;
+        for (size_t k = 0; k < NumCounts; k++)
+            m_countsTotal[k] = m_counts[k];
+        m_mpi->AllReduceAsync(m_countsTotal, NumCounts, &m_countsRequest);
+
+        int deviceId = parameters[0]->GetDeviceId();
+        if ((deviceId != CPUDEVICE) && m_useCudaAwareMpi)
+        {
+            for (size_t i = 0; i < parameters.size(); i++)
+            {
+                auto& state = m_parameterStates[i];
+                if (m_useAsync)
+                    state.m_snapshot->SetValue(*parameters[i]);
+                state.m_average->SetValue(*parameters[i]);
+                Matrix<ElemType>::Scale((ElemType) m_counts[Weight], *state.m_average);
+            }
+
+            // MPI reads the device memory without regard to our streams
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+            for (size_t i = 0; i < parameters.size(); i++)
+                m_mpi->AllReduceAsync(m_parameterStates[i].m_average->BufferPointer(), parameters[i]->GetNumElements(), &m_parameterStates[i].m_request);
+            m_pending = true;
+            return;
+        }
+        if (deviceId != CPUDEVICE)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+        }
+
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            auto& state = m_parameterStates[i];
+            if (m_useAsync)
+                state.m_snapshot->SetValue(*parameters[i]);
+            if (deviceId != CPUDEVICE)
+                state.m_gpuDataTransferer->CopyGPUToCPUAsync(parameters[i]->BufferPointer(), parameters[i]->GetNumElements(), state.m_buffer.get());
+            else
+                memcpy(state.m_buffer.get(), parameters[i]->BufferPointer(), parameters[i]->GetNumElements() * sizeof(ElemType));
+        }
+
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            auto& state = m_parameterStates[i];
+            if (deviceId != CPUDEVICE)
+                state.m_gpuDataTransferer->WaitForCopyGPUToCPUAsync();
+            ElemType* buffer = state.m_buffer.get();
+            size_t numElements = parameters[i]->GetNumElements();
+            for (size_t j = 0; j < numElements; j++)
+                buffer[j] *= (ElemType) m_counts[Weight];
+            m_mpi->AllReduceAsync(buffer, numElements, &state.m_request);
+        }
+        m_pending = true;
+    }
+
+    // wait for the pending all-reduce, and update the models with it
+    size_t Complete(const std::vector<Matrix<ElemType>*>& parameters)
+    {
+        m_mpi->Wait(&m_countsRequest);
+        const ElemType factor = (ElemType) 1 / m_countsTotal[Weight];
+
+        int deviceId = parameters[0]->GetDeviceId();
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            auto& state = m_parameterStates[i];
+            m_mpi->Wait(&state.m_request);
+            if ((deviceId != CPUDEVICE) && m_useCudaAwareMpi)
+            {
+                Matrix<ElemType>::Scale(factor, *state.m_average);
+                continue;
+            }
+            ElemType* buffer = state.m_buffer.get();
+            size_t numElements = parameters[i]->GetNumElements();
+            for (size_t j = 0; j < numElements; j++)
+                buffer[j] *= factor;
+            if (deviceId != CPUDEVICE)
+                state.m_gpuDataTransferer->CopyCPUToGPUAsync(buffer, numElements, state.m_average->BufferPointer());
+            else
+                memcpy(state.m_average->BufferPointer(), buffer, numElements * sizeof(ElemType));
+        }
+
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            auto& state = m_parameterStates[i];
+            if ((deviceId != CPUDEVICE) && !m_useCudaAwareMpi)
+                state.m_gpuDataTransferer->WaitForCopyCPUToGPUAsync();
+            Update(*parameters[i], state);
+        }
+
+        m_hasGlobalModel = (m_blockMomentum > 0);
+        m_pending = false;
+        return m_countsTotal[NumSamples];
+    }
+
+    // apply the average in state.m_average to the parameter
+    void Update(Matrix<ElemType>& parameter, ParameterState& state)
+    {
+        Matrix<ElemType>& average = *state.m_average;
+        const Matrix<ElemType>& snapshot = m_useAsync ? *state.m_snapshot : parameter;
+        if ((m_blockMomentum > 0) && !m_hasGlobalModel)
+        {
+            // the first average becomes the global model
+            state.m_globalModel->SetValue(average);
+        }
+        if (m_blockMomentum > 0)
+        {
+            // v = mu v + eta (A - G); G += v; W += G + mu v - S
+            Matrix<ElemType>& globalModel = *state.m_globalModel;
+            Matrix<ElemType>& blockVelocity = *state.m_blockVelocity;
+            average -= globalModel;
+            Matrix<ElemType>::ScaleAndAdd((ElemType) m_blockLearningRate, average, (ElemType) m_blockMomentum, blockVelocity);
+            globalModel += blockVelocity;
+            average.SetValue(globalModel);
+            Matrix<ElemType>::ScaleAndAdd((ElemType) m_blockMomentum, blockVelocity, average);
+        }
+        // W += alpha (A - S), with A the target
+        average -= snapshot;
+        Matrix<ElemType>::ScaleAndAdd((ElemType) m_elasticity, average, parameter);
+    }
+
+private:
+    MPIWrapper* m_mpi;
+    bool m_useAsync;
+    double m_elasticity;
+    double m_blockMomentum;
+    double m_blockLearningRate;
+    bool m_useCudaAwareMpi;
+
+    MemAllocator* m_allocator; // not owned
+    std::vector<ParameterState> m_parameterStates;
+    bool m_hasGlobalModel; // with block momentum, after the first average
+
+    // the pending average
+    bool m_pending;
+    enum
+    {
+        Weight,
+        NumSamples,
+        NumTraining, // workers that have not reached Finish() yet
+        NumCounts
+    };
+    int m_counts[NumCounts];
+    int m_countsTotal[NumCounts]; // (all-reduced in place)
+    MPI_Request m_countsRequest;
+};
+} } }
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "IDistGradAggregator.h"
+#include "NcclHierarchicalAllReduce.h"
+#include "TimerUtility.h"
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Hierarchical gradient aggregation for GPUs: the gradients are summed up with NCCL among the workers
+// on the same machine, into the local leader, which is the only one to copy them to the host and all-reduce
+// them with MPI with the leaders of the other machines. The result is then broadcast with NCCL.
+// The other workers never copy their gradients to the host.
+template <class ElemType>
+class NcclDistGradAggregator : public IDistGradAggregator<ElemType>
+{
+    UsingIDistGradAggregatorMembers;
+
+public:
+    NcclDistGradAggregator(MPIWrapper* mpi, int syncStatsTrace)
+        : IDistGradAggregator<ElemType>(mpi), m_allReduce(mpi, "NcclDistGradAggregator"), m_initialized(false), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0)
+    {
+    }
+
+    ~NcclDistGradAggregator()
+    {
+        for (size_t i = 0; i < m_recvHeaders.size(); ++i)
+        {
+            DistGradHeader::Destroy(m_recvHeaders[i]);
+        }
+    }
+
+    // Aggregate the gradient matrices across all nodes
+    bool AggregateGradients(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, int /*epochNumber*/) override
+    {
+        if (!m_initialized)
+        {
+            Initialize(headerCPU->numEvalNode);
+            m_initialized = true;
+        }
+
+        bool showSyncPerfStats = (m_syncStatsTrace > 0) && ((m_iterationCount % m_syncStatsTrace) == 0);
+        m_iterationCount++;
+
+        Timer aggregationTimer;
+        int deviceId = gradients[0]->GetDeviceId();
+        if (showSyncPerfStats)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+            aggregationTimer.Start();
+        }
+
+        // If the current node did not process any samples, the gradients should be zero'd
+        size_t numGradMatrices = gradients.size();
+        if (headerCPU->numSamples == 0)
+        {
+            for (size_t i = 0; i < numGradMatrices; ++i)
+            {
+                gradients[i]->SetValue(0);
+            }
+        }
+
+        // the header is small, it goes through the main node, while the gradients are being summed up on the GPUs
+        m_allReduce.AllReduce(gradients, [&]()
+                              {
+                                  AggregateHeader(headerCPU, m_recvHeaders, numGradMatrices);
+                              });
+        if (m_allReduce.IsLocalLeader() && (m_allReduce.NumMachines() > 1))
+        {
+            for (size_t i = 0; i < numGradMatrices; ++i)
+                m_numGradientBytesSent += gradients[i]->GetNumElements() * sizeof(ElemType);
+        }
+
+        if (showSyncPerfStats)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+            aggregationTimer.Stop();
+            double epochTime = aggregationTimer.ElapsedSeconds();
+            fprintf(stderr, "Actual gradient aggregation time: %.6g\n", epochTime);
+        }
+
+        return (headerCPU->numSamples != 0);
+    }
+
+private:
+    void Initialize(int numEvalNode)
+    {
+        if (m_mpi->IsMainNode())
+        {
+            for (size_t i = 0; i < NumProc() - 1; ++i)
+            {
+                m_recvHeaders.push_back(DistGradHeader::Create(numEvalNode));
+            }
+        }
+    }
+
+private:
+    NcclHierarchicalAllReduce<ElemType> m_allReduce;
+    bool m_initialized;
+
+    std::vector<DistGradHeader*> m_recvHeaders;
+
+    int m_syncStatsTrace;
+
+    // Only used for controlling frequency of measuring/showing gradient aggregation perf stats
+    size_t m_iterationCount;
+};
+} } }
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "MPIWrapper.h"
+#include "Matrix.h"
+#include "CUDAPageLockedMemAllocator.h"
+#include "GPUDataTransferer.h"
+#include "NcclComm.h"
+#include <memory>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Sums up GPU buffers across all workers in place, hierarchically: with NCCL (i.e. peer-to-peer between the GPUs,
+// without going through host memory) among the workers on the same machine, into the local leader, which is the
+// only one to copy them to the host and all-reduce them with MPI with the leaders of the other machines.
+// The result is then broadcast with NCCL. The buffers must be dense, on the GPU, and have the same sizes in every
+// call; all workers must call AllReduce() together.
+template <class ElemType>
+class NcclHierarchicalAllReduce
+{
+public:
+    NcclHierarchicalAllReduce(MPIWrapper* mpi, const char* who)
+        : m_mpi(mpi), m_who(who), m_localComm(MPI_COMM_NULL), m_leaderComm(MPI_COMM_NULL), m_localRank(0), m_numLeaders(0), m_allocator(nullptr)
+    {
+    }
+
+    ~NcclHierarchicalAllReduce()
+    {
+        if (m_leaderComm != MPI_COMM_NULL)
+            MPI_Comm_free(&m_leaderComm);
+        if (m_localComm != MPI_COMM_NULL)
+            MPI_Comm_free(&m_localComm);
+    }
+
+    DISABLE_COPY_AND_MOVE(NcclHierarchicalAllReduce);
+
+    // The reductions are queued on the compute stream, so the caller need not wait for them before
+    // issuing further work on it. 'betweenReduceAndBroadcast' runs (once the leaders' host step is done)
+    // before the result is broadcast, e.g. to exchange some small other data over MPI meanwhile.
+    template <class FUNCTION>
+    void AllReduce(const std::vector<Matrix<ElemType>*>& buffers, const FUNCTION& betweenReduceAndBroadcast)
+    {
+        if (!m_ncclComm)
+            Initialize(buffers);
+
+        // sum up within the machine, into the leader (local rank 0)
+        m_ncclComm->GroupStart();
+        for (auto buffer : buffers)
+            m_ncclComm->Reduce(buffer->BufferPointer(), buffer->GetNumElements(), 0);
+        m_ncclComm->GroupEnd();
+
+        // the leaders sum up across machines
+        if ((m_localRank == 0) && (m_numLeaders > 1))
+        {
+            // the copies must wait until the compute stream has completed the reduction
+            int deviceId = buffers[0]->GetDeviceId();
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+                m_gpuDataTransferers[i]->CopyGPUToCPUAsync(buffers[i]->BufferPointer(), buffers[i]->GetNumElements(), m_intermediateCPUBuffers[i].get());
+            }
+
+            std::vector<MPI_Request> allReduceRequests(buffers.size());
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+                ElemType* reductionBuffer = m_intermediateCPUBuffers[i].get();
+                m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
+                MPI_Iallreduce(MPI_IN_PLACE, reductionBuffer, buffers[i]->GetNumElements(), MPIWrapper::GetDataType(reductionBuffer), MPI_SUM, m_leaderComm, &allReduceRequests[i]) || MpiFail("MPI_Iallreduce");
+            }
+
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+                m_mpi->Wait(&allReduceRequests[i]);
+                m_gpuDataTransferers[i]->CopyCPUToGPUAsync(m_intermediateCPUBuffers[i].get(), buffers[i]->GetNumElements(), buffers[i]->BufferPointer());
+            }
+
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+                m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
+            }
+        }
+
+        betweenReduceAndBroadcast();
+
+        // distribute the result within the machine
+        m_ncclComm->GroupStart();
+        for (auto buffer : buffers)
+            m_ncclComm->Broadcast(buffer->BufferPointer(), buffer->GetNumElements(), 0);
+        m_ncclComm->GroupEnd();
+    }
+
+    void AllReduce(const std::vector<Matrix<ElemType>*>& buffers)
+    {
+        AllReduce(buffers, []() {});
+    }
+
+    // the leader of a machine, the only one to talk to the other machines
+    bool IsLocalLeader() const
+    {
+        return m_localRank == 0;
+    }
+    // number of machines; valid after the first AllReduce()
+    int NumMachines() const
+    {
+        return m_numLeaders;
+    }
+
+private:
+    // Set up the communicators: one per machine (MPI and NCCL), and one among the machines' leaders.
+    void Initialize(const std::vector<Matrix<ElemType>*>& buffers)
+    {
+        int deviceId = buffers[0]->GetDeviceId();
+        if (deviceId < 0)
+            RuntimeError("%s: NCCL requires training on GPUs.", m_who);
+
+        for (auto buffer : buffers)
+        {
+            // we currently do not support aggregation of sparse matrices
+            if (buffer->GetMatrixType() != DENSE)
+                RuntimeError("%s: NCCL reduction of sparse matrices is currently unsupported!", m_who);
+        }
+
+        MPI_Comm_split_type(m_mpi->Communicator(), MPI_COMM_TYPE_SHARED, (int) m_mpi->CurrentNodeRank(), MPI_INFO_NULL, &m_localComm) || MpiFail("MPI_Comm_split_type");
+        int numLocalRanks;
+        MPI_Comm_rank(m_localComm, &m_localRank) || MpiFail("MPI_Comm_rank");
+        MPI_Comm_size(m_localComm, &numLocalRanks) || MpiFail("MPI_Comm_size");
+
+        // (the others get MPI_COMM_NULL)
+        MPI_Comm_split(m_mpi->Communicator(), (m_localRank == 0) ? 0 : MPI_UNDEFINED, (int) m_mpi->CurrentNodeRank(), &m_leaderComm) || MpiFail("MPI_Comm_split");
+        if (m_localRank == 0)
+            MPI_Comm_size(m_leaderComm, &m_numLeaders) || MpiFail("MPI_Comm_size");
+        MPI_Bcast(&m_numLeaders, 1, MPI_INT, 0, m_localComm) || MpiFail("MPI_Bcast");
+
+        std::vector<char> uniqueId;
+        if (m_localRank == 0)
+            uniqueId = NcclComm::CreateUniqueId();
+        int uniqueIdSize = (int) uniqueId.size();
+        MPI_Bcast(&uniqueIdSize, 1, MPI_INT, 0, m_localComm) || MpiFail("MPI_Bcast");
+        uniqueId.resize(uniqueIdSize);
+        MPI_Bcast(uniqueId.data(), uniqueIdSize, MPI_CHAR, 0, m_localComm) || MpiFail("MPI_Bcast");
+        m_ncclComm.reset(new NcclComm(deviceId, m_localRank, numLocalRanks, uniqueId));
+
+        fprintf(stderr, "%s: Worker %d (GPU %d) is local rank %d of %d on its machine, %d machines in total.\n",
+                m_who, (int) m_mpi->CurrentNodeRank(), deviceId, m_localRank, numLocalRanks, m_numLeaders);
+
+        if ((m_localRank == 0) && (m_numLeaders > 1))
+        {
+            m_allocator = &CUDAPageLockedMemArena::GetSharedArena(deviceId);
+            for (auto buffer : buffers)
+            {
+                m_gpuDataTransferers.push_back(std::unique_ptr<GPUDataTransferer<ElemType>>(new GPUDataTransferer<ElemType>(deviceId, false /*useConcurrentStreams*/)));
+                m_intermediateCPUBuffers.push_back(AllocateIntermediateBuffer(buffer->GetNumElements()));
+            }
+        }
+    }
+
+    std::shared_ptr<ElemType> AllocateIntermediateBuffer(size_t numElements)
+    {
+        size_t totalSize = sizeof(ElemType) * numElements;
+        return std::shared_ptr<ElemType>((ElemType*) m_allocator->Malloc(totalSize), [this](ElemType* p)
+                                         {
+                                             m_allocator->Free(p);
+                                         });
+    }
+
+private:
+    MPIWrapper* m_mpi;
+    const char* m_who; // for messages
+    MPI_Comm m_localComm;  // the workers on this machine
+    MPI_Comm m_leaderComm; // local rank 0 of each machine; MPI_COMM_NULL on the others
+    int m_localRank;
+    int m_numLeaders; // number of machines
+    std::unique_ptr<NcclComm> m_ncclComm;
+
+    // only used by the leaders, if there is more than one machine
+    MemAllocator* m_allocator; // not owned
+    std::vector<std::shared_ptr<ElemType>> m_intermediateCPUBuffers;
+    std::vector<std::unique_ptr<GPUDataTransferer<ElemType>>> m_gpuDataTransferers;
+};
+} } }
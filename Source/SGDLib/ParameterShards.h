@@ -0,0 +1,371 @@
+#pragma once
+
+#include "ComputationNetwork.h"
+#include "ComputationNode.h"
+#include "InputAndParamNodes.h"
+#include "MPIWrapper.h"
+#include "Sequences.h"
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// Embedding matrices split across the workers of DataParallelSGD (SGD option shardedParameters), instead of every worker holding all of it.
+// Worker r owns the columns [V r / N, V (r + 1) / N) of a D x V parameter, and its value, gradient and smoothed gradient hold only those.
+// For each minibatch, the workers look up which columns their share of the data uses, fetch them from their owners with an all-to-all
+// exchange (FetchColumns()), and after backprop send the gradients of these columns back the same way (ReturnGradients()). The owners
+// sum them up into the gradient of their share, and update it like any other parameter; it is not part of the gradient aggregation.
+// So the memory per worker, and the traffic for these parameters, shrink with the number of workers.
+// Only parameters whose consumers are all LookupTable nodes of inputs with one word per sample (e.g. a sparse one-hot input) can be sharded.
+// Saving requires the full matrices: GatherForSave() assembles them on the main node (in CPU memory), RestoreAfterSave() goes back to the share.
+// All functions are collective: every worker must call them, in the same order (also FetchColumns() without data).
+template <class ElemType>
+class ParameterShards
+{
+    typedef shared_ptr<ComputationNode<ElemType>> ComputationNodePtr;
+
+    struct ShardedParameter
+    {
+        ComputationNodePtr m_node;
+        size_t m_nodeIndex; // in learnableNodes, for its smoothed gradient
+        TensorShape m_fullShape;
+        size_t m_numRows, m_numColumns; // of the full matrix
+        std::vector<shared_ptr<LookupTableNode<ElemType>>> m_lookups;
+        shared_ptr<Matrix<ElemType>> m_wordIds;   // [0 1 2 ... V-1], to turn one-hot inputs into word ids
+        shared_ptr<Matrix<ElemType>> m_columns;   // the columns this worker's minibatch uses, sorted by word id
+        shared_ptr<Matrix<ElemType>> m_gradients; // and their gradients
+        std::vector<size_t> m_requestCounts;      // [r] number of these columns owned by rank r
+        std::vector<size_t> m_servedCounts;       // [r] number of our columns rank r asked for
+        shared_ptr<Matrix<ElemType>> m_servedColumns; // (row vector) the columns of our share that were asked for, in rank order
+        Matrix<ElemType> m_savedValue, m_savedSmoothedGradient; // our share, while GatherForSave() has swapped in the full matrix
+
+        ShardedParameter(DEVICEID_TYPE deviceId)
+            : m_nodeIndex(0), m_numRows(0), m_numColumns(0), m_savedValue(CPUDEVICE), m_savedSmoothedGradient(CPUDEVICE)
+        {
+            m_wordIds = make_shared<Matrix<ElemType>>(deviceId);
+            m_columns = make_shared<Matrix<ElemType>>(deviceId);
+            m_gradients = make_shared<Matrix<ElemType>>(deviceId);
+            m_servedColumns = make_shared<Matrix<ElemType>>(deviceId);
+        }
+    };
+
+public:
+    ParameterShards(MPIWrapper* mpi)
+        : m_mpi(mpi), m_gathered(false)
+    {
+    }
+
+    // find the parameters and their LookupTable nodes, and check that they can be sharded; then cut them down with Reshard()
+    void Init(const ComputationNetworkPtr& net, const std::vector<std::wstring>& parameterNames,
+              const std::list<ComputationNodeBasePtr>& learnableNodes, std::list<Matrix<ElemType>>& smoothedGradients)
+    {
+        const auto allNodes = net->GetAllNodes();
+        for (const auto& name : parameterNames)
+        {
+            auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(net->GetNodeFromName(name));
+            auto learnableIter = std::find(learnableNodes.begin(), learnableNodes.end(), node);
+            if (!node || learnableIter == learnableNodes.end() || !node->IsParameterUpdateRequired())
+                InvalidArgument("shardedParameters: %ls is not a learnable parameter of the criterion.", name.c_str());
+            for (const auto& shard : m_shards)
+                if (shard->m_node == node)
+                    InvalidArgument("shardedParameters: %ls is listed twice.", name.c_str());
+
+            auto shard = make_shared<ShardedParameter>(node->GetDeviceId());
+            shard->m_node = node;
+            shard->m_nodeIndex = std::distance(learnableNodes.begin(), learnableIter);
+            shard->m_fullShape = node->GetSampleLayout();
+            shard->m_numRows = node->Value().GetNumRows();
+            shard->m_numColumns = node->Value().GetNumCols();
+            if (shard->m_numColumns < NumShards())
+                InvalidArgument("shardedParameters: %ls has fewer columns (%d) than there are workers.", name.c_str(), (int) shard->m_numColumns);
+            if ((size_t)(ElemType)(shard->m_numColumns - 1) != shard->m_numColumns - 1)
+                InvalidArgument("shardedParameters: %ls has too many columns to index them with this precision.", name.c_str());
+
+            for (const auto& consumer : allNodes)
+            {
+                for (size_t i = 0; i < consumer->GetNumInputs(); i++)
+                {
+                    if (consumer->GetInputs()[i] != node)
+                        continue;
+                    auto lookup = dynamic_pointer_cast<LookupTableNode<ElemType>>(consumer);
+                    if (!lookup || i != 0)
+                        InvalidArgument("shardedParameters: %ls is used by %ls, but only LookupTable nodes can use sharded parameters.", name.c_str(), consumer->NodeName().c_str());
+                    const auto& input = lookup->GetInputs()[1];
+                    if ((input->OperationName() != OperationNameOf(InputValue) && input->OperationName() != OperationNameOf(SparseInputValue)) ||
+                        input->GetSampleMatrixNumRows() != shard->m_numColumns)
+                        InvalidArgument("shardedParameters: The input of %ls must be an input with one word per sample.", lookup->NodeName().c_str());
+                    if (std::find(shard->m_lookups.begin(), shard->m_lookups.end(), lookup) == shard->m_lookups.end())
+                        shard->m_lookups.push_back(lookup);
+                }
+            }
+            if (shard->m_lookups.empty())
+                InvalidArgument("shardedParameters: %ls is not used by any LookupTable node.", name.c_str());
+
+            std::vector<ElemType> wordIds(shard->m_numColumns);
+            for (size_t j = 0; j < wordIds.size(); j++)
+                wordIds[j] = (ElemType) j;
+            shard->m_wordIds->SetValue(1, wordIds.size(), node->GetDeviceId(), wordIds.data());
+            for (const auto& lookup : shard->m_lookups)
+                lookup->SetSharded(shard->m_numColumns, shard->m_columns, shard->m_gradients);
+
+            fprintf(stderr, "ParameterShards: %ls [%d x %d] is split across %d workers, used by %d LookupTable node(s).\n",
+                    name.c_str(), (int) shard->m_numRows, (int) shard->m_numColumns, (int) NumShards(), (int) shard->m_lookups.size());
+            m_shards.push_back(shard);
+        }
+        Reshard(smoothedGradients);
+    }
+
+    // cut the full matrices down to our share: initially, and whenever they were read again (e.g. the best model of an earlier epoch)
+    void Reshard(std::list<Matrix<ElemType>>& smoothedGradients)
+    {
+        const size_t rank = Rank();
+        for (const auto& shard : m_shards)
+        {
+            const size_t begin = ColumnBegin(*shard, rank), numColumns = ColumnBegin(*shard, rank + 1) - begin;
+            auto& value = shard->m_node->Value();
+            auto& smoothedGradient = SmoothedGradientOf(*shard, smoothedGradients);
+            if (value.GetNumCols() == shard->m_numColumns) // (else it is sharded already)
+                value = Matrix<ElemType>(value.ColumnSlice(begin, numColumns), value.GetDeviceId());
+            if (smoothedGradient.GetNumRows() != shard->m_numRows)
+                InvalidArgument("shardedParameters: The gradient update type of %ls keeps state of another size.", shard->m_node->NodeName().c_str());
+            if (smoothedGradient.GetNumCols() == shard->m_numColumns)
+                smoothedGradient = Matrix<ElemType>(smoothedGradient.ColumnSlice(begin, numColumns), smoothedGradient.GetDeviceId());
+            VerifyShare(*shard, value, numColumns);
+            VerifyShare(*shard, smoothedGradient, numColumns);
+            shard->m_node->SetDims(TensorShape(shard->m_numRows, numColumns), false);
+
+            auto& gradient = shard->m_node->Gradient(); // (the LookupTable nodes would have made it sparse)
+            if (gradient.GetMatrixType() != DENSE)
+                gradient.SwitchToMatrixType(DENSE, matrixFormatDense, false);
+            gradient.Resize(shard->m_numRows, numColumns);
+        }
+    }
+
+    bool IsSharded(const ComputationNodeBasePtr& node) const
+    {
+        for (const auto& shard : m_shards)
+            if (shard->m_node == node)
+                return true;
+        return false;
+    }
+
+    // fetch the columns the minibatch in the network's inputs uses (call this after the inputs are set, before ForwardProp())
+    // haveData - false if this worker's share of the minibatch is empty; it still serves the other workers
+    void FetchColumns(bool haveData)
+    {
+        for (const auto& shard : m_shards)
+        {
+            const DEVICEID_TYPE deviceId = shard->m_node->GetDeviceId();
+            // the word id of each sample, -1 for gaps
+            std::vector<std::vector<ElemType>> wordsOfLookups(shard->m_lookups.size());
+            std::vector<size_t> words;
+            for (size_t k = 0; haveData && k < shard->m_lookups.size(); k++)
+            {
+                const auto& input = shard->m_lookups[k]->GetInputs()[1];
+                const auto& inputValue = dynamic_pointer_cast<ComputationNode<ElemType>>(input)->Value();
+                Matrix<ElemType> wordIds(deviceId);
+                wordIds.AssignProductOf(*shard->m_wordIds, false, inputValue, false);
+                MaskMissingColumnsTo(wordIds, input->GetMBLayout(), FrameRange(input->GetMBLayout()), (ElemType) -1);
+                auto& wordsOfSamples = wordsOfLookups[k];
+                wordsOfSamples.resize(wordIds.GetNumCols());
+                if (!wordsOfSamples.empty())
+                    wordIds.CopySection(1, wordsOfSamples.size(), wordsOfSamples.data(), 1);
+                for (auto word : wordsOfSamples)
+                    if (word >= 0)
+                        words.push_back((size_t) word);
+            }
+            std::sort(words.begin(), words.end());
+            words.erase(std::unique(words.begin(), words.end()), words.end());
+            if (!words.empty() && words.back() >= shard->m_numColumns)
+                LogicError("ParameterShards: Word id %d is out of range.", (int) words.back());
+
+            // where each sample finds its column among the fetched ones
+            for (size_t k = 0; haveData && k < shard->m_lookups.size(); k++)
+            {
+                auto& columnOfSample = wordsOfLookups[k];
+                for (auto& word : columnOfSample)
+                    if (word >= 0)
+                        word = (ElemType)(std::lower_bound(words.begin(), words.end(), (size_t) word) - words.begin());
+                auto& columnOfSampleMatrix = shard->m_lookups[k]->ShardColumnOfSample();
+                if (columnOfSample.empty())
+                    columnOfSampleMatrix.Resize(1, 0);
+                else
+                    columnOfSampleMatrix.SetValue(1, columnOfSample.size(), deviceId, columnOfSample.data());
+            }
+
+            // ask the owners for them (they come in rank order, since the owners' shares are in order as well)
+            const size_t rank = Rank();
+            shard->m_requestCounts.assign(NumShards(), 0);
+            for (size_t r = 0; r < NumShards(); r++)
+                shard->m_requestCounts[r] = std::lower_bound(words.begin(), words.end(), ColumnBegin(*shard, r + 1)) -
+                                            std::lower_bound(words.begin(), words.end(), ColumnBegin(*shard, r));
+            m_mpi->AllToAllCounts(shard->m_requestCounts, shard->m_servedCounts);
+            std::vector<size_t> servedWords(Total(shard->m_servedCounts));
+            m_mpi->AllToAll(words.data(), shard->m_requestCounts, servedWords.data(), shard->m_servedCounts);
+
+            // and serve theirs
+            const size_t begin = ColumnBegin(*shard, rank), end = ColumnBegin(*shard, rank + 1);
+            std::vector<ElemType> servedColumns(servedWords.size());
+            for (size_t j = 0; j < servedWords.size(); j++)
+            {
+                if (servedWords[j] < begin || servedWords[j] >= end)
+                    LogicError("ParameterShards: Asked for column %d, which is not in our share.", (int) servedWords[j]);
+                servedColumns[j] = (ElemType)(servedWords[j] - begin);
+            }
+            std::vector<ElemType> servedValues(shard->m_numRows * servedColumns.size());
+            if (servedColumns.empty())
+                shard->m_servedColumns->Resize(1, 0);
+            else
+            {
+                shard->m_servedColumns->SetValue(1, servedColumns.size(), deviceId, servedColumns.data());
+                Matrix<ElemType> served(shard->m_numRows, servedColumns.size(), deviceId);
+                served.DoGatherColumnsOf(0, *shard->m_servedColumns, shard->m_node->Value(), 1);
+                served.CopySection(served.GetNumRows(), served.GetNumCols(), servedValues.data(), served.GetNumRows());
+            }
+            std::vector<ElemType> fetchedValues(shard->m_numRows * words.size());
+            m_mpi->AllToAll(servedValues.data(), Scaled(shard->m_servedCounts, shard->m_numRows),
+                            fetchedValues.data(), Scaled(shard->m_requestCounts, shard->m_numRows));
+
+            if (words.empty())
+                shard->m_columns->Resize(shard->m_numRows, 0);
+            else
+                shard->m_columns->SetValue(shard->m_numRows, words.size(), deviceId, fetchedValues.data());
+            shard->m_gradients->Resize(shard->m_numRows, words.size());
+            shard->m_gradients->SetValue(0);
+        }
+    }
+
+    // send the gradients of the fetched columns to their owners, which sum them up into the gradients of their shares
+    // (call this after backprop, or in its place when this worker had no data, before the other parameters are aggregated)
+    void ReturnGradients()
+    {
+        const size_t rank = Rank();
+        for (const auto& shard : m_shards)
+        {
+            const DEVICEID_TYPE deviceId = shard->m_node->GetDeviceId();
+            const auto& gradients = *shard->m_gradients;
+            std::vector<ElemType> sentGradients(gradients.GetNumElements());
+            if (!sentGradients.empty())
+                gradients.CopySection(gradients.GetNumRows(), gradients.GetNumCols(), sentGradients.data(), gradients.GetNumRows());
+            const size_t numServed = Total(shard->m_servedCounts);
+            std::vector<ElemType> receivedGradients(shard->m_numRows * numServed);
+            m_mpi->AllToAll(sentGradients.data(), Scaled(shard->m_requestCounts, shard->m_numRows),
+                            receivedGradients.data(), Scaled(shard->m_servedCounts, shard->m_numRows));
+
+            auto& gradient = shard->m_node->Gradient();
+            gradient.Resize(shard->m_numRows, ColumnBegin(*shard, rank + 1) - ColumnBegin(*shard, rank));
+            gradient.SetValue(0);
+            if (numServed > 0)
+            {
+                Matrix<ElemType> received(shard->m_numRows, numServed, receivedGradients.data(), matrixFlagNormal, deviceId);
+                gradient.DoScatterColumnsOf(1, *shard->m_servedColumns, received, 1);
+            }
+        }
+    }
+
+    // assemble the full values and smoothed gradients on the main node, for saving the model and checkpoint
+    void GatherForSave(std::list<Matrix<ElemType>>& smoothedGradients)
+    {
+        if (m_gathered)
+            return;
+        const bool isMain = m_mpi == nullptr || m_mpi->IsMainNode();
+        for (const auto& shard : m_shards)
+        {
+            auto& value = shard->m_node->Value();
+            auto& smoothedGradient = SmoothedGradientOf(*shard, smoothedGradients);
+            Matrix<ElemType> fullValue = GatherToMain(*shard, value);
+            Matrix<ElemType> fullSmoothedGradient = GatherToMain(*shard, smoothedGradient);
+            if (!isMain)
+                continue;
+            shard->m_savedValue = std::move(value);
+            value = std::move(fullValue);
+            shard->m_savedSmoothedGradient = std::move(smoothedGradient);
+            smoothedGradient = std::move(fullSmoothedGradient);
+            shard->m_node->SetDims(shard->m_fullShape, false);
+        }
+        m_gathered = true;
+    }
+
+    void RestoreAfterSave(std::list<Matrix<ElemType>>& smoothedGradients)
+    {
+        if (!m_gathered)
+            return;
+        const bool isMain = m_mpi == nullptr || m_mpi->IsMainNode();
+        for (const auto& shard : m_shards)
+        {
+            if (!isMain)
+                continue;
+            shard->m_node->Value() = std::move(shard->m_savedValue);
+            SmoothedGradientOf(*shard, smoothedGradients) = std::move(shard->m_savedSmoothedGradient);
+            shard->m_node->SetDims(TensorShape(shard->m_numRows, shard->m_node->Value().GetNumCols()), false);
+        }
+        m_gathered = false;
+    }
+
+private:
+    size_t NumShards() const { return m_mpi ? m_mpi->NumNodesInUse() : 1; }
+    size_t Rank() const { return m_mpi ? m_mpi->CurrentNodeRank() : 0; }
+
+    size_t ColumnBegin(const ShardedParameter& shard, size_t rank) const { return shard.m_numColumns * rank / NumShards(); }
+
+    static Matrix<ElemType>& SmoothedGradientOf(const ShardedParameter& shard, std::list<Matrix<ElemType>>& smoothedGradients)
+    {
+        auto iter = smoothedGradients.begin();
+        std::advance(iter, shard.m_nodeIndex);
+        return *iter;
+    }
+
+    static void VerifyShare(const ShardedParameter& shard, const Matrix<ElemType>& m, size_t numColumns)
+    {
+        if (m.GetNumRows() != shard.m_numRows || m.GetNumCols() != numColumns)
+            LogicError("ParameterShards: %ls has [%d x %d] elements, but its share is [%d x %d].", shard.m_node->NodeName().c_str(),
+                       (int) m.GetNumRows(), (int) m.GetNumCols(), (int) shard.m_numRows, (int) numColumns);
+    }
+
+    static size_t Total(const std::vector<size_t>& counts)
+    {
+        size_t total = 0;
+        for (auto count : counts)
+            total += count;
+        return total;
+    }
+
+    static std::vector<size_t> Scaled(std::vector<size_t> counts, size_t factor)
+    {
+        for (auto& count : counts)
+            count *= factor;
+        return counts;
+    }
+
+    // the full matrix from the shares of all workers, in CPU memory of the main node (empty elsewhere)
+    Matrix<ElemType> GatherToMain(const ShardedParameter& shard, const Matrix<ElemType>& share) const
+    {
+        const size_t numShards = NumShards(), mainRank = m_mpi ? m_mpi->MainNodeRank() : 0;
+        const bool isMain = Rank() == mainRank;
+        std::vector<ElemType> sent(share.GetNumElements());
+        if (!sent.empty())
+            share.CopySection(share.GetNumRows(), share.GetNumCols(), sent.data(), share.GetNumRows());
+        std::vector<size_t> sendCounts(numShards, 0), recvCounts(numShards, 0);
+        sendCounts[mainRank] = sent.size();
+        for (size_t r = 0; isMain && r < numShards; r++)
+            recvCounts[r] = shard.m_numRows * (ColumnBegin(shard, r + 1) - ColumnBegin(shard, r));
+        std::vector<ElemType> full(isMain ? shard.m_numRows * shard.m_numColumns : 0);
+        if (m_mpi)
+            m_mpi->AllToAll(sent.data(), sendCounts, full.data(), recvCounts);
+        else
+            full = sent;
+        if (!isMain)
+            return Matrix<ElemType>(CPUDEVICE);
+        return Matrix<ElemType>(shard.m_numRows, shard.m_numColumns, full.data(), matrixFlagNormal, CPUDEVICE);
+    }
+
+    MPIWrapper* m_mpi;
+    std::vector<shared_ptr<ShardedParameter>> m_shards;
+    bool m_gathered; // between GatherForSave() and RestoreAfterSave()
+};
+
+} } }
@@ -0,0 +1,145 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include "Basics.h"
+#include "ComputationNode.h"
+#include "PreComputeNodes.h"
+#include "File.h"
+#include "fileutil.h"
+#include "Matrix.h"
+#include <list>
+#include <memory>
+#include <string>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// PreComputeCache -- the results of SGD::PreCompute() (Mean, InvStdDev, and through Mean the log priors) kept in a file for later jobs
+// on the same data (SGD option preComputeCache), so that these can skip the pass over the data.
+// The file is keyed by a hash of everything that determines the statistics: the precomputed nodes (names, operations, inputs and their
+// dimensions), the precompute settings, and the content of the first minibatch of all inputs. The latter reflects the data list and the
+// reader configuration (feature files, context window, normalization, randomization, ...). A file with another key is ignored, and replaced.
+template <class ElemType>
+class PreComputeCache
+{
+public:
+    PreComputeCache(const std::wstring& path)
+        : m_path(path), m_key(14695981039346656037ull) // (FNV-1a)
+    {
+    }
+
+    // things to key the statistics on
+    void Add(const std::wstring& s)
+    {
+        Add(s.size());
+        AddBytes(s.data(), s.size() * sizeof(wchar_t));
+    }
+    void Add(size_t value)
+    {
+        AddBytes(&value, sizeof(value));
+    }
+    void Add(double value)
+    {
+        AddBytes(&value, sizeof(value));
+    }
+    void Add(const Matrix<ElemType>& value)
+    {
+        Add(value.GetNumRows());
+        Add(value.GetNumCols());
+        if (value.GetNumElements() == 0)
+            return;
+        Matrix<ElemType> dense(value, value.GetDeviceId()); // (a copy on the CPU, dense even if the input is sparse)
+        dense.TransferToDeviceIfNotThere(CPUDEVICE, /*ismoved=*/true);
+        if (dense.GetMatrixType() != DENSE)
+            dense.SwitchToMatrixType(DENSE, matrixFormatDense, true);
+        std::unique_ptr<ElemType[]> values(dense.CopyToArray());
+        AddBytes(values.get(), dense.GetNumElements() * sizeof(ElemType));
+    }
+    void Add(const std::list<ComputationNodeBasePtr>& nodes)
+    {
+        for (const auto& node : nodes)
+        {
+            Add(node->NodeName());
+            Add(node->OperationName());
+            Add(node->Input(0)->NodeName());
+            Add(msra::strfun::utf16(string(node->Input(0)->GetSampleLayout())));
+        }
+    }
+
+    // set the nodes' values from the file if it exists and has our key; returns false otherwise
+    bool TryLoad(const std::list<ComputationNodeBasePtr>& nodes) const
+    {
+        if (!fexists(m_path))
+            return false;
+        try
+        {
+            File fstream(m_path, FileOptions::fileOptionsBinary | FileOptions::fileOptionsRead);
+            fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BPreComputeCache");
+            size_t key, numNodes;
+            fstream >> key >> numNodes;
+            if (key != m_key || numNodes != nodes.size())
+            {
+                fprintf(stderr, "PreComputeCache: %ls was computed for other data or nodes; precomputing anew.\n", m_path.c_str());
+                return false;
+            }
+            std::vector<Matrix<ElemType>> values;
+            for (const auto& node : nodes)
+            {
+                std::wstring name;
+                fstream >> name;
+                if (name != node->NodeName())
+                    return false;
+                values.push_back(Matrix<ElemType>(node->GetDeviceId()));
+                fstream >> values.back();
+            }
+            fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EPreComputeCache");
+
+            auto value = values.begin();
+            for (const auto& node : nodes)
+            {
+                auto precomputedNode = dynamic_pointer_cast<PreComputedNodeBase<ElemType>>(node);
+                precomputedNode->SideLoadFromMatrix(*value++, node->Input(0)->GetSampleLayout());
+            }
+        }
+        catch (const std::exception& e) // e.g. a file that was written by an older version
+        {
+            fprintf(stderr, "PreComputeCache: %ls cannot be used (%s); precomputing anew.\n", m_path.c_str(), e.what());
+            return false;
+        }
+        return true;
+    }
+
+    // write the nodes' values, under a temp name that is renamed at the end, since other jobs may read the file concurrently
+    void Save(const std::list<ComputationNodeBasePtr>& nodes) const
+    {
+        const std::wstring tempPath = m_path + L".tmp";
+        {
+            File fstream(tempPath, FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
+            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BPreComputeCache");
+            fstream << m_key << nodes.size();
+            for (const auto& node : nodes)
+                fstream << node->NodeName() << dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EPreComputeCache");
+        }
+        renameOrDie(tempPath, m_path);
+        fprintf(stderr, "PreComputeCache: Saved the precomputed values to %ls.\n", m_path.c_str());
+    }
+
+private:
+    void AddBytes(const void* data, size_t numBytes)
+    {
+        const unsigned char* p = (const unsigned char*) data;
+        for (size_t i = 0; i < numBytes; i++)
+        {
+            m_key ^= p[i];
+            m_key *= 1099511628211ull;
+        }
+    }
+
+    std::wstring m_path;
+    size_t m_key;
+};
+
+} } }
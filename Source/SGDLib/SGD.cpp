@@ -13,8 +13,22 @@
 #include "AllReduceDistGradAggregator.h"
 #endif
 #include "SimpleDistGradAggregator.h"
+#include "NcclDistGradAggregator.h"
+#include "NcclHierarchicalAllReduce.h"
+#include "CompressedDistGradAggregator.h"
+#include "ModelAverager.h"
+#include "ParameterShards.h"
+#include "CapturedStep.h"
+#include "CriterionAccumulator.h"
+#include "WeightPruner.h"
+#include "PreComputeCache.h"
+#include "NodeProfiler.h"
 #include "ProgressTracing.h"
+#include "TimelineTrace.h"
+#include "GPUWatcher.h"
+#include "TensorOps.h" // for AdamStateSize(), LarsStateSize()
 
+#include <random>
 #include <map>
 #include <set>
 
@@ -41,6 +55,18 @@ void SGD<ElemType>::Train(function<ComputationNetworkPtr(DEVICEID_TYPE)> createN
                           IDataReader<ElemType>* validationSetDataReader,
                           const bool makeMode)
 {
+    // a worker that joins a running elastic job starts with the job's next epoch, from the model of the epoch before
+    if (m_elasticJoin)
+    {
+        const int joinEpoch = JoinElasticJob();
+        auto net = ComputationNetwork::CreateFromFile<ElemType>(deviceId, GetModelNameForEpoch(joinEpoch - 1));
+        fprintf(stderr, "\nSGD joined the job in epoch %d, using %s.\n", joinEpoch + 1, net->GetDeviceId() < 0 ? "CPU" : "GPU");
+        m_needAdaptRegularization = false;
+        m_midEpochResume.epoch = -1;
+        TrainOrAdaptModel(joinEpoch, net, net, nullptr, trainSetDataReader, validationSetDataReader);
+        return;
+    }
+
     // determine which epoch to start with, including recoveing a checkpoint if any and 'makeMode' enabled
     int startEpoch = DetermineStartEpoch(makeMode);
     if (startEpoch == m_maxEpochs)
@@ -62,8 +88,9 @@ void SGD<ElemType>::Train(function<ComputationNetworkPtr(DEVICEID_TYPE)> createN
     else
         fprintf(stderr, "\nSGD using GPU %d.\n", (int) net->GetDeviceId());
 
-    // TODO: BUGBUG: if not starting from checkpoint, need to synchronize initial model
-    // strategy should be to run the initializer above on mpiRank==0, and then broadcast parameters.
+    // a new model: all ranks start from the parameters of the main node (the others' own random initialization is overwritten)
+    if (startEpoch < 0)
+        BroadcastInitialModel(net);
 
     startEpoch = max(startEpoch, 0);
     m_needAdaptRegularization = false;
@@ -123,12 +150,143 @@ void SGD<ElemType>::Adapt(wstring origModelFileName, wstring refNodeName,
     TrainOrAdaptModel(startEpoch, net, refNet, refNode, trainSetDataReader, validationSetDataReader);
 }
 
+// -----------------------------------------------------------------------
+// PlanMemory() -- CNTK "planMemory" action: what training a new model would take on each device, without training
+// The network is created and its matrix sharing planned as for training (AllocateAllMatrices()), but nothing is computed,
+// so that the matrices stay empty; their sizes follow from the plans of the MatrixPool for minibatches of 'numColumns'
+// columns (parallel sequences times time steps). Workspaces (cuDNN, RNN) are sized only at run time and not included.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+void SGD<ElemType>::PlanMemory(function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn, DEVICEID_TYPE deviceId,
+                               const size_t numColumns, const size_t deviceMemoryMB)
+{
+    shared_ptr<ComputationNetwork> net = createNetworkFn(deviceId);
+
+    // the same roots as TrainOrAdaptModel()
+    auto& criterionNodes = GetTrainCriterionNodes(net);
+    std::vector<ComputationNodeBasePtr> evaluationNodes;
+    for (const auto& node : GetEvalCriterionNodes(net))
+        if (std::find(criterionNodes.begin(), criterionNodes.end(), node) == criterionNodes.end())
+            evaluationNodes.push_back(node);
+    std::vector<ComputationNodeBasePtr> additionalNodesToEvaluate(net->OutputNodes().begin(), net->OutputNodes().end());
+    auto preComputeNodesList = net->GetNodesRequiringPreComputation();
+    additionalNodesToEvaluate.insert(additionalNodesToEvaluate.end(), preComputeNodesList.begin(), preComputeNodesList.end());
+    net->AllocateAllMatrices(evaluationNodes, additionalNodesToEvaluate, criterionNodes[0]);
+
+    // bytes per device, in the categories of the report; the activations as a function of the number of columns
+    struct DevicePlan
+    {
+        size_t parameters, gradients, smoothedGradients;
+        std::vector<MatrixPool::MatrixPlan> activations;
+    };
+    std::map<DEVICEID_TYPE, DevicePlan> devicePlans;
+    auto activationBytes = [](const DevicePlan& plan, size_t columns)
+    {
+        size_t bytes = 0;
+        for (const auto& matrix : plan.activations)
+            bytes += matrix.GetBytes(columns);
+        return bytes;
+    };
+
+    auto matrixPlans = net->GetMatrixPool().GetMatrixPlans(); // (a copy; the parameter gradients are taken out)
+    for (const auto& nodeBase : net->GetNodesWithType(OperationNameOf(LearnableParameter)))
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+        const size_t n = node->Value().GetNumElements();
+        DevicePlan& plan = devicePlans[node->GetDeviceId()];
+        plan.parameters += n * sizeof(ElemType);
+        if (!node->IsParameterUpdateRequired() || !node->GradientPtr())
+            continue;
+        auto gradientPlan = matrixPlans.find(node->GradientPtr().get());
+        if (gradientPlan != matrixPlans.end()) // (parameter gradients are never shared)
+        {
+            plan.gradients += gradientPlan->second.GetBytes(numColumns);
+            matrixPlans.erase(gradientPlan);
+        }
+        size_t stateElements;
+        switch (GradUpdateType())
+        {
+        case GradientsUpdateType::None:      stateElements = n; break;
+        case GradientsUpdateType::AdaGrad:   stateElements = m_needAveMultiplier ? 2 * n : n; break;
+        case GradientsUpdateType::RmsProp:   stateElements = m_needAveMultiplier ? 4 * n : 3 * n; break;
+        case GradientsUpdateType::FSAdaGrad: stateElements = 2 * n; break;
+        case GradientsUpdateType::Lars:      stateElements = LarsStateSize(n); break;
+        default:                             stateElements = AdamStateSize(n); break; // Adam, Lamb
+        }
+        plan.smoothedGradients += stateElements * sizeof(ElemType);
+    }
+    for (const auto& matrixPlan : matrixPlans)
+        devicePlans[matrixPlan.second.m_deviceId].activations.push_back(matrixPlan.second);
+    // values that do not come from the pool, e.g. of the inputs (sparse ones are counted as one element per column)
+    for (const auto& nodeBase : net->GetEvalOrder(nullptr))
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+        if (!node || node->OperationName() == OperationNameOf(LearnableParameter) || !node->ValuePtr() || net->GetMatrixPool().GetMatrixPlans().count(node->ValuePtr().get()) > 0)
+            continue;
+        const bool sparse = node->Value().GetMatrixType() == SPARSE;
+        const size_t elementsPerSample = sparse ? 1 : node->GetSampleLayout().GetNumElements();
+        const size_t elementSize = sparse ? sizeof(ElemType) + sizeof(int) : sizeof(ElemType);
+        if (node->HasMBLayout())
+            devicePlans[node->GetDeviceId()].activations.push_back(MatrixPool::MatrixPlan{node->GetDeviceId(), elementSize, elementsPerSample, 0});
+        else
+            devicePlans[node->GetDeviceId()].activations.push_back(MatrixPool::MatrixPlan{node->GetDeviceId(), elementSize, 0, elementsPerSample});
+    }
+
+    const double MB = 1024.0 * 1024.0;
+    fprintf(stderr, "\nPlanMemory: peak memory of training with minibatches of %d columns:\n", (int) numColumns);
+    for (const auto& entry : devicePlans)
+    {
+        const DevicePlan& plan = entry.second;
+        const size_t fixedBytes = plan.parameters + plan.gradients + plan.smoothedGradients;
+        const size_t activations = activationBytes(plan, numColumns);
+        fprintf(stderr, "  %s:\n", entry.first >= 0 ? msra::strfun::strprintf("GPU %d", (int) entry.first).c_str() : "CPU");
+        fprintf(stderr, "    parameters          %10.1f MB\n", plan.parameters / MB);
+        fprintf(stderr, "    gradients           %10.1f MB\n", plan.gradients / MB);
+        fprintf(stderr, "    smoothed gradients  %10.1f MB\n", plan.smoothedGradients / MB);
+        fprintf(stderr, "    activations         %10.1f MB (%d shared matrices; %.3f MB per column)\n", activations / MB, (int) plan.activations.size(),
+                (activationBytes(plan, 2 * numColumns) - activations) / MB / numColumns);
+        fprintf(stderr, "    workspaces                 n/a (sized at run time)\n");
+        fprintf(stderr, "    total               %10.1f MB\n", (fixedBytes + activations) / MB);
+
+        // the largest minibatch that fits: in the device's memory, or in deviceMemoryMB if given
+        size_t availableMB = deviceMemoryMB;
+        if (availableMB == 0 && entry.first >= 0)
+            availableMB = TracingGPUMemoryAllocator::GetFreeAndTotalMemoryInMBs(entry.first).second;
+        if (availableMB == 0)
+            continue;
+        const size_t availableBytes = availableMB * 1024 * 1024;
+        auto fits = [&](size_t columns) { return fixedBytes + activationBytes(plan, columns) <= availableBytes; };
+        if (!fits(1))
+            fprintf(stderr, "    not even a minibatch of 1 column fits into %d MB\n", (int) availableMB);
+        else if (fits((size_t) 1 << 30)) // nothing grows with the minibatch
+            fprintf(stderr, "    any minibatch size fits into %d MB\n", (int) availableMB);
+        else
+        {
+            size_t low = 1, high = 2; // fits(low), !fits(high)
+            while (fits(high))
+                low = high, high *= 2;
+            while (high - low > 1)
+            {
+                const size_t mid = low + (high - low) / 2;
+                (fits(mid) ? low : high) = mid;
+            }
+            fprintf(stderr, "    largest minibatch that fits into %d MB: %d columns\n", (int) availableMB, (int) low);
+        }
+    }
+}
+
 // -----------------------------------------------------------------------
 // TrainOrAdaptModel() -- main training end-to-end, given a start model
 // -----------------------------------------------------------------------
 
 static double MomentumPerMB(double momentumPerSample, size_t minibatchSize);
 
+template <class ElemType>
+SGD<ElemType>::~SGD()
+{
+}
+
 template <class ElemType>
 void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                                       ComputationNetworkPtr refNet,
@@ -136,6 +294,34 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                                       IDataReader<ElemType>* trainSetDataReader,
                                       IDataReader<ElemType>* validationSetDataReader)
 {
+    // the model averager keeps the global model and its momentum of a training run, which the next one must not start from
+    m_modelAverager.reset();
+
+    // split the model across GPUs (ParallelizationMethod::ModelParallelSGD)
+    // The model is cut into parts, and reloaded in place with the nodes of each part created on its GPU.
+    if (!m_modelParallelDeviceIds.empty())
+    {
+        if (net->GetDeviceId() < 0)
+            InvalidArgument("modelParallelDeviceIds requires the model to be on a GPU (deviceId).");
+        if (m_needAdaptRegularization || m_doGradientCheck || !m_replicaDeviceIds.empty() || m_flatParameterBuffers || m_parallelizationMethod != ParallelizationMethod::None)
+            InvalidArgument("modelParallelDeviceIds cannot be combined with adaptation regularization, gradientcheck, replicaDeviceIds, flatParameterBuffers, or parallelTrain.");
+        std::vector<DEVICEID_TYPE> deviceIds(1, net->GetDeviceId()); // the first part stays on the model's GPU
+        for (size_t i = 0; i < m_modelParallelDeviceIds.size(); i++)
+        {
+            DEVICEID_TYPE deviceId = (DEVICEID_TYPE) m_modelParallelDeviceIds[i];
+            if (deviceId < 0 || std::find(deviceIds.begin(), deviceIds.end(), deviceId) != deviceIds.end())
+                InvalidArgument("modelParallelDeviceIds must be GPUs other than the model's (%d), each listed once.", (int) net->GetDeviceId());
+            deviceIds.push_back(deviceId);
+            AllowAdditionalGPU(deviceId);
+        }
+        auto placement = net->PartitionAcrossDevices<ElemType>(GetTrainCriterionNodes(net)[0], deviceIds, m_modelParallelPartitionStarts);
+        wstring partitionedModelFileName = GetPerRankFileName(m_modelPath + L".partitioned", L"partitioned");
+        net->Save(partitionedModelFileName);
+        net->SetNodeDevicePlacement(placement);
+        net->Load<ElemType>(partitionedModelFileName); // (releases the unsplit nodes first)
+        _wunlink(partitionedModelFileName.c_str());
+    }
+
     auto& featureNodes = net->FeatureNodes();
     auto& labelNodes = net->LabelNodes();
     auto& criterionNodes = GetTrainCriterionNodes(net);
@@ -227,12 +413,53 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
     auto& learnableNodes = net->LearnableParameterNodes(criterionNodes[0]);
     std::list<Matrix<ElemType>> smoothedGradients;
 
-    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++)
+    // move the selected parameters into host memory, one at a time
+    std::set<ComputationNodeBasePtr> hostOffloadNodes;
+    if (!m_hostOffloadParameters.empty())
+    {
+        if (net->GetDeviceId() < 0 || m_flatParameterBuffers || !m_modelParallelDeviceIds.empty() || !m_replicaDeviceIds.empty())
+            InvalidArgument("hostOffloadParameters requires the model to be on a GPU, and cannot be combined with flatParameterBuffers, modelParallelDeviceIds, or replicaDeviceIds.");
+        for (const auto& name : m_hostOffloadParameters)
+        {
+            for (const auto& node : net->GetNodesFromName(name))
+            {
+                if (std::find(learnableNodes.begin(), learnableNodes.end(), node) == learnableNodes.end())
+                    InvalidArgument("hostOffloadParameters: %ls is not a LearnableParameter that is trained.", node->NodeName().c_str());
+                if (hostOffloadNodes.insert(node).second)
+                    dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value().PlaceInHostMemory();
+            }
+        }
+        fprintf(stderr, "Keeping %d parameters in host memory.\n", (int) hostOffloadNodes.size());
+    }
+
+    // with flat buffers, the smoothed gradients are views into a third buffer with the same layout as the parameters
+    // (only for plain momentum SGD; the states of the adaptive update types have other sizes)
+    m_flatParameterValues.reset();
+    m_flatParameterGradients.reset();
+    m_flatSmoothedGradients.reset();
+    if (m_flatParameterBuffers)
+    {
+        ComputationNetwork::AllocateFlatParameterBuffers<ElemType>(learnableNodes, m_flatParameterValues, m_flatParameterGradients, m_flatParameterOffsets);
+        if (m_flatParameterValues && GradUpdateType() == GradientsUpdateType::None)
+        {
+            m_flatSmoothedGradients = make_shared<Matrix<ElemType>>(m_flatParameterValues->GetNumRows(), 1, m_flatParameterValues->GetDeviceId());
+            m_flatSmoothedGradients->SetValue(0);
+        }
+    }
+    size_t nodeIndex = 0;
+    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, nodeIndex++)
     {
         ComputationNodePtr node = dynamic_pointer_cast<ComputationNode<ElemType>>(*nodeIter);
-        smoothedGradients.push_back(Matrix<ElemType>(node->Value().GetNumRows(),
-                                                     node->Value().GetNumCols(),
-                                                     net->GetDeviceId()));
+        if (m_flatSmoothedGradients && m_flatParameterOffsets[nodeIndex] != SIZE_MAX)
+            smoothedGradients.emplace_back(node->Value().GetNumRows(), node->Value().GetNumCols(),
+                                           m_flatSmoothedGradients->BufferPointer() + m_flatParameterOffsets[nodeIndex], matrixFlagDontOwnBuffer,
+                                           m_flatSmoothedGradients->GetDeviceId());
+        else
+            smoothedGradients.push_back(Matrix<ElemType>(node->Value().GetNumRows(),
+                                                         node->Value().GetNumCols(),
+                                                         node->Value().GetDeviceId()));
+        if (hostOffloadNodes.find(node) != hostOffloadNodes.end())
+            smoothedGradients.back().PlaceInHostMemory();
     }
 
     double epochCriterion, avgCriterion, prevCriterion, lrControlCriterion;
@@ -258,12 +485,23 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
         prevLearnRates[i] = -1.0;
     }
 
+    if (m_elasticTraining)
+    {
+        if (m_parallelizationMethod != ParallelizationMethod::DataParallelSGD || m_useNcclGradientAggregation || m_bufferedAsyncGradientAggregation ||
+            !m_shardedParameters.empty() || m_asyncCheckPoint)
+            InvalidArgument("Elastic training requires DataParallelSGD, without useNccl, useBufferedAsyncGradientAggregation, shardedParameters, or asyncCheckPoint.");
+        if (!m_elasticJoin) // (a joining worker has already)
+            g_mpi->EnableElasticity();
+    }
+
     if (m_parallelizationMethod == ParallelizationMethod::DataParallelSGD)
     {
         InitDistGradAgg(evaluationNodes.size(), m_traceLevel);
     }
     // precompute mean and invStdDev nodes and save initial model
-    if (PreCompute(net, trainSetDataReader, featureNodes, labelNodes, inputMatrices) || startEpoch == 0)
+    // (not when resuming within epoch 0, whose mid-epoch checkpoint must remain newer than the model, see DetermineStartEpoch();
+    // nor by a worker that has joined an elastic job, whose model is the job's)
+    if (!m_elasticJoin && (PreCompute(net, trainSetDataReader, featureNodes, labelNodes, inputMatrices) || (startEpoch == 0 && m_midEpochResume.epoch != 0)))
     {
         // Synchronize all ranks before writing the model to ensure that
         // everyone is done loading the model
@@ -288,6 +526,37 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
             prevLearnRates[startEpoch % m_numPrevLearnRates] = learnRatePerSample;
     }
 
+    // an interrupted epoch continues from its mid-epoch checkpoint
+    if (m_midEpochResume.epoch == startEpoch)
+    {
+        if (LoadMidEpochCheckPoint(net, startEpoch, smoothedGradients))
+        {
+            totalSamplesSeen = m_midEpochResume.totalSamplesSeen;
+            learnRatePerSample = m_midEpochResume.learnRatePerSample;
+            learnRateInitialized = true;
+        }
+        else
+            m_midEpochResume.epoch = -1;
+    }
+
+    // split the embeddings in m_shardedParameters across the workers (after the checkpoint has restored their full smoothed gradients)
+    m_parameterShards.reset();
+    if (!m_shardedParameters.empty())
+    {
+        if (m_parallelizationMethod != ParallelizationMethod::DataParallelSGD || m_parallelizationStartEpochNum > 0 || !m_distributedCrossValidation)
+            InvalidArgument("shardedParameters requires DataParallelSGD from the first epoch on, with distributedCrossValidation.");
+        if (m_numSubminiBatches > 1 || m_maxSamplesInRAM < SIZE_MAX || m_numMBsToAccumulate > 1 || m_bufferedAsyncGradientAggregation ||
+            m_checkPointIntervalInMinutes > 0 || m_asyncCheckPoint || m_asyncCrossValidation || !m_replicaDeviceIds.empty() || m_flatParameterBuffers ||
+            m_needAdaptRegularization || m_doGradientCheck || isSequenceTrainingCriterion)
+            InvalidArgument("shardedParameters cannot be combined with sub-minibatches, numMBsToAccumulate, useBufferedAsyncGradientAggregation, "
+                            "mid-epoch or asynchronous checkpoints, asyncCrossValidation, replicaDeviceIds, flatParameterBuffers, adaptation regularization, gradientcheck, or sequence training.");
+        if ((GradUpdateType() != GradientsUpdateType::None && GradUpdateType() != GradientsUpdateType::AdaGrad) ||
+            m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch || m_autoAdjustMinibatch)
+            InvalidArgument("shardedParameters requires gradUpdateType None or AdaGrad, and no learning rate search or minibatch size adjustment before epochs.");
+        m_parameterShards = make_shared<ParameterShards<ElemType>>(g_mpi);
+        m_parameterShards->Init(net, m_shardedParameters, learnableNodes, smoothedGradients);
+    }
+
     if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::AdjustAfterEpoch &&
         !learnRateInitialized && m_learningRatesParam.size() <= startEpoch)
     {
@@ -301,8 +570,65 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
 
     bool learnRateReduced = false;
 
+    m_cvNet.reset(); // (created at the first asynchronous cross-validation)
+    m_lastCrossValidationScores.clear();
+
+    // replicas of the model on the other GPUs of this process, see DeviceReplicaDispatcher
+    // They are loaded from a copy of the model; their parameters are overwritten with the main model's in every minibatch anyway.
+    m_deviceReplicas.reset();
+    if (!m_replicaDeviceIds.empty())
+    {
+        if (net->GetDeviceId() < 0)
+            InvalidArgument("replicaDeviceIds requires the model to be on a GPU (deviceId).");
+        if (isSequenceTrainingCriterion || (m_needAdaptRegularization && m_adaptationRegType == AdaptationRegType::KL) || m_doGradientCheck)
+            InvalidArgument("replicaDeviceIds cannot be combined with sequence training, KL-regularized adaptation, or gradientcheck.");
+        std::vector<DEVICEID_TYPE> deviceIds;
+        for (size_t i = 0; i < m_replicaDeviceIds.size(); i++)
+        {
+            DEVICEID_TYPE deviceId = (DEVICEID_TYPE) m_replicaDeviceIds[i];
+            if (deviceId < 0 || deviceId == net->GetDeviceId() || std::find(deviceIds.begin(), deviceIds.end(), deviceId) != deviceIds.end())
+                InvalidArgument("replicaDeviceIds must be GPUs other than the model's (%d), each listed once.", (int) net->GetDeviceId());
+            deviceIds.push_back(deviceId);
+            AllowAdditionalGPU(deviceId); // (networks are otherwise held to the first GPU chosen)
+        }
+        wstring replicaModelFileName = GetPerRankFileName(m_modelPath + L".replica", L"replica");
+        net->Save(replicaModelFileName);
+        m_deviceReplicas = make_shared<DataReaderHelpers::DeviceReplicaDispatcher<ElemType>>();
+        m_deviceReplicas->Init(net, replicaModelFileName, deviceIds, learnableNodes, criterionNodes, evaluationNodes);
+        _wunlink(replicaModelFileName.c_str());
+    }
+
+    // Hogwild: threads with their own copies of the network, which share its parameters, see HogwildDispatcher
+    m_hogwild.reset();
+    if (m_hogwildThreads > 0)
+    {
+        if (net->GetDeviceId() != CPUDEVICE)
+            InvalidArgument("hogwildThreads requires the model to be on the CPU (deviceId=-1).");
+        if (m_parallelizationMethod != ParallelizationMethod::None || m_parameterShards || m_flatParameterBuffers ||
+            isSequenceTrainingCriterion || m_needAdaptRegularization || m_doGradientCheck)
+            InvalidArgument("hogwildThreads cannot be combined with parallelTrain, shardedParameters, flatParameterBuffers, sequence training, adaptation regularization, or gradientcheck.");
+        if (GradUpdateType() != GradientsUpdateType::None || m_L2RegWeight != 0 || m_L1RegWeight != 0 || m_clippingThresholdPerSample != std::numeric_limits<double>::infinity())
+            InvalidArgument("hogwildThreads updates the parameters by plain SGD: gradUpdateType must be None, without L1RegWeight, L2RegWeight, or clippingThresholdPerSample.");
+        fprintf(stderr, "Warning: hogwildThreads ignores momentum.\n");
+        wstring copyModelFileName = GetPerRankFileName(m_modelPath + L".hogwild", L"hogwild");
+        net->Save(copyModelFileName);
+        m_hogwild = make_shared<DataReaderHelpers::HogwildDispatcher<ElemType>>();
+        m_hogwild->Init(net, copyModelFileName, m_hogwildThreads, m_hogwildAtomicUpdates, learnableNodes, criterionNodes, evaluationNodes);
+        _wunlink(copyModelFileName.c_str());
+    }
+
     // pass user config on memory allocation for convolution operations to the Network
     ComputationNetwork::SetMaxTempMemSizeForCNN(net, criterionNodes[0], m_maxTempMemSizeInSamplesForCNN);
+    for (size_t k = 0; m_deviceReplicas && k < m_deviceReplicas->NumReplicas(); k++)
+    {
+        auto replicaNet = m_deviceReplicas->GetReplicaNetwork(k);
+        ComputationNetwork::SetMaxTempMemSizeForCNN(replicaNet, replicaNet->GetNodeFromName(criterionNodes[0]->NodeName()), m_maxTempMemSizeInSamplesForCNN);
+    }
+    for (size_t k = 0; m_hogwild && k < m_hogwild->NumWorkers(); k++)
+    {
+        auto workerNet = m_hogwild->GetWorkerNetwork(k);
+        ComputationNetwork::SetMaxTempMemSizeForCNN(workerNet, workerNet->GetNodeFromName(criterionNodes[0]->NodeName()), m_maxTempMemSizeInSamplesForCNN);
+    }
     if (m_needAdaptRegularization && m_adaptationRegType == AdaptationRegType::KL && refNode)
     {
         ComputationNetwork::SetMaxTempMemSizeForCNN(refNet, refNode, m_maxTempMemSizeInSamplesForCNN);
@@ -315,20 +641,60 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                                                   m_seqGammarCalcAMF, m_seqGammarCalcLMF, m_seqGammarCalcWP, m_seqGammarCalcbMMIFactor, m_seqGammarCalcUsesMBR);
     }
 
+    if (!m_timelineTraceFile.empty())
+    {
+        TimelineTrace::Enable();
+        TimelineTrace::SetThreadName("main");
+    }
+
     // --- MAIN EPOCH LOOP
+    bool joinedElasticJob = m_elasticJoin; // (the others have let us in already, see JoinElasticJob())
     for (int i = startEpoch; i < (int) m_maxEpochs; i++) // TODO: why is this an int, and not a size_t?
     {
         // Synchronize all ranks before proceeding to ensure that
         // rank 0 has finished writing the previous model file
-        if (g_mpi != nullptr)
+        if (g_mpi != nullptr && !joinedElasticJob)
         {
             g_mpi->WaitAll();
         }
 
+        // in elastic training, workers may join here; they take over the main node's state
+        if (m_elasticTraining)
+        {
+            double sharedState[] = {learnRatePerSample, prevCriterion, avgCriterion, prevDropoutRate, (double) totalSamplesSeen,
+                                    (double) epochsNotCountedInAvgCriterion, (double) dropOutSeed, (double) learnRateReduced, (double) m_prevChosenMinibatchSize};
+            if (UpdateElasticMembership(net, i, joinedElasticJob, evaluationNodes.size(), smoothedGradients, sharedState, _countof(sharedState)))
+            {
+                learnRatePerSample = sharedState[0];
+                prevCriterion = sharedState[1];
+                avgCriterion = sharedState[2];
+                prevDropoutRate = sharedState[3];
+                totalSamplesSeen = (size_t) sharedState[4];
+                epochsNotCountedInAvgCriterion = (size_t) sharedState[5];
+                dropOutSeed = (unsigned long) sharedState[6];
+                learnRateReduced = sharedState[7] != 0;
+                m_prevChosenMinibatchSize = (size_t) sharedState[8];
+            }
+            joinedElasticJob = false;
+        }
+
         Timer timer;
         timer.Start();
 
         // set dropout rate for this epoch
+        // (the replicas get their own seeds from the sequence, so that the shards are not all dropped out the same way)
+        for (size_t k = 0; m_deviceReplicas && k < m_deviceReplicas->NumReplicas(); k++)
+        {
+            auto replicaNet = m_deviceReplicas->GetReplicaNetwork(k);
+            double prevReplicaDropoutRate = prevDropoutRate;
+            ComputationNetwork::SetDropoutRate<ElemType>(replicaNet, replicaNet->GetNodeFromName(criterionNodes[0]->NodeName()), m_dropoutRates[i], prevReplicaDropoutRate, dropOutSeed);
+        }
+        for (size_t k = 0; m_hogwild && k < m_hogwild->NumWorkers(); k++)
+        {
+            auto workerNet = m_hogwild->GetWorkerNetwork(k);
+            double prevWorkerDropoutRate = prevDropoutRate;
+            ComputationNetwork::SetDropoutRate<ElemType>(workerNet, workerNet->GetNodeFromName(criterionNodes[0]->NodeName()), m_dropoutRates[i], prevWorkerDropoutRate, dropOutSeed);
+        }
         ComputationNetwork::SetDropoutRate<ElemType>(net, criterionNodes[0], m_dropoutRates[i], prevDropoutRate, dropOutSeed);
 
         // learning rate adjustment
@@ -337,7 +703,7 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
             // BUGBUG: GetNumParallelSequences() returns 1 under certain situations; it seems when restarting from checkpoint
             learnRatePerSample = GetLearningRatePerSample(i /*BUGBUG workaround:*/, trainSetDataReader->GetNumParallelSequences());
         }
-        else if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch)
+        else if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch && m_midEpochResume.epoch != i) // (a resumed epoch keeps its learning rate)
         {
             double largestPrevLearnRatePerSample = prevLearnRates[0];
             for (int j = 1; j < m_numPrevLearnRates; j++)
@@ -366,6 +732,9 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                     i + 1, learnRatePerSample, m_minLearnRate);
             if (m_autoLearnRateSearchType != LearningRateSearchAlgorithm::None)
             {
+                WaitForCheckPoint(/*allRanks=*/false);
+                if (m_parameterShards)
+                    m_parameterShards->GatherForSave(smoothedGradients); // (training ends, so they stay gathered)
                 net->Save(m_modelPath);
             }
             break;
@@ -378,7 +747,12 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
         // basis for a set number of epochs.  For epochs after that point, m_mbSize.size(), either
         // we just keep using
         // the last minibatch size, or we use tuning to try and find a better one.
-        if (m_autoAdjustMinibatch && i >= m_mbSize.size())
+        // A resumed epoch keeps the minibatch size it was started with.
+        if (m_midEpochResume.epoch == i)
+        {
+            chosenMinibatchSize = m_midEpochResume.minibatchSize;
+        }
+        else if (m_autoAdjustMinibatch && i >= m_mbSize.size())
         {
             size_t numFramesToUseInSearch = m_numMiniBatch4LRSearch[i] * m_mbSize[i];
             if (m_epochSize != requestDataSize)
@@ -413,21 +787,31 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
         fprintf(stderr, "Starting Epoch %d: learning rate per sample = %f  effective momentum = %f  momentum as time constant = %.1f samples\n",
                 i + 1, learnRatePerSample, MomentumPerMB(momentumPerSample, actualMinibatchSize), momentumAsTimeConstant);
 
-        TrainOneEpoch(net,
-                      refNet,
-                      refNode,
-                      i,
-                      m_epochSize,
-                      trainSetDataReader,
-                      learnRatePerSample,
-                      chosenMinibatchSize,
-                      featureNodes,
-                      labelNodes,
-                      criterionNodes,
-                      evaluationNodes,
-                      inputMatrices,
-                      learnableNodes, smoothedGradients,
-                      epochCriterion, epochEvalErrors, totalSamplesSeen);
+        try
+        {
+            TrainOneEpoch(net,
+                          refNet,
+                          refNode,
+                          i,
+                          m_epochSize,
+                          trainSetDataReader,
+                          learnRatePerSample,
+                          chosenMinibatchSize,
+                          featureNodes,
+                          labelNodes,
+                          criterionNodes,
+                          evaluationNodes,
+                          inputMatrices,
+                          learnableNodes, smoothedGradients,
+                          epochCriterion, epochEvalErrors, totalSamplesSeen,
+                          "", /*midEpochCheckPoints=*/true);
+        }
+        catch (const MpiWorkerLost& e) // (elastic training only) the epoch starts over with the remaining workers
+        {
+            RecoverFromLostWorkers(net, i, evaluationNodes.size(), e, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion);
+            i--;
+            continue;
+        }
 
         timer.Stop();
         double epochTime = timer.ElapsedSeconds();
@@ -479,11 +863,16 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
             }
         }
 
-        if ((g_mpi == nullptr) || g_mpi->IsMainNode())
+        if (m_traceLevel > 0 && net->GetDeviceId() >= 0)
+            TracingGPUMemoryAllocator::PrintCacheStatistics(net->GetDeviceId());
+
+        // cross-validate, on all ranks if distributed, otherwise on the main node only
+        // (asynchronously always on the main node only, on its own device)
+        const bool useDistributedCV = m_distributedCrossValidation && !m_asyncCrossValidation && (m_parallelizationMethod != ParallelizationMethod::None) && (g_mpi != nullptr) && (g_mpi->NumNodesInUse() > 1);
+        if ((g_mpi == nullptr) || g_mpi->IsMainNode() || useDistributedCV)
         {
             if (validationSetDataReader != trainSetDataReader && validationSetDataReader != nullptr)
             {
-                SimpleEvaluator<ElemType> evalforvalidation(net);
                 vector<wstring> cvSetTrainAndEvalNodes;
                 if (criterionNodes.size() > 0)
                 {
@@ -494,15 +883,42 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                     cvSetTrainAndEvalNodes.push_back(evaluationNodes[0]->NodeName());
                 }
 
-                vector<double> vScore = evalforvalidation.Evaluate(validationSetDataReader, cvSetTrainAndEvalNodes, m_mbSize[i]);
-                fprintf(stderr, "Finished Epoch[%2d of %d]: [Validation Set] TrainLossPerSample = %.8g", i + 1, (int) m_maxEpochs, vScore[0]);
-                if (vScore.size() > 1)
+                vector<double> vScore;
+                if (m_asyncCrossValidation)
+                {
+                    StartCrossValidationAsync(net, validationSetDataReader, cvSetTrainAndEvalNodes, i, m_mbSize[i]);
+                    // If the result decides the learning rate after this epoch, wait for it, unless the previous epoch's may be used.
+                    // Otherwise it only goes to the log, and the next epoch starts right away.
+                    const bool learnRateNeedsCV = m_useCVSetControlLRIfCVExists && m_autoLearnRateSearchType == LearningRateSearchAlgorithm::AdjustAfterEpoch &&
+                                                  m_learningRatesParam.size() <= i;
+                    if (learnRateNeedsCV && !m_lateCVLearnRateDecision)
+                        WaitForCrossValidation();
+                    vScore = m_lastCrossValidationScores; // (this epoch's, the previous epoch's, or none yet)
+                }
+                else
                 {
-                    fprintf(stderr, "; EvalErrPerSample = %.8g", vScore[1]);
+                    SimpleEvaluator<ElemType> evalforvalidation(net, 100, 0, useDistributedCV, m_enableDistributedMBReading);
+                    if (m_parameterShards)
+                        evalforvalidation.SetBeforeForwardProp([this](bool haveData) { m_parameterShards->FetchColumns(haveData); });
+                    try
+                    {
+                        vScore = evalforvalidation.Evaluate(validationSetDataReader, cvSetTrainAndEvalNodes, m_mbSize[i]);
+                    }
+                    catch (const MpiWorkerLost& e) // (as above; distributed cross-validation of this epoch's model is not worth keeping it for)
+                    {
+                        RecoverFromLostWorkers(net, i, evaluationNodes.size(), e, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion);
+                        i--;
+                        continue;
+                    }
+                    fprintf(stderr, "Finished Epoch[%2d of %d]: [Validation Set] TrainLossPerSample = %.8g", i + 1, (int) m_maxEpochs, vScore[0]);
+                    if (vScore.size() > 1)
+                    {
+                        fprintf(stderr, "; EvalErrPerSample = %.8g", vScore[1]);
+                    }
+                    fprintf(stderr, "\n");
                 }
-                fprintf(stderr, "\n");
 
-                if (m_useCVSetControlLRIfCVExists)
+                if (m_useCVSetControlLRIfCVExists && !vScore.empty())
                 {
                     if (m_useEvalCriterionControlLR && vScore.size() > 1)
                     {
@@ -546,6 +962,7 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                 {
                     auto bestModelPath = GetModelNameForEpoch(i - m_learnRateAdjustInterval);
                     fprintf(stderr, "Loading previous model with best training-criterion value: %ls.\n", bestModelPath.c_str());
+                    WaitForCheckPoint(/*allRanks=*/true);
                     net->RereadPersistableParameters<ElemType>(bestModelPath);
                     LoadCheckPointInfo(i - m_learnRateAdjustInterval,
                                        /*out*/ totalSamplesSeen,
@@ -553,6 +970,8 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                                        smoothedGradients,
                                        /*out*/ prevCriterion,
                                        /*out*/ m_prevChosenMinibatchSize);
+                    if (m_parameterShards)
+                        m_parameterShards->Reshard(smoothedGradients); // (they were read in full)
                     loadedPrevModel = true;
                 }
             }
@@ -569,6 +988,9 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                     }
                     else
                     {
+                        WaitForCheckPoint(/*allRanks=*/false);
+                        if (m_parameterShards)
+                            m_parameterShards->GatherForSave(smoothedGradients);
                         net->Save(GetModelNameForEpoch(i, true));
 
                         fprintf(stderr, "Finished training and saved final model\n\n");
@@ -622,10 +1044,11 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
         }
 
         // persist model and check-point info
+        if (m_parameterShards)
+            m_parameterShards->GatherForSave(smoothedGradients);
         if ((g_mpi == nullptr) || g_mpi->IsMainNode())
         {
-            net->Save(GetModelNameForEpoch(i));
-            SaveCheckPointInfo(i, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, chosenMinibatchSize);
+            vector<wstring> obsoleteCheckPointFiles;
             if (!m_keepCheckPointFiles)
             {
                 // delete previous checkpoint file to save space
@@ -633,34 +1056,75 @@ void SGD<ElemType>::TrainOrAdaptModel(int startEpoch, ComputationNetworkPtr net,
                 {
                     if (epochsSinceLastLearnRateAdjust != 1)
                     {
-                        _wunlink(GetCheckPointFileNameForEpoch(i - 1).c_str());
+                        obsoleteCheckPointFiles.push_back(GetCheckPointFileNameForEpoch(i - 1));
                     }
                     if (epochsSinceLastLearnRateAdjust == m_learnRateAdjustInterval)
                     {
-                        _wunlink(GetCheckPointFileNameForEpoch(i - m_learnRateAdjustInterval).c_str());
+                        obsoleteCheckPointFiles.push_back(GetCheckPointFileNameForEpoch(i - m_learnRateAdjustInterval));
                     }
                 }
                 else
                 {
-                    _wunlink(GetCheckPointFileNameForEpoch(i - 1).c_str());
+                    obsoleteCheckPointFiles.push_back(GetCheckPointFileNameForEpoch(i - 1));
                 }
             }
+            // the epoch is complete, so its mid-epoch checkpoint, if any, is obsolete (the checkpoint file goes first, as it validates the others)
+            obsoleteCheckPointFiles.push_back(GetMidEpochCheckPointFileName(i));
+            obsoleteCheckPointFiles.push_back(GetMidEpochModelName(i));
+            for (size_t rank = 0; rank < (g_mpi ? g_mpi->NumNodesInUse() : 1); rank++)
+                obsoleteCheckPointFiles.push_back(GetMidEpochRankFileName(i, rank));
+            if (m_asyncCheckPoint)
+                SaveCheckPointAsync(net, i, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, chosenMinibatchSize, obsoleteCheckPointFiles);
+            else
+            {
+                net->Save(GetModelNameForEpoch(i));
+                SaveCheckPointInfo(i, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, chosenMinibatchSize);
+                for (const auto& file : obsoleteCheckPointFiles)
+                    _wunlink(file.c_str());
+            }
         }
+        if (m_parameterShards)
+            m_parameterShards->RestoreAfterSave(smoothedGradients);
 
         if (learnRatePerSample < 1e-12)
         {
             fprintf(stderr, "learnRate per sample is reduced to %.8g which is below 1e-12. stop training.\n",
                     learnRatePerSample);
         }
+
+        SaveTimelineTrace(); // (so far, in case training does not get to the end)
     }
     // --- END OF MAIN EPOCH LOOP
 
+    WaitForCrossValidation();               // (for the log of the last epoch's)
+    WaitForCheckPoint(/*allRanks=*/false); // (the ranks are synchronized below)
+    if (m_parameterShards)
+        m_parameterShards->GatherForSave(smoothedGradients);
+
+    // compact copy of the final model for deployment; training continues from the FP32 model
+    if (m_saveHalfPrecisionModel && ((g_mpi == nullptr) || g_mpi->IsMainNode()))
+    {
+        net->Save(m_modelPath + L".fp16", (FileOptions)(FileOptions::fileOptionsBinary | FileOptions::fileOptionsHalfPrecision));
+        fprintf(stderr, "Saved final model with half-precision parameters to %ls.fp16\n", m_modelPath.c_str());
+    }
+    if (m_saveMappableModel && ((g_mpi == nullptr) || g_mpi->IsMainNode()))
+    {
+        net->Save(m_modelPath + L".mapped", (FileOptions)(FileOptions::fileOptionsBinary | FileOptions::fileOptionsMappableParameters));
+        fprintf(stderr, "Saved final model with memory-mappable parameters to %ls.mapped\n", m_modelPath.c_str());
+    }
+    if (m_saveQuantizedModel && ((g_mpi == nullptr) || g_mpi->IsMainNode()))
+    {
+        net->Save(m_modelPath + L".int8", (FileOptions)(FileOptions::fileOptionsBinary | FileOptions::fileOptionsQuantized8Bit));
+        fprintf(stderr, "Saved final model with 8-bit parameters to %ls.int8\n", m_modelPath.c_str());
+    }
+
     // Synchronize all ranks before proceeding to ensure that
     // rank 0 has finished writing the model file
     if (g_mpi != nullptr)
     {
         g_mpi->WaitAll();
     }
+    SaveTimelineTrace();
 
     // progress tracing for compute cluster management
     ProgressTracing::TraceProgressPercentage(m_maxEpochs, 0.0, true);
@@ -704,7 +1168,8 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                                     /*out*/ double& epochCriterion,
                                     /*out*/ std::vector<double>& epochEvalErrors,
                                     /*out*/ size_t& totalSamplesSeen,
-                                    std::string prefixMsg)
+                                    std::string prefixMsg,
+                                    bool midEpochCheckPoints)
 {
     double totalTimeInMBs = 0; // use double since timer has sub-microsecond time resolution
     double epochCriterionLastMBs = 0;
@@ -719,18 +1184,50 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
 
     // NOTE: the following two local matrices are not used in distGradAgg path
     // assume only one training criterion node for each epoch.
-    // The criterion values are accumulated here over the minibatches (without having to pull them off the GPU).
-    Matrix<ElemType> localEpochCriterion(1, 1, net->GetDeviceId());
-    Matrix<ElemType> localEpochEvalErrors(1, epochEvalErrors.size(), net->GetDeviceId());
+    // The criterion values are accumulated here over the minibatches (without having to pull them off the GPU),
+    // and read back only for the progress log, checkpoints and at the end of the epoch.
+    // (on the criterion's device, which for a model split across GPUs is that of the last part)
+    CriterionAccumulator<ElemType> epochCriteria(criterionNodes[0]->GetDeviceId(), epochEvalErrors.size());
+    Matrix<ElemType>& localEpochCriterion = epochCriteria.Criterion();
+    Matrix<ElemType>& localEpochEvalErrors = epochCriteria.EvalErrors();
 
-    localEpochCriterion.SetValue(0);
-    localEpochEvalErrors.SetValue(0);
+    // per-parameter norms of the fused parameter update, kept across minibatches
+    Matrix<ElemType> multiTensorWorkspace(net->GetDeviceId());
+
+    // magnitude pruning of the weights to this epoch's sparsity, if enabled
+    WeightPruner<ElemType> weightPruner(net, criterionNodes[0], m_pruneSparsity, m_pruneStartEpoch, m_pruneEndEpoch, epochNumber + 1);
 
     bool useGradientAggregation = ((m_parallelizationMethod == ParallelizationMethod::DataParallelSGD) &&
-                                   (epochNumber >= m_parallelizationStartEpochNum));
+                                   (epochNumber >= m_parallelizationStartEpochNum) && !m_trainLocally);
     bool useModelAveraging = ((m_parallelizationMethod == ParallelizationMethod::ModelAveragingSGD) &&
-                              (epochNumber >= m_parallelizationStartEpochNum));
+                              (epochNumber >= m_parallelizationStartEpochNum) && !m_trainLocally);
     bool useParallelTrain = useGradientAggregation || useModelAveraging;
+    bool useAsyncModelAveraging = useModelAveraging && m_useAsyncModelAveraging;
+    if (useModelAveraging && (m_modelAverager == nullptr) && (m_useAsyncModelAveraging || (m_modelAveragingElasticity != 1) || (m_blockMomentum > 0)))
+    {
+        m_modelAverager.reset(new ModelAverager<ElemType>(g_mpi, m_useAsyncModelAveraging, m_modelAveragingElasticity, m_blockMomentum, m_blockLearningRate, m_useCudaAwareMpi));
+    }
+    if (useModelAveraging && m_useNcclModelAveraging)
+    {
+        if (!NcclComm::IsSupported())
+            RuntimeError("useNccl=true is unsupported in CNTK binaries built without NCCL support!");
+        if (m_modelAverager != nullptr)
+            InvalidArgument("useNccl=true in ModelAveragingSGD cannot be combined with useAsyncModelAveraging, elasticity, or blockMomentum.");
+        if (m_modelAveragingAllReduce == nullptr)
+            m_modelAveragingAllReduce = new NcclHierarchicalAllReduce<ElemType>(g_mpi, "ModelAveragingSync");
+    }
+    if (useModelAveraging && (m_modelAveragingDeltaBits > 0))
+    {
+        if ((m_modelAverager != nullptr) || m_useNcclModelAveraging)
+            InvalidArgument("deltaBits in ModelAveragingSGD cannot be combined with useAsyncModelAveraging, elasticity, blockMomentum, or useNccl.");
+        // The first sync of each epoch exchanges the full models, since the model may have been reloaded in between,
+        // and starts the error feedback afresh.
+        m_lastSyncedModels.clear();
+        delete m_modelDeltaAggregator;
+        m_modelDeltaAggregator = new CompressedDistGradAggregator<ElemType>(g_mpi, m_modelAveragingDeltaBits, false /*zeroThresholdFor1Bit*/, 0 /*topKFraction*/, m_syncStatsTrace);
+        if (m_modelDeltaHeader == nullptr)
+            m_modelDeltaHeader = DistGradHeader::Create(0);
+    }
 
     // MA-related variables
     size_t nSamplesSinceLastModelSync = 0;
@@ -739,10 +1236,50 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
     float nSecondsSinceLastMAPerfReport = 0;
 
     std::vector<Matrix<ElemType>*> learnParamsGradients;
+    std::map<ComputationNodeBasePtr, size_t> learnParamsGradientIndices; // [node] -> index into learnParamsGradients
     if (useGradientAggregation)
     {
         epochCriterion = double(0.0);
         epochEvalErrors.assign(epochEvalErrors.size(), double(0.0));
+
+        learnParamsGradients.reserve(learnableNodes.size());
+        // with flat buffers, the gradients in it are aggregated as one; an aggregator that overlaps with backprop still needs them one by one
+        const bool aggregateFlatGradients = m_flatParameterGradients && !m_distGradAgg->OverlapsWithBackprop();
+        if (aggregateFlatGradients)
+            learnParamsGradients.push_back(m_flatParameterGradients.get());
+        size_t nodeIndex = 0;
+        for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, nodeIndex++)
+        {
+            ComputationNodePtr node = dynamic_pointer_cast<ComputationNode<ElemType>>(*nodeIter);
+            if (node->IsParameterUpdateRequired() && !(aggregateFlatGradients && m_flatParameterOffsets[nodeIndex] != SIZE_MAX) &&
+                !(m_parameterShards && m_parameterShards->IsSharded(node))) // (their owners receive the gradients of their shares directly)
+            {
+                Matrix<ElemType>* currParamsGradient = &(node->Gradient());
+
+                // Sometimes, in parallel training, the current node may not get any samples to process
+                // In this case, the gradient matrix may not have been sized yet. If so, lets size it.
+                if (currParamsGradient->GetNumCols() == 0)
+                {
+                    Matrix<ElemType>* currParamsValues = &(node->Value());
+                    currParamsGradient->Resize(currParamsValues->GetNumRows(), currParamsValues->GetNumCols());
+                }
+
+                learnParamsGradientIndices[node] = learnParamsGradients.size();
+                learnParamsGradients.push_back(currParamsGradient);
+            }
+        }
+    }
+
+    // when the aggregator overlaps with backprop, tell it about every gradient that is complete
+    std::function<void(const ComputationNodeBasePtr&)> gradientIsFinal;
+    if (useGradientAggregation && m_distGradAgg->OverlapsWithBackprop())
+    {
+        gradientIsFinal = [&](const ComputationNodeBasePtr& node)
+        {
+            auto iter = learnParamsGradientIndices.find(node);
+            if (iter != learnParamsGradientIndices.end())
+                m_distGradAgg->GradientIsFinal(learnParamsGradients, iter->second);
+        };
     }
 
     Profiler profiler(m_numMBsToCUDAProfile);
@@ -763,8 +1300,51 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         trainSetDataReader->StartMinibatchLoop(tunedMBSize, epochNumber, epochSize);
     }
 
+    // continue an interrupted epoch from its mid-epoch checkpoint
+    size_t numMBsRead = 0; // (for mid-epoch checkpoints)
+    if (midEpochCheckPoints && m_midEpochResume.epoch == epochNumber)
+    {
+        const MidEpochCheckPoint& resume = m_midEpochResume;
+        if (resume.epochEvalErrors.size() != epochEvalErrors.size())
+            RuntimeError("TrainOneEpoch: The mid-epoch checkpoint has %d evaluation criteria, but the network has %d.", (int) resume.epochEvalErrors.size(), (int) epochEvalErrors.size());
+        fprintf(stderr, "Resuming epoch %d after minibatch %d from its mid-epoch checkpoint.\n", epochNumber + 1, (int) resume.numMBsRun);
+        if (!resume.hasReaderState || !trainSetDataReader->SetState(resume.readerState))
+        {
+            fprintf(stderr, "Reading the first %d minibatches of the epoch again to position the reader.\n", (int) resume.numMBsRead);
+            for (size_t i = 0; i < resume.numMBsRead && trainSetDataReader->GetMinibatch(*inputMatrices); i++)
+                trainSetDataReader->DataEnd(EndDataType::endDataSentence);
+        }
+        numMBsRead = resume.numMBsRead;
+        numMBsRun = (int) resume.numMBsRun;
+        totalEpochSamples = resume.totalEpochSamples;
+        epochCriterion = epochCriterionLastMBs = resume.epochCriterion;
+        epochEvalErrors = epochEvalErrorsLastMBs = resume.epochEvalErrors;
+        if (!useGradientAggregation)
+        {
+            localEpochCriterion.SetValue((ElemType) resume.epochCriterion);
+            std::vector<ElemType> evalErrors(resume.epochEvalErrors.begin(), resume.epochEvalErrors.end());
+            if (!evalErrors.empty())
+                localEpochEvalErrors.SetValue(1, evalErrors.size(), localEpochEvalErrors.GetDeviceId(), evalErrors.data());
+        }
+        m_midEpochResume.epoch = -1;
+    }
+
+    // The ranks' models and gradients are in flight with model averaging and buffered asynchronous aggregation, so no mid-epoch checkpoints there.
+    midEpochCheckPoints = midEpochCheckPoints && m_checkPointIntervalInMinutes > 0;
+    if (midEpochCheckPoints && (useModelAveraging || (useGradientAggregation && m_bufferedAsyncGradientAggregation)))
+    {
+        fprintf(stderr, "Warning: checkPointIntervalInMinutes is ignored with model averaging and buffered asynchronous gradient aggregation.\n");
+        midEpochCheckPoints = false;
+    }
+    Timer checkPointTimer;
+    checkPointTimer.Start();
+
     net->StartEvaluateMinibatchLoop(evaluationNodes);
     net->StartEvaluateMinibatchLoop(criterionNodes);
+    if (m_deviceReplicas)
+        m_deviceReplicas->StartEvaluateMinibatchLoop();
+    if (m_hogwild)
+        m_hogwild->StartEvaluateMinibatchLoop();
     if (m_needAdaptRegularization && m_adaptationRegType == AdaptationRegType::KL && refNode)
     {
         refNet->StartEvaluateMinibatchLoop(refNode);
@@ -793,6 +1373,18 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
     if (numSubminibatchesNeeded > 1)
         smbDispatcher.Init(net, learnableNodes, criterionNodes, evaluationNodes);
 
+    // prepare for accumulating the gradients of several minibatches
+    DataReaderHelpers::GradientAccumulator<ElemType> gradientAccumulator;
+    if (m_numMBsToAccumulate > 1)
+        gradientAccumulator.Init(net, learnableNodes, criterionNodes, evaluationNodes);
+    size_t numMBsAccumulated = 0; // minibatches read since the last update (on all ranks the same number, also if empty)
+    size_t accumulatedMBSize = 0;
+    size_t accumulatedNumSamplesWithLabel = 0;
+
+    // a gradient is only final for aggregation after the last pass that contributes to it
+    if ((numSubminibatchesNeeded > 1) || (m_numMBsToAccumulate > 1) || m_deviceReplicas)
+        gradientIsFinal = nullptr;
+
     // The following is a special feature only supported by the Kaldi2Reader for more efficient sequence training.
     // This attemps to compute the error signal for the whole utterance, which will
     // be fed to the neural network as features. Currently it is a workaround
@@ -810,6 +1402,18 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         {
             fprintf(stderr, ", BufferedAsyncGradientAggregation is ENABLED");
         }
+        else if (m_topKGradientFraction > 0)
+        {
+            fprintf(stderr, ", only the top %.3g%% of each gradient are exchanged", 100 * m_topKGradientFraction);
+        }
+        else if (m_useNcclGradientAggregation)
+        {
+            fprintf(stderr, ", gradients are aggregated with NCCL within machines");
+        }
+        else if (m_distGradAgg->OverlapsWithBackprop())
+        {
+            fprintf(stderr, ", gradient aggregation overlaps with backprop (buckets of %d KB)", (int) m_gradientBucketSizeInKB);
+        }
     }
     if (useDistributedMBReading)
     {
@@ -822,8 +1426,53 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         else
             fprintf(stderr, ", with %d subminibatch", (int) numSubminibatchesNeeded);
     }
+    if (m_numMBsToAccumulate > 1)
+    {
+        fprintf(stderr, ", accumulating the gradients of %d minibatches per update", (int) m_numMBsToAccumulate);
+    }
+    if (m_deviceReplicas)
+    {
+        fprintf(stderr, ", with model replicas on %d more GPUs", (int) m_deviceReplicas->NumReplicas());
+    }
+    if (m_hogwild)
+    {
+        fprintf(stderr, ", Hogwild on %d threads (their criteria are shown as they finish)", (int) m_hogwild->NumWorkers());
+    }
     fprintf(stderr, ".\n");
 
+    // per-node timing
+    unique_ptr<NodeProfiler> nodeProfiler(m_profileNodes ? new NodeProfiler() : nullptr);
+
+    // forward and backprop of minibatches that keep their shape, replayed from a CUDA graph
+    // Everything that runs CPU code between the nodes of a step, or changes the work from step to step, rules it out.
+    unique_ptr<CapturedTrainingStep<ElemType>> capturedStep;
+    if (m_useCUDAGraph)
+    {
+        std::vector<ComputationNodeBasePtr> inputNodes(featureNodes);
+        inputNodes.insert(inputNodes.end(), labelNodes.begin(), labelNodes.end());
+        wstring whyNot = CapturedTrainingStep<ElemType>::WhyNotCapturable(net, inputNodes, criterionNodes[0]);
+        if (whyNot.empty() && (numSubminibatchesNeeded > 1 || m_deviceReplicas || !m_modelParallelDeviceIds.empty() || m_parameterShards || gradientIsFinal || nodeProfiler || refNode))
+            whyNot = L"it is combined with sub-minibatches, replicaDeviceIds, modelParallelDeviceIds, shardedParameters, gradient aggregation overlapping with backprop, profileNodes, or adaptation regularization";
+        if (whyNot.empty())
+            capturedStep.reset(new CapturedTrainingStep<ElemType>(net, inputNodes));
+        else
+            fprintf(stderr, "Warning: cudaGraph ignored since %ls.\n", whyNot.c_str());
+    }
+
+    // machine-readable metrics, one JSON record per m_numMBsToShowResult minibatches, see WriteMetricsRecord()
+    // The CPU-side times of the three phases; GPU work shows up where the CPU waits for it (mostly in aggregation, or the next read).
+    unique_ptr<FILE, int (*)(FILE*)> metricsStream(m_metricsFile.empty() ? nullptr : fopenOrDie(GetPerRankFileName(m_metricsFile, L"jsonl"), L"a"), fclose);
+    ThroughputMetrics metrics;
+    Timer phaseTimer;
+    if (metricsStream)
+        TracingGPUMemoryAllocator::ResetPeakAllocatedBytes(net->GetDeviceId());
+    size_t gradientBytesSentLastMBs = m_distGradAgg ? m_distGradAgg->GetNumGradientBytesSent() : 0;
+
+    // GPU memory and utilization, sampled in the background, and reported with the progress lines below
+    GPUWatcher gpuWatcher;
+    if (m_gpuWatcherIntervalInSeconds > 0 && net->GetDeviceId() >= 0)
+        gpuWatcher.Start(net->GetDeviceId(), m_gpuWatcherIntervalInSeconds, m_gpuWatcherMinFreeMemoryMB);
+
     Timer timer;
     timer.Start();
 
@@ -835,10 +1484,19 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         // get minibatch
         // TODO: is it guaranteed that the GPU is already completed at this point, is it safe to overwrite the buffers?
         size_t actualMBSize = 0;
-        bool wasDataRead = DataReaderHelpers::GetMinibatchIntoNetwork(*trainSetDataReader, net, criterionNodes[0],
-                                                                      useDistributedMBReading, useParallelTrain, *inputMatrices, actualMBSize);
-        if (!wasDataRead && (!useDistributedMBReading || noMoreSamplesToProcess)) // in case of distributed reading, we do a few more loops until all ranks have completed
-            break;                                                                // end of epoch
+        bool wasDataRead;
+        {
+            TimelineScope scope("GetMinibatch", "reader");
+            phaseTimer.Restart();
+            wasDataRead = DataReaderHelpers::GetMinibatchIntoNetwork(*trainSetDataReader, net, criterionNodes[0],
+                                                                     useDistributedMBReading, useParallelTrain, *inputMatrices, actualMBSize);
+            phaseTimer.Stop();
+            metrics.readerSeconds += phaseTimer.ElapsedSeconds();
+        }
+        if (wasDataRead)
+            numMBsRead++;
+        if (!wasDataRead && (!useDistributedMBReading || noMoreSamplesToProcess) && (numMBsAccumulated == 0)) // in case of distributed reading, we do a few more loops until all ranks have completed
+            break;                                                                                                    // end of epoch
 
         // Note: If !wasDataRead then the data that GetMinibatchIntoNetwork() was supposed to full in are undefined.
         // Must not touch them.
@@ -856,9 +1514,19 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         ComputationNetwork::BumpEvalTimeStamp(featureNodes);
         ComputationNetwork::BumpEvalTimeStamp(labelNodes);
 
-        if (actualMBSize > 0)
+        // the columns of the sharded embeddings that our share of the minibatch uses (every worker serves the others, also without data)
+        if (m_parameterShards)
+            m_parameterShards->FetchColumns(actualMBSize > 0);
+
+        // with Hogwild, a training thread takes the minibatch and updates the parameters on its own, while we read the next one
+        if (m_hogwild && actualMBSize > 0)
+            m_hogwild->Dispatch(*inputMatrices, learnRatePerSample > 0.01 * m_minLearnRate ? learnRatePerSample : 0, localEpochCriterion, localEpochEvalErrors);
+
+        if (actualMBSize > 0 && !m_hogwild)
         {
             assert(wasDataRead);
+            TimelineScope scope("ForwardBackward", "compute");
+            phaseTimer.Restart();
 #ifndef EVALDLL
             if (m_doGradientCheck && GradientCheck(net, criterionNodes, learnableNodes, 0) == false)
                 LogicError("cannot pass gradient checker");
@@ -881,6 +1549,10 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
 
             // do forward and back propagation
 
+            // With replicas on other GPUs, the network below only processes its shard of the minibatch, see DeviceReplicaDispatcher.
+            if (m_deviceReplicas)
+                m_deviceReplicas->StartMinibatch(*inputMatrices, learnRatePerSample > 0.01 * m_minLearnRate);
+
             // We optionally break the minibatch into sub-minibatches.
             // This, when enabled, is used when a full minibatch does not fit into GPU RAM.
             size_t actualNumSubminibatches = numSubminibatchesNeeded <= 1 ? 1 : smbDispatcher.GetMinibatchIntoCache(*trainSetDataReader, *net, *inputMatrices, numSubminibatchesNeeded);
@@ -899,6 +1571,8 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
 
                 // compute eval node first since when gradient is computed the forward function values
                 // may be changed and need to be recomputed when gradient and function value share the same matrix
+                auto step = [&]()
+                {
                 net->ForwardProp(evaluationNodes); // the bulk of this evaluation is reused in ComputeGradient() below
 
                 // ===========================================================
@@ -912,7 +1586,25 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                 // ===========================================================
 
                 if (learnRatePerSample > 0.01 * m_minLearnRate) // only compute gradient when learning rate is large enough
-                    net->Backprop(criterionNodes[0]);
+                {
+                    // gradients are only final after the last sub-minibatch
+                    if (ismb + 1 == actualNumSubminibatches)
+                        net->Backprop(criterionNodes[0], gradientIsFinal);
+                    else
+                        net->Backprop(criterionNodes[0]);
+                }
+                };
+                if (capturedStep && learnRatePerSample > 0.01 * m_minLearnRate)
+                    capturedStep->Run(step);
+                else
+                {
+                    if (capturedStep)
+                        capturedStep->Invalidate(); // (a step without backprop)
+                    step();
+                }
+
+                if (nodeProfiler)
+                    nodeProfiler->EndPass();
 
                 // house-keeping for sub-minibatching
                 if (actualNumSubminibatches > 1)
@@ -920,11 +1612,47 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
             }                                                        // end sub-minibatch loop
             if (actualNumSubminibatches > 1)
                 smbDispatcher.DoneWithCurrentMinibatch();
+            if (m_deviceReplicas)
+                m_deviceReplicas->FinishMinibatch(); // (sums the replicas' gradients and criteria into the network's)
+            phaseTimer.Stop();
+            metrics.computeSeconds += phaseTimer.ElapsedSeconds();
         } // if (actualMBSize > 0)
 
+        // and their gradients go back to the owners, in place of aggregation
+        if (m_parameterShards)
+            m_parameterShards->ReturnGradients();
+
         // for progress and statistics, we should only count frames that are not gaps
         size_t numSamplesWithLabel = wasDataRead ? net->GetNumSamplesWithLabel(actualMBSize) : 0;
 
+        // with gradient accumulation, go on reading until we have the gradients of m_numMBsToAccumulate minibatches
+        // (or the data ran out), and then continue as if they had been a single minibatch
+        if (m_numMBsToAccumulate > 1)
+        {
+            if (wasDataRead)
+                numMBsAccumulated++;
+            if (actualMBSize > 0)
+                gradientAccumulator.Accumulate();
+            accumulatedMBSize += actualMBSize;
+            accumulatedNumSamplesWithLabel += numSamplesWithLabel;
+            if (wasDataRead && (numMBsAccumulated < m_numMBsToAccumulate))
+            {
+                // (as at the end of the loop below)
+                trainSetDataReader->DataEnd(EndDataType::endDataSentence);
+                AttemptUtteranceDerivativeFeatures(net, trainSetDataReader, featureNodes, inputMatrices);
+                continue;
+            }
+
+            if (gradientAccumulator.NumAccumulated() > 0)
+                gradientAccumulator.MoveToNet();
+            wasDataRead = (numMBsAccumulated > 0); // (if the data ran out, the next read will see that)
+            numMBsAccumulated = 0;
+            actualMBSize = accumulatedMBSize;
+            numSamplesWithLabel = accumulatedNumSamplesWithLabel;
+            accumulatedMBSize = 0;
+            accumulatedNumSamplesWithLabel = 0;
+        }
+
         // Sum of actualMBSize across all nodes when using parallel training
         size_t aggregateNumSamples = actualMBSize;
         size_t aggregateNumSamplesWithLabel = numSamplesWithLabel;
@@ -932,54 +1660,40 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         if (!useGradientAggregation)
         {
             // accumulate criterion values (objective, eval)
-            if (actualMBSize != 0)
+            if (actualMBSize != 0 && !m_hogwild) // (the Hogwild threads hand in theirs)
             {
                 assert(wasDataRead);
                 // criteria are in Value()(0,0), we accumulate into another 1x1 Matrix (to avoid having to pull the values off the GPU)
-                Matrix<ElemType>::AddElementToElement(dynamic_pointer_cast<ComputationNode<ElemType>>(criterionNodes[0])->Value(),
-                                                      0, 0, localEpochCriterion, 0, 0);
-                for (size_t i = 0; i < evaluationNodes.size(); i++)
-                {
-                    Matrix<ElemType>::AddElementToElement(dynamic_pointer_cast<ComputationNode<ElemType>>(evaluationNodes[i])->Value(),
-                                                          0, 0, localEpochEvalErrors, 0, i);
-                }
+                epochCriteria.Accumulate(criterionNodes[0], evaluationNodes);
             }
+            // for the progress log, start the readback now, so that it overlaps with the parameter update
+            if ((numMBsRun + 1) % m_numMBsToShowResult == 0)
+                epochCriteria.StartReadback();
         }
         else
         {
             // distributed gradient aggregation
-            if (learnParamsGradients.size() == 0)
-            {
-                learnParamsGradients.reserve(learnableNodes.size());
-                for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++)
-                {
-                    ComputationNodePtr node = dynamic_pointer_cast<ComputationNode<ElemType>>(*nodeIter);
-                    if (node->IsParameterUpdateRequired())
-                    {
-                        Matrix<ElemType>* currParamsGradient = &(node->Gradient());
-
-                        // Sometimes, in parallel training, the current node may not get any samples to process
-                        // In this case, the gradient matrix may not have been sized yet. If so, lets size it.
-                        if (currParamsGradient->GetNumCols() == 0)
-                        {
-                            Matrix<ElemType>* currParamsValues = &(node->Value());
-                            currParamsGradient->Resize(currParamsValues->GetNumRows(), currParamsValues->GetNumCols());
-                        }
-
-                        learnParamsGradients.push_back(currParamsGradient);
-                    }
-                }
-            }
-
             // prepare the header
             m_gradHeader->numEvalNode = evaluationNodes.size();
             m_gradHeader->numSamples = actualMBSize;
             m_gradHeader->numSamplesWithLabel = numSamplesWithLabel;
-            m_gradHeader->criterion = actualMBSize > 0 ? criterionNodes[0]->Get00Element() : 0.0;
+            // (all values in one transfer)
+            double mbCriterion = 0;
+            std::vector<double> mbEvalErrors(evaluationNodes.size(), 0.0);
+            if (actualMBSize > 0)
+                epochCriteria.ReadMinibatchValues(criterionNodes[0], evaluationNodes, mbCriterion, mbEvalErrors);
+            m_gradHeader->criterion = mbCriterion;
             for (size_t i = 0; i < evaluationNodes.size(); i++)
-                m_gradHeader->evalErrors[i] = actualMBSize > 0 ? evaluationNodes[i]->Get00Element() : 0.0;
+                m_gradHeader->evalErrors[i] = mbEvalErrors[i];
 
-            bool samplesProcessed = m_distGradAgg->AggregateGradients(learnParamsGradients, m_gradHeader, epochNumber);
+            bool samplesProcessed;
+            {
+                TimelineScope scope("AggregateGradients", "mpi");
+                phaseTimer.Restart();
+                samplesProcessed = m_distGradAgg->AggregateGradients(learnParamsGradients, m_gradHeader, epochNumber);
+                phaseTimer.Stop();
+                metrics.communicationSeconds += phaseTimer.ElapsedSeconds();
+            }
             noMoreSamplesToProcess = !samplesProcessed;
 
             aggregateNumSamples = m_gradHeader->numSamples;
@@ -990,13 +1704,20 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         }
 
         // update model parameters
-        if ((aggregateNumSamples > 0) && (learnRatePerSample > m_minLearnRate * 0.01))
+        if ((aggregateNumSamples > 0) && (learnRatePerSample > m_minLearnRate * 0.01) && !m_hogwild)
         {
+            TimelineScope scope("UpdateWeights", "compute");
+            phaseTimer.Restart();
+            std::vector<bool> updatedMultiTensor(learnableNodes.size(), false);
+            UpdateWeightsMultiTensor(learnableNodes, smoothedGradients, learnRatePerSample,
+                                     GetMomentumPerSample(epochNumber /*BUGBUG workaround:*/, net->GetMBLayoutPtr()->GetNumParallelSequences()), aggregateNumSamples,
+                                     updatedMultiTensor, multiTensorWorkspace);
+            size_t nodeIndex = 0;
             auto smoothedGradientIter = smoothedGradients.begin();
-            for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, smoothedGradientIter++)
+            for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, smoothedGradientIter++, nodeIndex++)
             {
                 ComputationNodeBasePtr node = *nodeIter;
-                if (node->IsParameterUpdateRequired())
+                if (node->IsParameterUpdateRequired() && !updatedMultiTensor[nodeIndex])
                 {
                     Matrix<ElemType>& smoothedGradient = *smoothedGradientIter;
 #ifdef _DEBUG
@@ -1013,13 +1734,22 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
 #endif
                 }
             }
+            weightPruner.ApplyMasks();
+            phaseTimer.Stop();
+            metrics.computeSeconds += phaseTimer.ElapsedSeconds();
         }
 
         // aggregation by model averaging
         if (useModelAveraging)
         {
             // Determine if any samples were processed across any of the ranks
-            if (useDistributedMBReading)
+            // (with asynchronous averaging, each worker stops on its own, and ModelAverager::Finish() waits for the others)
+            if (useAsyncModelAveraging)
+            {
+                if (!wasDataRead)
+                    noMoreSamplesToProcess = true;
+            }
+            else if (useDistributedMBReading)
             {
                 std::array<int, 1> numNodesWithDataToProcess;
                 numNodesWithDataToProcess[0] = wasDataRead ? 1 : 0;
@@ -1034,8 +1764,12 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                 size_t processedSamples = 0;
                 float secondsSinceLastSyncFinished = 0;
                 float secondsSpentOnSync = 0;
-                if (ModelAveragingProcessing(nSamplesSinceLastModelSync, learnableNodes, processedSamples,
-                                             secondsSinceLastSyncFinished, secondsSpentOnSync))
+                phaseTimer.Restart();
+                const bool synced = ModelAveragingProcessing(nSamplesSinceLastModelSync, learnableNodes, processedSamples,
+                                                             secondsSinceLastSyncFinished, secondsSpentOnSync);
+                phaseTimer.Stop();
+                metrics.communicationSeconds += phaseTimer.ElapsedSeconds();
+                if (synced)
                 {
                     // if a sync happens, do some extra work
                     nSamplesSinceLastModelSync = 0;
@@ -1071,11 +1805,7 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
             if (!useGradientAggregation)
             {
                 timer.Restart();
-                epochCriterion = localEpochCriterion.Get00Element();
-                for (size_t i = 0; i < epochEvalErrors.size(); i++)
-                {
-                    epochEvalErrors[i] = localEpochEvalErrors(0, i);
-                }
+                epochCriteria.FinishReadback(epochCriterion, epochEvalErrors);
                 timer.Stop();
 
                 // Add the last trailing compute
@@ -1092,7 +1822,7 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
                 int mbProgNumPrecision = 2;
                 if (m_maxComputedEpochSize != 0)
                 {
-                    double numMBPerEpoch = (double) m_maxComputedEpochSize / (double) tunedMBSize;
+                    double numMBPerEpoch = (double) m_maxComputedEpochSize / (double) (tunedMBSize * m_numMBsToAccumulate);
                     mbProg = (double) numMBsRun / numMBPerEpoch;
                     mbProgNumPrecision = (int) ceil(log10(numMBPerEpoch / (double) m_numMBsToShowResult));
                     mbProgNumPrecision = max(mbProgNumPrecision - 2, 2);
@@ -1127,6 +1857,31 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
             string formatString = "TotalTime = " + GeneratePaddedFloatOrExpFormat(0, 4, totalTimeInMBs) + "s; SamplesPerSecond = %.1f\n";
             SGDTrace(stderr, formatString.c_str(), totalTimeInMBs, numSamplesLastMBs / totalTimeInMBs);
 
+            if (gpuWatcher.IsRunning())
+            {
+                metrics.gpu = gpuWatcher.GetSampleAndReset();
+                if (m_traceLevel > 0)
+                    GPUWatcher::PrintSample(stderr, metrics.gpu);
+            }
+
+            if (metricsStream)
+            {
+                metrics.epoch = epochNumber;
+                metrics.firstMB = numMBsRun - m_numMBsToShowResult;
+                metrics.numMBs = m_numMBsToShowResult;
+                metrics.numSamples = numSamplesLastMBs;
+                metrics.seconds = totalTimeInMBs;
+                metrics.trainLossPerSample = trainLossPerSample;
+                metrics.gpuPeakBytes = TracingGPUMemoryAllocator::GetCacheStatistics(net->GetDeviceId()).m_peakAllocatedBytes;
+                const size_t gradientBytesSent = m_distGradAgg ? m_distGradAgg->GetNumGradientBytesSent() : 0;
+                metrics.gradientBytesSent = gradientBytesSent - gradientBytesSentLastMBs;
+                WriteMetricsRecord(metricsStream.get(), metrics);
+
+                metrics = ThroughputMetrics();
+                gradientBytesSentLastMBs = gradientBytesSent;
+                TracingGPUMemoryAllocator::ResetPeakAllocatedBytes(net->GetDeviceId());
+            }
+
             // progress tracing for compute cluster management
             if (wasProgressPrinted)
             {
@@ -1170,19 +1925,72 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
         // TODO: move the two-forward-pass support out of the reader.
         AttemptUtteranceDerivativeFeatures(net, trainSetDataReader, featureNodes, inputMatrices);
 
+        // save a mid-epoch checkpoint every m_checkPointIntervalInMinutes; all ranks decide together, at a minibatch whose progress was shown
+        if (midEpochCheckPoints && (numMBsRun % m_numMBsToShowResult == 0) && !noMoreSamplesToProcess)
+        {
+            checkPointTimer.Stop();
+            std::array<int, 1> numRanksDue;
+            numRanksDue[0] = checkPointTimer.ElapsedSeconds() >= 60 * m_checkPointIntervalInMinutes ? 1 : 0;
+            if (g_mpi != nullptr)
+                g_mpi->AllReduce(numRanksDue);
+            if (numRanksDue[0] > 0)
+            {
+                MidEpochCheckPoint checkPoint;
+                checkPoint.epoch = epochNumber;
+                checkPoint.numMBsRead = numMBsRead;
+                checkPoint.numMBsRun = numMBsRun;
+                checkPoint.totalEpochSamples = totalEpochSamples;
+                checkPoint.totalSamplesSeen = totalSamplesSeen;
+                checkPoint.learnRatePerSample = learnRatePerSample;
+                checkPoint.minibatchSize = tunedMBSize;
+                checkPoint.epochCriterion = epochCriterion;
+                checkPoint.epochEvalErrors = epochEvalErrors;
+                if (!useGradientAggregation)
+                    epochCriteria.Read(checkPoint.epochCriterion, checkPoint.epochEvalErrors);
+                checkPoint.hasReaderState = trainSetDataReader->GetState(checkPoint.readerState);
+                SaveMidEpochCheckPoint(net, checkPoint, smoothedGradients);
+                checkPointTimer.Restart();
+            }
+        }
+
         profiler.NextSample();
     }
 
     // --- END MAIN MINIBATCH LOOP
 
+    if (m_hogwild)
+        m_hogwild->Finish(localEpochCriterion, localEpochEvalErrors);
+
+    if (capturedStep)
+        capturedStep->PrintStatistics(numMBsRun);
+
+    if (nodeProfiler && ((g_mpi == nullptr) || g_mpi->IsMainNode()))
+    {
+        fprintf(stderr, "%s", prefixMsg.c_str());
+        nodeProfiler->PrintTable(stderr);
+        const wstring tracePath = GetModelNameForEpoch(epochNumber) + L".nodes.json";
+        nodeProfiler->SaveChromeTrace(tracePath);
+        fprintf(stderr, "Node profile saved to %ls\n", tracePath.c_str());
+    }
+    nodeProfiler.reset();
+
     if (useModelAveraging && (g_mpi->NumNodesInUse() > 1))
     {
         // may not be synced after epoch finished, so do the sync here
-        int residualSampels = (int) nSamplesSinceLastModelSync;
-        g_mpi->AllReduce(&residualSampels, 1);
-        totalSamplesSeen += residualSampels;
-        totalEpochSamples += residualSampels;
-        ModelAveragingSync(nSamplesSinceLastModelSync, learnableNodes);
+        if (m_modelAverager != nullptr)
+        {
+            size_t numSamplesAveraged = m_modelAverager->Finish(learnableNodes, nSamplesSinceLastModelSync);
+            totalSamplesSeen += numSamplesAveraged;
+            totalEpochSamples += numSamplesAveraged;
+        }
+        else
+        {
+            int residualSampels = (int) nSamplesSinceLastModelSync;
+            g_mpi->AllReduce(&residualSampels, 1);
+            totalSamplesSeen += residualSampels;
+            totalEpochSamples += residualSampels;
+            ModelAveragingSync(nSamplesSinceLastModelSync, learnableNodes);
+        }
         nSynced++;
         nSamplesSinceLastModelSync = 0;
     }
@@ -1200,14 +2008,8 @@ size_t SGD<ElemType>::TrainOneEpoch(ComputationNetworkPtr net,
     else
     {
         // without, we have them in Matrix objects that possibly live on the GPU--get them over now
-        localEpochCriterion /= float(totalEpochSamples);
-        localEpochEvalErrors /= float(totalEpochSamples);
-
-        epochCriterion = localEpochCriterion.Get00Element();
-        for (size_t i = 0; i < epochEvalErrors.size(); i++)
-        {
-            epochEvalErrors[i] = localEpochEvalErrors(0, i);
-        }
+        epochCriteria.Normalize(totalEpochSamples);
+        epochCriteria.Read(epochCriterion, epochEvalErrors);
     }
 
     // in case of model averaging, do one more final aggregation of criteria
@@ -1288,29 +2090,74 @@ bool SGD<ElemType>::PreCompute(ComputationNetworkPtr net,
     // trainSetDataReader->StartMinibatchLoop(m_mbSize[0],  0 , m_epochSize); // only based on one epoch
     // [1/12/2015 erw] to support large dataset, we usually partition whole dataset into several epoch's,
     // so we need to use all the data to do precomputing
-    if (m_useAllDataForPreComputedNode) // using all the data
-        trainSetDataReader->StartMinibatchLoop(m_mbSize[0], 0);
-    else // using only one epoch
-        trainSetDataReader->StartMinibatchLoop(m_mbSize[0], 0, m_epochSize);
-    net->StartEvaluateMinibatchLoop(nodes);
-
-    // initialize
-    for (auto nodeIter = nodes.begin(); nodeIter != nodes.end(); nodeIter++)
+    size_t epochSize = m_useAllDataForPreComputedNode ? requestDataSize /*all the data*/ : m_epochSize /*only one epoch*/;
+    // sampled estimation: if we know the amount of data, we read the requested fraction of it (readers randomize, so this
+    // is a random sample); otherwise we still read everything, but only accumulate a random subset of the minibatches
+    std::mt19937 sampleRandom((unsigned int) (g_mpi != nullptr ? g_mpi->CurrentNodeRank() : 0));
+    std::bernoulli_distribution sampleMinibatch(m_preComputeSampleFraction);
+    bool sampleMinibatches = false;
+    if (m_preComputeSampleFraction < 1)
     {
-        auto node = static_pointer_cast<PreComputedNodeBase<ElemType>>(*nodeIter);
-        node->MarkComputed(false /*begin accumulating*/);
+        if (epochSize != requestDataSize)
+            epochSize = max((size_t) (m_preComputeSampleFraction * epochSize), (size_t) 1);
+        else
+            sampleMinibatches = true;
+        fprintf(stderr, "Precomputing --> using %.1f%% of the %s.\n", 100 * m_preComputeSampleFraction, sampleMinibatches ? "minibatches" : "samples");
     }
 
-    const size_t numIterationsBeforePrintingProgress = 100;
-    size_t numItersSinceLastPrintOfProgress = 0;
-    size_t actualMBSizeDummy;
-    while (DataReaderHelpers::GetMinibatchIntoNetwork(*trainSetDataReader, net, nullptr, false, false, *inputMatrices, actualMBSizeDummy))
+    // reuse the statistics of an earlier job on the same data, if any (see PreComputeCache.h for what identifies the data)
+    unique_ptr<PreComputeCache<ElemType>> cache;
+    if (!m_preComputeCache.empty())
+    {
+        cache.reset(new PreComputeCache<ElemType>(m_preComputeCache));
+        cache->Add(nodes);
+        cache->Add(epochSize);
+        cache->Add(m_preComputeSampleFraction);
+        trainSetDataReader->StartMinibatchLoop(m_mbSize[0], 0, epochSize); // (the same first minibatch on all workers)
+        size_t firstMBSize;
+        if (DataReaderHelpers::GetMinibatchIntoNetwork(*trainSetDataReader, net, nullptr, false, false, *inputMatrices, firstMBSize))
+        {
+            for (const auto& input : *inputMatrices)
+            {
+                cache->Add(input.first);
+                cache->Add(*input.second);
+            }
+        }
+        if (cache->TryLoad(nodes))
+        {
+            fprintf(stderr, "\nPrecomputing --> Loaded from %ls.\n\n", m_preComputeCache.c_str());
+            return true;
+        }
+    }
+
+    // distributed: each worker accumulates over its share of the data, and the statistics are combined at the end
+    const bool useParallel = m_distributedPreCompute && (m_parallelizationMethod != ParallelizationMethod::None) && (g_mpi != nullptr) && (g_mpi->NumNodesInUse() > 1);
+    const bool useDistributedMBReading = useParallel && m_enableDistributedMBReading && trainSetDataReader->SupportsDistributedMBRead();
+    if (useDistributedMBReading)
+        trainSetDataReader->StartDistributedMinibatchLoop(m_mbSize[0], 0, g_mpi->CurrentNodeRank(), g_mpi->NumNodesInUse(), epochSize);
+    else
+        trainSetDataReader->StartMinibatchLoop(m_mbSize[0], 0, epochSize);
+    net->StartEvaluateMinibatchLoop(nodes);
+
+    // initialize
+    for (auto nodeIter = nodes.begin(); nodeIter != nodes.end(); nodeIter++)
+    {
+        auto node = static_pointer_cast<PreComputedNodeBase<ElemType>>(*nodeIter);
+        node->MarkComputed(false /*begin accumulating*/);
+    }
+
+    const size_t numIterationsBeforePrintingProgress = 100;
+    size_t numItersSinceLastPrintOfProgress = 0;
+    size_t actualMBSize;
+    while (DataReaderHelpers::GetMinibatchIntoNetwork(*trainSetDataReader, net, nullptr, useDistributedMBReading, useParallel, *inputMatrices, actualMBSize))
     {
         // TODO: move these into GetMinibatchIntoNetwork()  --but those are passed around; necessary? Can't we get them from 'net'?
         ComputationNetwork::BumpEvalTimeStamp(featureNodes);
         ComputationNetwork::BumpEvalTimeStamp(labelNodes);
 
-        net->ForwardProp(nodes);
+        // (in parallel, our share of a minibatch may be empty)
+        if (actualMBSize > 0 && (!sampleMinibatches || sampleMinibatch(sampleRandom)))
+            net->ForwardProp(nodes);
 
         if (ProgressTracing::IsEnabled())
         {
@@ -1324,6 +2171,21 @@ bool SGD<ElemType>::PreCompute(ComputationNetworkPtr net,
         }
     }
 
+    // combine the workers' statistics
+    if (useParallel)
+    {
+        for (auto nodeIter = nodes.begin(); nodeIter != nodes.end(); nodeIter++)
+        {
+            auto node = dynamic_pointer_cast<MeanInvStdDevNodeBase<ElemType>>(*nodeIter);
+            if (!node)
+                LogicError("PreCompute: %ls %ls operation cannot be precomputed in parallel.", (*nodeIter)->NodeName().c_str(), (*nodeIter)->OperationName().c_str());
+            node->AggregateAcrossWorkers([](std::vector<double>& buffer)
+                                         {
+                                             g_mpi->AllReduce(buffer);
+                                         });
+        }
+    }
+
     // finalize
     for (auto nodeIter = nodes.begin(); nodeIter != nodes.end(); nodeIter++)
     {
@@ -1331,6 +2193,8 @@ bool SGD<ElemType>::PreCompute(ComputationNetworkPtr net,
         node->MarkComputed(true /*done accumulating*/);
     }
     fprintf(stderr, "\nPrecomputing --> Completed.\n\n");
+    if (cache && (g_mpi == nullptr || g_mpi->IsMainNode()))
+        cache->Save(nodes);
 
     return true;
 }
@@ -1378,6 +2242,7 @@ double SGD<ElemType>::SearchForBestLearnRate(ComputationNetworkPtr net,
     }
 
     int baseModelEpoch = epochNumber - 1;
+    WaitForCheckPoint(/*allRanks=*/true);
     net->RereadPersistableParameters<ElemType>(GetModelNameForEpoch(baseModelEpoch));
 
     double learnRate = learnRatePerSample;
@@ -1389,42 +2254,113 @@ double SGD<ElemType>::SearchForBestLearnRate(ComputationNetworkPtr net,
                        /*out*/ prevCriterion,
                        /*out*/ dummyMinibatchSize);
 
-    // if model is not changed this is what we will get
-    TrainOneMiniEpochAndReloadModel(net, refNet, refNode, epochNumber,
-                                    numFramesToUseInSearch, trainSetDataReader, 0, m_mbSize[epochNumber],
-                                    featureNodes, labelNodes,
-                                    criterionNodes, evaluationNodes,
-                                    inputMatrices, learnableNodes,
-                                    smoothedGradients, /*out*/ baseCriterion,
-                                    /*out*/ epochEvalErrors, /*out*/ totalSamplesSeen,
-                                    "BaseAdaptiveLearnRateSearch:");
-
-    if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch)
+    // the base criterion: if model is not changed this is what we will get
+    auto adjustBaseCriterion = [&]()
     {
-        if (prevCriterion == std::numeric_limits<double>::infinity())
-            prevCriterion = baseCriterion;
+        if (m_autoLearnRateSearchType == LearningRateSearchAlgorithm::SearchBeforeEpoch)
+        {
+            if (prevCriterion == std::numeric_limits<double>::infinity())
+                prevCriterion = baseCriterion;
 
-        double ratio = 0.3;
+            double ratio = 0.3;
 
-        if (m_epochSize != requestDataSize)
-            ratio = pow(((double) numFramesToUseInSearch) / m_epochSize, 1.0f / 2);
+            if (m_epochSize != requestDataSize)
+                ratio = pow(((double) numFramesToUseInSearch) / m_epochSize, 1.0f / 2);
 
-        baseCriterion = max(ratio * prevCriterion + (1 - ratio) * baseCriterion, baseCriterion);
+            baseCriterion = max(ratio * prevCriterion + (1 - ratio) * baseCriterion, baseCriterion);
+        }
+    };
+
+    // Parallel search: each rank trains from the same model, on all of the search data by itself, while the others try other
+    // learning rates. In each round, rank 0 trains the next candidate (or in the first round, the base) and rank r the r-th
+    // after it; then all ranks exchange the criteria and choose the first candidate the sequential search would have stopped at.
+    // So the result is the same, in a fraction of the rounds. This saves the most where the ranks would otherwise all run the
+    // same trials (before parallelizationStartEpoch), or where the exchange of gradients dominates the trials.
+    const bool useParallelSearch = m_parallelLearnRateSearch && (g_mpi != nullptr) && (g_mpi->NumNodesInUse() > 1);
+    if (useParallelSearch)
+    {
+        const size_t numRanks = g_mpi->NumNodesInUse();
+        const size_t rank = g_mpi->CurrentNodeRank();
+        m_trainLocally = true;
+        try
+        {
+            bool done = false;
+            for (size_t round = 0; !done; round++)
+            {
+                // candidate k (1-based) has learning rate learnRatePerSample * 0.618^k; 0 is the base (learning rate 0)
+                const size_t firstCandidate = round * numRanks; // (of this round, at rank 0)
+                const size_t k = firstCandidate + rank;
+                const double trialLearnRatePerSample = k == 0 ? 0 : learnRatePerSample * pow(0.618, (double) k);
+                double trialCriterion;
+                TrainOneMiniEpochAndReloadModel(net, refNet, refNode, epochNumber,
+                                                numFramesToUseInSearch, trainSetDataReader,
+                                                trialLearnRatePerSample, m_mbSize[epochNumber], featureNodes,
+                                                labelNodes, criterionNodes,
+                                                evaluationNodes, inputMatrices,
+                                                learnableNodes, smoothedGradients,
+                                                /*out*/ trialCriterion, /*out*/ epochEvalErrors,
+                                                /*out*/ totalSamplesSeen, k == 0 ? "BaseAdaptiveLearnRateSearch:" : "AdaptiveLearnRateSearch:");
+
+                // exchange the criteria of this round: [r] = that of rank r
+                std::vector<double> criteria(numRanks, 0.0);
+                criteria[rank] = trialCriterion;
+                g_mpi->AllReduce(criteria);
+
+                for (size_t r = 0; r < numRanks && !done; r++)
+                {
+                    const size_t candidate = firstCandidate + r;
+                    if (candidate == 0)
+                    {
+                        baseCriterion = criteria[r];
+                        adjustBaseCriterion();
+                        continue;
+                    }
+                    const double candidateLearnRatePerSample = learnRatePerSample * pow(0.618, (double) candidate);
+                    // (the stopping condition of the sequential search below)
+                    if (!(std::isnan(criteria[r]) || (criteria[r] > baseCriterion && candidateLearnRatePerSample > minLearnRate)))
+                    {
+                        epochCriterion = criteria[r];
+                        bestLearnRatePerSample = candidateLearnRatePerSample;
+                        done = true;
+                    }
+                }
+            }
+        }
+        catch (...)
+        {
+            m_trainLocally = false;
+            throw;
+        }
+        m_trainLocally = false;
+        learnRatePerSample = bestLearnRatePerSample;
+        fprintf(stderr, "AdaptiveLearnRateSearch: %d ranks in parallel chose learning rate per sample %.10g.\n", (int) numRanks, learnRatePerSample);
     }
-
-    do
+    else
     {
-        learnRatePerSample *= 0.618;
         TrainOneMiniEpochAndReloadModel(net, refNet, refNode, epochNumber,
-                                        numFramesToUseInSearch, trainSetDataReader,
-                                        learnRatePerSample, m_mbSize[epochNumber], featureNodes,
-                                        labelNodes, criterionNodes,
-                                        evaluationNodes, inputMatrices,
-                                        learnableNodes, smoothedGradients,
-                                        /*out*/ epochCriterion, /*out*/ epochEvalErrors,
-                                        /*out*/ totalSamplesSeen, "AdaptiveLearnRateSearch:");
+                                        numFramesToUseInSearch, trainSetDataReader, 0, m_mbSize[epochNumber],
+                                        featureNodes, labelNodes,
+                                        criterionNodes, evaluationNodes,
+                                        inputMatrices, learnableNodes,
+                                        smoothedGradients, /*out*/ baseCriterion,
+                                        /*out*/ epochEvalErrors, /*out*/ totalSamplesSeen,
+                                        "BaseAdaptiveLearnRateSearch:");
+        adjustBaseCriterion();
 
-    } while (std::isnan(epochCriterion) || (epochCriterion > baseCriterion && learnRatePerSample > minLearnRate));
+        do
+        {
+            learnRatePerSample *= 0.618;
+            TrainOneMiniEpochAndReloadModel(net, refNet, refNode, epochNumber,
+                                            numFramesToUseInSearch, trainSetDataReader,
+                                            learnRatePerSample, m_mbSize[epochNumber], featureNodes,
+                                            labelNodes, criterionNodes,
+                                            evaluationNodes, inputMatrices,
+                                            learnableNodes, smoothedGradients,
+                                            /*out*/ epochCriterion, /*out*/ epochEvalErrors,
+                                            /*out*/ totalSamplesSeen, "AdaptiveLearnRateSearch:");
+
+        } while (std::isnan(epochCriterion) || (epochCriterion > baseCriterion && learnRatePerSample > minLearnRate));
+    }
 
     bestLearnRatePerSample = learnRatePerSample;
 
@@ -1608,6 +2544,10 @@ static size_t RoundToMultipleOf64(size_t val)
 
 // uses a small percentage of training data of minibatch to
 // speculatively train with various MB sizes; then picks the best
+// That is the largest size whose criterion stays within the margin of the smallest one, or with m_minibatchSearchByThroughput,
+// the one among those that trains the most samples per second: as all reach about the same criterion on the same data,
+// that is the one that converges fastest in wall-clock time. Sizes that leave less than m_minibatchSearchMinFreeMemoryMB free
+// are not taken, nor anything larger.
 template <class ElemType>
 size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
                                                  ComputationNetworkPtr refNet,
@@ -1640,6 +2580,10 @@ size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
 
     size_t lastTriedTrialMinibatchSize = 0;
     double lastTriedTrialEpochCriterion = 0;
+    size_t fastestTrialMinibatchSize = 0;
+    double fastestTrialSamplesPerSecond = 0;
+    double fastestTrialEpochCriterion = 0;
+    const DEVICEID_TYPE deviceId = net->GetDeviceId();
     for (float trialMinibatchSizeFloat = (float) minMinibatchSize;
          trialMinibatchSizeFloat <= maxMinibatchSize;
          trialMinibatchSizeFloat *= minibatchSizeTuningFactor)
@@ -1656,6 +2600,8 @@ size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
 
         // Train on a few minibatches and so we can observe the epochCriterion as we try increasing
         // minibatches with iteration of this loop.
+        Timer trialTimer;
+        trialTimer.Restart();
         TrainOneMiniEpochAndReloadModel(net, refNet, refNode, epochNumber,
                                         numFramesToUseInSearch, trainSetDataReader,
                                         learnRatePerSample, trialMinibatchSize, featureNodes,
@@ -1665,6 +2611,32 @@ size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
                                         /*out*/ epochCriterion, /*out*/ epochEvalErrors,
                                         /*out*/ totalSamplesSeen,
                                         isFirstIteration ? "BaseAdaptiveMinibatchSearch:" : "AdaptiveMinibatchSearch:");
+        trialTimer.Stop();
+
+        // throughput and memory headroom; all ranks must take the same decision, so these are agreed on across ranks
+        // (the minibatches of the trial are still allocated, so the free memory is what this size leaves)
+        double trialSeconds = trialTimer.ElapsedSeconds();
+        const size_t freeMemoryMB = deviceId >= 0 ? GPUWatcher::GetFreeMemoryOnCUDADevice(deviceId) >> 20 : 0;
+        double numRanksShortOfMemory = m_minibatchSearchMinFreeMemoryMB > 0 && deviceId >= 0 && freeMemoryMB < m_minibatchSearchMinFreeMemoryMB ? 1 : 0;
+        if (g_mpi != nullptr)
+        {
+            g_mpi->AllReduce(&trialSeconds, 1);
+            trialSeconds /= g_mpi->NumNodesInUse();
+            g_mpi->AllReduce(&numRanksShortOfMemory, 1);
+        }
+        const double samplesPerSecond = trialSeconds > 0 ? numFramesToUseInSearch / trialSeconds : 0;
+        fprintf(stderr, "AdaptiveMinibatchSearch: minibatchSize=%zd: EpochCriterion = %.10g, %.1f samples/sec",
+                trialMinibatchSize, epochCriterion, samplesPerSecond);
+        if (deviceId >= 0)
+            fprintf(stderr, ", %d MB GPU memory free", (int) freeMemoryMB);
+        fprintf(stderr, "\n");
+
+        if (numRanksShortOfMemory > 0 && !isFirstIteration)
+        {
+            fprintf(stderr, "AdaptiveMinibatchSearch: minibatchSize=%zd leaves less than %d MB GPU memory free. Stopping the search.\n",
+                    trialMinibatchSize, (int) m_minibatchSearchMinFreeMemoryMB);
+            break;
+        }
 
         if (isFirstIteration)
         {
@@ -1697,6 +2669,21 @@ size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
                         epochCriterion, baseCriterion);
             }
         }
+        // (the base size is accepted even if short of memory: it is the lower bound)
+        if (samplesPerSecond > fastestTrialSamplesPerSecond)
+        {
+            fastestTrialMinibatchSize = lastTriedTrialMinibatchSize;
+            fastestTrialSamplesPerSecond = samplesPerSecond;
+            fastestTrialEpochCriterion = lastTriedTrialEpochCriterion;
+        }
+    }
+    if (m_minibatchSearchByThroughput && fastestTrialMinibatchSize != 0)
+    {
+        fprintf(stderr, "AdaptiveMinibatchSearch: Choosing the fastest minibatchSize %d (%.1f samples/sec) "
+                        "rather than the largest %d.\n",
+                (int) fastestTrialMinibatchSize, fastestTrialSamplesPerSecond, (int) lastTriedTrialMinibatchSize);
+        lastTriedTrialMinibatchSize = fastestTrialMinibatchSize;
+        lastTriedTrialEpochCriterion = fastestTrialEpochCriterion;
     }
     fprintf(stderr, "AdaptiveMinibatchSearch: Search successful!!! Chose new minibatchSize of %d. "
                     "EpochCriterion = %.10g vs BaseCriterion = %.10g\n\n",
@@ -1705,6 +2692,51 @@ size_t SGD<ElemType>::SearchForBestMinibatchSize(ComputationNetworkPtr net,
     return lastTriedTrialMinibatchSize;
 }
 
+// SnapshotTrainingState - copy all parameter values (not only the learnable ones: e.g. batch-normalization statistics
+// are parameters without gradient) and the smoothed gradients, on their devices
+// Returns false, with an empty snapshot, if there is not enough memory for the copy.
+template <class ElemType>
+bool SGD<ElemType>::SnapshotTrainingState(ComputationNetworkPtr net, const std::list<Matrix<ElemType>>& smoothedGradients, TrainingStateSnapshot& snapshot)
+{
+    try
+    {
+        for (auto& nodeBase : net->GetAllNodes())
+        {
+            if (nodeBase->OperationName() != OperationNameOf(LearnableParameter))
+                continue;
+            auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+            if (!node)
+                continue;
+            snapshot.nodes.push_back(node);
+            snapshot.values.push_back(make_shared<Matrix<ElemType>>(node->Value(), node->Value().GetDeviceId()));
+        }
+        for (auto& smoothedGradient : smoothedGradients)
+            snapshot.smoothedGradients.push_back(make_shared<Matrix<ElemType>>(smoothedGradient, smoothedGradient.GetDeviceId()));
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "SnapshotTrainingState: No room for a copy of the model (%s). Trials will reload it from disk.\n", e.what());
+        snapshot = TrainingStateSnapshot();
+        return false;
+    }
+}
+
+// RestoreTrainingState - copy back what SnapshotTrainingState() took
+// (copies into the existing matrices, which keeps views into flat parameter buffers intact)
+template <class ElemType>
+void SGD<ElemType>::RestoreTrainingState(const TrainingStateSnapshot& snapshot, std::list<Matrix<ElemType>>& smoothedGradients)
+{
+    for (size_t i = 0; i < snapshot.nodes.size(); i++)
+    {
+        snapshot.nodes[i]->Value().SetValue(*snapshot.values[i]);
+        snapshot.nodes[i]->BumpEvalTimeStamp();
+    }
+    auto savedIter = snapshot.smoothedGradients.begin();
+    for (auto& smoothedGradient : smoothedGradients)
+        smoothedGradient.SetValue(**savedIter++);
+}
+
 // run training over a small subset of an epoch, for purpose of automatic LR and MB-size tuning
 template <class ElemType>
 void SGD<ElemType>::TrainOneMiniEpochAndReloadModel(ComputationNetworkPtr net,
@@ -1725,6 +2757,11 @@ void SGD<ElemType>::TrainOneMiniEpochAndReloadModel(ComputationNetworkPtr net,
                                                     /*out*/ size_t& totalSamplesSeen,
                                                     std::string prefixMsg)
 {
+    // undo the trial from a copy in memory if we can afford one; that is much faster than reloading the model and checkpoint
+    TrainingStateSnapshot snapshot;
+    const size_t initialTotalSamplesSeen = totalSamplesSeen;
+    const bool haveSnapshot = SnapshotTrainingState(net, smoothedGradients, snapshot);
+
     TrainOneEpoch(net, refNet, refNode, epochNumber, epochSize,
                   trainSetDataReader, learnRatePerSample, minibatchSize, featureNodes,
                   labelNodes, criterionNodes, evaluationNodes,
@@ -1746,7 +2783,15 @@ void SGD<ElemType>::TrainOneMiniEpochAndReloadModel(ComputationNetworkPtr net,
         fprintf(stderr, "AvgLearningRatePerSample = %.8g\n", learnRatePerSample);
     }
 
+    if (haveSnapshot)
+    {
+        RestoreTrainingState(snapshot, smoothedGradients);
+        totalSamplesSeen = initialTotalSamplesSeen;
+        return;
+    }
+
     int baseModelEpoch = epochNumber - 1;
+    WaitForCheckPoint(/*allRanks=*/true);
     net->RereadPersistableParameters<ElemType>(GetModelNameForEpoch(baseModelEpoch));
 
     double dummyLearnRate;
@@ -1831,17 +2876,35 @@ void SGD<ElemType>::InitDistGradAgg(int numEvalNodes, int traceLevel)
 {
     if (m_parallelizationMethod == ParallelizationMethod::DataParallelSGD)
     {
+        if ((m_distGradAgg == nullptr) && m_useNcclGradientAggregation)
+        {
+            if (!NcclComm::IsSupported())
+                RuntimeError("useNccl=true is unsupported in CNTK binaries built without NCCL support!");
+            if ((m_numGradientBits != (8 * sizeof(ElemType))) || (m_topKGradientFraction > 0) || m_bufferedAsyncGradientAggregation || (m_gradientBucketSizeInKB > 0))
+                InvalidArgument("useNccl=true cannot be combined with gradientBits, topKGradientFraction, useBufferedAsyncGradientAggregation, or gradientBucketSizeInKB.");
+
+            m_distGradAgg = new NcclDistGradAggregator<ElemType>(g_mpi, m_syncStatsTrace);
+        }
+
+        // compressed gradients; quantization is left to the 1-bit SGD aggregator where it is available
+#ifdef QUANTIZED_GRADIENT_AGGREGATION
+        bool useCompressedAggregation = (m_topKGradientFraction > 0);
+#else
+        bool useCompressedAggregation = (m_topKGradientFraction > 0) || (m_numGradientBits != (8 * sizeof(ElemType)));
+#endif
+        if ((m_distGradAgg == nullptr) && useCompressedAggregation)
+        {
+            if (m_bufferedAsyncGradientAggregation || (m_gradientBucketSizeInKB > 0))
+                InvalidArgument("gradientBits and topKGradientFraction cannot be combined with useBufferedAsyncGradientAggregation or gradientBucketSizeInKB.");
+
+            m_distGradAgg = new CompressedDistGradAggregator<ElemType>(g_mpi, m_numGradientBits, m_zeroThresholdFor1Bit, m_topKGradientFraction, m_syncStatsTrace);
+        }
         if (m_distGradAgg == nullptr)
         {
 #ifdef QUANTIZED_GRADIENT_AGGREGATION
             m_distGradAgg = new AllReduceDistGradAggregator<ElemType>(g_mpi, m_numGradientBits, m_zeroThresholdFor1Bit, true /*useQuantizationForSelfStripe*/, m_bufferedAsyncGradientAggregation, traceLevel, m_syncStatsTrace);
 #else
-            if (m_numGradientBits != (8 * sizeof(ElemType)))
-            {
-                RuntimeError("Gradient quantization is unsupported in CNTK binaries built without quantized gradient aggregation support!");
-            }
-
-            m_distGradAgg = new SimpleDistGradAggregator<ElemType>(g_mpi, m_bufferedAsyncGradientAggregation, m_syncStatsTrace);
+            m_distGradAgg = new SimpleDistGradAggregator<ElemType>(g_mpi, m_bufferedAsyncGradientAggregation, m_syncStatsTrace, m_gradientBucketSizeInKB << 10, m_allReduceAlgorithm, m_packGradientsBelowKB << 10, m_useCudaAwareMpi);
 #endif // !QUANTIZED_GRADIENT_AGGREGATION
         }
 
@@ -1872,12 +2935,21 @@ bool SGD<ElemType>::ModelAveragingProcessing(size_t nSamplesSinceLastSync, const
     }
 
     char bNeedToSync = (char) 0; // use char for bool
-    if (g_mpi->IsMainNode() && nSamplesSinceLastSync >= m_nFramesBetweenMASync)
+    if (m_useAsyncModelAveraging)
     {
-        // only the main node can decide whether a sync need to be performed
-        bNeedToSync = (char) 1;
+        // each worker decides on its own, so that nobody waits for the others
+        m_modelAverager->Progress();
+        bNeedToSync = (char) (nSamplesSinceLastSync >= m_nFramesBetweenMASync);
+    }
+    else
+    {
+        if (g_mpi->IsMainNode() && nSamplesSinceLastSync >= m_nFramesBetweenMASync)
+        {
+            // only the main node can decide whether a sync need to be performed
+            bNeedToSync = (char) 1;
+        }
+        g_mpi->Bcast(&bNeedToSync, 1, g_mpi->MainNodeRank());
     }
-    g_mpi->Bcast(&bNeedToSync, 1, g_mpi->MainNodeRank());
     if (bNeedToSync)
     {
         MAtimer.Stop();
@@ -1906,6 +2978,12 @@ size_t SGD<ElemType>::ModelAveragingSync(int nSamplesSinceLastSync, const std::l
         return nSamplesSinceLastSync;
     }
 
+    TimelineScope scope("ModelAveragingSync", "mpi");
+    if (m_modelAverager != nullptr)
+    {
+        return m_modelAverager->Sync(learnableNodes, nSamplesSinceLastSync);
+    }
+
     // ========================================
     // Sec. 1 calculate factor
     // ========================================
@@ -1924,6 +3002,30 @@ size_t SGD<ElemType>::ModelAveragingSync(int nSamplesSinceLastSync, const std::l
 
     // ========================================
     // Sec. 2 sync models based on factor
+    // With NCCL, all models are summed up at once, GPU to GPU within each machine, and through the host only among machines.
+    // With deltaBits, only the quantized changes since the last sync are exchanged, see QuantizedModelDeltaSync().
+    // ========================================
+    if ((m_modelAveragingDeltaBits > 0) && !m_lastSyncedModels.empty())
+    {
+        QuantizedModelDeltaSync(factor, learnableNodes);
+        return nTotalSamples;
+    }
+    if (m_modelAveragingAllReduce != nullptr)
+    {
+        std::vector<Matrix<ElemType>*> models;
+        for (auto& pNode : learnableNodes)
+        {
+            if (!pNode->IsParameterUpdateRequired())
+                continue;
+            Matrix<ElemType>& mat = dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value();
+            Matrix<ElemType>::Scale(factor, mat);
+            models.push_back(&mat);
+        }
+        if (!models.empty())
+            m_modelAveragingAllReduce->AllReduce(models);
+        return nTotalSamples;
+    }
+
     // Note: this is suboptimal at the moment:
     //       we do the averaging for each node in a sequence manner, i.e.,
     //          (node1) GPU->CPU->MPI_AllReduce -> (node2)GPU->CPU->MPI_AllReduce
@@ -1941,6 +3043,14 @@ size_t SGD<ElemType>::ModelAveragingSync(int nSamplesSinceLastSync, const std::l
         Matrix<ElemType>& mat = dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value();
         // 1. normalize the weight matrix
         Matrix<ElemType>::Scale(factor, mat);
+        // (a CUDA-aware MPI sums up the device memory in place, once the scaling is done)
+        if (m_useCudaAwareMpi && (mat.GetDeviceId() >= 0))
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(mat.GetDeviceId()));
+            mainStreamSyncEvent->SynchronizeEvent();
+            g_mpi->AllReduce(mat.BufferPointer(), mat.GetNumElements());
+            continue;
+        }
         // 2. send weight matrix over MPI nodes;
         ElemType* px = mat.CopyToArray();
         size_t nx = mat.GetNumElements();
@@ -1952,9 +3062,59 @@ size_t SGD<ElemType>::ModelAveragingSync(int nSamplesSinceLastSync, const std::l
         delete[] px;
     }
 
+    // the starting point for the deltas of the next syncs
+    if (m_modelAveragingDeltaBits > 0)
+    {
+        for (auto& pNode : learnableNodes)
+        {
+            if (!pNode->IsParameterUpdateRequired())
+                continue;
+            const Matrix<ElemType>& mat = dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value();
+            m_lastSyncedModels.push_back(std::unique_ptr<Matrix<ElemType>>(new Matrix<ElemType>(mat.GetNumRows(), mat.GetNumCols(), mat.GetDeviceId())));
+            m_lastSyncedModels.back()->SetValue(mat);
+            if (m_modelDeltas.size() < m_lastSyncedModels.size())
+                m_modelDeltas.push_back(std::unique_ptr<Matrix<ElemType>>(new Matrix<ElemType>(mat.GetNumRows(), mat.GetNumCols(), mat.GetDeviceId())));
+        }
+    }
+
     return nTotalSamples;
 }
 
+// QuantizedModelDeltaSync - plain synchronous model averaging that only sends the models' changes since the last sync
+// All workers start from the same model G of the last sync, so the average of the models is G plus the weighted sum of
+// their deltas W - G. The deltas are summed up quantized to m_modelAveragingDeltaBits, like gradients are by 1-bit SGD,
+// with each worker keeping its quantization error to add to its next delta; all workers apply the same sum, and so
+// still end up with the same model. factor - this worker's weight in the average
+template <class ElemType>
+void SGD<ElemType>::QuantizedModelDeltaSync(float factor, const std::list<ComputationNodeBasePtr>& learnableNodes)
+{
+    std::vector<Matrix<ElemType>*> deltas;
+    std::vector<Matrix<ElemType>*> models;
+    for (auto& pNode : learnableNodes)
+    {
+        if (!pNode->IsParameterUpdateRequired())
+            continue;
+        Matrix<ElemType>& mat = dynamic_pointer_cast<ComputationNode<ElemType>>(pNode)->Value();
+        Matrix<ElemType>& delta = *m_modelDeltas[models.size()];
+        delta.AssignDifferenceOf(mat, *m_lastSyncedModels[models.size()]);
+        Matrix<ElemType>::Scale(factor, delta);
+        deltas.push_back(&delta);
+        models.push_back(&mat);
+    }
+    if (models.size() != m_lastSyncedModels.size())
+        LogicError("QuantizedModelDeltaSync: The set of parameters has changed.");
+
+    m_modelDeltaHeader->Clear();
+    m_modelDeltaHeader->numSamples = 1; // (we weight the deltas ourselves; a worker without samples just sends a zero delta)
+    m_modelDeltaAggregator->AggregateGradients(deltas, m_modelDeltaHeader, 0);
+
+    for (size_t i = 0; i < models.size(); i++)
+    {
+        *m_lastSyncedModels[i] += *deltas[i];
+        models[i]->SetValue(*m_lastSyncedModels[i]);
+    }
+}
+
 // public:
 // UpdateWeightsS - static version of UpdateWeights()
 // not static since it wants to access protected methods on the SGD object
@@ -2011,11 +3171,9 @@ template <class ElemType>
         smoothedGradient.NormalGrad(gradientValues, functionValues,
                                     (ElemType) learnRatePerSample, (ElemType) momentum, useNesterovMomentum);
     }
-    else if (adpType == GradientsUpdateType::AdaGrad ||
-             (adpType == GradientsUpdateType::RmsProp && gradientValues.GetMatrixType() == MatrixType::SPARSE) ||
-             (adpType == GradientsUpdateType::FSAdaGrad && gradientValues.GetMatrixType() == MatrixType::SPARSE))
+    else if (adpType == GradientsUpdateType::AdaGrad || gradientValues.GetMatrixType() == MatrixType::SPARSE)
     {
-        // rmsprop for sparse is not implemented yet, delegate it with adagrad
+        // the other update types are not implemented for sparse gradients yet, delegate them to adagrad
 
         double aveMultiplier = smoothedGradient.Adagrad(gradientValues, needAveMultiplier);
         Matrix<ElemType>::ScaleAndAdd((ElemType)(-learnRatePerSample / aveMultiplier), gradientValues, functionValues);
@@ -2024,6 +3182,19 @@ template <class ElemType>
     {
         smoothedGradient.FSAdagrad(actualMBSize, gradientValues, functionValues, (ElemType) learnRatePerSample, (ElemType) momentum);
     }
+    else if (adpType == GradientsUpdateType::Adam || adpType == GradientsUpdateType::Lamb)
+    {
+        // the step is normalized, independent of the gradient's scale; so the learning rate is applied per minibatch
+        smoothedGradient.Adam(gradientValues, functionValues, (ElemType) (learnRatePerSample * actualMBSize), (ElemType) momentum,
+                              (ElemType) sgd->m_adam.beta2, (ElemType) sgd->m_adam.epsilon, (ElemType) sgd->m_adam.weightDecay,
+                              adpType == GradientsUpdateType::Lamb);
+    }
+    else if (adpType == GradientsUpdateType::Lars)
+    {
+        // likewise normalized by the trust ratio
+        smoothedGradient.Lars(gradientValues, functionValues, (ElemType) (learnRatePerSample * actualMBSize), (ElemType) momentum,
+                              (ElemType) sgd->m_adam.trustCoefficient);
+    }
     else if (adpType == GradientsUpdateType::RmsProp)
     {
         double aveMultiplier = smoothedGradient.RmsProp(gradientValues, (ElemType) sgd->m_rpi.gamma,
@@ -2075,14 +3246,129 @@ void SGD<ElemType>::UpdateWeights(const ComputationNodeBasePtr& node,
     node->BumpEvalTimeStamp();
 }
 
+// The 'None' update type without gradient noise is a sequence of elementwise steps per parameter
+// (ClipGradient(), L2, NormalGrad(), L1), which Matrix::MultiTensorNormalGrad() fuses for all of them.
+// Sparse gradients keep the per-node path.
+// Clipping by the global norm happens here for all nodes: on the device inside the fused update if that covers all of
+// them, else beforehand by ClipGradientsByGlobalNorm().
+template <class ElemType>
+void SGD<ElemType>::UpdateWeightsMultiTensor(const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                             std::list<Matrix<ElemType>>& smoothedGradients,
+                                             const double learnRatePerSample,
+                                             const double momentumPerSample,
+                                             const size_t actualMBSize,
+                                             std::vector<bool>& updated,
+                                             Matrix<ElemType>& workspace) const
+{
+    assert(actualMBSize > 0);
+#if DUMPOUTPUT
+    const bool canFuse = false; // UpdateWeightsS() prints each step
+#else
+    const bool canFuse = GradUpdateType() == GradientsUpdateType::None && GradientUpdateNoiseStd() <= 0;
+#endif
+    if (!canFuse)
+    {
+        if (IsClippingByGlobalNorm())
+            ClipGradientsByGlobalNorm(learnableNodes, actualMBSize);
+        return;
+    }
+
+    std::vector<Matrix<ElemType>*> functionValues, gradients, smoothed;
+    std::vector<ComputationNodeBasePtr> nodes;
+    std::vector<size_t> nodeIndices;
+    size_t numNodesToUpdate = 0;
+    size_t nodeIndex = 0;
+    auto smoothedGradientIter = smoothedGradients.begin();
+    for (auto nodeIter = learnableNodes.begin(); nodeIter != learnableNodes.end(); nodeIter++, smoothedGradientIter++, nodeIndex++)
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(*nodeIter);
+        if (!node->IsParameterUpdateRequired())
+            continue;
+        numNodesToUpdate++;
+        Matrix<ElemType>& value = node->Value();
+        Matrix<ElemType>& gradient = node->Gradient();
+        if (value.GetMatrixType() != MatrixType::DENSE || gradient.GetMatrixType() != MatrixType::DENSE || smoothedGradientIter->GetMatrixType() != MatrixType::DENSE)
+            continue;
+        if (gradient.GetNumElements() != value.GetNumElements() || smoothedGradientIter->GetNumElements() != value.GetNumElements())
+            continue;
+        if (value.GetDeviceId() != workspace.GetDeviceId()) // (the other parts of a model split across GPUs update one by one)
+            continue;
+        functionValues.push_back(&value);
+        gradients.push_back(&gradient);
+        smoothed.push_back(&*smoothedGradientIter);
+        nodes.push_back(node);
+        nodeIndices.push_back(nodeIndex);
+        updated[nodeIndex] = true;
+    }
+    // a global norm that the fused update would not see all of is computed up front
+    const bool clippingByNorm = m_clippingThresholdPerSample != std::numeric_limits<double>::infinity() && !m_gradientClippingWithTruncation;
+    const bool clippedByGlobalNorm = IsClippingByGlobalNorm() && nodes.size() < numNodesToUpdate;
+    if (clippedByGlobalNorm)
+        ClipGradientsByGlobalNorm(learnableNodes, actualMBSize);
+    if (nodes.empty())
+        return;
+
+    // with flat buffers, all parameters in them update as a single tensor, provided they all take part here
+    // (clipping by the norm of each parameter keeps them apart)
+    if (m_flatSmoothedGradients && (!clippingByNorm || IsClippingByGlobalNorm()) && m_flatParameterValues->GetDeviceId() == functionValues[0]->GetDeviceId())
+    {
+        bool allFlatUpdated = true;
+        for (size_t i = 0; i < m_flatParameterOffsets.size(); i++)
+            allFlatUpdated &= m_flatParameterOffsets[i] == SIZE_MAX || updated[i];
+        if (allFlatUpdated)
+        {
+            size_t k = 0;
+            for (size_t j = 0; j < nodes.size(); j++)
+            {
+                if (m_flatParameterOffsets[nodeIndices[j]] != SIZE_MAX)
+                    continue;
+                functionValues[k] = functionValues[j];
+                gradients[k] = gradients[j];
+                smoothed[k] = smoothed[j];
+                k++;
+            }
+            functionValues.resize(k);
+            gradients.resize(k);
+            smoothed.resize(k);
+            functionValues.push_back(m_flatParameterValues.get());
+            gradients.push_back(m_flatParameterGradients.get());
+            smoothed.push_back(m_flatSmoothedGradients.get());
+        }
+    }
+
+    MultiTensorUpdateDesc desc;
+    desc.learnRatePerSample = learnRatePerSample;
+    desc.momentum = MomentumPerMB(momentumPerSample, actualMBSize);
+    desc.useNesterovMomentum = m_useNesterovMomentum;
+    // multiply by actualMBSize so that it's invariant to minibatch size since learning rate is per sample
+    desc.L2RegWeight = m_L2RegWeight > 0 ? m_L2RegWeight * actualMBSize : 0;
+    desc.L1Threshold = m_L1RegWeight > 0 ? learnRatePerSample * m_L1RegWeight * actualMBSize : 0;
+    desc.clippingThreshold = clippedByGlobalNorm ? std::numeric_limits<double>::infinity() : m_clippingThresholdPerSample * actualMBSize;
+    desc.clippingWithTruncation = m_gradientClippingWithTruncation && m_clippingThresholdPerSample != std::numeric_limits<double>::infinity();
+    desc.clippingByGlobalNorm = IsClippingByGlobalNorm();
+    Matrix<ElemType>::MultiTensorNormalGrad(functionValues, gradients, smoothed, desc, workspace);
+
+    for (auto& node : nodes)
+        node->BumpEvalTimeStamp();
+}
+
 template <class ElemType>
 void SGD<ElemType>::ClipGradient(Matrix<ElemType>& gradient, const size_t actualMBSize) const
 {
-    if (m_clippingThresholdPerSample != std::numeric_limits<double>::infinity())
+    if (m_clippingThresholdPerSample != std::numeric_limits<double>::infinity() && !IsClippingByGlobalNorm()) // (global: see UpdateWeightsMultiTensor())
     {
         double maxGradientPerMB = m_clippingThresholdPerSample * actualMBSize;
         if (m_gradientClippingWithTruncation)
             gradient.InplaceTruncate((ElemType)(maxGradientPerMB));
+        else if (gradient.GetMatrixType() == MatrixType::DENSE && maxGradientPerMB > 0)
+        {
+            // norm2 normalized, on the device so that the CPU does not wait for the norm:
+            // gradient *= maxGradientPerMB / max(norm, maxGradientPerMB)
+            Matrix<ElemType> normFactor(gradient.GetDeviceId());
+            normFactor.AssignFrobeniusNormOf(gradient);
+            ScaleDownToNorm(normFactor, maxGradientPerMB);
+            Matrix<ElemType>::Scale(normFactor, gradient);
+        }
         else
         {
             // norm2 normalized
@@ -2096,6 +3382,78 @@ void SGD<ElemType>::ClipGradient(Matrix<ElemType>& gradient, const size_t actual
     }
 }
 
+template <class ElemType>
+bool SGD<ElemType>::IsClippingByGlobalNorm() const
+{
+    return m_gradientClippingByGlobalNorm && !m_gradientClippingWithTruncation && m_clippingThresholdPerSample != std::numeric_limits<double>::infinity();
+}
+
+// turn a 1x1 norm into the factor that scales it down to at most 'maxNorm' (1 if it is already below), without leaving the device
+template <class ElemType>
+/*static*/ void SGD<ElemType>::ScaleDownToNorm(Matrix<ElemType>& norm, double maxNorm)
+{
+    norm.InplaceTruncateBottom((ElemType) maxNorm);
+    norm.ElementInverse();
+    norm *= (ElemType) maxNorm;
+}
+
+// global-norm clipping for when not all gradients go through the fused update
+// With dense gradients on a single device, the norm is reduced on the device; otherwise this syncs with the device once per parameter.
+template <class ElemType>
+void SGD<ElemType>::ClipGradientsByGlobalNorm(const std::list<ComputationNodeBasePtr>& learnableNodes, const size_t actualMBSize) const
+{
+    const double maxGradientPerMB = m_clippingThresholdPerSample * actualMBSize;
+    std::vector<Matrix<ElemType>*> gradients;
+    for (auto& nodeBase : learnableNodes)
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+        if (node->IsParameterUpdateRequired())
+            gradients.push_back(&node->Gradient());
+    }
+    bool onDevice = !gradients.empty() && maxGradientPerMB > 0;
+    for (auto gradient : gradients)
+        onDevice &= gradient->GetMatrixType() == MatrixType::DENSE && gradient->GetDeviceId() == gradients.front()->GetDeviceId();
+    if (onDevice)
+    {
+        const DEVICEID_TYPE deviceId = gradients.front()->GetDeviceId();
+        Matrix<ElemType> normFactor(1, 1, deviceId);
+        Matrix<ElemType> norm(deviceId);
+        normFactor.SetValue(0);
+        for (auto gradient : gradients)
+        {
+            norm.AssignFrobeniusNormOf(*gradient);
+            norm.AssignElementProductOf(norm, norm);
+            normFactor += norm;
+        }
+        normFactor.InplaceSqrt();
+        ScaleDownToNorm(normFactor, maxGradientPerMB);
+        for (auto gradient : gradients)
+            Matrix<ElemType>::Scale(normFactor, *gradient);
+        return;
+    }
+
+    double sumOfSquares = 0;
+    for (auto& nodeBase : learnableNodes)
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+        if (node->IsParameterUpdateRequired())
+        {
+            const double norm = node->Gradient().FrobeniusNorm();
+            sumOfSquares += norm * norm;
+        }
+    }
+    const double globalNorm = sqrt(sumOfSquares);
+    if (globalNorm <= maxGradientPerMB)
+        return;
+    const ElemType normFactor = (ElemType) (maxGradientPerMB / globalNorm);
+    for (auto& nodeBase : learnableNodes)
+    {
+        auto node = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase);
+        if (node->IsParameterUpdateRequired())
+            node->Gradient() *= normFactor;
+    }
+}
+
 template <class ElemType>
 void SGD<ElemType>::SaveCheckPointInfo(const size_t epoch, const size_t totalSamplesSeen,
                                        const double learnRatePerSample,
@@ -2113,7 +3471,7 @@ void SGD<ElemType>::SaveCheckPointInfo(const size_t epoch, const size_t totalSam
         wstring tempFileName = checkPointFileName + L".tmp";
 
         {
-            File fstream(tempFileName, FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
+            File fstream(tempFileName, FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite | FileOptions::fileOptionsSequential | (m_saveHalfPrecisionCheckPoint ? FileOptions::fileOptionsHalfPrecision : 0));
             fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BCKP");
 
             fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BLearnRate");
@@ -2144,6 +3502,312 @@ void SGD<ElemType>::SaveCheckPointInfo(const size_t epoch, const size_t totalSam
     }
 }
 
+// SaveCheckPointAsync - save the model and checkpoint of an epoch like net->Save() and SaveCheckPointInfo(), on a background thread
+// The parameters and smoothed gradients are first copied to CPU memory, so training only waits for these copies, and for the
+// previous checkpoint if that is not written yet. obsoleteFiles are deleted once the new checkpoint is complete.
+template <class ElemType>
+void SGD<ElemType>::SaveCheckPointAsync(ComputationNetworkPtr net, const size_t epoch, const size_t totalSamplesSeen,
+                                        const double learnRatePerSample,
+                                        const std::list<Matrix<ElemType>>& smoothedGradients,
+                                        const double prevCriterion,
+                                        const size_t minibatchSize,
+                                        const std::vector<wstring>& obsoleteFiles)
+{
+    WaitForCheckPoint(/*allRanks=*/false);
+
+    net->SnapshotParameters();
+    auto gradientsSnapshot = make_shared<std::list<Matrix<ElemType>>>();
+    for (const auto& smoothedGradient : smoothedGradients)
+    {
+        gradientsSnapshot->emplace_back(smoothedGradient.GetNumRows(), smoothedGradient.GetNumCols(), CPUDEVICE);
+        smoothedGradient.CopySection(smoothedGradient.GetNumRows(), smoothedGradient.GetNumCols(), gradientsSnapshot->back().BufferPointer(), smoothedGradient.GetNumRows());
+    }
+
+    m_pendingCheckPoint = std::async(std::launch::async, [=]()
+                                     {
+                                         TimelineThread thread("checkpoint");
+                                         TimelineScope scope("SaveCheckPoint", "checkpoint");
+                                         try
+                                         {
+                                             net->Save(GetModelNameForEpoch(int(epoch)));
+                                             SaveCheckPointInfo(epoch, totalSamplesSeen, learnRatePerSample, *gradientsSnapshot, prevCriterion, minibatchSize);
+                                         }
+                                         catch (...)
+                                         {
+                                             net->ReleaseParameterSnapshot();
+                                             throw; // (rethrown by WaitForCheckPoint())
+                                         }
+                                         net->ReleaseParameterSnapshot();
+                                         for (const auto& file : obsoleteFiles)
+                                             _wunlink(file.c_str());
+                                     });
+}
+
+// StartCrossValidationAsync - cross-validate the current parameters on m_crossValidationDeviceId, on a background thread
+// The parameters are copied to CPU memory here, so that training can go on to modify them, and from there to the copy of
+// the model that the background thread evaluates. The validation reader is only used by that thread until it is done.
+// The result goes to the log and to m_lastCrossValidationScores when the next call of WaitForCrossValidation() collects it.
+// send the values of all LearnableParameters of the main node to the other ranks
+template <class ElemType>
+void SGD<ElemType>::BroadcastInitialModel(ComputationNetworkPtr net)
+{
+    if (!g_mpi || g_mpi->NumNodesInUse() <= 1)
+        return;
+
+    TimelineScope scope("BroadcastInitialModel", "mpi");
+    size_t numElements = 0;
+    for (const auto& nodeBase : net->GetNodesWithType(OperationNameOf(LearnableParameter)))
+    {
+        auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase)->Value();
+        BroadcastMatrix(value);
+        numElements += value.GetNumElements();
+    }
+    if (g_mpi->IsMainNode())
+        fprintf(stderr, "Broadcast the %d initial parameter values to %d ranks.\n", (int) numElements, (int) g_mpi->NumNodesInUse());
+}
+
+// send a dense matrix of the main node to the other ranks, which have one of the same dimensions
+template <class ElemType>
+/*static*/ void SGD<ElemType>::BroadcastMatrix(Matrix<ElemType>& value)
+{
+    if (value.GetNumElements() == 0)
+        return;
+    const size_t maxChunkElements = 1 << 28; // (MPI counts are 'int')
+    // GPU values go through a CPU buffer; CPU values are sent in place
+    const bool onCPU = value.GetDeviceId() < 0 && value.GetMatrixType() == DENSE;
+    Matrix<ElemType> buffer(CPUDEVICE);
+    if (!onCPU)
+    {
+        buffer.Resize(value.GetNumRows(), value.GetNumCols());
+        if (g_mpi->IsMainNode())
+            value.CopySection(value.GetNumRows(), value.GetNumCols(), buffer.BufferPointer(), value.GetNumRows());
+    }
+    ElemType* data = onCPU ? value.BufferPointer() : buffer.BufferPointer();
+    for (size_t begin = 0; begin < value.GetNumElements(); begin += maxChunkElements)
+        g_mpi->Bcast(data + begin, min(maxChunkElements, value.GetNumElements() - begin), g_mpi->MainNodeRank());
+    if (!onCPU && !g_mpi->IsMainNode())
+        value.SetValue(value.GetNumRows(), value.GetNumCols(), value.GetDeviceId(), buffer.BufferPointer());
+}
+
+template <class ElemType>
+void SGD<ElemType>::StartCrossValidationAsync(ComputationNetworkPtr net, IDataReader<ElemType>* validationSetDataReader,
+                                              const vector<wstring>& cvNodeNames, const int epoch, const size_t mbSize)
+{
+    WaitForCrossValidation(); // (one at a time; the previous one normally finished during the epoch)
+
+    // the copy of the model, created once; all further epochs only copy the values of the LearnableParameters
+    if (!m_cvNet)
+    {
+        if (m_crossValidationDeviceId >= 0)
+            AllowAdditionalGPU(m_crossValidationDeviceId); // (networks are otherwise held to the first GPU chosen)
+        wstring cvModelFileName = m_modelPath + L".cv";
+        net->Save(cvModelFileName);
+        m_cvNet = ComputationNetwork::CreateFromFile<ElemType>(m_crossValidationDeviceId, cvModelFileName);
+        _wunlink(cvModelFileName.c_str());
+        fprintf(stderr, "Cross-validating asynchronously on %s.\n", m_crossValidationDeviceId >= 0 ? msra::strfun::strprintf("GPU %d", (int) m_crossValidationDeviceId).c_str() : "the CPU");
+    }
+
+    typedef std::pair<ComputationNodePtr, shared_ptr<Matrix<ElemType>>> ParameterSnapshot; // [node of m_cvNet, value on the CPU]
+    auto snapshot = make_shared<std::vector<ParameterSnapshot>>();
+    for (const auto& nodeBase : net->GetNodesWithType(OperationNameOf(LearnableParameter)))
+    {
+        const auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(nodeBase)->Value();
+        auto copy = make_shared<Matrix<ElemType>>(value.GetNumRows(), value.GetNumCols(), CPUDEVICE);
+        value.CopySection(value.GetNumRows(), value.GetNumCols(), copy->BufferPointer(), value.GetNumRows());
+        snapshot->emplace_back(dynamic_pointer_cast<ComputationNode<ElemType>>(m_cvNet->GetNodeFromName(nodeBase->NodeName())), copy);
+    }
+
+    const ComputationNetworkPtr cvNet = m_cvNet;
+    const DEVICEID_TYPE deviceId = m_crossValidationDeviceId;
+    const int maxEpochs = (int) m_maxEpochs;
+    m_pendingCrossValidation = std::async(std::launch::async, [=]()
+                                          {
+                                              TimelineThread thread("crossvalidation");
+                                              TimelineScope scope("CrossValidation", "crossvalidation");
+                                              for (const auto& parameter : *snapshot)
+                                                  parameter.first->Value().SetValue(parameter.second->GetNumRows(), parameter.second->GetNumCols(), deviceId, parameter.second->BufferPointer());
+                                              SimpleEvaluator<ElemType> evalforvalidation(cvNet, 100, 0);
+                                              vector<double> vScore = evalforvalidation.Evaluate(validationSetDataReader, cvNodeNames, mbSize);
+                                              fprintf(stderr, "Finished Epoch[%2d of %d]: [Validation Set] TrainLossPerSample = %.8g", epoch + 1, maxEpochs, vScore[0]);
+                                              if (vScore.size() > 1)
+                                                  fprintf(stderr, "; EvalErrPerSample = %.8g", vScore[1]);
+                                              fprintf(stderr, " (cross-validated asynchronously)\n");
+                                              return vScore;
+                                          });
+}
+
+// WaitForCrossValidation - block until the cross-validation started by StartCrossValidationAsync(), if any, is complete, and keep its result
+template <class ElemType>
+void SGD<ElemType>::WaitForCrossValidation()
+{
+    if (m_pendingCrossValidation.valid())
+        m_lastCrossValidationScores = m_pendingCrossValidation.get(); // (rethrows an exception of the background thread)
+}
+
+// GetPerRankFileName - path.rankN.extension in parallel training, else path; for files that every rank writes on its own
+template <class ElemType>
+wstring SGD<ElemType>::GetPerRankFileName(const wstring& path, const wchar_t* extension) const
+{
+    if (g_mpi == nullptr)
+        return path;
+    return msra::strfun::wstrprintf(L"%ls.rank%d.%ls", path.c_str(), (int) g_mpi->CurrentNodeRank(), extension);
+}
+
+// SaveTimelineTrace - write the timeline of this rank so far, if enabled, to timelineTraceFile.rankN.json
+// Each rank writes its own file (ranks do not share a clock); load them together in chrome://tracing or Perfetto.
+template <class ElemType>
+void SGD<ElemType>::SaveTimelineTrace() const
+{
+    if (m_timelineTraceFile.empty())
+        return;
+    TimelineTrace::Save(GetPerRankFileName(m_timelineTraceFile, L"json"), g_mpi ? (int) g_mpi->CurrentNodeRank() : 0);
+}
+
+// WriteMetricsRecord - append one line of JSON to the stream of metricsFile, and flush it, so that it can be followed live
+// Each rank writes its own file (metricsFile.rankN.jsonl), so that stragglers can be told apart.
+template <class ElemType>
+void SGD<ElemType>::WriteMetricsRecord(FILE* f, const ThroughputMetrics& metrics) const
+{
+    fprintf(f, "{\"rank\":%d,\"epoch\":%d,\"firstMB\":%d,\"numMBs\":%d,\"samples\":%d,\"seconds\":%.6f,\"samplesPerSecond\":%.3f,"
+               "\"trainLossPerSample\":%.8g,\"readerSeconds\":%.6f,\"computeSeconds\":%.6f,\"communicationSeconds\":%.6f,"
+               "\"gpuPeakBytes\":%llu,\"gradientBytesSent\":%llu,\"gpuUsedBytes\":%llu,\"gpuUsedPeakBytes\":%llu,\"gpuCachedBytes\":%llu,"
+               "\"gpuSMUtilization\":%d,\"pcieTxKBPerSecond\":%d,\"pcieRxKBPerSecond\":%d}\n",
+            g_mpi ? (int) g_mpi->CurrentNodeRank() : 0, metrics.epoch + 1, (int) metrics.firstMB + 1, (int) metrics.numMBs, (int) metrics.numSamples,
+            metrics.seconds, metrics.seconds > 0 ? metrics.numSamples / metrics.seconds : 0.0,
+            metrics.trainLossPerSample, metrics.readerSeconds, metrics.computeSeconds, metrics.communicationSeconds,
+            (unsigned long long) metrics.gpuPeakBytes, (unsigned long long) metrics.gradientBytesSent,
+            (unsigned long long) metrics.gpu.UsedBytes(), (unsigned long long) metrics.gpu.m_peakUsedBytes, (unsigned long long) metrics.gpu.m_cache.m_cachedBytes,
+            metrics.gpu.m_smUtilization, metrics.gpu.m_pcieTxKBPerSecond, metrics.gpu.m_pcieRxKBPerSecond);
+    fflush(f);
+}
+
+// WaitForCheckPoint - block until the checkpoint being written by SaveCheckPointAsync(), if any, is complete
+// allRanks - all ranks call this, and must not go on to read the files before the main node has finished them
+template <class ElemType>
+void SGD<ElemType>::WaitForCheckPoint(bool allRanks)
+{
+    if (m_pendingCheckPoint.valid())
+        m_pendingCheckPoint.get();
+    if (allRanks && m_asyncCheckPoint && g_mpi != nullptr)
+        g_mpi->WaitAll();
+}
+
+// SaveMidEpochCheckPoint - save the state of an epoch in progress, from which a restart in make mode continues the epoch
+// Called by all ranks. The main node saves the model and GetMidEpochCheckPointFileName() with what the ranks share,
+// and each rank saves its own position in the data. The checkpoint file is written last, as it validates the others.
+template <class ElemType>
+void SGD<ElemType>::SaveMidEpochCheckPoint(ComputationNetworkPtr net, const MidEpochCheckPoint& checkPoint,
+                                           const std::list<Matrix<ElemType>>& smoothedGradients)
+{
+    WaitForCheckPoint(/*allRanks=*/false); // (the previous epoch's)
+
+    const bool isMainNode = (g_mpi == nullptr) || g_mpi->IsMainNode();
+    const size_t numRanks = (g_mpi == nullptr) ? 1 : g_mpi->NumNodesInUse();
+    const wstring checkPointFileName = GetMidEpochCheckPointFileName(checkPoint.epoch);
+    if (isMainNode)
+    {
+        if (fexists(checkPointFileName)) // (it would not match the files written below)
+            unlinkOrDie(checkPointFileName);
+        net->Save(GetMidEpochModelName(checkPoint.epoch));
+    }
+
+    const wstring rankFileName = GetMidEpochRankFileName(checkPoint.epoch, (g_mpi == nullptr) ? 0 : g_mpi->CurrentNodeRank());
+    {
+        File fstream(rankFileName + L".tmp", FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite);
+        fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BRankState");
+        fstream << checkPoint.numMBsRun << checkPoint.numMBsRead << checkPoint.totalEpochSamples;
+        fstream << checkPoint.epochCriterion << checkPoint.epochEvalErrors;
+        fstream << checkPoint.hasReaderState << checkPoint.readerState.size();
+        for (const auto& entry : checkPoint.readerState)
+            fstream << entry.first << entry.second;
+        fstream.PutMarker(FileMarker::fileMarkerEndSection, L"ERankState");
+        fstream.Flush();
+    }
+    renameOrDie(rankFileName + L".tmp", rankFileName);
+
+    if (g_mpi != nullptr)
+        g_mpi->WaitAll(); // all files are complete
+
+    if (isMainNode)
+    {
+        {
+            File fstream(checkPointFileName + L".tmp", FileOptions::fileOptionsBinary | FileOptions::fileOptionsWrite | FileOptions::fileOptionsSequential | (m_saveHalfPrecisionCheckPoint ? FileOptions::fileOptionsHalfPrecision : 0));
+            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BMidEpochCKP");
+            fstream << numRanks << checkPoint.numMBsRun << checkPoint.totalSamplesSeen << checkPoint.learnRatePerSample << checkPoint.minibatchSize;
+            fstream.PutMarker(FileMarker::fileMarkerBeginSection, L"BGradient");
+            for (const auto& smoothedGradient : smoothedGradients)
+                fstream << smoothedGradient;
+            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EGradient");
+            fstream.PutMarker(FileMarker::fileMarkerEndSection, L"EMidEpochCKP");
+            fstream.Flush();
+        }
+        renameOrDie(checkPointFileName + L".tmp", checkPointFileName);
+        fprintf(stderr, "Saved mid-epoch checkpoint after minibatch %d of epoch %d.\n", (int) checkPoint.numMBsRun, checkPoint.epoch + 1);
+    }
+}
+
+// LoadMidEpochCheckPoint - restore the model, smoothed gradients, and m_midEpochResume from the files SaveMidEpochCheckPoint() wrote
+// Returns false, leaving the model as it was, if they are incomplete or were written by a different number of ranks.
+template <class ElemType>
+bool SGD<ElemType>::LoadMidEpochCheckPoint(ComputationNetworkPtr net, const int epoch,
+                                           std::list<Matrix<ElemType>>& smoothedGradients)
+{
+    MidEpochCheckPoint& checkPoint = m_midEpochResume;
+    const size_t numRanks = (g_mpi == nullptr) ? 1 : g_mpi->NumNodesInUse();
+    const wstring rankFileName = GetMidEpochRankFileName(epoch, (g_mpi == nullptr) ? 0 : g_mpi->CurrentNodeRank());
+
+    File fstream(GetMidEpochCheckPointFileName(epoch), FileOptions::fileOptionsBinary | FileOptions::fileOptionsRead);
+    fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BMidEpochCKP");
+    size_t savedNumRanks;
+    fstream >> savedNumRanks >> checkPoint.numMBsRun >> checkPoint.totalSamplesSeen >> checkPoint.learnRatePerSample >> checkPoint.minibatchSize;
+    if (savedNumRanks != numRanks || !fexists(rankFileName))
+    {
+        fprintf(stderr, "Warning: The mid-epoch checkpoint of epoch %d is from training on %d ranks, or incomplete. The epoch starts over.\n", epoch + 1, (int) savedNumRanks);
+        return false;
+    }
+
+    {
+        File rankStream(rankFileName, FileOptions::fileOptionsBinary | FileOptions::fileOptionsRead);
+        rankStream.GetMarker(FileMarker::fileMarkerBeginSection, L"BRankState");
+        size_t numMBsRun, numEntries;
+        rankStream >> numMBsRun >> checkPoint.numMBsRead >> checkPoint.totalEpochSamples;
+        rankStream >> checkPoint.epochCriterion >> checkPoint.epochEvalErrors;
+        rankStream >> checkPoint.hasReaderState >> numEntries;
+        checkPoint.readerState.clear();
+        for (size_t i = 0; i < numEntries; i++)
+        {
+            wstring key;
+            rankStream >> key;
+            rankStream >> checkPoint.readerState[key];
+        }
+        rankStream.GetMarker(FileMarker::fileMarkerEndSection, L"ERankState");
+        if (numMBsRun != checkPoint.numMBsRun) // (interrupted between the two files)
+        {
+            fprintf(stderr, "Warning: The mid-epoch checkpoint of epoch %d is inconsistent. The epoch starts over.\n", epoch + 1);
+            return false;
+        }
+    }
+
+    fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BGradient");
+    for (auto& smoothedGradient : smoothedGradients)
+        LoadSmoothedGradient(fstream, smoothedGradient);
+    fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EGradient");
+    fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EMidEpochCKP");
+
+    net->RereadPersistableParameters<ElemType>(GetMidEpochModelName(epoch));
+    fprintf(stderr, "Loaded mid-epoch checkpoint after minibatch %d of epoch %d.\n", (int) checkPoint.numMBsRun, epoch + 1);
+    return true;
+}
+
+// read into a temporary and copy, rather than reading in place, which would detach views into m_flatSmoothedGradients
+template <class ElemType>
+/*static*/ void SGD<ElemType>::LoadSmoothedGradient(File& fstream, Matrix<ElemType>& smoothedGradient)
+{
+    Matrix<ElemType> loaded(smoothedGradient.GetDeviceId());
+    fstream >> loaded;
+    smoothedGradient.SetValue(loaded);
+}
+
 template <class ElemType>
 bool SGD<ElemType>::LoadCheckPointInfo(const size_t epochNumber,
                                        /*out*/ size_t& totalSamplesSeen,
@@ -2160,7 +3824,7 @@ bool SGD<ElemType>::LoadCheckPointInfo(const size_t epochNumber,
     }
 
     File fstream(checkPointFileName,
-                 FileOptions::fileOptionsBinary | FileOptions::fileOptionsRead);
+                 FileOptions::fileOptionsBinary | FileOptions::fileOptionsRead | FileOptions::fileOptionsSequential);
     fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BCKP");
 
     fstream.GetMarker(FileMarker::fileMarkerBeginSection, L"BLearnRate");
@@ -2182,7 +3846,7 @@ bool SGD<ElemType>::LoadCheckPointInfo(const size_t epochNumber,
     for (auto smoothedGradientIter = smoothedGradients.begin(); smoothedGradientIter != smoothedGradients.end(); smoothedGradientIter++)
     {
         Matrix<ElemType>& smoothedGradient = *smoothedGradientIter;
-        fstream >> smoothedGradient;
+        LoadSmoothedGradient(fstream, smoothedGradient);
     }
     fstream.GetMarker(FileMarker::fileMarkerEndSection, L"EGradient");
 
@@ -2197,6 +3861,145 @@ wstring SGD<ElemType>::GetCheckPointFileNameForEpoch(const int epoch)
     return GetModelNameForEpoch(epoch) + L".ckp";
 }
 
+// mid-epoch checkpoints are named after the model the epoch produces
+template <class ElemType>
+wstring SGD<ElemType>::GetMidEpochModelName(const int epoch)
+{
+    return GetModelNameForEpoch(epoch) + L".partial";
+}
+
+template <class ElemType>
+wstring SGD<ElemType>::GetMidEpochCheckPointFileName(const int epoch)
+{
+    return GetMidEpochModelName(epoch) + L".ckp";
+}
+
+// -----------------------------------------------------------------------
+// elastic training (ParallelTrain/elastic=true)
+// When a worker is lost (which requires ULFM, see MPIWrapper), the others form a communicator without it, and the epoch starts
+// over from the model and checkpoint of the previous one; the distributed readers are split into as many subsets as there are
+// workers now. New workers (ParallelTrain/elasticJoin=true, each started as an MPI job of its own with the same config) join at
+// the start of an epoch. As the minibatch size and learning rate are those of all workers together, the share of each worker
+// changes, but the learning rate does not need to.
+// -----------------------------------------------------------------------
+
+template <class ElemType>
+wstring SGD<ElemType>::GetElasticPortFileName() const
+{
+    return m_elasticPortFile.empty() ? m_modelPath + L".elastic" : m_elasticPortFile;
+}
+
+// JoinElasticJob - join a running elastic job as a new worker; returns the epoch that the job starts next
+// The main node publishes its port in the port file. We leave a request file next to it, upon which the job accepts us
+// at the start of the next epoch (UpdateElasticMembership()).
+template <class ElemType>
+int SGD<ElemType>::JoinElasticJob()
+{
+    const wstring portFileName = GetElasticPortFileName();
+    while (!fexists(portFileName))
+    {
+        fprintf(stderr, "JoinElasticJob: Waiting for the job to publish %ls.\n", portFileName.c_str());
+        ::Sleep(10000);
+    }
+    auto lines = msra::files::fgetfilelines(portFileName);
+    if (lines.empty() || lines[0].empty())
+        RuntimeError("JoinElasticJob: No port name in %ls.", portFileName.c_str());
+
+    const wstring requestFileName = msra::strfun::wstrprintf(L"%ls.join.%d.%d", portFileName.c_str(), (int) GetCurrentProcessId(), (int) time(nullptr));
+    fcloseOrDie(fopenOrDie(requestFileName, L"wb"));
+    fprintf(stderr, "JoinElasticJob: Asked to join the job at port %s, waiting for the next epoch.\n", lines[0].c_str());
+
+    g_mpi->EnableElasticity();
+    g_mpi->JoinElasticJob(lines[0]);
+    int epoch = 0;
+    g_mpi->Bcast(&epoch, 1, g_mpi->MainNodeRank());
+    return epoch;
+}
+
+// UpdateElasticMembership - at the start of epoch 'epoch', let in the workers that asked to join, if any, and give all of them
+// the main node's model, smoothed gradients, and 'sharedState' (the training state of TrainOrAdaptModel()).
+// 'joined' is true in the epoch that this worker has joined in (JoinElasticJob()). Returns whether workers joined.
+template <class ElemType>
+bool SGD<ElemType>::UpdateElasticMembership(ComputationNetworkPtr net, int& epoch, const bool joined, const size_t numEvalNodes,
+                                            std::list<Matrix<ElemType>>& smoothedGradients, double* sharedState, const size_t numSharedState)
+{
+    if (!joined)
+    {
+        vector<wstring> requestFileNames;
+        if (g_mpi->IsMainNode())
+        {
+            // (re)publish the port, e.g. after taking over from a lost main node
+            const wstring portFileName = GetElasticPortFileName();
+            const string& portName = g_mpi->OpenElasticPort();
+            auto lines = fexists(portFileName) ? msra::files::fgetfilelines(portFileName) : vector<string>();
+            if (lines.empty() || lines[0] != portName)
+            {
+                FILE* f = fopenOrDie(portFileName + L".tmp", L"wb");
+                fprintfOrDie(f, "%s\n", portName.c_str());
+                fcloseOrDie(f);
+                renameOrDie(portFileName + L".tmp", portFileName);
+            }
+            expand_wildcards(portFileName + L".join.*", requestFileNames);
+            for (const auto& requestFileName : requestFileNames)
+                unlinkOrDie(requestFileName);
+        }
+        if (g_mpi->AcceptJoiningWorkers(requestFileNames.size()) == 0)
+            return false;
+        g_mpi->Bcast(&epoch, 1, g_mpi->MainNodeRank()); // (what they return from JoinElasticJob())
+    }
+
+    g_mpi->Bcast(sharedState, numSharedState, g_mpi->MainNodeRank());
+    BroadcastInitialModel(net);
+    for (auto& smoothedGradient : smoothedGradients)
+        BroadcastMatrix(smoothedGradient);
+
+    // the aggregator is for a given set of workers
+    delete m_distGradAgg;
+    m_distGradAgg = nullptr;
+    InitDistGradAgg((int) numEvalNodes, m_traceLevel);
+    if (g_mpi->IsMainNode())
+        fprintf(stderr, "Epoch %d starts with %d workers.\n", epoch + 1, (int) g_mpi->NumNodesInUse());
+    return true;
+}
+
+// RecoverFromLostWorkers - after MpiWorkerLost in epoch 'epoch', continue without the lost workers from the model and checkpoint that
+// the previous epoch ended with (which were complete before the epoch started); the epoch then starts over
+template <class ElemType>
+void SGD<ElemType>::RecoverFromLostWorkers(ComputationNetworkPtr net, const int epoch, const size_t numEvalNodes, const MpiWorkerLost& e,
+                                           /*out*/ size_t& totalSamplesSeen,
+                                           /*out*/ double& learnRatePerSample,
+                                           std::list<Matrix<ElemType>>& smoothedGradients,
+                                           /*out*/ double& prevCriterion)
+{
+    if (!m_elasticTraining)
+        throw e;
+    fprintf(stderr, "Lost a worker in epoch %d (%s).\n", epoch + 1, e.what());
+    g_mpi->ExcludeLostWorkers();
+
+    net->RereadPersistableParameters<ElemType>(GetModelNameForEpoch(epoch - 1));
+    if (epoch == 0)
+    {
+        for (auto& smoothedGradient : smoothedGradients)
+            smoothedGradient.SetValue(0);
+        totalSamplesSeen = 0;
+    }
+    else if (!LoadCheckPointInfo(epoch - 1, totalSamplesSeen, learnRatePerSample, smoothedGradients, prevCriterion, m_prevChosenMinibatchSize))
+        RuntimeError("RecoverFromLostWorkers: Cannot continue without the checkpoint of epoch %d.", epoch);
+    m_midEpochResume.epoch = -1; // (its ranks are gone)
+
+    delete m_distGradAgg;
+    m_distGradAgg = nullptr;
+    InitDistGradAgg((int) numEvalNodes, m_traceLevel);
+    if (g_mpi->IsMainNode())
+        fprintf(stderr, "Epoch %d starts over with %d workers.\n", epoch + 1, (int) g_mpi->NumNodesInUse());
+}
+
+template <class ElemType>
+wstring SGD<ElemType>::GetMidEpochRankFileName(const int epoch, const size_t rank)
+{
+    return msra::strfun::wstrprintf(L"%ls.rank%d", GetMidEpochModelName(epoch).c_str(), (int) rank);
+}
+
 template <class ElemType>
 wstring SGD<ElemType>::GetModelNameForEpoch(const int epoch, bool bLastModel)
 {
@@ -2242,6 +4045,12 @@ int SGD<ElemType>::DetermineStartEpoch(const bool makeMode)
     if (firstEpoch == m_maxEpochs)
         fprintf(stderr, "Final model exists: %ls\n", GetModelNameForEpoch(firstEpoch - 1).c_str());
 
+    // an interrupted epoch resumes from its mid-epoch checkpoint, unless that is older than the model the epoch starts from
+    // (which is loaded by TrainOrAdaptModel())
+    if (firstEpoch >= 0 && firstEpoch < (int) m_maxEpochs &&
+        msra::files::fuptodate(GetMidEpochCheckPointFileName(firstEpoch), GetModelNameForEpoch(firstEpoch - 1), false))
+        m_midEpochResume.epoch = firstEpoch;
+
     return firstEpoch;
 }
 
@@ -2369,8 +4178,14 @@ static GradientsUpdateType ParseGradUpdateType(const wstring& s)
         return GradientsUpdateType::RmsProp;
     else if (!_wcsicmp(s.c_str(), L"fsAdagrad"))
         return GradientsUpdateType::FSAdaGrad;
+    else if (!_wcsicmp(s.c_str(), L"adam"))
+        return GradientsUpdateType::Adam;
+    else if (!_wcsicmp(s.c_str(), L"lamb"))
+        return GradientsUpdateType::Lamb;
+    else if (!_wcsicmp(s.c_str(), L"lars"))
+        return GradientsUpdateType::Lars;
     else
-        InvalidArgument("ParseGradUpdateType: Invalid Gradient Updating Type. Valid values are (none | adagrad | rmsProp | fsAdagrad )");
+        InvalidArgument("ParseGradUpdateType: Invalid Gradient Updating Type. Valid values are (none | adagrad | rmsProp | fsAdagrad | adam | lamb | lars )");
 }
 
 static ParallelizationMethod ParseParallelizationMethod(const wstring& s)
@@ -2385,6 +4200,20 @@ static ParallelizationMethod ParseParallelizationMethod(const wstring& s)
         InvalidArgument("ParseParallelizationMethod: Invalid Parallelization Method. Valid values are (none | dataParallelSGD | modelAveragingSGD)");
 }
 
+static AllReduceAlgorithm ParseAllReduceAlgorithm(const wstring& s)
+{
+    if (!_wcsicmp(s.c_str(), L"") || !_wcsicmp(s.c_str(), L"mpi"))
+        return AllReduceAlgorithm::Mpi;
+    else if (!_wcsicmp(s.c_str(), L"ring"))
+        return AllReduceAlgorithm::Ring;
+    else if (!_wcsicmp(s.c_str(), L"recursiveHalving"))
+        return AllReduceAlgorithm::RecursiveHalving;
+    else if (!_wcsicmp(s.c_str(), L"auto"))
+        return AllReduceAlgorithm::Auto;
+    else
+        InvalidArgument("ParseAllReduceAlgorithm: Invalid all-reduce algorithm. Valid values are (mpi | ring | recursiveHalving | auto)");
+}
+
 static LearningRateSearchAlgorithm ParseLearningRateSearchType(const wstring& s)
 {
     // TODO: why allow so many variants?
@@ -2423,6 +4252,8 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_minibatchSizeTuningFrequency = configAALR(L"minibatchSizeTuningFrequency", (size_t) 1);
     m_minibatchSizeTuningMax = configAALR(L"minibatchSizeTuningMax", (size_t) 1048576);
     m_minibatchSearchCriterionErrorMargin = configAALR(L"minibatchSearchCriterionErrorMargin", (size_t) 1);
+    m_minibatchSearchByThroughput = configAALR(L"minibatchSearchByThroughput", false);
+    m_minibatchSearchMinFreeMemoryMB = configAALR(L"minibatchSearchMinFreeMemoryMB", (size_t) 0);
 
     // the number of minibatches used to search
     // the learning rate. Its typically set to 10-20% of
@@ -2431,6 +4262,7 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
 
     m_numPrevLearnRates = configAALR(L"numPrevLearnRates", (size_t) 5);
     m_numBestSearchEpoch = configAALR(L"numBestSearchEpoch", (size_t) 1);
+    m_parallelLearnRateSearch = configAALR(L"parallelLearnRateSearch", false);
     m_loadBestModel = configAALR(L"loadBestModel", true);
     m_useCVSetControlLRIfCVExists = configAALR(L"UseCVSetControlLRIfCVExists", true);
     m_useEvalCriterionControlLR = configAALR(L"UseEvalCriterionControlLR", false);
@@ -2442,6 +4274,21 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_truncated = configSGD(L"truncated", false);
     m_maxSamplesInRAM = configSGD(L"maxSamplesInRAM", (size_t) SIZE_MAX);
     m_numSubminiBatches = configSGD(L"numSubminibatches", (size_t) 1);
+    m_numMBsToAccumulate = configSGD(L"numMBsToAccumulate", (size_t) 1);
+    if (m_numMBsToAccumulate == 0)
+        InvalidArgument("numMBsToAccumulate must be at least 1.");
+    m_replicaDeviceIds = configSGD(L"replicaDeviceIds", ConfigRecordType::Array(intargvector(vector<int>{})));
+    if (!m_replicaDeviceIds.empty() && (m_maxSamplesInRAM < SIZE_MAX || m_numSubminiBatches > 1))
+        InvalidArgument("replicaDeviceIds cannot be combined with maxSamplesInRAM or numSubminibatches.");
+    m_modelParallelDeviceIds = configSGD(L"modelParallelDeviceIds", ConfigRecordType::Array(intargvector(vector<int>{})));
+    m_modelParallelPartitionStarts = configSGD(L"modelParallelPartitionStarts", ConfigRecordType::Array(stringargvector()));
+    if (!m_modelParallelPartitionStarts.empty() && m_modelParallelPartitionStarts.size() != m_modelParallelDeviceIds.size())
+        InvalidArgument("modelParallelPartitionStarts must name one node for each of the modelParallelDeviceIds.");
+    m_hostOffloadParameters = configSGD(L"hostOffloadParameters", ConfigRecordType::Array(stringargvector()));
+    m_hogwildThreads = configSGD(L"hogwildThreads", (size_t) 0);
+    m_hogwildAtomicUpdates = configSGD(L"hogwildAtomicUpdates", false);
+    if (m_hogwildThreads > 0 && (m_maxSamplesInRAM < SIZE_MAX || m_numSubminiBatches > 1 || m_numMBsToAccumulate > 1 || !m_replicaDeviceIds.empty() || !m_modelParallelDeviceIds.empty()))
+        InvalidArgument("hogwildThreads cannot be combined with maxSamplesInRAM, numSubminibatches, numMBsToAccumulate, replicaDeviceIds, or modelParallelDeviceIds.");
 
     // the number of samples in each epoch (0 means, use all the samples in each epoch).
     m_epochSize = configSGD(L"epochSize", (size_t) 0);
@@ -2464,12 +4311,14 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     bool useNesterovMomentum = configSGD(L"useNAG", false);
 
     m_maxTempMemSizeInSamplesForCNN = configSGD(L"maxTempMemSizeInSamplesForCNN", (size_t) 0);
+    m_flatParameterBuffers = configSGD(L"flatParameterBuffers", false);
 
     m_traceLevel = configSGD(L"traceLevel", (int) 0);
     m_numMBsToShowResult = configSGD(L"numMBsToShowResult", (size_t) 10);
     m_numMBsToCUDAProfile = configSGD(L"numMBsToCUDAProfile", (size_t) 0);
 
     m_gradientClippingWithTruncation = configSGD(L"gradientClippingWithTruncation", true);
+    m_gradientClippingByGlobalNorm = configSGD(L"gradientClippingByGlobalNorm", false);
     m_clippingThresholdPerSample = configSGD(L"clippingThresholdPerSample", numeric_limits<double>::infinity());
 
     // sequence-training parameters
@@ -2496,6 +4345,12 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_rpi.max = configSGD(L"rms_wgt_max", 10.0);
     m_rpi.gamma = configSGD(L"rms_gamma", 0.99);
 
+    // Adam, LAMB and LARS parameters
+    m_adam.beta2 = configSGD(L"adam_beta2", 0.999);
+    m_adam.epsilon = configSGD(L"adam_epsilon", 1e-8);
+    m_adam.weightDecay = configSGD(L"adam_weightDecay", 0.0);
+    m_adam.trustCoefficient = configSGD(L"lars_trustCoefficient", 0.001);
+
     m_needAveMultiplier = configSGD(L"normWithAveMultiplier", true);
     m_L2RegWeight = configSGD(L"L2RegWeight", 0.0);
     m_L1RegWeight = configSGD(L"L1RegWeight", 0.0);
@@ -2522,6 +4377,10 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     }
 
     m_useAllDataForPreComputedNode = configSGD(L"UseAllDataForPreComputedNode", true);
+    m_preComputeSampleFraction = configSGD(L"preComputeSampleFraction", 1.0);
+    if (m_preComputeSampleFraction <= 0 || m_preComputeSampleFraction > 1)
+        InvalidArgument("preComputeSampleFraction must be greater than 0 and at most 1.");
+    m_preComputeCache = (const wstring&) configSGD(L"preComputeCache", L"");
 
     // consistency checks
     for (size_t i = 0; i < m_mbSize.size(); i++)
@@ -2624,9 +4483,26 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
     m_numGradientBits = 32;
     m_zeroThresholdFor1Bit = true;
     m_bufferedAsyncGradientAggregation = false;
+    m_gradientBucketSizeInKB = 0;
+    m_packGradientsBelowKB = 0;
+    m_allReduceAlgorithm = AllReduceAlgorithm::Mpi;
+    m_useNcclGradientAggregation = false;
+    m_topKGradientFraction = 0;
+    m_shardedParameters.clear();
     m_enableDistributedMBReading = false;
+    m_distributedCrossValidation = false;
+    m_distributedPreCompute = false;
+    m_useCudaAwareMpi = false;
+    m_elasticTraining = false;
+    m_elasticJoin = false;
     m_parallelizationStartEpochNum = 0;
     m_nFramesBetweenMASync = 40000; // default 40k frames
+    m_useAsyncModelAveraging = false;
+    m_modelAveragingElasticity = 1;
+    m_blockMomentum = 0;
+    m_blockLearningRate = 1;
+    m_useNcclModelAveraging = false;
+    m_modelAveragingDeltaBits = 0;
 
     if ((g_mpi != nullptr) && configSGD.Exists(L"ParallelTrain"))
     {
@@ -2634,7 +4510,18 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
         m_parallelizationMethod = ParseParallelizationMethod(configParallelTrain(L"parallelizationMethod", L"none"));
         m_parallelizationStartEpochNum = configParallelTrain(L"parallelizationStartEpoch", (int) 1) - 1; // Epoch numbers internally are 0 based
         m_enableDistributedMBReading = configParallelTrain(L"distributedMBReading", false);
+        m_distributedCrossValidation = configParallelTrain(L"distributedCrossValidation", true);
+        m_distributedPreCompute = configParallelTrain(L"distributedPreCompute", true);
         m_syncStatsTrace = configParallelTrain(L"syncPerfStats", (int) 0);
+        m_useCudaAwareMpi = configParallelTrain(L"useCudaAwareMpi", false);
+        if (m_useCudaAwareMpi && !g_mpi->IsCudaAware())
+        {
+            fprintf(stderr, "WARNING: useCudaAwareMpi=true, but MPI is not CUDA-aware (set CNTK_CUDA_AWARE_MPI=1 if it is); GPU buffers will be copied through the host.\n");
+            m_useCudaAwareMpi = false;
+        }
+        m_elasticJoin = configParallelTrain(L"elasticJoin", false);
+        m_elasticTraining = configParallelTrain(L"elastic", false) || m_elasticJoin;
+        m_elasticPortFile = (const wstring&) configParallelTrain(L"elasticPortFile", L"");
 
         if (configParallelTrain.Exists(L"DataParallelSGD"))
         {
@@ -2643,6 +4530,16 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
             m_numGradientBits = configDataParallelSGD(L"gradientBits", defaultGradientBits);
             m_zeroThresholdFor1Bit = configDataParallelSGD(L"useZeroThresholdFor1BitQuantization", true);
             m_bufferedAsyncGradientAggregation = configDataParallelSGD(L"useBufferedAsyncGradientAggregation", false);
+            m_gradientBucketSizeInKB = configDataParallelSGD(L"gradientBucketSizeInKB", (size_t) 0);
+            m_packGradientsBelowKB = configDataParallelSGD(L"packGradientsBelowKB", (size_t) 32);
+            m_allReduceAlgorithm = ParseAllReduceAlgorithm(configDataParallelSGD(L"allReduceAlgorithm", L"mpi"));
+            m_useNcclGradientAggregation = configDataParallelSGD(L"useNccl", false);
+            m_topKGradientFraction = configDataParallelSGD(L"topKGradientFraction", 0.0);
+            m_shardedParameters = configDataParallelSGD(L"shardedParameters", ConfigRecordType::Array(stringargvector()));
+            if ((m_topKGradientFraction < 0) || (m_topKGradientFraction > 1))
+            {
+                InvalidArgument("topKGradientFraction must be in the range [0, 1]!");
+            }
             if ((m_numGradientBits < 1) || (m_numGradientBits > (8 * sizeofElemType)))
             {
                 InvalidArgument("gradientBits must be in the range [1, 32] when using precision=float and in range [1, 64] when using precision=double!");
@@ -2653,6 +4550,14 @@ SGDParams::SGDParams(const ConfigRecordType& configSGD, size_t sizeofElemType)
         {
             const ConfigRecordType& configMASGD(configParallelTrain(L"ModelAveragingSGD", ConfigRecordType::Record()));
             m_nFramesBetweenMASync = configMASGD(L"syncFrequencyInFrames", (size_t) 40000);
+            m_useAsyncModelAveraging = configMASGD(L"useAsyncModelAveraging", false);
+            m_modelAveragingElasticity = configMASGD(L"elasticity", 1.0);
+            m_blockMomentum = configMASGD(L"blockMomentum", 0.0);
+            m_blockLearningRate = configMASGD(L"blockLearningRate", 1.0);
+            m_useNcclModelAveraging = configMASGD(L"useNccl", false);
+            m_modelAveragingDeltaBits = configMASGD(L"deltaBits", (size_t) 0);
+            if ((m_modelAveragingDeltaBits != 0) && (m_modelAveragingDeltaBits != 8) && (m_modelAveragingDeltaBits != 16))
+                InvalidArgument("deltaBits in ModelAveragingSGD must be 8 or 16 (or 0 to exchange the full models).");
         }
     }
 }
@@ -15,8 +15,10 @@
 #include "fileutil.h"
 #include "Config.h"
 #include <chrono>
+#include <future>
 #include <random>
 #include "Profiler.h"
+#include "GPUWatcher.h"
 
 using namespace std; // ugh! TODO: get rid of this from .h files!!!
 
@@ -40,7 +42,10 @@ enum class GradientsUpdateType : int
     None,
     AdaGrad,
     RmsProp,
-    FSAdaGrad
+    FSAdaGrad,
+    Adam,
+    Lamb, // Adam with a layer-wise trust ratio
+    Lars  // momentum SGD with a layer-wise trust ratio
 };
 
 // TODO: While currently combining these methods is not supported,
@@ -51,7 +56,7 @@ enum class ParallelizationMethod : int
     None = 0,
     DataParallelSGD = 1,
     ModelAveragingSGD = (1 << 1),
-    ModelParallelSGD = (1 << 2), // Currently unsupported
+    ModelParallelSGD = (1 << 2), // within one process only, by the SGD options modelParallelDeviceIds and modelParallelPartitionStarts
 };
 
 // configuration parameters associated with RMSProp learning algorithm
@@ -73,6 +78,23 @@ struct RMSPropInfo
     }
 };
 
+// configuration parameters associated with Adam, LAMB and LARS (beta1 is the momentum)
+struct AdamInfo
+{
+    double beta2;            // Adam, LAMB: momentum of the second moments
+    double epsilon;          // Adam, LAMB
+    double weightDecay;      // Adam, LAMB: decoupled, i.e. added to the normalized step (AdamW)
+    double trustCoefficient; // LARS
+
+    AdamInfo()
+    {
+        beta2 = 0.999;
+        epsilon = 1e-8;
+        weightDecay = 0.0;
+        trustCoefficient = 0.001;
+    }
+};
+
 struct GradientUpdateInfo
 {
     GradientsUpdateType mType;
@@ -159,6 +181,25 @@ protected:
     // default is 1, which means no subminibatch is used
     // if m_maxTempMemSizeInSamples = SIZE_MAX (which means users do not specify the option) and m_numSubminiBatches > 1
     // we divide one minibatch to m_numSubminiBatches subMinibatches
+    size_t m_numMBsToAccumulate;
+    // alternatively, the gradients of this many consecutive minibatches are summed up for a single model update
+    // Unlike sub-minibatches, this also works for a single long sequence, and each minibatch (incl. BPTT truncation) stays as read.
+    // The effective minibatch size is m_numMBsToAccumulate times m_mbSize; default is 1.
+    intargvector m_replicaDeviceIds;
+    // additional GPUs of this process, each of which trains a replica of the model on a shard of every minibatch,
+    // see DataReaderHelpers::DeviceReplicaDispatcher; the model itself stays on the 'deviceId' GPU. Combines with MPI.
+    intargvector m_modelParallelDeviceIds;
+    std::vector<std::wstring> m_modelParallelPartitionStarts;
+    // alternatively, the model is split into consecutive parts on the 'deviceId' GPU and these, see ComputationNetwork::PartitionAcrossDevices().
+    // Each part but the first starts with the node named in m_modelParallelPartitionStarts; by default the parts get equal numbers of parameters.
+    // The parts run one after the other; with numSubminibatches, they overlap only as far as the asynchronous launches let them.
+    std::vector<std::wstring> m_hostOffloadParameters;
+    // LearnableParameters (names, with '*' wildcards) whose values and smoothed gradients are kept in host memory mapped into the GPU,
+    // see Matrix::PlaceInHostMemory(); for parameter tables that do not fit into the GPU next to the rest of the model
+    size_t m_hogwildThreads;
+    bool m_hogwildAtomicUpdates;
+    // > 0: on the CPU, train on this many threads, each on its own minibatches, with lock-free updates of the shared parameters
+    // (plain SGD, atomically per element if m_hogwildAtomicUpdates); see DataReaderHelpers::HogwildDispatcher
 
     // the number of samples in each epoch (0 means, use all the samples in each epoch).
     size_t m_epochSize;
@@ -168,10 +209,12 @@ protected:
     size_t m_maxEpochs;
 
     bool m_gradientClippingWithTruncation;
+    bool m_gradientClippingByGlobalNorm; // (without truncation) clip the norm of all gradients together rather than that of each
     double m_clippingThresholdPerSample;
 
     intargvector m_numMiniBatch4LRSearch;
     size_t m_numBestSearchEpoch;
+    bool m_parallelLearnRateSearch; // in parallel training, let each rank try another learning rate at the same time, see SearchForBestLearnRate()
 
     LearningRateSearchAlgorithm m_autoLearnRateSearchType;
 
@@ -196,9 +239,12 @@ protected:
     size_t m_minibatchSearchCriterionErrorMargin;
     size_t m_minibatchSizeTuningFrequency;
     size_t m_minibatchSizeTuningMax;
+    bool m_minibatchSearchByThroughput;       // among the sizes within the criterion margin, choose the one with the most samples/sec rather than the largest
+    size_t m_minibatchSearchMinFreeMemoryMB; // if > 0, a trial size that leaves less GPU memory free ends the search
 
     floatargvector m_dropoutRates;
     size_t m_maxTempMemSizeInSamplesForCNN;
+    bool m_flatParameterBuffers; // keep all dense parameters, gradients and smoothed gradients in one buffer each, see ComputationNetwork::AllocateFlatParameterBuffers()
 
     int m_traceLevel;
 
@@ -208,6 +254,7 @@ protected:
 
     GradientUpdateInfo m_gradType;
     RMSPropInfo m_rpi;
+    AdamInfo m_adam;
 
     int m_numMBsToShowResult;
     int m_numMBsToCUDAProfile;
@@ -218,10 +265,18 @@ protected:
     bool m_doUnitTest;
 
     bool m_useAllDataForPreComputedNode;
+    double m_preComputeSampleFraction; // estimate the precomputed statistics from this fraction of the data
+    wstring m_preComputeCache;         // if not empty, file to reuse the precomputed statistics from, or to store them in, see PreComputeCache.h
 
     // Parallel training
     ParallelizationMethod m_parallelizationMethod;
     bool m_enableDistributedMBReading;
+    bool m_distributedCrossValidation; // cross-validate on all ranks, each on a share of the CV set
+    bool m_distributedPreCompute;      // precompute on all ranks, each on a share of the data
+    bool m_useCudaAwareMpi;            // pass GPU memory to MPI directly, if it is CUDA-aware (e.g. with GPUDirect RDMA), see MPIWrapper::IsCudaAware()
+    bool m_elasticTraining;            // workers may be lost and join while training, see UpdateElasticMembership()
+    bool m_elasticJoin;                // this process joins a running elastic job, see JoinElasticJob()
+    wstring m_elasticPortFile;         // where the main node publishes the port that workers join on (default: modelPath.elastic)
     int m_parallelizationStartEpochNum;
 
     // decide if/how often we measure and show sync performance stats (seconds spend on sync, seconds since last sync etc.) ?
@@ -233,10 +288,22 @@ protected:
     // Data parallel SGD training parameters
     int m_numGradientBits;
     bool m_bufferedAsyncGradientAggregation;
+    size_t m_gradientBucketSizeInKB; // > 0: aggregate gradients in buckets of this size, overlapping with backprop
+    size_t m_packGradientsBelowKB;   // > 0 (without buckets): aggregate the gradients up to this size together with the header, in one message
+    AllReduceAlgorithm m_allReduceAlgorithm;
+    bool m_useNcclGradientAggregation; // hierarchical aggregation with NCCL within machines and MPI among them
+    double m_topKGradientFraction;     // > 0: exchange only this fraction of the largest gradient values, carrying over the rest
     bool m_zeroThresholdFor1Bit;
+    std::vector<std::wstring> m_shardedParameters; // embeddings to split across the workers instead of aggregating them, see ParameterShards
 
     // Parallel training related with MA
     size_t m_nFramesBetweenMASync;
+    bool m_useAsyncModelAveraging;     // overlap the averaging with training; see ModelAverager
+    double m_modelAveragingElasticity; // < 1: move the models only part of the way towards the average
+    double m_blockMomentum;            // > 0: block momentum on the averaged model updates
+    double m_blockLearningRate;
+    bool m_useNcclModelAveraging; // plain synchronous averaging: sum up the models with NCCL within machines and MPI among them
+    size_t m_modelAveragingDeltaBits; // > 0: plain synchronous averaging exchanges the models' changes since the last sync, quantized to this many bits
 
     bool m_needAveMultiplier;
     double m_L2RegWeight;
@@ -256,6 +323,15 @@ protected:
 template <class ElemType>
 class IDistGradAggregator;
 
+template <class ElemType>
+class ModelAverager;
+
+template <class ElemType>
+class NcclHierarchicalAllReduce;
+
+template <class ElemType>
+class ParameterShards;
+
 // -----------------------------------------------------------------------
 // class SGD
 // -----------------------------------------------------------------------
@@ -277,15 +353,38 @@ public:
           // TODO: The next few do not belong into SGD any more than the network or reader we operate on. Either move network and reader in here, or move these out.
           m_modelPath((const wstring&) configSGD(L"modelPath")),
           m_keepCheckPointFiles(configSGD(L"keepCheckPointFiles", false)),
+          m_asyncCheckPoint(configSGD(L"asyncCheckPoint", false)),
+          m_asyncCrossValidation(configSGD(L"asyncCrossValidation", false)),
+          m_crossValidationDeviceId((DEVICEID_TYPE) configSGD(L"crossValidationDeviceId", (int) CPUDEVICE)),
+          m_lateCVLearnRateDecision(configSGD(L"lateCVLearnRateDecision", false)),
+          m_saveHalfPrecisionModel(configSGD(L"saveHalfPrecisionModel", false)),
+          m_saveMappableModel(configSGD(L"saveMappableModel", false)),
+          m_saveQuantizedModel(configSGD(L"saveQuantizedModel", false)),
+          m_saveHalfPrecisionCheckPoint(configSGD(L"saveHalfPrecisionCheckPoint", false)),
+          m_checkPointIntervalInMinutes(configSGD(L"checkPointIntervalInMinutes", 0.0)),
+          m_profileNodes(configSGD(L"profileNodes", false)),
+          m_useCUDAGraph(configSGD(L"cudaGraph", false)),
+          m_pruneSparsity(configSGD(L"pruneSparsity", 0.0)),
+          m_pruneStartEpoch(configSGD(L"pruneStartEpoch", (int) 1)),
+          m_pruneEndEpoch(configSGD(L"pruneEndEpoch", (int) 1)),
+          m_timelineTraceFile((const wstring&) configSGD(L"timelineTraceFile", L"")),
+          m_metricsFile((const wstring&) configSGD(L"metricsFile", L"")),
+          m_gpuWatcherIntervalInSeconds(configSGD(L"gpuWatcherIntervalInSeconds", 0.0)),
+          m_gpuWatcherMinFreeMemoryMB(configSGD(L"gpuWatcherMinFreeMemoryMB", (size_t) 512)),
           // m_validateAfterModelReloading(configSGD(L"validateAfterModelReloading", true)),
           m_trainCriterionNodeName((const wstring&) configSGD(L"trainCriterionNodeName", L"")),
           m_evalCriterionNodeName((const wstring&) configSGD(L"evalCriterionNodeName", L"")),
           m_prevChosenMinibatchSize(0),
           m_lastFinishedEpochTrainLoss(0.0),
+          m_trainLocally(false),
           m_distGradAgg(nullptr),
-          m_gradHeader(nullptr)
+          m_gradHeader(nullptr),
+          m_modelAveragingAllReduce(nullptr),
+          m_modelDeltaAggregator(nullptr),
+          m_modelDeltaHeader(nullptr)
     {
         msra::files::make_intermediate_dirs(m_modelPath);
+        m_midEpochResume.epoch = -1;
     }
     // note: This must be in the header, as we cannot properly specialize this constructor in the CPP to make sure all versions are generated.
 
@@ -295,10 +394,14 @@ public:
     {
     }
 
+    ~SGD(); // (in the CPP, where the types held by unique_ptrs are complete)
+
     void Train(function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn, DEVICEID_TYPE deviceId,
                IDataReader<ElemType>* trainSetDataReader,
                IDataReader<ElemType>* validationSetDataReader,
                const bool makeMode = true);
+    void PlanMemory(function<ComputationNetworkPtr(DEVICEID_TYPE)> createNetworkFn, DEVICEID_TYPE deviceId,
+                    const size_t numColumns, const size_t deviceMemoryMB);
     void Adapt(wstring origModelFileName, wstring refNodeName,
                IDataReader<ElemType>* trainSetDataReader,
                IDataReader<ElemType>* validationSetDataReader,
@@ -340,6 +443,16 @@ protected:
                                   const bool learnRateInitialized,
                                   const double largestPrevLearnRatePerSample);
 
+    // in-memory copy of all parameter values and the smoothed gradients, taken to undo trial training in the LR and MB-size searches
+    struct TrainingStateSnapshot
+    {
+        std::vector<ComputationNodePtr> nodes;
+        std::vector<shared_ptr<Matrix<ElemType>>> values;
+        std::vector<shared_ptr<Matrix<ElemType>>> smoothedGradients;
+    };
+    bool SnapshotTrainingState(ComputationNetworkPtr net, const std::list<Matrix<ElemType>>& smoothedGradients, TrainingStateSnapshot& snapshot);
+    void RestoreTrainingState(const TrainingStateSnapshot& snapshot, std::list<Matrix<ElemType>>& smoothedGradients);
+
     void TrainOneMiniEpochAndReloadModel(ComputationNetworkPtr net,
                                          ComputationNetworkPtr refNet,
                                          const ComputationNodeBasePtr& refNode, const int epochNumber,
@@ -421,7 +534,8 @@ protected:
                          /*out*/ double& epochCriterion,
                          /*out*/ std::vector<double>& epochEvalErrors,
                          /*out*/ size_t& totalSamplesSeen,
-                         std::string prefixMsg = "");
+                         std::string prefixMsg = "",
+                         bool midEpochCheckPoints = false);
 
     void InitDistGradAgg(int numEvalNodes, int traceLevel);
 
@@ -429,6 +543,7 @@ protected:
                                   float& SecondsSinceLastSyncFinished, float& SecondsSpentOnSync);
 
     size_t ModelAveragingSync(int nSamplesSinceLastSync, const std::list<ComputationNodeBasePtr>& learnableNodes);
+    void QuantizedModelDeltaSync(float factor, const std::list<ComputationNodeBasePtr>& learnableNodes);
 
 public:
     // UpdateWeightsS - static version of UpdateWeights()
@@ -454,7 +569,20 @@ protected:
                        const bool needAveMultiplier,
                        const bool useNesterovMomentum) const;
 
+    // UpdateWeightsMultiTensor - UpdateWeights() for all dense parameters at once, where the update type allows;
+    // sets 'updated' for the nodes it has updated, the others go through UpdateWeights()
+    void UpdateWeightsMultiTensor(const std::list<ComputationNodeBasePtr>& learnableNodes,
+                                  std::list<Matrix<ElemType>>& smoothedGradients,
+                                  const double learnRatePerSample,
+                                  const double momentumPerSample,
+                                  const size_t actualMBSize,
+                                  std::vector<bool>& updated,
+                                  Matrix<ElemType>& workspace) const;
+
     void ClipGradient(Matrix<ElemType>& gradient, const size_t actualMBSize) const;
+    static void ScaleDownToNorm(Matrix<ElemType>& norm, double maxNorm);
+    bool IsClippingByGlobalNorm() const;
+    void ClipGradientsByGlobalNorm(const std::list<ComputationNodeBasePtr>& learnableNodes, const size_t actualMBSize) const;
 
     void SaveCheckPointInfo(const size_t epoch, const size_t totalSamplesSeen,
                             const double learnRatePerSample,
@@ -462,6 +590,81 @@ protected:
                             const double prevCriterion,
                             const size_t minibatchSize);
 
+    void SaveCheckPointAsync(ComputationNetworkPtr net, const size_t epoch, const size_t totalSamplesSeen,
+                             const double learnRatePerSample,
+                             const std::list<Matrix<ElemType>>& smoothedGradients,
+                             const double prevCriterion,
+                             const size_t minibatchSize,
+                             const std::vector<wstring>& obsoleteFiles);
+    void WaitForCheckPoint(bool allRanks);
+    void BroadcastInitialModel(ComputationNetworkPtr net);
+    void StartCrossValidationAsync(ComputationNetworkPtr net, IDataReader<ElemType>* validationSetDataReader,
+                                   const vector<wstring>& cvNodeNames, const int epoch, const size_t mbSize);
+    void WaitForCrossValidation();
+    wstring GetPerRankFileName(const wstring& path, const wchar_t* extension) const;
+    void SaveTimelineTrace() const;
+
+    // one record of the metrics stream, over the minibatches since the previous one
+    struct ThroughputMetrics
+    {
+        int epoch;
+        size_t firstMB;
+        size_t numMBs;
+        size_t numSamples; // as in the SamplesPerSecond of the log
+        double seconds;
+        double trainLossPerSample;
+        double readerSeconds;        // in GetMinibatchIntoNetwork()
+        double computeSeconds;       // in forward/backward and the parameter update
+        double communicationSeconds; // in gradient aggregation or model averaging
+        size_t gpuPeakBytes;         // high-water mark of the GPU memory cache, see GPUMemoryCacheStatistics
+        size_t gradientBytesSent;    // see IDistGradAggregator::GetNumGradientBytesSent()
+        GPUDeviceSample gpu;         // from the GPUWatcher, if it runs; its defaults (-1 and 0) otherwise
+
+        ThroughputMetrics()
+            : epoch(0), firstMB(0), numMBs(0), numSamples(0), seconds(0), trainLossPerSample(0),
+              readerSeconds(0), computeSeconds(0), communicationSeconds(0), gpuPeakBytes(0), gradientBytesSent(0)
+        {
+        }
+    };
+    void WriteMetricsRecord(FILE* f, const ThroughputMetrics& metrics) const;
+
+    // state of an epoch in progress, saved every m_checkPointIntervalInMinutes, see SaveMidEpochCheckPoint()
+    struct MidEpochCheckPoint
+    {
+        int epoch;                    // -1 if none
+        size_t numMBsRead;            // minibatches this rank has read in the epoch
+        size_t numMBsRun;             // model updates in the epoch (the same on all ranks)
+        size_t totalEpochSamples;
+        size_t totalSamplesSeen;
+        double learnRatePerSample;
+        size_t minibatchSize;
+        double epochCriterion;        // accumulated since the start of the epoch, not yet divided by totalEpochSamples
+        std::vector<double> epochEvalErrors;
+        bool hasReaderState;          // if not, the reader is positioned by reading numMBsRead minibatches again
+        ReaderState readerState;
+    };
+
+    void SaveMidEpochCheckPoint(ComputationNetworkPtr net, const MidEpochCheckPoint& checkPoint,
+                                const std::list<Matrix<ElemType>>& smoothedGradients);
+    bool LoadMidEpochCheckPoint(ComputationNetworkPtr net, const int epoch,
+                                std::list<Matrix<ElemType>>& smoothedGradients);
+    wstring GetMidEpochModelName(const int epoch);
+    wstring GetMidEpochCheckPointFileName(const int epoch);
+    wstring GetMidEpochRankFileName(const int epoch, const size_t rank);
+
+    // elastic training
+    wstring GetElasticPortFileName() const;
+    int JoinElasticJob();
+    bool UpdateElasticMembership(ComputationNetworkPtr net, int& epoch, const bool joined, const size_t numEvalNodes,
+                                 std::list<Matrix<ElemType>>& smoothedGradients, double* sharedState, const size_t numSharedState);
+    void RecoverFromLostWorkers(ComputationNetworkPtr net, const int epoch, const size_t numEvalNodes, const MpiWorkerLost& e,
+                                /*out*/ size_t& totalSamplesSeen,
+                                /*out*/ double& learnRatePerSample,
+                                std::list<Matrix<ElemType>>& smoothedGradients,
+                                /*out*/ double& prevCriterion);
+    static void BroadcastMatrix(Matrix<ElemType>& value);
+
+    static void LoadSmoothedGradient(File& fstream, Matrix<ElemType>& smoothedGradient);
     bool LoadCheckPointInfo(const size_t epochNumber,
                             /*out*/ size_t& totalSamplesSeen,
                             /*out*/ double& learnRatePerSample,
@@ -495,6 +698,28 @@ public:
 protected:
     wstring m_modelPath;
     bool m_keepCheckPointFiles;
+    bool m_asyncCheckPoint;                 // write the epoch's model and checkpoint on a background thread, see SaveCheckPointAsync()
+    std::future<void> m_pendingCheckPoint; // the background write in flight, if any
+    bool m_asyncCrossValidation;           // cross-validate on another device on a background thread while the next epoch trains, see StartCrossValidationAsync()
+    DEVICEID_TYPE m_crossValidationDeviceId; // (GPU or CPUDEVICE) for m_asyncCrossValidation
+    bool m_lateCVLearnRateDecision;        // with m_asyncCrossValidation, adjust the learning rate by the previous epoch's result instead of waiting for this one's
+    ComputationNetworkPtr m_cvNet;         // the copy of the model that m_asyncCrossValidation evaluates, on m_crossValidationDeviceId
+    std::future<vector<double>> m_pendingCrossValidation; // the cross-validation in flight, if any
+    vector<double> m_lastCrossValidationScores;           // of the most recent cross-validation that finished (empty if none)
+    bool m_saveHalfPrecisionModel; // also save the final model with FP16 parameters as modelPath.fp16; the FP32 model remains the master copy
+    bool m_saveMappableModel;      // also save the final model as modelPath.mapped, whose parameters loaders memory-map instead of reading them
+    bool m_saveQuantizedModel;     // also save the final model with 8-bit parameters (a scale per row) as modelPath.int8
+    bool m_saveHalfPrecisionCheckPoint; // write the smoothed gradients of checkpoints in FP16; loading accepts either
+    double m_checkPointIntervalInMinutes; // if > 0, also checkpoint within epochs, so that an interrupted epoch resumes where it stopped
+    MidEpochCheckPoint m_midEpochResume;  // the checkpoint the start epoch resumes from (epoch = -1 if none), see DetermineStartEpoch()
+    bool m_profileNodes;                  // time every node in every epoch, see NodeProfiler; prints a table and saves modelPath.N.nodes.json
+    bool m_useCUDAGraph;                  // replay forward and backprop of minibatches of unchanged shape from a CUDA graph, see CapturedTrainingStep
+    double m_pruneSparsity;               // if > 0, prune this fraction of the weights of Times operations by pruneEndEpoch, see WeightPruner
+    int m_pruneStartEpoch, m_pruneEndEpoch; // (1-based)
+    wstring m_timelineTraceFile;          // if not empty, trace reader, compute and MPI intervals of all threads, see TimelineTrace and SaveTimelineTrace()
+    wstring m_metricsFile;                // if not empty, append throughput metrics as JSON lines to it (per rank), see WriteMetricsRecord()
+    double m_gpuWatcherIntervalInSeconds; // if > 0, sample the GPU in the background at this interval, see GPUWatcher; adds a GPU line to the progress log
+    size_t m_gpuWatcherMinFreeMemoryMB;   // the GPUWatcher warns when less device memory than this is left free
     // bool m_validateAfterModelReloading; // TODO: remove this. Why would one not validate a model?
 
     wstring m_trainCriterionNodeName;
@@ -502,10 +727,30 @@ protected:
 
     size_t m_prevChosenMinibatchSize;
     double m_lastFinishedEpochTrainLoss;
+    bool m_trainLocally; // TrainOneEpoch() on this rank alone, without gradient aggregation or model averaging (trials of the parallel learning rate search)
 
     IDistGradAggregator<ElemType>* m_distGradAgg;
     struct DistGradHeader* m_gradHeader;
 
+    std::unique_ptr<ModelAverager<ElemType>> m_modelAverager; // only for the model averaging options beyond plain synchronous averaging; anew for each TrainOrAdaptModel()
+    NcclHierarchicalAllReduce<ElemType>* m_modelAveragingAllReduce; // if m_useNcclModelAveraging, for ModelAveragingSync()
+    // if m_modelAveragingDeltaBits, for QuantizedModelDeltaSync(): the model all workers agreed on at the last sync (empty until the
+    // first sync of an epoch, which exchanges the full models), the deltas to it, and what sums them up with error feedback
+    std::vector<std::unique_ptr<Matrix<ElemType>>> m_lastSyncedModels;
+    std::vector<std::unique_ptr<Matrix<ElemType>>> m_modelDeltas;
+    IDistGradAggregator<ElemType>* m_modelDeltaAggregator;
+    struct DistGradHeader* m_modelDeltaHeader;
+
+    // if m_flatParameterBuffers: the buffers, and per learnable node the offset into them (SIZE_MAX if the node is not in them)
+    shared_ptr<Matrix<ElemType>> m_flatParameterValues;
+    shared_ptr<Matrix<ElemType>> m_flatParameterGradients;
+    shared_ptr<Matrix<ElemType>> m_flatSmoothedGradients;
+    std::vector<size_t> m_flatParameterOffsets;
+
+    shared_ptr<DataReaderHelpers::DeviceReplicaDispatcher<ElemType>> m_deviceReplicas; // if m_replicaDeviceIds is not empty
+    shared_ptr<ParameterShards<ElemType>> m_parameterShards;                            // if m_shardedParameters is not empty
+    shared_ptr<DataReaderHelpers::HogwildDispatcher<ElemType>> m_hogwild;               // if m_hogwildThreads > 0
+
 private:
     int SGDTrace(FILE* __restrict __stream, const char* __restrict __format, ...);
 };
@@ -2,6 +2,7 @@
 
 #include "IDistGradAggregator.h"
 #include "CUDAPageLockedMemAllocator.h"
+#include <algorithm>
 #include <future>
 #include "GPUDataTransferer.h"
 #include "TimerUtility.h"
@@ -14,8 +15,14 @@ class SimpleDistGradAggregator : public IDistGradAggregator<ElemType>
     UsingIDistGradAggregatorMembers;
 
 public:
-    SimpleDistGradAggregator(MPIWrapper* mpi, bool useAsyncAggregation, int syncStatsTrace)
-        : IDistGradAggregator<ElemType>(mpi), m_useAsyncAggregation(useAsyncAggregation), m_currentEpochNumber(-1), m_bufferedGradHeader(nullptr), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0)
+    // gradientBucketSize > 0 overlaps the aggregation with backprop, in buckets of about this many bytes (not combinable with useAsyncAggregation)
+    // allReduceAlgorithm other than Mpi replaces MPI_Iallreduce() by a blocking MPIWrapper::AllReduce() with that algorithm
+    // packedGradientThreshold > 0 (without buckets) sends the dense gradients of up to this many bytes, together with the header, as one message
+    // useCudaAwareMpi passes the other dense GPU gradients to MPI_Iallreduce() directly, if MPI is CUDA-aware (only with allReduceAlgorithm Mpi,
+    // and without buckets or useAsyncAggregation, which stage the gradients on the host anyway)
+    SimpleDistGradAggregator(MPIWrapper* mpi, bool useAsyncAggregation, int syncStatsTrace, size_t gradientBucketSize = 0, AllReduceAlgorithm allReduceAlgorithm = AllReduceAlgorithm::Mpi, size_t packedGradientThreshold = 0, bool useCudaAwareMpi = false)
+        : IDistGradAggregator<ElemType>(mpi), m_allocator(nullptr), m_buffersPrepared(false), m_useAsyncAggregation(useAsyncAggregation), m_gradientBucketSize(useAsyncAggregation ? 0 : gradientBucketSize), m_numBucketsStarted(0), m_allReduceAlgorithm(allReduceAlgorithm), m_packedGradientThreshold((m_gradientBucketSize > 0) ? 0 : packedGradientThreshold), m_packedRequest(MPI_REQUEST_NULL),
+          m_useCudaAwareMpi(useCudaAwareMpi && mpi->IsCudaAware() && !useAsyncAggregation && (m_gradientBucketSize == 0) && (allReduceAlgorithm == AllReduceAlgorithm::Mpi)), m_currentEpochNumber(-1), m_bufferedGradHeader(nullptr), m_syncStatsTrace(syncStatsTrace), m_iterationCount(0)
     {
     }
 
@@ -114,6 +121,11 @@ public:
 
             return false;
         }
+        else if (m_gradientBucketSize > 0)
+        {
+            AggregateGradientBuckets(gradients, headerCPU, showSyncPerfStats);
+            return (headerCPU->numSamples != 0);
+        }
         else
         {
             AggregateGradientsImpl(gradients, headerCPU, showSyncPerfStats);
@@ -121,12 +133,58 @@ public:
         }
     }
 
+    bool OverlapsWithBackprop() const override
+    {
+        return m_gradientBucketSize > 0;
+    }
+
+    // Called during backprop. Gradients are packed into buckets, and each bucket's all-reduce is started
+    // as soon as all of its gradients are final. AggregateGradients() then only waits for what has not finished yet.
+    void GradientIsFinal(const std::vector<Matrix<ElemType>*>& gradients, size_t i) override
+    {
+        if (m_gradientBucketSize == 0)
+            return;
+
+        PrepareBuffers(gradients);
+        if (m_gradientIsFinal[i] || IsSparse(gradients[i]))
+            return;
+        m_gradientIsFinal[i] = true;
+
+        size_t b = m_bucketOfGradient[i];
+        auto& bucket = m_buckets[b];
+        if (++bucket.m_numFinal < bucket.m_gradients.size())
+            return;
+
+        FetchBucket(gradients, bucket);
+        // On GPUs, starting a bucket means waiting for its copy to the CPU, so we only start the ones before it,
+        // whose copies have had time to complete while we were computing this one.
+        StartBuckets(gradients, gradients[0]->GetDeviceId() >= 0 ? b : b + 1);
+    }
+
 private:
+    // gradients packed into one buffer, for a single all-reduce
+    struct GradientBucket
+    {
+        std::vector<size_t> m_gradients; // indices into the list of gradients
+        std::vector<size_t> m_offsets;   // of each gradient in m_buffer
+        size_t m_numElements;
+        std::shared_ptr<ElemType> m_buffer; // in pinned memory for GPU devices
+        size_t m_numFinal;                  // number of its gradients that are final in this iteration
+        bool m_isFetched;                   // its gradients were (or are being) copied into m_buffer
+        MPI_Request m_request;
+
+        GradientBucket()
+            : m_numElements(0), m_numFinal(0), m_isFetched(false), m_request(MPI_REQUEST_NULL)
+        {
+        }
+    };
+
     std::shared_ptr<ElemType> AllocateIntermediateBuffer(int deviceID, size_t numElements)
     {
         assert(deviceID >= 0);
 
         // Use pinned memory for GPU devices for better copy performance
+        // The buffers are carved out of the device's shared arena, which bounds the pinned footprint per process.
         size_t totalSize = sizeof(ElemType) * numElements;
         return std::shared_ptr<ElemType>((ElemType*) m_allocator->Malloc(totalSize), [this, deviceID](ElemType* p)
                                          {
@@ -134,36 +192,348 @@ private:
                                          });
     }
 
-    bool ResetCurrentEpoch(const std::vector<Matrix<ElemType>*>& gradients, int numEvalNode, int epochNumber)
+    // set up the buffers for the gradients, which are the same in every call; done upon first use
+    void PrepareBuffers(const std::vector<Matrix<ElemType>*>& gradients)
     {
-        bool isNewEpoch = (m_currentEpochNumber != epochNumber);
+        if (m_buffersPrepared)
+            return;
+        m_buffersPrepared = true;
 
-        // When called the first time let's setup the intermediateCPU buffers for gradient aggregation if needed
-        if (m_currentEpochNumber == -1)
+        int deviceId = gradients[0]->GetDeviceId();
+        if (deviceId != CPUDEVICE)
+        {
+            m_allocator = &CUDAPageLockedMemArena::GetSharedArena(deviceId);
+        }
+
+        // the small gradients go first into the packed message, followed by the header
+        m_isPacked.assign(gradients.size(), false);
+        m_packedOffsets.assign(gradients.size(), 0);
+        m_numPackedGradientElements = 0;
+        for (size_t i = 0; (m_packedGradientThreshold > 0) && (i < gradients.size()); i++)
+        {
+            if (IsSparse(gradients[i]) || (gradients[i]->GetNumElements() * sizeof(ElemType) > m_packedGradientThreshold))
+                continue;
+            m_isPacked[i] = true;
+            m_packedOffsets[i] = m_numPackedGradientElements;
+            m_numPackedGradientElements += gradients[i]->GetNumElements();
+        }
+
+        for (size_t i = 0; i < gradients.size(); i++)
         {
-            int deviceId = gradients[0]->GetDeviceId();
+            // sparse gradients need no buffers, see AggregateSparseGradients(), nor do those that MPI reduces on the device
+            if (IsSparse(gradients[i]) || IsReducedOnDevice(gradients, i))
+            {
+                if (m_useAsyncAggregation && IsSparse(gradients[i]))
+                    RuntimeError("Aggregation of sparse gradient matrices is unsupported with useBufferedAsyncGradientAggregation.");
+                if (deviceId != CPUDEVICE)
+                {
+                    m_gpuDataTransferers.push_back(nullptr);
+                    if (m_gradientBucketSize == 0)
+                        m_intermediateCPUBuffers.push_back(nullptr);
+                }
+                continue;
+            }
+
             if (deviceId != CPUDEVICE)
             {
-                m_allocator.reset(new CUDAPageLockedMemAllocator(deviceId));
+                // with buckets, the copies run on separate streams, to overlap with backprop
+                m_gpuDataTransferers.push_back(std::unique_ptr<GPUDataTransferer<ElemType>>(new GPUDataTransferer<ElemType>(deviceId, m_useAsyncAggregation || (m_gradientBucketSize > 0))));
+                if (m_gradientBucketSize == 0)
+                    m_intermediateCPUBuffers.push_back(AllocateIntermediateBuffer(deviceId, gradients[i]->GetNumElements()));
             }
 
-            for (size_t i = 0; i < gradients.size(); i++)
+            if (m_useAsyncAggregation)
             {
-                // Make sure none of the gradient matrixes are sparse - we currently do not support aggregation of sparse gradient matrices
-                if (gradients[i]->GetMatrixType() != DENSE)
-                    RuntimeError("Gradient aggregation for sparse gradient matrices is currently unsupported!");
+                m_bufferedGradients[gradients[i]].reset(new Matrix<ElemType>(gradients[i]->GetNumRows(), gradients[i]->GetNumCols(), deviceId));
+            }
+        }
 
-                if (deviceId != CPUDEVICE)
-                {
-                    m_gpuDataTransferers.push_back(std::unique_ptr<GPUDataTransferer<ElemType>>(new GPUDataTransferer<ElemType>(deviceId, m_useAsyncAggregation)));
-                    m_intermediateCPUBuffers.push_back(AllocateIntermediateBuffer(deviceId, gradients[i]->GetNumElements()));
-                }
+        if (m_gradientBucketSize > 0)
+            CreateBuckets(gradients);
+    }
 
-                if (m_useAsyncAggregation)
-                {
-                    m_bufferedGradients[gradients[i]].reset(new Matrix<ElemType>(gradients[i]->GetNumRows(), gradients[i]->GetNumCols(), deviceId));
-                }
+    // The packed message is one all-reduce of doubles: the small gradients, then numSamples, numSamplesWithLabel, criterion and the
+    // eval errors, which are sums over the workers just like the gradients. (Sample counts are exact in doubles up to 2^53.)
+    // This replaces both the per-gradient all-reduces of the small gradients and the gathering and scattering of the header,
+    // which dominate the latency of a step for models with many small parameters.
+    bool PacksHeader() const
+    {
+        return m_packedGradientThreshold > 0;
+    }
+
+    // pack the small gradients (from the intermediate buffers on GPUs, whose copies must have completed) and the header, and start their all-reduce
+    void StartPackedAllReduce(const std::vector<Matrix<ElemType>*>& gradients, const DistGradHeader* headerCPU)
+    {
+        int deviceId = gradients[0]->GetDeviceId();
+        m_packedBuffer.resize(m_numPackedGradientElements + 3 + headerCPU->numEvalNode);
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            if (!m_isPacked[i])
+                continue;
+            if (deviceId >= 0)
+                m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
+            const ElemType* data = (deviceId >= 0) ? m_intermediateCPUBuffers[i].get() : gradients[i]->BufferPointer();
+            std::copy(data, data + gradients[i]->GetNumElements(), m_packedBuffer.begin() + m_packedOffsets[i]);
+        }
+
+        double* header = m_packedBuffer.data() + m_numPackedGradientElements;
+        header[0] = (double) headerCPU->numSamples;
+        header[1] = (double) headerCPU->numSamplesWithLabel;
+        header[2] = headerCPU->criterion;
+        for (int j = 0; j < headerCPU->numEvalNode; j++)
+            header[3 + j] = headerCPU->evalErrors[j];
+
+        if (m_allReduceAlgorithm == AllReduceAlgorithm::Mpi)
+            m_mpi->AllReduceAsync(m_packedBuffer.data(), m_packedBuffer.size(), &m_packedRequest);
+        else
+            m_mpi->AllReduce(m_packedBuffer.data(), m_packedBuffer.size(), m_allReduceAlgorithm);
+        m_numGradientBytesSent += m_numPackedGradientElements * sizeof(ElemType);
+    }
+
+    // wait for the packed all-reduce, and unpack the header and the small gradients (starting their copies back to the GPU)
+    void FinishPackedAllReduce(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU)
+    {
+        m_mpi->Wait(&m_packedRequest);
+
+        const double* header = m_packedBuffer.data() + m_numPackedGradientElements;
+        headerCPU->numSamples = (size_t) header[0];
+        headerCPU->numSamplesWithLabel = (size_t) header[1];
+        headerCPU->criterion = header[2];
+        for (int j = 0; j < headerCPU->numEvalNode; j++)
+            headerCPU->evalErrors[j] = header[3 + j];
+
+        int deviceId = gradients[0]->GetDeviceId();
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            if (!m_isPacked[i])
+                continue;
+            const size_t numElements = gradients[i]->GetNumElements();
+            ElemType* data = (deviceId >= 0) ? m_intermediateCPUBuffers[i].get() : gradients[i]->BufferPointer();
+            std::transform(m_packedBuffer.begin() + m_packedOffsets[i], m_packedBuffer.begin() + m_packedOffsets[i] + numElements, data, [](double value)
+                           {
+                               return (ElemType) value;
+                           });
+            if (deviceId >= 0)
+                m_gpuDataTransferers[i]->CopyCPUToGPUAsync(m_intermediateCPUBuffers[i].get(), numElements, gradients[i]->BufferPointer());
+        }
+    }
+
+    // Pack the gradients into buckets of up to m_gradientBucketSize bytes (or a single larger gradient), from last to first,
+    // since gradients are passed in evaluation order, and backprop completes them in reverse.
+    void CreateBuckets(const std::vector<Matrix<ElemType>*>& gradients)
+    {
+        m_bucketOfGradient.resize(gradients.size());
+        m_gradientIsFinal.assign(gradients.size(), false);
+        for (size_t i = gradients.size(); i-- > 0;)
+        {
+            m_bucketOfGradient[i] = SIZE_MAX;
+            if (IsSparse(gradients[i]))
+                continue;
+
+            size_t numElements = gradients[i]->GetNumElements();
+            if (m_buckets.empty() || ((m_buckets.back().m_numElements > 0) && ((m_buckets.back().m_numElements + numElements) * sizeof(ElemType) > m_gradientBucketSize)))
+                m_buckets.push_back(GradientBucket());
+            auto& bucket = m_buckets.back();
+            m_bucketOfGradient[i] = m_buckets.size() - 1;
+            bucket.m_gradients.push_back(i);
+            bucket.m_offsets.push_back(bucket.m_numElements);
+            bucket.m_numElements += numElements;
+        }
+
+        int deviceId = gradients[0]->GetDeviceId();
+        for (auto& bucket : m_buckets)
+        {
+            if (deviceId != CPUDEVICE)
+                bucket.m_buffer = AllocateIntermediateBuffer(deviceId, bucket.m_numElements);
+            else
+                bucket.m_buffer.reset(new ElemType[bucket.m_numElements], [](ElemType* p)
+                                      {
+                                          delete[] p;
+                                      });
+        }
+    }
+
+    // copy the gradients of a bucket into its buffer (asynchronously on GPUs)
+    void FetchBucket(const std::vector<Matrix<ElemType>*>& gradients, GradientBucket& bucket)
+    {
+        int deviceId = gradients[0]->GetDeviceId();
+        if (deviceId >= 0)
+        {
+            // the copies run on the fetch stream, which must wait until the main compute stream has completed the gradients
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeDataTransferFetchStreamWithEvent<ElemType>();
+        }
+
+        for (size_t j = 0; j < bucket.m_gradients.size(); j++)
+        {
+            size_t i = bucket.m_gradients[j];
+            ElemType* bucketBuffer = bucket.m_buffer.get() + bucket.m_offsets[j];
+            if (deviceId >= 0)
+                m_gpuDataTransferers[i]->CopyGPUToCPUAsync(gradients[i]->BufferPointer(), gradients[i]->GetNumElements(), bucketBuffer);
+            else
+                memcpy(bucketBuffer, gradients[i]->BufferPointer(), gradients[i]->GetNumElements() * sizeof(ElemType));
+        }
+        bucket.m_isFetched = true;
+    }
+
+    // Start the all-reduce of the fetched buckets before endBucket. This must go strictly in bucket order,
+    // since all workers must issue their collective operations in the same order.
+    void StartBuckets(const std::vector<Matrix<ElemType>*>& gradients, size_t endBucket)
+    {
+        int deviceId = gradients[0]->GetDeviceId();
+        for (; (m_numBucketsStarted < endBucket) && m_buckets[m_numBucketsStarted].m_isFetched; m_numBucketsStarted++)
+        {
+            auto& bucket = m_buckets[m_numBucketsStarted];
+            if (deviceId >= 0)
+            {
+                for (size_t i : bucket.m_gradients)
+                    m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
+            }
+            if (m_allReduceAlgorithm == AllReduceAlgorithm::Mpi)
+                m_mpi->AllReduceAsync(bucket.m_buffer.get(), bucket.m_numElements, &bucket.m_request);
+            else
+                m_mpi->AllReduce(bucket.m_buffer.get(), bucket.m_numElements, m_allReduceAlgorithm);
+            m_numGradientBytesSent += bucket.m_numElements * sizeof(ElemType);
+        }
+
+        // give MPI a chance to make progress on the ones in flight
+        for (size_t b = 0; b < m_numBucketsStarted; b++)
+            m_mpi->Test(&m_buckets[b].m_request);
+    }
+
+    static bool IsSparse(const Matrix<ElemType>* gradient)
+    {
+        return gradient->GetMatrixType() != DENSE;
+    }
+
+    // whether this gradient's device memory goes to MPI as is, without copies through the host
+    bool IsReducedOnDevice(const std::vector<Matrix<ElemType>*>& gradients, size_t i) const
+    {
+        return m_useCudaAwareMpi && (gradients[i]->GetDeviceId() >= 0) && !IsSparse(gradients[i]) && !m_isPacked[i];
+    }
+
+    // Sparse gradients (in matrixFormatSparseBlockCol, e.g. of embeddings of sparse inputs) are aggregated by their stored columns:
+    // first which columns any worker has (one count per column), then the values of those columns only, which the optimizer
+    // then applies to just those columns. These are blocking collectives, which all workers issue in the same order.
+    void AggregateSparseGradients(const std::vector<Matrix<ElemType>*>& gradients)
+    {
+        for (size_t i = 0; i < gradients.size(); i++)
+        {
+            if (!IsSparse(gradients[i]))
+                continue;
+
+            Matrix<ElemType>& gradient = *gradients[i];
+            std::vector<size_t> columnIds;
+            std::vector<ElemType> values;
+            gradient.GetBlockColumns(columnIds, values);
+
+            std::vector<int> columnCounts(gradient.GetNumCols(), 0);
+            for (size_t col : columnIds)
+                columnCounts[col] = 1;
+            m_mpi->AllReduce(columnCounts);
+
+            std::vector<size_t> aggregatedColumnIds;
+            std::vector<size_t> blockOfColumn(columnCounts.size(), SIZE_MAX);
+            for (size_t col = 0; col < columnCounts.size(); col++)
+            {
+                if (columnCounts[col] == 0)
+                    continue;
+                blockOfColumn[col] = aggregatedColumnIds.size();
+                aggregatedColumnIds.push_back(col);
+            }
+
+            const size_t numRows = gradient.GetNumRows();
+            std::vector<ElemType> aggregatedValues(numRows * aggregatedColumnIds.size(), 0);
+            for (size_t j = 0; j < columnIds.size(); j++)
+                std::copy(values.begin() + j * numRows, values.begin() + (j + 1) * numRows, aggregatedValues.begin() + blockOfColumn[columnIds[j]] * numRows);
+            if (!aggregatedValues.empty())
+                m_mpi->AllReduce(aggregatedValues.data(), aggregatedValues.size(), m_allReduceAlgorithm);
+
+            gradient.SetMatrixFromBlockColumns(aggregatedColumnIds, aggregatedValues.data());
+            m_numGradientBytesSent += columnCounts.size() * sizeof(int) + aggregatedValues.size() * sizeof(ElemType);
+        }
+    }
+
+    void AggregateGradientBuckets(const std::vector<Matrix<ElemType>*>& gradients, DistGradHeader* headerCPU, bool showSyncPerfStats)
+    {
+        Timer aggregationTimer;
+        int deviceId = gradients[0]->GetDeviceId();
+        if (showSyncPerfStats)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+            aggregationTimer.Start();
+        }
+
+        // If the current node did not process any samples, there was no backprop; the gradients should be zero'd
+        if (headerCPU->numSamples == 0)
+        {
+            for (size_t i = 0; i < gradients.size(); ++i)
+            {
+                if (!m_gradientIsFinal[i])
+                    gradients[i]->SetValue(0);
+            }
+        }
+
+        // start whatever has not been started during backprop
+        for (size_t i = gradients.size(); i-- > 0;)
+            GradientIsFinal(gradients, i);
+        StartBuckets(gradients, m_buckets.size());
+        assert(m_numBucketsStarted == m_buckets.size());
+        AggregateSparseGradients(gradients);
+
+        AggregateHeader(headerCPU, m_recvHeaders, gradients.size());
+
+        // wait for the all-reduce operations to finish and unpack the buckets
+        for (auto& bucket : m_buckets)
+        {
+            m_mpi->Wait(&bucket.m_request);
+            for (size_t j = 0; j < bucket.m_gradients.size(); j++)
+            {
+                size_t i = bucket.m_gradients[j];
+                ElemType* bucketBuffer = bucket.m_buffer.get() + bucket.m_offsets[j];
+                if (deviceId >= 0)
+                    m_gpuDataTransferers[i]->CopyCPUToGPUAsync(bucketBuffer, gradients[i]->GetNumElements(), gradients[i]->BufferPointer());
+                else
+                    memcpy(gradients[i]->BufferPointer(), bucketBuffer, gradients[i]->GetNumElements() * sizeof(ElemType));
             }
+        }
+
+        // Wait for all the transfers to finish
+        if (deviceId >= 0)
+        {
+            for (size_t i = 0; i < gradients.size(); ++i)
+            {
+                if (!IsSparse(gradients[i]))
+                    m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
+            }
+        }
+
+        // ready for the next iteration
+        for (auto& bucket : m_buckets)
+        {
+            bucket.m_numFinal = 0;
+            bucket.m_isFetched = false;
+        }
+        m_gradientIsFinal.assign(gradients.size(), false);
+        m_numBucketsStarted = 0;
+
+        if (showSyncPerfStats)
+        {
+            aggregationTimer.Stop();
+            double epochTime = aggregationTimer.ElapsedSeconds();
+            fprintf(stderr, "Actual gradient aggregation time: %.6g\n", epochTime);
+        }
+    }
+
+    bool ResetCurrentEpoch(const std::vector<Matrix<ElemType>*>& gradients, int numEvalNode, int epochNumber)
+    {
+        bool isNewEpoch = (m_currentEpochNumber != epochNumber);
+
+        // When called the first time let's setup the intermediateCPU buffers for gradient aggregation if needed
+        if (m_currentEpochNumber == -1)
+        {
+            PrepareBuffers(gradients);
 
             if (m_useAsyncAggregation)
             {
@@ -171,7 +541,7 @@ private:
                 m_bufferedGradHeader->Clear();
             }
 
-            if (m_mpi->IsMainNode())
+            if (m_mpi->IsMainNode() && !PacksHeader())
             {
                 for (size_t i = 0; i < NumProc() - 1; ++i)
                 {
@@ -240,17 +610,25 @@ private:
         }
 
         // Initiate transfer of the gradient matrices to the CPU if needed
+        bool anyReducedOnDevice = false;
         if (deviceId >= 0)
         {
             for (size_t i = 0; i < numGradMatrices; ++i)
             {
+                anyReducedOnDevice |= IsReducedOnDevice(gradients, i);
+                if (IsSparse(gradients[i]) || IsReducedOnDevice(gradients, i))
+                    continue;
                 m_gpuDataTransferers[i]->CopyGPUToCPUAsync(gradients[i]->BufferPointer(), gradients[i]->GetNumElements(), m_intermediateCPUBuffers[i].get());
             }
         }
 
+        // With packing, the header goes with the small gradients, whose all-reduce is started first, since it is the one waited for longest
+        if (PacksHeader())
+            StartPackedAllReduce(gradients, headerCPU);
+
         // Initiate receive of the header on the main node
         std::vector<MPI_Request> recvHeaderRequests(NumProc() - 1);
-        if (m_mpi->IsMainNode())
+        if (m_mpi->IsMainNode() && !PacksHeader())
         {
             for (size_t j = 0; j < NumProc() - 1; ++j)
             {
@@ -261,30 +639,51 @@ private:
         }
 
         // Send the headers from all nodes but the main node
-        MPI_Request sendHeaderRequest;
-        if (!m_mpi->IsMainNode())
+        MPI_Request sendHeaderRequest = MPI_REQUEST_NULL;
+        if (!m_mpi->IsMainNode() && !PacksHeader())
         {
             MPI_Isend(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), numGradMatrices, m_mpi->Communicator(), &sendHeaderRequest) || MpiFail("MPI_Isend");
         }
 
+        // MPI reads the device memory without regard to our streams, so the gradients must be complete before
+        if (anyReducedOnDevice)
+        {
+            std::unique_ptr<MatrixComputeStreamEvent> mainStreamSyncEvent(MatrixComputeStreamEvent::Create(deviceId));
+            mainStreamSyncEvent->SynchronizeEvent();
+        }
+
         // Perform MPI async allreduce on the gradient data
-        std::vector<MPI_Request> allReduceRequests(numGradMatrices);
+        std::vector<MPI_Request> allReduceRequests(numGradMatrices, MPI_REQUEST_NULL);
         for (size_t i = 0; i < numGradMatrices; ++i)
         {
+            if (IsSparse(gradients[i]) || m_isPacked[i])
+                continue;
+
             ElemType* reductionBuffer = gradients[i]->BufferPointer();
-            if (deviceId >= 0)
+            if ((deviceId >= 0) && !IsReducedOnDevice(gradients, i))
             {
                 m_gpuDataTransferers[i]->WaitForCopyGPUToCPUAsync();
                 reductionBuffer = m_intermediateCPUBuffers[i].get();
             }
 
-            // On Windows this async MPI_Iallreduce call requires MS MPI v7 or higher to be installed
-            MPI_Iallreduce(MPI_IN_PLACE, reductionBuffer, gradients[i]->GetNumElements(), MPIWrapper::GetDataType(reductionBuffer), MPI_SUM, m_mpi->Communicator(), &allReduceRequests[i]) || MpiFail("MPI_Iallreduce");
+            if (m_allReduceAlgorithm == AllReduceAlgorithm::Mpi)
+            {
+                // On Windows this async MPI_Iallreduce call requires MS MPI v7 or higher to be installed
+                MPI_Iallreduce(MPI_IN_PLACE, reductionBuffer, gradients[i]->GetNumElements(), MPIWrapper::GetDataType(reductionBuffer), MPI_SUM, m_mpi->Communicator(), &allReduceRequests[i]) || MpiFail("MPI_Iallreduce");
+            }
+            else
+            {
+                m_mpi->AllReduce(reductionBuffer, gradients[i]->GetNumElements(), m_allReduceAlgorithm);
+                allReduceRequests[i] = MPI_REQUEST_NULL; // (done already)
+            }
+            m_numGradientBytesSent += gradients[i]->GetNumElements() * sizeof(ElemType);
         }
+        AggregateSparseGradients(gradients);
 
         // On the main node wait for the headers to arrive and aggregate
-        if (m_mpi->IsMainNode())
+        if (m_mpi->IsMainNode() && !PacksHeader())
         {
+            TimelineScope scope("WaitForHeaders", "mpi");
             size_t numNodesHeadersReceivedFrom = 0;
             while (numNodesHeadersReceivedFrom < (NumProc() - 1))
             {
@@ -303,16 +702,16 @@ private:
             assert(numNodesHeadersReceivedFrom == (NumProc() - 1));
         }
 
-        MPI_Request recvAggHeaderRequest;
+        MPI_Request recvAggHeaderRequest = MPI_REQUEST_NULL;
         // Initiate receive of the aggregate header
-        if (!m_mpi->IsMainNode())
+        if (!m_mpi->IsMainNode() && !PacksHeader())
         {
             MPI_Irecv(headerCPU, headerCPU->Size(), MPI_CHAR, m_mpi->MainNodeRank(), numGradMatrices + 1 + numGradMatrices, m_mpi->Communicator(), &recvAggHeaderRequest) || MpiFail("MPI_Irecv");
         }
 
         // Intiate send of the aggregate header from main node
-        std::vector<MPI_Request> sendAggHeaderRequests(NumProc() - 1);
-        if (m_mpi->IsMainNode())
+        std::vector<MPI_Request> sendAggHeaderRequests(PacksHeader() ? 0 : NumProc() - 1);
+        if (m_mpi->IsMainNode() && !PacksHeader())
         {
             for (size_t j = 0; j < NumProc() - 1; ++j)
             {
@@ -323,19 +722,23 @@ private:
         }
 
         // Wait for the allreduce operations to finish and initiate transfer back to the GPU if needed
+        if (PacksHeader())
+            FinishPackedAllReduce(gradients, headerCPU);
         for (size_t i = 0; i < numGradMatrices; ++i)
         {
-            MPI_Wait(&allReduceRequests[i], MPI_STATUSES_IGNORE) || MpiFail("MPI_Wait");
-            if (deviceId >= 0)
+            if (IsSparse(gradients[i]) || m_isPacked[i])
+                continue;
+            m_mpi->Wait(&allReduceRequests[i]);
+            if ((deviceId >= 0) && !IsReducedOnDevice(gradients, i))
             {
                 m_gpuDataTransferers[i]->CopyCPUToGPUAsync(m_intermediateCPUBuffers[i].get(), gradients[i]->GetNumElements(), gradients[i]->BufferPointer());
             }
         }
 
         // Wait to receive aggregate header
-        if (!m_mpi->IsMainNode())
+        if (!m_mpi->IsMainNode() && !PacksHeader())
         {
-            MPI_Wait(&recvAggHeaderRequest, MPI_STATUSES_IGNORE) || MpiFail("MPI_Wait");
+            m_mpi->Wait(&recvAggHeaderRequest);
         }
 
         // Wait for all the transfers to finish
@@ -343,17 +746,19 @@ private:
         {
             for (size_t i = 0; i < numGradMatrices; ++i)
             {
-                m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
+                if (!IsSparse(gradients[i]) && !IsReducedOnDevice(gradients, i))
+                    m_gpuDataTransferers[i]->WaitForCopyCPUToGPUAsync();
             }
         }
 
         // Wait for completion of the async send requests
-        if (!m_mpi->IsMainNode())
+        if (!m_mpi->IsMainNode() && !PacksHeader())
         {
-            MPI_Wait(&sendHeaderRequest, MPI_STATUSES_IGNORE) || MpiFail("MPI_Wait");
+            m_mpi->Wait(&sendHeaderRequest);
         }
         else
         {
+            TimelineScope scope("MPI_Waitall", "mpi");
             MPI_Waitall(sendAggHeaderRequests.size(), sendAggHeaderRequests.data(), MPI_STATUSES_IGNORE) || MpiFail("MPI_Waitall");
         }
 
@@ -366,8 +771,9 @@ private:
     }
 
 private:
-    std::unique_ptr<CUDAPageLockedMemAllocator> m_allocator;
+    MemAllocator* m_allocator; // not owned
     std::vector<std::shared_ptr<ElemType>> m_intermediateCPUBuffers;
+    bool m_buffersPrepared;
 
     std::vector<std::unique_ptr<GPUDataTransferer<ElemType>>> m_gpuDataTransferers;
 
@@ -379,6 +785,26 @@ private:
     // Future corresponding to the current in-flight async gradient aggregation
     std::future<void> m_pendingAsyncAggregation;
 
+    // Bucketed gradient aggregation overlapping with backprop, if m_gradientBucketSize > 0
+    size_t m_gradientBucketSize;
+    std::vector<GradientBucket> m_buckets; // in the order in which they are started
+    std::vector<size_t> m_bucketOfGradient;
+    std::vector<bool> m_gradientIsFinal; // GradientIsFinal() was called for it in this iteration
+    size_t m_numBucketsStarted;
+
+    AllReduceAlgorithm m_allReduceAlgorithm;
+
+    // Small gradients and the header packed into one all-reduce, if m_packedGradientThreshold > 0, see PacksHeader()
+    size_t m_packedGradientThreshold;
+    std::vector<bool> m_isPacked;        // [gradient]
+    std::vector<size_t> m_packedOffsets; // [gradient] its offset in m_packedBuffer, if packed
+    size_t m_numPackedGradientElements;  // the header follows them in m_packedBuffer
+    std::vector<double> m_packedBuffer;
+    MPI_Request m_packedRequest;
+
+    // the other dense gradients of GPUs go to MPI without copies, see IsReducedOnDevice()
+    bool m_useCudaAwareMpi;
+
     // Buffered gradients that we asynchronously aggregate
     std::unordered_map<Matrix<ElemType>*, std::unique_ptr<Matrix<ElemType>>> m_bufferedGradients;
     DistGradHeader* m_bufferedGradHeader;
@@ -9,11 +9,13 @@
 #include "ComputationNode.h"
 #include "ComputationNetwork.h"
 #include "DataReaderHelpers.h"
+#include "CriterionAccumulator.h"
 #include "TrainingNodes.h" // TODO: we should move the functions that depend on these to the .cpp
 
 #include <vector>
 #include <string>
 #include <set>
+#include <functional>
 
 using namespace std;
 
@@ -24,12 +26,22 @@ template <class ElemType>
 class SimpleEvaluator
 {
 public:
-    SimpleEvaluator(ComputationNetworkPtr net, const size_t numMBsToShowResult = 100, const int traceLevel = 0)
-        : m_net(net), m_numMBsToShowResult(numMBsToShowResult), m_traceLevel(traceLevel)
+    // parallel - evaluate on all MPI ranks, each on its share of the data, and sum up the criteria across them (all ranks must call Evaluate())
+    // enableDistributedMBReading - with 'parallel', let each rank read only its share of the data, if the reader supports it (otherwise all read everything and each evaluates a subset)
+    SimpleEvaluator(ComputationNetworkPtr net, const size_t numMBsToShowResult = 100, const int traceLevel = 0, const bool parallel = false, const bool enableDistributedMBReading = false)
+        : m_net(net), m_numMBsToShowResult(numMBsToShowResult), m_traceLevel(traceLevel), m_parallel(parallel), m_enableDistributedMBReading(enableDistributedMBReading)
     {
     }
 
+    // called for each minibatch before the forward pass, on all ranks (with haveData = false where the share is empty),
+    // e.g. to fetch the columns of embeddings split across the ranks, see ParameterShards
+    void SetBeforeForwardProp(const std::function<void(bool haveData)>& beforeForwardProp)
+    {
+        m_beforeForwardProp = beforeForwardProp;
+    }
+
     // returns evaluation node values per sample determined by evalNodeNames (which can include both training and eval criterion nodes)
+    // In parallel, all ranks return the values for the entire data.
     vector<double> Evaluate(IDataReader<ElemType>* dataReader, const vector<wstring>& evalNodeNames, const size_t mbSize, const size_t testSize = requestDataSize)
     {
         // determine nodes to evaluate
@@ -92,27 +104,62 @@ public:
         for (int i = 0; i < evalResults.size(); i++)
             evalResultsLastMBs.push_back((ElemType) 0);
 
-        dataReader->StartMinibatchLoop(mbSize, 0, testSize);
+        // The node values are summed up on their device, and read back only every m_numMBsToShowResult minibatches and at the end,
+        // so that the loop does not wait for the GPU after each minibatch. Each read adds the partial sums to 'evalResults' in double
+        // precision and resets them, so that float sums of many error counts do not lose precision.
+        // (only if all nodes are on the same device, e.g. not for a model split across GPUs with criteria on different parts)
+        bool accumulateOnDevice = !evalNodes.empty();
+        for (const auto& node : evalNodes)
+            accumulateOnDevice &= node->GetDeviceId() == evalNodes.front()->GetDeviceId();
+        std::unique_ptr<CriterionAccumulator<ElemType>> deviceResults;
+        if (accumulateOnDevice)
+            deviceResults.reset(new CriterionAccumulator<ElemType>(evalNodes.front()->GetDeviceId(), evalNodes.size()));
+        auto addDeviceResults = [&]()
+        {
+            if (!deviceResults)
+                return;
+            double unusedCriterion;
+            vector<double> partialResults;
+            deviceResults->Read(unusedCriterion, partialResults);
+            deviceResults->Reset();
+            for (size_t i = 0; i < evalResults.size(); i++)
+                evalResults[i] += partialResults[i];
+        };
+
+        const bool useParallel = m_parallel && (g_mpi != nullptr) && (g_mpi->NumNodesInUse() > 1);
+        const bool useDistributedMBReading = useParallel && m_enableDistributedMBReading && dataReader->SupportsDistributedMBRead();
+        if (useDistributedMBReading)
+            dataReader->StartDistributedMinibatchLoop(mbSize, 0, g_mpi->CurrentNodeRank(), g_mpi->NumNodesInUse(), testSize);
+        else
+            dataReader->StartMinibatchLoop(mbSize, 0, testSize);
         m_net->StartEvaluateMinibatchLoop(evalNodes);
 
-        while (DataReaderHelpers::GetMinibatchIntoNetwork(*dataReader, m_net, nullptr, false, false, inputMatrices, actualMBSize))
+        while (DataReaderHelpers::GetMinibatchIntoNetwork(*dataReader, m_net, nullptr, useDistributedMBReading, useParallel, inputMatrices, actualMBSize))
         {
             ComputationNetwork::BumpEvalTimeStamp(featureNodes);
             ComputationNetwork::BumpEvalTimeStamp(labelNodes);
+            if (m_beforeForwardProp)
+                m_beforeForwardProp(actualMBSize > 0);
 
             // for now since we share the same label masking flag we call this on one node only
             // Later, when we apply different labels on different nodes
             // we need to add code to call this function multiple times, one for each criteria node
             size_t numSamplesWithLabel = m_net->GetNumSamplesWithLabel(actualMBSize);
-            for (int i = 0; i < evalNodes.size(); i++)
+            for (int i = 0; i < evalNodes.size() && actualMBSize > 0; i++) // (in parallel, our share of a minibatch may be empty)
             {
                 m_net->ForwardProp(evalNodes[i]);
-                evalResults[i] += (double) evalNodes[i]->Get00Element(); // criterionNode should be a scalar
+                if (!deviceResults)
+                    evalResults[i] += (double) evalNodes[i]->Get00Element(); // criterionNode should be a scalar
             }
+            if (deviceResults && actualMBSize > 0)
+                deviceResults->AccumulateEvalErrors(evalNodes);
 
             totalEpochSamples += numSamplesWithLabel;
             numMBsRun++;
 
+            if (m_numMBsToShowResult > 0 && numMBsRun % m_numMBsToShowResult == 0)
+                addDeviceResults();
+
             if (m_traceLevel > 0)
             {
                 numSamplesLastMBs += numSamplesWithLabel;
@@ -135,12 +182,25 @@ public:
             dataReader->DataEnd(endDataSentence);
         }
 
+        addDeviceResults();
+
         // show last batch of results
         if (m_traceLevel > 0 && numSamplesLastMBs > 0)
         {
             DisplayEvalStatistics(lastMBsRun + 1, numMBsRun, numSamplesLastMBs, evalNodes, evalResults, evalResultsLastMBs);
         }
 
+        // sum up the shares of all ranks
+        if (useParallel)
+        {
+            vector<double> sums = evalResults;
+            sums.push_back((double) totalEpochSamples);
+            g_mpi->AllReduce(sums);
+            totalEpochSamples = (size_t) sums.back();
+            sums.pop_back();
+            evalResults = sums;
+        }
+
         // final statistics
         for (int i = 0; i < evalResultsLastMBs.size(); i++)
         {
@@ -199,6 +259,9 @@ protected:
     ComputationNetworkPtr m_net;
     size_t m_numMBsToShowResult;
     int m_traceLevel;
+    bool m_parallel;
+    bool m_enableDistributedMBReading;
+    std::function<void(bool)> m_beforeForwardProp;
     void operator=(const SimpleEvaluator&); // (not assignable)
 };
 } } }
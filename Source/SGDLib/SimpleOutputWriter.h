@@ -10,10 +10,18 @@
 #include "DataReaderHelpers.h"
 #include "Helpers.h"
 #include "fileutil.h"
+#include "FeatureArchive.h"
+#include "MatrixReadback.h"
 #include <vector>
 #include <string>
 #include <stdexcept>
 #include <fstream>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
 
 using namespace std;
 
@@ -79,11 +87,10 @@ public:
             ComputationNetwork::BumpEvalTimeStamp(featureNodes);
             ComputationNetwork::BumpEvalTimeStamp(labelNodes);
 
+            // (one pass for all outputs, which mostly share their inputs)
+            m_net->ForwardPropJointly(outputNodes);
             for (int i = 0; i < outputNodes.size(); i++)
-            {
-                m_net->ForwardProp(outputNodes[i]);
                 outputMatrices[outputNodes[i]->NodeName()] = (void*) (&dynamic_pointer_cast<ComputationNode<ElemType>>(outputNodes[i])->Value());
-            }
 
             if (doUnitTest)
             {
@@ -108,7 +115,11 @@ public:
         // clean up
     }
 
-    void WriteOutput(IDataReader<ElemType>& dataReader, size_t mbSize, std::wstring outputPath, const std::vector<std::wstring>& outputNodeNames, size_t numOutputSamples = requestDataSize)
+    // WriteOutput - write the values of the output nodes to outputPath.<node name>, one line of text per sample,
+    // or with 'archive', binary into a FeatureArchive of that name, with the same samples in the same order; its script
+    // outputPath.<node name>.scp then lists them as a single utterance <node name>=outputPath.<node name>[0,N-1] for HTKMLFReader
+    void WriteOutput(IDataReader<ElemType>& dataReader, size_t mbSize, std::wstring outputPath, const std::vector<std::wstring>& outputNodeNames, size_t numOutputSamples = requestDataSize,
+                     const FeatureArchive::Encoding* archive = nullptr, size_t archiveChunkFrames = 65536)
     {
         msra::files::make_intermediate_dirs(outputPath);
 
@@ -129,7 +140,10 @@ public:
         }
 
         std::vector<ofstream*> outputStreams;
-        for (int i = 0; i < outputNodes.size(); i++)
+        std::vector<shared_ptr<FeatureArchive::Writer>> archiveWriters;
+        for (int i = 0; i < outputNodes.size() && archive; i++)
+            archiveWriters.push_back(make_shared<FeatureArchive::Writer>(outputPath + L"." + outputNodes[i]->NodeName(), outputNodes[i]->GetSampleMatrixNumRows(), "USER", 100000, *archive, archiveChunkFrames));
+        for (int i = 0; i < outputNodes.size() && !archive; i++)
 #ifdef _MSC_VER
             outputStreams.push_back(new ofstream((outputPath + L"." + outputNodes[i]->NodeName()).c_str()));
 #else
@@ -152,36 +166,58 @@ public:
 
         size_t totalEpochSamples = 0;
         size_t numMBsRun = 0;
-        size_t tempArraySize = 0;
-        ElemType* tempArray = nullptr;
-
-        size_t actualMBSize;
-        while (DataReaderHelpers::GetMinibatchIntoNetwork(dataReader, m_net, nullptr, false, false, inputMatrices, actualMBSize))
+        std::vector<float> archiveFrames;
+
+        // the outputs of a minibatch are written while the next one is read and evaluated: its readbacks only wait for the
+        // device in writeOutputs(), after the next minibatch's evaluation has been issued (two sets, used alternately)
+        std::vector<std::unique_ptr<MatrixReadback<ElemType>>> readbacks[2];
+        for (auto& set : readbacks)
+            for (size_t i = 0; i < outputNodes.size(); i++)
+                set.push_back(std::unique_ptr<MatrixReadback<ElemType>>(new MatrixReadback<ElemType>()));
+        auto writeOutputs = [&](std::vector<std::unique_ptr<MatrixReadback<ElemType>>>& set)
         {
-            ComputationNetwork::BumpEvalTimeStamp(featureNodes);
-
             for (int i = 0; i < outputNodes.size(); i++)
             {
-                m_net->ForwardProp(outputNodes[i]);
-
-                Matrix<ElemType>& outputValues = dynamic_pointer_cast<ComputationNode<ElemType>>(outputNodes[i])->Value();
+                MatrixReadback<ElemType>& readback = *set[i];
+                const ElemType* pCurValue = readback.Wait();
+                if (archive)
+                {
+                    archiveFrames.assign(pCurValue, pCurValue + readback.GetNumElements());
+                    archiveWriters[i]->Write(archiveFrames.data(), readback.GetNumCols(), readback.GetNumRows());
+                    continue;
+                }
                 ofstream& outputStream = *outputStreams[i];
-                outputValues.CopyToArray(tempArray, tempArraySize);
-                ElemType* pCurValue = tempArray;
-                foreach_column (j, outputValues)
+                for (size_t j = 0; j < readback.GetNumCols(); j++)
                 {
-                    foreach_row (k, outputValues)
+                    for (size_t k = 0; k < readback.GetNumRows(); k++)
                     {
                         outputStream << *pCurValue++ << " ";
                     }
                     outputStream << endl;
                 }
             }
+        };
+
+        size_t actualMBSize;
+        while (DataReaderHelpers::GetMinibatchIntoNetwork(dataReader, m_net, nullptr, false, false, inputMatrices, actualMBSize))
+        {
+            ComputationNetwork::BumpEvalTimeStamp(featureNodes);
+
+            auto& current = readbacks[numMBsRun % 2];
+            for (int i = 0; i < outputNodes.size(); i++)
+            {
+                m_net->ForwardProp(outputNodes[i]);
+                current[i]->Start(dynamic_pointer_cast<ComputationNode<ElemType>>(outputNodes[i])->Value());
+            }
+            if (numMBsRun > 0)
+                writeOutputs(readbacks[(numMBsRun - 1) % 2]);
 
             totalEpochSamples += actualMBSize;
 
             fprintf(stderr, "Minibatch[%lu]: ActualMBSize = %lu\n", ++numMBsRun, actualMBSize);
         }
+        if (numMBsRun > 0)
+            writeOutputs(readbacks[(numMBsRun - 1) % 2]);
 
         fprintf(stderr, "Total Samples Evaluated = %lu\n", totalEpochSamples);
 
@@ -191,8 +227,243 @@ public:
             outputStreams[i]->close();
             delete outputStreams[i];
         }
+        for (int i = 0; i < archiveWriters.size(); i++)
+        {
+            archiveWriters[i]->Close();
+            const wstring archivePath = outputPath + L"." + outputNodes[i]->NodeName();
+            FILE* scp = fopenOrDie(archivePath + L".scp", L"w");
+            if (totalEpochSamples > 0)
+                fprintfOrDie(scp, "%ls=%ls[0,%d]\n", outputNodes[i]->NodeName().c_str(), archivePath.c_str(), (int) totalEpochSamples - 1);
+            fcloseOrDie(scp);
+        }
+    }
+
+    // WriteOutputPipelined - like WriteOutput() above, but reading, evaluating and writing overlap
+    // A reader thread fetches minibatches into CPU memory, one thread per network evaluates them (the network given to the
+    // constructor, plus optional further copies of the model, for data-parallel evaluation), and the writer is called on
+    // this thread with CPU copies of the outputs, in the original order of the minibatches. At most maxMinibatchesInFlight
+    // minibatches are held between reading and writing, which bounds the memory.
+    void WriteOutputPipelined(IDataReader<ElemType>& dataReader, size_t mbSize, IDataWriter<ElemType>& dataWriter, const std::vector<std::wstring>& outputNodeNames,
+                              const std::vector<ComputationNetworkPtr>& replicas, size_t maxMinibatchesInFlight, size_t numOutputSamples = requestDataSize)
+    {
+        std::vector<ComputationNetworkPtr> nets(1, m_net);
+        nets.insert(nets.end(), replicas.begin(), replicas.end());
+
+        // the same output nodes for each network
+        std::vector<std::wstring> outputNames = outputNodeNames;
+        if (outputNames.empty())
+        {
+            if (m_verbosity > 0)
+                fprintf(stderr, "OutputNodeNames are not specified, using the default outputnodes.\n");
+            if (m_net->OutputNodes().size() == 0)
+                LogicError("There is no default output node specified in the network.");
+            for (const auto& node : m_net->OutputNodes())
+                outputNames.push_back(node->NodeName());
+        }
+        std::vector<std::vector<ComputationNodeBasePtr>> outputNodes(nets.size());
+        for (size_t n = 0; n < nets.size(); n++)
+        {
+            for (const auto& name : outputNames)
+                outputNodes[n].push_back(nets[n]->GetNodeFromName(name));
+            nets[n]->AllocateAllMatrices({}, outputNodes[n], nullptr);
+            nets[n]->StartEvaluateMinibatchLoop(outputNodes[n]);
+        }
+
+        // the reader fills CPU matrices of the same types as the input nodes' values
+        std::vector<ComputationNodeBasePtr> inputNodes = m_net->FeatureNodes();
+        inputNodes.insert(inputNodes.end(), m_net->LabelNodes().begin(), m_net->LabelNodes().end());
+
+        // a minibatch on its way through the pipeline
+        struct Minibatch
+        {
+            std::map<std::wstring, shared_ptr<Matrix<ElemType>>> inputs;  // [node name] as read, on the CPU
+            MBLayoutPtr pMBLayout;
+            std::map<std::wstring, shared_ptr<Matrix<ElemType>>> outputs; // [node name] as evaluated, copied to the CPU
+            size_t numSamples;
+        };
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::pair<size_t, shared_ptr<Minibatch>>> read;    // minibatches ready for evaluation, by index
+        std::map<size_t, shared_ptr<Minibatch>> evaluated;            // minibatches ready for writing, by index
+        size_t numRead = 0, numInFlight = 0;
+        bool readingDone = false;
+        std::exception_ptr failure; // first exception on any of the threads; stops all of them
+        maxMinibatchesInFlight = max(maxMinibatchesInFlight, nets.size() + 1);
+
+        dataReader.StartMinibatchLoop(mbSize, 0, numOutputSamples);
+        dataReader.SetNumParallelSequences(1);
+
+        std::thread reader([&]()
+        {
+            try
+            {
+                for (;;)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return numInFlight < maxMinibatchesInFlight || failure; });
+                        if (failure)
+                            return;
+                    }
+                    auto mb = make_shared<Minibatch>();
+                    std::map<std::wstring, Matrix<ElemType>*> inputMatrices;
+                    for (const auto& node : inputNodes)
+                    {
+                        const auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                        auto& input = mb->inputs[node->NodeName()];
+                        input = make_shared<Matrix<ElemType>>(0, 0, CPUDEVICE, value.GetMatrixType(), value.GetFormat());
+                        inputMatrices[node->NodeName()] = input.get();
+                    }
+                    const bool wasDataRead = dataReader.GetMinibatch(inputMatrices);
+                    if (wasDataRead)
+                    {
+                        mb->pMBLayout = make_shared<MBLayout>();
+                        dataReader.CopyMBLayoutTo(mb->pMBLayout);
+                        dataReader.DataEnd(endDataSentence);
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!wasDataRead)
+                    {
+                        readingDone = true;
+                        changed.notify_all();
+                        return;
+                    }
+                    read.push_back(make_pair(numRead++, mb));
+                    numInFlight++;
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                    failure = std::current_exception();
+                changed.notify_all();
+            }
+        });
+
+        std::vector<std::thread> evaluators;
+        for (size_t n = 0; n < nets.size(); n++)
+        {
+            evaluators.push_back(std::thread([&, n]()
+            {
+                try
+                {
+                    auto& net = nets[n];
+                    std::vector<std::unique_ptr<MatrixReadback<ElemType>>> readbacks; // [output] (dense ones)
+                    for (size_t i = 0; i < outputNodes[n].size(); i++)
+                        readbacks.push_back(std::unique_ptr<MatrixReadback<ElemType>>(new MatrixReadback<ElemType>()));
+                    for (;;)
+                    {
+                        std::pair<size_t, shared_ptr<Minibatch>> item;
+                        {
+                            std::unique_lock<std::mutex> lock(mutex);
+                            changed.wait(lock, [&]() { return !read.empty() || readingDone || failure; });
+                            if (failure || read.empty())
+                                return;
+                            item = read.front();
+                            read.pop_front();
+                        }
+                        auto& mb = *item.second;
+
+                        // move the inputs into the network's input nodes (deep copies, since the nodes keep their own matrices)
+                        std::vector<ComputationNodeBasePtr> netInputNodes;
+                        for (const auto& input : mb.inputs)
+                        {
+                            auto node = net->GetNodeFromName(input.first);
+                            auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                            input.second->TransferToDeviceIfNotThere(value.GetDeviceId(), true);
+                            value.SetValue(*input.second);
+                            netInputNodes.push_back(node);
+                        }
+                        mb.inputs.clear();
+                        net->GetMBLayoutPtr()->CopyFrom(mb.pMBLayout);
+                        for (const auto& node : netInputNodes)
+                            node->NotifyFunctionValuesMBSizeModified();
+                        mb.numSamples = net->DetermineActualMBSizeFromFeatures();
+                        ComputationNetwork::BumpEvalTimeStamp(netInputNodes);
+
+                        // (the copies of the dense outputs overlap with the evaluation of the next ones)
+                        for (size_t i = 0; i < outputNodes[n].size(); i++)
+                        {
+                            const auto& node = outputNodes[n][i];
+                            net->ForwardProp(node);
+                            const auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+                            if (value.GetMatrixType() == DENSE)
+                                readbacks[i]->Start(value);
+                            else
+                                mb.outputs[node->NodeName()] = make_shared<Matrix<ElemType>>(value, CPUDEVICE);
+                        }
+                        for (size_t i = 0; i < outputNodes[n].size(); i++)
+                        {
+                            const auto& node = outputNodes[n][i];
+                            if (dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value().GetMatrixType() != DENSE)
+                                continue;
+                            auto& readback = *readbacks[i];
+                            ElemType* values = const_cast<ElemType*>(readback.Wait()); // (copied by the constructor)
+                            mb.outputs[node->NodeName()] = make_shared<Matrix<ElemType>>(readback.GetNumRows(), readback.GetNumCols(), values, matrixFlagNormal, CPUDEVICE);
+                        }
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        evaluated[item.first] = item.second;
+                        changed.notify_all();
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!failure)
+                        failure = std::current_exception();
+                    changed.notify_all();
+                }
+            }));
+        }
+
+        // write the minibatches in order
+        size_t totalEpochSamples = 0;
+        size_t numEvaluators = nets.size();
+        size_t numWritten = 0;
+        try
+        {
+            for (;;)
+            {
+                shared_ptr<Minibatch> mb;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return evaluated.find(numWritten) != evaluated.end() || (readingDone && numWritten == numRead) || failure; });
+                    if (failure || evaluated.find(numWritten) == evaluated.end())
+                        break;
+                    mb = evaluated[numWritten];
+                    evaluated.erase(numWritten);
+                }
+                std::map<std::wstring, void*, nocase_compare> outputMatrices;
+                for (const auto& output : mb->outputs)
+                    outputMatrices[output.first] = (void*) output.second.get();
+                dataWriter.SaveData(0, outputMatrices, mb->numSamples, mb->numSamples, 0);
+                totalEpochSamples += mb->numSamples;
+                numWritten++;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                numInFlight--;
+                changed.notify_all();
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure)
+                failure = std::current_exception();
+            changed.notify_all();
+        }
 
-        delete[] tempArray;
+        reader.join();
+        for (auto& evaluator : evaluators)
+            evaluator.join();
+        if (failure)
+            std::rethrow_exception(failure);
+
+        if (m_verbosity > 0)
+            fprintf(stderr, "Total Samples Evaluated = %lu (%d minibatches, %d evaluators)\n", totalEpochSamples, (int) numWritten, (int) numEvaluators);
     }
 
 private:
@@ -0,0 +1,103 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+#pragma once
+
+#include "ComputationNetwork.h"
+#include "ComputationNode.h"
+#include "LinearAlgebraNodes.h"
+#include "Matrix.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace Microsoft { namespace MSR { namespace CNTK {
+
+// WeightPruner -- magnitude pruning of the weights of Times operations during training (SGD option pruneSparsity)
+// From epoch pruneStartEpoch on, the weights of smallest magnitude of each weight matrix are set to zero at the start of the epoch,
+// and kept at zero by masking them after every parameter update (ApplyMasks()). The fraction that is pruned grows to pruneSparsity
+// by pruneEndEpoch, quickly at first and then slowly (sparsity * (1 - (1 - progress)^3)), so that the remaining weights can adapt.
+// The masks are determined anew from the weights in each epoch; weights pruned before are zero and thus pruned again, so nothing
+// has to be kept in checkpoints. At inference, such weights can be used as sparse matrices (TimesNode::SparsifyWeights()).
+template <class ElemType>
+class WeightPruner
+{
+public:
+    // 'sparsity' is the final fraction of zeros; epochs are 1-based as in the log
+    WeightPruner(ComputationNetworkPtr net, const ComputationNodeBasePtr& criterionNode, double sparsity, int startEpoch, int endEpoch, int epoch)
+    {
+        if (sparsity <= 0 || epoch < startEpoch)
+            return;
+        endEpoch = max(endEpoch, startEpoch);
+        const double progress = min(1.0, (double) (epoch - startEpoch + 1) / (endEpoch - startEpoch + 1));
+        const double epochSparsity = sparsity * (1 - pow(1 - progress, 3));
+
+        // the weights (left operands that are learnable) of all Times and TransposeTimes operations
+        std::set<ComputationNodeBasePtr> weightNodes;
+        for (const auto& typeName : {OperationNameOf(TimesNode), OperationNameOf(TransposeTimesNode)})
+        {
+            for (const auto& node : net->GetNodesWithType(typeName, criterionNode))
+            {
+                const auto& weights = node->Input(0);
+                if (weights->OperationName() == OperationNameOf(LearnableParameter) && weights->IsParameterUpdateRequired())
+                    weightNodes.insert(weights);
+            }
+        }
+
+        size_t numPruned = 0, numWeights = 0;
+        for (const auto& node : weightNodes)
+        {
+            auto& value = dynamic_pointer_cast<ComputationNode<ElemType>>(node)->Value();
+            if (value.GetMatrixType() != DENSE || value.GetNumRows() == 1 || value.GetNumCols() == 1)
+                continue;
+            numWeights += value.GetNumElements();
+            numPruned += Prune(value, epochSparsity);
+        }
+        if (!m_masks.empty())
+            fprintf(stderr, "WeightPruner: Pruned %d of %d weights in %d matrices (%.1f%%, target %.1f%%).\n",
+                    (int) numPruned, (int) numWeights, (int) m_masks.size(), 100.0 * numPruned / numWeights, 100.0 * epochSparsity);
+    }
+
+    // keep the pruned weights at zero, after each parameter update
+    void ApplyMasks()
+    {
+        for (auto& mask : m_masks)
+            mask.first->ElementMultiplyWith(*mask.second);
+    }
+
+private:
+    // set the 'sparsity' fraction of the weights of smallest magnitude to zero and remember them; returns the number of zeros
+    size_t Prune(Matrix<ElemType>& value, double sparsity)
+    {
+        const size_t numRows = value.GetNumRows(), numCols = value.GetNumCols(), numElements = value.GetNumElements();
+        const size_t numToPrune = (size_t) (sparsity * numElements);
+        if (numToPrune == 0)
+            return 0;
+        std::vector<ElemType> values(numElements);
+        value.CopySection(numRows, numCols, values.data(), numRows);
+        std::vector<ElemType> magnitudes(numElements);
+        for (size_t i = 0; i < numElements; i++)
+            magnitudes[i] = fabs(values[i]);
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + (numToPrune - 1), magnitudes.end());
+        const ElemType threshold = magnitudes[numToPrune - 1];
+
+        // (ties at the threshold are pruned, too, and so are weights that are zero already)
+        size_t numZeros = 0;
+        for (size_t i = 0; i < numElements; i++)
+        {
+            values[i] = (fabs(values[i]) > threshold) ? 1 : 0;
+            numZeros += values[i] == 0;
+        }
+        auto mask = make_shared<Matrix<ElemType>>(numRows, numCols, values.data(), matrixFlagNormal, value.GetDeviceId());
+        value.ElementMultiplyWith(*mask);
+        m_masks.push_back(make_pair(&value, mask));
+        return numZeros;
+    }
+
+    std::vector<std::pair<Matrix<ElemType>*, shared_ptr<Matrix<ElemType>>>> m_masks; // [parameter value, 0/1 mask]
+};
+
+} } }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <exception>
 #include <unordered_map>
 #include "simplesenonehmm.h"
 #include "latticearchive.h"
@@ -36,7 +37,7 @@ class GammaCalculation
 
 public:
     GammaCalculation()
-        : cpumode(false)
+        : cpumode(false), m_intermediateCUDACopyBufferSize(0), m_hostMinibatchBufferSize(0)
     {
         initialmark = false;
         lmf = 7.0f; // Note that 9 was best for Fisher  --these should best be configurable
@@ -97,7 +98,6 @@ public:
     {
         // check total frame number to be added ?
         // int deviceid = loglikelihood.GetDeviceId();
-        size_t boundaryframenum;
         std::vector<size_t> validframes; // [s] cursor pointing to next utterance begin within a single parallel sequence [s]
         validframes.assign(samplesInRecurrentStep, 0);
         ElemType objectValue = 0.0;
@@ -116,6 +116,14 @@ public:
         if (doreferencealign)
             labels.SetValue((ElemType)(0.0f));
 
+        // On the GPU, the log-likelihoods, alignments and gammas stay on the device; only the CPU computation and the
+        // reference alignment (done on the CPU) need the log-likelihoods on the host. Then bring those of all utterances
+        // to the CPU side in a single transfer, rather than one (synchronizing) copy per utterance.
+        const bool hostloglls = (m_deviceid == CPUDEVICE) || doreferencealign;
+        const ElemType* hostloglikelihood = hostloglls ? CopyMinibatchToHost(loglikelihood) : nullptr;
+        if (!hostloglls)
+            m_numeratorRows.assign(numcols, -1); // numerator scores are then summed up on the device, see DeviceNumeratorScore()
+
         size_t T = numcols / samplesInRecurrentStep; // number of time steps in minibatch
         if (samplesInRecurrentStep > 1)
         {
@@ -123,100 +131,91 @@ public:
             assert(T == pMBLayout->GetNumTimeSteps());
         }
 
-        size_t mapi = 0; // parallel-sequence index for utterance [i]
-        // cal gamma for each utterance
+        // locate each utterance in the minibatch
+        std::vector<UtteranceSlot> slots(lattices.size());
         size_t ts = 0;
         for (size_t i = 0; i < lattices.size(); i++)
         {
-            const size_t numframes = lattices[i]->getnumframes();
-
-            msra::dbn::matrixstripe predstripe(pred, ts, numframes);           // logLLs for this utterance
-            msra::dbn::matrixstripe dengammasstripe(dengammas, ts, numframes); // denominator gammas
-
+            auto& slot = slots[i];
+            slot.ts = ts;
+            slot.numframes = lattices[i]->getnumframes();
             if (samplesInRecurrentStep == 1) // no sequence parallelism
             {
-                tempmatrix = loglikelihood.ColumnSlice(ts, numframes);
-                // if (m_deviceid == CPUDEVICE)
-                {
-                    CopyFromCNTKMatrixToSSEMatrix(tempmatrix, numframes, predstripe);
-                }
-
-                if (m_deviceid != CPUDEVICE)
-                    parallellattice.setloglls(tempmatrix);
+                slot.mapi = 0;
+                slot.firstframe = ts;
             }
             else // multiple parallel sequences
             {
                 // get number of frames for the utterance
-                mapi = extrauttmap[i]; // parallel-sequence index; in case of >1 utterance within this parallel sequence, this is in order of concatenation
+                slot.mapi = extrauttmap[i]; // parallel-sequence index; in case of >1 utterance within this parallel sequence, this is in order of concatenation
+                slot.firstframe = validframes[slot.mapi];
 
                 // scan MBLayout for end of utterance
                 size_t mapframenum = SIZE_MAX; // duration of utterance [i] as determined from MBLayout
-                for (size_t t = validframes[mapi]; t < T; t++)
+                for (size_t t = slot.firstframe; t < T; t++)
                 {
                     // TODO: Adapt this to new MBLayout, m_sequences would be easier to work off.
-                    if (pMBLayout->IsEnd(mapi, t))
+                    if (pMBLayout->IsEnd(slot.mapi, t))
                     {
-                        mapframenum = t - validframes[mapi] + 1;
+                        mapframenum = t - slot.firstframe + 1;
                         break;
                     }
                 }
 
                 // must match the explicit information we get from the reader
-                if (numframes != mapframenum)
-                    LogicError("gammacalculation: IsEnd() not working, numframes (%d) vs. mapframenum (%d)", (int) numframes, (int) mapframenum);
-                assert(numframes == mapframenum);
+                if (slot.numframes != mapframenum)
+                    LogicError("gammacalculation: IsEnd() not working, numframes (%d) vs. mapframenum (%d)", (int) slot.numframes, (int) mapframenum);
+                assert(slot.numframes == mapframenum);
 
-                if (numframes > tempmatrix.GetNumCols())
-                    tempmatrix.Resize(numrows, numframes);
+                if (slot.numframes > tempmatrix.GetNumCols())
+                    tempmatrix.Resize(numrows, slot.numframes);
 
-                Microsoft::MSR::CNTK::Matrix<ElemType> loglikelihoodForCurrentParallelUtterance = loglikelihood.ColumnSlice(mapi + (validframes[mapi] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
-                tempmatrix.CopyColumnsStrided(loglikelihoodForCurrentParallelUtterance, numframes, samplesInRecurrentStep, 1);
+                validframes[slot.mapi] += slot.numframes; // advance the cursor within the parallel sequence
+            }
+            ts += slot.numframes;
+        }
 
-                // if (doreferencealign || m_deviceid == CPUDEVICE)
+        // cal gamma for each utterance
+        if (m_deviceid == CPUDEVICE)
+        {
+            // On the CPU, the lattices are independent of each other and only read shared state, so process them concurrently,
+            // each into its own stripe of 'dengammas'. Copying out the gammas is then done in order.
+            std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+            for (long i = 0; i < (long) lattices.size(); i++)
+            {
+                try
                 {
-                    CopyFromCNTKMatrixToSSEMatrix(tempmatrix, numframes, predstripe);
+                    ForwardBackwardUtterance(slots[i], *lattices[i], hostloglikelihood, numrows, samplesInRecurrentStep, uids, boundaries, doreferencealign, tempmatrix, loglikelihood);
                 }
-
-                if (m_deviceid != CPUDEVICE)
+                catch (...)
                 {
-                    parallellattice.setloglls(tempmatrix);
+#pragma omp critical
+                    if (!error)
+                        error = std::current_exception();
                 }
             }
-
-            array_ref<size_t> uidsstripe(&uids[ts], numframes);
-
-            if (doreferencealign)
-            {
-                boundaryframenum = numframes;
-            }
-            else
-                boundaryframenum = 0;
-            array_ref<size_t> boundariesstripe(&boundaries[ts], boundaryframenum);
-
-            double numavlogp = 0;
-            foreach_column (t, dengammasstripe) // we do not allocate memory for numgamma now, should be the same as numgammasstripe
-            {
-                const size_t s = uidsstripe[t];
-                numavlogp += predstripe(s, t) / amf;
-            }
-            numavlogp /= numframes;
-
-            // auto_timer dengammatimer;
-            double denavlogp = lattices[i]->second.forwardbackward(parallellattice,
-                                                                   (const msra::math::ssematrixbase&) predstripe, (const msra::asr::simplesenonehmm&) m_hset,
-                                                                   (msra::math::ssematrixbase&) dengammasstripe, (msra::math::ssematrixbase&) gammasbuffer /*empty, not used*/,
-                                                                   lmf, wp, amf, boostmmifactor, seqsMBRmode, uidsstripe, boundariesstripe);
-            objectValue += (ElemType)((numavlogp - denavlogp) * numframes);
+            if (error)
+                std::rethrow_exception(error);
+        }
+        for (size_t i = 0; i < lattices.size(); i++)
+        {
+            if (m_deviceid != CPUDEVICE) // on the GPU, the lattices share the state of 'parallellattice', so go one by one
+                ForwardBackwardUtterance(slots[i], *lattices[i], hostloglikelihood, numrows, samplesInRecurrentStep, uids, boundaries, doreferencealign, tempmatrix, loglikelihood);
+            const auto& slot = slots[i];
+            const size_t numframes = slot.numframes;
+            objectValue += (ElemType)((slot.numavlogp - slot.denavlogp) * numframes);
 
             if (samplesInRecurrentStep == 1)
             {
-                tempmatrix = gammafromlattice.ColumnSlice(ts, numframes);
+                tempmatrix = gammafromlattice.ColumnSlice(slot.ts, numframes);
             }
 
             // copy gamma to tempmatrix
             if (m_deviceid == CPUDEVICE)
             {
-                CopyFromSSEMatrixToCNTKMatrix(dengammas, numrows, numframes, tempmatrix, gammafromlattice.GetDeviceId());
+                msra::dbn::matrixstripe dengammasstripe(dengammas, slot.ts, numframes);
+                CopyFromSSEMatrixToCNTKMatrix(dengammasstripe, numrows, numframes, tempmatrix, gammafromlattice.GetDeviceId());
             }
             else
                 parallellattice.getgamma(tempmatrix);
@@ -224,7 +223,7 @@ public:
             // set gamma for multi channel
             if (samplesInRecurrentStep > 1)
             {
-                Microsoft::MSR::CNTK::Matrix<ElemType> gammaFromLatticeForCurrentParallelUtterance = gammafromlattice.ColumnSlice(mapi + (validframes[mapi] * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
+                Microsoft::MSR::CNTK::Matrix<ElemType> gammaFromLatticeForCurrentParallelUtterance = gammafromlattice.ColumnSlice(slot.mapi + (slot.firstframe * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
                 gammaFromLatticeForCurrentParallelUtterance.CopyColumnsStrided(tempmatrix, numframes, 1, samplesInRecurrentStep);
             }
 
@@ -232,55 +231,145 @@ public:
             {
                 for (size_t nframe = 0; nframe < numframes; nframe++)
                 {
-                    size_t uid = uidsstripe[nframe];
+                    size_t uid = uids[slot.ts + nframe];
                     if (samplesInRecurrentStep > 1)
-                        labels(uid, (nframe + validframes[mapi]) * samplesInRecurrentStep + mapi) = 1.0;
+                        labels(uid, (nframe + slot.firstframe) * samplesInRecurrentStep + slot.mapi) = 1.0;
                     else
-                        labels(uid, ts + nframe) = 1.0;
+                        labels(uid, slot.ts + nframe) = 1.0;
                 }
             }
-            if (samplesInRecurrentStep > 1)
-                validframes[mapi] += numframes; // advance the cursor within the parallel sequence
-            fprintf(stderr, "dengamma value %f\n", denavlogp);
-            ts += numframes;
+            fprintf(stderr, "dengamma value %f\n", slot.denavlogp);
         }
+        if (!hostloglls)
+            objectValue += DeviceNumeratorScore(loglikelihood) / amf;
         functionValues.SetValue(objectValue);
     }
 
 private:
+    // where an utterance's frames are in the minibatch, and the results of its forward-backward
+    struct UtteranceSlot
+    {
+        size_t ts;         // first frame in 'pred', 'dengammas', 'uids', and 'boundaries'
+        size_t numframes;
+        size_t mapi;       // parallel-sequence index
+        size_t firstframe; // first time step within the parallel sequence; frame t is minibatch column mapi + (firstframe + t) * samplesInRecurrentStep
+        double numavlogp;
+        double denavlogp;
+    };
+
+    // lattice forward-backward of one utterance into its stripe of 'dengammas' (CPU) or into 'parallellattice' (GPU)
+    // On the CPU, this is called concurrently for the utterances of a minibatch, and thus must not modify any shared members.
+    void ForwardBackwardUtterance(UtteranceSlot& slot, const msra::dbn::latticepair& lattice, const ElemType* hostloglikelihood, size_t numrows, size_t samplesInRecurrentStep,
+                                  std::vector<size_t>& uids, std::vector<size_t>& boundaries, bool doreferencealign,
+                                  Microsoft::MSR::CNTK::Matrix<ElemType>& tempmatrix, const Microsoft::MSR::CNTK::Matrix<ElemType>& loglikelihood)
+    {
+        const size_t numframes = slot.numframes;
+        msra::dbn::matrixstripe predstripe(pred, slot.ts, numframes);           // logLLs for this utterance
+        msra::dbn::matrixstripe dengammasstripe(dengammas, slot.ts, numframes); // denominator gammas
+
+        if (hostloglikelihood)
+            CopyFromHostBufferToSSEMatrix(hostloglikelihood, numrows, slot.mapi + (slot.firstframe * samplesInRecurrentStep), samplesInRecurrentStep, numframes, predstripe);
+
+        if (m_deviceid != CPUDEVICE)
+        {
+            if (samplesInRecurrentStep == 1) // no sequence parallelism
+                tempmatrix = loglikelihood.ColumnSlice(slot.ts, numframes);
+            else // multiple parallel sequences
+            {
+                Microsoft::MSR::CNTK::Matrix<ElemType> loglikelihoodForCurrentParallelUtterance = loglikelihood.ColumnSlice(slot.mapi + (slot.firstframe * samplesInRecurrentStep), ((numframes - 1) * samplesInRecurrentStep) + 1);
+                tempmatrix.CopyColumnsStrided(loglikelihoodForCurrentParallelUtterance, numframes, samplesInRecurrentStep, 1);
+            }
+            parallellattice.setloglls(tempmatrix);
+        }
+
+        array_ref<size_t> uidsstripe(&uids[slot.ts], numframes);
+        array_ref<size_t> boundariesstripe(&boundaries[slot.ts], doreferencealign ? numframes : 0);
+
+        slot.numavlogp = 0;
+        if (hostloglikelihood)
+        {
+            foreach_column (t, dengammasstripe) // we do not allocate memory for numgamma now, should be the same as numgammasstripe
+            {
+                const size_t s = uidsstripe[t];
+                slot.numavlogp += predstripe(s, t) / amf;
+            }
+            slot.numavlogp /= numframes;
+        }
+        else // remember where the numerator senones are; note that predstripe was not filled in, the GPU lattice code does not use it
+        {
+            for (size_t t = 0; t < numframes; t++)
+                m_numeratorRows[slot.mapi + (slot.firstframe + t) * samplesInRecurrentStep] = (int) uidsstripe[t];
+        }
+
+        // auto_timer dengammatimer;
+        // ('gammasbuffer' is only used by the sMBR error signal on the GPU, thus not shared among concurrent CPU calls)
+        slot.denavlogp = lattice.second.forwardbackward(parallellattice,
+                                                        (const msra::math::ssematrixbase&) predstripe, (const msra::asr::simplesenonehmm&) m_hset,
+                                                        (msra::math::ssematrixbase&) dengammasstripe, (msra::math::ssematrixbase&) gammasbuffer /*empty, not used*/,
+                                                        lmf, wp, amf, boostmmifactor, seqsMBRmode, uidsstripe, boundariesstripe);
+    }
+
+    // DeviceNumeratorScore - sum of loglikelihood(m_numeratorRows[j], j) over all columns j that have a numerator senone
+    // This runs on the device as the inner product with a sparse 0/1 matrix, so that only the index list goes to the GPU and a scalar comes back.
+    ElemType DeviceNumeratorScore(const Microsoft::MSR::CNTK::Matrix<ElemType>& loglikelihood)
+    {
+        std::vector<CPUSPARSE_INDEX_TYPE> colStarts(m_numeratorRows.size() + 1);
+        std::vector<CPUSPARSE_INDEX_TYPE> rows;
+        rows.reserve(m_numeratorRows.size());
+        for (size_t j = 0; j < m_numeratorRows.size(); j++)
+        {
+            colStarts[j] = (CPUSPARSE_INDEX_TYPE) rows.size();
+            if (m_numeratorRows[j] >= 0)
+                rows.push_back(m_numeratorRows[j]);
+        }
+        colStarts.back() = (CPUSPARSE_INDEX_TYPE) rows.size();
+        if (rows.empty())
+            return 0;
+
+        std::vector<ElemType> ones(rows.size(), 1);
+        Microsoft::MSR::CNTK::Matrix<ElemType> numeratorLabels(loglikelihood.GetNumRows(), loglikelihood.GetNumCols(), loglikelihood.GetDeviceId(),
+                                                                Microsoft::MSR::CNTK::MatrixType::SPARSE, Microsoft::MSR::CNTK::matrixFormatSparseCSC);
+        numeratorLabels.SetMatrixFromCSCFormat(colStarts.data(), rows.data(), ones.data(), rows.size(), loglikelihood.GetNumRows(), loglikelihood.GetNumCols());
+        return Microsoft::MSR::CNTK::Matrix<ElemType>::InnerProductOfMatrices(loglikelihood, numeratorLabels);
+    }
+
     // Helper methods for copying between ssematrix objects and CNTK matrices
-    void CopyFromCNTKMatrixToSSEMatrix(const Microsoft::MSR::CNTK::Matrix<ElemType>& src, size_t numCols, msra::math::ssematrixbase& dest)
+    // CopyMinibatchToHost - copy all columns of 'src' into the (pinned) host buffer, which stays valid until the next call
+    const ElemType* CopyMinibatchToHost(const Microsoft::MSR::CNTK::Matrix<ElemType>& src)
     {
         if (!std::is_same<ElemType, float>::value)
         {
             LogicError("Cannot copy between a SSE matrix and a non-float type CNTK Matrix object!");
         }
 
-        size_t numRows = src.GetNumRows();
-        const Microsoft::MSR::CNTK::Matrix<ElemType> srcSlice = src.ColumnSlice(0, numCols);
-        if ((m_intermediateCUDACopyBuffer == nullptr) || (m_intermediateCUDACopyBufferSize < srcSlice.GetNumElements()))
+        if ((m_hostMinibatchBuffer == nullptr) || (m_hostMinibatchBufferSize < src.GetNumElements()))
         {
-            m_intermediateCUDACopyBuffer = AllocateIntermediateBuffer(srcSlice.GetDeviceId(), srcSlice.GetNumElements());
-            m_intermediateCUDACopyBufferSize = srcSlice.GetNumElements();
+            m_hostMinibatchBuffer = AllocateIntermediateBuffer(src.GetDeviceId(), src.GetNumElements());
+            m_hostMinibatchBufferSize = src.GetNumElements();
         }
 
-        ElemType* pBuf = m_intermediateCUDACopyBuffer.get();
-        srcSlice.CopyToArray(pBuf, m_intermediateCUDACopyBufferSize);
-        if (pBuf != m_intermediateCUDACopyBuffer.get())
+        ElemType* pBuf = m_hostMinibatchBuffer.get();
+        src.CopyToArray(pBuf, m_hostMinibatchBufferSize);
+        if (pBuf != m_hostMinibatchBuffer.get())
         {
             LogicError("Unexpected re-allocation of destination CPU buffer in Matrix::CopyToArray!");
         }
+        return pBuf;
+    }
 
-        if ((dest.getcolstride() == dest.rows()) && (numRows == dest.rows()))
+    // copy the frames of one utterance out of the host copy of the minibatch; its frame t is column firstCol + t * colStride
+    void CopyFromHostBufferToSSEMatrix(const ElemType* src, size_t numRows, size_t firstCol, size_t colStride, size_t numCols, msra::math::ssematrixbase& dest)
+    {
+        if ((colStride == 1) && (dest.getcolstride() == dest.rows()) && (numRows == dest.rows()))
         {
-            memcpy(&dest(0, 0), (float*) pBuf, sizeof(ElemType) * numRows * numCols);
+            memcpy(&dest(0, 0), (const float*) (src + firstCol * numRows), sizeof(ElemType) * numRows * numCols);
         }
         else
         {
             // We need to copy columnwise
             for (size_t i = 0; i < numCols; ++i)
             {
-                memcpy(&dest(0, i), (float*) (pBuf + (i * numRows)), sizeof(ElemType) * numRows);
+                memcpy(&dest(0, i), (const float*) (src + (firstCol + i * colStride) * numRows), sizeof(ElemType) * numRows);
             }
         }
     }
@@ -378,5 +467,8 @@ private:
     std::unique_ptr<Microsoft::MSR::CNTK::CUDAPageLockedMemAllocator> m_cudaAllocator;
     std::shared_ptr<ElemType> m_intermediateCUDACopyBuffer;
     size_t m_intermediateCUDACopyBufferSize;
+    std::shared_ptr<ElemType> m_hostMinibatchBuffer; // log-likelihoods of the whole minibatch, see CopyMinibatchToHost()
+    size_t m_hostMinibatchBufferSize;
+    std::vector<int> m_numeratorRows; // [column] numerator senone of each minibatch column, or -1 (GPU mode only)
 };
 } }
@@ -910,10 +910,7 @@ void lattice::parallelsMBRerrorsignal(parallelstate& parallelstate, const edgeal
                                           logEframescorrecttotal,
                                           *parallelstate->errorsignalgpu.get(), *parallelstate->errorsignalneggpu.get());
 
-        if (errorsignal.rows() > 0 && errorsignal.cols() > 0)
-        {
-            parallelstate->errorsignalgpu->CopySection(errorsignal.rows(), errorsignal.cols(), &errorsignal(0, 0), errorsignal.getcolstride());
-        }
+        // the error signal stays on the GPU, where the caller picks it up with getgamma(); 'errorsignal' is not filled in
     }
     else
     {
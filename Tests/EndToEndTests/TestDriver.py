@@ -94,8 +94,23 @@
 # In practice, TestDriver performs 1 pass through the output of run-test performing a real-time 
 # matching against all test-cases/pattern simulteneously
 #
+# ----- Performance mode (--perf) ------
+# In addition to the checks above, measures for each test run:
+#   samplesPerSecond - median of the SamplesPerSecond of the minibatch log lines
+#   epochTime        - median of the EpochTime of the 'Finished Epoch' lines
+#   startupTime      - seconds from the start of run-test to the first 'Starting Epoch' line
+#   peakGpuMemoryMB  - (gpu only) the largest increase of the memory used on any GPU over its use before the test, polled with nvidia-smi
+# and compares them to the test's perf-baseline.yml, which holds one entry per flavor, device and machine type (the name of the
+# first GPU, or of the CPU), e.g.
+#   release gpu Tesla K40m:
+#     samplesPerSecond: 8747
+#     ...
+# A metric regresses if it is worse than its baseline by more than the tolerance (--perf-tolerance, unless the test's testcases.yml
+# sets perfTolerance), which fails the test. Entries are added or replaced with --update-perf-baseline.
+# Measurements are only comparable on otherwise idle machines, and in release builds.
+#
 
-import sys, os, argparse, traceback, yaml, subprocess, random, re, time, sets
+import sys, os, argparse, traceback, yaml, subprocess, random, re, time, sets, threading
 
 thisDir = os.path.dirname(os.path.realpath(__file__))
 windows = os.getenv("OS")=="Windows_NT"
@@ -126,6 +141,9 @@ class Test:
     else:
       self.dataDir = self.testDir
 
+    # optional tolerance of the performance mode, overriding --perf-tolerance
+    self.perfTolerance = self.rawYamlData.get("perfTolerance")
+
     # parsing test cases
     self.testCases = []
     if "testCases" in self.rawYamlData.keys():
@@ -247,6 +265,7 @@ class Test:
     allLines = []
     if args.verbose:
       print self.fullName + ":>" + logFile
+    perf = PerfMeasurement(device) if args.perf and not args.dry_run else None
     with open(logFile, "w") as output:
       cmdLine = ["bash", "-c", self.testDir + "/run-test 2>&1"]
       process = subprocess.Popen(cmdLine, stdout=subprocess.PIPE)
@@ -269,10 +288,14 @@ class Test:
         print >>output, line
         allLines.append(line)
         output.flush()
+        if perf:
+          perf.processLine(line)
         for testCaseRunResult in result.testCaseRunResults:
           testCaseRunResult.testCase.processLine(line, testCaseRunResult, args.verbose)
 
     exitCode = process.wait()
+    if perf:
+      perf.stop()
     success = True
 
     # saving log file path, so it can be reported later
@@ -308,8 +331,52 @@ class Test:
        with open(baselineFile, "w") as f:
          f.write("\n".join(allLines))
 
+    if perf and result.succeeded:
+      result.testCaseRunResults.append(self.checkPerformance(perf.metrics(), flavor, device, args))
+
     return result
 
+  # Compares the performance metrics of a run against the entry for this flavor, device and machine type in perf-baseline.yml,
+  # or (with --update-perf-baseline) stores them there
+  # returns an instance of TestCaseRunResult
+  def checkPerformance(self, metrics, flavor, device, args):
+    name = "Performance must not regress"
+    key = "{0} {1} {2}".format(flavor, device, machineType(device))
+    baselineFile = os.path.join(self.testDir, "perf-baseline.yml")
+    baselines = {}
+    if os.path.isfile(baselineFile):
+      with open(baselineFile, "r") as f:
+        baselines = yaml.safe_load(f.read()) or {}
+    measured = ", ".join("{0} = {1:.6g}".format(m, metrics[m]) for m in sorted(metrics.keys()))
+    if args.verbose:
+      print "Performance ({0}): {1}".format(key, measured)
+
+    if args.update_perf_baseline:
+      baselines[key] = dict((m, float("{0:.6g}".format(metrics[m]))) for m in metrics.keys())
+      with open(baselineFile, "w") as f:
+        yaml.safe_dump(baselines, f, default_flow_style=False)
+      return TestCaseRunResult(name, True, "Updated {0} in {1}: {2}".format(key, baselineFile, measured))
+
+    if not key in baselines:
+      # not a failure, since there cannot be baselines for every machine type
+      print "  No performance baseline for '{0}' in {1} (measured {2}); use --update-perf-baseline to add one".format(key, baselineFile, measured)
+      return TestCaseRunResult(name, True)
+
+    tolerance = self.perfTolerance if self.perfTolerance != None else args.perf_tolerance
+    regressions = []
+    for metric, baseline in sorted(baselines[key].items()):
+      if not metric in metrics:
+        regressions.append("{0} was not measured (baseline {1:.6g})".format(metric, baseline))
+        continue
+      actual = metrics[metric]
+      higherIsBetter = metric == "samplesPerSecond"
+      regressed = actual < baseline * (1 - tolerance / 100.0) if higherIsBetter else actual > baseline * (1 + tolerance / 100.0)
+      if regressed:
+        regressions.append("{0} = {1:.6g}, baseline {2:.6g} ({3:+.1f}%, tolerance {4}%)".format(metric, actual, baseline, (actual / baseline - 1) * 100 if baseline else 0, tolerance))
+    if len(regressions) > 0:
+      return TestCaseRunResult(name, False, "Regressed against {0} for '{1}':\n".format(baselineFile, key) + "\n".join(regressions))
+    return TestCaseRunResult(name, True)
+
   # Finds a location of a baseline file by probing different names in the following order:
   #   baseline.$os.$flavor.$device.txt
   #   baseline.$os.$flavor.txt
@@ -499,6 +566,91 @@ class TestPattern:
         return False;
     return True
 
+# Measures the performance of one test run from its output, and for gpu runs, the GPU memory it uses
+class PerfMeasurement:
+  samplesPerSecondRegex = re.compile(r"Epoch\[ *\d+ of \d+\]-Minibatch\[.*SamplesPerSecond = ([0-9.eE+-]+)")
+  epochTimeRegex = re.compile(r"^(?:MPI Rank \d+: )?Finished Epoch\[ *\d+ of \d+\]: \[Training Set\].*EpochTime=([0-9.eE+-]+)")
+  startingEpochRegex = re.compile(r"^(?:MPI Rank \d+: )?Starting Epoch \d+")
+
+  def __init__(self, device):
+    self.startTime = time.time()
+    self.startupTime = None
+    self.samplesPerSecond = []
+    self.epochTimes = []
+    self.peakGpuMemoryMB = None
+    self.stopping = threading.Event()
+    self.poller = None
+    if device == "gpu":
+      self.initialGpuMemoryMB = queryGpuMemoryUsedMB()
+      if self.initialGpuMemoryMB:
+        self.peakGpuMemoryMB = 0
+        self.poller = threading.Thread(target=self.pollGpuMemory)
+        self.poller.daemon = True
+        self.poller.start()
+
+  def pollGpuMemory(self):
+    while not self.stopping.wait(0.5):
+      used = queryGpuMemoryUsedMB()
+      if used and len(used) == len(self.initialGpuMemoryMB):
+        self.peakGpuMemoryMB = max([self.peakGpuMemoryMB] + [u - i for u, i in zip(used, self.initialGpuMemoryMB)])
+
+  def processLine(self, line):
+    if self.startupTime == None and PerfMeasurement.startingEpochRegex.match(line):
+      self.startupTime = time.time() - self.startTime
+    match = PerfMeasurement.samplesPerSecondRegex.search(line)
+    if match:
+      self.samplesPerSecond.append(float(match.group(1)))
+    match = PerfMeasurement.epochTimeRegex.search(line)
+    if match:
+      self.epochTimes.append(float(match.group(1)))
+
+  def stop(self):
+    self.stopping.set()
+    if self.poller:
+      self.poller.join()
+
+  # returns a dictionary of the metrics that were measured
+  def metrics(self):
+    result = {}
+    if len(self.samplesPerSecond) > 0:
+      result["samplesPerSecond"] = median(self.samplesPerSecond)
+    if len(self.epochTimes) > 0:
+      result["epochTime"] = median(self.epochTimes)
+    if self.startupTime != None:
+      result["startupTime"] = self.startupTime
+    if self.peakGpuMemoryMB != None:
+      result["peakGpuMemoryMB"] = self.peakGpuMemoryMB
+    return result
+
+def median(values):
+  values = sorted(values)
+  return values[len(values) // 2] if len(values) % 2 == 1 else (values[len(values) // 2 - 1] + values[len(values) // 2]) / 2.0
+
+# memory used on each GPU in MB, or None if nvidia-smi is not available
+def queryGpuMemoryUsedMB():
+  try:
+    output = subprocess.check_output(["nvidia-smi", "--query-gpu=memory.used", "--format=csv,noheader,nounits"])
+    return [int(line.strip()) for line in output.split("\n") if line.strip()]
+  except Exception:
+    return None
+
+# name of the machine type the performance baselines are kept for: the first GPU's, or the CPU's
+def machineType(device):
+  try:
+    if device == "gpu":
+      output = subprocess.check_output(["nvidia-smi", "--query-gpu=name", "--format=csv,noheader"])
+      return output.split("\n")[0].strip()
+    elif windows:
+      return os.getenv("PROCESSOR_IDENTIFIER", "unknown cpu").strip()
+    else:
+      with open("/proc/cpuinfo", "r") as f:
+        for line in f:
+          if line.startswith("model name"):
+            return " ".join(line.split(":", 1)[1].split())
+  except Exception:
+    pass
+  return "unknown " + device
+
 class TestRunResult:
   def __init__(self):
     self.succeeded = False;
@@ -565,6 +717,8 @@ def runCommand(args):
   print "Devices:        ", " ".join(devices)
   if (args.update_baseline):
     print "*** Running in automatic baseline update mode ***"
+  if (args.perf):
+    print "*** Running in performance mode, tolerance {0}% ***".format(args.perf_tolerance)
   print ""
   if args.dry_run:
     os.environ["DRY_RUN"] = "1"
@@ -646,6 +800,9 @@ runSubparser.add_argument("-r", "--run-dir", default=defaultRunDir, help="direct
 runSubparser.add_argument("--update-baseline", action='store_true', help="update baseline file(s) instead of matching them")
 runSubparser.add_argument("-v", "--verbose", action='store_true', help="verbose output - dump all output of test script")
 runSubparser.add_argument("-n", "--dry-run", action='store_true', help="do not run the tests, only print test names and configurations to be run along with full command lines")
+runSubparser.add_argument("--perf", action='store_true', help="also measure samples/sec, epoch time, startup time and peak GPU memory, and fail on regressions against perf-baseline.yml")
+runSubparser.add_argument("--perf-tolerance", type=float, default=10, help="regression tolerance of --perf in percent, default: 10")
+runSubparser.add_argument("--update-perf-baseline", action='store_true', help="store the performance of this machine type in perf-baseline.yml (implies --perf)")
 
 runSubparser.set_defaults(func=runCommand)
 
@@ -664,6 +821,9 @@ if len(sys.argv)==1:
 
 args = parser.parse_args(sys.argv[1:])
 
+if args.func == runCommand and args.update_perf_baseline:
+  args.perf = True
+
 # parsing a --device, --flavor and --os options:
 args.devices = ["cpu", "gpu"]
 if (args.device):
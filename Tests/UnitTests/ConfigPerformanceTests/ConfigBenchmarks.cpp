@@ -0,0 +1,196 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// ConfigBenchmarks.cpp -- startup-time benchmark of reading configurations: the legacy config parser, and BrainScript parsing and evaluation
+//
+// Usage: configbenchmarks [-sections N] [-minSeconds S] [-config file.cntk] [-brainScript file.bs]
+// Without -config/-brainScript, it generates a configuration with N sections (and a BrainScript macro library
+// with N macros) in the temp directory, roughly like a large config with all its included macro libraries.
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "Config.h"
+#include "ScriptableObjects.h"
+#include "BrainScriptEvaluator.h"
+#include "BrainScriptParser.h"
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::MSR::CNTK;
+using namespace Microsoft::MSR::ScriptableObjects;
+using namespace std;
+
+// time 'body' after a warm-up call, repeating it until 'minSeconds' have passed
+static void Run(const string& name, double minSeconds, const function<void()>& body)
+{
+    body(); // warm-up: file cache
+    size_t numIterations = 0;
+    auto start = chrono::steady_clock::now();
+    double seconds = 0;
+    while (seconds < minSeconds)
+    {
+        body();
+        numIterations++;
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    fprintf(stderr, "%-40s %12.3f\n", name.c_str(), 1e3 * seconds / numIterations);
+}
+
+static void WriteFile(const string& path, const string& text)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        RuntimeError("Cannot create %s.", path.c_str());
+    fputs(text.c_str(), f);
+    if (fclose(f) != 0)
+        RuntimeError("Error writing %s.", path.c_str());
+}
+
+static string TempPath(const char* name)
+{
+#ifdef _WIN32
+    const char* dir = getenv("TEMP");
+#else
+    const char* dir = getenv("TMPDIR");
+#endif
+    return string(dir ? dir : ".") + "/" + name;
+}
+
+// a legacy config with 'numSections' commands that use $variables$ and nested blocks
+static string GenerateConfig(size_t numSections)
+{
+    string config = "root=/data\nmodelDir=$root$/models\n";
+    for (size_t i = 0; i < numSections; i++)
+    {
+        config += msra::strfun::strprintf(
+            "section%d=[\n"
+            "    action=train\n"
+            "    modelPath=$modelDir$/model%d.dnn\n"
+            "    deviceId=auto\n"
+            "    SGD=[\n"
+            "        epochSize=0\n"
+            "        minibatchSize=256:512\n"
+            "        learningRatesPerMB=0.8*2:0.2   # per minibatch\n"
+            "        momentumPerMB=0.9*2:0.99\n"
+            "    ]\n"
+            "    reader=[\n"
+            "        readerType=HTKMLFReader\n"
+            "        features=[ dim=363 ; scpFile=$root$/glob_%d.scp ]\n"
+            "        labels=[ mlfFile=$root$/glob.mlf ; labelDim=132 ]\n"
+            "    ]\n"
+            "]\n",
+            (int) i, (int) i, (int) i);
+    }
+    return config;
+}
+
+// a BrainScript macro library with 'numMacros' macros, and a record 'r' that uses all of them
+static string GenerateBrainScript(size_t numMacros)
+{
+    string script = "Sq(x) = x * x\nAdd3(a, b, c) = a + b + c\n";
+    for (size_t i = 0; i < numMacros; i++)
+        script += msra::strfun::strprintf("M%d(x, y = %d) = [ u = Sq(x) + y ; v = Add3(u, x, %d) ; w = if v > 10 then v - 10 else v ; s = 'name%d' + '.txt' ]\n", (int) i, (int) i, (int) i, (int) i);
+    script += "r = [\n";
+    for (size_t i = 0; i < numMacros; i++)
+        script += msra::strfun::strprintf("    e%d = M%d(%d).w\n", (int) i, (int) i, (int) (i % 7));
+    script += "]\n";
+    return script;
+}
+
+// read all members, recursively, the way the actions do
+static size_t ReadAll(const ConfigParameters& config, size_t depth)
+{
+    size_t numValues = 0;
+    for (const auto& id : config.GetMemberIds())
+    {
+        const string value = config(id);
+        numValues++;
+        if (depth < 3 && !value.empty() && value[0] == '[')
+        {
+            const ConfigParameters& member = config(id);
+            numValues += ReadAll(member, depth + 1);
+        }
+    }
+    return numValues;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        size_t numSections = 2000;
+        double minSeconds = 1;
+        string configPath, brainScriptPath;
+        for (int i = 1; i < argc; i++)
+        {
+            const string arg = argv[i];
+            if (i + 1 >= argc)
+                InvalidArgument("Missing value for %s.", arg.c_str());
+            const char* value = argv[++i];
+            if (arg == "-sections")
+                numSections = (size_t) atoi(value);
+            else if (arg == "-minSeconds")
+                minSeconds = atof(value);
+            else if (arg == "-config")
+                configPath = value;
+            else if (arg == "-brainScript")
+                brainScriptPath = value;
+            else
+                InvalidArgument("Unknown option %s.", arg.c_str());
+        }
+        if (configPath.empty())
+        {
+            configPath = TempPath("configbenchmarks.cntk");
+            WriteFile(configPath, GenerateConfig(numSections));
+        }
+        const bool generatedBrainScript = brainScriptPath.empty();
+        if (generatedBrainScript)
+        {
+            brainScriptPath = TempPath("configbenchmarks.bs");
+            WriteFile(brainScriptPath, GenerateBrainScript(numSections));
+        }
+
+        fprintf(stderr, "Config benchmarks on %s and %s\n\n", configPath.c_str(), brainScriptPath.c_str());
+        fprintf(stderr, "%-40s %12s\n", "benchmark", "ms/call");
+        const wstring wconfigPath = msra::strfun::utf16(configPath);
+        Run("config_load", minSeconds, [&]()
+            {
+                ConfigParameters config;
+                config.LoadConfigFile(wconfigPath);
+            });
+        Run("config_load_and_read_all", minSeconds, [&]()
+            {
+                ConfigParameters config;
+                config.LoadConfigFile(wconfigPath);
+                ReadAll(config, 0);
+            });
+
+        const wstring wbrainScriptPath = msra::strfun::utf16(brainScriptPath);
+        Run("brainscript_parse", minSeconds, [&]()
+            {
+                Microsoft::MSR::BS::ParseConfigDictFromFile(wbrainScriptPath, vector<wstring>());
+            });
+        if (generatedBrainScript) // (we only know what to evaluate in our own)
+        {
+            Run("brainscript_parse_and_evaluate", minSeconds, [&]()
+                {
+                    auto expr = Microsoft::MSR::BS::ParseConfigDictFromFile(wbrainScriptPath, vector<wstring>());
+                    auto record = dynamic_pointer_cast<IConfigRecord>(Microsoft::MSR::BS::EvaluateField(expr, L"r"));
+                    for (size_t i = 0; i < numSections; i++)
+                        (double) (*record)[msra::strfun::wstrprintf(L"e%d", (int) i)];
+                });
+        }
+        return 0;
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "EXCEPTION occurred: %s\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,387 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// MathBenchmarks.cpp -- micro-benchmarks of the Math kernels that dominate training, with comparison against a baseline
+//
+// Usage: mathbenchmarks [-device N] [-filter substring] [-minSeconds S] [-json results.json] [-baseline baseline.json] [-tolerance 0.1]
+// Results are printed as a table, and with -json saved in a format that serves as a -baseline of a later run.
+// A benchmark that is slower than its baseline by more than the tolerance is reported, and makes the exit code 1.
+// Baselines are only meaningful on the machine (and build) they were recorded on.
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "Matrix.h"
+#include "TensorView.h"
+#include "ConvolutionEngine.h"
+#include "MatrixQuantizerImpl.h"
+#include "QuantizedMatrix.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::MSR::CNTK;
+using namespace std;
+
+typedef float ElemType;
+
+struct BenchmarkResult
+{
+    string name;
+    double seconds; // per iteration
+    double gflops;  // per second
+    double gbytes;  // per second
+};
+
+class Benchmarks
+{
+    DEVICEID_TYPE m_deviceId;
+    string m_filter;
+    double m_minSeconds;
+
+public:
+    vector<BenchmarkResult> m_results;
+
+    Benchmarks(DEVICEID_TYPE deviceId, const string& filter, double minSeconds)
+        : m_deviceId(deviceId), m_filter(filter), m_minSeconds(minSeconds)
+    {
+    }
+
+    DEVICEID_TYPE DeviceId() const
+    {
+        return m_deviceId;
+    }
+
+    // time 'body' after a warm-up call, repeating it until m_minSeconds have passed
+    // flops and bytes are per call, the bytes being the minimum memory traffic (each input read once, each output written once).
+    void Run(const string& name, double flops, double bytes, const function<void()>& body)
+    {
+        if (name.find(m_filter) == string::npos)
+            return;
+        body(); // warm-up: first-touch allocation, cuBLAS handles, kernel loading
+
+        DeviceTimer timer(m_deviceId);
+        size_t numIterations = 0;
+        double seconds = 0;
+        for (size_t batch = 1; seconds < m_minSeconds; batch *= 2) // (batches, so that reading the timer does not serialize every call)
+        {
+            timer.Start();
+            for (size_t i = 0; i < batch; i++)
+                body();
+            timer.Stop();
+            seconds += timer.ElapsedSeconds();
+            numIterations += batch;
+        }
+
+        BenchmarkResult result;
+        result.name = name;
+        result.seconds = seconds / numIterations;
+        result.gflops = flops / result.seconds / 1e9;
+        result.gbytes = bytes / result.seconds / 1e9;
+        m_results.push_back(result);
+        fprintf(stderr, "%-40s %12.3f %10.2f %10.2f\n", name.c_str(), 1e6 * result.seconds, result.gflops, result.gbytes);
+    }
+};
+
+// -----------------------------------------------------------------------
+// the benchmarks
+// -----------------------------------------------------------------------
+
+static void BenchmarkGemm(Benchmarks& benchmarks)
+{
+    // (m, n, k) of c[m x n] = a[m x k] * b[k x n]; n is the minibatch size
+    // hidden layers of speech and text models, a large softmax output layer, and the single-sample case of evaluation
+    const size_t shapes[][3] = {{512, 256, 512}, {2048, 256, 2048}, {2048, 256, 440}, {9304, 256, 2048}, {4096, 1, 4096}};
+    for (const auto& shape : shapes)
+    {
+        const size_t m = shape[0], n = shape[1], k = shape[2];
+        const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+        Matrix<ElemType> a(m, k, deviceId), b(k, n, deviceId), c(m, n, deviceId);
+        a.SetUniformRandomValue(-1, 1, 1);
+        b.SetUniformRandomValue(-1, 1, 2);
+        const double flops = 2.0 * m * n * k;
+        const double bytes = sizeof(ElemType) * (double) (m * k + k * n + m * n);
+        benchmarks.Run(msra::strfun::strprintf("gemm_%dx%dx%d", (int) m, (int) n, (int) k), flops, bytes, [&]()
+                       {
+                           Matrix<ElemType>::MultiplyAndWeightedAdd(1, a, false, b, false, 0, c);
+                       });
+        // the weight gradient of the same layer: a += c * b'
+        benchmarks.Run(msra::strfun::strprintf("gemm_%dx%dx%d_tn", (int) m, (int) k, (int) n), flops, bytes, [&]()
+                       {
+                           Matrix<ElemType>::MultiplyAndWeightedAdd(1, c, false, b, true, 1, a);
+                       });
+    }
+}
+
+static void BenchmarkTensorOps(Benchmarks& benchmarks)
+{
+    const size_t rows = 2048, cols = 2048;
+    const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+    Matrix<ElemType> a(rows, cols, deviceId), b(rows, cols, deviceId), c(rows, cols, deviceId), bias(rows, 1, deviceId), sum(rows, 1, deviceId);
+    a.SetUniformRandomValue(-1, 1, 1);
+    b.SetUniformRandomValue(-1, 1, 2);
+    bias.SetUniformRandomValue(-1, 1, 3);
+    TensorView<ElemType> aT(a, TensorShape(rows, cols)), bT(b, TensorShape(rows, cols)), cT(c, TensorShape(rows, cols));
+    TensorView<ElemType> biasT(bias, TensorShape(rows, 1)), sumT(sum, TensorShape(rows, 1));
+    const double n = (double) rows * cols;
+    benchmarks.Run("tensor_sum", n, 3 * n * sizeof(ElemType), [&]()
+                   {
+                       cT.AssignSumOf(aT, bT);
+                   });
+    benchmarks.Run("tensor_sigmoid", n, 2 * n * sizeof(ElemType), [&]()
+                   {
+                       cT.AssignSigmoidOf(aT);
+                   });
+    benchmarks.Run("tensor_add_bias", n, 2 * n * sizeof(ElemType), [&]()
+                   {
+                       cT.AssignSumOf(aT, biasT); // (broadcasting)
+                   });
+    benchmarks.Run("tensor_reduce_rows", n, n * sizeof(ElemType), [&]()
+                   {
+                       sumT.AssignCopyOf(aT); // (reduction, as for the bias gradient)
+                   });
+}
+
+static void BenchmarkSoftmax(Benchmarks& benchmarks)
+{
+    const size_t rows = 9304, cols = 256;
+    const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+    Matrix<ElemType> a(rows, cols, deviceId), c(rows, cols, deviceId);
+    a.SetUniformRandomValue(-5, 5, 1);
+    const double n = (double) rows * cols;
+    benchmarks.Run("log_softmax_9304x256", 4 * n, 2 * n * sizeof(ElemType), [&]()
+                   {
+                       c.AssignLogSoftmaxOf(a, true);
+                   });
+}
+
+static void BenchmarkSparseDense(Benchmarks& benchmarks)
+{
+    // a one-hot-like sparse input layer: c[512 x 256] = w[512 x 100000] * s[100000 x 256] with 20 non-zeros per column
+    const size_t rows = 512, inputDim = 100000, cols = 256, nzPerCol = 20;
+    const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+    vector<CPUSPARSE_INDEX_TYPE> colStarts(cols + 1), rowIndices(cols * nzPerCol);
+    vector<ElemType> values(cols * nzPerCol, 1);
+    for (size_t j = 0; j < cols; j++)
+    {
+        colStarts[j] = (CPUSPARSE_INDEX_TYPE) (j * nzPerCol);
+        for (size_t i = 0; i < nzPerCol; i++)
+            rowIndices[j * nzPerCol + i] = (CPUSPARSE_INDEX_TYPE) (i * (inputDim / nzPerCol) + (j * 7919) % (inputDim / nzPerCol)); // (ascending within a column)
+    }
+    colStarts[cols] = (CPUSPARSE_INDEX_TYPE) (cols * nzPerCol);
+    Matrix<ElemType> s(inputDim, cols, deviceId, MatrixType::SPARSE, matrixFormatSparseCSC);
+    s.SetMatrixFromCSCFormat(colStarts.data(), rowIndices.data(), values.data(), values.size(), inputDim, cols);
+    Matrix<ElemType> w(rows, inputDim, deviceId), c(rows, cols, deviceId), e(rows, cols, deviceId);
+    w.SetUniformRandomValue(-1, 1, 1);
+    e.SetUniformRandomValue(-1, 1, 2);
+    const double nz = (double) values.size();
+    benchmarks.Run("sparse_times_dense", 2 * rows * nz, sizeof(ElemType) * (rows * nz + rows * cols), [&]()
+                   {
+                       Matrix<ElemType>::MultiplyAndWeightedAdd(1, w, false, s, false, 0, c);
+                   });
+    // its weight gradient, which touches only the columns of w that occur in s
+    benchmarks.Run("dense_times_sparse_transposed", 2 * rows * nz, sizeof(ElemType) * (2 * rows * nz + rows * cols), [&]()
+                   {
+                       Matrix<ElemType>::MultiplyAndWeightedAdd(1, e, false, s, true, 1, w);
+                   });
+}
+
+static void BenchmarkConvolution(Benchmarks& benchmarks)
+{
+    typedef ConvolutionEngineFactory<ElemType> Factory;
+    const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+    const size_t inW = 32, inH = 32, inC = 64, kW = 3, kH = 3, outC = 64, n = 32;
+    for (auto engineType : {Factory::EngineType::Legacy, Factory::EngineType::CuDnn})
+    {
+        unique_ptr<Factory> factory;
+        try
+        {
+            factory = Factory::Create(deviceId, engineType, engineType == Factory::EngineType::CuDnn ? ImageLayoutKind::CHW : ImageLayoutKind::HWC);
+        }
+        catch (const exception&) // (e.g. cuDNN on the CPU, or in a build without it)
+        {
+            continue;
+        }
+        const string engineName = engineType == Factory::EngineType::CuDnn ? "cudnn" : "legacy";
+        auto engine = factory->CreateConvEngine(deviceId, 0);
+        auto inT = factory->CreateTensor(inW, inH, inC, n);
+        auto filterT = factory->CreateFilter(kW, kH, inC, outC);
+        auto outT = factory->CreateTensor(inW, inH, outC, n); // (padded, stride 1)
+        auto convT = factory->CreateConvDescriptor(*inT, *filterT, 1, 1, true);
+        Matrix<ElemType> in(inW * inH * inC, n, deviceId), filter(outC, kW * kH * inC, deviceId), out(inW * inH * outC, n, deviceId);
+        Matrix<ElemType> inGrad(inW * inH * inC, n, deviceId), filterGrad(outC, kW * kH * inC, deviceId), workspace(deviceId);
+        in.SetUniformRandomValue(-1, 1, 1);
+        filter.SetUniformRandomValue(-1, 1, 2);
+        out.SetUniformRandomValue(-1, 1, 3);
+        const double flops = 2.0 * inW * inH * outC * kW * kH * inC * n;
+        const double bytes = sizeof(ElemType) * (double) (in.GetNumElements() + filter.GetNumElements() + out.GetNumElements());
+        benchmarks.Run("conv_" + engineName + "_forward_32x32x64", flops, bytes, [&]()
+                       {
+                           engine->Forward(*inT, in, *filterT, filter, *convT, *outT, out, workspace);
+                       });
+        benchmarks.Run("conv_" + engineName + "_backward_data_32x32x64", flops, bytes, [&]()
+                       {
+                           engine->BackwardData(*outT, out, *filterT, filter, *convT, *inT, inGrad, workspace);
+                       });
+        benchmarks.Run("conv_" + engineName + "_backward_filter_32x32x64", flops, bytes, [&]()
+                       {
+                           engine->BackwardFilter(*outT, out, *inT, in, *convT, *filterT, filterGrad, true, workspace);
+                       });
+    }
+}
+
+static void BenchmarkQuantizers(Benchmarks& benchmarks)
+{
+    const size_t rows = 2048, cols = 2048;
+    const DEVICEID_TYPE deviceId = benchmarks.DeviceId();
+    unique_ptr<MatrixQuantizerImpl<ElemType>> quantizer(MatrixQuantizerImpl<ElemType>::Create(deviceId, false /*useAsync*/));
+    Matrix<ElemType> gradient(rows, cols, deviceId), residual(rows, cols, deviceId), result(rows, cols, deviceId);
+    gradient.SetUniformRandomValue(-1, 1, 1);
+    residual.SetValue(0);
+    const double n = (double) rows * cols;
+    for (size_t numBits : {1, 8})
+    {
+        QuantizedMatrix<ElemType> quantized(rows, cols, numBits, deviceId);
+        // reads gradient and residual, writes residual and the quantized values
+        benchmarks.Run(msra::strfun::strprintf("quantize_%dbit", (int) numBits), 0, sizeof(ElemType) * 3 * n + n * numBits / 8, [&]()
+                       {
+                           quantizer->QuantizeAsync(gradient, residual, quantized, residual, true);
+                           quantizer->WaitQuantizeAsyncDone();
+                       });
+        benchmarks.Run(msra::strfun::strprintf("unquantize_%dbit", (int) numBits), 0, sizeof(ElemType) * n + n * numBits / 8, [&]()
+                       {
+                           quantizer->UnquantizeAsync(quantized, result, false);
+                           quantizer->WaitUnquantizeAsyncDone();
+                       });
+    }
+}
+
+// -----------------------------------------------------------------------
+// results and baselines
+// -----------------------------------------------------------------------
+
+// one result per line, so that LoadBaseline() can read them back without a JSON parser
+static void SaveResults(const string& path, DEVICEID_TYPE deviceId, const vector<BenchmarkResult>& results)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+        RuntimeError("Cannot create %s.", path.c_str());
+    fprintf(f, "{\"device\":%d,\"results\":[\n", (int) deviceId);
+    for (size_t i = 0; i < results.size(); i++)
+        fprintf(f, "{\"name\":\"%s\",\"seconds\":%.9g,\"gflops\":%.3f,\"gbytes\":%.3f}%s\n",
+                results[i].name.c_str(), results[i].seconds, results[i].gflops, results[i].gbytes, i + 1 < results.size() ? "," : "");
+    fprintf(f, "]}\n");
+    if (fclose(f) != 0)
+        RuntimeError("Error writing %s.", path.c_str());
+}
+
+// name -> seconds, from a file written by SaveResults()
+static map<string, double> LoadBaseline(const string& path)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        RuntimeError("Cannot open baseline %s.", path.c_str());
+    map<string, double> baseline;
+    char line[1024];
+    while (fgets(line, sizeof(line), f))
+    {
+        char name[256];
+        double seconds;
+        if (sscanf(line, "{\"name\":\"%255[^\"]\",\"seconds\":%lf", name, &seconds) == 2)
+            baseline[name] = seconds;
+    }
+    fclose(f);
+    if (baseline.empty())
+        RuntimeError("Baseline %s contains no results.", path.c_str());
+    return baseline;
+}
+
+// returns the number of regressions
+static size_t CompareWithBaseline(const vector<BenchmarkResult>& results, const map<string, double>& baseline, double tolerance)
+{
+    size_t numRegressions = 0;
+    fprintf(stderr, "\n%-40s %12s %12s %8s\n", "comparison with baseline", "baseline us", "now us", "change");
+    for (const auto& result : results)
+    {
+        auto iter = baseline.find(result.name);
+        if (iter == baseline.end())
+        {
+            fprintf(stderr, "%-40s %12s %12.3f\n", result.name.c_str(), "(new)", 1e6 * result.seconds);
+            continue;
+        }
+        const double change = result.seconds / iter->second - 1;
+        const bool isRegression = change > tolerance;
+        fprintf(stderr, "%-40s %12.3f %12.3f %+7.1f%%%s\n", result.name.c_str(), 1e6 * iter->second, 1e6 * result.seconds, 100 * change, isRegression ? "  REGRESSION" : "");
+        if (isRegression)
+            numRegressions++;
+    }
+    return numRegressions;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        DEVICEID_TYPE deviceId = CPUDEVICE;
+        string filter, jsonPath, baselinePath;
+        double minSeconds = 0.5;
+        double tolerance = 0.1;
+        for (int i = 1; i < argc; i++)
+        {
+            const string arg = argv[i];
+            if (i + 1 >= argc)
+                InvalidArgument("Missing value for %s.", arg.c_str());
+            const char* value = argv[++i];
+            if (arg == "-device")
+                deviceId = (DEVICEID_TYPE) atoi(value);
+            else if (arg == "-filter")
+                filter = value;
+            else if (arg == "-minSeconds")
+                minSeconds = atof(value);
+            else if (arg == "-json")
+                jsonPath = value;
+            else if (arg == "-baseline")
+                baselinePath = value;
+            else if (arg == "-tolerance")
+                tolerance = atof(value);
+            else
+                InvalidArgument("Unknown option %s.", arg.c_str());
+        }
+        map<string, double> baseline;
+        if (!baselinePath.empty())
+            baseline = LoadBaseline(baselinePath); // (first, to fail early)
+
+        Benchmarks benchmarks(deviceId, filter, minSeconds);
+        fprintf(stderr, "Math benchmarks on %s\n\n", deviceId == CPUDEVICE ? "the CPU" : msra::strfun::strprintf("GPU %d", (int) deviceId).c_str());
+        fprintf(stderr, "%-40s %12s %10s %10s\n", "benchmark", "us/call", "GFLOP/s", "GB/s");
+        BenchmarkGemm(benchmarks);
+        BenchmarkTensorOps(benchmarks);
+        BenchmarkSoftmax(benchmarks);
+        BenchmarkSparseDense(benchmarks);
+        BenchmarkConvolution(benchmarks);
+        BenchmarkQuantizers(benchmarks);
+
+        if (!jsonPath.empty())
+            SaveResults(jsonPath, deviceId, benchmarks.m_results);
+        if (!baselinePath.empty())
+        {
+            size_t numRegressions = CompareWithBaseline(benchmarks.m_results, baseline, tolerance);
+            if (numRegressions > 0)
+            {
+                fprintf(stderr, "\n%d benchmarks are more than %.0f%% slower than the baseline.\n", (int) numRegressions, 100 * tolerance);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "EXCEPTION occurred: %s\n", e.what());
+        return 2;
+    }
+}
@@ -898,6 +898,107 @@ BOOST_FIXTURE_TEST_CASE(CPUMatrixSeedingDouble, RandomSeedFixture)
     BOOST_CHECK(m1.IsEqualTo(m2));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUMatrixFastMathApproximations, RandomSeedFixture)
+{
+    // odd sizes so that the scalar remainder loops of the vectorized kernels are exercised as well
+    SMatrix m0 = SMatrix::RandomUniform(37, 19, -5, 5, IncrementCounter());
+    SMatrix exact, fast;
+
+    SMatrix::SetUseFastMathApproximations(false);
+    exact.AssignSigmoidOf(m0);
+    SMatrix::SetUseFastMathApproximations(true);
+    fast.AssignSigmoidOf(m0);
+    BOOST_CHECK(fast.IsEqualTo(exact, c_epsilonFloatE5));
+
+    SMatrix::SetUseFastMathApproximations(false);
+    exact.AssignTanhOf(m0);
+    SMatrix::SetUseFastMathApproximations(true);
+    fast.AssignTanhOf(m0);
+    BOOST_CHECK(fast.IsEqualTo(exact, c_epsilonFloatE5));
+
+    SMatrix::SetUseFastMathApproximations(false);
+    exact.AssignExpOf(m0);
+    SMatrix::SetUseFastMathApproximations(true);
+    fast.AssignExpOf(m0);
+    BOOST_CHECK(fast.IsEqualTo(exact, c_epsilonFloatE3));
+
+    SMatrix::SetUseFastMathApproximations(false);
+    exact.AssignLogSoftmaxOf(m0, true);
+    SMatrix::SetUseFastMathApproximations(true);
+    fast.AssignLogSoftmaxOf(m0, true);
+    BOOST_CHECK(fast.IsEqualTo(exact, c_epsilonFloatE4));
+
+    SMatrix::SetUseFastMathApproximations(false);
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixTensorOpBroadcastAndReduction, RandomSeedFixture)
+{
+    // large enough to take the multithreaded and blocked code paths
+    const size_t rows = 700;
+    const size_t cols = 300;
+    SMatrix a = SMatrix::RandomUniform(rows, cols, -1, 1, IncrementCounter());
+    SMatrix b = SMatrix::RandomUniform(rows, 1, -1, 1, IncrementCounter());
+
+    // c = a + b, with b broadcast along the columns
+    SMatrix c(rows, cols);
+    SmallVector<size_t> regularOpDims;
+    regularOpDims.push_back(rows);
+    regularOpDims.push_back(cols);
+    std::array<SmallVector<ptrdiff_t>, 3> regularStrides;
+    for (auto& strides : regularStrides)
+    {
+        strides.push_back(1);
+        strides.push_back(rows);
+    }
+    regularStrides[1][1] = 0;
+    c.TensorOp(0, a, b, 1, ElementWiseOperator::opSum, std::array<size_t, 3>{0, 0, 0},
+               regularOpDims, regularStrides, SmallVector<size_t>(), std::array<SmallVector<ptrdiff_t>, 3>());
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            BOOST_CHECK(fabs(c(i, j) - (a(i, j) + b(i, 0))) < c_epsilonFloatE5);
+
+    // s = 0.5 * s + 2 * sum over columns of a .* c, as for a bias gradient
+    SMatrix s = SMatrix::RandomUniform(rows, 1, -1, 1, IncrementCounter());
+    SMatrix s0 = s;
+    SmallVector<size_t> rowOpDims;
+    rowOpDims.push_back(rows);
+    std::array<SmallVector<ptrdiff_t>, 3> rowStrides;
+    for (auto& strides : rowStrides)
+        strides.push_back(1);
+    SmallVector<size_t> reducingOpDims;
+    reducingOpDims.push_back(cols);
+    std::array<SmallVector<ptrdiff_t>, 3> reducingStrides;
+    for (auto& strides : reducingStrides)
+        strides.push_back(rows);
+    reducingStrides[2][0] = 0;
+    s.TensorOp(0.5f, a, c, 2, ElementWiseOperator::opElementwiseProduct, std::array<size_t, 3>{0, 0, 0},
+               rowOpDims, rowStrides, reducingOpDims, reducingStrides);
+    for (size_t i = 0; i < rows; i++)
+    {
+        double sum = 0;
+        for (size_t j = 0; j < cols; j++)
+            sum += a(i, j) * c(i, j);
+        BOOST_CHECK(fabs(s(i, 0) - (0.5 * s0(i, 0) + 2 * sum)) < c_epsilonFloatE3);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixObjectStorageIsRecycled, RandomSeedFixture)
+{
+    SMatrix m = SMatrix::RandomUniform(3, 10, -1, 1, IncrementCounter());
+
+    // the storage of a deleted matrix object is handed to the next one of the same type
+    SMatrix* slice = new SMatrix(m.ColumnSlice(0, 1));
+    const void* storage = slice;
+    delete slice;
+    for (size_t t = 1; t < m.GetNumCols(); t++)
+    {
+        slice = new SMatrix(m.ColumnSlice(t, 1));
+        BOOST_CHECK_EQUAL((const void*) slice, storage);
+        BOOST_CHECK_EQUAL((*slice)(2, 0), m(2, t));
+        delete slice;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
@@ -59,6 +59,127 @@ BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixCopyColumnSliceToDense, RandomSeedFixture
     BOOST_CHECK(dm1.IsEqualTo(dm2, c_epsilonFloatE4));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixSetMatrixFromCSCBuffer, RandomSeedFixture)
+{
+    // 3 x 4 matrix with columns {1 at row 0, 2 at row 2}, {}, {3 at row 1}, {4 at row 0}, in a buffer with room for 6 elements
+    const size_t numNZReserved = 6;
+    struct
+    {
+        double values[numNZReserved];
+        CPUSPARSE_INDEX_TYPE rows[numNZReserved];
+        CPUSPARSE_INDEX_TYPE colStarts[5];
+    } buffer = {{1, 2, 3, 4}, {0, 2, 1, 0}, {0, 2, 2, 3, 4}};
+
+    SparseMatrix sm(MatrixFormat::matrixFormatSparseCSC);
+    sm.SetMatrixFromCSCBuffer(&buffer, numNZReserved, 4, 3, 4);
+
+    DenseMatrix expected(3, 4);
+    expected.SetValue(0);
+    expected(0, 0) = 1;
+    expected(2, 0) = 2;
+    expected(1, 2) = 3;
+    expected(0, 3) = 4;
+
+    BOOST_CHECK_EQUAL(4, sm.NzCount());
+    BOOST_CHECK(expected.IsEqualTo(sm.CopyColumnSliceToDense(0, 4), c_epsilonFloatE4));
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixMultiplyWithDense, RandomSeedFixture)
+{
+    // sparse 3 x 4 weights as in the test above, times dense activations, in both orientations
+    const size_t numNZReserved = 6;
+    struct
+    {
+        double values[numNZReserved];
+        CPUSPARSE_INDEX_TYPE rows[numNZReserved];
+        CPUSPARSE_INDEX_TYPE colStarts[5];
+    } buffer = {{1, 2, 3, 4}, {0, 2, 1, 0}, {0, 2, 2, 3, 4}};
+    SparseMatrix sm(MatrixFormat::matrixFormatSparseCSC);
+    sm.SetMatrixFromCSCBuffer(&buffer, numNZReserved, 4, 3, 4);
+    DenseMatrix dense = sm.CopyColumnSliceToDense(0, 4);
+
+    DenseMatrix x(4, 5), y(3, 5);
+    x.SetUniformRandomValue(-1, 1, IncrementCounter());
+    y.SetUniformRandomValue(-1, 1, IncrementCounter());
+
+    DenseMatrix expected(3, 5), result(3, 5);
+    DenseMatrix::MultiplyAndWeightedAdd(1, dense, false, x, false, 0, expected);
+    SparseMatrix::MultiplyAndWeightedAdd(1, sm, false, x, false, 0, result);
+    BOOST_CHECK(expected.IsEqualTo(result, c_epsilonFloatE4));
+
+    // with accumulation into the previous result
+    DenseMatrix::MultiplyAndWeightedAdd(2, dense, false, x, false, 0.5, expected);
+    SparseMatrix::MultiplyAndWeightedAdd(2, sm, false, x, false, 0.5, result);
+    BOOST_CHECK(expected.IsEqualTo(result, c_epsilonFloatE4));
+
+    DenseMatrix expectedT(4, 5), resultT(4, 5);
+    DenseMatrix::MultiplyAndWeightedAdd(1, dense, true, y, false, 0, expectedT);
+    SparseMatrix::MultiplyAndWeightedAdd(1, sm, true, y, false, 0, resultT);
+    BOOST_CHECK(expectedT.IsEqualTo(resultT, c_epsilonFloatE4));
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixBlockColumns, RandomSeedFixture)
+{
+    // 2 x 5 block-col matrix with values in columns 3 and 1, as a sparse gradient of an embedding has them
+    const size_t m = 2;
+    const size_t n = 5;
+    const double values[] = {1, 2, 3, 4};
+    SparseMatrix sm(MatrixFormat::matrixFormatSparseBlockCol, m, n, 0);
+    sm.SetMatrixFromBlockColumns(std::vector<size_t>{3, 1}, values);
+
+    DenseMatrix expected(m, n);
+    expected.SetValue(0);
+    expected(0, 3) = 1;
+    expected(1, 3) = 2;
+    expected(0, 1) = 3;
+    expected(1, 1) = 4;
+
+    DenseMatrix dense(m, n);
+    dense.SetValue(0);
+    SparseMatrix::ScaleAndAdd(1, sm, dense);
+    BOOST_CHECK_EQUAL(4, sm.NzCount());
+    BOOST_CHECK(expected.IsEqualTo(dense, c_epsilonFloatE4));
+
+    std::vector<size_t> columnIds;
+    std::vector<double> result;
+    sm.GetBlockColumns(columnIds, result);
+    BOOST_CHECK(columnIds == (std::vector<size_t>{3, 1}));
+    BOOST_CHECK(result == (std::vector<double>(values, values + 4)));
+
+    // setting replaces the previous columns
+    sm.SetMatrixFromBlockColumns(std::vector<size_t>{0}, values);
+    expected.SetValue(0);
+    expected(0, 0) = 1;
+    expected(1, 0) = 2;
+    dense.SetValue(0);
+    SparseMatrix::ScaleAndAdd(1, sm, dense);
+    BOOST_CHECK_EQUAL(2, sm.NzCount());
+    BOOST_CHECK(expected.IsEqualTo(dense, c_epsilonFloatE4));
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUSparseMatrixGetCSCFormat, RandomSeedFixture)
+{
+    // 3 x 4 matrix [1 0 0 4; 0 2 0 0; 0 3 0 5]
+    const CPUSPARSE_INDEX_TYPE colStarts[] = {0, 1, 3, 3, 5};
+    const CPUSPARSE_INDEX_TYPE rows[] = {0, 1, 2, 0, 2};
+    const double values[] = {1, 2, 3, 4, 5};
+    SparseMatrix sm(MatrixFormat::matrixFormatSparseCSC);
+    sm.SetMatrixFromCSCFormat(colStarts, rows, values, 5, 3, 4);
+
+    std::vector<CPUSPARSE_INDEX_TYPE> resultColStarts, resultRows;
+    std::vector<double> resultValues;
+    sm.GetCSCFormat(resultColStarts, resultRows, resultValues);
+    BOOST_CHECK(resultColStarts == (std::vector<CPUSPARSE_INDEX_TYPE>(colStarts, colStarts + 5)));
+    BOOST_CHECK(resultRows == (std::vector<CPUSPARSE_INDEX_TYPE>(rows, rows + 5)));
+    BOOST_CHECK(resultValues == (std::vector<double>(values, values + 5)));
+
+    // a column slice comes back with column starts from 0
+    sm.ColumnSlice(1, 3).GetCSCFormat(resultColStarts, resultRows, resultValues);
+    BOOST_CHECK(resultColStarts == (std::vector<CPUSPARSE_INDEX_TYPE>{0, 2, 2, 4}));
+    BOOST_CHECK(resultRows == (std::vector<CPUSPARSE_INDEX_TYPE>{1, 2, 0, 2}));
+    BOOST_CHECK(resultValues == (std::vector<double>{2, 3, 4, 5}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
@@ -535,6 +535,336 @@ BOOST_AUTO_TEST_CASE(AvgPoolBackward)
     }
 }
 
+// The legacy engine uses a single GEMM (1x1), Winograd (3x3) and FFT (7x7) kernels for stride-1 convolutions on the CPU;
+// compare them with a direct implementation in the HWC layout.
+BOOST_FIXTURE_TEST_CASE(LegacyStrideOneConvolutionCpu, RandomSeedFixture)
+{
+    const int deviceId = CPUDEVICE;
+    const int n = 3;
+    const int cmapIn = 4;
+    const int cmapOut = 5;
+    const int inW = 11;
+    const int inH = 9;
+
+    for (int k : {1, 3, 7})
+    {
+        for (bool pad : {false, true})
+        {
+            const int outW = GetNumOut(inW, k, 1, pad);
+            const int outH = GetNumOut(inH, k, 1, pad);
+            const int padW = pad ? k / 2 : 0;
+            const int padH = pad ? k / 2 : 0;
+
+            auto fact = ConvFact::Create(deviceId, ConvFact::EngineType::Legacy, ImageLayoutKind::HWC);
+            auto eng = fact->CreateConvEngine(deviceId, 2); // two sub-batches
+            auto inT = fact->CreateTensor(inW, inH, cmapIn, n);
+            auto filtT = fact->CreateFilter(k, k, cmapIn, cmapOut);
+            auto outT = fact->CreateTensor(outW, outH, cmapOut, n);
+            auto convT = fact->CreateConvDescriptor(*inT, *filtT, 1, 1, pad);
+
+            SingleMatrix in = SingleMatrix::RandomUniform(inW * inH * cmapIn, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix filt = SingleMatrix::RandomUniform(cmapOut, k * k * cmapIn, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix srcGrad = SingleMatrix::RandomUniform(outW * outH * cmapOut, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix out(outW * outH * cmapOut, n, deviceId);
+            SingleMatrix grad = SingleMatrix::RandomUniform(inW * inH * cmapIn, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix temp(deviceId);
+
+            // direct convolution; BackwardData() adds to the gradient
+            SingleMatrix expOut(outW * outH * cmapOut, n, deviceId);
+            expOut.SetValue(0);
+            SingleMatrix expGrad(grad);
+            for (int s = 0; s < n; s++)
+                for (int oc = 0; oc < outW; oc++)
+                    for (int orow = 0; orow < outH; orow++)
+                        for (int m = 0; m < cmapOut; m++)
+                            for (int kc = 0; kc < k; kc++)
+                                for (int kr = 0; kr < k; kr++)
+                                {
+                                    const int row = orow + kr - padH;
+                                    const int col = oc + kc - padW;
+                                    if (row < 0 || row >= inH || col < 0 || col >= inW)
+                                        continue;
+                                    for (int c = 0; c < cmapIn; c++)
+                                    {
+                                        const float w = filt(m, c * k * k + kr + kc * k);
+                                        expOut(m + (orow + oc * outH) * cmapOut, s) += w * in(c + (row + col * inH) * cmapIn, s);
+                                        expGrad(c + (row + col * inH) * cmapIn, s) += w * srcGrad(m + (orow + oc * outH) * cmapOut, s);
+                                    }
+                                }
+
+            eng->Forward(*inT, in, *filtT, filt, *convT, *outT, out, temp);
+            BOOST_CHECK_MESSAGE(out.IsEqualTo(expOut, c_epsilonFloatE4), "Unexpected convolution output for kernel size " << k << ", padding " << pad << ".");
+
+            eng->BackwardData(*outT, srcGrad, *filtT, filt, *convT, *inT, grad, temp);
+            BOOST_CHECK_MESSAGE(grad.IsEqualTo(expGrad, c_epsilonFloatE4), "Unexpected input gradient for kernel size " << k << ", padding " << pad << ".");
+        }
+    }
+}
+
+// Pooling of the legacy engine on the CPU against the elementwise Matrix functions, with more channels than one tile of the kernels,
+// with overlapping windows, and for a backward pass whose output is not the one of the last forward pass.
+BOOST_FIXTURE_TEST_CASE(LegacyPoolingCpu, RandomSeedFixture)
+{
+    const int deviceId = CPUDEVICE;
+    const int n = 3;
+    const int cmap = 40;
+    const int inW = 9;
+    const int inH = 7;
+
+    for (int k : {2, 3})
+    {
+        for (auto kind : {PoolingDescriptor::PoolKind::Max, PoolingDescriptor::PoolKind::Average})
+        {
+            const int s = 2;
+            const int outW = GetNumOut(inW, k, s, false);
+            const int outH = GetNumOut(inH, k, s, false);
+            const bool isMax = kind == PoolingDescriptor::PoolKind::Max;
+
+            auto fact = ConvFact::Create(deviceId, ConvFact::EngineType::Legacy, ImageLayoutKind::HWC);
+            auto eng = fact->CreatePoolEngine(deviceId);
+            auto inT = fact->CreateTensor(inW, inH, cmap, n);
+            auto outT = fact->CreateTensor(outW, outH, cmap, n);
+            auto poolT = fact->CreatePoolDescriptor(kind, k, k, s, s, 0, 0);
+
+            SingleMatrix in = SingleMatrix::RandomUniform(inW * inH * cmap, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix srcGrad = SingleMatrix::RandomUniform(outW * outH * cmap, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix grad = SingleMatrix::RandomUniform(inW * inH * cmap, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix out(outW * outH * cmap, n, deviceId);
+
+            SingleMatrix expOut(deviceId);
+            SingleMatrix expGrad(grad);
+            if (isMax)
+            {
+                expOut.AssignMaxPoolingResult(in, cmap, inW, inH, inW * inH * cmap, outW, outH, outW * outH * cmap, k, k, s, s);
+                expGrad.AddMaxPoolingGradient(srcGrad, in, expOut, cmap, inW, inH, inW * inH * cmap, outW, outH, outW * outH * cmap, k, k, s, s);
+            }
+            else
+            {
+                expOut.AssignAveragePoolingResult(in, cmap, inW, inH, inW * inH * cmap, outW, outH, outW * outH * cmap, k, k, s, s);
+                expGrad.AddAveragePoolingGradient(srcGrad, cmap, inW, inH, inW * inH * cmap, outW, outH, outW * outH * cmap, k, k, s, s);
+            }
+
+            eng->Forward(*inT, in, *poolT, *outT, out);
+            BOOST_CHECK_MESSAGE(out.IsEqualTo(expOut, c_epsilonFloatE5), "Unexpected pooling output for window size " << k << ".");
+
+            SingleMatrix gradAfterForward(grad);
+            eng->Backward(*outT, out, srcGrad, *poolT, *inT, in, gradAfterForward);
+            BOOST_CHECK_MESSAGE(gradAfterForward.IsEqualTo(expGrad, c_epsilonFloatE5), "Unexpected pooling gradient for window size " << k << ".");
+
+            SingleMatrix otherOut(out);
+            eng->Backward(*outT, otherOut, srcGrad, *poolT, *inT, in, grad);
+            BOOST_CHECK_MESSAGE(grad.IsEqualTo(expGrad, c_epsilonFloatE5), "Unexpected pooling gradient without forward pass for window size " << k << ".");
+        }
+    }
+}
+
+// Batch normalization of the legacy engine, on the CPU, in both layouts: each channel of the output has mean 0 and variance 1
+// (for scale 1 and bias 0), inference with the minibatch statistics gives the same output, and the gradient of each channel sums to 0.
+BOOST_FIXTURE_TEST_CASE(LegacyBatchNormalizationCpu, RandomSeedFixture)
+{
+    const int deviceId = CPUDEVICE;
+    const int n = 5;
+    const int cmap = 3;
+    const int w = 4;
+    const int h = 2;
+    const int count = n * w * h;
+
+    for (auto layout : {ImageLayoutKind::HWC, ImageLayoutKind::CHW})
+    {
+        auto fact = ConvFact::Create(deviceId, ConvFact::EngineType::Legacy, ImageLayoutKind::HWC);
+        auto eng = fact->CreateConvEngine(deviceId, 0);
+        ConvolutionTensor4D inT(w, h, cmap, n, layout);
+        auto scaleBiasT = fact->CreateTensor(1, 1, cmap, 1);
+        auto index = [&](int c, int p)
+        {
+            return layout == ImageLayoutKind::CHW ? c * w * h + p : p * cmap + c;
+        };
+
+        SingleMatrix in = SingleMatrix::RandomUniform(w * h * cmap, n, -1, 3, IncrementCounter(), deviceId);
+        SingleMatrix scale(cmap, 1, deviceId);
+        scale.SetValue(1);
+        SingleMatrix bias(cmap, 1, deviceId);
+        bias.SetValue(0);
+        SingleMatrix runMean(cmap, 1, deviceId);
+        runMean.SetValue(0);
+        SingleMatrix runInvStdDev(cmap, 1, deviceId);
+        runInvStdDev.SetValue(1);
+        SingleMatrix out(w * h * cmap, n, deviceId);
+        SingleMatrix saveMean(cmap, 1, deviceId);
+        SingleMatrix saveInvStdDev(cmap, 1, deviceId);
+        eng->NormalizeBatch(inT, in, *scaleBiasT, scale, bias, true, 1.0, runMean, runInvStdDev, out, saveMean, saveInvStdDev);
+
+        for (int c = 0; c < cmap; c++)
+        {
+            double mean = 0, inMean = 0, sumSq = 0;
+            for (int s = 0; s < n; s++)
+                for (int p = 0; p < w * h; p++)
+                {
+                    mean += out(index(c, p), s) / count;
+                    inMean += in(index(c, p), s) / count;
+                    sumSq += out(index(c, p), s) * out(index(c, p), s);
+                }
+            BOOST_CHECK_SMALL(mean, 1e-5);
+            BOOST_CHECK_CLOSE(sumSq / count, 1.0, 1e-2);
+            BOOST_CHECK_SMALL(saveMean(c, 0) - inMean, 1e-5);
+            BOOST_CHECK_SMALL(runMean(c, 0) - inMean, 1e-5); // (expAvgFactor 1)
+        }
+
+        SingleMatrix inferred(w * h * cmap, n, deviceId);
+        eng->NormalizeBatchInference(inT, in, *scaleBiasT, scale, bias, true, saveMean, saveInvStdDev, inferred);
+        BOOST_CHECK(inferred.IsEqualTo(out, c_epsilonFloatE4));
+
+        SingleMatrix srcGrad = SingleMatrix::RandomUniform(w * h * cmap, n, -1, 1, IncrementCounter(), deviceId);
+        SingleMatrix grad(w * h * cmap, n, deviceId);
+        grad.SetValue(0);
+        SingleMatrix scaleGrad(cmap, 1, deviceId);
+        SingleMatrix biasGrad(cmap, 1, deviceId);
+        eng->BackwardNormalizeBatch(inT, in, srcGrad, grad, *scaleBiasT, scale, true, saveMean, saveInvStdDev, scaleGrad, biasGrad);
+        for (int c = 0; c < cmap; c++)
+        {
+            double gradSum = 0, srcGradSum = 0;
+            for (int s = 0; s < n; s++)
+                for (int p = 0; p < w * h; p++)
+                {
+                    gradSum += grad(index(c, p), s);
+                    srcGradSum += srcGrad(index(c, p), s);
+                }
+            BOOST_CHECK_SMALL(gradSum, 1e-4);
+            BOOST_CHECK_SMALL(biasGrad(c, 0) - srcGradSum, 1e-4);
+        }
+    }
+}
+
+// Batch statistics of the legacy engine against a two-pass reference in double, per element (not spatial) and per channel, for values
+// far from 0 (where E[x^2] - E[x]^2 would lose the variance), with a batch of more pixels than threads; then the gradients against
+// the reference formula.
+BOOST_FIXTURE_TEST_CASE(LegacyBatchNormalizationStatisticsCpu, RandomSeedFixture)
+{
+    const int deviceId = CPUDEVICE;
+    const int n = 37;
+    const int cmap = 3;
+    const int w = 5;
+    const int h = 3;
+
+    for (bool spatial : {false, true})
+    {
+        for (auto layout : {ImageLayoutKind::HWC, ImageLayoutKind::CHW})
+        {
+            auto fact = ConvFact::Create(deviceId, ConvFact::EngineType::Legacy, ImageLayoutKind::HWC);
+            auto eng = fact->CreateConvEngine(deviceId, 0);
+            ConvolutionTensor4D inT(w, h, cmap, n, layout);
+            const int numChannels = spatial ? cmap : w * h * cmap;
+            auto scaleBiasT = fact->CreateTensor(1, 1, numChannels, 1);
+            // the channel of each row of a sample
+            auto channel = [&](int row)
+            {
+                if (!spatial)
+                    return row;
+                return layout == ImageLayoutKind::CHW ? row / (w * h) : row % cmap;
+            };
+
+            SingleMatrix in = SingleMatrix::RandomUniform(w * h * cmap, n, 999, 1001, IncrementCounter(), deviceId);
+            SingleMatrix scale = SingleMatrix::RandomUniform(numChannels, 1, 0.5, 2, IncrementCounter(), deviceId);
+            SingleMatrix bias = SingleMatrix::RandomUniform(numChannels, 1, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix runMean(numChannels, 1, deviceId);
+            runMean.SetValue(0);
+            SingleMatrix runInvStdDev(numChannels, 1, deviceId);
+            runInvStdDev.SetValue(1);
+            SingleMatrix out(w * h * cmap, n, deviceId);
+            SingleMatrix saveMean(numChannels, 1, deviceId);
+            SingleMatrix saveInvStdDev(numChannels, 1, deviceId);
+            eng->NormalizeBatch(inT, in, *scaleBiasT, scale, bias, spatial, 0.25, runMean, runInvStdDev, out, saveMean, saveInvStdDev);
+
+            std::vector<double> mean(numChannels, 0), variance(numChannels, 0), count(numChannels, 0);
+            for (int s = 0; s < n; s++)
+                for (int r = 0; r < w * h * cmap; r++)
+                {
+                    mean[channel(r)] += in(r, s);
+                    count[channel(r)]++;
+                }
+            for (int c = 0; c < numChannels; c++)
+                mean[c] /= count[c];
+            for (int s = 0; s < n; s++)
+                for (int r = 0; r < w * h * cmap; r++)
+                    variance[channel(r)] += (in(r, s) - mean[channel(r)]) * (in(r, s) - mean[channel(r)]) / count[channel(r)];
+            for (int c = 0; c < numChannels; c++)
+            {
+                const double invStdDev = 1 / sqrt(variance[c] + 1e-5);
+                BOOST_CHECK_CLOSE(saveMean(c, 0), mean[c], 1e-4);
+                BOOST_CHECK_CLOSE(saveInvStdDev(c, 0), invStdDev, 1e-2);
+                BOOST_CHECK_CLOSE(runMean(c, 0), 0.25 * mean[c], 1e-4);
+                BOOST_CHECK_CLOSE(runInvStdDev(c, 0), 0.75 + 0.25 * invStdDev, 1e-2);
+            }
+            bool equal = true;
+            for (int s = 0; s < n; s++)
+                for (int r = 0; r < w * h * cmap; r++)
+                {
+                    const int c = channel(r);
+                    const double expected = scale(c, 0) * (in(r, s) - mean[c]) / sqrt(variance[c] + 1e-5) + bias(c, 0);
+                    equal = equal && fabs(out(r, s) - expected) < 1e-2;
+                }
+            BOOST_CHECK_MESSAGE(equal, "Unexpected batch normalization output (spatial = " << spatial << ").");
+
+            SingleMatrix srcGrad = SingleMatrix::RandomUniform(w * h * cmap, n, -1, 1, IncrementCounter(), deviceId);
+            SingleMatrix grad(w * h * cmap, n, deviceId);
+            grad.SetValue(1); // (added to)
+            SingleMatrix scaleGrad(numChannels, 1, deviceId);
+            SingleMatrix biasGrad(numChannels, 1, deviceId);
+            eng->BackwardNormalizeBatch(inT, in, srcGrad, grad, *scaleBiasT, scale, spatial, saveMean, saveInvStdDev, scaleGrad, biasGrad);
+            std::vector<double> dBias(numChannels, 0), dScale(numChannels, 0);
+            for (int s = 0; s < n; s++)
+                for (int r = 0; r < w * h * cmap; r++)
+                {
+                    const int c = channel(r);
+                    dBias[c] += srcGrad(r, s);
+                    dScale[c] += srcGrad(r, s) * (in(r, s) - saveMean(c, 0)) * saveInvStdDev(c, 0);
+                }
+            equal = true;
+            for (int c = 0; c < numChannels; c++)
+                equal = equal && fabs(biasGrad(c, 0) - dBias[c]) < 1e-3 && fabs(scaleGrad(c, 0) - dScale[c]) < 1e-3;
+            for (int s = 0; s < n; s++)
+                for (int r = 0; r < w * h * cmap; r++)
+                {
+                    const int c = channel(r);
+                    const double xHat = (in(r, s) - saveMean(c, 0)) * saveInvStdDev(c, 0);
+                    const double expected = 1 + scale(c, 0) * saveInvStdDev(c, 0) * (srcGrad(r, s) - (dBias[c] + xHat * dScale[c]) / count[c]);
+                    equal = equal && fabs(grad(r, s) - expected) < 1e-2;
+                }
+            BOOST_CHECK_MESSAGE(equal, "Unexpected batch normalization gradients (spatial = " << spatial << ").");
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(ConvertLayout, RandomSeedFixture)
+{
+    const int deviceId = CPUDEVICE;
+    const int n = 2;
+    const int cmap = 3;
+    const int w = 4;
+    const int h = 5;
+
+    ConvolutionTensor4D t(w, h, cmap, n);
+    SingleMatrix hwc = SingleMatrix::RandomUniform(w * h * cmap, n, -1, 1, IncrementCounter(), deviceId);
+    SingleMatrix chw(deviceId);
+    ConvFact::ConvertLayout(t, hwc, ImageLayoutKind::HWC, chw, ImageLayoutKind::CHW, false);
+
+    // HWC is [C x W x H], CHW is [W x H x C]
+    bool equal = true;
+    for (int s = 0; s < n; s++)
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                for (int c = 0; c < cmap; c++)
+                    equal = equal && chw(x + (y + c * h) * w, s) == hwc(c + (x + y * w) * cmap, s);
+    BOOST_CHECK_MESSAGE(equal, "Unexpected CHW layout.");
+
+    // the way back, adding to the destination
+    SingleMatrix twice(hwc);
+    ConvFact::ConvertLayout(t, chw, ImageLayoutKind::CHW, twice, ImageLayoutKind::HWC, true);
+    SingleMatrix expected(hwc);
+    SingleMatrix::Scale(2.0f, expected);
+    BOOST_CHECK(twice.IsEqualTo(expected, c_epsilonFloatE5));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
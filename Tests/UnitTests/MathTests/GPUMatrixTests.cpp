@@ -537,6 +537,61 @@ BOOST_FIXTURE_TEST_CASE(GPUMatrixCurandSeedingDouble, RandomSeedFixture)
     BOOST_CHECK(m1.IsEqualTo(m2));
 }
 
+BOOST_FIXTURE_TEST_CASE(GPUMatrixTensorOpSpecializedKernels, RandomSeedFixture)
+{
+    // odd sizes, so that the float4 kernel has a tail and the reduction a partial block
+    const size_t rows = 67;
+    const size_t cols = 45;
+    GPUMatrix<float> a = GPUMatrix<float>::RandomUniform(rows, cols, c_deviceIdZero, -1, 1, IncrementCounter());
+    GPUMatrix<float> b = GPUMatrix<float>::RandomUniform(rows, cols, c_deviceIdZero, -1, 1, IncrementCounter());
+    GPUMatrix<float> v = GPUMatrix<float>::RandomUniform(rows, 1, c_deviceIdZero, -1, 1, IncrementCounter());
+    unique_ptr<float[]> pa(a.CopyToArray());
+    unique_ptr<float[]> pb(b.CopyToArray());
+    unique_ptr<float[]> pv(v.CopyToArray());
+    const std::array<size_t, 3> offsets = {0, 0, 0};
+
+    // linear: c = a .* b over all elements
+    GPUMatrix<float> c(rows, cols, c_deviceIdZero);
+    SmallVector<size_t> linearOpDims;
+    linearOpDims.push_back(rows * cols);
+    std::array<SmallVector<ptrdiff_t>, 3> linearStrides;
+    for (auto& strides : linearStrides)
+        strides.push_back(1);
+    c.TensorOp(0, a, b, 1, ElementWiseOperator::opElementwiseProduct, offsets, linearOpDims, linearStrides, SmallVector<size_t>(), std::array<SmallVector<ptrdiff_t>, 3>());
+    unique_ptr<float[]> pc(c.CopyToArray());
+    for (size_t i = 0; i < rows * cols; i++)
+        BOOST_CHECK(fabs(pc[i] - pa[i] * pb[i]) < c_epsilonFloatE5);
+
+    // 2D: c = 2 * (a + v) + 0.5 * c, with v broadcast along the columns
+    SmallVector<size_t> matrixOpDims;
+    matrixOpDims.push_back(rows);
+    matrixOpDims.push_back(cols);
+    std::array<SmallVector<ptrdiff_t>, 3> matrixStrides;
+    for (auto& strides : matrixStrides)
+    {
+        strides.push_back(1);
+        strides.push_back(rows);
+    }
+    matrixStrides[1][1] = 0;
+    c.TensorOp(0.5f, a, v, 2, ElementWiseOperator::opSum, offsets, matrixOpDims, matrixStrides, SmallVector<size_t>(), std::array<SmallVector<ptrdiff_t>, 3>());
+    unique_ptr<float[]> pc2(c.CopyToArray());
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            BOOST_CHECK(fabs(pc2[i + j * rows] - (2 * (pa[i + j * rows] + pv[i]) + 0.5f * pc[i + j * rows])) < c_epsilonFloatE5);
+
+    // full reduction: s = 0.5 * s + sum of a .* b
+    GPUMatrix<float> s(1, 1, c_deviceIdZero);
+    s.SetValue(3);
+    std::array<SmallVector<ptrdiff_t>, 3> reducingStrides = linearStrides;
+    reducingStrides[2][0] = 0;
+    s.TensorOp(0.5f, a, b, 1, ElementWiseOperator::opElementwiseProduct, offsets, SmallVector<size_t>(), std::array<SmallVector<ptrdiff_t>, 3>(), linearOpDims, reducingStrides);
+    double sum = 0;
+    for (size_t i = 0; i < rows * cols; i++)
+        sum += pa[i] * pb[i];
+    unique_ptr<float[]> ps(s.CopyToArray());
+    BOOST_CHECK(fabs(ps[0] - (1.5 + sum)) < c_epsilonFloatE3);
+}
+
 #if 0 // Temporarily disabling
 BOOST_FIXTURE_TEST_CASE(GPUMatrixLargeInequality, RandomSeedFixture)
 {
@@ -37,6 +37,92 @@ BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteRead, RandomSeedFixture)
     BOOST_CHECK(matrixCpuCopy.IsEqualTo(matrixCpuRead, c_epsilonFloatE5));
 }
 
+BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteReadHalfPrecision, RandomSeedFixture)
+{
+    CPUMatrix<float> matrixCpu = CPUMatrix<float>::RandomUniform(43, 10, -26.3f, 30.2f, IncrementCounter());
+
+    std::wstring fileNameCpu(L"MCPUHalf.bin");
+    File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsHalfPrecision | fileOptionsReadWrite);
+
+    fileCpu << matrixCpu;
+    fileCpu.SetPosition(0);
+
+    // FP16 has an 11-bit mantissa, so values up to 32 are within 2^-6 of the original
+    CPUMatrix<double> matrixCpuRead;
+    fileCpu >> matrixCpuRead;
+
+    BOOST_CHECK_EQUAL(matrixCpu.GetNumRows(), matrixCpuRead.GetNumRows());
+    BOOST_CHECK_EQUAL(matrixCpu.GetNumCols(), matrixCpuRead.GetNumCols());
+    for (size_t j = 0; j < matrixCpu.GetNumCols(); j++)
+        for (size_t i = 0; i < matrixCpu.GetNumRows(); i++)
+            BOOST_CHECK(fabs(matrixCpu(i, j) - matrixCpuRead(i, j)) <= 1.0 / 64);
+
+    // special values
+    BOOST_CHECK_EQUAL((float) half(65504.0f), 65504.0f);
+    BOOST_CHECK_EQUAL((float) half(1e6f), std::numeric_limits<float>::infinity());
+    BOOST_CHECK_EQUAL((float) half(-1e-8f), 0.0f);
+    BOOST_CHECK_EQUAL((float) half(5.9604645e-8f), 5.9604645e-8f); // smallest denormal
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteReadQuantized8Bit, RandomSeedFixture)
+{
+    CPUMatrix<float> matrixCpu = CPUMatrix<float>::RandomUniform(43, 10, -26.3f, 30.2f, IncrementCounter());
+    CPUMatrix<float> vectorCpu = CPUMatrix<float>::RandomUniform(43, 1, -26.3f, 30.2f, IncrementCounter());
+
+    std::wstring fileNameCpu(L"MCPUQuantized.bin");
+    File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsQuantized8Bit | fileOptionsReadWrite);
+
+    fileCpu << matrixCpu << vectorCpu;
+    fileCpu.SetPosition(0);
+
+    CPUMatrix<double> matrixCpuRead, vectorCpuRead;
+    fileCpu >> matrixCpuRead >> vectorCpuRead;
+
+    // each value is within half a quantization step of its row's scale max|row| / 127
+    BOOST_CHECK_EQUAL(matrixCpu.GetNumRows(), matrixCpuRead.GetNumRows());
+    BOOST_CHECK_EQUAL(matrixCpu.GetNumCols(), matrixCpuRead.GetNumCols());
+    for (size_t i = 0; i < matrixCpu.GetNumRows(); i++)
+    {
+        double maxAbs = 0;
+        for (size_t j = 0; j < matrixCpu.GetNumCols(); j++)
+            maxAbs = std::max(maxAbs, (double) fabs(matrixCpu(i, j)));
+        for (size_t j = 0; j < matrixCpu.GetNumCols(); j++)
+            BOOST_CHECK(fabs(matrixCpu(i, j) - matrixCpuRead(i, j)) <= 0.5001 * maxAbs / 127);
+    }
+
+    // a column vector has one value per row, which is kept (up to float rounding)
+    for (size_t i = 0; i < vectorCpu.GetNumRows(); i++)
+        BOOST_CHECK(fabs(vectorCpu(i, 0) - vectorCpuRead(i, 0)) <= 1e-5 * fabs(vectorCpu(i, 0)));
+}
+
+BOOST_FIXTURE_TEST_CASE(CPUMatrixFileWriteReadBinarySequential, RandomSeedFixture)
+{
+    // large enough for the FP16 conversion to take more than one chunk
+    CPUMatrix<float> matrixCpu = CPUMatrix<float>::RandomUniform(300, 400, -26.3f, 30.2f, IncrementCounter());
+
+    std::wstring fileNameCpu(L"MCPUSequential.bin");
+    File fileCpu(fileNameCpu, fileOptionsBinary | fileOptionsSequential | fileOptionsReadWrite);
+
+    fileCpu << matrixCpu;
+    fileCpu.SetPosition(0);
+
+    CPUMatrix<float> matrixCpuRead;
+    fileCpu >> matrixCpuRead;
+
+    BOOST_CHECK(matrixCpu.IsEqualTo(matrixCpuRead, 0));
+
+    std::wstring fileNameHalf(L"MCPUSequentialHalf.bin");
+    File fileHalf(fileNameHalf, fileOptionsBinary | fileOptionsSequential | fileOptionsHalfPrecision | fileOptionsReadWrite);
+
+    fileHalf << matrixCpu;
+    fileHalf.SetPosition(0);
+
+    CPUMatrix<float> matrixHalfRead;
+    fileHalf >> matrixHalfRead;
+
+    BOOST_CHECK(matrixCpu.IsEqualTo(matrixHalfRead, 1.0f / 64));
+}
+
 BOOST_FIXTURE_TEST_CASE(MatrixFileWriteRead, RandomSeedFixture)
 {
     // Test Matrix in Dense mode
@@ -95,6 +95,61 @@ BOOST_FIXTURE_TEST_CASE(MatrixDenseTimesSparse, RandomSeedFixture)
     BOOST_CHECK(mD.IsEqualTo(mC, c_epsilonFloatE4));
 }
 
+BOOST_FIXTURE_TEST_CASE(MatrixDenseTimesSparseSkewed, RandomSeedFixture)
+{
+    // a narrow transposed dense matrix, and sparse columns with power-law-like nonzero counts, some longer than a tile of rows
+    const size_t m = 40, k = 1000, n = 64;
+    Matrix<float> mAdense(k, n, CPUDEVICE);
+    mAdense.SetValue(0);
+    for (size_t j = 0; j < n; j++)
+    {
+        const size_t nz = (j % 8 == 0) ? k / (j / 8 + 1) : 1 + j % 4;
+        for (size_t p = 0; p < nz; p++)
+            mAdense(p * (k / nz), j) = (float) (p % 7) - 3.0f;
+    }
+    mAdense.TransferToDeviceIfNotThere(0, true);
+
+    Matrix<float> mAsparse(mAdense);
+    mAsparse.SwitchToMatrixType(MatrixType::SPARSE, matrixFormatSparseCSC, true);
+
+    Matrix<float> mB = Matrix<float>::RandomGaussian(k, m, 1.0f, 4.0f, IncrementCounter());
+    Matrix<float> mC = Matrix<float>::RandomGaussian(m, n, 1.0f, 2.0f, IncrementCounter());
+    Matrix<float> mD(mC);
+
+    Matrix<float>::MultiplyAndWeightedAdd(0.7f, mB, true, mAdense, false, 1.5f, mC);
+    Matrix<float>::MultiplyAndWeightedAdd(0.7f, mB, true, mAsparse, false, 1.5f, mD);
+
+    BOOST_CHECK(mD.IsEqualTo(mC, c_epsilonFloatE3));
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixDenseTimesSparseOneHot, RandomSeedFixture)
+{
+    // an embedding: one-hot words, some repeated within the minibatch, and the gradient w.r.t. the embedding matrix
+    const size_t m = 50, k = 300, n = 40;
+    Matrix<float> mAdense(k, n, CPUDEVICE);
+    mAdense.SetValue(0);
+    for (size_t j = 0; j < n; j++)
+        mAdense((j * 7) % 23, j) = 1.0f;
+    mAdense.TransferToDeviceIfNotThere(0, true);
+
+    Matrix<float> mAsparse(mAdense);
+    mAsparse.SwitchToMatrixType(MatrixType::SPARSE, matrixFormatSparseCSC, true);
+
+    Matrix<float> mW = Matrix<float>::RandomGaussian(m, k, 1.0f, 4.0f, IncrementCounter());
+    Matrix<float> mC(m, n, 0);
+    Matrix<float> mD(m, n, 0);
+    Matrix<float>::MultiplyAndWeightedAdd(1.0f, mW, false, mAdense, false, 0.0f, mC);
+    Matrix<float>::MultiplyAndWeightedAdd(1.0f, mW, false, mAsparse, false, 0.0f, mD);
+    BOOST_CHECK(mD.IsEqualTo(mC, c_epsilonFloatE4));
+
+    Matrix<float> mG = Matrix<float>::RandomGaussian(m, n, 1.0f, 2.0f, IncrementCounter());
+    Matrix<float> mWGradDense = Matrix<float>::RandomGaussian(m, k, 1.0f, 2.0f, IncrementCounter());
+    Matrix<float> mWGradSparse(mWGradDense);
+    Matrix<float>::MultiplyAndWeightedAdd(0.5f, mG, false, mAdense, true, 1.0f, mWGradDense);
+    Matrix<float>::MultiplyAndWeightedAdd(0.5f, mG, false, mAsparse, true, 1.0f, mWGradSparse);
+    BOOST_CHECK(mWGradSparse.IsEqualTo(mWGradDense, c_epsilonFloatE4));
+}
+
 BOOST_FIXTURE_TEST_CASE(CPUMatrixDenseTimesSparse, RandomSeedFixture)
 {
     // TODO: test fails with large dimensions
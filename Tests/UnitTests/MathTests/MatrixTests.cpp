@@ -6,6 +6,10 @@
 #include "../../../Source/Math/Matrix.h"
 #include "../../../Source/Math/CPUMatrix.h"
 #include "../../../Source/Math/Helpers.h"
+#include "../../../Source/Math/MatrixReadback.h"
+#include "../../../Source/Math/Int8QuantizedMatrix.h"
+#include "../../../Source/Math/PackedWeightMatrix.h"
+#include "../../../Source/Math/TensorView.h"
 
 #define IDX2C(i, j, ld) (((j) * (ld)) + (i)) // 0 based indexing
 
@@ -997,6 +1001,33 @@ BOOST_FIXTURE_TEST_CASE(MatrixAddColumnReshapeProductOf, RandomSeedFixture)
     BOOST_CHECK(c.IsEqualTo(d1, c_epsilonFloatE4));
 }
 
+BOOST_FIXTURE_TEST_CASE(MatrixKhatriRaoProductTiled, RandomSeedFixture)
+{
+    // sizes that are not multiples of the GPU tile, against the CPU
+    const size_t rowsA = 45, rowsB = 37, cols = 3;
+    SingleMatrix aCpu = SingleMatrix::RandomUniform(rowsA, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix bCpu = SingleMatrix::RandomUniform(rowsB, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix gCpu = SingleMatrix::RandomUniform(rowsA * rowsB, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix a(aCpu, c_deviceIdZero), b(bCpu, c_deviceIdZero), g(gCpu, c_deviceIdZero);
+
+    SingleMatrix productCpu(CPUDEVICE), product(c_deviceIdZero);
+    productCpu.AssignKhatriRaoProductOf(aCpu, bCpu);
+    product.AssignKhatriRaoProductOf(a, b);
+    product.TransferToDeviceIfNotThere(CPUDEVICE, true);
+    BOOST_CHECK(product.IsEqualTo(productCpu, c_epsilonFloatE5));
+
+    for (bool transposeAColumn : {false, true})
+    {
+        const SingleMatrix& factorCpu = transposeAColumn ? aCpu : bCpu;
+        SingleMatrix gradientCpu = SingleMatrix::Ones(transposeAColumn ? rowsB : rowsA, cols, CPUDEVICE);
+        SingleMatrix gradient(gradientCpu, c_deviceIdZero);
+        gradientCpu.AddColumnReshapeProductOf(gCpu, factorCpu, transposeAColumn);
+        gradient.AddColumnReshapeProductOf(g, transposeAColumn ? a : b, transposeAColumn);
+        gradient.TransferToDeviceIfNotThere(CPUDEVICE, true);
+        BOOST_CHECK(gradient.IsEqualTo(gradientCpu, c_epsilonFloatE4));
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(MatrixCopy, RandomSeedFixture)
 {
     const size_t crow = 3;
@@ -1101,6 +1132,716 @@ BOOST_FIXTURE_TEST_CASE(MatrixAssignNumOfDiff, RandomSeedFixture)
         BOOST_CHECK_EQUAL(expectedDiff, actual.Get00Element());
     }
 }
+
+BOOST_FIXTURE_TEST_CASE(MatrixInt8QuantizedMultiply, RandomSeedFixture)
+{
+    // odd sizes so that the remainder loops of the int8 kernels are used as well
+    const size_t M = 67, K = 101, N = 13;
+    SingleMatrix w = SingleMatrix::RandomUniform(M, K, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix x = SingleMatrix::RandomUniform(K, N, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix expected(M, N, CPUDEVICE);
+    expected.AssignProductOf(w, false, x, false);
+
+    Int8QuantizedMatrix<float> wq(w);
+    SingleMatrix actual(M, N, CPUDEVICE);
+    wq.Multiply(x, actual);
+
+    // each factor is off by at most half a quantization step, i.e. 1/254 of its range
+    BOOST_CHECK(actual.IsEqualTo(expected, (float) K / 127));
+    // the error should typically be much smaller than that bound
+    SingleMatrix diff(CPUDEVICE);
+    diff.AssignDifferenceOf(actual, expected);
+    BOOST_CHECK_LT(diff.FrobeniusNorm() / expected.FrobeniusNorm(), 0.02);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixPackedWeightMultiply, RandomSeedFixture)
+{
+    // M is not a multiple of the panel height, and N covers each microkernel as well as a remainder after a full group
+    const size_t M = 37, K = 29;
+    SingleMatrix w = SingleMatrix::RandomUniform(M, K, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix wt(CPUDEVICE);
+    wt.AssignTransposeOf(w);
+    PackedWeightMatrix<float> wp(w, false);
+    PackedWeightMatrix<float> wtp(wt, true);
+    BOOST_CHECK_EQUAL(wtp.GetNumRows(), M);
+    BOOST_CHECK_EQUAL(wtp.GetNumCols(), K);
+    for (size_t N = 1; N <= 11; N++)
+    {
+        SingleMatrix x = SingleMatrix::RandomUniform(K, N, -1, 1, IncrementCounter(), CPUDEVICE);
+        SingleMatrix expected(M, N, CPUDEVICE);
+        expected.AssignProductOf(w, false, x, false);
+
+        SingleMatrix actual(M, N, CPUDEVICE);
+        wp.Multiply(x, actual);
+        BOOST_CHECK(actual.IsEqualTo(expected, c_epsilonFloatE4));
+        actual.SetValue(0);
+        wtp.Multiply(x, actual);
+        BOOST_CHECK(actual.IsEqualTo(expected, c_epsilonFloatE4));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixBatchMultiplyAndWeightedAdd, RandomSeedFixture)
+{
+    const size_t M = 5, K = 7, N = 3, batchCount = 4;
+    const float alpha = 0.5f, beta = 2.0f;
+    SingleMatrix a = SingleMatrix::RandomUniform(K, M * batchCount, -1, 1, IncrementCounter(), CPUDEVICE); // transposed blocks
+    SingleMatrix b = SingleMatrix::RandomUniform(K, N * batchCount, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix c = SingleMatrix::RandomUniform(M, N * batchCount, -1, 1, IncrementCounter(), CPUDEVICE);
+
+    SingleMatrix expected(c);
+    for (size_t i = 0; i < batchCount; i++)
+    {
+        SingleMatrix expectedBlock = expected.ColumnSlice(i * N, N);
+        SingleMatrix::MultiplyAndWeightedAdd(alpha, a.ColumnSlice(i * M, M), true, b.ColumnSlice(i * N, N), false, beta, expectedBlock);
+    }
+
+    SingleMatrix::BatchMultiplyAndWeightedAdd(alpha, a, true, b, false, beta, c, batchCount);
+    BOOST_CHECK(c.IsEqualTo(expected, c_epsilonFloatE5));
+
+    // the Khatri-Rao product is a batch of outer products
+    SingleMatrix x = SingleMatrix::RandomUniform(M, N, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix y = SingleMatrix::RandomUniform(K, N, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix khatriRao(CPUDEVICE);
+    khatriRao.AssignKhatriRaoProductOf(x, y);
+    SingleMatrix outerProducts(CPUDEVICE);
+    SingleMatrix::BatchMultiplyAndWeightedAdd(1, x, false, y, true, 0, outerProducts, N);
+    outerProducts.Reshape(M * K, N);
+    BOOST_CHECK(outerProducts.IsEqualTo(khatriRao, c_epsilonFloatE5));
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixAssignAugmentedImagesOf, RandomSeedFixture)
+{
+    // two 4 x 4 images with 3 channels; the second one is mirrored
+    const size_t numImages = 2, side = 4, channels = 3, imageBytes = side * side * channels;
+    std::vector<char> buffer(numImages * sizeof(ImageAugmentationDesc) + numImages * imageBytes);
+    ImageAugmentationDesc* descs = (ImageAugmentationDesc*) buffer.data();
+    unsigned char* pixels = (unsigned char*) buffer.data() + numImages * sizeof(ImageAugmentationDesc);
+    for (size_t j = 0; j < numImages; j++)
+    {
+        descs[j].offset = numImages * sizeof(ImageAugmentationDesc) + j * imageBytes;
+        descs[j].rows = side;
+        descs[j].cols = side;
+        descs[j].flip = j == 1;
+        descs[j].reserved = 0;
+    }
+    for (size_t i = 0; i < numImages * imageBytes; i++)
+        pixels[i] = (unsigned char) (rand() % 256);
+    auto pixel = [&](size_t j, size_t y, size_t x, size_t c) -> float
+    {
+        return pixels[j * imageBytes + (y * side + x) * channels + c];
+    };
+
+    Matrix<char> images(buffer.size(), 1, buffer.data(), matrixFlagNormal, CPUDEVICE);
+    SingleMatrix noMean(CPUDEVICE);
+    SingleMatrix result(CPUDEVICE);
+
+    // at the original size, this copies (and mirrors) the pixels
+    result.AssignAugmentedImagesOf(images, numImages, side, side, channels, false, noMean);
+    BOOST_CHECK_EQUAL(result.GetNumRows(), imageBytes);
+    BOOST_CHECK_EQUAL(result.GetNumCols(), numImages);
+    for (size_t y = 0; y < side; y++)
+        for (size_t x = 0; x < side; x++)
+            for (size_t c = 0; c < channels; c++)
+            {
+                BOOST_CHECK_EQUAL(result((y * side + x) * channels + c, 0), pixel(0, y, x, c));
+                BOOST_CHECK_EQUAL(result((y * side + x) * channels + c, 1), pixel(1, y, side - 1 - x, c));
+            }
+
+    // halving the size averages blocks of 2 x 2 pixels; the output is channel by channel, minus the mean
+    const size_t half = side / 2;
+    SingleMatrix mean = SingleMatrix::RandomUniform(half * half * channels, 1, 0, 255, IncrementCounter(), CPUDEVICE);
+    result.AssignAugmentedImagesOf(images, numImages, half, half, channels, true, mean);
+    for (size_t y = 0; y < half; y++)
+        for (size_t x = 0; x < half; x++)
+            for (size_t c = 0; c < channels; c++)
+            {
+                float average = (pixel(0, 2 * y, 2 * x, c) + pixel(0, 2 * y, 2 * x + 1, c) + pixel(0, 2 * y + 1, 2 * x, c) + pixel(0, 2 * y + 1, 2 * x + 1, c)) / 4;
+                BOOST_CHECK_CLOSE(result(c * half * half + y * half + x, 0), average - mean((y * half + x) * channels + c, 0), 1e-3);
+            }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixGatherScatterColumns, RandomSeedFixture)
+{
+    const size_t numRows = 3, numCols = 5;
+    SingleMatrix a = SingleMatrix::RandomUniform(numRows, numCols, -1, 1, IncrementCounter(), CPUDEVICE);
+
+    // gather: columns 4, 0, nothing, 2 (a negative index yields a column of zeros, or leaves it alone for beta = 1)
+    float idxValues[] = {4, 0, -1, 2};
+    const size_t numIdx = sizeof(idxValues) / sizeof(*idxValues);
+    SingleMatrix idx(1, numIdx, idxValues, matrixFlagNormal, CPUDEVICE);
+    SingleMatrix gathered(CPUDEVICE);
+    gathered.DoGatherColumnsOf(0, idx, a, 2);
+    BOOST_CHECK_EQUAL(gathered.GetNumRows(), numRows);
+    BOOST_CHECK_EQUAL(gathered.GetNumCols(), numIdx);
+    for (size_t i = 0; i < numRows; i++)
+        for (size_t j = 0; j < numIdx; j++)
+            BOOST_CHECK_EQUAL(gathered(i, j), idxValues[j] < 0 ? 0 : 2 * a(i, (size_t) idxValues[j]));
+
+    // scatter back on top of a: columns that are not targeted keep their (scaled) value
+    SingleMatrix scattered(CPUDEVICE);
+    scattered.SetValue(a);
+    scattered.DoScatterColumnsOf(1, idx, gathered, 0.5);
+    for (size_t i = 0; i < numRows; i++)
+        for (size_t j = 0; j < numCols; j++)
+            BOOST_CHECK_EQUAL(scattered(i, j), (j == 4 || j == 0 || j == 2 ? 2 : 1) * a(i, j));
+
+    // scatter with beta = 0 clears the others
+    scattered.DoScatterColumnsOf(0, idx, gathered, 0.5);
+    for (size_t i = 0; i < numRows; i++)
+        for (size_t j = 0; j < numCols; j++)
+            BOOST_CHECK_EQUAL(scattered(i, j), j == 4 || j == 0 || j == 2 ? a(i, j) : 0);
+
+    // repeated indices accumulate
+    float repeatedIdxValues[] = {1, 3, 1, 1};
+    SingleMatrix repeatedIdx(1, numIdx, repeatedIdxValues, matrixFlagNormal, CPUDEVICE);
+    scattered.DoScatterColumnsOf(0, repeatedIdx, gathered, 1);
+    for (size_t i = 0; i < numRows; i++)
+        for (size_t j = 0; j < numCols; j++)
+            BOOST_CHECK_CLOSE(scattered(i, j) + 1, (j == 1 ? gathered(i, 0) + gathered(i, 2) + gathered(i, 3) : j == 3 ? gathered(i, 1) : 0) + 1, 1e-4f);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixCrossEntropyWithSoftmax, RandomSeedFixture)
+{
+    const size_t numRows = 7, numCols = 6;
+    // large logits, such that a naive exp() would overflow
+    SingleMatrix logits = SingleMatrix::RandomUniform(numRows, numCols, -100, 100, IncrementCounter(), CPUDEVICE);
+    SingleMatrix labels(numRows, numCols, CPUDEVICE);
+    labels.SetValue(0);
+    for (size_t j = 0; j < numCols - 1; j++) // the last column is a gap: no label
+        labels(j % numRows, j) = 1;
+
+    // reference: the unfused computation
+    SingleMatrix logSoftmax(CPUDEVICE);
+    logSoftmax.AssignLogSoftmaxOf(logits, true);
+    float expected = 0;
+    for (size_t j = 0; j < numCols - 1; j++)
+        expected -= logSoftmax(j % numRows, j);
+
+    SingleMatrix logSumExp(CPUDEVICE);
+    SingleMatrix criterion(CPUDEVICE);
+    criterion.AssignCrossEntropyWithSoftmaxOf(labels, logits, logSumExp);
+    BOOST_CHECK_EQUAL(criterion.GetNumElements(), 1);
+    BOOST_CHECK_EQUAL(logSumExp.GetNumCols(), numCols);
+    BOOST_CHECK_CLOSE(criterion(0, 0), expected, 0.01f);
+
+    // gradient: alpha * (softmax - labels)
+    SingleMatrix alpha(1, 1, CPUDEVICE);
+    alpha.SetValue(2);
+    SingleMatrix gradient(numRows, numCols, CPUDEVICE);
+    gradient.SetValue(1);
+    SingleMatrix::AddCrossEntropyWithSoftmaxGradient(alpha, labels, logits, logSumExp, gradient);
+    for (size_t i = 0; i < numRows; i++)
+        for (size_t j = 0; j < numCols; j++)
+            BOOST_CHECK_SMALL(gradient(i, j) - (1 + 2 * (exp(logSoftmax(i, j)) - labels(i, j))), 1e-4f);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixAssignDropoutOf, RandomSeedFixture)
+{
+    const size_t numRows = 37, numCols = 50;
+    const double dropoutRate = 0.3;
+    const unsigned long seed = 4711;
+    SingleMatrix value(numRows, numCols, CPUDEVICE);
+    value.SetValue(1);
+
+    SingleMatrix output(CPUDEVICE);
+    output.AssignDropoutOf(value, dropoutRate, seed, 0);
+    BOOST_CHECK_EQUAL(output.GetNumRows(), numRows);
+    BOOST_CHECK_EQUAL(output.GetNumCols(), numCols);
+
+    // kept elements are pre-scaled, and about 1 - dropoutRate of them are kept
+    const float scale = (float) (1 / (1 - dropoutRate));
+    size_t numKept = 0;
+    foreach_coord (i, j, output)
+    {
+        BOOST_CHECK(output(i, j) == 0 || fabs(output(i, j) - scale) < 1e-5f);
+        numKept += output(i, j) != 0;
+    }
+    BOOST_CHECK_CLOSE((double) numKept / (numRows * numCols), 1 - dropoutRate, 10);
+
+    // the gradient regenerates the same mask
+    SingleMatrix gradient(numRows, numCols, CPUDEVICE);
+    gradient.SetValue(1);
+    gradient.AddDropoutOf(value, dropoutRate, seed, 0);
+    foreach_coord (i, j, gradient)
+        BOOST_CHECK_SMALL(gradient(i, j) - (1 + output(i, j)), 1e-5f);
+
+    // a column slice addressed by its first element index sees the same mask as the full matrix
+    const size_t firstCol = 7, numSliceCols = 3;
+    SingleMatrix slice(CPUDEVICE);
+    slice.AssignDropoutOf(value.ColumnSlice(firstCol, numSliceCols), dropoutRate, seed, firstCol * numRows);
+    foreach_coord (i, j, slice)
+        BOOST_CHECK_EQUAL(slice(i, j), output(i, firstCol + j));
+
+    // a different seed gives a different mask
+    SingleMatrix other(CPUDEVICE);
+    other.AssignDropoutOf(value, dropoutRate, seed + 1, 0);
+    BOOST_CHECK(!other.IsEqualTo(output));
+}
+
+// compares Matrix::MultiTensorNormalGrad() with the step-by-step update of SGD::UpdateWeightsS()
+static void TestMultiTensorNormalGrad(RandomSeedFixture& fixture, bool clippingByGlobalNorm)
+{
+    const float learnRatePerSample = 0.1f, momentum = 0.9f, L2RegWeight = 0.01f, clippingThreshold = 1.5f;
+    std::vector<SingleMatrix> values, gradients, smoothed;
+    const size_t dims[3][2] = {{13, 7}, {1, 1}, {40, 3}};
+    for (size_t t = 0; t < 3; t++)
+    {
+        values.push_back(SingleMatrix::RandomUniform(dims[t][0], dims[t][1], -1, 1, fixture.IncrementCounter(), CPUDEVICE));
+        gradients.push_back(SingleMatrix::RandomUniform(dims[t][0], dims[t][1], -1, 1, fixture.IncrementCounter(), CPUDEVICE));
+        smoothed.push_back(SingleMatrix::RandomUniform(dims[t][0], dims[t][1], -1, 1, fixture.IncrementCounter(), CPUDEVICE));
+    }
+
+    float globalSumOfSquares = 0;
+    for (size_t t = 0; t < 3; t++)
+        globalSumOfSquares += gradients[t].FrobeniusNorm() * gradients[t].FrobeniusNorm();
+
+    std::vector<SingleMatrix> expectedValues, expectedSmoothed;
+    for (size_t t = 0; t < 3; t++)
+    {
+        SingleMatrix value(values[t], CPUDEVICE), gradient(gradients[t], CPUDEVICE), smoothedGradient(smoothed[t], CPUDEVICE);
+        const float norm = clippingByGlobalNorm ? sqrt(globalSumOfSquares) : gradient.FrobeniusNorm();
+        if (norm > clippingThreshold)
+            gradient *= clippingThreshold / norm;
+        SingleMatrix::ScaleAndAdd(L2RegWeight, value, gradient);
+        smoothedGradient.NormalGrad(gradient, value, learnRatePerSample, momentum, false);
+        expectedValues.push_back(std::move(value));
+        expectedSmoothed.push_back(std::move(smoothedGradient));
+    }
+
+    MultiTensorUpdateDesc desc;
+    desc.learnRatePerSample = learnRatePerSample;
+    desc.momentum = momentum;
+    desc.useNesterovMomentum = false;
+    desc.L2RegWeight = L2RegWeight;
+    desc.L1Threshold = 0;
+    desc.clippingThreshold = clippingThreshold;
+    desc.clippingWithTruncation = false;
+    desc.clippingByGlobalNorm = clippingByGlobalNorm;
+    std::vector<SingleMatrix*> valuePtrs, gradientPtrs, smoothedPtrs;
+    for (size_t t = 0; t < 3; t++)
+    {
+        valuePtrs.push_back(&values[t]);
+        gradientPtrs.push_back(&gradients[t]);
+        smoothedPtrs.push_back(&smoothed[t]);
+    }
+    SingleMatrix workspace(CPUDEVICE);
+    SingleMatrix::MultiTensorNormalGrad(valuePtrs, gradientPtrs, smoothedPtrs, desc, workspace);
+
+    for (size_t t = 0; t < 3; t++)
+    {
+        BOOST_CHECK(values[t].IsEqualTo(expectedValues[t], c_epsilonFloatE4));
+        BOOST_CHECK(smoothed[t].IsEqualTo(expectedSmoothed[t], c_epsilonFloatE4));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixMultiTensorNormalGrad, RandomSeedFixture)
+{
+    TestMultiTensorNormalGrad(*this, false);
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixMultiTensorNormalGradGlobalNorm, RandomSeedFixture)
+{
+    TestMultiTensorNormalGrad(*this, true);
+}
+
+static std::vector<float> ToVector(const SingleMatrix& a)
+{
+    return std::vector<float>(a.BufferPointer(), a.BufferPointer() + a.GetNumElements());
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixAdamAndLamb, RandomSeedFixture)
+{
+    const float learnRate = 0.01f, beta1 = 0.9f, beta2 = 0.999f, epsilon = 1e-8f, weightDecay = 0.01f;
+    const size_t rows = 17, cols = 5, n = rows * cols;
+    for (bool layerwiseAdaptive : {false, true})
+    {
+        SingleMatrix value = SingleMatrix::RandomUniform(rows, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+        SingleMatrix state(CPUDEVICE);
+        std::vector<float> w(ToVector(value)), m(n, 0), v(n, 0), r(n);
+        for (int step = 1; step <= 3; step++)
+        {
+            SingleMatrix gradient = SingleMatrix::RandomUniform(rows, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+            const std::vector<float> g(ToVector(gradient));
+            state.Adam(gradient, value, learnRate, beta1, beta2, epsilon, weightDecay, layerwiseAdaptive);
+
+            // reference
+            double sumOfSquaresW = 0, sumOfSquaresR = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                m[i] = beta1 * m[i] + (1 - beta1) * g[i];
+                v[i] = beta2 * v[i] + (1 - beta2) * g[i] * g[i];
+                const float mHat = m[i] / (1 - pow(beta1, step)), vHat = v[i] / (1 - pow(beta2, step));
+                r[i] = mHat / (sqrt(vHat) + epsilon) + weightDecay * w[i];
+                sumOfSquaresW += w[i] * w[i];
+                sumOfSquaresR += r[i] * r[i];
+            }
+            const float trustRatio = layerwiseAdaptive ? (float) sqrt(sumOfSquaresW / sumOfSquaresR) : 1;
+            for (size_t i = 0; i < n; i++)
+                w[i] -= learnRate * trustRatio * r[i];
+
+            BOOST_CHECK_EQUAL(state.GetNumElements(), 2 * n + 3); // moments, update count, scratch
+            const std::vector<float> result(ToVector(value));
+            for (size_t i = 0; i < n; i++)
+                BOOST_CHECK_CLOSE(result[i], w[i], 1e-2);
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixLars, RandomSeedFixture)
+{
+    const float learnRate = 0.5f, momentum = 0.9f, trustCoefficient = 0.001f;
+    const size_t rows = 9, cols = 4, n = rows * cols;
+    SingleMatrix value = SingleMatrix::RandomUniform(rows, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix state(CPUDEVICE);
+    std::vector<float> w(ToVector(value)), smoothed(n, 0);
+    for (int step = 1; step <= 3; step++)
+    {
+        SingleMatrix gradient = SingleMatrix::RandomUniform(rows, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+        const std::vector<float> g(ToVector(gradient));
+        state.Lars(gradient, value, learnRate, momentum, trustCoefficient);
+
+        double sumOfSquaresW = 0, sumOfSquaresG = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            sumOfSquaresW += w[i] * w[i];
+            sumOfSquaresG += g[i] * g[i];
+        }
+        const float rate = learnRate * trustCoefficient * (float) sqrt(sumOfSquaresW / sumOfSquaresG);
+        for (size_t i = 0; i < n; i++)
+        {
+            smoothed[i] = momentum * smoothed[i] + rate * g[i];
+            w[i] -= smoothed[i];
+        }
+
+        const std::vector<float> result(ToVector(value));
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK_CLOSE(result[i], w[i], 1e-2);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixRCRFForwardCompute, RandomSeedFixture)
+{
+    const size_t numLabels = 5, numSteps = 4, numSequences = 3, cols = numSteps * numSequences;
+    const int startLbl = 2;
+    SingleMatrix posScores = SingleMatrix::RandomUniform(numLabels, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix pairScores = SingleMatrix::RandomUniform(numLabels, numLabels, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix alpha(CPUDEVICE), viterbi(CPUDEVICE), backtrace(CPUDEVICE);
+    SingleMatrix::RCRFForwardCompute(posScores, pairScores, alpha, startLbl, numSequences);
+    SingleMatrix::ViterbiForwardCompute(posScores, pairScores, viterbi, backtrace, startLbl, numSequences);
+    BOOST_CHECK_EQUAL(alpha.GetNumCols(), cols);
+    BOOST_CHECK_EQUAL(backtrace.GetNumCols(), cols);
+
+    // reference: each sequence on its own
+    for (size_t s = 0; s < numSequences; s++)
+    {
+        std::vector<double> a(numLabels * numSteps), v(numLabels * numSteps);
+        std::vector<size_t> b(numLabels * numSteps);
+        for (size_t t = 0; t < numSteps; t++)
+        {
+            const size_t col = t * numSequences + s;
+            for (size_t k = 0; k < numLabels; k++)
+            {
+                double sum = 0, best = -1e30;
+                size_t argBest = startLbl;
+                for (size_t j = 0; j < numLabels; j++)
+                {
+                    const double prev = t > 0 ? a[(t - 1) * numLabels + j] : (j == startLbl ? 0 : -std::numeric_limits<double>::infinity());
+                    sum += exp(prev + pairScores(k, j));
+                    if (t > 1 && v[(t - 1) * numLabels + j] + pairScores(k, j) > best)
+                    {
+                        best = v[(t - 1) * numLabels + j] + pairScores(k, j);
+                        argBest = j;
+                    }
+                }
+                a[t * numLabels + k] = log(sum) + posScores(k, col);
+                if (t == 0)
+                    best = k == startLbl ? posScores(k, col) : LZERO;
+                else if (t == 1)
+                    best = v[startLbl] + pairScores(k, startLbl) + posScores(k, col);
+                else
+                    best += posScores(k, col);
+                v[t * numLabels + k] = best;
+                b[t * numLabels + k] = argBest;
+
+                BOOST_CHECK_CLOSE(alpha(k, col), a[t * numLabels + k], 1e-3);
+                if (t > 0 || k == startLbl) // (LZERO entries cannot be compared relatively)
+                    BOOST_CHECK_CLOSE(viterbi(k, col), v[t * numLabels + k], 1e-3);
+                BOOST_CHECK_EQUAL((size_t) backtrace(k, col), b[t * numLabels + k]);
+            }
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixLSTMForwardWithState, RandomSeedFixture)
+{
+    // sequence 0 continues from the given state, 1 starts at time 1, and 2 starts at time 0 and ends after time 2
+    const size_t H = 6, numSteps = 5, numSequences = 3, cols = numSteps * numSequences;
+    const float flagValues[cols] = {1, 0, 2, 1, 2, 1, 1, 1, 1, 1, 1, 0, 1, 1, 0};
+    SingleMatrix flags(1, cols, const_cast<float*>(flagValues), matrixFlagNormal, CPUDEVICE);
+    SingleMatrix gates = SingleMatrix::RandomUniform(4 * H, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix recurrentWeights = SingleMatrix::RandomUniform(H, 4 * H, -0.5, 0.5, IncrementCounter(), CPUDEVICE);
+    SingleMatrix h0 = SingleMatrix::RandomUniform(H, numSequences, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix c0 = SingleMatrix::RandomUniform(H, numSequences, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix h(h0), c(c0), output(CPUDEVICE);
+    SingleMatrix::LSTMForwardWithState(gates, recurrentWeights, flags, h, c, output, numSequences);
+    BOOST_CHECK_EQUAL(output.GetNumCols(), cols);
+
+    // reference: each sequence on its own
+    auto sigmoid = [](double z) { return 1 / (1 + exp(-z)); };
+    for (size_t s = 0; s < numSequences; s++)
+    {
+        std::vector<double> hPrev(H), cPrev(H);
+        for (size_t j = 0; j < H; j++)
+        {
+            hPrev[j] = h0(j, s);
+            cPrev[j] = c0(j, s);
+        }
+        for (size_t t = 0; t < numSteps; t++)
+        {
+            const size_t col = t * numSequences + s;
+            if (flagValues[col] == 2)
+                fill(hPrev.begin(), hPrev.end(), 0), fill(cPrev.begin(), cPrev.end(), 0);
+            std::vector<double> hNew(hPrev), cNew(cPrev);
+            for (size_t j = 0; j < H && flagValues[col] != 0; j++)
+            {
+                double sums[4];
+                for (size_t g = 0; g < 4; g++)
+                {
+                    sums[g] = gates(g * H + j, col);
+                    for (size_t k = 0; k < H; k++)
+                        sums[g] += recurrentWeights(k, g * H + j) * hPrev[k];
+                }
+                cNew[j] = sigmoid(sums[1]) * cPrev[j] + sigmoid(sums[0]) * tanh(sums[2]);
+                hNew[j] = sigmoid(sums[3]) * tanh(cNew[j]);
+            }
+            hPrev = hNew;
+            cPrev = cNew;
+            for (size_t j = 0; j < H; j++)
+                BOOST_CHECK_CLOSE(output(j, col), hPrev[j], 1e-3);
+        }
+        for (size_t j = 0; j < H; j++)
+        {
+            BOOST_CHECK_CLOSE(h(j, s), hPrev[j], 1e-3);
+            BOOST_CHECK_CLOSE(c(j, s), cPrev[j], 1e-3);
+        }
+    }
+
+    // the GPU kernel, with enough units to be spread over several blocks
+    const size_t bigH = 70;
+    SingleMatrix bigGatesCpu = SingleMatrix::RandomUniform(4 * bigH, cols, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix bigWeightsCpu = SingleMatrix::RandomUniform(bigH, 4 * bigH, -0.1, 0.1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix hCpu = SingleMatrix::RandomUniform(bigH, numSequences, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix cCpu = SingleMatrix::RandomUniform(bigH, numSequences, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix bigGates(bigGatesCpu, c_deviceIdZero), bigWeights(bigWeightsCpu, c_deviceIdZero), flagsGpu(flags, c_deviceIdZero);
+    SingleMatrix hGpu(hCpu, c_deviceIdZero), cGpu(cCpu, c_deviceIdZero), outputCpu(CPUDEVICE), outputGpu(c_deviceIdZero);
+    SingleMatrix::LSTMForwardWithState(bigGatesCpu, bigWeightsCpu, flags, hCpu, cCpu, outputCpu, numSequences);
+    SingleMatrix::LSTMForwardWithState(bigGates, bigWeights, flagsGpu, hGpu, cGpu, outputGpu, numSequences);
+    outputGpu.TransferToDeviceIfNotThere(CPUDEVICE, true);
+    hGpu.TransferToDeviceIfNotThere(CPUDEVICE, true);
+    cGpu.TransferToDeviceIfNotThere(CPUDEVICE, true);
+    BOOST_CHECK(outputGpu.IsEqualTo(outputCpu, c_epsilonFloatE4));
+    BOOST_CHECK(hGpu.IsEqualTo(hCpu, c_epsilonFloatE4));
+    BOOST_CHECK(cGpu.IsEqualTo(cCpu, c_epsilonFloatE4));
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixGMMLogLikelihood, RandomSeedFixture)
+{
+    const size_t numComponents = 3, featureDim = 4, numSamples = 5;
+    std::vector<DoubleMatrix> inputs;
+    inputs.push_back(DoubleMatrix::RandomUniform(numComponents, 1, -1, 1, IncrementCounter(), CPUDEVICE));                      // unnormedPrior, shared
+    inputs.push_back(DoubleMatrix::RandomUniform(numComponents * featureDim, numSamples, -1, 1, IncrementCounter(), CPUDEVICE)); // mean, per sample
+    inputs.push_back(DoubleMatrix::RandomUniform(numComponents, 1, -0.5, 0.5, IncrementCounter(), CPUDEVICE));                  // logStddev, shared
+    inputs.push_back(DoubleMatrix::RandomUniform(featureDim, numSamples, -1, 1, IncrementCounter(), CPUDEVICE));                 // feature
+    DoubleMatrix gradient = DoubleMatrix::RandomUniform(1, numSamples, -1, 1, IncrementCounter(), CPUDEVICE);
+    DoubleMatrix logLikelihood(CPUDEVICE), posterior(CPUDEVICE), normedDeviation(CPUDEVICE);
+    DoubleMatrix::GMMLogLikelihood(inputs[0], inputs[1], inputs[2], inputs[3], logLikelihood, posterior, normedDeviation);
+
+    // reference: sum of the weighted component densities
+    double priorSum = 0;
+    for (size_t c = 0; c < numComponents; c++)
+        priorSum += exp(inputs[0](c, 0));
+    for (size_t n = 0; n < numSamples; n++)
+    {
+        double likelihood = 0;
+        for (size_t c = 0; c < numComponents; c++)
+        {
+            const double sigma = exp(inputs[2](c, 0));
+            double density = exp(inputs[0](c, 0)) / priorSum;
+            for (size_t i = 0; i < featureDim; i++)
+                density *= exp(-0.5 * pow((inputs[3](i, n) - inputs[1](c * featureDim + i, n)) / sigma, 2)) / (sqrt(TWO_PI) * sigma);
+            likelihood += density;
+        }
+        BOOST_CHECK_CLOSE(logLikelihood(0, n), log(likelihood), 1e-3);
+    }
+
+    // gradients against finite differences of sum_n gradient(n) * logLikelihood(n)
+    auto objective = [&]()
+    {
+        DoubleMatrix ll(CPUDEVICE), p(CPUDEVICE), q(CPUDEVICE);
+        DoubleMatrix::GMMLogLikelihood(inputs[0], inputs[1], inputs[2], inputs[3], ll, p, q);
+        double sum = 0;
+        for (size_t n = 0; n < numSamples; n++)
+            sum += gradient(0, n) * ll(0, n);
+        return sum;
+    };
+    const double epsilon = 1e-6;
+    for (size_t inputIndex = 0; inputIndex < inputs.size(); inputIndex++)
+    {
+        DoubleMatrix inputGradient(inputs[inputIndex].GetNumRows(), inputs[inputIndex].GetNumCols(), CPUDEVICE);
+        inputGradient.SetValue(0);
+        DoubleMatrix::AddGMMLogLikelihoodGradient(inputIndex, gradient, posterior, normedDeviation, inputs[0], inputs[1], inputs[2], inputs[3], inputGradient);
+        for (size_t j = 0; j < inputGradient.GetNumCols(); j++)
+            for (size_t i = 0; i < inputGradient.GetNumRows(); i++)
+            {
+                const double value = inputs[inputIndex](i, j);
+                inputs[inputIndex](i, j) = value + epsilon;
+                const double plus = objective();
+                inputs[inputIndex](i, j) = value - epsilon;
+                const double minus = objective();
+                inputs[inputIndex](i, j) = value;
+                BOOST_CHECK_SMALL(inputGradient(i, j) - (plus - minus) / (2 * epsilon), 1e-5);
+            }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixDenseFastPath, RandomSeedFixture)
+{
+    // dense operands on the same device take the fast path of MultiplyAndWeightedAdd() and SetValue(), also for column-slice views
+    SingleMatrix a = SingleMatrix::RandomUniform(7, 5, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix b = SingleMatrix::RandomUniform(5, 9, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix c = SingleMatrix::RandomUniform(7, 4, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix expected(7, 4, CPUDEVICE);
+    for (size_t j = 0; j < 4; j++)
+        for (size_t i = 0; i < 7; i++)
+        {
+            double sum = 0;
+            for (size_t k = 0; k < 5; k++)
+                sum += a(i, k) * b(k, j + 2);
+            expected(i, j) = (float) (0.5 * c(i, j) + 2 * sum);
+        }
+    SingleMatrix::MultiplyAndWeightedAdd(2, a, false, b.ColumnSlice(2, 4), false, 0.5, c);
+    BOOST_CHECK(c.IsEqualTo(expected, c_epsilonFloatE4));
+
+    SingleMatrix copy = SingleMatrix::Zeros(7, 4, CPUDEVICE);
+    copy.SetValue(c);
+    BOOST_CHECK(copy.IsEqualTo(c, 0));
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixTensorOpPlanReuse, RandomSeedFixture)
+{
+    // the same broadcasting op once per column (same plan, different offsets), alternating with a whole-matrix op (different plan)
+    const size_t rows = 4, cols = 6;
+    SingleMatrix a = SingleMatrix::RandomUniform(rows, cols, CPUDEVICE, -1, 1, IncrementCounter());
+    SingleMatrix b = SingleMatrix::RandomUniform(rows, 1, CPUDEVICE, -1, 1, IncrementCounter());
+    SingleMatrix c(rows, cols, CPUDEVICE);
+    SingleMatrix d(rows, cols, CPUDEVICE);
+    for (size_t t = 0; t < cols; t++)
+    {
+        TensorView<float> cSlice(c, TensorShape(rows, cols).NarrowTo(1, t, t + 1));
+        TensorView<float> aSlice(a, TensorShape(rows, cols).NarrowTo(1, t, t + 1));
+        cSlice.AssignSumOf(aSlice, TensorView<float>(b, TensorShape(rows, 1)));
+
+        TensorView<float> dView(d, TensorShape(rows, cols));
+        dView.AssignSumOf(TensorView<float>(a, TensorShape(rows, cols)), TensorView<float>(b, TensorShape(rows, 1)));
+    }
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+        {
+            BOOST_CHECK_CLOSE(c(i, j), a(i, j) + b(i, 0), c_epsilonFloatE5);
+            BOOST_CHECK_CLOSE(d(i, j), a(i, j) + b(i, 0), c_epsilonFloatE5);
+        }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixCosDistanceWithShiftNeg, RandomSeedFixture)
+{
+    const size_t dim = 6, numSamples = 5, shift = 1, negNumber = 3;
+    std::vector<DoubleMatrix> inputs;
+    inputs.push_back(DoubleMatrix::RandomUniform(dim, numSamples, -1, 1, IncrementCounter(), CPUDEVICE)); // query
+    inputs.push_back(DoubleMatrix::RandomUniform(dim, numSamples, -1, 1, IncrementCounter(), CPUDEVICE)); // document
+    DoubleMatrix gradient = DoubleMatrix::RandomUniform(negNumber + 1, numSamples, -1, 1, IncrementCounter(), CPUDEVICE);
+    DoubleMatrix cos(CPUDEVICE), invNormA(CPUDEVICE), invNormB(CPUDEVICE);
+    DoubleMatrix::CosDistanceWithShiftNeg(inputs[0], inputs[1], cos, invNormA, invNormB, shift, negNumber);
+
+    // reference: row 0 pairs the same columns, row i pairs column j with column (j + shift + i - 1) % numSamples
+    for (size_t j = 0; j < numSamples; j++)
+        for (size_t i = 0; i <= negNumber; i++)
+        {
+            const size_t k = i == 0 ? j : (j + shift + i - 1) % numSamples;
+            double dot = 0, sumA = 0, sumB = 0;
+            for (size_t r = 0; r < dim; r++)
+            {
+                dot += inputs[0](r, j) * inputs[1](r, k);
+                sumA += inputs[0](r, j) * inputs[0](r, j);
+                sumB += inputs[1](r, k) * inputs[1](r, k);
+            }
+            BOOST_CHECK_CLOSE(cos(i, j), dot / sqrt(sumA * sumB), 1e-8);
+        }
+
+    // gradients against finite differences of sum_ij gradient(i, j) * cos(i, j)
+    auto objective = [&]()
+    {
+        DoubleMatrix c(CPUDEVICE), na(CPUDEVICE), nb(CPUDEVICE);
+        DoubleMatrix::CosDistanceWithShiftNeg(inputs[0], inputs[1], c, na, nb, shift, negNumber);
+        double sum = 0;
+        for (size_t j = 0; j < numSamples; j++)
+            for (size_t i = 0; i <= negNumber; i++)
+                sum += gradient(i, j) * c(i, j);
+        return sum;
+    };
+    const double epsilon = 1e-6;
+    for (size_t inputIndex = 0; inputIndex < inputs.size(); inputIndex++)
+    {
+        DoubleMatrix inputGradient(dim, numSamples, CPUDEVICE);
+        inputGradient.SetValue(0);
+        DoubleMatrix::AddCosDistanceGradientWithShiftNeg(inputIndex, inputs[0], inputs[1], cos, gradient, invNormA, invNormB, shift, negNumber, inputGradient);
+        for (size_t j = 0; j < numSamples; j++)
+            for (size_t i = 0; i < dim; i++)
+            {
+                const double value = inputs[inputIndex](i, j);
+                inputs[inputIndex](i, j) = value + epsilon;
+                const double plus = objective();
+                inputs[inputIndex](i, j) = value - epsilon;
+                const double minus = objective();
+                inputs[inputIndex](i, j) = value;
+                BOOST_CHECK_SMALL(inputGradient(i, j) - (plus - minus) / (2 * epsilon), 1e-5);
+            }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(MatrixReadbackValues, RandomSeedFixture)
+{
+    SingleMatrix a = SingleMatrix::RandomUniform(5, 3, -1, 1, IncrementCounter(), CPUDEVICE);
+    SingleMatrix original(5, 3, CPUDEVICE);
+    original.SetValue(a);
+    MatrixReadback<float> readback;
+    BOOST_CHECK(!readback.IsStarted());
+    readback.Start(a);
+    a.SetValue(0); // (does not change the values read back)
+    const float* values = readback.Wait();
+    BOOST_CHECK_EQUAL(readback.GetNumRows(), 5);
+    BOOST_CHECK_EQUAL(readback.GetNumCols(), 3);
+    for (size_t j = 0; j < 3; j++)
+        for (size_t i = 0; i < 5; i++)
+            BOOST_CHECK_EQUAL(values[IDX2C(i, j, 5)], original(i, j));
+
+    // strided into a larger buffer
+    std::vector<float> strided(7 * 3, -2);
+    readback.WaitAndCopyTo(strided.data(), 7);
+    for (size_t j = 0; j < 3; j++)
+        for (size_t i = 0; i < 7; i++)
+            BOOST_CHECK_EQUAL(strided[IDX2C(i, j, 7)], i < 5 ? original(i, j) : -2);
+    BOOST_CHECK_THROW(readback.WaitAndCopyTo(strided.data(), 4), std::invalid_argument);
+
+    // the next Start() replaces the values, also with a larger matrix
+    SingleMatrix b = SingleMatrix::RandomUniform(8, 6, -1, 1, IncrementCounter(), CPUDEVICE);
+    readback.Start(b);
+    values = readback.Wait();
+    BOOST_CHECK_EQUAL(readback.GetNumElements(), 48);
+    for (size_t j = 0; j < 6; j++)
+        for (size_t i = 0; i < 8; i++)
+            BOOST_CHECK_EQUAL(values[IDX2C(i, j, 8)], b(i, j));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 }
 } } }
@@ -0,0 +1,141 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// NetworkBenchmarks.cpp -- compile-time benchmark of CompileNetwork() (loop discovery, eval orders, validation) on large generated networks
+//
+// Usage: networkbenchmarks [-nodes N] [-minSeconds S]
+// It generates networks of roughly N nodes each, the way programmatically generated models look:
+//  - deep:      a chain of N/4 sigmoid layers (e.g. an unrolled decoder)
+//  - multitask: a shared layer with N/6 task heads, each with its own criterion (many roots)
+//  - recurrent: N/6 stacked recurrent layers (many small loops)
+// Only CompileNetwork() is timed; the network is built anew for each call.
+//
+
+#define _CRT_SECURE_NO_WARNINGS // "secure" CRT not available on all platforms  --add this at the top of all CPP files that give "function or variable may be unsafe" warnings
+
+#include "Basics.h"
+#include "ComputationNetwork.h"
+#include "ComputationNetworkBuilder.h"
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <string>
+
+using namespace Microsoft::MSR::CNTK;
+using namespace std;
+
+typedef ComputationNetworkBuilder<float> Builder;
+static const size_t dim = 4; // the dimensions do not matter for compilation; keep the parameters small
+
+// a chain of sigmoid layers
+static void BuildDeep(ComputationNetwork& net, size_t numNodes)
+{
+    Builder builder(net);
+    auto h = builder.CreateInputNode(L"features", dim);
+    net.FeatureNodes().push_back(h);
+    for (size_t i = 0; i < numNodes / 4; i++)
+    {
+        auto W = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"W%d", (int) i), dim, dim);
+        h = builder.Sigmoid(builder.Times(W, h)); // (nodes without names get unique ones)
+    }
+    auto labels = builder.CreateInputNode(L"labels", dim);
+    net.LabelNodes().push_back(labels);
+    net.FinalCriterionNodes().push_back(builder.SquareError(labels, h, L"criterion"));
+}
+
+// a shared layer and many heads with a criterion each
+static void BuildMultiTask(ComputationNetwork& net, size_t numNodes)
+{
+    Builder builder(net);
+    auto x = builder.CreateInputNode(L"features", dim);
+    net.FeatureNodes().push_back(x);
+    auto labels = builder.CreateInputNode(L"labels", dim);
+    net.LabelNodes().push_back(labels);
+    auto shared = builder.Tanh(builder.Times(builder.CreateLearnableParameter(L"W", dim, dim), x));
+    for (size_t i = 0; i < numNodes / 6; i++)
+    {
+        auto W = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"W%d", (int) i), dim, dim);
+        auto b = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"b%d", (int) i), dim, 1);
+        auto head = builder.Plus(builder.Times(W, shared), b);
+        auto criterion = builder.SquareError(labels, head, msra::strfun::wstrprintf(L"criterion%d", (int) i));
+        if (i == 0)
+            net.FinalCriterionNodes().push_back(criterion);
+        else
+            net.EvaluationNodes().push_back(criterion);
+    }
+}
+
+// stacked recurrent layers h(t) = tanh(U x(t) + W h(t-1)), each its own loop
+static void BuildRecurrent(ComputationNetwork& net, size_t numNodes)
+{
+    Builder builder(net);
+    auto h = builder.CreateInputNode(L"features", dim);
+    net.FeatureNodes().push_back(h);
+    for (size_t i = 0; i < numNodes / 6; i++)
+    {
+        auto U = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"U%d", (int) i), dim, dim);
+        auto W = builder.CreateLearnableParameter(msra::strfun::wstrprintf(L"W%d", (int) i), dim, dim);
+        auto pastValue = builder.PastValue(NULL, 0.1f, dim, 1);
+        auto output = builder.Tanh(builder.Plus(builder.Times(U, h), builder.Times(W, pastValue)));
+        pastValue->AttachInputs(output);
+        h = output;
+    }
+    auto labels = builder.CreateInputNode(L"labels", dim);
+    net.LabelNodes().push_back(labels);
+    net.FinalCriterionNodes().push_back(builder.SquareError(labels, h, L"criterion"));
+}
+
+// time CompileNetwork() on networks made by 'build', repeating it until 'minSeconds' have passed
+static void Run(const string& name, size_t numNodes, double minSeconds, const function<void(ComputationNetwork&, size_t)>& build)
+{
+    size_t numIterations = 0;
+    size_t numNodesBuilt = 0;
+    double seconds = 0;
+    while (seconds < minSeconds || numIterations == 0)
+    {
+        auto net = make_shared<ComputationNetwork>(CPUDEVICE);
+        build(*net, numNodes);
+        numNodesBuilt = net->GetTotalNumberOfNodes();
+        auto start = chrono::steady_clock::now();
+        net->CompileNetwork();
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        numIterations++;
+    }
+    fprintf(stdout, "%-20s %10d %12.3f\n", name.c_str(), (int) numNodesBuilt, 1e3 * seconds / numIterations);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        size_t numNodes = 50000;
+        double minSeconds = 1;
+        for (int i = 1; i < argc; i++)
+        {
+            const string arg = argv[i];
+            if (i + 1 >= argc)
+                InvalidArgument("Missing value for %s.", arg.c_str());
+            const char* value = argv[++i];
+            if (arg == "-nodes")
+                numNodes = (size_t) atoi(value);
+            else if (arg == "-minSeconds")
+                minSeconds = atof(value);
+            else
+                InvalidArgument("Unknown option %s.", arg.c_str());
+        }
+
+        // (CompileNetwork() logs every node to stderr; the results go to stdout)
+        fprintf(stdout, "%-20s %10s %12s\n", "benchmark", "nodes", "ms/compile");
+        Run("deep", numNodes, minSeconds, BuildDeep);
+        Run("multitask", numNodes, minSeconds, BuildMultiTask);
+        Run("recurrent", numNodes, minSeconds, BuildRecurrent);
+        return 0;
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "EXCEPTION occurred: %s\n", e.what());
+        return 2;
+    }
+}
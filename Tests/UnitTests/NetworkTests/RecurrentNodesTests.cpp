@@ -0,0 +1,127 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// RecurrentNodesTests.cpp -- tests of the state that PastValue carries over across minibatches
+//
+#include "stdafx.h"
+#include "Basics.h"
+#include "ComputationNetwork.h"
+#include "ComputationNetworkBuilder.h"
+#include "RecurrentNodes.h"
+#include <vector>
+
+using namespace Microsoft::MSR::CNTK;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+// Two parallel sequences of 6 frames each, fed in minibatches of 3 time steps, as in truncated BPTT.
+// Frame t of sequence s has the value 10 * (s + 1) + t, so every frame that PastValue outputs tells where it came from.
+static const size_t c_numTimeSteps = 3;
+static const size_t c_sequenceLength = 2 * c_numTimeSteps;
+static const float c_initialActivation = 0.5f;
+
+struct PastValueNetwork
+{
+    ComputationNetworkPtr net;
+    shared_ptr<ComputationNode<float>> features;
+    shared_ptr<ComputationNode<float>> pastValue;
+
+    PastValueNetwork()
+        : net(make_shared<ComputationNetwork>(CPUDEVICE))
+    {
+        ComputationNetworkBuilder<float> builder(*net);
+        features = builder.CreateInputNode(L"features", 1);
+        net->FeatureNodes().push_back(features);
+        pastValue = builder.PastValue(features, c_initialActivation, 1, 1, L"pastValue");
+        net->OutputNodes().push_back(pastValue);
+        net->CompileNetwork();
+        net->AllocateAllMatrices({}, {pastValue}, nullptr);
+        net->StartEvaluateMinibatchLoop(ComputationNodeBasePtr(pastValue));
+    }
+
+    // feed minibatch 'mb' of the given sequences (as parallel sequences in this order) and check what PastValue outputs
+    void ForwardAndCheck(size_t mb, const std::vector<size_t>& sequences)
+    {
+        const size_t numParallelSequences = sequences.size();
+        const ptrdiff_t tBegin = -(ptrdiff_t)(mb * c_numTimeSteps);
+        auto pMBLayout = net->GetMBLayoutPtr();
+        pMBLayout->Init(numParallelSequences, c_numTimeSteps);
+        std::vector<float> values(numParallelSequences * c_numTimeSteps);
+        for (size_t i = 0; i < numParallelSequences; i++)
+        {
+            pMBLayout->AddSequence(sequences[i], i, tBegin, (size_t)(tBegin + c_sequenceLength));
+            for (size_t t = 0; t < c_numTimeSteps; t++)
+                values[t * numParallelSequences + i] = Value(sequences[i], mb * c_numTimeSteps + t);
+        }
+        features->Value().SetValue(1, values.size(), CPUDEVICE, values.data());
+        features->NotifyFunctionValuesMBSizeModified();
+        net->DetermineActualMBSizeFromFeatures();
+        ComputationNetwork::BumpEvalTimeStamp(net->FeatureNodes());
+        net->ForwardProp(ComputationNodeBasePtr(pastValue));
+
+        const Matrix<float>& output = pastValue->Value();
+        BOOST_REQUIRE_EQUAL(output.GetNumCols(), values.size());
+        for (size_t i = 0; i < numParallelSequences; i++)
+            for (size_t t = 0; t < c_numTimeSteps; t++)
+            {
+                const size_t frame = mb * c_numTimeSteps + t;
+                const float expected = frame == 0 ? c_initialActivation : Value(sequences[i], frame - 1);
+                BOOST_CHECK_EQUAL(output(0, t * numParallelSequences + i), expected);
+            }
+    }
+
+    IStatefulNode& State()
+    {
+        return *dynamic_pointer_cast<IStatefulNode>(pastValue);
+    }
+
+    static float Value(size_t sequence, size_t frame)
+    {
+        return (float) (10 * (sequence + 1) + frame);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(RecurrentNodesSuite)
+
+BOOST_AUTO_TEST_CASE(PastValueCarriesOverAcrossMinibatches)
+{
+    PastValueNetwork network;
+    for (size_t mb = 0; mb * c_numTimeSteps < c_sequenceLength; mb++)
+        network.ForwardAndCheck(mb, {0, 1});
+}
+
+BOOST_AUTO_TEST_CASE(PastValueStateRoundTripAcrossNetworks)
+{
+    PastValueNetwork network;
+    network.ForwardAndCheck(0, {0, 1});
+    NodeStatePtr state = network.State().ExportState();
+    BOOST_REQUIRE(state);
+
+    PastValueNetwork other;
+    other.State().ImportState(state);
+    other.ForwardAndCheck(1, {0, 1});
+}
+
+// what SubminibatchDispatcher does: each sub-minibatch has its own layout and state, which is exported after
+// its forward pass and imported again before the same sub-minibatch of the next minibatch
+BOOST_AUTO_TEST_CASE(PastValueStateRoundTripAcrossSubminibatches)
+{
+    PastValueNetwork network;
+    std::vector<NodeStatePtr> states(2);
+    for (size_t mb = 0; mb * c_numTimeSteps < c_sequenceLength; mb++)
+    {
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            if (states[i])
+                network.State().ImportState(states[i]);
+            network.ForwardAndCheck(mb, {i});
+            states[i] = network.State().ExportState();
+            BOOST_REQUIRE(states[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }
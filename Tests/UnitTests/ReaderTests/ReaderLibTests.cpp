@@ -0,0 +1,347 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE.md file in the project root for full license information.
+//
+// ReaderLibTests.cpp -- tests of the stages of the composable reader pipeline (BlockRandomizer, PipelineReader) on in-memory data
+//
+#include "stdafx.h"
+#include "DataDeserializer.h"
+#include "BlockRandomizer.h"
+#include "PipelineReader.h"
+#include "Config.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace Microsoft::MSR::CNTK;
+
+namespace Microsoft { namespace MSR { namespace CNTK { namespace Test {
+
+// -----------------------------------------------------------------------
+// InMemoryDeserializer -- numChunks chunks of 2 to 4 sequences of 1 to maxLength samples each, and a record of the chunks paged in
+// Stream 0 ('features', dense, dim 1): sample t of sequence id is FeatureValue(id, t).
+// Stream 1 ('labels', category, dim c_numClasses): sample t of sequence id is of class Label(id, t).
+// -----------------------------------------------------------------------
+
+static const size_t c_numClasses = 4;
+
+class InMemoryDeserializer : public IDataDeserializer
+{
+public:
+    InMemoryDeserializer(size_t numChunks, size_t maxLength)
+    {
+        size_t id = 0;
+        for (size_t c = 0; c < numChunks; c++)
+        {
+            ChunkDescription chunk{c, 0, 2 + c % 3};
+            for (size_t i = 0; i < chunk.numberOfSequences; i++)
+            {
+                const size_t length = 1 + (id * 7) % maxLength;
+                m_sequences.push_back(SequenceDescription{id++, length, c});
+                chunk.numberOfSamples += length;
+            }
+            m_chunks.push_back(chunk);
+        }
+    }
+
+    static float FeatureValue(size_t id, size_t t)
+    {
+        return (float) (1000 * id + t);
+    }
+    static size_t Label(size_t id, size_t t)
+    {
+        return (id + t) % c_numClasses;
+    }
+
+    const std::vector<SequenceDescription>& AllSequences() const
+    {
+        return m_sequences;
+    }
+    std::set<size_t> PagedChunks() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pagedChunks;
+    }
+
+    virtual std::vector<StreamDescription> GetStreamDescriptions() const override
+    {
+        return std::vector<StreamDescription>{{L"features", 0, StorageType::dense, 1}, {L"labels", 1, StorageType::category, c_numClasses}};
+    }
+    virtual std::vector<ChunkDescription> GetChunkDescriptions() const override
+    {
+        return m_chunks;
+    }
+    virtual void GetSequencesForChunk(size_t chunkId, std::vector<SequenceDescription>& sequences) const override
+    {
+        for (const auto& sequence : m_sequences)
+            if (sequence.chunkId == chunkId)
+                sequences.push_back(sequence);
+    }
+    virtual ChunkPtr GetChunk(size_t chunkId) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pagedChunks.insert(chunkId);
+        return std::make_shared<InMemoryChunk>(this);
+    }
+
+private:
+    class InMemoryChunk : public Chunk
+    {
+    public:
+        InMemoryChunk(const InMemoryDeserializer* deserializer)
+            : m_deserializer(deserializer)
+        {
+        }
+        virtual void CopyDenseSequence(size_t sequenceId, size_t streamId, float* values, size_t colStride) const override
+        {
+            if (streamId != 0)
+                LogicError("InMemoryChunk: stream %d is not dense.", (int) streamId);
+            for (size_t t = 0; t < m_deserializer->m_sequences[sequenceId].numberOfSamples; t++)
+                values[t * colStride] = FeatureValue(sequenceId, t);
+        }
+        virtual void CopyCategorySequence(size_t sequenceId, size_t streamId, size_t* categories) const override
+        {
+            if (streamId != 1)
+                LogicError("InMemoryChunk: stream %d is not a category stream.", (int) streamId);
+            for (size_t t = 0; t < m_deserializer->m_sequences[sequenceId].numberOfSamples; t++)
+                categories[t] = Label(sequenceId, t);
+        }
+
+    private:
+        const InMemoryDeserializer* m_deserializer;
+    };
+
+    std::vector<ChunkDescription> m_chunks;
+    std::vector<SequenceDescription> m_sequences; // [id]
+    mutable std::mutex m_mutex;
+    std::set<size_t> m_pagedChunks;
+};
+
+static const size_t c_numChunks = 12;
+static const size_t c_maxLength = 5;
+static const size_t c_randomizationRange = 40;
+
+// the ids of the sequences of one epoch of one worker, as the minibatches of numSamples samples that the randomizer hands out
+static std::vector<std::vector<size_t>> ReadEpoch(BlockRandomizer& randomizer, size_t epoch, size_t workerRank, size_t numWorkers, size_t numSamples = 10)
+{
+    std::vector<std::vector<size_t>> minibatches;
+    randomizer.StartEpoch(epoch, randomizer.GetNumberOfSamples(), workerRank, numWorkers);
+    std::vector<RandomizedSequence> sequences;
+    while (randomizer.GetNextSequences(numSamples, sequences))
+    {
+        minibatches.push_back(std::vector<size_t>());
+        for (const auto& sequence : sequences)
+        {
+            BOOST_REQUIRE(sequence.chunk);
+            minibatches.back().push_back(sequence.description.id);
+        }
+    }
+    return minibatches;
+}
+
+static std::vector<size_t> Flatten(const std::vector<std::vector<size_t>>& minibatches)
+{
+    std::vector<size_t> ids;
+    for (const auto& minibatch : minibatches)
+        ids.insert(ids.end(), minibatch.begin(), minibatch.end());
+    return ids;
+}
+
+static std::vector<size_t> AllIds(const InMemoryDeserializer& deserializer)
+{
+    std::vector<size_t> ids;
+    for (const auto& sequence : deserializer.AllSequences())
+        ids.push_back(sequence.id);
+    return ids;
+}
+
+BOOST_AUTO_TEST_SUITE(BlockRandomizerSuite)
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerSweepIsDeterministicPermutation)
+{
+    auto deserializer = std::make_shared<InMemoryDeserializer>(c_numChunks, c_maxLength);
+    BlockRandomizer randomizer(deserializer, c_randomizationRange, 2, 0, false, 0);
+    BlockRandomizer other(std::make_shared<InMemoryDeserializer>(c_numChunks, c_maxLength), c_randomizationRange, 2, 0, false, 0);
+
+    // each epoch of a sweep's size is one sweep: every sequence once, in an order that depends only on the epoch
+    const auto epoch0 = Flatten(ReadEpoch(randomizer, 0, 0, 1));
+    const auto epoch1 = Flatten(ReadEpoch(randomizer, 1, 0, 1));
+    auto sorted = epoch0;
+    std::sort(sorted.begin(), sorted.end());
+    BOOST_CHECK(sorted == AllIds(*deserializer));
+    sorted = epoch1;
+    std::sort(sorted.begin(), sorted.end());
+    BOOST_CHECK(sorted == AllIds(*deserializer));
+    BOOST_CHECK(epoch0 != AllIds(*deserializer));
+    BOOST_CHECK(epoch0 != epoch1);
+
+    // also when restarted at epoch 1, or when epoch 0 is read again
+    BOOST_CHECK(Flatten(ReadEpoch(other, 1, 0, 1)) == epoch1);
+    BOOST_CHECK(Flatten(ReadEpoch(other, 0, 0, 1)) == epoch0);
+    BOOST_CHECK(Flatten(ReadEpoch(randomizer, 0, 0, 1)) == epoch0);
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerWithoutRandomizationKeepsOriginalOrder)
+{
+    auto deserializer = std::make_shared<InMemoryDeserializer>(c_numChunks, c_maxLength);
+    BlockRandomizer randomizer(deserializer, 0, 2, 0, false, 0);
+    BOOST_CHECK(Flatten(ReadEpoch(randomizer, 0, 0, 1)) == AllIds(*deserializer));
+    BOOST_CHECK(Flatten(ReadEpoch(randomizer, 1, 0, 1)) == AllIds(*deserializer));
+}
+
+// each worker gets the sequences of its own chunks, and only pages in those; together the workers read each sequence once
+static void CheckWorkersAreDisjoint(bool shardChunks)
+{
+    const size_t numWorkers = 3;
+    InMemoryDeserializer reference(c_numChunks, c_maxLength);
+    std::vector<size_t> allIds;
+    std::set<size_t> allChunks;
+    std::set<size_t> numMinibatches;
+    for (size_t rank = 0; rank < numWorkers; rank++)
+    {
+        auto deserializer = std::make_shared<InMemoryDeserializer>(c_numChunks, c_maxLength);
+        BlockRandomizer randomizer(deserializer, c_randomizationRange, 2, 0, shardChunks, 0);
+        const auto minibatches = ReadEpoch(randomizer, 0, rank, numWorkers);
+        numMinibatches.insert(minibatches.size());
+        const auto ids = Flatten(minibatches);
+        BOOST_CHECK(!ids.empty());
+
+        std::set<size_t> chunks;
+        for (size_t id : ids)
+            chunks.insert(reference.AllSequences()[id].chunkId);
+        BOOST_CHECK(deserializer->PagedChunks() == chunks);
+        for (size_t chunk : chunks)
+            BOOST_CHECK_MESSAGE(allChunks.insert(chunk).second, "chunk " << chunk << " is read by more than one worker");
+        allIds.insert(allIds.end(), ids.begin(), ids.end());
+    }
+    std::sort(allIds.begin(), allIds.end());
+    BOOST_CHECK(allIds == AllIds(reference));
+    if (!shardChunks) // (all workers step through the same positions; with shardChunks they may end a few minibatches apart)
+        BOOST_CHECK_EQUAL(numMinibatches.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerWorkersReadDisjointChunks)
+{
+    CheckWorkersAreDisjoint(false);
+}
+
+BOOST_AUTO_TEST_CASE(BlockRandomizerShardedWorkersReadDisjointChunks)
+{
+    CheckWorkersAreDisjoint(true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+// -----------------------------------------------------------------------
+// PipelineReader on an InMemoryDeserializer
+// -----------------------------------------------------------------------
+
+class InMemoryPipelineReader : public PipelineReader<float>
+{
+public:
+    InMemoryPipelineReader(IDataDeserializerPtr deserializer)
+        : m_deserializer(deserializer)
+    {
+    }
+
+protected:
+    virtual IDataDeserializerPtr CreateDeserializer(const ConfigParameters&) override
+    {
+        return m_deserializer;
+    }
+    virtual IDataDeserializerPtr CreateDeserializer(const ScriptableObjects::IConfigRecord&) override
+    {
+        return m_deserializer;
+    }
+
+private:
+    IDataDeserializerPtr m_deserializer;
+};
+
+// read an epoch, check that each minibatch's layout tiles its columns with its sequences and gaps, and that each sequence's samples
+// are in the columns the layout says; checks that the epoch has each sequence once
+static void ReadAndCheckEpoch(size_t maxLength, size_t mbSize)
+{
+    auto deserializer = std::make_shared<InMemoryDeserializer>(c_numChunks, maxLength);
+    InMemoryPipelineReader reader(deserializer);
+    ConfigParameters config;
+    config.Parse("randomize=40\nnumPrefetchChunks=1");
+    reader.Init(config);
+
+    Matrix<float> features(CPUDEVICE), labels(CPUDEVICE);
+    std::map<std::wstring, Matrix<float>*> matrices{{L"features", &features}, {L"labels", &labels}};
+    auto pMBLayout = make_shared<MBLayout>();
+    std::vector<size_t> ids;
+    bool anyShared = false;
+    reader.StartMinibatchLoop(mbSize, 0);
+    while (reader.GetMinibatch(matrices))
+    {
+        reader.CopyMBLayoutTo(pMBLayout);
+        const size_t numSlots = pMBLayout->GetNumParallelSequences();
+        const size_t numTimeSteps = pMBLayout->GetNumTimeSteps();
+        BOOST_REQUIRE_EQUAL(features.GetNumRows(), 1);
+        BOOST_REQUIRE_EQUAL(features.GetNumCols(), pMBLayout->GetNumCols());
+        BOOST_REQUIRE_EQUAL(labels.GetNumRows(), c_numClasses);
+        BOOST_REQUIRE_EQUAL(labels.GetNumCols(), pMBLayout->GetNumCols());
+
+        std::vector<int> covered(pMBLayout->GetNumCols(), 0);
+        size_t longest = 0, numSequences = 0;
+        for (const auto& sequence : pMBLayout->GetAllSequences())
+        {
+            BOOST_REQUIRE(sequence.tBegin >= 0 && sequence.tEnd <= numTimeSteps && sequence.s < numSlots);
+            for (size_t t = (size_t) sequence.tBegin; t < sequence.tEnd; t++)
+                covered[t * numSlots + sequence.s]++;
+            if (sequence.seqId == GAP_SEQUENCE_ID)
+                continue;
+
+            // the whole sequence is in this minibatch, in the columns of its parallel sequence
+            // (In frame mode, the layout numbers the frames by parallel sequence; their features tell which sequence they are.)
+            const size_t id = (size_t) features(0, sequence.tBegin * numSlots + sequence.s) / 1000;
+            BOOST_REQUIRE(id < deserializer->AllSequences().size());
+            if (numTimeSteps > 1)
+                BOOST_CHECK_EQUAL(sequence.seqId, id);
+            BOOST_CHECK_EQUAL(sequence.GetNumTimeSteps(), deserializer->AllSequences()[id].numberOfSamples);
+            for (size_t t = 0; t < sequence.GetNumTimeSteps(); t++)
+            {
+                const size_t col = (sequence.tBegin + t) * numSlots + sequence.s;
+                BOOST_CHECK_EQUAL(features(0, col), InMemoryDeserializer::FeatureValue(id, t));
+                for (size_t c = 0; c < c_numClasses; c++)
+                    BOOST_CHECK_EQUAL(labels(c, col), c == InMemoryDeserializer::Label(id, t) ? 1.0f : 0.0f);
+            }
+            longest = max(longest, sequence.GetNumTimeSteps());
+            numSequences++;
+            ids.push_back(id);
+        }
+        BOOST_CHECK(std::all_of(covered.begin(), covered.end(), [](int n) { return n == 1; }));
+        BOOST_CHECK_EQUAL(numTimeSteps, longest);
+        if (maxLength == 1)
+            BOOST_CHECK_EQUAL(numSlots, numSequences); // (frame mode: one frame per parallel sequence)
+        else
+            BOOST_CHECK_LE(numSlots, numSequences);
+        anyShared |= numSlots < numSequences;
+    }
+    BOOST_CHECK(reader.DataEnd(endDataEpoch));
+    if (maxLength > 1) // (short sequences share parallel sequences)
+        BOOST_CHECK(anyShared);
+
+    std::sort(ids.begin(), ids.end());
+    BOOST_CHECK(ids == AllIds(*deserializer));
+}
+
+BOOST_AUTO_TEST_SUITE(PipelineReaderSuite)
+
+BOOST_AUTO_TEST_CASE(PipelineReaderPacksSequences)
+{
+    ReadAndCheckEpoch(c_maxLength, 16);
+}
+
+BOOST_AUTO_TEST_CASE(PipelineReaderPacksFrames)
+{
+    ReadAndCheckEpoch(1, 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+}
+} } }